@@ -102,16 +102,8 @@ static int set_density(void *self, const PropertyValue &value)
 
 static int FillWithConstant(Volume *volume, float density)
 {
-  int xres, yres, zres;
-  volume->GetResolution(&xres, &yres, &zres);
-
-  for (int k = 0; k < zres; k++) {
-    for (int j = 0; j < yres; j++) {
-      for (int i = 0; i < xres; i++) {
-        volume->SetValue(i, j, k, density);
-      }
-    }
-  }
+  // no voxel memory for a constant
+  volume->Fill(density);
 
   return 0;
 }
@@ -35,6 +35,29 @@ static int set_is_hair(void *self, const PropertyValue &value);
 static int generate_curve(const Mesh &mesh, Curve &curve);
 static int generate_hair(const Mesh &mesh, Curve &curve);
 
+class CurveColors {
+public:
+  CurveColors() : curve(NULL), sourceP(NULL) {}
+  ~CurveColors() {}
+
+  Curve *curve;
+  const Vector *sourceP;
+};
+
+class HairStrands {
+public:
+  HairStrands() : curve(NULL), sourceP(NULL), sourceN(NULL), curves_per_hair(0) {}
+  ~HairStrands() {}
+
+  Curve *curve;
+  const Vector *sourceP;
+  const Vector *sourceN;
+  int curves_per_hair;
+};
+
+static void curve_colors_range(void *data, int begin, int end);
+static void grow_strands_range(void *data, int begin, int end);
+
 static const Property MyPropertyList[] = {
   Property("mesh",    PropMesh(NULL),  set_mesh),
   Property("curve",   PropCurve(NULL), set_curve),
@@ -152,10 +175,12 @@ static int generate_curve(const Mesh &mesh, Curve &curve)
   std::cout << "total curve count: " << total_ncurves << "\n";
 
   const int total_ncps = 4 * total_ncurves;
-  std::vector<Vector> P(total_ncps);
-  std::vector<double> width(total_ncps);
-  std::vector<Color>  Cd(total_ncps);
-  std::vector<int>    indices(total_ncurves);
+  curve.SetVertexCount(total_ncps);
+  curve.SetCurveCount(total_ncurves);
+  curve.AddVertexPosition();
+  curve.AddVertexWidth();
+  curve.AddVertexColor();
+  curve.AddCurveIndices();
 
   std::vector<Vector> sourceP(total_ncurves);
   std::vector<Vector> sourceN(total_ncurves);
@@ -194,10 +219,11 @@ static int generate_curve(const Mesh &mesh, Curve &curve)
   }
   assert(curve_id == total_ncurves);
 
-  int cp_id = 0;
-  curve_id = 0;
   std::cout << "Generating curves ...\n";
 
+  // rand() is not thread safe. positions are drawn here and colors
+  // are computed in parallel
+  int cp_id = 0;
   for (int i = 0; i < total_ncurves; i++) {
     for (int vtx = 0; vtx < 4; vtx++) {
       // noise
@@ -210,75 +236,61 @@ static int generate_curve(const Mesh &mesh, Curve &curve)
       }
 
       // P
-      Vector &src_P = sourceP[curve_id];
-      Vector &src_N = sourceN[curve_id];
+      const Vector &src_P = sourceP[i];
+      const Vector &src_N = sourceN[i];
 
       const double LENGTH = .02;
       const double noiseamp = .75 * LENGTH;
       const Vector dst_P = src_P + noiseamp * noisevec + vtx * LENGTH/3. * src_N;
-      P[cp_id] = dst_P;
-
-      // width
-      if (vtx == 0) {
-        double *w = &width[cp_id];
-        w[0] = .003;
-        w[1] = .002;
-        w[2] = .001;
-        w[3] = .0001;
-      }
-
-      // Cd
-      double amp = 1;
-      const Color C_dark(.8, .5, .3);
-      const Color C_light(.9, .88, .85);
-      const Vector freq(3, 3, 3);
-      const Vector offset(0, 1, 0);
-
-      const Vector src_Q = src_P * freq + offset;
-      double C_noise = amp * PerlinNoise(src_Q, 2, .5, 2);
-      C_noise = SmoothStep(.55, .75, C_noise);
-      const Color dst_Cd = Lerp(C_dark, C_light, C_noise);
-      Cd[cp_id] = dst_Cd;
+      curve.SetVertexPosition(cp_id, dst_P);
 
-      // cp_id
       cp_id++;
     }
 
-    indices[curve_id] = 4*i;
-    curve_id++;
+    // width
+    curve.SetVertexWidth(4*i + 0, .003);
+    curve.SetVertexWidth(4*i + 1, .002);
+    curve.SetVertexWidth(4*i + 2, .001);
+    curve.SetVertexWidth(4*i + 3, .0001);
+
+    curve.SetCurveIndices(i, 4*i);
   }
   assert(cp_id == total_ncps);
 
-  // count
-  curve.SetVertexCount(total_ncps);
-  curve.SetCurveCount(total_ncurves);
-
-  // P
-  curve.AddVertexPosition();
-  for (int i = 0; i < total_ncps; i++) {
-    curve.SetVertexPosition(i, P[i]);
-  }
-  // width
-  curve.AddVertexWidth();
-  for (int i = 0; i < total_ncps; i++) {
-    curve.SetVertexWidth(i, width[i]);
-  }
-  // Cd
-  curve.AddVertexColor();
-  for (int i = 0; i < total_ncps; i++) {
-    curve.SetVertexColor(i, Cd[i]);
-  }
-  // indices
-  curve.AddCurveIndices();
-  for (int i = 0; i < total_ncurves; i++) {
-    curve.SetCurveIndices(i, indices[i]);
-  }
+  CurveColors colors;
+  colors.curve = &curve;
+  colors.sourceP = &sourceP[0];
+  Procedure::ParallelFor(&colors, curve_colors_range, total_ncurves);
 
   curve.ComputeBounds();
 
   return 0;
 }
 
+static void curve_colors_range(void *data, int begin, int end)
+{
+  const CurveColors *colors = (const CurveColors *) data;
+
+  for (int i = begin; i < end; i++) {
+    // Cd
+    double amp = 1;
+    const Color C_dark(.8, .5, .3);
+    const Color C_light(.9, .88, .85);
+    const Vector freq(3, 3, 3);
+    const Vector offset(0, 1, 0);
+
+    const Vector src_Q = colors->sourceP[i] * freq + offset;
+    double C_noise = amp * PerlinNoise(src_Q, 2, .5, 2);
+    C_noise = SmoothStep(.55, .75, C_noise);
+    const Color dst_Cd = Lerp(C_dark, C_light, C_noise);
+
+    // the same for all control points of the curve
+    for (int vtx = 0; vtx < 4; vtx++) {
+      colors->curve->SetVertexColor(4*i + vtx, dst_Cd);
+    }
+  }
+}
+
 static int generate_hair(const Mesh &mesh, Curve &curve)
 {
   curve.Clear();
@@ -318,18 +330,24 @@ static int generate_hair(const Mesh &mesh, Curve &curve)
   std::cout << "total curve count: " << total_ncurves << "\n";
 
   const int total_ncps = 4 * total_ncurves;
-  std::vector<Vector> P(total_ncps);
-  std::vector<double> width(total_ncps);
-  std::vector<Color>  Cd(total_ncps);
-  std::vector<Vector> velocity(total_ncps);
-  std::vector<int>    indices(total_ncurves);
+  const int total_nstrands = total_ncurves / N_CURVES_PER_HAIR;
+  curve.SetVertexCount(total_ncps);
+  curve.SetCurveCount(total_ncurves);
+  curve.AddVertexPosition();
+  curve.AddVertexWidth();
+  curve.AddVertexColor();
+  curve.AddVertexVelocity();
+  curve.AddCurveIndices();
+
+  std::vector<Vector> sourceP(total_nstrands);
+  std::vector<Vector> sourceN(total_nstrands);
 
   std::cout << "Computing curve's positions ...\n";
 
+  // draws of the rng are sequential. roots are placed here and strands
+  // are grown from them in parallel
   XorShift rng;
   int strand_id = 0;
-  int curve_id = 0;
-  int cp_id = 0;
 
   for (int i = 0; i < FACE_COUNT; i++) {
     Vector P0, P1, P2;
@@ -355,98 +373,87 @@ static int generate_hair(const Mesh &mesh, Curve &curve)
       }
       src_N = Normalize(src_N);
 
-      Vector next_P = src_P;
-      Vector next_N = src_N;
-
-      for (int k = 0; k < N_CURVES_PER_HAIR; k++) {
-        // the first cp_id of curve
-        indices[curve_id] = cp_id;
-
-        for (int vtx = 0; vtx < 4; vtx++) {
-          const double w[4] = {1, .5, .2, .05};
-          P[cp_id] = next_P;
-          Cd[cp_id] = Color(.9, .8, .5);
-
-          if (k == N_CURVES_PER_HAIR - 1) {
-            width[cp_id] = .0005 * w[vtx];
-          }
-          else {
-            width[cp_id] = .0005;
-          }
-
-          // update the 'next' next_P if not the last control point
-          if (vtx != 3) {
-            const Vector curr_P = P[cp_id];
-            const double amp = .002 * .1;
-            const double freq = 100;
-            const double segment_len = .01;
-
-            const Vector Q = curr_P * Vector(freq, 2, freq);
-            const Vector noise_vec = PerlinNoise3d(Q, 2, .5, 2);
-
-            next_P += segment_len * next_N + Vector(amp, 0, amp) * noise_vec;
-            next_N = next_P - curr_P;
-            next_N = Normalize(next_N);
-
-            next_N.y += -.5;
-            next_N = Normalize(next_N);
-          }
-          // compute velocity
-          {
-            const Vector curr_P = P[cp_id];
-            const double amp = .01;
-            const double freq = 1;
-
-            const Vector Q = freq * curr_P + Vector(0, 5, 0);
-            const Vector noise_vec = PerlinNoise3d(Q, 2, .5, 2);
-
-            const double vmult = SmoothStep(1, N_CURVES_PER_HAIR, k);
-            const Vector curr_v = vmult * amp * noise_vec;
-
-            velocity[cp_id] = curr_v;
-          }
-
-          cp_id++;
-        }
-        curve_id++;
-      }
-
+      sourceP[strand_id] = src_P;
+      sourceN[strand_id] = src_N;
       strand_id++;
     }
   }
-  assert(strand_id == total_ncurves / N_CURVES_PER_HAIR);
+  assert(strand_id == total_nstrands);
 
-  // count
-  curve.SetVertexCount(total_ncps);
-  curve.SetCurveCount(total_ncurves);
-
-  // P
-  curve.AddVertexPosition();
-  for (int i = 0; i < total_ncps; i++) {
-    curve.SetVertexPosition(i, P[i]);
-  }
-  // width
-  curve.AddVertexWidth();
-  for (int i = 0; i < total_ncps; i++) {
-    curve.SetVertexWidth(i, width[i]);
-  }
-  // Cd
-  curve.AddVertexColor();
-  for (int i = 0; i < total_ncps; i++) {
-    curve.SetVertexColor(i, Cd[i]);
-  }
-  // velocity
-  curve.AddVertexVelocity();
-  for (int i = 0; i < total_ncps; i++) {
-    curve.SetVertexVelocity(i, velocity[i]);
-  }
-  // indices
-  curve.AddCurveIndices();
-  for (int i = 0; i < total_ncurves; i++) {
-    curve.SetCurveIndices(i, indices[i]);
-  }
+  HairStrands strands;
+  strands.curve = &curve;
+  strands.sourceP = &sourceP[0];
+  strands.sourceN = &sourceN[0];
+  strands.curves_per_hair = N_CURVES_PER_HAIR;
+  Procedure::ParallelFor(&strands, grow_strands_range, total_nstrands);
 
   curve.ComputeBounds();
 
   return 0;
 }
+
+static void grow_strands_range(void *data, int begin, int end)
+{
+  const HairStrands *strands = (const HairStrands *) data;
+  Curve &curve = *strands->curve;
+  const int N_CURVES_PER_HAIR = strands->curves_per_hair;
+
+  for (int i = begin; i < end; i++) {
+    Vector next_P = strands->sourceP[i];
+    Vector next_N = strands->sourceN[i];
+    int curve_id = i * N_CURVES_PER_HAIR;
+    int cp_id = 4 * curve_id;
+
+    for (int k = 0; k < N_CURVES_PER_HAIR; k++) {
+      // the first cp_id of curve
+      curve.SetCurveIndices(curve_id, cp_id);
+
+      for (int vtx = 0; vtx < 4; vtx++) {
+        const double w[4] = {1, .5, .2, .05};
+        const Vector curr_P = next_P;
+        curve.SetVertexPosition(cp_id, curr_P);
+        curve.SetVertexColor(cp_id, Color(.9, .8, .5));
+
+        if (k == N_CURVES_PER_HAIR - 1) {
+          curve.SetVertexWidth(cp_id, .0005 * w[vtx]);
+        }
+        else {
+          curve.SetVertexWidth(cp_id, .0005);
+        }
+
+        // update the 'next' next_P if not the last control point
+        if (vtx != 3) {
+          const double amp = .002 * .1;
+          const double freq = 100;
+          const double segment_len = .01;
+
+          const Vector Q = curr_P * Vector(freq, 2, freq);
+          const Vector noise_vec = PerlinNoise3d(Q, 2, .5, 2);
+
+          next_P += segment_len * next_N + Vector(amp, 0, amp) * noise_vec;
+          next_N = next_P - curr_P;
+          next_N = Normalize(next_N);
+
+          next_N.y += -.5;
+          next_N = Normalize(next_N);
+        }
+        // compute velocity
+        {
+          const double amp = .01;
+          const double freq = 1;
+
+          const Vector Q = freq * curr_P + Vector(0, 5, 0);
+          const Vector noise_vec = PerlinNoise3d(Q, 2, .5, 2);
+
+          const double vmult = SmoothStep(1, N_CURVES_PER_HAIR, k);
+          const Vector curr_v = vmult * amp * noise_vec;
+
+          curve.SetVertexVelocity(cp_id, curr_v);
+        }
+
+        cp_id++;
+      }
+      curve_id++;
+    }
+  }
+}
@@ -34,6 +34,18 @@ static int set_add_velocity(void *self, const PropertyValue &value);
 static int generate_pointcloud(const Mesh &mesh, PointCloud &pointcloud, bool add_velocity);
 static void noise_position(Vector &P, const Vector &N, Vector &velocity);
 
+class NoisePoints {
+public:
+  NoisePoints() : pointcloud(NULL), positions(NULL), normals(NULL) {}
+  ~NoisePoints() {}
+
+  PointCloud *pointcloud;
+  const Vector *positions;
+  const Vector *normals;
+};
+
+static void noise_points_range(void *data, int begin, int end);
+
 static const Property MyPropertyList[] = {
   Property("mesh",         PropMesh(NULL),       set_mesh),
   Property("pointcloud",   PropPointCloud(NULL), set_pointcloud),
@@ -132,13 +144,25 @@ static int generate_pointcloud(const Mesh &mesh, PointCloud &pointcloud, bool ad
   const int face_count = mesh.GetFaceCount();
   std::vector<int> point_count_list(face_count);
 
+  // noise of all face centers at once
+  std::vector<Vector> noise_positions(face_count);
+  std::vector<Real> noise_values(face_count);
   for (int i = 0; i < face_count; i++) {
     Vector P0, P1, P2;
     MshGetFacePointPosition(&mesh, i, &P0, &P1, &P2);
 
     const Vector center = (P0 + P1 + P2) / 3;
-    Real noise_val = PerlinNoise(2.5 * center, 2, .5, 8);
-    noise_val = Fit(noise_val, -.2, 1, 0, 1);
+    noise_positions[i] = 2.5 * center;
+  }
+  if (face_count > 0) {
+    PerlinNoise(&noise_positions[0], face_count, 2, .5, 8, &noise_values[0]);
+  }
+
+  for (int i = 0; i < face_count; i++) {
+    Vector P0, P1, P2;
+    MshGetFacePointPosition(&mesh, i, &P0, &P1, &P2);
+
+    const Real noise_val = Fit(noise_values[i], -.2, 1, 0, 1);
 
     const Real area = TriComputeArea(P0, P1, P2);
 
@@ -161,6 +185,10 @@ static int generate_pointcloud(const Mesh &mesh, PointCloud &pointcloud, bool ad
     pointcloud.AddPointVelocity();
   }
 
+  // draws of the rng are sequential. points are placed here and moved by
+  // the noise in parallel since that is the most of the time
+  std::vector<Vector> positions(add_velocity ? total_point_count : 0);
+  std::vector<Vector> normals(add_velocity ? total_point_count : 0);
   XorShift rng;
   int point_id = 0;
   for (int i = 0; i < face_count; i++) {
@@ -173,7 +201,6 @@ static int generate_pointcloud(const Mesh &mesh, PointCloud &pointcloud, bool ad
 
     for (int j = 0; j < npt_on_face; j++) {
       Vector P_out;
-      Real radius = 0;
 
       const Real u = rng.NextFloat01();
       const Real v = (1 - u) * rng.NextFloat01();
@@ -187,34 +214,60 @@ static int generate_pointcloud(const Mesh &mesh, PointCloud &pointcloud, bool ad
       P_out += offset * normal;
 
       if (add_velocity) {
-        radius = .01 * .2 * 3;
-        Vector vel;
-        noise_position(P_out, normal, vel);
-        pointcloud.SetPointVelocity(point_id, vel);
+        positions[point_id] = P_out;
+        normals[point_id] = normal;
+        pointcloud.SetPointRadius(point_id, .01 * .2 * 3);
       } else {
-        radius = .01 * .2;
+        pointcloud.SetPointPosition(point_id, P_out);
+        pointcloud.SetPointRadius(point_id, .01 * .2);
       }
 
-      pointcloud.SetPointPosition(point_id, P_out);
-      pointcloud.SetPointRadius(point_id, radius);
-
       point_id++;
     }
   }
+
+  if (add_velocity) {
+    NoisePoints noise;
+    noise.pointcloud = &pointcloud;
+    noise.positions = &positions[0];
+    noise.normals = &normals[0];
+    Procedure::ParallelFor(&noise, noise_points_range, total_point_count);
+  }
+
   pointcloud.ComputeBounds();
 
   return 0;
 }
 
+static void noise_points_range(void *data, int begin, int end)
+{
+  const NoisePoints *noise = (const NoisePoints *) data;
+  PointCloud *pointcloud = noise->pointcloud;
+
+  for (int i = begin; i < end; i++) {
+    Vector P = noise->positions[i];
+    Vector velocity;
+    noise_position(P, noise->normals[i], velocity);
+    pointcloud->SetPointPosition(i, P);
+    pointcloud->SetPointVelocity(i, velocity);
+  }
+}
+
 static void noise_position(Vector &P, const Vector &N, Vector &velocity)
 {
-  Vector noise_vec = PerlinNoise3d(P, 2, .5, 8);
+  // the same noise as PerlinNoise3d and PerlinNoise in one call
+  const Vector positions[4] = {
+    P,
+    P + Vector(131.977, 21.1823, 71.0231),
+    P + Vector(237.492, 11.1312, 133.129),
+    P + Vector(1.234, -24.31 + .2, 123.4)};
+  Real noise[4] = {0, 0, 0, 0};
+  PerlinNoise(positions, 4, 2, .5, 8, noise);
+
+  Vector noise_vec(noise[0], noise[1], noise[2]);
   noise_vec += N;
 
-  const Vector P_offset = P + Vector(1.234, -24.31 + .2, 123.4);
-
-  Real noise_amp = PerlinNoise(P_offset, 2, .5, 8);
-  noise_amp = Fit(noise_amp, .2, 1, 0, 1);
+  const Real noise_amp = Fit(noise[3], .2, 1, 0, 1);
 
   P += noise_amp * noise_vec;
   velocity = .2 * noise_amp * noise_vec;
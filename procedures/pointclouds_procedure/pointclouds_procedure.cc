@@ -2,17 +2,21 @@
 // See LICENSE and README
 
 #include "fj_procedure.h"
+#include "fj_geometry_io.h"
+#include <iostream>
+#include <string>
 
 using namespace fj;
 
 class PointCloudsProcedure : Procedure {
 public:
-  PointCloudsProcedure() : volume(NULL), turbulence(NULL) {}
+  PointCloudsProcedure() : volume(NULL), turbulence(NULL), cache_file("") {}
   virtual ~PointCloudsProcedure() {}
 
 public:
   Volume *volume;
   const Turbulence *turbulence;
+  std::string cache_file;
 
 private:
   virtual int run() const;
@@ -24,6 +28,7 @@ static const char MyPluginName[] = "PointCloudsProcedure";
 
 static int set_volume(void *self, const PropertyValue &value);
 static int set_turbulence(void *self, const PropertyValue &value);
+static int set_cache_file(void *self, const PropertyValue &value);
 
 static int FillWithPointClouds(Volume *volume,
     const CloudControlPoint *cp, const Turbulence *turbulence);
@@ -31,6 +36,7 @@ static int FillWithPointClouds(Volume *volume,
 static const Property MyPropertyList[] = {
   Property("volume",     PropVolume(NULL),     set_volume),
   Property("turbulence", PropTurbulence(NULL), set_turbulence),
+  Property("cache_file", PropString(""),       set_cache_file),
   Property()
 };
 
@@ -75,6 +81,12 @@ int PointCloudsProcedure::run() const
     return -1;
   }
 
+  // bricks of the cache are read while rendering. it is not checked
+  // against the properties so remove it when they change
+  if (!cache_file.empty() && VolumeInputFile(cache_file).Read(*volume) == 0) {
+    return 0;
+  }
+
   CloudControlPoint cp;
   cp.orig = Vector(0, 0, 0);
   cp.udir = Vector(1, 0, 0);
@@ -87,6 +99,12 @@ int PointCloudsProcedure::run() const
 
   const int err = FillWithPointClouds(volume, &cp, turbulence);
 
+  volume->Compact();
+
+  if (!err && !cache_file.empty() && VolumeOutputFile(cache_file).Write(*volume)) {
+    std::cerr << "* WARNING: could not write volume cache: " << cache_file << "\n";
+  }
+
   return err;
 }
 
@@ -114,84 +132,95 @@ static int set_turbulence(void *self, const PropertyValue &value)
   return 0;
 }
 
+static int set_cache_file(void *self, const PropertyValue &value)
+{
+  PointCloudsProcedure *cloud = (PointCloudsProcedure *) self;
+
+  if (value.string == NULL)
+    return -1;
+
+  cloud->cache_file = value.string;
+
+  return 0;
+}
+
+class PointCloudFill {
+public:
+  PointCloudFill() : volume(NULL), cp(NULL), turbulence(NULL), thresholdwidth(0) {}
+  ~PointCloudFill() {}
+
+  const Volume *volume;
+  const CloudControlPoint *cp;
+  const Turbulence *turbulence;
+  double thresholdwidth;
+};
+
+static float pyro_cloud_value(void *data, int i, int j, int k, float value)
+{
+  const PointCloudFill *fill = (const PointCloudFill *) data;
+  const CloudControlPoint *cp = fill->cp;
+  const double thresholdwidth = fill->thresholdwidth;
+
+  double sphere_func = 0;
+  double noise_func = 0;
+  double pyro_func = 0;
+  double distance = 0;
+
+  Vector cell_center;
+  Vector P_local_space;
+  Vector P_noise_space;
+  float pyro_value = 0;
+
+  cell_center = fill->volume->IndexToPoint(i, j, k);
+  P_local_space.x =  cell_center.x - cp->orig.x;
+  P_local_space.y =  cell_center.y - cp->orig.y;
+  P_local_space.z =  cell_center.z - cp->orig.z;
+  distance = Length(P_local_space);
+
+  if (distance < cp->radius - thresholdwidth) {
+    return Max(value, cp->density);
+  }
+
+  P_noise_space = P_local_space;
+  P_noise_space = Normalize(P_noise_space);
+  P_noise_space.x += cp->noise_space.x;
+  P_noise_space.y += cp->noise_space.y;
+  P_noise_space.z += cp->noise_space.z;
+
+  noise_func = fill->turbulence->Evaluate(P_noise_space);
+  noise_func = Abs(noise_func);
+  noise_func = Gamma(noise_func, .5);
+  noise_func *= cp->noise_amplitude;
+
+  sphere_func = distance - cp->radius;
+  pyro_func = sphere_func - noise_func;
+  pyro_value = Fit(pyro_func, -thresholdwidth, thresholdwidth, 1, 0);
+  pyro_value *= cp->density;
+
+  return Max(value, pyro_value);
+}
+
 static int FillWithPointClouds(Volume *volume,
     const CloudControlPoint *cp, const Turbulence *turbulence)
 
 {
   // based on Production Volume Rendering (SIGGRAPH 2011) Course notes
-  int i, j, k;
-  int xres, yres, zres;
   int xmin, ymin, zmin;
   int xmax, ymax, zmax;
 
-  double thresholdwidth = 0;
-
-  // TODO come up with the best place to put progress
-  Progress progress;
-
-  volume->GetResolution(&xres, &yres, &zres);
-  thresholdwidth = .5 * volume->GetFilterSize();
+  PointCloudFill fill;
+  fill.volume = volume;
+  fill.cp = cp;
+  fill.turbulence = turbulence;
+  fill.thresholdwidth = .5 * volume->GetFilterSize();
 
   VolGetIndexRange(volume, &cp->orig, cp->radius * 1.5,
       &xmin, &ymin, &zmin,
       &xmax, &ymax, &zmax);
 
-  progress.Start(
-      (xmax - xmin + 1) *
-      (ymax - ymin + 1) *
-      (zmax - zmin + 1));
-
-  for (k = zmin; k <= zmax; k++) {
-    for (j = ymin; j <= ymax; j++) {
-      for (i = xmin; i <= xmax; i++) {
-        double sphere_func = 0;
-        double noise_func = 0;
-        double pyro_func = 0;
-        double distance = 0;
-
-        Vector cell_center;
-        Vector P_local_space;
-        Vector P_noise_space;
-        float pyro_value = 0;
-        float value = 0;
-
-        cell_center = volume->IndexToPoint(i, j, k);
-        P_local_space.x =  cell_center.x - cp->orig.x;
-        P_local_space.y =  cell_center.y - cp->orig.y;
-        P_local_space.z =  cell_center.z - cp->orig.z;
-        distance = Length(P_local_space);
-
-        if (distance < cp->radius - thresholdwidth) {
-          value = volume->GetValue(i, j, k);
-          volume->SetValue(i, j, k, Max(value, cp->density));
-          progress.Increment();
-          continue;
-        }
-
-        P_noise_space = P_local_space;
-        P_noise_space = Normalize(P_noise_space);
-        P_noise_space.x += cp->noise_space.x;
-        P_noise_space.y += cp->noise_space.y;
-        P_noise_space.z += cp->noise_space.z;
-
-        noise_func = turbulence->Evaluate(P_noise_space);
-        noise_func = Abs(noise_func);
-        noise_func = Gamma(noise_func, .5);
-        noise_func *= cp->noise_amplitude;
-
-        sphere_func = distance - cp->radius;
-        pyro_func = sphere_func - noise_func;
-        pyro_value = Fit(pyro_func, -thresholdwidth, thresholdwidth, 1, 0);
-        pyro_value *= cp->density;
-
-        value = volume->GetValue(i, j, k);
-        volume->SetValue(i, j, k, Max(value, pyro_value));
-
-        progress.Increment();
-      }
-    }
-  }
-  progress.Done();
+  // voxels are filled in parallel
+  volume->UpdateValues(xmin, ymin, zmin, xmax, ymax, zmax,
+      pyro_cloud_value, &fill);
 
   return 0;
 }
@@ -2,17 +2,21 @@
 // See LICENSE and README
 
 #include "fj_procedure.h"
+#include "fj_geometry_io.h"
+#include <iostream>
+#include <string>
 
 using namespace fj;
 
 class SplineWispsProcedure : public Procedure {
 public:
-  SplineWispsProcedure() : volume(NULL), turbulence(NULL) {}
+  SplineWispsProcedure() : volume(NULL), turbulence(NULL), cache_file("") {}
   virtual ~SplineWispsProcedure() {}
 
 public:
   Volume *volume;
   const Turbulence *turbulence;
+  std::string cache_file;
 
 private:
   virtual int run() const;
@@ -24,6 +28,7 @@ static const char MyPluginName[] = "SplineWispsProcedure";
 
 static int set_volume(void *self, const PropertyValue &value);
 static int set_turbulence(void *self, const PropertyValue &value);
+static int set_cache_file(void *self, const PropertyValue &value);
 
 static int FillWithSpecksAlongLine(Volume *volume,
     const WispsControlPoint *cp0, const WispsControlPoint *cp1,
@@ -32,6 +37,7 @@ static int FillWithSpecksAlongLine(Volume *volume,
 static const Property MyPropertyList[] = {
   Property("volume",     PropVolume(NULL),     set_volume),
   Property("turbulence", PropTurbulence(NULL), set_turbulence),
+  Property("cache_file", PropString(""),       set_cache_file),
   Property()
 };
 
@@ -76,6 +82,12 @@ int SplineWispsProcedure::run() const
     return -1;
   }
 
+  // bricks of the cache are read while rendering. it is not checked
+  // against the properties so remove it when they change
+  if (!cache_file.empty() && VolumeInputFile(cache_file).Read(*volume) == 0) {
+    return 0;
+  }
+
   WispsControlPoint cp0, cp1;
   cp0.orig = Vector(-.75, -.5, .75);
   cp0.udir = Vector(1, 0, 0);
@@ -114,6 +126,12 @@ int SplineWispsProcedure::run() const
 
   const int err = FillWithSpecksAlongLine(volume, &cp0, &cp1, turbulence);
 
+  volume->Compact();
+
+  if (!err && !cache_file.empty() && VolumeOutputFile(cache_file).Write(*volume)) {
+    std::cerr << "* WARNING: could not write volume cache: " << cache_file << "\n";
+  }
+
   return err;
 }
 
@@ -141,55 +159,78 @@ static int set_turbulence(void *self, const PropertyValue &value)
   return 0;
 }
 
-static int FillWithSpecksAlongLine(Volume *volume,
-    const WispsControlPoint *cp0, const WispsControlPoint *cp1,
-    const Turbulence *turbulence)
+static int set_cache_file(void *self, const PropertyValue &value)
 {
-  XorShift rng;
-  int NSPECKS = 1000;
-  int i = 0;
-
-  // TODO come up with the best place to put progress
-  Progress progress;
-
-  // TODO should not be a point attribute?
-  NSPECKS = cp0->speck_count;
+  SplineWispsProcedure *spline = (SplineWispsProcedure *) self;
 
-  progress.Start(NSPECKS);
+  if (value.string == NULL)
+    return -1;
 
-  for (i = 0; i < NSPECKS; i++) {
-    WispsControlPoint cp_t;
-    Vector P_speck;
-    Vector P_noise_space;
-    Vector noise;
+  spline->cache_file = value.string;
 
-    const Vector2 disk = rng.SolidDiskRand();
-    const double line_t = rng.NextFloat01();
+  return 0;
+}
 
-    LerpWispConstrolPoint(&cp_t, cp0, cp1, line_t);
+class LineSpecks {
+public:
+  LineSpecks() : cp0(NULL), cp1(NULL), turbulence(NULL) {}
+  ~LineSpecks() {}
 
-    P_speck = cp_t.orig;
-    P_speck.x += cp_t.radius * disk.x * cp_t.udir.x + cp_t.radius * disk.y * cp_t.vdir.x;
-    P_speck.y += cp_t.radius * disk.x * cp_t.udir.y + cp_t.radius * disk.y * cp_t.vdir.y;
-    P_speck.z += cp_t.radius * disk.x * cp_t.udir.z + cp_t.radius * disk.y * cp_t.vdir.z;
+  const WispsControlPoint *cp0;
+  const WispsControlPoint *cp1;
+  const Turbulence *turbulence;
+};
 
-    P_noise_space.x = cp_t.noise_space.x + disk.x;
-    P_noise_space.y = cp_t.noise_space.y + disk.y;
-    P_noise_space.z = cp_t.noise_space.z;
-    noise = turbulence->Evaluate3d(P_noise_space);
+static void make_line_speck(void *data, XorShift &rng,
+    Vector *center, Real *radius, float *density)
+{
+  const LineSpecks *line = (const LineSpecks *) data;
+  WispsControlPoint cp_t;
+  Vector P_speck;
+  Vector P_noise_space;
+  Vector noise;
+
+  const Vector2 disk = rng.SolidDiskRand();
+  const double line_t = rng.NextFloat01();
+
+  LerpWispConstrolPoint(&cp_t, line->cp0, line->cp1, line_t);
+
+  P_speck = cp_t.orig;
+  P_speck.x += cp_t.radius * disk.x * cp_t.udir.x + cp_t.radius * disk.y * cp_t.vdir.x;
+  P_speck.y += cp_t.radius * disk.x * cp_t.udir.y + cp_t.radius * disk.y * cp_t.vdir.y;
+  P_speck.z += cp_t.radius * disk.x * cp_t.udir.z + cp_t.radius * disk.y * cp_t.vdir.z;
+
+  P_noise_space.x = cp_t.noise_space.x + disk.x;
+  P_noise_space.y = cp_t.noise_space.y + disk.y;
+  P_noise_space.z = cp_t.noise_space.z;
+  noise = line->turbulence->Evaluate3d(P_noise_space);
+
+  noise.x *= cp_t.radius * cp_t.noise_amplitude;
+  noise.y *= cp_t.radius * cp_t.noise_amplitude;
+  noise.z *= 1;
+
+  P_speck.x += noise.x * cp_t.udir.x + noise.y * cp_t.vdir.x + noise.z * cp_t.wdir.x;
+  P_speck.y += noise.x * cp_t.udir.y + noise.y * cp_t.vdir.y + noise.z * cp_t.wdir.y;
+  P_speck.z += noise.x * cp_t.udir.z + noise.y * cp_t.vdir.z + noise.z * cp_t.wdir.z;
+
+  *center = P_speck;
+  *radius = cp_t.speck_radius;
+  *density = cp_t.density;
+}
 
-    noise.x *= cp_t.radius * cp_t.noise_amplitude;
-    noise.y *= cp_t.radius * cp_t.noise_amplitude;
-    noise.z *= 1;
+static int FillWithSpecksAlongLine(Volume *volume,
+    const WispsControlPoint *cp0, const WispsControlPoint *cp1,
+    const Turbulence *turbulence)
+{
+  LineSpecks line;
+  line.cp0 = cp0;
+  line.cp1 = cp1;
+  line.turbulence = turbulence;
 
-    P_speck.x += noise.x * cp_t.udir.x + noise.y * cp_t.vdir.x + noise.z * cp_t.wdir.x;
-    P_speck.y += noise.x * cp_t.udir.y + noise.y * cp_t.vdir.y + noise.z * cp_t.wdir.y;
-    P_speck.z += noise.x * cp_t.udir.z + noise.y * cp_t.vdir.z + noise.z * cp_t.wdir.z;
+  // TODO should not be a point attribute?
+  const int NSPECKS = cp0->speck_count;
 
-    FillWithSphere(volume, &P_speck, cp_t.speck_radius, cp_t.density);
-    progress.Increment();
-  }
-  progress.Done();
+  FillWithSpecks(volume, NSPECKS, make_line_speck, &line);
 
   return 0;
 }
@@ -48,6 +48,170 @@ PlyProperty face_props[] = { // list of property information for a face
     1, PLY_UCHAR, PLY_UCHAR, offsetof(PlyFace,nverts)},
 };
 
+// sizes of PLY_CHAR to PLY_DOUBLE in files
+static const int TYPE_SIZE[] = {0, 1, 2, 4, 1, 2, 4, 4, 8};
+
+// hands out records of files read in large blocks
+class BlockReader {
+public:
+  BlockReader(FILE *fp) : fp_(fp), buffer_(1 << 20), begin_(0), end_(0) {}
+  ~BlockReader() {}
+
+  // returns NULL if the file ends before size bytes
+  const char *Read(size_t size)
+  {
+    if (end_ - begin_ < size) {
+      memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+      if (buffer_.size() < size) {
+        buffer_.resize(size);
+      }
+      end_ += fread(&buffer_[end_], 1, buffer_.size() - end_, fp_);
+      if (end_ < size) {
+        return NULL;
+      }
+    }
+    const char *data = &buffer_[begin_];
+    begin_ += size;
+    return data;
+  }
+
+private:
+  FILE *fp_;
+  std::vector<char> buffer_;
+  size_t begin_, end_;
+};
+
+template<typename T>
+static inline T read_value(const char *data)
+{
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+static int find_property(const PlyElement *elem, const char *name)
+{
+  for (int i = 0; i < elem->nprops; i++) {
+    if (strcmp(elem->props[i]->name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// byte offset of the scalar property in a record of the element
+static int property_offset(const PlyElement *elem, int prop_index)
+{
+  int offset = 0;
+  for (int i = 0; i < prop_index; i++) {
+    offset += TYPE_SIZE[elem->props[i]->external_type];
+  }
+  return offset;
+}
+
+// binary little endian files of float vertices followed by faces of
+// a uchar count list of int indices, like the Stanford scans
+static bool is_bulk_readable(const PlyFile *ply)
+{
+  if (ply->file_type != PLY_BINARY_LE || get_native_binary_type2() != PLY_BINARY_LE) {
+    return false;
+  }
+  if (ply->nelems < 2 ||
+      strcmp(ply->elems[0]->name, "vertex") != 0 ||
+      strcmp(ply->elems[1]->name, "face") != 0) {
+    return false;
+  }
+
+  const PlyElement *vertex = ply->elems[0];
+  for (int i = 0; i < vertex->nprops; i++) {
+    const PlyProperty *prop = vertex->props[i];
+    if (prop->is_list ||
+        prop->external_type <= PLY_START_TYPE || prop->external_type >= PLY_END_TYPE) {
+      return false;
+    }
+  }
+  const char *xyz[] = {"x", "y", "z"};
+  for (int i = 0; i < 3; i++) {
+    const int index = find_property(vertex, xyz[i]);
+    if (index < 0 || vertex->props[index]->external_type != PLY_FLOAT) {
+      return false;
+    }
+  }
+  if (find_property(vertex, "uv1") >= 0 || find_property(vertex, "uv2") >= 0) {
+    return false;
+  }
+
+  const PlyElement *face = ply->elems[1];
+  if (face->nprops != 1) {
+    return false;
+  }
+  const PlyProperty *list = face->props[0];
+  return list->is_list &&
+      list->count_external == PLY_UCHAR &&
+      (list->external_type == PLY_INT || list->external_type == PLY_UINT);
+}
+
+static int read_in_bulk(PlyFile *ply, Mesh &mesh)
+{
+  BlockReader reader(ply->fp);
+
+  const PlyElement *vertex = ply->elems[0];
+  const int nverts = vertex->num;
+  const int stride = property_offset(vertex, vertex->nprops);
+  const int x_offset = property_offset(vertex, find_property(vertex, "x"));
+  const int y_offset = property_offset(vertex, find_property(vertex, "y"));
+  const int z_offset = property_offset(vertex, find_property(vertex, "z"));
+
+  mesh.SetPointCount(nverts);
+  mesh.AddPointPosition();
+  for (int i = 0; i < nverts; i++) {
+    const char *record = reader.Read(stride);
+    if (record == NULL) {
+      return -1;
+    }
+    mesh.SetPointPosition(i, Vector(
+        read_value<float>(record + x_offset),
+        read_value<float>(record + y_offset),
+        read_value<float>(record + z_offset)));
+  }
+
+  const PlyElement *face = ply->elems[1];
+  const int npolys = face->num;
+  std::vector<Index3> indices;
+  indices.reserve(npolys);
+
+  for (int i = 0; i < npolys; i++) {
+    const char *count = reader.Read(1);
+    if (count == NULL) {
+      return -1;
+    }
+    const int nverts_in_face = read_value<unsigned char>(count);
+    const char *verts = reader.Read(nverts_in_face * sizeof(int));
+    if (verts == NULL) {
+      return -1;
+    }
+
+    // n triangles in a polygon is (n vertices - 2)
+    const int v0 = read_value<int>(verts);
+    for (int k = 0; k < nverts_in_face - 2; k++) {
+      indices.push_back(Index3(v0,
+          read_value<int>(verts + (k + 1) * sizeof(int)),
+          read_value<int>(verts + (k + 2) * sizeof(int))));
+    }
+  }
+
+  const int face_count = indices.size();
+  mesh.SetFaceCount(face_count);
+  mesh.AddFaceIndices();
+  for (int i = 0; i < face_count; i++) {
+    mesh.SetFaceIndices(i, indices[i]);
+  }
+
+  return 0;
+}
+
 int ReadPlyFile(const char *filename, Mesh &mesh)
 {
   PlyFile *in_ply;
@@ -73,6 +237,18 @@ int ReadPlyFile(const char *filename, Mesh &mesh)
     return -1;
   }
 
+  if (is_bulk_readable(in_ply)) {
+    const int err = read_in_bulk(in_ply, mesh);
+    ply_close(in_ply);
+    if (err) {
+      fprintf(stderr, "error: couldn't read input file: %s\n", filename);
+      return -1;
+    }
+    mesh.ComputeNormals();
+    mesh.ComputeBounds();
+    return 0;
+  }
+
   for (int i = 0; i < nelems; i++) {
     PlyElement *elem = in_ply->elems[i];
 
@@ -134,6 +310,7 @@ int ReadPlyFile(const char *filename, Mesh &mesh)
           indices.push_back(tri_index);
           ntris++;
         }
+        free(face.verts);
       }
     }
   }
@@ -168,7 +168,7 @@ char *my_strdup(const char *s)
   if (len == 0)
     return NULL;
 
-  dup = (char *) malloc(sizeof(char) * len);
+  dup = (char *) malloc(sizeof(char) * (len + 1));
   strcpy(dup, s);
 
   return dup;
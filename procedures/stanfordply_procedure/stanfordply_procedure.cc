@@ -2,6 +2,7 @@
 // See LICENSE and README
 
 #include "fj_procedure.h"
+#include "fj_geometry_io.h"
 #include "ply2mesh.h"
 #include <iostream>
 
@@ -9,13 +10,14 @@ using namespace fj;
 
 class StanfordPlyProcedure : Procedure {
 public:
-  StanfordPlyProcedure() : mesh(NULL), filepath(""), io_mode("r") {}
+  StanfordPlyProcedure() : mesh(NULL), filepath(""), io_mode("r"), cache_file("") {}
   virtual ~StanfordPlyProcedure() {}
 
 public:
   Mesh *mesh;
   std::string filepath;
   std::string io_mode;
+  std::string cache_file;
 
 private:
   virtual int run() const;
@@ -28,11 +30,13 @@ static const char MyPluginName[] = "StanfordPlyProcedure";
 static int set_mesh(void *self, const PropertyValue &value);
 static int set_filepath(void *self, const PropertyValue &value);
 static int set_io_mode(void *self, const PropertyValue &value);
+static int set_cache_file(void *self, const PropertyValue &value);
 
 static const Property MyPropertyList[] = {
   Property("mesh",         PropMesh(NULL),  set_mesh),
   Property("filepath",     PropString(""),  set_filepath),
   Property("io_mode",      PropString("r"), set_io_mode),
+  Property("cache_file",   PropString(""),  set_cache_file),
   Property()
 };
 
@@ -82,7 +86,15 @@ int StanfordPlyProcedure::run() const
 
   int err = 0;
   if (io_mode == "r") {
+    // the cache is mapped without parsing and copying. it is not checked
+    // against the PLY file so remove it when the PLY file changes
+    if (!cache_file.empty() && MeshInputFile(cache_file).Read(*mesh) == 0) {
+      return 0;
+    }
     err = ReadPlyFile(filepath.c_str(), *mesh);
+    if (!err && !cache_file.empty() && MeshOutputFile(cache_file).Write(*mesh)) {
+      std::cerr << "* WARNING: could not write mesh cache: " << cache_file << "\n";
+    }
   }
   /* not supported yet
   else if (io_mode == "w") {
@@ -129,3 +141,15 @@ static int set_io_mode(void *self, const PropertyValue &value)
 
   return 0;
 }
+
+static int set_cache_file(void *self, const PropertyValue &value)
+{
+  StanfordPlyProcedure *sfply = (StanfordPlyProcedure *) self;
+
+  if (value.string == NULL)
+    return -1;
+
+  sfply->cache_file = value.string;
+
+  return 0;
+}
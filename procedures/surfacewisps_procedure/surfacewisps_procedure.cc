@@ -2,17 +2,21 @@
 // See LICENSE and README
 
 #include "fj_procedure.h"
+#include "fj_geometry_io.h"
+#include <iostream>
+#include <string>
 
 using namespace fj;
 
 class SurfaceWispsProcedure : public Procedure {
 public:
-  SurfaceWispsProcedure() : volume(NULL), turbulence(NULL) {}
+  SurfaceWispsProcedure() : volume(NULL), turbulence(NULL), cache_file("") {}
   virtual ~SurfaceWispsProcedure() {}
 
 public:
   Volume *volume;
   const Turbulence *turbulence;
+  std::string cache_file;
 
 private:
   virtual int run() const;
@@ -24,6 +28,7 @@ static const char MyPluginName[] = "SurfaceWispsProcedure";
 
 static int set_volume(void *self, const PropertyValue &value);
 static int set_turbulence(void *self, const PropertyValue &value);
+static int set_cache_file(void *self, const PropertyValue &value);
 
 static int FillWithSpecksOnSurface(Volume *volume,
     const WispsControlPoint *cp00, const WispsControlPoint *cp10,
@@ -33,6 +38,7 @@ static int FillWithSpecksOnSurface(Volume *volume,
 static const Property MyPropertyList[] = {
   Property("volume",     PropVolume(NULL),     set_volume),
   Property("turbulence", PropTurbulence(NULL), set_turbulence),
+  Property("cache_file", PropString(""),       set_cache_file),
   Property()
 };
 
@@ -77,6 +83,12 @@ int SurfaceWispsProcedure::run() const
     return -1;
   }
 
+  // bricks of the cache are read while rendering. it is not checked
+  // against the properties so remove it when they change
+  if (!cache_file.empty() && VolumeInputFile(cache_file).Read(*volume) == 0) {
+    return 0;
+  }
+
   WispsControlPoint cp00, cp10, cp01, cp11;
   cp00.orig = Vector(0, 0, 0);
   cp00.udir = Vector(1, 0, 0);
@@ -110,6 +122,12 @@ int SurfaceWispsProcedure::run() const
       &cp01, &cp11,
       turbulence);
 
+  volume->Compact();
+
+  if (!err && !cache_file.empty() && VolumeOutputFile(cache_file).Write(*volume)) {
+    std::cerr << "* WARNING: could not write volume cache: " << cache_file << "\n";
+  }
+
   return err;
 }
 
@@ -137,61 +155,90 @@ static int set_turbulence(void *self, const PropertyValue &value)
   return 0;
 }
 
-static int FillWithSpecksOnSurface(Volume *volume,
-    const WispsControlPoint *cp00, const WispsControlPoint *cp10,
-    const WispsControlPoint *cp01, const WispsControlPoint *cp11,
-    const Turbulence *turbulence)
-
+static int set_cache_file(void *self, const PropertyValue &value)
 {
-  XorShift rng;
-  int NSPECKS = 1000;
-  int i = 0;
-
-  // TODO come up with the best place to put progress
-  Progress progress;
-
-  // TODO should not be a point attribute?
-  NSPECKS = cp00->speck_count;
+  SurfaceWispsProcedure *surface = (SurfaceWispsProcedure *) self;
 
-  progress.Start(NSPECKS);
+  if (value.string == NULL)
+    return -1;
 
-  for (i = 0; i < NSPECKS; i++) {
-    WispsControlPoint cp_t;
-    Vector P_speck;
-    Vector P_noise_space;
-    Vector noise;
-    double s = 0;
-    double t = 0;
+  surface->cache_file = value.string;
 
-    const Vector cube = rng.SolidCubeRand();
+  return 0;
+}
 
-    s = cube.x;
-    t = cube.y;
+class SurfaceSpecks {
+public:
+  SurfaceSpecks() : cp00(NULL), cp10(NULL), cp01(NULL), cp11(NULL), turbulence(NULL) {}
+  ~SurfaceSpecks() {}
 
-    BilerpWispConstrolPoint(&cp_t, cp00, cp10, cp01, cp11, s, t);
+  const WispsControlPoint *cp00;
+  const WispsControlPoint *cp10;
+  const WispsControlPoint *cp01;
+  const WispsControlPoint *cp11;
+  const Turbulence *turbulence;
+};
 
-    P_speck = cp_t.orig;
-    P_speck.x += cp_t.radius * cube.z * cp_t.wdir.x;
-    P_speck.y += cp_t.radius * cube.z * cp_t.wdir.y;
-    P_speck.z += cp_t.radius * cube.z * cp_t.wdir.z;
+static void make_surface_speck(void *data, XorShift &rng,
+    Vector *center, Real *radius, float *density)
+{
+  const SurfaceSpecks *surface = (const SurfaceSpecks *) data;
+  WispsControlPoint cp_t;
+  Vector P_speck;
+  Vector P_noise_space;
+  Vector noise;
+  double s = 0;
+  double t = 0;
+
+  const Vector cube = rng.SolidCubeRand();
+
+  s = cube.x;
+  t = cube.y;
+
+  BilerpWispConstrolPoint(&cp_t,
+      surface->cp00, surface->cp10,
+      surface->cp01, surface->cp11, s, t);
+
+  P_speck = cp_t.orig;
+  P_speck.x += cp_t.radius * cube.z * cp_t.wdir.x;
+  P_speck.y += cp_t.radius * cube.z * cp_t.wdir.y;
+  P_speck.z += cp_t.radius * cube.z * cp_t.wdir.z;
+
+  P_noise_space.x = cp_t.noise_space.x;
+  P_noise_space.y = cp_t.noise_space.y;
+  P_noise_space.z = cp_t.noise_space.z + cube.z;
+  noise = surface->turbulence->Evaluate3d(P_noise_space);
+
+  noise.x *= cp_t.noise_amplitude;
+  noise.y *= cp_t.noise_amplitude;
+  noise.z *= cp_t.radius * cp_t.noise_amplitude;
+
+  P_speck.x += noise.x * cp_t.udir.x + noise.y * cp_t.vdir.x + noise.z * cp_t.wdir.x;
+  P_speck.y += noise.x * cp_t.udir.y + noise.y * cp_t.vdir.y + noise.z * cp_t.wdir.y;
+  P_speck.z += noise.x * cp_t.udir.z + noise.y * cp_t.vdir.z + noise.z * cp_t.wdir.z;
+
+  *center = P_speck;
+  *radius = cp_t.speck_radius;
+  *density = cp_t.density;
+}
 
-    P_noise_space.x = cp_t.noise_space.x;
-    P_noise_space.y = cp_t.noise_space.y;
-    P_noise_space.z = cp_t.noise_space.z + cube.z;
-    noise = turbulence->Evaluate3d(P_noise_space);
+static int FillWithSpecksOnSurface(Volume *volume,
+    const WispsControlPoint *cp00, const WispsControlPoint *cp10,
+    const WispsControlPoint *cp01, const WispsControlPoint *cp11,
+    const Turbulence *turbulence)
 
-    noise.x *= cp_t.noise_amplitude;
-    noise.y *= cp_t.noise_amplitude;
-    noise.z *= cp_t.radius * cp_t.noise_amplitude;
+{
+  SurfaceSpecks surface;
+  surface.cp00 = cp00;
+  surface.cp10 = cp10;
+  surface.cp01 = cp01;
+  surface.cp11 = cp11;
+  surface.turbulence = turbulence;
 
-    P_speck.x += noise.x * cp_t.udir.x + noise.y * cp_t.vdir.x + noise.z * cp_t.wdir.x;
-    P_speck.y += noise.x * cp_t.udir.y + noise.y * cp_t.vdir.y + noise.z * cp_t.wdir.y;
-    P_speck.z += noise.x * cp_t.udir.z + noise.y * cp_t.vdir.z + noise.z * cp_t.wdir.z;
+  // TODO should not be a point attribute?
+  const int NSPECKS = cp00->speck_count;
 
-    FillWithSphere(volume, &P_speck, cp_t.speck_radius, cp_t.density);
-    progress.Increment();
-  }
-  progress.Done();
+  FillWithSpecks(volume, NSPECKS, make_surface_speck, &surface);
 
   return 0;
 }
@@ -142,6 +142,9 @@ private:
   }
 };
 
+// parses chunks of the memory mapped file in parallel. returns -1 if
+// the file can't be mapped
+extern int ObjBufferReadFile(ObjBuffer &buffer, const std::string &filepath);
 extern int ObjBufferToMesh(const ObjBuffer &buffer, Mesh &mesh);
 extern int ObjBufferComputeNormals(ObjBuffer &buffer);
 
@@ -0,0 +1,456 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "ObjBuffer.h"
+#include "fj_procedure.h"
+#include "fj_os.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+// chunks end at line ends so no line spans two chunks
+static const size_t CHUNK_SIZE = 1 << 20;
+
+class Chunk {
+public:
+  Chunk() :
+      begin(NULL), end(NULL),
+      v_count(0), vt_count(0), vn_count(0),
+      tri_count(0), vt_tri_count(0), vn_tri_count(0),
+      v_offset(0), vt_offset(0), vn_offset(0),
+      tri_offset(0), vt_tri_offset(0), vn_tri_offset(0),
+      group_id(0) {}
+  ~Chunk() {}
+
+public:
+  const char *begin;
+  const char *end;
+
+  // counts in the chunk
+  long v_count, vt_count, vn_count;
+  long tri_count, vt_tri_count, vn_tri_count;
+  // first names of g lines in order
+  std::vector<std::string> group_names;
+
+  // counts in all previous chunks
+  long v_offset, vt_offset, vn_offset;
+  long tri_offset, vt_tri_offset, vn_tri_offset;
+  // group at the beginning of the chunk and ids of g lines
+  int group_id;
+  std::vector<int> group_ids;
+};
+
+class ChunkList {
+public:
+  ChunkList() : chunks(NULL), buffer(NULL) {}
+  ~ChunkList() {}
+
+  std::vector<Chunk> *chunks;
+  // NULL when counting
+  ObjBuffer *buffer;
+};
+
+static inline bool is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\f' || c == '\v' || c == '\r';
+}
+
+static inline bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+static inline const char *skip_spaces(const char *p, const char *end)
+{
+  while (p < end && is_space(*p)) {
+    p++;
+  }
+  return p;
+}
+
+static inline const char *skip_token(const char *p, const char *end)
+{
+  while (p < end && !is_space(*p)) {
+    p++;
+  }
+  return p;
+}
+
+static const char *scan_long(const char *p, const char *end, long *value)
+{
+  p = skip_spaces(p, end);
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  if (p == end || !is_digit(*p)) {
+    return NULL;
+  }
+
+  long n = 0;
+  while (p < end && is_digit(*p)) {
+    n = 10 * n + (*p - '0');
+    p++;
+  }
+  *value = negative ? -n : n;
+  return p;
+}
+
+// exact when the digits fit in a double and the power of ten is exact.
+// other numbers go to strtod
+static const char *scan_double(const char *p, const char *end, double *value)
+{
+  static const double POW10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const int MAX_EXACT_DIGITS = 15;
+  const int MAX_EXACT_POW10 = 22;
+
+  p = skip_spaces(p, end);
+  const char *start = p;
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int digit_count = 0;
+  int exponent = 0;
+  bool has_digits = false;
+
+  while (p < end && is_digit(*p)) {
+    has_digits = true;
+    if (mantissa > 0 || *p != '0') {
+      if (digit_count < 19) {
+        mantissa = 10 * mantissa + (*p - '0');
+      } else {
+        exponent++;
+      }
+      digit_count++;
+    }
+    p++;
+  }
+  if (p < end && *p == '.') {
+    p++;
+    while (p < end && is_digit(*p)) {
+      has_digits = true;
+      if (mantissa > 0 || *p != '0') {
+        if (digit_count < 19) {
+          mantissa = 10 * mantissa + (*p - '0');
+          exponent--;
+        }
+        digit_count++;
+      } else {
+        exponent--;
+      }
+      p++;
+    }
+  }
+  if (!has_digits) {
+    return NULL;
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool exp_negative = false;
+    if (q < end && (*q == '-' || *q == '+')) {
+      exp_negative = *q == '-';
+      q++;
+    }
+    if (q < end && is_digit(*q)) {
+      int e = 0;
+      while (q < end && is_digit(*q)) {
+        if (e < 10000) {
+          e = 10 * e + (*q - '0');
+        }
+        q++;
+      }
+      exponent += exp_negative ? -e : e;
+      p = q;
+    }
+  }
+
+  if (mantissa == 0) {
+    *value = negative ? -0. : 0.;
+  }
+  else if (digit_count <= MAX_EXACT_DIGITS &&
+      exponent >= -MAX_EXACT_POW10 && exponent <= MAX_EXACT_POW10) {
+    const double m = static_cast<double>(mantissa);
+    const double x = exponent < 0 ? m / POW10[-exponent] : m * POW10[exponent];
+    *value = negative ? -x : x;
+  }
+  else {
+    const std::string number(start, p);
+    *value = strtod(number.c_str(), NULL);
+  }
+
+  return p;
+}
+
+static const char *scan_vector(const char *p, const char *end, double *v)
+{
+  for (int i = 0; i < 4; i++) {
+    const char *next = scan_double(p, end, &v[i]);
+    if (next == NULL) {
+      break;
+    }
+    p = next;
+  }
+  return p;
+}
+
+static long reindex(long total, long index)
+{
+  if (index > 0) {
+    return index - 1;
+  } else if (index < 0) {
+    return index + total;
+  } else {
+    return 0;
+  }
+}
+
+static void push_triangles(std::vector<Index3> &dst, long offset,
+    const std::vector<long> &indices, long ntriangles)
+{
+  for (long i = 0; i < ntriangles; i++) {
+    dst[offset + i] = Index3(indices[0], indices[i + 1], indices[i + 2]);
+  }
+}
+
+// counts elements of the chunk if buffer is NULL, otherwise stores them
+// from the offsets of the chunk
+static void parse_chunk(Chunk &chunk, ObjBuffer *buffer)
+{
+  long v_count = 0, vt_count = 0, vn_count = 0;
+  long tri_count = 0, vt_tri_count = 0, vn_tri_count = 0;
+  int group_count = 0;
+  int group_id = chunk.group_id;
+
+  std::vector<long> v_indices, vt_indices, vn_indices;
+
+  const char *p = chunk.begin;
+  while (p < chunk.end) {
+    const char *line_end = static_cast<const char *>(memchr(p, '\n', chunk.end - p));
+    if (line_end == NULL) {
+      line_end = chunk.end;
+    }
+
+    const char *tag = skip_spaces(p, line_end);
+    const char *q = skip_token(tag, line_end);
+    const size_t tag_len = q - tag;
+
+    if (tag_len == 1 && tag[0] == 'v') {
+      if (buffer != NULL) {
+        double v[4] = {0, 0, 0, 0};
+        scan_vector(q, line_end, v);
+        buffer->vertex_position[chunk.v_offset + v_count] = Vector(v[0], v[1], v[2]);
+      }
+      v_count++;
+    }
+    else if (tag_len == 2 && tag[0] == 'v' && tag[1] == 't') {
+      if (buffer != NULL) {
+        double v[4] = {0, 0, 0, 0};
+        scan_vector(q, line_end, v);
+        buffer->vertex_texture[chunk.vt_offset + vt_count] = TexCoord(v[0], v[1]);
+      }
+      vt_count++;
+    }
+    else if (tag_len == 2 && tag[0] == 'v' && tag[1] == 'n') {
+      if (buffer != NULL) {
+        double v[4] = {0, 0, 0, 0};
+        scan_vector(q, line_end, v);
+        buffer->vertex_normal[chunk.vn_offset + vn_count] = Vector(v[0], v[1], v[2]);
+      }
+      vn_count++;
+    }
+    else if (tag_len == 1 && tag[0] == 'f') {
+      v_indices.clear();
+      vt_indices.clear();
+      vn_indices.clear();
+
+      // v, v/vt, v//vn or v/vt/vn
+      for (;;) {
+        long v = 0, vt = 0, vn = 0;
+        const char *next = scan_long(q, line_end, &v);
+        if (next == NULL) {
+          break;
+        }
+        q = next;
+        v_indices.push_back(reindex(chunk.v_offset + v_count, v));
+
+        if (q < line_end && *q == '/') {
+          q++;
+          if (q < line_end && *q == '/') {
+            q++;
+            if ((next = scan_long(q, line_end, &vn)) != NULL) {
+              q = next;
+              vn_indices.push_back(reindex(chunk.vn_offset + vn_count, vn));
+            }
+          } else {
+            if ((next = scan_long(q, line_end, &vt)) != NULL) {
+              q = next;
+              vt_indices.push_back(reindex(chunk.vt_offset + vt_count, vt));
+            }
+            if (q < line_end && *q == '/') {
+              q++;
+              if ((next = scan_long(q, line_end, &vn)) != NULL) {
+                q = next;
+                vn_indices.push_back(reindex(chunk.vn_offset + vn_count, vn));
+              }
+            }
+          }
+        }
+      }
+
+      const long ntriangles = std::max(static_cast<long>(v_indices.size()) - 2, 0L);
+      const bool has_vt = ntriangles > 0 && vt_indices.size() == v_indices.size();
+      const bool has_vn = ntriangles > 0 && vn_indices.size() == v_indices.size();
+
+      if (buffer != NULL) {
+        const long tri_offset = chunk.tri_offset + tri_count;
+        push_triangles(buffer->position_indices, tri_offset, v_indices, ntriangles);
+        if (has_vt) {
+          push_triangles(buffer->texture_indices, chunk.vt_tri_offset + vt_tri_count,
+              vt_indices, ntriangles);
+        }
+        if (has_vn) {
+          push_triangles(buffer->normal_indices, chunk.vn_tri_offset + vn_tri_count,
+              vn_indices, ntriangles);
+        }
+        for (long i = 0; i < ntriangles; i++) {
+          buffer->face_group_id[tri_offset + i] = group_id;
+        }
+      }
+      tri_count += ntriangles;
+      vt_tri_count += has_vt ? ntriangles : 0;
+      vn_tri_count += has_vn ? ntriangles : 0;
+    }
+    else if (tag_len == 1 && tag[0] == 'g') {
+      if (buffer != NULL) {
+        group_id = chunk.group_ids[group_count];
+      } else {
+        const char *name = skip_spaces(q, line_end);
+        chunk.group_names.push_back(std::string(name, skip_token(name, line_end)));
+      }
+      group_count++;
+    }
+
+    p = line_end + 1;
+  }
+
+  if (buffer == NULL) {
+    chunk.v_count = v_count;
+    chunk.vt_count = vt_count;
+    chunk.vn_count = vn_count;
+    chunk.tri_count = tri_count;
+    chunk.vt_tri_count = vt_tri_count;
+    chunk.vn_tri_count = vn_tri_count;
+  }
+}
+
+static void parse_chunk_range(void *data, int begin, int end)
+{
+  const ChunkList *list = (const ChunkList *) data;
+
+  for (int i = begin; i < end; i++) {
+    parse_chunk((*list->chunks)[i], list->buffer);
+  }
+}
+
+static int lookup_group_or_create_new(ObjBuffer &buffer, const std::string &group_name)
+{
+  std::map<std::string, int>::const_iterator it = buffer.group_name_to_id.find(group_name);
+  if (it != buffer.group_name_to_id.end()) {
+    return it->second;
+  }
+
+  // the size is the next id
+  const int new_id = buffer.group_name_to_id.size();
+  buffer.group_name_to_id[group_name] = new_id;
+  return new_id;
+}
+
+int ObjBufferReadFile(ObjBuffer &buffer, const std::string &filepath)
+{
+  size_t size = 0;
+  void *data = OsMapFile(filepath.c_str(), &size);
+  if (data == NULL) {
+    return -1;
+  }
+
+  const char *text = static_cast<const char *>(data);
+  const char *text_end = text + size;
+
+  std::vector<Chunk> chunks;
+  for (const char *p = text; p < text_end;) {
+    const char *end = p + std::min(CHUNK_SIZE, static_cast<size_t>(text_end - p));
+    if (end < text_end) {
+      const char *newline = static_cast<const char *>(memchr(end, '\n', text_end - end));
+      end = newline == NULL ? text_end : newline + 1;
+    }
+    Chunk chunk;
+    chunk.begin = p;
+    chunk.end = end;
+    chunks.push_back(chunk);
+    p = end;
+  }
+
+  ChunkList list;
+  list.chunks = &chunks;
+  list.buffer = NULL;
+  fj::Procedure::ParallelFor(&list, parse_chunk_range, chunks.size());
+
+  // offsets and groups are in the order of the file
+  long v_total = 0, vt_total = 0, vn_total = 0;
+  long tri_total = 0, vt_tri_total = 0, vn_tri_total = 0;
+  int group_id = buffer.current_group_id;
+
+  for (std::size_t i = 0; i < chunks.size(); i++) {
+    Chunk &chunk = chunks[i];
+    chunk.v_offset = v_total;
+    chunk.vt_offset = vt_total;
+    chunk.vn_offset = vn_total;
+    chunk.tri_offset = tri_total;
+    chunk.vt_tri_offset = vt_tri_total;
+    chunk.vn_tri_offset = vn_tri_total;
+
+    v_total += chunk.v_count;
+    vt_total += chunk.vt_count;
+    vn_total += chunk.vn_count;
+    tri_total += chunk.tri_count;
+    vt_tri_total += chunk.vt_tri_count;
+    vn_tri_total += chunk.vn_tri_count;
+
+    chunk.group_id = group_id;
+    for (std::size_t j = 0; j < chunk.group_names.size(); j++) {
+      group_id = lookup_group_or_create_new(buffer, chunk.group_names[j]);
+      chunk.group_ids.push_back(group_id);
+    }
+  }
+  buffer.current_group_id = group_id;
+
+  buffer.vertex_position.resize(v_total);
+  buffer.vertex_texture.resize(vt_total);
+  buffer.vertex_normal.resize(vn_total);
+  buffer.position_indices.resize(tri_total);
+  buffer.texture_indices.resize(vt_tri_total);
+  buffer.normal_indices.resize(vn_tri_total);
+  buffer.face_group_id.resize(tri_total);
+
+  list.buffer = &buffer;
+  fj::Procedure::ParallelFor(&list, parse_chunk_range, chunks.size());
+
+  buffer.vertex_count = v_total;
+  buffer.face_count = tri_total;
+
+  OsUnmapFile(data, size);
+
+  return 0;
+}
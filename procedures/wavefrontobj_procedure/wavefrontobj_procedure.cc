@@ -135,17 +135,21 @@ static int set_io_mode(void *self, const PropertyValue &value)
 
 static int read_file(const std::string &filepath, Mesh &mesh)
 {
-  std::ifstream ifs(filepath.c_str());
-  if (!ifs) {
-    std::cerr << "error: couldn't open input file: " << filepath << "\n";
-    return -1;
-  }
-
   ObjBuffer buffer;
-  int err = buffer.Parse(ifs);
+  int err = ObjBufferReadFile(buffer, filepath);
   if (err) {
-    // TODO error handling
-    return -1;
+    // falls back to the stream parser
+    std::ifstream ifs(filepath.c_str());
+    if (!ifs) {
+      std::cerr << "error: couldn't open input file: " << filepath << "\n";
+      return -1;
+    }
+
+    err = buffer.Parse(ifs);
+    if (err) {
+      // TODO error handling
+      return -1;
+    }
   }
 
   mesh.Clear();
@@ -38,10 +38,11 @@ static Interrupt tile_start(void *data, const TileInfo *info)
   printf("#   Callback Sample -- Tile Start\n");
   return CALLBACK_CONTINUE;
 }
+// polled a few times a second while rendering
 static Interrupt interrupt_in_the_middle(void *data)
 {
   int *n = (int *) data;
-  if (*n == 320 * 240 * 3 * 3 / 2)
+  if (*n == 5)
     return CALLBACK_INTERRUPT;
   (*n)++;
   return CALLBACK_CONTINUE;
@@ -76,7 +76,7 @@ void ConstantShader::evaluate(const TraceContext &cxt,
 
   // C_tex
   if (texture != NULL) {
-    C_tex = texture->Lookup(in.uv.u, in.uv.v);
+    C_tex = texture->Lookup(in.uv.u, in.uv.v, in.du, in.dv);
     C_tex.r *= diffuse.r;
     C_tex.g *= diffuse.g;
     C_tex.b *= diffuse.b;
@@ -25,6 +25,9 @@ public:
 private:
   virtual void evaluate(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
+  virtual bool scatter_photon(const SurfaceInput &in, double u,
+      Vector *dir, Color *weight) const;
+  virtual bool scatters_photons() const { return true; }
 };
 
 static void *MyCreateFunction(void);
@@ -95,6 +98,7 @@ void GlassShader::evaluate(const TraceContext &cxt,
   Color4 C_refl;
   Color4 C_refr;
   double Kt = 0, Kr = 0;
+  float Wt = 0, Wr = 0;
   double t_hit = REAL_MAX;
 
   // Cs
@@ -105,33 +109,56 @@ void GlassShader::evaluate(const TraceContext &cxt,
 
   // reflect
   refl_cxt = SlReflectContext(&cxt, in.shaded_object);
-  SlReflect(&in.I, &in.N, &R);
-  R = Normalize(R);
-  // TODO fix hard-coded trace distance
-  SlTrace(&refl_cxt, &in.P, &R, .0001, 1000, &C_refl, &t_hit);
-  out->Cs.r += Kr * C_refl.r;
-  out->Cs.g += Kr * C_refl.g;
-  out->Cs.b += Kr * C_refl.b;
-
-  // refract
-  refr_cxt = SlRefractContext(&cxt, in.shaded_object);
-  SlRefract(&in.I, &in.N, 1/ior, &T);
-  T = Normalize(T);
-  SlTrace(&refr_cxt, &in.P, &T, .0001, 1000, &C_refr, &t_hit);
-
-  if (do_color_filter && Dot(in.I, in.N) < 0) {
-    C_refr.r *= pow(filter_color.r, t_hit);
-    C_refr.g *= pow(filter_color.g, t_hit);
-    C_refr.b *= pow(filter_color.b, t_hit);
+  Wr = SlWeightRay(&refl_cxt, Color(Kr, Kr, Kr));
+  if (Wr > 0) {
+    SlReflect(&in.I, &in.N, &R);
+    R = Normalize(R);
+    // TODO fix hard-coded trace distance
+    SlTrace(&refl_cxt, &in.P, &R, .0001, 1000, &C_refl, &t_hit);
+    out->Cs.r += Wr * Kr * C_refl.r;
+    out->Cs.g += Wr * Kr * C_refl.g;
+    out->Cs.b += Wr * Kr * C_refl.b;
   }
 
-  out->Cs.r += Kt * C_refr.r;
-  out->Cs.g += Kt * C_refr.g;
-  out->Cs.b += Kt * C_refr.b;
+  // refract. the absorption of the filter color is unknown until the hit
+  refr_cxt = SlRefractContext(&cxt, in.shaded_object);
+  Wt = SlWeightRay(&refr_cxt, Color(Kt, Kt, Kt));
+  if (Wt > 0) {
+    SlRefract(&in.I, &in.N, 1/ior, &T);
+    T = Normalize(T);
+    SlTrace(&refr_cxt, &in.P, &T, .0001, 1000, &C_refr, &t_hit);
+
+    if (do_color_filter && Dot(in.I, in.N) < 0) {
+      C_refr.r *= Pow(filter_color.r, t_hit);
+      C_refr.g *= Pow(filter_color.g, t_hit);
+      C_refr.b *= Pow(filter_color.b, t_hit);
+    }
+
+    out->Cs.r += Wt * Kt * C_refr.r;
+    out->Cs.g += Wt * Kt * C_refr.g;
+    out->Cs.b += Wt * Kt * C_refr.b;
+  }
 
   out->Os = 1;
 }
 
+bool GlassShader::scatter_photon(const SurfaceInput &in, double u,
+    Vector *dir, Color *weight) const
+{
+  // reflects or refracts by the fresnel term so photons keep their power
+  const double Kr = SlFresnel(&in.I, &in.N, 1/ior);
+
+  if (u < Kr) {
+    SlReflect(&in.I, &in.N, dir);
+  } else {
+    SlRefract(&in.I, &in.N, 1/ior, dir);
+  }
+  *dir = Normalize(*dir);
+  *weight = Color(1, 1, 1);
+
+  return true;
+}
+
 static int set_diffuse(void *self, const PropertyValue &value)
 {
   GlassShader *glass = (GlassShader *) self;
@@ -2,10 +2,29 @@
 // See LICENSE and README
 
 #include "fj_shader.h"
+#include "fj_memory_arena.h"
 #include <cassert>
+#include <cmath>
 
 using namespace fj;
 
+// the specular lobe over the cosine of the angle between the cones of
+// the light and the eye. linearly interpolated. the lobe doesn't use the
+// roughness property yet
+static const float SPECULAR_ROUGHNESS = .05;
+static const int SPECULAR_TABLE_SIZE = 2048;
+
+class SpecularTable {
+public:
+  SpecularTable();
+  ~SpecularTable() {}
+
+  float Lookup(float cosine) const;
+
+private:
+  float values_[SPECULAR_TABLE_SIZE + 1];
+};
+
 class HairShader : public Shader {
 public:
   HairShader() {}
@@ -19,6 +38,8 @@ public:
 
   Color reflect;
 
+  SpecularTable specular_table;
+
 private:
   virtual void evaluate(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
@@ -34,10 +55,6 @@ static int set_ambient(void *self, const PropertyValue &value);
 static int set_roughness(void *self, const PropertyValue &value);
 static int set_reflect(void *self, const PropertyValue &value);
 
-// hair shading implementations
-static float kajiya_diffuse(const Vector &tangent, const Vector &Ln);
-static float kajiya_specular(const Vector &tangent, const Vector &Ln, const Vector &I);
-
 static const Property MyPropertyList[] = {
   Property("diffuse",   PropVector3(1, 1, 1), set_diffuse),
   Property("specular",  PropVector3(1, 1, 1), set_specular),
@@ -87,35 +104,57 @@ static void MyDeleteFunction(void *self)
 void HairShader::evaluate(const TraceContext &cxt,
     const SurfaceInput &in, SurfaceOutput *out) const
 {
-  LightSample *samples = NULL;
-  // allocate samples
-  samples = SlNewLightSamples(&in);
-
   out->Cs = Color();
-  const int nsamples = SlGetLightSampleCount(&in);
-
-  for (int i = 0; i < nsamples; i++) {
-    LightOutput Lout = {};
-    Vector tangent;
-    float diff = 0;
-    float spec = 0;
-
-    SlIlluminance(&cxt, &samples[i], &in.P, &in.N, PI, &in, &Lout);
+  const int nlights = SlGetLightSelectionCount(&cxt, &in);
 
-    tangent = in.dPdv;
-    tangent = Normalize(tangent);
+  // kajiya-kay. terms of the eye are the same for all light samples
+  const Vector tangent = Normalize(in.dPdv);
+  const float TI = Dot(tangent, in.I);
+  assert(-1 <= TI && TI <= 1);
+  const float sin_I = sqrt(1 - TI * TI);
+
+  for (int j = 0; j < nlights; j++) {
+    int nsamples = 0;
+    const LightSample *samples = SlGetLightSamples(&cxt, &in, j, &nsamples);
+    LightOutput *Louts = SlGetScratchArena(&cxt).NewArray<LightOutput>(nsamples);
+    SlIlluminanceList(&cxt, samples, nsamples, &in.P, &in.N, PI, &in, Louts);
+
+    for (int i = 0; i < nsamples; i++) {
+      const LightOutput &Lout = Louts[i];
+
+      // samples the light doesn't reach are black
+      if (Lout.Cl.r == 0 && Lout.Cl.g == 0 && Lout.Cl.b == 0) {
+        continue;
+      }
+
+      const float TL = Dot(tangent, Lout.Ln);
+      assert(-1 <= TL && TL <= 1);
+      const float diff = sqrt(1 - TL * TL);
+      const float spec = specular_table.Lookup(diff * sin_I + TL * TI);
+
+      out->Cs.r += (in.Cd.r * diffuse.r * diff + spec) * Lout.Cl.r;
+      out->Cs.g += (in.Cd.g * diffuse.g * diff + spec) * Lout.Cl.g;
+      out->Cs.b += (in.Cd.b * diffuse.b * diff + spec) * Lout.Cl.b;
+    }
+  }
 
-    diff = kajiya_diffuse(tangent, Lout.Ln);
-    spec = kajiya_specular(tangent, Lout.Ln, in.I);
+  out->Os = 1;
+}
 
-    out->Cs.r += (in.Cd.r * diffuse.r * diff + spec) * Lout.Cl.r;
-    out->Cs.g += (in.Cd.g * diffuse.g * diff + spec) * Lout.Cl.g;
-    out->Cs.b += (in.Cd.b * diffuse.b * diff + spec) * Lout.Cl.b;
+SpecularTable::SpecularTable()
+{
+  for (int i = 0; i <= SPECULAR_TABLE_SIZE; i++) {
+    const double cosine = 2. * i / SPECULAR_TABLE_SIZE - 1;
+    values_[i] = std::pow(cosine, static_cast<double>(1 / SPECULAR_ROUGHNESS));
   }
+}
 
-  SlFreeLightSamples(samples);
-
-  out->Os = 1;
+float SpecularTable::Lookup(float cosine) const
+{
+  const float x = (Clamp(cosine, -1, 1) + 1) * .5 * SPECULAR_TABLE_SIZE;
+  const int i = Min(static_cast<int>(x), SPECULAR_TABLE_SIZE - 1);
+  const float t = x - i;
+  return (1 - t) * values_[i] + t * values_[i + 1];
 }
 
 static int set_diffuse(void *self, const PropertyValue &value)
@@ -180,27 +219,3 @@ static int set_reflect(void *self, const PropertyValue &value)
 
   return 0;
 }
-
-static float kajiya_diffuse(const Vector &tangent, const Vector &Ln)
-{
-  const float TL = Dot(tangent, Ln);
-  const float diff = sqrt(1-TL*TL);
-
-  return diff;
-}
-
-static float kajiya_specular(const Vector &tangent, const Vector &Ln, const Vector &I)
-{
-  const float roughness = .05;
-  const float TL = Dot(tangent, Ln);
-  const float TI = Dot(tangent, I);
-  float spec = 0;
-
-  assert(-1 <= TL && TL <= 1);
-  assert(-1 <= TI && TI <= 1);
-
-  spec = sqrt(1-TL*TL) * sqrt(1-TI*TI) + TL*TI;
-  spec = pow(spec, 1/roughness);
-
-  return spec;
-}
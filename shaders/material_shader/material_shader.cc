@@ -2,6 +2,7 @@
 // See LICENSE and README
 
 #include "fj_shader.h"
+#include "fj_memory_arena.h"
 #include "fj_multi_thread.h"
 
 using namespace fj;
@@ -33,6 +34,12 @@ public:
 private:
   virtual void evaluate(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
+  virtual void evaluate_batch(const TraceContext *cxts, const SurfaceInput *in, int count,
+      SurfaceOutput *out) const;
+
+  void apply_maps(const SurfaceInput &in, SurfaceInput *in_modified) const;
+  void shade(const TraceContext &cxt,
+      const SurfaceInput &in_modified, SurfaceOutput *out) const;
 
   Color integrate_diffuse(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
@@ -46,8 +53,6 @@ private:
   // TODO TEST
   Color direct_lighting(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
-
-  mutable XorShift rng[64];
 };
 
 static void *MyCreateFunction(void);
@@ -128,21 +133,46 @@ void MaterialShader::evaluate(const TraceContext &cxt,
   // TODO come up with the best way to pass attributes to integrators
   SurfaceInput in_modified = in;
 
+  apply_maps(in, &in_modified);
+  shade(cxt, in_modified, out);
+}
+
+void MaterialShader::evaluate_batch(const TraceContext *cxts, const SurfaceInput *in,
+    int count, SurfaceOutput *out) const
+{
+  SurfaceInput in_modified[SHADE_BATCH_SIZE];
+
+  // texture lookups of all points before lights
+  for (int i = 0; i < count; i++) {
+    in_modified[i] = in[i];
+    apply_maps(in[i], &in_modified[i]);
+  }
+  for (int i = 0; i < count; i++) {
+    shade(cxts[i], in_modified[i], &out[i]);
+  }
+}
+
+void MaterialShader::apply_maps(const SurfaceInput &in, SurfaceInput *in_modified) const
+{
   // diffuse map
   if (diffuse_map != NULL) {
-    const Color4 C_diff_map = diffuse_map->Lookup(in.uv.u, in.uv.v);
-    in_modified.Cd *= ToColor(C_diff_map);
+    const Color4 C_diff_map = diffuse_map->Lookup(in.uv.u, in.uv.v, in.du, in.dv);
+    in_modified->Cd *= ToColor(C_diff_map);
   }
   // bump map
   if (bump_map != NULL) {
     Vector N_bump;
     SlBumpMapping(bump_map,
         &in.dPdu, &in.dPdv,
-        &in.uv, bump_amplitude,
+        &in.uv, in.du, in.dv, bump_amplitude,
         &in.N, &N_bump);
-    in_modified.N = N_bump;
+    in_modified->N = N_bump;
   }
+}
 
+void MaterialShader::shade(const TraceContext &cxt,
+    const SurfaceInput &in_modified, SurfaceOutput *out) const
+{
   Color Lo, Le, /*L_direct,*/ L_diffuse, L_reflect, L_refract;
   Color L_direct;
 
@@ -168,6 +198,8 @@ void MaterialShader::evaluate(const TraceContext &cxt,
 
   out->Cs = Lo;
   out->Os = 1;
+  out->albedo = in_modified.Cd * diffuse;
+  out->direct = L_direct;
 }
 
 // TODO TEST NEW FUNCTIONS
@@ -187,25 +219,31 @@ Color MaterialShader::integrate_diffuse(const TraceContext &cxt,
   u = Normalize(u);
   v = Cross(w, u);
 
-  const int id = MtGetThreadID();
-  const Real r1 = 2. * PI * rng[id].NextFloat01();
-  const Real r2 = rng[id].NextFloat01();
+  const Vector2 uv = SlGetSampleSequence(&cxt).Next2D();
+  const Real r1 = 2. * PI * uv[0];
+  const Real r2 = uv[1];
   const Real r2sqrt = Sqrt(r2);
 
   const Vector D = Normalize(
-    u * cos(r1) * r2sqrt +
-    v * sin(r1) * r2sqrt +
+    u * Cos(r1) * r2sqrt +
+    v * Sin(r1) * r2sqrt +
     w * sqrt(1. - r2));
 
   const Real Kd = Dot(in.N, D);
 
   Color4 C_diff;
-  Real t_hit = REAL_MAX;
-  const TraceContext refl_cxt = SlDiffuseContext(&cxt, in.shaded_object);
+  double t_hit = REAL_MAX;
+  TraceContext refl_cxt = SlDiffuseContext(&cxt, in.shaded_object);
+  const float Wd = SlWeightRay(&refl_cxt, in.Cd * Kd * diffuse);
+  if (Wd == 0) {
+    out->Cs = Color();
+    out->Os = 1.0;
+    return out->Cs;
+  }
 
   SlTrace(&refl_cxt, &in.P, &D, .001, 1000, &C_diff, &t_hit);
 
-  out->Cs = in.Cd * Kd * diffuse * ToColor(C_diff);
+  out->Cs = Wd * in.Cd * Kd * diffuse * ToColor(C_diff);
   out->Os = 1.0;
 
   return out->Cs;
@@ -221,12 +259,18 @@ Color MaterialShader::integrate_reflect(const TraceContext &cxt,
   const Real Kr = SlFresnel(&in.I, &in.N, 1./ior);
 
   Color4 C_refl;
-  Real t_hit = REAL_MAX;
-  const TraceContext refl_cxt = SlReflectContext(&cxt, in.shaded_object);
+  double t_hit = REAL_MAX;
+  TraceContext refl_cxt = SlReflectContext(&cxt, in.shaded_object);
+  const float Wr = SlWeightRay(&refl_cxt, Kr * reflect);
+  if (Wr == 0) {
+    out->Cs = Color();
+    out->Os = 1.0;
+    return out->Cs;
+  }
 
   SlTrace(&refl_cxt, &in.P, &R, .001, 1000, &C_refl, &t_hit);
 
-  out->Cs = Kr * reflect * ToColor(C_refl);
+  out->Cs = Wr * Kr * reflect * ToColor(C_refl);
   out->Os = 1.0;
 
   return out->Cs;
@@ -243,18 +287,24 @@ Color MaterialShader::integrate_refract(const TraceContext &cxt,
   const Real Kt = 1 - Kr;
 
   Color4 C_refr;
-  Real t_hit = REAL_MAX;
-  const TraceContext refr_cxt = SlRefractContext(&cxt, in.shaded_object);
+  double t_hit = REAL_MAX;
+  TraceContext refr_cxt = SlRefractContext(&cxt, in.shaded_object);
+  const float Wt = SlWeightRay(&refr_cxt, Kt * refract);
+  if (Wt == 0) {
+    out->Cs = Color();
+    out->Os = 1;
+    return out->Cs;
+  }
 
   SlTrace(&refr_cxt, &in.P, &T, .0001, 1000, &C_refr, &t_hit);
 
   if (do_color_filter && Dot(in.I, in.N) < 0) {
-    C_refr.r *= pow(transmit.r, t_hit);
-    C_refr.g *= pow(transmit.g, t_hit);
-    C_refr.b *= pow(transmit.b, t_hit);
+    C_refr.r *= Pow(transmit.r, t_hit);
+    C_refr.g *= Pow(transmit.g, t_hit);
+    C_refr.b *= Pow(transmit.b, t_hit);
   }
 
-  out->Cs = Kt * refract * ToColor(C_refr);
+  out->Cs = Wt * Kt * refract * ToColor(C_refr);
   out->Os = 1;
 
   return out->Cs;
@@ -266,7 +316,7 @@ Color MaterialShader::direct_lighting(const TraceContext &cxt,
 #if 0
   /* THIS OLD VERSION */
   // allocate samples
-  LightSample *samples = SlNewLightSamples(&in);
+  LightSample *samples = SlNewLightSamples(&cxt, &in);
   const Vector D = Normalize(samples[0].P - in.P);
   // free samples
   SlFreeLightSamples(samples);
@@ -275,7 +325,7 @@ Color MaterialShader::direct_lighting(const TraceContext &cxt,
   const Real Kd = Dot(in.N, D);
 
   Color4 C_diff;
-  Real t_hit = REAL_MAX;
+  double t_hit = REAL_MAX;
   const TraceContext refl_cxt = SlDiffuseContext(&cxt, in.shaded_object);
 
   SlTrace(&refl_cxt, &in.P, &D, .001, 1000, &C_diff, &t_hit);
@@ -313,22 +363,24 @@ Color MaterialShader::direct_lighting(const TraceContext &cxt,
   Vector Nf;
   SlFaceforward(&in.I, &in.N, &Nf);
 
-  // allocate samples
-  LightSample *samples = SlNewLightSamples(&in);
-  const int nsamples = SlGetLightSampleCount(&in);
+  const int nlights = SlGetLightSelectionCount(&cxt, &in);
 
   Color C_direct;
-  for (int i = 0; i < nsamples; i++) {
-    LightOutput Lout;
-    SlIlluminance(&cxt, &samples[i], &in.P, &Nf, PI / 2., &in, &Lout);
+  for (int j = 0; j < nlights; j++) {
+    int nsamples = 0;
+    const LightSample *samples = SlGetLightSamples(&cxt, &in, j, &nsamples);
+    LightOutput *Louts = SlGetScratchArena(&cxt).NewArray<LightOutput>(nsamples);
+    SlIlluminanceList(&cxt, samples, nsamples, &in.P, &Nf, PI / 2., &in, Louts);
 
-    const float Ks = SlPhong(&in.I, &Nf, &Lout.Ln, .05) * 0;
-    const float Kd = Max(0, Dot(Nf, Lout.Ln));
+    for (int i = 0; i < nsamples; i++) {
+      const LightOutput &Lout = Louts[i];
 
-    C_direct += in.Cd * Kd * diffuse * Lout.Cl + Ks * specular * Lout.Cl;
+      const float Ks = SlPhong(&in.I, &Nf, &Lout.Ln, .05) * 0;
+      const float Kd = Max(0, Dot(Nf, Lout.Ln));
+
+      C_direct += in.Cd * Kd * diffuse * Lout.Cl + Ks * specular * Lout.Cl;
+    }
   }
-  // free samples
-  SlFreeLightSamples(samples);
 
   return C_direct;
 #endif
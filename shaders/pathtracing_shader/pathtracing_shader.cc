@@ -2,7 +2,7 @@
 // See LICENSE and README
 
 #include "fj_shader.h"
-#include "fj_multi_thread.h"
+#include "fj_memory_arena.h"
 
 using namespace fj;
 
@@ -43,17 +43,21 @@ private:
   Color integrate_refract(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
 
-  // TODO TEST
   Color direct_lighting(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
-
-  mutable XorShift rng[64];
 };
 
+// diffuse depth where paths start to be terminated by their throughput
+static const int ROULETTE_DEPTH = 2;
+// keeps paths of bright albedo from bouncing forever
+static const Real ROULETTE_MAX_PROB = .95;
+
 static void *MyCreateFunction(void);
 static void MyDeleteFunction(void *self);
 static const char MyPluginName[] = "PathtracingShader";
 
+static Real max_component(const Color &color);
+
 static int set_emission(void *self, const PropertyValue &value);
 static int set_diffuse(void *self, const PropertyValue &value);
 static int set_specular(void *self, const PropertyValue &value);
@@ -130,7 +134,7 @@ void PathtracingShader::evaluate(const TraceContext &cxt,
 
   // diffuse map
   if (diffuse_map != NULL) {
-    const Color4 C_diff_map = diffuse_map->Lookup(in.uv.u, in.uv.v);
+    const Color4 C_diff_map = diffuse_map->Lookup(in.uv.u, in.uv.v, in.du, in.dv);
     in_modified.Cd *= ToColor(C_diff_map);
   }
   // bump map
@@ -138,18 +142,15 @@ void PathtracingShader::evaluate(const TraceContext &cxt,
     Vector N_bump;
     SlBumpMapping(bump_map,
         &in.dPdu, &in.dPdv,
-        &in.uv, bump_amplitude,
+        &in.uv, in.du, in.dv, bump_amplitude,
         &in.N, &N_bump);
     in_modified.N = N_bump;
   }
 
-  Color Lo, Le, /*L_direct,*/ L_diffuse, L_reflect, L_refract;
+  Color Lo, Le, L_diffuse, L_reflect, L_refract;
 
   Le = emission;
 
-  // TODO TEST
-  //L_direct = direct_lighting(cxt, in_modified, out);
-
   if (Luminance(diffuse) > 0.) {
     L_diffuse = integrate_diffuse(cxt, in_modified, out);
   }
@@ -160,7 +161,7 @@ void PathtracingShader::evaluate(const TraceContext &cxt,
     L_refract = integrate_refract(cxt, in_modified, out);
   }
 
-  Lo = Le + /*L_direct +*/ L_diffuse + L_reflect + L_refract;
+  Lo = Le + L_diffuse + L_reflect + L_refract;
 
   out->Cs = Lo;
   out->Os = 1;
@@ -183,25 +184,59 @@ Color PathtracingShader::integrate_diffuse(const TraceContext &cxt,
   u = Normalize(u);
   v = Cross(w, u);
 
-  const int id = MtGetThreadID();
-  const Real r1 = 2. * PI * rng[id].NextFloat01();
-  const Real r2 = rng[id].NextFloat01();
+  const Vector2 uv = SlGetSampleSequence(&cxt).Next2D();
+  const Real r1 = 2. * PI * uv[0];
+  const Real r2 = uv[1];
   const Real r2sqrt = Sqrt(r2);
 
   const Vector D = Normalize(
-    u * cos(r1) * r2sqrt +
-    v * sin(r1) * r2sqrt +
+    u * Cos(r1) * r2sqrt +
+    v * Sin(r1) * r2sqrt +
     w * sqrt(1. - r2));
 
-  const Real Kd = Dot(in.N, D);
+  // lights are not seen by diffuse rays so they are sampled here
+  const Color L_direct = direct_lighting(cxt, in, out);
+
+  // cosine weighted directions leave albedo as the weight of the ray
+  const Color albedo = in.Cd * diffuse;
+
+  // secondary bounces use radiance of neighbours in the cache. primary
+  // ones trace to keep the details of cells out of sight
+  const bool use_cache = cxt.diffuse_depth > 0;
+  Color C_cached;
+  if (use_cache && SlLookupRadianceCache(&cxt, &in.P, &in.N, &C_cached)) {
+    out->Cs = L_direct + albedo * C_cached;
+    out->Os = 1.0;
+    return out->Cs;
+  }
+
+  TraceContext refl_cxt = SlDiffuseContext(&cxt, in.shaded_object);
+  refl_cxt.throughput = cxt.throughput * max_component(albedo);
+
+  // russian roulette
+  Real continue_prob = 1;
+  if (cxt.diffuse_depth >= ROULETTE_DEPTH) {
+    continue_prob = Min(refl_cxt.throughput, ROULETTE_MAX_PROB);
+    if (SlGetRandom(&cxt).NextFloat01() >= continue_prob) {
+      out->Cs = L_direct;
+      out->Os = 1.0;
+      return out->Cs;
+    }
+    refl_cxt.throughput /= continue_prob;
+  }
 
   Color4 C_diff;
-  Real t_hit = REAL_MAX;
-  const TraceContext refl_cxt = SlDiffuseContext(&cxt, in.shaded_object);
+  double t_hit = REAL_MAX;
 
   SlTrace(&refl_cxt, &in.P, &D, .001, 1000, &C_diff, &t_hit);
 
-  out->Cs = in.Cd * Kd * diffuse * ToColor(C_diff);
+  if (use_cache) {
+    // one unweighted sample of the incoming radiance
+    const Color C_incoming = ToColor(C_diff);
+    SlAddRadianceCache(&cxt, &in.P, &in.N, &C_incoming);
+  }
+
+  out->Cs = L_direct + albedo * ToColor(C_diff) / continue_prob;
   out->Os = 1.0;
 
   return out->Cs;
@@ -217,12 +252,18 @@ Color PathtracingShader::integrate_reflect(const TraceContext &cxt,
   const Real Kr = SlFresnel(&in.I, &in.N, 1./ior);
 
   Color4 C_refl;
-  Real t_hit = REAL_MAX;
-  const TraceContext refl_cxt = SlReflectContext(&cxt, in.shaded_object);
+  double t_hit = REAL_MAX;
+  TraceContext refl_cxt = SlReflectContext(&cxt, in.shaded_object);
+  const float Wr = SlWeightRay(&refl_cxt, Kr * reflect);
+  if (Wr == 0) {
+    out->Cs = Color();
+    out->Os = 1.0;
+    return out->Cs;
+  }
 
   SlTrace(&refl_cxt, &in.P, &R, .001, 1000, &C_refl, &t_hit);
 
-  out->Cs = Kr * reflect * ToColor(C_refl);
+  out->Cs = Wr * Kr * reflect * ToColor(C_refl);
   out->Os = 1.0;
 
   return out->Cs;
@@ -239,18 +280,24 @@ Color PathtracingShader::integrate_refract(const TraceContext &cxt,
   const Real Kt = 1 - Kr;
 
   Color4 C_refr;
-  Real t_hit = REAL_MAX;
-  const TraceContext refr_cxt = SlRefractContext(&cxt, in.shaded_object);
+  double t_hit = REAL_MAX;
+  TraceContext refr_cxt = SlRefractContext(&cxt, in.shaded_object);
+  const float Wt = SlWeightRay(&refr_cxt, Kt * refract);
+  if (Wt == 0) {
+    out->Cs = Color();
+    out->Os = 1;
+    return out->Cs;
+  }
 
   SlTrace(&refr_cxt, &in.P, &T, .0001, 1000, &C_refr, &t_hit);
 
   if (do_color_filter && Dot(in.I, in.N) < 0) {
-    C_refr.r *= pow(transmit.r, t_hit);
-    C_refr.g *= pow(transmit.g, t_hit);
-    C_refr.b *= pow(transmit.b, t_hit);
+    C_refr.r *= Pow(transmit.r, t_hit);
+    C_refr.g *= Pow(transmit.g, t_hit);
+    C_refr.b *= Pow(transmit.b, t_hit);
   }
 
-  out->Cs = Kt * refract * ToColor(C_refr);
+  out->Cs = Wt * Kt * refract * ToColor(C_refr);
   out->Os = 1;
 
   return out->Cs;
@@ -259,48 +306,30 @@ Color PathtracingShader::integrate_refract(const TraceContext &cxt,
 Color PathtracingShader::direct_lighting(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const
 {
-  // allocate samples
-  LightSample *samples = SlNewLightSamples(&in);
-  const Vector D = Normalize(samples[0].P - in.P);
-  // free samples
-  SlFreeLightSamples(samples);
-  //----------------------------------------------------------
-
-  const Real Kd = Dot(in.N, D);
-
-  Color4 C_diff;
-  Real t_hit = REAL_MAX;
-  const TraceContext refl_cxt = SlDiffuseContext(&cxt, in.shaded_object);
-
-  SlTrace(&refl_cxt, &in.P, &D, .001, 1000, &C_diff, &t_hit);
-
-  out->Cs = in.Cd * Kd * diffuse * ToColor(C_diff);
-  out->Os = 1.0;
-
-  return out->Cs;
-#if 0
   Vector Nf;
   SlFaceforward(&in.I, &in.N, &Nf);
 
-  // allocate samples
-  LightSample *samples = SlNewLightSamples(&in);
-  const int nsamples = SlGetLightSampleCount(&in);
-
   Color C_direct;
-  for (int i = 0; i < nsamples; i++) {
-    LightOutput Lout;
-    SlIlluminance(&cxt, &samples[i], &in.P, &Nf, PI / 2., &in, &Lout);
+  const int nlights = SlGetLightSelectionCount(&cxt, &in);
 
-    const float Ks = SlPhong(&in.I, &Nf, &Lout.Ln, .05) * 0;
-    const float Kd = Max(0, Dot(Nf, Lout.Ln));
+  for (int j = 0; j < nlights; j++) {
+    int nsamples = 0;
+    const LightSample *samples = SlGetLightSamples(&cxt, &in, j, &nsamples);
+    LightOutput *Louts = SlGetScratchArena(&cxt).NewArray<LightOutput>(nsamples);
+    SlIlluminanceList(&cxt, samples, nsamples, &in.P, &Nf, PI / 2., &in, Louts);
 
-    C_direct += in.Cd * Kd * diffuse * Lout.Cl + Ks * specular * Lout.Cl;
+    for (int i = 0; i < nsamples; i++) {
+      const LightOutput &Lout = Louts[i];
+
+      const Real Kd = Max(0, Dot(Nf, Lout.Ln));
+      C_direct += in.Cd * Kd * diffuse * Lout.Cl;
+    }
   }
-  // free samples
-  SlFreeLightSamples(samples);
 
-  return C_direct;
-#endif
+  out->Cs = C_direct;
+  out->Os = 1.0;
+
+  return out->Cs;
 }
 
 static int set_emission(void *self, const PropertyValue &value)
@@ -500,3 +529,8 @@ Vector RefractionDir(const Vector &I, const Vector &N, Real ior,
   return Normalize(eta * I + ncoeff * Nf);
 }
 #endif
+
+static Real max_component(const Color &color)
+{
+  return Max(Max(color.r, color.g), color.b);
+}
@@ -2,12 +2,21 @@
 // See LICENSE and README
 
 #include "fj_shader.h"
+#include "fj_memory_arena.h"
 
 using namespace fj;
 
+// properties compiled out of evaluate when not used
+enum {
+  FEATURE_DIFFUSE_MAP = 1 << 0,
+  FEATURE_BUMP_MAP    = 1 << 1,
+  FEATURE_REFLECT     = 1 << 2,
+  FEATURE_COUNT       = 1 << 3
+};
+
 class PlasticShader : public Shader {
 public:
-  PlasticShader() {}
+  PlasticShader() : evaluate_func_(NULL), evaluate_batch_func_(NULL) {}
   virtual ~PlasticShader() {}
 
 public:
@@ -30,6 +39,34 @@ public:
 private:
   virtual void evaluate(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
+  virtual bool is_opaque() const { return opacity >= 1; }
+  virtual float evaluate_opacity(const TraceContext &cxt, const SurfaceInput &in) const
+  {
+    return opacity;
+  }
+  virtual void evaluate_batch(const TraceContext *cxts, const SurfaceInput *in, int count,
+      SurfaceOutput *out) const;
+  virtual void compile();
+
+  template <int FEATURES>
+  void evaluate_features(const TraceContext &cxt,
+      const SurfaceInput &in, SurfaceOutput *out) const;
+  template <int FEATURES>
+  void evaluate_batch_features(const TraceContext *cxts, const SurfaceInput *in,
+      int count, SurfaceOutput *out) const;
+  template <int FEATURES>
+  void shading_normal(const SurfaceInput &in, Vector *Nf) const;
+  template <int FEATURES>
+  void shade(const TraceContext &cxt, const SurfaceInput &in,
+      const Vector &Nf, const Color4 &diff_map, SurfaceOutput *out) const;
+
+  typedef void (PlasticShader::*EvaluateFunction)(const TraceContext &cxt,
+      const SurfaceInput &in, SurfaceOutput *out) const;
+  typedef void (PlasticShader::*EvaluateBatchFunction)(const TraceContext *cxts,
+      const SurfaceInput *in, int count, SurfaceOutput *out) const;
+
+  EvaluateFunction evaluate_func_;
+  EvaluateBatchFunction evaluate_batch_func_;
 };
 
 static void *MyCreateFunction(void);
@@ -85,6 +122,7 @@ static void *MyCreateFunction(void)
 {
   PlasticShader *plastic = new PlasticShader();
   PropSetAllDefaultValues(plastic, MyPropertyList);
+  plastic->Compile();
 
   return plastic;
 }
@@ -101,53 +139,162 @@ static void MyDeleteFunction(void *self)
 void PlasticShader::evaluate(const TraceContext &cxt,
     const SurfaceInput &in, SurfaceOutput *out) const
 {
-  Color diff;
-  Color spec;
+  (this->*evaluate_func_)(cxt, in, out);
+}
+
+void PlasticShader::evaluate_batch(const TraceContext *cxts, const SurfaceInput *in,
+    int count, SurfaceOutput *out) const
+{
+  (this->*evaluate_batch_func_)(cxts, in, count, out);
+}
+
+void PlasticShader::compile()
+{
+  // one instance of evaluate for each combination of features
+  static const EvaluateFunction funcs[FEATURE_COUNT] = {
+    &PlasticShader::evaluate_features<0>,
+    &PlasticShader::evaluate_features<1>,
+    &PlasticShader::evaluate_features<2>,
+    &PlasticShader::evaluate_features<3>,
+    &PlasticShader::evaluate_features<4>,
+    &PlasticShader::evaluate_features<5>,
+    &PlasticShader::evaluate_features<6>,
+    &PlasticShader::evaluate_features<7>
+  };
+  static const EvaluateBatchFunction batch_funcs[FEATURE_COUNT] = {
+    &PlasticShader::evaluate_batch_features<0>,
+    &PlasticShader::evaluate_batch_features<1>,
+    &PlasticShader::evaluate_batch_features<2>,
+    &PlasticShader::evaluate_batch_features<3>,
+    &PlasticShader::evaluate_batch_features<4>,
+    &PlasticShader::evaluate_batch_features<5>,
+    &PlasticShader::evaluate_batch_features<6>,
+    &PlasticShader::evaluate_batch_features<7>
+  };
+  int features = 0;
+
+  if (diffuse_map != NULL) {
+    features |= FEATURE_DIFFUSE_MAP;
+  }
+  if (bump_map != NULL) {
+    features |= FEATURE_BUMP_MAP;
+  }
+  if (do_reflect) {
+    features |= FEATURE_REFLECT;
+  }
+
+  evaluate_func_ = funcs[features];
+  evaluate_batch_func_ = batch_funcs[features];
+}
+
+template <int FEATURES>
+void PlasticShader::evaluate_features(const TraceContext &cxt,
+    const SurfaceInput &in, SurfaceOutput *out) const
+{
   Color4 diff_map(1, 1, 1, 1);
   Vector Nf;
-  int i = 0;
 
-  LightSample *samples = NULL;
-  const int nsamples = SlGetLightSampleCount(&in);
+  shading_normal<FEATURES>(in, &Nf);
 
-  SlFaceforward(&in.I, &in.N, &Nf);
+  // diffuse map
+  if (FEATURES & FEATURE_DIFFUSE_MAP) {
+    diff_map = diffuse_map->Lookup(in.uv.u, in.uv.v, in.du, in.dv);
+  }
+
+  shade<FEATURES>(cxt, in, Nf, diff_map, out);
+}
+
+template <int FEATURES>
+void PlasticShader::evaluate_batch_features(const TraceContext *cxts, const SurfaceInput *in,
+    int count, SurfaceOutput *out) const
+{
+  Color4 diff_map[SHADE_BATCH_SIZE];
+  Vector Nf[SHADE_BATCH_SIZE];
+
+  // tiles of all points are in flight while the first ones are shaded
+  if (FEATURES & FEATURE_BUMP_MAP) {
+    for (int i = 0; i < count; i++) {
+      bump_map->Prefetch(in[i].uv.u, in[i].uv.v, in[i].du, in[i].dv);
+    }
+  }
+  if (FEATURES & FEATURE_DIFFUSE_MAP) {
+    for (int i = 0; i < count; i++) {
+      diffuse_map->Prefetch(in[i].uv.u, in[i].uv.v, in[i].du, in[i].dv);
+    }
+  }
+
+  // normals and texture lookups of all points before lights
+  for (int i = 0; i < count; i++) {
+    shading_normal<FEATURES>(in[i], &Nf[i]);
+  }
+  if (FEATURES & FEATURE_DIFFUSE_MAP) {
+    for (int i = 0; i < count; i++) {
+      diff_map[i] = diffuse_map->Lookup(in[i].uv.u, in[i].uv.v, in[i].du, in[i].dv);
+    }
+  } else {
+    for (int i = 0; i < count; i++) {
+      diff_map[i] = Color4(1, 1, 1, 1);
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    shade<FEATURES>(cxts[i], in[i], Nf[i], diff_map[i], &out[i]);
+  }
+}
+
+template <int FEATURES>
+void PlasticShader::shading_normal(const SurfaceInput &in, Vector *Nf) const
+{
+  SlFaceforward(&in.I, &in.N, Nf);
 
   // bump map
-  if (bump_map != NULL) {
+  if (FEATURES & FEATURE_BUMP_MAP) {
     Vector N_bump;
     SlBumpMapping(bump_map,
         &in.dPdu, &in.dPdv,
-        &in.uv, bump_amplitude,
-        &Nf, &N_bump);
-    Nf = N_bump;
+        &in.uv, in.du, in.dv, bump_amplitude,
+        Nf, &N_bump);
+    *Nf = N_bump;
   }
+}
+
+template <int FEATURES>
+void PlasticShader::shade(const TraceContext &cxt, const SurfaceInput &in,
+    const Vector &Nf, const Color4 &diff_map, SurfaceOutput *out) const
+{
+  Color diff;
+  Color spec;
+  int i = 0;
+
+  const int nlights = SlGetLightSelectionCount(&cxt, &in);
 
-  // allocate samples
-  samples = SlNewLightSamples(&in);
+  for (int j = 0; j < nlights; j++) {
+    int nsamples = 0;
+    const LightSample *samples = SlGetLightSamples(&cxt, &in, j, &nsamples);
+    LightOutput *Louts = SlGetScratchArena(&cxt).NewArray<LightOutput>(nsamples);
+    SlIlluminanceList(&cxt, samples, nsamples, &in.P, &Nf, PI / 2., &in, Louts);
 
-  for (i = 0; i < nsamples; i++) {
-    LightOutput Lout;
-    float Kd = 0;
-    SlIlluminance(&cxt, &samples[i], &in.P, &Nf, PI / 2., &in, &Lout);
-    // spec
+    for (i = 0; i < nsamples; i++) {
+      const LightOutput &Lout = Louts[i];
+      float Kd = 0;
+      // spec
 #if 0
-    Ks = SlPhong(in.I, Nf, Ln, .05);
+      Ks = SlPhong(in.I, Nf, Ln, .05);
 #endif
 
-    // diff
-    Kd = Dot(Nf, Lout.Ln);
-    Kd = Max(0, Kd);
-    diff.r += Kd * Lout.Cl.r;
-    diff.g += Kd * Lout.Cl.g;
-    diff.b += Kd * Lout.Cl.b;
+      // diff
+      Kd = Dot(Nf, Lout.Ln);
+      Kd = Max(0, Kd);
+      diff.r += Kd * Lout.Cl.r;
+      diff.g += Kd * Lout.Cl.g;
+      diff.b += Kd * Lout.Cl.b;
+    }
   }
 
-  // free samples
-  SlFreeLightSamples(samples);
-
-  // diffuse map
-  if (diffuse_map != NULL) {
-    diff_map = diffuse_map->Lookup(in.uv.u, in.uv.v);
+  // caustics
+  Color caustics;
+  if (SlLookupCaustics(&cxt, &in.P, &Nf, &caustics)) {
+    diff += caustics;
   }
 
   // Cs
@@ -155,23 +302,31 @@ void PlasticShader::evaluate(const TraceContext &cxt,
   out->Cs.g = diff.g * diffuse.g * diff_map.g + spec.g;
   out->Cs.b = diff.b * diffuse.b * diff_map.b + spec.b;
 
+  // aovs
+  out->albedo.r = diffuse.r * diff_map.r;
+  out->albedo.g = diffuse.g * diff_map.g;
+  out->albedo.b = diffuse.b * diff_map.b;
+  out->direct = out->Cs;
+
   // reflect
-  if (do_reflect) {
+  if (FEATURES & FEATURE_REFLECT) {
     Color4 C_refl;
     Vector R;
     double t_hit = REAL_MAX;
-    double Kr = 0;
+    const double Kr = SlFresnel(&in.I, &Nf, 1/ior);
 
-    const TraceContext refl_cxt = SlReflectContext(&cxt, in.shaded_object);
+    TraceContext refl_cxt = SlReflectContext(&cxt, in.shaded_object);
+    const float Wr = SlWeightRay(&refl_cxt, Kr * reflect);
 
-    SlReflect(&in.I, &Nf, &R);
-    R = Normalize(R);
-    SlTrace(&refl_cxt, &in.P, &R, .001, 1000, &C_refl, &t_hit);
+    if (Wr > 0) {
+      SlReflect(&in.I, &Nf, &R);
+      R = Normalize(R);
+      SlTrace(&refl_cxt, &in.P, &R, .001, 1000, &C_refl, &t_hit);
 
-    Kr = SlFresnel(&in.I, &Nf, 1/ior);
-    out->Cs.r += Kr * C_refl.r * reflect.r;
-    out->Cs.g += Kr * C_refl.g * reflect.g;
-    out->Cs.b += Kr * C_refl.b * reflect.b;
+      out->Cs.r += Wr * Kr * C_refl.r * reflect.r;
+      out->Cs.g += Wr * Kr * C_refl.g * reflect.g;
+      out->Cs.b += Wr * Kr * C_refl.b * reflect.b;
+    }
   }
 
   out->Os = 1;
@@ -2,6 +2,11 @@
 // See LICENSE and README
 
 #include "fj_shader.h"
+#include "fj_irradiance_octree.h"
+#include "fj_box.h"
+#include <memory>
+#include <mutex>
+#include <map>
 
 #define COPY3(dst,src) do { \
   (dst)[0] = (src)[0]; \
@@ -13,7 +18,7 @@ using namespace fj;
 
 class SSSShader : public Shader {
 public:
-  SSSShader() {}
+  SSSShader() : octree_mutex_(), octrees_() {}
   virtual ~SSSShader() {}
 
 public:
@@ -34,8 +39,6 @@ public:
   int enable_single_scattering;
   int enable_multiple_scattering;
 
-  XorShift rng;
-
   float scattering_coeff[3];
   float absorption_coeff[3];
   float extinction_coeff[3];
@@ -47,6 +50,9 @@ public:
   int single_scattering_samples;
   int multiple_scattering_samples;
 
+  int point_based_scattering;
+  int irradiance_point_count;
+
   float reduced_scattering_coeff[3];
   float reduced_extinction_coeff[3];
   float effective_extinction_coeff[3];
@@ -57,13 +63,32 @@ public:
 private:
   virtual void evaluate(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
+  virtual bool is_opaque() const { return opacity >= 1; }
+  virtual float evaluate_opacity(const TraceContext &cxt, const SurfaceInput &in) const
+  {
+    return opacity;
+  }
 
   Color single_scattering(const TraceContext &cxt, const SurfaceInput &in,
       const LightSample &light_sample) const;
   Color diffusion_scattering(const TraceContext &cxt, const SurfaceInput &in,
       const LightSample &light_sample) const;
+
+  // multiple scattering of all lights from irradiance points of the object
+  Color point_based_diffusion(const TraceContext &cxt, const SurfaceInput &in) const;
+  // built when the object is shaded first and kept until the shader is deleted
+  const IrradianceOctree *get_irradiance_octree(const TraceContext &cxt,
+      const SurfaceInput &in) const;
+
+  mutable std::mutex octree_mutex_;
+  mutable std::map<const ObjectInstance *, std::unique_ptr<IrradianceOctree>> octrees_;
 };
 
+// nodes of the octree seen at less than this solid angle are not opened
+static const Real MAX_SOLID_ANGLE = .3;
+// hits on the surface per random line beyond this are ignored
+static const int MAX_LINE_HITS = 64;
+
 static void *MyCreateFunction(void);
 static void MyDeleteFunction(void *self);
 static const char MyPluginName[] = "SSSShader";
@@ -86,6 +111,12 @@ static int set_absorption_coeff(void *self, const PropertyValue &value);
 static int set_scattering_phase(void *self, const PropertyValue &value);
 static int set_single_scattering_intensity(void *self, const PropertyValue &value);
 static int set_multiple_scattering_intensity(void *self, const PropertyValue &value);
+static int set_point_based_scattering(void *self, const PropertyValue &value);
+static int set_irradiance_point_count(void *self, const PropertyValue &value);
+
+static void distribute_irradiance_points(const TraceContext &cxt, const SurfaceInput &in,
+    int point_count, std::vector<IrradiancePoint> *points);
+static Color dipole_diffusion(void *data, Real distance_sq);
 
 static const Property MyPropertyList[] = {
   Property("diffuse",     PropVector3(.8, .8, .8), set_diffuse),
@@ -105,6 +136,13 @@ static const Property MyPropertyList[] = {
   Property("scattering_phase",       PropScalar(0), set_scattering_phase),
   Property("single_scattering_intensity",   PropScalar(1), set_single_scattering_intensity),
   Property("multiple_scattering_intensity", PropScalar(.02), set_multiple_scattering_intensity),
+  // point-based scattering sums the normalized dipole over the object. it is
+  // far darker than the brute-force path, whose samples mostly shade the
+  // point itself and are not normalized. about 1/70 on a cube of 2 units
+  // with the default coefficients. raise multiple_scattering_intensity to
+  // match
+  Property("point_based_scattering",        PropScalar(0), set_point_based_scattering),
+  Property("irradiance_point_count",        PropScalar(100000), set_irradiance_point_count),
   Property()
 };
 
@@ -151,41 +189,44 @@ void SSSShader::evaluate(const TraceContext &cxt,
   Color diff;
   Color spec;
 
-  LightSample *samples = NULL;
-  const int nsamples = SlGetLightSampleCount(&in);
+  const int nlights = SlGetLightSelectionCount(&cxt, &in);
 
-  // allocate samples
-  samples = SlNewLightSamples(&in);
+  for (int j = 0; j < nlights; j++) {
+    int nsamples = 0;
+    const LightSample *samples = SlGetLightSamples(&cxt, &in, j, &nsamples);
 
-  for (int i = 0; i < nsamples; i++) {
-    LightOutput Lout;
+    for (int i = 0; i < nsamples; i++) {
+      LightOutput Lout;
 
-    Color single_scatter;
-    Color diffusion_scatter;
+      Color single_scatter;
+      Color diffusion_scatter;
 
-    SlIlluminance(&cxt, &samples[i], &in.P, &in.N, PI / 2.0, &in, &Lout);
-    // spec
-    const float Ks = SlPhong(&in.I, &in.N, &Lout.Ln, roughness);
-    spec += Ks * specular;
+      SlIlluminance(&cxt, &samples[i], &in.P, &in.N, PI / 2.0, &in, &Lout);
+      // spec
+      const float Ks = SlPhong(&in.I, &in.N, &Lout.Ln, roughness);
+      spec += Ks * specular;
 
-    if (enable_single_scattering) {
-      single_scatter += single_scattering(cxt, in, samples[i]);
-      single_scatter *= single_scattering_intensity;
-      diff += single_scatter;
-    }
-    if (enable_multiple_scattering) {
-      diffusion_scatter += diffusion_scattering(cxt, in, samples[i]);
-      diffusion_scatter *= multiple_scattering_intensity;
-      diff += diffusion_scatter;
+      if (enable_single_scattering) {
+        single_scatter += single_scattering(cxt, in, samples[i]);
+        single_scatter *= single_scattering_intensity;
+        diff += single_scatter;
+      }
+      if (enable_multiple_scattering && !point_based_scattering) {
+        diffusion_scatter += diffusion_scattering(cxt, in, samples[i]);
+        diffusion_scatter *= multiple_scattering_intensity;
+        diff += diffusion_scatter;
+      }
     }
   }
 
-  SlFreeLightSamples(samples);
+  if (enable_multiple_scattering && point_based_scattering) {
+    diff += point_based_diffusion(cxt, in) * multiple_scattering_intensity;
+  }
 
   // diffuse map
   Color4 diff_map4(1, 1, 1, 1);
   if (diffuse_map != NULL) {
-    diff_map4 = diffuse_map->Lookup(in.uv.u, in.uv.v);
+    diff_map4 = diffuse_map->Lookup(in.uv.u, in.uv.v, in.du, in.dv);
   }
   const Color diff_map = ToColor(diff_map4);
 
@@ -251,8 +292,8 @@ Color SSSShader::single_scattering(const TraceContext &cxt, const SurfaceInput &
   To = Normalize(To);
 
   for (i = 0; i < nsamples; i++) {
-    XorShift &mutable_rng = const_cast<XorShift &>(rng);
-    const float sp_dist = -log(mutable_rng.NextFloat01());
+    XorShift &rng = SlGetRandom(&cxt);
+    const float sp_dist = -Log(rng.NextFloat01());
 
     for (j = 0; j < 3; j++) {
       Vector P_sample;
@@ -303,7 +344,7 @@ Color SSSShader::single_scattering(const TraceContext &cxt, const SurfaceInput &
       Kti = 1 - Kri;
 
       Ti_dot_To = Dot(Ti, To);
-      phase = (1 - g_sq) / pow(1 + 2 * g * Ti_dot_To + g_sq, 1.5);
+      phase = (1 - g_sq) / Pow(1 + 2 * g * Ti_dot_To + g_sq, 1.5);
 
       Ni_dot_To = Dot(Ni, To);
       Ni_dot_Ti = Dot(Ni, Ti);
@@ -315,13 +356,13 @@ Color SSSShader::single_scattering(const TraceContext &cxt, const SurfaceInput &
 
       switch (j) {
       case 0:
-        scatter.r += Lout.Cl.r * exp(-sp_i * sigma_t[0]) / sigma_tc * phase * Kti;
+        scatter.r += Lout.Cl.r * Exp(-sp_i * sigma_t[0]) / sigma_tc * phase * Kti;
         break;
       case 1:
-        scatter.g += Lout.Cl.g * exp(-sp_i * sigma_t[1]) / sigma_tc * phase * Kti;
+        scatter.g += Lout.Cl.g * Exp(-sp_i * sigma_t[1]) / sigma_tc * phase * Kti;
         break;
       case 2:
-        scatter.b += Lout.Cl.b * exp(-sp_i * sigma_t[2]) / sigma_tc * phase * Kti;
+        scatter.b += Lout.Cl.b * Exp(-sp_i * sigma_t[2]) / sigma_tc * phase * Kti;
         break;
       default:
         break;
@@ -386,8 +427,8 @@ Color SSSShader::diffusion_scattering(const TraceContext &cxt, const SurfaceInpu
   base2 = Cross(N, base1);
 
   for (i = 0; i < nsamples; i++) {
-    XorShift &mutable_rng = const_cast<XorShift &>(rng);
-    const double dist_rand = -log(mutable_rng.NextFloat01());
+    XorShift &rng = SlGetRandom(&cxt);
+    const double dist_rand = -Log(rng.NextFloat01());
 
     for (j = 0; j < 3; j++) {
       const TraceContext self_cxt = SlSelfHitContext(&cxt, in.shaded_object);
@@ -415,7 +456,7 @@ Color SSSShader::diffusion_scattering(const TraceContext &cxt, const SurfaceInpu
 
       const double dist = dist_rand / sigma_tr[j];
 
-      disk = mutable_rng.HollowDiskRand();
+      disk = rng.HollowDiskRand();
       disk.x *= dist;
       disk.y *= dist;
       P_sample.x = P.x + 1/sigma_tr[j] * (disk.x * base1.x + disk.y * base2.x);
@@ -446,13 +487,13 @@ Color SSSShader::diffusion_scattering(const TraceContext &cxt, const SurfaceInpu
       dv = sqrt(r * r + zv * zv); // distance to negative light
       sigma_tr_dr = sigma_tr[j] * dr;
       sigma_tr_dv = sigma_tr[j] * dv;
-      Rd = (sigma_tr_dr + 1) * exp(-sigma_tr_dr) * zr / pow(dr, 3) +
-         (sigma_tr_dv + 1) * exp(-sigma_tr_dv) * zr / pow(dv, 3);
+      Rd = (sigma_tr_dr + 1) * Exp(-sigma_tr_dr) * zr / (dr * dr * dr) +
+         (sigma_tr_dv + 1) * Exp(-sigma_tr_dv) * zr / (dv * dv * dv);
 
       Ln_dot_Ni = Dot(Ln, Ni);
       Ln_dot_Ni = Max(0, Ln_dot_Ni);
 
-      scat = sigma_tr[j] * sigma_tr[j] * exp(-sigma_tr[j] * r);
+      scat = sigma_tr[j] * sigma_tr[j] * Exp(-sigma_tr[j] * r);
       if (scat != 0) {
         switch (j) {
         case 0:
@@ -480,6 +521,155 @@ Color SSSShader::diffusion_scattering(const TraceContext &cxt, const SurfaceInpu
   return scatter;
 }
 
+class DipoleProfile {
+public:
+  float sigma_tr[3];
+  float alpha_prime[3];
+  float zr[3];
+  float zv[3];
+};
+
+Color SSSShader::point_based_diffusion(const TraceContext &cxt, const SurfaceInput &in) const
+{
+  const IrradianceOctree *octree = get_irradiance_octree(cxt, in);
+  if (octree == NULL || octree->IsEmpty()) {
+    return Color();
+  }
+
+  // Jensen et al. 2001
+  const float Fdr = diffuse_fresnel_reflectance;
+  const float A = (1 + Fdr) / (1 - Fdr);
+  DipoleProfile profile;
+  for (int i = 0; i < 3; i++) {
+    profile.sigma_tr[i] = effective_extinction_coeff[i];
+    profile.alpha_prime[i] = reduced_scattering_coeff[i] / reduced_extinction_coeff[i];
+    profile.zr[i] = 1 / reduced_extinction_coeff[i];
+    profile.zv[i] = profile.zr[i] * (1 + 4./3 * A);
+  }
+
+  const Color Mo = octree->Evaluate(in.P, MAX_SOLID_ANGLE, dipole_diffusion, &profile);
+  const Real Kt = 1 - SlFresnel(&in.I, &in.N, 1/ior);
+
+  return Kt / PI * Mo;
+}
+
+const IrradianceOctree *SSSShader::get_irradiance_octree(const TraceContext &cxt,
+    const SurfaceInput &in) const
+{
+  std::lock_guard<std::mutex> lock(octree_mutex_);
+
+  std::unique_ptr<IrradianceOctree> &octree = octrees_[in.shaded_object];
+  if (octree == NULL) {
+    std::vector<IrradiancePoint> points;
+    distribute_irradiance_points(cxt, in, irradiance_point_count, &points);
+
+    octree.reset(new IrradianceOctree());
+    octree->Build(points);
+  }
+
+  return octree.get();
+}
+
+static void distribute_irradiance_points(const TraceContext &cxt, const SurfaceInput &in,
+    int point_count, std::vector<IrradiancePoint> *points)
+{
+  const TraceContext self_cxt = SlSelfHitContext(&cxt, in.shaded_object);
+  // irradiance is of lights seen from the surface whatever ray hit it first
+  TraceContext light_cxt = cxt;
+  light_cxt.ray_context = CXT_CAMERA_RAY;
+
+  Box bounds;
+  SlGetSurfaceBounds(&self_cxt, &bounds);
+  const Vector center = bounds.Centroid();
+  const Real radius = .5 * Length(bounds.Diagonal()) * 1.01;
+  if (radius <= 0) {
+    return;
+  }
+
+  // isotropic random lines through the bounding sphere hit the surface
+  // uniformly. by Crofton's formula each hit stands for the area of
+  // half the sphere surface divided by the line count
+  XorShift rng;
+  int line_count = 0;
+  points->clear();
+
+  while (static_cast<int>(points->size()) < point_count) {
+    const Vector D = rng.HollowSphereRand();
+    Vector u, v;
+    u = Abs(D.x) > .9 ? Vector(0, 1, 0) : Vector(1, 0, 0);
+    u = Normalize(Cross(u, D));
+    v = Cross(D, u);
+    const Vector2 disk = rng.SolidDiskRand();
+    Vector orig = center + radius * (disk.x * u + disk.y * v - D);
+    line_count++;
+
+    // all hits along the line
+    Real t_left = 2 * radius;
+    for (int i = 0; i < MAX_LINE_HITS; i++) {
+      Vector P_hit, N_hit;
+      double t_hit = REAL_MAX;
+      if (!SlSurfaceRayIntersect(&self_cxt, &orig, &D, 1e-6, t_left, &P_hit, &N_hit, &t_hit)) {
+        break;
+      }
+      IrradiancePoint point;
+      point.P = P_hit;
+      point.N = Normalize(N_hit);
+      points->push_back(point);
+
+      orig = P_hit;
+      t_left -= t_hit;
+    }
+
+    // gives up on objects the lines hardly hit
+    if (points->empty() && line_count > point_count) {
+      return;
+    }
+  }
+
+  const Real area = 2 * PI * radius * radius / line_count;
+
+  for (std::size_t i = 0; i < points->size(); i++) {
+    IrradiancePoint &point = (*points)[i];
+    SurfaceInput point_in = in;
+    point_in.P = point.P;
+    point_in.N = point.N;
+    point_in.Ng = point.N;
+
+    const int nlights = SlGetLightSelectionCount(&light_cxt, &point_in);
+    for (int j = 0; j < nlights; j++) {
+      int nsamples = 0;
+      const LightSample *samples = SlGetLightSamples(&light_cxt, &point_in, j, &nsamples);
+
+      for (int k = 0; k < nsamples; k++) {
+        LightOutput Lout;
+        SlIlluminance(&light_cxt, &samples[k], &point.P, &point.N, PI / 2., &point_in, &Lout);
+        point.E += Lout.Cl * Max(0, Dot(point.N, Lout.Ln));
+      }
+    }
+    point.area = area;
+  }
+}
+
+static Color dipole_diffusion(void *data, Real distance_sq)
+{
+  const DipoleProfile *profile = (const DipoleProfile *) data;
+  Color Rd;
+
+  for (int i = 0; i < 3; i++) {
+    const Real sigma_tr = profile->sigma_tr[i];
+    const Real zr = profile->zr[i];
+    const Real zv = profile->zv[i];
+    const Real dr = sqrt(distance_sq + zr * zr);
+    const Real dv = sqrt(distance_sq + zv * zv);
+
+    Rd[i] = profile->alpha_prime[i] / (4 * PI) * (
+        zr * (sigma_tr * dr + 1) * Exp(-sigma_tr * dr) / (dr * dr * dr) +
+        zv * (sigma_tr * dv + 1) * Exp(-sigma_tr * dv) / (dv * dv * dv));
+  }
+
+  return Rd;
+}
+
 void SSSShader::UpdateProperties()
 {
   const float eta = ior;
@@ -728,3 +918,25 @@ static int set_multiple_scattering_intensity(void *self, const PropertyValue &va
 
   return 0;
 }
+
+static int set_point_based_scattering(void *self, const PropertyValue &value)
+{
+  SSSShader *sss = (SSSShader *) self;
+  const int enable = (int) value.vector[0] == 0 ? 0 : 1;
+
+  sss->point_based_scattering = enable;
+
+  return 0;
+}
+
+static int set_irradiance_point_count(void *self, const PropertyValue &value)
+{
+  SSSShader *sss = (SSSShader *) self;
+  int count = (int) value.vector[0];
+
+  count = Max(1, count);
+
+  sss->irradiance_point_count = count;
+
+  return 0;
+}
@@ -7,15 +7,21 @@ using namespace fj;
 
 class VolumeShader : public Shader {
 public:
-  VolumeShader() {}
+  VolumeShader() : secondary_density_only(false) {}
   virtual ~VolumeShader() {}
 
 public:
   Color diffuse;
+  // diffuse, reflect and refract rays are only absorbed without lighting
+  bool secondary_density_only;
 
 private:
   virtual void evaluate(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const;
+  virtual bool is_density_only(int ray_context) const
+  {
+    return secondary_density_only && ray_context != CXT_CAMERA_RAY;
+  }
 };
 
 static void *MyCreateFunction(void);
@@ -23,9 +29,11 @@ static void MyDeleteFunction(void *self);
 static const char MyPluginName[] = "VolumeShader";
 
 static int set_diffuse(void *self, const PropertyValue &value);
+static int set_secondary_density_only(void *self, const PropertyValue &value);
 
 static const Property MyPropertyList[] = {
   Property("diffuse", PropVector3(1, 1, 1), set_diffuse),
+  Property("secondary_density_only", PropScalar(0), set_secondary_density_only),
   Property()
 };
 
@@ -71,23 +79,22 @@ void VolumeShader::evaluate(const TraceContext &cxt,
 {
   Color diff;
 
-  LightSample *samples = NULL;
-  const int nsamples = SlGetLightSampleCount(&in);
+  const int nlights = SlGetLightSelectionCount(&cxt, &in);
 
-  // allocate samples
-  samples = SlNewLightSamples(&in);
+  for (int j = 0; j < nlights; j++) {
+    int nsamples = 0;
+    const LightSample *samples = SlGetLightSamples(&cxt, &in, j, &nsamples);
 
-  for (int i = 0; i < nsamples; i++) {
-    LightOutput Lout;
+    for (int i = 0; i < nsamples; i++) {
+      LightOutput Lout;
 
-    SlIlluminance(&cxt, &samples[i], &in.P, &in.N, PI, &in, &Lout);
+      SlIlluminance(&cxt, &samples[i], &in.P, &in.N, PI, &in, &Lout);
 
-    // diff
-    diff += Lout.Cl;
+      // diff
+      diff += Lout.Cl;
+    }
   }
 
-  SlFreeLightSamples(samples);
-
   // Cs
   out->Cs = diff * diffuse;
 
@@ -107,3 +114,12 @@ static int set_diffuse(void *self, const PropertyValue &value)
 
   return 0;
 }
+
+static int set_secondary_density_only(void *self, const PropertyValue &value)
+{
+  VolumeShader *volume = (VolumeShader *) self;
+
+  volume->secondary_density_only = (value.vector[0] != 0);
+
+  return 0;
+}
@@ -3,10 +3,15 @@
 
 #include "fj_accelerator.h"
 #include "fj_primitive_set.h"
-#include "fj_multi_thread.h"
+#include "fj_intersection.h"
+#include "fj_ray_stats.h"
+#include "fj_procedure.h"
 #include "fj_ray.h"
 
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <typeinfo>
 
 namespace fj {
 
@@ -27,10 +32,122 @@ private:
 
 static NullPrimitiveSet null_primset;
 
+class AcceleratorTypeName {
+public:
+  int type;
+  const char *name;
+};
+
+static const AcceleratorTypeName accelerator_type_names[] = {
+  {ACC_GRID, "grid"},
+  {ACC_BVH,  "bvh"},
+  {ACC_QBVH, "qbvh"},
+#if defined(FJ_EMBREE)
+  {ACC_EMBREE, "embree"},
+#endif
+  {-1, NULL}
+};
+
+int AccFindTypeByName(const char *name)
+{
+  if (name == NULL) {
+    return -1;
+  }
+
+  for (const AcceleratorTypeName *t = accelerator_type_names; t->name != NULL; t++) {
+    if (strcmp(t->name, name) == 0) {
+      return t->type;
+    }
+  }
+  return -1;
+}
+
 // for critical session
-static void build_accelerator_callback(void *data);
 
-Accelerator::Accelerator() : bounds_(), has_built_(false), primset_(NULL)
+AcceleratorStats::AcceleratorStats() :
+    sah_cost(0),
+    overlap_ratio(0),
+    interior_count(0),
+    leaf_count(0),
+    reference_count(0),
+    max_depth(0),
+    average_leaf_depth(0),
+    depth_histogram(),
+    leaf_size_histogram(),
+    area_sum_(0),
+    overlap_sum_(0),
+    leaf_depth_sum_(0)
+{
+}
+
+AcceleratorStats::~AcceleratorStats()
+{
+}
+
+void AcceleratorStats::AddInterior(int depth, const Box &bounds,
+    const Box *children, int child_count)
+{
+  const Real area = bounds.SurfaceArea();
+  area_sum_ += area;
+  interior_count++;
+  max_depth = std::max(max_depth, depth);
+
+  if (area <= 0) {
+    return;
+  }
+  Real overlap = 0;
+  for (int i = 0; i < child_count; i++) {
+    for (int j = i + 1; j < child_count; j++) {
+      Box shared = children[i];
+      shared.Clip(children[j]);
+      if (!shared.IsEmpty()) {
+        overlap += shared.SurfaceArea();
+      }
+    }
+  }
+  overlap_sum_ += overlap / area;
+}
+
+void AcceleratorStats::AddLeaf(int depth, const Box &bounds, int prim_count)
+{
+  area_sum_ += bounds.SurfaceArea() * prim_count;
+  leaf_count++;
+  reference_count += prim_count;
+  leaf_depth_sum_ += depth;
+  max_depth = std::max(max_depth, depth);
+
+  if (depth >= static_cast<int>(depth_histogram.size())) {
+    depth_histogram.resize(depth + 1, 0);
+  }
+  depth_histogram[depth]++;
+
+  int bin = 0;
+  while (bin < ACC_LEAF_SIZE_BIN_COUNT - 1 && AccGetLeafSizeBinStart(bin + 1) <= prim_count) {
+    bin++;
+  }
+  leaf_size_histogram[bin]++;
+}
+
+void AcceleratorStats::Finish(const Box &root_bounds)
+{
+  const Real root_area = root_bounds.SurfaceArea();
+  sah_cost = root_area > 0 ? area_sum_ / root_area : 0;
+  overlap_ratio = interior_count > 0 ? overlap_sum_ / interior_count : 0;
+  average_leaf_depth = leaf_count > 0 ?
+      static_cast<Real>(leaf_depth_sum_) / leaf_count : 0;
+}
+
+int AccGetLeafSizeBinStart(int bin)
+{
+  // 0, 1, 2, 3, 5, 9, 17, 33
+  return bin < 3 ? bin : (1 << (bin - 2)) + 1;
+}
+
+Accelerator::Accelerator() : bounds_(), has_built_(false), was_refit_(false),
+    built_change_count_(0),
+    primset_(NULL),
+    deferred_procedure_(NULL), deferred_bounds_(), is_deferred_(false),
+    expand_mutex_(), expand_failed_(false)
 {
   SetPrimitiveSet(NULL);
 }
@@ -54,6 +171,16 @@ const char *Accelerator::GetName() const
   return get_name();
 }
 
+bool Accelerator::HasSameSettings(const Accelerator &other) const
+{
+  return typeid(*this) == typeid(other) && has_same_settings(other);
+}
+
+std::size_t Accelerator::GetMemoryUsage() const
+{
+  return get_memory_usage();
+}
+
 bool Accelerator::HasBuilt() const
 {
   return has_built_;
@@ -61,7 +188,11 @@ bool Accelerator::HasBuilt() const
 
 void Accelerator::ComputeBounds()
 {
-  primset_->GetEntireBounds(&bounds_);
+  if (IsDeferred()) {
+    bounds_ = deferred_bounds_;
+  } else {
+    primset_->GetEntireBounds(&bounds_);
+  }
   bounds_.Expand(GetBoundsPadding());
 }
 
@@ -76,11 +207,19 @@ void Accelerator::SetPrimitiveSet(PrimitiveSet *primset)
   ComputeBounds();
 }
 
+PrimitiveSet *Accelerator::GetPrimitiveSet()
+{
+  return primset_;
+}
+
 int Accelerator::Build()
 {
   if (HasBuilt()) { 
     return -1;
   }
+  if (IsDeferred()) {
+    return 0;
+  }
 
   const int err = build();
   if (err) {
@@ -88,6 +227,101 @@ int Accelerator::Build()
   }
 
   has_built_ = true;
+  built_change_count_ = primset_->GetChangeCount();
+  return 0;
+}
+
+int Accelerator::Rebuild()
+{
+  has_built_ = false;
+  ComputeBounds();
+
+  return Build();
+}
+
+int Accelerator::Refit()
+{
+  if (!HasBuilt() || IsDeferred()) {
+    return -1;
+  }
+
+  ComputeBounds();
+  const int err = refit();
+  if (err) {
+    return -1;
+  }
+
+  built_change_count_ = primset_->GetChangeCount();
+  return 0;
+}
+
+int Accelerator::Update()
+{
+  if (IsUpToDate()) {
+    return 0;
+  }
+
+  // deformed geometry of the same topology only needs new bounds
+  was_refit_ = HasBuilt() && Refit() == 0;
+  if (was_refit_) {
+    return 0;
+  }
+  return HasBuilt() ? Rebuild() : Build();
+}
+
+bool Accelerator::IsUpToDate() const
+{
+  return HasBuilt() && built_change_count_ == primset_->GetChangeCount();
+}
+
+bool Accelerator::WasRefit() const
+{
+  return was_refit_;
+}
+
+void Accelerator::SetDeferredProcedure(const Procedure *procedure, const Box &bounds)
+{
+  deferred_procedure_ = procedure;
+  deferred_bounds_ = bounds;
+  is_deferred_ = procedure != NULL;
+  expand_failed_ = false;
+
+  ComputeBounds();
+}
+
+bool Accelerator::IsDeferred() const
+{
+  return is_deferred_.load(std::memory_order_acquire);
+}
+
+const Procedure *Accelerator::GetDeferredProcedure() const
+{
+  return deferred_procedure_;
+}
+
+const Box &Accelerator::GetDeferredBounds() const
+{
+  return deferred_bounds_;
+}
+
+int Accelerator::Expand()
+{
+  std::lock_guard<std::mutex> lock(expand_mutex_);
+  if (!IsDeferred() || expand_failed_) {
+    return -1;
+  }
+
+  // bounds stay the same while rendering since object groups are built on them.
+  // the flag is cleared only after the tree is built since rays check it
+  // without the lock
+  if (deferred_procedure_->Run() || build()) {
+    expand_failed_ = true;
+    return -1;
+  }
+
+  has_built_ = true;
+  built_change_count_ = primset_->GetChangeCount();
+  is_deferred_.store(false, std::memory_order_release);
   return 0;
 }
 
@@ -96,6 +330,8 @@ bool Accelerator::Intersect(const Ray &ray, Real time, Intersection *isect) cons
   Real boxhit_tmin = 0;
   Real boxhit_tmax = 0;
 
+  FJ_RAY_STATS_ADD(surface_query_count, 1);
+
   // check intersection with overall bounds
   const bool hit = BoxRayIntersect(bounds_, ray.orig, ray.dir, ray.tmin, ray.tmax,
         &boxhit_tmin, &boxhit_tmax);
@@ -104,22 +340,183 @@ bool Accelerator::Intersect(const Ray &ray, Real time, Intersection *isect) cons
     return false;
   }
 
-  if (0) {
-    // dynamic build is now disabled. build all accelerators before rendering
-    MtCriticalSection((void *) this, build_accelerator_callback);
+  if (!expand_deferred()) {
+    return false;
+  }
+
+  const bool found = intersect(ray, time, isect);
+  FJ_RAY_STATS_ADD(surface_hit_count, found);
+
+  if (found) {
+    primset_->ComputeHitAttributes(ray, time, isect);
   }
 
-  return intersect(ray, time, isect);
+  return found;
 }
 
-static void build_accelerator_callback(void *data)
+bool Accelerator::Occlude(const Ray &ray, Real time, Intersection *isect) const
 {
-  Accelerator *acc = reinterpret_cast<Accelerator *>(data);
+  Real boxhit_tmin = 0;
+  Real boxhit_tmax = 0;
+
+  FJ_RAY_STATS_ADD(surface_query_count, 1);
 
-  if (!acc->HasBuilt()) {
-    std::cout << "\nbuilding accelerator ... : " << acc->GetName() << std::endl;
-    acc->Build();
+  const bool hit = BoxRayIntersect(bounds_, ray.orig, ray.dir, ray.tmin, ray.tmax,
+        &boxhit_tmin, &boxhit_tmax);
+
+  if (!hit) {
+    return false;
   }
+
+  if (!expand_deferred()) {
+    return false;
+  }
+
+  const bool found = occlude(ray, time, isect);
+  FJ_RAY_STATS_ADD(surface_hit_count, found);
+
+  return found;
+}
+
+bool Accelerator::OccludePrimitive(Index prim_id, const Ray &ray, Real time,
+    Intersection *isect) const
+{
+  if (IsDeferred() || primset_ == NULL ||
+      prim_id < 0 || prim_id >= primset_->GetPrimitiveCount()) {
+    return false;
+  }
+
+  FJ_RAY_STATS_ADD(surface_primitive_test_count, 1);
+  return primset_->RayOcclude(prim_id, ray, time, isect) &&
+      RayInRange(ray, isect->t_hit);
+}
+
+bool Accelerator::ComputeHitAttributes(const Ray &ray, Real time,
+    Intersection *isect) const
+{
+  if (IsDeferred() || primset_ == NULL ||
+      isect->prim_id < 0 || isect->prim_id >= primset_->GetPrimitiveCount()) {
+    return false;
+  }
+
+  primset_->ComputeHitAttributes(ray, time, isect);
+  return true;
+}
+
+unsigned int Accelerator::IntersectPacket(const Ray *rays, const Real *times, int count,
+    Intersection *isects) const
+{
+  unsigned int ray_mask = 0;
+
+  FJ_RAY_STATS_ADD(surface_query_count, count);
+
+  for (int i = 0; i < count; i++) {
+    Real boxhit_tmin = 0;
+    Real boxhit_tmax = 0;
+    const bool hit = BoxRayIntersect(bounds_, rays[i].orig, rays[i].dir,
+        rays[i].tmin, rays[i].tmax, &boxhit_tmin, &boxhit_tmax);
+    if (hit) {
+      ray_mask |= 1U << i;
+    }
+  }
+
+  if (ray_mask == 0) {
+    return 0;
+  }
+
+  if (!expand_deferred()) {
+    return 0;
+  }
+
+  const unsigned int hit_mask = intersect_packet(rays, times, count, ray_mask, isects);
+  for (int i = 0; i < count; i++) {
+    FJ_RAY_STATS_ADD(surface_hit_count, (hit_mask >> i) & 1);
+    if (hit_mask & (1U << i)) {
+      primset_->ComputeHitAttributes(rays[i], times[i], &isects[i]);
+    }
+  }
+
+  return hit_mask;
+}
+
+bool Accelerator::IntersectAll(const Ray &ray, Real time, HitList *hits) const
+{
+  Real boxhit_tmin = 0;
+  Real boxhit_tmax = 0;
+
+  FJ_RAY_STATS_ADD(surface_query_count, 1);
+
+  const bool hit = BoxRayIntersect(bounds_, ray.orig, ray.dir, ray.tmin, ray.tmax,
+        &boxhit_tmin, &boxhit_tmax);
+
+  if (!hit) {
+    return false;
+  }
+
+  if (!expand_deferred()) {
+    return false;
+  }
+
+  const bool found = intersect_all(ray, time, hits);
+  FJ_RAY_STATS_ADD(surface_hit_count, found);
+
+  return found;
+}
+
+int Accelerator::Analyze(AcceleratorStats *stats) const
+{
+  *stats = AcceleratorStats();
+  if (!has_built_ || IsDeferred()) {
+    return -1;
+  }
+  return analyze(stats);
+}
+
+bool Accelerator::expand_deferred() const
+{
+  if (!IsDeferred()) {
+    return true;
+  }
+
+  // rays of other threads wait for the first one to expand it
+  const_cast<Accelerator *>(this)->Expand();
+  return !IsDeferred();
+}
+
+bool Accelerator::intersect_all(const Ray &ray, Real time, HitList *hits) const
+{
+  // a small step so that the same hit is not found again
+  const Real T_STEP = .0001;
+  Ray ray_tmp = ray;
+  bool found = false;
+
+  while (!hits->IsFull()) {
+    Intersection isect;
+    ray_tmp.tmax = Min(ray.tmax, hits->GetMaxDistance());
+    if (!intersect(ray_tmp, time, &isect)) {
+      break;
+    }
+    primset_->ComputeHitAttributes(ray, time, &isect);
+    hits->Add(isect);
+    found = true;
+    ray_tmp.tmin = isect.t_hit + T_STEP;
+  }
+
+  return found;
+}
+
+unsigned int Accelerator::intersect_packet(const Ray *rays, const Real *times, int count,
+    unsigned int ray_mask, Intersection *isects) const
+{
+  unsigned int hit_mask = 0;
+
+  for (int i = 0; i < count; i++) {
+    if ((ray_mask & (1U << i)) && intersect(rays[i], times[i], &isects[i])) {
+      hit_mask |= 1U << i;
+    }
+  }
+
+  return hit_mask;
 }
 
 } // namespace xxx
@@ -6,13 +6,72 @@
 
 #include "fj_types.h"
 #include "fj_box.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 namespace fj {
 
 class Intersection;
+class HitList;
 class PrimitiveSet;
+class Procedure;
 class Ray;
 
+enum AcceleratorType {
+  ACC_GRID = 0,
+  ACC_BVH,
+  ACC_QBVH,
+  // only with make EMBREE=1
+  ACC_EMBREE
+};
+
+// returns -1 if name is not a known accelerator type
+extern int AccFindTypeByName(const char *name);
+
+// the most rays intersected together by IntersectPacket. bit i of
+// a ray mask is for the ith ray of a packet
+const int RAY_PACKET_SIZE = 16;
+
+// leaves are counted by size in bins of 0, 1, 2, 3-4, 5-8, 9-16, 17-32
+// and more primitives
+const int ACC_LEAF_SIZE_BIN_COUNT = 8;
+
+// quality of a built tree. accelerators add their nodes from the root down
+class AcceleratorStats {
+public:
+  AcceleratorStats();
+  ~AcceleratorStats();
+
+  void AddInterior(int depth, const Box &bounds, const Box *children, int child_count);
+  void AddLeaf(int depth, const Box &bounds, int prim_count);
+  // divides the costs by the surface area of the root
+  void Finish(const Box &root_bounds);
+
+  // expected node visits and primitive tests of a ray hitting the root,
+  // the same cost the builders minimize
+  Real sah_cost;
+  // mean surface area of overlaps between siblings relative to their parent
+  Real overlap_ratio;
+  int64_t interior_count;
+  int64_t leaf_count;
+  // primitives in leaves. more than the primitive count after spatial splits
+  int64_t reference_count;
+  int max_depth;
+  Real average_leaf_depth;
+  // leaves at each depth
+  std::vector<int64_t> depth_histogram;
+  int64_t leaf_size_histogram[ACC_LEAF_SIZE_BIN_COUNT];
+
+private:
+  Real area_sum_;
+  Real overlap_sum_;
+  int64_t leaf_depth_sum_;
+};
+
+// returns the first leaf size of the bin
+extern int AccGetLeafSizeBinStart(int bin);
+
 class Accelerator {
 public:
   Accelerator();
@@ -21,23 +80,117 @@ public:
   Real GetBoundsPadding() const;
   const Box &GetBounds() const;
   const char *GetName() const;
+  // true if other is of the same type and set to build and traverse the
+  // same tree from the same primitives
+  bool HasSameSettings(const Accelerator &other) const;
   bool HasBuilt() const;
+  // bytes of the tree not including the primitive set
+  std::size_t GetMemoryUsage() const;
 
   void ComputeBounds();
   void SetPrimitiveSet(PrimitiveSet *primset);
+  PrimitiveSet *GetPrimitiveSet();
   int Build();
+  // builds again even if built before e.g. after primitive bounds changed
+  int Rebuild();
+  // updates node bounds to primitives moved since the last build keeping
+  // the tree. returns -1 if the tree can't be refit e.g. the primitive count
+  // has changed or if its quality got too low. the tree should be rebuilt then
+  int Refit();
+  // builds if not built yet or the primitive set has changed since the
+  // last build. a built tree is refit if possible and rebuilt otherwise.
+  // does nothing if up to date
+  int Update();
+  bool IsUpToDate() const;
+  // true if the last Update refit the tree instead of building it
+  bool WasRefit() const;
+  // the procedure filling the primitive set runs when a ray first enters
+  // bounds instead of before rendering. bounds are in object space and
+  // geometry outside of them is not hit
+  void SetDeferredProcedure(const Procedure *procedure, const Box &bounds);
+  bool IsDeferred() const;
+  const Procedure *GetDeferredProcedure() const;
+  const Box &GetDeferredBounds() const;
+  // runs the deferred procedure and builds once. other threads calling it
+  // wait for the first one. if either fails the accelerator stays deferred
+  // and rays miss it. returns -1 then or if it isn't deferred
+  int Expand();
   bool Intersect(const Ray &ray, Real time, Intersection *isect) const;
+  // returns as soon as any hit is found, not the closest one.
+  // isect only has what PrimitiveSet::RayOcclude fills
+  bool Occlude(const Ray &ray, Real time, Intersection *isect) const;
+  // Occlude by the primitive prim_id only without traversal. false if the
+  // primitive set has no such primitive or isn't expanded yet
+  bool OccludePrimitive(Index prim_id, const Ray &ray, Real time,
+      Intersection *isect) const;
+  // fills the attributes of a hit Intersect found before from prim_id,
+  // shading_group_id, t_hit and prim_uv of isect without traversal. false
+  // if the primitive set has no such primitive or isn't expanded yet
+  bool ComputeHitAttributes(const Ray &ray, Real time, Intersection *isect) const;
+  // closest hits of count rays at times[i]. count is up to
+  // RAY_PACKET_SIZE. returns the mask of rays that hit. coherent rays
+  // share node fetches in accelerators that trace packets
+  unsigned int IntersectPacket(const Ray *rays, const Real *times, int count,
+      Intersection *isects) const;
+  // adds the closest hits in ray range to hits in one traversal up to the
+  // capacity of hits. hits already in the list shorten the range. returns
+  // true if any is added
+  bool IntersectAll(const Ray &ray, Real time, HitList *hits) const;
+  // walks the built tree and fills stats. returns -1 if not built or the
+  // type can't be analyzed
+  int Analyze(AcceleratorStats *stats) const;
 
 private:
+  // expands if deferred. false if the tree can't be traversed
+  bool expand_deferred() const;
+
   virtual int build() = 0;
+  // can't refit unless overridden
+  virtual int refit()
+  {
+    return -1;
+  }
   virtual bool intersect(const Ray &ray, Real time, Intersection *isect) const = 0;
+  virtual bool occlude(const Ray &ray, Real time, Intersection *isect) const
+  {
+    return intersect(ray, time, isect);
+  }
+  // intersects rays of ray_mask one by one unless overridden
+  virtual unsigned int intersect_packet(const Ray *rays, const Real *times, int count,
+      unsigned int ray_mask, Intersection *isects) const;
+  // steps through hits by calling intersect again past each one unless
+  // overridden
+  virtual bool intersect_all(const Ray &ray, Real time, HitList *hits) const;
   virtual const char *get_name() const = 0;
+  virtual std::size_t get_memory_usage() const
+  {
+    return 0;
+  }
+  // called for other of the same type. no settings unless overridden
+  virtual bool has_same_settings(const Accelerator &other) const
+  {
+    return true;
+  }
+  // can't analyze unless overridden
+  virtual int analyze(AcceleratorStats *stats) const
+  {
+    return -1;
+  }
 
   Box bounds_;
   bool has_built_;
+  bool was_refit_;
+  // change count of the primitive set at the last build or refit
+  int64_t built_change_count_;
 
   PrimitiveSet *primset_;
 
+  const Procedure *deferred_procedure_;
+  Box deferred_bounds_;
+  std::atomic<bool> is_deferred_;
+  std::mutex expand_mutex_;
+  bool expand_failed_;
+
 protected:
   // TODO PrimitiveSet might have to own Accelerator
   const PrimitiveSet *GetPrimitiveSet() const { return primset_; }
@@ -8,6 +8,11 @@
 
 namespace fj {
 
+static int floor_div(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
 AdaptiveGridSampler::AdaptiveGridSampler() :
   samples_(),
 
@@ -41,13 +46,14 @@ int AdaptiveGridSampler::generate_samples(const Rectangle &region)
   samples_.resize(nsamples_[0] * nsamples_[1]);
   pixel_start_ = region.min;
 
-  XorShift rng; // random number generator
-  XorShift rng_time; // for time sampling jitter
+  // seed 0 keeps the default sequences
+  const int seed = GetSampleSeed();
+  XorShift rng = seed == 0 ? XorShift() : XorShift(2 * seed); // random number generator
+  XorShift rng_time = seed == 0 ? XorShift() : XorShift(2 * seed + 1); // for time sampling jitter
 
   const Int2 div = ndivision_;
   const Int2 res = GetResolution();
   const Real jitter = GetJitter();
-  const Vector2 sample_time_range = GetSampleTimeRange();
 
   // uv delta (screen space uv. excludes margins)
   const Real udelta = 1./(div[0] * res[0]);
@@ -77,9 +83,16 @@ int AdaptiveGridSampler::generate_samples(const Rectangle &region)
         sample.uv[1] += vdelta * (v_jitter - .5);
       }
 
+      // corners on the top and left edges belong to the pixel
+      const Int2 grid_pos(x + xoffset, y + yoffset);
+      const Int2 pixel_pos(floor_div(grid_pos[0], div[0]), floor_div(grid_pos[1], div[1]));
+      const Int2 sub_pos = grid_pos - pixel_pos * div;
+      const int sub_index = sub_pos[1] * div[0] + sub_pos[0];
+      SetSequence(sample, pixel_pos, sub_index, div[0] * div[1]);
+
       if (IsSamplingTime()) {
         const Real rnd = rng_time.NextFloat01();
-        sample.time = Fit(rnd, 0, 1, sample_time_range[0], sample_time_range[1]);
+        sample.time = ComputeSampleTime(pixel_pos, sub_index, div[0] * div[1], rnd);
       } else {
         sample.time = 0;
       }
@@ -194,6 +207,12 @@ void AdaptiveGridSampler::get_sampleset_in_pixel(std::vector<Sample> &pixelsampl
   }
 }
 
+const Sample *AdaptiveGridSampler::get_samples(int *sample_count) const
+{
+  *sample_count = samples_.size();
+  return samples_.empty() ? NULL : &samples_[0];
+}
+
 int AdaptiveGridSampler::get_sample_count() const
 {
   return samples_.size();
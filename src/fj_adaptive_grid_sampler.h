@@ -21,6 +21,7 @@ private:
   virtual Sample *get_next_sample();
   virtual void get_sampleset_in_pixel(std::vector<Sample> &pixelsamples,
       const Int2 &pixel_pos) const;
+  virtual const Sample *get_samples(int *sample_count) const;
 
   int get_sample_count() const;
   Int2 count_samples_in_region(const Rectangle &region) const;
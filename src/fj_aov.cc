@@ -0,0 +1,181 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_aov.h"
+#include "fj_shading.h"
+
+namespace fj {
+
+class AOVInfo {
+public:
+  const char *name;
+  int channel_count;
+  // suffixes of EXR channel names
+  const char *channels;
+};
+
+static const AOVInfo AOV_INFO_LIST[] = {
+  {"depth",        1, "Z"},
+  {"normal",       3, "XYZ"},
+  {"albedo",       3, "RGB"},
+  {"direct",       3, "RGB"},
+  {"indirect",     3, "RGB"},
+  {"sample_count", 1, "Y"},
+  {"variance",     1, "Y"},
+  {"time",         1, "Y"},
+  {"rays",         5, "CSDRT"},
+  {"nodes",        1, "Y"},
+  {"march_steps",  1, "Y"}
+};
+static_assert(sizeof(AOV_INFO_LIST) / sizeof(AOV_INFO_LIST[0]) == AOV_TYPE_COUNT,
+    "AOV_INFO_LIST has to have all AOVType");
+
+static int find_aov_type(const std::string &name);
+
+AOVLayout::AOVLayout()
+{
+  Clear();
+}
+
+AOVLayout::~AOVLayout()
+{
+}
+
+int AOVLayout::Parse(const std::string &names)
+{
+  AOVLayout layout;
+  std::string::size_type begin = 0;
+
+  while (!names.empty() && begin <= names.size()) {
+    std::string::size_type end = names.find(',', begin);
+    if (end == std::string::npos) {
+      end = names.size();
+    }
+    const int type = find_aov_type(names.substr(begin, end - begin));
+    if (type == -1 || layout.offsets_[type] != -1) {
+      return -1;
+    }
+
+    layout.offsets_[type] = layout.channel_count_;
+    layout.order_[layout.aov_count_++] = type;
+    layout.channel_count_ += AOV_INFO_LIST[type].channel_count;
+    begin = end + 1;
+  }
+
+  *this = layout;
+  return 0;
+}
+
+void AOVLayout::Clear()
+{
+  for (int i = 0; i < AOV_TYPE_COUNT; i++) {
+    offsets_[i] = -1;
+    order_[i] = -1;
+  }
+  aov_count_ = 0;
+  channel_count_ = 0;
+}
+
+bool AOVLayout::IsEmpty() const
+{
+  return aov_count_ == 0;
+}
+
+int AOVLayout::GetChannelCount() const
+{
+  return channel_count_;
+}
+
+int AOVLayout::GetOffset(int aov_type) const
+{
+  if (aov_type < 0 || aov_type >= AOV_TYPE_COUNT) {
+    return -1;
+  }
+  return offsets_[aov_type];
+}
+
+std::string AOVLayout::GetChannelNames() const
+{
+  std::string names;
+
+  for (int i = 0; i < aov_count_; i++) {
+    const AOVInfo &info = AOV_INFO_LIST[order_[i]];
+    for (int j = 0; j < info.channel_count; j++) {
+      if (!names.empty()) {
+        names += ",";
+      }
+      names += info.name;
+      names += ".";
+      names += info.channels[j];
+    }
+  }
+  return names;
+}
+
+void AOVLayout::StoreSample(const AOVSample &aov, float *values) const
+{
+  for (int i = 0; i < aov_count_; i++) {
+    const int type = order_[i];
+    float *dst = values + offsets_[type];
+
+    switch (type) {
+    case AOV_DEPTH:
+      dst[0] = aov.depth;
+      break;
+    case AOV_NORMAL:
+      dst[0] = aov.N.x;
+      dst[1] = aov.N.y;
+      dst[2] = aov.N.z;
+      break;
+    case AOV_ALBEDO:
+      dst[0] = aov.albedo.r;
+      dst[1] = aov.albedo.g;
+      dst[2] = aov.albedo.b;
+      break;
+    case AOV_DIRECT:
+      dst[0] = aov.direct.r;
+      dst[1] = aov.direct.g;
+      dst[2] = aov.direct.b;
+      break;
+    case AOV_INDIRECT:
+      dst[0] = aov.indirect.r;
+      dst[1] = aov.indirect.g;
+      dst[2] = aov.indirect.b;
+      break;
+    case AOV_SAMPLE_COUNT:
+      dst[0] = 1;
+      break;
+    case AOV_VARIANCE:
+      dst[0] = 0;
+      break;
+    case AOV_TIME:
+      dst[0] = aov.time;
+      break;
+    case AOV_RAYS:
+      for (int j = 0; j < RAY_CONTEXT_COUNT; j++) {
+        dst[j] = aov.ray_count[j];
+      }
+      break;
+    case AOV_NODES:
+      dst[0] = aov.node_count;
+      break;
+    case AOV_MARCH_STEPS:
+      dst[0] = aov.march_step_count;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+static int find_aov_type(const std::string &name)
+{
+  for (int i = 0; i < AOV_TYPE_COUNT; i++) {
+    if (name == AOV_INFO_LIST[i].name) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+} // namespace xxx
@@ -0,0 +1,73 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_AOV_H
+#define FJ_AOV_H
+
+#include "fj_compatibility.h"
+#include <string>
+
+namespace fj {
+
+class AOVSample;
+
+// Arbitrary output variables rendered into channels following RGBA of the
+// framebuffer. they are filtered the same as colors except sample_count
+enum AOVType {
+  // distance to the first surface. 0 where camera rays miss
+  AOV_DEPTH = 0,
+  // shading normal of the first surface
+  AOV_NORMAL,
+  AOV_ALBEDO,
+  // lighting from lights and the rest of Cs
+  AOV_DIRECT,
+  AOV_INDIRECT,
+  // camera samples in the pixel summed over progressive passes
+  AOV_SAMPLE_COUNT,
+  // estimated variance of the luminance of the pixel from its samples
+  AOV_VARIANCE,
+  // costs of camera samples averaged in the pixel for heatmaps. time is
+  // in cycles of the cpu counter, rays are of each ray context and nodes
+  // are of accelerators (only counted when built with RAY_STATS=1)
+  AOV_TIME,
+  AOV_RAYS,
+  AOV_NODES,
+  AOV_MARCH_STEPS,
+  AOV_TYPE_COUNT
+};
+
+// channels of all aovs
+const int AOV_MAX_CHANNEL_COUNT = 23;
+
+class FJ_API AOVLayout {
+public:
+  AOVLayout();
+  ~AOVLayout();
+
+  // names of AOVType separated by commas in the order of channels.
+  // e.g. "depth,normal". returns -1 for unknown or repeated names
+  int Parse(const std::string &names);
+  void Clear();
+
+  bool IsEmpty() const;
+  int GetChannelCount() const;
+  // of the first channel of the aov counted from the first aov channel.
+  // -1 if not included
+  int GetOffset(int aov_type) const;
+  // EXR channel names of aov channels separated by commas
+  std::string GetChannelNames() const;
+
+  // writes GetChannelCount() values of the sample. sample_count is 1.
+  // variance is left 0 for the renderer since it is of the sample color
+  void StoreSample(const AOVSample &aov, float *values) const;
+
+private:
+  int offsets_[AOV_TYPE_COUNT];
+  int order_[AOV_TYPE_COUNT];
+  int aov_count_;
+  int channel_count_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
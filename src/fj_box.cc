@@ -60,6 +60,21 @@ void Box::AddBox(const Box &other)
   max[2] = Max(max[2], other.max[2]);
 }
 
+void Box::Clip(const Box &other)
+{
+  min[0] = Max(min[0], other.min[0]);
+  min[1] = Max(min[1], other.min[1]);
+  min[2] = Max(min[2], other.min[2]);
+  max[0] = Min(max[0], other.max[0]);
+  max[1] = Min(max[1], other.max[1]);
+  max[2] = Min(max[2], other.max[2]);
+}
+
+bool Box::IsEmpty() const
+{
+  return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+}
+
 Vector Box::Centroid() const
 {
   return .5 * (min + max);
@@ -70,6 +85,17 @@ Vector Box::Diagonal() const
   return max - min;
 }
 
+Real Box::SurfaceArea() const
+{
+  const Vector D = Diagonal();
+
+  if (D.x < 0 || D.y < 0 || D.z < 0) {
+    return 0;
+  }
+
+  return 2 * (D.x * D.y + D.y * D.z + D.z * D.x);
+}
+
 bool BoxRayIntersect(const Box &box,
     const Vector &rayorig, const Vector &raydir,
     Real ray_tmin, Real ray_tmax,
@@ -22,9 +22,14 @@ public:
   bool ContainsPoint(const Vector &point) const;
   void AddPoint(const Vector &point);
   void AddBox(const Box &other);
+  // shrinks to the overlap with other. empty if they don't overlap
+  void Clip(const Box &other);
+  // true if min is larger than max on any axis
+  bool IsEmpty() const;
 
   Vector Centroid() const;
   Vector Diagonal() const;
+  Real SurfaceArea() const;
 
 public:
   Vector min;
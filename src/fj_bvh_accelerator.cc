@@ -3,29 +3,62 @@
 
 #include "fj_bvh_accelerator.h"
 #include "fj_intersection.h"
+#include "fj_bvh_cache.h"
+#include "fj_primitive_leaf_test.h"
 #include "fj_primitive_set.h"
 #include "fj_accelerator.h"
+#include "fj_memory_usage.h"
+#include "fj_multi_thread.h"
 #include "fj_numeric.h"
+#include "fj_ray_stats.h"
 #include "fj_box.h"
 #include "fj_ray.h"
+#include "internal/fj_float_rounding.h"
 
 #include <algorithm>
+#include <deque>
+#include <typeinfo>
 #include <utility>
 #include <vector>
-#include <stack>
 #include <cassert>
+#include <cmath>
 
 namespace fj {
 
 static const char ACCELERATOR_NAME[] = "BVH";
 
+// primitive sets whose traversals are instantiated
 enum {
-  HIT_NONE = 0,
-  HIT_LEFT = 1,
-  HIT_RIGHT = 2,
-  HIT_BOTH = 3
+  PRIMSET_GENERIC = 0,
+  PRIMSET_MESH,
+  PRIMSET_CURVE,
+  PRIMSET_POINT_CLOUD,
+  PRIMSET_OBJECT_SET
 };
 
+// the number of bins along each axis to evaluate SAH cost
+static const int SAH_BIN_COUNT = 16;
+// relative costs of a box test and a primitive test
+static const Real SAH_TRAVERSAL_COST = 1;
+static const Real SAH_INTERSECTION_COST = 1;
+// spatial splits are tried when children of the object split overlap more
+// than this relative to the surface area of the root
+static const Real SBVH_MIN_OVERLAP = 1e-5;
+
+static const int DEFAULT_LEAF_SIZE = 4;
+static const int MAX_STACK_DEPTH = BVH_MAX_DEPTH;
+
+// meshes smaller than this are built on the calling thread
+static const int PARALLEL_BUILD_MIN_PRIMS = 16384;
+// the number of subtree tasks per thread for load balancing
+static const int SUBTREE_TASKS_PER_THREAD = 8;
+// the number of primitives whose bounds are computed in a task
+static const int BOUNDS_CHUNK_SIZE = 4096;
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode should be 32 bytes");
+// vertices of faces in a leaf fit in 8 bit local indices
+static_assert(3 * BVH_MAX_LEAF_SIZE <= 256, "leaf clusters should have up to 256 vertices");
+
 class Primitive {
 public:
   Primitive() : bounds(), centroid(), index(0) {}
@@ -36,301 +69,1937 @@ public:
   int index;
 };
 
-class BVHNode {
+class SubtreeTask {
+public:
+  SubtreeTask() : begin(0), end(0), axis(0), depth(0), nodes() {}
+  ~SubtreeTask() {}
+
+  int begin, end;
+  int axis;
+  int depth;
+  std::vector<BVHNode> nodes;
+};
+
+class BuildContext {
+public:
+  BuildContext(int mode, int leaf) :
+      build_mode(mode), leaf_size(leaf), nodes(),
+      task_prim_count(0), tasks(NULL) {}
+  ~BuildContext() {}
+
+  int build_mode;
+  int leaf_size;
+  std::vector<BVHNode> nodes;
+
+  // when tasks is not NULL, subtrees with task_prim_count primitives or less
+  // are not built but recorded as tasks with a placeholder node
+  int task_prim_count;
+  std::vector<SubtreeTask> *tasks;
+};
+
+// References to primitives of a tree with spatial splits. a primitive split
+// by a plane is referred by both children with its bounds clipped
+class SplitBuildContext {
+public:
+  SplitBuildContext(const PrimitiveSet &set, int leaf) :
+      primset(set), leaf_size(leaf), nodes(), prim_indices(), split_prims(),
+      ref_count(0), max_ref_count(0), min_overlap_area(0) {}
+  ~SplitBuildContext() {}
+
+  const PrimitiveSet &primset;
+  int leaf_size;
+  std::vector<BVHNode> nodes;
+  std::vector<Index> prim_indices;
+
+  // references made by spatial splits. deque keeps pointers to them valid
+  std::deque<Primitive> split_prims;
+  int ref_count;
+  int max_ref_count;
+  Real min_overlap_area;
+};
+
+// the best spatial split of a node. counts and bounds are of the references
+// in each side including the clipped ones
+class SpatialSplit {
+public:
+  SpatialSplit() : axis(0), position(0), left_bounds(), right_bounds(),
+      left_count(0), right_count(0) {}
+  ~SpatialSplit() {}
+
+  int axis;
+  Real position;
+  Box left_bounds, right_bounds;
+  int left_count, right_count;
+};
+
+class ParallelBuild {
+public:
+  ParallelBuild() : primset(NULL), prims(NULL), primptrs(NULL),
+      nprims(0), build_mode(0), leaf_size(0), tasks(NULL) {}
+  ~ParallelBuild() {}
+
+  const PrimitiveSet *primset;
+  Primitive *prims;
+  Primitive **primptrs;
+  int nprims;
+  int build_mode;
+  int leaf_size;
+  std::vector<SubtreeTask> *tasks;
+};
+
+// Primitive bounds in the middle of the shutter. the tree of moving primitives
+// is built over these so that fast motion doesn't make every split look bad
+class MidShutterPrimitiveSet : public PrimitiveSet {
 public:
-  BVHNode() : left(NULL), right(NULL), bounds(), prim_id(-1) {}
-  ~BVHNode() {}
+  MidShutterPrimitiveSet(const PrimitiveSet &primset) : primset_(primset) {}
+  virtual ~MidShutterPrimitiveSet() {}
 
-  bool is_leaf() const
+private:
+  virtual bool ray_intersect(Index prim_id, const Ray &ray,
+      Real time, Intersection *isect) const
+  {
+    return primset_.RayIntersect(prim_id, ray, time, isect);
+  }
+  virtual void get_primitive_bounds(Index prim_id, Box *bounds) const
+  {
+    Box bounds_open, bounds_close;
+    primset_.GetPrimitiveMotionBounds(prim_id, &bounds_open, &bounds_close);
+    bounds->min = .5 * (bounds_open.min + bounds_close.min);
+    bounds->max = .5 * (bounds_open.max + bounds_close.max);
+  }
+  virtual void get_bounds(Box *bounds) const
+  {
+    primset_.GetEntireBounds(bounds);
+  }
+  virtual Index get_primitive_count() const
   {
-    return (
-      left == NULL &&
-      right == NULL &&
-      prim_id != -1);
+    return primset_.GetPrimitiveCount();
   }
 
-  BVHNode *left;
-  BVHNode *right;
-  Box bounds;
-  int prim_id;
+  const PrimitiveSet &primset_;
 };
 
-static bool intersect_bvh_recursive(const PrimitiveSet *primset,
-    const BVHNode *node, const Ray &ray, Real time,
-    Intersection *isect);
-static bool intersect_bvh_loop(const PrimitiveSet *primset,
-    const BVHNode *root, const Ray &ray, Real time,
-    Intersection *isect);
+// Compares the number of primitives of subtree tasks for std::stable_sort.
+class SubtreeIsLarger {
+public:
+  SubtreeIsLarger(const std::vector<SubtreeTask> &tasks) : tasks_(tasks) {}
+  bool operator()(int a, int b) const
+  {
+    return tasks_[a].end - tasks_[a].begin > tasks_[b].end - tasks_[b].begin;
+  }
+private:
+  const std::vector<SubtreeTask> &tasks_;
+};
 
-static BVHNode *new_bvhnode();
-static void free_bvhnode_recursive(BVHNode *node);
-static BVHNode *build_bvh(Primitive **prims, int begin, int end, int axis);
+static int build_bvh(BuildContext &build, Primitive **prims,
+    int begin, int end, int axis, int depth);
+static LoopStatus compute_bounds_task(void *data, const ThreadContext &context);
+static LoopStatus build_subtree_task(void *data, const ThreadContext &context);
+static int emit_nodes(const std::vector<BVHNode> &top_nodes, int top_id,
+    std::vector<SubtreeTask> &tasks, std::vector<BVHNode> *nodes);
 static int find_median(Primitive **prims, int begin, int end, int axis);
+static int find_sah_split(Primitive **prims, int begin, int end, int *axis);
+static Real evaluate_sah_split(Primitive **prims, int begin, int end,
+    int *axis, Real *split_pos);
+static int build_sbvh(SplitBuildContext &build, std::vector<Primitive *> &refs,
+    int axis, int depth);
+static Real evaluate_spatial_split(Primitive *const *prims, int count,
+    const Box &node_bounds, SpatialSplit *split);
+static void split_references(SplitBuildContext &build,
+    const std::vector<Primitive *> &refs, const SpatialSplit &split,
+    std::vector<Primitive *> *left_refs, std::vector<Primitive *> *right_refs);
+
+static void set_node_bounds(BVHNode *node, const Box &box);
+static void refit_node_bounds(const PrimitiveSet &primset,
+    const MappedArray<Index> &prim_indices, MappedArray<BVHNode> *nodes);
+static void compute_motion_bounds(const PrimitiveSet &primset,
+    const MappedArray<BVHNode> &nodes, const MappedArray<Index> &prim_indices,
+    std::vector<BVHMotionBounds> *motion_bounds);
+static Real compute_tree_cost(const MappedArray<BVHNode> &nodes);
+static bool node_ray_intersect(const BVHNode &node, const TraversalRay &ray,
+    Real ray_tmin, Real ray_tmax, Real *hit_tmin);
+static bool motion_node_ray_intersect(const BVHMotionBounds &bounds, Real time,
+    const TraversalRay &ray, Real ray_tmin, Real ray_tmax, Real *hit_tmin);
+
+// rays of a packet being traced and the ranges of their origins and
+// inverse directions. a node outside of the ranges is missed by all rays
+class RayPacket {
+public:
+  RayPacket() : rays(), traversal_rays(), times(NULL), ray_mask(0), coherent(false),
+      orig_min(), orig_max(), inv_min(), inv_max(), tmin(0), tmax(0) {}
+  ~RayPacket() {}
+
+  Ray rays[RAY_PACKET_SIZE];
+  TraversalRay traversal_rays[RAY_PACKET_SIZE];
+  const Real *times;
+  unsigned int ray_mask;
+
+  // true if directions of all rays have the same signs
+  bool coherent;
+  Vector orig_min, orig_max;
+  Vector inv_min, inv_max;
+  Real tmin, tmax;
+};
+
+static void setup_ray_packet(const Ray *rays, const Real *times, int count,
+    unsigned int ray_mask, RayPacket *packet);
+static void update_packet_tmax(RayPacket *packet);
+static bool packet_misses_node(const BVHNode &node, const RayPacket &packet);
+
+// tests the node at the ray time if the tree has motion bounds
+static inline bool node_ray_intersect_at(const MappedArray<BVHNode> &nodes,
+    const std::vector<BVHMotionBounds> &motion_bounds, int node_id, Real time,
+    const TraversalRay &ray, Real ray_tmin, Real ray_tmax, Real *hit_tmin)
+{
+  if (motion_bounds.empty()) {
+    return node_ray_intersect(nodes[node_id],
+        ray, ray_tmin, ray_tmax, hit_tmin);
+  } else {
+    return motion_node_ray_intersect(motion_bounds[node_id], time,
+        ray, ray_tmin, ray_tmax, hit_tmin);
+  }
+}
 
-BVHAccelerator::BVHAccelerator() : root(NULL)
+BVHAccelerator::BVHAccelerator() :
+    nodes_(),
+    prim_indices_(),
+    motion_bounds_(),
+    mapping_(),
+    cluster_offsets_(),
+    cluster_points_(),
+    cluster_indices_(),
+    mesh_clusters_(true),
+    build_mode_(BVH_BUILD_MEDIAN),
+    leaf_size_(DEFAULT_LEAF_SIZE),
+    split_budget_(BVH_DEFAULT_SPLIT_BUDGET),
+    cache_dir_(),
+    prim_count_(0),
+    built_cost_(0),
+    primset_type_(PRIMSET_GENERIC)
 {
 }
 
 BVHAccelerator::~BVHAccelerator()
 {
-  free_bvhnode_recursive(root);
 }
 
-int BVHAccelerator::build()
+int BVHAccelerator::SetBuildMode(int build_mode)
 {
-  const PrimitiveSet *primset = GetPrimitiveSet();
-  const int NPRIMS = primset->GetPrimitiveCount();
-
-  if (NPRIMS == 0) {
-    // TODO is NPRIMS == 0 error?
+  switch (build_mode) {
+  case BVH_BUILD_MEDIAN:
+  case BVH_BUILD_SAH:
+  case BVH_BUILD_SBVH:
+    build_mode_ = build_mode;
+    return 0;
+  default:
     return -1;
   }
+}
 
-  std::vector<Primitive> prims(NPRIMS);
-  std::vector<Primitive*> primptrs(NPRIMS, NULL);
-
-  for (int i = 0; i < NPRIMS; i++) {
-    primset->GetPrimitiveBounds(i, &prims[i].bounds);
-    prims[i].centroid = prims[i].bounds.Centroid();
-    prims[i].index = i;
+int BVHAccelerator::GetBuildMode() const
+{
+  return build_mode_;
+}
 
-    primptrs[i] = &prims[i];
+int BVHAccelerator::SetSplitBudget(Real split_budget)
+{
+  if (split_budget < 0) {
+    return -1;
   }
 
-  root = build_bvh(&primptrs[0], 0, NPRIMS, 0);
-  if (root == NULL) {
-    // TODO NODE COULD BE NULL IF PRIMITIVE IS EMPTY. MIGHT BE BETTER CHANGE
+  split_budget_ = split_budget;
+  return 0;
+}
+
+Real BVHAccelerator::GetSplitBudget() const
+{
+  return split_budget_;
+}
+
+int BVHAccelerator::SetLeafSize(int leaf_size)
+{
+  if (leaf_size < 1 || leaf_size > BVH_MAX_LEAF_SIZE) {
     return -1;
   }
 
+  leaf_size_ = leaf_size;
   return 0;
 }
 
-bool BVHAccelerator::intersect(const Ray &ray, Real time, Intersection *isect) const
+int BVHAccelerator::GetLeafSize() const
 {
-  const PrimitiveSet *primset = GetPrimitiveSet();
+  return leaf_size_;
+}
 
-  if (1)
-    return intersect_bvh_loop(primset, root, ray, time, isect);
-  else
-    return intersect_bvh_recursive(primset, root, ray, time, isect);
+void BVHAccelerator::SetCacheDirectory(const std::string &dir)
+{
+  cache_dir_ = dir;
 }
 
-const char *BVHAccelerator::get_name() const
+const std::string &BVHAccelerator::GetCacheDirectory() const
 {
-  return ACCELERATOR_NAME;
+  return cache_dir_;
 }
 
-static bool intersect_bvh_recursive(const PrimitiveSet *primset,
-    const BVHNode *node, const Ray &ray, Real time,
-    Intersection *isect)
+void BVHAccelerator::SetMeshClusters(bool on_or_off)
 {
-  // TODO NODE COULD BE NULL IF PRIMITIVE IS EMPTY. MIGHT BE BETTER CHANGE
-  if (node == NULL)
-    return false;
+  mesh_clusters_ = on_or_off;
+}
 
-  Real boxhit_tmin;
-  Real boxhit_tmax;
-  const bool hit = BoxRayIntersect(node->bounds,
-      ray.orig, ray.dir, ray.tmin, ray.tmax,
-      &boxhit_tmin, &boxhit_tmax);
+bool BVHAccelerator::IsMeshClusters() const
+{
+  return mesh_clusters_;
+}
 
-  if (!hit) {
-    return false;
+int BVHAccelerator::GetNodeCount() const
+{
+  return static_cast<int>(nodes_.size());
+}
+
+bool BVHAccelerator::HasMotion() const
+{
+  return !motion_bounds_.empty();
+}
+
+int BVHAccelerator::build()
+{
+  std::shared_ptr<const void> mapping_tmp;
+  MappedArray<BVHNode> nodes_tmp;
+  MappedArray<Index> indices_tmp;
+  std::vector<BVHMotionBounds> motion_tmp;
+
+  const PrimitiveSet &primset = *GetPrimitiveSet();
+  const MidShutterPrimitiveSet mid_shutter(primset);
+  const bool has_motion = primset.HasMotion();
+
+  const int err = BvhBuildTreeMapped(has_motion ? mid_shutter : primset,
+      build_mode_, leaf_size_, split_budget_, cache_dir_,
+      &mapping_tmp, &nodes_tmp, &indices_tmp);
+  if (err) {
+    return -1;
+  }
+
+  if (has_motion) {
+    compute_motion_bounds(primset, nodes_tmp, indices_tmp, &motion_tmp);
+  }
+
+  // commit
+  nodes_.swap(nodes_tmp);
+  prim_indices_.swap(indices_tmp);
+  motion_bounds_.swap(motion_tmp);
+  mapping_.swap(mapping_tmp);
+  prim_count_ = primset.GetPrimitiveCount();
+  built_cost_ = compute_tree_cost(nodes_);
+
+  // traversed by workers of all nodes. pages of mapped cache files are
+  // shared with other processes and left where they are
+  if (mapping_ == NULL) {
+    MtInterleaveSharedMemory(nodes_.data(), nodes_.size() * sizeof(BVHNode));
+    MtInterleaveSharedMemory(prim_indices_.data(), prim_indices_.size() * sizeof(Index));
   }
+  MtInterleaveSharedMemory(motion_bounds_);
 
-  if (node->is_leaf()) {
-    return primset->RayIntersect(node->prim_id, ray, time, isect);
+  // exact types only. subclasses may override the leaf tests
+  if (typeid(primset) == typeid(Mesh)) {
+    primset_type_ = PRIMSET_MESH;
   }
+  else if (typeid(primset) == typeid(Curve)) {
+    primset_type_ = PRIMSET_CURVE;
+  }
+  else if (typeid(primset) == typeid(PointCloud)) {
+    primset_type_ = PRIMSET_POINT_CLOUD;
+  }
+  else if (typeid(primset) == typeid(ObjectSet)) {
+    primset_type_ = PRIMSET_OBJECT_SET;
+  }
+  else {
+    primset_type_ = PRIMSET_GENERIC;
+  }
+
+  build_mesh_clusters();
+
+  return 0;
+}
 
-  Intersection isect_left, isect_right;
-  const bool hit_left  = intersect_bvh_recursive(primset, node->left,  ray, time, &isect_left);
-  const bool hit_right = intersect_bvh_recursive(primset, node->right, ray, time, &isect_right);
+int BVHAccelerator::refit()
+{
+  const PrimitiveSet &primset = *GetPrimitiveSet();
+  const bool has_motion = primset.HasMotion();
+
+  if (nodes_.empty() ||
+      prim_count_ != primset.GetPrimitiveCount() ||
+      has_motion != HasMotion()) {
+    return -1;
+  }
 
-  if (isect_left.t_hit < ray.tmin)
-    isect_left.t_hit = REAL_MAX;
-  if (isect_right.t_hit < ray.tmin)
-    isect_right.t_hit = REAL_MAX;
+  const MidShutterPrimitiveSet mid_shutter(primset);
+  refit_node_bounds(has_motion ? mid_shutter : primset, prim_indices_, &nodes_);
 
-  if (isect_left.t_hit < isect_right.t_hit) {
-    *isect = isect_left;
-  } else if (isect_right.t_hit < isect_left.t_hit) {
-    *isect = isect_right;
+  if (has_motion) {
+    compute_motion_bounds(primset, nodes_, prim_indices_, &motion_bounds_);
   }
 
-  return (hit_left || hit_right);
+  // vertices moved since the build
+  build_mesh_clusters();
+
+  // nodes grown by moving primitives apart are hit more than a new tree
+  if (compute_tree_cost(nodes_) > BVH_MAX_REFIT_COST_RATIO * built_cost_) {
+    return -1;
+  }
+  return 0;
 }
 
-static bool intersect_bvh_loop(const PrimitiveSet *primset,
-    const BVHNode *root, const Ray &ray, Real time,
-    Intersection *isect)
+bool BVHAccelerator::intersect(const Ray &ray, Real time, Intersection *isect) const
 {
-  bool hit = false;
-  const BVHNode *node = root;
-  std::stack<BVHNode*> stack;
+  if (nodes_.empty()) {
+    return false;
+  }
+
+  const PrimitiveSet *primset = GetPrimitiveSet();
+  switch (primset_type_) {
+  case PRIMSET_MESH:
+    return intersect_tree(*static_cast<const Mesh *>(primset), ray, time, isect);
+  case PRIMSET_CURVE:
+    return intersect_tree(*static_cast<const Curve *>(primset), ray, time, isect);
+  case PRIMSET_POINT_CLOUD:
+    return intersect_tree(*static_cast<const PointCloud *>(primset), ray, time, isect);
+  case PRIMSET_OBJECT_SET:
+    return intersect_tree(*static_cast<const ObjectSet *>(primset), ray, time, isect);
+  default:
+    return intersect_tree(*primset, ray, time, isect);
+  }
+}
 
-  // TODO NODE COULD BE NULL IF PRIMITIVE IS EMPTY. MIGHT BE BETTER CHANGE
-  if (node == NULL)
+bool BVHAccelerator::occlude(const Ray &ray, Real time, Intersection *isect) const
+{
+  if (nodes_.empty()) {
     return false;
+  }
+
+  const PrimitiveSet *primset = GetPrimitiveSet();
+  switch (primset_type_) {
+  case PRIMSET_MESH:
+    return occlude_tree(*static_cast<const Mesh *>(primset), ray, time, isect);
+  case PRIMSET_CURVE:
+    return occlude_tree(*static_cast<const Curve *>(primset), ray, time, isect);
+  case PRIMSET_POINT_CLOUD:
+    return occlude_tree(*static_cast<const PointCloud *>(primset), ray, time, isect);
+  case PRIMSET_OBJECT_SET:
+    return occlude_tree(*static_cast<const ObjectSet *>(primset), ray, time, isect);
+  default:
+    return occlude_tree(*primset, ray, time, isect);
+  }
+}
+
+template <typename T>
+bool BVHAccelerator::intersect_tree(const T &primset, const Ray &ray, Real time,
+    Intersection *isect) const
+{
+  const TraversalRay traversal_ray(ray);
+
+  // the ray is shortened to the closest hit found so far
+  Ray ray_tmp = ray;
+  bool hit = false;
 
   Intersection isect_candidates[2];
   Intersection *isect_min = &isect_candidates[0];
   Intersection *isect_tmp = &isect_candidates[1];
 
+  int stack[MAX_STACK_DEPTH];
+  int stack_size = 0;
+  int node_id = 0;
+  FJ_RAY_STATS_LOCAL(int max_stack_size = 0);
+
+  Real root_tmin = 0;
+  if (!node_ray_intersect_at(nodes_, motion_bounds_, 0, time,
+        traversal_ray, ray.tmin, ray.tmax, &root_tmin)) {
+    return false;
+  }
+
   for (;;) {
-    if (node->is_leaf()) {
-      const bool hittmp = primset->RayIntersect(node->prim_id, ray, time, isect_tmp);
+    const BVHNode &node = nodes_[node_id];
+    FJ_RAY_STATS_ADD(surface_node_visit_count, 1);
+
+    if (node.is_leaf()) {
+      const bool hittmp = leaf_intersect(primset, node, node_id, ray_tmp, time, isect_tmp);
+      FJ_RAY_STATS_ADD(surface_primitive_test_count, node.count);
       if (hittmp && isect_tmp->t_hit < isect_min->t_hit) {
         std::swap(isect_min, isect_tmp);
-        hit = hittmp;
+        ray_tmp.tmax = isect_min->t_hit;
+        hit = true;
       }
 
-      if (stack.empty())
-        goto loop_exit;
-      node = stack.top();
-      stack.pop();
+      if (stack_size == 0)
+        break;
+      node_id = stack[--stack_size];
       continue;
     }
 
-    Real boxhit_tmin, boxhit_tmax;
-    const bool hit_left = BoxRayIntersect(node->left->bounds,
-        ray.orig, ray.dir, ray.tmin, ray.tmax,
-        &boxhit_tmin, &boxhit_tmax);
+    const int left_id  = node_id + 1;
+    const int right_id = node.offset;
+    Real left_tmin = 0;
+    Real right_tmin = 0;
+
+    const bool hit_left = node_ray_intersect_at(nodes_, motion_bounds_, left_id, time,
+        traversal_ray, ray_tmp.tmin, ray_tmp.tmax, &left_tmin);
+    const bool hit_right = node_ray_intersect_at(nodes_, motion_bounds_, right_id, time,
+        traversal_ray, ray_tmp.tmin, ray_tmp.tmax, &right_tmin);
+
+    if (hit_left && hit_right) {
+      // visit the nearer child first
+      if (left_tmin <= right_tmin) {
+        stack[stack_size++] = right_id;
+        node_id = left_id;
+      } else {
+        stack[stack_size++] = left_id;
+        node_id = right_id;
+      }
+      assert(stack_size < MAX_STACK_DEPTH);
+      FJ_RAY_STATS_MAX(max_stack_size, stack_size);
+    }
+    else if (hit_left) {
+      node_id = left_id;
+    }
+    else if (hit_right) {
+      node_id = right_id;
+    }
+    else {
+      if (stack_size == 0)
+        break;
+      node_id = stack[--stack_size];
+    }
+  }
+
+  if (hit) {
+    *isect = *isect_min;
+  }
+  FJ_RAY_STATS_ADD(surface_stack_depth_sum, max_stack_size);
+
+  return hit;
+}
 
-    const bool hit_right = BoxRayIntersect(node->right->bounds,
-        ray.orig, ray.dir, ray.tmin, ray.tmax,
-        &boxhit_tmin, &boxhit_tmax);
+template <typename T>
+bool BVHAccelerator::occlude_tree(const T &primset, const Ray &ray, Real time,
+    Intersection *isect) const
+{
+  const TraversalRay traversal_ray(ray);
 
-    int whichhit = HIT_NONE;
-    whichhit |= hit_left  ? HIT_LEFT :  HIT_NONE;
-    whichhit |= hit_right ? HIT_RIGHT : HIT_NONE;
+  int stack[MAX_STACK_DEPTH];
+  int stack_size = 0;
+  int node_id = 0;
+  FJ_RAY_STATS_LOCAL(int max_stack_size = 0);
 
-    switch (whichhit) {
-    case HIT_NONE:
-      if (stack.empty())
-        goto loop_exit;
-      node = stack.top();
-      stack.pop();
-      break;
+  Real root_tmin = 0;
+  if (!node_ray_intersect_at(nodes_, motion_bounds_, 0, time,
+        traversal_ray, ray.tmin, ray.tmax, &root_tmin)) {
+    return false;
+  }
 
-    case HIT_LEFT:
-      node = node->left;
-      break;
+  // the ray is never shortened. traversal order doesn't matter
+  // since the first hit ends the traversal
+  for (;;) {
+    const BVHNode &node = nodes_[node_id];
+    FJ_RAY_STATS_ADD(surface_node_visit_count, 1);
 
-    case HIT_RIGHT:
-      node = node->right;
-      break;
+    if (node.is_leaf()) {
+      if (leaf_occlude(primset, node, node_id, ray, time, isect)) {
+        FJ_RAY_STATS_ADD(surface_stack_depth_sum, max_stack_size);
+        return true;
+      }
 
-    case HIT_BOTH:
-      stack.push(node->right);
-      node = node->left;
-      break;
+      if (stack_size == 0)
+        break;
+      node_id = stack[--stack_size];
+      continue;
+    }
 
-    default:
-      assert(!"invalid whichhit");
-      break;
+    const int left_id  = node_id + 1;
+    const int right_id = node.offset;
+    Real left_tmin = 0;
+    Real right_tmin = 0;
+
+    const bool hit_left = node_ray_intersect_at(nodes_, motion_bounds_, left_id, time,
+        traversal_ray, ray.tmin, ray.tmax, &left_tmin);
+    const bool hit_right = node_ray_intersect_at(nodes_, motion_bounds_, right_id, time,
+        traversal_ray, ray.tmin, ray.tmax, &right_tmin);
+
+    if (hit_left && hit_right) {
+      stack[stack_size++] = right_id;
+      node_id = left_id;
+      assert(stack_size < MAX_STACK_DEPTH);
+      FJ_RAY_STATS_MAX(max_stack_size, stack_size);
+    }
+    else if (hit_left) {
+      node_id = left_id;
+    }
+    else if (hit_right) {
+      node_id = right_id;
+    }
+    else {
+      if (stack_size == 0)
+        break;
+      node_id = stack[--stack_size];
     }
   }
-loop_exit:
+  FJ_RAY_STATS_ADD(surface_stack_depth_sum, max_stack_size);
 
-  if (hit) {
-    *isect = *isect_min;
-  }
+  return false;
+}
 
-  return hit;
+template <typename T>
+bool BVHAccelerator::leaf_intersect(const T &primset, const BVHNode &node, int node_id,
+    const Ray &ray, Real time, Intersection *isect) const
+{
+  return PrimitiveLeafTest<T>::IntersectList(primset,
+      &prim_indices_[node.offset], node.count, ray, time, isect);
 }
 
-// Compares an axis component of primitive centroid for std::sort.
-template<int Axis>
-class CentroidLess {
-public:
-  bool operator()(Primitive *a, Primitive *b) const
-  { 
-    return a->centroid[Axis] < b->centroid[Axis];
+template <typename T>
+bool BVHAccelerator::leaf_occlude(const T &primset, const BVHNode &node, int node_id,
+    const Ray &ray, Real time, Intersection *isect) const
+{
+  const int END = node.offset + node.count;
+
+  for (int i = node.offset; i < END; i++) {
+    FJ_RAY_STATS_ADD(surface_primitive_test_count, 1);
+    if (PrimitiveLeafTest<T>::Occlude(primset, prim_indices_[i], ray, time, isect)) {
+      return true;
+    }
   }
-};
+  return false;
+}
 
-static BVHNode *build_bvh(Primitive **primptrs, int begin, int end, int axis)
+bool BVHAccelerator::leaf_intersect(const Mesh &mesh, const BVHNode &node, int node_id,
+    const Ray &ray, Real time, Intersection *isect) const
 {
-  BVHNode *node = new_bvhnode();
-
-  if (end - begin == 1) {
-    node->prim_id = primptrs[begin]->index;
-    node->bounds  = primptrs[begin]->bounds;
-    return node;
+  if (cluster_offsets_.empty()) {
+    return PrimitiveLeafTest<Mesh>::IntersectList(mesh,
+        &prim_indices_[node.offset], node.count, ray, time, isect);
   }
 
-  Primitive **prim_begin = primptrs + begin;
-  Primitive **prim_end   = primptrs + end;
+  return PrimitiveLeafTest<Mesh>::IntersectCluster(mesh,
+      &prim_indices_[node.offset], &cluster_indices_[3 * node.offset],
+      &cluster_points_[cluster_offsets_[node_id]], node.count, ray, isect);
+}
 
-  switch (axis) {
-    case 0:
-      std::sort(prim_begin, prim_end, CentroidLess<0>());
-      break;
-    case 1:
-      std::sort(prim_begin, prim_end, CentroidLess<1>());
-      break;
-    case 2:
-      std::sort(prim_begin, prim_end, CentroidLess<2>());
-      break;
-    default:
-      assert(!"invalid axis");
-      break;
+bool BVHAccelerator::leaf_occlude(const Mesh &mesh, const BVHNode &node, int node_id,
+    const Ray &ray, Real time, Intersection *isect) const
+{
+  if (cluster_offsets_.empty()) {
+    return leaf_occlude<Mesh>(mesh, node, node_id, ray, time, isect);
   }
 
-  const int median = find_median(primptrs, begin, end, axis);
-  const int new_axis = (axis + 1) % 3;
-
-  node->left  = build_bvh(primptrs, begin, median, new_axis);
-  if (node->left == NULL)
-    return NULL;
+  FJ_RAY_STATS_ADD(surface_primitive_test_count, node.count);
+  return PrimitiveLeafTest<Mesh>::OccludeCluster(mesh,
+      &prim_indices_[node.offset], &cluster_indices_[3 * node.offset],
+      &cluster_points_[cluster_offsets_[node_id]], node.count, ray, isect);
+}
 
-  node->right = build_bvh(primptrs, median, end, new_axis);
-  if (node->right == NULL)
-    return NULL;
+unsigned int BVHAccelerator::leaf_intersect_cluster_packet(const BVHNode &node, int node_id,
+    const Ray *rays, unsigned int ray_mask, Intersection *isects) const
+{
+  const Mesh &mesh = *static_cast<const Mesh *>(GetPrimitiveSet());
+  unsigned int hit_mask = 0;
 
-  node->bounds = node->left->bounds;
-  node->bounds.AddBox(node->right->bounds);
+  for (int i = 0; ray_mask >> i != 0; i++) {
+    if (!(ray_mask & (1U << i))) {
+      continue;
+    }
+    Intersection isect_tmp;
+    const bool hit = PrimitiveLeafTest<Mesh>::IntersectCluster(mesh,
+        &prim_indices_[node.offset], &cluster_indices_[3 * node.offset],
+        &cluster_points_[cluster_offsets_[node_id]], node.count, rays[i], &isect_tmp);
+    if (hit && isect_tmp.t_hit < rays[i].tmax) {
+      isects[i] = isect_tmp;
+      hit_mask |= 1U << i;
+    }
+  }
 
-  return node;
+  return hit_mask;
 }
 
-static BVHNode *new_bvhnode()
+// the number of distinct vertices of faces in the leaf. local indices of
+// them are written to local_indices if not NULL
+static int cluster_leaf_vertices(const Mesh &mesh, const Index *prim_ids, int count,
+    Index *vertex_ids, uint8_t *local_indices)
 {
-  return new BVHNode();
+  int nverts = 0;
+
+  for (int i = 0; i < count; i++) {
+    const Index3 face = mesh.GetFaceIndices(prim_ids[i]);
+    const Index ids[3] = {face.i0, face.i1, face.i2};
+
+    for (int j = 0; j < 3; j++) {
+      int local = 0;
+      while (local < nverts && vertex_ids[local] != ids[j]) {
+        local++;
+      }
+      if (local == nverts) {
+        vertex_ids[nverts++] = ids[j];
+      }
+      if (local_indices != NULL) {
+        local_indices[3 * i + j] = static_cast<uint8_t>(local);
+      }
+    }
+  }
+  return nverts;
 }
 
-static void free_bvhnode_recursive(BVHNode *node)
+void BVHAccelerator::build_mesh_clusters()
 {
-  if (node == NULL)
+  std::vector<int32_t>().swap(cluster_offsets_);
+  std::vector<Vector>().swap(cluster_points_);
+  std::vector<uint8_t>().swap(cluster_indices_);
+
+  if (primset_type_ != PRIMSET_MESH) {
+    return;
+  }
+  Mesh &mesh = *static_cast<Mesh *>(GetPrimitiveSet());
+  // leaves without clusters test the precomputed triangles
+  if (!mesh_clusters_) {
+    mesh.PrecomputeTriangles();
     return;
+  }
+  if (!mesh.IsStatic()) {
+    return;
+  }
+
+  const int NNODES = static_cast<int>(nodes_.size());
+  Index vertex_ids[3 * BVH_MAX_LEAF_SIZE];
+
+  // sizes of clusters first so that arrays are allocated once
+  std::vector<int32_t> offsets(NNODES, 0);
+  int32_t npoints = 0;
+  for (int i = 0; i < NNODES; i++) {
+    const BVHNode &node = nodes_[i];
+    offsets[i] = npoints;
+    if (node.is_leaf()) {
+      npoints += cluster_leaf_vertices(mesh,
+          &prim_indices_[node.offset], node.count, vertex_ids, NULL);
+    }
+  }
+
+  std::vector<Vector> points(npoints);
+  std::vector<uint8_t> indices(3 * prim_indices_.size());
+  for (int i = 0; i < NNODES; i++) {
+    const BVHNode &node = nodes_[i];
+    if (!node.is_leaf()) {
+      continue;
+    }
+    const int nverts = cluster_leaf_vertices(mesh,
+        &prim_indices_[node.offset], node.count, vertex_ids, &indices[3 * node.offset]);
+    for (int j = 0; j < nverts; j++) {
+      points[offsets[i] + j] = mesh.GetPointPosition(vertex_ids[j]);
+    }
+  }
 
-  free_bvhnode_recursive(node->left);
-  free_bvhnode_recursive(node->right);
+  // commit
+  cluster_offsets_.swap(offsets);
+  cluster_points_.swap(points);
+  cluster_indices_.swap(indices);
+  MtInterleaveSharedMemory(cluster_offsets_);
+  MtInterleaveSharedMemory(cluster_points_);
+  MtInterleaveSharedMemory(cluster_indices_);
 
-  delete node;
+  // clusters have the vertices of all faces
+  mesh.ReleasePrecomputedTriangles();
 }
 
-static int find_median(Primitive **prims, int begin, int end, int axis)
+bool BVHAccelerator::intersect_all(const Ray &ray, Real time, HitList *hits) const
 {
-  assert(axis >= 0 && axis <= 2);
+  if (nodes_.empty()) {
+    return false;
+  }
 
-  int low  = begin;
-  int high = end - 1;
-  int mid  = -1;
-  const Real key = (prims[low]->centroid[axis] + prims[high]->centroid[axis]) / 2;
+  const PrimitiveSet *primset = GetPrimitiveSet();
+  const TraversalRay traversal_ray(ray);
 
-  while (low != mid) {
-    mid = (low + high) / 2;
-    if (key < prims[mid]->centroid[axis])
-      high = mid;
-    else if (prims[mid]->centroid[axis] < key)
-      low = mid;
-    else
-      break;
+  // the ray is shortened to the farthest hit kept once the list is full
+  Ray ray_tmp = ray;
+  ray_tmp.tmax = Min(ray.tmax, hits->GetMaxDistance());
+  bool hit = false;
+
+  int stack[MAX_STACK_DEPTH];
+  int stack_size = 0;
+  int node_id = 0;
+  FJ_RAY_STATS_LOCAL(int max_stack_size = 0);
+
+  Real root_tmin = 0;
+  if (!node_ray_intersect_at(nodes_, motion_bounds_, 0, time,
+        traversal_ray, ray_tmp.tmin, ray_tmp.tmax, &root_tmin)) {
+    return false;
   }
 
-  return mid + 1;
+  for (;;) {
+    const BVHNode &node = nodes_[node_id];
+    FJ_RAY_STATS_ADD(surface_node_visit_count, 1);
+
+    if (node.is_leaf()) {
+      const int END = node.offset + node.count;
+
+      for (int i = node.offset; i < END; i++) {
+        FJ_RAY_STATS_ADD(surface_primitive_test_count, 1);
+        if (primset->RayIntersectAll(prim_indices_[i], ray_tmp, time, hits)) {
+          ray_tmp.tmax = Min(ray.tmax, hits->GetMaxDistance());
+          hit = true;
+        }
+      }
+
+      if (stack_size == 0)
+        break;
+      node_id = stack[--stack_size];
+      continue;
+    }
+
+    const int left_id  = node_id + 1;
+    const int right_id = node.offset;
+    Real left_tmin = 0;
+    Real right_tmin = 0;
+
+    const bool hit_left = node_ray_intersect_at(nodes_, motion_bounds_, left_id, time,
+        traversal_ray, ray_tmp.tmin, ray_tmp.tmax, &left_tmin);
+    const bool hit_right = node_ray_intersect_at(nodes_, motion_bounds_, right_id, time,
+        traversal_ray, ray_tmp.tmin, ray_tmp.tmax, &right_tmin);
+
+    if (hit_left && hit_right) {
+      // visit the nearer child first so the list fills with close hits
+      if (left_tmin <= right_tmin) {
+        stack[stack_size++] = right_id;
+        node_id = left_id;
+      } else {
+        stack[stack_size++] = left_id;
+        node_id = right_id;
+      }
+      assert(stack_size < MAX_STACK_DEPTH);
+      FJ_RAY_STATS_MAX(max_stack_size, stack_size);
+    }
+    else if (hit_left) {
+      node_id = left_id;
+    }
+    else if (hit_right) {
+      node_id = right_id;
+    }
+    else {
+      if (stack_size == 0)
+        break;
+      node_id = stack[--stack_size];
+    }
+  }
+  FJ_RAY_STATS_ADD(surface_stack_depth_sum, max_stack_size);
+
+  return hit;
+}
+
+// tests rays of the packet until one hits the node. returns false without
+// testing them if the node is outside of the ranges of the packet
+static inline bool packet_node_intersect(const MappedArray<BVHNode> &nodes,
+    const std::vector<BVHMotionBounds> &motion_bounds, int node_id,
+    const RayPacket &packet, Real *hit_tmin)
+{
+  if (packet.coherent && motion_bounds.empty() &&
+      packet_misses_node(nodes[node_id], packet)) {
+    return false;
+  }
+
+  for (int i = 0; packet.ray_mask >> i != 0; i++) {
+    if (!(packet.ray_mask & (1U << i))) {
+      continue;
+    }
+    const Ray &ray = packet.rays[i];
+    if (node_ray_intersect_at(nodes, motion_bounds, node_id, packet.times[i],
+          packet.traversal_rays[i], ray.tmin, ray.tmax, hit_tmin)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned int BVHAccelerator::intersect_packet(const Ray *rays, const Real *times, int count,
+    unsigned int ray_mask, Intersection *isects) const
+{
+  if (nodes_.empty()) {
+    return 0;
+  }
+
+  const PrimitiveSet *primset = GetPrimitiveSet();
+
+  // rays are shortened to the closest hits found so far
+  RayPacket packet;
+  setup_ray_packet(rays, times, count, ray_mask, &packet);
+  unsigned int hit_mask = 0;
+
+  int stack[MAX_STACK_DEPTH];
+  int stack_size = 0;
+  int node_id = 0;
+  FJ_RAY_STATS_LOCAL(int max_stack_size = 0);
+
+  Real root_tmin = 0;
+  if (!packet_node_intersect(nodes_, motion_bounds_, 0, packet, &root_tmin)) {
+    return 0;
+  }
+
+  // nodes are visited while any ray of the packet hits them
+  for (;;) {
+    const BVHNode &node = nodes_[node_id];
+    FJ_RAY_STATS_ADD(surface_node_visit_count, 1);
+
+    if (node.is_leaf()) {
+      unsigned int leaf_mask = 0;
+      for (int i = 0; packet.ray_mask >> i != 0; i++) {
+        const Ray &ray = packet.rays[i];
+        Real leaf_tmin = 0;
+        if ((packet.ray_mask & (1U << i)) &&
+            node_ray_intersect_at(nodes_, motion_bounds_, node_id, times[i],
+              packet.traversal_rays[i], ray.tmin, ray.tmax, &leaf_tmin)) {
+          leaf_mask |= 1U << i;
+        }
+      }
+
+      if (leaf_mask != 0) {
+        const unsigned int closer_mask = cluster_offsets_.empty() ?
+            primset->RayIntersectPacket(&prim_indices_[node.offset], node.count,
+              packet.rays, times, leaf_mask, isects) :
+            leaf_intersect_cluster_packet(node, node_id, packet.rays, leaf_mask, isects);
+        FJ_RAY_STATS_ADD(surface_primitive_test_count, node.count);
+
+        if (closer_mask != 0) {
+          for (int i = 0; closer_mask >> i != 0; i++) {
+            if (closer_mask & (1U << i)) {
+              packet.rays[i].tmax = isects[i].t_hit;
+            }
+          }
+          hit_mask |= closer_mask;
+          update_packet_tmax(&packet);
+        }
+      }
+
+      if (stack_size == 0)
+        break;
+      node_id = stack[--stack_size];
+      continue;
+    }
+
+    const int left_id  = node_id + 1;
+    const int right_id = node.offset;
+    Real left_tmin = 0;
+    Real right_tmin = 0;
+
+    const bool hit_left = packet_node_intersect(nodes_, motion_bounds_, left_id,
+        packet, &left_tmin);
+    const bool hit_right = packet_node_intersect(nodes_, motion_bounds_, right_id,
+        packet, &right_tmin);
+
+    if (hit_left && hit_right) {
+      // visit the child nearer to the first ray hitting them first
+      if (left_tmin <= right_tmin) {
+        stack[stack_size++] = right_id;
+        node_id = left_id;
+      } else {
+        stack[stack_size++] = left_id;
+        node_id = right_id;
+      }
+      assert(stack_size < MAX_STACK_DEPTH);
+      FJ_RAY_STATS_MAX(max_stack_size, stack_size);
+    }
+    else if (hit_left) {
+      node_id = left_id;
+    }
+    else if (hit_right) {
+      node_id = right_id;
+    }
+    else {
+      if (stack_size == 0)
+        break;
+      node_id = stack[--stack_size];
+    }
+  }
+  FJ_RAY_STATS_ADD(surface_stack_depth_sum, max_stack_size);
+
+  return hit_mask;
+}
+
+const char *BVHAccelerator::get_name() const
+{
+  return ACCELERATOR_NAME;
+}
+
+std::size_t BVHAccelerator::get_memory_usage() const
+{
+  return
+      nodes_.GetMemoryUsage() +
+      prim_indices_.GetMemoryUsage() +
+      MemoryUsageOf(motion_bounds_) +
+      MemoryUsageOf(cluster_offsets_) +
+      MemoryUsageOf(cluster_points_) +
+      MemoryUsageOf(cluster_indices_);
+}
+
+bool BVHAccelerator::has_same_settings(const Accelerator &other) const
+{
+  const BVHAccelerator &bvh = static_cast<const BVHAccelerator &>(other);
+  return
+      build_mode_ == bvh.build_mode_ &&
+      leaf_size_ == bvh.leaf_size_ &&
+      split_budget_ == bvh.split_budget_ &&
+      mesh_clusters_ == bvh.mesh_clusters_ &&
+      cache_dir_ == bvh.cache_dir_;
+}
+
+static Box node_bounds(const BVHNode &node)
+{
+  return Box(
+      Vector(node.bounds_min[0], node.bounds_min[1], node.bounds_min[2]),
+      Vector(node.bounds_max[0], node.bounds_max[1], node.bounds_max[2]));
+}
+
+int BVHAccelerator::analyze(AcceleratorStats *stats) const
+{
+  if (nodes_.empty()) {
+    return -1;
+  }
+
+  // node and depth
+  std::vector<std::pair<int, int>> stack(1, std::make_pair(0, 0));
+  while (!stack.empty()) {
+    const int id = stack.back().first;
+    const int depth = stack.back().second;
+    stack.pop_back();
+
+    const BVHNode &node = nodes_[id];
+    if (node.is_leaf()) {
+      stats->AddLeaf(depth, node_bounds(node), node.count);
+      continue;
+    }
+    const Box children[2] = {node_bounds(nodes_[id + 1]), node_bounds(nodes_[node.offset])};
+    stats->AddInterior(depth, node_bounds(node), children, 2);
+    stack.push_back(std::make_pair(node.offset, depth + 1));
+    stack.push_back(std::make_pair(id + 1, depth + 1));
+  }
+
+  stats->Finish(node_bounds(nodes_[0]));
+  return 0;
+}
+
+int BvhBuildTree(const PrimitiveSet &primset, int build_mode, int leaf_size,
+    Real split_budget, std::vector<BVHNode> *nodes, std::vector<Index> *prim_indices)
+{
+  const int NPRIMS = primset.GetPrimitiveCount();
+
+  if (NPRIMS == 0) {
+    // TODO is NPRIMS == 0 error?
+    return -1;
+  }
+
+  std::vector<Primitive> prims(NPRIMS);
+  std::vector<Primitive*> primptrs(NPRIMS, NULL);
+
+  const int max_thread_count = MtGetMaxAvailableThreadCount();
+  const bool is_parallel = max_thread_count > 1 && NPRIMS >= PARALLEL_BUILD_MIN_PRIMS;
+  const int thread_count = is_parallel ? max_thread_count : 1;
+
+  std::vector<SubtreeTask> tasks;
+  ParallelBuild parallel;
+  parallel.primset = &primset;
+  parallel.prims = &prims[0];
+  parallel.primptrs = &primptrs[0];
+  parallel.nprims = NPRIMS;
+  parallel.build_mode = build_mode;
+  parallel.leaf_size = leaf_size;
+  parallel.tasks = &tasks;
+
+  const int NCHUNKS = (NPRIMS + BOUNDS_CHUNK_SIZE - 1) / BOUNDS_CHUNK_SIZE;
+  std::vector<int> chunk_que(NCHUNKS);
+  for (int i = 0; i < NCHUNKS; i++) {
+    chunk_que[i] = i;
+  }
+
+  MtRunParallelLoop(&parallel, compute_bounds_task, thread_count, chunk_que);
+
+  if (build_mode == BVH_BUILD_SBVH) {
+    // built on the calling thread as children of spatial splits share
+    // primitives
+    SplitBuildContext split_build(primset, leaf_size);
+    split_build.ref_count = NPRIMS;
+    split_build.max_ref_count = NPRIMS + static_cast<int>(NPRIMS * split_budget);
+
+    Box root_bounds;
+    root_bounds.ReverseInfinite();
+    for (int i = 0; i < NPRIMS; i++) {
+      root_bounds.AddBox(prims[i].bounds);
+    }
+    split_build.min_overlap_area = SBVH_MIN_OVERLAP * root_bounds.SurfaceArea();
+
+    build_sbvh(split_build, primptrs, 0, 0);
+
+    nodes->swap(split_build.nodes);
+    prim_indices->swap(split_build.prim_indices);
+    return 0;
+  }
+
+  BuildContext build(build_mode, leaf_size);
+  // a binary tree with N leaves has 2N-1 nodes
+  build.nodes.reserve(2 * NPRIMS - 1);
+
+  if (is_parallel) {
+    // build upper levels here then subtrees below them in parallel.
+    // subtrees cover disjoint ranges of primptrs so the resulting tree
+    // is the same as the one built on a single thread
+    build.task_prim_count = NPRIMS / (thread_count * SUBTREE_TASKS_PER_THREAD);
+    build.tasks = &tasks;
+
+    build_bvh(build, &primptrs[0], 0, NPRIMS, 0, 0);
+
+    // larger subtrees first
+    std::vector<int> task_que(tasks.size());
+    for (std::size_t i = 0; i < tasks.size(); i++) {
+      task_que[i] = static_cast<int>(i);
+    }
+    std::stable_sort(task_que.begin(), task_que.end(), SubtreeIsLarger(tasks));
+
+    MtRunParallelLoop(&parallel, build_subtree_task, thread_count, task_que);
+
+    std::vector<BVHNode> top_nodes;
+    top_nodes.swap(build.nodes);
+    emit_nodes(top_nodes, 0, tasks, &build.nodes);
+  } else {
+    build_bvh(build, &primptrs[0], 0, NPRIMS, 0, 0);
+  }
+
+  // leaves refer to primitives in the order they were partitioned
+  prim_indices->resize(NPRIMS);
+  for (int i = 0; i < NPRIMS; i++) {
+    (*prim_indices)[i] = primptrs[i]->index;
+  }
+  nodes->swap(build.nodes);
+
+  return 0;
+}
+
+static LoopStatus compute_bounds_task(void *data, const ThreadContext &context)
+{
+  ParallelBuild *parallel = reinterpret_cast<ParallelBuild *>(data);
+  const int begin = context.iteration_id * BOUNDS_CHUNK_SIZE;
+  const int end = std::min(begin + BOUNDS_CHUNK_SIZE, parallel->nprims);
+
+  for (int i = begin; i < end; i++) {
+    Primitive &prim = parallel->prims[i];
+    parallel->primset->GetPrimitiveBounds(i, &prim.bounds);
+    prim.centroid = prim.bounds.Centroid();
+    prim.index = i;
+
+    parallel->primptrs[i] = &prim;
+  }
+
+  return LoopStatus::Continue;
+}
+
+static LoopStatus build_subtree_task(void *data, const ThreadContext &context)
+{
+  ParallelBuild *parallel = reinterpret_cast<ParallelBuild *>(data);
+  SubtreeTask &task = (*parallel->tasks)[context.iteration_id];
+
+  BuildContext build(parallel->build_mode, parallel->leaf_size);
+  build.nodes.reserve(2 * (task.end - task.begin) - 1);
+
+  build_bvh(build, parallel->primptrs, task.begin, task.end, task.axis, task.depth);
+  task.nodes.swap(build.nodes);
+
+  return LoopStatus::Continue;
+}
+
+// Copies the upper levels and the subtrees into one depth-first array
+// and returns the index of the copied node.
+static int emit_nodes(const std::vector<BVHNode> &top_nodes, int top_id,
+    std::vector<SubtreeTask> &tasks, std::vector<BVHNode> *nodes)
+{
+  const BVHNode &top = top_nodes[top_id];
+  const int node_id = static_cast<int>(nodes->size());
+
+  if (top.count < 0) {
+    // placeholder. subtree nodes are relative to the subtree root
+    std::vector<BVHNode> &subtree = tasks[-top.count - 1].nodes;
+    for (std::size_t i = 0; i < subtree.size(); i++) {
+      BVHNode node = subtree[i];
+      if (!node.is_leaf()) {
+        node.offset += node_id;
+      }
+      nodes->push_back(node);
+    }
+    std::vector<BVHNode>().swap(subtree);
+    return node_id;
+  }
+
+  nodes->push_back(top);
+  if (top.is_leaf()) {
+    return node_id;
+  }
+
+  emit_nodes(top_nodes, top_id + 1, tasks, nodes);
+  const int right_id = emit_nodes(top_nodes, top.offset, tasks, nodes);
+  (*nodes)[node_id].offset = right_id;
+
+  return node_id;
+}
+
+// Compares an axis component of primitive centroid for std::sort.
+template<int Axis>
+class CentroidLess {
+public:
+  bool operator()(Primitive *a, Primitive *b) const
+  {
+    return a->centroid[Axis] < b->centroid[Axis];
+  }
+};
+
+// Tells if the centroid of primitive is on the left side of split plane.
+class CentroidIsLeft {
+public:
+  CentroidIsLeft(int axis, Real split) : axis_(axis), split_(split) {}
+  bool operator()(Primitive *prim) const
+  {
+    return prim->centroid[axis_] < split_;
+  }
+private:
+  int axis_;
+  Real split_;
+};
+
+static void sort_by_centroid(Primitive **primptrs, int begin, int end, int axis)
+{
+  Primitive **prim_begin = primptrs + begin;
+  Primitive **prim_end   = primptrs + end;
+
+  switch (axis) {
+    case 0:
+      std::sort(prim_begin, prim_end, CentroidLess<0>());
+      break;
+    case 1:
+      std::sort(prim_begin, prim_end, CentroidLess<1>());
+      break;
+    case 2:
+      std::sort(prim_begin, prim_end, CentroidLess<2>());
+      break;
+    default:
+      assert(!"invalid axis");
+      break;
+  }
+}
+
+// Builds the subtree of prims [begin, end) in depth-first order and
+// returns the index of its root node.
+static int build_bvh(BuildContext &build, Primitive **primptrs,
+    int begin, int end, int axis, int depth)
+{
+  const int node_id = static_cast<int>(build.nodes.size());
+  build.nodes.push_back(BVHNode());
+
+  Box bounds;
+  bounds.ReverseInfinite();
+  for (int i = begin; i < end; i++) {
+    bounds.AddBox(primptrs[i]->bounds);
+  }
+  set_node_bounds(&build.nodes[node_id], bounds);
+
+  if (end - begin <= build.leaf_size || depth == MAX_STACK_DEPTH - 1) {
+    build.nodes[node_id].offset = begin;
+    build.nodes[node_id].count = end - begin;
+    return node_id;
+  }
+
+  if (build.tasks != NULL && end - begin <= build.task_prim_count) {
+    SubtreeTask task;
+    task.begin = begin;
+    task.end = end;
+    task.axis = axis;
+    task.depth = depth;
+    build.tasks->push_back(task);
+
+    // negative count marks placeholder of a subtree task
+    build.nodes[node_id].offset = 0;
+    build.nodes[node_id].count = -static_cast<int>(build.tasks->size());
+    return node_id;
+  }
+
+  int split = -1;
+  int new_axis = (axis + 1) % 3;
+
+  if (build.build_mode == BVH_BUILD_SAH) {
+    int sah_axis = axis;
+    split = find_sah_split(primptrs, begin, end, &sah_axis);
+    new_axis = sah_axis;
+  }
+
+  if (split == -1) {
+    // median split. this is also the fallback when SAH can't separate prims
+    sort_by_centroid(primptrs, begin, end, axis);
+    split = find_median(primptrs, begin, end, axis);
+  }
+
+  build_bvh(build, primptrs, begin, split, new_axis, depth + 1);
+  const int right_id = build_bvh(build, primptrs, split, end, new_axis, depth + 1);
+
+  // nodes may be reallocated while building children
+  build.nodes[node_id].offset = right_id;
+  build.nodes[node_id].count = 0;
+
+  return node_id;
+}
+
+// Finds the split by binned SAH over all three axes and partitions primitives.
+// Returns the index of the first primitive on the right side, or -1 when
+// the primitives can't be separated e.g. all centroids are at the same point.
+static int find_sah_split(Primitive **prims, int begin, int end, int *axis)
+{
+  int best_axis = -1;
+  Real split_pos = 0;
+
+  if (evaluate_sah_split(prims, begin, end, &best_axis, &split_pos) == REAL_MAX) {
+    return -1;
+  }
+
+  Primitive **mid = std::partition(prims + begin, prims + end,
+      CentroidIsLeft(best_axis, split_pos));
+  const int split = static_cast<int>(mid - prims);
+
+  if (split == begin || split == end) {
+    return -1;
+  }
+
+  *axis = best_axis;
+  return split;
+}
+
+// Returns the cost of the best split by binned SAH and the split plane
+// of centroids. REAL_MAX if there is no split e.g. all centroids are at
+// the same point.
+static Real evaluate_sah_split(Primitive **prims, int begin, int end,
+    int *axis, Real *split_pos)
+{
+  class Bin {
+  public:
+    Bin() : bounds(), count(0) { bounds.ReverseInfinite(); }
+    Box bounds;
+    int count;
+  };
+
+  Box centroid_bounds;
+  Box node_bounds;
+  centroid_bounds.ReverseInfinite();
+  node_bounds.ReverseInfinite();
+
+  for (int i = begin; i < end; i++) {
+    centroid_bounds.AddPoint(prims[i]->centroid);
+    node_bounds.AddBox(prims[i]->bounds);
+  }
+
+  const Real node_area = node_bounds.SurfaceArea();
+  const Real inv_node_area = node_area > 0 ? 1 / node_area : 1;
+  const Vector extent = centroid_bounds.Diagonal();
+
+  Real best_cost = REAL_MAX;
+  int best_axis = -1;
+  int best_bin = -1;
+
+  for (int ax = 0; ax < 3; ax++) {
+    if (extent[ax] <= 0) {
+      continue;
+    }
+
+    Bin bins[SAH_BIN_COUNT];
+    const Real scale = SAH_BIN_COUNT / extent[ax];
+
+    for (int i = begin; i < end; i++) {
+      int b = static_cast<int>((prims[i]->centroid[ax] - centroid_bounds.min[ax]) * scale);
+      b = b < SAH_BIN_COUNT ? b : SAH_BIN_COUNT - 1;
+      bins[b].bounds.AddBox(prims[i]->bounds);
+      bins[b].count++;
+    }
+
+    // sweep from right to accumulate right side areas
+    Real right_area[SAH_BIN_COUNT];
+    int right_count[SAH_BIN_COUNT];
+    Box right_bounds;
+    int count = 0;
+    right_bounds.ReverseInfinite();
+
+    for (int b = SAH_BIN_COUNT - 1; b > 0; b--) {
+      right_bounds.AddBox(bins[b].bounds);
+      count += bins[b].count;
+      right_area[b] = right_bounds.SurfaceArea();
+      right_count[b] = count;
+    }
+
+    // sweep from left and evaluate cost at each bin boundary
+    Box left_bounds;
+    int left_count = 0;
+    left_bounds.ReverseInfinite();
+
+    for (int b = 1; b < SAH_BIN_COUNT; b++) {
+      left_bounds.AddBox(bins[b - 1].bounds);
+      left_count += bins[b - 1].count;
+
+      if (left_count == 0 || right_count[b] == 0) {
+        continue;
+      }
+
+      const Real cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST *
+          (left_count * left_bounds.SurfaceArea() +
+          right_count[b] * right_area[b]) * inv_node_area;
+
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = ax;
+        best_bin = b;
+      }
+    }
+  }
+
+  if (best_axis == -1) {
+    return REAL_MAX;
+  }
+
+  *axis = best_axis;
+  *split_pos = centroid_bounds.min[best_axis] +
+      best_bin * extent[best_axis] / SAH_BIN_COUNT;
+  return best_cost;
+}
+
+static int find_median(Primitive **prims, int begin, int end, int axis)
+{
+  assert(axis >= 0 && axis <= 2);
+
+  int low  = begin;
+  int high = end - 1;
+  int mid  = -1;
+  const Real key = (prims[low]->centroid[axis] + prims[high]->centroid[axis]) / 2;
+
+  while (low != mid) {
+    mid = (low + high) / 2;
+    if (key < prims[mid]->centroid[axis])
+      high = mid;
+    else if (prims[mid]->centroid[axis] < key)
+      low = mid;
+    else
+      break;
+  }
+
+  return mid + 1;
+}
+
+// Builds the subtree of the references in depth-first order choosing object
+// or spatial splits by SAH and returns the index of its root node. refs are
+// cleared before building children.
+static int build_sbvh(SplitBuildContext &build, std::vector<Primitive *> &refs,
+    int axis, int depth)
+{
+  const int node_id = static_cast<int>(build.nodes.size());
+  build.nodes.push_back(BVHNode());
+
+  const int NREFS = static_cast<int>(refs.size());
+  Box bounds;
+  bounds.ReverseInfinite();
+  for (int i = 0; i < NREFS; i++) {
+    bounds.AddBox(refs[i]->bounds);
+  }
+  set_node_bounds(&build.nodes[node_id], bounds);
+
+  if (NREFS <= build.leaf_size || depth == MAX_STACK_DEPTH - 1) {
+    build.nodes[node_id].offset = static_cast<int>(build.prim_indices.size());
+    build.nodes[node_id].count = NREFS;
+    for (int i = 0; i < NREFS; i++) {
+      build.prim_indices.push_back(refs[i]->index);
+    }
+    return node_id;
+  }
+
+  Primitive **prims = &refs[0];
+  int object_axis = axis;
+  Real object_pos = 0;
+  const Real object_cost = evaluate_sah_split(prims, 0, NREFS, &object_axis, &object_pos);
+
+  // spatial splits only pay off where children of the object split overlap
+  bool try_spatial = build.ref_count < build.max_ref_count;
+  if (try_spatial && object_cost < REAL_MAX) {
+    Box left_bounds, right_bounds;
+    left_bounds.ReverseInfinite();
+    right_bounds.ReverseInfinite();
+    for (int i = 0; i < NREFS; i++) {
+      Box &side = prims[i]->centroid[object_axis] < object_pos ? left_bounds : right_bounds;
+      side.AddBox(prims[i]->bounds);
+    }
+    left_bounds.Clip(right_bounds);
+    try_spatial = left_bounds.SurfaceArea() > build.min_overlap_area;
+  }
+
+  SpatialSplit spatial;
+  Real spatial_cost = REAL_MAX;
+  if (try_spatial) {
+    spatial_cost = evaluate_spatial_split(prims, NREFS, bounds, &spatial);
+    const int added = spatial.left_count + spatial.right_count - NREFS;
+    if (build.ref_count + added > build.max_ref_count) {
+      spatial_cost = REAL_MAX;
+    }
+  }
+
+  std::vector<Primitive *> left_refs;
+  std::vector<Primitive *> right_refs;
+  int new_axis = (axis + 1) % 3;
+
+  if (spatial_cost < object_cost) {
+    split_references(build, refs, spatial, &left_refs, &right_refs);
+    if (left_refs.empty() || right_refs.empty()) {
+      left_refs.clear();
+      right_refs.clear();
+    } else {
+      build.ref_count += static_cast<int>(left_refs.size() + right_refs.size()) - NREFS;
+      new_axis = spatial.axis;
+    }
+  }
+
+  if (left_refs.empty() && object_cost < REAL_MAX) {
+    Primitive **mid = std::partition(prims, prims + NREFS,
+        CentroidIsLeft(object_axis, object_pos));
+    const int split = static_cast<int>(mid - prims);
+    if (split != 0 && split != NREFS) {
+      left_refs.assign(prims, prims + split);
+      right_refs.assign(prims + split, prims + NREFS);
+      new_axis = object_axis;
+    }
+  }
+
+  if (left_refs.empty()) {
+    // median split as the fallback when SAH can't separate references
+    sort_by_centroid(prims, 0, NREFS, axis);
+    const int split = find_median(prims, 0, NREFS, axis);
+    left_refs.assign(prims, prims + split);
+    right_refs.assign(prims + split, prims + NREFS);
+  }
+
+  std::vector<Primitive *>().swap(refs);
+
+  build_sbvh(build, left_refs, new_axis, depth + 1);
+  const int right_id = build_sbvh(build, right_refs, new_axis, depth + 1);
+
+  // nodes may be reallocated while building children
+  build.nodes[node_id].offset = right_id;
+  build.nodes[node_id].count = 0;
+
+  return node_id;
+}
+
+// bounds of the part of the reference between lo and hi along the axis.
+// returns false if the part is empty
+static bool clip_reference(const PrimitiveSet &primset, const Primitive &prim,
+    int axis, Real lo, Real hi, Box *bounds)
+{
+  Box clip = prim.bounds;
+  clip.min[axis] = Max(clip.min[axis], lo);
+  clip.max[axis] = Min(clip.max[axis], hi);
+
+  primset.GetClippedPrimitiveBounds(prim.index, clip, bounds);
+  return !bounds->IsEmpty();
+}
+
+static Primitive *add_split_reference(SplitBuildContext &build, int index,
+    const Box &bounds)
+{
+  build.split_prims.push_back(Primitive());
+  Primitive &prim = build.split_prims.back();
+  prim.bounds = bounds;
+  prim.centroid = bounds.Centroid();
+  prim.index = index;
+  return &prim;
+}
+
+// Finds the split plane by binned SAH over all three axes where bounds of
+// references are cut into every bin they overlap. primitives are clipped only
+// when the split is made as clipping them for every bin makes the build
+// several times slower. entering and exiting references are counted in the
+// first and last bins so straddling ones count on both sides.
+// Returns the cost or REAL_MAX if there is no split.
+static Real evaluate_spatial_split(Primitive *const *prims, int count,
+    const Box &node_bounds, SpatialSplit *split)
+{
+  const Real node_area = node_bounds.SurfaceArea();
+  const Real inv_node_area = node_area > 0 ? 1 / node_area : 1;
+  const Vector extent = node_bounds.Diagonal();
+  Real best_cost = REAL_MAX;
+
+  for (int ax = 0; ax < 3; ax++) {
+    if (extent[ax] <= 0) {
+      continue;
+    }
+
+    Box bins[SAH_BIN_COUNT];
+    int entries[SAH_BIN_COUNT] = {0};
+    int exits[SAH_BIN_COUNT] = {0};
+    const Real origin = node_bounds.min[ax];
+    const Real bin_width = extent[ax] / SAH_BIN_COUNT;
+    const Real scale = SAH_BIN_COUNT / extent[ax];
+
+    for (int b = 0; b < SAH_BIN_COUNT; b++) {
+      bins[b].ReverseInfinite();
+    }
+
+    for (int i = 0; i < count; i++) {
+      const Primitive &prim = *prims[i];
+      int first = static_cast<int>((prim.bounds.min[ax] - origin) * scale);
+      int last = static_cast<int>((prim.bounds.max[ax] - origin) * scale);
+      first = std::max(0, std::min(first, SAH_BIN_COUNT - 1));
+      last = std::max(first, std::min(last, SAH_BIN_COUNT - 1));
+
+      if (first == last) {
+        bins[first].AddBox(prim.bounds);
+      } else {
+        for (int b = first; b <= last; b++) {
+          const Real lo = origin + b * bin_width;
+          const Real hi = b == SAH_BIN_COUNT - 1 ? node_bounds.max[ax] : lo + bin_width;
+          Box cut = prim.bounds;
+          cut.min[ax] = Max(cut.min[ax], lo);
+          cut.max[ax] = Min(cut.max[ax], hi);
+          bins[b].AddBox(cut);
+        }
+      }
+      entries[first]++;
+      exits[last]++;
+    }
+
+    // sweep from right to accumulate right side bounds
+    Box right_bounds[SAH_BIN_COUNT];
+    int right_count[SAH_BIN_COUNT];
+    Box right;
+    int exit_count = 0;
+    right.ReverseInfinite();
+
+    for (int b = SAH_BIN_COUNT - 1; b > 0; b--) {
+      right.AddBox(bins[b]);
+      exit_count += exits[b];
+      right_bounds[b] = right;
+      right_count[b] = exit_count;
+    }
+
+    // sweep from left and evaluate cost at each bin boundary
+    Box left;
+    int left_count = 0;
+    left.ReverseInfinite();
+
+    for (int b = 1; b < SAH_BIN_COUNT; b++) {
+      left.AddBox(bins[b - 1]);
+      left_count += entries[b - 1];
+
+      if (left_count == 0 || right_count[b] == 0) {
+        continue;
+      }
+
+      const Real cost = SAH_TRAVERSAL_COST + SAH_INTERSECTION_COST *
+          (left_count * left.SurfaceArea() +
+          right_count[b] * right_bounds[b].SurfaceArea()) * inv_node_area;
+
+      if (cost < best_cost) {
+        best_cost = cost;
+        split->axis = ax;
+        split->position = origin + b * bin_width;
+        split->left_bounds = left;
+        split->right_bounds = right_bounds[b];
+        split->left_count = left_count;
+        split->right_count = right_count[b];
+      }
+    }
+  }
+
+  return best_cost;
+}
+
+// Distributes references to the sides of the spatial split. a straddling
+// reference is clipped into both sides unless putting it whole into one
+// side costs less (unsplitting)
+static void split_references(SplitBuildContext &build,
+    const std::vector<Primitive *> &refs, const SpatialSplit &split,
+    std::vector<Primitive *> *left_refs, std::vector<Primitive *> *right_refs)
+{
+  const int ax = split.axis;
+  const Real pos = split.position;
+  Box left_bounds = split.left_bounds;
+  Box right_bounds = split.right_bounds;
+  int left_count = split.left_count;
+  int right_count = split.right_count;
+
+  for (std::size_t i = 0; i < refs.size(); i++) {
+    Primitive *prim = refs[i];
+
+    if (prim->bounds.max[ax] <= pos) {
+      left_refs->push_back(prim);
+      continue;
+    }
+    if (prim->bounds.min[ax] >= pos) {
+      right_refs->push_back(prim);
+      continue;
+    }
+
+    Box left_whole = left_bounds;
+    Box right_whole = right_bounds;
+    left_whole.AddBox(prim->bounds);
+    right_whole.AddBox(prim->bounds);
+
+    const Real left_area = left_bounds.SurfaceArea();
+    const Real right_area = right_bounds.SurfaceArea();
+    const Real split_cost = left_area * left_count + right_area * right_count;
+    const Real left_cost = left_whole.SurfaceArea() * left_count +
+        right_area * (right_count - 1);
+    const Real right_cost = left_area * (left_count - 1) +
+        right_whole.SurfaceArea() * right_count;
+
+    if (left_cost < split_cost && left_cost <= right_cost) {
+      left_refs->push_back(prim);
+      left_bounds = left_whole;
+      right_count--;
+      continue;
+    }
+    if (right_cost < split_cost) {
+      right_refs->push_back(prim);
+      right_bounds = right_whole;
+      left_count--;
+      continue;
+    }
+
+    Box clipped_left, clipped_right;
+    const bool in_left = clip_reference(build.primset, *prim, ax, -REAL_MAX, pos,
+        &clipped_left);
+    const bool in_right = clip_reference(build.primset, *prim, ax, pos, REAL_MAX,
+        &clipped_right);
+
+    if (in_left) {
+      left_refs->push_back(add_split_reference(build, prim->index, clipped_left));
+    }
+    if (in_right) {
+      right_refs->push_back(add_split_reference(build, prim->index, clipped_right));
+    }
+    if (!in_left && !in_right) {
+      // only by rounding. keeps it whole
+      left_refs->push_back(prim);
+    }
+  }
+}
+
+static void set_node_bounds(BVHNode *node, const Box &box)
+{
+  for (int i = 0; i < 3; i++) {
+    node->bounds_min[i] = RoundDownToFloat(box.min[i]);
+    node->bounds_max[i] = RoundUpToFloat(box.max[i]);
+  }
+}
+
+static void refit_node_bounds(const PrimitiveSet &primset,
+    const MappedArray<Index> &prim_indices, MappedArray<BVHNode> *nodes)
+{
+  const int NNODES = static_cast<int>(nodes->size());
+  std::vector<Box> bounds(NNODES);
+
+  // children are always after their parent in depth-first order
+  for (int i = NNODES - 1; i >= 0; i--) {
+    BVHNode &node = (*nodes)[i];
+    bounds[i].ReverseInfinite();
+
+    if (node.is_leaf()) {
+      for (int j = node.offset; j < node.offset + node.count; j++) {
+        Box prim_bounds;
+        primset.GetPrimitiveBounds(prim_indices[j], &prim_bounds);
+        bounds[i].AddBox(prim_bounds);
+      }
+    } else {
+      bounds[i].AddBox(bounds[i + 1]);
+      bounds[i].AddBox(bounds[node.offset]);
+    }
+    set_node_bounds(&node, bounds[i]);
+  }
+}
+
+static void compute_motion_bounds(const PrimitiveSet &primset,
+    const MappedArray<BVHNode> &nodes, const MappedArray<Index> &prim_indices,
+    std::vector<BVHMotionBounds> *motion_bounds)
+{
+  const int NNODES = static_cast<int>(nodes.size());
+  std::vector<Box> open(NNODES);
+  std::vector<Box> close(NNODES);
+
+  // children are always after their parent in depth-first order
+  for (int i = NNODES - 1; i >= 0; i--) {
+    const BVHNode &node = nodes[i];
+    open[i].ReverseInfinite();
+    close[i].ReverseInfinite();
+
+    if (node.is_leaf()) {
+      for (int j = node.offset; j < node.offset + node.count; j++) {
+        Box bounds_open, bounds_close;
+        primset.GetPrimitiveMotionBounds(prim_indices[j], &bounds_open, &bounds_close);
+        open[i].AddBox(bounds_open);
+        close[i].AddBox(bounds_close);
+      }
+    } else {
+      open[i].AddBox(open[i + 1]);
+      open[i].AddBox(open[node.offset]);
+      close[i].AddBox(close[i + 1]);
+      close[i].AddBox(close[node.offset]);
+    }
+  }
+
+  motion_bounds->resize(NNODES);
+  for (int i = 0; i < NNODES; i++) {
+    BVHMotionBounds &bounds = (*motion_bounds)[i];
+    for (int j = 0; j < 3; j++) {
+      bounds.open_min[j]  = RoundDownToFloat(open[i].min[j]);
+      bounds.open_max[j]  = RoundUpToFloat(open[i].max[j]);
+      bounds.close_min[j] = RoundDownToFloat(close[i].min[j]);
+      bounds.close_max[j] = RoundUpToFloat(close[i].max[j]);
+    }
+  }
+}
+
+static Real node_surface_area(const BVHNode &node)
+{
+  const Real dx = node.bounds_max[0] - node.bounds_min[0];
+  const Real dy = node.bounds_max[1] - node.bounds_min[1];
+  const Real dz = node.bounds_max[2] - node.bounds_min[2];
+  return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+static Real compute_tree_cost(const MappedArray<BVHNode> &nodes)
+{
+  if (nodes.empty()) {
+    return 0;
+  }
+
+  // expected number of node visits and primitive tests of a ray hitting
+  // the root without termination
+  Real cost = 0;
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    const BVHNode &node = nodes[i];
+    const Real area = node_surface_area(node);
+    cost += node.is_leaf() ? area * node.count : area;
+  }
+
+  const Real root_area = node_surface_area(nodes[0]);
+  return root_area > 0 ? cost / root_area : 0;
+}
+
+static bool node_ray_intersect(const BVHNode &node, const TraversalRay &ray,
+    Real ray_tmin, Real ray_tmax, Real *hit_tmin)
+{
+  Real hit_tmax = 0;
+  return RayBoxIntersect(ray, node.bounds_min, node.bounds_max,
+      ray_tmin, ray_tmax, hit_tmin, &hit_tmax);
+}
+
+static bool motion_node_ray_intersect(const BVHMotionBounds &bounds, Real time,
+    const TraversalRay &ray, Real ray_tmin, Real ray_tmax, Real *hit_tmin)
+{
+  Real bmin[3];
+  Real bmax[3];
+
+  for (int i = 0; i < 3; i++) {
+    bmin[i] = bounds.open_min[i] +
+        time * (static_cast<Real>(bounds.close_min[i]) - bounds.open_min[i]);
+    bmax[i] = bounds.open_max[i] +
+        time * (static_cast<Real>(bounds.close_max[i]) - bounds.open_max[i]);
+  }
+
+  Real hit_tmax = 0;
+  return RayBoxIntersect(ray, bmin, bmax, ray_tmin, ray_tmax, hit_tmin, &hit_tmax);
+}
+
+static void setup_ray_packet(const Ray *rays, const Real *times, int count,
+    unsigned int ray_mask, RayPacket *packet)
+{
+  bool has_first = false;
+  int signs[3] = {0, 0, 0};
+
+  packet->times = times;
+  packet->ray_mask = ray_mask;
+  packet->coherent = true;
+
+  for (int i = 0; i < count; i++) {
+    const Ray &ray = rays[i];
+    packet->rays[i] = ray;
+    packet->traversal_rays[i] = TraversalRay(ray);
+
+    if (!(ray_mask & (1U << i))) {
+      continue;
+    }
+
+    const Vector &inv_dir = packet->traversal_rays[i].inv_dir;
+    if (!has_first) {
+      packet->orig_min = packet->orig_max = ray.orig;
+      packet->inv_min = packet->inv_max = inv_dir;
+      packet->tmin = ray.tmin;
+      for (int j = 0; j < 3; j++) {
+        signs[j] = ray.dir[j] > 0 ? 1 : (ray.dir[j] < 0 ? -1 : 0);
+      }
+      has_first = true;
+    }
+
+    for (int j = 0; j < 3; j++) {
+      const int sign = ray.dir[j] > 0 ? 1 : (ray.dir[j] < 0 ? -1 : 0);
+      // zero components give infinite inverses that can't be bounded
+      if (sign == 0 || sign != signs[j]) {
+        packet->coherent = false;
+      }
+      packet->orig_min[j] = Min(packet->orig_min[j], ray.orig[j]);
+      packet->orig_max[j] = Max(packet->orig_max[j], ray.orig[j]);
+      packet->inv_min[j] = Min(packet->inv_min[j], inv_dir[j]);
+      packet->inv_max[j] = Max(packet->inv_max[j], inv_dir[j]);
+    }
+    packet->tmin = Min(packet->tmin, ray.tmin);
+  }
+
+  update_packet_tmax(packet);
+}
+
+static void update_packet_tmax(RayPacket *packet)
+{
+  packet->tmax = -REAL_MAX;
+
+  for (int i = 0; packet->ray_mask >> i != 0; i++) {
+    if (packet->ray_mask & (1U << i)) {
+      packet->tmax = Max(packet->tmax, packet->rays[i].tmax);
+    }
+  }
+}
+
+static Real min_product(Real a0, Real a1, Real b0, Real b1)
+{
+  return Min(Min(a0 * b0, a0 * b1), Min(a1 * b0, a1 * b1));
+}
+
+static Real max_product(Real a0, Real a1, Real b0, Real b1)
+{
+  return Max(Max(a0 * b0, a0 * b1), Max(a1 * b0, a1 * b1));
+}
+
+// interval arithmetic over origins and inverse directions gives the earliest
+// entry and the latest exit of any ray in the packet on each slab
+static bool packet_misses_node(const BVHNode &node, const RayPacket &packet)
+{
+  Real tmin = packet.tmin;
+  Real tmax = packet.tmax;
+
+  for (int i = 0; i < 3; i++) {
+    const bool positive = packet.inv_min[i] > 0;
+    const Real near = positive ? node.bounds_min[i] : node.bounds_max[i];
+    const Real far  = positive ? node.bounds_max[i] : node.bounds_min[i];
+
+    const Real t0 = min_product(near - packet.orig_max[i], near - packet.orig_min[i],
+        packet.inv_min[i], packet.inv_max[i]);
+    const Real t1 = max_product(far - packet.orig_max[i], far - packet.orig_min[i],
+        packet.inv_min[i], packet.inv_max[i]);
+
+    tmin = t0 > tmin ? t0 : tmin;
+    tmax = t1 < tmax ? t1 : tmax;
+    if (tmin > tmax) {
+      return true;
+    }
+  }
+
+  return false;
 }
 
 } // namespace xxx
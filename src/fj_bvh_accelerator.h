@@ -5,22 +5,165 @@
 #define FJ_BVH_ACCELERATOR_H
 
 #include "fj_accelerator.h"
+#include "fj_mapped_array.h"
+#include "fj_vector.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
 
 namespace fj {
 
-class BVHNode;
+class Mesh;
+
+// BVH_BUILD_SBVH also splits primitives by planes when their bounds overlap
+// (Stich et al. 2009). leaves may refer to a primitive more than once
+enum BVHBuildMode {
+  BVH_BUILD_MEDIAN = 0,
+  BVH_BUILD_SAH,
+  BVH_BUILD_SBVH
+};
+
+// subtrees deeper than this are made into leaves so traversal stack never overflows
+const int BVH_MAX_DEPTH = 128;
+const int BVH_MAX_LEAF_SIZE = 64;
+// references added by spatial splits relative to the number of primitives
+const Real BVH_DEFAULT_SPLIT_BUDGET = .3;
+// refit trees costing more than this relative to the built tree are rebuilt
+const Real BVH_MAX_REFIT_COST_RATIO = 1.5;
+
+// 32-byte node stored in depth-first order. the left child of an interior node
+// is always the next node in the array. bounds are rounded outward to float.
+class BVHNode {
+public:
+  BVHNode() : bounds_min(), bounds_max(), offset(0), count(0) {}
+  ~BVHNode() {}
+
+  bool is_leaf() const { return count > 0; }
+
+  float bounds_min[3];
+  float bounds_max[3];
+  // leaf: index of the first primitive in ordered primitive array
+  // interior: index of the right child node
+  int32_t offset;
+  // leaf: number of primitives. interior: 0
+  int32_t count;
+};
+
+// bounds of a node at shutter open and close when primitives move.
+// traversal interpolates them at the ray time. rounded outward to float.
+class BVHMotionBounds {
+public:
+  BVHMotionBounds() : open_min(), open_max(), close_min(), close_max() {}
+  ~BVHMotionBounds() {}
+
+  float open_min[3];
+  float open_max[3];
+  float close_min[3];
+  float close_max[3];
+};
+
+// Builds a binary tree over all primitives in primset. nodes are stored in
+// depth-first order and leaves refer to ranges of prim_indices. split_budget
+// limits references added by BVH_BUILD_SBVH so prim_indices has up to
+// (1 + split_budget) times as many entries as primitives.
+// Returns -1 if primset has no primitives.
+extern int BvhBuildTree(const PrimitiveSet &primset, int build_mode, int leaf_size,
+    Real split_budget, std::vector<BVHNode> *nodes, std::vector<Index> *prim_indices);
 
 class BVHAccelerator : public Accelerator {
 public:
   BVHAccelerator();
   ~BVHAccelerator();
 
-public:
+  // BVH_BUILD_MEDIAN, BVH_BUILD_SAH or BVH_BUILD_SBVH. returns -1 if mode
+  // is invalid
+  int SetBuildMode(int build_mode);
+  int GetBuildMode() const;
+
+  // references added by BVH_BUILD_SBVH relative to the number of primitives.
+  // returns -1 if budget is negative
+  int SetSplitBudget(Real split_budget);
+  Real GetSplitBudget() const;
+
+  // max number of primitives in a leaf. returns -1 if size is invalid
+  int SetLeafSize(int leaf_size);
+  int GetLeafSize() const;
+
+  // directory of cached trees. cache is not used if dir is empty. trees
+  // refer to the cache files mapped read only so renders sharing dir
+  // on a host share them
+  void SetCacheDirectory(const std::string &dir);
+  const std::string &GetCacheDirectory() const;
+
+  // vertices of faces in each leaf of static meshes are copied next to
+  // each other and faces refer to them by 8 bit indices local to the leaf.
+  // the precomputed triangles of the mesh are released. on by default
+  void SetMeshClusters(bool on_or_off);
+  bool IsMeshClusters() const;
+
+  int GetNodeCount() const;
+  // true if the tree was built with bounds at shutter open and close
+  bool HasMotion() const;
+
+private:
   virtual int build();
+  // bounds of primitives split by BVH_BUILD_SBVH are not clipped
+  virtual int refit();
   virtual bool intersect(const Ray &ray, Real time, Intersection *isect) const;
+  virtual bool occlude(const Ray &ray, Real time, Intersection *isect) const;
+  virtual bool intersect_all(const Ray &ray, Real time, HitList *hits) const;
+  virtual unsigned int intersect_packet(const Ray *rays, const Real *times, int count,
+      unsigned int ray_mask, Intersection *isects) const;
   virtual const char *get_name() const;
+  virtual std::size_t get_memory_usage() const;
+  virtual bool has_same_settings(const Accelerator &other) const;
+  // bounds at mid shutter when primitives move
+  virtual int analyze(AcceleratorStats *stats) const;
+
+  // traversals with leaf tests of the concrete type of primitive set
+  template <typename T>
+  bool intersect_tree(const T &primset, const Ray &ray, Real time, Intersection *isect) const;
+  template <typename T>
+  bool occlude_tree(const T &primset, const Ray &ray, Real time, Intersection *isect) const;
+  template <typename T>
+  bool leaf_intersect(const T &primset, const BVHNode &node, int node_id,
+      const Ray &ray, Real time, Intersection *isect) const;
+  template <typename T>
+  bool leaf_occlude(const T &primset, const BVHNode &node, int node_id,
+      const Ray &ray, Real time, Intersection *isect) const;
+  bool leaf_intersect(const Mesh &mesh, const BVHNode &node, int node_id,
+      const Ray &ray, Real time, Intersection *isect) const;
+  bool leaf_occlude(const Mesh &mesh, const BVHNode &node, int node_id,
+      const Ray &ray, Real time, Intersection *isect) const;
+  // the same as RayIntersectPacket of the mesh
+  unsigned int leaf_intersect_cluster_packet(const BVHNode &node, int node_id,
+      const Ray *rays, unsigned int ray_mask, Intersection *isects) const;
+  void build_mesh_clusters();
 
-  BVHNode *root;
+  // may refer to a mapped cache file
+  MappedArray<BVHNode> nodes_;
+  MappedArray<Index> prim_indices_;
+  // empty if primitives don't move
+  std::vector<BVHMotionBounds> motion_bounds_;
+  // the cache file nodes_ and prim_indices_ refer to. NULL if owned
+  std::shared_ptr<const void> mapping_;
+  // first vertex of each leaf node in cluster_points_ and three local
+  // indices of each entry of prim_indices_. empty if not clustered
+  std::vector<int32_t> cluster_offsets_;
+  std::vector<Vector> cluster_points_;
+  std::vector<uint8_t> cluster_indices_;
+  bool mesh_clusters_;
+  int build_mode_;
+  int leaf_size_;
+  Real split_budget_;
+  std::string cache_dir_;
+  // prim_indices_ may have more entries than this after spatial splits
+  Index prim_count_;
+  // surface area cost of the tree at build relative to the root
+  Real built_cost_;
+  // PRIMSET_XXX of the primitive set found at build
+  int primset_type_;
 };
 
 } // namespace xxx
@@ -0,0 +1,387 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_bvh_cache.h"
+#include "fj_primitive_set.h"
+#include "fj_serialize.h"
+#include "fj_box.h"
+#include "fj_os.h"
+
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+namespace fj {
+
+static const char SIGNATURE[] = "fjbvh";
+static const size_t SIGNATURE_SIZE = 8;
+// increment when BVHNode layout or the build algorithm changes
+static const int CACHE_FILE_VERSION = 1;
+
+// 64-bit FNV-1a
+static const uint64_t HASH_OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t HASH_PRIME = 1099511628211ULL;
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= HASH_PRIME;
+  }
+  return hash;
+}
+
+template<typename T>
+static uint64_t hash_value(uint64_t hash, const T &value)
+{
+  return hash_bytes(hash, &value, sizeof(value));
+}
+
+static uint64_t compute_checksum(const BVHNode *nodes, int nnodes,
+    const Index *prim_indices, int nrefs)
+{
+  uint64_t hash = HASH_OFFSET_BASIS;
+  hash = hash_bytes(hash, nodes, sizeof(BVHNode) * nnodes);
+  hash = hash_bytes(hash, prim_indices, sizeof(Index) * nrefs);
+  return hash;
+}
+
+// unmaps the cache file when the last tree referring to it is freed
+class BvhCacheMapping {
+public:
+  BvhCacheMapping(void *data, size_t size) : data_(data), size_(size) {}
+  ~BvhCacheMapping()
+  {
+    OsUnmapFile(data_, size_);
+  }
+
+  const char *GetData() const { return static_cast<const char *>(data_); }
+  size_t GetSize() const { return size_; }
+
+private:
+  BvhCacheMapping(const BvhCacheMapping &);
+  const BvhCacheMapping &operator=(const BvhCacheMapping &);
+
+  void *data_;
+  size_t size_;
+};
+
+static void write_signature(std::ofstream &file)
+{
+  char sign[SIGNATURE_SIZE] = {'\0'};
+  strcpy(sign, SIGNATURE);
+  file.write(sign, SIGNATURE_SIZE);
+}
+
+static bool match_signature(std::ifstream &file)
+{
+  char sign[SIGNATURE_SIZE] = {'\0'};
+  file.read(sign, SIGNATURE_SIZE);
+  return file && strncmp(sign, SIGNATURE, SIGNATURE_SIZE) == 0;
+}
+
+static bool is_valid_tree(const BVHNode *nodes, int nnodes,
+    const Index *prim_indices, int nrefs, int nprims)
+{
+  const int NNODES = nnodes;
+  const int NREFS = nrefs;
+
+  for (int i = 0; i < NNODES; i++) {
+    const BVHNode &node = nodes[i];
+    if (node.is_leaf()) {
+      if (node.offset < 0 || node.offset + node.count > NREFS)
+        return false;
+    } else {
+      // left child is i + 1 so the right child can't be before i + 2
+      if (node.count != 0 || node.offset < i + 2 || node.offset >= NNODES)
+        return false;
+    }
+  }
+  for (int i = 0; i < NREFS; i++) {
+    if (prim_indices[i] < 0 || prim_indices[i] >= nprims)
+      return false;
+  }
+  return true;
+}
+
+uint64_t BvhComputeCacheKey(const PrimitiveSet &primset,
+    int build_mode, int leaf_size, Real split_budget)
+{
+  const int NPRIMS = primset.GetPrimitiveCount();
+  uint64_t hash = HASH_OFFSET_BASIS;
+
+  hash = hash_value(hash, CACHE_FILE_VERSION);
+  hash = hash_value(hash, build_mode);
+  hash = hash_value(hash, leaf_size);
+  hash = hash_value(hash, NPRIMS);
+  // only for spatial splits so that other trees keep their keys
+  if (build_mode == BVH_BUILD_SBVH) {
+    hash = hash_value(hash, split_budget);
+  }
+
+  for (int i = 0; i < NPRIMS; i++) {
+    Box bounds;
+    primset.GetPrimitiveBounds(i, &bounds);
+    // hash each component so padding bytes are never hashed
+    for (int j = 0; j < 3; j++) {
+      hash = hash_value(hash, bounds.min[j]);
+      hash = hash_value(hash, bounds.max[j]);
+    }
+  }
+
+  return hash;
+}
+
+std::string BvhGetCacheFilename(const std::string &cache_dir, uint64_t key)
+{
+  char name[32] = {'\0'};
+  sprintf(name, "%016llx.bvh", static_cast<unsigned long long>(key));
+
+  if (cache_dir.empty()) {
+    return name;
+  }
+
+  const char last = cache_dir[cache_dir.size() - 1];
+  if (last == '/' || last == '\\') {
+    return cache_dir + name;
+  } else {
+    return cache_dir + "/" + name;
+  }
+}
+
+int BvhReadCache(const std::string &filename, uint64_t key, int nprims,
+    std::vector<BVHNode> *nodes, std::vector<Index> *prim_indices)
+{
+  std::ifstream file(filename.c_str(), std::fstream::in | std::fstream::binary);
+  if (!file) {
+    return -1;
+  }
+
+  if (!match_signature(file)) {
+    return -1;
+  }
+
+  int version = 0;
+  unsigned long long file_key = 0;
+  int nnodes = 0;
+  int nrefs = 0;
+
+  read_(file, version);
+  file.read(reinterpret_cast<char *>(&file_key), sizeof(file_key));
+  read_(file, nnodes);
+  read_(file, nrefs);
+
+  if (!file || version != CACHE_FILE_VERSION || file_key != key ||
+      nrefs < nprims || nnodes < 1 || nnodes > 2 * nrefs - 1) {
+    return -1;
+  }
+
+  std::vector<BVHNode> nodes_tmp(nnodes);
+  std::vector<Index> indices_tmp(nrefs);
+
+  // the arrays are read as they are in memory
+  file.read(reinterpret_cast<char *>(&nodes_tmp[0]), sizeof(BVHNode) * nnodes);
+  file.read(reinterpret_cast<char *>(&indices_tmp[0]), sizeof(Index) * nrefs);
+
+  unsigned long long checksum = 0;
+  file.read(reinterpret_cast<char *>(&checksum), sizeof(checksum));
+
+  if (!file || checksum != compute_checksum(&nodes_tmp[0], nnodes, &indices_tmp[0], nrefs) ||
+      !is_valid_tree(&nodes_tmp[0], nnodes, &indices_tmp[0], nrefs, nprims)) {
+    return -1;
+  }
+
+  nodes->swap(nodes_tmp);
+  prim_indices->swap(indices_tmp);
+
+  return 0;
+}
+
+int BvhMapCache(const std::string &filename, uint64_t key, int nprims,
+    std::shared_ptr<const void> *mapping,
+    MappedArray<BVHNode> *nodes, MappedArray<Index> *prim_indices)
+{
+  size_t size = 0;
+  void *data = OsMapFile(filename.c_str(), &size);
+  if (data == NULL) {
+    return -1;
+  }
+  std::shared_ptr<const BvhCacheMapping> file =
+      std::make_shared<BvhCacheMapping>(data, size);
+
+  // the same layout as BvhWriteCache writes. arrays are 4 byte aligned
+  const size_t HEADER_SIZE = SIGNATURE_SIZE + sizeof(int) +
+      sizeof(unsigned long long) + 2 * sizeof(int);
+  if (size < HEADER_SIZE ||
+      strncmp(file->GetData(), SIGNATURE, SIGNATURE_SIZE) != 0) {
+    return -1;
+  }
+
+  const char *p = file->GetData() + SIGNATURE_SIZE;
+  int version = 0;
+  unsigned long long file_key = 0;
+  int nnodes = 0;
+  int nrefs = 0;
+  memcpy(&version, p, sizeof(version));
+  p += sizeof(version);
+  memcpy(&file_key, p, sizeof(file_key));
+  p += sizeof(file_key);
+  memcpy(&nnodes, p, sizeof(nnodes));
+  p += sizeof(nnodes);
+  memcpy(&nrefs, p, sizeof(nrefs));
+  p += sizeof(nrefs);
+
+  if (version != CACHE_FILE_VERSION || file_key != key ||
+      nrefs < nprims || nnodes < 1 || nnodes > 2 * nrefs - 1) {
+    return -1;
+  }
+  const size_t data_size = sizeof(BVHNode) * nnodes + sizeof(Index) * nrefs;
+  if (size != HEADER_SIZE + data_size + sizeof(unsigned long long)) {
+    return -1;
+  }
+
+  const BVHNode *nodes_data = reinterpret_cast<const BVHNode *>(p);
+  const Index *indices_data = reinterpret_cast<const Index *>(p + sizeof(BVHNode) * nnodes);
+  unsigned long long checksum = 0;
+  memcpy(&checksum, p + data_size, sizeof(checksum));
+
+  if (checksum != compute_checksum(nodes_data, nnodes, indices_data, nrefs) ||
+      !is_valid_tree(nodes_data, nnodes, indices_data, nrefs, nprims)) {
+    return -1;
+  }
+
+  nodes->Refer(nodes_data, nnodes);
+  prim_indices->Refer(indices_data, nrefs);
+  *mapping = file;
+
+  return 0;
+}
+
+int BvhWriteCache(const std::string &filename, uint64_t key,
+    const std::vector<BVHNode> &nodes, const std::vector<Index> &prim_indices)
+{
+  if (nodes.empty() || prim_indices.empty()) {
+    return -1;
+  }
+
+  // write to a temporary file then rename it so that other processes
+  // reading or writing the same cache never see a partial file. the
+  // count tells writers of the same key in one process apart
+  static std::atomic<int> write_count(0);
+  const std::string tmpname = filename + "." + std::to_string(OsGetProcessId()) + "." +
+      std::to_string(write_count++) + ".tmp";
+  {
+    std::ofstream file(tmpname.c_str(), std::fstream::out | std::fstream::binary);
+    if (!file) {
+      return -1;
+    }
+
+    const unsigned long long file_key = key;
+    const int nnodes = static_cast<int>(nodes.size());
+    const int nrefs = static_cast<int>(prim_indices.size());
+    const unsigned long long checksum =
+        compute_checksum(&nodes[0], nnodes, &prim_indices[0], nrefs);
+
+    write_signature(file);
+    write_(file, CACHE_FILE_VERSION);
+    file.write(reinterpret_cast<const char *>(&file_key), sizeof(file_key));
+    write_(file, nnodes);
+    write_(file, nrefs);
+    file.write(reinterpret_cast<const char *>(&nodes[0]), sizeof(BVHNode) * nnodes);
+    file.write(reinterpret_cast<const char *>(&prim_indices[0]), sizeof(Index) * nrefs);
+    file.write(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
+
+    if (!file) {
+      file.close();
+      std::remove(tmpname.c_str());
+      return -1;
+    }
+  }
+
+  if (std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+    std::remove(tmpname.c_str());
+    return -1;
+  }
+
+  return 0;
+}
+
+int BvhBuildTreeCached(const PrimitiveSet &primset, int build_mode, int leaf_size,
+    Real split_budget, const std::string &cache_dir,
+    std::vector<BVHNode> *nodes, std::vector<Index> *prim_indices)
+{
+  if (cache_dir.empty()) {
+    return BvhBuildTree(primset, build_mode, leaf_size, split_budget,
+        nodes, prim_indices);
+  }
+
+  const int NPRIMS = primset.GetPrimitiveCount();
+  const uint64_t key = BvhComputeCacheKey(primset, build_mode, leaf_size, split_budget);
+  const std::string filename = BvhGetCacheFilename(cache_dir, key);
+
+  if (BvhReadCache(filename, key, NPRIMS, nodes, prim_indices) == 0) {
+    return 0;
+  }
+
+  const int err = BvhBuildTree(primset, build_mode, leaf_size, split_budget,
+      nodes, prim_indices);
+  if (err) {
+    return -1;
+  }
+
+  if (BvhWriteCache(filename, key, *nodes, *prim_indices)) {
+    // rendering doesn't need the cache
+    std::cerr << "* WARNING: could not write bvh cache: " << filename << "\n";
+  }
+
+  return 0;
+}
+
+int BvhBuildTreeMapped(const PrimitiveSet &primset, int build_mode, int leaf_size,
+    Real split_budget, const std::string &cache_dir,
+    std::shared_ptr<const void> *mapping,
+    MappedArray<BVHNode> *nodes, MappedArray<Index> *prim_indices)
+{
+  const int NPRIMS = primset.GetPrimitiveCount();
+  uint64_t key = 0;
+  std::string filename;
+
+  if (!cache_dir.empty()) {
+    key = BvhComputeCacheKey(primset, build_mode, leaf_size, split_budget);
+    filename = BvhGetCacheFilename(cache_dir, key);
+
+    if (BvhMapCache(filename, key, NPRIMS, mapping, nodes, prim_indices) == 0) {
+      return 0;
+    }
+  }
+
+  std::vector<BVHNode> nodes_tmp;
+  std::vector<Index> indices_tmp;
+  const int err = BvhBuildTree(primset, build_mode, leaf_size, split_budget,
+      &nodes_tmp, &indices_tmp);
+  if (err) {
+    return -1;
+  }
+
+  // the process building the tree refers to the file too so that
+  // processes starting later share the same pages
+  if (!cache_dir.empty()) {
+    if (BvhWriteCache(filename, key, nodes_tmp, indices_tmp)) {
+      std::cerr << "* WARNING: could not write bvh cache: " << filename << "\n";
+    }
+    else if (BvhMapCache(filename, key, NPRIMS, mapping, nodes, prim_indices) == 0) {
+      return 0;
+    }
+  }
+
+  mapping->reset();
+  nodes->Adopt(&nodes_tmp);
+  prim_indices->Adopt(&indices_tmp);
+
+  return 0;
+}
+
+} // namespace xxx
@@ -0,0 +1,57 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_BVH_CACHE_H
+#define FJ_BVH_CACHE_H
+
+#include "fj_bvh_accelerator.h"
+#include "fj_mapped_array.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace fj {
+
+class PrimitiveSet;
+
+// Hash of primitive bounds and build settings. primitive sets with the same
+// key build the same tree.
+extern uint64_t BvhComputeCacheKey(const PrimitiveSet &primset,
+    int build_mode, int leaf_size, Real split_budget);
+
+// Returns cache_dir/<key>.bvh
+extern std::string BvhGetCacheFilename(const std::string &cache_dir, uint64_t key);
+
+// Returns -1 if the file doesn't exist, is broken or is made for another key.
+// trees of spatial splits have more prim_indices than nprims.
+extern int BvhReadCache(const std::string &filename, uint64_t key, int nprims,
+    std::vector<BVHNode> *nodes, std::vector<Index> *prim_indices);
+extern int BvhWriteCache(const std::string &filename, uint64_t key,
+    const std::vector<BVHNode> &nodes, const std::vector<Index> &prim_indices);
+
+// Same as BvhReadCache but maps the file read only and refers to the arrays
+// in it without copying. processes mapping the same file share its pages.
+// mapping keeps the file mapped while the arrays refer to it
+extern int BvhMapCache(const std::string &filename, uint64_t key, int nprims,
+    std::shared_ptr<const void> *mapping,
+    MappedArray<BVHNode> *nodes, MappedArray<Index> *prim_indices);
+
+// Same as BvhBuildTree but reads the tree from cache_dir if it was built
+// before and writes it otherwise. the cache is not used if cache_dir is empty.
+extern int BvhBuildTreeCached(const PrimitiveSet &primset, int build_mode, int leaf_size,
+    Real split_budget, const std::string &cache_dir,
+    std::vector<BVHNode> *nodes, std::vector<Index> *prim_indices);
+
+// Same as BvhBuildTreeCached but the tree refers to the cache file mapped
+// read only, also right after building and writing it. renders on a host
+// with the same cache_dir e.g. on /dev/shm share one copy of each tree.
+// mapping is NULL if the tree is owned
+extern int BvhBuildTreeMapped(const PrimitiveSet &primset, int build_mode, int leaf_size,
+    Real split_budget, const std::string &cache_dir,
+    std::shared_ptr<const void> *mapping,
+    MappedArray<BVHNode> *nodes, MappedArray<Index> *prim_indices);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -71,6 +71,9 @@ typedef Interrupt (*FrameDoneCallback)(void *data, const FrameInfo *info);
 typedef Interrupt (*TileStartCallback)(void *data, const TileInfo *info);
 typedef Interrupt (*TileDoneCallback)(void *data, const TileInfo *info);
 
+// polled a few times a second from a thread of its own while tiles are
+// rendered, not after each sample. returning CALLBACK_INTERRUPT stops the
+// render
 typedef Interrupt (*SampleDoneCallback)(void *data);
 
 class FrameReport {
@@ -5,6 +5,7 @@
 #include "fj_property.h"
 #include "fj_numeric.h"
 #include "fj_ray.h"
+#include "fj_box.h"
 
 #include <cassert>
 #include <cmath>
@@ -76,23 +77,89 @@ void Camera::SetRotateOrder(int order)
   XfmSetSampleRotateOrder(&transform_samples_, order);
 }
 
-void Camera::GetRay(const Vector2 &screen_uv, Real time, Ray *ray) const
+void Camera::SetTimeOffset(Real time_offset)
 {
-  Transform transform_interp;
-  XfmLerpTransformSample(&transform_samples_, time, &transform_interp);
-
-  Vector target = compute_ray_target(screen_uv);
-  Vector eye;
-
-  XfmTransformPoint(&transform_interp, &target);
-  XfmTransformPoint(&transform_interp, &eye);
+  XfmSetSampleTimeOffset(&transform_samples_, time_offset);
+}
 
-  ray->dir  = target - eye;
+void CameraFrame::GetRay(const Vector2 &screen_uv, Ray *ray) const
+{
+  ray->dir  = corner + screen_uv[0] * axis_u + screen_uv[1] * axis_v;
   ray->dir  = Normalize(ray->dir);
   ray->orig = eye;
 
-  ray->tmin = znear_;
-  ray->tmax = zfar_;
+  ray->tmin = znear;
+  ray->tmax = zfar;
+}
+
+bool CameraFrame::IsBoxInRegion(const Box &box,
+    const Vector2 &uv_min, const Vector2 &uv_max) const
+{
+  // directions of the corners of the region in counterclockwise order
+  const Vector dirs[4] = {
+    corner + uv_min[0] * axis_u + uv_min[1] * axis_v,
+    corner + uv_max[0] * axis_u + uv_min[1] * axis_v,
+    corner + uv_max[0] * axis_u + uv_max[1] * axis_v,
+    corner + uv_min[0] * axis_u + uv_max[1] * axis_v
+  };
+  const Vector center = dirs[0] + dirs[1] + dirs[2] + dirs[3];
+
+  for (int i = 0; i < 4; i++) {
+    Vector N = Cross(dirs[i], dirs[(i + 1) % 4]);
+    if (Dot(N, center) < 0) {
+      N = -N;
+    }
+    // the corner of the box farthest inside the plane
+    const Vector P(
+        N[0] > 0 ? box.max[0] : box.min[0],
+        N[1] > 0 ? box.max[1] : box.min[1],
+        N[2] > 0 ? box.max[2] : box.min[2]);
+    if (Dot(N, P - eye) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Camera::GetRay(const Vector2 &screen_uv, Real time, Ray *ray) const
+{
+  CameraFrame frame;
+  ComputeFrame(time, &frame);
+  frame.GetRay(screen_uv, ray);
+}
+
+void Camera::ComputeFrame(Real time, CameraFrame *frame) const
+{
+  Transform transform_tmp;
+  const Transform *transform =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
+
+  // directions are linear to screen uv so only three are transformed
+  frame->eye = Vector();
+  frame->corner = compute_ray_target(Vector2(0, 0));
+  frame->axis_u = Vector(uv_size_[0], 0, 0);
+  frame->axis_v = Vector(0, uv_size_[1], 0);
+
+  XfmTransformPoint(transform, &frame->eye);
+  XfmTransformVector(transform, &frame->corner);
+  XfmTransformVector(transform, &frame->axis_u);
+  XfmTransformVector(transform, &frame->axis_v);
+
+  frame->znear = znear_;
+  frame->zfar = zfar_;
+}
+
+bool Camera::IsStatic() const
+{
+  return transform_samples_.cache_count == 1;
+}
+
+Real Camera::GetPixelSpread(int yres) const
+{
+  if (yres <= 0) {
+    return 0;
+  }
+  return uv_size_[1] / yres;
 }
 
 void Camera::compute_uv_size()
@@ -109,4 +176,34 @@ Vector Camera::compute_ray_target(const Vector2 &uv) const
       -1);
 }
 
+CameraRayGenerator::CameraRayGenerator() :
+  camera_(NULL),
+  frame_(),
+  frame_time_(0),
+  has_frame_(false),
+  is_static_(false)
+{
+}
+
+CameraRayGenerator::~CameraRayGenerator()
+{
+}
+
+void CameraRayGenerator::Init(const Camera *camera)
+{
+  camera_ = camera;
+  has_frame_ = false;
+  is_static_ = camera_->IsStatic();
+}
+
+void CameraRayGenerator::GetRay(const Vector2 &screen_uv, Real time, Ray *ray)
+{
+  if (!has_frame_ || (!is_static_ && time != frame_time_)) {
+    camera_->ComputeFrame(time, &frame_);
+    frame_time_ = time;
+    has_frame_ = true;
+  }
+  frame_.GetRay(screen_uv, ray);
+}
+
 } // namespace xxx
@@ -11,6 +11,29 @@
 namespace fj {
 
 class Ray;
+class Box;
+
+// Eye and screen of the camera at a time. the direction of the ray of a
+// screen position is corner + u * axis_u + v * axis_v before normalizing
+class CameraFrame {
+public:
+  CameraFrame() : eye(), corner(), axis_u(), axis_v(), znear(0), zfar(0) {}
+  ~CameraFrame() {}
+
+  void GetRay(const Vector2 &screen_uv, Ray *ray) const;
+  // false if no ray of the screen region can hit the box. the box is
+  // tested against the side planes of the region frustum only
+  bool IsBoxInRegion(const Box &box,
+      const Vector2 &uv_min, const Vector2 &uv_max) const;
+
+public:
+  Vector eye;
+  Vector corner;
+  Vector axis_u;
+  Vector axis_v;
+  Real znear;
+  Real zfar;
+};
 
 class Camera {
 public:
@@ -26,8 +49,16 @@ public:
   void SetRotate(Real rx, Real ry, Real rz, Real time);
   void SetTransformOrder(int order);
   void SetRotateOrder(int order);
+  // transform samples are looked up at time + time_offset
+  void SetTimeOffset(Real time_offset);
 
   void GetRay(const Vector2 &screen_uv, Real time, Ray *ray) const;
+  void ComputeFrame(Real time, CameraFrame *frame) const;
+  // true if the frame is the same at any time
+  bool IsStatic() const;
+  // angle between rays of neighboring pixels at the center of the screen
+  // for the footprint of camera rays
+  Real GetPixelSpread(int yres) const;
 
 private:
   void compute_uv_size();
@@ -43,6 +74,27 @@ private:
   Vector2 uv_size_;
 };
 
+// Generates camera rays of the samples of a tile. the frame is computed once
+// for static cameras and once for each distinct time of moving ones instead
+// of interpolating the transform for every ray.
+class CameraRayGenerator {
+public:
+  CameraRayGenerator();
+  ~CameraRayGenerator();
+
+  // the camera must not change until Init is called again
+  void Init(const Camera *camera);
+  // the same ray as Camera::GetRay
+  void GetRay(const Vector2 &screen_uv, Real time, Ray *ray);
+
+private:
+  const Camera *camera_;
+  CameraFrame frame_;
+  Real frame_time_;
+  bool has_frame_;
+  bool is_static_;
+};
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -0,0 +1,203 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_compression.h"
+#include <cstring>
+
+namespace fj {
+
+static const int RLE_MIN_RUN = 3;
+static const int RLE_MAX_RUN = 127;
+
+uint16_t FloatToHalf(float value)
+{
+  uint32_t bits = 0;
+  memcpy(&bits, &value, sizeof(bits));
+
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const uint32_t abs_bits = bits & 0x7FFFFFFF;
+
+  if (abs_bits >= 0x7F800000) {
+    // inf or nan
+    const uint32_t nan_bit = abs_bits > 0x7F800000 ? 0x0200 : 0;
+    return static_cast<uint16_t>(sign | 0x7C00 | nan_bit);
+  }
+  if (abs_bits >= 0x477FF000) {
+    // rounds up to inf
+    return static_cast<uint16_t>(sign | 0x7C00);
+  }
+  if (abs_bits < 0x38800000) {
+    // subnormal or zero. 2^-24 is the smallest half
+    if (abs_bits < 0x33000000) {
+      return static_cast<uint16_t>(sign);
+    }
+    const uint32_t exponent = abs_bits >> 23;
+    const uint32_t mantissa = (abs_bits & 0x007FFFFF) | 0x00800000;
+    const uint32_t shift = 126 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      half++;
+    }
+    return static_cast<uint16_t>(sign | half);
+  }
+
+  uint32_t half = ((abs_bits - 0x38000000) >> 13);
+  const uint32_t rest = abs_bits & 0x1FFF;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    half++;
+  }
+  return static_cast<uint16_t>(sign | half);
+}
+
+float HalfToFloat(uint16_t half)
+{
+  const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1F;
+  uint32_t mantissa = half & 0x03FF;
+  uint32_t bits = 0;
+
+  if (exponent == 0x1F) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  }
+  else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  else if (mantissa == 0) {
+    bits = sign;
+  }
+  else {
+    // subnormal half is a normal float
+    int e = 113;
+    while ((mantissa & 0x0400) == 0) {
+      mantissa <<= 1;
+      e--;
+    }
+    bits = sign | (static_cast<uint32_t>(e) << 23) | ((mantissa & 0x03FF) << 13);
+  }
+
+  float value = 0;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// the predictor and byte order of the PIZ and RLE compressors of OpenEXR.
+// bytes of the same significance end up next to each other
+static void reorder_bytes(const std::vector<char> &src, std::vector<char> &dst)
+{
+  const size_t N = src.size();
+  dst.resize(N);
+
+  char *t1 = &dst[0];
+  char *t2 = &dst[0] + (N + 1) / 2;
+  for (size_t i = 0; i < N; i++) {
+    if (i % 2 == 0) {
+      *t1++ = src[i];
+    } else {
+      *t2++ = src[i];
+    }
+  }
+
+  unsigned char *t = reinterpret_cast<unsigned char *>(&dst[0]);
+  int prev = t[0];
+  for (size_t i = 1; i < N; i++) {
+    const int d = static_cast<int>(t[i]) - prev + (128 + 256);
+    prev = t[i];
+    t[i] = static_cast<unsigned char>(d);
+  }
+}
+
+// a run is a count - 1 and a byte. a sequence of different bytes is
+// -count and the bytes
+static void rle_compress(const std::vector<char> &src, std::vector<char> &dst)
+{
+  const char *in = &src[0];
+  const char *in_end = in + src.size();
+  const char *run_start = in;
+  const char *run_end = in + 1;
+
+  dst.clear();
+  while (run_start < in_end) {
+    while (run_end < in_end && *run_start == *run_end &&
+        run_end - run_start - 1 < RLE_MAX_RUN) {
+      ++run_end;
+    }
+
+    if (run_end - run_start >= RLE_MIN_RUN) {
+      dst.push_back(static_cast<char>((run_end - run_start) - 1));
+      dst.push_back(*run_start);
+      run_start = run_end;
+    } else {
+      while (run_end < in_end &&
+          ((run_end + 1 >= in_end || *run_end != *(run_end + 1)) ||
+           (run_end + 2 >= in_end || *(run_end + 1) != *(run_end + 2))) &&
+          run_end - run_start < RLE_MAX_RUN) {
+        ++run_end;
+      }
+      dst.push_back(static_cast<char>(run_start - run_end));
+      dst.insert(dst.end(), run_start, run_end);
+      run_start = run_end;
+    }
+    ++run_end;
+  }
+}
+
+void RleCompress(const std::vector<char> &src, std::vector<char> &dst)
+{
+  if (src.empty()) {
+    dst.clear();
+    return;
+  }
+
+  std::vector<char> reordered;
+  reorder_bytes(src, reordered);
+  rle_compress(reordered, dst);
+}
+
+int RleUncompress(const char *src, std::size_t src_size,
+    char *dst, std::size_t dst_size)
+{
+  std::vector<unsigned char> t(dst_size);
+  std::size_t in = 0;
+  std::size_t out = 0;
+
+  while (in < src_size) {
+    const int count = static_cast<signed char>(src[in++]);
+    if (count < 0) {
+      const std::size_t n = -count;
+      if (in + n > src_size || out + n > dst_size) {
+        return -1;
+      }
+      memcpy(&t[out], src + in, n);
+      in += n;
+      out += n;
+    } else {
+      const std::size_t n = count + 1;
+      if (in + 1 > src_size || out + n > dst_size) {
+        return -1;
+      }
+      memset(&t[out], static_cast<unsigned char>(src[in++]), n);
+      out += n;
+    }
+  }
+  if (out != dst_size) {
+    return -1;
+  }
+  if (dst_size == 0) {
+    return 0;
+  }
+
+  for (std::size_t i = 1; i < dst_size; i++) {
+    t[i] = static_cast<unsigned char>(t[i - 1] + t[i] - 128);
+  }
+
+  const unsigned char *t1 = &t[0];
+  const unsigned char *t2 = &t[0] + (dst_size + 1) / 2;
+  for (std::size_t i = 0; i < dst_size; i++) {
+    dst[i] = static_cast<char>(i % 2 == 0 ? *t1++ : *t2++);
+  }
+  return 0;
+}
+
+} // namespace xxx
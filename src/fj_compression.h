@@ -0,0 +1,27 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_COMPRESSION_H
+#define FJ_COMPRESSION_H
+
+#include "fj_compatibility.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace fj {
+
+// IEEE 754 binary16. rounds to the nearest even and keeps inf and nan
+FJ_API uint16_t FloatToHalf(float value);
+FJ_API float HalfToFloat(uint16_t half);
+
+// The RLE compressor of OpenEXR. bytes are split into even and odd ones and
+// differences of neighbors are run length encoded.
+FJ_API void RleCompress(const std::vector<char> &src, std::vector<char> &dst);
+// Returns -1 if src doesn't expand to exactly dst_size bytes.
+FJ_API int RleUncompress(const char *src, std::size_t src_size,
+    char *dst, std::size_t dst_size);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,106 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_cpu.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+namespace fj {
+
+// -1 until the first call
+static std::atomic<int> simd_level(-1);
+
+// the widest kernels compiled in this build
+static int max_kernel_level()
+{
+#if defined(FJ_HAVE_AVX2_KERNELS)
+  return CPU_SIMD_AVX2;
+#elif defined(__SSE2__) || defined(_M_X64)
+  return CPU_SIMD_SSE2;
+#else
+  return CPU_SIMD_SCALAR;
+#endif
+}
+
+// kernels of the build flags are always used
+static int min_kernel_level()
+{
+#if defined(__SSE2__) || defined(_M_X64)
+  return CPU_SIMD_SSE2;
+#else
+  return CPU_SIMD_SCALAR;
+#endif
+}
+
+static int clamp_level(int level)
+{
+  const int max_level = CpuDetectSimdLevel() < max_kernel_level() ?
+      CpuDetectSimdLevel() : max_kernel_level();
+  if (level > max_level) {
+    level = max_level;
+  }
+  if (level < min_kernel_level()) {
+    level = min_kernel_level();
+  }
+  return level;
+}
+
+static int level_from_env()
+{
+  const char *env = std::getenv("FJ_SIMD");
+  if (env == NULL) {
+    return CPU_SIMD_AVX512;
+  }
+  for (int i = CPU_SIMD_SCALAR; i <= CPU_SIMD_AVX512; i++) {
+    if (strcmp(env, CpuGetSimdLevelName(i)) == 0) {
+      return i;
+    }
+  }
+  return CPU_SIMD_AVX512;
+}
+
+int CpuDetectSimdLevel()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  if (__builtin_cpu_supports("avx512f")) {
+    return CPU_SIMD_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return CPU_SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return CPU_SIMD_SSE2;
+  }
+  return CPU_SIMD_SCALAR;
+#else
+  return min_kernel_level();
+#endif
+}
+
+int CpuGetSimdLevel()
+{
+  int level = simd_level.load(std::memory_order_relaxed);
+  if (level < 0) {
+    level = clamp_level(level_from_env());
+    simd_level.store(level, std::memory_order_relaxed);
+  }
+  return level;
+}
+
+void CpuSetSimdLevel(int level)
+{
+  simd_level.store(clamp_level(level), std::memory_order_relaxed);
+}
+
+const char *CpuGetSimdLevelName(int level)
+{
+  switch (level) {
+  case CPU_SIMD_SSE2:   return "sse2";
+  case CPU_SIMD_AVX2:   return "avx2";
+  case CPU_SIMD_AVX512: return "avx512";
+  default:              return "scalar";
+  }
+}
+
+} // namespace xxx
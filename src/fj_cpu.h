@@ -0,0 +1,38 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_CPU_H
+#define FJ_CPU_H
+
+#include "fj_compatibility.h"
+
+// Kernels wider than the flags of the build are compiled per function with
+// FJ_TARGET_AVX2 and called only when CpuGetSimdLevel() allows them, so the
+// same binary runs on cpus without them.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define FJ_HAVE_AVX2_KERNELS
+  #define FJ_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace fj {
+
+enum CpuSimdLevel {
+  CPU_SIMD_SCALAR = 0,
+  CPU_SIMD_SSE2,
+  CPU_SIMD_AVX2,
+  CPU_SIMD_AVX512
+};
+
+// of the cpu running this
+FJ_API int CpuDetectSimdLevel();
+// Kernels use variants up to this level. it is the cpu level limited by the
+// kernels in the build and by FJ_SIMD (scalar, sse2, avx2 or avx512) in
+// the environment if it is set
+FJ_API int CpuGetSimdLevel();
+// limits kernels to the level. the detected one is still the upper limit
+FJ_API void CpuSetSimdLevel(int level);
+FJ_API const char *CpuGetSimdLevelName(int level);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
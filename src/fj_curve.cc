@@ -3,13 +3,17 @@
 
 #include "fj_curve.h"
 #include "fj_intersection.h"
+#include "fj_level_of_detail.h"
 #include "fj_primitive_set.h"
+#include "fj_memory_usage.h"
+#include "fj_multi_thread.h"
 #include "fj_transform.h"
 #include "fj_numeric.h"
 #include "fj_matrix.h"
 #include "fj_vector.h"
 #include "fj_ray.h"
 #include "fj_box.h"
+#include <algorithm>
 
 #define ATTRIBUTE_LIST(ATTR) \
   ATTR(Vertex, Vector,   P_,        Position) \
@@ -21,6 +25,9 @@
 
 namespace fj {
 
+// curves are split into up to 2^PRE_SPLIT_DEPTH segments
+static const int PRE_SPLIT_DEPTH = 2;
+
 #define ATTR(Class, Type, Name, Label) \
 void Curve::Add##Class##Label() \
 { \
@@ -64,7 +71,7 @@ public:
 static Real get_bezier3_max_radius(const Bezier3 &bezier);
 static Real get_bezier3_width(const Bezier3 &bezier, Real t);
 static void get_bezier3_bounds(const Bezier3 &bezier, Box *bounds);
-static void get_bezier3(const Curve *curve, int prim_id, Bezier3 *bezier);
+static void get_bezier3(const CurveSnapshot &curve, int prim_id, Bezier3 *bezier);
 static Vector eval_bezier3(const Vector *cp, Real t);
 static Vector derivative_bezier3(const Vector *cp, Real t);
 static void split_bezier3(const Bezier3 &bezier,
@@ -73,8 +80,15 @@ static bool converge_bezier3(const Bezier3 &bezier,
     Real v0, Real vn, int depth,
     Real *v_hit, Real *P_hit);
 static void time_sample_bezier3(Bezier3 *bezier, Real time);
+static void get_segment_bezier3(const CurveSnapshot &curve, int curve_id,
+    int segment, int depth, Bezier3 *bezier, Real *v0, Real *vn);
+static void get_bezier3_motion_bounds(const Bezier3 &bezier,
+    Box *bounds_open, Box *bounds_close);
+static bool ray_misses_bezier3_hull(const Ray &ray, const Bezier3 &bezier);
 
 static bool box_bezier3_intersect_recursive(const Box &box, const Bezier3 &bezier, int depth);
+static void add_clipped_bezier3_bounds(const Bezier3 &bezier, const Box &clip, int depth,
+    Box *bounds);
 
 // helper functions
 static inline Vector mid_point(const Vector &a, const Vector &b)
@@ -90,7 +104,66 @@ static inline Real dot_xy(const Vector &a, const Vector &b)
   return a.x * b.x + a.y * b.y;
 }
 
-Curve::Curve() : nverts_(0), ncurves_(0)
+// curves in a chunk of parallel passes over a curve
+static const int PARALLEL_CHUNK_SIZE = 4096;
+
+class CurvePass {
+public:
+  CurvePass() :
+      curve(NULL),
+      lod_fraction(1),
+      chunk_bounds(NULL),
+      chunk_max_radius(NULL),
+      split_depth(NULL) {}
+  ~CurvePass() {}
+
+  const CurveSnapshot *curve;
+  Real lod_fraction;
+  Box *chunk_bounds;
+  Real *chunk_max_radius;
+  int *split_depth;
+};
+
+static void compute_kept_bounds_range(void *data, int begin, int end)
+{
+  CurvePass *pass = reinterpret_cast<CurvePass *>(data);
+  Box &bounds = pass->chunk_bounds[begin / PARALLEL_CHUNK_SIZE];
+  Real &max_radius = pass->chunk_max_radius[begin / PARALLEL_CHUNK_SIZE];
+
+  bounds.ReverseInfinite();
+  for (int i = begin; i < end; i++) {
+    if (!LodIsKept(i, pass->lod_fraction)) {
+      continue;
+    }
+    Bezier3 bezier;
+    get_bezier3(*pass->curve, i, &bezier);
+
+    Box bounds_open, bounds_close;
+    get_bezier3_motion_bounds(bezier, &bounds_open, &bounds_close);
+    bounds.AddBox(bounds_open);
+    bounds.AddBox(bounds_close);
+
+    const Real bezier_max_radius = get_bezier3_max_radius(bezier);
+    max_radius = Max(max_radius, bezier_max_radius);
+  }
+}
+
+static void compute_split_depth_range(void *data, int begin, int end)
+{
+  CurvePass *pass = reinterpret_cast<CurvePass *>(data);
+
+  for (int i = begin; i < end; i++) {
+    Bezier3 bezier;
+    get_bezier3(*pass->curve, i, &bezier);
+
+    int depth = compute_split_depth_limit(bezier.cp, 2*get_bezier3_max_radius(bezier) / 20.);
+    depth = Clamp(depth, 1, 5);
+
+    pass->split_depth[i] = depth;
+  }
+}
+
+Curve::Curve() : nverts_(0), ncurves_(0), lod_width_(0), lod_fraction_(1)
 {
 }
 
@@ -125,27 +198,79 @@ const Box &Curve::GetBounds() const
 
 void Curve::ComputeBounds()
 {
-  Real max_radius = 0;
+  compute_kept_bounds();
 
-  bounds_.ReverseInfinite();
+  // TODO find a better place to put this
+  cache_split_depth();
+  cache_segments();
+}
+
+void Curve::SetLevelOfDetailWidth(Real pixels)
+{
+  // for the content hash. strands kept by Simplify depend on the width
+  if (Max(pixels, 0) != lod_width_) {
+    MarkChanged();
+  }
+  lod_width_ = Max(pixels, 0);
+}
+
+bool Curve::Simplify(Real pixel_size)
+{
+  Real width_sum = 0;
+  for (int i = 0; i < GetCurveCount() && HasVertexWidth(); i++) {
+    const int i0 = indices_[i];
+    width_sum += width_[i0] + width_[i0 + 3];
+  }
+  const Real mean_width = GetCurveCount() > 0 ? width_sum / (2 * GetCurveCount()) : 0;
 
+  const Real fraction = LodComputeKeepFraction(mean_width, pixel_size, lod_width_, 1);
+  if (fraction == lod_fraction_) {
+    return false;
+  }
+  lod_fraction_ = fraction;
+
+  // curves not computed yet are simplified at ComputeBounds()
+  if (static_cast<int>(split_depth_.size()) == GetCurveCount()) {
+    compute_kept_bounds();
+    cache_segments();
+  }
+  return true;
+}
+
+int Curve::GetKeptCurveCount() const
+{
+  int count = 0;
   for (int i = 0; i < GetCurveCount(); i++) {
-    Box bezier_bounds;
+    count += LodIsKept(i, lod_fraction_);
+  }
+  return count;
+}
 
-    GetPrimitiveBounds(i, &bezier_bounds);
-    bounds_.AddBox(bezier_bounds);
+void Curve::compute_kept_bounds()
+{
+  Real max_radius = 0;
 
-    Bezier3 bezier;
-    get_bezier3(this, i, &bezier);
+  MarkChanged();
+  take_snapshot();
 
-    const Real bezier_max_radius = get_bezier3_max_radius(bezier);
-    max_radius = Max(max_radius, bezier_max_radius);
+  // reduces bounds and radii of chunks of curves
+  const int nchunks = (GetCurveCount() + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+  std::vector<Box> chunk_bounds(nchunks);
+  std::vector<Real> chunk_max_radius(nchunks, 0);
+  CurvePass pass;
+  pass.curve = &snapshot_;
+  pass.lod_fraction = lod_fraction_;
+  pass.chunk_bounds = nchunks > 0 ? &chunk_bounds[0] : NULL;
+  pass.chunk_max_radius = nchunks > 0 ? &chunk_max_radius[0] : NULL;
+  MtParallelFor(&pass, compute_kept_bounds_range, GetCurveCount(), PARALLEL_CHUNK_SIZE);
+
+  bounds_.ReverseInfinite();
+  for (int i = 0; i < nchunks; i++) {
+    bounds_.AddBox(chunk_bounds[i]);
+    max_radius = Max(max_radius, chunk_max_radius[i]);
   }
 
   bounds_.Expand(max_radius);
-
-  // TODO find a better place to put this
-  cache_split_depth();
 }
 
 void Curve::Clear()
@@ -163,6 +288,10 @@ void Curve::Clear()
   bounds_ = Box();
 
   split_depth_.clear();
+  segment_curves_.clear();
+  curve_segment_offsets_.clear();
+  snapshot_ = CurveSnapshot();
+  lod_fraction_ = 1;
 }
 
 void Curve::cache_split_depth()
@@ -172,34 +301,79 @@ void Curve::cache_split_depth()
   const int NCURVES = GetCurveCount();
 
   split_depth_.resize(NCURVES);
-  for (int i = 0; i < NCURVES; i++) {
-    Bezier3 bezier;
-    // TODO REMOVE 'this' POINTER
-    get_bezier3(this, i, &bezier);
+  CurvePass pass;
+  pass.curve = &snapshot_;
+  pass.split_depth = NCURVES > 0 ? &split_depth_[0] : NULL;
+  MtParallelFor(&pass, compute_split_depth_range, NCURVES, PARALLEL_CHUNK_SIZE);
+}
 
-    int depth = compute_split_depth_limit(bezier.cp, 2*get_bezier3_max_radius(bezier) / 20.);
-    depth = Clamp(depth, 1, 5);
+void Curve::cache_segments()
+{
+  const int NCURVES = GetCurveCount();
+
+  // pruning releases memory of segments
+  std::vector<int>().swap(segment_curves_);
+  curve_segment_offsets_.resize(NCURVES);
+
+  for (int i = 0; i < NCURVES; i++) {
+    // pruned curves have no segments
+    if (!LodIsKept(i, lod_fraction_)) {
+      continue;
+    }
+    const int nsegments = 1 << get_segment_depth(i);
 
-    split_depth_[i] = depth;
+    curve_segment_offsets_[i] = segment_curves_.size();
+    segment_curves_.insert(segment_curves_.end(), nsegments, i);
   }
 }
 
+int Curve::get_segment_depth(int curve_id) const
+{
+  return std::min(split_depth_[curve_id], PRE_SPLIT_DEPTH);
+}
+
+template<typename T> inline
+const T *data_or_null(const std::vector<T> &v)
+{
+  return v.empty() ? NULL : &v[0];
+}
+
+void Curve::take_snapshot()
+{
+  snapshot_.P        = data_or_null(P_);
+  snapshot_.Cd       = data_or_null(Cd_);
+  snapshot_.velocity = data_or_null(velocity_);
+  snapshot_.width    = data_or_null(width_);
+  snapshot_.indices  = data_or_null(indices_);
+  snapshot_.width_scale = 1 / lod_fraction_;
+}
+
 bool Curve::ray_intersect(Index prim_id, const Ray &ray,
     Real time, Intersection *isect) const
 {
   Matrix world_to_ray;
   Bezier3 bezier;
   Ray nml_ray;
+  Real v0 = 0;
+  Real vn = 1;
 
   // for scaled ray
   const Real ray_scale = Length(ray.dir);
   nml_ray = ray;
   nml_ray.dir /= ray_scale;
 
-  get_bezier3(this, prim_id, &bezier);
-  const int depth = split_depth_[prim_id];
+  const int curve_id = segment_curves_[prim_id];
+  const int segment_depth = get_segment_depth(curve_id);
+  get_segment_bezier3(snapshot_, curve_id, prim_id - curve_segment_offsets_[curve_id],
+      segment_depth, &bezier, &v0, &vn);
+  const int depth = split_depth_[curve_id] - segment_depth;
   time_sample_bezier3(&bezier, time);
 
+  // most rays in the box of the segment pass by thin hairs
+  if (ray_misses_bezier3_hull(nml_ray, bezier)) {
+    return false;
+  }
+
   compute_world_to_ray_matrix(nml_ray, &world_to_ray);
   for (int i = 0; i < 4; i++) {
     MatTransformPoint(world_to_ray, &bezier.cp[i]);
@@ -208,34 +382,50 @@ bool Curve::ray_intersect(Index prim_id, const Ray &ray,
   Real ttmp = REAL_MAX;
   Real v_hit = REAL_MAX;
 
-  const bool hit = converge_bezier3(bezier, 0, 1, depth, &v_hit, &ttmp);
+  const bool hit = converge_bezier3(bezier, v0, vn, depth, &v_hit, &ttmp);
   if (hit) {
-    // P
+    isect->prim_id = prim_id;
     isect->t_hit = ttmp / ray_scale;
-    isect->P = RayPointAt(ray, isect->t_hit);
-
-    // dPdv
-    Bezier3 original;
-    get_bezier3(this, prim_id, &original);
-    time_sample_bezier3(&original, time);
-    isect->dPdv = derivative_bezier3(original.cp, v_hit);
-
-    // Cd
-    const int i0 = GetCurveIndices(prim_id);
-    const int i1 = GetCurveIndices(prim_id) + 3;
-    const Color Cd_curve0 = GetVertexColor(i0);
-    const Color Cd_curve1 = GetVertexColor(i1);
-    isect->Cd = Lerp(Cd_curve0, Cd_curve1, v_hit);
+    isect->prim_uv = Vector2(0, v_hit);
   }
 
   return hit;
 }
 
+void Curve::compute_hit_attributes(const Ray &ray, Real time, Intersection *isect) const
+{
+  const int curve_id = segment_curves_[isect->prim_id];
+  const Real v_hit = isect->prim_uv[1];
+
+  // P
+  isect->P = RayPointAt(ray, isect->t_hit);
+
+  // dPdv
+  Bezier3 original;
+  get_bezier3(snapshot_, curve_id, &original);
+  time_sample_bezier3(&original, time);
+  isect->dPdv = derivative_bezier3(original.cp, v_hit);
+
+  // Cd
+  if (snapshot_.Cd != NULL) {
+    const int i0 = snapshot_.indices[curve_id];
+    const int i1 = i0 + 3;
+    isect->Cd = Lerp(snapshot_.Cd[i0], snapshot_.Cd[i1], v_hit);
+  } else {
+    isect->Cd = Color();
+  }
+}
+
 bool Curve::box_intersect(Index prim_id, const Box &box) const
 {
-  const int recursive_depth = 5;
+  const int curve_id = segment_curves_[prim_id];
+  const int segment_depth = get_segment_depth(curve_id);
+  const int recursive_depth = 5 - segment_depth;
   Bezier3 bezier;
-  get_bezier3(this, prim_id, &bezier);
+  Real v0 = 0;
+  Real vn = 1;
+  get_segment_bezier3(snapshot_, curve_id, prim_id - curve_segment_offsets_[curve_id],
+      segment_depth, &bezier, &v0, &vn);
   const bool hit = box_bezier3_intersect_recursive(box, bezier, recursive_depth);
 
   return hit;
@@ -243,18 +433,53 @@ bool Curve::box_intersect(Index prim_id, const Box &box) const
 
 void Curve::get_primitive_bounds(Index prim_id, Box *bounds) const
 {
-  Bezier3 bezier;
-  get_bezier3(this, prim_id, &bezier);
-  get_bezier3_bounds(bezier, bounds);
+  Box bounds_shutter_close;
 
   // TODO need to pass max time sample instead of 1.
-  time_sample_bezier3(&bezier, 1);
-
-  Box bounds_shutter_close;
-  get_bezier3_bounds(bezier, &bounds_shutter_close);
+  get_primitive_motion_bounds(prim_id, bounds, &bounds_shutter_close);
   bounds->AddBox(bounds_shutter_close);
 }
 
+void Curve::get_clipped_primitive_bounds(Index prim_id, const Box &clip,
+    Box *bounds) const
+{
+  if (HasVertexVelocity()) {
+    get_primitive_bounds(prim_id, bounds);
+    bounds->Clip(clip);
+    return;
+  }
+
+  // bounds of 8 pieces of the segment clipped one by one. the box test of
+  // curves ignores width so it can't tell which pieces are outside
+  const int curve_id = segment_curves_[prim_id];
+  const int clip_depth = 3;
+  Bezier3 bezier;
+  Real v0 = 0;
+  Real vn = 1;
+  get_segment_bezier3(snapshot_, curve_id, prim_id - curve_segment_offsets_[curve_id],
+      get_segment_depth(curve_id), &bezier, &v0, &vn);
+
+  bounds->ReverseInfinite();
+  add_clipped_bezier3_bounds(bezier, clip, clip_depth, bounds);
+}
+
+bool Curve::has_motion() const
+{
+  return HasVertexVelocity();
+}
+
+void Curve::get_primitive_motion_bounds(Index prim_id,
+    Box *bounds_open, Box *bounds_close) const
+{
+  const int curve_id = segment_curves_[prim_id];
+  Bezier3 bezier;
+  Real v0 = 0;
+  Real vn = 1;
+  get_segment_bezier3(snapshot_, curve_id, prim_id - curve_segment_offsets_[curve_id],
+      get_segment_depth(curve_id), &bezier, &v0, &vn);
+  get_bezier3_motion_bounds(bezier, bounds_open, bounds_close);
+}
+
 void Curve::get_bounds(Box *bounds) const
 {
   *bounds = GetBounds();
@@ -262,7 +487,60 @@ void Curve::get_bounds(Box *bounds) const
 
 Index Curve::get_primitive_count() const
 {
-  return GetCurveCount();
+  return segment_curves_.size();
+}
+
+uint64_t Curve::compute_content_hash() const
+{
+  uint64_t hash = PRIM_HASH_BASIS;
+  hash = PrimHashBytes(hash, &nverts_, sizeof(nverts_));
+  hash = PrimHashBytes(hash, &ncurves_, sizeof(ncurves_));
+  hash = PrimHashBytes(hash, &lod_width_, sizeof(lod_width_));
+  hash = PrimHashArray(hash, P_.empty() ? NULL : &P_[0], P_.size());
+  hash = PrimHashArray(hash, Cd_.empty() ? NULL : &Cd_[0], Cd_.size());
+  hash = PrimHashArray(hash, uv_.empty() ? NULL : &uv_[0], uv_.size());
+  hash = PrimHashArray(hash, velocity_.empty() ? NULL : &velocity_[0], velocity_.size());
+  hash = PrimHashArray(hash, width_.empty() ? NULL : &width_[0], width_.size());
+  hash = PrimHashArray(hash, indices_.empty() ? NULL : &indices_[0], indices_.size());
+  return hash == 0 ? 1 : hash;
+}
+
+template <typename T>
+static bool same_vector(const std::vector<T> &a, const std::vector<T> &b)
+{
+  return PrimSameArray(a.empty() ? NULL : &a[0], a.size(), b.empty() ? NULL : &b[0], b.size());
+}
+
+bool Curve::has_same_content(const PrimitiveSet &other) const
+{
+  const Curve *curve = dynamic_cast<const Curve *>(&other);
+  if (curve == NULL) {
+    return false;
+  }
+  return
+      nverts_ == curve->nverts_ &&
+      ncurves_ == curve->ncurves_ &&
+      std::memcmp(&lod_width_, &curve->lod_width_, sizeof(lod_width_)) == 0 &&
+      same_vector(P_, curve->P_) &&
+      same_vector(Cd_, curve->Cd_) &&
+      same_vector(uv_, curve->uv_) &&
+      same_vector(velocity_, curve->velocity_) &&
+      same_vector(width_, curve->width_) &&
+      same_vector(indices_, curve->indices_);
+}
+
+std::size_t Curve::get_memory_usage() const
+{
+  return
+      MemoryUsageOf(P_) +
+      MemoryUsageOf(Cd_) +
+      MemoryUsageOf(uv_) +
+      MemoryUsageOf(velocity_) +
+      MemoryUsageOf(width_) +
+      MemoryUsageOf(indices_) +
+      MemoryUsageOf(split_depth_) +
+      MemoryUsageOf(segment_curves_) +
+      MemoryUsageOf(curve_segment_offsets_);
 }
 
 static void compute_world_to_ray_matrix(const Ray &ray, Matrix *dst)
@@ -396,6 +674,80 @@ static void time_sample_bezier3(Bezier3 *bezier, Real time)
   }
 }
 
+// the segment-th of 2^depth pieces of the curve and its range of v.
+// velocities are split the same way as control points move linearly
+static void get_segment_bezier3(const CurveSnapshot &curve, int curve_id,
+    int segment, int depth, Bezier3 *bezier, Real *v0, Real *vn)
+{
+  get_bezier3(curve, curve_id, bezier);
+  *v0 = 0;
+  *vn = 1;
+
+  for (int level = depth - 1; level >= 0; level--) {
+    Bezier3 left, right;
+    Bezier3 velocity, velocity_left, velocity_right;
+
+    for (int i = 0; i < 4; i++) {
+      velocity.cp[i] = bezier->velocity[i];
+    }
+    split_bezier3(*bezier, &left, &right);
+    split_bezier3(velocity, &velocity_left, &velocity_right);
+
+    const Real vm = (*v0 + *vn) * .5;
+    const bool is_right = (segment >> level) & 1;
+    const Bezier3 &half_velocity = is_right ? velocity_right : velocity_left;
+
+    *bezier = is_right ? right : left;
+    for (int i = 0; i < 4; i++) {
+      bezier->velocity[i] = half_velocity.cp[i];
+    }
+    if (is_right) {
+      *v0 = vm;
+    } else {
+      *vn = vm;
+    }
+  }
+}
+
+static void get_bezier3_motion_bounds(const Bezier3 &bezier,
+    Box *bounds_open, Box *bounds_close)
+{
+  get_bezier3_bounds(bezier, bounds_open);
+
+  // control points move linearly and the curve is inside their hull
+  Bezier3 bezier_close = bezier;
+  time_sample_bezier3(&bezier_close, 1);
+  get_bezier3_bounds(bezier_close, bounds_close);
+}
+
+// the hull of control points is inside the capsule around the line from
+// the first to the last one. tests the distance from the line of the ray
+// with a normalized direction to the capsule
+static bool ray_misses_bezier3_hull(const Ray &ray, const Bezier3 &bezier)
+{
+  const Vector &A = bezier.cp[0];
+  const Vector e = bezier.cp[3] - A;
+  const Real e_len2 = Dot(e, e);
+
+  Real hull_radius = 0;
+  for (int i = 1; i < 3; i++) {
+    const Vector d = bezier.cp[i] - A;
+    const Real s = e_len2 > 0 ? Clamp(Dot(d, e) / e_len2, 0, 1) : 0;
+    hull_radius = Max(hull_radius, Length(d - s * e));
+  }
+  const Real radius = hull_radius + get_bezier3_max_radius(bezier);
+
+  // components perpendicular to the ray
+  const Vector w = A - ray.orig;
+  const Vector w_perp = w - Dot(w, ray.dir) * ray.dir;
+  const Vector e_perp = e - Dot(e, ray.dir) * ray.dir;
+  const Real e_perp_len2 = Dot(e_perp, e_perp);
+  const Real s = e_perp_len2 > 0 ? Clamp(-Dot(w_perp, e_perp) / e_perp_len2, 0, 1) : 0;
+  const Vector closest = w_perp + s * e_perp;
+
+  return Dot(closest, closest) > radius * radius;
+}
+
 static bool box_bezier3_intersect(const Box &box, const Bezier3 &bezier)
 {
   const int N_STEPS = 1;
@@ -523,6 +875,28 @@ static int compute_split_depth_limit(const Vector *cp, Real epsilon)
   return r0;
 }
 
+static void add_clipped_bezier3_bounds(const Bezier3 &bezier, const Box &clip, int depth,
+    Box *bounds)
+{
+  Box piece_bounds;
+  get_bezier3_bounds(bezier, &piece_bounds);
+  piece_bounds.Clip(clip);
+
+  if (piece_bounds.IsEmpty()) {
+    return;
+  }
+  if (depth == 0) {
+    bounds->AddBox(piece_bounds);
+    return;
+  }
+
+  Bezier3 bezier_l;
+  Bezier3 bezier_r;
+  split_bezier3(bezier, &bezier_l, &bezier_r);
+  add_clipped_bezier3_bounds(bezier_l, clip, depth - 1, bounds);
+  add_clipped_bezier3_bounds(bezier_r, clip, depth - 1, bounds);
+}
+
 static Real get_bezier3_max_radius(const Bezier3 &bezier)
 {
   return .5 * Max(bezier.width[0], bezier.width[1]);
@@ -545,25 +919,29 @@ static void get_bezier3_bounds(const Bezier3 &bezier, Box *bounds)
   bounds->Expand(max_radius);
 }
 
-static void get_bezier3(const Curve *curve, int prim_id, Bezier3 *bezier)
+static void get_bezier3(const CurveSnapshot &curve, int prim_id, Bezier3 *bezier)
 {
-  const int i0 = curve->GetCurveIndices(prim_id);
-  const int i1 = i0 + 1;
-  const int i2 = i0 + 2;
-  const int i3 = i0 + 3;
+  const int i0 = curve.indices[prim_id];
 
-  bezier->cp[0] = curve->GetVertexPosition(i0);
-  bezier->cp[1] = curve->GetVertexPosition(i1);
-  bezier->cp[2] = curve->GetVertexPosition(i2);
-  bezier->cp[3] = curve->GetVertexPosition(i3);
+  for (int i = 0; i < 4; i++) {
+    bezier->cp[i] = curve.P[i0 + i];
+  }
 
-  bezier->width[0] = curve->GetVertexWidth(i0);
-  bezier->width[1] = curve->GetVertexWidth(i3);
+  if (curve.width != NULL) {
+    bezier->width[0] = curve.width[i0] * curve.width_scale;
+    bezier->width[1] = curve.width[i0 + 3] * curve.width_scale;
+  } else {
+    bezier->width[0] = 0;
+    bezier->width[1] = 0;
+  }
 
-  bezier->velocity[0] = curve->GetVertexVelocity(i0);
-  bezier->velocity[1] = curve->GetVertexVelocity(i1);
-  bezier->velocity[2] = curve->GetVertexVelocity(i2);
-  bezier->velocity[3] = curve->GetVertexVelocity(i3);
+  for (int i = 0; i < 4; i++) {
+    if (curve.velocity != NULL) {
+      bezier->velocity[i] = curve.velocity[i0 + i];
+    } else {
+      bezier->velocity[i] = Vector(0, 0, 0);
+    }
+  }
 }
 
 } // namespace xxx
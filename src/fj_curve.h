@@ -15,6 +15,27 @@
 
 namespace fj {
 
+// Read only view of curve attributes for ray intersection taken at
+// Curve::ComputeBounds(). arrays are contiguous and indexed without
+// bounds checks. missing attributes are NULL
+class CurveSnapshot {
+public:
+  CurveSnapshot() : P(NULL), Cd(NULL), velocity(NULL), width(NULL),
+      indices(NULL), width_scale(1) {}
+  ~CurveSnapshot() {}
+
+  const CompactVector *P;
+  const Color *Cd;
+  const CompactVector *velocity;
+  const CompactReal *width;
+  const int *indices;
+  // widening of strands kept by simplification
+  Real width_scale;
+};
+
+// Primitives are segments of curves. each bezier is split into short
+// segments at ComputeBounds() so that accelerators bound thin diagonal
+// hairs tightly and rays converge on fewer subdivisions
 class FJ_API Curve : public PrimitiveSet {
 public:
   Curve();
@@ -40,6 +61,8 @@ public:
   Real     GetVertexWidth(int idx) const;
   int      GetCurveIndices(int idx) const;
 
+  // setting distinct indices from multiple threads is safe after
+  // counts are set and attributes are added
   void SetVertexPosition(int idx, const Vector &value);
   void SetVertexColor(int idx, const Color &value);
   void SetVertexTexture(int idx, const TexCoord &value);
@@ -54,32 +77,63 @@ public:
   bool HasVertexWidth() const;
   bool HasCurveIndices() const;
 
+  // also takes the snapshot. call this again after changing the curves
   void ComputeBounds();
   void Clear();
 
+  // strands thinner than the pixels are pruned at random by Simplify().
+  // 0 keeps all strands
+  void SetLevelOfDetailWidth(Real pixels);
+  // keeps strands for pixel_size in object space where the curve is
+  // nearest to the camera. returns true if the kept strands have changed
+  bool Simplify(Real pixel_size);
+  int GetKeptCurveCount() const;
+
 private:
+  template <typename T> friend class PrimitiveLeafTest;
+
   virtual bool ray_intersect(Index prim_id, const Ray &ray,
       Real time, Intersection *isect) const;
+  virtual void compute_hit_attributes(const Ray &ray, Real time, Intersection *isect) const;
   virtual bool box_intersect(Index prim_id, const Box &box) const;
   virtual void get_primitive_bounds(Index prim_id, Box *bounds) const;
+  virtual void get_clipped_primitive_bounds(Index prim_id, const Box &clip,
+      Box *bounds) const;
+  virtual bool has_motion() const;
+  virtual void get_primitive_motion_bounds(Index prim_id,
+      Box *bounds_open, Box *bounds_close) const;
   virtual void get_bounds(Box *bounds) const;
   virtual Index get_primitive_count() const;
+  virtual std::size_t get_memory_usage() const;
+  virtual uint64_t compute_content_hash() const;
+  virtual bool has_same_content(const PrimitiveSet &other) const;
 
   int nverts_;
   int ncurves_;
 
-  std::vector<Vector>   P_;
-  std::vector<Color>    Cd_;
-  std::vector<TexCoord> uv_;
-  std::vector<Vector>   velocity_;
-  std::vector<Real>     width_;
-  std::vector<int>      indices_;
+  std::vector<CompactVector> P_;
+  std::vector<Color>         Cd_;
+  std::vector<TexCoord>      uv_;
+  std::vector<CompactVector> velocity_;
+  std::vector<CompactReal>   width_;
+  std::vector<int>           indices_;
 
   Box bounds_;
 
   std::vector<int> split_depth_;
+  // the curve of each segment and the first segment of each curve
+  std::vector<int> segment_curves_;
+  std::vector<int> curve_segment_offsets_;
+  CurveSnapshot snapshot_;
+
+  Real lod_width_;
+  Real lod_fraction_;
 
+  void compute_kept_bounds();
   void cache_split_depth();
+  void cache_segments();
+  int get_segment_depth(int curve_id) const;
+  void take_snapshot();
 };
 
 } // namespace xxx
@@ -0,0 +1,329 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_denoiser.h"
+#include "fj_multi_thread.h"
+#include "fj_framebuffer.h"
+#include "fj_numeric.h"
+#include "fj_color.h"
+#include "fj_aov.h"
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+namespace fj {
+
+// the filter reaches 2 * (2^ITERATION_COUNT - 1) pixels away
+static const int ITERATION_COUNT = 5;
+// rows of pixels filtered in a task
+static const int ROW_BAND_SIZE = 16;
+// how far luminance may differ in standard deviations of its noise
+static const float SIGMA_LUMINANCE = 4;
+// exponent of the cosine between normals
+static const int NORMAL_POWER_LOG2 = 7;
+// how far depth may differ from its gradient
+static const float SIGMA_DEPTH = 1;
+// albedo channels lower than this are not divided by
+static const float MIN_ALBEDO = .01f;
+
+// 1/16 1/4 3/8 1/4 1/16
+static const float KERNEL[5] = {1.f/16, 1.f/4, 3.f/8, 1.f/4, 1.f/16};
+
+class DenoiseBuffers {
+public:
+  DenoiseBuffers() : width(0), height(0), step(0), current(0),
+      has_normal(false), has_depth(false),
+      albedo(), normal(), depth(), depth_gradient() {}
+  ~DenoiseBuffers() {}
+
+  int width;
+  int height;
+  int step;
+  int current;
+  bool has_normal;
+  bool has_depth;
+
+  // colors divided by albedo and their variance. filtered back and forth
+  std::vector<Color> irradiance[2];
+  std::vector<float> variance[2];
+
+  std::vector<Color> albedo;
+  std::vector<float> normal;
+  std::vector<float> depth;
+  std::vector<float> depth_gradient;
+};
+
+static LoopStatus filter_rows_task(void *data, const ThreadContext &context);
+static void init_buffers(const FrameBuffer &src, const AOVLayout &layout,
+    DenoiseBuffers &buf);
+static void estimate_variance(DenoiseBuffers &buf);
+static float blurred_variance(const DenoiseBuffers &buf, int x, int y);
+static float one_sided_gradient(float center, float prev, float next);
+
+int DenoiseInto(const FrameBuffer &src, const AOVLayout &layout, FrameBuffer &dst)
+{
+  if (src.IsEmpty() || src.GetChannelCount() < 3) {
+    return -1;
+  }
+
+  DenoiseBuffers buf;
+  init_buffers(src, layout, buf);
+  if (layout.GetOffset(AOV_VARIANCE) < 0) {
+    estimate_variance(buf);
+  }
+
+  const int NBANDS = (buf.height + ROW_BAND_SIZE - 1) / ROW_BAND_SIZE;
+  std::vector<int> band_que(NBANDS);
+  for (int i = 0; i < NBANDS; i++) {
+    band_que[i] = i;
+  }
+
+  for (int i = 0; i < ITERATION_COUNT; i++) {
+    buf.step = 1 << i;
+    MtRunParallelLoop(&buf, filter_rows_task, MtGetMaxAvailableThreadCount(), band_que);
+    buf.current = 1 - buf.current;
+  }
+
+  dst.Resize(buf.width, buf.height, 4);
+  for (int y = 0; y < buf.height; y++) {
+    for (int x = 0; x < buf.width; x++) {
+      const int i = y * buf.width + x;
+      const Color C = buf.irradiance[buf.current][i] * buf.albedo[i];
+      dst.SetColor(x, y, Color4(C.r, C.g, C.b, src.GetColor(x, y).a));
+    }
+  }
+
+  return 0;
+}
+
+static void init_buffers(const FrameBuffer &src, const AOVLayout &layout,
+    DenoiseBuffers &buf)
+{
+  const int W = src.GetWidth();
+  const int H = src.GetHeight();
+  const int N = W * H;
+  // aovs follow RGBA
+  const int albedo_offset = layout.GetOffset(AOV_ALBEDO);
+  const int normal_offset = layout.GetOffset(AOV_NORMAL);
+  const int depth_offset = layout.GetOffset(AOV_DEPTH);
+  const int variance_offset = layout.GetOffset(AOV_VARIANCE);
+  const bool has_aovs = src.GetChannelCount() >= 4 + layout.GetChannelCount();
+
+  buf.width = W;
+  buf.height = H;
+  buf.has_normal = has_aovs && normal_offset >= 0;
+  buf.has_depth = has_aovs && depth_offset >= 0;
+  for (int i = 0; i < 2; i++) {
+    buf.irradiance[i].resize(N);
+    buf.variance[i].resize(N);
+  }
+  buf.albedo.assign(N, Color(1, 1, 1));
+  if (buf.has_normal) {
+    buf.normal.resize(3 * N);
+  }
+  if (buf.has_depth) {
+    buf.depth.resize(N);
+    buf.depth_gradient.resize(2 * N);
+  }
+
+  for (int y = 0; y < H; y++) {
+    for (int x = 0; x < W; x++) {
+      const int i = y * W + x;
+      const Color4 C4 = src.GetColor(x, y);
+      Color &A = buf.albedo[i];
+
+      if (has_aovs && albedo_offset >= 0) {
+        const int z = 4 + albedo_offset;
+        const float a[] = {src.GetValue(x, y, z), src.GetValue(x, y, z + 1), src.GetValue(x, y, z + 2)};
+        A.r = a[0] >= MIN_ALBEDO ? a[0] : 1;
+        A.g = a[1] >= MIN_ALBEDO ? a[1] : 1;
+        A.b = a[2] >= MIN_ALBEDO ? a[2] : 1;
+      }
+      buf.irradiance[0][i] = Color(C4.r / A.r, C4.g / A.g, C4.b / A.b);
+
+      if (has_aovs && variance_offset >= 0) {
+        const float lum = Luminance(A);
+        buf.variance[0][i] = src.GetValue(x, y, 4 + variance_offset) / (lum * lum);
+      }
+      if (buf.has_normal) {
+        const int z = 4 + normal_offset;
+        buf.normal[3 * i + 0] = src.GetValue(x, y, z + 0);
+        buf.normal[3 * i + 1] = src.GetValue(x, y, z + 1);
+        buf.normal[3 * i + 2] = src.GetValue(x, y, z + 2);
+      }
+      if (buf.has_depth) {
+        buf.depth[i] = src.GetValue(x, y, 4 + depth_offset);
+      }
+    }
+  }
+
+  // per pixel change of depth within the surface. 0 where rays miss
+  if (buf.has_depth) {
+    for (int y = 0; y < H; y++) {
+      for (int x = 0; x < W; x++) {
+        const int i = y * W + x;
+        const float z = buf.depth[i];
+        const float left  = x > 0     ? buf.depth[i - 1] : 0;
+        const float right = x < W - 1 ? buf.depth[i + 1] : 0;
+        const float up    = y > 0     ? buf.depth[i - W] : 0;
+        const float down  = y < H - 1 ? buf.depth[i + W] : 0;
+        buf.depth_gradient[2 * i + 0] = one_sided_gradient(z, left, right);
+        buf.depth_gradient[2 * i + 1] = one_sided_gradient(z, up, down);
+      }
+    }
+  }
+}
+
+// variance of luminance of 3x3 pixels when the renderer gives none
+static void estimate_variance(DenoiseBuffers &buf)
+{
+  const int W = buf.width;
+  const int H = buf.height;
+
+  for (int y = 0; y < H; y++) {
+    for (int x = 0; x < W; x++) {
+      float sum = 0;
+      float sum2 = 0;
+      int count = 0;
+      for (int v = std::max(y - 1, 0); v <= std::min(y + 1, H - 1); v++) {
+        for (int u = std::max(x - 1, 0); u <= std::min(x + 1, W - 1); u++) {
+          const float lum = Luminance(buf.irradiance[0][v * W + u]);
+          sum += lum;
+          sum2 += lum * lum;
+          count++;
+        }
+      }
+      const float mean = sum / count;
+      buf.variance[0][y * W + x] = std::max(sum2 / count - mean * mean, 0.f);
+    }
+  }
+}
+
+static LoopStatus filter_rows_task(void *data, const ThreadContext &context)
+{
+  DenoiseBuffers &buf = *reinterpret_cast<DenoiseBuffers *>(data);
+  const int W = buf.width;
+  const int H = buf.height;
+  const int step = buf.step;
+  const std::vector<Color> &src_irr = buf.irradiance[buf.current];
+  const std::vector<float> &src_var = buf.variance[buf.current];
+  std::vector<Color> &dst_irr = buf.irradiance[1 - buf.current];
+  std::vector<float> &dst_var = buf.variance[1 - buf.current];
+
+  const int ymin = context.iteration_id * ROW_BAND_SIZE;
+  const int ymax = std::min(ymin + ROW_BAND_SIZE, H);
+
+  for (int y = ymin; y < ymax; y++) {
+    for (int x = 0; x < W; x++) {
+      const int p = y * W + x;
+      const float lum_p = Luminance(src_irr[p]);
+      const float sigma_lum = SIGMA_LUMINANCE * std::sqrt(blurred_variance(buf, x, y)) + 1e-6f;
+
+      Color sum_irr;
+      float sum_var = 0;
+      float sum_wgt = 0;
+
+      for (int j = -2; j <= 2; j++) {
+        const int qy = y + j * step;
+        if (qy < 0 || qy >= H) {
+          continue;
+        }
+        for (int i = -2; i <= 2; i++) {
+          const int qx = x + i * step;
+          if (qx < 0 || qx >= W) {
+            continue;
+          }
+          const int q = qy * W + qx;
+          float wgt = KERNEL[i + 2] * KERNEL[j + 2];
+
+          if (q != p) {
+            const float lum_q = Luminance(src_irr[q]);
+            wgt *= Exp(-std::abs(lum_p - lum_q) / sigma_lum);
+
+            if (buf.has_normal) {
+              const float *np = &buf.normal[3 * p];
+              const float *nq = &buf.normal[3 * q];
+              const float dot = np[0] * nq[0] + np[1] * nq[1] + np[2] * nq[2];
+              const bool missed_p = np[0] == 0 && np[1] == 0 && np[2] == 0;
+              const bool missed_q = nq[0] == 0 && nq[1] == 0 && nq[2] == 0;
+              if (missed_p != missed_q) {
+                wgt = 0;
+              } else if (!missed_p) {
+                float w = std::max(dot, 0.f);
+                for (int k = 0; k < NORMAL_POWER_LOG2; k++) {
+                  w *= w;
+                }
+                wgt *= w;
+              }
+            }
+
+            if (buf.has_depth) {
+              const float zp = buf.depth[p];
+              const float zq = buf.depth[q];
+              if ((zp > 0) != (zq > 0)) {
+                wgt = 0;
+              } else if (zp > 0) {
+                const float *grad = &buf.depth_gradient[2 * p];
+                const float expected = std::abs(grad[0] * i * step + grad[1] * j * step);
+                wgt *= Exp(-std::abs(zp - zq) / (SIGMA_DEPTH * expected + 1e-3f * zp));
+              }
+            }
+          }
+
+          sum_irr += wgt * src_irr[q];
+          sum_var += wgt * wgt * src_var[q];
+          sum_wgt += wgt;
+        }
+      }
+
+      const float inv_wgt = 1 / sum_wgt;
+      dst_irr[p] = sum_irr * inv_wgt;
+      dst_var[p] = sum_var * inv_wgt * inv_wgt;
+    }
+  }
+
+  return LoopStatus::Continue;
+}
+
+// the variance of one pixel is too noisy to stop the filter
+static float blurred_variance(const DenoiseBuffers &buf, int x, int y)
+{
+  static const float GAUSS[2] = {.5f, .25f};
+  const std::vector<float> &var = buf.variance[buf.current];
+  float sum = 0;
+  float sum_wgt = 0;
+
+  for (int j = -1; j <= 1; j++) {
+    const int v = y + j;
+    if (v < 0 || v >= buf.height) {
+      continue;
+    }
+    for (int i = -1; i <= 1; i++) {
+      const int u = x + i;
+      if (u < 0 || u >= buf.width) {
+        continue;
+      }
+      const float wgt = GAUSS[std::abs(i)] * GAUSS[std::abs(j)];
+      sum += wgt * var[v * buf.width + u];
+      sum_wgt += wgt;
+    }
+  }
+  return sum / sum_wgt;
+}
+
+// the smaller difference to neighbors hit by rays so that edges of
+// surfaces don't make the gradient of either side steep
+static float one_sided_gradient(float center, float prev, float next)
+{
+  if (center <= 0) {
+    return 0;
+  }
+  const float d_prev = prev > 0 ? center - prev : REAL_MAX;
+  const float d_next = next > 0 ? next - center : REAL_MAX;
+  if (std::abs(d_prev) < std::abs(d_next)) {
+    return d_prev;
+  }
+  return d_next < REAL_MAX ? d_next : 0;
+}
+
+} // namespace xxx
@@ -0,0 +1,25 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_DENOISER_H
+#define FJ_DENOISER_H
+
+#include "fj_compatibility.h"
+
+namespace fj {
+
+class FrameBuffer;
+class AOVLayout;
+
+// Denoises RGBA of src into dst with an edge-avoiding a-trous filter guided
+// by the aovs of src in the layout. colors are divided by albedo so texture
+// details are kept, normals and depth stop the filter at edges of surfaces,
+// and variance tells noise from details. guides not in the layout are not
+// used and variance is estimated from neighbor pixels then. dst has 4
+// channels. returns -1 if src has no color
+FJ_API int DenoiseInto(const FrameBuffer &src, const AOVLayout &layout,
+    FrameBuffer &dst);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
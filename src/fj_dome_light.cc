@@ -9,7 +9,7 @@
 
 namespace fj {
 
-DomeLight::DomeLight() : dome_samples_()
+DomeLight::DomeLight() : sampler_(), transform_(), sh_()
 {
 }
 
@@ -19,33 +19,41 @@ DomeLight::~DomeLight()
 
 int DomeLight::get_sample_count() const
 {
-  return GetSampleDensity();
+  return sh_.IsEmpty() ? GetSampleDensity() : 1;
 }
 
-void DomeLight::get_samples(LightSample *samples, int max_samples) const
+int DomeLight::get_sample_set_count() const
 {
-  Transform transform_interp;
-  // TODO time sampling
-  const float time = 0;
-  get_transform_sample(transform_interp, time);
+  // the sample of irradiance is always the same
+  return sh_.IsEmpty() ? 0 : 1;
+}
 
+void DomeLight::get_samples(LightSample *samples, int max_samples,
+    const Vector2 *points) const
+{
   int nsamples = GetSampleCount();
   nsamples = Min(nsamples, max_samples);
 
   for (int i = 0; i < nsamples; i++) {
-    const DomeSample *dome_sample = &dome_samples_[i];
+    DomeSample dome_sample;
+    if (sampler_.IsEmpty() || !sh_.IsEmpty()) {
+      dome_sample.color = Color(1, .63, .63);
+      dome_sample.dir = Normalize(Vector(1./nsamples, 1, 1./nsamples));
+    } else {
+      dome_sample = sampler_.Sample(points[i]);
+    }
 
     // TODO CHANGE IT TO REAL_MAX WHEN FINISHING IT TO OTHERS
-    Vector P_sample = dome_sample->dir * FLT_MAX;
-    Vector N_sample = -1 * dome_sample->dir;
+    Vector P_sample = dome_sample.dir * FLT_MAX;
+    Vector N_sample = -1 * dome_sample.dir;
 
     // TODO cancel translate and scale
-    XfmTransformPoint(&transform_interp, &P_sample);
-    XfmTransformVector(&transform_interp, &N_sample);
+    XfmTransformPoint(&transform_, &P_sample);
+    XfmTransformVector(&transform_, &N_sample);
 
     samples[i].P = P_sample;
     samples[i].N = N_sample;
-    samples[i].color = dome_sample->color;
+    samples[i].color = dome_sample.color;
     samples[i].light = this;
   }
 }
@@ -57,19 +65,13 @@ Color DomeLight::illuminate(const LightSample &sample, const Vector &Ps) const
 
 int DomeLight::preprocess()
 {
-  const int NSAMPLES = GetSampleCount();
-  DomeSample init_sample;
-  init_sample.uv = TexCoord(1./NSAMPLES, 1./NSAMPLES);
-  init_sample.color = Color(1, .63, .63);
-  init_sample.dir = Vector(1./NSAMPLES, 1, 1./NSAMPLES);
-  init_sample.dir = Normalize(init_sample.dir);
-
-  dome_samples_.resize(NSAMPLES, init_sample);
-  std::vector<DomeSample>(dome_samples_).swap(dome_samples_);
+  // samples are drawn for each shading so the transform is computed once
+  get_transform_sample(transform_, 0);
 
   Texture *envmap = GetEnvironmentMap();
   if (envmap == NULL) {
     // TODO should be an error?
+    sh_.Clear();
     return 0;
   }
 
@@ -79,21 +81,34 @@ int DomeLight::preprocess()
   XRES /= 8;
   YRES /= 8;
 
-  if (0) {
-    ImportanceSampling(envmap, 0,
-        XRES, YRES,
-        &dome_samples_[0], NSAMPLES);
-  } else if (1) {
-    StratifiedImportanceSampling(envmap, 0,
-        XRES, YRES,
-        &dome_samples_[0], NSAMPLES);
-  } else {
-    StructuredImportanceSampling(envmap, 0,
-        XRES, YRES,
-        &dome_samples_[0], NSAMPLES);
+  const int err = sampler_.Build(envmap, Max(XRES, 1), Max(YRES, 1));
+  if (err || GetSHIrradiance() == SH_IRRADIANCE_OFF) {
+    sh_.Clear();
+    return err;
   }
 
+  // pixels weighted by the probability of the sampler give the
+  // irradiance its samples converge to
+  sh_.Clear();
+  for (int i = 0; i < sampler_.GetPixelCount(); i++) {
+    Vector dir;
+    Color color;
+    double probability = 0;
+    sampler_.GetPixel(i, &dir, &color, &probability);
+    XfmTransformVector(&transform_, &dir);
+    sh_.AddRadiance(Normalize(dir), color * probability);
+  }
   return 0;
 }
 
+bool DomeLight::has_irradiance() const
+{
+  return !sh_.IsEmpty();
+}
+
+Color DomeLight::irradiance(const Vector &N) const
+{
+  return GetIntensity() * sh_.Evaluate(N);
+}
+
 } // namespace xxx
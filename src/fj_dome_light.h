@@ -6,7 +6,7 @@
 
 #include "fj_light.h"
 #include "fj_importance_sampling.h"
-#include <vector>
+#include "fj_spherical_harmonics.h"
 
 namespace fj {
 
@@ -17,12 +17,20 @@ public:
 
 private:
   virtual int get_sample_count() const;
-  virtual void get_samples(LightSample *samples, int max_samples) const;
+  virtual int get_sample_set_count() const;
+  virtual void get_samples(LightSample *samples, int max_samples,
+      const Vector2 *points) const;
   virtual Color illuminate(const LightSample &sample, const Vector &Ps) const;
   virtual int preprocess();
-
-  // TODO tmp solution for dome light data
-  std::vector<DomeSample> dome_samples_;
+  virtual bool has_irradiance() const;
+  virtual Color irradiance(const Vector &N) const;
+
+  // draws fresh samples for each shading with no sample sets
+  EnvironmentSampler sampler_;
+  // TODO time sampling
+  Transform transform_;
+  // the expectation of the samples for each normal if not empty
+  SHIrradiance sh_;
 };
 
 } // namespace xxx
@@ -0,0 +1,381 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_embree_accelerator.h"
+#include "fj_intersection.h"
+#include "fj_primitive_set.h"
+#include "fj_numeric.h"
+#include "fj_mesh.h"
+#include "fj_ray.h"
+#include "internal/fj_float_rounding.h"
+
+#include <embree3/rtcore.h>
+#include <iostream>
+#include <typeinfo>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+namespace fj {
+
+static const char ACCELERATOR_NAME[] = "Embree";
+
+// passed to callbacks in place of the embree context, which it starts with
+class EmbreeContext {
+public:
+  RTCIntersectContext context;
+  const PrimitiveSet *primset;
+  const Ray *ray;
+  Real time;
+  Intersection *isect;
+  bool hit;
+};
+
+static RTCDevice get_device();
+static RTCGeometry new_triangle_geometry(RTCDevice device, const Mesh &mesh,
+    std::size_t *buffer_size);
+static RTCGeometry new_user_geometry(RTCDevice device, const PrimitiveSet &primset);
+static void setup_context(const PrimitiveSet &primset, const Ray &ray, Real time,
+    Intersection *isect, EmbreeContext *cxt);
+static void setup_ray(const Ray &ray, Real time, RTCRay *rtc_ray);
+static void set_triangle_hit(const Mesh &mesh, unsigned int prim_id,
+    float t_hit, float u, float v, Intersection *isect);
+
+static void get_user_bounds(const RTCBoundsFunctionArguments *args);
+static void intersect_user_primitive(const RTCIntersectFunctionNArguments *args);
+static void occlude_user_primitive(const RTCOccludedFunctionNArguments *args);
+static void filter_occluded_triangle(const RTCFilterFunctionNArguments *args);
+
+EmbreeAccelerator::EmbreeAccelerator() :
+    scene_(NULL),
+    has_triangles_(false),
+    buffer_size_(0)
+{
+}
+
+EmbreeAccelerator::~EmbreeAccelerator()
+{
+  if (scene_ != NULL) {
+    rtcReleaseScene(scene_);
+  }
+}
+
+bool EmbreeAccelerator::HasTriangles() const
+{
+  return has_triangles_;
+}
+
+int EmbreeAccelerator::build()
+{
+  const RTCDevice device = get_device();
+  if (device == NULL) {
+    return -1;
+  }
+
+  const PrimitiveSet &primset = *GetPrimitiveSet();
+  // exact type only. subclasses may override the ray tests
+  const bool has_triangles = typeid(primset) == typeid(Mesh) && !primset.HasMotion();
+  std::size_t buffer_size = 0;
+
+  const RTCGeometry geom = has_triangles ?
+      new_triangle_geometry(device, static_cast<const Mesh &>(primset), &buffer_size) :
+      new_user_geometry(device, primset);
+  if (geom == NULL) {
+    return -1;
+  }
+
+  const RTCScene scene = rtcNewScene(device);
+  rtcSetSceneBuildQuality(scene, RTC_BUILD_QUALITY_HIGH);
+  rtcAttachGeometry(scene, geom);
+  rtcReleaseGeometry(geom);
+  rtcCommitScene(scene);
+
+  const RTCError err = rtcGetDeviceError(device);
+  if (err != RTC_ERROR_NONE) {
+    std::cerr << "* WARNING: embree failed to build: error " << err << "\n";
+    rtcReleaseScene(scene);
+    return -1;
+  }
+
+  // commit
+  if (scene_ != NULL) {
+    rtcReleaseScene(scene_);
+  }
+  scene_ = scene;
+  has_triangles_ = has_triangles;
+  buffer_size_ = buffer_size;
+
+  return 0;
+}
+
+bool EmbreeAccelerator::intersect(const Ray &ray, Real time, Intersection *isect) const
+{
+  if (scene_ == NULL) {
+    return false;
+  }
+
+  const PrimitiveSet &primset = *GetPrimitiveSet();
+  EmbreeContext cxt;
+  setup_context(primset, ray, time, isect, &cxt);
+
+  RTCRayHit rayhit;
+  setup_ray(ray, time, &rayhit.ray);
+  rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+  rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+
+  rtcIntersect1(scene_, &cxt.context, &rayhit);
+
+  if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
+    return false;
+  }
+  if (has_triangles_) {
+    set_triangle_hit(static_cast<const Mesh &>(primset), rayhit.hit.primID,
+        rayhit.ray.tfar, rayhit.hit.u, rayhit.hit.v, isect);
+    return true;
+  }
+
+  // user primitives store the hit of the primitive set by themselves
+  return cxt.hit;
+}
+
+bool EmbreeAccelerator::occlude(const Ray &ray, Real time, Intersection *isect) const
+{
+  if (scene_ == NULL) {
+    return false;
+  }
+
+  EmbreeContext cxt;
+  setup_context(*GetPrimitiveSet(), ray, time, isect, &cxt);
+
+  RTCRay rtc_ray;
+  setup_ray(ray, time, &rtc_ray);
+
+  // the hit is stored by the filter of triangles or the user primitive
+  rtcOccluded1(scene_, &cxt.context, &rtc_ray);
+
+  return cxt.hit;
+}
+
+const char *EmbreeAccelerator::get_name() const
+{
+  return ACCELERATOR_NAME;
+}
+
+std::size_t EmbreeAccelerator::get_memory_usage() const
+{
+  return buffer_size_;
+}
+
+static void print_device_error(void *user_ptr, RTCError code, const char *str)
+{
+  std::cerr << "* WARNING: embree: " << (str != NULL ? str : "") <<
+      " (error " << code << ")\n";
+}
+
+static RTCDevice new_device()
+{
+  const RTCDevice device = rtcNewDevice(NULL);
+  if (device == NULL) {
+    std::cerr << "* WARNING: could not create embree device\n";
+    return NULL;
+  }
+
+  rtcSetDeviceErrorFunction(device, print_device_error, NULL);
+  return device;
+}
+
+// a device for all accelerators since each one has its own threads
+static RTCDevice get_device()
+{
+  static const RTCDevice device = new_device();
+  return device;
+}
+
+static RTCGeometry new_triangle_geometry(RTCDevice device, const Mesh &mesh,
+    std::size_t *buffer_size)
+{
+  const int NPOINTS = mesh.GetPointCount();
+  const int NFACES = mesh.GetFaceCount();
+  const RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+
+  float *vertices = static_cast<float *>(rtcSetNewGeometryBuffer(geom,
+      RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, 3 * sizeof(float), NPOINTS));
+  unsigned int *indices = static_cast<unsigned int *>(rtcSetNewGeometryBuffer(geom,
+      RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, 3 * sizeof(unsigned int), NFACES));
+  if (vertices == NULL || indices == NULL) {
+    rtcReleaseGeometry(geom);
+    return NULL;
+  }
+
+  for (int i = 0; i < NPOINTS; i++) {
+    const Vector P = mesh.GetPointPosition(i);
+    vertices[3 * i + 0] = static_cast<float>(P.x);
+    vertices[3 * i + 1] = static_cast<float>(P.y);
+    vertices[3 * i + 2] = static_cast<float>(P.z);
+  }
+  for (int i = 0; i < NFACES; i++) {
+    const Index3 face = mesh.GetFaceIndices(i);
+    indices[3 * i + 0] = static_cast<unsigned int>(face.i0);
+    indices[3 * i + 1] = static_cast<unsigned int>(face.i1);
+    indices[3 * i + 2] = static_cast<unsigned int>(face.i2);
+  }
+  *buffer_size = 3 * (sizeof(float) * NPOINTS + sizeof(unsigned int) * NFACES);
+
+  // shadow rays need the shader of the first hit
+  rtcSetGeometryOccludedFilterFunction(geom, filter_occluded_triangle);
+  rtcCommitGeometry(geom);
+  return geom;
+}
+
+static RTCGeometry new_user_geometry(RTCDevice device, const PrimitiveSet &primset)
+{
+  const RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+
+  rtcSetGeometryUserPrimitiveCount(geom,
+      static_cast<unsigned int>(primset.GetPrimitiveCount()));
+  // bounds at shutter open and close
+  if (primset.HasMotion()) {
+    rtcSetGeometryTimeStepCount(geom, 2);
+  }
+  rtcSetGeometryUserData(geom, const_cast<PrimitiveSet *>(&primset));
+  rtcSetGeometryBoundsFunction(geom, get_user_bounds, NULL);
+  rtcSetGeometryIntersectFunction(geom, intersect_user_primitive);
+  rtcSetGeometryOccludedFunction(geom, occlude_user_primitive);
+  rtcCommitGeometry(geom);
+  return geom;
+}
+
+static void setup_context(const PrimitiveSet &primset, const Ray &ray, Real time,
+    Intersection *isect, EmbreeContext *cxt)
+{
+  rtcInitIntersectContext(&cxt->context);
+  cxt->primset = &primset;
+  cxt->ray = &ray;
+  cxt->time = time;
+  cxt->isect = isect;
+  cxt->hit = false;
+}
+
+static void setup_ray(const Ray &ray, Real time, RTCRay *rtc_ray)
+{
+  rtc_ray->org_x = static_cast<float>(ray.orig.x);
+  rtc_ray->org_y = static_cast<float>(ray.orig.y);
+  rtc_ray->org_z = static_cast<float>(ray.orig.z);
+  rtc_ray->dir_x = static_cast<float>(ray.dir.x);
+  rtc_ray->dir_y = static_cast<float>(ray.dir.y);
+  rtc_ray->dir_z = static_cast<float>(ray.dir.z);
+  rtc_ray->tnear = static_cast<float>(ray.tmin);
+  rtc_ray->tfar = RoundUpToFloat(ray.tmax);
+  rtc_ray->time = static_cast<float>(Clamp(time, 0, 1));
+  rtc_ray->mask = 0xFFFFFFFF;
+  rtc_ray->id = 0;
+  rtc_ray->flags = 0;
+}
+
+// same as the hit of Mesh. attributes are computed after traversal
+static void set_triangle_hit(const Mesh &mesh, unsigned int prim_id,
+    float t_hit, float u, float v, Intersection *isect)
+{
+  isect->object = NULL;
+  isect->prim_id = prim_id;
+  isect->shading_group_id = mesh.GetFaceGroupID(prim_id);
+  isect->t_hit = t_hit;
+  isect->prim_uv = Vector2(u, v);
+}
+
+static void get_user_bounds(const RTCBoundsFunctionArguments *args)
+{
+  const PrimitiveSet *primset = static_cast<const PrimitiveSet *>(args->geometryUserPtr);
+  Box bounds;
+
+  if (primset->HasMotion()) {
+    Box bounds_open, bounds_close;
+    primset->GetPrimitiveMotionBounds(args->primID, &bounds_open, &bounds_close);
+    bounds = args->timeStep == 0 ? bounds_open : bounds_close;
+  } else {
+    primset->GetPrimitiveBounds(args->primID, &bounds);
+  }
+
+  // rounded outward so that float bounds contain the primitive
+  RTCBounds *rtc_bounds = args->bounds_o;
+  rtc_bounds->lower_x = RoundDownToFloat(bounds.min.x);
+  rtc_bounds->lower_y = RoundDownToFloat(bounds.min.y);
+  rtc_bounds->lower_z = RoundDownToFloat(bounds.min.z);
+  rtc_bounds->upper_x = RoundUpToFloat(bounds.max.x);
+  rtc_bounds->upper_y = RoundUpToFloat(bounds.max.y);
+  rtc_bounds->upper_z = RoundUpToFloat(bounds.max.z);
+}
+
+static void intersect_user_primitive(const RTCIntersectFunctionNArguments *args)
+{
+  // traced by rtcIntersect1 only
+  assert(args->N == 1);
+  if (!args->valid[0]) {
+    return;
+  }
+
+  EmbreeContext *cxt = reinterpret_cast<EmbreeContext *>(args->context);
+  Ray ray = *cxt->ray;
+  if (cxt->hit) {
+    ray.tmax = cxt->isect->t_hit;
+  }
+
+  Intersection isect;
+  const bool hit = cxt->primset->RayIntersect(args->primID, ray, cxt->time, &isect);
+  if (!hit || (cxt->hit && isect.t_hit >= cxt->isect->t_hit)) {
+    return;
+  }
+
+  *cxt->isect = isect;
+  cxt->hit = true;
+
+  // tfar in float is only for culling. the hit in double is in the context
+  RTCRayHit *rayhit = reinterpret_cast<RTCRayHit *>(args->rayhit);
+  rayhit->ray.tfar = RoundUpToFloat(isect.t_hit);
+  rayhit->hit.u = 0;
+  rayhit->hit.v = 0;
+  rayhit->hit.primID = args->primID;
+  rayhit->hit.geomID = args->geomID;
+  rayhit->hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+}
+
+static void occlude_user_primitive(const RTCOccludedFunctionNArguments *args)
+{
+  // traced by rtcOccluded1 only
+  assert(args->N == 1);
+  if (!args->valid[0]) {
+    return;
+  }
+
+  EmbreeContext *cxt = reinterpret_cast<EmbreeContext *>(args->context);
+  const bool hit = cxt->primset->RayOcclude(args->primID, *cxt->ray, cxt->time,
+      cxt->isect);
+  if (!hit) {
+    return;
+  }
+
+  cxt->hit = true;
+  // -inf tells embree that the ray is occluded
+  RTCRay *rtc_ray = reinterpret_cast<RTCRay *>(args->ray);
+  rtc_ray->tfar = -HUGE_VALF;
+}
+
+static void filter_occluded_triangle(const RTCFilterFunctionNArguments *args)
+{
+  assert(args->N == 1);
+  if (!args->valid[0]) {
+    return;
+  }
+
+  const EmbreeContext *cxt = reinterpret_cast<const EmbreeContext *>(args->context);
+  set_triangle_hit(static_cast<const Mesh &>(*cxt->primset),
+      RTCHitN_primID(args->hit, args->N, 0),
+      RTCRayN_tfar(args->ray, args->N, 0),
+      RTCHitN_u(args->hit, args->N, 0),
+      RTCHitN_v(args->hit, args->N, 0),
+      cxt->isect);
+  // the context is const to embree but not its hit
+  const_cast<EmbreeContext *>(cxt)->hit = true;
+}
+
+} // namespace xxx
@@ -0,0 +1,41 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_EMBREE_ACCELERATOR_H
+#define FJ_EMBREE_ACCELERATOR_H
+
+#include "fj_accelerator.h"
+
+// RTCScene of embree3/rtcore.h
+struct RTCSceneTy;
+
+namespace fj {
+
+// Accelerator of Embree 3 BVH builders and traversal. only built with
+// make EMBREE=1. meshes without motion are handed to embree as float
+// triangles. other primitive sets are user geometry of the bounds and the
+// ray tests of the primitive set.
+class EmbreeAccelerator : public Accelerator {
+public:
+  EmbreeAccelerator();
+  ~EmbreeAccelerator();
+
+  // true if the primitives are embree triangles
+  bool HasTriangles() const;
+
+private:
+  virtual int build();
+  virtual bool intersect(const Ray &ray, Real time, Intersection *isect) const;
+  virtual bool occlude(const Ray &ray, Real time, Intersection *isect) const;
+  virtual const char *get_name() const;
+  virtual std::size_t get_memory_usage() const;
+
+  RTCSceneTy *scene_;
+  bool has_triangles_;
+  // of vertex and index buffers. the tree is held by embree
+  std::size_t buffer_size_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
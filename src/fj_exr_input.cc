@@ -0,0 +1,398 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_exr_input.h"
+#include "fj_compression.h"
+#include "fj_framebuffer.h"
+#include "fj_os.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+namespace fj {
+
+static const int32_t EXR_MAGIC = 20000630;
+static const int32_t EXR_TILED_FLAG = 0x200;
+static const int32_t EXR_DEEP_FLAG = 0x800;
+static const int32_t EXR_MULTIPART_FLAG = 0x1000;
+
+static const int EXR_PIXEL_UINT = 0;
+static const int EXR_PIXEL_HALF = 1;
+static const int EXR_PIXEL_FLOAT = 2;
+static const int EXR_NO_COMPRESSION = 0;
+static const int EXR_RLE_COMPRESSION = 1;
+static const int EXR_ONE_LEVEL = 0;
+
+// Reads values of the header from the mapped file. reads past the end
+// of the file make the reader invalid instead of reading out of bounds.
+class ByteReader {
+public:
+  ByteReader(const char *data, std::size_t size, std::size_t pos) :
+      data_(data), size_(size), pos_(pos), is_valid_(pos <= size) {}
+  ~ByteReader() {}
+
+  int32_t ReadInt()
+  {
+    int32_t value = 0;
+    read_bytes(&value, sizeof(value));
+    return value;
+  }
+  unsigned char ReadByte()
+  {
+    unsigned char value = 0;
+    read_bytes(&value, sizeof(value));
+    return value;
+  }
+  std::string ReadString()
+  {
+    const char *begin = data_ + pos_;
+    const void *end = is_valid_ ? memchr(begin, '\0', size_ - pos_) : NULL;
+    if (end == NULL) {
+      is_valid_ = false;
+      return std::string();
+    }
+    const std::string str(begin, static_cast<const char *>(end));
+    pos_ += str.size() + 1;
+    return str;
+  }
+  void Skip(std::size_t size)
+  {
+    if (!is_valid_ || size > size_ - pos_) {
+      is_valid_ = false;
+      return;
+    }
+    pos_ += size;
+  }
+
+  std::size_t GetPosition() const { return pos_; }
+  bool IsValid() const { return is_valid_; }
+
+private:
+  void read_bytes(void *dst, std::size_t size)
+  {
+    if (!is_valid_ || size > size_ - pos_) {
+      is_valid_ = false;
+      return;
+    }
+    memcpy(dst, data_ + pos_, size);
+    pos_ += size;
+  }
+
+  const char *data_;
+  std::size_t size_;
+  std::size_t pos_;
+  bool is_valid_;
+};
+
+static std::size_t pixel_size(int type)
+{
+  return type == EXR_PIXEL_HALF ? 2 : 4;
+}
+
+static float read_pixel(const char *src, int type)
+{
+  switch (type) {
+  case EXR_PIXEL_UINT: {
+    uint32_t value = 0;
+    memcpy(&value, src, sizeof(value));
+    return static_cast<float>(value);
+    }
+  case EXR_PIXEL_HALF: {
+    uint16_t value = 0;
+    memcpy(&value, src, sizeof(value));
+    return HalfToFloat(value);
+    }
+  default: {
+    float value = 0;
+    memcpy(&value, src, sizeof(value));
+    return value;
+    }
+  }
+}
+
+ExrInput::ExrInput() :
+  data_(NULL),
+  size_(0),
+  channels_(),
+  channel_names_(),
+  compression_(EXR_NO_COMPRESSION),
+  xmin_(0), ymin_(0), xmax_(-1), ymax_(-1),
+  is_tiled_(false),
+  xtile_size_(0),
+  ytile_size_(0),
+  table_offset_(0),
+  chunk_count_(0)
+{
+}
+
+ExrInput::~ExrInput()
+{
+  Close();
+}
+
+int ExrInput::Open(const std::string &filename)
+{
+  Close();
+
+  data_ = OsMapFile(filename.c_str(), &size_);
+  if (data_ == NULL) {
+    return -1;
+  }
+
+  if (read_header()) {
+    Close();
+    return -1;
+  }
+  return 0;
+}
+
+void ExrInput::Close()
+{
+  if (data_ != NULL) {
+    OsUnmapFile(data_, size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  channels_.clear();
+  channel_names_.clear();
+}
+
+bool ExrInput::IsOpen() const
+{
+  return data_ != NULL;
+}
+
+int ExrInput::GetWidth() const
+{
+  return xmax_ - xmin_ + 1;
+}
+
+int ExrInput::GetHeight() const
+{
+  return ymax_ - ymin_ + 1;
+}
+
+const std::vector<std::string> &ExrInput::GetChannelNames() const
+{
+  return channel_names_;
+}
+
+int ExrInput::ReadPixels(const std::vector<std::string> &names, FrameBuffer &fb) const
+{
+  if (!IsOpen() || names.empty()) {
+    return -1;
+  }
+
+  // framebuffer channel of each file channel. -1 if not read
+  std::vector<int> channel_map(channels_.size(), -1);
+  for (std::size_t i = 0; i < names.size(); i++) {
+    const std::vector<std::string>::const_iterator it =
+        std::find(channel_names_.begin(), channel_names_.end(), names[i]);
+    if (it != channel_names_.end()) {
+      channel_map[it - channel_names_.begin()] = static_cast<int>(i);
+    }
+  }
+
+  fb.Resize(GetWidth(), GetHeight(), static_cast<int>(names.size()));
+  if (fb.GetWidth() != GetWidth() || fb.GetHeight() != GetHeight() ||
+      fb.GetChannelCount() != static_cast<int>(names.size())) {
+    return -1;
+  }
+
+  const char *bytes = static_cast<const char *>(data_);
+  std::vector<char> raw;
+
+  for (int i = 0; i < chunk_count_; i++) {
+    uint64_t offset = 0;
+    memcpy(&offset, bytes + table_offset_ + sizeof(offset) * i, sizeof(offset));
+    // not written e.g. by a renderer that crashed
+    if (offset == 0) {
+      continue;
+    }
+    if (read_chunk(static_cast<std::size_t>(offset), channel_map, raw, fb)) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int ExrInput::read_header()
+{
+  ByteReader reader(static_cast<const char *>(data_), size_, 0);
+
+  const int32_t magic = reader.ReadInt();
+  const int32_t version = reader.ReadInt();
+  if (!reader.IsValid() || magic != EXR_MAGIC || (version & 0xFF) != 2 ||
+      (version & (EXR_DEEP_FLAG | EXR_MULTIPART_FLAG)) != 0) {
+    return -1;
+  }
+
+  is_tiled_ = (version & EXR_TILED_FLAG) != 0;
+  compression_ = -1;
+  xmax_ = xmin_ - 1;
+  ymax_ = ymin_ - 1;
+  int level_mode = EXR_ONE_LEVEL;
+
+  for (;;) {
+    const std::string name = reader.ReadString();
+    if (name.empty()) {
+      break;
+    }
+    const std::string type = reader.ReadString();
+    const int32_t size = reader.ReadInt();
+    if (!reader.IsValid() || size < 0) {
+      return -1;
+    }
+    const std::size_t next = reader.GetPosition() + size;
+
+    if (name == "channels" && type == "chlist") {
+      for (;;) {
+        Channel channel;
+        channel.name = reader.ReadString();
+        if (channel.name.empty()) {
+          break;
+        }
+        channel.type = reader.ReadInt();
+        // pLinear and reserved
+        reader.Skip(4);
+        const int32_t xsampling = reader.ReadInt();
+        const int32_t ysampling = reader.ReadInt();
+        if (xsampling != 1 || ysampling != 1 ||
+            channel.type < EXR_PIXEL_UINT || channel.type > EXR_PIXEL_FLOAT) {
+          return -1;
+        }
+        channels_.push_back(channel);
+        channel_names_.push_back(channel.name);
+      }
+    }
+    else if (name == "compression" && type == "compression") {
+      compression_ = reader.ReadByte();
+    }
+    else if (name == "dataWindow" && type == "box2i") {
+      xmin_ = reader.ReadInt();
+      ymin_ = reader.ReadInt();
+      xmax_ = reader.ReadInt();
+      ymax_ = reader.ReadInt();
+    }
+    else if (name == "tiles" && type == "tiledesc") {
+      xtile_size_ = reader.ReadInt();
+      ytile_size_ = reader.ReadInt();
+      level_mode = reader.ReadByte() & 0x0F;
+    }
+
+    if (!reader.IsValid() || reader.GetPosition() > next) {
+      return -1;
+    }
+    reader.Skip(next - reader.GetPosition());
+  }
+
+  if (!reader.IsValid() || channels_.empty() ||
+      GetWidth() < 1 || GetHeight() < 1 ||
+      (compression_ != EXR_NO_COMPRESSION && compression_ != EXR_RLE_COMPRESSION)) {
+    return -1;
+  }
+
+  if (is_tiled_) {
+    if (xtile_size_ < 1 || ytile_size_ < 1 || level_mode != EXR_ONE_LEVEL) {
+      return -1;
+    }
+    const int xntiles = (GetWidth() + xtile_size_ - 1) / xtile_size_;
+    const int yntiles = (GetHeight() + ytile_size_ - 1) / ytile_size_;
+    chunk_count_ = xntiles * yntiles;
+  } else {
+    // a scanline in each chunk without compression and with RLE
+    chunk_count_ = GetHeight();
+  }
+
+  table_offset_ = reader.GetPosition();
+  reader.Skip(sizeof(uint64_t) * chunk_count_);
+  if (!reader.IsValid()) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int ExrInput::read_chunk(std::size_t offset, const std::vector<int> &channel_map,
+    std::vector<char> &raw, FrameBuffer &fb) const
+{
+  ByteReader reader(static_cast<const char *>(data_), size_, offset);
+  int x0 = 0;
+  int y0 = 0;
+  int width = GetWidth();
+  int height = 1;
+
+  if (is_tiled_) {
+    const int32_t xtile = reader.ReadInt();
+    const int32_t ytile = reader.ReadInt();
+    const int32_t xlevel = reader.ReadInt();
+    const int32_t ylevel = reader.ReadInt();
+    x0 = xtile * xtile_size_;
+    y0 = ytile * ytile_size_;
+    if (xtile < 0 || ytile < 0 || xlevel != 0 || ylevel != 0 ||
+        x0 >= GetWidth() || y0 >= GetHeight()) {
+      return -1;
+    }
+    width = std::min(xtile_size_, GetWidth() - x0);
+    height = std::min(ytile_size_, GetHeight() - y0);
+  } else {
+    y0 = reader.ReadInt() - ymin_;
+    if (y0 < 0 || y0 >= GetHeight()) {
+      return -1;
+    }
+  }
+
+  const int32_t data_size = reader.ReadInt();
+  const std::size_t data_offset = reader.GetPosition();
+  reader.Skip(data_size);
+  if (!reader.IsValid() || data_size < 0) {
+    return -1;
+  }
+
+  // lines of the chunk, each line has the pixels of a channel one after another
+  std::size_t line_size = 0;
+  for (std::size_t i = 0; i < channels_.size(); i++) {
+    line_size += pixel_size(channels_[i].type) * width;
+  }
+  const std::size_t raw_size = line_size * height;
+
+  const char *src = static_cast<const char *>(data_) + data_offset;
+  if (static_cast<std::size_t>(data_size) < raw_size) {
+    if (compression_ != EXR_RLE_COMPRESSION) {
+      return -1;
+    }
+    raw.resize(raw_size);
+    if (RleUncompress(src, data_size, &raw[0], raw_size)) {
+      return -1;
+    }
+    src = &raw[0];
+  }
+  else if (static_cast<std::size_t>(data_size) != raw_size) {
+    return -1;
+  }
+
+  const int NCHANNELS = fb.GetChannelCount();
+  for (int y = 0; y < height; y++) {
+    for (std::size_t i = 0; i < channels_.size(); i++) {
+      const int type = channels_[i].type;
+      const std::size_t size = pixel_size(type);
+      if (channel_map[i] >= 0 && !fb.IsTiled() && fb.GetFormat() == FB_FORMAT_FLOAT) {
+        float *dst = fb.GetWritable(x0, y0 + y, channel_map[i]);
+        for (int x = 0; x < width; x++) {
+          dst[x * NCHANNELS] = read_pixel(src + size * x, type);
+        }
+      } else if (channel_map[i] >= 0) {
+        for (int x = 0; x < width; x++) {
+          fb.SetValue(x0 + x, y0 + y, channel_map[i], read_pixel(src + size * x, type));
+        }
+      }
+      src += size * width;
+    }
+  }
+
+  return 0;
+}
+
+} // namespace xxx
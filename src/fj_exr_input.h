@@ -0,0 +1,71 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_EXR_INPUT_H
+#define FJ_EXR_INPUT_H
+
+#include "fj_compatibility.h"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace fj {
+
+class FrameBuffer;
+
+// Reads single part OpenEXR files of one level through a memory mapping of
+// the file. Both scanline and tiled files are read when they are not
+// compressed or RLE compressed like the ones of ExrOutput. Half, float and
+// uint channels are all read as float.
+class FJ_API ExrInput {
+public:
+  ExrInput();
+  ~ExrInput();
+
+  // maps the file and reads the header
+  int Open(const std::string &filename);
+  void Close();
+  bool IsOpen() const;
+
+  // of the data window
+  int GetWidth() const;
+  int GetHeight() const;
+  // sorted by name as they are in the file
+  const std::vector<std::string> &GetChannelNames() const;
+
+  // Reads the channels of the names in the order of names into the
+  // framebuffer. channels not in the file are 0.
+  int ReadPixels(const std::vector<std::string> &names, FrameBuffer &fb) const;
+
+private:
+  class Channel {
+  public:
+    Channel() : name(), type(0) {}
+    ~Channel() {}
+
+    std::string name;
+    int type;
+  };
+
+  int read_header();
+  int read_chunk(std::size_t offset, const std::vector<int> &channel_map,
+      std::vector<char> &raw, FrameBuffer &fb) const;
+
+  void *data_;
+  std::size_t size_;
+
+  std::vector<Channel> channels_;
+  std::vector<std::string> channel_names_;
+  int compression_;
+  int xmin_, ymin_, xmax_, ymax_;
+  bool is_tiled_;
+  int xtile_size_;
+  int ytile_size_;
+  // of the offset table of chunks
+  std::size_t table_offset_;
+  int chunk_count_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
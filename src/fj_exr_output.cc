@@ -0,0 +1,331 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_exr_output.h"
+#include "fj_compression.h"
+#include "fj_framebuffer.h"
+#include "fj_tiler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+namespace fj {
+
+static const int32_t EXR_MAGIC = 20000630;
+// version 2 of single part tiled files
+static const int32_t EXR_VERSION = 2 | 0x200;
+
+static const int EXR_PIXEL_HALF = 1;
+static const int EXR_PIXEL_FLOAT = 2;
+static const char EXR_RLE_COMPRESSION = 1;
+static const char EXR_RANDOM_Y = 2;
+// ONE_LEVEL and ROUND_DOWN
+static const char EXR_ONE_LEVEL = 0;
+
+static void append_bytes(std::vector<char> &dst, const void *src, size_t size)
+{
+  const size_t offset = dst.size();
+  dst.resize(offset + size);
+  memcpy(&dst[offset], src, size);
+}
+
+static void append_int(std::vector<char> &dst, int32_t value)
+{
+  append_bytes(dst, &value, sizeof(value));
+}
+
+static void append_string(std::vector<char> &dst, const std::string &str)
+{
+  append_bytes(dst, str.c_str(), str.size() + 1);
+}
+
+static void append_attribute(std::vector<char> &dst, const std::string &name,
+    const std::string &type, const std::vector<char> &value)
+{
+  append_string(dst, name);
+  append_string(dst, type);
+  append_int(dst, static_cast<int32_t>(value.size()));
+  dst.insert(dst.end(), value.begin(), value.end());
+}
+
+static std::vector<char> make_box2i(int xmin, int ymin, int xmax, int ymax)
+{
+  std::vector<char> box;
+  append_int(box, xmin);
+  append_int(box, ymin);
+  append_int(box, xmax);
+  append_int(box, ymax);
+  return box;
+}
+
+std::vector<std::string> ExrChannelNames(const std::string &names, int nchannels)
+{
+  std::vector<std::string> result;
+  std::string::size_type begin = 0;
+  while (!names.empty() && begin <= names.size()) {
+    const std::string::size_type end = std::min(names.find(',', begin), names.size());
+    result.push_back(names.substr(begin, end - begin));
+    begin = end + 1;
+  }
+
+  bool is_valid = static_cast<int>(result.size()) == nchannels;
+  for (std::size_t i = 0; i < result.size(); i++) {
+    is_valid = is_valid && !result[i].empty() &&
+        std::count(result.begin(), result.end(), result[i]) == 1;
+  }
+  if (is_valid) {
+    return result;
+  }
+
+  if (!names.empty()) {
+    std::cerr << "* WARNING: EXR channel names \"" << names <<
+        "\" don't match " << nchannels << " channels. default names are used\n";
+  }
+
+  static const char *RGBA[] = {"R", "G", "B", "A"};
+  result.clear();
+  if (nchannels == 1) {
+    result.push_back("Y");
+  }
+  else if (nchannels == 3 || nchannels == 4) {
+    result.assign(RGBA, RGBA + nchannels);
+  }
+  else {
+    for (int i = 0; i < nchannels; i++) {
+      result.push_back("C" + std::to_string(i));
+    }
+  }
+  return result;
+}
+
+ExrOutput::ExrOutput() :
+  file_(NULL),
+  tiler_(NULL),
+  framebuffer_(NULL),
+  channel_order_(),
+  xntiles_(0),
+  yntiles_(0),
+  table_offset_(0),
+  end_offset_(0),
+  mutex_(),
+  tile_offsets_(),
+  has_error_(false)
+{
+}
+
+ExrOutput::~ExrOutput()
+{
+  Finish();
+}
+
+int ExrOutput::Start(const std::string &filename, const std::vector<std::string> &channel_names,
+    const Tiler *tiler, const FrameBuffer *framebuffer)
+{
+  const int NCHANNELS = framebuffer->GetChannelCount();
+  if (static_cast<int>(channel_names.size()) != NCHANNELS || NCHANNELS < 1) {
+    return -1;
+  }
+
+  tiler_ = tiler;
+  framebuffer_ = framebuffer;
+  xntiles_ = (tiler_->xres_ + tiler_->xtile_size_ - 1) / tiler_->xtile_size_;
+  yntiles_ = (tiler_->yres_ + tiler_->ytile_size_ - 1) / tiler_->ytile_size_;
+  tile_offsets_.assign(xntiles_ * yntiles_, 0);
+  has_error_ = false;
+
+  channel_order_.resize(NCHANNELS);
+  for (int i = 0; i < NCHANNELS; i++) {
+    channel_order_[i] = i;
+  }
+  std::sort(channel_order_.begin(), channel_order_.end(),
+      [&channel_names](int a, int b) { return channel_names[a] < channel_names[b]; });
+
+  std::vector<char> channels;
+  for (int i = 0; i < NCHANNELS; i++) {
+    const char RESERVED[4] = {0, 0, 0, 0};
+    append_string(channels, channel_names[channel_order_[i]]);
+    append_int(channels, is_half() ? EXR_PIXEL_HALF : EXR_PIXEL_FLOAT);
+    // pLinear and reserved
+    append_bytes(channels, RESERVED, sizeof(RESERVED));
+    // x and y sampling
+    append_int(channels, 1);
+    append_int(channels, 1);
+  }
+  channels.push_back('\0');
+
+  const float ONE = 1;
+  const float ZERO[2] = {0, 0};
+  std::vector<char> tiles;
+  append_int(tiles, tiler_->xtile_size_);
+  append_int(tiles, tiler_->ytile_size_);
+  tiles.push_back(EXR_ONE_LEVEL);
+
+  std::vector<char> header;
+  append_int(header, EXR_MAGIC);
+  append_int(header, EXR_VERSION);
+  append_attribute(header, "channels", "chlist", channels);
+  append_attribute(header, "compression", "compression",
+      std::vector<char>(1, EXR_RLE_COMPRESSION));
+  append_attribute(header, "dataWindow", "box2i",
+      make_box2i(0, 0, tiler_->xres_ - 1, tiler_->yres_ - 1));
+  append_attribute(header, "displayWindow", "box2i",
+      make_box2i(0, 0, tiler_->xres_ - 1, tiler_->yres_ - 1));
+  append_attribute(header, "lineOrder", "lineOrder", std::vector<char>(1, EXR_RANDOM_Y));
+  append_attribute(header, "pixelAspectRatio", "float",
+      std::vector<char>(reinterpret_cast<const char *>(&ONE),
+          reinterpret_cast<const char *>(&ONE) + sizeof(ONE)));
+  append_attribute(header, "screenWindowCenter", "v2f",
+      std::vector<char>(reinterpret_cast<const char *>(ZERO),
+          reinterpret_cast<const char *>(ZERO) + sizeof(ZERO)));
+  append_attribute(header, "screenWindowWidth", "float",
+      std::vector<char>(reinterpret_cast<const char *>(&ONE),
+          reinterpret_cast<const char *>(&ONE) + sizeof(ONE)));
+  append_attribute(header, "tiles", "tiledesc", tiles);
+  header.push_back('\0');
+
+  file_ = fopen(filename.c_str(), "wb");
+  if (file_ == NULL) {
+    return -1;
+  }
+
+  // the table is filled when the file is finished
+  table_offset_ = header.size();
+  header.resize(header.size() + sizeof(uint64_t) * tile_offsets_.size(), '\0');
+  end_offset_ = header.size();
+
+  if (fwrite(&header[0], 1, header.size(), file_) != header.size()) {
+    fclose(file_);
+    file_ = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+bool ExrOutput::IsEnabled() const
+{
+  return file_ != NULL;
+}
+
+void ExrOutput::TileDone(int tile_id)
+{
+  if (!IsEnabled()) {
+    return;
+  }
+
+  const Tile *tile = tiler_->GetTile(tile_id);
+  if (tile == NULL) {
+    return;
+  }
+  write_tile(tile->xmin / tiler_->xtile_size_, tile->ymin / tiler_->ytile_size_);
+}
+
+int ExrOutput::Finish()
+{
+  if (!IsEnabled()) {
+    return 0;
+  }
+
+  // e.g. tiles outside the render region or of a cancelled render
+  for (int y = 0; y < yntiles_; y++) {
+    for (int x = 0; x < xntiles_; x++) {
+      write_tile(x, y);
+    }
+  }
+
+  if (fseek(file_, static_cast<long>(table_offset_), SEEK_SET) != 0 ||
+      fwrite(&tile_offsets_[0], sizeof(uint64_t), tile_offsets_.size(), file_) !=
+          tile_offsets_.size()) {
+    has_error_ = true;
+  }
+
+  if (fclose(file_) != 0) {
+    has_error_ = true;
+  }
+  file_ = NULL;
+
+  if (has_error_) {
+    std::cerr << "* WARNING: could not write EXR file\n";
+    return -1;
+  }
+  return 0;
+}
+
+int ExrOutput::write_tile(int xtile, int ytile)
+{
+  const int tile_index = ytile * xntiles_ + xtile;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tile_offsets_[tile_index] != 0) {
+      return 0;
+    }
+  }
+
+  // encoding is done by the calling thread without the lock
+  std::vector<char> chunk;
+  encode_tile(xtile, ytile, chunk);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (tile_offsets_[tile_index] != 0) {
+    return 0;
+  }
+  if (fwrite(&chunk[0], 1, chunk.size(), file_) != chunk.size()) {
+    has_error_ = true;
+    return -1;
+  }
+  tile_offsets_[tile_index] = end_offset_;
+  end_offset_ += chunk.size();
+
+  return 0;
+}
+
+bool ExrOutput::is_half() const
+{
+  return framebuffer_->GetFormat() == FB_FORMAT_HALF;
+}
+
+void ExrOutput::encode_tile(int xtile, int ytile, std::vector<char> &chunk) const
+{
+  const int XMIN = xtile * tiler_->xtile_size_;
+  const int YMIN = ytile * tiler_->ytile_size_;
+  const int XMAX = std::min(XMIN + tiler_->xtile_size_, tiler_->xres_);
+  const int YMAX = std::min(YMIN + tiler_->ytile_size_, tiler_->yres_);
+  const int NCHANNELS = static_cast<int>(channel_order_.size());
+
+  // lines of the tile, each line has the pixels of a channel one after another
+  std::vector<char> raw;
+  const bool HALF = is_half();
+  raw.reserve((HALF ? 2 : 4) * (XMAX - XMIN) * (YMAX - YMIN) * NCHANNELS);
+  for (int y = YMIN; y < YMAX; y++) {
+    for (int i = 0; i < NCHANNELS; i++) {
+      const int ch = channel_order_[i];
+      for (int x = XMIN; x < XMAX; x++) {
+        const float value = framebuffer_->GetValue(x, y, ch);
+        if (HALF) {
+          const uint16_t half = FloatToHalf(value);
+          append_bytes(raw, &half, sizeof(half));
+        } else {
+          append_bytes(raw, &value, sizeof(value));
+        }
+      }
+    }
+  }
+
+  std::vector<char> compressed;
+  RleCompress(raw, compressed);
+
+  // readers take data as it is when it is not smaller than raw data
+  const std::vector<char> &data = compressed.size() < raw.size() ? compressed : raw;
+
+  chunk.clear();
+  append_int(chunk, xtile);
+  append_int(chunk, ytile);
+  // level x and y
+  append_int(chunk, 0);
+  append_int(chunk, 0);
+  append_int(chunk, static_cast<int32_t>(data.size()));
+  chunk.insert(chunk.end(), data.begin(), data.end());
+}
+
+} // namespace xxx
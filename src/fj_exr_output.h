@@ -0,0 +1,72 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_EXR_OUTPUT_H
+#define FJ_EXR_OUTPUT_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+
+namespace fj {
+
+class FrameBuffer;
+class Tiler;
+
+// Writes a tiled OpenEXR file while rendering. Each tile is compressed and
+// appended as soon as it is done so the image is never encoded as a whole.
+// Tiles of the file are the tiles of the tiler in the full resolution.
+// Pixels are 32-bit float, or half for half framebuffers, and RLE
+// compressed. All channels of the framebuffer go into the file e.g. for AOVs.
+class ExrOutput {
+public:
+  ExrOutput();
+  // Finishes if started
+  ~ExrOutput();
+
+  // Writes the header and makes room for the offset table. channel names
+  // are in the order of framebuffer channels.
+  int Start(const std::string &filename, const std::vector<std::string> &channel_names,
+      const Tiler *tiler, const FrameBuffer *framebuffer);
+  bool IsEnabled() const;
+
+  // Thread safe. Pixels of the tile must not change after this. Tiles done
+  // again e.g. by farm workers are written only once. ids the tiler
+  // doesn't have are ignored.
+  void TileDone(int tile_id);
+  // Writes the tiles not done yet as they are in the framebuffer, then the
+  // offset table.
+  int Finish();
+
+private:
+  int write_tile(int xtile, int ytile);
+  void encode_tile(int xtile, int ytile, std::vector<char> &chunk) const;
+  // channels of the file are half floats
+  bool is_half() const;
+
+  FILE *file_;
+  const Tiler *tiler_;
+  const FrameBuffer *framebuffer_;
+  // channel indices of the framebuffer sorted by name as EXR requires
+  std::vector<int> channel_order_;
+
+  int xntiles_;
+  int yntiles_;
+  uint64_t table_offset_;
+  // of the next tile
+  uint64_t end_offset_;
+
+  std::mutex mutex_;
+  std::vector<uint64_t> tile_offsets_;
+  bool has_error_;
+};
+
+// Splits names separated by commas. returns the default names for the
+// channel count e.g. R,G,B,A when names are empty or the count differs.
+extern std::vector<std::string> ExrChannelNames(const std::string &names, int nchannels);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -2,19 +2,32 @@
 // See LICENSE and README
 
 #include "fj_filter.h"
+#include "fj_numeric.h"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
 namespace fj {
 
-static Real eval_gaussian(Real xwidth, Real ywidth, Real x, Real y);
-static Real eval_box(Real xwidth, Real ywidth, Real x, Real y);
+// entries per unit distance. linear interpolation keeps errors under 1e-4
+static const int TABLE_RESOLUTION = 256;
+// steps of the integral of the kernel within the radius
+static const int CDF_RESOLUTION = 256;
+
+static Real kernel_gaussian(Real width, Real t);
+static Real kernel_box(Real width, Real t);
+static Real kernel_mitchell(Real width, Real t);
+static Real kernel_blackman_harris(Real width, Real t);
 
 Filter::Filter() :
     xwidth_(1),
     ywidth_(1),
-    evaluate_(eval_box)
+    kernel_(kernel_box),
+    xtable_(),
+    ytable_()
 {
+  xtable_.Build(kernel_, xwidth_);
+  ytable_.Build(kernel_, ywidth_);
 }
 
 Filter::~Filter()
@@ -28,10 +41,16 @@ void Filter::SetFilterType(int filtertype, Real xwidth, Real ywidth)
 
   switch (filtertype) {
   case FLT_GAUSSIAN:
-    evaluate_ = eval_gaussian;
+    kernel_ = kernel_gaussian;
     break;
   case FLT_BOX:
-    evaluate_ = eval_box;
+    kernel_ = kernel_box;
+    break;
+  case FLT_MITCHELL:
+    kernel_ = kernel_mitchell;
+    break;
+  case FLT_BLACKMAN_HARRIS:
+    kernel_ = kernel_blackman_harris;
     break;
   default:
     assert(!"invalid filter type");
@@ -39,27 +58,125 @@ void Filter::SetFilterType(int filtertype, Real xwidth, Real ywidth)
   }
   xwidth_ = xwidth;
   ywidth_ = ywidth;
+
+  xtable_.Build(kernel_, xwidth_);
+  ytable_.Build(kernel_, ywidth_);
 }
 
-Real Filter::Evaluate(Real x, Real y) const
+Real Filter::GetXRadius() const
 {
-  return evaluate_(xwidth_, ywidth_, x, y);
+  return .5 * xwidth_;
 }
 
-static Real eval_gaussian(Real xwidth, Real ywidth, Real x, Real y)
+Real Filter::GetYRadius() const
+{
+  return .5 * ywidth_;
+}
+
+void Filter::Table::Build(Real (*kernel)(Real width, Real t), Real w)
+{
+  // samplers put samples up to about a pixel beyond the radius
+  width = w;
+  range = .5 * w + 1;
+  scale = TABLE_RESOLUTION;
+
+  const int N = static_cast<int>(Ceil(range * scale)) + 2;
+  values.resize(N);
+  for (int i = 0; i < N; i++) {
+    values[i] = kernel(width, i / scale);
+  }
+
+  // trapezoids of the absolute kernel
+  const Real step = .5 * w / CDF_RESOLUTION;
+  cdf.resize(CDF_RESOLUTION + 1);
+  cdf[0] = 0;
+  Real signed_total = 0;
+  for (int i = 1; i <= CDF_RESOLUTION; i++) {
+    const Real k0 = kernel(width, (i - 1) * step);
+    const Real k1 = kernel(width, i * step);
+    cdf[i] = cdf[i - 1] + .5 * (Abs(k0) + Abs(k1)) * step;
+    signed_total += .5 * (k0 + k1) * step;
+  }
+  const Real total = cdf[CDF_RESOLUTION];
+  abs_ratio = signed_total > 0 ? total / signed_total : 1;
+  for (int i = 1; i <= CDF_RESOLUTION; i++) {
+    cdf[i] = total > 0 ? cdf[i] / total : static_cast<Real>(i) / CDF_RESOLUTION;
+  }
+}
+
+Real Filter::Table::Sample(Real (*kernel)(Real width, Real t), Real u, Real *sign) const
+{
+  // [0, .5) goes to the negative side and [.5, 1) to the positive side
+  const Real side = u < .5 ? -1 : 1;
+  const Real t = Min(Abs(2 * u - 1), 1);
+
+  const std::vector<Real>::const_iterator it =
+      std::upper_bound(cdf.begin() + 1, cdf.end() - 1, t);
+  const int i = static_cast<int>(it - cdf.begin());
+  const Real c0 = cdf[i - 1];
+  const Real c1 = cdf[i];
+  const Real frac = c1 > c0 ? (t - c0) / (c1 - c0) : 0;
+  const Real x = (i - 1 + frac) * .5 * width / CDF_RESOLUTION;
+
+  *sign = kernel(width, x) < 0 ? -1 : 1;
+  return side * x;
+}
+
+static Real kernel_gaussian(Real width, Real t)
 {
   // The RenderMan Interface
   // Version 3.2.1
   // November, 2005
-  const Real xx = 2 * x / xwidth;
-  const Real yy = 2 * y / ywidth;
+  const Real tt = 2 * t / width;
 
-  return exp(-2 * ( xx * xx + yy * yy ));
+  return Exp(-2 * tt * tt);
 }
 
-static Real eval_box(Real xwidth, Real ywidth, Real x, Real y)
+static Real kernel_box(Real width, Real t)
 {
   return 1;
 }
 
+static Real kernel_mitchell(Real width, Real t)
+{
+  // Mitchell and Netravali 1988. B = C = 1/3
+  const Real B = 1./3;
+  const Real C = 1./3;
+  const Real x = Abs(4 * t / width);
+
+  if (x < 1) {
+    return ((12 - 9 * B - 6 * C) * x * x * x +
+        (-18 + 12 * B + 6 * C) * x * x +
+        (6 - 2 * B)) / 6;
+  }
+  else if (x < 2) {
+    return ((-B - 6 * C) * x * x * x +
+        (6 * B + 30 * C) * x * x +
+        (-12 * B - 48 * C) * x +
+        (8 * B + 24 * C)) / 6;
+  }
+  else {
+    return 0;
+  }
+}
+
+static Real kernel_blackman_harris(Real width, Real t)
+{
+  // 4-term Blackman-Harris window
+  const Real x = t / width + .5;
+  if (x < 0 || x > 1) {
+    return 0;
+  }
+
+  const Real a0 = .35875;
+  const Real a1 = .48829;
+  const Real a2 = .14128;
+  const Real a3 = .01168;
+
+  return a0 -
+      a1 * Cos(2 * PI * x) +
+      a2 * Cos(4 * PI * x) -
+      a3 * Cos(6 * PI * x);
+}
+
 } // namespace xxx
@@ -5,25 +5,80 @@
 #define FJ_FILTER_H
 
 #include "fj_types.h"
+#include <vector>
+#include <cmath>
 
 namespace fj {
 
 enum {
   FLT_BOX = 0,
-  FLT_GAUSSIAN
+  FLT_GAUSSIAN,
+  FLT_MITCHELL,
+  FLT_BLACKMAN_HARRIS
 };
 
+// All filters are separable. Evaluate looks up tables of the x and y
+// kernels and computes the kernels directly only far outside the widths.
 class Filter {
 public:
   Filter();
   ~Filter();
 
   void SetFilterType(int filtertype, Real xwidth, Real ywidth);
-  Real Evaluate(Real x, Real y) const;
+  Real Evaluate(Real x, Real y) const { return EvaluateX(x) * EvaluateY(y); }
+
+  // half widths. samples farther than these have no or little weight
+  Real GetXRadius() const;
+  Real GetYRadius() const;
+
+  // kernels in each axis. Evaluate(x, y) == EvaluateX(x) * EvaluateY(y)
+  Real EvaluateX(Real x) const { return xtable_.Lookup(kernel_, x); }
+  Real EvaluateY(Real y) const { return ytable_.Lookup(kernel_, y); }
+
+  // offsets from the pixel center distributed as the absolute kernel within
+  // the radius for u in [0, 1). increasing with u so strata of u are kept.
+  // sign is -1 where the kernel is negative and 1 elsewhere
+  Real SampleX(Real u, Real *sign) const { return xtable_.Sample(kernel_, u, sign); }
+  Real SampleY(Real u, Real *sign) const { return ytable_.Sample(kernel_, u, sign); }
+  // the integral of the absolute kernel over that of the kernel within the
+  // radius. the signs of samples drawn by SampleX and SampleY times this
+  // average to the filtered value over the sample count
+  Real GetImportanceScale() const { return xtable_.abs_ratio * ytable_.abs_ratio; }
 
 private:
+  class Table {
+  public:
+    Table() : width(1), range(0), scale(0), abs_ratio(1), values(), cdf() {}
+    ~Table() {}
+
+    void Build(Real (*kernel)(Real width, Real t), Real w);
+    Real Lookup(Real (*kernel)(Real width, Real t), Real t) const
+    {
+      const Real abs_t = std::fabs(t);
+      if (abs_t >= range) {
+        return kernel(width, abs_t);
+      }
+
+      const Real pos = abs_t * scale;
+      const int i = static_cast<int>(pos);
+      const Real frac = pos - i;
+      return values[i] + frac * (values[i + 1] - values[i]);
+    }
+    Real Sample(Real (*kernel)(Real width, Real t), Real u, Real *sign) const;
+
+    Real width;
+    Real range;
+    Real scale;
+    // integral of the absolute kernel over that of the kernel
+    Real abs_ratio;
+    std::vector<Real> values;
+    // integral of the absolute kernel from 0 to the radius. ends with 1
+    std::vector<Real> cdf;
+  };
+
   Real xwidth_, ywidth_;
-  Real (*evaluate_)(Real xwidth, Real ywidth, Real x, Real y);
+  Real (*kernel_)(Real width, Real t);
+  Table xtable_, ytable_;
 };
 
 } // namespace xxx
@@ -3,13 +3,39 @@
 
 #include "fj_fixed_grid_sampler.h"
 #include "fj_rectangle.h"
+#include "fj_filter.h"
 #include "fj_numeric.h"
-#include "fj_random.h"
+#include <cstdint>
 
 namespace fj {
 
+static int floor_div(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// a random number in [0, 1) of the sample at the grid position. samples
+// in margins get the same numbers as the same samples of neighbor tiles
+static double grid_random(const Int2 &grid_pos, int seed, int dimension)
+{
+  uint32_t h =
+    static_cast<uint32_t>(grid_pos[0]) * 73856093U ^
+    static_cast<uint32_t>(grid_pos[1]) * 19349663U ^
+    static_cast<uint32_t>(4 * seed + dimension) * 83492791U;
+
+  // finalizer of MurmurHash3
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+
+  return h * (1. / 4294967296.);
+}
+
 FixedGridSampler::FixedGridSampler() :
   samples_(),
+  sample_count_(0),
 
   nsamples_(1, 1),
   pixel_start_(0, 0),
@@ -34,17 +60,19 @@ int FixedGridSampler::generate_samples(const Rectangle &region)
 {
   // allocate samples in region
   nsamples_ = count_samples_in_region(region);
-  samples_.resize(nsamples_[0] * nsamples_[1]);
+  sample_count_ = nsamples_[0] * nsamples_[1];
+  if (static_cast<int>(samples_.size()) < sample_count_) {
+    samples_.resize(sample_count_);
+  }
   pixel_start_ = region.min;
   current_index_ = 0;
 
-  XorShift rng; // random number generator
-  XorShift rng_time; // for time sampling jitter
+  const int seed = GetSampleSeed();
 
   const Int2 rate = GetPixelSamples();
   const Int2 res  = GetResolution();
   const Real jitter = GetJitter();
-  const Vector2 sample_time_range = GetSampleTimeRange();
+  const Filter *filter = GetImportanceFilter();
 
   // uv delta (screen space uv. excludes margins)
   const Real udelta = 1./(rate[0] * res[0]);
@@ -58,25 +86,46 @@ int FixedGridSampler::generate_samples(const Rectangle &region)
 
   for (int y = 0; y < nsamples_[1]; y++) {
     for (int x = 0; x < nsamples_[0]; x++) {
-      sample->uv.x =     (.5 + x + xoffset) * udelta;
-      sample->uv.y = 1 - (.5 + y + yoffset) * vdelta;
-
-      if (IsJittered()) {
-        const Real u_jitter = rng.NextFloat01() * jitter;
-        const Real v_jitter = rng.NextFloat01() * jitter;
-
-        sample->uv.x += udelta * (u_jitter - .5);
-        sample->uv.y += vdelta * (v_jitter - .5);
+      const Int2 grid_pos(x + xoffset, y + yoffset);
+
+      // samples in margins belong to pixels of neighbor tiles
+      const Int2 pixel_pos(floor_div(grid_pos[0], rate[0]), floor_div(grid_pos[1], rate[1]));
+      const Int2 sub_pos = grid_pos - pixel_pos * rate;
+      const int sub_index = sub_pos[1] * rate[0] + sub_pos[0];
+      SetSequence(*sample, pixel_pos, sub_index, rate[0] * rate[1]);
+
+      const Real u_jitter = IsJittered() ? grid_random(grid_pos, seed, 0) * jitter : .5;
+      const Real v_jitter = IsJittered() ? grid_random(grid_pos, seed, 1) * jitter : .5;
+
+      if (filter != NULL) {
+        // strata of the pixel are mapped around its center by the filter
+        Real xsign = 1, ysign = 1;
+        const Real xfilt = filter->SampleX((sub_pos[0] + u_jitter) / rate[0], &xsign);
+        const Real yfilt = filter->SampleY((sub_pos[1] + v_jitter) / rate[1], &ysign);
+        sample->uv.x =     (pixel_pos[0] + .5 + xfilt) / res[0];
+        sample->uv.y = 1 - (pixel_pos[1] + .5 + yfilt) / res[1];
+        sample->weight = xsign * ysign * filter->GetImportanceScale();
+      } else {
+        sample->uv.x =     (.5 + x + xoffset) * udelta;
+        sample->uv.y = 1 - (.5 + y + yoffset) * vdelta;
+
+        if (IsJittered()) {
+          sample->uv.x += udelta * (u_jitter - .5);
+          sample->uv.y += vdelta * (v_jitter - .5);
+        }
+        sample->weight = 1;
       }
 
       if (IsSamplingTime()) {
-        const Real rnd = rng_time.NextFloat01();
-        sample->time = Fit(rnd, 0, 1, sample_time_range[0], sample_time_range[1]);
+        const Real rnd = grid_random(grid_pos, seed, 2);
+        sample->time = ComputeSampleTime(pixel_pos, sub_index, rate[0] * rate[1], rnd);
       } else {
         sample->time = 0;
       }
 
       sample->data = Vector4();
+      sample->aov_index = -1;
+      sample->shared = false;
       sample++;
     }
   }
@@ -123,13 +172,35 @@ void FixedGridSampler::get_sampleset_in_pixel(std::vector<Sample> &pixelsamples,
   }
 }
 
+const Sample *FixedGridSampler::get_samples(int *sample_count) const
+{
+  *sample_count = sample_count_;
+  return sample_count_ == 0 ? NULL : &samples_[0];
+}
+
+const Sample *FixedGridSampler::get_sample_grid(Int2 *origin, Int2 *size) const
+{
+  *origin = pixel_start_ * GetPixelSamples() - margin_;
+  *size = nsamples_;
+  return sample_count_ == 0 ? NULL : &samples_[0];
+}
+
+Int2 FixedGridSampler::get_sample_margin() const
+{
+  return margin_;
+}
+
 int FixedGridSampler::get_sample_count() const
 {
-  return samples_.size();
+  return sample_count_;
 }
 
 Int2 FixedGridSampler::count_samples_in_margin() const
 {
+  // samples drawn from the filter are only of their pixels
+  if (GetImportanceFilter() != NULL) {
+    return Int2(0, 0);
+  }
   return Int2(
       static_cast<int>(Ceil(((GetFilterWidth()[0] - 1) * GetPixelSamples()[0]) * .5)),
       static_cast<int>(Ceil(((GetFilterWidth()[1] - 1) * GetPixelSamples()[1]) * .5)));
@@ -19,13 +19,18 @@ private:
   virtual Sample *get_next_sample();
   virtual void get_sampleset_in_pixel(std::vector<Sample> &pixelsamples,
       const Int2 &pixel_pos) const;
+  virtual const Sample *get_samples(int *sample_count) const;
+  virtual const Sample *get_sample_grid(Int2 *origin, Int2 *size) const;
+  virtual Int2 get_sample_margin() const;
 
   int get_sample_count() const;
   Int2 count_samples_in_region(const Rectangle &region) const;
   Int2 count_samples_in_pixel() const;
   Int2 count_samples_in_margin() const;
 
+  // only grows so that tiles of the same size reuse it
   std::vector<Sample> samples_;
+  int sample_count_;
 
   Int2 nsamples_;
   Int2 pixel_start_;
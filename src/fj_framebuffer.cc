@@ -2,18 +2,76 @@
 // See LICENSE and README
 
 #include "fj_framebuffer.h"
+#include "fj_multi_thread.h"
 #include "fj_color.h"
+#include "fj_compression.h"
+#include "fj_os.h"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <cstdio>
 
 namespace fj {
 
+// rows are downsampled by tasks of this many rows
+static const int ROWS_PER_TASK = 16;
+
+class Downsampler {
+public:
+  Downsampler() : src(NULL), dst(NULL) {}
+  ~Downsampler() {}
+
+public:
+  const FrameBuffer *src;
+  FrameBuffer *dst;
+};
+
+static LoopStatus downsample_rows_task(void *data, const ThreadContext &context);
+
 FrameBuffer::FrameBuffer() :
-    buf_(), width_(0), height_(0), nchannels_(0)
+    buf_(), data_(NULL), mapped_size_(0), mapped_file_(),
+    width_(0), height_(0), nchannels_(0), format_(FB_FORMAT_FLOAT),
+    tile_width_(0), tile_height_(0), xtile_count_(0),
+    next_tile_width_(0), next_tile_height_(0), next_format_(FB_FORMAT_FLOAT),
+    backing_file_()
 {
 }
 
+FrameBuffer::FrameBuffer(const FrameBuffer &other) :
+    buf_(), data_(NULL), mapped_size_(0), mapped_file_(),
+    width_(0), height_(0), nchannels_(0), format_(FB_FORMAT_FLOAT),
+    tile_width_(0), tile_height_(0), xtile_count_(0),
+    next_tile_width_(0), next_tile_height_(0), next_format_(FB_FORMAT_FLOAT),
+    backing_file_()
+{
+  *this = other;
+}
+
 FrameBuffer::~FrameBuffer()
 {
+  release_storage();
+}
+
+FrameBuffer &FrameBuffer::operator=(const FrameBuffer &other)
+{
+  if (this == &other) {
+    return *this;
+  }
+
+  const std::string backing_file = backing_file_;
+  backing_file_ = "";
+  release_storage();
+  if (!other.IsEmpty()) {
+    SetTileLayout(other.tile_width_, other.tile_height_);
+    SetFormat(other.format_);
+    Resize(other.width_, other.height_, other.nchannels_);
+    memcpy(data_, other.data_, get_storage_size());
+  }
+
+  SetTileLayout(other.next_tile_width_, other.next_tile_height_);
+  SetFormat(other.next_format_);
+  backing_file_ = backing_file;
+  return *this;
 }
 
 int FrameBuffer::GetWidth() const
@@ -31,9 +89,9 @@ int FrameBuffer::GetChannelCount() const
   return nchannels_;
 }
 
-int FrameBuffer::GetSize() const
+std::size_t FrameBuffer::GetSize() const
 {
-  return GetWidth() * GetHeight() * GetChannelCount();
+  return static_cast<std::size_t>(GetWidth()) * GetHeight() * GetChannelCount();
 }
 
 void FrameBuffer::Resize(int width, int height, int nchannels)
@@ -42,53 +100,295 @@ void FrameBuffer::Resize(int width, int height, int nchannels)
   assert(height >= 0);
   assert(nchannels >= 0);
 
-  const int total_alloc = width * height * nchannels;
-  // check overflow
-  if (total_alloc < 0) {
+  const bool tiled = next_tile_width_ > 0 && next_tile_height_ > 0;
+  const int tile_w = tiled ? next_tile_width_ : 0;
+  const int tile_h = tiled ? next_tile_height_ : 0;
+  const int xtiles = tiled ? (width + tile_w - 1) / tile_w : 0;
+  const int ytiles = tiled ? (height + tile_h - 1) / tile_h : 0;
+  const std::size_t total_alloc = value_size(next_format_) * (tiled ?
+      static_cast<std::size_t>(xtiles) * ytiles * tile_w * tile_h * nchannels :
+      static_cast<std::size_t>(width) * height * nchannels);
+  if (total_alloc == 0) {
     return;
   }
 
-  std::vector<float> buftmp(total_alloc);
-  if (buftmp.empty()) {
-    return;
+  std::vector<char> buftmp;
+  char *data = NULL;
+  std::size_t mapped_size = 0;
+
+  if (backing_file_.empty()) {
+    buftmp.resize(total_alloc);
+    data = &buftmp[0];
+  } else {
+    // the old file is removed first when it has the same name
+    release_storage();
+    mapped_size = total_alloc;
+    data = static_cast<char *>(OsMapWritableFile(backing_file_.c_str(), mapped_size));
+    if (data == NULL) {
+      return;
+    }
   }
 
   // commit
+  release_storage();
   buf_.swap(buftmp);
+  data_ = data;
+  mapped_size_ = mapped_size;
+  mapped_file_ = backing_file_;
   width_     = width;
   height_    = height;
   nchannels_ = nchannels;
+  format_    = next_format_;
+  tile_width_  = tile_w;
+  tile_height_ = tile_h;
+  xtile_count_ = xtiles;
 }
 
 bool FrameBuffer::IsEmpty() const
 {
-  return buf_.empty();
+  return data_ == NULL;
+}
+
+std::size_t FrameBuffer::GetMemoryUsage() const
+{
+  if (!IsFileBacked()) {
+    return buf_.capacity();
+  }
+
+  std::size_t resident = 0;
+  if (OsGetResidentSize(data_, mapped_size_, &resident)) {
+    return mapped_size_;
+  }
+  return resident;
+}
+
+void FrameBuffer::Swap(FrameBuffer &other)
+{
+  buf_.swap(other.buf_);
+  std::swap(data_, other.data_);
+  std::swap(mapped_size_, other.mapped_size_);
+  mapped_file_.swap(other.mapped_file_);
+  std::swap(width_, other.width_);
+  std::swap(height_, other.height_);
+  std::swap(nchannels_, other.nchannels_);
+  std::swap(format_, other.format_);
+  std::swap(tile_width_, other.tile_width_);
+  std::swap(tile_height_, other.tile_height_);
+  std::swap(xtile_count_, other.xtile_count_);
+}
+
+void FrameBuffer::SetFormat(int format)
+{
+  assert(format == FB_FORMAT_FLOAT || format == FB_FORMAT_HALF);
+  next_format_ = format;
+}
+
+int FrameBuffer::GetFormat() const
+{
+  return format_;
+}
+
+void FrameBuffer::SetTileLayout(int tile_width, int tile_height)
+{
+  assert(tile_width >= 0);
+  assert(tile_height >= 0);
+  next_tile_width_ = tile_width;
+  next_tile_height_ = tile_height;
+}
+
+bool FrameBuffer::IsTiled() const
+{
+  return tile_width_ > 0;
+}
+
+int FrameBuffer::GetTileWidth() const
+{
+  return tile_width_;
+}
+
+int FrameBuffer::GetTileHeight() const
+{
+  return tile_height_;
+}
+
+void FrameBuffer::SetBackingFile(const std::string &filename)
+{
+  backing_file_ = filename;
+}
+
+bool FrameBuffer::IsFileBacked() const
+{
+  return mapped_size_ > 0;
+}
+
+int FrameBuffer::EvictRegion(int xmin, int ymin, int xmax, int ymax) const
+{
+  if (!IsFileBacked()) {
+    return 0;
+  }
+
+  xmin = std::max(xmin, 0);
+  ymin = std::max(ymin, 0);
+  xmax = std::min(xmax, GetWidth());
+  ymax = std::min(ymax, GetHeight());
+  if (xmin >= xmax || ymin >= ymax) {
+    return 0;
+  }
+
+  // byte ranges of the storage covered by the region. tiles or rows
+  std::vector<std::pair<std::size_t, std::size_t>> ranges;
+  const std::size_t PIXEL_SIZE = value_size(format_) * nchannels_;
+  if (IsTiled()) {
+    const std::size_t TILE_SIZE = PIXEL_SIZE * tile_width_ * tile_height_;
+    for (int ty = ymin / tile_height_; ty <= (ymax - 1) / tile_height_; ty++) {
+      for (int tx = xmin / tile_width_; tx <= (xmax - 1) / tile_width_; tx++) {
+        // tiles on the right and bottom edges end at the image
+        const int x0 = tx * tile_width_;
+        const int y0 = ty * tile_height_;
+        const int x1 = std::min(x0 + tile_width_, GetWidth());
+        const int y1 = std::min(y0 + tile_height_, GetHeight());
+        if (x0 < xmin || y0 < ymin || x1 > xmax || y1 > ymax) {
+          continue;
+        }
+        const std::size_t begin = TILE_SIZE * (static_cast<std::size_t>(ty) * xtile_count_ + tx);
+        ranges.push_back(std::make_pair(begin, begin + TILE_SIZE));
+      }
+    }
+  } else {
+    for (int y = ymin; y < ymax; y++) {
+      const std::size_t begin = value_size(format_) * get_index(xmin, y, 0);
+      ranges.push_back(std::make_pair(begin, begin + PIXEL_SIZE * (xmax - xmin)));
+    }
+  }
+
+  const std::size_t PAGE_SIZE = OsGetPageSize();
+  char *bytes = data_;
+  int err = 0;
+
+  for (std::size_t i = 0; i < ranges.size(); i++) {
+    // adjacent ranges are evicted at once
+    std::size_t begin = ranges[i].first;
+    std::size_t end = ranges[i].second;
+    while (i + 1 < ranges.size() && ranges[i + 1].first == end) {
+      end = ranges[++i].second;
+    }
+
+    // pages shared with pixels out of the region stay
+    begin = (begin + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    end = end / PAGE_SIZE * PAGE_SIZE;
+    if (begin >= end) {
+      continue;
+    }
+    if (OsFlushMappedPages(bytes + begin, end - begin) ||
+        OsEvictMappedPages(bytes + begin, end - begin)) {
+      err = -1;
+    }
+  }
+
+  return err;
 }
 
 float *FrameBuffer::GetWritable(int x, int y, int z)
 {
-  if (!is_inside(x, y, z)) {
+  if (!is_inside(x, y, z) || format_ != FB_FORMAT_FLOAT) {
     return NULL;
   }
-  return &buf_[get_index(x, y, z)];
+  return reinterpret_cast<float *>(data_) + get_index(x, y, z);
 }
 
 const float *FrameBuffer::GetReadOnly(int x, int y, int z) const
 {
-  if (!is_inside(x, y, z)) {
+  if (!is_inside(x, y, z) || format_ != FB_FORMAT_FLOAT) {
     return NULL;
   }
-  return &buf_[get_index(x, y, z)];
+  return reinterpret_cast<const float *>(data_) + get_index(x, y, z);
+}
+
+float FrameBuffer::GetValue(int x, int y, int z) const
+{
+  if (!is_inside(x, y, z)) {
+    return 0;
+  }
+  return load_value(get_index(x, y, z));
+}
+
+void FrameBuffer::SetValue(int x, int y, int z, float value)
+{
+  if (!is_inside(x, y, z)) {
+    return;
+  }
+  store_value(get_index(x, y, z), value);
+}
+
+void FrameBuffer::ReadRow(int x, int y, int count, float *dst) const
+{
+  if (y < 0 || y >= GetHeight()) {
+    return;
+  }
+
+  const int xmin = std::max(x, 0);
+  const int xmax = std::min(x + count, GetWidth());
+  dst += static_cast<std::size_t>(xmin - x) * nchannels_;
+
+  // runs of contiguous pixels
+  for (int i = xmin; i < xmax; ) {
+    const int run_end = IsTiled() ?
+        std::min(xmax, (i / tile_width_ + 1) * tile_width_) : xmax;
+    const std::size_t N = static_cast<std::size_t>(run_end - i) * nchannels_;
+    const std::size_t index = get_index(i, y, 0);
+    if (format_ == FB_FORMAT_FLOAT) {
+      memcpy(dst, data_ + sizeof(float) * index, sizeof(float) * N);
+    } else {
+      for (std::size_t j = 0; j < N; j++) {
+        dst[j] = load_value(index + j);
+      }
+    }
+    dst += N;
+    i = run_end;
+  }
+}
+
+void FrameBuffer::WriteRow(int x, int y, int count, const float *src)
+{
+  if (y < 0 || y >= GetHeight()) {
+    return;
+  }
+
+  const int xmin = std::max(x, 0);
+  const int xmax = std::min(x + count, GetWidth());
+  src += static_cast<std::size_t>(xmin - x) * nchannels_;
+
+  for (int i = xmin; i < xmax; ) {
+    const int run_end = IsTiled() ?
+        std::min(xmax, (i / tile_width_ + 1) * tile_width_) : xmax;
+    const std::size_t N = static_cast<std::size_t>(run_end - i) * nchannels_;
+    const std::size_t index = get_index(i, y, 0);
+    if (format_ == FB_FORMAT_FLOAT) {
+      memcpy(data_ + sizeof(float) * index, src, sizeof(float) * N);
+    } else {
+      for (std::size_t j = 0; j < N; j++) {
+        store_value(index + j, src[j]);
+      }
+    }
+    src += N;
+    i = run_end;
+  }
 }
 
 Color4 FrameBuffer::GetColor(int x, int y) const
 {
-  const float *pixel = GetReadOnly(x, y, 0);
-  if (pixel == NULL) {
+  if (!is_inside(x, y, 0)) {
     return Color4();
   }
 
-  switch (GetChannelCount()) {
+  float pixel[4] = {0, 0, 0, 0};
+  const std::size_t index = get_index(x, y, 0);
+  for (int i = 0; i < std::min(GetChannelCount(), 4); i++) {
+    pixel[i] = load_value(index + i);
+  }
+
+  // channels after rgba are of arbitrary output variables
+  switch (std::min(GetChannelCount(), 4)) {
   case 1:
     return Color4(pixel[0], pixel[0], pixel[0], 1);
   case 3:
@@ -102,34 +402,42 @@ Color4 FrameBuffer::GetColor(int x, int y) const
 
 void FrameBuffer::SetColor(int x, int y, const Color4 &rgba)
 {
-  float *pixel = GetWritable(x, y, 0);
-  if (pixel == NULL) {
+  if (!is_inside(x, y, 0)) {
     return;
   }
-  
-  switch (GetChannelCount()) {
+
+  const std::size_t index = get_index(x, y, 0);
+  switch (std::min(GetChannelCount(), 4)) {
   case 1:
-    pixel[0] = rgba[0];
+    store_value(index, rgba[0]);
     break;
   case 3:
-    pixel[0] = rgba[0];
-    pixel[1] = rgba[1];
-    pixel[2] = rgba[2];
+    store_value(index + 0, rgba[0]);
+    store_value(index + 1, rgba[1]);
+    store_value(index + 2, rgba[2]);
     break;
   case 4:
-    pixel[0] = rgba[0];
-    pixel[1] = rgba[1];
-    pixel[2] = rgba[2];
-    pixel[3] = rgba[3];
+    store_value(index + 0, rgba[0]);
+    store_value(index + 1, rgba[1]);
+    store_value(index + 2, rgba[2]);
+    store_value(index + 3, rgba[3]);
     break;
   default:
     break;
   }
 }
 
-int FrameBuffer::get_index(int x, int y, int z) const
+std::size_t FrameBuffer::get_index(int x, int y, int z) const
 {
-  return y * width_ * nchannels_ + x * nchannels_ + z;
+  if (!IsTiled()) {
+    return (static_cast<std::size_t>(y) * width_ + x) * nchannels_ + z;
+  }
+
+  const int tx = x / tile_width_;
+  const int ty = y / tile_height_;
+  const std::size_t tile = static_cast<std::size_t>(ty) * xtile_count_ + tx;
+  const int pixel = (y - ty * tile_height_) * tile_width_ + (x - tx * tile_width_);
+  return (tile * tile_width_ * tile_height_ + pixel) * nchannels_ + z;
 }
 
 bool FrameBuffer::is_inside(int x, int y, int z) const
@@ -142,6 +450,62 @@ bool FrameBuffer::is_inside(int x, int y, int z) const
   return true;
 }
 
+std::size_t FrameBuffer::get_storage_size() const
+{
+  if (!IsTiled()) {
+    return value_size(format_) * GetSize();
+  }
+  const int ytile_count = (height_ + tile_height_ - 1) / tile_height_;
+  return value_size(format_) * xtile_count_ * ytile_count *
+      tile_width_ * tile_height_ * nchannels_;
+}
+
+std::size_t FrameBuffer::value_size(int format)
+{
+  return format == FB_FORMAT_HALF ? sizeof(uint16_t) : sizeof(float);
+}
+
+float FrameBuffer::load_value(std::size_t index) const
+{
+  if (format_ == FB_FORMAT_HALF) {
+    uint16_t half = 0;
+    memcpy(&half, data_ + sizeof(uint16_t) * index, sizeof(half));
+    return HalfToFloat(half);
+  }
+  float value = 0;
+  memcpy(&value, data_ + sizeof(float) * index, sizeof(value));
+  return value;
+}
+
+void FrameBuffer::store_value(std::size_t index, float value)
+{
+  if (format_ == FB_FORMAT_HALF) {
+    const uint16_t half = FloatToHalf(value);
+    memcpy(data_ + sizeof(uint16_t) * index, &half, sizeof(half));
+    return;
+  }
+  memcpy(data_ + sizeof(float) * index, &value, sizeof(value));
+}
+
+void FrameBuffer::release_storage()
+{
+  if (IsFileBacked()) {
+    OsUnmapFile(data_, mapped_size_);
+    std::remove(mapped_file_.c_str());
+  }
+  std::vector<char>().swap(buf_);
+  data_ = NULL;
+  mapped_size_ = 0;
+  mapped_file_ = "";
+  width_ = 0;
+  height_ = 0;
+  nchannels_ = 0;
+  format_ = FB_FORMAT_FLOAT;
+  tile_width_ = 0;
+  tile_height_ = 0;
+  xtile_count_ = 0;
+}
+
 void CopyInto(const FrameBuffer &src, FrameBuffer &dst,
     int dst_offsetx, int dst_offsety)
 {
@@ -168,4 +532,63 @@ void PasteInto(FrameBuffer &dst, const FrameBuffer &src,
   }
 }
 
+void DownsampleInto(const FrameBuffer &src, FrameBuffer &dst)
+{
+  const int DST_W = std::max(src.GetWidth() / 2, 1);
+  const int DST_H = std::max(src.GetHeight() / 2, 1);
+
+  dst.Resize(DST_W, DST_H, src.GetChannelCount());
+
+  Downsampler downsampler;
+  downsampler.src = &src;
+  downsampler.dst = &dst;
+
+  const int NTASKS = (DST_H + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+  std::vector<int> task_que(NTASKS);
+  for (int i = 0; i < NTASKS; i++) {
+    task_que[i] = i;
+  }
+  MtRunParallelLoop(&downsampler, downsample_rows_task,
+      MtGetMaxAvailableThreadCount(), task_que);
+}
+
+static LoopStatus downsample_rows_task(void *data, const ThreadContext &context)
+{
+  const Downsampler *downsampler = static_cast<const Downsampler *>(data);
+  const FrameBuffer &src = *downsampler->src;
+  FrameBuffer &dst = *downsampler->dst;
+  const int SRC_W = src.GetWidth();
+  const int SRC_H = src.GetHeight();
+  const int NCHANS = src.GetChannelCount();
+  const int XSTEP = SRC_W > 1 ? 1 : 0;
+  const int YSTEP = SRC_H > 1 ? 1 : 0;
+  const int YMIN = context.iteration_id * ROWS_PER_TASK;
+  const int YMAX = std::min(YMIN + ROWS_PER_TASK, dst.GetHeight());
+
+  // rows of any layout and format
+  const int DST_W = dst.GetWidth();
+  std::vector<float> row0(SRC_W * NCHANS), row1(SRC_W * NCHANS), out(DST_W * NCHANS);
+
+  for (int y = YMIN; y < YMAX; y++) {
+    const int sy = y * (YSTEP + 1);
+    src.ReadRow(0, sy,         SRC_W, &row0[0]);
+    src.ReadRow(0, sy + YSTEP, SRC_W, &row1[0]);
+
+    for (int x = 0; x < DST_W; x++) {
+      const int sx = x * (XSTEP + 1);
+      const float *p00 = &row0[sx * NCHANS];
+      const float *p10 = &row0[(sx + XSTEP) * NCHANS];
+      const float *p01 = &row1[sx * NCHANS];
+      const float *p11 = &row1[(sx + XSTEP) * NCHANS];
+      float *o = &out[x * NCHANS];
+
+      for (int ch = 0; ch < NCHANS; ch++) {
+        o[ch] = .25f * (p00[ch] + p10[ch] + p01[ch] + p11[ch]);
+      }
+    }
+    dst.WriteRow(0, y, DST_W, &out[0]);
+  }
+  return LoopStatus::Continue;
+}
+
 } // namespace xxx
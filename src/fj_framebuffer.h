@@ -5,50 +5,125 @@
 #define FJ_FRAMEBUFFER_H
 
 #include "fj_compatibility.h"
+#include <string>
 #include <vector>
 
 namespace fj {
 
 class Color4;
 
+// storage of channels. all channels of a framebuffer are of the same
+// format. they are always float when read or written
+enum FrameBufferFormat {
+  FB_FORMAT_FLOAT = 0,
+  // 16-bit half float. half of the memory
+  FB_FORMAT_HALF
+};
+
 class FJ_API FrameBuffer {
 public:
   FrameBuffer();
+  // copies pixels into memory in the same layout
+  FrameBuffer(const FrameBuffer &other);
   ~FrameBuffer();
 
+  FrameBuffer &operator=(const FrameBuffer &other);
+
   int GetWidth() const;
   int GetHeight() const;
   int GetChannelCount() const;
 
-  int GetSize() const;
+  std::size_t GetSize() const;
   void Resize(int width, int height, int nchannels);
   bool IsEmpty() const;
+  // bytes of pixels in memory. pages of the file in memory if backed by it
+  std::size_t GetMemoryUsage() const;
+  // exchanges pixels without copying them
+  void Swap(FrameBuffer &other);
+
+  // one of FrameBufferFormat. takes effect at the next Resize
+  void SetFormat(int format);
+  int GetFormat() const;
+
+  // stores pixels in tiles of the size one after another so that pixels of
+  // a tile are close in memory. tiles are from (0, 0). 0 for rows of the
+  // whole width (default). takes effect at the next Resize
+  void SetTileLayout(int tile_width, int tile_height);
+  bool IsTiled() const;
+  // 0 if not tiled
+  int GetTileWidth() const;
+  int GetTileHeight() const;
+  // keeps pixels in the file mapped in memory instead of in memory so that
+  // they can be evicted. the file is removed when pixels are resized or
+  // freed. empty for memory (default). takes effect at the next Resize
+  void SetBackingFile(const std::string &filename);
+  bool IsFileBacked() const;
+  // writes pixels in the region to the file and drops them from memory.
+  // they are read from the file again when touched. only whole pages of
+  // pixels in the region are evicted. pixels are not changed. does nothing
+  // if not backed by a file. returns -1 if failed
+  int EvictRegion(int xmin, int ymin, int xmax, int ymax) const;
 
   // Use these functions with caution.
-  // Returns NULL if (x, y, z) is out of bounds.
+  // Returns NULL if (x, y, z) is out of bounds or the format is not float.
+  // channels of a pixel are contiguous. pixels of a row are contiguous to
+  // the end of the row or of the tile if tiled
   float *GetWritable(int x, int y, int z);
   const float *GetReadOnly(int x, int y, int z) const;
 
+  // a channel of any format. 0 if out of bounds
+  float GetValue(int x, int y, int z) const;
+  void SetValue(int x, int y, int z, float value);
+
+  // copy count pixels of all channels of the row from (x, y) from or to
+  // pixels packed in rows. work for any layout and format. pixels out of bounds are
+  // skipped
+  void ReadRow(int x, int y, int count, float *dst) const;
+  void WriteRow(int x, int y, int count, const float *src);
+
   // Get color at pixel (x, y).
   // (r, r, r, 1) will be returned when framebuffer is grayscale
   // (r, g, b, 1) will be returned when framebuffer is rgb
-  // (r, g, b, a) will be returned when framebuffer is rgba
+  // (r, g, b, a) will be returned when framebuffer is rgba or has more
   Color4 GetColor(int x, int y) const;
 
   // Set color at pixel (x, y).
   // (r)          will be set when framebuffer is grayscale
   // (r, g, b)    will be set when framebuffer is rgb
-  // (r, g, b, a) will be set when framebuffer is rgba
+  // (r, g, b, a) will be set when framebuffer is rgba or has more
   void SetColor(int x, int y, const Color4 &rgba);
 
 private:
-  int get_index(int x, int y, int z) const;
+  std::size_t get_index(int x, int y, int z) const;
   bool is_inside(int x, int y, int z) const;
+  // bytes of the storage including padding of tiles
+  std::size_t get_storage_size() const;
+  static std::size_t value_size(int format);
+  float load_value(std::size_t index) const;
+  void store_value(std::size_t index, float value);
+  void release_storage();
+
+  std::vector<char> buf_;
+  // buf_ or the mapped file
+  char *data_;
+  std::size_t mapped_size_;
+  std::string mapped_file_;
 
-  std::vector<float> buf_;
   int width_;
   int height_;
   int nchannels_;
+  int format_;
+
+  // of the current pixels
+  int tile_width_;
+  int tile_height_;
+  int xtile_count_;
+
+  // for the next Resize
+  int next_tile_width_;
+  int next_tile_height_;
+  int next_format_;
+  std::string backing_file_;
 };
 
 FJ_API void CopyInto(const FrameBuffer &src, FrameBuffer &dst,
@@ -57,6 +132,9 @@ FJ_API void CopyInto(const FrameBuffer &src, FrameBuffer &dst,
 FJ_API void PasteInto(FrameBuffer &dst, const FrameBuffer &src,
     int src_offsetx, int src_offsety);
 
+// Halves the size by averaging 2x2 pixels. sizes of 1 stay 1
+FJ_API void DownsampleInto(const FrameBuffer &src, FrameBuffer &dst);
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
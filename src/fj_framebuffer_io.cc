@@ -7,14 +7,24 @@
 #include "fj_color.h"
 #include "fj_box.h"
 #include "fj_pto.h"
+#include "fj_os.h"
 
 #include <fstream>
+#include <vector>
+#include <cstring>
+#include <cstdio>
 #include <cerrno>
 
 namespace fj {
 
 static int error_no = ERR_FB_NOERR;
 
+// magic, version, width, height, channel count, data offset and padding
+#define FB_FILE_MAGIC "FJFB"
+#define FB_MAGIC_SIZE 4
+#define FB_FILE_VERSION 1
+#define FB_HEADER_SIZE 32
+
 int FbGetErrorNo(void)
 {
   return error_no;
@@ -44,6 +54,53 @@ static void set_error(int err)
 }
 
 int WriteFrameBuffer(const std::string &filename, const FrameBuffer &fb)
+{
+  set_error(ERR_FB_NOERR);
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (file == NULL) {
+    set_error(ERR_FB_NOFILE);
+    return -1;
+  }
+
+  char header[FB_HEADER_SIZE] = {'\0'};
+  const int values[] = {
+    FB_FILE_VERSION,
+    fb.GetWidth(),
+    fb.GetHeight(),
+    fb.GetChannelCount(),
+    FB_HEADER_SIZE
+  };
+  memcpy(header, FB_FILE_MAGIC, FB_MAGIC_SIZE);
+  memcpy(header + FB_MAGIC_SIZE, values, sizeof(values));
+
+  const size_t NFLOATS = fb.IsEmpty() ? 0 : fb.GetSize();
+  size_t nwrites = fwrite(header, 1, FB_HEADER_SIZE, file);
+  if (NFLOATS > 0 && fb.GetReadOnly(0, 0, 0) != NULL && !fb.IsTiled()) {
+    nwrites += sizeof(float) * fwrite(fb.GetReadOnly(0, 0, 0), sizeof(float), NFLOATS, file);
+  } else if (NFLOATS > 0) {
+    // the file has float rows of the whole width
+    std::vector<float> row(fb.GetWidth() * fb.GetChannelCount());
+    for (int y = 0; y < fb.GetHeight(); y++) {
+      fb.ReadRow(0, y, fb.GetWidth(), &row[0]);
+      nwrites += sizeof(float) * fwrite(&row[0], sizeof(float), row.size(), file);
+
+      // drops each row of tiles once written out
+      const int TILE_H = fb.GetTileHeight();
+      if (fb.IsFileBacked() && ((y + 1) % TILE_H == 0 || y + 1 == fb.GetHeight())) {
+        fb.EvictRegion(0, y / TILE_H * TILE_H, fb.GetWidth(), y + 1);
+      }
+    }
+  }
+
+  const int err = fclose(file);
+  if (err || nwrites != FB_HEADER_SIZE + sizeof(float) * NFLOATS) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int WriteFrameBufferText(const std::string &filename, const FrameBuffer &fb)
 {
   set_error(ERR_FB_NOERR);
   std::ofstream strm(filename.c_str());
@@ -142,8 +199,67 @@ private:
   }
 };
 
+// Returns 1 if the file is not binary
+static int read_binary(const std::string &filename, FrameBuffer &fb)
+{
+  size_t size = 0;
+  void *data = OsMapFile(filename.c_str(), &size);
+  if (data == NULL) {
+    return 1;
+  }
+  // pixels are copied from the first to the last
+  OsAdviseMappedPages(data, size, OS_ACCESS_SEQUENTIAL);
+
+  const char *bytes = static_cast<const char *>(data);
+  if (size < FB_HEADER_SIZE || memcmp(bytes, FB_FILE_MAGIC, FB_MAGIC_SIZE) != 0) {
+    OsUnmapFile(data, size);
+    return 1;
+  }
+
+  int values[5] = {0};
+  memcpy(values, bytes + FB_MAGIC_SIZE, sizeof(values));
+  const int version = values[0];
+  const int width = values[1];
+  const int height = values[2];
+  const int nchannels = values[3];
+  const int offset = values[4];
+
+  if (version != FB_FILE_VERSION) {
+    OsUnmapFile(data, size);
+    set_error(ERR_FB_BADVER);
+    return -1;
+  }
+
+  const size_t NFLOATS = static_cast<size_t>(width) * height * nchannels;
+  if (width < 0 || height < 0 || nchannels < 0 || offset < FB_HEADER_SIZE ||
+      offset + sizeof(float) * NFLOATS > size) {
+    OsUnmapFile(data, size);
+    set_error(ERR_FB_NOTFB);
+    return -1;
+  }
+
+  fb.Resize(width, height, nchannels);
+  if (NFLOATS > 0 && fb.GetWritable(0, 0, 0) != NULL && !fb.IsTiled()) {
+    memcpy(fb.GetWritable(0, 0, 0), bytes + offset, sizeof(float) * NFLOATS);
+  } else if (NFLOATS > 0) {
+    const float *rows = reinterpret_cast<const float *>(bytes + offset);
+    for (int y = 0; y < height; y++) {
+      fb.WriteRow(0, y, width, rows + static_cast<size_t>(y) * width * nchannels);
+    }
+  }
+
+  OsUnmapFile(data, size);
+  return 0;
+}
+
 int ReadFrameBuffer(const std::string &filename, FrameBuffer &fb)
 {
+  set_error(ERR_FB_NOERR);
+  const int err = read_binary(filename, fb);
+  if (err != 1) {
+    return err;
+  }
+
   std::ifstream strm(filename.c_str());
   if (!strm) {
     return -1;
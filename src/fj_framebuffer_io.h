@@ -22,7 +22,12 @@ enum FbErrorNo {
 FJ_API int FbGetErrorNo(void);
 FJ_API const char *FbGetErrorMessage(int err);
 
+// Writes a binary file of a header and raw floats in one write. The floats
+// start at an aligned offset so that readers can map the file.
 FJ_API int WriteFrameBuffer(const std::string &filename, const FrameBuffer &fb);
+// Writes the plain text format of older versions.
+FJ_API int WriteFrameBufferText(const std::string &filename, const FrameBuffer &fb);
+// Reads both binary and text files.
 FJ_API int ReadFrameBuffer(const std::string &filename, FrameBuffer &fb);
 
 } // namespace xxx
@@ -2,9 +2,19 @@
 // See LICENSE and README
 
 #include "fj_geo_io.h"
+#include "fj_compression.h"
+#include "fj_multi_thread.h"
+#include <algorithm>
+#include <cstring>
 
 namespace fj {
 
+static const char SIGNATURE[] = "fjgeo";
+static const size_t SIGNATURE_SIZE = 8;
+
+// data are split into chunks of about this size in bytes
+static const int64_t CHUNK_SIZE = 1 << 20;
+
 enum {
   Type_Null,
   Type_Integer,
@@ -17,16 +27,56 @@ template <> struct DataType<float>  { static const int value = Type_Float; };
 template <> struct DataType<double> { static const int value = Type_Float; };
 template <> struct DataType<std::string> { static const int value = Type_String; };
 template <> struct DataType<Vector> { static const int value = Type_Float; };
+template <> struct DataType<TexCoord> { static const int value = Type_Float; };
+template <> struct DataType<Color> { static const int value = Type_Float; };
 
 template <typename T> struct DataSize { static const int value = sizeof(T); };
 template <> struct DataSize<Vector>  { static const int value = sizeof(Real); };
+template <> struct DataSize<TexCoord>  { static const int value = sizeof(float); };
+template <> struct DataSize<Color>  { static const int value = sizeof(float); };
 
 template <typename T> struct ElementSize { static const int value = 1; };
 template <> struct ElementSize<Vector> { static const int value = 3; };
+template <> struct ElementSize<TexCoord> { static const int value = 2; };
+template <> struct ElementSize<Color> { static const int value = 3; };
+
+static int64_t chunk_byte_size(int64_t elem_bytes)
+{
+  const int64_t chunk_elems = CHUNK_SIZE / elem_bytes;
+  return elem_bytes * (chunk_elems > 0 ? chunk_elems : 1);
+}
+
+// bytes of the same significance of scalars are put next to each other
+// so the delta and RLE coding of RleCompress finds runs in sign, exponent
+// and upper mantissa bytes
+static void split_bytes(const char *src, int64_t size, int scalar_size,
+    std::vector<char> &dst)
+{
+  const int64_t N = size / scalar_size;
+  dst.resize(size);
+  for (int b = 0; b < scalar_size; b++) {
+    char *plane = &dst[b * N];
+    for (int64_t i = 0; i < N; i++) {
+      plane[i] = src[i * scalar_size + b];
+    }
+  }
+}
+
+static void join_bytes(const char *src, int64_t size, int scalar_size,
+    char *dst)
+{
+  const int64_t N = size / scalar_size;
+  for (int b = 0; b < scalar_size; b++) {
+    const char *plane = &src[b * N];
+    for (int64_t i = 0; i < N; i++) {
+      dst[i * scalar_size + b] = plane[i];
+    }
+  }
+}
 
 template <typename T> inline
-static void write_data(std::fstream &file,
-    const std::string &name, const T *data, int64_t count)
+static void write_data(std::fstream &file, const std::string &name,
+    const T *data, int64_t count, int compression)
 {
   // data name
   const Archive::SizeType name_size = name.length() + 1;
@@ -48,9 +98,58 @@ static void write_data(std::fstream &file,
   file.write(&elem_size, sizeof(elem_size));
   file.write(reinterpret_cast<const char *>(&count), sizeof(count));
 
-  // data body
+  // chunk table. sizes are known after chunks are written
+  const char chunk_compression = compression;
   const Archive::SizeType size = data_size * elem_size * count;
-  file.write(reinterpret_cast<const char*>(data), size);
+  const Archive::SizeType chunk_size = chunk_byte_size(data_size * elem_size);
+  const int64_t chunk_count = (size + chunk_size - 1) / chunk_size;
+  std::vector<int64_t> chunk_sizes(chunk_count, 0);
+
+  file.write(&chunk_compression, sizeof(chunk_compression));
+  file.write(reinterpret_cast<const char *>(&chunk_count), sizeof(chunk_count));
+  const std::streamoff table_offset = file.tellp();
+  if (chunk_count > 0) {
+    file.write(reinterpret_cast<const char *>(&chunk_sizes[0]),
+        sizeof(int64_t) * chunk_count);
+  }
+
+  // data body
+  const char *bytes = reinterpret_cast<const char *>(data);
+  std::vector<char> src;
+  std::vector<char> dst;
+
+  for (int64_t i = 0; i < chunk_count; i++) {
+    const int64_t offset = i * chunk_size;
+    const int64_t raw_size = std::min(chunk_size, size - offset);
+
+    if (compression == ARCHIVE_COMPRESSION_RLE) {
+      split_bytes(bytes + offset, raw_size, data_size, src);
+      RleCompress(src, dst);
+      if (static_cast<int64_t>(dst.size()) < raw_size) {
+        chunk_sizes[i] = dst.size();
+        file.write(&dst[0], dst.size());
+        continue;
+      }
+    }
+    chunk_sizes[i] = raw_size;
+    file.write(bytes + offset, raw_size);
+  }
+
+  // back patch chunk sizes
+  const std::streamoff end_offset = file.tellp();
+  file.seekp(table_offset);
+  if (chunk_count > 0) {
+    file.write(reinterpret_cast<const char *>(&chunk_sizes[0]),
+        sizeof(int64_t) * chunk_count);
+  }
+  file.seekp(end_offset);
+}
+
+template <typename T> inline
+static void write_data(std::fstream &file, const std::string &name,
+    const T *data, int64_t count)
+{
+  write_data(file, name, data, count, ARCHIVE_COMPRESSION_NONE);
 }
 
 static void write_null_data(std::fstream &file, const std::string &name)
@@ -66,7 +165,51 @@ static bool match_signature(std::istream &istr, const char *signature)
   return strcmp(sign, signature) == 0;
 }
 
-Archive::Archive() : err_(0)
+class ChunkReader {
+public:
+  ChunkReader() {}
+  ~ChunkReader() {}
+
+  const char *body;
+  std::vector<int64_t> chunk_offsets;
+  std::vector<int64_t> chunk_sizes;
+  std::vector<int> chunk_errors;
+  char *dst;
+  int64_t dst_size;
+  int64_t chunk_size;
+  int scalar_size;
+};
+
+static int uncompress_chunk(const ChunkReader &reader, int64_t i)
+{
+  const int64_t offset = i * reader.chunk_size;
+  const int64_t raw_size = std::min(reader.chunk_size, reader.dst_size - offset);
+  const char *src = reader.body + reader.chunk_offsets[i];
+  const int64_t src_size = reader.chunk_sizes[i];
+
+  // chunks RLE didn't shrink are stored as they are
+  if (src_size == raw_size) {
+    memcpy(reader.dst + offset, src, raw_size);
+    return 0;
+  }
+
+  std::vector<char> split(raw_size);
+  if (RleUncompress(src, src_size, &split[0], raw_size)) {
+    return -1;
+  }
+  join_bytes(&split[0], raw_size, reader.scalar_size, reader.dst + offset);
+  return 0;
+}
+
+static LoopStatus uncompress_chunk_task(void *data, const ThreadContext &context)
+{
+  ChunkReader *reader = static_cast<ChunkReader *>(data);
+  const int i = context.iteration_id;
+  reader->chunk_errors[i] = uncompress_chunk(*reader, i);
+  return LoopStatus::Continue;
+}
+
+Archive::Archive() : compression_(ARCHIVE_COMPRESSION_RLE), err_(0)
 {
 }
 
@@ -78,7 +221,8 @@ Archive::~Archive()
 int Archive::OpenOutput(const std::string &filename)
 {
   file_.open(filename.c_str(), std::fstream::out | std::fstream::binary);
-  if (file_) {
+  if (!file_) {
+    err_ = -1;
     return -1;
   }
   return 0;
@@ -92,35 +236,60 @@ int Archive::OpenInput(const std::string &filename)
     return -1;
   }
 
-  if (!match_signature(file_, "fjgeo")) {
+  if (!match_signature(file_, SIGNATURE)) {
     err_ = -1;
     return -1;
   }
 
   int64_t body_start;
   file_.read(reinterpret_cast<char *>(&body_start), sizeof(body_start));
-  std::cout << "geo_io::body_start " << body_start << "\n";
 
-  while (file_.tellg() < body_start) {
-
-    std::string name = read_data_name();
+  while (file_ && file_.tellg() < body_start) {
+    const std::string name = read_data_name();
+    int err = 0;
 
     if (name == "position_count") {
-      read_data(&position_.data_count, 1);
-      std::cout << "geo_io::position_count " << position_.data_count << "\n";
+      err = read_count(&position_.data_count);
+    }
+    else if (name == "position_index_count") {
+      err = read_count(&position_.index_count);
     }
     else if (name == "normal_count") {
-      read_data(&normal_.data_count, 1);
-      std::cout << "geo_io::normal_count " << normal_.data_count << "\n";
+      err = read_count(&normal_.data_count);
+    }
+    else if (name == "normal_index_count") {
+      err = read_count(&normal_.index_count);
+    }
+    else if (name == "texture_count") {
+      err = read_count(&texture_.data_count);
+    }
+    else if (name == "texture_index_count") {
+      err = read_count(&texture_.index_count);
+    }
+    else if (name == "color_count") {
+      err = read_count(&color_.data_count);
+    }
+    else if (name == "color_index_count") {
+      err = read_count(&color_.index_count);
     }
     else if (name == "end_of_header") {
       break;
     }
     else {
-      break;
+      err = read_data(NULL, 0, 0);
+    }
+
+    if (err) {
+      err_ = -1;
+      return -1;
     }
   }
 
+  file_.seekg(body_start);
+  if (!file_) {
+    err_ = -1;
+    return -1;
+  }
   return 0;
 }
 
@@ -135,8 +304,18 @@ void Archive::Close()
   file_.close();
 }
 
-void Archive::Write()
+void Archive::SetCompression(int compression)
 {
+  compression_ = compression;
+}
+
+int Archive::Write()
+{
+  if (!file_) {
+    err_ = -1;
+    return -1;
+  }
+
   char sign[SIGNATURE_SIZE] = {'\0'};
   strcpy(sign, SIGNATURE);
   file_.write(sign, SIGNATURE_SIZE);
@@ -150,7 +329,7 @@ void Archive::Write()
   write_data(file_, "position_count",       &position_.data_count,  1);
   write_data(file_, "position_index_count", &position_.index_count, 1);
   write_data(file_, "normal_count",         &normal_.data_count,    1);
-  write_data(file_, "normal_index_count",   &position_.index_count, 1);
+  write_data(file_, "normal_index_count",   &normal_.index_count,   1);
   write_data(file_, "texture_count",        &texture_.data_count,   1);
   write_data(file_, "texture_index_count",  &texture_.index_count,  1);
   write_data(file_, "color_count",          &color_.data_count,     1);
@@ -166,59 +345,197 @@ void Archive::Write()
   file_.seekp(body_start);
 
   // body data
-  write_data(file_, "position_data",  &position_.data,  position_.data_count);
-  //write_data(file_, "position_index", &position_.index, position_.index_count);
+  const int c = compression_;
+  write_data(file_, "position_data",  position_.data,  position_.data_count,  c);
+  write_data(file_, "position_index", position_.index, position_.index_count, c);
+  write_data(file_, "normal_data",    normal_.data,    normal_.data_count,    c);
+  write_data(file_, "normal_index",   normal_.index,   normal_.index_count,   c);
+  write_data(file_, "texture_data",   texture_.data,   texture_.data_count,   c);
+  write_data(file_, "texture_index",  texture_.index,  texture_.index_count,  c);
+  write_data(file_, "color_data",     color_.data,     color_.data_count,     c);
+  write_data(file_, "color_index",    color_.index,    color_.index_count,    c);
+
+  if (!file_) {
+    err_ = -1;
+    return -1;
+  }
+  return 0;
+}
+
+int Archive::Read()
+{
+  if (!file_) {
+    err_ = -1;
+    return -1;
+  }
+
+  for (;;) {
+    const std::string name = read_data_name();
+    if (name.empty()) {
+      break;
+    }
+
+    char *dst = NULL;
+    int64_t count = 0;
+    int elem_size = 0;
+
+    if (name == "position_data") {
+      dst = reinterpret_cast<char *>(position_.data);
+      count = position_.data_count;
+      elem_size = sizeof(Vector);
+    }
+    else if (name == "position_index") {
+      dst = reinterpret_cast<char *>(position_.index);
+      count = position_.index_count;
+      elem_size = sizeof(int64_t);
+    }
+    else if (name == "normal_data") {
+      dst = reinterpret_cast<char *>(normal_.data);
+      count = normal_.data_count;
+      elem_size = sizeof(Vector);
+    }
+    else if (name == "normal_index") {
+      dst = reinterpret_cast<char *>(normal_.index);
+      count = normal_.index_count;
+      elem_size = sizeof(int64_t);
+    }
+    else if (name == "texture_data") {
+      dst = reinterpret_cast<char *>(texture_.data);
+      count = texture_.data_count;
+      elem_size = sizeof(TexCoord);
+    }
+    else if (name == "texture_index") {
+      dst = reinterpret_cast<char *>(texture_.index);
+      count = texture_.index_count;
+      elem_size = sizeof(int64_t);
+    }
+    else if (name == "color_data") {
+      dst = reinterpret_cast<char *>(color_.data);
+      count = color_.data_count;
+      elem_size = sizeof(Color);
+    }
+    else if (name == "color_index") {
+      dst = reinterpret_cast<char *>(color_.index);
+      count = color_.index_count;
+      elem_size = sizeof(int64_t);
+    }
+
+    if (read_data(dst, count, elem_size)) {
+      err_ = -1;
+      return -1;
+    }
+  }
+
+  return 0;
 }
 
 std::string Archive::read_data_name()
 {
   SizeType size = 0;
   file_.read(reinterpret_cast<char*>(&size), sizeof(size));
+  if (!file_ || size <= 0) {
+    return std::string();
+  }
   string_buf_.resize(size);
   file_.read(&string_buf_[0], sizeof(char) * size);
+  if (!file_) {
+    return std::string();
+  }
   return std::string(&string_buf_[0]);
 }
 
-void Archive::read_data_info(char *data_type, char *data_size,
-    char *elem_size, int64_t *data_count)
+// reads data of the name just read. skips it if dst is NULL
+int Archive::read_data(char *dst, int64_t dst_count, int dst_elem_size)
 {
-  file_.read(data_type, sizeof(*data_type));
-  file_.read(data_size, sizeof(*data_size));
-  file_.read(elem_size, sizeof(*elem_size));
-  file_.read(reinterpret_cast<char *>(data_count), sizeof(*data_count));
-}
+  char data_type = Type_Null;
+  file_.read(&data_type, sizeof(data_type));
+  if (!file_) {
+    return -1;
+  }
+  if (data_type == Type_Null) {
+    return 0;
+  }
 
-void Archive::read_data(int64_t *data, int64_t count)
-{
-  char data_type;
-  char data_size;
-  char elem_size;
-  int64_t data_count;
-  read_data_info(&data_type, &data_size, &elem_size, &data_count);
+  char data_size = 0;
+  char elem_size = 0;
+  int64_t data_count = 0;
+  char compression = ARCHIVE_COMPRESSION_NONE;
+  int64_t chunk_count = 0;
+  file_.read(&data_size, sizeof(data_size));
+  file_.read(&elem_size, sizeof(elem_size));
+  file_.read(reinterpret_cast<char *>(&data_count), sizeof(data_count));
+  file_.read(&compression, sizeof(compression));
+  file_.read(reinterpret_cast<char *>(&chunk_count), sizeof(chunk_count));
+  if (!file_ || chunk_count < 0 || data_size <= 0 || elem_size <= 0) {
+    return -1;
+  }
 
-  const SizeType size = data_size * elem_size * data_count;
-  string_buf_.resize(size);
-  file_.read(&string_buf_[0], size);
+  ChunkReader reader;
+  reader.chunk_sizes.resize(chunk_count);
+  reader.chunk_offsets.resize(chunk_count);
+  if (chunk_count > 0) {
+    file_.read(reinterpret_cast<char *>(&reader.chunk_sizes[0]),
+        sizeof(int64_t) * chunk_count);
+  }
+  int64_t body_size = 0;
+  for (int64_t i = 0; i < chunk_count; i++) {
+    reader.chunk_offsets[i] = body_size;
+    body_size += reader.chunk_sizes[i];
+  }
 
-  int64_t *tmp_data = reinterpret_cast<int64_t *>(&string_buf_[0]);
-  for (int64_t i = 0; i < data_count; i++) {
-    data[i] = tmp_data[i];
+  if (dst == NULL) {
+    file_.seekg(body_size, std::fstream::cur);
+    return file_ ? 0 : -1;
   }
-}
 
-std::string Archive::ReadDataName()
-{
-    return read_data_name();
+  const int64_t elem_bytes = data_size * elem_size;
+  const int64_t expected_chunk_count =
+      (elem_bytes * data_count + chunk_byte_size(elem_bytes) - 1) /
+      chunk_byte_size(elem_bytes);
+  if (elem_bytes != dst_elem_size || data_count != dst_count ||
+      chunk_count != expected_chunk_count) {
+    return -1;
+  }
+
+  std::vector<char> body(body_size);
+  if (body_size > 0) {
+    file_.read(&body[0], body_size);
+  }
+  if (!file_) {
+    return -1;
+  }
+
+  reader.body = body.empty() ? NULL : &body[0];
+  reader.chunk_errors.resize(chunk_count, 0);
+  reader.dst = dst;
+  reader.dst_size = elem_bytes * data_count;
+  reader.chunk_size = chunk_byte_size(elem_bytes);
+  reader.scalar_size = data_size;
+
+  if (chunk_count > 1) {
+    std::vector<int> chunk_que(chunk_count);
+    for (int64_t i = 0; i < chunk_count; i++) {
+      chunk_que[i] = i;
+    }
+    MtRunParallelLoop(&reader, uncompress_chunk_task,
+        MtGetMaxAvailableThreadCount(), chunk_que);
+  } else {
+    for (int64_t i = 0; i < chunk_count; i++) {
+      reader.chunk_errors[i] = uncompress_chunk(reader, i);
+    }
+  }
+
+  for (int64_t i = 0; i < chunk_count; i++) {
+    if (reader.chunk_errors[i]) {
+      return -1;
+    }
+  }
+  return 0;
 }
 
-void Archive::ReadData()
+int Archive::read_count(int64_t *count)
 {
-  int64_t data_count;
-  read_data_info(&data_type_, &data_size_, &elem_size_, &data_count);
-
-  const SizeType size = data_size_ * elem_size_ * data_count;
-  string_buf_.resize(size);
-  file_.read(&string_buf_[0], size);
+  return read_data(reinterpret_cast<char *>(count), 1, sizeof(*count));
 }
 
 } // namespace xxx
@@ -12,15 +12,17 @@
 #include <fstream>
 #include <vector>
 #include <string>
-#include <cstring>
-
-#include <iostream>
 
 namespace fj {
 
-const char SIGNATURE[] = "fjgeo";
-const size_t SIGNATURE_SIZE = 8;
+enum ArchiveCompression {
+  ARCHIVE_COMPRESSION_NONE = 0,
+  ARCHIVE_COMPRESSION_RLE
+};
 
+// Archives keep positions, normals, texture coordinates and colors with
+// their indices. Data are split into chunks compressed on their own, so
+// chunks of large data are uncompressed in parallel when read.
 class Archive {
 public:
   typedef int64_t SizeType;
@@ -36,54 +38,62 @@ public:
 
   void Close();
 
+  // RLE by default. chunks RLE doesn't shrink are written as they are
+  void SetCompression(int compression);
+
   void SetPositionData(
-      const Vector *data, int64_t data_count,
-      const int64_t *index, int64_t index_count)
+      Vector *data, int64_t data_count,
+      int64_t *index, int64_t index_count)
   {
-    position_.data        = const_cast<Vector *>(data);
-    position_.data_count  = data_count;
-    position_.index       = const_cast<int64_t *>(index);
-    position_.index_count = index_count;
+    position_.Set(data, data_count, index, index_count);
   }
 
   void SetNormalData(
-      const Vector *data, int64_t data_count,
-      const int64_t *index, int64_t index_count)
+      Vector *data, int64_t data_count,
+      int64_t *index, int64_t index_count)
   {
-    normal_.data        = const_cast<Vector *>(data);
-    normal_.data_count  = data_count;
-    normal_.index       = const_cast<int64_t *>(index);
-    normal_.index_count = index_count;
+    normal_.Set(data, data_count, index, index_count);
   }
 
-  int64_t GetPositionCount() const
+  void SetTextureData(
+      TexCoord *data, int64_t data_count,
+      int64_t *index, int64_t index_count)
   {
-    return position_.data_count;
+    texture_.Set(data, data_count, index, index_count);
   }
 
-  void Write();
+  void SetColorData(
+      Color *data, int64_t data_count,
+      int64_t *index, int64_t index_count)
+  {
+    color_.Set(data, data_count, index, index_count);
+  }
 
-  bool IsFailed() const;
+  // counts are read from the header by OpenInput
+  int64_t GetPositionCount() const { return position_.data_count; }
+  int64_t GetPositionIndexCount() const { return position_.index_count; }
+  int64_t GetNormalCount() const { return normal_.data_count; }
+  int64_t GetNormalIndexCount() const { return normal_.index_count; }
+  int64_t GetTextureCount() const { return texture_.data_count; }
+  int64_t GetTextureIndexCount() const { return texture_.index_count; }
+  int64_t GetColorCount() const { return color_.data_count; }
+  int64_t GetColorIndexCount() const { return color_.index_count; }
 
-  //======================================================================
-  std::string ReadDataName();
-  void ReadData();
+  int Write();
 
-  void SkipData()
-  {
-    size_t size = 0;
-    file_.read(reinterpret_cast<char*>(&size), sizeof(size));
-    file_.seekg(size, std::fstream::cur);
-  }
+  // reads into the arrays set by Set*Data after OpenInput. arrays not set
+  // are skipped
+  int Read();
+
+  bool IsFailed() const;
 
 private:
   Archive(const Archive &);
   const Archive &operator=(const Archive &);
 
   std::string read_data_name();
-  void read_data_info(char *data_type, char *data_size,
-      char *elem_size, int64_t *data_count);
-  void read_data(int64_t *data, int64_t count);
+  int read_data(char *dst, int64_t dst_count, int dst_elem_size);
+  int read_count(int64_t *count);
 
   std::fstream file_;
   std::vector<char> string_buf_;
@@ -97,6 +107,14 @@ private:
         index_count(0) {}
     ~DataRef() {}
 
+    void Set(T *d, int64_t d_count, int64_t *i, int64_t i_count)
+    {
+      data        = d;
+      data_count  = d_count;
+      index       = i;
+      index_count = i_count;
+    }
+
     T *data;
     int64_t data_count;
     int64_t *index;
@@ -108,12 +126,8 @@ private:
   DataRef<TexCoord> texture_;
   DataRef<Color>    color_;
 
+  int compression_;
   int err_;
-
-  //======================================================================
-  char data_type_;
-  char data_size_;
-  char elem_size_;
 };
 
 } // namespace xxx
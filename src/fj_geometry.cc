@@ -2,6 +2,7 @@
 // See LICENSE and README
 
 #include "fj_geometry.h"
+#include "fj_memory_usage.h"
 
 namespace fj {
 
@@ -47,6 +48,35 @@ void Geometry::set_bounds(const Box &bounds)
   bounds_ = bounds;
 }
 
+template<typename T> inline
+const T *data_or_null(const std::vector<T> &v)
+{
+  return v.empty() ? NULL : &v[0];
+}
+
+const CompactVector *Geometry::get_point_position_data() const
+{
+  return data_or_null(PointPosition_);
+}
+
+const CompactVector *Geometry::get_point_velocity_data() const
+{
+  return data_or_null(PointVelocity_);
+}
+
+const CompactReal *Geometry::get_point_radius_data() const
+{
+  return data_or_null(PointRadius_);
+}
+
+std::size_t Geometry::get_attribute_memory_usage() const
+{
+  return
+      MemoryUsageOf(PointPosition_) +
+      MemoryUsageOf(PointVelocity_) +
+      MemoryUsageOf(PointRadius_);
+}
+
 template<typename T> inline
 bool out_of_range(const std::vector<T> &v, Index i)
 {
@@ -57,8 +87,8 @@ void add_attribute(std::vector<T> &v, Index size)
 {
   v.resize(size);
 }
-template<typename T> inline
-void set_attribute(std::vector<T> &v, Index i, const T &value)
+template<typename T, typename U> inline
+void set_attribute(std::vector<T> &v, Index i, const U &value)
 {
   if (out_of_range(v, i)) {
     return;
@@ -17,6 +17,8 @@ public:
   Geometry();
   virtual ~Geometry();
 
+  // Set functions of distinct indices can be called from multiple
+  // threads after the count is set and attributes are added
   Index GetPointCount() const;
   void SetPointCount(Index point_count);
 
@@ -44,6 +46,11 @@ public:
 
 protected:
   void set_bounds(const Box &bounds);
+  // contiguous attributes for ray intersection. NULL if missing
+  const CompactVector *get_point_position_data() const;
+  const CompactVector *get_point_velocity_data() const;
+  const CompactReal   *get_point_radius_data() const;
+  std::size_t get_attribute_memory_usage() const;
 
 private:
   virtual void compute_bounds() = 0;
@@ -51,9 +58,9 @@ private:
   Index point_count_;
   Box bounds_;
 
-  std::vector<Vector> PointPosition_;
-  std::vector<Vector> PointVelocity_;
-  std::vector<Real>   PointRadius_;
+  std::vector<CompactVector> PointPosition_;
+  std::vector<CompactVector> PointVelocity_;
+  std::vector<CompactReal>   PointRadius_;
 };
 
 } // namespace xxx
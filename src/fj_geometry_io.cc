@@ -3,8 +3,19 @@
 
 #include "fj_geometry_io.h"
 #include "fj_geometry.h"
+#include "fj_geometry_pager.h"
+#include "fj_compression.h"
+#include "fj_tile_cache.h"
 #include "fj_serialize.h"
+#include "fj_volume.h"
+#include "fj_curve.h"
+#include "fj_mesh.h"
+#include "fj_os.h"
+#include <algorithm>
+#include <climits>
 #include <cstring>
+#include <memory>
+#include <cmath>
 
 namespace fj {
 
@@ -26,6 +37,83 @@ static bool match_signature(std::ifstream &file, const char *signature)
   return strcmp(sign, signature) == 0;
 }
 
+const char MESH_SIGNATURE[] = "fjmesh";
+const int64_t MESH_FILE_VERSION = 1;
+// arrays start at multiples of this from the start of the file. mapped
+// files start at page boundaries
+const int64_t MESH_DATA_ALIGNMENT = 64;
+
+enum {
+  MESH_HEADER_VERSION = 0,
+  MESH_HEADER_VECTOR_SIZE,
+  MESH_HEADER_INDEX3_SIZE,
+  MESH_HEADER_POINT_COUNT,
+  MESH_HEADER_FACE_COUNT,
+  MESH_HEADER_POSITION_OFFSET,
+  MESH_HEADER_NORMAL_OFFSET,
+  MESH_HEADER_INDICES_OFFSET,
+  MESH_HEADER_SIZE
+};
+
+// Unmaps the file when the last mesh referring to it is gone. the geometry
+// pager can evict pages of the file while mapped.
+class MeshMapping {
+public:
+  MeshMapping(void *data, size_t size) : data_(data), size_(size)
+  {
+    GeometryPagerGetGlobal().AddMapping(data_, size_);
+  }
+  ~MeshMapping()
+  {
+    GeometryPagerGetGlobal().RemoveMapping(data_);
+    OsUnmapFile(data_, size_);
+  }
+
+  const char *GetData() const { return static_cast<const char *>(data_); }
+  size_t GetSize() const { return size_; }
+
+private:
+  MeshMapping(const MeshMapping &);
+  const MeshMapping &operator=(const MeshMapping &);
+
+  void *data_;
+  size_t size_;
+};
+
+const char VOLUME_SIGNATURE[] = "fjvol";
+const int64_t VOLUME_FILE_VERSION = 1;
+const int64_t VOLUME_BRICK_VOXEL_COUNT =
+    VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE * VOXEL_BRICK_SIZE;
+const int64_t VOLUME_BRICK_BYTES = sizeof(float) * VOLUME_BRICK_VOXEL_COUNT;
+
+enum {
+  VOLUME_HEADER_VERSION = 0,
+  VOLUME_HEADER_BRICK_SIZE,
+  VOLUME_HEADER_XRES,
+  VOLUME_HEADER_YRES,
+  VOLUME_HEADER_ZRES,
+  VOLUME_HEADER_COMPRESSION,
+  VOLUME_HEADER_BRICK_COUNT,
+  VOLUME_HEADER_TABLE_OFFSET,
+  VOLUME_HEADER_SIZE
+};
+
+// bounds min and max follow the header
+const int VOLUME_BOUNDS_SIZE = 6;
+
+// size is 0 for bricks of tile_value. bricks of VOLUME_BRICK_BYTES are not
+// compressed
+class VolumeBrickEntry {
+public:
+  VolumeBrickEntry() : offset(0), size(0), tile_value(0), max_value(0) {}
+  ~VolumeBrickEntry() {}
+
+  int64_t offset;
+  int64_t size;
+  float tile_value;
+  float max_value;
+};
+
 template <typename T> inline
 static void write_data(std::ofstream &file, const std::string &name, const T &data)
 {
@@ -133,4 +221,582 @@ int GeoInputFile::Read(Geometry &geo)
   return 0;
 }
 
+const char CURVE_SIGNATURE[] = "fjcurve";
+
+CurveOutputFile::CurveOutputFile(const std::string &filename)
+{
+  file_.open(filename.c_str(), std::fstream::out | std::fstream::binary);
+}
+
+CurveOutputFile::~CurveOutputFile()
+{
+}
+
+int CurveOutputFile::Write(const Curve &curve)
+{
+  if (!file_) {
+    return -1;
+  }
+
+  char sign[SIGNATURE_SIZE] = {'\0'};
+  strcpy(sign, CURVE_SIGNATURE);
+  file_.write(sign, SIGNATURE_SIZE);
+
+  const int nverts = curve.GetVertexCount();
+  const int ncurves = curve.GetCurveCount();
+  write_data(file_, "vertex::count", nverts);
+  write_data(file_, "curve::count", ncurves);
+  if (curve.HasVertexPosition()) {
+    write_(file_, "vertex::position");
+    for (int i = 0; i < nverts; i++) {
+      write_(file_, curve.GetVertexPosition(i));
+    }
+  }
+  if (curve.HasVertexColor()) {
+    write_(file_, "vertex::color");
+    for (int i = 0; i < nverts; i++) {
+      write_(file_, curve.GetVertexColor(i));
+    }
+  }
+  if (curve.HasVertexTexture()) {
+    write_(file_, "vertex::texture");
+    for (int i = 0; i < nverts; i++) {
+      write_(file_, curve.GetVertexTexture(i));
+    }
+  }
+  if (curve.HasVertexVelocity()) {
+    write_(file_, "vertex::velocity");
+    for (int i = 0; i < nverts; i++) {
+      write_(file_, curve.GetVertexVelocity(i));
+    }
+  }
+  if (curve.HasVertexWidth()) {
+    write_(file_, "vertex::width");
+    for (int i = 0; i < nverts; i++) {
+      write_(file_, curve.GetVertexWidth(i));
+    }
+  }
+  if (curve.HasCurveIndices()) {
+    write_(file_, "curve::indices");
+    for (int i = 0; i < ncurves; i++) {
+      write_(file_, curve.GetCurveIndices(i));
+    }
+  }
+  write_(file_, "end");
+
+  file_.flush();
+  return file_ ? 0 : -1;
+}
+
+CurveInputFile::CurveInputFile(const std::string &filename)
+{
+  file_.open(filename.c_str(), std::fstream::in | std::fstream::binary);
+}
+
+CurveInputFile::~CurveInputFile()
+{
+}
+
+int CurveInputFile::Read(Curve &curve)
+{
+  if (!file_ || !match_signature(file_, CURVE_SIGNATURE)) {
+    return -1;
+  }
+
+  curve.Clear();
+  std::string name;
+  for (;;) {
+    read_data_name(file_, name);
+    if (!file_) {
+      return -1;
+    }
+
+    if (name == "end") {
+      break;
+    }
+    else if (name == "vertex::count") {
+      int value = 0;
+      read_(file_, value);
+      curve.SetVertexCount(value);
+    }
+    else if (name == "curve::count") {
+      int value = 0;
+      read_(file_, value);
+      curve.SetCurveCount(value);
+    }
+    else if (name == "vertex::position") {
+      curve.AddVertexPosition();
+      for (int i = 0; i < curve.GetVertexCount(); i++) {
+        Vector value;
+        read_(file_, value);
+        curve.SetVertexPosition(i, value);
+      }
+    }
+    else if (name == "vertex::color") {
+      curve.AddVertexColor();
+      for (int i = 0; i < curve.GetVertexCount(); i++) {
+        Color value;
+        read_(file_, value);
+        curve.SetVertexColor(i, value);
+      }
+    }
+    else if (name == "vertex::texture") {
+      curve.AddVertexTexture();
+      for (int i = 0; i < curve.GetVertexCount(); i++) {
+        TexCoord value;
+        read_(file_, value);
+        curve.SetVertexTexture(i, value);
+      }
+    }
+    else if (name == "vertex::velocity") {
+      curve.AddVertexVelocity();
+      for (int i = 0; i < curve.GetVertexCount(); i++) {
+        Vector value;
+        read_(file_, value);
+        curve.SetVertexVelocity(i, value);
+      }
+    }
+    else if (name == "vertex::width") {
+      curve.AddVertexWidth();
+      for (int i = 0; i < curve.GetVertexCount(); i++) {
+        Real value = 0;
+        read_(file_, value);
+        curve.SetVertexWidth(i, value);
+      }
+    }
+    else if (name == "curve::indices") {
+      curve.AddCurveIndices();
+      for (int i = 0; i < curve.GetCurveCount(); i++) {
+        int value = 0;
+        read_(file_, value);
+        if (value < 0 || value >= curve.GetVertexCount()) {
+          curve.Clear();
+          return -1;
+        }
+        curve.SetCurveIndices(i, value);
+      }
+    }
+    else {
+      curve.Clear();
+      return -1;
+    }
+  }
+  curve.ComputeBounds();
+
+  return file_ ? 0 : -1;
+}
+
+static int64_t align_offset(int64_t offset)
+{
+  return (offset + MESH_DATA_ALIGNMENT - 1) / MESH_DATA_ALIGNMENT * MESH_DATA_ALIGNMENT;
+}
+
+static void write_padding(std::ofstream &file, int64_t offset)
+{
+  const int64_t padding = offset - file.tellp();
+  for (int64_t i = 0; i < padding; i++) {
+    file.put('\0');
+  }
+}
+
+// NULL if the array is out of the data or not aligned
+template <typename T>
+static const T *get_mesh_array(const char *data, size_t size,
+    int64_t offset, int64_t count)
+{
+  if (offset <= 0 || offset % MESH_DATA_ALIGNMENT != 0 ||
+      offset > static_cast<int64_t>(size) ||
+      count > (static_cast<int64_t>(size) - offset) / static_cast<int64_t>(sizeof(T))) {
+    return NULL;
+  }
+  return reinterpret_cast<const T *>(data + offset);
+}
+
+static int refer_mesh_data(const std::shared_ptr<const void> &owner,
+    const char *data, size_t size, Mesh &mesh)
+{
+  const size_t header_end = SIGNATURE_SIZE + sizeof(int64_t) * MESH_HEADER_SIZE;
+  if (size < header_end || memcmp(data, MESH_SIGNATURE, sizeof(MESH_SIGNATURE)) != 0) {
+    return -1;
+  }
+
+  int64_t header[MESH_HEADER_SIZE] = {0};
+  memcpy(header, data + SIGNATURE_SIZE, sizeof(header));
+
+  const int64_t point_count = header[MESH_HEADER_POINT_COUNT];
+  const int64_t face_count = header[MESH_HEADER_FACE_COUNT];
+  if (header[MESH_HEADER_VERSION] != MESH_FILE_VERSION ||
+      header[MESH_HEADER_VECTOR_SIZE] != static_cast<int64_t>(sizeof(Vector)) ||
+      header[MESH_HEADER_INDEX3_SIZE] != static_cast<int64_t>(sizeof(Index3)) ||
+      point_count < 0 || point_count > INT_MAX ||
+      face_count < 0 || face_count > INT_MAX) {
+    return -1;
+  }
+
+  const Vector *P = get_mesh_array<Vector>(data, size,
+      header[MESH_HEADER_POSITION_OFFSET], point_count);
+  const Vector *N = get_mesh_array<Vector>(data, size,
+      header[MESH_HEADER_NORMAL_OFFSET], point_count);
+  const Index3 *indices = get_mesh_array<Index3>(data, size,
+      header[MESH_HEADER_INDICES_OFFSET], face_count);
+  if (P == NULL || indices == NULL ||
+      (N == NULL && header[MESH_HEADER_NORMAL_OFFSET] != 0)) {
+    return -1;
+  }
+
+  for (int64_t i = 0; i < face_count; i++) {
+    const Index3 &face = indices[i];
+    if (face.i0 < 0 || face.i0 >= point_count ||
+        face.i1 < 0 || face.i1 >= point_count ||
+        face.i2 < 0 || face.i2 >= point_count) {
+      return -1;
+    }
+  }
+
+  mesh.Clear();
+  mesh.SetPointCount(static_cast<int>(point_count));
+  mesh.SetFaceCount(static_cast<int>(face_count));
+  mesh.ReferMappedData(owner, P, N, indices);
+  mesh.ComputeBounds();
+
+  return 0;
+}
+
+MeshOutputFile::MeshOutputFile(const std::string &filename)
+{
+  file_.open(filename.c_str(), std::fstream::out | std::fstream::binary);
+}
+
+MeshOutputFile::~MeshOutputFile()
+{
+}
+
+int MeshOutputFile::Write(const Mesh &mesh)
+{
+  if (!file_ || !mesh.HasPointPosition() || !mesh.HasFaceIndices()) {
+    return -1;
+  }
+
+  const int64_t point_count = mesh.GetPointCount();
+  const int64_t face_count = mesh.GetFaceCount();
+  const int64_t array_size = sizeof(Vector) * point_count;
+
+  int64_t header[MESH_HEADER_SIZE] = {0};
+  header[MESH_HEADER_VERSION] = MESH_FILE_VERSION;
+  header[MESH_HEADER_VECTOR_SIZE] = sizeof(Vector);
+  header[MESH_HEADER_INDEX3_SIZE] = sizeof(Index3);
+  header[MESH_HEADER_POINT_COUNT] = point_count;
+  header[MESH_HEADER_FACE_COUNT] = face_count;
+
+  int64_t offset = align_offset(SIGNATURE_SIZE + sizeof(header));
+  header[MESH_HEADER_POSITION_OFFSET] = offset;
+  offset = align_offset(offset + array_size);
+  if (mesh.HasPointNormal()) {
+    header[MESH_HEADER_NORMAL_OFFSET] = offset;
+    offset = align_offset(offset + array_size);
+  }
+  header[MESH_HEADER_INDICES_OFFSET] = offset;
+
+  char sign[SIGNATURE_SIZE] = {'\0'};
+  strcpy(sign, MESH_SIGNATURE);
+  file_.write(sign, SIGNATURE_SIZE);
+  file_.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+  write_padding(file_, header[MESH_HEADER_POSITION_OFFSET]);
+  for (int i = 0; i < point_count; i++) {
+    const Vector P = mesh.GetPointPosition(i);
+    file_.write(reinterpret_cast<const char *>(&P), sizeof(P));
+  }
+  if (mesh.HasPointNormal()) {
+    write_padding(file_, header[MESH_HEADER_NORMAL_OFFSET]);
+    for (int i = 0; i < point_count; i++) {
+      const Vector N = mesh.GetPointNormal(i);
+      file_.write(reinterpret_cast<const char *>(&N), sizeof(N));
+    }
+  }
+  write_padding(file_, header[MESH_HEADER_INDICES_OFFSET]);
+  for (int i = 0; i < face_count; i++) {
+    const Index3 face = mesh.GetFaceIndices(i);
+    file_.write(reinterpret_cast<const char *>(&face), sizeof(face));
+  }
+
+  file_.flush();
+  return file_ ? 0 : -1;
+}
+
+MeshInputFile::MeshInputFile(const std::string &filename) : filename_(filename)
+{
+}
+
+MeshInputFile::~MeshInputFile()
+{
+}
+
+int MeshInputFile::Read(Mesh &mesh)
+{
+  size_t size = 0;
+  void *data = OsMapFile(filename_.c_str(), &size);
+  if (data != NULL) {
+    std::shared_ptr<const MeshMapping> mapping =
+        std::make_shared<MeshMapping>(data, size);
+    return refer_mesh_data(mapping, mapping->GetData(), mapping->GetSize(), mesh);
+  }
+
+  // the mesh refers to the file read into memory
+  std::ifstream file(filename_.c_str(), std::fstream::in | std::fstream::binary);
+  if (!file) {
+    return -1;
+  }
+  file.seekg(0, std::fstream::end);
+  const std::streamoff file_size = file.tellg();
+  file.seekg(0, std::fstream::beg);
+  if (file_size <= 0) {
+    return -1;
+  }
+
+  std::shared_ptr<std::vector<char>> buffer =
+      std::make_shared<std::vector<char>>(file_size);
+  if (!file.read(&(*buffer)[0], file_size)) {
+    return -1;
+  }
+  return refer_mesh_data(buffer, &(*buffer)[0], buffer->size(), mesh);
+}
+
+VolumeOutputFile::VolumeOutputFile(const std::string &filename) :
+    compression_(VOLUME_COMPRESSION_RLE)
+{
+  file_.open(filename.c_str(), std::fstream::out | std::fstream::binary);
+}
+
+VolumeOutputFile::~VolumeOutputFile()
+{
+}
+
+void VolumeOutputFile::SetCompression(int compression)
+{
+  compression_ = compression;
+}
+
+int VolumeOutputFile::Write(const Volume &volume)
+{
+  const VoxelBuffer &buffer = volume.GetVoxelBuffer();
+  if (!file_ || buffer.IsEmpty()) {
+    return -1;
+  }
+
+  const Resolution &res = buffer.GetResolution();
+  const Box &bounds = volume.GetBounds();
+  const int64_t brick_count = buffer.GetBrickCount();
+
+  int64_t header[VOLUME_HEADER_SIZE] = {0};
+  header[VOLUME_HEADER_VERSION] = VOLUME_FILE_VERSION;
+  header[VOLUME_HEADER_BRICK_SIZE] = VOXEL_BRICK_SIZE;
+  header[VOLUME_HEADER_XRES] = res.x;
+  header[VOLUME_HEADER_YRES] = res.y;
+  header[VOLUME_HEADER_ZRES] = res.z;
+  header[VOLUME_HEADER_COMPRESSION] = compression_;
+  header[VOLUME_HEADER_BRICK_COUNT] = brick_count;
+
+  const double bounds_values[VOLUME_BOUNDS_SIZE] = {
+    bounds.min.x, bounds.min.y, bounds.min.z,
+    bounds.max.x, bounds.max.y, bounds.max.z};
+
+  // the table offset is known after bricks are written
+  char sign[SIGNATURE_SIZE] = {'\0'};
+  strcpy(sign, VOLUME_SIGNATURE);
+  file_.write(sign, SIGNATURE_SIZE);
+  const std::streamoff header_offset = file_.tellp();
+  file_.write(reinterpret_cast<const char *>(header), sizeof(header));
+  file_.write(reinterpret_cast<const char *>(bounds_values), sizeof(bounds_values));
+
+  std::vector<VolumeBrickEntry> table(brick_count);
+  std::vector<float> voxels(VOLUME_BRICK_VOXEL_COUNT);
+  std::vector<char> src(VOLUME_BRICK_BYTES);
+  std::vector<char> dst;
+
+  for (int64_t i = 0; i < brick_count; i++) {
+    VolumeBrickEntry &entry = table[i];
+    if (!buffer.GetBrick(i, &voxels[0], &entry.tile_value)) {
+      entry.max_value = std::abs(entry.tile_value);
+      continue;
+    }
+    for (int64_t j = 0; j < VOLUME_BRICK_VOXEL_COUNT; j++) {
+      entry.max_value = std::max(entry.max_value, std::abs(voxels[j]));
+    }
+
+    memcpy(&src[0], &voxels[0], VOLUME_BRICK_BYTES);
+    const std::vector<char> *data = &src;
+    if (compression_ == VOLUME_COMPRESSION_RLE) {
+      RleCompress(src, dst);
+      if (dst.size() < src.size()) {
+        data = &dst;
+      }
+    }
+
+    entry.offset = file_.tellp();
+    entry.size = data->size();
+    file_.write(&(*data)[0], data->size());
+  }
+
+  header[VOLUME_HEADER_TABLE_OFFSET] = align_offset(file_.tellp());
+  write_padding(file_, header[VOLUME_HEADER_TABLE_OFFSET]);
+  for (int64_t i = 0; i < brick_count; i++) {
+    file_.write(reinterpret_cast<const char *>(&table[i]), sizeof(table[i]));
+  }
+
+  file_.seekp(header_offset);
+  file_.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+  file_.flush();
+  return file_ ? 0 : -1;
+}
+
+// Reads bricks from the mapped file or the file read into memory.
+class VolumeFileReader : public VoxelBrickReader {
+public:
+  VolumeFileReader(const std::shared_ptr<const void> &owner,
+      const char *data, const VolumeBrickEntry *table, int file_id) :
+      owner_(owner), data_(data), table_(table), file_id_(file_id) {}
+  virtual ~VolumeFileReader() {}
+
+  virtual int GetFileID() const
+  {
+    return file_id_;
+  }
+
+  virtual bool GetBrickInfo(int64_t index, float *tile_value, float *max_value) const
+  {
+    const VolumeBrickEntry &entry = table_[index];
+    *tile_value = entry.tile_value;
+    *max_value = entry.max_value;
+    return entry.size > 0;
+  }
+
+  virtual int ReadBrick(int64_t index, float *voxels) const
+  {
+    const VolumeBrickEntry &entry = table_[index];
+    const char *src = data_ + entry.offset;
+    char *dst = reinterpret_cast<char *>(voxels);
+
+    if (entry.size == VOLUME_BRICK_BYTES) {
+      memcpy(dst, src, VOLUME_BRICK_BYTES);
+      return 0;
+    }
+    return RleUncompress(src, entry.size, dst, VOLUME_BRICK_BYTES);
+  }
+
+private:
+  std::shared_ptr<const void> owner_;
+  const char *data_;
+  const VolumeBrickEntry *table_;
+  int file_id_;
+};
+
+static int refer_volume_data(const std::shared_ptr<const void> &owner,
+    const char *data, size_t size, const std::string &filename, Volume &volume)
+{
+  const size_t header_end = SIGNATURE_SIZE +
+      sizeof(int64_t) * VOLUME_HEADER_SIZE + sizeof(double) * VOLUME_BOUNDS_SIZE;
+  if (size < header_end || memcmp(data, VOLUME_SIGNATURE, sizeof(VOLUME_SIGNATURE)) != 0) {
+    return -1;
+  }
+
+  int64_t header[VOLUME_HEADER_SIZE] = {0};
+  double bounds_values[VOLUME_BOUNDS_SIZE] = {0};
+  memcpy(header, data + SIGNATURE_SIZE, sizeof(header));
+  memcpy(bounds_values, data + SIGNATURE_SIZE + sizeof(header), sizeof(bounds_values));
+
+  const int64_t xres = header[VOLUME_HEADER_XRES];
+  const int64_t yres = header[VOLUME_HEADER_YRES];
+  const int64_t zres = header[VOLUME_HEADER_ZRES];
+  if (header[VOLUME_HEADER_VERSION] != VOLUME_FILE_VERSION ||
+      header[VOLUME_HEADER_BRICK_SIZE] != VOXEL_BRICK_SIZE ||
+      xres < 1 || xres > INT_MAX ||
+      yres < 1 || yres > INT_MAX ||
+      zres < 1 || zres > INT_MAX) {
+    return -1;
+  }
+
+  const int64_t brick_count =
+      (xres + VOXEL_BRICK_SIZE - 1) / VOXEL_BRICK_SIZE *
+      ((yres + VOXEL_BRICK_SIZE - 1) / VOXEL_BRICK_SIZE) *
+      ((zres + VOXEL_BRICK_SIZE - 1) / VOXEL_BRICK_SIZE);
+  const int64_t table_offset = header[VOLUME_HEADER_TABLE_OFFSET];
+  if (header[VOLUME_HEADER_BRICK_COUNT] != brick_count ||
+      table_offset <= 0 || table_offset % MESH_DATA_ALIGNMENT != 0 ||
+      table_offset > static_cast<int64_t>(size) ||
+      brick_count > (static_cast<int64_t>(size) - table_offset) /
+          static_cast<int64_t>(sizeof(VolumeBrickEntry))) {
+    return -1;
+  }
+
+  const VolumeBrickEntry *table =
+      reinterpret_cast<const VolumeBrickEntry *>(data + table_offset);
+  for (int64_t i = 0; i < brick_count; i++) {
+    const VolumeBrickEntry &entry = table[i];
+    if (entry.size < 0 || entry.size > VOLUME_BRICK_BYTES ||
+        (entry.size > 0 && (entry.offset < static_cast<int64_t>(header_end) ||
+        entry.offset > table_offset - entry.size))) {
+      return -1;
+    }
+  }
+
+  // bricks of the file loaded before are dropped
+  TileCache &cache = TileCacheGetGlobal();
+  const int file_id = cache.GetFileID(filename);
+  cache.RemoveFile(file_id);
+
+  std::shared_ptr<const VoxelBrickReader> reader =
+      std::make_shared<VolumeFileReader>(owner, data, table, file_id);
+
+  volume.SetBounds(Box(
+      Vector(bounds_values[0], bounds_values[1], bounds_values[2]),
+      Vector(bounds_values[3], bounds_values[4], bounds_values[5])));
+  volume.SetBrickReader(
+      static_cast<int>(xres),
+      static_cast<int>(yres),
+      static_cast<int>(zres),
+      reader);
+
+  return 0;
+}
+
+VolumeInputFile::VolumeInputFile(const std::string &filename) : filename_(filename)
+{
+}
+
+VolumeInputFile::~VolumeInputFile()
+{
+}
+
+int VolumeInputFile::Read(Volume &volume)
+{
+  size_t size = 0;
+  void *data = OsMapFile(filename_.c_str(), &size);
+  if (data != NULL) {
+    std::shared_ptr<const MeshMapping> mapping =
+        std::make_shared<MeshMapping>(data, size);
+    return refer_volume_data(mapping, mapping->GetData(), mapping->GetSize(),
+        filename_, volume);
+  }
+
+  std::ifstream file(filename_.c_str(), std::fstream::in | std::fstream::binary);
+  if (!file) {
+    return -1;
+  }
+  file.seekg(0, std::fstream::end);
+  const std::streamoff file_size = file.tellg();
+  file.seekg(0, std::fstream::beg);
+  if (file_size <= 0) {
+    return -1;
+  }
+
+  std::shared_ptr<std::vector<char>> buffer =
+      std::make_shared<std::vector<char>>(file_size);
+  if (!file.read(&(*buffer)[0], file_size)) {
+    return -1;
+  }
+  return refer_volume_data(buffer, &(*buffer)[0], buffer->size(), filename_, volume);
+}
+
 } // namespace xxx
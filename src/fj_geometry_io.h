@@ -10,6 +10,10 @@
 
 namespace fj {
 
+class Mesh;
+class Curve;
+class Volume;
+
 //int WriteGeometry(const std::string &filename, const Geometry &geo);
 
 class GeoOutputFile {
@@ -38,6 +42,107 @@ private:
   std::ifstream file_;
 };
 
+// Curve files keep counts, indices and vertex attributes the curve has
+class CurveOutputFile {
+public:
+  CurveOutputFile(const std::string &filename);
+  virtual ~CurveOutputFile();
+
+  int Write(const Curve &curve);
+
+private:
+  CurveOutputFile(const CurveOutputFile &);
+  const CurveOutputFile &operator=(const CurveOutputFile &);
+
+  std::ofstream file_;
+};
+
+class CurveInputFile {
+public:
+  CurveInputFile(const std::string &filename);
+  virtual ~CurveInputFile();
+
+  int Read(Curve &curve);
+
+private:
+  CurveInputFile(const CurveInputFile &);
+  const CurveInputFile &operator=(const CurveInputFile &);
+
+  std::ifstream file_;
+};
+
+// Mesh files keep positions, normals and face indices as they are in
+// memory, aligned in the file, so a mapped file is used without copying.
+// Files are only read by the same build of the renderer on the same
+// platform since Real and Index are written as they are.
+class MeshOutputFile {
+public:
+  MeshOutputFile(const std::string &filename);
+  virtual ~MeshOutputFile();
+
+  int Write(const Mesh &mesh);
+private:
+  MeshOutputFile(const MeshOutputFile &);
+  const MeshOutputFile &operator=(const MeshOutputFile &);
+
+  std::ofstream file_;
+};
+
+class MeshInputFile {
+public:
+  MeshInputFile(const std::string &filename);
+  virtual ~MeshInputFile();
+
+  // The mesh refers to the mapped file which stays mapped until the mesh
+  // is cleared or deleted. The file is read into memory if not mapped.
+  int Read(Mesh &mesh);
+private:
+  MeshInputFile(const MeshInputFile &);
+  const MeshInputFile &operator=(const MeshInputFile &);
+
+  std::string filename_;
+};
+
+enum VolumeCompression {
+  VOLUME_COMPRESSION_NONE = 0,
+  VOLUME_COMPRESSION_RLE
+};
+
+// Volume files keep bricks of 8x8x8 voxels with a table of them at the
+// end. bricks of the same value are only in the table. Compact() the
+// volume before writing it to keep more bricks out of the file.
+class VolumeOutputFile {
+public:
+  VolumeOutputFile(const std::string &filename);
+  virtual ~VolumeOutputFile();
+
+  // RLE by default. bricks RLE doesn't shrink are written as they are
+  void SetCompression(int compression);
+  int Write(const Volume &volume);
+private:
+  VolumeOutputFile(const VolumeOutputFile &);
+  const VolumeOutputFile &operator=(const VolumeOutputFile &);
+
+  std::ofstream file_;
+  int compression_;
+};
+
+class VolumeInputFile {
+public:
+  VolumeInputFile(const std::string &filename);
+  virtual ~VolumeInputFile();
+
+  // Only the header and the brick table are read. bricks are read when
+  // the volume first accesses them. The file stays mapped until the volume
+  // is resized, filled or deleted.
+  int Read(Volume &volume);
+private:
+  VolumeInputFile(const VolumeInputFile &);
+  const VolumeInputFile &operator=(const VolumeInputFile &);
+
+  std::string filename_;
+};
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
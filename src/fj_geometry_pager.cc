@@ -0,0 +1,209 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_geometry_pager.h"
+#include "fj_os.h"
+#include <algorithm>
+#include <chrono>
+
+namespace fj {
+
+// checking resident pages walks page tables of all mappings
+static const double MIN_TRIM_INTERVAL = 0.5;
+
+static double now_seconds()
+{
+  const std::chrono::duration<double> now =
+      std::chrono::steady_clock::now().time_since_epoch();
+  return now.count();
+}
+
+static std::size_t resident_size_of(const char *data, std::size_t size)
+{
+  std::size_t resident = 0;
+  // assumes all pages are resident if not known
+  if (OsGetResidentSize(data, size, &resident)) {
+    return size;
+  }
+  return resident;
+}
+
+GeometryPager::GeometryPager() :
+  mutex_(),
+  mappings_(),
+  budget_(0),
+  hand_mapping_(0),
+  hand_cluster_(0),
+  last_trim_time_(0),
+  page_in_base_(0),
+  evicted_count_(0)
+{
+  page_in_base_ = OsGetPageInCount();
+}
+
+GeometryPager::~GeometryPager()
+{
+}
+
+void GeometryPager::SetMemoryBudget(std::size_t bytes)
+{
+  budget_ = bytes;
+}
+
+std::size_t GeometryPager::GetMemoryBudget() const
+{
+  return budget_;
+}
+
+bool GeometryPager::IsEnabled() const
+{
+  return budget_ > 0;
+}
+
+void GeometryPager::AddMapping(const void *data, std::size_t size)
+{
+  if (data == NULL || size == 0) {
+    return;
+  }
+
+  Mapping mapping;
+  mapping.data = static_cast<const char *>(data);
+  mapping.size = size;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  mappings_.push_back(mapping);
+}
+
+void GeometryPager::RemoveMapping(const void *data)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::size_t i = 0; i < mappings_.size(); i++) {
+    if (mappings_[i].data == data) {
+      mappings_.erase(mappings_.begin() + i);
+      break;
+    }
+  }
+  hand_mapping_ = 0;
+  hand_cluster_ = 0;
+}
+
+bool GeometryPager::IsMapped(const void *address) const
+{
+  const char *addr = static_cast<const char *>(address);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::size_t i = 0; i < mappings_.size(); i++) {
+    const Mapping &m = mappings_[i];
+    if (addr >= m.data && addr < m.data + m.size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int GeometryPager::Trim()
+{
+  if (!IsEnabled()) {
+    return 0;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  if (!lock.owns_lock() || mappings_.empty()) {
+    return 0;
+  }
+
+  const double now = now_seconds();
+  if (now - last_trim_time_ < MIN_TRIM_INTERVAL) {
+    return 0;
+  }
+  last_trim_time_ = now;
+
+  const std::size_t budget = budget_;
+  std::size_t resident = compute_resident_size();
+  int evicted = 0;
+
+  std::size_t total_clusters = 0;
+  for (std::size_t i = 0; i < mappings_.size(); i++) {
+    total_clusters +=
+        (mappings_[i].size + GEOMETRY_PAGER_CLUSTER_SIZE - 1) / GEOMETRY_PAGER_CLUSTER_SIZE;
+  }
+
+  // at most one round of the clock
+  for (std::size_t n = 0; n < total_clusters && resident > budget; n++) {
+    if (hand_mapping_ >= mappings_.size()) {
+      hand_mapping_ = 0;
+      hand_cluster_ = 0;
+    }
+    const Mapping &m = mappings_[hand_mapping_];
+    const std::size_t offset = hand_cluster_ * GEOMETRY_PAGER_CLUSTER_SIZE;
+    const std::size_t size = std::min(GEOMETRY_PAGER_CLUSTER_SIZE, m.size - offset);
+
+    const std::size_t cluster_resident = resident_size_of(m.data + offset, size);
+    if (cluster_resident > 0 && OsEvictMappedPages(m.data + offset, size) == 0) {
+      resident -= std::min(resident, cluster_resident);
+      evicted++;
+    }
+
+    hand_cluster_++;
+    if (hand_cluster_ * GEOMETRY_PAGER_CLUSTER_SIZE >= m.size) {
+      hand_mapping_++;
+      hand_cluster_ = 0;
+    }
+  }
+
+  evicted_count_ += evicted;
+  return evicted;
+}
+
+std::size_t GeometryPager::GetMappedSize() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < mappings_.size(); i++) {
+    size += mappings_[i].size;
+  }
+  return size;
+}
+
+std::size_t GeometryPager::GetResidentSize() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return compute_resident_size();
+}
+
+long long GeometryPager::GetPageInCount() const
+{
+  const long long count = OsGetPageInCount();
+  if (count < 0 || page_in_base_ < 0) {
+    return -1;
+  }
+  return count - page_in_base_;
+}
+
+long long GeometryPager::GetEvictedClusterCount() const
+{
+  return evicted_count_;
+}
+
+void GeometryPager::ResetStats()
+{
+  page_in_base_ = OsGetPageInCount();
+  evicted_count_ = 0;
+}
+
+std::size_t GeometryPager::compute_resident_size() const
+{
+  std::size_t resident = 0;
+  for (std::size_t i = 0; i < mappings_.size(); i++) {
+    resident += resident_size_of(mappings_[i].data, mappings_[i].size);
+  }
+  return resident;
+}
+
+GeometryPager &GeometryPagerGetGlobal()
+{
+  static GeometryPager pager;
+  return pager;
+}
+
+} // namespace xxx
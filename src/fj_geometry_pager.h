@@ -0,0 +1,83 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_GEOMETRY_PAGER_H
+#define FJ_GEOMETRY_PAGER_H
+
+#include "fj_compatibility.h"
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <mutex>
+
+namespace fj {
+
+// Keeps mapped geometry files under a memory budget. Mappings are split into
+// clusters of GEOMETRY_PAGER_CLUSTER_SIZE bytes. The OS faults clusters in
+// from the file when rays touch them, and Trim() evicts resident clusters in
+// clock order while the mappings take more memory than the budget.
+class FJ_API GeometryPager {
+public:
+  GeometryPager();
+  ~GeometryPager();
+
+  // 0 disables paging. meshes mapped while paging is enabled do not
+  // precompute triangles so that most of their memory can be paged
+  void SetMemoryBudget(std::size_t bytes);
+  std::size_t GetMemoryBudget() const;
+  bool IsEnabled() const;
+
+  // data must be page aligned e.g. returned by OsMapFile
+  void AddMapping(const void *data, std::size_t size);
+  void RemoveMapping(const void *data);
+  // true if the address is in a mapping
+  bool IsMapped(const void *address) const;
+
+  // evicts clusters until the resident bytes fit in the budget. does nothing
+  // if another thread is trimming or the last trim was very recent. returns
+  // the number of evicted clusters
+  int Trim();
+
+  std::size_t GetMappedSize() const;
+  std::size_t GetResidentSize() const;
+  // since the last ResetStats(). page-ins are of all files of the process
+  long long GetPageInCount() const;
+  long long GetEvictedClusterCount() const;
+  void ResetStats();
+
+private:
+  GeometryPager(const GeometryPager &);
+  const GeometryPager &operator=(const GeometryPager &);
+
+  class Mapping {
+  public:
+    Mapping() : data(NULL), size(0) {}
+    ~Mapping() {}
+
+    const char *data;
+    std::size_t size;
+  };
+
+  std::size_t compute_resident_size() const;
+
+  mutable std::mutex mutex_;
+  std::vector<Mapping> mappings_;
+  std::atomic<std::size_t> budget_;
+
+  // clock hand
+  std::size_t hand_mapping_;
+  std::size_t hand_cluster_;
+  double last_trim_time_;
+
+  long long page_in_base_;
+  std::atomic<long long> evicted_count_;
+};
+
+const std::size_t GEOMETRY_PAGER_CLUSTER_SIZE = 4 * 1024 * 1024;
+
+// pager of mapped geometry files. disabled by default
+FJ_API GeometryPager &GeometryPagerGetGlobal();
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -4,71 +4,116 @@
 #include "fj_grid_accelerator.h"
 #include "fj_intersection.h"
 #include "fj_primitive_set.h"
+#include "fj_memory_usage.h"
+#include "fj_mesh.h"
+#include "fj_multi_thread.h"
 #include "fj_numeric.h"
+#include "fj_ray_stats.h"
 #include "fj_types.h"
 #include "fj_ray.h"
 
+#include <typeinfo>
+
 namespace fj {
 
 static const char ACCELERATOR_NAME[] = "Uniform-Grid";
 static const int GRID_MAXCELLS = 512;
 
-class Cell {
+// meshes smaller than this are built on a single thread
+static const int PARALLEL_BUILD_MIN_PRIMS = 16384;
+// the number of primitives whose cell ranges are computed in a task
+static const int RANGE_CHUNK_SIZE = 4096;
+// primitives recently tested by a ray. primitives overlapping several cells
+// are tested once unless another one took their slot in between
+static const int MAILBOX_SIZE = 16;
+
+// ranges of cell indices overlapped by a primitive. e.g. [min .. max)
+class CellRange {
 public:
-  Cell() : prim_id(0), next(NULL) {}
-  Cell(int primid) : prim_id(primid), next(NULL) {}
-  ~Cell() {}
+  CellRange() : min(), max() {}
+  ~CellRange() {}
 
-  int prim_id;
-  Cell *next;
+  int min[3];
+  int max[3];
 };
 
-static Cell *new_cell(int prim_id)
-{
-  return new Cell(prim_id);
-}
+// a primitive overlapping the cell at x + y * XNCELLS of a z slice
+class SliceEntry {
+public:
+  SliceEntry() : cell(0), prim_id(0) {}
+  SliceEntry(int cellid, Index primid) : cell(cellid), prim_id(primid) {}
+  ~SliceEntry() {}
+
+  int cell;
+  Index prim_id;
+};
+
+class GridBuild {
+public:
+  GridBuild() : primset(NULL), bounds(), cellsize(), ncells(), half_padding(0),
+      nprims(0), ranges(), slice_prims(), slice_entries(),
+      cell_offsets(NULL), cell_prims(NULL) {}
+  ~GridBuild() {}
+
+  const PrimitiveSet *primset;
+  Box bounds;
+  Vector cellsize;
+  int ncells[3];
+  Real half_padding;
+  int nprims;
+
+  std::vector<CellRange> ranges;
+  // primitive ids overlapping each z slice of cells
+  std::vector<std::vector<int>> slice_prims;
+  // overlaps found by counting and placed by filling
+  std::vector<std::vector<SliceEntry>> slice_entries;
+  std::vector<int64_t> *cell_offsets;
+  std::vector<Index> *cell_prims;
+};
 
-static void free_cell(Cell *cell)
+int GridAccelerator::analyze(AcceleratorStats *stats) const
 {
-  delete cell;
+  if (cell_offsets_.empty()) {
+    return -1;
+  }
+
+  stats->AddInterior(0, bounds_, NULL, 0);
+  for (int z = 0; z < ncells_[2]; z++) {
+    for (int y = 0; y < ncells_[1]; y++) {
+      for (int x = 0; x < ncells_[0]; x++) {
+        const int id = ncells_[0] * ncells_[1] * z + ncells_[0] * y + x;
+        const Vector cell_min = bounds_.min + Vector(x, y, z) * cellsize_;
+        const Box cell(cell_min, cell_min + cellsize_);
+        stats->AddLeaf(1, cell,
+            static_cast<int>(cell_offsets_[id + 1] - cell_offsets_[id]));
+      }
+    }
+  }
+  stats->Finish(bounds_);
+  return 0;
 }
 
+static LoopStatus compute_cell_ranges_task(void *data, const ThreadContext &context);
+static LoopStatus count_cell_slice_task(void *data, const ThreadContext &context);
+static LoopStatus fill_cell_slice_task(void *data, const ThreadContext &context);
 static Real max_component(const Vector &a);
 static void compute_grid_cellsizes(int nprimitives, const Vector &grid_size,
     int *xncells, int *yncells, int *zncells);
 static Box get_grid_cell(const Box &grid_bounds, const Vector &cell_size,
     int x, int y, int z);
 
-GridAccelerator::GridAccelerator() : cells_(), cellsize_(), bounds_()
+GridAccelerator::GridAccelerator() : cell_offsets_(), cell_prims_(), cellsize_(), bounds_()
 {
+  ncells_[0] = ncells_[1] = ncells_[2] = 0;
 }
 
 GridAccelerator::~GridAccelerator()
 {
-  const int XNCELLS = ncells_[0];
-  const int YNCELLS = ncells_[1];
-  const int ZNCELLS = ncells_[2];
-
-  for (int z = 0; z < ZNCELLS; z++) {
-    for (int y = 0; y < YNCELLS; y++) {
-      for (int x = 0; x < XNCELLS; x++) {
-        const int cell_id = z * YNCELLS * XNCELLS + y * XNCELLS + x;
-        Cell *cell = cells_[cell_id];
-
-        while (cell != NULL) {
-          Cell *kill = cell;
-          Cell *next = cell->next;
-          free_cell(kill);
-          cell = next;
-        }
-      }
-    }
-  }
 }
 
 int GridAccelerator::build()
 {
-  const PrimitiveSet *primset = GetPrimitiveSet();
+  PrimitiveSet *primset = GetPrimitiveSet();
   const Real PADDING = GetBoundsPadding();
   const Real HALF_PADDING = .5 * PADDING;
 
@@ -82,84 +127,91 @@ int GridAccelerator::build()
   const int NPRIMS = primset->GetPrimitiveCount();
   compute_grid_cellsizes(NPRIMS, bounds_tmp.Diagonal(), &XNCELLS, &YNCELLS, &ZNCELLS);
 
-  std::vector<Cell*> cells_tmp(XNCELLS * YNCELLS * ZNCELLS, NULL);
+  const int64_t NCELLS = static_cast<int64_t>(XNCELLS) * YNCELLS * ZNCELLS;
+  std::vector<int64_t> offsets_tmp(NCELLS + 1, 0);
+  std::vector<Index> prims_tmp;
   const Vector cellsize_tmp =
       (bounds_tmp.max - bounds_tmp.min) / Vector(XNCELLS, YNCELLS, ZNCELLS);
 
-  // TODO TEST
-  int total_cell_count = 0;
-  int added_cell_count = 0;
+  const int max_thread_count = MtGetMaxAvailableThreadCount();
+  const bool is_parallel = max_thread_count > 1 && NPRIMS >= PARALLEL_BUILD_MIN_PRIMS;
+  const int thread_count = is_parallel ? max_thread_count : 1;
+
+  GridBuild grid;
+  grid.primset = primset;
+  grid.bounds = bounds_tmp;
+  grid.cellsize = cellsize_tmp;
+  grid.ncells[0] = XNCELLS;
+  grid.ncells[1] = YNCELLS;
+  grid.ncells[2] = ZNCELLS;
+  grid.half_padding = HALF_PADDING;
+  grid.nprims = NPRIMS;
+  grid.ranges.resize(NPRIMS);
+  grid.slice_prims.resize(ZNCELLS);
+  grid.slice_entries.resize(ZNCELLS);
+  grid.cell_offsets = &offsets_tmp;
+  grid.cell_prims = &prims_tmp;
+
+  const int NCHUNKS = (NPRIMS + RANGE_CHUNK_SIZE - 1) / RANGE_CHUNK_SIZE;
+  std::vector<int> chunk_que(NCHUNKS);
+  for (int i = 0; i < NCHUNKS; i++) {
+    chunk_que[i] = i;
+  }
+  MtRunParallelLoop(&grid, compute_cell_ranges_task, thread_count, chunk_que);
 
+  // primitives are listed in ascending order in each slice so that cells
+  // have the same lists as they are filled on a single thread
   for (int i = 0; i < NPRIMS; i++) {
-    const int prim_id = i;
-    Box primbbox;
-
-    primset->GetPrimitiveBounds(prim_id, &primbbox);
-    primbbox.Expand(HALF_PADDING);
-
-    // compute the ranges of cell indices. e.g. [X0 .. X1)
-    int X0 = static_cast<int>(Floor((primbbox.min.x - bounds_tmp.min.x) / cellsize_tmp.x));
-    int X1 = static_cast<int>(Floor((primbbox.max.x - bounds_tmp.min.x) / cellsize_tmp.x) + 1);
-    int Y0 = static_cast<int>(Floor((primbbox.min.y - bounds_tmp.min.y) / cellsize_tmp.y));
-    int Y1 = static_cast<int>(Floor((primbbox.max.y - bounds_tmp.min.y) / cellsize_tmp.y) + 1);
-    int Z0 = static_cast<int>(Floor((primbbox.min.z - bounds_tmp.min.z) / cellsize_tmp.z));
-    int Z1 = static_cast<int>(Floor((primbbox.max.z - bounds_tmp.min.z) / cellsize_tmp.z) + 1);
-    X0 = Clamp(X0, 0, XNCELLS);
-    X1 = Clamp(X1, 0, XNCELLS);
-    Y0 = Clamp(Y0, 0, YNCELLS);
-    Y1 = Clamp(Y1, 0, YNCELLS);
-    Z0 = Clamp(Z0, 0, ZNCELLS);
-    Z1 = Clamp(Z1, 0, ZNCELLS);
-
-    // add cell list which holds face id inside the cell
-    for (int z = Z0; z < Z1; z++) {
-      for (int y = Y0; y < Y1; y++) {
-        for (int x = X0; x < X1; x++) {
-          // TODO TEST
-          total_cell_count++;
-
-          const Box cellbox = get_grid_cell(bounds_tmp, cellsize_tmp, x, y, z);
-          if (!primset->BoxIntersect(prim_id, cellbox)) {
-            continue;
-          }
-
-          const int cell_id = z * YNCELLS * XNCELLS + y * XNCELLS + x;
-          Cell *newcell = new_cell(prim_id);
-
-          if (cells_tmp[cell_id] == NULL) {
-            cells_tmp[cell_id] = newcell;
-          } else {
-            Cell *oldcell = cells_tmp[cell_id];
-            cells_tmp[cell_id] = newcell;
-            cells_tmp[cell_id]->next = oldcell;
-          }
-          // TODO TEST
-          added_cell_count++;
-        }
-      }
+    const CellRange &range = grid.ranges[i];
+    for (int z = range.min[2]; z < range.max[2]; z++) {
+      grid.slice_prims[z].push_back(i);
     }
   }
 
-  if (1) {
-    // TODO TEST
-    std::cout << "-------------------------------------\n";
-    std::cout << "total_cell_count: " << total_cell_count << "\n";
-    std::cout << "added_cell_count: " << added_cell_count << "\n";
-    std::cout << "reduced:          " << 100. * added_cell_count/total_cell_count << "%\n";
+  // each task works on a z slice of cells so no cell is shared between
+  // threads. counts of cells are put in offsets then summed up to offsets
+  std::vector<int> slice_que(ZNCELLS);
+  for (int z = 0; z < ZNCELLS; z++) {
+    slice_que[z] = z;
+  }
+  MtRunParallelLoop(&grid, count_cell_slice_task, thread_count, slice_que);
+
+  for (int64_t i = 0; i < NCELLS; i++) {
+    offsets_tmp[i + 1] += offsets_tmp[i];
   }
+  prims_tmp.resize(offsets_tmp[NCELLS]);
+
+  MtRunParallelLoop(&grid, fill_cell_slice_task, thread_count, slice_que);
 
   // commit
-  cells_.swap(cells_tmp);
+  cell_offsets_.swap(offsets_tmp);
+  cell_prims_.swap(prims_tmp);
   ncells_[0] = XNCELLS;
   ncells_[1] = YNCELLS;
   ncells_[2] = ZNCELLS;
   cellsize_ = cellsize_tmp;
   bounds_ = bounds_tmp;
 
+  // cells test the precomputed triangles
+  if (typeid(*primset) == typeid(Mesh)) {
+    static_cast<Mesh *>(primset)->PrecomputeTriangles();
+  }
+
   return 0;
 }
 
 bool GridAccelerator::intersect(const Ray &ray, Real time, Intersection *isect) const
+{
+  return traverse(ray, time, false, isect);
+}
+
+bool GridAccelerator::occlude(const Ray &ray, Real time, Intersection *isect) const
+{
+  return traverse(ray, time, true, isect);
+}
+
+bool GridAccelerator::traverse(const Ray &ray, Real time, bool any_hit,
+    Intersection *isect) const
 {
   int NCELLS[3]    = {0, 0, 0};
   int cell_id[3]   = {0, 0, 0};
@@ -230,43 +282,54 @@ bool GridAccelerator::intersect(const Ray &ray, Real time, Intersection *isect)
     }
   }
 
+  Index mailbox[MAILBOX_SIZE];
+  for (int i = 0; i < MAILBOX_SIZE; i++) {
+    mailbox[i] = -1;
+  }
+
+  Intersection isect_candidates[2];
+  Intersection *isect_min = &isect_candidates[0];
+  Intersection *isect_tmp = &isect_candidates[1];
+  isect_min->t_hit = REAL_MAX;
+
   // traverse voxels
   bool hit = false;
   for (;;) {
-    Intersection isect_candidates[2];
-    Intersection *isect_min, *isect_tmp;
-
-    isect_min = &isect_candidates[0];
-    isect_tmp = &isect_candidates[1];
-    isect_min->t_hit = REAL_MAX;
-
     const int id = NCELLS[0] * NCELLS[1] * cell_id[2] + NCELLS[0] * cell_id[1] + cell_id[0];
-
-    // loop over face list that associated in current cell
-    for (Cell *cell = cells_[id]; cell != NULL; cell = cell->next) {
-      const bool hittmp = primset->RayIntersect(cell->prim_id, ray, time, isect_tmp);
-      if (!hittmp) {
+    FJ_RAY_STATS_ADD(surface_node_visit_count, 1);
+
+    // loop over primitives overlapping the current cell
+    const int64_t end = cell_offsets_[id + 1];
+    for (int64_t i = cell_offsets_[id]; i < end; i++) {
+      const Index prim_id = cell_prims_[i];
+      Index &slot = mailbox[prim_id & (MAILBOX_SIZE - 1)];
+      if (slot == prim_id) {
         continue;
       }
+      slot = prim_id;
 
-      // check if the hit point is inside the cell
-      const Box cellbox = get_grid_cell(bounds_, cellsize_,
-          cell_id[0], cell_id[1], cell_id[2]);
-      const Vector P_hit = RayPointAt(ray, isect_tmp->t_hit);
-      const bool inside_cell = cellbox.ContainsPoint(P_hit);
-
-      if (!inside_cell) {
+      FJ_RAY_STATS_ADD(surface_primitive_test_count, 1);
+      // any hit in ray range occludes even if it's in another cell
+      if (any_hit) {
+        if (primset->RayOcclude(prim_id, ray, time, isect)) {
+          return true;
+        }
         continue;
       }
 
-      // update info ONLY if isect->t_hit renewed
+      // hits in cells ahead are kept since the primitive isn't tested again
+      if (!primset->RayIntersect(prim_id, ray, time, isect_tmp)) {
+        continue;
+      }
       if (isect_tmp->t_hit < isect_min->t_hit) {
         std::swap(isect_min, isect_tmp);
-        hit = hittmp;
+        hit = true;
       }
     }
-    if (hit) {
-      *isect = *isect_min;
+
+    // cells ahead can't have closer hits
+    const Real t_exit = Min(Min(t_next[0], t_next[1]), t_next[2]);
+    if (hit && isect_min->t_hit <= t_exit) {
       break;
     }
 
@@ -302,6 +365,10 @@ bool GridAccelerator::intersect(const Ray &ray, Real time, Intersection *isect)
       t_next[1] += t_delta[1];
     }
   }
+
+  if (hit) {
+    *isect = *isect_min;
+  }
   return hit;
 }
 
@@ -310,6 +377,92 @@ const char *GridAccelerator::get_name() const
   return ACCELERATOR_NAME;
 }
 
+std::size_t GridAccelerator::get_memory_usage() const
+{
+  return MemoryUsageOf(cell_offsets_) + MemoryUsageOf(cell_prims_);
+}
+
+static LoopStatus compute_cell_ranges_task(void *data, const ThreadContext &context)
+{
+  GridBuild *grid = reinterpret_cast<GridBuild *>(data);
+  const Box &bounds = grid->bounds;
+  const Vector &cellsize = grid->cellsize;
+  const int begin = context.iteration_id * RANGE_CHUNK_SIZE;
+  const int end = Min(begin + RANGE_CHUNK_SIZE, grid->nprims);
+
+  for (int i = begin; i < end; i++) {
+    Box primbbox;
+    grid->primset->GetPrimitiveBounds(i, &primbbox);
+    primbbox.Expand(grid->half_padding);
+
+    CellRange &range = grid->ranges[i];
+    for (int k = 0; k < 3; k++) {
+      const int K0 = static_cast<int>(Floor((primbbox.min[k] - bounds.min[k]) / cellsize[k]));
+      const int K1 = static_cast<int>(Floor((primbbox.max[k] - bounds.min[k]) / cellsize[k]) + 1);
+      range.min[k] = Clamp(K0, 0, grid->ncells[k]);
+      range.max[k] = Clamp(K1, 0, grid->ncells[k]);
+    }
+  }
+
+  return LoopStatus::Continue;
+}
+
+static LoopStatus count_cell_slice_task(void *data, const ThreadContext &context)
+{
+  GridBuild *grid = reinterpret_cast<GridBuild *>(data);
+  std::vector<int64_t> &offsets = *grid->cell_offsets;
+  const int XNCELLS = grid->ncells[0];
+  const int YNCELLS = grid->ncells[1];
+  const int z = context.iteration_id;
+  const int64_t slice_start = static_cast<int64_t>(z) * YNCELLS * XNCELLS;
+  const std::vector<int> &prims = grid->slice_prims[z];
+  std::vector<SliceEntry> &entries = grid->slice_entries[z];
+
+  for (std::size_t i = 0; i < prims.size(); i++) {
+    const int prim_id = prims[i];
+    const CellRange &range = grid->ranges[prim_id];
+
+    for (int y = range.min[1]; y < range.max[1]; y++) {
+      for (int x = range.min[0]; x < range.max[0]; x++) {
+        const Box cellbox = get_grid_cell(grid->bounds, grid->cellsize, x, y, z);
+        if (!grid->primset->BoxIntersect(prim_id, cellbox)) {
+          continue;
+        }
+
+        const int cell = y * XNCELLS + x;
+        entries.push_back(SliceEntry(cell, prim_id));
+        // the count of the cell goes to the next offset for summing up
+        offsets[slice_start + cell + 1]++;
+      }
+    }
+  }
+
+  return LoopStatus::Continue;
+}
+
+static LoopStatus fill_cell_slice_task(void *data, const ThreadContext &context)
+{
+  GridBuild *grid = reinterpret_cast<GridBuild *>(data);
+  const std::vector<int64_t> &offsets = *grid->cell_offsets;
+  std::vector<Index> &cell_prims = *grid->cell_prims;
+  const int XNCELLS = grid->ncells[0];
+  const int YNCELLS = grid->ncells[1];
+  const int z = context.iteration_id;
+  const int64_t slice_start = static_cast<int64_t>(z) * YNCELLS * XNCELLS;
+  std::vector<SliceEntry> &entries = grid->slice_entries[z];
+
+  // primitives are in ascending order in each cell as they are in slices
+  std::vector<int64_t> next(offsets.begin() + slice_start,
+      offsets.begin() + slice_start + YNCELLS * XNCELLS);
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    cell_prims[next[entries[i].cell]++] = entries[i].prim_id;
+  }
+
+  std::vector<SliceEntry>().swap(entries);
+
+  return LoopStatus::Continue;
+}
+
 static Real max_component(const Vector &a)
 {
   return Max(Max(a[0], a[1]), a[2]);
@@ -8,12 +8,11 @@
 #include "fj_vector.h"
 #include "fj_box.h"
 
+#include <cstdint>
 #include <vector>
 
 namespace fj {
 
-class Cell;
-
 class GridAccelerator : public Accelerator {
 public:
   GridAccelerator();
@@ -22,9 +21,18 @@ public:
 private:
   virtual int build();
   virtual bool intersect(const Ray &ray, Real time, Intersection *isect) const;
+  virtual bool occlude(const Ray &ray, Real time, Intersection *isect) const;
   virtual const char *get_name() const;
+  virtual std::size_t get_memory_usage() const;
+  // cells are the leaves of a root node. steps between cells are not counted
+  virtual int analyze(AcceleratorStats *stats) const;
+
+  // walks the cells along the ray. returns the first hit found if any_hit
+  bool traverse(const Ray &ray, Real time, bool any_hit, Intersection *isect) const;
 
-  std::vector<Cell*> cells_;
+  // primitives of cell i are cell_prims_[cell_offsets_[i] .. cell_offsets_[i+1])
+  std::vector<int64_t> cell_offsets_;
+  std::vector<Index> cell_prims_;
   int ncells_[3];
   Vector cellsize_;
   Box bounds_;
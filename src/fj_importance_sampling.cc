@@ -2,11 +2,13 @@
 // See LICENSE and README
 
 #include "fj_importance_sampling.h"
+#include "fj_multi_thread.h"
 #include "fj_numeric.h"
 #include "fj_texture.h"
 #include "fj_random.h"
 #include "fj_vector.h"
 
+#include <algorithm>
 #include <vector>
 #include <cstdlib>
 #include <cfloat>
@@ -53,6 +55,192 @@ static void generate_dome_samples(int sample_xres, int sample_yres,
     const int *connected_label, int label_count,
     DomeSample *dome_samples, int sample_count);
 
+AliasTable::AliasTable() : thresholds_(), aliases_(), probabilities_()
+{
+}
+
+AliasTable::~AliasTable()
+{
+}
+
+void AliasTable::Build(const double *weights, int count)
+{
+  thresholds_.assign(count, 1);
+  aliases_.resize(count);
+  probabilities_.resize(count);
+
+  double sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum += weights[i];
+  }
+
+  // probabilities scaled by count are split into the ones below and above
+  // the average. each below one gets the rest of its column from above one
+  std::vector<double> scaled(count);
+  std::vector<int> small, large;
+  for (int i = 0; i < count; i++) {
+    probabilities_[i] = sum > 0 ? weights[i] / sum : 1. / count;
+    scaled[i] = probabilities_[i] * count;
+    aliases_[i] = i;
+    if (scaled[i] < 1) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+
+  while (!small.empty() && !large.empty()) {
+    const int s = small.back();
+    const int l = large.back();
+    small.pop_back();
+
+    thresholds_[s] = scaled[s];
+    aliases_[s] = l;
+    scaled[l] -= 1 - scaled[s];
+
+    if (scaled[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // the rest are 1 up to rounding errors
+}
+
+int AliasTable::GetCount() const
+{
+  return thresholds_.size();
+}
+
+double AliasTable::GetProbability(int index) const
+{
+  return probabilities_[index];
+}
+
+int AliasTable::Sample(double u, double *u_remapped) const
+{
+  // keeps u in [0, 1) after rescaling
+  const double U_MAX = 1 - DBL_EPSILON;
+  const int N = GetCount();
+  const double x = u * N;
+  const int i = std::min(static_cast<int>(x), N - 1);
+  const double frac = x - i;
+  const double threshold = thresholds_[i];
+
+  if (frac < threshold) {
+    *u_remapped = Min(frac / threshold, U_MAX);
+    return i;
+  } else {
+    *u_remapped = Min((frac - threshold) / (1 - threshold), U_MAX);
+    return aliases_[i];
+  }
+}
+
+class EnvironmentBuild {
+public:
+  EnvironmentBuild() : texture(NULL), xres(0), yres(0), luminances(NULL), colors(NULL) {}
+  ~EnvironmentBuild() {}
+
+  const Texture *texture;
+  int xres, yres;
+  double *luminances;
+  Color *colors;
+};
+
+static LoopStatus lookup_environment_row_task(void *data, const ThreadContext &context)
+{
+  EnvironmentBuild *build = (EnvironmentBuild *) data;
+  const int y = context.iteration_id;
+
+  for (int x = 0; x < build->xres; x++) {
+    const int index = y * build->xres + x;
+    TexCoord uv;
+
+    xy_to_uv(build->xres, build->yres, x, y, &uv);
+    const Color4 tex_rgba = build->texture->Lookup(uv.u, uv.v);
+
+    build->luminances[index] = Luminance4(tex_rgba);
+    build->colors[index] = Color(tex_rgba.r, tex_rgba.g, tex_rgba.b);
+  }
+
+  return LoopStatus::Continue;
+}
+
+EnvironmentSampler::EnvironmentSampler() : table_(), colors_(), xres_(0), yres_(0)
+{
+}
+
+EnvironmentSampler::~EnvironmentSampler()
+{
+}
+
+int EnvironmentSampler::Build(Texture *texture, int sample_xres, int sample_yres)
+{
+  if (texture == NULL || sample_xres < 1 || sample_yres < 1) {
+    return -1;
+  }
+
+  const int NPIXELS = sample_xres * sample_yres;
+  std::vector<double> luminances(NPIXELS);
+  colors_.resize(NPIXELS);
+  xres_ = sample_xres;
+  yres_ = sample_yres;
+
+  EnvironmentBuild build;
+  build.texture = texture;
+  build.xres = sample_xres;
+  build.yres = sample_yres;
+  build.luminances = &luminances[0];
+  build.colors = &colors_[0];
+
+  std::vector<int> row_que(sample_yres);
+  for (int y = 0; y < sample_yres; y++) {
+    row_que[y] = y;
+  }
+  MtRunParallelLoop(&build, lookup_environment_row_task,
+      MtGetMaxAvailableThreadCount(), row_que);
+
+  table_.Build(&luminances[0], NPIXELS);
+
+  return 0;
+}
+
+bool EnvironmentSampler::IsEmpty() const
+{
+  return table_.GetCount() == 0;
+}
+
+DomeSample EnvironmentSampler::Sample(const Vector2 &uv) const
+{
+  double v_jitter = 0;
+  const int index = table_.Sample(uv[0], &v_jitter);
+  const int x = index % xres_;
+  const int y = index / xres_;
+
+  DomeSample sample;
+  sample.uv.u = (x + uv[1]) / xres_;
+  sample.uv.v = 1. - ((y + v_jitter) / yres_);
+  uv_to_dir(sample.uv.u, sample.uv.v, &sample.dir);
+  sample.color = colors_[index];
+
+  return sample;
+}
+
+int EnvironmentSampler::GetPixelCount() const
+{
+  return table_.GetCount();
+}
+
+void EnvironmentSampler::GetPixel(int index, Vector *dir, Color *color,
+    double *probability) const
+{
+  const int x = index % xres_;
+  const int y = index / xres_;
+
+  uv_to_dir((x + .5) / xres_, 1. - ((y + .5) / yres_), dir);
+  *color = colors_[index];
+  *probability = table_.GetProbability(index);
+}
+
 int ImportanceSampling(Texture *texture, int seed,
     int sample_xres, int sample_yres,
     DomeSample *dome_samples, int sample_count)
@@ -269,11 +457,11 @@ static void uv_to_dir(float u, float v, Vector *dir)
 {
   const double phi = 2 * PI * u;
   const double theta = PI * (v - .5);
-  const double r = cos(theta);
+  const double r = Cos(theta);
 
-  dir->x = r * sin(phi);
-  dir->y = sin(theta);
-  dir->z = r * cos(phi);
+  dir->x = r * Sin(phi);
+  dir->y = Sin(theta);
+  dir->z = r * Cos(phi);
 }
 
 static void setup_structured_importance_sampling(Texture *texture,
@@ -4,9 +4,11 @@
 #ifndef FJ_IMPORTANCE_SAMPLING_H
 #define FJ_IMPORTANCE_SAMPLING_H
 
+#include "fj_compatibility.h"
 #include "fj_tex_coord.h"
 #include "fj_vector.h"
 #include "fj_color.h"
+#include <vector>
 
 namespace fj {
 
@@ -35,6 +37,53 @@ extern int StructuredImportanceSampling(Texture *texture, int seed,
     int sample_xres, int sample_yres,
     DomeSample *dome_samples, int sample_count);
 
+// Draws indices in proportion to their weights in constant time with
+// the alias method. all zero weights are drawn uniformly
+class FJ_API AliasTable {
+public:
+  AliasTable();
+  ~AliasTable();
+
+  void Build(const double *weights, int count);
+  int GetCount() const;
+  double GetProbability(int index) const;
+
+  // u is uniform in [0, 1). u_remapped is the rest of u after the index
+  // is chosen and is uniform in [0, 1) again
+  int Sample(double u, double *u_remapped) const;
+
+private:
+  std::vector<double> thresholds_;
+  std::vector<int> aliases_;
+  std::vector<double> probabilities_;
+};
+
+// Draws directions of an environment map in proportion to luminance of
+// pixels of the sample resolution. pixels are looked up in parallel
+// when built and draws take constant time
+class FJ_API EnvironmentSampler {
+public:
+  EnvironmentSampler();
+  ~EnvironmentSampler();
+
+  int Build(Texture *texture, int sample_xres, int sample_yres);
+  bool IsEmpty() const;
+
+  // uv is uniform in [0, 1)^2. directions are jittered in the pixel
+  // and have the color of the pixel center
+  DomeSample Sample(const Vector2 &uv) const;
+
+  // pixels of the sample resolution with the direction of the center and
+  // the probability each is drawn, e.g. for integrals over the distribution
+  int GetPixelCount() const;
+  void GetPixel(int index, Vector *dir, Color *color, double *probability) const;
+
+private:
+  AliasTable table_;
+  std::vector<Color> colors_;
+  int xres_, yres_;
+};
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -31,7 +31,8 @@ public:
       object(NULL),
       prim_id(0),
       shading_group_id(0),
-      t_hit(REAL_MAX) {}
+      t_hit(REAL_MAX),
+      prim_uv() {}
   ~Intersection() {}
 
   Vector P;
@@ -47,6 +48,9 @@ public:
   int shading_group_id;
 
   Real t_hit;
+  // where the primitive is hit e.g. barycentric coordinates of triangles.
+  // the attributes above are computed from it once for the closest hit
+  Vector2 prim_uv;
 
   const Shader *GetShader() const
   {
@@ -54,6 +58,51 @@ public:
   }
 };
 
+// The closest hits of a ray up to MAX_HIT_COUNT in the order of distance.
+// layers of transparent surfaces are collected in one traversal by
+// Accelerator::IntersectAll
+class HitList {
+public:
+  HitList() : count_(0) {}
+  ~HitList() {}
+
+  enum { MAX_HIT_COUNT = 8 };
+
+  void Clear() { count_ = 0; }
+  // ignored if it is farther than the last one of a full list or if the
+  // same hit is already in the list e.g. primitives split into bvh leaves
+  void Add(const Intersection &isect)
+  {
+    if (isect.t_hit >= GetMaxDistance()) {
+      return;
+    }
+    for (int i = 0; i < count_; i++) {
+      const Intersection &hit = hits_[i];
+      if (hit.t_hit == isect.t_hit && hit.prim_id == isect.prim_id &&
+          hit.object == isect.object) {
+        return;
+      }
+    }
+    int i = count_ < MAX_HIT_COUNT ? count_++ : MAX_HIT_COUNT - 1;
+    for (; i > 0 && hits_[i - 1].t_hit > isect.t_hit; i--) {
+      hits_[i] = hits_[i - 1];
+    }
+    hits_[i] = isect;
+  }
+  int GetCount() const { return count_; }
+  bool IsFull() const { return count_ == MAX_HIT_COUNT; }
+  // hits farther than this are not kept
+  Real GetMaxDistance() const
+  {
+    return IsFull() ? hits_[MAX_HIT_COUNT - 1].t_hit : REAL_MAX;
+  }
+  const Intersection &Get(int index) const { return hits_[index]; }
+
+private:
+  Intersection hits_[MAX_HIT_COUNT];
+  int count_;
+};
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -3,17 +3,17 @@
 
 #include "fj_interval.h"
 #include "fj_numeric.h"
+#include <cassert>
 
 namespace fj {
 
-static void free_interval_nodes(Interval *head);
-static int closer_than(const Interval *interval, const Interval *other);
-static Interval *dup_interval(const Interval &src);
-static void free_interval(Interval *interval);
-
 IntervalList::IntervalList() :
-    root_(),
-    num_nodes_(0),
+    inline_intervals_(),
+    intervals_(inline_intervals_),
+    count_(0),
+    capacity_(INLINE_CAPACITY),
+    arena_mark_(),
+    is_in_arena_(false),
     tmin_(REAL_MAX),
     tmax_(-REAL_MAX)
 {
@@ -21,29 +21,40 @@ IntervalList::IntervalList() :
 
 IntervalList::~IntervalList()
 {
-  free_interval_nodes(root_.next);
+  // lists live in nested scopes of tracing so nothing allocated after
+  // this list outlives it
+  if (is_in_arena_) {
+    MemoryArenaGetThreadLocal().Rewind(arena_mark_);
+  }
 }
 
 void IntervalList::Push(const Interval &interval)
 {
-  Interval *new_node = dup_interval(interval);
-  Interval *current = NULL;
-
-  for (current = &root_; current != NULL; current = current->next) {
-    if (current->next == NULL || closer_than(&interval, current->next)) {
-      new_node->next = current->next;
-      current->next = new_node;
-      break;
-    }
+  if (count_ == capacity_) {
+    grow();
+  }
+
+  // insertion sort. usually only a few volumes overlap
+  int i = count_;
+  for (; i > 0 && interval.tmin < intervals_[i - 1].tmin; i--) {
+    intervals_[i] = intervals_[i - 1];
   }
-  num_nodes_++;
+  intervals_[i] = interval;
+
+  count_++;
   tmin_ = Min(tmin_, interval.tmin);
   tmax_ = Max(tmax_, interval.tmax);
 }
 
 int IntervalList::GetCount() const
 {
-  return num_nodes_;
+  return count_;
+}
+
+const Interval &IntervalList::Get(int index) const
+{
+  assert(index >= 0 && index < count_);
+  return intervals_[index];
 }
 
 Real IntervalList::GetMinT() const
@@ -56,43 +67,24 @@ Real IntervalList::GetMaxT() const
   return tmax_;
 }
 
-const Interval *IntervalList::GetHead() const
-{
-  return root_.next;
-}
-
-static void free_interval_nodes(Interval *head)
+void IntervalList::grow()
 {
-  Interval *current = head;
+  MemoryArena &arena = MemoryArenaGetThreadLocal();
 
-  while (current != NULL) {
-    Interval *kill = current;
-    Interval *next = current->next;
-    free_interval(kill);
-    current = next;
+  if (!is_in_arena_) {
+    arena_mark_ = arena.GetMark();
+    is_in_arena_ = true;
   }
-}
-
-static int closer_than(const Interval *interval, const Interval *other)
-{
-  if (interval->tmin < other->tmin)
-    return 1;
-  else
-    return 0;
-}
-
-static Interval *dup_interval(const Interval &src)
-{
-  Interval *new_interval = new Interval(src);
-
-  new_interval->next = NULL;
 
-  return new_interval;
-}
+  // the old array in the arena is released together when rewound
+  const int new_capacity = 2 * capacity_;
+  Interval *new_intervals = arena.NewArray<Interval>(new_capacity);
+  for (int i = 0; i < count_; i++) {
+    new_intervals[i] = intervals_[i];
+  }
 
-static void free_interval(Interval *interval)
-{
-  delete interval;
+  intervals_ = new_intervals;
+  capacity_ = new_capacity;
 }
 
 } // namespace xxx
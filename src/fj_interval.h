@@ -4,12 +4,12 @@
 #ifndef FJ_INTERVAL_H
 #define FJ_INTERVAL_H
 
+#include "fj_memory_arena.h"
 #include "fj_types.h"
 #include <cstddef>
 
 namespace fj {
 
-class IntervalList;
 class ObjectInstance;
 
 // ray-march interval for volumetric object
@@ -18,8 +18,7 @@ public:
   Interval() :
       tmin(0),
       tmax(0),
-      object(NULL),
-      next(NULL)
+      object(NULL)
   {}
   ~Interval() {}
 
@@ -27,9 +26,10 @@ public:
   Real tmin;
   Real tmax;
   const ObjectInstance *object;
-  Interval *next;
 };
 
+// intervals sorted by tmin. a few intervals are kept in the list itself
+// and more are moved to the thread arena
 class IntervalList {
 public:
   IntervalList();
@@ -37,15 +37,26 @@ public:
 
   void Push(const Interval &interval);
   int GetCount() const;
+  const Interval &Get(int index) const;
 
   Real GetMinT() const;
   Real GetMaxT() const;
 
-  const Interval *GetHead() const;
-
 private:
-  Interval root_;
-  int num_nodes_;
+  IntervalList(const IntervalList &);
+  const IntervalList &operator=(const IntervalList &);
+
+  void grow();
+
+  static const int INLINE_CAPACITY = 4;
+
+  Interval inline_intervals_[INLINE_CAPACITY];
+  Interval *intervals_;
+  int count_;
+  int capacity_;
+  // taken when intervals are moved to the arena
+  MemoryArena::Mark arena_mark_;
+  bool is_in_arena_;
   Real tmin_;
   Real tmax_;
 };
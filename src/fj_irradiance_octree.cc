@@ -0,0 +1,175 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_irradiance_octree.h"
+#include "fj_numeric.h"
+#include <algorithm>
+
+namespace fj {
+
+// points in a leaf evaluated one by one
+static const int MAX_LEAF_POINTS = 8;
+// stops splitting points at the same position
+static const int MAX_DEPTH = 24;
+
+static Real distance_sq_to_box(const Box &box, const Vector &P)
+{
+  Real dist_sq = 0;
+  for (int i = 0; i < 3; i++) {
+    const Real d = Max(Max(box.min[i] - P[i], P[i] - box.max[i]), 0.);
+    dist_sq += d * d;
+  }
+  return dist_sq;
+}
+
+IrradianceOctree::IrradianceOctree() : points_(), nodes_()
+{
+}
+
+IrradianceOctree::~IrradianceOctree()
+{
+}
+
+void IrradianceOctree::Build(const std::vector<IrradiancePoint> &points)
+{
+  points_ = points;
+  nodes_.clear();
+
+  if (points_.empty()) {
+    return;
+  }
+
+  // a cube keeps children cubic
+  Box bounds(points_[0].P, points_[0].P);
+  for (std::size_t i = 1; i < points_.size(); i++) {
+    bounds.AddPoint(points_[i].P);
+  }
+  const Vector center = bounds.Centroid();
+  const Vector diagonal = bounds.Diagonal();
+  const Real half = .5 * Max(Max(diagonal[0], diagonal[1]), diagonal[2]);
+  bounds = Box(center - Vector(half, half, half), center + Vector(half, half, half));
+
+  build_node(bounds, 0, points_.size(), 0);
+}
+
+bool IrradianceOctree::IsEmpty() const
+{
+  return nodes_.empty();
+}
+
+int IrradianceOctree::GetPointCount() const
+{
+  return points_.size();
+}
+
+Color IrradianceOctree::Evaluate(const Vector &P, Real max_solid_angle,
+    DiffusionProfile profile, void *data) const
+{
+  if (IsEmpty()) {
+    return Color();
+  }
+  return evaluate_node(0, P, max_solid_angle, profile, data);
+}
+
+int IrradianceOctree::build_node(const Box &bounds, int begin, int end, int depth)
+{
+  const int node_index = nodes_.size();
+  nodes_.push_back(Node());
+
+  Node node;
+  node.bounds = bounds;
+  node.begin = begin;
+  node.end = end;
+
+  for (int i = begin; i < end; i++) {
+    const IrradiancePoint &point = points_[i];
+    node.P += point.area * point.P;
+    node.E += point.area * point.E;
+    node.area += point.area;
+  }
+  if (node.area > 0) {
+    node.P /= node.area;
+    node.E *= 1. / node.area;
+  }
+
+  if (end - begin > MAX_LEAF_POINTS && depth < MAX_DEPTH) {
+    // points are sorted by octant of the center
+    const Vector center = bounds.Centroid();
+    int octant_begin[9] = {0};
+    std::vector<int> octants(end - begin);
+    for (int i = begin; i < end; i++) {
+      const Vector &P = points_[i].P;
+      const int octant =
+          (P[0] > center[0]) |
+          (P[1] > center[1]) << 1 |
+          (P[2] > center[2]) << 2;
+      octants[i - begin] = octant;
+      octant_begin[octant + 1]++;
+    }
+    for (int i = 0; i < 8; i++) {
+      octant_begin[i + 1] += octant_begin[i];
+    }
+
+    std::vector<IrradiancePoint> sorted(end - begin);
+    std::vector<int> next(octant_begin, octant_begin + 8);
+    for (int i = begin; i < end; i++) {
+      sorted[next[octants[i - begin]]++] = points_[i];
+    }
+    std::copy(sorted.begin(), sorted.end(), points_.begin() + begin);
+
+    for (int i = 0; i < 8; i++) {
+      const int child_begin = begin + octant_begin[i];
+      const int child_end = begin + octant_begin[i + 1];
+      if (child_begin == child_end) {
+        continue;
+      }
+      Box child_bounds(bounds.min, center);
+      for (int axis = 0; axis < 3; axis++) {
+        if (i & (1 << axis)) {
+          child_bounds.min[axis] = center[axis];
+          child_bounds.max[axis] = bounds.max[axis];
+        }
+      }
+      node.children[i] = build_node(child_bounds, child_begin, child_end, depth + 1);
+    }
+    node.begin = node.end = 0;
+  }
+
+  nodes_[node_index] = node;
+  return node_index;
+}
+
+Color IrradianceOctree::evaluate_node(int index, const Vector &P, Real max_solid_angle,
+    DiffusionProfile profile, void *data) const
+{
+  const Node &node = nodes_[index];
+
+  // far nodes as one point
+  const Real dist_sq_box = distance_sq_to_box(node.bounds, P);
+  if (dist_sq_box > 0) {
+    const Vector D = node.P - P;
+    const Real dist_sq = Dot(D, D);
+    if (node.area < max_solid_angle * dist_sq) {
+      return profile(data, dist_sq) * node.E * node.area;
+    }
+  }
+
+  Color sum;
+  if (node.begin < node.end) {
+    for (int i = node.begin; i < node.end; i++) {
+      const IrradiancePoint &point = points_[i];
+      const Vector D = point.P - P;
+      sum += profile(data, Dot(D, D)) * point.E * point.area;
+    }
+    return sum;
+  }
+
+  for (int i = 0; i < 8; i++) {
+    if (node.children[i] >= 0) {
+      sum += evaluate_node(node.children[i], P, max_solid_angle, profile, data);
+    }
+  }
+  return sum;
+}
+
+} // namespace xxx
@@ -0,0 +1,80 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_IRRADIANCE_OCTREE_H
+#define FJ_IRRADIANCE_OCTREE_H
+
+#include "fj_compatibility.h"
+#include "fj_vector.h"
+#include "fj_color.h"
+#include "fj_types.h"
+#include "fj_box.h"
+#include <vector>
+
+namespace fj {
+
+class IrradiancePoint {
+public:
+  IrradiancePoint() : P(), N(), E(), area(0) {}
+  ~IrradiancePoint() {}
+
+  Vector P;
+  Vector N;
+  Color E;
+  // of the surface the point stands for
+  Real area;
+};
+
+// returns the diffuse reflectance of each channel at the squared distance
+typedef Color (*DiffusionProfile)(void *data, Real distance_sq);
+
+// An octree of irradiance points on a surface for subsurface scattering
+// evaluated hierarchically. nodes far enough away for their solid angle
+// are used as one point of the total area and area weighted irradiance
+// and position (Jensen and Buhler 2002)
+class FJ_API IrradianceOctree {
+public:
+  IrradianceOctree();
+  ~IrradianceOctree();
+
+  void Build(const std::vector<IrradiancePoint> &points);
+  bool IsEmpty() const;
+  int GetPointCount() const;
+
+  // sum of profile * E * area over all points. nodes whose area over
+  // squared distance is below max_solid_angle are not opened
+  Color Evaluate(const Vector &P, Real max_solid_angle,
+      DiffusionProfile profile, void *data) const;
+
+private:
+  class Node {
+  public:
+    Node() : bounds(), P(), E(), area(0), begin(0), end(0)
+    {
+      for (int i = 0; i < 8; i++) {
+        children[i] = -1;
+      }
+    }
+    ~Node() {}
+
+    Box bounds;
+    // area weighted
+    Vector P;
+    Color E;
+    Real area;
+    // points of leaves
+    int begin, end;
+    int children[8];
+  };
+
+  int build_node(const Box &bounds, int begin, int end, int depth);
+  Color evaluate_node(int index, const Vector &P, Real max_solid_angle,
+      DiffusionProfile profile, void *data) const;
+
+  std::vector<IrradiancePoint> points_;
+  std::vector<Node> nodes_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,50 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_level_of_detail.h"
+#include "fj_numeric.h"
+#include <cstdint>
+#include <cmath>
+
+namespace fj {
+
+// a few primitives widened to cover the whole object look like blobs
+static const Real MIN_KEEP_FRACTION = 1. / 256;
+
+Real LodComputeKeepFraction(Real size, Real pixel_size, Real lod_width,
+    int dimension)
+{
+  if (lod_width <= 0 || pixel_size <= 0 || size <= 0) {
+    return 1;
+  }
+
+  const Real coverage = size / (lod_width * pixel_size);
+  if (coverage >= 1) {
+    return 1;
+  }
+
+  // steps of a quarter octave so that small moves of the camera don't
+  // rebuild accelerators
+  const Real fraction = dimension == 2 ? coverage * coverage : coverage;
+  const Real stepped = std::exp2(std::floor(4 * std::log2(fraction)) / 4);
+  return Max(stepped, MIN_KEEP_FRACTION);
+}
+
+bool LodIsKept(Index id, Real fraction)
+{
+  if (fraction >= 1) {
+    return true;
+  }
+
+  uint64_t h = static_cast<uint64_t>(id);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  // 53 bits to [0, 1)
+  return (h >> 11) * (1. / (1ULL << 53)) < fraction;
+}
+
+} // namespace xxx
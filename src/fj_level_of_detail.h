@@ -0,0 +1,29 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_LEVEL_OF_DETAIL_H
+#define FJ_LEVEL_OF_DETAIL_H
+
+#include "fj_compatibility.h"
+#include "fj_types.h"
+
+namespace fj {
+
+// Stochastic simplification of hair and particles. Primitives smaller than
+// lod_width pixels are pruned at random down to the keep fraction and the
+// rest are widened by the inverse so that they cover the same area of the
+// screen.
+
+// size is the mean width of strands (dimension 1) or of points
+// (dimension 2) and pixel_size is the size of a pixel in the same space.
+// 1 if lod_width is 0 or they are large enough
+FJ_API Real LodComputeKeepFraction(Real size, Real pixel_size, Real lod_width,
+    int dimension);
+
+// The same primitives are kept each time, and primitives kept for a fraction
+// are also kept for larger ones so that pruning grows smoothly with distance.
+FJ_API bool LodIsKept(Index id, Real fraction);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -4,8 +4,10 @@
 #include "fj_light.h"
 #include "fj_framebuffer_io.h"
 #include "fj_framebuffer.h"
+#include "fj_memory_arena.h"
 #include "fj_numeric.h"
 #include "fj_texture.h"
+#include <algorithm>
 
 namespace fj {
 
@@ -18,7 +20,16 @@ Light::Light() :
   sample_count_(16),
   sample_intensity_(intensity_ / sample_count_),
 
-  environment_map_(NULL)
+  environment_map_(NULL),
+  sh_irradiance_(SH_IRRADIANCE_OFF),
+  visible_sampling_(false),
+  adaptive_sampling_(false),
+
+  sample_sets_(),
+  sample_set_count_(0),
+  sample_points_(),
+  set_points_(),
+  bounds_()
 {
   XfmInitTransformSampleList(&transform_samples_);
 }
@@ -56,6 +67,30 @@ void Light::SetEnvironmentMap(Texture *texture)
   environment_map_ = texture;
 }
 
+void Light::SetSHIrradiance(int mode)
+{
+  switch (mode) {
+  case SH_IRRADIANCE_OFF:
+  case SH_IRRADIANCE_UNSHADOWED:
+  case SH_IRRADIANCE_OCCLUDED:
+    sh_irradiance_ = mode;
+    break;
+  default:
+    sh_irradiance_ = SH_IRRADIANCE_OFF;
+    break;
+  }
+}
+
+void Light::SetVisibleSampling(bool on_or_off)
+{
+  visible_sampling_ = on_or_off;
+}
+
+void Light::SetAdaptiveSampling(bool on_or_off)
+{
+  adaptive_sampling_ = on_or_off;
+}
+
 Color Light::GetColor() const
 {
   return color_;
@@ -81,6 +116,21 @@ Texture *Light::GetEnvironmentMap() const
   return environment_map_;
 }
 
+int Light::GetSHIrradiance() const
+{
+  return sh_irradiance_;
+}
+
+bool Light::IsVisibleSampling() const
+{
+  return visible_sampling_;
+}
+
+bool Light::IsAdaptiveSampling() const
+{
+  return adaptive_sampling_;
+}
+
 void Light::SetTranslate(Real tx, Real ty, Real tz, Real time)
 {
   XfmPushTranslateSample(&transform_samples_, tx, ty, tz, time);
@@ -106,9 +156,23 @@ void Light::SetRotateOrder(int order)
   XfmSetSampleRotateOrder(&transform_samples_, order);
 }
 
-void Light::GetSamples(LightSample *samples, int max_samples) const
+void Light::SetTimeOffset(Real time_offset)
 {
-  get_samples(samples, max_samples);
+  XfmSetSampleTimeOffset(&transform_samples_, time_offset);
+}
+
+const LightSample *Light::GetSampleSet(SampleSequence &sequence) const
+{
+  if (sample_set_count_ == 0 && !sample_points_.empty()) {
+    return draw_samples(sequence);
+  }
+  if (sample_set_count_ < 2) {
+    return sample_sets_.empty() ? NULL : &sample_sets_[0];
+  }
+
+  const int set = static_cast<int>(sequence.Next1D() * sample_set_count_);
+  const int NSAMPLES = GetSampleCount();
+  return &sample_sets_[std::min(set, sample_set_count_ - 1) * NSAMPLES];
 }
 
 int Light::GetSampleCount() const
@@ -116,14 +180,104 @@ int Light::GetSampleCount() const
   return get_sample_count();
 }
 
+bool Light::HasSamplesAt() const
+{
+  return visible_sampling_ && has_samples_at();
+}
+
+const LightSample *Light::GetSamplesAt(SampleSequence &sequence, const Vector &Ps,
+    int *sample_count) const
+{
+  const int NSAMPLES = sample_points_.size();
+  if (NSAMPLES == 0) {
+    *sample_count = 0;
+    return NULL;
+  }
+
+  // the points of a sample set are more uniform than shifted points
+  const Vector2 *points = NULL;
+  if (set_points_.empty()) {
+    points = shift_sample_points(sequence);
+  } else {
+    const int set = static_cast<int>(sequence.Next1D() * sample_set_count_);
+    points = &set_points_[std::min(set, sample_set_count_ - 1) * NSAMPLES];
+  }
+  LightSample *samples = MemoryArenaGetThreadLocal().NewArray<LightSample>(NSAMPLES);
+  *sample_count = get_samples_at(samples, NSAMPLES, points, Ps);
+
+  return samples;
+}
+
+const Box &Light::GetBounds() const
+{
+  return bounds_;
+}
+
 Color Light::Illuminate(const LightSample &sample, const Vector &Ps) const
 {
   return illuminate(sample, Ps);
 }
 
+bool Light::HasIrradiance() const
+{
+  return has_irradiance();
+}
+
+Color Light::Irradiance(const Vector &N) const
+{
+  return irradiance(N);
+}
+
 int Light::Preprocess()
 {
-  return preprocess();
+  const int err = preprocess();
+  if (err) {
+    return err;
+  }
+
+  const int NSAMPLES = GetSampleCount();
+  sample_set_count_ = NSAMPLES > 0 ? get_sample_set_count() : 0;
+  sample_sets_.assign(sample_set_count_ * NSAMPLES, LightSample());
+
+  // consecutive sobol points of each set are stratified
+  std::vector<Vector2> points(NSAMPLES);
+  set_points_.clear();
+  for (int set = 0; set < std::max(sample_set_count_, 1); set++) {
+    for (int i = 0; i < NSAMPLES; i++) {
+      SampleSequence sequence;
+      sequence.Start(SAMPLE_SEQUENCE_SOBOL, set * NSAMPLES + i, 0, NULL);
+      points[i] = sequence.Next2D();
+    }
+    if (set == 0) {
+      sample_points_ = points;
+    }
+    if (sample_set_count_ > 1 && has_samples_at()) {
+      set_points_.insert(set_points_.end(), points.begin(), points.end());
+    }
+    if (sample_set_count_ > 0) {
+      get_samples(&sample_sets_[set * NSAMPLES], NSAMPLES, &points[0]);
+    }
+  }
+
+  // bounds of lights drawing samples on demand are of unshifted points
+  std::vector<LightSample> unshifted;
+  if (sample_set_count_ == 0 && NSAMPLES > 0) {
+    unshifted.resize(NSAMPLES);
+    get_samples(&unshifted[0], NSAMPLES, &sample_points_[0]);
+  }
+  const std::vector<LightSample> &samples = unshifted.empty() ? sample_sets_ : unshifted;
+
+  bounds_ = Box();
+  for (std::size_t i = 0; i < samples.size(); i++) {
+    const Vector &P = samples[i].P;
+    if (i == 0) {
+      bounds_ = Box(P, P);
+    } else {
+      bounds_.AddPoint(P);
+    }
+  }
+
+  return 0;
 }
 
 void Light::get_transform_sample(Transform &sample, Real time) const
@@ -137,4 +291,30 @@ float Light::get_sample_intensity() const
   return sample_intensity_;
 }
 
+const LightSample *Light::draw_samples(SampleSequence &sequence) const
+{
+  const int NSAMPLES = sample_points_.size();
+  const Vector2 *points = shift_sample_points(sequence);
+  LightSample *samples = MemoryArenaGetThreadLocal().NewArray<LightSample>(NSAMPLES);
+  get_samples(samples, NSAMPLES, points);
+
+  return samples;
+}
+
+Vector2 *Light::shift_sample_points(SampleSequence &sequence) const
+{
+  // stratified points shifted by the same random offset stay stratified
+  const int NSAMPLES = sample_points_.size();
+  const Vector2 shift = sequence.Next2D();
+  Vector2 *points = MemoryArenaGetThreadLocal().NewArray<Vector2>(NSAMPLES);
+
+  for (int i = 0; i < NSAMPLES; i++) {
+    for (int j = 0; j < 2; j++) {
+      const Real x = sample_points_[i][j] + shift[j];
+      points[i][j] = x < 1 ? x : x - 1;
+    }
+  }
+  return points;
+}
+
 } // namespace xxx
@@ -10,6 +10,7 @@
 #include "fj_vector.h"
 #include "fj_color.h"
 #include "fj_types.h"
+#include "fj_box.h"
 #include <vector>
 
 namespace fj {
@@ -17,15 +18,34 @@ namespace fj {
 class Light;
 class Texture;
 
+// sample sets of each light made by Preprocess(). the set for a shading
+// point is chosen at random. lights with no sets draw samples on demand
+const int LIGHT_SAMPLE_SET_COUNT = 64;
+// the least samples of adaptive sampling whose shadow rays are always
+// traced. the first points of a sample set are stratified over the light
+const int LIGHT_PROBE_SAMPLE_COUNT = 8;
+
+// diffuse lighting of lights projected to spherical harmonics
+enum SHIrradianceMode {
+  SH_IRRADIANCE_OFF = 0,
+  // no shadow rays
+  SH_IRRADIANCE_UNSHADOWED,
+  // one shadow ray of a cosine weighted direction as ambient occlusion
+  SH_IRRADIANCE_OCCLUDED
+};
+
 class LightSample {
 public:
-  LightSample() : light(NULL), P(), N(), color() {}
+  LightSample() : light(NULL), P(), N(), color(), weight(1) {}
   ~LightSample() {}
 
   const Light *light;
   Vector P;
   Vector N;
   Color color;
+  // multiplied to the light color. lights drawn by their contribution
+  // weight samples by the inverse of the probability
+  float weight;
 };
 
 class Light {
@@ -40,12 +60,24 @@ public:
   void SetSampleCount(int sample_count);
   void SetDoubleSided(bool on_or_off);
   void SetEnvironmentMap(Texture *texture);
+  // one of SHIrradianceMode. lights supporting it give one sample
+  // for diffuse irradiance instead of their samples
+  void SetSHIrradiance(int mode);
+  // lights supporting it draw samples of the part seen from each
+  // shading point instead of using the sample sets
+  void SetVisibleSampling(bool on_or_off);
+  // shadow rays of samples after the first probes are traced only when
+  // the visibility of those disagrees. see SlIlluminanceList()
+  void SetAdaptiveSampling(bool on_or_off);
 
   Color GetColor() const;
   float GetIntensity() const;
   int GetSampleDensity() const;
   bool IsDoulbeSided() const;
   Texture *GetEnvironmentMap() const;
+  int GetSHIrradiance() const;
+  bool IsVisibleSampling() const;
+  bool IsAdaptiveSampling() const;
 
   // transformation
   void SetTranslate(Real tx, Real ty, Real tz, Real time);
@@ -53,11 +85,31 @@ public:
   void SetScale(Real sx, Real sy, Real sz, Real time);
   void SetTransformOrder(int order);
   void SetRotateOrder(int order);
+  // transform samples are looked up at time + time_offset
+  void SetTimeOffset(Real time_offset);
 
   // samples
-  void GetSamples(LightSample *samples, int max_samples) const;
+  // one of the sample sets made by Preprocess() chosen with the sequence of
+  // the sample being shaded. samples in a set are stratified on the light.
+  // has GetSampleCount() samples. samples drawn on demand live in the
+  // thread memory arena until the end of the pixel sample
+  const LightSample *GetSampleSet(SampleSequence &sequence) const;
   int GetSampleCount() const;
+  // bounds of sample positions made by Preprocess()
+  // true if visible sampling is on and the light supports it
+  bool HasSamplesAt() const;
+  // samples of the part of the light seen from Ps weighted by the share of
+  // the part so that they sum to what GetSampleSet() samples sum to. at most
+  // GetSampleCount() samples in the thread memory arena. no samples if no
+  // part is seen
+  const LightSample *GetSamplesAt(SampleSequence &sequence, const Vector &Ps,
+      int *sample_count) const;
+  const Box &GetBounds() const;
   Color Illuminate(const LightSample &sample, const Vector &Ps) const;
+  // true if the light was projected for irradiance by Preprocess()
+  bool HasIrradiance() const;
+  // unshadowed irradiance at normal N in constant time
+  Color Irradiance(const Vector &N) const;
   int Preprocess();
 
 protected:
@@ -75,11 +127,36 @@ private:
   int sample_count_;
   float sample_intensity_;
   Texture *environment_map_;
+  int sh_irradiance_;
+  bool visible_sampling_;
+  bool adaptive_sampling_;
+
+  const LightSample *draw_samples(SampleSequence &sequence) const;
+  Vector2 *shift_sample_points(SampleSequence &sequence) const;
+
+  std::vector<LightSample> sample_sets_;
+  int sample_set_count_;
+  // shifted by the sequence for samples drawn on demand
+  std::vector<Vector2> sample_points_;
+  // points of all sample sets for lights drawing samples at shading points
+  std::vector<Vector2> set_points_;
+  Box bounds_;
 
 private:
   virtual int get_sample_count() const = 0;
-  virtual void get_samples(LightSample *samples, int max_samples) const = 0;
+  // sets of lights whose samples are always the same have one set.
+  // lights cheap to sample with no sets draw samples for each shading
+  virtual int get_sample_set_count() const = 0;
+  // points are stratified in [0, 1)^2, one for each sample
+  virtual void get_samples(LightSample *samples, int max_samples,
+      const Vector2 *points) const = 0;
+  virtual bool has_samples_at() const { return false; }
+  // returns the number of samples of the part seen from Ps
+  virtual int get_samples_at(LightSample *samples, int max_samples,
+      const Vector2 *points, const Vector &Ps) const { return 0; }
   virtual Color illuminate(const LightSample &sample, const Vector &Ps) const = 0;
+  virtual bool has_irradiance() const { return false; }
+  virtual Color irradiance(const Vector &N) const { return Color(); }
   virtual int preprocess() = 0;
 };
 
@@ -0,0 +1,255 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_light_tree.h"
+#include "fj_numeric.h"
+#include "fj_light.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace fj {
+
+// dome lights put samples at FLT_MAX
+static bool is_infinite(const Box &bounds)
+{
+  const Real LIMIT = FLT_MAX * .5;
+  for (int i = 0; i < 3; i++) {
+    if (Abs(bounds.min[i]) > LIMIT || Abs(bounds.max[i]) > LIMIT) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static Real light_power(const Light &light)
+{
+  return light.GetIntensity() * Luminance(light.GetColor());
+}
+
+static Vector box_centroid(const Box &box)
+{
+  return .5 * (box.min + box.max);
+}
+
+LightTree::LightTree() :
+  nodes_(),
+  lights_(),
+  light_bounds_(),
+  light_powers_(),
+  infinite_lights_(),
+  infinite_powers_(),
+  infinite_power_(0)
+{
+}
+
+LightTree::~LightTree()
+{
+}
+
+void LightTree::Build(const Light *const *lights, int light_count)
+{
+  nodes_.clear();
+  lights_.clear();
+  light_bounds_.clear();
+  light_powers_.clear();
+  infinite_lights_.clear();
+  infinite_powers_.clear();
+  infinite_power_ = 0;
+
+  for (int i = 0; i < light_count; i++) {
+    const Light *light = lights[i];
+    const Real power = light_power(*light);
+    if (power <= 0 || light->GetSampleCount() == 0) {
+      continue;
+    }
+
+    if (is_infinite(light->GetBounds())) {
+      infinite_lights_.push_back(light);
+      infinite_powers_.push_back(power);
+      infinite_power_ += power;
+    } else {
+      lights_.push_back(light);
+      light_bounds_.push_back(light->GetBounds());
+      light_powers_.push_back(power);
+    }
+  }
+
+  if (lights_.empty()) {
+    return;
+  }
+
+  std::vector<int> indices(lights_.size());
+  for (std::size_t i = 0; i < indices.size(); i++) {
+    indices[i] = i;
+  }
+  nodes_.reserve(2 * lights_.size() - 1);
+  build_node(indices, 0, indices.size());
+}
+
+bool LightTree::IsEmpty() const
+{
+  return nodes_.empty() && infinite_lights_.empty();
+}
+
+const Light *LightTree::Sample(const Vector &P, Real u, Real *pdf) const
+{
+  *pdf = 0;
+  if (IsEmpty()) {
+    return NULL;
+  }
+
+  const Real p_finite = finite_probability(P);
+  // keeps u in [0, 1) after rescaling
+  const Real U_MAX = 1 - DBL_EPSILON;
+
+  if (u >= p_finite) {
+    u = Min((u - p_finite) / (1 - p_finite), U_MAX);
+    Real cdf = 0;
+    const int N = infinite_lights_.size();
+    for (int i = 0; i < N; i++) {
+      const Real p = infinite_powers_[i] / infinite_power_;
+      cdf += p;
+      if (u < cdf || i == N - 1) {
+        *pdf = (1 - p_finite) * p;
+        return infinite_lights_[i];
+      }
+    }
+  }
+
+  u = Min(u / p_finite, U_MAX);
+  Real prob = p_finite;
+  int index = 0;
+
+  while (nodes_[index].light == NULL) {
+    const Node &node = nodes_[index];
+    const Real imp_left = importance(nodes_[node.left], P);
+    const Real imp_right = importance(nodes_[node.right], P);
+    const Real imp_sum = imp_left + imp_right;
+    const Real p_left = imp_sum > 0 ? imp_left / imp_sum : .5;
+
+    if (u < p_left) {
+      u = Min(u / p_left, U_MAX);
+      prob *= p_left;
+      index = node.left;
+    } else {
+      u = Min((u - p_left) / (1 - p_left), U_MAX);
+      prob *= 1 - p_left;
+      index = node.right;
+    }
+  }
+
+  *pdf = prob;
+  return nodes_[index].light;
+}
+
+Real LightTree::Pdf(const Vector &P, const Light *light) const
+{
+  const Real p_finite = finite_probability(P);
+
+  for (std::size_t i = 0; i < infinite_lights_.size(); i++) {
+    if (infinite_lights_[i] == light) {
+      return (1 - p_finite) * infinite_powers_[i] / infinite_power_;
+    }
+  }
+
+  // walks up from the leaf. lights are not looked up while rendering
+  int index = -1;
+  for (std::size_t i = 0; i < nodes_.size(); i++) {
+    if (nodes_[i].light == light) {
+      index = i;
+      break;
+    }
+  }
+  if (index < 0) {
+    return 0;
+  }
+
+  Real prob = p_finite;
+  while (nodes_[index].parent >= 0) {
+    const Node &parent = nodes_[nodes_[index].parent];
+    const Real imp_left = importance(nodes_[parent.left], P);
+    const Real imp_right = importance(nodes_[parent.right], P);
+    const Real imp_sum = imp_left + imp_right;
+    const Real p_left = imp_sum > 0 ? imp_left / imp_sum : .5;
+
+    prob *= parent.left == index ? p_left : 1 - p_left;
+    index = nodes_[index].parent;
+  }
+  return prob;
+}
+
+int LightTree::build_node(std::vector<int> &indices, int begin, int end)
+{
+  const int node_index = nodes_.size();
+  nodes_.push_back(Node());
+
+  Box bounds = light_bounds_[indices[begin]];
+  Box centroid_bounds(box_centroid(bounds), box_centroid(bounds));
+  Real power = 0;
+
+  for (int i = begin; i < end; i++) {
+    const Box &light_bounds = light_bounds_[indices[i]];
+    bounds.AddBox(light_bounds);
+    centroid_bounds.AddPoint(box_centroid(light_bounds));
+    power += light_powers_[indices[i]];
+  }
+
+  nodes_[node_index].bounds = bounds;
+  nodes_[node_index].power = power;
+
+  if (end - begin == 1) {
+    nodes_[node_index].light = lights_[indices[begin]];
+    return node_index;
+  }
+
+  // median split on the longest axis of centroids
+  const Vector extent = centroid_bounds.max - centroid_bounds.min;
+  int axis = 0;
+  if (extent[1] > extent[axis]) axis = 1;
+  if (extent[2] > extent[axis]) axis = 2;
+
+  const int mid = (begin + end) / 2;
+  std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end,
+      [this, axis](int a, int b)
+      {
+        return box_centroid(light_bounds_[a])[axis] < box_centroid(light_bounds_[b])[axis];
+      });
+
+  const int left = build_node(indices, begin, mid);
+  const int right = build_node(indices, mid, end);
+
+  nodes_[node_index].left = left;
+  nodes_[node_index].right = right;
+  nodes_[left].parent = node_index;
+  nodes_[right].parent = node_index;
+
+  return node_index;
+}
+
+Real LightTree::importance(const Node &node, const Vector &P) const
+{
+  // distances inside bounds are clamped to the radius of the bounds
+  // so nearby lights don't get all samples
+  const Vector half = .5 * (node.bounds.max - node.bounds.min);
+  const Vector D = P - box_centroid(node.bounds);
+  const Real radius2 = Dot(half, half);
+  const Real dist2 = Dot(D, D);
+
+  return node.power / Max(Max(dist2, radius2), 1e-6);
+}
+
+Real LightTree::finite_probability(const Vector &P) const
+{
+  if (nodes_.empty()) {
+    return 0;
+  }
+  if (infinite_lights_.empty()) {
+    return 1;
+  }
+
+  // infinite lights are as far as a light at distance 1
+  const Real imp_finite = importance(nodes_[0], P);
+  return imp_finite / (imp_finite + infinite_power_);
+}
+
+} // namespace xxx
@@ -0,0 +1,63 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_LIGHT_TREE_H
+#define FJ_LIGHT_TREE_H
+
+#include "fj_compatibility.h"
+#include "fj_vector.h"
+#include "fj_types.h"
+#include "fj_box.h"
+#include <vector>
+
+namespace fj {
+
+class Light;
+
+// A BVH over lights to draw one light in proportion to its estimated
+// contribution to a point, power over squared distance of each node, in
+// time logarithmic to the number of lights. lights of infinite bounds like
+// dome lights are drawn by power alone. build after lights are preprocessed
+class FJ_API LightTree {
+public:
+  LightTree();
+  ~LightTree();
+
+  void Build(const Light *const *lights, int light_count);
+  bool IsEmpty() const;
+
+  // u is uniform in [0, 1). returns NULL if no lights have power
+  const Light *Sample(const Vector &P, Real u, Real *pdf) const;
+  Real Pdf(const Vector &P, const Light *light) const;
+
+private:
+  class Node {
+  public:
+    Node() : bounds(), power(0), left(-1), right(-1), parent(-1), light(NULL) {}
+    ~Node() {}
+
+    Box bounds;
+    Real power;
+    // children or light for leaves
+    int left, right;
+    int parent;
+    const Light *light;
+  };
+
+  int build_node(std::vector<int> &indices, int begin, int end);
+  Real importance(const Node &node, const Vector &P) const;
+  // probability of drawing one of finite lights over infinite ones
+  Real finite_probability(const Vector &P) const;
+
+  std::vector<Node> nodes_;
+  std::vector<const Light *> lights_;
+  std::vector<Box> light_bounds_;
+  std::vector<Real> light_powers_;
+  std::vector<const Light *> infinite_lights_;
+  std::vector<Real> infinite_powers_;
+  Real infinite_power_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,143 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_MAPPED_ARRAY_H
+#define FJ_MAPPED_ARRAY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace fj {
+
+// An array that owns its elements or refers to read only memory such as
+// a mapped file without copying it. Elements referred to are copied on the
+// first write. The referred memory must be kept alive by the owner.
+template <typename T>
+class MappedArray {
+public:
+  MappedArray() : values_(), data_(NULL), size_(0), is_referring_(false) {}
+  MappedArray(const MappedArray &other) :
+      values_(other.values_), data_(NULL), size_(0), is_referring_(false)
+  {
+    if (other.is_referring_) {
+      Refer(other.data_, other.size_);
+    } else {
+      update_data();
+    }
+  }
+  ~MappedArray() {}
+
+  const MappedArray &operator=(const MappedArray &other)
+  {
+    if (this != &other) {
+      MappedArray tmp(other);
+      swap(tmp);
+    }
+    return *this;
+  }
+
+  void Refer(const T *data, std::size_t size)
+  {
+    std::vector<T>().swap(values_);
+    data_ = data;
+    size_ = size;
+    is_referring_ = true;
+  }
+  bool IsReferring() const
+  {
+    return is_referring_;
+  }
+  // takes the elements of values leaving it empty
+  void Adopt(std::vector<T> *values)
+  {
+    values_.swap(*values);
+    std::vector<T>().swap(*values);
+    is_referring_ = false;
+    update_data();
+  }
+  // copies the elements referred to so the memory can be released
+  void Detach()
+  {
+    own();
+  }
+
+  const T *data() const
+  {
+    return data_;
+  }
+  std::size_t size() const
+  {
+    return size_;
+  }
+  bool empty() const
+  {
+    return size_ == 0;
+  }
+  // bytes owned. the memory referred to is not counted
+  std::size_t GetMemoryUsage() const
+  {
+    return values_.capacity() * sizeof(T);
+  }
+  void resize(std::size_t size)
+  {
+    own();
+    values_.resize(size);
+    update_data();
+  }
+  // frees the memory
+  void clear()
+  {
+    std::vector<T>().swap(values_);
+    is_referring_ = false;
+    update_data();
+  }
+  void swap(MappedArray &other)
+  {
+    values_.swap(other.values_);
+    std::swap(is_referring_, other.is_referring_);
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    if (!is_referring_) {
+      update_data();
+    }
+    if (!other.is_referring_) {
+      other.update_data();
+    }
+  }
+
+  const T &operator[](std::size_t i) const
+  {
+    return data_[i];
+  }
+  T &operator[](std::size_t i)
+  {
+    own();
+    return values_[i];
+  }
+
+private:
+  void own()
+  {
+    if (is_referring_) {
+      values_.assign(data_, data_ + size_);
+      is_referring_ = false;
+      update_data();
+    }
+  }
+  void update_data()
+  {
+    data_ = values_.empty() ? NULL : &values_[0];
+    size_ = values_.size();
+  }
+
+  std::vector<T> values_;
+  // values_ or the memory referred to
+  const T *data_;
+  std::size_t size_;
+  bool is_referring_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,143 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_memory_arena.h"
+#include <cassert>
+#include <cstdint>
+
+namespace fj {
+
+static const std::size_t ALIGNMENT = 16;
+static const std::size_t BLOCK_SIZE = 64 * 1024;
+
+// placed right before each allocation for Free
+class AllocationHeader {
+public:
+  std::size_t prev_offset;
+  std::size_t end_offset;
+};
+
+static const std::size_t HEADER_SIZE =
+    (sizeof(AllocationHeader) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+static std::size_t align_size(std::size_t size)
+{
+  return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+MemoryArena::MemoryArena() :
+    blocks_(),
+    current_block_(0),
+    offset_(0)
+{
+}
+
+MemoryArena::~MemoryArena()
+{
+  for (std::size_t i = 0; i < blocks_.size(); i++) {
+    delete [] blocks_[i].data;
+  }
+}
+
+void *MemoryArena::Allocate(std::size_t size)
+{
+  return AllocateAligned(size, ALIGNMENT);
+}
+
+void *MemoryArena::AllocateAligned(std::size_t size, std::size_t alignment)
+{
+  if (alignment < ALIGNMENT) {
+    alignment = ALIGNMENT;
+  }
+  const std::size_t total_size = HEADER_SIZE + align_size(size);
+  std::size_t padding = 0;
+
+  for (;;) {
+    if (current_block_ == static_cast<int>(blocks_.size())) {
+      // new[] of char is 16 byte aligned. larger alignments need padding
+      const std::size_t min_size = total_size + alignment - ALIGNMENT;
+      Block block;
+      block.size = min_size > BLOCK_SIZE ? min_size : BLOCK_SIZE;
+      block.data = new char[block.size];
+      blocks_.push_back(block);
+    }
+
+    const Block &block = blocks_[current_block_];
+    const uintptr_t address =
+        reinterpret_cast<uintptr_t>(block.data) + offset_ + HEADER_SIZE;
+    padding = (alignment - address % alignment) % alignment;
+    if (offset_ + padding + total_size <= block.size) {
+      break;
+    }
+    // the rest of this block is wasted until reset
+    current_block_++;
+    offset_ = 0;
+  }
+
+  char *data = blocks_[current_block_].data + offset_ + padding;
+  AllocationHeader *header = reinterpret_cast<AllocationHeader *>(data);
+  // Free goes back to before the padding
+  header->prev_offset = offset_;
+  header->end_offset = offset_ + padding + total_size;
+
+  offset_ = header->end_offset;
+  return data + HEADER_SIZE;
+}
+
+void MemoryArena::Free(void *ptr)
+{
+  if (ptr == NULL || current_block_ >= static_cast<int>(blocks_.size())) {
+    return;
+  }
+
+  const Block &block = blocks_[current_block_];
+  char *data = static_cast<char *>(ptr) - HEADER_SIZE;
+  if (data < block.data || data >= block.data + block.size) {
+    return;
+  }
+
+  const AllocationHeader *header = reinterpret_cast<const AllocationHeader *>(data);
+  if (header->end_offset == offset_) {
+    offset_ = header->prev_offset;
+  }
+}
+
+MemoryArena::Mark MemoryArena::GetMark() const
+{
+  Mark mark;
+  mark.block = current_block_;
+  mark.offset = offset_;
+  return mark;
+}
+
+void MemoryArena::Rewind(const Mark &mark)
+{
+  assert(mark.block < current_block_ ||
+      (mark.block == current_block_ && mark.offset <= offset_));
+
+  current_block_ = mark.block;
+  offset_ = mark.offset;
+}
+
+void MemoryArena::Reset()
+{
+  current_block_ = 0;
+  offset_ = 0;
+}
+
+std::size_t MemoryArena::GetReservedSize() const
+{
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < blocks_.size(); i++) {
+    size += blocks_[i].size;
+  }
+  return size;
+}
+
+MemoryArena &MemoryArenaGetThreadLocal()
+{
+  static thread_local MemoryArena arena;
+  return arena;
+}
+
+} // namespace xxx
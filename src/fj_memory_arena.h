@@ -0,0 +1,79 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_MEMORY_ARENA_H
+#define FJ_MEMORY_ARENA_H
+
+#include "fj_compatibility.h"
+#include <vector>
+#include <cstddef>
+#include <new>
+
+namespace fj {
+
+// Bump allocator for temporaries of shading and tracing. Allocations are
+// freed all at once by Reset or Rewind. Free releases a block only when
+// it is the last one, which is enough for nested scopes.
+class FJ_API MemoryArena {
+public:
+  class Mark {
+  public:
+    Mark() : block(0), offset(0) {}
+    ~Mark() {}
+
+    int block;
+    std::size_t offset;
+  };
+
+public:
+  MemoryArena();
+  ~MemoryArena();
+
+  // aligned for any type up to 16 bytes
+  void *Allocate(std::size_t size);
+  // alignment is a power of 2 e.g. 64 for a cache line
+  void *AllocateAligned(std::size_t size, std::size_t alignment);
+  void Free(void *ptr);
+
+  Mark GetMark() const;
+  void Rewind(const Mark &mark);
+  void Reset();
+
+  std::size_t GetReservedSize() const;
+
+  // default constructed array. the arena never calls destructors
+  template<typename T>
+  T *NewArray(int count)
+  {
+    T *array = static_cast<T *>(Allocate(sizeof(T) * count));
+    for (int i = 0; i < count; i++) {
+      new (&array[i]) T();
+    }
+    return array;
+  }
+
+private:
+  MemoryArena(const MemoryArena &);
+  const MemoryArena &operator=(const MemoryArena &);
+
+  class Block {
+  public:
+    Block() : data(NULL), size(0) {}
+    ~Block() {}
+
+    char *data;
+    std::size_t size;
+  };
+
+  std::vector<Block> blocks_;
+  int current_block_;
+  std::size_t offset_;
+};
+
+// arena of the calling thread. the renderer resets it after every
+// camera sample or batch of camera samples shaded together
+FJ_API MemoryArena &MemoryArenaGetThreadLocal();
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,21 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_MEMORY_USAGE_H
+#define FJ_MEMORY_USAGE_H
+
+#include <cstddef>
+#include <vector>
+
+namespace fj {
+
+// bytes allocated for elements of the vector including unused capacity
+template <typename T>
+inline std::size_t MemoryUsageOf(const std::vector<T> &v)
+{
+  return v.capacity() * sizeof(T);
+}
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -3,9 +3,17 @@
 
 #include "fj_mesh.h"
 #include "fj_intersection.h"
+#include "fj_geometry_pager.h"
+#include "fj_tessellation_cache.h"
 #include "fj_primitive_set.h"
+#include "fj_memory_usage.h"
+#include "fj_multi_thread.h"
 #include "fj_triangle.h"
+#include "fj_texture.h"
+#include "fj_numeric.h"
 #include "fj_ray.h"
+#include <algorithm>
+#include <cmath>
 
 #define ATTRIBUTE_LIST(ATTR) \
   ATTR(Point, Vector,   P_,        Position) \
@@ -52,9 +60,91 @@ void Mesh::Clear()
   face_count_ = 0;
   bounds_ = Box();
 
-#define ATTR(Class, Type, Name, Label) std::vector<Type>().swap(Name);
+#define ATTR(Class, Type, Name, Label) Name.clear();
   ATTRIBUTE_LIST(ATTR)
 #undef ATTR
+  mapping_.reset();
+  TessellationCacheGetGlobal().RemoveMesh(tessellation_id_);
+  std::vector<PrecomputedTriangle>().swap(triangles_);
+  std::vector<Vector>().swap(face_vertex_normals_);
+  snapshot_ = MeshSnapshot();
+}
+
+void Mesh::ReferMappedData(const std::shared_ptr<const void> &mapping,
+    const Vector *P, const Vector *N, const Index3 *indices)
+{
+  // the previous mapping is released
+  if (mapping != mapping_) {
+    if (P == NULL) {
+      P_.Detach();
+    }
+    if (N == NULL) {
+      N_.Detach();
+    }
+    if (indices == NULL) {
+      indices_.Detach();
+    }
+  }
+
+  if (P != NULL) {
+    P_.Refer(P, GetPointCount());
+  }
+  if (N != NULL) {
+    N_.Refer(N, GetPointCount());
+  }
+  if (indices != NULL) {
+    indices_.Refer(indices, GetFaceCount());
+  }
+  mapping_ = mapping;
+}
+
+// arrays of meshes sharing them by ShareArrays. arrays referring to a
+// mapped file keep referring to it
+class SharedMeshArrays {
+public:
+  SharedMeshArrays() : mapping(), P(), N(), indices() {}
+  ~SharedMeshArrays() {}
+
+  std::shared_ptr<const void> mapping;
+  MappedArray<Vector> P;
+  MappedArray<Vector> N;
+  MappedArray<Index3> indices;
+};
+
+void Mesh::ShareArrays(Mesh *other)
+{
+  if (other == this ||
+      other->GetPointCount() != GetPointCount() ||
+      other->GetFaceCount() != GetFaceCount()) {
+    return;
+  }
+  if (other->P_.data() == P_.data() &&
+      other->N_.data() == N_.data() &&
+      other->indices_.data() == indices_.data()) {
+    return;
+  }
+
+  // owned elements are moved to the holder without copying so the
+  // snapshot of this mesh stays valid
+  std::shared_ptr<SharedMeshArrays> shared = std::make_shared<SharedMeshArrays>();
+  shared->mapping = mapping_;
+  shared->P.swap(P_);
+  shared->N.swap(N_);
+  shared->indices.swap(indices_);
+
+  ReferMappedData(shared, shared->P.data(), shared->N.data(), shared->indices.data());
+  other->ReferMappedData(shared, shared->P.data(), shared->N.data(), shared->indices.data());
+  take_snapshot();
+  other->take_snapshot();
+}
+
+// arrays referring to mappings stay where the file pages are
+template <typename T>
+static void interleave_array(const MappedArray<T> &array)
+{
+  if (!array.IsReferring() && array.size() > 0) {
+    MtInterleaveSharedMemory(array.data(), array.size() * sizeof(T));
+  }
 }
 
 static void get_point_positions(const Mesh &mesh, Index face_index,
@@ -77,16 +167,6 @@ static void get_point_normals(const Mesh &mesh, Index face_index,
   N2 = mesh.GetPointNormal(face.i2);
 }
 
-static void get_point_texture(const Mesh &mesh, Index face_index,
-    TexCoord &T0, TexCoord &T1, TexCoord &T2)
-{
-  const Index3 face = mesh.GetFaceIndices(face_index);
-
-  T0 = mesh.GetPointTexture(face.i0);
-  T1 = mesh.GetPointTexture(face.i1);
-  T2 = mesh.GetPointTexture(face.i2);
-}
-
 static void get_point_velocity(const Mesh &mesh, Index face_index,
     Vector &V0, Vector &V1, Vector &V2)
 {
@@ -105,27 +185,56 @@ static void get_vertex_normals(const Mesh &mesh, Index face_index,
   N2 = mesh.GetVertexNormal(3 * face_index + 2);
 }
 
-static Vector compute_shading_normal(const Mesh &mesh, Index face_index, double u, double v)
+// the same as above for the snapshot
+static void get_point_positions(const MeshSnapshot &mesh, Index face_index,
+    Vector &P0, Vector &P1, Vector &P2)
 {
-  Vector N0, N1, N2;
+  const Index3 &face = mesh.indices[face_index];
 
-  if (mesh.HasVertexNormal()) {
-    get_vertex_normals(mesh, face_index, N0, N1, N2);
+  P0 = mesh.P[face.i0];
+  P1 = mesh.P[face.i1];
+  P2 = mesh.P[face.i2];
+}
+
+static void get_point_velocity(const MeshSnapshot &mesh, Index face_index,
+    Vector &V0, Vector &V1, Vector &V2)
+{
+  const Index3 &face = mesh.indices[face_index];
+
+  V0 = mesh.velocity[face.i0];
+  V1 = mesh.velocity[face.i1];
+  V2 = mesh.velocity[face.i2];
+}
+
+static Vector compute_shading_normal(const MeshSnapshot &mesh, Index face_index,
+    double u, double v)
+{
+  if (mesh.vertex_N != NULL) {
+    const Vector *N = &mesh.vertex_N[3 * face_index];
+    return TriComputeNormal(N[0], N[1], N[2], u, v);
   }
-  else {
-    get_point_normals(mesh, face_index, N0, N1, N2);
+  if (mesh.N != NULL) {
+    const Index3 &face = mesh.indices[face_index];
+    return TriComputeNormal(mesh.N[face.i0], mesh.N[face.i1], mesh.N[face.i2], u, v);
   }
-
-  return TriComputeNormal(N0, N1, N2, u, v);
+  return Vector(0, 0, 0);
 }
 
-Mesh::Mesh() : point_count_(0), face_count_(0), bounds_()
+Mesh::Mesh() : point_count_(0), face_count_(0),
+    displacement_map_(NULL),
+    displacement_scale_(1),
+    displacement_rate_(1),
+    displacement_max_level_(MESH_DEFAULT_DISPLACEMENT_MAX_LEVEL),
+    tessellation_id_(TessellationCacheGetGlobal().NewMeshID()),
+    precompute_triangles_(false),
+    bounds_()
 {
   face_group_name_[""] = 0;
 }
 
 Mesh::~Mesh()
 {
+  TessellationCacheGetGlobal().RemoveMesh(tessellation_id_);
 }
 
 int Mesh::GetPointCount() const
@@ -153,6 +262,40 @@ const Box &Mesh::GetBounds() const
   return bounds_;
 }
 
+// bounds depend on the displacement so they are computed again
+void Mesh::SetDisplacementMap(const Texture *map)
+{
+  displacement_map_ = map;
+  if (HasPointPosition() && HasFaceIndices()) {
+    ComputeBounds();
+  }
+}
+
+void Mesh::SetDisplacementScale(Real scale)
+{
+  displacement_scale_ = scale;
+  if (HasPointPosition() && HasFaceIndices()) {
+    ComputeBounds();
+  }
+}
+
+void Mesh::SetDisplacementRate(Real rate)
+{
+  displacement_rate_ = Max(rate, .01);
+  TessellationCacheGetGlobal().RemoveMesh(tessellation_id_);
+}
+
+void Mesh::SetDisplacementMaxLevel(int max_level)
+{
+  displacement_max_level_ = std::max(0, std::min(max_level, MESH_MAX_DISPLACEMENT_LEVEL));
+  TessellationCacheGetGlobal().RemoveMesh(tessellation_id_);
+}
+
+bool Mesh::HasDisplacement() const
+{
+  return displacement_map_ != NULL && displacement_scale_ != 0 && HasPointTexture();
+}
+
 //TODO TEST
 bool Mesh::HasVertexNormal() const
 {
@@ -192,6 +335,70 @@ int Mesh::LookupFaceGroup(const std::string &group_name) const
   }
 }
 
+// faces or points in a chunk of parallel passes over a mesh
+static const int PARALLEL_CHUNK_SIZE = 16384;
+
+class MeshPass {
+public:
+  MeshPass() :
+      mesh(NULL),
+      face_normals(NULL),
+      point_normals(NULL),
+      chunk_bounds(NULL),
+      triangles(NULL) {}
+  ~MeshPass() {}
+
+  Mesh *mesh;
+  Vector *face_normals;
+  Vector *point_normals;
+  Box *chunk_bounds;
+  PrecomputedTriangle *triangles;
+};
+
+static void compute_face_normals_range(void *data, int begin, int end)
+{
+  MeshPass *pass = reinterpret_cast<MeshPass *>(data);
+
+  for (int i = begin; i < end; i++) {
+    Vector P0, P1, P2;
+    get_point_positions(*pass->mesh, i, P0, P1, P2);
+    pass->face_normals[i] = TriComputeFaceNormal(P0, P1, P2);
+  }
+}
+
+static void normalize_point_normals_range(void *data, int begin, int end)
+{
+  MeshPass *pass = reinterpret_cast<MeshPass *>(data);
+
+  for (int i = begin; i < end; i++) {
+    pass->mesh->SetPointNormal(i, Normalize(pass->point_normals[i]));
+  }
+}
+
+static void compute_face_bounds_range(void *data, int begin, int end)
+{
+  MeshPass *pass = reinterpret_cast<MeshPass *>(data);
+  Box &bounds = pass->chunk_bounds[begin / PARALLEL_CHUNK_SIZE];
+
+  bounds.ReverseInfinite();
+  for (int i = begin; i < end; i++) {
+    Box tri_bounds;
+    pass->mesh->GetPrimitiveBounds(i, &tri_bounds);
+    bounds.AddBox(tri_bounds);
+  }
+}
+
+static void precompute_triangles_range(void *data, int begin, int end)
+{
+  MeshPass *pass = reinterpret_cast<MeshPass *>(data);
+
+  for (int i = begin; i < end; i++) {
+    Vector P0, P1, P2;
+    get_point_positions(*pass->mesh, i, P0, P1, P2);
+    TriPrecompute(P0, P1, P2, &pass->triangles[i]);
+  }
+}
+
 void Mesh::ComputeNormals()
 {
   if (!HasPointPosition() || !HasFaceIndices())
@@ -204,62 +411,179 @@ void Mesh::ComputeNormals()
     AddPointNormal();
   }
 
-  // initialize N
-  for (int i = 0; i < nverts; i++) {
-    SetPointNormal(i, Vector(0, 0, 0));
-  }
+  // face normals in parallel
+  std::vector<Vector> face_normals(nfaces);
+  MeshPass pass;
+  pass.mesh = this;
+  pass.face_normals = &face_normals[0];
+  MtParallelFor(&pass, compute_face_normals_range, nfaces, PARALLEL_CHUNK_SIZE);
 
-  // compute N
+  // sums in the order of faces as the serial loop did so that normals
+  // don't depend on the thread count
+  std::vector<Vector> N(nverts, Vector(0, 0, 0));
   for (int i = 0; i < nfaces; i++) {
-    Vector P0, P1, P2;
-    get_point_positions(*this, i, P0, P1, P2);
-
-    Vector N0, N1, N2;
-    get_point_normals(*this, i, N0, N1, N2);
-
     const Index3 face = GetFaceIndices(i);
-    const Vector Ng = TriComputeFaceNormal(P0, P1, P2);
-    SetPointNormal(face.i0, N0 + Ng);
-    SetPointNormal(face.i1, N1 + Ng);
-    SetPointNormal(face.i2, N2 + Ng);
+    const Vector &Ng = face_normals[i];
+    N[face.i0] += Ng;
+    N[face.i1] += Ng;
+    N[face.i2] += Ng;
   }
 
   // normalize N
-  for (int i = 0; i < nverts; i++) {
-    Vector N = GetPointNormal(i);
-    N = Normalize(N);
-    SetPointNormal(i, N);
+  pass.point_normals = &N[0];
+  MtParallelFor(&pass, normalize_point_normals_range, nverts, PARALLEL_CHUNK_SIZE);
+}
+
+static void set_hit(const MeshSnapshot &mesh, Index prim_id,
+    Real t_hit, Real u, Real v, Intersection *isect)
+{
+  isect->object = NULL;
+  isect->prim_id = prim_id;
+  isect->shading_group_id = mesh.group_id != NULL ? mesh.group_id[prim_id] : 0;
+  isect->t_hit = t_hit;
+  isect->prim_uv = Vector2(u, v);
+}
+
+static void set_hit_attributes(const MeshSnapshot &mesh, Index prim_id, const Ray &ray,
+    const Vector &P0, const Vector &P1, const Vector &P2,
+    Real t_hit, Real u, Real v, Intersection *isect)
+{
+  // we don't know N at time sampled point with velocity motion blur
+  // just using N from mesh data
+  // intersect info
+  isect->N = compute_shading_normal(mesh, prim_id, u, v);
+
+  // TODO TMP uv handling
+  // UV = (1-u-v) * UV0 + u * UV1 + v * UV2
+  if (mesh.uv != NULL) {
+    const Index3 &face = mesh.indices[prim_id];
+    const TexCoord &uv0 = mesh.uv[face.i0];
+    const TexCoord &uv1 = mesh.uv[face.i1];
+    const TexCoord &uv2 = mesh.uv[face.i2];
+
+    const float t = 1 - u - v;
+    isect->uv.u = t * uv0.u + u * uv1.u + v * uv2.u;
+    isect->uv.v = t * uv0.v + u * uv1.v + v * uv2.v;
+
+    TriComputeDerivatives(
+        P0, P1, P2,
+        uv0, uv1, uv2,
+        &isect->dPdu, &isect->dPdv);
+  }
+  else {
+    isect->uv.u = 0;
+    isect->uv.v = 0;
+    isect->dPdu = Vector(0, 0, 0);
+    isect->dPdv = Vector(0, 0, 0);
   }
+
+  isect->P = RayPointAt(ray, t_hit);
 }
 
 void Mesh::ComputeBounds()
 {
+  MarkChanged();
+  take_snapshot();
+
+  // reduces bounds of chunks of faces
+  const int nchunks = (GetFaceCount() + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+  std::vector<Box> chunk_bounds(nchunks);
+  MeshPass pass;
+  pass.mesh = this;
+  pass.chunk_bounds = nchunks > 0 ? &chunk_bounds[0] : NULL;
+  MtParallelFor(&pass, compute_face_bounds_range, GetFaceCount(), PARALLEL_CHUNK_SIZE);
+
   bounds_.ReverseInfinite();
+  for (int i = 0; i < nchunks; i++) {
+    bounds_.AddBox(chunk_bounds[i]);
+  }
 
-  for (int i = 0; i < GetFaceCount(); i++) {
-    Box tri_bounds;
-    GetPrimitiveBounds(i, &tri_bounds);
-    bounds_.AddBox(tri_bounds);
+  // tessellations of the previous mesh are dropped
+  TessellationCacheGetGlobal().RemoveMesh(tessellation_id_);
+
+  // read by workers of all nodes
+  interleave_array(P_);
+  interleave_array(N_);
+  interleave_array(uv_);
+  interleave_array(indices_);
+  MtInterleaveSharedMemory(face_vertex_normals_);
+
+  // triangles of the previous mesh are computed again if requested
+  update_precomputed_triangles();
+}
+
+void Mesh::PrecomputeTriangles()
+{
+  if (precompute_triangles_ && has_precomputed_triangles()) {
+    return;
   }
+  precompute_triangles_ = true;
+  update_precomputed_triangles();
+}
+
+bool Mesh::IsStatic() const
+{
+  return !HasPointVelocity() && !HasDisplacement() && !is_paged();
+}
+
+void Mesh::ReleasePrecomputedTriangles()
+{
+  precompute_triangles_ = false;
+  std::vector<PrecomputedTriangle>().swap(triangles_);
+}
+
+void Mesh::update_precomputed_triangles()
+{
+  if (!precompute_triangles_ || !IsStatic()) {
+    std::vector<PrecomputedTriangle>().swap(triangles_);
+    return;
+  }
+
+  MeshPass pass;
+  pass.mesh = this;
+  triangles_.resize(GetFaceCount());
+  pass.triangles = triangles_.empty() ? NULL : &triangles_[0];
+  MtParallelFor(&pass, precompute_triangles_range, GetFaceCount(), PARALLEL_CHUNK_SIZE);
+  MtInterleaveSharedMemory(triangles_);
 }
 
 bool Mesh::ray_intersect(Index prim_id, const Ray &ray,
     Real time, Intersection *isect) const
 {
   Vector P0, P1, P2;
-  get_point_positions(*this, prim_id, P0, P1, P2);
+  Real u, v;
+  Real t_hit;
 
-  if (HasPointVelocity()) {
+  if (HasDisplacement()) {
+    return displaced_ray_intersect(prim_id, ray, isect);
+  }
+
+  if (has_precomputed_triangles()) {
+    const int hit = TriRayIntersectPrecomputed(triangles_[prim_id],
+        ray.orig, ray.dir, DO_NOT_CULL_BACKFACES,
+        &t_hit, &u, &v);
+
+    if (!hit)
+      return false;
+
+    if (isect == NULL)
+      return true;
+
+    set_hit(snapshot_, prim_id, t_hit, u, v, isect);
+    return true;
+  }
+
+  get_point_positions(snapshot_, prim_id, P0, P1, P2);
+
+  if (snapshot_.velocity != NULL) {
     Vector velocity0, velocity1, velocity2;
-    get_point_velocity(*this, prim_id, velocity0, velocity1, velocity2);
+    get_point_velocity(snapshot_, prim_id, velocity0, velocity1, velocity2);
 
     P0 += time * velocity0;
     P1 += time * velocity1;
     P2 += time * velocity2;
   }
 
-  double u, v;
-  double t_hit;
   const int hit = TriRayIntersect(
       P0, P1, P2,
       ray.orig, ray.dir, DO_NOT_CULL_BACKFACES,
@@ -271,42 +595,528 @@ bool Mesh::ray_intersect(Index prim_id, const Ray &ray,
   if (isect == NULL)
     return true;
 
-  // we don't know N at time sampled point with velocity motion blur
-  // just using N from mesh data
-  // intersect info
-  isect->N = compute_shading_normal(*this, prim_id, u, v);
+  set_hit(snapshot_, prim_id, t_hit, u, v, isect);
+  return true;
+}
 
-  // TODO TMP uv handling
-  // UV = (1-u-v) * UV0 + u * UV1 + v * UV2
-  if (HasPointTexture()) {
-    TexCoord uv0, uv1, uv2;
-    get_point_texture(*this, prim_id, uv0, uv1, uv2);
+bool Mesh::ray_occlude(Index prim_id, const Ray &ray,
+    Real time, Intersection *isect) const
+{
+  Real u, v;
+  Real t_hit;
+  int hit = 0;
 
-    const float t = 1 - u - v;
-    isect->uv.u = t * uv0.u + u * uv1.u + v * uv2.u;
-    isect->uv.v = t * uv0.v + u * uv1.v + v * uv2.v;
+  if (HasDisplacement()) {
+    return displaced_ray_intersect(prim_id, ray, isect);
+  }
 
-    TriComputeDerivatives(
+  if (has_precomputed_triangles()) {
+    hit = TriRayIntersectPrecomputed(triangles_[prim_id],
+        ray.orig, ray.dir, DO_NOT_CULL_BACKFACES,
+        &t_hit, &u, &v);
+  } else {
+    Vector P0, P1, P2;
+    get_point_positions(snapshot_, prim_id, P0, P1, P2);
+
+    if (snapshot_.velocity != NULL) {
+      Vector velocity0, velocity1, velocity2;
+      get_point_velocity(snapshot_, prim_id, velocity0, velocity1, velocity2);
+
+      P0 += time * velocity0;
+      P1 += time * velocity1;
+      P2 += time * velocity2;
+    }
+
+    hit = TriRayIntersect(
         P0, P1, P2,
-        uv0, uv1, uv2,
-        &isect->dPdu, &isect->dPdv);
-  }
-  else {
-    isect->uv.u = 0;
-    isect->uv.v = 0;
-    isect->dPdu = Vector(0, 0, 0);
-    isect->dPdv = Vector(0, 0, 0);
+        ray.orig, ray.dir, DO_NOT_CULL_BACKFACES,
+        &t_hit, &u, &v);
   }
 
-  isect->P = RayPointAt(ray, t_hit);
+  if (!hit)
+    return false;
+
+  // no attribute interpolation. shadow rays only need the shader
   isect->object = NULL;
   isect->prim_id = prim_id;
-  isect->shading_group_id = GetFaceGroupID(prim_id);
+  isect->shading_group_id = snapshot_.group_id != NULL ? snapshot_.group_id[prim_id] : 0;
   isect->t_hit = t_hit;
 
   return true;
 }
 
+bool Mesh::ray_intersect_list(const Index *prim_ids, int count, const Ray &ray,
+    Real time, Intersection *isect) const
+{
+  if (!has_precomputed_triangles()) {
+    Intersection isect_tmp;
+    bool hit = false;
+
+    isect->t_hit = REAL_MAX;
+
+    for (int i = 0; i < count; i++) {
+      const bool hittmp = RayIntersect(prim_ids[i], ray, time, &isect_tmp);
+      if (hittmp && isect_tmp.t_hit < isect->t_hit) {
+        *isect = isect_tmp;
+        hit = true;
+      }
+    }
+    return hit;
+  }
+
+  Index hit_id = -1;
+  Real t_min = REAL_MAX;
+  Real u_min = 0;
+  Real v_min = 0;
+
+  for (int i = 0; i < count; i += 4) {
+    const PrecomputedTriangle *tris[4] = {NULL, NULL, NULL, NULL};
+    const int ntris = Min(count - i, 4);
+
+    for (int j = 0; j < ntris; j++) {
+      tris[j] = &triangles_[prim_ids[i + j]];
+    }
+
+    Real t[4], u[4], v[4];
+    const int mask = TriRayIntersect4(tris, ntris, ray.orig, ray.dir, t, u, v);
+    if (mask == 0) {
+      continue;
+    }
+
+    for (int j = 0; j < ntris; j++) {
+      if ((mask & (1 << j)) && RayInRange(ray, t[j]) && t[j] < t_min) {
+        hit_id = prim_ids[i + j];
+        t_min = t[j];
+        u_min = u[j];
+        v_min = v[j];
+      }
+    }
+  }
+
+  if (hit_id < 0) {
+    return false;
+  }
+
+  set_hit(snapshot_, hit_id, t_min, u_min, v_min, isect);
+
+  return true;
+}
+
+static inline void precompute_cluster_triangle(const uint8_t *local_indices,
+    const Vector *points, PrecomputedTriangle *tri)
+{
+  TriPrecompute(
+      points[local_indices[0]],
+      points[local_indices[1]],
+      points[local_indices[2]],
+      tri);
+}
+
+bool Mesh::ray_intersect_cluster(const Index *prim_ids, const uint8_t *local_indices,
+    const Vector *points, int count, const Ray &ray, Intersection *isect) const
+{
+  Index hit_id = -1;
+  Real t_min = REAL_MAX;
+  Real u_min = 0;
+  Real v_min = 0;
+
+  for (int i = 0; i < count; i += 4) {
+    PrecomputedTriangle tri_tmp[4];
+    const PrecomputedTriangle *tris[4] = {NULL, NULL, NULL, NULL};
+    const int ntris = Min(count - i, 4);
+
+    // the same as precomputed by ComputeBounds bit by bit
+    for (int j = 0; j < ntris; j++) {
+      precompute_cluster_triangle(&local_indices[3 * (i + j)], points, &tri_tmp[j]);
+      tris[j] = &tri_tmp[j];
+    }
+
+    Real t[4], u[4], v[4];
+    const int mask = TriRayIntersect4(tris, ntris, ray.orig, ray.dir, t, u, v);
+    if (mask == 0) {
+      continue;
+    }
+
+    for (int j = 0; j < ntris; j++) {
+      if ((mask & (1 << j)) && RayInRange(ray, t[j]) && t[j] < t_min) {
+        hit_id = prim_ids[i + j];
+        t_min = t[j];
+        u_min = u[j];
+        v_min = v[j];
+      }
+    }
+  }
+
+  if (hit_id < 0) {
+    return false;
+  }
+
+  set_hit(snapshot_, hit_id, t_min, u_min, v_min, isect);
+
+  return true;
+}
+
+bool Mesh::ray_occlude_cluster(const Index *prim_ids, const uint8_t *local_indices,
+    const Vector *points, int count, const Ray &ray, Intersection *isect) const
+{
+  for (int i = 0; i < count; i++) {
+    PrecomputedTriangle tri;
+    precompute_cluster_triangle(&local_indices[3 * i], points, &tri);
+
+    Real t_hit, u, v;
+    const int hit = TriRayIntersectPrecomputed(tri,
+        ray.orig, ray.dir, DO_NOT_CULL_BACKFACES,
+        &t_hit, &u, &v);
+    if (!hit || !RayInRange(ray, t_hit)) {
+      continue;
+    }
+
+    const Index prim_id = prim_ids[i];
+    isect->object = NULL;
+    isect->prim_id = prim_id;
+    isect->shading_group_id = snapshot_.group_id != NULL ? snapshot_.group_id[prim_id] : 0;
+    isect->t_hit = t_hit;
+    return true;
+  }
+
+  return false;
+}
+
+void Mesh::compute_hit_attributes(const Ray &ray, Real time, Intersection *isect) const
+{
+  if (HasDisplacement()) {
+    compute_displaced_hit_attributes(ray, isect);
+    return;
+  }
+
+  const Index prim_id = isect->prim_id;
+  Vector P0, P1, P2;
+  get_point_positions(snapshot_, prim_id, P0, P1, P2);
+
+  if (snapshot_.velocity != NULL) {
+    Vector velocity0, velocity1, velocity2;
+    get_point_velocity(snapshot_, prim_id, velocity0, velocity1, velocity2);
+
+    P0 += time * velocity0;
+    P1 += time * velocity1;
+    P2 += time * velocity2;
+  }
+
+  set_hit_attributes(snapshot_, prim_id, ray, P0, P1, P2,
+      isect->t_hit, isect->prim_uv[0], isect->prim_uv[1], isect);
+}
+
+bool Mesh::has_precomputed_triangles() const
+{
+  return !HasPointVelocity() &&
+      static_cast<int>(triangles_.size()) == GetFaceCount();
+}
+
+bool Mesh::is_paged() const
+{
+  // paged positions are read from the mapping instead of being copied
+  return GeometryPagerGetGlobal().IsEnabled() &&
+      GeometryPagerGetGlobal().IsMapped(P_.data());
+}
+
+void Mesh::take_snapshot()
+{
+  if (HasVertexNormal()) {
+    face_vertex_normals_.resize(3 * GetFaceCount());
+    for (int i = 0; i < GetFaceCount(); i++) {
+      get_vertex_normals(*this, i,
+          face_vertex_normals_[3 * i + 0],
+          face_vertex_normals_[3 * i + 1],
+          face_vertex_normals_[3 * i + 2]);
+    }
+  } else {
+    std::vector<Vector>().swap(face_vertex_normals_);
+  }
+
+  snapshot_.P        = P_.data();
+  snapshot_.N        = N_.data();
+  snapshot_.uv       = uv_.data();
+  snapshot_.velocity = velocity_.data();
+  snapshot_.indices  = indices_.data();
+  snapshot_.group_id = face_group_id_.data();
+  snapshot_.vertex_N = face_vertex_normals_.empty() ? NULL : &face_vertex_normals_[0];
+}
+
+// sub-triangle of a face on the grid of its tessellation. corners are
+// barycentric coordinates of the face times the resolution of the grid
+class GridTriangle {
+public:
+  GridTriangle() : depth(0), index(0), corner() {}
+  ~GridTriangle() {}
+
+  int depth;
+  int index;
+  int corner[3][2];
+};
+
+static void set_corner(int *dst, const int *src)
+{
+  dst[0] = src[0];
+  dst[1] = src[1];
+}
+
+// the 3 corner triangles and the inverted one in the middle
+static void split_grid_triangle(const GridTriangle &tri, GridTriangle *children)
+{
+  const int *a = tri.corner[0];
+  const int *b = tri.corner[1];
+  const int *c = tri.corner[2];
+  const int ab[2] = {(a[0] + b[0]) / 2, (a[1] + b[1]) / 2};
+  const int bc[2] = {(b[0] + c[0]) / 2, (b[1] + c[1]) / 2};
+  const int ca[2] = {(c[0] + a[0]) / 2, (c[1] + a[1]) / 2};
+  const int *corners[4][3] = {
+    {a, ab, ca},
+    {ab, b, bc},
+    {ca, bc, c},
+    {bc, ca, ab}
+  };
+
+  for (int i = 0; i < 4; i++) {
+    GridTriangle &child = children[i];
+    child.depth = tri.depth + 1;
+    child.index = 4 * tri.index + i;
+    for (int j = 0; j < 3; j++) {
+      set_corner(child.corner[j], corners[i][j]);
+    }
+  }
+}
+
+static GridTriangle root_grid_triangle(int resolution)
+{
+  GridTriangle root;
+  root.corner[1][0] = resolution;
+  root.corner[2][1] = resolution;
+  return root;
+}
+
+static const Box &compute_grid_bounds(const GridTriangle &tri, TessellatedFace *face)
+{
+  Box &bounds = face->bounds[((1 << (2 * tri.depth)) - 1) / 3 + tri.index];
+
+  if (tri.depth == face->level) {
+    TriComputeBounds(
+        face->GetPoint(tri.corner[0][0], tri.corner[0][1]),
+        face->GetPoint(tri.corner[1][0], tri.corner[1][1]),
+        face->GetPoint(tri.corner[2][0], tri.corner[2][1]),
+        &bounds);
+    return bounds;
+  }
+
+  GridTriangle children[4];
+  split_grid_triangle(tri, children);
+
+  bounds.ReverseInfinite();
+  for (int i = 0; i < 4; i++) {
+    bounds.AddBox(compute_grid_bounds(children[i], face));
+  }
+  return bounds;
+}
+
+int Mesh::get_displacement_level(Index prim_id) const
+{
+  const TessellationCache &cache = TessellationCacheGetGlobal();
+  const Vector &eye = cache.GetDicingPosition();
+
+  Box bounds;
+  get_primitive_bounds(prim_id, &bounds);
+  Vector nearest;
+  for (int i = 0; i < 3; i++) {
+    nearest[i] = Clamp(eye[i], bounds.min[i], bounds.max[i]);
+  }
+
+  // micro-triangles of rate pixels where the face is nearest to the camera
+  const Real micro_edge = Length(nearest - eye) * cache.GetDicingSpread() *
+      displacement_rate_;
+  if (micro_edge <= 0) {
+    return displacement_max_level_;
+  }
+
+  Vector P0, P1, P2;
+  get_point_positions(snapshot_, prim_id, P0, P1, P2);
+  const Real edge = Max(Length(P1 - P0), Max(Length(P2 - P1), Length(P0 - P2)));
+
+  const int level = static_cast<int>(std::ceil(std::log2(edge / micro_edge)));
+  return std::max(0, std::min(level, displacement_max_level_));
+}
+
+Vector Mesh::get_displaced_point(Index prim_id, Real u, Real v, int level) const
+{
+  const Index3 &face = snapshot_.indices[prim_id];
+  const Vector &P0 = snapshot_.P[face.i0];
+  const Vector &P1 = snapshot_.P[face.i1];
+  const Vector &P2 = snapshot_.P[face.i2];
+  const Real w = 1 - u - v;
+
+  Vector N = compute_shading_normal(snapshot_, prim_id, u, v);
+  if (Length(N) == 0) {
+    N = TriComputeFaceNormal(P0, P1, P2);
+  } else {
+    N = Normalize(N);
+  }
+
+  const TexCoord &uv0 = snapshot_.uv[face.i0];
+  const TexCoord &uv1 = snapshot_.uv[face.i1];
+  const TexCoord &uv2 = snapshot_.uv[face.i2];
+  const float s = w * uv0.u + u * uv1.u + v * uv2.u;
+  const float t = w * uv0.v + u * uv1.v + v * uv2.v;
+
+  // texels as large as micro-triangles
+  const float du = Max(Max(std::abs(uv1.u - uv0.u), std::abs(uv2.u - uv0.u)),
+      std::abs(uv2.u - uv1.u)) / (1 << level);
+  const float dv = Max(Max(std::abs(uv1.v - uv0.v), std::abs(uv2.v - uv0.v)),
+      std::abs(uv2.v - uv1.v)) / (1 << level);
+  const Real height = Clamp(displacement_map_->Lookup(s, t, du, dv).r, 0, 1);
+
+  return w * P0 + u * P1 + v * P2 + displacement_scale_ * height * N;
+}
+
+void Mesh::tessellate_face(Index prim_id, int level, TessellatedFace *face) const
+{
+  const int n = 1 << level;
+
+  face->level = level;
+  face->points.resize((n + 1) * (n + 2) / 2);
+  face->bounds.resize(((1 << (2 * (level + 1))) - 1) / 3);
+
+  int index = 0;
+  for (int j = 0; j <= n; j++) {
+    for (int i = 0; i <= n - j; i++) {
+      face->points[index++] =
+          get_displaced_point(prim_id, Real(i) / n, Real(j) / n, level);
+    }
+  }
+
+  compute_grid_bounds(root_grid_triangle(n), face);
+}
+
+std::shared_ptr<const TessellatedFace> Mesh::get_tessellated_face(Index prim_id) const
+{
+  TessellationCache &cache = TessellationCacheGetGlobal();
+
+  // the level is only computed for faces not cached
+  TessellationCache::FacePtr face = cache.Find(tessellation_id_, prim_id);
+  if (face) {
+    return face;
+  }
+
+  std::shared_ptr<TessellatedFace> new_face = std::make_shared<TessellatedFace>();
+  tessellate_face(prim_id, get_displacement_level(prim_id), new_face.get());
+  return cache.Insert(tessellation_id_, prim_id, new_face);
+}
+
+bool Mesh::displaced_ray_intersect(Index prim_id, const Ray &ray,
+    Intersection *isect) const
+{
+  const std::shared_ptr<const TessellatedFace> face = get_tessellated_face(prim_id);
+  const int n = face->GetResolution();
+  const TraversalRay traversal_ray(ray);
+
+  // each sub-triangle popped pushes at most 4 children
+  GridTriangle stack[4 * MESH_MAX_DISPLACEMENT_LEVEL + 4];
+  int stack_size = 0;
+  stack[stack_size++] = root_grid_triangle(n);
+
+  Real t_min = ray.tmax;
+  Real u_min = 0;
+  Real v_min = 0;
+  bool hit = false;
+
+  while (stack_size > 0) {
+    const GridTriangle tri = stack[--stack_size];
+    const Box &bounds = face->GetBounds(tri.depth, tri.index);
+
+    Real hit_tmin = 0, hit_tmax = 0;
+    if (!RayBoxIntersect(traversal_ray, bounds.min, bounds.max,
+        ray.tmin, t_min, &hit_tmin, &hit_tmax)) {
+      continue;
+    }
+
+    if (tri.depth < face->level) {
+      split_grid_triangle(tri, &stack[stack_size]);
+      stack_size += 4;
+      continue;
+    }
+
+    const int *a = tri.corner[0];
+    const int *b = tri.corner[1];
+    const int *c = tri.corner[2];
+    Real t = 0, s = 0, r = 0;
+    const bool hit_micro = TriRayIntersect(
+        face->GetPoint(a[0], a[1]),
+        face->GetPoint(b[0], b[1]),
+        face->GetPoint(c[0], c[1]),
+        ray.orig, ray.dir, DO_NOT_CULL_BACKFACES,
+        &t, &s, &r);
+
+    if (hit_micro && RayInRange(ray, t) && t < t_min) {
+      // barycentric coordinates of the face
+      t_min = t;
+      u_min = ((1 - s - r) * a[0] + s * b[0] + r * c[0]) / n;
+      v_min = ((1 - s - r) * a[1] + s * b[1] + r * c[1]) / n;
+      hit = true;
+    }
+  }
+
+  if (!hit) {
+    return false;
+  }
+  if (isect == NULL) {
+    return true;
+  }
+
+  set_hit(snapshot_, prim_id, t_min, u_min, v_min, isect);
+  return true;
+}
+
+void Mesh::compute_displaced_hit_attributes(const Ray &ray, Intersection *isect) const
+{
+  const Index prim_id = isect->prim_id;
+  const Real u = isect->prim_uv[0];
+  const Real v = isect->prim_uv[1];
+
+  Vector P0, P1, P2;
+  get_point_positions(snapshot_, prim_id, P0, P1, P2);
+  set_hit_attributes(snapshot_, prim_id, ray, P0, P1, P2,
+      isect->t_hit, u, v, isect);
+
+  // normal of the displaced surface from central differences. steps shorter
+  // than a texel see edges of bilinear patches of the map as creases
+  const Index3 &face = snapshot_.indices[prim_id];
+  const TexCoord &uv0 = snapshot_.uv[face.i0];
+  const TexCoord &uv1 = snapshot_.uv[face.i1];
+  const TexCoord &uv2 = snapshot_.uv[face.i2];
+  const Real span_u = Max(Max(std::abs(uv1.u - uv0.u), std::abs(uv2.u - uv0.u)),
+      std::abs(uv2.u - uv1.u));
+  const Real span_v = Max(Max(std::abs(uv1.v - uv0.v), std::abs(uv2.v - uv0.v)),
+      std::abs(uv2.v - uv1.v));
+  const Real texel = Max(
+      span_u > 0 ? 1. / (displacement_map_->GetWidth() * span_u) : 0,
+      span_v > 0 ? 1. / (displacement_map_->GetHeight() * span_v) : 0);
+
+  const int level = get_tessellated_face(prim_id)->level;
+  const Real step = Max(1. / (1 << level), texel);
+  const Vector dPdu = get_displaced_point(prim_id, u + step, v, level) -
+      get_displaced_point(prim_id, u - step, v, level);
+  const Vector dPdv = get_displaced_point(prim_id, u, v + step, level) -
+      get_displaced_point(prim_id, u, v - step, level);
+  const Vector N = Cross(dPdu, dPdv);
+
+  if (Length(N) == 0) {
+    return;
+  }
+  // faces the same side as the normal of the mesh
+  if (Dot(N, isect->N) < 0) {
+    isect->N = -Normalize(N);
+  } else {
+    isect->N = Normalize(N);
+  }
+}
+
 struct SubTri {
   SubTri(): P0(), P1(), P2(), vel0(), vel1(), vel2() {}
   ~SubTri() {}
@@ -400,6 +1210,12 @@ static bool box_tri_intersect_recursive(const Box &box, const SubTri &tri, int d
 
 bool Mesh::box_intersect(Index prim_id, const Box &box) const
 {
+  if (HasDisplacement()) {
+    Box bounds;
+    get_primitive_bounds(prim_id, &bounds);
+    return BoxBoxIntersect(bounds, box);
+  }
+
   const int recursive_depth = 0;
   SubTri t;
   get_point_positions(*this, prim_id, t.P0, t.P1, t.P2);
@@ -417,6 +1233,54 @@ bool Mesh::box_intersect(Index prim_id, const Box &box) const
 #endif
 }
 
+// points move along normals interpolated in the face times the map clamped
+// to [0, 1]. interpolated normals stay in the cone of the vertex normals
+static void expand_by_displacement(const Mesh &mesh, Index face_index,
+    Real scale, Box *bounds)
+{
+  Vector N[3];
+  if (mesh.HasVertexNormal()) {
+    get_vertex_normals(mesh, face_index, N[0], N[1], N[2]);
+  } else if (mesh.HasPointNormal()) {
+    get_point_normals(mesh, face_index, N[0], N[1], N[2]);
+  } else {
+    Vector P0, P1, P2;
+    get_point_positions(mesh, face_index, P0, P1, P2);
+    N[0] = N[1] = N[2] = TriComputeFaceNormal(P0, P1, P2);
+  }
+
+  Real cos_min = 1;
+  for (int i = 0; i < 3; i++) {
+    if (Length(N[i]) == 0) {
+      cos_min = 0;
+      break;
+    }
+    N[i] = Normalize(N[i]);
+  }
+  const Vector axis = N[0] + N[1] + N[2];
+  if (cos_min > 0 && Length(axis) > 0) {
+    for (int i = 0; i < 3; i++) {
+      cos_min = Min(cos_min, Dot(N[i], Normalize(axis)));
+    }
+  }
+
+  // too wide cones can make any direction
+  if (cos_min < .1 || Length(axis) == 0) {
+    bounds->Expand(std::abs(scale));
+    return;
+  }
+
+  for (int k = 0; k < 3; k++) {
+    Real lo = Min(N[0][k], Min(N[1][k], N[2][k]));
+    Real hi = Max(N[0][k], Max(N[1][k], N[2][k]));
+    // normalizing makes components longer up to 1 / cos_min
+    lo = lo < 0 ? Max(lo / cos_min, -1.) : lo;
+    hi = hi > 0 ? Min(hi / cos_min, 1.) : hi;
+    bounds->min[k] += Min(0., Min(scale * lo, scale * hi));
+    bounds->max[k] += Max(0., Max(scale * lo, scale * hi));
+  }
+}
+
 void Mesh::get_primitive_bounds(Index prim_id, Box *bounds) const
 {
   Vector P0, P1, P2;
@@ -424,6 +1288,11 @@ void Mesh::get_primitive_bounds(Index prim_id, Box *bounds) const
 
   TriComputeBounds(P0, P1, P2, bounds);
 
+  if (HasDisplacement()) {
+    expand_by_displacement(*this, prim_id, displacement_scale_, bounds);
+    return;
+  }
+
   if (HasPointVelocity()) {
     Vector velocity0, velocity1, velocity2;
     get_point_velocity(*this, prim_id, velocity0, velocity1, velocity2);
@@ -438,6 +1307,52 @@ void Mesh::get_primitive_bounds(Index prim_id, Box *bounds) const
   }
 }
 
+void Mesh::get_clipped_primitive_bounds(Index prim_id, const Box &clip,
+    Box *bounds) const
+{
+  // moving triangles sweep volumes that are not clipped as triangles
+  if (HasPointVelocity() || HasDisplacement()) {
+    get_primitive_bounds(prim_id, bounds);
+    bounds->Clip(clip);
+    return;
+  }
+
+  Vector P0, P1, P2;
+  get_point_positions(*this, prim_id, P0, P1, P2);
+
+  TriClipBounds(P0, P1, P2, clip, bounds);
+}
+
+bool Mesh::has_motion() const
+{
+  return HasPointVelocity() && !HasDisplacement();
+}
+
+void Mesh::get_primitive_motion_bounds(Index prim_id,
+    Box *bounds_open, Box *bounds_close) const
+{
+  if (HasDisplacement()) {
+    get_primitive_bounds(prim_id, bounds_open);
+    *bounds_close = *bounds_open;
+    return;
+  }
+
+  Vector P0, P1, P2;
+  get_point_positions(*this, prim_id, P0, P1, P2);
+
+  TriComputeBounds(P0, P1, P2, bounds_open);
+
+  if (!HasPointVelocity()) {
+    *bounds_close = *bounds_open;
+    return;
+  }
+
+  Vector velocity0, velocity1, velocity2;
+  get_point_velocity(*this, prim_id, velocity0, velocity1, velocity2);
+
+  TriComputeBounds(P0 + velocity0, P1 + velocity1, P2 + velocity2, bounds_close);
+}
+
 void Mesh::get_bounds(Box *bounds) const
 {
   *bounds = GetBounds();
@@ -448,6 +1363,99 @@ Index Mesh::get_primitive_count() const
   return GetFaceCount();
 }
 
+uint64_t Mesh::compute_content_hash() const
+{
+  // tessellation settings don't count as changes. displaced meshes are
+  // never the same
+  if (HasDisplacement()) {
+    return 0;
+  }
+
+  uint64_t hash = PRIM_HASH_BASIS;
+  hash = PrimHashBytes(hash, &point_count_, sizeof(point_count_));
+  hash = PrimHashBytes(hash, &face_count_, sizeof(face_count_));
+  hash = PrimHashArray(hash, P_.data(), P_.size());
+  hash = PrimHashArray(hash, N_.data(), N_.size());
+  hash = PrimHashArray(hash, Cd_.data(), Cd_.size());
+  hash = PrimHashArray(hash, uv_.data(), uv_.size());
+  hash = PrimHashArray(hash, velocity_.data(), velocity_.size());
+  hash = PrimHashArray(hash, indices_.data(), indices_.size());
+  hash = PrimHashArray(hash, face_group_id_.data(), face_group_id_.size());
+
+  const Index nvalues = vertex_normal_.GetValueCount();
+  const Index nindices = vertex_normal_.GetIndexCount();
+  hash = PrimHashBytes(hash, &nvalues, sizeof(nvalues));
+  hash = PrimHashBytes(hash, &nindices, sizeof(nindices));
+  for (Index i = 0; i < nvalues; i++) {
+    const Vector value = vertex_normal_.GetValue(i);
+    hash = PrimHashBytes(hash, &value, sizeof(value));
+  }
+  for (Index i = 0; i < nindices; i++) {
+    const Index index = vertex_normal_.GetIndex(i);
+    hash = PrimHashBytes(hash, &index, sizeof(index));
+  }
+
+  return hash == 0 ? 1 : hash;
+}
+
+bool Mesh::has_same_content(const PrimitiveSet &other) const
+{
+  const Mesh *mesh = dynamic_cast<const Mesh *>(&other);
+  if (mesh == NULL || HasDisplacement() || mesh->HasDisplacement()) {
+    return false;
+  }
+  if (point_count_ != mesh->point_count_ || face_count_ != mesh->face_count_) {
+    return false;
+  }
+  if (!PrimSameArray(P_.data(), P_.size(), mesh->P_.data(), mesh->P_.size()) ||
+      !PrimSameArray(N_.data(), N_.size(), mesh->N_.data(), mesh->N_.size()) ||
+      !PrimSameArray(Cd_.data(), Cd_.size(), mesh->Cd_.data(), mesh->Cd_.size()) ||
+      !PrimSameArray(uv_.data(), uv_.size(), mesh->uv_.data(), mesh->uv_.size()) ||
+      !PrimSameArray(velocity_.data(), velocity_.size(),
+          mesh->velocity_.data(), mesh->velocity_.size()) ||
+      !PrimSameArray(indices_.data(), indices_.size(),
+          mesh->indices_.data(), mesh->indices_.size()) ||
+      !PrimSameArray(face_group_id_.data(), face_group_id_.size(),
+          mesh->face_group_id_.data(), mesh->face_group_id_.size())) {
+    return false;
+  }
+
+  const VertexAttribute<Vector> &other_normal = mesh->vertex_normal_;
+  const Index nvalues = vertex_normal_.GetValueCount();
+  const Index nindices = vertex_normal_.GetIndexCount();
+  if (nvalues != other_normal.GetValueCount() || nindices != other_normal.GetIndexCount()) {
+    return false;
+  }
+  for (Index i = 0; i < nvalues; i++) {
+    const Vector a = vertex_normal_.GetValue(i);
+    const Vector b = other_normal.GetValue(i);
+    if (std::memcmp(&a, &b, sizeof(a)) != 0) {
+      return false;
+    }
+  }
+  for (Index i = 0; i < nindices; i++) {
+    if (vertex_normal_.GetIndex(i) != other_normal.GetIndex(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::size_t Mesh::get_memory_usage() const
+{
+  return
+      vertex_normal_.GetMemoryUsage() +
+      P_.GetMemoryUsage() +
+      N_.GetMemoryUsage() +
+      Cd_.GetMemoryUsage() +
+      uv_.GetMemoryUsage() +
+      velocity_.GetMemoryUsage() +
+      indices_.GetMemoryUsage() +
+      face_group_id_.GetMemoryUsage() +
+      MemoryUsageOf(triangles_) +
+      MemoryUsageOf(face_vertex_normals_);
+}
+
 void MshGetFacePointPosition(const Mesh *mesh, int face_index,
     Vector *P0, Vector *P1, Vector *P2)
 {
@@ -6,8 +6,10 @@
 
 #include "fj_compatibility.h"
 #include "fj_vertex_attribute.h"
+#include "fj_mapped_array.h"
 #include "fj_primitive_set.h"
 #include "fj_tex_coord.h"
+#include "fj_triangle.h"
 #include "fj_vector.h"
 #include "fj_color.h"
 #include "fj_types.h"
@@ -15,10 +17,37 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <map>
+#include <cstdint>
 
 namespace fj {
 
+class TessellatedFace;
+class Texture;
+
+// Read only view of mesh attributes for ray intersection and shading
+// taken at Mesh::ComputeBounds(). arrays are contiguous and indexed
+// without bounds checks. missing attributes are NULL
+class MeshSnapshot {
+public:
+  MeshSnapshot() : P(NULL), N(NULL), uv(NULL), velocity(NULL),
+      indices(NULL), group_id(NULL), vertex_N(NULL) {}
+  ~MeshSnapshot() {}
+
+  const Vector *P;
+  const Vector *N;
+  const TexCoord *uv;
+  const Vector *velocity;
+  const Index3 *indices;
+  const int *group_id;
+  // vertex normals resolved to 3 per face
+  const Vector *vertex_N;
+};
+
+const int MESH_DEFAULT_DISPLACEMENT_MAX_LEVEL = 5;
+const int MESH_MAX_DISPLACEMENT_LEVEL = 10;
+
 class FJ_API Mesh : public PrimitiveSet {
 public:
   Mesh();
@@ -182,20 +211,89 @@ public:
   bool HasFaceIndices() const;
   bool HasFaceGroupID() const;
 
+  // positions, normals and face indices refer to memory kept alive by
+  // mapping, e.g. a mapped mesh file, instead of being copied. NULL leaves
+  // the attribute as it is. counts must be set before. writing to an
+  // attribute copies it first
+  void ReferMappedData(const std::shared_ptr<const void> &mapping,
+      const Vector *P, const Vector *N, const Index3 *indices);
+  // makes this and other refer to one copy of positions, normals and face
+  // indices of this mesh. either copies an array before writing to it.
+  // other must have the same content e.g. the same GetContentHash()
+  void ShareArrays(Mesh *other);
+
   int CreateFaceGroup(const std::string &group_name);
   int LookupFaceGroup(const std::string &group_name) const;
 
+  // faces are displaced along normals by scale times the first channel of
+  // the map at texture coordinates. each face is tessellated on demand into
+  // micro-triangles whose edges are about rate pixels long on the dicing
+  // camera of TessellationCacheGetGlobal(), up to 4^max_level of them.
+  // distances to the camera are measured in object space. the map should be
+  // in [0, 1]. meshes without texture coordinates are not displaced and
+  // displaced meshes ignore velocity
+  void SetDisplacementMap(const Texture *map);
+  void SetDisplacementScale(Real scale);
+  void SetDisplacementRate(Real rate);
+  void SetDisplacementMaxLevel(int max_level);
+  bool HasDisplacement() const;
+
   void ComputeNormals();
+  // also takes the snapshot and computes the precomputed triangles again
+  // if they were requested. call this again after changing the mesh
   void ComputeBounds();
   void Clear();
 
+  // true if the mesh has no velocity, displacement or paged positions.
+  // accelerators may copy vertices of static meshes next to each other
+  // and release the precomputed triangles
+  bool IsStatic() const;
+  // vert0 and edges of faces for ray intersection of static meshes, about
+  // 72 bytes per face. built only for accelerators testing faces with them
+  // and kept up to date by ComputeBounds until released
+  void PrecomputeTriangles();
+  void ReleasePrecomputedTriangles();
+
 private:
+  template <typename T> friend class PrimitiveLeafTest;
+
   virtual bool ray_intersect(Index prim_id, const Ray &ray,
       Real time, Intersection *isect) const;
+  virtual bool ray_occlude(Index prim_id, const Ray &ray,
+      Real time, Intersection *isect) const;
+  virtual bool ray_intersect_list(const Index *prim_ids, int count, const Ray &ray,
+      Real time, Intersection *isect) const;
+  // faces of a leaf cluster. the three local indices of each face refer to
+  // the vertices of the cluster
+  bool ray_intersect_cluster(const Index *prim_ids, const uint8_t *local_indices,
+      const Vector *points, int count, const Ray &ray, Intersection *isect) const;
+  bool ray_occlude_cluster(const Index *prim_ids, const uint8_t *local_indices,
+      const Vector *points, int count, const Ray &ray, Intersection *isect) const;
+  virtual void compute_hit_attributes(const Ray &ray, Real time, Intersection *isect) const;
   virtual bool box_intersect(Index prim_id, const Box &box) const;
   virtual void get_primitive_bounds(Index prim_id, Box *bounds) const;
+  virtual void get_clipped_primitive_bounds(Index prim_id, const Box &clip,
+      Box *bounds) const;
+  virtual bool has_motion() const;
+  virtual void get_primitive_motion_bounds(Index prim_id,
+      Box *bounds_open, Box *bounds_close) const;
   virtual void get_bounds(Box *bounds) const;
   virtual Index get_primitive_count() const;
+  virtual std::size_t get_memory_usage() const;
+  virtual uint64_t compute_content_hash() const;
+  virtual bool has_same_content(const PrimitiveSet &other) const;
+
+  bool has_precomputed_triangles() const;
+  void update_precomputed_triangles();
+  bool is_paged() const;
+  void take_snapshot();
+
+  int get_displacement_level(Index prim_id) const;
+  Vector get_displaced_point(Index prim_id, Real u, Real v, int level) const;
+  void tessellate_face(Index prim_id, int level, TessellatedFace *face) const;
+  std::shared_ptr<const TessellatedFace> get_tessellated_face(Index prim_id) const;
+  bool displaced_ray_intersect(Index prim_id, const Ray &ray, Intersection *isect) const;
+  void compute_displaced_hit_attributes(const Ray &ray, Intersection *isect) const;
 
   int point_count_;
   int face_count_;
@@ -203,16 +301,31 @@ private:
   //TODO TEST
   VertexAttribute<Vector> vertex_normal_;
 
-  std::vector<Vector>   P_;
-  std::vector<Vector>   N_;
-  std::vector<Color>    Cd_;
-  std::vector<TexCoord> uv_;
-  std::vector<Vector>   velocity_;
-  std::vector<Index3>   indices_;
-  std::vector<int>      face_group_id_;
+  MappedArray<Vector>   P_;
+  MappedArray<Vector>   N_;
+  MappedArray<Color>    Cd_;
+  MappedArray<TexCoord> uv_;
+  MappedArray<Vector>   velocity_;
+  MappedArray<Index3>   indices_;
+  MappedArray<int>      face_group_id_;
+  std::shared_ptr<const void> mapping_;
 
   std::map<std::string, int> face_group_name_;
 
+  // vert0 and edges of each face for static meshes
+  std::vector<PrecomputedTriangle> triangles_;
+  std::vector<Vector> face_vertex_normals_;
+  MeshSnapshot snapshot_;
+
+  const Texture *displacement_map_;
+  Real displacement_scale_;
+  Real displacement_rate_;
+  int displacement_max_level_;
+  // of the tessellation cache
+  int tessellation_id_;
+  // set by PrecomputeTriangles until released
+  bool precompute_triangles_;
+
   Box bounds_;
 };
 
@@ -2,17 +2,25 @@
 // See LICENSE and README
 
 #include "fj_mipmap.h"
+#include "fj_compression.h"
+#include "fj_multi_thread.h"
 #include "fj_numeric.h"
+#include "fj_os.h"
 #include "fj_vector.h"
 #include "fj_box.h"
 
+#include <algorithm>
+#include <fstream>
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
 #include <cerrno>
 #include <cmath>
 
-#define MIP_FILE_VERSION 1
+// version 2 has all levels after level 0
+// version 3 has the tile format after the level count
+// version 4 has flags after the tile format
+#define MIP_FILE_VERSION 4
 #define MIP_FILE_MAGIC "MIPM"
 #define MIP_MAGIC_SIZE 4
 
@@ -23,7 +31,14 @@ static inline float round(float x)
   return std::floor(x + .5);
 }
 
+// flags of the file
+static const int MIP_FLAG_BUMP_DERIVATIVES = 1 << 0;
+
 static const int POW2_SIZE = 16;
+// rows of images are scaled by tasks of this many rows
+static const int ROWS_PER_TASK = 16;
+// levels are encoded and written by chunks of tile rows of about this size
+static const size_t BYTES_PER_WRITE = 32 * 1024 * 1024;
 
 static int error_no = ERR_MIP_NOERR;
 static int pow2[POW2_SIZE] = {
@@ -48,13 +63,72 @@ public:
   float x, y;
 };
 
+class ImageScaler {
+public:
+  ImageScaler() : src(NULL), sw(0), sh(0), dst(NULL), dw(0), dh(0), nchannels(0) {}
+  ~ImageScaler() {}
+
+public:
+  const float *src;
+  int sw, sh;
+  float *dst;
+  int dw, dh;
+  int nchannels;
+};
+
+// encodes tiles of tile rows from first_row into dst one after another
+class TileEncoder {
+public:
+  TileEncoder() : level(NULL), tilesize(0), format(MIP_TILE_FLOAT),
+      xntiles(0), first_row(0), tile_bytes(0), dst(NULL) {}
+  ~TileEncoder() {}
+
+public:
+  const FrameBuffer *level;
+  int tilesize;
+  int format;
+  int xntiles;
+  int first_row;
+  size_t tile_bytes;
+  char *dst;
+};
+
 static void compute_output_res(int in_w, int in_h, int *out_w, int *out_h);
 static void scale_and_copy_image(const float *src, int sw, int sh,
     float *dst, int dw, int dh, int nchannels);
+static void scale_rows(const ImageScaler &scaler, int ymin, int ymax);
+static LoopStatus scale_rows_task(void *data, const ThreadContext &context);
+static LoopStatus encode_tile_task(void *data, const ThreadContext &context);
+static void run_tasks(void *data, TaskFunction task_fn, int task_count);
+static int count_levels(int width, int height);
+static int level_size(int size, int level);
+static int level_tile_size(int tilesize, int width, int height, int level);
+static void append_bump_derivatives(FrameBuffer &level, int level_index);
+static void write_level(FILE *file, const FrameBuffer &level, int tilesize, int format);
+static size_t channel_size(int format);
+static void encode_texels(const float *src, size_t count, int format, void *dst);
+static void decode_texels(const void *src, size_t count, int format, float *dst);
 
 // TODO REMOVE THIS
 static void set_error(int err);
 
+// Unmaps the file when the last reader sharing it is gone.
+class MipMapping {
+public:
+  MipMapping(void *data, size_t size) : data_(data), size_(size) {}
+  ~MipMapping() { OsUnmapFile(data_, size_); }
+
+  const char *GetData() const { return static_cast<const char *>(data_); }
+  size_t GetSize() const { return size_; }
+
+private:
+  MipMapping(const MipMapping &);
+  const MipMapping &operator=(const MipMapping &);
+
+  void *data_;
+  size_t size_;
+};
+
 int MipGetErrorNo(void)
 {
   return error_no;
@@ -79,7 +153,10 @@ const char *MipGetErrorMessage(int err)
 }
 
 MipInput::MipInput() :
+    filename_(),
     file_(NULL),
+    mapping_(),
+    read_pos_(0),
     version_(0),
     width_(0),
     height_(0),
@@ -87,8 +164,12 @@ MipInput::MipInput() :
     tilesize_(0),
     xntiles_(0),
     yntiles_(0),
+    format_(MIP_TILE_FLOAT),
+    flags_(0),
     offset_of_header_(0),
-    offset_of_tile_(0)
+    offset_of_tile_(0),
+    nlevels_(0),
+    level_offsets_()
 {
 }
 
@@ -99,7 +180,21 @@ MipInput::~MipInput()
 
 int MipInput::Open(const std::string &filename)
 {
-  file_ = fopen(filename.c_str(), "rb");
+  Close();
+  filename_ = filename;
+
+  size_t size = 0;
+  void *data = OsMapFile(filename.c_str(), &size);
+  if (data != NULL) {
+    // tiles are read in the order of texture lookups. reading ahead around
+    // them brings in tiles of other levels and far texels
+    OsAdviseMappedPages(data, size, OS_ACCESS_RANDOM);
+    mapping_ = std::make_shared<MipMapping>(data, size);
+    read_pos_ = 0;
+    return 0;
+  }
+
+  file_ = OsOpenFile(filename.c_str());
   if (file_ == NULL) {
     set_error(ERR_MIP_NOFILE);
     Close();
@@ -108,17 +203,61 @@ int MipInput::Open(const std::string &filename)
   return 0;
 }
 
+int MipInput::Share(const MipInput &other)
+{
+  if (!other.IsMapped() || other.nlevels_ < 1) {
+    // a file can't be shared. reads the file by itself
+    if (Open(other.filename_)) {
+      return -1;
+    }
+    return ReadHeader();
+  }
+
+  Close();
+  filename_ = other.filename_;
+  mapping_ = other.mapping_;
+  read_pos_ = other.read_pos_;
+
+  version_ = other.version_;
+  width_ = other.width_;
+  height_ = other.height_;
+  nchannels_ = other.nchannels_;
+  tilesize_ = other.tilesize_;
+  xntiles_ = other.xntiles_;
+  yntiles_ = other.yntiles_;
+  format_ = other.format_;
+  flags_ = other.flags_;
+  offset_of_header_ = other.offset_of_header_;
+  offset_of_tile_ = other.offset_of_tile_;
+  nlevels_ = other.nlevels_;
+  level_offsets_ = other.level_offsets_;
+
+  return 0;
+}
+
 void MipInput::Close()
 {
   if (file_ != NULL) {
-    fclose(file_);
+    OsCloseFile(file_);
     file_ = NULL;
   }
+  mapping_.reset();
+  read_pos_ = 0;
 }
 
 bool MipInput::IsOpen() const
 {
-  return file_ != NULL;
+  return file_ != NULL || mapping_;
+}
+
+bool MipInput::IsMapped() const
+{
+  return static_cast<bool>(mapping_);
+}
+
+const std::string &MipInput::GetFilename() const
+{
+  return filename_;
 }
 
 int MipInput::ReadHeader()
@@ -126,54 +265,166 @@ int MipInput::ReadHeader()
   size_t nreads = 0;
   char magic[MIP_MAGIC_SIZE];
 
-  nreads += sizeof(char) * fread(magic, sizeof(char), MIP_MAGIC_SIZE, file_);
+  nreads += sizeof(char) * read_header_values(magic, sizeof(char), MIP_MAGIC_SIZE);
   if (memcmp(magic, MIP_FILE_MAGIC, MIP_MAGIC_SIZE) != 0) {
     set_error(ERR_MIP_NOTMIP);
     return -1;
   }
-  nreads += sizeof(int) * fread(&version_, sizeof(int), 1, file_);
-  if (version_ != MIP_FILE_VERSION) {
+  nreads += sizeof(int) * read_header_values(&version_, sizeof(int), 1);
+  if (version_ < 1 || version_ > MIP_FILE_VERSION) {
     set_error(ERR_MIP_BADVER);
     return -1;
   }
-  nreads += sizeof(int) * fread(&width_, sizeof(int), 1, file_);
-  nreads += sizeof(int) * fread(&height_, sizeof(int), 1, file_);
-  nreads += sizeof(int) * fread(&nchannels_, sizeof(int), 1, file_);
-  nreads += sizeof(int) * fread(&tilesize_, sizeof(int), 1, file_);
+  nreads += sizeof(int) * read_header_values(&width_, sizeof(int), 1);
+  nreads += sizeof(int) * read_header_values(&height_, sizeof(int), 1);
+  nreads += sizeof(int) * read_header_values(&nchannels_, sizeof(int), 1);
+  nreads += sizeof(int) * read_header_values(&tilesize_, sizeof(int), 1);
+
+  nlevels_ = 1;
+  if (version_ >= 2) {
+    nreads += sizeof(int) * read_header_values(&nlevels_, sizeof(int), 1);
+  }
+  format_ = MIP_TILE_FLOAT;
+  if (version_ >= 3) {
+    nreads += sizeof(int) * read_header_values(&format_, sizeof(int), 1);
+  }
+  flags_ = 0;
+  if (version_ >= 4) {
+    nreads += sizeof(int) * read_header_values(&flags_, sizeof(int), 1);
+  }
+  if (width_ < 1 || height_ < 1 || tilesize_ < 1 ||
+      nlevels_ < 1 || nlevels_ > count_levels(width_, height_) ||
+      format_ < MIP_TILE_FLOAT || format_ > MIP_TILE_UINT8 ||
+      ((flags_ & MIP_FLAG_BUMP_DERIVATIVES) && nchannels_ < 3)) {
+    set_error(ERR_MIP_NOTMIP);
+    return -1;
+  }
 
   xntiles_ = width_ / tilesize_;
   yntiles_ = height_ / tilesize_;
 
   offset_of_header_ = nreads;
-  offset_of_tile_ = sizeof(float) * tilesize_ * tilesize_ * nchannels_;
+  offset_of_tile_ = channel_size(format_) * tilesize_ * tilesize_ * nchannels_;
+
+  // levels are stored one after another
+  level_offsets_.resize(nlevels_);
+  size_t offset = offset_of_header_;
+  for (int i = 0; i < nlevels_; i++) {
+    level_offsets_[i] = offset;
+    offset += channel_size(format_) * GetLevelWidth(i) * GetLevelHeight(i) * nchannels_;
+  }
 
   return 0;
 }
 
 int MipInput::ReadTile(int xtile, int ytile, float *dst)
 {
-  const int TILESIZE = tilesize_;
-  const int XNTILES = width_ / TILESIZE;
-  const int YNTILES = height_ / TILESIZE;
+  return ReadTile(0, xtile, ytile, dst);
+}
+
+int MipInput::ReadTile(int level, int xtile, int ytile, float *dst)
+{
+  if (level < 0 || level >= nlevels_) {
+    return -1;
+  }
+
+  const int TILESIZE = GetLevelTileSize(level);
+  const int XNTILES = GetLevelTileCountX(level);
+  const int YNTILES = GetLevelTileCountY(level);
   const int TILE_PXLS = TILESIZE * TILESIZE * nchannels_;
-  size_t nread = 0;
 
   // TODO TEMP out of border handling
   const int x = Clamp(xtile, 0, XNTILES-1);
   const int y = Clamp(ytile, 0, YNTILES-1);
   const int tile_index = y * XNTILES + x;
 
-  fseek(file_, offset_of_header_ + sizeof(float) * tile_index * TILE_PXLS , SEEK_SET);
+  return read_texels(level, tile_index, 0, TILE_PXLS, dst);
+}
 
-  nread = fread(dst, sizeof(float), TILE_PXLS, file_);
-  if (nread == 0) {
-    // TODO error handling
+int MipInput::ReadTileWithBorder(int level, int xtile, int ytile, float *dst)
+{
+  if (level < 0 || level >= nlevels_) {
+    return -1;
+  }
+
+  const int TILESIZE = GetLevelTileSize(level);
+  const int XNTILES = GetLevelTileCountX(level);
+  const int YNTILES = GetLevelTileCountY(level);
+  const int ROW_PXLS = TILESIZE * nchannels_;
+  const int STRIDE = ROW_PXLS + nchannels_;
+
+  const int x = Clamp(xtile, 0, XNTILES-1);
+  const int y = Clamp(ytile, 0, YNTILES-1);
+  // the image repeats so tiles at the edge border the other side
+  const int right = y * XNTILES + (x + 1) % XNTILES;
+  const int below = ((y + 1) % YNTILES) * XNTILES + x;
+  const int corner = ((y + 1) % YNTILES) * XNTILES + (x + 1) % XNTILES;
+  const int tile_index = y * XNTILES + x;
+  int err = 0;
+
+  for (int i = 0; i < TILESIZE; i++) {
+    float *row = dst + i * STRIDE;
+    err |= read_texels(level, tile_index, i * ROW_PXLS, ROW_PXLS, row);
+    err |= read_texels(level, right, i * ROW_PXLS, nchannels_, row + ROW_PXLS);
+  }
+  float *last_row = dst + TILESIZE * STRIDE;
+  err |= read_texels(level, below, 0, ROW_PXLS, last_row);
+  err |= read_texels(level, corner, 0, nchannels_, last_row + ROW_PXLS);
+
+  return err ? -1 : 0;
+}
+
+int MipInput::read_texels(int level, int tile_index, int first, int count, float *dst)
+{
+  const int TILESIZE = GetLevelTileSize(level);
+  const size_t TILE_PXLS = TILESIZE * TILESIZE * nchannels_;
+  const size_t CHANNEL_SIZE = channel_size(format_);
+  const size_t BYTES = CHANNEL_SIZE * count;
+  const size_t offset = level_offsets_[level] +
+      CHANNEL_SIZE * (TILE_PXLS * tile_index + first);
+  long long nread = 0;
+
+  if (mapping_) {
+    if (offset + BYTES > mapping_->GetSize()) {
+      return -1;
+    }
+    decode_texels(mapping_->GetData() + offset, count, format_, dst);
+    return 0;
+  }
+
+  if (format_ == MIP_TILE_FLOAT) {
+    nread = OsReadFile(file_, offset, dst, BYTES);
+  } else {
+    std::vector<char> encoded(BYTES);
+    nread = OsReadFile(file_, offset, &encoded[0], BYTES);
+    decode_texels(&encoded[0], count, format_, dst);
+  }
+  if (nread != static_cast<long long>(BYTES)) {
     return -1;
   }
 
   return 0;
 }
 
+size_t MipInput::read_header_values(void *dst, size_t size, size_t count)
+{
+  // the same as fread
+  if (!mapping_) {
+    const long long nread = OsReadFile(file_, read_pos_, dst, size * count);
+    if (nread <= 0) {
+      return 0;
+    }
+    read_pos_ += nread;
+    return static_cast<size_t>(nread) / size;
+  }
+
+  const size_t available = (mapping_->GetSize() - read_pos_) / size;
+  const size_t nreads = std::min(count, available);
+  memcpy(dst, mapping_->GetData() + read_pos_, size * nreads);
+  read_pos_ += size * nreads;
+  return nreads;
+}
+
 int MipInput::GetWidth() const
 {
   return width_;
@@ -204,6 +455,46 @@ int MipInput::GetTileSize() const
   return tilesize_;
 }
 
+int MipInput::GetTileFormat() const
+{
+  return format_;
+}
+
+bool MipInput::HasBumpDerivatives() const
+{
+  return (flags_ & MIP_FLAG_BUMP_DERIVATIVES) != 0;
+}
+
+int MipInput::GetLevelCount() const
+{
+  return nlevels_;
+}
+
+int MipInput::GetLevelWidth(int level) const
+{
+  return level_size(width_, level);
+}
+
+int MipInput::GetLevelHeight(int level) const
+{
+  return level_size(height_, level);
+}
+
+int MipInput::GetLevelTileSize(int level) const
+{
+  return level_tile_size(tilesize_, width_, height_, level);
+}
+
+int MipInput::GetLevelTileCountX(int level) const
+{
+  return GetLevelWidth(level) / GetLevelTileSize(level);
+}
+
+int MipInput::GetLevelTileCountY(int level) const
+{
+  return GetLevelHeight(level) / GetLevelTileSize(level);
+}
+
 MipOutput::MipOutput() :
     file_(NULL),
     version_(MIP_FILE_VERSION),
@@ -211,7 +502,10 @@ MipOutput::MipOutput() :
     height_(0),
     nchannels_(0),
     tilesize_(0),
-    fb_()
+    format_(MIP_TILE_FLOAT),
+    bump_derivatives_(false),
+    fb_(),
+    levels_()
 {
 }
 
@@ -267,14 +561,47 @@ int MipOutput::GenerateFromSourceData(const float *pixels,
   tilesize_ = Min(64, width_);
   tilesize_ = Min(tilesize_, height_);
 
+  const int NLEVELS = count_levels(width_, height_);
+  levels_.resize(NLEVELS - 1);
+  for (int i = 1; i < NLEVELS; i++) {
+    const FrameBuffer &finer = i == 1 ? fb_ : levels_[i - 2];
+    DownsampleInto(finer, levels_[i - 1]);
+  }
+
+  // of the downsampled colors of each level
+  if (bump_derivatives_) {
+    append_bump_derivatives(fb_, 0);
+    for (int i = 1; i < NLEVELS; i++) {
+      append_bump_derivatives(levels_[i - 1], i);
+    }
+    nchannels_ += 2;
+  }
+
   return 0;
 }
 
+int MipOutput::SetTileFormat(int format)
+{
+  if (format < MIP_TILE_FLOAT || format > MIP_TILE_UINT8) {
+    return -1;
+  }
+  format_ = format;
+  return 0;
+}
+
+void MipOutput::SetBumpDerivatives(bool bake)
+{
+  bump_derivatives_ = bake;
+}
+
 void MipOutput::WriteFile()
 {
   size_t nwrites;
   char magic[] = MIP_FILE_MAGIC;
   const int TILESIZE = tilesize_;
+  const int FLAGS = bump_derivatives_ ? MIP_FLAG_BUMP_DERIVATIVES : 0;
+  const int FORMAT = bump_derivatives_ && format_ == MIP_TILE_UINT8 ?
+      MIP_TILE_HALF : format_;
 
   nwrites = 0;
   nwrites += sizeof(char) * fwrite(magic, sizeof(char), MIP_MAGIC_SIZE, file_);
@@ -284,18 +611,14 @@ void MipOutput::WriteFile()
   nwrites += sizeof(int) *  fwrite(&nchannels_, sizeof(int), 1, file_);
   nwrites += sizeof(int) *  fwrite(&TILESIZE, sizeof(int), 1, file_);
 
-  const int XNTILES = width_ / TILESIZE;
-  const int YNTILES = height_ / TILESIZE;
-
-  FrameBuffer tilebuf;
-  tilebuf.Resize(TILESIZE, TILESIZE, nchannels_);
-  for (int y = 0; y < YNTILES; y++) {
-    for (int x = 0; x < XNTILES; x++) {
-      const int TILE_STARTX = x * TILESIZE;
-      const int TILE_STARTY = y * TILESIZE;
-      CopyInto(fb_, tilebuf, TILE_STARTX, TILE_STARTY);
-      fwrite(tilebuf.GetReadOnly(0, 0, 0), sizeof(float), tilebuf.GetSize(), file_);
-    }
+  const int NLEVELS = static_cast<int>(levels_.size()) + 1;
+  nwrites += sizeof(int) *  fwrite(&NLEVELS, sizeof(int), 1, file_);
+  nwrites += sizeof(int) *  fwrite(&FORMAT, sizeof(int), 1, file_);
+  nwrites += sizeof(int) *  fwrite(&FLAGS, sizeof(int), 1, file_);
+
+  write_level(file_, fb_, TILESIZE, FORMAT);
+  for (int i = 1; i < NLEVELS; i++) {
+    write_level(file_, levels_[i - 1], level_tile_size(TILESIZE, width_, height_, i), FORMAT);
   }
 }
 
@@ -309,6 +632,81 @@ int MipOutput::GetHeight() const
   return height_;
 }
 
+MipConvertCache::MipConvertCache() : keys_()
+{
+}
+
+MipConvertCache::~MipConvertCache()
+{
+}
+
+int MipConvertCache::Read(const std::string &filename)
+{
+  keys_.clear();
+
+  std::ifstream file(filename.c_str());
+  if (!file) {
+    return 0;
+  }
+
+  uint64_t key = 0;
+  std::string source;
+  while (file >> std::hex >> key && std::getline(file >> std::ws, source)) {
+    keys_[source] = key;
+  }
+  return file.eof() ? 0 : -1;
+}
+
+int MipConvertCache::Write(const std::string &filename) const
+{
+  std::ofstream file(filename.c_str());
+  for (std::map<std::string, uint64_t>::const_iterator it = keys_.begin();
+      it != keys_.end(); ++it) {
+    file << std::hex << it->second << " " << it->first << "\n";
+  }
+  return file ? 0 : -1;
+}
+
+bool MipConvertCache::IsConverted(const std::string &source, uint64_t key) const
+{
+  const std::map<std::string, uint64_t>::const_iterator it = keys_.find(source);
+  return key != 0 && it != keys_.end() && it->second == key;
+}
+
+void MipConvertCache::SetConverted(const std::string &source, uint64_t key)
+{
+  keys_[source] = key;
+}
+
+uint64_t MipComputeSourceKey(const std::string &filename, int format)
+{
+  // FNV-1a
+  const uint64_t HASH_OFFSET_BASIS = 14695981039346656037ULL;
+  const uint64_t HASH_PRIME = 1099511628211ULL;
+
+  size_t size = 0;
+  void *data = OsMapFile(filename.c_str(), &size);
+  if (data == NULL) {
+    return 0;
+  }
+  OsAdviseMappedPages(data, size, OS_ACCESS_SEQUENTIAL);
+
+  uint64_t hash = HASH_OFFSET_BASIS;
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= HASH_PRIME;
+  }
+  OsUnmapFile(data, size);
+
+  const unsigned char *format_bytes = reinterpret_cast<const unsigned char *>(&format);
+  for (size_t i = 0; i < sizeof(format); i++) {
+    hash ^= format_bytes[i];
+    hash *= HASH_PRIME;
+  }
+  return hash;
+}
+
 static void set_error(int err)
 {
   error_no = err;
@@ -330,6 +728,159 @@ static void compute_output_res(int in_w, int in_h, int *out_w, int *out_h)
   }
 }
 
+static int count_levels(int width, int height)
+{
+  int nlevels = 1;
+  while ((width >> nlevels) > 0 || (height >> nlevels) > 0) {
+    nlevels++;
+  }
+  return nlevels;
+}
+
+static int level_size(int size, int level)
+{
+  return std::max(size >> level, 1);
+}
+
+// the same ratio of width and height makes tiles smaller than
+// the level keep square
+static int level_tile_size(int tilesize, int width, int height, int level)
+{
+  const int w = level_size(width, level);
+  const int h = level_size(height, level);
+  return std::min(tilesize, std::min(w, h));
+}
+
+// central differences of the luminance. the image repeats. rows go down
+// while v goes up
+static void append_bump_derivatives(FrameBuffer &level, int level_index)
+{
+  const int W = level.GetWidth();
+  const int H = level.GetHeight();
+  const int NCHANS = level.GetChannelCount();
+  // differences span two texels of this level
+  const float SCALE = .5f / (1 << level_index);
+
+  std::vector<float> height(W * H);
+  for (int y = 0; y < H; y++) {
+    for (int x = 0; x < W; x++) {
+      const float *src = level.GetReadOnly(x, y, 0);
+      height[y * W + x] = NCHANS == 1 ? src[0] :
+          .298912f * src[0] + .586611f * src[1] + .114478f * src[2];
+    }
+  }
+
+  FrameBuffer baked;
+  baked.Resize(W, H, NCHANS + 2);
+  for (int y = 0; y < H; y++) {
+    const int up = (y + H - 1) % H;
+    const int down = (y + 1) % H;
+    for (int x = 0; x < W; x++) {
+      const int left = (x + W - 1) % W;
+      const int right = (x + 1) % W;
+      const float *src = level.GetReadOnly(x, y, 0);
+      float *dst = baked.GetWritable(x, y, 0);
+      for (int ch = 0; ch < NCHANS; ch++) {
+        dst[ch] = src[ch];
+      }
+      dst[NCHANS]     = SCALE * (height[y * W + right] - height[y * W + left]);
+      dst[NCHANS + 1] = SCALE * (height[up * W + x] - height[down * W + x]);
+    }
+  }
+
+  level = baked;
+}
+
+static void write_level(FILE *file, const FrameBuffer &level, int tilesize, int format)
+{
+  const int XNTILES = level.GetWidth() / tilesize;
+  const int YNTILES = level.GetHeight() / tilesize;
+
+  TileEncoder encoder;
+  encoder.level = &level;
+  encoder.tilesize = tilesize;
+  encoder.format = format;
+  encoder.xntiles = XNTILES;
+  encoder.tile_bytes = channel_size(format) * tilesize * tilesize * level.GetChannelCount();
+
+  const size_t TILE_ROW_BYTES = encoder.tile_bytes * XNTILES;
+  const int ROWS_PER_WRITE = static_cast<int>(std::max<size_t>(1, BYTES_PER_WRITE / TILE_ROW_BYTES));
+  std::vector<char> encoded;
+
+  for (int y = 0; y < YNTILES; y += ROWS_PER_WRITE) {
+    const int NROWS = std::min(ROWS_PER_WRITE, YNTILES - y);
+    encoded.resize(TILE_ROW_BYTES * NROWS);
+    encoder.first_row = y;
+    encoder.dst = &encoded[0];
+
+    run_tasks(&encoder, encode_tile_task, XNTILES * NROWS);
+    fwrite(&encoded[0], 1, encoded.size(), file);
+  }
+}
+
+static size_t channel_size(int format)
+{
+  switch (format) {
+  case MIP_TILE_HALF:
+    return sizeof(uint16_t);
+  case MIP_TILE_UINT8:
+    return sizeof(uint8_t);
+  default:
+    return sizeof(float);
+  }
+}
+
+static void encode_texels(const float *src, size_t count, int format, void *dst)
+{
+  switch (format) {
+  case MIP_TILE_HALF:
+    {
+      uint16_t *half = static_cast<uint16_t *>(dst);
+      for (size_t i = 0; i < count; i++) {
+        half[i] = FloatToHalf(src[i]);
+      }
+    }
+    break;
+  case MIP_TILE_UINT8:
+    {
+      uint8_t *byte = static_cast<uint8_t *>(dst);
+      for (size_t i = 0; i < count; i++) {
+        const float value = std::min(std::max(src[i], 0.f), 1.f);
+        byte[i] = static_cast<uint8_t>(value * 255 + .5f);
+      }
+    }
+    break;
+  default:
+    memcpy(dst, src, sizeof(float) * count);
+    break;
+  }
+}
+
+static void decode_texels(const void *src, size_t count, int format, float *dst)
+{
+  switch (format) {
+  case MIP_TILE_HALF:
+    {
+      const uint16_t *half = static_cast<const uint16_t *>(src);
+      for (size_t i = 0; i < count; i++) {
+        dst[i] = HalfToFloat(half[i]);
+      }
+    }
+    break;
+  case MIP_TILE_UINT8:
+    {
+      const uint8_t *byte = static_cast<const uint8_t *>(src);
+      for (size_t i = 0; i < count; i++) {
+        dst[i] = byte[i] / 255.f;
+      }
+    }
+    break;
+  default:
+    memcpy(dst, src, sizeof(float) * count);
+    break;
+  }
+}
+
 static void scale_and_copy_image(const float *src_pxls, int sw, int sh,
     float *dst_pxls, int dw, int dh, int nchannels)
 {
@@ -338,15 +889,30 @@ static void scale_and_copy_image(const float *src_pxls, int sw, int sh,
     return;
   }
 
-  const int DST_W = dw;
-  const int DST_H = dh;
-  const int SRC_W = sw;
-  const int SRC_H = sh;
-  const int NCHANS = nchannels;
-  const float XSCALE = dw / (float) sw;
-  const float YSCALE = dh / (float) sh;
+  ImageScaler scaler;
+  scaler.src = src_pxls;
+  scaler.sw = sw;
+  scaler.sh = sh;
+  scaler.dst = dst_pxls;
+  scaler.dw = dw;
+  scaler.dh = dh;
+  scaler.nchannels = nchannels;
+
+  run_tasks(&scaler, scale_rows_task, (dh + ROWS_PER_TASK - 1) / ROWS_PER_TASK);
+}
 
-  for (int dst_y = 0; dst_y < DST_H; dst_y++) {
+static void scale_rows(const ImageScaler &scaler, int ymin, int ymax)
+{
+  const float *src_pxls = scaler.src;
+  float *dst_pxls = scaler.dst;
+  const int DST_W = scaler.dw;
+  const int SRC_W = scaler.sw;
+  const int SRC_H = scaler.sh;
+  const int NCHANS = scaler.nchannels;
+  const float XSCALE = scaler.dw / (float) scaler.sw;
+  const float YSCALE = scaler.dh / (float) scaler.sh;
+
+  for (int dst_y = ymin; dst_y < ymax; dst_y++) {
     Position src_pos;
     src_pos.x = 0;
     src_pos.y = (dst_y + .5) / YSCALE;
@@ -397,4 +963,40 @@ static void scale_and_copy_image(const float *src_pxls, int sw, int sh,
   }
 }
 
+static LoopStatus scale_rows_task(void *data, const ThreadContext &context)
+{
+  const ImageScaler *scaler = static_cast<const ImageScaler *>(data);
+  const int ymin = context.iteration_id * ROWS_PER_TASK;
+  const int ymax = std::min(ymin + ROWS_PER_TASK, scaler->dh);
+  scale_rows(*scaler, ymin, ymax);
+  return LoopStatus::Continue;
+}
+
+static LoopStatus encode_tile_task(void *data, const ThreadContext &context)
+{
+  const TileEncoder *encoder = static_cast<const TileEncoder *>(data);
+  const int TILESIZE = encoder->tilesize;
+  const int x = context.iteration_id % encoder->xntiles;
+  const int y = context.iteration_id / encoder->xntiles + encoder->first_row;
+  const size_t ROW_TEXELS = TILESIZE * encoder->level->GetChannelCount();
+  const size_t ROW_BYTES = encoder->tile_bytes / TILESIZE;
+  char *dst = encoder->dst + encoder->tile_bytes * context.iteration_id;
+
+  // rows of the tile are contiguous in the level
+  for (int i = 0; i < TILESIZE; i++) {
+    const float *src = encoder->level->GetReadOnly(x * TILESIZE, y * TILESIZE + i, 0);
+    encode_texels(src, ROW_TEXELS, encoder->format, dst + ROW_BYTES * i);
+  }
+  return LoopStatus::Continue;
+}
+
+static void run_tasks(void *data, TaskFunction task_fn, int task_count)
+{
+  std::vector<int> task_que(task_count);
+  for (int i = 0; i < task_count; i++) {
+    task_que[i] = i;
+  }
+  MtRunParallelLoop(data, task_fn, MtGetMaxAvailableThreadCount(), task_que);
+}
+
 } // namespace xxx
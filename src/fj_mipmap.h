@@ -6,34 +6,88 @@
 
 #include "fj_compatibility.h"
 #include "fj_framebuffer.h"
+#include <memory>
 #include <string>
+#include <vector>
+#include <map>
 #include <cstdio>
+#include <cstdint>
 
 namespace fj {
 
 class FrameBuffer;
+class MipMapping;
+
+// how texels are stored in the file. tiles are always read as float.
+// uint8 is clamped to [0, 1]
+enum MipTileFormat {
+  MIP_TILE_FLOAT = 0,
+  MIP_TILE_HALF,
+  MIP_TILE_UINT8
+};
+
+class OsFile;
 
+// Reads tiles through a memory mapping of the file so that the OS page cache
+// decides which tiles stay in memory. falls back to reading the file at the
+// offsets of tiles when the file cannot be mapped.
 class FJ_API MipInput {
 public:
   MipInput();
   ~MipInput();
 
   int Open(const std::string &filename);
+  // Opens the same file as other after other has read the header. readers
+  // share the mapping of other so each thread can have its own reader
+  int Share(const MipInput &other);
   void Close();
   bool IsOpen() const;
+  bool IsMapped() const;
+  const std::string &GetFilename() const;
 
   int ReadHeader();
+  // reads a tile of level 0
   int ReadTile(int xtile, int ytile, float *dst);
-
+  // dst needs room for a tile of level 0. tiles of coarse levels are
+  // smaller when the level is smaller than a tile
+  int ReadTile(int level, int xtile, int ytile, float *dst);
+  // Same as above but each row has one more texel and one more row is at
+  // the end. they are copied from the tiles to the right and below so that
+  // bilinear filtering never needs other tiles. dst needs room for
+  // (tilesize + 1) x (tilesize + 1) texels
+  int ReadTileWithBorder(int level, int xtile, int ytile, float *dst);
+
+  // of level 0
   int GetWidth() const;
   int GetHeight() const;
   int GetChannelCount() const;
   int GetTileCountX() const;
   int GetTileCountY() const;
   int GetTileSize() const;
+  int GetTileFormat() const;
+  // the last two channels are the derivatives of the height written by
+  // MipOutput::SetBumpDerivatives
+  bool HasBumpDerivatives() const;
+
+  // level 0 is the full resolution and each level is half the size of
+  // the previous one down to 1x1. files of version 1 have only level 0
+  int GetLevelCount() const;
+  int GetLevelWidth(int level) const;
+  int GetLevelHeight(int level) const;
+  int GetLevelTileSize(int level) const;
+  int GetLevelTileCountX(int level) const;
+  int GetLevelTileCountY(int level) const;
 
 private:
-  FILE *file_;
+  size_t read_header_values(void *dst, size_t size, size_t count);
+  int read_texels(int level, int tile_index, int first, int count, float *dst);
+
+  std::string filename_;
+  OsFile *file_;
+  std::shared_ptr<const MipMapping> mapping_;
+  // position of the header being read
+  size_t read_pos_;
+
   int version_;
   int width_;
   int height_;
@@ -42,9 +96,15 @@ private:
   int tilesize_;
   int xntiles_;
   int yntiles_;
+  int format_;
+  int flags_;
 
   size_t offset_of_header_;
   size_t offset_of_tile_;
+
+  int nlevels_;
+  // offsets of the first tile of each level from the beginning of file
+  std::vector<size_t> level_offsets_;
 };
 
 class FJ_API MipOutput {
@@ -57,6 +117,13 @@ public:
   bool IsOpen() const;
 
   int GenerateFromSourceData(const float *pixels, int width, int height, int nchannels);
+  // MIP_TILE_FLOAT by default
+  int SetTileFormat(int format);
+  // appends two channels of the derivatives of the height (the luminance)
+  // with respect to u and v in texels of level 0 so that bump mapping needs
+  // one lookup. call before GenerateFromSourceData. derivatives are signed
+  // so uint8 tiles are written as half
+  void SetBumpDerivatives(bool bake);
   void WriteFile();
 
   int GetWidth() const;
@@ -69,10 +136,37 @@ private:
   int height_;
   int nchannels_;
   int tilesize_;
+  int format_;
+  bool bump_derivatives_;
 
   FrameBuffer fb_;
+  // levels from 1 to the last one
+  std::vector<FrameBuffer> levels_;
 };
 
+// Keys of source images converted into mip files of a directory so that
+// batch conversions skip sources not changed since. the file has a line of
+// "<key> <source name>" for each source
+class FJ_API MipConvertCache {
+public:
+  MipConvertCache();
+  ~MipConvertCache();
+
+  // a missing file is read as an empty cache
+  int Read(const std::string &filename);
+  int Write(const std::string &filename) const;
+
+  bool IsConverted(const std::string &source, uint64_t key) const;
+  void SetConverted(const std::string &source, uint64_t key);
+
+private:
+  std::map<std::string, uint64_t> keys_;
+};
+
+// Hash of the contents of the source file and the tile format.
+// returns 0 if the file cannot be read
+FJ_API uint64_t MipComputeSourceKey(const std::string &filename, int format);
+
 enum MipErrorNo {
   ERR_MIP_NOERR = 0,
   ERR_MIP_NOMEM,
@@ -2,176 +2,845 @@
 // See LICENSE and README
 
 #include "fj_multi_thread.h"
+#include "fj_os.h"
 
-#include <unordered_map>
+#include <condition_variable>
+#include <algorithm>
+#include <memory>
+#include <chrono>
 #include <utility>
 #include <vector>
+#include <atomic>
 #include <thread>
+#include <deque>
 #include <mutex>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
 
 namespace fj {
 
-// c++ thread id (0x2384b312) <=> our thread id (0 to N-1)
-static std::unordered_map<std::thread::id, int> thread_id_map;
-static std::mutex thread_id_map_mtx;
-static int active_thread_count = 1;
+// idle threads yield first then sleep so that waiting for the last
+// long task doesn't keep all the other cores busy
+static const int IDLE_YIELD_COUNT = 64;
+static const int IDLE_SLEEP_MICROSECONDS = 50;
 
-// manage all threads' status
-static LoopStatus global_loop_status = LoopStatus::Continue;
-static std::mutex global_stat_mtx;
+static void wait_for_task(int *idle_count)
+{
+  if (*idle_count < IDLE_YIELD_COUNT) {
+    (*idle_count)++;
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(IDLE_SLEEP_MICROSECONDS));
+  }
+}
+
+class Task {
+public:
+  Task() : data(NULL), task_fn(NULL), iteration_id(0), iteration_count(0),
+      group(NULL) {}
+  ~Task() {}
+
+  void *data;
+  TaskFunction task_fn;
+  int iteration_id;
+  int iteration_count;
+  // NULL for iterations of the top level loop
+  TaskGroup *group;
+};
+
+// The owner pushes and pops at the front so that spawned tasks run depth
+// first. thieves take from the back where the oldest and usually largest
+// tasks are. each queue has its own lock so threads only contend when
+// stealing from the same queue.
+class WorkQueue {
+public:
+  WorkQueue() {}
+  ~WorkQueue() {}
+
+  void PushFront(const Task &task)
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    tasks_.push_front(task);
+  }
+  void PushBack(const Task &task)
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    tasks_.push_back(task);
+  }
+  bool PopFront(Task *task)
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    *task = tasks_.front();
+    tasks_.pop_front();
+    return true;
+  }
+  bool PopBack(Task *task)
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    *task = tasks_.back();
+    tasks_.pop_back();
+    return true;
+  }
+  // takes the task nearest to the front or the back that belongs to group
+  // or its descendants. other tasks stay in the queue
+  bool PopInGroup(const TaskGroup *group, bool from_front, Task *task)
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    const std::size_t N = tasks_.size();
+    for (std::size_t i = 0; i < N; i++) {
+      const std::size_t index = from_front ? i : N - 1 - i;
+      if (is_in_group(tasks_[index], group)) {
+        *task = tasks_[index];
+        tasks_.erase(tasks_.begin() + index);
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  // groups of queued tasks and their parents are alive since each parent
+  // waits in a running task for the groups spawned inside it
+  static bool is_in_group(const Task &task, const TaskGroup *group)
+  {
+    for (const TaskGroup *g = task.group; g != NULL; g = g->parent_) {
+      if (g == group) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::deque<Task> tasks_;
+  std::mutex mtx_;
+};
+
+class TaskScheduler {
+public:
+  TaskScheduler(int thread_count) :
+      queues_(new WorkQueue[thread_count]),
+      thread_count_(thread_count),
+      pending_(0),
+      cancelled_(false)
+  {
+  }
+  ~TaskScheduler() {}
+
+  int GetThreadCount() const { return thread_count_; }
+  bool IsCancelled() const { return cancelled_.load(); }
+
+  void Push(int thread_id, const Task &task, bool at_front);
+  // runs tasks on this thread until all tasks in the scheduler are done
+  void RunWorker(int thread_id);
+  // runs tasks of the group and its descendants on this thread until all
+  // tasks in the group are done. other tasks are left to other threads so
+  // that an iteration of the outer loop never starts in the middle of a task
+  void WaitGroup(int thread_id, const TaskGroup &group);
+  // true if the loop or any group the task is in has been cancelled
+  bool IsCancelled(const TaskGroup *group) const;
+
+private:
+  bool get_task(int thread_id, Task *task);
+  bool get_group_task(int thread_id, const TaskGroup &group, Task *task);
+  void run_task(int thread_id, const Task &task);
+
+  std::unique_ptr<WorkQueue[]> queues_;
+  const int thread_count_;
+  // tasks queued or running. spawned tasks are counted before
+  // their parent finishes so this never reaches zero too early
+  std::atomic<int> pending_;
+  std::atomic<bool> cancelled_;
+};
+
+// the scheduler and the context of the calling thread. these are set only
+// while the thread runs a parallel loop so no lock is needed to read them
+static thread_local TaskScheduler *current_scheduler = NULL;
+static thread_local ThreadContext current_context;
+// the group of the task running on the calling thread. NULL for
+// iterations of the top level loop
+static thread_local TaskGroup *current_group = NULL;
+
+// sets the thread local context while a task runs
+class ContextBinding {
+public:
+  ContextBinding(const ThreadContext &context) : prev_context_(current_context)
+  {
+    current_context = context;
+  }
+  ~ContextBinding()
+  {
+    current_context = prev_context_;
+  }
+
+private:
+  ThreadContext prev_context_;
+};
+
+// sets the thread local scheduler while a thread works for it
+class SchedulerBinding {
+public:
+  SchedulerBinding(TaskScheduler *scheduler, ThreadContext context) :
+      prev_scheduler_(current_scheduler),
+      context_binding_(context)
+  {
+    current_scheduler = scheduler;
+  }
+  ~SchedulerBinding()
+  {
+    current_scheduler = prev_scheduler_;
+  }
+
+private:
+  TaskScheduler *prev_scheduler_;
+  ContextBinding context_binding_;
+};
+
+void TaskScheduler::Push(int thread_id, const Task &task, bool at_front)
+{
+  pending_++;
+  if (task.group != NULL) {
+    task.group->pending_++;
+  }
+
+  if (at_front) {
+    queues_[thread_id].PushFront(task);
+  } else {
+    queues_[thread_id].PushBack(task);
+  }
+}
+
+void TaskScheduler::RunWorker(int thread_id)
+{
+  ThreadContext cxt;
+  cxt.thread_id = thread_id;
+  cxt.thread_count = thread_count_;
+  SchedulerBinding binding(this, cxt);
+
+  int idle_count = 0;
+
+  while (pending_.load() > 0) {
+    Task task;
+    if (get_task(thread_id, &task)) {
+      run_task(thread_id, task);
+      idle_count = 0;
+    } else {
+      wait_for_task(&idle_count);
+    }
+  }
+}
 
-// manage iterations
-static int iteration_que_index = 0;
-static std::mutex iteration_que_index_mtx;
+void TaskScheduler::WaitGroup(int thread_id, const TaskGroup &group)
+{
+  int idle_count = 0;
+
+  while (group.pending_.load() > 0) {
+    Task task;
+    if (get_group_task(thread_id, group, &task)) {
+      run_task(thread_id, task);
+      idle_count = 0;
+    } else {
+      wait_for_task(&idle_count);
+    }
+  }
+}
 
-static void register_thread_id(int id)
+bool TaskScheduler::get_task(int thread_id, Task *task)
 {
-  std::lock_guard<std::mutex> lock(thread_id_map_mtx);
+  if (queues_[thread_id].PopFront(task)) {
+    return true;
+  }
+
+  for (int i = 1; i < thread_count_; i++) {
+    const int victim = (thread_id + i) % thread_count_;
+    if (queues_[victim].PopBack(task)) {
+      return true;
+    }
+  }
 
-  const auto this_id = std::this_thread::get_id();
-  thread_id_map[this_id] = id;
+  return false;
 }
 
-static void unregister_thread_id()
+bool TaskScheduler::get_group_task(int thread_id, const TaskGroup &group, Task *task)
 {
-  std::lock_guard<std::mutex> lock(thread_id_map_mtx);
+  if (queues_[thread_id].PopInGroup(&group, true, task)) {
+    return true;
+  }
+
+  for (int i = 1; i < thread_count_; i++) {
+    const int victim = (thread_id + i) % thread_count_;
+    if (queues_[victim].PopInGroup(&group, false, task)) {
+      return true;
+    }
+  }
 
-  const auto this_id = std::this_thread::get_id();
-  thread_id_map.erase(this_id);
+  return false;
 }
 
-// thread registeration RAII
-class ThreadRegistration {
+bool TaskScheduler::IsCancelled(const TaskGroup *group) const
+{
+  for (const TaskGroup *g = group; g != NULL; g = g->parent_) {
+    if (g->cancelled_.load()) {
+      return true;
+    }
+  }
+  return IsCancelled();
+}
+
+void TaskScheduler::run_task(int thread_id, const Task &task)
+{
+  // tasks are still taken after cancellation so that waiting
+  // threads and groups finish, but they are not run
+  if (!IsCancelled(task.group)) {
+    ThreadContext cxt;
+    cxt.thread_count = thread_count_;
+    cxt.thread_id = thread_id;
+    cxt.iteration_count = task.iteration_count;
+    cxt.iteration_id = task.iteration_id;
+
+    ContextBinding binding(cxt);
+    TaskGroup *prev_group = current_group;
+    current_group = task.group;
+    const LoopStatus status = task.task_fn(task.data, cxt);
+    current_group = prev_group;
+
+    // a task of a group cancels only the group and its descendants
+    if (status == LoopStatus::Cancel) {
+      if (task.group != NULL) {
+        task.group->cancelled_.store(true);
+      } else {
+        cancelled_.store(true);
+      }
+    }
+  }
+
+  if (task.group != NULL) {
+    task.group->pending_--;
+  }
+  pending_--;
+}
+
+// Workers are parked on a condition variable between loops. a loop wakes
+// the workers it needs and the calling thread works as thread 0. thread
+// affinity is applied by the worker itself while it is parked
+class ThreadPool {
 public:
-  ThreadRegistration(int thread_id)
+  ThreadPool() :
+      job_(NULL),
+      job_thread_count_(0),
+      job_generation_(0),
+      running_count_(0),
+      is_busy_(false),
+      is_stopping_(false)
   {
-    register_thread_id(thread_id);
   }
-  ~ThreadRegistration()
+  ~ThreadPool()
   {
-    unregister_thread_id();
+    Stop();
   }
+
+  int Start(int thread_count);
+  void Stop();
+  // the number of threads including the calling thread
+  int GetSize() const;
+  // returns false if the pool is too small or used by another loop
+  bool Run(TaskScheduler *scheduler);
+  int SetAffinity(int thread_id, const std::vector<int> &cpu_ids);
+
+private:
+  void worker_loop(int thread_id, unsigned long generation);
+
+  // for worker 1 to N-1. index 0 is not used
+  std::vector<std::thread> threads_;
+  std::vector<std::vector<int>> affinity_requests_;
+  std::vector<char> has_affinity_request_;
+  std::vector<int> affinity_results_;
+
+  TaskScheduler *job_;
+  int job_thread_count_;
+  unsigned long job_generation_;
+  int running_count_;
+  bool is_busy_;
+  bool is_stopping_;
+
+  mutable std::mutex mtx_;
+  std::condition_variable wake_cv_;
+  std::condition_variable done_cv_;
 };
 
-static int get_thread_id()
+int ThreadPool::Start(int thread_count)
 {
-  std::lock_guard<std::mutex> lock(thread_id_map_mtx);
-  const auto this_id = std::this_thread::get_id();
-  return thread_id_map[this_id];
-}
+  if (thread_count < 1) {
+    return -1;
+  }
+  if (thread_count == GetSize()) {
+    return 0;
+  }
+  Stop();
 
-static int get_active_thread_count()
-{
-  std::lock_guard<std::mutex> lock(thread_id_map_mtx);
-  return thread_id_map.size();
+  std::lock_guard<std::mutex> lock(mtx_);
+  threads_.resize(thread_count);
+  affinity_requests_.resize(thread_count);
+  has_affinity_request_.resize(thread_count, 0);
+  affinity_results_.resize(thread_count, 0);
+
+  // workers start from the current generation so they never run a stale job
+  for (int i = 1; i < thread_count; i++) {
+    threads_[i] = std::thread(&ThreadPool::worker_loop, this, i, job_generation_);
+  }
+
+  return 0;
 }
 
-static LoopStatus get_global_loop_status()
+void ThreadPool::Stop()
 {
-  std::lock_guard<std::mutex> lock(global_stat_mtx);
-  return global_loop_status;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (threads_.empty()) {
+      return;
+    }
+    is_stopping_ = true;
+  }
+  wake_cv_.notify_all();
+
+  for (std::size_t i = 1; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  threads_.clear();
+  affinity_requests_.clear();
+  has_affinity_request_.clear();
+  affinity_results_.clear();
+  is_stopping_ = false;
 }
 
-static void cancel_parallel_loop()
+int ThreadPool::GetSize() const
 {
-  std::lock_guard<std::mutex> lock(global_stat_mtx);
-  global_loop_status = LoopStatus::Cancel;
+  std::lock_guard<std::mutex> lock(mtx_);
+  return static_cast<int>(threads_.size());
 }
 
-static void init_iteration_que_index()
+bool ThreadPool::Run(TaskScheduler *scheduler)
 {
-  iteration_que_index = 0;
+  const int thread_count = scheduler->GetThreadCount();
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (is_busy_ || is_stopping_ || thread_count > static_cast<int>(threads_.size())) {
+      return false;
+    }
+    is_busy_ = true;
+    job_ = scheduler;
+    job_thread_count_ = thread_count;
+    job_generation_++;
+    running_count_ = thread_count - 1;
+  }
+  wake_cv_.notify_all();
+
+  scheduler->RunWorker(0);
+
+  std::unique_lock<std::mutex> lock(mtx_);
+  done_cv_.wait(lock, [this] { return running_count_ == 0; });
+  job_ = NULL;
+  is_busy_ = false;
+
+  return true;
 }
 
-static int checkout_iteration_id(const std::vector<int> &iteration_que)
+int ThreadPool::SetAffinity(int thread_id, const std::vector<int> &cpu_ids)
 {
-  static std::mutex mtx;
-  std::lock_guard<std::mutex> lock(iteration_que_index_mtx);
+  if (thread_id == 0) {
+    return OsSetThreadAffinity(cpu_ids.empty() ? NULL : &cpu_ids[0],
+        static_cast<int>(cpu_ids.size()));
+  }
 
-  const int que_size = static_cast<int>(iteration_que.size());
-  if (iteration_que_index >= que_size) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  if (thread_id < 0 || thread_id >= static_cast<int>(threads_.size()) || is_busy_) {
     return -1;
   }
+  affinity_requests_[thread_id] = cpu_ids;
+  has_affinity_request_[thread_id] = 1;
+  wake_cv_.notify_all();
 
-  const int id = iteration_que[iteration_que_index];
-  iteration_que_index++;
-
-  return id;
+  done_cv_.wait(lock, [this, thread_id] { return !has_affinity_request_[thread_id]; });
+  return affinity_results_[thread_id];
 }
 
-static void parallel_for(int thread_id, const std::vector<int> &iteration_que,
-    void *data, TaskFunction task)
+void ThreadPool::worker_loop(int thread_id, unsigned long generation)
 {
-  ThreadRegistration reg(thread_id);
+  std::unique_lock<std::mutex> lock(mtx_);
 
   for (;;) {
-    // check global loop status
-    const LoopStatus global_status = get_global_loop_status();
-    if (global_status == LoopStatus::Cancel) {
+    wake_cv_.wait(lock, [this, thread_id, generation] {
+      return is_stopping_ || job_generation_ != generation ||
+          has_affinity_request_[thread_id];
+    });
+
+    if (is_stopping_) {
       break;
     }
 
-    // checkout next iteration
-    const int iteration_id = checkout_iteration_id(iteration_que);
-    if (iteration_id == -1) {
-      break;
+    if (has_affinity_request_[thread_id]) {
+      const std::vector<int> &cpu_ids = affinity_requests_[thread_id];
+      affinity_results_[thread_id] = OsSetThreadAffinity(
+          cpu_ids.empty() ? NULL : &cpu_ids[0], static_cast<int>(cpu_ids.size()));
+      has_affinity_request_[thread_id] = 0;
+      done_cv_.notify_all();
+      continue;
     }
 
-    ThreadContext cxt;
-    cxt.thread_count = MtGetActiveThreadCount();
-    cxt.thread_id = MtGetThreadID();
-    cxt.iteration_count = iteration_que.size();
-    cxt.iteration_id = iteration_id;
+    generation = job_generation_;
+    if (thread_id >= job_thread_count_) {
+      continue;
+    }
 
-    const LoopStatus local_status = task(data, cxt);
-    if (local_status == LoopStatus::Cancel) {
-      cancel_parallel_loop();
-      break;
+    TaskScheduler *scheduler = job_;
+    lock.unlock();
+    scheduler->RunWorker(thread_id);
+    lock.lock();
+
+    running_count_--;
+    if (running_count_ == 0) {
+      done_cv_.notify_all();
     }
   }
 }
 
+static ThreadPool thread_pool;
+
+TaskGroup::TaskGroup() : pending_(0), cancelled_(false),
+    parent_(current_group), serial_status_(LoopStatus::Continue)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+  Wait();
+}
+
+void TaskGroup::Spawn(void *data, TaskFunction task_fn, int iteration_id)
+{
+  TaskScheduler *scheduler = current_scheduler;
+
+  if (scheduler == NULL) {
+    if (serial_status_ == LoopStatus::Cancel) {
+      return;
+    }
+    ThreadContext cxt = current_context;
+    cxt.iteration_count = 0;
+    cxt.iteration_id = iteration_id;
+
+    ContextBinding binding(cxt);
+    serial_status_ = task_fn(data, cxt);
+    return;
+  }
+
+  Task task;
+  task.data = data;
+  task.task_fn = task_fn;
+  task.iteration_id = iteration_id;
+  task.iteration_count = 0;
+  task.group = this;
+
+  scheduler->Push(current_context.thread_id, task, true);
+}
+
+LoopStatus TaskGroup::Wait()
+{
+  TaskScheduler *scheduler = current_scheduler;
+
+  if (scheduler == NULL) {
+    return serial_status_;
+  }
+
+  scheduler->WaitGroup(current_context.thread_id, *this);
+
+  return scheduler->IsCancelled(this) ? LoopStatus::Cancel : LoopStatus::Continue;
+}
+
 int MtGetMaxAvailableThreadCount()
 {
-  return std::thread::hardware_concurrency();
+  // containers see every cpu of the host in hardware_concurrency
+  static const int max_count = [] {
+    int count = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+    const int affinity_count = OsGetAffinityCPUCount();
+    if (affinity_count > 0) {
+      count = std::min(count, affinity_count);
+    }
+    const double quota = OsGetCPUQuota();
+    if (quota > 0) {
+      count = std::min(count, std::max(static_cast<int>(std::ceil(quota)), 1));
+    }
+    return count;
+  }();
+  return max_count;
 }
 
 int MtGetActiveThreadCount()
 {
-  return get_active_thread_count();
+  return current_context.thread_count;
 }
 
-void MtSetActiveThreadCount(int count)
+int MtGetThreadID()
 {
-  const int max = MtGetMaxAvailableThreadCount();
-  int n = count < 1 ? 1 : count;
-  n = n > max ? max : n;
+  return current_context.thread_id;
+}
 
-  active_thread_count = n;
+const ThreadContext &MtGetThreadContext()
+{
+  return current_context;
 }
 
-int MtGetThreadID()
+static LoopStatus run_nested_loop(void *data, TaskFunction task_fn,
+    const std::vector<int> &iteration_que)
 {
-  return get_thread_id();
+  TaskScheduler *scheduler = current_scheduler;
+  const int que_size = static_cast<int>(iteration_que.size());
+  TaskGroup group;
+
+  // pushed in reverse so that this thread pops them in the que order
+  for (int i = que_size - 1; i >= 0; i--) {
+    Task task;
+    task.data = data;
+    task.task_fn = task_fn;
+    task.iteration_id = iteration_que[i];
+    task.iteration_count = que_size;
+    task.group = &group;
+    scheduler->Push(current_context.thread_id, task, true);
+  }
+
+  return group.Wait();
 }
 
 LoopStatus MtRunParallelLoop(void *data, TaskFunction task_fn,
     int thread_count, const std::vector<int> &iteration_que)
 {
-  std::vector<std::thread> threads;
-  init_iteration_que_index();
+  if (current_scheduler != NULL) {
+    return run_nested_loop(data, task_fn, iteration_que);
+  }
+
+  const int que_size = static_cast<int>(iteration_que.size());
+  const int nthreads = thread_count < 1 ? 1 : thread_count;
+  // a loop cancelled before should not stop this loop since
+  // every loop has its own scheduler
+  TaskScheduler scheduler(nthreads);
+
+  // deal iterations so that each thread starts with its share in the que order
+  for (int i = 0; i < que_size; i++) {
+    Task task;
+    task.data = data;
+    task.task_fn = task_fn;
+    task.iteration_id = iteration_que[i];
+    task.iteration_count = que_size;
+    scheduler.Push(i % nthreads, task, false);
+  }
 
-  for (int i = 0; i < thread_count; i++) {
-    const int thread_id = i;
-    threads.push_back(std::thread(parallel_for, thread_id, std::cref(iteration_que),
-          data, task_fn));
+  if (thread_pool.Run(&scheduler)) {
+    return scheduler.IsCancelled() ? LoopStatus::Cancel : LoopStatus::Continue;
   }
 
+  // the calling thread works as thread 0
+  std::vector<std::thread> threads;
+  for (int i = 1; i < nthreads; i++) {
+    threads.push_back(std::thread(&TaskScheduler::RunWorker, &scheduler, i));
+  }
+
+  scheduler.RunWorker(0);
+
   for (auto &t: threads) {
     t.join();
   }
 
-  return get_global_loop_status();
+  return scheduler.IsCancelled() ? LoopStatus::Cancel : LoopStatus::Continue;
+}
+
+class ParallelRange {
+public:
+  ParallelRange() : data(NULL), range_fn(NULL), count(0), chunk_size(1) {}
+  ~ParallelRange() {}
+
+  void *data;
+  RangeFunction range_fn;
+  int count;
+  int chunk_size;
+};
+
+static LoopStatus run_range_task(void *data, const ThreadContext &context)
+{
+  const ParallelRange *range = reinterpret_cast<const ParallelRange *>(data);
+  const int begin = context.iteration_id * range->chunk_size;
+  const int end = std::min(begin + range->chunk_size, range->count);
+
+  range->range_fn(range->data, begin, end);
+
+  return LoopStatus::Continue;
+}
+
+void MtParallelFor(void *data, RangeFunction range_fn, int count, int chunk_size)
+{
+  if (count <= 0) {
+    return;
+  }
+
+  const int size = chunk_size < 1 ? 1 : chunk_size;
+  if (count <= size) {
+    range_fn(data, 0, count);
+    return;
+  }
+
+  ParallelRange range;
+  range.data = data;
+  range.range_fn = range_fn;
+  range.count = count;
+  range.chunk_size = size;
+
+  const int NCHUNKS = (count + size - 1) / size;
+  std::vector<int> chunk_que(NCHUNKS);
+  for (int i = 0; i < NCHUNKS; i++) {
+    chunk_que[i] = i;
+  }
+
+  MtRunParallelLoop(&range, run_range_task, MtGetMaxAvailableThreadCount(), chunk_que);
+}
+
+int MtStartThreadPool(int thread_count)
+{
+  return thread_pool.Start(thread_count);
+}
+
+void MtStopThreadPool()
+{
+  thread_pool.Stop();
+}
+
+int MtGetThreadPoolSize()
+{
+  return thread_pool.GetSize();
+}
+
+int MtSetWorkerCPU(int thread_id, int cpu_id)
+{
+  return thread_pool.SetAffinity(thread_id, std::vector<int>(1, cpu_id));
+}
+
+int MtSetWorkerNumaNode(int thread_id, int node_id)
+{
+  const int MAX_CPUS = 1024;
+  std::vector<int> cpu_ids(MAX_CPUS);
+
+  const int count = OsGetNumaNodeCPUs(node_id, &cpu_ids[0], MAX_CPUS);
+  if (count < 1) {
+    return -1;
+  }
+  cpu_ids.resize(count);
+
+  return thread_pool.SetAffinity(thread_id, cpu_ids);
+}
+
+int MtGetNumaNodeCount()
+{
+  static const int node_count = [] {
+    const char *env = std::getenv("FJ_NUMA");
+    if (env != NULL && strcmp(env, "off") == 0) {
+      return 1;
+    }
+    return std::max(OsGetNumaNodeCount(), 1);
+  }();
+  return node_count;
+}
+
+int MtBindWorkersToNumaNodes()
+{
+  const int NODES = MtGetNumaNodeCount();
+  const int NTHREADS = MtGetThreadPoolSize();
+  if (NODES < 2 || NTHREADS < 1) {
+    return -1;
+  }
+
+  int err = 0;
+  for (int i = 0; i < NTHREADS; i++) {
+    if (MtSetWorkerNumaNode(i, i * NODES / NTHREADS)) {
+      err = -1;
+    }
+  }
+  return err;
+}
+
+void MtInterleaveSharedMemory(const void *data, std::size_t size)
+{
+  if (MtGetNumaNodeCount() < 2) {
+    return;
+  }
+  OsInterleaveMemory(data, size);
+}
+
+int MtGetHostCPUBudget()
+{
+  static const int budget = [] {
+    const char *env = std::getenv("FJ_HOST_CPUS");
+    if (env == NULL) {
+      return 0;
+    }
+    return std::max(std::atoi(env), 0);
+  }();
+  return budget;
+}
+
+std::string MtGetHostCPUDirectory()
+{
+  const char *env = std::getenv("FJ_HOST_CPU_DIR");
+  if (env != NULL && env[0] != '\0') {
+    return env;
+  }
+  return OsGetTempDirectory();
+}
+
+HostCPULease::HostCPULease() : locks_()
+{
+}
+
+HostCPULease::~HostCPULease()
+{
+  Release();
+}
+
+int HostCPULease::Acquire(const std::string &dirname, int budget, int count)
+{
+  Release();
+  if (budget < 1) {
+    return count;
+  }
+
+  for (int i = 0; i < budget && static_cast<int>(locks_.size()) < count; i++) {
+    char filename[64] = {'\0'};
+    sprintf(filename, "/fj_host_cpu_%d.lock", i);
+    OsFileLock *lock = OsTryLockFile((dirname + filename).c_str());
+    if (lock != NULL) {
+      locks_.push_back(lock);
+    }
+  }
+  return std::max(GetHeldCount(), 1);
+}
+
+void HostCPULease::Release()
+{
+  for (std::size_t i = 0; i < locks_.size(); i++) {
+    OsUnlockFile(locks_[i]);
+  }
+  locks_.clear();
+}
+
+int HostCPULease::GetHeldCount() const
+{
+  return static_cast<int>(locks_.size());
 }
 
 void MtCriticalSection(void *data, CriticalFunction critical_fn)
@@ -6,6 +6,9 @@
 
 #include "fj_compatibility.h"
 #include <vector>
+#include <atomic>
+#include <string>
+#include <cstddef>
 
 namespace fj {
 
@@ -18,7 +21,7 @@ public:
   int iteration_id = 0;
   int iteration_count = 0;
   int thread_id = 0;
-  int thread_count = 0;
+  int thread_count = 1;
 };
 
 enum class LoopStatus {
@@ -29,16 +32,122 @@ enum class LoopStatus {
 using TaskFunction = LoopStatus (*)(void *data, const ThreadContext &context);
 using CriticalFunction = void (*)(void *data);
 
-int MtGetMaxAvailableThreadCount();
-int MtGetActiveThreadCount();
-void MtSetActiveThreadCount(int count);
+// the smallest of hardware threads, cpus of the affinity mask and the cpu
+// quota of the container rounded up. it is computed once at the first call
+FJ_API int MtGetMaxAvailableThreadCount();
+FJ_API int MtGetActiveThreadCount();
 // TODO possible to hide this from plugin?
 FJ_API int MtGetThreadID();
+// the context of the task running on the calling thread. it is thread local
+// so plugins can call this per sample with no lock. outside parallel loops
+// thread_id is 0 and thread_count is 1
+FJ_API const ThreadContext &MtGetThreadContext();
 
-LoopStatus MtRunParallelLoop(void *data, TaskFunction task_fn,
+// iterations are dealt to per-thread queues in the order of iteration_que
+// and idle threads steal from the others. when called from inside a
+// parallel loop, iterations run as tasks on the threads of the outer loop
+// and thread_count is ignored
+FJ_API LoopStatus MtRunParallelLoop(void *data, TaskFunction task_fn,
     int thread_count, const std::vector<int> &iteration_que);
 void MtCriticalSection(void *data, CriticalFunction critical_fn);
 
+// calls range_fn on chunks of [0, count) of chunk_size on the threads of the
+// pool and returns when all are done. begin / chunk_size is the index of the
+// chunk for per-chunk results of reductions. one chunk runs on the calling
+// thread with no loop
+using RangeFunction = void (*)(void *data, int begin, int end);
+FJ_API void MtParallelFor(void *data, RangeFunction range_fn, int count, int chunk_size);
+
+// Parallel loops run on a pool of parked threads once it is started.
+// SiOpenScene starts it with MtGetMaxAvailableThreadCount threads.
+// loops needing more threads than the pool spawn their own threads
+FJ_API int MtStartThreadPool(int thread_count);
+FJ_API void MtStopThreadPool();
+FJ_API int MtGetThreadPoolSize();
+// pins a pool worker to a cpu or to the cpus of a NUMA node. thread 0 is
+// the thread calling the loops so it pins the calling thread. call between
+// loops. returns -1 if failed or not supported
+FJ_API int MtSetWorkerCPU(int thread_id, int cpu_id);
+FJ_API int MtSetWorkerNumaNode(int thread_id, int node_id);
+
+// NUMA nodes used by the pool. 1 on single node machines or if the
+// environment variable FJ_NUMA is off
+FJ_API int MtGetNumaNodeCount();
+// pins pool workers to NUMA nodes in blocks of contiguous thread ids so
+// workers of a node share its caches and memory. returns -1 if there is
+// only one node or failed
+FJ_API int MtBindWorkersToNumaNodes();
+// spreads pages of read only data shared by workers of all nodes, e.g.
+// geometry and trees built by one thread, over the nodes so no node serves
+// all the reads. does nothing on one node
+FJ_API void MtInterleaveSharedMemory(const void *data, std::size_t size);
+template <typename T>
+inline void MtInterleaveSharedMemory(const std::vector<T> &v)
+{
+  if (!v.empty()) {
+    MtInterleaveSharedMemory(&v[0], v.size() * sizeof(T));
+  }
+}
+
+// Processes sharing the cpus of a host hold cpus of a budget while they
+// render so they don't all run a thread per cpu. each cpu of the budget is
+// a lock file in a directory, so cpus of a crashed process are released by
+// the system. the budget is the environment variable FJ_HOST_CPUS and the
+// directory is FJ_HOST_CPU_DIR or the temporary directory.
+// returns 0 if there is no budget
+FJ_API int MtGetHostCPUBudget();
+FJ_API std::string MtGetHostCPUDirectory();
+
+class OsFileLock;
+
+class FJ_API HostCPULease {
+public:
+  HostCPULease();
+  // releases the cpus held
+  ~HostCPULease();
+
+  // holds up to count cpus of the budget free in the directory and returns
+  // the cpus held. returns 1 if all are held by others so that the caller
+  // still makes progress. returns count if budget is 0
+  int Acquire(const std::string &dirname, int budget, int count);
+  void Release();
+  int GetHeldCount() const;
+
+private:
+  HostCPULease(const HostCPULease &);
+  const HostCPULease &operator=(const HostCPULease &);
+
+  std::vector<OsFileLock *> locks_;
+};
+
+// Tasks spawned in a parallel loop go to the queue of the spawning thread
+// and can be stolen by idle threads. tasks can spawn tasks recursively.
+// outside a parallel loop, Spawn runs the task immediately.
+// context.iteration_count is 0 for spawned tasks
+class FJ_API TaskGroup {
+public:
+  TaskGroup();
+  ~TaskGroup();
+
+  void Spawn(void *data, TaskFunction task_fn, int iteration_id);
+  // runs queued tasks of the group while waiting. returns Cancel when
+  // a task of the group, of an enclosing group or of the loop returned
+  // Cancel. cancelling a group skips only its tasks and nested groups
+  LoopStatus Wait();
+
+private:
+  friend class TaskScheduler;
+  friend class WorkQueue;
+
+  // tasks spawned and not finished yet
+  std::atomic<int> pending_;
+  std::atomic<bool> cancelled_;
+  // the group of the task creating this group. NULL at the top level
+  TaskGroup *parent_;
+  // for tasks run immediately outside a parallel loop
+  LoopStatus serial_status_;
+};
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
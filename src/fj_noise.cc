@@ -5,8 +5,16 @@ See LICENSE and README
 
 #include "fj_noise.h"
 #include "fj_vector.h"
+#include "fj_cpu.h"
 #include <cmath>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(FJ_HAVE_AVX2_KERNELS)
+#include <immintrin.h>
+#endif
+
 #define PERMUTAION \
 151,160,137,91,90,15,131,13,201,95,96,53,194,233,7,225,140,36,103,30,69, \
 142,8,99,37,240,21,10,23,190,6,148,247,120,234,75,0,26,197,62,94,252, \
@@ -30,39 +38,96 @@ static const int perm[] = {
   PERMUTAION
 };
 
-Real PerlinNoise(const Vector &position,
-    Real lacunarity, Real persistence, int octaves)
+// octaves of positions to be evaluated together. 8 lanes with AVX2
+class NoiseLanes {
+public:
+  NoiseLanes() : count(0), width(CpuGetSimdLevel() >= CPU_SIMD_AVX2 ? 8 : 4) {}
+  ~NoiseLanes() {}
+
+  Real x[8], y[8], z[8];
+  Real amp[8];
+  Real *noise[8];
+  int count;
+  int width;
+};
+
+static void flush_lanes(NoiseLanes &lanes)
 {
-  Vector P = position;
-  Real noise_value = 0;
-  Real amp = 1;
+  // the last lanes of a few octaves fit in 4 lanes
+  const int width = lanes.count > 4 ? lanes.width : 4;
+  // unused lanes evaluate the first point again
+  for (int i = lanes.count; i < width; i++) {
+    lanes.x[i] = lanes.x[0];
+    lanes.y[i] = lanes.y[0];
+    lanes.z[i] = lanes.z[0];
+  }
 
-  for (int i = 0; i < octaves; i++) {
-    noise_value += amp * PeriodicNoise3d(P.x, P.y, P.z);
+  float noise[8];
+  if (width == 8) {
+    PeriodicNoise3d8(lanes.x, lanes.y, lanes.z, noise);
+  } else {
+    PeriodicNoise3d4(lanes.x, lanes.y, lanes.z, noise);
+  }
 
-    amp *= persistence;
-    P   *= lacunarity;
+  for (int i = 0; i < lanes.count; i++) {
+    *lanes.noise[i] += lanes.amp[i] * noise[i];
   }
+  lanes.count = 0;
+}
 
-  return noise_value;
+void PerlinNoise(const Vector *positions, int count,
+    Real lacunarity, Real persistence, int octaves, Real *noise)
+{
+  NoiseLanes lanes;
+
+  for (int i = 0; i < count; i++) {
+    Vector P = positions[i];
+    Real amp = 1;
+    noise[i] = 0;
+
+    for (int j = 0; j < octaves; j++) {
+      const int lane = lanes.count++;
+      lanes.x[lane] = P.x;
+      lanes.y[lane] = P.y;
+      lanes.z[lane] = P.z;
+      lanes.amp[lane] = amp;
+      lanes.noise[lane] = &noise[i];
+      if (lanes.count == lanes.width) {
+        flush_lanes(lanes);
+      }
+
+      amp *= persistence;
+      P   *= lacunarity;
+    }
+  }
+
+  if (lanes.count > 0) {
+    flush_lanes(lanes);
+  }
 }
 
-Vector PerlinNoise3d(const Vector &position,
+Real PerlinNoise(const Vector &position,
     Real lacunarity, Real persistence, int octaves)
 {
-  Vector P_out;
-  Vector P;
+  Real noise_value = 0;
+  PerlinNoise(&position, 1, lacunarity, persistence, octaves, &noise_value);
 
-  P = position;
-  P_out.x = PerlinNoise(P, lacunarity, persistence, octaves);
+  return noise_value;
+}
 
-  P = position + Vector(131.977, 21.1823, 71.0231);
-  P_out.y = PerlinNoise(P, lacunarity, persistence, octaves);
+Vector PerlinNoise3d(const Vector &position,
+    Real lacunarity, Real persistence, int octaves)
+{
+  // the three channels share lanes
+  const Vector P[3] = {
+    position,
+    position + Vector(131.977, 21.1823, 71.0231),
+    position + Vector(237.492, 11.1312, 133.129)};
+  Real noise[3] = {0, 0, 0};
 
-  P = position + Vector(237.492, 11.1312, 133.129);
-  P_out.z = PerlinNoise(P, lacunarity, persistence, octaves);
+  PerlinNoise(P, 3, lacunarity, persistence, octaves, noise);
 
-  return P_out;
+  return Vector(noise[0], noise[1], noise[2]);
 }
 
 static inline Real fade(Real t)
@@ -127,4 +192,354 @@ Real PeriodicNoise3d(Real x, Real y, Real z)
   return result;
 }
 
+Real TiledNoise3d(Real x, Real y, Real z, int period)
+{
+  const Real fx = floor(x);
+  const Real fy = floor(y);
+  const Real fz = floor(z);
+  // corners wrap at the period instead of at 256
+  const int X0 = static_cast<int>(fx - period * floor(fx / period));
+  const int Y0 = static_cast<int>(fy - period * floor(fy / period));
+  const int Z0 = static_cast<int>(fz - period * floor(fz / period));
+  const int X1 = (X0 + 1) % period;
+  const int Y1 = (Y0 + 1) % period;
+  const int Z1 = (Z0 + 1) % period;
+
+  const Real xx = x - fx;
+  const Real yy = y - fy;
+  const Real zz = z - fz;
+
+  const Real u = fade(xx);
+  const Real v = fade(yy);
+  const Real w = fade(zz);
+
+  const int A0 = perm[perm[X0] + Y0];
+  const int A1 = perm[perm[X0] + Y1];
+  const int B0 = perm[perm[X1] + Y0];
+  const int B1 = perm[perm[X1] + Y1];
+
+  const Real result =
+    lerp(w,
+      lerp(v,
+        lerp(u, grad(perm[A0 + Z0], xx,   yy,   zz),
+            grad(perm[B0 + Z0], xx-1, yy,   zz)),
+        lerp(u, grad(perm[A1 + Z0], xx,   yy-1, zz),
+            grad(perm[B1 + Z0], xx-1, yy-1, zz))),
+      lerp(v,
+        lerp(u, grad(perm[A0 + Z1], xx,   yy,   zz-1),
+            grad(perm[B0 + Z1], xx-1, yy,   zz-1)),
+        lerp(u, grad(perm[A1 + Z1], xx,   yy-1, zz-1),
+            grad(perm[B1 + Z1], xx-1, yy-1, zz-1))));
+
+  return result;
+}
+
+// floor() is a library call without SSE4.1
+static inline int fast_floor(Real x)
+{
+  const int i = static_cast<int>(x);
+  return x < i ? i - 1 : i;
+}
+
+// the lattice cell and the hashes of its 8 corners
+class NoiseCell {
+public:
+  NoiseCell() {}
+  ~NoiseCell() {}
+
+  void Setup(Real x, Real y, Real z)
+  {
+    const int fx = fast_floor(x);
+    const int fy = fast_floor(y);
+    const int fz = fast_floor(z);
+    const int X = fx & 255;
+    const int Y = fy & 255;
+    const int Z = fz & 255;
+
+    xx = static_cast<float>(x - fx);
+    yy = static_cast<float>(y - fy);
+    zz = static_cast<float>(z - fz);
+
+    const int A =  perm[X] + Y;
+    const int AA = perm[A] + Z;
+    const int AB = perm[A + 1] + Z;
+    const int B =  perm[X + 1] + Y;
+    const int BA = perm[B] + Z;
+    const int BB = perm[B + 1] + Z;
+
+    // in the order of lerp below
+    hash[0] = perm[AA];
+    hash[1] = perm[BA];
+    hash[2] = perm[AB];
+    hash[3] = perm[BB];
+    hash[4] = perm[AA + 1];
+    hash[5] = perm[BA + 1];
+    hash[6] = perm[AB + 1];
+    hash[7] = perm[BB + 1];
+  }
+
+  float xx, yy, zz;
+  int hash[8];
+};
+
+static inline float fadef(float t)
+{
+  return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static inline float lerpf(float t, float a, float b)
+{
+  return a + t * (b - a);
+}
+
+static inline float gradf(int hash, float x, float y, float z)
+{
+  const int h = hash & 15;
+  const float u = h < 8 ? x : y;
+  const float v = h < 4 ? y : h==12 || h==14 ? x : z;
+
+  return ((h&1) == 0 ? u : -u) + ((h&2) == 0 ? v : -v);
+}
+
+float PeriodicNoise3df(Real x, Real y, Real z)
+{
+  NoiseCell cell;
+  cell.Setup(x, y, z);
+
+  const float xx = cell.xx;
+  const float yy = cell.yy;
+  const float zz = cell.zz;
+  const int *hash = cell.hash;
+
+  const float u = fadef(xx);
+  const float v = fadef(yy);
+  const float w = fadef(zz);
+
+  return
+    lerpf(w,
+      lerpf(v,
+        lerpf(u, gradf(hash[0], xx,   yy,   zz),
+            gradf(hash[1], xx-1, yy,   zz)),
+        lerpf(u, gradf(hash[2], xx,   yy-1, zz),
+            gradf(hash[3], xx-1, yy-1, zz))),
+      lerpf(v,
+        lerpf(u, gradf(hash[4], xx,   yy,   zz-1),
+            gradf(hash[5], xx-1, yy,   zz-1)),
+        lerpf(u, gradf(hash[6], xx,   yy-1, zz-1),
+            gradf(hash[7], xx-1, yy-1, zz-1))));
+}
+
+#if defined(__SSE2__)
+static inline __m128 fade4(__m128 t)
+{
+  const __m128 inner = _mm_add_ps(_mm_mul_ps(t,
+      _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6)), _mm_set1_ps(15))), _mm_set1_ps(10));
+  return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+static inline __m128 lerp4(__m128 t, __m128 a, __m128 b)
+{
+  return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+static inline __m128 select4(__m128i mask, __m128 a, __m128 b)
+{
+  const __m128 m = _mm_castsi128_ps(mask);
+  return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+
+// gradf without branches. the low 2 bits of the hash flip the signs
+static inline __m128 grad4(__m128i hash, __m128 x, __m128 y, __m128 z)
+{
+  const __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+  const __m128 u = select4(_mm_cmplt_epi32(h, _mm_set1_epi32(8)), x, y);
+  const __m128i h_is_x = _mm_or_si128(
+      _mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+      _mm_cmpeq_epi32(h, _mm_set1_epi32(14)));
+  const __m128 v = select4(_mm_cmplt_epi32(h, _mm_set1_epi32(4)), y,
+      select4(h_is_x, x, z));
+
+  const __m128 u_sign = _mm_castsi128_ps(
+      _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+  const __m128 v_sign = _mm_castsi128_ps(
+      _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+
+  return _mm_add_ps(_mm_xor_ps(u, u_sign), _mm_xor_ps(v, v_sign));
+}
+#endif
+
+void PeriodicNoise3d4(const Real *x, const Real *y, const Real *z, float *noise)
+{
+#if defined(__SSE2__)
+  NoiseCell cells[4];
+  for (int i = 0; i < 4; i++) {
+    cells[i].Setup(x[i], y[i], z[i]);
+  }
+
+  const __m128 one = _mm_set1_ps(1);
+  const __m128 xx = _mm_setr_ps(cells[0].xx, cells[1].xx, cells[2].xx, cells[3].xx);
+  const __m128 yy = _mm_setr_ps(cells[0].yy, cells[1].yy, cells[2].yy, cells[3].yy);
+  const __m128 zz = _mm_setr_ps(cells[0].zz, cells[1].zz, cells[2].zz, cells[3].zz);
+  const __m128 xx1 = _mm_sub_ps(xx, one);
+  const __m128 yy1 = _mm_sub_ps(yy, one);
+  const __m128 zz1 = _mm_sub_ps(zz, one);
+
+  __m128i hash[8];
+  for (int i = 0; i < 8; i++) {
+    hash[i] = _mm_setr_epi32(
+        cells[0].hash[i], cells[1].hash[i], cells[2].hash[i], cells[3].hash[i]);
+  }
+
+  const __m128 u = fade4(xx);
+  const __m128 v = fade4(yy);
+  const __m128 w = fade4(zz);
+
+  const __m128 result =
+    lerp4(w,
+      lerp4(v,
+        lerp4(u, grad4(hash[0], xx,  yy,  zz),
+            grad4(hash[1], xx1, yy,  zz)),
+        lerp4(u, grad4(hash[2], xx,  yy1, zz),
+            grad4(hash[3], xx1, yy1, zz))),
+      lerp4(v,
+        lerp4(u, grad4(hash[4], xx,  yy,  zz1),
+            grad4(hash[5], xx1, yy,  zz1)),
+        lerp4(u, grad4(hash[6], xx,  yy1, zz1),
+            grad4(hash[7], xx1, yy1, zz1))));
+
+  _mm_storeu_ps(noise, result);
+#else
+  for (int i = 0; i < 4; i++) {
+    noise[i] = PeriodicNoise3df(x[i], y[i], z[i]);
+  }
+#endif
+}
+
+#if defined(FJ_HAVE_AVX2_KERNELS)
+FJ_TARGET_AVX2
+static inline __m256 fade8(__m256 t)
+{
+  const __m256 inner = _mm256_add_ps(_mm256_mul_ps(t,
+      _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6)), _mm256_set1_ps(15))),
+      _mm256_set1_ps(10));
+  return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+FJ_TARGET_AVX2
+static inline __m256 lerp8(__m256 t, __m256 a, __m256 b)
+{
+  return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+FJ_TARGET_AVX2
+static inline __m256 grad8(__m256i hash, __m256 x, __m256 y, __m256 z)
+{
+  const __m256i h = _mm256_and_si256(hash, _mm256_set1_epi32(15));
+  const __m256 u = _mm256_blendv_ps(y, x,
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(8), h)));
+  const __m256i h_is_x = _mm256_or_si256(
+      _mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+      _mm256_cmpeq_epi32(h, _mm256_set1_epi32(14)));
+  const __m256 v = _mm256_blendv_ps(
+      _mm256_blendv_ps(z, x, _mm256_castsi256_ps(h_is_x)), y,
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h)));
+
+  const __m256 u_sign = _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+  const __m256 v_sign = _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+
+  return _mm256_add_ps(_mm256_xor_ps(u, u_sign), _mm256_xor_ps(v, v_sign));
+}
+
+// the lattice cell of 8 coordinates in the precision of Real like NoiseCell
+FJ_TARGET_AVX2
+static inline void lattice8(const Real *x, __m256i *cell, __m256 *fraction)
+{
+#if defined(FJ_SINGLE_PRECISION)
+  const __m256 x0 = _mm256_loadu_ps(x);
+  const __m256 f0 = _mm256_floor_ps(x0);
+
+  *cell = _mm256_and_si256(_mm256_cvtps_epi32(f0), _mm256_set1_epi32(255));
+  *fraction = _mm256_sub_ps(x0, f0);
+#else
+  const __m256d x0 = _mm256_loadu_pd(x);
+  const __m256d x1 = _mm256_loadu_pd(x + 4);
+  const __m256d f0 = _mm256_floor_pd(x0);
+  const __m256d f1 = _mm256_floor_pd(x1);
+
+  *cell = _mm256_and_si256(_mm256_set_m128i(
+      _mm256_cvtpd_epi32(f1), _mm256_cvtpd_epi32(f0)), _mm256_set1_epi32(255));
+  *fraction = _mm256_set_m128(
+      _mm256_cvtpd_ps(_mm256_sub_pd(x1, f1)), _mm256_cvtpd_ps(_mm256_sub_pd(x0, f0)));
+#endif
+}
+
+FJ_TARGET_AVX2
+static inline __m256i perm8(__m256i index)
+{
+  return _mm256_i32gather_epi32(perm, index, 4);
+}
+
+FJ_TARGET_AVX2
+static void periodic_noise_avx2(const Real *x, const Real *y, const Real *z, float *noise)
+{
+  __m256i X, Y, Z;
+  __m256 xx, yy, zz;
+  lattice8(x, &X, &xx);
+  lattice8(y, &Y, &yy);
+  lattice8(z, &Z, &zz);
+
+  // the hashes of NoiseCell with gathers
+  const __m256i one_i = _mm256_set1_epi32(1);
+  const __m256i A = _mm256_add_epi32(perm8(X), Y);
+  const __m256i B = _mm256_add_epi32(perm8(_mm256_add_epi32(X, one_i)), Y);
+  const __m256i AA = _mm256_add_epi32(perm8(A), Z);
+  const __m256i AB = _mm256_add_epi32(perm8(_mm256_add_epi32(A, one_i)), Z);
+  const __m256i BA = _mm256_add_epi32(perm8(B), Z);
+  const __m256i BB = _mm256_add_epi32(perm8(_mm256_add_epi32(B, one_i)), Z);
+
+  const __m256i hash[8] = {
+    perm8(AA), perm8(BA), perm8(AB), perm8(BB),
+    perm8(_mm256_add_epi32(AA, one_i)), perm8(_mm256_add_epi32(BA, one_i)),
+    perm8(_mm256_add_epi32(AB, one_i)), perm8(_mm256_add_epi32(BB, one_i))};
+
+  const __m256 one = _mm256_set1_ps(1);
+  const __m256 xx1 = _mm256_sub_ps(xx, one);
+  const __m256 yy1 = _mm256_sub_ps(yy, one);
+  const __m256 zz1 = _mm256_sub_ps(zz, one);
+
+  const __m256 u = fade8(xx);
+  const __m256 v = fade8(yy);
+  const __m256 w = fade8(zz);
+
+  const __m256 result =
+    lerp8(w,
+      lerp8(v,
+        lerp8(u, grad8(hash[0], xx,  yy,  zz),
+            grad8(hash[1], xx1, yy,  zz)),
+        lerp8(u, grad8(hash[2], xx,  yy1, zz),
+            grad8(hash[3], xx1, yy1, zz))),
+      lerp8(v,
+        lerp8(u, grad8(hash[4], xx,  yy,  zz1),
+            grad8(hash[5], xx1, yy,  zz1)),
+        lerp8(u, grad8(hash[6], xx,  yy1, zz1),
+            grad8(hash[7], xx1, yy1, zz1))));
+
+  _mm256_storeu_ps(noise, result);
+}
+#endif
+
+void PeriodicNoise3d8(const Real *x, const Real *y, const Real *z, float *noise)
+{
+#if defined(FJ_HAVE_AVX2_KERNELS)
+  if (CpuGetSimdLevel() >= CPU_SIMD_AVX2) {
+    periodic_noise_avx2(x, y, z, noise);
+    return;
+  }
+#endif
+  PeriodicNoise3d4(x, y, z, noise);
+  PeriodicNoise3d4(x + 4, y + 4, z + 4, noise + 4);
+}
+
 } // namespace xxx
@@ -17,7 +17,23 @@ FJ_API Real PerlinNoise(const Vector &position,
 FJ_API Vector PerlinNoise3d(const Vector &position,
     Real lacunarity, Real persistence, int octaves);
 
+// noise of count positions. octaves of all positions are evaluated 4 at a
+// time so this is faster than calling PerlinNoise for each of them
+FJ_API void PerlinNoise(const Vector *positions, int count,
+    Real lacunarity, Real persistence, int octaves, Real *noise);
+
 FJ_API Real PeriodicNoise3d(Real x, Real y, Real z);
+// PeriodicNoise3d repeating every period lattice cells. period is up to 256
+FJ_API Real TiledNoise3d(Real x, Real y, Real z, int period);
+// PeriodicNoise3d in single precision. lattice cells are still found in
+// double precision so large coordinates don't lose the fraction
+FJ_API float PeriodicNoise3df(Real x, Real y, Real z);
+// PeriodicNoise3df of 4 points at a time with SSE2
+FJ_API void PeriodicNoise3d4(const Real *x, const Real *y, const Real *z,
+    float *noise);
+// PeriodicNoise3d4 of 8 points at a time with AVX2 if CpuGetSimdLevel allows
+FJ_API void PeriodicNoise3d8(const Real *x, const Real *y, const Real *z,
+    float *noise);
 
 } // namespace xxx
 
@@ -0,0 +1,29 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_numeric.h"
+
+namespace fj {
+
+int math_accuracy_mode = MATH_ACCURACY_EXACT;
+
+void MathSetAccuracy(int accuracy)
+{
+  switch (accuracy) {
+  case MATH_ACCURACY_EXACT:
+  case MATH_ACCURACY_BALANCED:
+  case MATH_ACCURACY_FAST:
+    math_accuracy_mode = accuracy;
+    break;
+  default:
+    math_accuracy_mode = MATH_ACCURACY_EXACT;
+    break;
+  }
+}
+
+int MathGetAccuracy()
+{
+  return math_accuracy_mode;
+}
+
+} // namespace xxx
@@ -4,7 +4,10 @@
 #ifndef FJ_NUMERIC_H
 #define FJ_NUMERIC_H
 
+#include "fj_compatibility.h"
 #include "fj_types.h"
+#include <cstring>
+#include <cstdint>
 #include <limits>
 #include <cmath>
 
@@ -12,6 +15,24 @@ namespace fj {
 
 const Real PI = 3.14159265358979323846;
 const Real REAL_MAX = std::numeric_limits<Real>::max();
+// for tolerances that hold in both precisions
+const Real REAL_EPSILON = std::numeric_limits<Real>::epsilon();
+
+// accuracy of Exp(), Log(), Pow(), Sin() and Cos() for all threads
+enum MathAccuracy {
+  // double precision of libm (default)
+  MATH_ACCURACY_EXACT = 0,
+  // single precision of libm. relative errors around 1e-7
+  MATH_ACCURACY_BALANCED,
+  // the Fast* polynomials. relative errors around 1e-5
+  MATH_ACCURACY_FAST
+};
+
+FJ_API void MathSetAccuracy(int accuracy);
+FJ_API int MathGetAccuracy();
+
+// for the inline functions below. use MathSetAccuracy()
+extern FJ_API int math_accuracy_mode;
 
 inline Real Abs(Real x)
 {
@@ -33,9 +54,133 @@ inline Real Sqrt(Real x)
   return std::sqrt(x);
 }
 
+// the nearest integer of |x| < 2^51 without calls to libm. adding and
+// subtracting 1.5 * 2^52 rounds off the fraction unless built with
+// -ffast-math
+inline double FastRound(double x)
+{
+  return (x + 6755399441055744.) - 6755399441055744.;
+}
+
+// inline approximations without calls to libm or branches on the value.
+// arguments of FastSin() and FastCos() are good for |x| up to around 1e6
+inline double FastExp(double x)
+{
+  // 2^t = 2^i * 2^f where f in [-.5, .5]
+  const double t = x * 1.4426950408889634;
+  const double c = t < -1022 ? -1022 : (t > 1023 ? 1023 : t);
+  const double i = FastRound(c);
+  const double f = (c - i) * 0.6931471805599453;
+  const double p = 1 + f * (1 + f * (1./2 + f * (1./6 + f * (1./24 + f * (1./120)))));
+
+  const uint64_t bits = static_cast<uint64_t>(static_cast<int64_t>(i) + 1023) << 52;
+  double scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+inline double FastLog(double x)
+{
+  // x = m * 2^e where m in [1, 2). the exponent of 0 and negatives is bogus
+  uint64_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  const double e = static_cast<double>(static_cast<int64_t>((bits >> 52) & 0x7ff) - 1023);
+  bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+  double m;
+  std::memcpy(&m, &bits, sizeof(m));
+
+  // then m in [sqrt(.5), sqrt(2))
+  const double half = m > 1.4142135623730951 ? 1 : 0;
+  m *= 1 - .5 * half;
+
+  // log(m) = 2 atanh(s) where |s| < .172
+  const double s = (m - 1) / (m + 1);
+  const double s2 = s * s;
+  const double p = 2 * s * (1 + s2 * (1./3 + s2 * (1./5 + s2 * (1./7 + s2 * (1./9)))));
+  return p + (e + half) * 0.6931471805599453;
+}
+
+// x must be positive
+inline double FastPow(double x, double y)
+{
+  return FastExp(y * FastLog(x));
+}
+
+inline double FastSin(double x)
+{
+  // x = k * PI + r where r in [-PI/2, PI/2]
+  const double k = FastRound(x * (1 / PI));
+  const double r = x - k * PI;
+  const double r2 = r * r;
+  const double s =
+      r * (1 + r2 * (-1./6 + r2 * (1./120 + r2 * (-1./5040 + r2 * (1./362880 + r2 * (-1./39916800))))));
+  // negative for odd k
+  return (static_cast<int64_t>(k) & 1) ? -s : s;
+}
+
+inline double FastCos(double x)
+{
+  return FastSin(x + .5 * PI);
+}
+
+inline Real Exp(Real x)
+{
+  switch (math_accuracy_mode) {
+  case MATH_ACCURACY_BALANCED:
+    return std::exp(static_cast<float>(x));
+  case MATH_ACCURACY_FAST:
+    return FastExp(x);
+  default:
+    return std::exp(x);
+  }
+}
+
+inline Real Log(Real x)
+{
+  switch (math_accuracy_mode) {
+  case MATH_ACCURACY_BALANCED:
+    return std::log(static_cast<float>(x));
+  case MATH_ACCURACY_FAST:
+    return x > 0 ? FastLog(x) : std::log(x);
+  default:
+    return std::log(x);
+  }
+}
+
 inline Real Pow(Real x, Real exp)
 {
-  return std::pow(x, exp);
+  switch (math_accuracy_mode) {
+  case MATH_ACCURACY_BALANCED:
+    return std::pow(static_cast<float>(x), static_cast<float>(exp));
+  case MATH_ACCURACY_FAST:
+    return x > 0 ? FastPow(x, exp) : std::pow(x, exp);
+  default:
+    return std::pow(x, exp);
+  }
+}
+
+inline Real Sin(Real x)
+{
+  switch (math_accuracy_mode) {
+  case MATH_ACCURACY_BALANCED:
+    return std::sin(static_cast<float>(x));
+  case MATH_ACCURACY_FAST:
+    return FastSin(x);
+  default:
+    return std::sin(x);
+  }
+}
+
+inline Real Cos(Real x)
+{
+  switch (math_accuracy_mode) {
+  case MATH_ACCURACY_BALANCED:
+    return std::cos(static_cast<float>(x));
+  case MATH_ACCURACY_FAST:
+    return FastCos(x);
+  default:
+    return std::cos(x);
+  }
 }
 
 inline Real Min(Real x, Real y)
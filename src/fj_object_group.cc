@@ -5,6 +5,8 @@
 #include "fj_volume_accelerator.h"
 #include "fj_bvh_accelerator.h"
 #include "fj_object_instance.h"
+#include "fj_memory_usage.h"
+#include "fj_ray.h"
 
 #include <cassert>
 
@@ -13,8 +15,10 @@ namespace fj {
 class Interval;
 class Ray;
 
+static BVHAccelerator *new_top_level_bvh();
 //TODO remove these
 static void volume_bounds(const void *prim_set, int prim_id, Box *bounds);
+static bool update_built_bounds(const ObjectSet &objset, std::vector<Box> *built_bounds);
 static int volume_ray_intersect(const void *prim_set, int prim_id, double time,
     const Ray *ray, Interval *interval);
 
@@ -22,9 +26,13 @@ ObjectGroup::ObjectGroup() :
     surface_set_(),
     volume_set_(),
     surface_set_acc_(NULL),
-    volume_set_acc_(NULL)
+    volume_set_acc_(NULL),
+    surface_built_bounds_(),
+    volume_built_bounds_(),
+    shared_(NULL),
+    group_bit_(0)
 {
-  surface_set_acc_ = new BVHAccelerator();
+  surface_set_acc_ = new_top_level_bvh();
   volume_set_acc_ = VolumeAccNew(VOLACC_BVH);
 }
 
@@ -54,14 +62,38 @@ void ObjectGroup::AddObject(const ObjectInstance *obj)
 
 const Accelerator *ObjectGroup::GetSurfaceAccelerator() const
 {
+  if (IsSharingTree()) {
+    return shared_->GetSurfaceAccelerator();
+  }
   return surface_set_acc_;
 }
 
+const ObjectSet &ObjectGroup::GetSurfaceSet() const
+{
+  return surface_set_;
+}
+
+const ObjectSet &ObjectGroup::GetVolumeSet() const
+{
+  return volume_set_;
+}
+
 const VolumeAccelerator *ObjectGroup::GetVolumeAccelerator() const
 {
+  if (IsSharingTree()) {
+    return shared_->GetVolumeAccelerator();
+  }
   return volume_set_acc_;
 }
 
+std::size_t ObjectGroup::GetMemoryUsage() const
+{
+  return
+      surface_set_acc_->GetMemoryUsage() +
+      MemoryUsageOf(surface_built_bounds_) +
+      MemoryUsageOf(volume_built_bounds_);
+}
+
 void ObjectGroup::ComputeBounds()
 {
   surface_set_.ComputeBounds();
@@ -78,6 +110,92 @@ void ObjectGroup::ComputeBounds()
       volume_bounds);
 }
 
+int ObjectGroup::Build()
+{
+  if (IsSharingTree()) {
+    return 0;
+  }
+
+  int err = 0;
+  const bool surface_added =
+      surface_set_.GetObjectCount() != static_cast<Index>(surface_built_bounds_.size());
+
+  if (update_built_bounds(surface_set_, &surface_built_bounds_)) {
+    if (!surface_set_acc_->HasBuilt()) {
+      err = surface_set_acc_->Build();
+    } else if (surface_added || surface_set_acc_->Refit()) {
+      err = surface_set_acc_->Rebuild();
+    }
+    if (err) {
+      return -1;
+    }
+  }
+
+  if (update_built_bounds(volume_set_, &volume_built_bounds_)) {
+    // volume accelerator can't be built twice. make a new one
+    VolumeAccFree(volume_set_acc_);
+    volume_set_acc_ = VolumeAccNew(VOLACC_BVH);
+    VolumeAccSetTargetGeometry(volume_set_acc_,
+        &volume_set_,
+        volume_set_.GetObjectCount(),
+        &volume_set_.GetBounds(),
+        volume_ray_intersect,
+        volume_bounds);
+
+    err = VolumeAccBuild(volume_set_acc_);
+    if (err) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void ObjectGroup::ShareTree(const ObjectGroup *shared, unsigned int group_bit)
+{
+  if (shared == NULL || shared == this) {
+    shared_ = NULL;
+    group_bit_ = 0;
+    return;
+  }
+
+  shared_ = shared;
+  group_bit_ = group_bit;
+
+  // trees built before sharing are dropped
+  if (!surface_built_bounds_.empty()) {
+    delete surface_set_acc_;
+    surface_set_acc_ = new_top_level_bvh();
+    surface_set_acc_->SetPrimitiveSet(&surface_set_);
+    surface_built_bounds_.clear();
+  }
+  if (!volume_built_bounds_.empty()) {
+    VolumeAccFree(volume_set_acc_);
+    volume_set_acc_ = VolumeAccNew(VOLACC_BVH);
+    VolumeAccSetTargetGeometry(volume_set_acc_,
+        &volume_set_,
+        volume_set_.GetObjectCount(),
+        &volume_set_.GetBounds(),
+        volume_ray_intersect,
+        volume_bounds);
+    volume_built_bounds_.clear();
+  }
+}
+
+bool ObjectGroup::IsSharingTree() const
+{
+  return shared_ != NULL;
+}
+
+unsigned int ObjectGroup::GetRayMask() const
+{
+  // a tree of its own has no other instances
+  if (IsSharingTree()) {
+    return group_bit_;
+  }
+  return ~static_cast<unsigned int>(GROUP_MASK_KINDS);
+}
+
 ObjectGroup *ObjGroupNew()
 {
   return new ObjectGroup();
@@ -88,6 +206,16 @@ void ObjGroupFree(ObjectGroup *group)
   delete group;
 }
 
+static BVHAccelerator *new_top_level_bvh()
+{
+  // instances overlap and are much more expensive to test than boxes
+  // so the top level is built with SAH down to single instance leaves
+  BVHAccelerator *bvh = new BVHAccelerator();
+  bvh->SetBuildMode(BVH_BUILD_SAH);
+  bvh->SetLeafSize(1);
+  return bvh;
+}
+
 static void volume_bounds(const void *prim_set, int prim_id, Box *bounds)
 {
   const ObjectSet *objset = (const ObjectSet *) prim_set;
@@ -95,11 +223,47 @@ static void volume_bounds(const void *prim_set, int prim_id, Box *bounds)
   *bounds = obj->GetBounds();
 }
 
+static bool is_same_box(const Box &a, const Box &b)
+{
+  return a.min.x == b.min.x && a.min.y == b.min.y && a.min.z == b.min.z &&
+         a.max.x == b.max.x && a.max.y == b.max.y && a.max.z == b.max.z;
+}
+
+// Returns true and records current bounds if objset is not empty and any of
+// object bounds differs from the ones used in the last build.
+static bool update_built_bounds(const ObjectSet &objset, std::vector<Box> *built_bounds)
+{
+  const int NOBJECTS = objset.GetObjectCount();
+  if (NOBJECTS == 0) {
+    return false;
+  }
+
+  bool changed = NOBJECTS != static_cast<int>(built_bounds->size());
+
+  for (int i = 0; i < NOBJECTS && !changed; i++) {
+    changed = !is_same_box(objset.GetObject(i)->GetBounds(), (*built_bounds)[i]);
+  }
+
+  if (!changed) {
+    return false;
+  }
+
+  built_bounds->resize(NOBJECTS);
+  for (int i = 0; i < NOBJECTS; i++) {
+    (*built_bounds)[i] = objset.GetObject(i)->GetBounds();
+  }
+
+  return true;
+}
+
 static int volume_ray_intersect(const void *prim_set, int prim_id, double time,
     const Ray *ray, Interval *interval)
 {
   const ObjectSet *objset = (const ObjectSet *) prim_set;
   const ObjectInstance *obj = objset->GetObject(prim_id);
+  if (!GroupMaskHits(obj->GetGroupMask(), ray->group_mask)) {
+    return 0;
+  }
   return obj->RayVolumeIntersect(*ray, time, interval);
 }
 
@@ -5,13 +5,47 @@
 #define FJ_OBJECT_GROUP_H
 
 #include "fj_object_set.h"
+#include "fj_box.h"
+#include <vector>
 
 namespace fj {
 
 class ObjectInstance;
 class VolumeAccelerator;
+class BVHAccelerator;
 class Accelerator;
 
+// Groups can trace the tree of another group holding all of their instances
+// instead of building trees of their own. rays carry a bit of their kind and
+// the bits of the group traced, and instances carry bits of the kinds they
+// are visible to and of the groups they are in. an instance is hit only if
+// it shares a kind bit and a group bit with the ray
+enum {
+  GROUP_MASK_CAMERA  = 1 << 0,
+  GROUP_MASK_SHADOW  = 1 << 1,
+  // diffuse rays too
+  GROUP_MASK_REFLECT = 1 << 2,
+  GROUP_MASK_REFRACT = 1 << 3,
+  GROUP_MASK_KINDS   = 0xF,
+  // the bit of the group of all objects. the bits above it are for groups
+  // sharing its tree
+  GROUP_MASK_ALL_OBJECTS = 1 << 4
+};
+// groups sharing a tree beyond this count build trees of their own
+const int GROUP_MASK_SHARED_COUNT = 27;
+
+inline bool GroupMaskHits(unsigned int object_mask, unsigned int ray_mask)
+{
+  const unsigned int shared = object_mask & ray_mask;
+  return (shared & GROUP_MASK_KINDS) != 0 && (shared & ~GROUP_MASK_KINDS) != 0;
+}
+
+// the bit of the nth group sharing a tree
+inline unsigned int GroupMaskSharedBit(int index)
+{
+  return GROUP_MASK_ALL_OBJECTS << (index + 1);
+}
+
 class ObjectGroup {
 public:
   ObjectGroup();
@@ -20,15 +54,40 @@ public:
   void AddObject(const ObjectInstance *obj);
   const Accelerator *GetSurfaceAccelerator() const;
   const VolumeAccelerator *GetVolumeAccelerator() const;
+  const ObjectSet &GetSurfaceSet() const;
+  const ObjectSet &GetVolumeSet() const;
+  // bytes of the accelerators over instances
+  std::size_t GetMemoryUsage() const;
 
   void ComputeBounds();
 
+  // builds accelerators over object instances. once built, they are refit
+  // when bounds of instances change e.g. by updating transforms, and
+  // rebuilt when instances are added. accelerators of the instanced
+  // geometry are never rebuilt here. does nothing while sharing a tree
+  int Build();
+
+  // traces the accelerators of the shared group holding all instances of
+  // this group and hits only instances with the group bit. NULL builds
+  // accelerators of its own again
+  void ShareTree(const ObjectGroup *shared, unsigned int group_bit);
+  bool IsSharingTree() const;
+  // group bits of rays traced against the group
+  unsigned int GetRayMask() const;
+
 private:
   ObjectSet surface_set_;
   ObjectSet volume_set_;
 
-  Accelerator *surface_set_acc_;
+  BVHAccelerator *surface_set_acc_;
   VolumeAccelerator *volume_set_acc_;
+
+  // instance bounds used in the last build
+  std::vector<Box> surface_built_bounds_;
+  std::vector<Box> volume_built_bounds_;
+
+  const ObjectGroup *shared_;
+  unsigned int group_bit_;
 };
 
 extern ObjectGroup *ObjGroupNew();
@@ -5,6 +5,7 @@
 #include "fj_intersection.h"
 #include "fj_accelerator.h"
 #include "fj_object_group.h"
+#include "fj_profile.h"
 #include "fj_interval.h"
 #include "fj_numeric.h"
 #include "fj_vector.h"
@@ -12,14 +13,19 @@
 #include "fj_matrix.h"
 #include "fj_ray.h"
 
+#include <algorithm>
 #include <cassert>
 
 namespace fj {
 
 ObjectInstance::ObjectInstance() :
     acc_(NULL),
+    own_acc_(NULL),
     volume_(NULL),
     bounds_(),
+    bounds_open_(),
+    bounds_close_(),
+    has_linear_motion_(false),
 
     transform_samples_(),
 
@@ -30,7 +36,9 @@ ObjectInstance::ObjectInstance() :
     reflection_target_(NULL),
     refraction_target_(NULL),
     shadow_target_(NULL),
-    self_target_(NULL)
+    self_target_(NULL),
+    visibility_(GROUP_MASK_KINDS),
+    group_mask_(~0U)
 {
   XfmInitTransformSampleList(&transform_samples_);
   update_bounds();
@@ -49,6 +57,7 @@ int ObjectInstance::SetSurface(const Accelerator *acc)
     return -1;
 
   acc_ = acc;
+  own_acc_ = acc;
   update_bounds();
 
   assert(acc_ != NULL && volume_ == NULL);
@@ -70,6 +79,29 @@ int ObjectInstance::SetVolume(const Volume *volume)
   return 0;
 }
 
+const Accelerator *ObjectInstance::GetSurface() const
+{
+  return acc_;
+}
+
+void ObjectInstance::ShareSurface(const Accelerator *acc)
+{
+  if (own_acc_ == NULL) {
+    return;
+  }
+
+  const Accelerator *next = acc == NULL ? own_acc_ : acc;
+  if (next != acc_) {
+    acc_ = next;
+    update_bounds();
+  }
+}
+
+const Accelerator *ObjectInstance::GetOwnSurface() const
+{
+  return own_acc_;
+}
+
 bool ObjectInstance::IsSurface() const
 {
   if (acc_ == NULL)
@@ -106,6 +138,12 @@ void ObjectInstance::SetScale(Real sx, Real sy, Real sz, Real time)
   update_bounds();
 }
 
+void ObjectInstance::SetTransform(const Real *trs, Real time)
+{
+  XfmPushTransformSamples(&transform_samples_, trs, time);
+  update_bounds();
+}
+
 void ObjectInstance::SetTransformOrder(int order)
 {
   XfmSetSampleTransformOrder(&transform_samples_, order);
@@ -118,6 +156,12 @@ void ObjectInstance::SetRotateOrder(int order)
   update_bounds();
 }
 
+void ObjectInstance::SetTimeOffset(Real time_offset)
+{
+  XfmSetSampleTimeOffset(&transform_samples_, time_offset);
+  update_bounds();
+}
+
 void ObjectInstance::SetShader(const Shader *shader, int shading_group_id)
 {
   if (static_cast<int>(shader_list_.size()) <= shading_group_id) {
@@ -174,6 +218,27 @@ const ObjectGroup *ObjectInstance::GetSelfHitTarget() const
   return self_target_;
 }
 
+void ObjectInstance::SetVisibility(unsigned int kinds)
+{
+  visibility_ = kinds & GROUP_MASK_KINDS;
+  group_mask_ = (group_mask_ & ~static_cast<unsigned int>(GROUP_MASK_KINDS)) | visibility_;
+}
+
+unsigned int ObjectInstance::GetVisibility() const
+{
+  return visibility_;
+}
+
+void ObjectInstance::SetGroupMask(unsigned int group_mask)
+{
+  group_mask_ = group_mask;
+}
+
+unsigned int ObjectInstance::GetGroupMask() const
+{
+  return group_mask_;
+}
+
 const Shader *ObjectInstance::GetShader(int shading_group_id) const
 {
   if (shading_group_id < 0 ||
@@ -190,6 +255,11 @@ const Shader *ObjectInstance::GetShader(int shading_group_id) const
   }
 }
 
+bool ObjectInstance::HasShader(const Shader *shader) const
+{
+  return std::find(shader_list_.begin(), shader_list_.end(), shader) != shader_list_.end();
+}
+
 const Light **ObjectInstance::GetLightList() const
 {
   return target_lights_;
@@ -210,19 +280,32 @@ void ObjectInstance::ComputeBounds()
   update_bounds();
 }
 
+bool ObjectInstance::HasLinearMotion() const
+{
+  return has_linear_motion_;
+}
+
+void ObjectInstance::GetMotionBounds(Box *bounds_open, Box *bounds_close) const
+{
+  *bounds_open = bounds_open_;
+  *bounds_close = bounds_close_;
+}
+
 bool ObjectInstance::RayIntersect(const Ray &ray, Real time, Intersection *isect) const
 {
   if (!IsSurface()) {
     return false;
   }
+  const ProfileScope profile(PROFILE_OBJECT, this);
 
-  Transform transform_interp;
-  XfmLerpTransformSample(&transform_samples_, time, &transform_interp);
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
 
   // transform ray to object space
   Ray ray_object_space = ray;
-  XfmTransformPointInverse(&transform_interp, &ray_object_space.orig);
-  XfmTransformVectorInverse(&transform_interp, &ray_object_space.dir);
+  XfmTransformPointInverse(transform_interp, &ray_object_space.orig);
+  XfmTransformVectorInverse(transform_interp, &ray_object_space.dir);
 
   const bool hit = acc_->Intersect(ray_object_space, time, isect);
   if (!hit) {
@@ -230,12 +313,199 @@ bool ObjectInstance::RayIntersect(const Ray &ray, Real time, Intersection *isect
   }
 
   // transform intersection back to world space
-  XfmTransformPoint(&transform_interp, &isect->P);
-  XfmTransformVector(&transform_interp, &isect->N);
+  XfmTransformPoint(transform_interp, &isect->P);
+  XfmTransformVector(transform_interp, &isect->N);
+  isect->N = Normalize(isect->N);
+
+  XfmTransformVector(transform_interp, &isect->dPdu);
+  XfmTransformVector(transform_interp, &isect->dPdv);
+
+  isect->object = this;
+
+  return true;
+}
+
+bool ObjectInstance::RayIntersectAll(const Ray &ray, Real time, HitList *hits) const
+{
+  if (!IsSurface()) {
+    return false;
+  }
+  const ProfileScope profile(PROFILE_OBJECT, this);
+
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
+
+  // hits of the object are collected apart since they are in object space.
+  // t_hit is the same in both spaces as the direction is not normalized
+  Ray ray_object_space = ray;
+  XfmTransformPointInverse(transform_interp, &ray_object_space.orig);
+  XfmTransformVectorInverse(transform_interp, &ray_object_space.dir);
+  ray_object_space.tmax = Min(ray.tmax, hits->GetMaxDistance());
+
+  HitList object_hits;
+  if (!acc_->IntersectAll(ray_object_space, time, &object_hits)) {
+    return false;
+  }
+
+  for (int i = 0; i < object_hits.GetCount(); i++) {
+    Intersection isect = object_hits.Get(i);
+
+    XfmTransformPoint(transform_interp, &isect.P);
+    XfmTransformVector(transform_interp, &isect.N);
+    isect.N = Normalize(isect.N);
+
+    XfmTransformVector(transform_interp, &isect.dPdu);
+    XfmTransformVector(transform_interp, &isect.dPdv);
+
+    isect.object = this;
+    hits->Add(isect);
+  }
+
+  return true;
+}
+
+unsigned int ObjectInstance::RayIntersectPacket(const Ray *rays, const Real *times,
+    unsigned int ray_mask, Intersection *isects) const
+{
+  if (!IsSurface()) {
+    return 0;
+  }
+
+  // active rays are packed in object space
+  Ray rays_object_space[RAY_PACKET_SIZE];
+  Real times_packed[RAY_PACKET_SIZE];
+  Intersection isects_tmp[RAY_PACKET_SIZE];
+  int ray_ids[RAY_PACKET_SIZE];
+  int count = 0;
+
+  for (int i = 0; ray_mask >> i != 0; i++) {
+    if (!(ray_mask & (1U << i))) {
+      continue;
+    }
+    Transform transform_tmp;
+    const Transform *transform_interp =
+        XfmGetTransformSample(&transform_samples_, times[i], &transform_tmp);
+
+    Ray &ray_object_space = rays_object_space[count];
+    ray_object_space = rays[i];
+    XfmTransformPointInverse(transform_interp, &ray_object_space.orig);
+    XfmTransformVectorInverse(transform_interp, &ray_object_space.dir);
+    times_packed[count] = times[i];
+    ray_ids[count++] = i;
+  }
+
+  unsigned int packed_mask = 0;
+  {
+    const ProfileScope profile(PROFILE_OBJECT, this, count);
+    packed_mask = acc_->IntersectPacket(rays_object_space, times_packed,
+        count, isects_tmp);
+  }
+  unsigned int hit_mask = 0;
+
+  for (int i = 0; i < count; i++) {
+    if (!(packed_mask & (1U << i))) {
+      continue;
+    }
+    Transform transform_tmp;
+    const Transform *transform_interp =
+        XfmGetTransformSample(&transform_samples_, times_packed[i], &transform_tmp);
+    Intersection &isect = isects_tmp[i];
+
+    // transform intersection back to world space
+    XfmTransformPoint(transform_interp, &isect.P);
+    XfmTransformVector(transform_interp, &isect.N);
+    isect.N = Normalize(isect.N);
+
+    XfmTransformVector(transform_interp, &isect.dPdu);
+    XfmTransformVector(transform_interp, &isect.dPdv);
+
+    isect.object = this;
+
+    isects[ray_ids[i]] = isect;
+    hit_mask |= 1U << ray_ids[i];
+  }
+
+  return hit_mask;
+}
+
+bool ObjectInstance::RayOcclude(const Ray &ray, Real time, Intersection *isect) const
+{
+  if (!IsSurface()) {
+    return false;
+  }
+  const ProfileScope profile(PROFILE_OBJECT, this);
+
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
+
+  // transform ray to object space. t_hit is the same in both spaces
+  Ray ray_object_space = ray;
+  XfmTransformPointInverse(transform_interp, &ray_object_space.orig);
+  XfmTransformVectorInverse(transform_interp, &ray_object_space.dir);
+
+  const bool hit = acc_->Occlude(ray_object_space, time, isect);
+  if (!hit) {
+    return false;
+  }
+
+  isect->object = this;
+
+  return true;
+}
+
+bool ObjectInstance::ComputeHitAttributes(const Ray &ray, Real time,
+    Intersection *isect) const
+{
+  if (!IsSurface()) {
+    return false;
+  }
+
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
+
+  Ray ray_object_space = ray;
+  XfmTransformPointInverse(transform_interp, &ray_object_space.orig);
+  XfmTransformVectorInverse(transform_interp, &ray_object_space.dir);
+
+  if (!acc_->ComputeHitAttributes(ray_object_space, time, isect)) {
+    return false;
+  }
+
+  // transform intersection back to world space
+  XfmTransformPoint(transform_interp, &isect->P);
+  XfmTransformVector(transform_interp, &isect->N);
   isect->N = Normalize(isect->N);
 
-  XfmTransformVector(&transform_interp, &isect->dPdu);
-  XfmTransformVector(&transform_interp, &isect->dPdv);
+  XfmTransformVector(transform_interp, &isect->dPdu);
+  XfmTransformVector(transform_interp, &isect->dPdv);
+
+  isect->object = this;
+
+  return true;
+}
+
+bool ObjectInstance::RayOccludePrimitive(Index prim_id, const Ray &ray, Real time,
+    Intersection *isect) const
+{
+  if (!IsSurface()) {
+    return false;
+  }
+
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
+
+  Ray ray_object_space = ray;
+  XfmTransformPointInverse(transform_interp, &ray_object_space.orig);
+  XfmTransformVectorInverse(transform_interp, &ray_object_space.dir);
+
+  const bool hit = acc_->OccludePrimitive(prim_id, ray_object_space, time, isect);
+  if (!hit) {
+    return false;
+  }
 
   isect->object = this;
 
@@ -248,14 +518,16 @@ bool ObjectInstance::RayVolumeIntersect(const Ray &ray, Real time,
   if (!IsVolume()) {
     return false;
   }
+  const ProfileScope profile(PROFILE_OBJECT, this);
 
-  Transform transform_interp;
-  XfmLerpTransformSample(&transform_samples_, time, &transform_interp);
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
 
   // transform ray to object space
   Ray ray_object_space = ray;
-  XfmTransformPointInverse(&transform_interp, &ray_object_space.orig);
-  XfmTransformVectorInverse(&transform_interp, &ray_object_space.dir);
+  XfmTransformPointInverse(transform_interp, &ray_object_space.orig);
+  XfmTransformVectorInverse(transform_interp, &ray_object_space.dir);
 
   const Box volume_bounds = volume_->GetBounds();
   Real boxhit_tmin = 0;
@@ -279,21 +551,81 @@ bool ObjectInstance::RayVolumeIntersect(const Ray &ray, Real time,
   return true;
 }
 
-bool ObjectInstance::GetVolumeSample(const Vector &point, Real time,
+bool ObjectInstance::GetVolumeSample(const Vector &point, Real time, Real filter_width,
     VolumeSample *sample) const
 {
   if (!IsVolume()) {
     return false;
   }
+  const ProfileScope profile(PROFILE_OBJECT, this);
+
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
+
+  Vector point_in_objspace = point;
+  XfmTransformPointInverse(transform_interp, &point_in_objspace);
+
+  if (filter_width == 0) {
+    return volume_->GetSample(point_in_objspace, sample);
+  }
 
-  Transform transform_interp;
-  XfmLerpTransformSample(&transform_samples_, time, &transform_interp);
+  // assumes uniform scaling
+  Vector width_in_objspace(filter_width, 0, 0);
+  XfmTransformVectorInverse(transform_interp, &width_in_objspace);
 
+  return volume_->GetFilteredSample(point_in_objspace, Length(width_in_objspace), sample);
+}
+
+void ObjectInstance::GetVolumeSamples(const Vector *points, int count, Real time,
+    Real filter_width, VolumeSample *samples) const
+{
+  if (!IsVolume()) {
+    for (int i = 0; i < count; i++) {
+      samples[i].density = 0;
+    }
+    return;
+  }
+  const ProfileScope profile(PROFILE_OBJECT, this, count);
+
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
+
+  Vector width_in_objspace(filter_width, 0, 0);
+  XfmTransformVectorInverse(transform_interp, &width_in_objspace);
+  const Real width = filter_width == 0 ? 0 : Length(width_in_objspace);
+
+  for (int i = 0; i < count; i += 4) {
+    const int chunk_count = Min(count - i, 4);
+    Vector points_in_objspace[4];
+    for (int j = 0; j < chunk_count; j++) {
+      points_in_objspace[j] = points[i + j];
+      XfmTransformPointInverse(transform_interp, &points_in_objspace[j]);
+    }
+    volume_->GetFilteredSamples(points_in_objspace, chunk_count, width, &samples[i]);
+  }
+}
+
+float ObjectInstance::GetVolumeMaxDensity(const Vector &point, const Vector &dir,
+    Real time, Real *t_exit) const
+{
+  if (!IsVolume()) {
+    *t_exit = 0;
+    return 0;
+  }
+
+  Transform transform_tmp;
+  const Transform *transform_interp =
+      XfmGetTransformSample(&transform_samples_, time, &transform_tmp);
+
+  // distance along the ray stays the same in object space
   Vector point_in_objspace = point;
-  XfmTransformPointInverse(&transform_interp, &point_in_objspace);
+  Vector dir_in_objspace = dir;
+  XfmTransformPointInverse(transform_interp, &point_in_objspace);
+  XfmTransformVectorInverse(transform_interp, &dir_in_objspace);
 
-  const bool hit = volume_->GetSample(point_in_objspace, sample);
-  return hit;
+  return volume_->GetMaxDensity(point_in_objspace, dir_in_objspace, t_exit);
 }
 
 void ObjectInstance::update_bounds()
@@ -307,7 +639,9 @@ void ObjectInstance::update_bounds()
   else {
     bounds_ = Box();
   }
+  const Box original_bounds = bounds_;
   merge_sampled_bounds();
+  update_motion_bounds(original_bounds);
 }
 
 void ObjectInstance::merge_sampled_bounds()
@@ -355,4 +689,36 @@ void ObjectInstance::merge_sampled_bounds()
   bounds_ = merged_bounds;
 }
 
+void ObjectInstance::update_motion_bounds(const Box &original_bounds)
+{
+  const PropertySampleList &translate = transform_samples_.translate;
+  const Real time_offset = transform_samples_.time_offset;
+
+  // the linear part of the transform is the same at any time when only
+  // translate is animated, so the bounds move linearly with translation
+  has_linear_motion_ =
+      transform_samples_.rotate.sample_count == 1 &&
+      transform_samples_.scale.sample_count == 1 &&
+      translate.sample_count == 2 &&
+      translate.samples[0].time == time_offset &&
+      translate.samples[1].time == time_offset + 1;
+
+  if (!has_linear_motion_) {
+    bounds_open_ = bounds_;
+    bounds_close_ = bounds_;
+    return;
+  }
+
+  Transform transform_tmp;
+  const Transform *transform_open =
+      XfmGetTransformSample(&transform_samples_, 0, &transform_tmp);
+  bounds_open_ = original_bounds;
+  XfmTransformBounds(transform_open, &bounds_open_);
+
+  const Transform *transform_close =
+      XfmGetTransformSample(&transform_samples_, 1, &transform_tmp);
+  bounds_close_ = original_bounds;
+  XfmTransformBounds(transform_close, &bounds_close_);
+}
+
 } // namespace xxx
@@ -6,6 +6,7 @@
 
 #include "fj_compatibility.h"
 #include "fj_transform.h"
+#include "fj_types.h"
 #include "fj_box.h"
 
 #include <vector>
@@ -13,6 +14,7 @@
 namespace fj {
 
 class Intersection;
+class HitList;
 class VolumeSample;
 class Accelerator;
 class Interval;
@@ -31,6 +33,12 @@ public:
   // surface/volume interfaces
   int SetSurface(const Accelerator *acc);
   int SetVolume(const Volume *volume);
+  // the surface rendered. the one set by SetSurface unless shared
+  const Accelerator *GetSurface() const;
+  // renders acc of the same geometry instead of the surface set by
+  // SetSurface. NULL renders that surface again
+  void ShareSurface(const Accelerator *acc);
+  const Accelerator *GetOwnSurface() const;
   bool IsSurface() const;
   bool IsVolume() const;
 
@@ -38,8 +46,12 @@ public:
   void SetTranslate(Real tx, Real ty, Real tz, Real time);
   void SetRotate(Real rx, Real ry, Real rz, Real time);
   void SetScale(Real sx, Real sy, Real sz, Real time);
+  // translate, rotate and scale in trs at once
+  void SetTransform(const Real *trs, Real time);
   void SetTransformOrder(int order);
   void SetRotateOrder(int order);
+  // transform samples are looked up at time + time_offset
+  void SetTimeOffset(Real time_offset);
 
   // non-geometric properties */
   void SetShader(const Shader *shader, int shading_group_id);
@@ -53,26 +65,69 @@ public:
   const ObjectGroup *GetRefractTarget() const;
   const ObjectGroup *GetShadowTarget() const;
   const ObjectGroup *GetSelfHitTarget() const;
+  // kinds of rays of GROUP_MASK_* the instance is hit by. all by default
+  void SetVisibility(unsigned int kinds);
+  unsigned int GetVisibility() const;
+  // the visibility and bits of the groups the instance is in. group bits
+  // are set when groups are prepared for rendering. all bits until then
+  void SetGroupMask(unsigned int group_mask);
+  unsigned int GetGroupMask() const;
 
   const Shader *GetShader(int shading_group_id) const;
+  // true if any shading group has the shader
+  bool HasShader(const Shader *shader) const;
   const Light **GetLightList() const;
   int   GetLightCount() const;
   const Box &GetBounds() const;
   void  ComputeBounds();
+  // true if only translate moves linearly from time 0 to 1 after the time
+  // offset. motion bounds are the bounds at time 0 and 1 then, otherwise
+  // both are GetBounds()
+  bool HasLinearMotion() const;
+  void GetMotionBounds(Box *bounds_open, Box *bounds_close) const;
 
   // sampling
   bool RayIntersect(const Ray &ray, Real time, Intersection *isect) const;
+  // returns any hit in ray range. only object, prim_id, shading_group_id
+  // and t_hit are filled
+  bool RayOcclude(const Ray &ray, Real time, Intersection *isect) const;
+  // RayIntersect of a hit found before, e.g. kept from the last render,
+  // from prim_id, shading_group_id, t_hit and prim_uv of isect
+  bool ComputeHitAttributes(const Ray &ray, Real time, Intersection *isect) const;
+  // RayOcclude by the primitive prim_id of the surface only
+  bool RayOccludePrimitive(Index prim_id, const Ray &ray, Real time,
+      Intersection *isect) const;
+  // adds the closest hits in world space to hits
+  bool RayIntersectAll(const Ray &ray, Real time, HitList *hits) const;
+  // RayIntersect for rays of ray_mask in a packet. isects[i] is replaced
+  // by a hit closer than rays[i].tmax. returns the mask of replaced ones
+  unsigned int RayIntersectPacket(const Ray *rays, const Real *times, unsigned int ray_mask,
+      Intersection *isects) const;
   bool RayVolumeIntersect(const Ray &ray, Real time, Interval *interval) const;
-  bool GetVolumeSample(const Vector &point, Real time, VolumeSample *sample) const;
+  // filter_width is the size of the footprint in world space around point
+  // coarser levels of the volume are sampled for. 0 for full resolution
+  bool GetVolumeSample(const Vector &point, Real time, Real filter_width,
+      VolumeSample *sample) const;
+  // GetVolumeSample of points at a time with the same filter_width.
+  // density is 0 where they are not in the volume
+  void GetVolumeSamples(const Vector *points, int count, Real time, Real filter_width,
+      VolumeSample *samples) const;
+  float GetVolumeMaxDensity(const Vector &point, const Vector &dir,
+      Real time, Real *t_exit) const;
 
 private:
   void update_bounds();
   void merge_sampled_bounds();
+  void update_motion_bounds(const Box &original_bounds);
 
   // geometric properties
   const Accelerator *acc_;
+  const Accelerator *own_acc_;
   const Volume *volume_;
   Box bounds_;
+  Box bounds_open_;
+  Box bounds_close_;
+  bool has_linear_motion_;
 
   // transformation properties
   TransformSampleList transform_samples_;
@@ -85,6 +140,8 @@ private:
   const ObjectGroup *refraction_target_;
   const ObjectGroup *shadow_target_;
   const ObjectGroup *self_target_;
+  unsigned int visibility_;
+  unsigned int group_mask_;
 };
 
 } // namespace xxx
@@ -3,6 +3,10 @@
 
 #include "fj_object_set.h"
 #include "fj_object_instance.h"
+#include "fj_object_group.h"
+#include "fj_intersection.h"
+#include "fj_accelerator.h"
+#include "fj_ray.h"
 
 #include <cassert>
 
@@ -45,6 +49,8 @@ const Box &ObjectSet::GetBounds() const
 
 void ObjectSet::ComputeBounds()
 {
+  bounds_.ReverseInfinite();
+
   for (int i = 0; i < GetObjectCount(); i++) {
     const ObjectInstance *obj = GetObject(i);
     Box obj_bounds;
@@ -58,15 +64,92 @@ bool ObjectSet::ray_intersect(Index prim_id, const Ray &ray,
     Real time, Intersection *isect) const
 {
   const ObjectInstance *obj = GetObject(prim_id);
+  if (!GroupMaskHits(obj->GetGroupMask(), ray.group_mask)) {
+    return false;
+  }
   return obj->RayIntersect(ray, time, isect);
 }
 
+bool ObjectSet::ray_occlude(Index prim_id, const Ray &ray,
+    Real time, Intersection *isect) const
+{
+  const ObjectInstance *obj = GetObject(prim_id);
+  if (!GroupMaskHits(obj->GetGroupMask(), ray.group_mask)) {
+    return false;
+  }
+  return obj->RayOcclude(ray, time, isect);
+}
+
+bool ObjectSet::ray_intersect_all(Index prim_id, const Ray &ray,
+    Real time, HitList *hits) const
+{
+  const ObjectInstance *obj = GetObject(prim_id);
+  if (!GroupMaskHits(obj->GetGroupMask(), ray.group_mask)) {
+    return false;
+  }
+  return obj->RayIntersectAll(ray, time, hits);
+}
+
+unsigned int ObjectSet::ray_intersect_packet(const Index *prim_ids, int count,
+    const Ray *rays, const Real *times, unsigned int ray_mask,
+    Intersection *isects) const
+{
+  // rays are shortened to the closest hits of objects tested before
+  Ray rays_tmp[RAY_PACKET_SIZE];
+  unsigned int hit_mask = 0;
+
+  for (int i = 0; ray_mask >> i != 0; i++) {
+    rays_tmp[i] = rays[i];
+  }
+
+  for (int i = 0; i < count; i++) {
+    const ObjectInstance *obj = GetObject(prim_ids[i]);
+    unsigned int visible_mask = 0;
+    for (int j = 0; ray_mask >> j != 0; j++) {
+      if ((ray_mask & (1U << j)) && GroupMaskHits(obj->GetGroupMask(), rays[j].group_mask)) {
+        visible_mask |= 1U << j;
+      }
+    }
+    if (visible_mask == 0) {
+      continue;
+    }
+    const unsigned int obj_mask =
+        obj->RayIntersectPacket(rays_tmp, times, visible_mask, isects);
+
+    for (int j = 0; obj_mask >> j != 0; j++) {
+      if (obj_mask & (1U << j)) {
+        rays_tmp[j].tmax = isects[j].t_hit;
+      }
+    }
+    hit_mask |= obj_mask;
+  }
+
+  return hit_mask;
+}
+
 void ObjectSet::get_primitive_bounds(Index prim_id, Box *bounds) const
 {
   const ObjectInstance *obj = GetObject(prim_id);
   *bounds = obj->GetBounds();
 }
 
+bool ObjectSet::has_motion() const
+{
+  for (int i = 0; i < GetObjectCount(); i++) {
+    if (GetObject(i)->HasLinearMotion()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ObjectSet::get_primitive_motion_bounds(Index prim_id,
+    Box *bounds_open, Box *bounds_close) const
+{
+  const ObjectInstance *obj = GetObject(prim_id);
+  obj->GetMotionBounds(bounds_open, bounds_close);
+}
+
 void ObjectSet::get_bounds(Box *bounds) const
 {
   *bounds = GetBounds();
@@ -30,9 +30,21 @@ public:
   void ComputeBounds();
 
 private:
+  template <typename T> friend class PrimitiveLeafTest;
+
   virtual bool ray_intersect(Index prim_id, const Ray &ray,
       Real time, Intersection *isect) const;
+  virtual bool ray_occlude(Index prim_id, const Ray &ray,
+      Real time, Intersection *isect) const;
+  virtual bool ray_intersect_all(Index prim_id, const Ray &ray,
+      Real time, HitList *hits) const;
+  virtual unsigned int ray_intersect_packet(const Index *prim_ids, int count,
+      const Ray *rays, const Real *times, unsigned int ray_mask,
+      Intersection *isects) const;
   virtual void get_primitive_bounds(Index prim_id, Box *bounds) const;
+  virtual bool has_motion() const;
+  virtual void get_primitive_motion_bounds(Index prim_id,
+      Box *bounds_open, Box *bounds_close) const;
   virtual void get_bounds(Box *bounds) const;
   virtual Index get_primitive_count() const;
 
@@ -5,6 +5,9 @@ See LICENSE and README
 
 #include "fj_os.h"
 #include "fj_compatibility.h"
+#include <algorithm>
+#include <mutex>
+#include <map>
 
 namespace fj {
 
@@ -6,6 +6,11 @@ See LICENSE and README
 #ifndef FJ_OS_H
 #define FJ_OS_H
 
+#include "fj_compatibility.h"
+#include <string>
+#include <vector>
+#include <cstddef>
+
 namespace fj {
 
 extern void *OsDlopen(const char *filename);
@@ -13,6 +18,116 @@ extern void *OsDlsym(void *handle, const char *symbol);
 extern char *OsDlerror(void *handle);
 extern int OsDlclose(void *handle);
 
+// pins the calling thread to the cpus. count 0 allows all cpus.
+// returns -1 if failed or not supported
+extern int OsSetThreadAffinity(const int *cpu_ids, int count);
+// stores up to max_count cpus in the NUMA node and returns the count.
+// returns -1 if the node is not found or not supported
+extern int OsGetNumaNodeCPUs(int node_id, int *cpu_ids, int max_count);
+// the number of NUMA nodes. 1 if not supported
+extern int OsGetNumaNodeCount();
+// cpus the process is allowed to run on by its affinity mask. returns -1
+// if not supported
+extern int OsGetAffinityCPUCount();
+// cpus worth of time the process may use by the cpu quota of its container
+// e.g. 2.5 for 250ms per 100ms period. returns -1 if there is no quota or
+// not supported
+extern double OsGetCPUQuota();
+// spreads pages of the range over all NUMA nodes page by page. pages
+// already touched are moved. only whole pages in the range are spread.
+// returns -1 if failed or not supported
+extern int OsInterleaveMemory(const void *data, size_t size);
+
+// maps the whole file read only and stores its size. returns NULL if failed.
+// the mapping can be read by any thread until unmapped
+extern FJ_API void *OsMapFile(const char *filename, size_t *size);
+extern FJ_API int OsUnmapFile(void *data, size_t size);
+// creates the file of the size filled with zeros or truncates it to the
+// size, and maps it for reading and writing. writes go to the file.
+// returns NULL if failed
+extern FJ_API void *OsMapWritableFile(const char *filename, size_t size);
+// writes modified pages of the writable mapped range to the file. data must
+// be page aligned. returns -1 if failed
+extern FJ_API int OsFlushMappedPages(void *data, size_t size);
+// creates the named memory of the size filled with zeros, and maps it for
+// reading and writing. other processes map it by the name until removed.
+// names are of letters, digits and underscores. returns NULL if failed
+extern FJ_API void *OsCreateSharedMemory(const char *name, size_t size);
+// maps the named memory created by another process read only. returns NULL
+// if not found or smaller than the size
+extern FJ_API void *OsOpenSharedMemory(const char *name, size_t size);
+extern FJ_API int OsUnmapSharedMemory(void *data, size_t size);
+// removes the name. mappings stay valid until unmapped
+extern FJ_API int OsRemoveSharedMemory(const char *name);
+extern FJ_API int OsGetProcessId();
+// bytes of a page of memory mappings
+extern FJ_API size_t OsGetPageSize();
+// drops the pages of the mapped range from memory. they are read again from
+// the file when touched. data must be page aligned. returns -1 if failed
+extern FJ_API int OsEvictMappedPages(const void *data, size_t size);
+// stores bytes of the mapped range in memory. data must be page aligned.
+// returns -1 if failed or not supported
+extern FJ_API int OsGetResidentSize(const void *data, size_t size, size_t *resident);
+// how a mapped range or a file range is going to be read
+enum OsAccessAdvice {
+  OS_ACCESS_NORMAL = 0,
+  // reads ahead more and drops pages behind
+  OS_ACCESS_SEQUENTIAL,
+  // doesn't read ahead around pages touched
+  OS_ACCESS_RANDOM,
+  // starts reading the range in the background
+  OS_ACCESS_WILLNEED
+};
+// advises how the mapped range is going to be read. the range is widened to
+// whole pages. returns -1 if failed or not supported
+extern FJ_API int OsAdviseMappedPages(const void *data, size_t size, int advice);
+
+// a file opened for reading at offsets. reads don't move a shared position
+// so that threads can read the same file at once
+class OsFile;
+// returns NULL if failed
+extern FJ_API OsFile *OsOpenFile(const char *filename);
+extern FJ_API void OsCloseFile(OsFile *file);
+// returns -1 if failed
+extern FJ_API long long OsGetFileSize(const OsFile *file);
+// reads size bytes at offset and returns the bytes read, fewer only at the
+// end of the file. returns -1 if failed
+extern FJ_API long long OsReadFile(OsFile *file, long long offset, void *dst, size_t size);
+// advises how the range of the file is going to be read. OS_ACCESS_WILLNEED
+// reads it ahead into the page cache. returns -1 if failed or not supported
+extern FJ_API int OsAdviseFile(OsFile *file, long long offset, size_t size, int advice);
+
+// a read running in the background. dst must stay valid until it is finished
+class OsAsyncRead;
+// returns NULL if the read cannot be started
+extern FJ_API OsAsyncRead *OsStartAsyncRead(OsFile *file, long long offset,
+    void *dst, size_t size);
+// true if the read is done and finishing it won't wait
+extern FJ_API bool OsIsAsyncReadDone(OsAsyncRead *read);
+// waits for the read and deletes it. returns the same as OsReadFile
+extern FJ_API long long OsFinishAsyncRead(OsAsyncRead *read);
+
+// pages read from files by the process so far. returns -1 if not supported
+extern FJ_API long long OsGetPageInCount();
+// the largest resident memory of the process so far in bytes. returns -1 if
+// not supported
+extern FJ_API long long OsGetPeakMemoryUsage();
+// the resident memory of the process in bytes. returns -1 if not supported
+extern FJ_API long long OsGetMemoryUsage();
+
+// locks the file exclusively between processes without waiting, creating
+// it if needed. the lock is released by OsUnlockFile or when the process
+// exits. returns NULL if the file is locked by anyone else or failed
+class OsFileLock;
+extern FJ_API OsFileLock *OsTryLockFile(const char *filename);
+extern FJ_API void OsUnlockFile(OsFileLock *lock);
+// the directory for temporary files with no trailing separator
+extern FJ_API std::string OsGetTempDirectory();
+
+// stores names of the regular files in the directory sorted by name.
+// returns -1 if the directory cannot be read
+extern FJ_API int OsListFiles(const char *dirname, std::vector<std::string> *filenames);
+
 } // namespace xxx
 
 #endif /* FJ_XXX_H */
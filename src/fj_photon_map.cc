@@ -0,0 +1,523 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_photon_map.h"
+#include "fj_object_instance.h"
+#include "fj_memory_arena.h"
+#include "fj_multi_thread.h"
+#include "fj_object_group.h"
+#include "fj_intersection.h"
+#include "fj_accelerator.h"
+#include "fj_numeric.h"
+#include "fj_shading.h"
+#include "fj_shader.h"
+#include "fj_random.h"
+#include "fj_light.h"
+#include "fj_ray.h"
+#include <algorithm>
+#include <cmath>
+
+namespace fj {
+
+// photons emitted in a task of tracing
+static const int EMIT_CHUNK_SIZE = 4096;
+// photons stored in a task of building
+static const int BUILD_CHUNK_SIZE = 65536;
+// paths longer than this are dropped
+static const int MAX_BOUNCE_COUNT = 8;
+// default radius relative to the bounds of specular objects
+static const Real AUTO_RADIUS_RATIO = 1. / 64;
+// a photon and its share of bucket offsets. buckets are up to twice photons
+static const std::size_t PHOTON_BYTES = sizeof(Photon) + 2 * sizeof(uint32_t);
+static const Real RAY_OFFSET = .0001;
+
+// photons of a light aimed at the bounding sphere of a specular object
+class Emitter {
+public:
+  Emitter() : light(NULL), center(), radius(0), weight(0), first(0), count(0) {}
+  ~Emitter() {}
+
+  const Light *light;
+  Vector center;
+  Real radius;
+  Real weight;
+  int first;
+  int count;
+};
+
+class PhotonTrace {
+public:
+  PhotonTrace() : target(NULL), emitters(), emit_count(0), chunks() {}
+  ~PhotonTrace() {}
+
+  const ObjectGroup *target;
+  std::vector<Emitter> emitters;
+  int emit_count;
+  // photons stored by each task. merged in the order of tasks
+  std::vector<std::vector<Photon>> chunks;
+};
+
+class PhotonBuild {
+public:
+  PhotonBuild() : photons(NULL), inv_cell_size(0), mask(0), buckets() {}
+  ~PhotonBuild() {}
+
+  const std::vector<Photon> *photons;
+  Real inv_cell_size;
+  uint64_t mask;
+  std::vector<uint32_t> buckets;
+};
+
+static LoopStatus trace_photon_chunk_task(void *data, const ThreadContext &context);
+static LoopStatus compute_bucket_chunk_task(void *data, const ThreadContext &context);
+static void trace_photon(const PhotonTrace &trace, const Emitter &emitter,
+    XorShift &rng, std::vector<Photon> &photons);
+static Real cone_cos_max(const Vector &apex, const Vector &center, Real radius);
+static Vector cone_direction(const Vector &axis, Real cos_max, Real u, Real v);
+static int cell_index(Real x, Real inv_cell_size);
+
+static uint64_t compute_bucket(int x, int y, int z)
+{
+  uint64_t key =
+      (static_cast<uint64_t>(x & 0x1fffff) << 42) |
+      (static_cast<uint64_t>(y & 0x1fffff) << 21) |
+      (static_cast<uint64_t>(z & 0x1fffff));
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+PhotonMap::PhotonMap() :
+  photons_(),
+  bucket_offsets_(),
+  max_photon_count_(0),
+  radius_(0),
+  cell_size_(0)
+{
+}
+
+PhotonMap::~PhotonMap()
+{
+}
+
+void PhotonMap::Init(int photon_count, std::size_t memory_budget, Real radius)
+{
+  std::vector<Photon>().swap(photons_);
+  std::vector<uint32_t>().swap(bucket_offsets_);
+
+  const std::size_t budget_count = memory_budget / PHOTON_BYTES;
+  max_photon_count_ = static_cast<Index>(
+      std::min(static_cast<std::size_t>(Max(photon_count, 0)), budget_count));
+  radius_ = Max(radius, 0);
+  cell_size_ = 2 * radius_;
+}
+
+bool PhotonMap::IsEnabled() const
+{
+  return max_photon_count_ > 0;
+}
+
+int PhotonMap::Trace(const ObjectGroup *target, Light **lights, int nlights)
+{
+  if (!IsEnabled() || target == NULL) {
+    return -1;
+  }
+
+  PhotonTrace trace;
+  trace.target = target;
+
+  // specular objects photons are aimed at
+  const ObjectSet &surfaces = target->GetSurfaceSet();
+  std::vector<const ObjectInstance *> casters;
+  Box caster_bounds;
+  caster_bounds.ReverseInfinite();
+  for (Index i = 0; i < surfaces.GetObjectCount(); i++) {
+    const ObjectInstance *obj = surfaces.GetObject(i);
+    const Shader *shader = obj->GetShader(0);
+    if (shader != NULL && shader->ScattersPhotons()) {
+      casters.push_back(obj);
+      caster_bounds.AddBox(obj->GetBounds());
+    }
+  }
+  if (casters.empty()) {
+    return 0;
+  }
+
+  if (radius_ <= 0) {
+    radius_ = Length(caster_bounds.Diagonal()) * AUTO_RADIUS_RATIO;
+    cell_size_ = 2 * radius_;
+  }
+
+  // photons are split by the power each light sends to each object
+  Real total_weight = 0;
+  for (int i = 0; i < nlights; i++) {
+    const Light *light = lights[i];
+    const Real power = light->GetIntensity() * Luminance(light->GetColor());
+    if (power <= 0 || light->GetSampleCount() < 1) {
+      continue;
+    }
+    const Vector apex = light->GetBounds().Centroid();
+
+    for (std::size_t j = 0; j < casters.size(); j++) {
+      const Box &bounds = casters[j]->GetBounds();
+      Emitter emitter;
+      emitter.light = light;
+      emitter.center = bounds.Centroid();
+      emitter.radius = .5 * Length(bounds.Diagonal());
+      const Real cos_max = cone_cos_max(apex, emitter.center, emitter.radius);
+      emitter.weight = power * (1 - cos_max);
+      total_weight += emitter.weight;
+      trace.emitters.push_back(emitter);
+    }
+  }
+  if (total_weight <= 0) {
+    return 0;
+  }
+
+  int first = 0;
+  for (std::size_t i = 0; i < trace.emitters.size(); i++) {
+    Emitter &emitter = trace.emitters[i];
+    emitter.first = first;
+    emitter.count = static_cast<int>(max_photon_count_ * emitter.weight / total_weight);
+    first += emitter.count;
+  }
+  trace.emit_count = first;
+
+  const int NCHUNKS = (trace.emit_count + EMIT_CHUNK_SIZE - 1) / EMIT_CHUNK_SIZE;
+  trace.chunks.resize(NCHUNKS);
+  std::vector<int> chunk_que(NCHUNKS);
+  for (int i = 0; i < NCHUNKS; i++) {
+    chunk_que[i] = i;
+  }
+  MtRunParallelLoop(&trace, trace_photon_chunk_task,
+      MtGetMaxAvailableThreadCount(), chunk_que);
+
+  std::size_t stored = 0;
+  for (int i = 0; i < NCHUNKS; i++) {
+    stored += trace.chunks[i].size();
+  }
+  photons_.reserve(stored);
+  for (int i = 0; i < NCHUNKS; i++) {
+    photons_.insert(photons_.end(), trace.chunks[i].begin(), trace.chunks[i].end());
+    std::vector<Photon>().swap(trace.chunks[i]);
+  }
+
+  Build();
+  return 0;
+}
+
+void PhotonMap::Store(const Vector &P, const Vector &dir, const Color &power)
+{
+  if (static_cast<Index>(photons_.size()) >= max_photon_count_) {
+    return;
+  }
+
+  Photon photon;
+  for (int i = 0; i < 3; i++) {
+    photon.P[i] = P[i];
+    photon.dir[i] = dir[i];
+  }
+  photon.power[0] = power.r;
+  photon.power[1] = power.g;
+  photon.power[2] = power.b;
+  photons_.push_back(photon);
+}
+
+void PhotonMap::Build()
+{
+  const std::size_t NPHOTONS = photons_.size();
+  std::vector<uint32_t>().swap(bucket_offsets_);
+  if (NPHOTONS == 0 || cell_size_ <= 0) {
+    return;
+  }
+
+  std::size_t NBUCKETS = 1;
+  while (NBUCKETS < NPHOTONS) {
+    NBUCKETS *= 2;
+  }
+  bucket_offsets_.resize(NBUCKETS + 1, 0);
+
+  PhotonBuild build;
+  build.photons = &photons_;
+  build.inv_cell_size = 1 / cell_size_;
+  build.mask = NBUCKETS - 1;
+  build.buckets.resize(NPHOTONS);
+
+  const int NCHUNKS = (NPHOTONS + BUILD_CHUNK_SIZE - 1) / BUILD_CHUNK_SIZE;
+  std::vector<int> chunk_que(NCHUNKS);
+  for (int i = 0; i < NCHUNKS; i++) {
+    chunk_que[i] = i;
+  }
+  MtRunParallelLoop(&build, compute_bucket_chunk_task,
+      MtGetMaxAvailableThreadCount(), chunk_que);
+
+  // counting sort by bucket keeps the order of photons in each bucket
+  for (std::size_t i = 0; i < NPHOTONS; i++) {
+    bucket_offsets_[build.buckets[i] + 1]++;
+  }
+  for (std::size_t i = 0; i < NBUCKETS; i++) {
+    bucket_offsets_[i + 1] += bucket_offsets_[i];
+  }
+
+  std::vector<uint32_t> next(bucket_offsets_.begin(), bucket_offsets_.end() - 1);
+  std::vector<Photon> sorted(NPHOTONS);
+  for (std::size_t i = 0; i < NPHOTONS; i++) {
+    sorted[next[build.buckets[i]]++] = photons_[i];
+  }
+  photons_.swap(sorted);
+}
+
+bool PhotonMap::Lookup(const Vector &P, const Vector &N, Color *irradiance) const
+{
+  *irradiance = Color();
+  if (bucket_offsets_.empty()) {
+    return false;
+  }
+
+  // the 8 cells around the nearest cell corner cover the radius
+  const Real inv_cell_size = 1 / cell_size_;
+  const int x0 = cell_index(P.x - radius_, inv_cell_size);
+  const int y0 = cell_index(P.y - radius_, inv_cell_size);
+  const int z0 = cell_index(P.z - radius_, inv_cell_size);
+  const Real radius2 = radius_ * radius_;
+  const uint64_t MASK = bucket_offsets_.size() - 2;
+
+  uint64_t visited[8];
+  int nvisited = 0;
+  int found = 0;
+  float sum[3] = {0, 0, 0};
+
+  for (int i = 0; i < 8; i++) {
+    const uint64_t bucket = compute_bucket(x0 + (i & 1), y0 + ((i >> 1) & 1),
+        z0 + ((i >> 2) & 1)) & MASK;
+    // cells sharing a bucket are gathered once
+    if (std::find(visited, visited + nvisited, bucket) != visited + nvisited) {
+      continue;
+    }
+    visited[nvisited++] = bucket;
+
+    const uint32_t end = bucket_offsets_[bucket + 1];
+    for (uint32_t j = bucket_offsets_[bucket]; j < end; j++) {
+      const Photon &photon = photons_[j];
+      const Real dx = photon.P[0] - P.x;
+      const Real dy = photon.P[1] - P.y;
+      const Real dz = photon.P[2] - P.z;
+      if (dx * dx + dy * dy + dz * dz > radius2) {
+        continue;
+      }
+      if (photon.dir[0] * N.x + photon.dir[1] * N.y + photon.dir[2] * N.z >= 0) {
+        continue;
+      }
+      sum[0] += photon.power[0];
+      sum[1] += photon.power[1];
+      sum[2] += photon.power[2];
+      found++;
+    }
+  }
+
+  if (found == 0) {
+    return false;
+  }
+
+  const Real inv_area = 1 / (PI * radius2);
+  irradiance->r = sum[0] * inv_area;
+  irradiance->g = sum[1] * inv_area;
+  irradiance->b = sum[2] * inv_area;
+  return true;
+}
+
+Index PhotonMap::GetPhotonCount() const
+{
+  return photons_.size();
+}
+
+Index PhotonMap::GetMaxPhotonCount() const
+{
+  return max_photon_count_;
+}
+
+Real PhotonMap::GetRadius() const
+{
+  return radius_;
+}
+
+std::size_t PhotonMap::GetMemoryUsage() const
+{
+  return
+      sizeof(Photon) * photons_.capacity() +
+      sizeof(uint32_t) * bucket_offsets_.capacity();
+}
+
+static LoopStatus trace_photon_chunk_task(void *data, const ThreadContext &context)
+{
+  PhotonTrace *trace = reinterpret_cast<PhotonTrace *>(data);
+  const int chunk = context.iteration_id;
+  const int begin = chunk * EMIT_CHUNK_SIZE;
+  const int end = Min(begin + EMIT_CHUNK_SIZE, trace->emit_count);
+
+  // seeded by the chunk so photons don't depend on the thread count
+  XorShift rng(chunk + 1);
+  std::vector<Photon> &photons = trace->chunks[chunk];
+  MemoryArena &arena = MemoryArenaGetThreadLocal();
+  const MemoryArena::Mark mark = arena.GetMark();
+
+  std::size_t e = 0;
+  for (int i = begin; i < end; i++) {
+    while (i >= trace->emitters[e].first + trace->emitters[e].count) {
+      e++;
+    }
+    trace_photon(*trace, trace->emitters[e], rng, photons);
+    // light samples drawn on demand
+    arena.Rewind(mark);
+  }
+
+  return LoopStatus::Continue;
+}
+
+static LoopStatus compute_bucket_chunk_task(void *data, const ThreadContext &context)
+{
+  PhotonBuild *build = reinterpret_cast<PhotonBuild *>(data);
+  const std::vector<Photon> &photons = *build->photons;
+  const std::size_t begin = static_cast<std::size_t>(context.iteration_id) * BUILD_CHUNK_SIZE;
+  const std::size_t end = std::min(begin + BUILD_CHUNK_SIZE, photons.size());
+  const Real inv_cell_size = build->inv_cell_size;
+
+  for (std::size_t i = begin; i < end; i++) {
+    const Photon &photon = photons[i];
+    build->buckets[i] = static_cast<uint32_t>(compute_bucket(
+        cell_index(photon.P[0], inv_cell_size),
+        cell_index(photon.P[1], inv_cell_size),
+        cell_index(photon.P[2], inv_cell_size)) & build->mask);
+  }
+
+  return LoopStatus::Continue;
+}
+
+static void trace_photon(const PhotonTrace &trace, const Emitter &emitter,
+    XorShift &rng, std::vector<Photon> &photons)
+{
+  const Light *light = emitter.light;
+  const int NSAMPLES = light->GetSampleCount();
+
+  SampleSequence sequence;
+  sequence.Start(SAMPLE_SEQUENCE_RANDOM, 0, 0, &rng);
+  const LightSample *samples = light->GetSampleSet(sequence);
+  if (samples == NULL || NSAMPLES < 1) {
+    return;
+  }
+  const int index = Min(static_cast<int>(rng.NextFloat01() * NSAMPLES), NSAMPLES - 1);
+  const LightSample &sample = samples[index];
+
+  const Vector to_center = emitter.center - sample.P;
+  const Real cos_max = cone_cos_max(sample.P, emitter.center, emitter.radius);
+  const Real solid_angle = 2 * PI * (1 - cos_max);
+  const Real u = rng.NextFloat01();
+  const Real v = rng.NextFloat01();
+
+  Ray ray;
+  ray.orig = sample.P;
+  ray.dir = cone_direction(Normalize(to_center), cos_max, u, v);
+  ray.tmin = RAY_OFFSET;
+  ray.tmax = REAL_MAX;
+  // photons bounce off what reflections and refractions see
+  ray.group_mask = GROUP_MASK_REFLECT | GROUP_MASK_REFRACT | trace.target->GetRayMask();
+
+  const Accelerator *acc = trace.target->GetSurfaceAccelerator();
+  Color power;
+  Real path_length = 0;
+
+  for (int bounce = 0; bounce < MAX_BOUNCE_COUNT; bounce++) {
+    Intersection isect;
+    if (!acc->Intersect(ray, 0, &isect)) {
+      return;
+    }
+    path_length += isect.t_hit;
+
+    if (bounce == 0) {
+      // lights have no falloff, so photons spread over the distance squared
+      // are scaled back by it when stored. each sample of the set lights
+      // shading points, so the chosen one stands for all of them
+      const Color Cl = light->Illuminate(sample, isect.P) * sample.weight;
+      power = Cl * (NSAMPLES * solid_angle / emitter.count);
+    }
+
+    SurfaceInput in;
+    in.P = isect.P;
+    in.N = isect.N;
+    in.Ng = isect.N;
+    in.Cd = isect.Cd;
+    in.uv = isect.uv;
+    in.I = ray.dir;
+    in.dPdu = isect.dPdu;
+    in.dPdv = isect.dPdv;
+    in.du = 0;
+    in.dv = 0;
+    in.shaded_object = isect.object;
+
+    const Shader *shader = isect.GetShader();
+    Vector dir;
+    Color weight;
+    if (shader != NULL && shader->ScatterPhoton(in, rng.NextFloat01(), &dir, &weight)) {
+      power = power * weight;
+      if (power.r <= 0 && power.g <= 0 && power.b <= 0) {
+        return;
+      }
+      ray.orig = isect.P;
+      ray.dir = Normalize(dir);
+      continue;
+    }
+
+    // direct light of diffuse surfaces is done by shaders
+    if (bounce > 0) {
+      const float scale = path_length * path_length;
+      Photon photon;
+      for (int i = 0; i < 3; i++) {
+        photon.P[i] = isect.P[i];
+        photon.dir[i] = ray.dir[i];
+      }
+      photon.power[0] = power.r * scale;
+      photon.power[1] = power.g * scale;
+      photon.power[2] = power.b * scale;
+      photons.push_back(photon);
+    }
+    return;
+  }
+}
+
+// cosine of the half angle of the cone from apex to the sphere
+static Real cone_cos_max(const Vector &apex, const Vector &center, Real radius)
+{
+  const Real dist = Length(center - apex);
+  if (dist <= radius) {
+    return -1;
+  }
+  const Real sin_max = radius / dist;
+  return sqrt(Max(0, 1 - sin_max * sin_max));
+}
+
+// uniform in the solid angle of the cone around axis
+static Vector cone_direction(const Vector &axis, Real cos_max, Real u, Real v)
+{
+  const Real cos_theta = 1 - u * (1 - cos_max);
+  const Real sin_theta = sqrt(Max(0, 1 - cos_theta * cos_theta));
+  const Real phi = 2 * PI * v;
+
+  const Vector up = Abs(axis.x) < .9 ? Vector(1, 0, 0) : Vector(0, 1, 0);
+  const Vector b1 = Normalize(Cross(up, axis));
+  const Vector b2 = Cross(axis, b1);
+
+  return
+      sin_theta * cos(phi) * b1 +
+      sin_theta * sin(phi) * b2 +
+      cos_theta * axis;
+}
+
+static int cell_index(Real x, Real inv_cell_size)
+{
+  return static_cast<int>(floor(x * inv_cell_size));
+}
+
+} // namespace xxx
@@ -0,0 +1,74 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_PHOTON_MAP_H
+#define FJ_PHOTON_MAP_H
+
+#include "fj_compatibility.h"
+#include "fj_vector.h"
+#include "fj_color.h"
+#include "fj_types.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fj {
+
+class ObjectGroup;
+class Light;
+
+// A photon landed on a diffuse surface. dir is the direction it traveled
+class Photon {
+public:
+  Photon() : P(), dir(), power() {}
+  ~Photon() {}
+
+  float P[3];
+  float dir[3];
+  float power[3];
+};
+
+// Caustic photons shot from lights through specular shaders and stored
+// where they land on diffuse surfaces. photons are in a hash grid whose
+// cells are twice the gather radius, so a lookup visits 8 cells
+class FJ_API PhotonMap {
+public:
+  PhotonMap();
+  ~PhotonMap();
+
+  // clears the map. photons emitted are capped by the memory budget in
+  // bytes. radius 0 is chosen from the bounds of specular objects.
+  // photon_count <= 0 disables it
+  void Init(int photon_count, std::size_t memory_budget, Real radius);
+  bool IsEnabled() const;
+
+  // shoots photons from lights toward objects of the group whose shaders
+  // scatter photons. photons hitting diffuse surfaces first are not stored
+  // since shaders light them directly. then builds the grid
+  int Trace(const ObjectGroup *target, Light **lights, int nlights);
+
+  // for photons made outside Trace. Build() before lookups
+  void Store(const Vector &P, const Vector &dir, const Color &power);
+  void Build();
+
+  // irradiance estimated from photons within the radius coming to the
+  // front side of N. returns false if no photon is found
+  bool Lookup(const Vector &P, const Vector &N, Color *irradiance) const;
+
+  Index GetPhotonCount() const;
+  Index GetMaxPhotonCount() const;
+  Real GetRadius() const;
+  std::size_t GetMemoryUsage() const;
+
+private:
+  std::vector<Photon> photons_;
+  // photons of bucket i are in [bucket_offsets_[i], bucket_offsets_[i + 1])
+  std::vector<uint32_t> bucket_offsets_;
+  Index max_photon_count_;
+  Real radius_;
+  Real cell_size_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
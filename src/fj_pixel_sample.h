@@ -12,13 +12,27 @@ namespace fj {
 
 class Sample {
 public:
-  Sample() : uv(), data(), time(0.) {}
+  Sample() : uv(), data(), time(0.), weight(1.),
+      sequence_index(0), sequence_seed(0), aov_index(-1), shared(false) {}
   ~Sample() {}
 
 public:
   Vector2 uv;
   Vector4 data;
   Real time;
+  // multiplied to the filter weight. samplers with uneven sample density
+  // lower weights of samples in dense pixels
+  Real weight;
+  // the sample in the sample sequence of its pixel. later progressive
+  // passes continue the sequence. see SampleSequence
+  uint32_t sequence_index;
+  uint32_t sequence_seed;
+  // values of arbitrary output variables kept by the renderer for the
+  // tile. -1 if not traced with them
+  int aov_index;
+  // data is taken from the neighbor tile that traced the same sample
+  // instead of tracing it again
+  bool shared;
 };
 
 inline Vector4 ToData(const Color4 &color)
@@ -16,7 +16,7 @@ static int error_no = PLG_ERR_NONE;
 static int is_valid_pluginfo(const PluginInfo *info);
 static void set_errno(int err_no);
 
-Plugin::Plugin() : dso_(NULL), info_(), instance_list_()
+Plugin::Plugin() : dso_(NULL), info_(), property_table_(), instance_list_()
 {
 }
 
@@ -65,6 +65,7 @@ int Plugin::Open(const std::string &filename)
   // commit
   dso_ = tmpdso;
   info_ = info;
+  property_table_.Init(info_.property_list);
   return 0;
 }
 
@@ -93,6 +94,11 @@ const Property *Plugin::GetPropertyList() const
   return info_.property_list;
 }
 
+const PropertyTable &Plugin::GetPropertyTable() const
+{
+  return property_table_;
+}
+
 const MetaInfo *Plugin::Metainfo() const
 {
   return info_.meta;
@@ -5,6 +5,7 @@
 #define FJ_PLUGIN_H
 
 #include "fj_compatibility.h"
+#include "fj_property.h"
 #include <string>
 #include <vector>
 #include <cstddef>
@@ -14,7 +15,6 @@
 namespace fj {
 
 class PluginInfo;
-class Property;
 class MetaInfo;
 
 typedef int (*PlgInitializeFn)(PluginInfo *info);
@@ -79,6 +79,8 @@ public:
   void DeleteInstance(void *instance) const;
 
   const Property *GetPropertyList() const;
+  // lookup index of the property list built when the plugin is opened
+  const PropertyTable &GetPropertyTable() const;
   const MetaInfo *Metainfo() const;
   const char *GetName() const;
   const char *GetType() const;
@@ -87,6 +89,7 @@ public:
 private:
   void *dso_;
   PluginInfo info_;
+  PropertyTable property_table_;
 
   std::vector<void *> instance_list_;
 };
@@ -3,12 +3,24 @@
 
 #include "fj_point_cloud.h"
 #include "fj_intersection.h"
+#include "fj_level_of_detail.h"
+#include "fj_memory_usage.h"
 #include "fj_numeric.h"
 #include "fj_ray.h"
+#include <algorithm>
+#include <cmath>
 
 namespace fj {
 
-PointCloud::PointCloud()
+static void set_hit(Index prim_id, Real t_hit, Intersection *isect)
+{
+  isect->object = NULL;
+  isect->prim_id = prim_id;
+  isect->t_hit = t_hit;
+}
+
+PointCloud::PointCloud() : has_uniform_radius_(false), uniform_radius_(0),
+    lod_width_(0), lod_fraction_(1), radius_scale_(1), kept_points_()
 {
 }
 
@@ -16,6 +28,49 @@ PointCloud::~PointCloud()
 {
 }
 
+void PointCloud::SetLevelOfDetailWidth(Real pixels)
+{
+  // for the content hash. points kept by Simplify depend on the width
+  if (Max(pixels, 0) != lod_width_) {
+    MarkChanged();
+  }
+  lod_width_ = Max(pixels, 0);
+}
+
+bool PointCloud::Simplify(Real pixel_size)
+{
+  Real radius_sum = 0;
+  for (Index i = 0; i < GetPointCount(); i++) {
+    radius_sum += GetPointRadius(i);
+  }
+  const Real mean_diameter = GetPointCount() > 0 ? 2 * radius_sum / GetPointCount() : 0;
+
+  const Real fraction = LodComputeKeepFraction(mean_diameter, pixel_size, lod_width_, 2);
+  if (fraction == lod_fraction_) {
+    return false;
+  }
+  lod_fraction_ = fraction;
+  radius_scale_ = 1 / std::sqrt(fraction);
+
+  ComputeBounds();
+  return true;
+}
+
+Index PointCloud::GetKeptPointCount() const
+{
+  return get_primitive_count();
+}
+
+Index PointCloud::get_point_id(Index prim_id) const
+{
+  return lod_fraction_ < 1 ? kept_points_[prim_id] : prim_id;
+}
+
+Real PointCloud::get_radius(Index point_id) const
+{
+  return GetPointRadius(point_id) * radius_scale_;
+}
+
 bool PointCloud::ray_intersect(Index prim_id, const Ray &ray,
     Real time, Intersection *isect) const
 {
@@ -27,9 +82,10 @@ bool PointCloud::ray_intersect(Index prim_id, const Ray &ray,
   t = (-d * (o - center) +- sqrt(D)) / |d|^2;
   D = {d * (o - center)}^2 - |d|^2 * (|o - center|^2 - r^2);
 */
-  const Vector P = GetPointPosition(prim_id);
-  const Vector velocity = GetPointVelocity(prim_id);
-  const Real radius = GetPointRadius(prim_id);
+  const Index point_id = get_point_id(prim_id);
+  const Vector P = GetPointPosition(point_id);
+  const Vector velocity = GetPointVelocity(point_id);
+  const Real radius = get_radius(point_id);
 
   const Vector center = P + time * velocity;
   const Vector orig_local = ray.orig - center;
@@ -52,22 +108,103 @@ bool PointCloud::ray_intersect(Index prim_id, const Ray &ray,
   }
   const Real t_hit = (t1 <= 0.) ? t1 : t0;
 
-  isect->P = RayPointAt(ray, t_hit);
-  isect->N = isect->P - center;
-  isect->N = Normalize(isect->N);
+  set_hit(prim_id, t_hit, isect);
 
-  isect->object = NULL;
-  isect->prim_id = prim_id;
-  isect->t_hit = t_hit;
+  return true;
+}
+
+// the same test as ray_intersect for a block of points at a time. points
+// are gathered into arrays of each component so the compiler vectorizes
+// the test across the block
+bool PointCloud::ray_intersect_list(const Index *prim_ids, int count, const Ray &ray,
+    Real time, Intersection *isect) const
+{
+  const CompactVector *P = get_point_position_data();
+  const CompactVector *velocity = get_point_velocity_data();
+  const CompactReal *radius = get_point_radius_data();
+
+  if (P == NULL || (radius == NULL && !has_uniform_radius_)) {
+    Intersection isect_tmp;
+    bool hit = false;
+    isect->t_hit = REAL_MAX;
+    for (int i = 0; i < count; i++) {
+      if (RayIntersect(prim_ids[i], ray, time, &isect_tmp) && isect_tmp.t_hit < isect->t_hit) {
+        *isect = isect_tmp;
+        hit = true;
+      }
+    }
+    return hit;
+  }
+
+  const Real a = Dot(ray.dir, ray.dir);
+  Index hit_id = -1;
+  Real t_min = REAL_MAX;
+
+  for (int i = 0; i < count; i += POINT_BLOCK_SIZE) {
+    const int N = std::min(count - i, POINT_BLOCK_SIZE);
+    Real ox[POINT_BLOCK_SIZE], oy[POINT_BLOCK_SIZE], oz[POINT_BLOCK_SIZE];
+    Real r2[POINT_BLOCK_SIZE];
+    Real t0[POINT_BLOCK_SIZE];
+    bool hit[POINT_BLOCK_SIZE];
+
+    for (int j = 0; j < N; j++) {
+      const Index id = get_point_id(prim_ids[i + j]);
+      Vector center = P[id];
+      if (velocity != NULL) {
+        center += time * Vector(velocity[id]);
+      }
+      const Real r = has_uniform_radius_ ? uniform_radius_ : radius[id] * radius_scale_;
+
+      ox[j] = ray.orig.x - center.x;
+      oy[j] = ray.orig.y - center.y;
+      oz[j] = ray.orig.z - center.z;
+      r2[j] = r * r;
+    }
+
+    for (int j = 0; j < N; j++) {
+      const Real b = ray.dir.x * ox[j] + ray.dir.y * oy[j] + ray.dir.z * oz[j];
+      const Real c = ox[j] * ox[j] + oy[j] * oy[j] + oz[j] * oz[j] - r2[j];
+      const Real discriminant = b * b - a * c;
+      const Real disc_sqrt = sqrt(Max(discriminant, 0.));
+
+      t0[j] = -b - disc_sqrt;
+      hit[j] = discriminant >= 0 && -b + disc_sqrt > 0;
+    }
+
+    for (int j = 0; j < N; j++) {
+      if (hit[j] && RayInRange(ray, t0[j]) && t0[j] < t_min) {
+        hit_id = prim_ids[i + j];
+        t_min = t0[j];
+      }
+    }
+  }
+
+  if (hit_id < 0) {
+    return false;
+  }
+
+  set_hit(hit_id, t_min, isect);
 
   return true;
 }
 
+void PointCloud::compute_hit_attributes(const Ray &ray, Real time, Intersection *isect) const
+{
+  const Index point_id = get_point_id(isect->prim_id);
+  const Vector center =
+      GetPointPosition(point_id) + time * GetPointVelocity(point_id);
+
+  isect->P = RayPointAt(ray, isect->t_hit);
+  isect->N = isect->P - center;
+  isect->N = Normalize(isect->N);
+}
+
 bool PointCloud::box_intersect(Index prim_id, const Box &box) const
 {
-  const Vector velocity = GetPointVelocity(prim_id);
-  const Vector P0 = GetPointPosition(prim_id);
-  const Real radius = GetPointRadius(prim_id);
+  const Index point_id = get_point_id(prim_id);
+  const Vector velocity = GetPointVelocity(point_id);
+  const Vector P0 = GetPointPosition(point_id);
+  const Real radius = get_radius(point_id);
   const int N_STEPS = 16;
   const Vector step = velocity / N_STEPS;
 
@@ -86,9 +223,10 @@ bool PointCloud::box_intersect(Index prim_id, const Box &box) const
 
 void PointCloud::get_primitive_bounds(Index prim_id, Box *bounds) const
 {
-  const Vector P = GetPointPosition(prim_id);
-  const Vector velocity = GetPointVelocity(prim_id);
-  const Real radius = GetPointRadius(prim_id);
+  const Index point_id = get_point_id(prim_id);
+  const Vector P = GetPointPosition(point_id);
+  const Vector velocity = GetPointVelocity(point_id);
+  const Real radius = get_radius(point_id);
 
   *bounds = Box(P, P);
 
@@ -102,19 +240,81 @@ void PointCloud::get_bounds(Box *bounds) const
 
 Index PointCloud::get_primitive_count() const
 {
-  return GetPointCount();
+  return lod_fraction_ < 1 ? static_cast<Index>(kept_points_.size()) : GetPointCount();
+}
+
+std::size_t PointCloud::get_memory_usage() const
+{
+  return get_attribute_memory_usage() + MemoryUsageOf(kept_points_);
+}
+
+uint64_t PointCloud::compute_content_hash() const
+{
+  // the radius scale of simplified points is left out as it follows the
+  // kept points
+  const Index N = GetPointCount();
+  uint64_t hash = PRIM_HASH_BASIS;
+  hash = PrimHashBytes(hash, &lod_width_, sizeof(lod_width_));
+  hash = PrimHashArray(hash, get_point_position_data(),
+      get_point_position_data() != NULL ? N : 0);
+  hash = PrimHashArray(hash, get_point_velocity_data(),
+      get_point_velocity_data() != NULL ? N : 0);
+  hash = PrimHashArray(hash, get_point_radius_data(),
+      get_point_radius_data() != NULL ? N : 0);
+  return hash == 0 ? 1 : hash;
+}
+
+template <typename T>
+static bool same_point_data(const T *a, const T *b, Index point_count)
+{
+  return PrimSameArray(a, a != NULL ? point_count : 0, b, b != NULL ? point_count : 0);
+}
+
+bool PointCloud::has_same_content(const PrimitiveSet &other) const
+{
+  const PointCloud *ptc = dynamic_cast<const PointCloud *>(&other);
+  if (ptc == NULL || GetPointCount() != ptc->GetPointCount()) {
+    return false;
+  }
+  const Index N = GetPointCount();
+  return
+      std::memcmp(&lod_width_, &ptc->lod_width_, sizeof(lod_width_)) == 0 &&
+      same_point_data(get_point_position_data(), ptc->get_point_position_data(), N) &&
+      same_point_data(get_point_velocity_data(), ptc->get_point_velocity_data(), N) &&
+      same_point_data(get_point_radius_data(), ptc->get_point_radius_data(), N);
 }
 
 void PointCloud::compute_bounds()
 {
+  MarkChanged();
+
+  // points kept from the points now
+  std::vector<Index>().swap(kept_points_);
+  for (Index i = 0; lod_fraction_ < 1 && i < GetPointCount(); i++) {
+    if (LodIsKept(i, lod_fraction_)) {
+      kept_points_.push_back(i);
+    }
+  }
+
   Box box;
   box.ReverseInfinite(); 
-  for (int i = 0; i < GetPointCount(); i++) {
+  for (Index i = 0; i < GetPrimitiveCount(); i++) {
     Box ptbox;
     GetPrimitiveBounds(i, &ptbox);
     box.AddBox(ptbox);
   }
   set_bounds(box);
+
+  // points of the same radius don't fetch it in ray_intersect_list
+  const CompactReal *radius = get_point_radius_data();
+  has_uniform_radius_ = true;
+  uniform_radius_ = radius != NULL && GetPointCount() > 0 ? radius[0] * radius_scale_ : 0;
+  for (int i = 0; radius != NULL && i < GetPointCount(); i++) {
+    if (radius[i] != radius[0]) {
+      has_uniform_radius_ = false;
+      break;
+    }
+  }
 }
 
 } // namespace xxx
@@ -14,20 +14,53 @@
 
 namespace fj {
 
+// points are tested against a ray in blocks of this size. bvh leaves of
+// the same size are tested in one block
+const int POINT_BLOCK_SIZE = 8;
+
 class FJ_API PointCloud : public PrimitiveSet, public Geometry {
 public:
   PointCloud();
   virtual ~PointCloud();
 
+  // points smaller than the pixels are pruned at random by Simplify().
+  // 0 keeps all points
+  void SetLevelOfDetailWidth(Real pixels);
+  // keeps points for pixel_size in object space where the cloud is
+  // nearest to the camera. returns true if the kept points have changed
+  bool Simplify(Real pixel_size);
+  Index GetKeptPointCount() const;
+
 private:
+  template <typename T> friend class PrimitiveLeafTest;
+
   virtual bool ray_intersect(Index prim_id, const Ray &ray,
       Real time, Intersection *isect) const;
+  virtual bool ray_intersect_list(const Index *prim_ids, int count, const Ray &ray,
+      Real time, Intersection *isect) const;
+  virtual void compute_hit_attributes(const Ray &ray, Real time, Intersection *isect) const;
   virtual bool box_intersect(Index prim_id, const Box &box) const;
   virtual void get_primitive_bounds(Index prim_id, Box *bounds) const;
   virtual void get_bounds(Box *bounds) const;
   virtual Index get_primitive_count() const;
+  virtual std::size_t get_memory_usage() const;
+  virtual uint64_t compute_content_hash() const;
+  virtual bool has_same_content(const PrimitiveSet &other) const;
 
   virtual void compute_bounds();
+
+  // primitives are kept points while simplified
+  Index get_point_id(Index prim_id) const;
+  Real get_radius(Index point_id) const;
+
+  // radius of all points if they are the same, set at ComputeBounds()
+  bool has_uniform_radius_;
+  Real uniform_radius_;
+
+  Real lod_width_;
+  Real lod_fraction_;
+  Real radius_scale_;
+  std::vector<Index> kept_points_;
 };
 
 } // namespace xxx
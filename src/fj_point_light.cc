@@ -18,7 +18,13 @@ int PointLight::get_sample_count() const
   return 1;
 }
 
-void PointLight::get_samples(LightSample *samples, int max_samples) const
+int PointLight::get_sample_set_count() const
+{
+  return 1;
+}
+
+void PointLight::get_samples(LightSample *samples, int max_samples,
+    const Vector2 *points) const
 {
   if (max_samples == 0)
     return;
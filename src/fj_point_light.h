@@ -15,7 +15,9 @@ public:
 
 private:
   virtual int get_sample_count() const;
-  virtual void get_samples(LightSample *samples, int max_samples) const;
+  virtual int get_sample_set_count() const;
+  virtual void get_samples(LightSample *samples, int max_samples,
+      const Vector2 *points) const;
   virtual Color illuminate(const LightSample &sample, const Vector &Ps) const;
   virtual int preprocess();
 };
@@ -0,0 +1,87 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_primary_hit_cache.h"
+#include <algorithm>
+
+namespace fj {
+
+PrimaryHitCache::PrimaryHitCache() :
+  key_(0),
+  max_bytes_(0),
+  used_bytes_(0),
+  slots_()
+{
+}
+
+PrimaryHitCache::~PrimaryHitCache()
+{
+}
+
+void PrimaryHitCache::Init(uint64_t key, int slot_count, std::size_t max_bytes)
+{
+  max_bytes_ = max_bytes;
+  if (key == key_ && slot_count == GetSlotCount() &&
+      used_bytes_ <= max_bytes_) {
+    return;
+  }
+
+  key_ = key;
+  used_bytes_ = 0;
+  slots_.clear();
+  slots_.shrink_to_fit();
+  slots_.resize(std::max(slot_count, 0));
+}
+
+void PrimaryHitCache::Clear()
+{
+  Init(0, 0, 0);
+}
+
+uint64_t PrimaryHitCache::GetKey() const
+{
+  return key_;
+}
+
+int PrimaryHitCache::GetSlotCount() const
+{
+  return static_cast<int>(slots_.size());
+}
+
+std::size_t PrimaryHitCache::GetMemoryUsage() const
+{
+  return used_bytes_;
+}
+
+const std::vector<PrimaryHit> *PrimaryHitCache::GetHits(int slot) const
+{
+  if (slot < 0 || slot >= GetSlotCount() || slots_[slot].empty()) {
+    return NULL;
+  }
+  return &slots_[slot];
+}
+
+int PrimaryHitCache::SetHits(int slot, std::vector<PrimaryHit> &hits)
+{
+  if (slot < 0 || slot >= GetSlotCount()) {
+    return -1;
+  }
+
+  std::vector<PrimaryHit> &dst = slots_[slot];
+  const std::size_t old_bytes = dst.size() * sizeof(PrimaryHit);
+  const std::size_t new_bytes = hits.size() * sizeof(PrimaryHit);
+
+  // reserves the bytes first so that threads don't go over together
+  const std::size_t used = used_bytes_.fetch_add(new_bytes) + new_bytes;
+  if (used - old_bytes > max_bytes_) {
+    used_bytes_ -= new_bytes;
+    return -1;
+  }
+  used_bytes_ -= old_bytes;
+
+  dst.swap(hits);
+  hits.clear();
+  return 0;
+}
+
+} // namespace xxx
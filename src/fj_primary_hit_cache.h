@@ -0,0 +1,69 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_PRIMARY_HIT_CACHE_H
+#define FJ_PRIMARY_HIT_CACHE_H
+
+#include "fj_compatibility.h"
+#include "fj_numeric.h"
+#include "fj_vector.h"
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+
+namespace fj {
+
+class ObjectInstance;
+
+// What the hit test of a camera ray found. the attributes of the hit are
+// computed again from it. no object for rays that hit nothing and prim_id
+// -1 for samples not traced
+class PrimaryHit {
+public:
+  PrimaryHit() :
+      object(NULL), t_hit(REAL_MAX), prim_uv(), prim_id(-1), shading_group_id(0) {}
+  ~PrimaryHit() {}
+
+  bool IsTraced() const { return prim_id >= 0; }
+
+  const ObjectInstance *object;
+  Real t_hit;
+  Vector2 prim_uv;
+  int prim_id;
+  int shading_group_id;
+};
+
+// Hits of camera rays of the last render in slots of tiles of passes, so
+// that renders after edits of shaders shade them again without tracing.
+// hits of a slot are in the order of the samples of its tile.
+class FJ_API PrimaryHitCache {
+public:
+  PrimaryHitCache();
+  ~PrimaryHitCache();
+
+  // hits are kept if the key and the slot count are the same as the last
+  // time, otherwise all slots are empty. hits are capped by the bytes
+  void Init(uint64_t key, int slot_count, std::size_t max_bytes);
+  // no hits are kept. the next render needs Init
+  void Clear();
+  uint64_t GetKey() const;
+  int GetSlotCount() const;
+  std::size_t GetMemoryUsage() const;
+
+  // NULL if the slot has no hits
+  const std::vector<PrimaryHit> *GetHits(int slot) const;
+  // threads may set different slots at once. hits are moved into the slot.
+  // returns -1 if they are over the memory and the slot stays empty
+  int SetHits(int slot, std::vector<PrimaryHit> &hits);
+
+private:
+  uint64_t key_;
+  std::size_t max_bytes_;
+  std::atomic<std::size_t> used_bytes_;
+  std::vector<std::vector<PrimaryHit>> slots_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,169 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_PRIMITIVE_LEAF_TEST_H
+#define FJ_PRIMITIVE_LEAF_TEST_H
+
+#include "fj_primitive_set.h"
+#include "fj_intersection.h"
+#include "fj_point_cloud.h"
+#include "fj_object_set.h"
+#include "fj_curve.h"
+#include "fj_mesh.h"
+#include "fj_ray.h"
+
+namespace fj {
+
+// Tests of primitives in leaves of accelerators. Traversals instantiated
+// for a concrete primitive set call its overrides directly instead of
+// through the vtable for each primitive. The generic one goes through the
+// interface of PrimitiveSet for sets of plugins. Results are the same as
+// RayIntersectList and RayOcclude.
+template <typename T>
+class PrimitiveLeafTest {
+public:
+  static bool IntersectList(const T &primset, const Index *prim_ids, int count,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return primset.RayIntersectList(prim_ids, count, ray, time, isect);
+  }
+  static bool Occlude(const T &primset, Index prim_id,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return primset.RayOcclude(prim_id, ray, time, isect);
+  }
+};
+
+// the closest hit in range of primitives one by one
+// with PrimitiveLeafTest<T>::Intersect
+template <typename T>
+inline bool closest_leaf_hit(const T &primset,
+    const Index *prim_ids, int count, const Ray &ray, Real time, Intersection *isect)
+{
+  Intersection isect_tmp;
+  bool hit = false;
+
+  isect->t_hit = REAL_MAX;
+
+  for (int i = 0; i < count; i++) {
+    const bool hittmp =
+        PrimitiveLeafTest<T>::Intersect(primset, prim_ids[i], ray, time, &isect_tmp) &&
+        RayInRange(ray, isect_tmp.t_hit);
+    if (hittmp && isect_tmp.t_hit < isect->t_hit) {
+      *isect = isect_tmp;
+      hit = true;
+    }
+  }
+
+  return hit;
+}
+
+inline bool hit_in_range(bool hit, const Ray &ray, Intersection *isect)
+{
+  if (!hit || !RayInRange(ray, isect->t_hit)) {
+    isect->t_hit = REAL_MAX;
+    return false;
+  }
+  return true;
+}
+
+template <>
+class PrimitiveLeafTest<Mesh> {
+public:
+  static bool IntersectList(const Mesh &mesh, const Index *prim_ids, int count,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    const bool hit = mesh.Mesh::ray_intersect_list(prim_ids, count, ray, time, isect);
+    if (!hit) {
+      isect->t_hit = REAL_MAX;
+    }
+    return hit;
+  }
+  static bool Occlude(const Mesh &mesh, Index prim_id,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return hit_in_range(mesh.Mesh::ray_occlude(prim_id, ray, time, isect), ray, isect);
+  }
+  // faces of a leaf whose vertices are copied to the cluster. the same
+  // results as IntersectList and Occlude of the faces
+  static bool IntersectCluster(const Mesh &mesh, const Index *prim_ids,
+      const uint8_t *local_indices, const Vector *points, int count,
+      const Ray &ray, Intersection *isect)
+  {
+    const bool hit = mesh.ray_intersect_cluster(prim_ids, local_indices, points, count,
+        ray, isect);
+    if (!hit) {
+      isect->t_hit = REAL_MAX;
+    }
+    return hit;
+  }
+  static bool OccludeCluster(const Mesh &mesh, const Index *prim_ids,
+      const uint8_t *local_indices, const Vector *points, int count,
+      const Ray &ray, Intersection *isect)
+  {
+    return mesh.ray_occlude_cluster(prim_ids, local_indices, points, count, ray, isect);
+  }
+};
+
+template <>
+class PrimitiveLeafTest<PointCloud> {
+public:
+  static bool IntersectList(const PointCloud &ptc, const Index *prim_ids, int count,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    const bool hit = ptc.PointCloud::ray_intersect_list(prim_ids, count, ray, time, isect);
+    if (!hit) {
+      isect->t_hit = REAL_MAX;
+    }
+    return hit;
+  }
+  static bool Occlude(const PointCloud &ptc, Index prim_id,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return hit_in_range(ptc.PointCloud::ray_intersect(prim_id, ray, time, isect), ray, isect);
+  }
+};
+
+template <>
+class PrimitiveLeafTest<Curve> {
+public:
+  static bool IntersectList(const Curve &curve, const Index *prim_ids, int count,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return closest_leaf_hit(curve, prim_ids, count, ray, time, isect);
+  }
+  static bool Intersect(const Curve &curve, Index prim_id,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return curve.Curve::ray_intersect(prim_id, ray, time, isect);
+  }
+  static bool Occlude(const Curve &curve, Index prim_id,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return hit_in_range(curve.Curve::ray_intersect(prim_id, ray, time, isect), ray, isect);
+  }
+};
+
+template <>
+class PrimitiveLeafTest<ObjectSet> {
+public:
+  static bool IntersectList(const ObjectSet &objset, const Index *prim_ids, int count,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return closest_leaf_hit(objset, prim_ids, count, ray, time, isect);
+  }
+  static bool Intersect(const ObjectSet &objset, Index prim_id,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return objset.ObjectSet::ray_intersect(prim_id, ray, time, isect);
+  }
+  static bool Occlude(const ObjectSet &objset, Index prim_id,
+      const Ray &ray, Real time, Intersection *isect)
+  {
+    return hit_in_range(objset.ObjectSet::ray_occlude(prim_id, ray, time, isect), ray, isect);
+  }
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -3,10 +3,36 @@
 
 #include "fj_primitive_set.h"
 #include "fj_intersection.h"
+#include "fj_box.h"
 #include "fj_ray.h"
 
 namespace fj {
 
+uint64_t PrimHashBytes(uint64_t hash, const void *data, std::size_t size)
+{
+  const uint64_t HASH_PRIME = 1099511628211ULL;
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for (std::size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= HASH_PRIME;
+  }
+  return hash;
+}
+
+uint64_t PrimitiveSet::GetContentHash() const
+{
+  if (hashed_change_count_ != change_count_) {
+    content_hash_ = compute_content_hash();
+    hashed_change_count_ = change_count_;
+  }
+  return content_hash_;
+}
+
+bool PrimitiveSet::HasSameContent(const PrimitiveSet &other) const
+{
+  return has_same_content(other);
+}
+
 bool PrimitiveSet::RayIntersect(Index prim_id, const Ray &ray,
     Real time, Intersection *isect) const
 {
@@ -25,6 +51,56 @@ bool PrimitiveSet::RayIntersect(Index prim_id, const Ray &ray,
   return true;
 }
 
+void PrimitiveSet::ComputeHitAttributes(const Ray &ray, Real time,
+    Intersection *isect) const
+{
+  compute_hit_attributes(ray, time, isect);
+}
+
+bool PrimitiveSet::RayIntersectAll(Index prim_id, const Ray &ray,
+    Real time, HitList *hits) const
+{
+  return ray_intersect_all(prim_id, ray, time, hits);
+}
+
+bool PrimitiveSet::RayOcclude(Index prim_id, const Ray &ray,
+    Real time, Intersection *isect) const
+{
+  const bool hit = ray_occlude(prim_id, ray, time, isect);
+
+  if (!hit) {
+    isect->t_hit = REAL_MAX;
+    return false;
+  }
+
+  if (!RayInRange(ray, isect->t_hit)) {
+    isect->t_hit = REAL_MAX;
+    return false;
+  }
+
+  return true;
+}
+
+bool PrimitiveSet::RayIntersectList(const Index *prim_ids, int count,
+    const Ray &ray, Real time, Intersection *isect) const
+{
+  const bool hit = ray_intersect_list(prim_ids, count, ray, time, isect);
+
+  if (!hit) {
+    isect->t_hit = REAL_MAX;
+    return false;
+  }
+
+  return true;
+}
+
+unsigned int PrimitiveSet::RayIntersectPacket(const Index *prim_ids, int count,
+    const Ray *rays, const Real *times, unsigned int ray_mask,
+    Intersection *isects) const
+{
+  return ray_intersect_packet(prim_ids, count, rays, times, ray_mask, isects);
+}
+
 bool PrimitiveSet::BoxIntersect(Index prim_id, const Box &box) const
 {
   return box_intersect(prim_id, box);
@@ -35,6 +111,23 @@ void PrimitiveSet::GetPrimitiveBounds(Index prim_id, Box *bounds) const
   get_primitive_bounds(prim_id, bounds);
 }
 
+void PrimitiveSet::GetClippedPrimitiveBounds(Index prim_id, const Box &clip,
+    Box *bounds) const
+{
+  get_clipped_primitive_bounds(prim_id, clip, bounds);
+}
+
+bool PrimitiveSet::HasMotion() const
+{
+  return has_motion();
+}
+
+void PrimitiveSet::GetPrimitiveMotionBounds(Index prim_id,
+    Box *bounds_open, Box *bounds_close) const
+{
+  get_primitive_motion_bounds(prim_id, bounds_open, bounds_close);
+}
+
 void PrimitiveSet::GetEntireBounds(Box *bounds) const
 {
   get_bounds(bounds);
@@ -45,4 +138,77 @@ Index PrimitiveSet::GetPrimitiveCount() const
   return get_primitive_count();
 }
 
+std::size_t PrimitiveSet::GetMemoryUsage() const
+{
+  return get_memory_usage();
+}
+
+void PrimitiveSet::get_clipped_primitive_bounds(Index prim_id, const Box &clip,
+    Box *bounds) const
+{
+  GetPrimitiveBounds(prim_id, bounds);
+  bounds->Clip(clip);
+}
+
+bool PrimitiveSet::ray_intersect_list(const Index *prim_ids, int count,
+    const Ray &ray, Real time, Intersection *isect) const
+{
+  Intersection isect_tmp;
+  bool hit = false;
+
+  isect->t_hit = REAL_MAX;
+
+  for (int i = 0; i < count; i++) {
+    const bool hittmp = RayIntersect(prim_ids[i], ray, time, &isect_tmp);
+    if (hittmp && isect_tmp.t_hit < isect->t_hit) {
+      *isect = isect_tmp;
+      hit = true;
+    }
+  }
+
+  return hit;
+}
+
+bool PrimitiveSet::ray_intersect_all(Index prim_id, const Ray &ray,
+    Real time, HitList *hits) const
+{
+  Intersection isect;
+
+  if (!RayIntersect(prim_id, ray, time, &isect) || isect.t_hit >= hits->GetMaxDistance()) {
+    return false;
+  }
+
+  ComputeHitAttributes(ray, time, &isect);
+  hits->Add(isect);
+  return true;
+}
+
+unsigned int PrimitiveSet::ray_intersect_packet(const Index *prim_ids, int count,
+    const Ray *rays, const Real *times, unsigned int ray_mask,
+    Intersection *isects) const
+{
+  unsigned int hit_mask = 0;
+
+  for (int i = 0; ray_mask >> i != 0; i++) {
+    if (!(ray_mask & (1U << i))) {
+      continue;
+    }
+    Intersection isect_tmp;
+    const bool hit = RayIntersectList(prim_ids, count, rays[i], times[i], &isect_tmp);
+    if (hit && isect_tmp.t_hit < rays[i].tmax) {
+      isects[i] = isect_tmp;
+      hit_mask |= 1U << i;
+    }
+  }
+
+  return hit_mask;
+}
+
+void PrimitiveSet::get_primitive_motion_bounds(Index prim_id,
+    Box *bounds_open, Box *bounds_close) const
+{
+  get_primitive_bounds(prim_id, bounds_open);
+  *bounds_close = *bounds_open;
+}
+
 } // namespace xxx
@@ -6,38 +6,150 @@
 
 #include "fj_compatibility.h"
 #include "fj_types.h"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
 
 namespace fj {
 
+// 64-bit FNV-1a of size bytes continuing from hash. start from PRIM_HASH_BASIS
+const uint64_t PRIM_HASH_BASIS = 14695981039346656037ULL;
+FJ_API uint64_t PrimHashBytes(uint64_t hash, const void *data, std::size_t size);
+
+// hashes the count then the elements so arrays of different lengths differ
+template <typename T>
+inline uint64_t PrimHashArray(uint64_t hash, const T *data, std::size_t count)
+{
+  hash = PrimHashBytes(hash, &count, sizeof(count));
+  return count > 0 ? PrimHashBytes(hash, data, sizeof(T) * count) : hash;
+}
+
+// true if arrays have the same count and bytes, the same as PrimHashArray sees
+template <typename T>
+inline bool PrimSameArray(const T *a, std::size_t a_count, const T *b, std::size_t b_count)
+{
+  return a_count == b_count &&
+      (a_count == 0 || a == b || std::memcmp(a, b, sizeof(T) * a_count) == 0);
+}
+
 class Intersection;
+class HitList;
 class Box;
 class Ray;
 
 // PrimitiveSet abstract a set of primitives that is used by Accelerator
 class FJ_API PrimitiveSet {
 public:
-  PrimitiveSet() {}
+  PrimitiveSet() : change_count_(0), content_hash_(0), hashed_change_count_(-1) {}
   virtual ~PrimitiveSet() {}
 
+  // geometry counts a change each time its bounds are computed, which is
+  // done after editing it. accelerators are rebuilt when it has changed
+  void MarkChanged() { change_count_++; }
+  int64_t GetChangeCount() const { return change_count_; }
+  // hash of primitives and attributes rays and shaders see. sets of the
+  // same type and hash render the same. 0 if the set can't be compared.
+  // computed again only after the set has changed
+  uint64_t GetContentHash() const;
+  // true if other is of the same type and has the same bytes the hash is
+  // computed from. confirms sets of the same hash aren't a collision
+  bool HasSameContent(const PrimitiveSet &other) const;
+
+  // only fills what the hit test finds, object, prim_id, shading_group_id,
+  // t_hit and prim_uv of isect. the rest is filled by ComputeHitAttributes
+  // so that hits discarded by closer ones don't interpolate attributes
   bool RayIntersect(Index prim_id, const Ray &ray, Real time, Intersection *isect) const;
+  // fills P, N, uv, dPdu, dPdv and Cd of the hit found by the ray at time
+  void ComputeHitAttributes(const Ray &ray, Real time, Intersection *isect) const;
+  // adds hits of the primitive with attributes to hits. returns true if
+  // any is added
+  bool RayIntersectAll(Index prim_id, const Ray &ray, Real time, HitList *hits) const;
+  // only fills object, prim_id, shading_group_id and t_hit of isect.
+  // used for shadow rays that don't need the attributes of hit point
+  bool RayOcclude(Index prim_id, const Ray &ray, Real time, Intersection *isect) const;
+  // closest hit of count primitives in prim_ids. accelerators pass all
+  // primitives in a leaf at once so that they can be tested together
+  bool RayIntersectList(const Index *prim_ids, int count, const Ray &ray,
+      Real time, Intersection *isect) const;
+  // RayIntersectList for rays of ray_mask in a packet. isects[i] is
+  // replaced by a hit closer than rays[i].tmax. returns the mask of
+  // rays whose isects were replaced
+  unsigned int RayIntersectPacket(const Index *prim_ids, int count,
+      const Ray *rays, const Real *times, unsigned int ray_mask,
+      Intersection *isects) const;
   bool BoxIntersect(Index prim_id, const Box &box) const;
 
   void GetPrimitiveBounds(Index prim_id, Box *bounds) const;
+  // bounds of the part of the primitive inside clip. empty if the part is
+  // found to be empty. used for spatial splits of bvh
+  void GetClippedPrimitiveBounds(Index prim_id, const Box &clip, Box *bounds) const;
+  // true if primitives move linearly from shutter open to close.
+  // GetPrimitiveBounds encloses the whole motion in that case
+  bool HasMotion() const;
+  // bounds at time 0 and 1. linear interpolation of them encloses
+  // the primitive at any time in between
+  void GetPrimitiveMotionBounds(Index prim_id, Box *bounds_open, Box *bounds_close) const;
   void GetEntireBounds(Box *bounds) const;
   Index GetPrimitiveCount() const;
+  // bytes of attributes and precomputed data. memory of mapped files
+  // is not counted
+  std::size_t GetMemoryUsage() const;
 
 private:
   virtual bool ray_intersect(Index prim_id, const Ray &ray,
       Real time, Intersection *isect) const = 0;
+  virtual bool ray_occlude(Index prim_id, const Ray &ray,
+      Real time, Intersection *isect) const
+  {
+    return ray_intersect(prim_id, ray, time, isect);
+  }
+  virtual bool ray_intersect_list(const Index *prim_ids, int count, const Ray &ray,
+      Real time, Intersection *isect) const;
+  // does nothing for primitive sets whose ray_intersect fills everything
+  virtual void compute_hit_attributes(const Ray &ray, Real time, Intersection *isect) const
+  {
+  }
+  // adds the hit of RayIntersect unless overridden
+  virtual bool ray_intersect_all(Index prim_id, const Ray &ray,
+      Real time, HitList *hits) const;
+  virtual unsigned int ray_intersect_packet(const Index *prim_ids, int count,
+      const Ray *rays, const Real *times, unsigned int ray_mask,
+      Intersection *isects) const;
   // TODO make this pure virtual
   virtual bool box_intersect(Index prim_id, const Box &box) const
   {
     return true;
   }
   virtual void get_primitive_bounds(Index prim_id, Box *bounds) const = 0;
+  // primitive bounds clipped by the box unless overridden
+  virtual void get_clipped_primitive_bounds(Index prim_id, const Box &clip,
+      Box *bounds) const;
+  virtual bool has_motion() const
+  {
+    return false;
+  }
+  virtual void get_primitive_motion_bounds(Index prim_id,
+      Box *bounds_open, Box *bounds_close) const;
   // TODO rename this
   virtual void get_bounds(Box *bounds) const = 0;
   virtual Index get_primitive_count() const = 0;
+  virtual std::size_t get_memory_usage() const
+  {
+    return 0;
+  }
+  virtual uint64_t compute_content_hash() const
+  {
+    return 0;
+  }
+  // compares what compute_content_hash hashes. never the same unless overridden
+  virtual bool has_same_content(const PrimitiveSet &other) const
+  {
+    return false;
+  }
+
+  int64_t change_count_;
+  mutable uint64_t content_hash_;
+  mutable int64_t hashed_change_count_;
 };
 
 } // namespace xxx
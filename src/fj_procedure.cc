@@ -2,12 +2,21 @@
 // See LICENSE and README
 
 #include "fj_procedure.h"
+#include "fj_multi_thread.h"
 #include "fj_timer.h"
+#include <algorithm>
 #include <cstdio>
 
 namespace fj {
 
-Procedure::Procedure()
+// chunks per thread so idle threads can steal from slow ones
+static const int CHUNKS_PER_THREAD = 8;
+
+Procedure::Procedure() :
+    type_name_(),
+    cache_dir_(),
+    properties_(),
+    property_strings_()
 {
 }
 
@@ -23,7 +32,7 @@ int Procedure::Run() const
   Timer timer;
   timer.Start();
 
-  const int err = run();
+  const int err = cache_dir_.empty() ? run() : run_cached();
 
   const Elapse elapse = timer.GetElapse();
 
@@ -36,4 +45,98 @@ int Procedure::Run() const
   }
 }
 
+void Procedure::SetCacheDirectory(const std::string &dir)
+{
+  cache_dir_ = dir;
+}
+
+const std::string &Procedure::GetCacheDirectory() const
+{
+  return cache_dir_;
+}
+
+void Procedure::SetTypeName(const std::string &type_name)
+{
+  type_name_ = type_name;
+}
+
+void Procedure::RecordProperty(const std::string &name, const PropertyValue &value)
+{
+  PropertyValue &recorded = properties_[name];
+  recorded = value;
+  if (value.type == PROP_STRING) {
+    std::string &string = property_strings_[name];
+    string = value.string != NULL ? value.string : "";
+    recorded.string = string.c_str();
+  }
+}
+
+int Procedure::run_cached() const
+{
+  const uint64_t key = ProcCacheComputeKey(type_name_, properties_);
+  if (key == 0) {
+    for (ProcedurePropertyMap::const_iterator it = properties_.begin();
+        it != properties_.end(); ++it) {
+      if (ProcCacheHashValue(it->second) == 0) {
+        printf("Procedure not cached: %s can't be hashed\n", it->first.c_str());
+        break;
+      }
+    }
+    return run();
+  }
+
+  if (ProcCacheRead(cache_dir_, key, properties_) == 0) {
+    printf("Loaded from cache: %s\n", ProcCacheGetFilename(cache_dir_, key).c_str());
+    return 0;
+  }
+
+  // results are the nodes changed by run(). their hashes before running
+  // are in the key
+  std::map<std::string, uint64_t> input_hashes;
+  for (ProcedurePropertyMap::const_iterator it = properties_.begin();
+      it != properties_.end(); ++it) {
+    if (it->second.type == PROP_MESH || ProcCacheIsCachedType(it->second.type)) {
+      input_hashes[it->first] = ProcCacheHashValue(it->second);
+    }
+  }
+
+  const int err = run();
+  if (err) {
+    return err;
+  }
+
+  std::vector<std::string> results;
+  for (std::map<std::string, uint64_t>::const_iterator it = input_hashes.begin();
+      it != input_hashes.end(); ++it) {
+    const PropertyValue &value = properties_.find(it->first)->second;
+    if (ProcCacheHashValue(value) == it->second) {
+      continue;
+    }
+    if (!ProcCacheIsCachedType(value.type)) {
+      printf("Procedure not cached: %s is not a curve, point cloud or volume\n",
+          it->first.c_str());
+      return 0;
+    }
+    results.push_back(it->first);
+  }
+
+  if (ProcCacheWrite(cache_dir_, key, properties_, results)) {
+    fprintf(stderr, "* WARNING: could not write procedure cache: %s\n",
+        ProcCacheGetFilename(cache_dir_, key).c_str());
+  }
+  return 0;
+}
+
+void Procedure::ParallelFor(void *data, RangeFunction range_fn, int count)
+{
+  if (count <= 0) {
+    return;
+  }
+
+  const int max_chunks = MtGetMaxAvailableThreadCount() * CHUNKS_PER_THREAD;
+  const int chunk_size = (count + max_chunks - 1) / max_chunks;
+
+  MtParallelFor(data, range_fn, count, chunk_size);
+}
+
 } // namespace xxx
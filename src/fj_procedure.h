@@ -5,7 +5,9 @@
 #define FJ_PROCEDURE_H
 
 #include "fj_compatibility.h"
+#include "fj_procedure_cache.h"
 #include "fj_volume_filling.h"
+#include "fj_multi_thread.h"
 #include "fj_turbulence.h"
 #include "fj_point_cloud.h"
 #include "fj_progress.h"
@@ -33,10 +35,38 @@ public:
   Procedure();
   virtual ~Procedure();
 
+  // loads the results from the cache directory if they were cached for
+  // the same properties. runs and caches them otherwise
   int Run() const;
 
+  // curves, point clouds and volumes the procedure changes are cached.
+  // empty disables the cache
+  void SetCacheDirectory(const std::string &dir);
+  const std::string &GetCacheDirectory() const;
+  // the plugin name and the properties set are the key of the cache.
+  // called by the scene
+  void SetTypeName(const std::string &type_name);
+  void RecordProperty(const std::string &name, const PropertyValue &value);
+
+  // calls range_fn on chunks of [0, count) on the threads of the pool and
+  // returns when all are done. range_fn can set attributes of geometry at
+  // distinct indices once their counts are set and attributes are added
+  using RangeFunction = fj::RangeFunction;
+  static void ParallelFor(void *data, RangeFunction range_fn, int count);
+
 private:
+  Procedure(const Procedure &);
+  const Procedure &operator=(const Procedure &);
+
   virtual int run() const = 0;
+
+  int run_cached() const;
+
+  std::string type_name_;
+  std::string cache_dir_;
+  ProcedurePropertyMap properties_;
+  // strings of properties_ point to them
+  std::map<std::string, std::string> property_strings_;
 };
 
 } // namespace xxx
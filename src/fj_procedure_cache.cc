@@ -0,0 +1,294 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_procedure_cache.h"
+#include "fj_primitive_set.h"
+#include "fj_geometry_io.h"
+#include "fj_point_cloud.h"
+#include "fj_turbulence.h"
+#include "fj_serialize.h"
+#include "fj_volume.h"
+#include "fj_curve.h"
+#include "fj_mesh.h"
+#include "fj_os.h"
+#include <cstring>
+#include <cstdio>
+
+namespace fj {
+
+const char PROC_SIGNATURE[] = "fjproc";
+const int PROC_FILE_VERSION = 1;
+const std::size_t PROC_SIGNATURE_SIZE = 8;
+
+static uint64_t hash_volume(const Volume &volume)
+{
+  int xres = 0, yres = 0, zres = 0;
+  volume.GetResolution(&xres, &yres, &zres);
+  const Box &bounds = volume.GetBounds();
+
+  uint64_t hash = PRIM_HASH_BASIS;
+  hash = PrimHashBytes(hash, &xres, sizeof(xres));
+  hash = PrimHashBytes(hash, &yres, sizeof(yres));
+  hash = PrimHashBytes(hash, &zres, sizeof(zres));
+  hash = PrimHashBytes(hash, &bounds, sizeof(bounds));
+
+  std::vector<float> row(xres);
+  for (int z = 0; z < zres; z++) {
+    for (int y = 0; y < yres; y++) {
+      for (int x = 0; x < xres; x++) {
+        row[x] = volume.GetValue(x, y, z);
+      }
+      hash = PrimHashArray(hash, row.empty() ? NULL : &row[0], row.size());
+    }
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+static const char *data_suffix(int property_type)
+{
+  switch (property_type) {
+  case PROP_POINTCLOUD:
+    return "geo";
+  case PROP_CURVE:
+    return "crv";
+  case PROP_VOLUME:
+    return "vol";
+  default:
+    return NULL;
+  }
+}
+
+static std::string data_filename(const std::string &dir, uint64_t key, int index,
+    int property_type)
+{
+  char name[64] = {'\0'};
+  sprintf(name, "%016llx.%d.%s", static_cast<unsigned long long>(key), index,
+      data_suffix(property_type));
+  return dir + "/" + name;
+}
+
+static std::string temporary_filename(const std::string &filename)
+{
+  return filename + "." + std::to_string(OsGetProcessId()) + ".tmp";
+}
+
+// writes to a temporary file then renames it so that other processes
+// never read a partial file
+static int write_data(const std::string &filename, const PropertyValue &value)
+{
+  const std::string tmpname = temporary_filename(filename);
+  int err = -1;
+
+  switch (value.type) {
+  case PROP_POINTCLOUD:
+    {
+      GeoOutputFile file(tmpname);
+      err = file.Write(*value.pointcloud);
+    }
+    break;
+  case PROP_CURVE:
+    {
+      CurveOutputFile file(tmpname);
+      err = file.Write(*value.curve);
+    }
+    break;
+  case PROP_VOLUME:
+    {
+      VolumeOutputFile file(tmpname);
+      err = file.Write(*value.volume);
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (err || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+    std::remove(tmpname.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+static int read_data(const std::string &filename, const PropertyValue &value)
+{
+  switch (value.type) {
+  case PROP_POINTCLOUD:
+    {
+      GeoInputFile file(filename);
+      return file.Read(*value.pointcloud);
+    }
+  case PROP_CURVE:
+    {
+      CurveInputFile file(filename);
+      return file.Read(*value.curve);
+    }
+  case PROP_VOLUME:
+    {
+      VolumeInputFile file(filename);
+      return file.Read(*value.volume);
+    }
+  default:
+    return -1;
+  }
+}
+
+uint64_t ProcCacheHashValue(const PropertyValue &value)
+{
+  uint64_t hash = PRIM_HASH_BASIS;
+
+  switch (value.type) {
+  case PROP_SCALAR:
+  case PROP_VECTOR2:
+  case PROP_VECTOR3:
+  case PROP_VECTOR4:
+    hash = PrimHashBytes(hash, &value.vector, sizeof(value.vector));
+    hash = PrimHashBytes(hash, &value.time, sizeof(value.time));
+    break;
+  case PROP_STRING:
+    if (value.string != NULL) {
+      hash = PrimHashBytes(hash, value.string, strlen(value.string));
+    }
+    break;
+  case PROP_POINTCLOUD:
+    return value.pointcloud != NULL ? value.pointcloud->GetContentHash() : 0;
+  case PROP_CURVE:
+    return value.curve != NULL ? value.curve->GetContentHash() : 0;
+  case PROP_MESH:
+    return value.mesh != NULL ? value.mesh->GetContentHash() : 0;
+  case PROP_VOLUME:
+    return value.volume != NULL ? hash_volume(*value.volume) : 0;
+  case PROP_TURBULENCE:
+    return value.turbulence != NULL ? value.turbulence->GetContentHash() : 0;
+  default:
+    return 0;
+  }
+
+  return hash == 0 ? 1 : hash;
+}
+
+uint64_t ProcCacheComputeKey(const std::string &type_name,
+    const ProcedurePropertyMap &properties)
+{
+  uint64_t key = PRIM_HASH_BASIS;
+  key = PrimHashBytes(key, type_name.c_str(), type_name.size() + 1);
+
+  for (ProcedurePropertyMap::const_iterator it = properties.begin();
+      it != properties.end(); ++it) {
+    const uint64_t value_hash = ProcCacheHashValue(it->second);
+    if (value_hash == 0) {
+      return 0;
+    }
+    key = PrimHashBytes(key, it->first.c_str(), it->first.size() + 1);
+    key = PrimHashBytes(key, &it->second.type, sizeof(it->second.type));
+    key = PrimHashBytes(key, &value_hash, sizeof(value_hash));
+  }
+
+  return key == 0 ? 1 : key;
+}
+
+bool ProcCacheIsCachedType(int property_type)
+{
+  return data_suffix(property_type) != NULL;
+}
+
+std::string ProcCacheGetFilename(const std::string &dir, uint64_t key)
+{
+  char name[32] = {'\0'};
+  sprintf(name, "%016llx.proc", static_cast<unsigned long long>(key));
+  return dir + "/" + name;
+}
+
+int ProcCacheRead(const std::string &dir, uint64_t key,
+    const ProcedurePropertyMap &properties)
+{
+  std::ifstream file(ProcCacheGetFilename(dir, key).c_str(),
+      std::fstream::in | std::fstream::binary);
+  if (!file) {
+    return -1;
+  }
+
+  char sign[PROC_SIGNATURE_SIZE] = {'\0'};
+  file.read(sign, PROC_SIGNATURE_SIZE);
+  int version = 0;
+  int count = 0;
+  read_(file, version);
+  read_(file, count);
+  if (!file || strcmp(sign, PROC_SIGNATURE) != 0 ||
+      version != PROC_FILE_VERSION || count < 0) {
+    return -1;
+  }
+
+  // every result is checked before any node is changed
+  std::vector<PropertyValue> values;
+  std::vector<std::string> filenames;
+  for (int i = 0; i < count; i++) {
+    std::string name;
+    int type = PROP_NONE;
+    read_(file, name);
+    read_(file, type);
+
+    ProcedurePropertyMap::const_iterator it = properties.find(name);
+    if (!file || it == properties.end() || it->second.type != type ||
+        !ProcCacheIsCachedType(type)) {
+      return -1;
+    }
+
+    const std::string filename = data_filename(dir, key, i, type);
+    if (!std::ifstream(filename.c_str())) {
+      return -1;
+    }
+    values.push_back(it->second);
+    filenames.push_back(filename);
+  }
+
+  for (std::size_t i = 0; i < values.size(); i++) {
+    if (read_data(filenames[i], values[i])) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int ProcCacheWrite(const std::string &dir, uint64_t key,
+    const ProcedurePropertyMap &properties, const std::vector<std::string> &results)
+{
+  for (std::size_t i = 0; i < results.size(); i++) {
+    ProcedurePropertyMap::const_iterator it = properties.find(results[i]);
+    if (it == properties.end() || !ProcCacheIsCachedType(it->second.type)) {
+      return -1;
+    }
+    if (write_data(data_filename(dir, key, i, it->second.type), it->second)) {
+      return -1;
+    }
+  }
+
+  // the list is written last so readers find all results it names
+  const std::string filename = ProcCacheGetFilename(dir, key);
+  const std::string tmpname = temporary_filename(filename);
+  {
+    std::ofstream file(tmpname.c_str(), std::fstream::out | std::fstream::binary);
+    char sign[PROC_SIGNATURE_SIZE] = {'\0'};
+    strcpy(sign, PROC_SIGNATURE);
+    file.write(sign, PROC_SIGNATURE_SIZE);
+    write_(file, PROC_FILE_VERSION);
+    write_(file, static_cast<int>(results.size()));
+    for (std::size_t i = 0; i < results.size(); i++) {
+      write_(file, results[i]);
+      write_(file, properties.find(results[i])->second.type);
+    }
+    file.flush();
+    if (!file) {
+      std::remove(tmpname.c_str());
+      return -1;
+    }
+  }
+
+  if (std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+    std::remove(tmpname.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+} // namespace xxx
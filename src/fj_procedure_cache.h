@@ -0,0 +1,44 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_PROCEDURE_CACHE_H
+#define FJ_PROCEDURE_CACHE_H
+
+#include "fj_compatibility.h"
+#include "fj_property.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+// Results of procedures in files of a cache directory keyed by the type of
+// the procedure and its property values. geometry is keyed by its content
+// so procedures run again when their input geometry changes. files named
+// by string properties are not checked
+
+namespace fj {
+
+typedef std::map<std::string, PropertyValue> ProcedurePropertyMap;
+
+// content hash of the value. 0 if it can't be hashed e.g. shaders, textures
+// and object groups
+FJ_API uint64_t ProcCacheHashValue(const PropertyValue &value);
+// 0 if any of the values can't be hashed
+FJ_API uint64_t ProcCacheComputeKey(const std::string &type_name,
+    const ProcedurePropertyMap &properties);
+// curves, point clouds and volumes can be results
+FJ_API bool ProcCacheIsCachedType(int property_type);
+
+// Returns dir/<key>.proc listing the results in the files next to it
+FJ_API std::string ProcCacheGetFilename(const std::string &dir, uint64_t key);
+// reads the results into the nodes of the properties. returns -1 without
+// changing them if the key is not cached
+FJ_API int ProcCacheRead(const std::string &dir, uint64_t key,
+    const ProcedurePropertyMap &properties);
+// writes the nodes of the properties named in results
+FJ_API int ProcCacheWrite(const std::string &dir, uint64_t key,
+    const ProcedurePropertyMap &properties, const std::vector<std::string> &results);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,126 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_profile.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace fj {
+
+typedef std::unordered_map<const void *, ProfileCounter> ProfileTable;
+
+static std::atomic<bool> profile_enabled(false);
+
+// tables of running threads and the sum of tables of finished threads
+static std::vector<ProfileTable *> thread_table_list;
+static ProfileTable finished_thread_tables[PROFILE_KIND_COUNT];
+static std::mutex thread_table_mtx;
+
+static void add_table(ProfileTable &dst, const ProfileTable &src)
+{
+  for (ProfileTable::const_iterator it = src.begin(); it != src.end(); ++it) {
+    ProfileCounter &counter = dst[it->first];
+    counter.call_count += it->second.call_count;
+    counter.nanoseconds += it->second.nanoseconds;
+  }
+}
+
+// registers the tables of a thread while it lives
+class ThreadProfile {
+public:
+  ThreadProfile() : tables()
+  {
+    std::lock_guard<std::mutex> lock(thread_table_mtx);
+    thread_table_list.push_back(tables);
+  }
+  ~ThreadProfile()
+  {
+    std::lock_guard<std::mutex> lock(thread_table_mtx);
+    for (int i = 0; i < PROFILE_KIND_COUNT; i++) {
+      add_table(finished_thread_tables[i], tables[i]);
+    }
+    thread_table_list.erase(
+        std::find(thread_table_list.begin(), thread_table_list.end(), tables));
+  }
+
+  ProfileTable tables[PROFILE_KIND_COUNT];
+};
+
+static ProfileTable *get_thread_tables()
+{
+  static thread_local ThreadProfile thread_profile;
+  return thread_profile.tables;
+}
+
+void ProfileSetEnabled(bool enable)
+{
+  profile_enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool ProfileIsEnabled()
+{
+  return profile_enabled.load(std::memory_order_relaxed);
+}
+
+void ProfileReset()
+{
+  std::lock_guard<std::mutex> lock(thread_table_mtx);
+  for (int i = 0; i < PROFILE_KIND_COUNT; i++) {
+    finished_thread_tables[i].clear();
+  }
+  for (size_t i = 0; i < thread_table_list.size(); i++) {
+    for (int j = 0; j < PROFILE_KIND_COUNT; j++) {
+      thread_table_list[i][j].clear();
+    }
+  }
+}
+
+void ProfileGather(int kind, std::vector<ProfileCounter> *counters)
+{
+  counters->clear();
+  if (kind < 0 || kind >= PROFILE_KIND_COUNT) {
+    return;
+  }
+
+  ProfileTable sum;
+  {
+    std::lock_guard<std::mutex> lock(thread_table_mtx);
+    add_table(sum, finished_thread_tables[kind]);
+    for (size_t i = 0; i < thread_table_list.size(); i++) {
+      add_table(sum, thread_table_list[i][kind]);
+    }
+  }
+
+  counters->reserve(sum.size());
+  for (ProfileTable::const_iterator it = sum.begin(); it != sum.end(); ++it) {
+    counters->push_back(it->second);
+    counters->back().key = it->first;
+  }
+  std::sort(counters->begin(), counters->end(),
+      [](const ProfileCounter &a, const ProfileCounter &b)
+      {
+        if (a.nanoseconds != b.nanoseconds) {
+          return a.nanoseconds > b.nanoseconds;
+        }
+        return a.call_count > b.call_count;
+      });
+}
+
+int64_t ProfileNow()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ProfileAdd(int kind, const void *key, int64_t call_count, int64_t nanoseconds)
+{
+  ProfileCounter &counter = get_thread_tables()[kind][key];
+  counter.call_count += call_count;
+  counter.nanoseconds += nanoseconds;
+}
+
+} // namespace xxx
@@ -0,0 +1,73 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_PROFILE_H
+#define FJ_PROFILE_H
+
+#include "fj_compatibility.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Call counts and inclusive time of each shader and object instance.
+// counting is switched on at run time by ProfileSetEnabled(), e.g. by the
+// profile property of renderers. while off a scope costs a flag check
+
+namespace fj {
+
+enum ProfileKind {
+  // Shader::Evaluate, EvaluateBatch and EvaluateOpacity
+  PROFILE_SHADER = 0,
+  // ray queries and volume samples of ObjectInstance
+  PROFILE_OBJECT,
+  PROFILE_KIND_COUNT
+};
+
+class FJ_API ProfileCounter {
+public:
+  ProfileCounter() : key(NULL), call_count(0), nanoseconds(0) {}
+  ~ProfileCounter() {}
+
+  const void *key;
+  int64_t call_count;
+  // including nested calls e.g. shaders of reflection rays
+  int64_t nanoseconds;
+};
+
+FJ_API void ProfileSetEnabled(bool enable);
+FJ_API bool ProfileIsEnabled();
+// clears counters of all threads. call when no thread is rendering
+FJ_API void ProfileReset();
+// sums counters of all threads sorted by time in descending order. call
+// when no thread is rendering
+FJ_API void ProfileGather(int kind, std::vector<ProfileCounter> *counters);
+
+FJ_API int64_t ProfileNow();
+FJ_API void ProfileAdd(int kind, const void *key, int64_t call_count, int64_t nanoseconds);
+
+// counts a call of key from construction to destruction
+class ProfileScope {
+public:
+  ProfileScope(int kind, const void *key, int64_t call_count = 1) :
+      kind_(kind), key_(key), call_count_(call_count),
+      start_(ProfileIsEnabled() ? ProfileNow() : -1) {}
+  ~ProfileScope()
+  {
+    if (start_ >= 0) {
+      ProfileAdd(kind_, key_, call_count_, ProfileNow() - start_);
+    }
+  }
+
+private:
+  ProfileScope(const ProfileScope &);
+  const ProfileScope &operator=(const ProfileScope &);
+
+  const int kind_;
+  const void *key_;
+  const int64_t call_count_;
+  const int64_t start_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
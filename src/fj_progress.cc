@@ -4,6 +4,8 @@
 #include "fj_progress.h"
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <cstdio>
 
 namespace fj {
 
@@ -64,4 +66,160 @@ void Progress::Done()
   std::cout << '\n';
 }
 
+// reports are frequent enough for interrupts to feel immediate
+static const int REPORT_INTERVAL_MSEC = 100;
+static const int PROGRESS_STEPS = 10;
+
+static_assert(sizeof(ProgressCounter) == 64, "ProgressCounter should be 64 bytes");
+
+static void print_time(double seconds)
+{
+  const int total = static_cast<int>(seconds + .5);
+  printf("%dh %dm %ds", total / 3600, total / 60 % 60, total % 60);
+}
+
+ProgressReporter::ProgressReporter() :
+    counters_(),
+    counter_count_(0),
+    poll_(NULL),
+    poll_data_(NULL),
+    total_tiles_(0),
+    print_progress_(false),
+    printed_steps_(0),
+    start_time_(),
+    thread_(),
+    mutex_(),
+    wake_(),
+    is_stopping_(false),
+    canceled_(false)
+{
+}
+
+ProgressReporter::~ProgressReporter()
+{
+  Stop();
+}
+
+void ProgressReporter::Init(int worker_count, ProgressPollFunction poll, void *poll_data)
+{
+  Stop();
+
+  counters_.reset(new ProgressCounter[worker_count]);
+  counter_count_ = worker_count;
+  poll_ = poll;
+  poll_data_ = poll_data;
+  canceled_ = false;
+}
+
+ProgressCounter *ProgressReporter::GetCounter(int worker_id)
+{
+  assert(worker_id >= 0 && worker_id < counter_count_);
+  return &counters_[worker_id];
+}
+
+void ProgressReporter::Start(Iteration total_tiles, bool print_progress)
+{
+  Stop();
+
+  for (int i = 0; i < counter_count_; i++) {
+    counters_[i].samples = 0;
+    counters_[i].tiles = 0;
+  }
+  total_tiles_ = total_tiles;
+  print_progress_ = print_progress;
+  printed_steps_ = 0;
+  start_time_ = std::chrono::steady_clock::now();
+  is_stopping_ = false;
+
+  // interrupts before the start are seen by the first sample
+  if (poll_ != NULL && poll_(poll_data_)) {
+    canceled_ = true;
+  }
+
+  thread_ = std::thread(&ProgressReporter::run, this);
+}
+
+void ProgressReporter::Stop()
+{
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+
+  // the last steps of tiles finished since the last report
+  report();
+}
+
+Iteration ProgressReporter::GetSampleCount() const
+{
+  Iteration count = 0;
+  for (int i = 0; i < counter_count_; i++) {
+    count += counters_[i].samples.load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+Iteration ProgressReporter::GetTileCount() const
+{
+  Iteration count = 0;
+  for (int i = 0; i < counter_count_; i++) {
+    count += counters_[i].tiles.load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+void ProgressReporter::run()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (!is_stopping_) {
+    wake_.wait_for(lock, std::chrono::milliseconds(REPORT_INTERVAL_MSEC));
+    if (is_stopping_) {
+      break;
+    }
+
+    if (poll_ != NULL && !canceled_ && poll_(poll_data_)) {
+      canceled_ = true;
+    }
+    report();
+  }
+}
+
+void ProgressReporter::report()
+{
+  if (!print_progress_ || total_tiles_ < 1) {
+    return;
+  }
+
+  const Iteration tiles = GetTileCount();
+  const int steps = static_cast<int>(
+      std::min(tiles, total_tiles_) * PROGRESS_STEPS / total_tiles_);
+  if (steps <= printed_steps_) {
+    return;
+  }
+
+  const std::chrono::duration<double> elapse =
+      std::chrono::steady_clock::now() - start_time_;
+  const double seconds = elapse.count();
+  const double remaining = seconds * (total_tiles_ - tiles) / tiles;
+  const Iteration samples = GetSampleCount();
+
+  printf(" %3d%%  (", steps * 100 / PROGRESS_STEPS);
+  print_time(seconds);
+  if (tiles < total_tiles_) {
+    printf(", ");
+    print_time(remaining);
+    printf(" left");
+  }
+  printf(", %.0f samples/s)\n", seconds > 0 ? samples / seconds : 0.);
+  fflush(stdout);
+
+  printed_steps_ = steps;
+}
+
 } // namespace xxx
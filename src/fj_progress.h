@@ -6,6 +6,12 @@
 
 #include "fj_compatibility.h"
 #include "fj_types.h"
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 namespace fj {
 
@@ -30,6 +36,72 @@ private:
   Iteration iteration_;
 };
 
+// Samples and tiles done by a worker. each worker adds to its own counter
+// only, which takes a cache line of its own so workers never contend.
+class ProgressCounter {
+public:
+  ProgressCounter() : samples(0), tiles(0) {}
+  ~ProgressCounter() {}
+
+  void AddSample() { samples.fetch_add(1, std::memory_order_relaxed); }
+  void AddTile() { tiles.fetch_add(1, std::memory_order_relaxed); }
+
+  std::atomic<Iteration> samples;
+  std::atomic<Iteration> tiles;
+
+private:
+  char padding_[64 - 2 * sizeof(std::atomic<Iteration>)];
+};
+
+// returns non zero to cancel the work
+typedef int (*ProgressPollFunction)(void *data);
+
+// Reports progress of workers from a thread of its own a few times a
+// second by summing their counters, so that no reporting is done nor any
+// lock taken in sample loops. a line of the elapsed and the estimated
+// remaining time is printed at each 10% of the tiles. the poll function
+// is called at each report and the reporter is canceled once it returns
+// non zero. workers see it with IsCanceled.
+class FJ_API ProgressReporter {
+public:
+  ProgressReporter();
+  ~ProgressReporter();
+
+  void Init(int worker_count, ProgressPollFunction poll, void *poll_data);
+  ProgressCounter *GetCounter(int worker_id);
+
+  // counters are reset and the reporting thread runs until Stop
+  void Start(Iteration total_tiles, bool print_progress);
+  void Stop();
+
+  bool IsCanceled() const
+  {
+    return canceled_.load(std::memory_order_relaxed);
+  }
+  Iteration GetSampleCount() const;
+  Iteration GetTileCount() const;
+
+private:
+  void run();
+  void report();
+
+  std::unique_ptr<ProgressCounter[]> counters_;
+  int counter_count_;
+  ProgressPollFunction poll_;
+  void *poll_data_;
+
+  Iteration total_tiles_;
+  bool print_progress_;
+  int printed_steps_;
+  std::chrono::steady_clock::time_point start_time_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool is_stopping_;
+  std::atomic<bool> canceled_;
+};
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
 
 #define VEC4_COPY(dst,a) do { \
   (dst)[0] = (a)[0]; \
@@ -33,7 +34,7 @@ PropertyValue PropNull()
   return PropertyValue();
 }
 
-PropertyValue PropScalar(double v0)
+PropertyValue PropScalar(Real v0)
 {
   PropertyValue value;
 
@@ -43,7 +44,7 @@ PropertyValue PropScalar(double v0)
   return value;
 }
 
-PropertyValue PropVector2(double v0, double v1)
+PropertyValue PropVector2(Real v0, Real v1)
 {
   PropertyValue value;
 
@@ -54,7 +55,7 @@ PropertyValue PropVector2(double v0, double v1)
   return value;
 }
 
-PropertyValue PropVector3(double v0, double v1, double v2)
+PropertyValue PropVector3(Real v0, Real v1, Real v2)
 {
   PropertyValue value;
 
@@ -66,7 +67,7 @@ PropertyValue PropVector3(double v0, double v1, double v2)
   return value;
 }
 
-PropertyValue PropVector4(double v0, double v1, double v2, double v3)
+PropertyValue PropVector4(Real v0, Real v1, Real v2, Real v3)
 {
   PropertyValue value;
 
@@ -143,7 +144,7 @@ PropertyValue PropCurve(Curve *curve)
 {
   PropertyValue value;
 
-  value.type = PROP_VOLUME;
+  value.type = PROP_CURVE;
   value.curve = curve;
 
   return value;
@@ -242,6 +243,83 @@ const Property *PropFind(const Property *list, int type, const char *name)
   return found;
 }
 
+// orders by name first so that the first of the same names is found by
+// lower_bound, then by type for lists having the same name of two types
+static int compare_property(const Property *a, int type, const char *name)
+{
+  const int cmp = strcmp(a->GetName(), name);
+  if (cmp != 0)
+    return cmp;
+  return a->GetType() - type;
+}
+
+class PropertyLess {
+public:
+  bool operator()(const Property *a, const Property *b) const
+  {
+    return compare_property(a, b->GetType(), b->GetName()) < 0;
+  }
+};
+
+PropertyTable::PropertyTable() : list_(NULL), count_(0), sorted_()
+{
+}
+
+PropertyTable::PropertyTable(const Property *list) : list_(NULL), count_(0), sorted_()
+{
+  Init(list);
+}
+
+PropertyTable::~PropertyTable()
+{
+}
+
+void PropertyTable::Init(const Property *list)
+{
+  list_ = list;
+  count_ = 0;
+  sorted_.clear();
+
+  if (list == NULL)
+    return;
+
+  for (const Property *prop = list; prop->IsValid(); prop++) {
+    sorted_.push_back(prop);
+  }
+  count_ = static_cast<int>(sorted_.size());
+  // stable so that the first of duplicates wins as in PropFind
+  std::stable_sort(sorted_.begin(), sorted_.end(), PropertyLess());
+}
+
+const Property *PropertyTable::GetList() const
+{
+  return list_;
+}
+
+const Property *PropertyTable::Find(int type, const char *name) const
+{
+  int lo = 0;
+  int hi = count_;
+
+  while (lo < hi) {
+    const int mid = (lo + hi) / 2;
+    if (compare_property(sorted_[mid], type, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo < count_ && compare_property(sorted_[lo], type, name) == 0)
+    return sorted_[lo];
+  else
+    return NULL;
+}
+
+bool PropertyTable::Contains(const Property *property) const
+{
+  return list_ != NULL && property >= list_ && property < list_ + count_;
+}
+
 int PropSetAllDefaultValues(void *self, const Property *list)
 {
   int err_count = 0;
@@ -314,7 +392,7 @@ int PropPushSample(PropertySampleList *list, const PropertySample *sample)
   return 0;
 }
 
-void PropLerpSamples(const PropertySampleList *list, double time,
+void PropLerpSamples(const PropertySampleList *list, Real time,
     PropertySample *dst)
 {
   int i;
@@ -7,6 +7,7 @@
 #include "fj_vector.h"
 #include "fj_types.h"
 #include <cstddef>
+#include <vector>
 
 namespace fj {
 
@@ -113,6 +114,29 @@ private:
 FJ_API const Property *PropFind(const Property *list, int type, const char *name);
 FJ_API int PropSetAllDefaultValues(void *self, const Property *list);
 
+// index of a property list sorted by name and type so that lookups are
+// binary searches instead of scans. built once when the list is registered
+class FJ_API PropertyTable {
+public:
+  PropertyTable();
+  explicit PropertyTable(const Property *list);
+  ~PropertyTable();
+
+  void Init(const Property *list);
+  const Property *GetList() const;
+
+  // the same property as PropFind
+  const Property *Find(int type, const char *name) const;
+  // true if property is an element of the list
+  bool Contains(const Property *property) const;
+
+private:
+  const Property *list_;
+  int count_;
+  std::vector<const Property *> sorted_;
+};
+FJ_API int PropSetAllDefaultValues(void *self, const Property *list);
+
 /* for time variable properties */
 enum { MAX_PROPERTY_SAMPLES = 8 };
 
@@ -4,7 +4,12 @@
 #include "fj_protocol.h"
 #include "fj_socket.h"
 #include "fj_color.h"
+#include "fj_compression.h"
+#include "fj_os.h"
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <cstdio>
 
 #define CONVERT_MSG_RENDER_FRAME_START(CONV) do { \
   CONV(0, size          ) \
@@ -14,9 +19,10 @@
   CONV(4, yres          ) \
   CONV(5, channel_count ) \
   CONV(6, tile_count    ) \
+  CONV(7, tile_encoding ) \
   } while(0)
 #define SIZEOF_RENDER_FRAME_START \
-       7
+       8
 
 #define CONVERT_MSG_RENDER_FRAME_DONE(CONV) \
   CONV(0, size          ) \
@@ -48,9 +54,23 @@
   CONV(6, xmax          ) \
   CONV(7, ymax          ) \
   CONV(8, channel_count ) \
+  CONV(9, tile_encoding ) \
   } while(0)
 #define SIZEOF_RENDER_TILE_DONE \
-       9
+       10
+
+// the same layout as frame start without frame id
+#define CONVERT_MSG_RENDER_TILE_REQUEST(CONV) do { \
+  CONV(0, size          ) \
+  CONV(1, type          ) \
+  CONV(2, frame_id      ) \
+  CONV(3, xres          ) \
+  CONV(4, yres          ) \
+  CONV(5, channel_count ) \
+  CONV(6, tile_count    ) \
+  } while(0)
+#define SIZEOF_RENDER_TILE_REQUEST \
+       7
 
 #define CONVERT_MSG_RENDER_FRAME_ABORT(CONV) \
   CONV(0, size          ) \
@@ -59,20 +79,285 @@
 #define SIZEOF_RENDER_FRAME_ABORT \
        3
 
+// tile_count of the batch, not of the frame
+#define CONVERT_MSG_RENDER_TILE_BATCH(CONV) do { \
+  CONV(0, size          ) \
+  CONV(1, type          ) \
+  CONV(2, frame_id      ) \
+  CONV(3, tile_count    ) \
+  } while(0)
+#define SIZEOF_RENDER_TILE_BATCH \
+       4
+
+#define CONVERT_MSG_RENDER_FRAME_SHARED(CONV) do { \
+  CONV(0, size          ) \
+  CONV(1, type          ) \
+  CONV(2, frame_id      ) \
+  CONV(3, shared_key    ) \
+  } while(0)
+#define SIZEOF_RENDER_FRAME_SHARED \
+       4
+
 #define MSG_TO_ARRAY(i,name) array[i] = name;
 #define ARRAY_TO_MSG(i,name) message.name = body[i];
 
 namespace fj {
 
+// larger sizes are taken as broken messages
+static const int32_t MAX_MESSAGE_SIZE = 1 << 30;
+
+static bool is_rle_encoding(int tile_encoding)
+{
+  return tile_encoding == TILE_ENCODING_FLOAT_RLE ||
+      tile_encoding == TILE_ENCODING_HALF_RLE;
+}
+
+static bool is_half_encoding(int tile_encoding)
+{
+  return tile_encoding == TILE_ENCODING_HALF ||
+      tile_encoding == TILE_ENCODING_HALF_RLE;
+}
+
+// returns the encoding actually used since RLE falls back to uncompressed
+static int encode_pixels(const FrameBuffer &tile, int tile_encoding,
+    std::vector<char> &dst)
+{
+  const int N = tile.GetSize();
+  const float *src = N > 0 ? tile.GetReadOnly(0, 0, 0) : NULL;
+  std::vector<char> raw;
+
+  if (is_half_encoding(tile_encoding)) {
+    raw.resize(sizeof(uint16_t) * N);
+    for (int i = 0; i < N; i++) {
+      const uint16_t half = FloatToHalf(src[i]);
+      memcpy(&raw[sizeof(half) * i], &half, sizeof(half));
+    }
+  } else {
+    raw.resize(sizeof(float) * N);
+    if (N > 0) {
+      memcpy(&raw[0], src, raw.size());
+    }
+  }
+
+  int encoding = is_half_encoding(tile_encoding) ?
+      TILE_ENCODING_HALF : TILE_ENCODING_FLOAT;
+
+  if (is_rle_encoding(tile_encoding)) {
+    std::vector<char> compressed;
+    RleCompress(raw, compressed);
+    if (compressed.size() < raw.size()) {
+      raw.swap(compressed);
+      encoding = encoding == TILE_ENCODING_HALF ?
+          TILE_ENCODING_HALF_RLE : TILE_ENCODING_FLOAT_RLE;
+    }
+  }
+
+  dst.insert(dst.end(), raw.begin(), raw.end());
+  return encoding;
+}
+
+static int decode_pixels(const std::vector<char> &src, int tile_encoding,
+    FrameBuffer &tile)
+{
+  // pixels are read from the shared frame by the receiver
+  if (tile_encoding == TILE_ENCODING_SHARED) {
+    return src.empty() ? 0 : -1;
+  }
+  if (tile_encoding < TILE_ENCODING_FLOAT || tile_encoding > TILE_ENCODING_HALF_RLE) {
+    return -1;
+  }
+
+  const int N = tile.GetSize();
+  const std::size_t raw_size =
+      (is_half_encoding(tile_encoding) ? sizeof(uint16_t) : sizeof(float)) * N;
+  std::vector<char> uncompressed;
+  const char *raw = src.empty() ? NULL : &src[0];
+
+  if (is_rle_encoding(tile_encoding)) {
+    uncompressed.resize(raw_size);
+    raw = uncompressed.empty() ? NULL : &uncompressed[0];
+    if (RleUncompress(src.empty() ? NULL : &src[0], src.size(),
+        uncompressed.empty() ? NULL : &uncompressed[0], raw_size)) {
+      return -1;
+    }
+  }
+  else if (src.size() != raw_size) {
+    return -1;
+  }
+  if (N == 0) {
+    return 0;
+  }
+
+  float *dst = tile.GetWritable(0, 0, 0);
+  if (is_half_encoding(tile_encoding)) {
+    for (int i = 0; i < N; i++) {
+      uint16_t half = 0;
+      memcpy(&half, raw + sizeof(half) * i, sizeof(half));
+      dst[i] = HalfToFloat(half);
+    }
+  } else {
+    memcpy(dst, raw, raw_size);
+  }
+  return 0;
+}
+
+static std::string shared_frame_name(int32_t key, int32_t frame_id)
+{
+  char name[64] = {'\0'};
+  sprintf(name, "fj_frame_%d_%d", key, frame_id);
+  return name;
+}
+
+SharedFrame::SharedFrame() :
+  name_(),
+  data_(NULL),
+  key_(0),
+  xres_(0),
+  yres_(0),
+  channel_count_(0),
+  is_creator_(false)
+{
+}
+
+SharedFrame::~SharedFrame()
+{
+  Close();
+}
+
+int SharedFrame::Create(int32_t frame_id, int xres, int yres, int channel_count)
+{
+  Close();
+  if (xres <= 0 || yres <= 0 || channel_count <= 0) {
+    return -1;
+  }
+
+  const int32_t key = OsGetProcessId();
+  const std::string name = shared_frame_name(key, frame_id);
+  const std::size_t size = sizeof(float) * xres * yres * channel_count;
+  void *data = OsCreateSharedMemory(name.c_str(), size);
+  if (data == NULL) {
+    return -1;
+  }
+
+  name_ = name;
+  data_ = static_cast<float *>(data);
+  key_ = key;
+  xres_ = xres;
+  yres_ = yres;
+  channel_count_ = channel_count;
+  is_creator_ = true;
+  return 0;
+}
+
+int SharedFrame::Open(int32_t key, int32_t frame_id, int xres, int yres, int channel_count)
+{
+  Close();
+  if (xres <= 0 || yres <= 0 || channel_count <= 0) {
+    return -1;
+  }
+
+  const std::string name = shared_frame_name(key, frame_id);
+  const std::size_t size = sizeof(float) * xres * yres * channel_count;
+  void *data = OsOpenSharedMemory(name.c_str(), size);
+  if (data == NULL) {
+    return -1;
+  }
+
+  name_ = name;
+  data_ = static_cast<float *>(data);
+  key_ = key;
+  xres_ = xres;
+  yres_ = yres;
+  channel_count_ = channel_count;
+  is_creator_ = false;
+  return 0;
+}
+
+void SharedFrame::Close()
+{
+  if (!IsOpen()) {
+    return;
+  }
+
+  OsUnmapSharedMemory(data_, sizeof(float) * xres_ * yres_ * channel_count_);
+  if (is_creator_) {
+    OsRemoveSharedMemory(name_.c_str());
+  }
+
+  name_.clear();
+  data_ = NULL;
+  key_ = 0;
+  xres_ = 0;
+  yres_ = 0;
+  channel_count_ = 0;
+  is_creator_ = false;
+}
+
+bool SharedFrame::IsOpen() const
+{
+  return data_ != NULL;
+}
+
+int32_t SharedFrame::GetKey() const
+{
+  return key_;
+}
+
+int SharedFrame::GetWidth() const
+{
+  return xres_;
+}
+
+int SharedFrame::GetHeight() const
+{
+  return yres_;
+}
+
+int SharedFrame::GetChannelCount() const
+{
+  return channel_count_;
+}
+
+float *SharedFrame::GetWritable(int x, int y)
+{
+  if (!is_creator_) {
+    return NULL;
+  }
+  return data_ + (static_cast<std::size_t>(y) * xres_ + x) * channel_count_;
+}
+
+const float *SharedFrame::GetReadOnly(int x, int y) const
+{
+  return data_ + (static_cast<std::size_t>(y) * xres_ + x) * channel_count_;
+}
+
+void SharedFrame::ReadTile(const Message &message, FrameBuffer &tile) const
+{
+  // regions outside of the frame are left as decoded
+  if (!IsOpen() || message.channel_count != channel_count_ ||
+      message.xmin < 0 || message.ymin < 0 ||
+      message.xmax > xres_ || message.ymax > yres_ ||
+      tile.GetWidth() != message.xmax - message.xmin ||
+      tile.GetHeight() != message.ymax - message.ymin) {
+    return;
+  }
+
+  const std::size_t row_size = sizeof(float) * tile.GetWidth() * channel_count_;
+  for (int y = 0; y < tile.GetHeight(); y++) {
+    memcpy(tile.GetWritable(0, y, 0),
+        GetReadOnly(message.xmin, message.ymin + y), row_size);
+  }
+}
+
 int SendRenderFrameStart(Socket &socket, int32_t frame_id,
-    int xres, int yres, int channel_count, int tile_count)
+    int xres, int yres, int channel_count, int tile_count, int tile_encoding)
 {
   int32_t array[SIZEOF_RENDER_FRAME_START];
   const int32_t size = sizeof(array) - sizeof(array[0]);
   const int32_t type = MSG_RENDER_FRAME_START;
   CONVERT_MSG_RENDER_FRAME_START(MSG_TO_ARRAY);
-  socket.Send(reinterpret_cast<char *>(array), sizeof(array));
-  return 0;
+  const int sent = socket.Send(reinterpret_cast<char *>(array), sizeof(array));
+  return sent == static_cast<int>(sizeof(array)) ? 0 : -1;
 }
 
 int SendRenderFrameDone(Socket &socket, int32_t frame_id)
@@ -81,8 +366,8 @@ int SendRenderFrameDone(Socket &socket, int32_t frame_id)
   const int32_t size = sizeof(array) - sizeof(array[0]);
   const int32_t type = MSG_RENDER_FRAME_DONE;
   CONVERT_MSG_RENDER_FRAME_DONE(MSG_TO_ARRAY)
-  socket.Send(reinterpret_cast<char *>(array), sizeof(array));
-  return 0;
+  const int sent = socket.Send(reinterpret_cast<char *>(array), sizeof(array));
+  return sent == static_cast<int>(sizeof(array)) ? 0 : -1;
 }
 
 int SendRenderFrameAbort(Socket &socket, int32_t frame_id)
@@ -91,8 +376,8 @@ int SendRenderFrameAbort(Socket &socket, int32_t frame_id)
   const int32_t size = sizeof(array) - sizeof(array[0]);
   const int32_t type = MSG_RENDER_FRAME_ABORT;
   CONVERT_MSG_RENDER_FRAME_ABORT(MSG_TO_ARRAY)
-  socket.Send(reinterpret_cast<char *>(array), sizeof(array));
-  return 0;
+  const int sent = socket.Send(reinterpret_cast<char *>(array), sizeof(array));
+  return sent == static_cast<int>(sizeof(array)) ? 0 : -1;
 }
 
 int SendRenderTileStart(Socket &socket, int32_t frame_id,
@@ -102,28 +387,104 @@ int SendRenderTileStart(Socket &socket, int32_t frame_id,
   const int32_t size = sizeof(array) - sizeof(array[0]);
   const int32_t type = MSG_RENDER_TILE_START;
   CONVERT_MSG_RENDER_TILE_START(MSG_TO_ARRAY);
-  socket.Send(reinterpret_cast<char *>(array), sizeof(array));
-  return 0;
+  const int sent = socket.Send(reinterpret_cast<char *>(array), sizeof(array));
+  return sent == static_cast<int>(sizeof(array)) ? 0 : -1;
 }
 
 int SendRenderTileDone(Socket &socket, int32_t frame_id,
     int tile_id, int xmin, int ymin, int xmax, int ymax,
-    const FrameBuffer &tile)
+    const FrameBuffer &tile, int tile_encoding)
 {
-  const int32_t tile_size =
-      sizeof(float) *
-      tile.GetWidth() *
-      tile.GetHeight() *
-      tile.GetChannelCount();
-  const int32_t channel_count = tile.GetChannelCount();
+  std::vector<char> buffer;
+  EncodeRenderTileDone(buffer, frame_id, tile_id, xmin, ymin, xmax, ymax,
+      tile, tile_encoding);
+  const int sent = socket.Send(&buffer[0], buffer.size());
+  return sent == static_cast<int>(buffer.size()) ? 0 : -1;
+}
+
+int SendRenderFrameShared(Socket &socket, int32_t frame_id, int32_t shared_key)
+{
+  int32_t array[SIZEOF_RENDER_FRAME_SHARED];
+  const int32_t size = sizeof(array) - sizeof(array[0]);
+  const int32_t type = MSG_RENDER_FRAME_SHARED;
+  CONVERT_MSG_RENDER_FRAME_SHARED(MSG_TO_ARRAY);
+  const int sent = socket.Send(reinterpret_cast<char *>(array), sizeof(array));
+  return sent == static_cast<int>(sizeof(array)) ? 0 : -1;
+}
+
+int SendRenderTileShared(Socket &socket, int32_t frame_id,
+    int tile_id, int xmin, int ymin, int xmax, int ymax, int channel_count)
+{
+  std::vector<char> buffer;
+  EncodeRenderTileShared(buffer, frame_id, tile_id, xmin, ymin, xmax, ymax,
+      channel_count);
+  const int sent = socket.Send(&buffer[0], buffer.size());
+  return sent == static_cast<int>(buffer.size()) ? 0 : -1;
+}
 
+void EncodeRenderTileShared(std::vector<char> &dst, int32_t frame_id,
+    int tile_id, int xmin, int ymin, int xmax, int ymax, int channel_count)
+{
   int32_t array[SIZEOF_RENDER_TILE_DONE];
-  const int32_t size = sizeof(array) - sizeof(array[0]) + tile_size;
+  const int32_t size = sizeof(array) - sizeof(array[0]);
   const int32_t type = MSG_RENDER_TILE_DONE;
+  const int32_t tile_encoding = TILE_ENCODING_SHARED;
   CONVERT_MSG_RENDER_TILE_DONE(MSG_TO_ARRAY);
-  int err = socket.Send(reinterpret_cast<char *>(array), sizeof(array));
-  err = socket.Send(reinterpret_cast<const char *>(tile.GetReadOnly(0, 0, 0)), tile_size);
-  return err;
+
+  const std::size_t offset = dst.size();
+  dst.resize(offset + sizeof(array));
+  memcpy(&dst[offset], array, sizeof(array));
+}
+
+void EncodeRenderTileDone(std::vector<char> &dst, int32_t frame_id,
+    int tile_id, int xmin, int ymin, int xmax, int ymax,
+    const FrameBuffer &tile, int tile_encoding)
+{
+  const int32_t channel_count = tile.GetChannelCount();
+  const int32_t type = MSG_RENDER_TILE_DONE;
+  const std::size_t offset = dst.size();
+
+  // the header is filled after the pixels since size and encoding change
+  int32_t array[SIZEOF_RENDER_TILE_DONE];
+  dst.resize(offset + sizeof(array));
+  const int32_t encoding = encode_pixels(tile, tile_encoding, dst);
+  const int32_t size = dst.size() - offset - sizeof(array[0]);
+
+  {
+    const int32_t tile_encoding = encoding;
+    CONVERT_MSG_RENDER_TILE_DONE(MSG_TO_ARRAY);
+  }
+  memcpy(&dst[offset], array, sizeof(array));
+}
+
+int SendRenderTileBatch(Socket &socket, int32_t frame_id,
+    int tile_count, const std::vector<char> &encoded_tiles)
+{
+  int32_t array[SIZEOF_RENDER_TILE_BATCH];
+  const int32_t size = sizeof(array) - sizeof(array[0]);
+  const int32_t type = MSG_RENDER_TILE_BATCH;
+  CONVERT_MSG_RENDER_TILE_BATCH(MSG_TO_ARRAY);
+
+  // one send for the whole batch
+  std::vector<char> buffer(sizeof(array) + encoded_tiles.size());
+  memcpy(&buffer[0], array, sizeof(array));
+  if (!encoded_tiles.empty()) {
+    memcpy(&buffer[sizeof(array)], &encoded_tiles[0], encoded_tiles.size());
+  }
+  const int sent = socket.Send(&buffer[0], buffer.size());
+  return sent == static_cast<int>(buffer.size()) ? 0 : -1;
+}
+
+int SendRenderTileRequest(Socket &socket,
+    int xres, int yres, int channel_count, int tile_count)
+{
+  int32_t array[SIZEOF_RENDER_TILE_REQUEST];
+  const int32_t size = sizeof(array) - sizeof(array[0]);
+  const int32_t type = MSG_RENDER_TILE_REQUEST;
+  const int32_t frame_id = 0;
+  CONVERT_MSG_RENDER_TILE_REQUEST(MSG_TO_ARRAY);
+  const int sent = socket.Send(reinterpret_cast<char *>(array), sizeof(array));
+  return sent == static_cast<int>(sizeof(array)) ? 0 : -1;
 }
 
 Message::Message()
@@ -134,67 +495,64 @@ Message::~Message()
 {
 }
 
-int ReceiveMessage(Socket &socket, Message &message, FrameBuffer &tile)
+int PeekMessageSize(const char *data, std::size_t count)
 {
-  int32_t body[16] = {0};
-
-  // reading size of message
-  int err = socket.Receive(reinterpret_cast<char *>(&body[0]), sizeof(body[0]));
-  if (err == -1) {
-    // TODO ERROR HANDLING
-    return -1;
+  int32_t size_of_msg = 0;
+  if (count < sizeof(size_of_msg)) {
+    return 0;
   }
 
-  if (err == 0) {
+  memcpy(&size_of_msg, data, sizeof(size_of_msg));
+  if (size_of_msg < static_cast<int32_t>(sizeof(size_of_msg)) ||
+      size_of_msg > MAX_MESSAGE_SIZE) {
     return -1;
   }
+  return sizeof(size_of_msg) + size_of_msg;
+}
 
-  // reading type of message
-  err = socket.Receive(reinterpret_cast<char *>(&body[1]), sizeof(body[1]));
-  if (err == -1) {
-    // TODO ERROR HANDLING
+int DecodeMessage(const char *data, std::size_t size, Message &message, FrameBuffer &tile)
+{
+  int32_t body[16] = {0};
+
+  if (PeekMessageSize(data, size) != static_cast<int>(size)) {
     return -1;
   }
+  memcpy(&body[0], data, 2 * sizeof(body[0]));
 
   const int32_t size_of_msg = body[0];
   const int32_t type_of_msg = body[1];
 
   // special case
   if (type_of_msg == MSG_RENDER_TILE_DONE) {
-    err = socket.Receive(reinterpret_cast<char *>(&body[2]),
-        (SIZEOF_RENDER_TILE_DONE - 2) * sizeof(body[0]));
-    if (err == -1) {
-      // TODO ERROR HANDLING
+    const std::size_t HEADER_SIZE = SIZEOF_RENDER_TILE_DONE * sizeof(body[0]);
+    if (size < HEADER_SIZE) {
       return -1;
     }
+    memcpy(&body[0], data, HEADER_SIZE);
     CONVERT_MSG_RENDER_TILE_DONE(ARRAY_TO_MSG);
 
-    tile.Resize(
-        message.xmax - message.xmin,
-        message.ymax - message.ymin,
-        message.channel_count);
-
-    for (int y = 0; y < tile.GetHeight(); y++) {
-      for (int x = 0; x < tile.GetWidth(); x++) {
-        float pixel[4] = {0};
-        err = socket.Receive(reinterpret_cast<char *>(pixel), sizeof(pixel));
-        if (err == -1) {
-          // TODO ERROR HANDLING
-        }
-        const Color4 color(pixel[0], pixel[1], pixel[2], pixel[3]);
-        tile.SetColor(x, y, color);
-      }
+    const int width = message.xmax - message.xmin;
+    const int height = message.ymax - message.ymin;
+    const int32_t pixels_size =
+        size_of_msg - (SIZEOF_RENDER_TILE_DONE - 1) * sizeof(body[0]);
+    // no encoding is larger than float pixels
+    if (width < 0 || height < 0 || message.channel_count < 0 || pixels_size < 0 ||
+        pixels_size > static_cast<int64_t>(sizeof(float)) *
+        width * height * message.channel_count) {
+      return -1;
+    }
+    tile.Resize(width, height, message.channel_count);
+
+    const std::vector<char> pixels(data + HEADER_SIZE, data + size);
+    if (decode_pixels(pixels, message.tile_encoding, tile)) {
+      return -1;
     }
 
     return 0;
   }
 
-  //body.resize(size_of_msg);
-  err = socket.Receive(reinterpret_cast<char *>(&body[2]), size_of_msg - sizeof(body[1]));
-  if (err == -1) {
-    // TODO ERROR HANDLING
-    return -1;
-  }
+  // other messages fit in the body
+  memcpy(&body[0], data, std::min(size, sizeof(body)));
 
   switch (type_of_msg) {
 
@@ -230,6 +588,38 @@ int ReceiveMessage(Socket &socket, Message &message, FrameBuffer &tile)
     }
     break;
 
+  case MSG_RENDER_FRAME_ABORT:
+    if (size_of_msg != (SIZEOF_RENDER_FRAME_ABORT - 1) * sizeof(body[0])) {
+      break;
+    } else {
+      CONVERT_MSG_RENDER_FRAME_ABORT(ARRAY_TO_MSG);
+    }
+    break;
+
+  case MSG_RENDER_TILE_REQUEST:
+    if (size_of_msg != (SIZEOF_RENDER_TILE_REQUEST - 1) * sizeof(body[0])) {
+      break;
+    } else {
+      CONVERT_MSG_RENDER_TILE_REQUEST(ARRAY_TO_MSG);
+    }
+    break;
+
+  case MSG_RENDER_TILE_BATCH:
+    if (size_of_msg != (SIZEOF_RENDER_TILE_BATCH - 1) * sizeof(body[0])) {
+      break;
+    } else {
+      CONVERT_MSG_RENDER_TILE_BATCH(ARRAY_TO_MSG);
+    }
+    break;
+
+  case MSG_RENDER_FRAME_SHARED:
+    if (size_of_msg != (SIZEOF_RENDER_FRAME_SHARED - 1) * sizeof(body[0])) {
+      break;
+    } else {
+      CONVERT_MSG_RENDER_FRAME_SHARED(ARRAY_TO_MSG);
+    }
+    break;
+
   default:
     break;
   }
@@ -237,6 +627,37 @@ int ReceiveMessage(Socket &socket, Message &message, FrameBuffer &tile)
   return 0;
 }
 
+int ReceiveMessage(Socket &socket, Message &message, FrameBuffer &tile)
+{
+  int32_t size_of_msg = 0;
+
+  // reading size of message
+  int err = socket.Receive(reinterpret_cast<char *>(&size_of_msg), sizeof(size_of_msg));
+  if (err == -1) {
+    // TODO ERROR HANDLING
+    return -1;
+  }
+
+  if (err == 0) {
+    return -1;
+  }
+
+  const int total_size = PeekMessageSize(reinterpret_cast<char *>(&size_of_msg),
+      sizeof(size_of_msg));
+  if (total_size < 0) {
+    return -1;
+  }
+
+  std::vector<char> data(total_size);
+  memcpy(&data[0], &size_of_msg, sizeof(size_of_msg));
+  err = socket.Receive(&data[sizeof(size_of_msg)], size_of_msg);
+  if (err != size_of_msg) {
+    return -1;
+  }
+
+  return DecodeMessage(&data[0], data.size(), message, tile);
+}
+
 int ReceiveEOF(Socket &socket)
 {
   char unused;
@@ -6,6 +6,8 @@
 
 #include "fj_framebuffer.h"
 #include "fj_types.h"
+#include <cstddef>
+#include <string>
 #include <vector>
 
 namespace fj {
@@ -18,7 +20,28 @@ enum {
   MSG_RENDER_FRAME_DONE,
   MSG_RENDER_FRAME_ABORT,
   MSG_RENDER_TILE_START,
-  MSG_RENDER_TILE_DONE
+  MSG_RENDER_TILE_DONE,
+  // farm workers ask the coordinator for a tile
+  MSG_RENDER_TILE_REQUEST,
+  // followed by tile_count MSG_RENDER_TILE_DONE messages
+  MSG_RENDER_TILE_BATCH,
+  // follows MSG_RENDER_FRAME_START of TILE_ENCODING_SHARED with the key of
+  // the SharedFrame
+  MSG_RENDER_FRAME_SHARED
+};
+
+// Pixel formats of MSG_RENDER_TILE_DONE. The sender tells the format of the
+// frame in MSG_RENDER_FRAME_START and each tile tells its own, so receivers
+// decode any of them. RLE tiles are sent uncompressed if not smaller.
+enum TileEncoding {
+  TILE_ENCODING_FLOAT = 0,
+  TILE_ENCODING_FLOAT_RLE,
+  // lossy. enough for display
+  TILE_ENCODING_HALF,
+  TILE_ENCODING_HALF_RLE,
+  // no pixels in messages. they are in the SharedFrame of the frame. only
+  // for a viewer on the same machine
+  TILE_ENCODING_SHARED
 };
 
 class FJ_API Message {
@@ -33,6 +56,8 @@ public:
   int32_t yres;
   int32_t channel_count;
   int32_t tile_count;
+  int32_t tile_encoding;
+  int32_t shared_key;
 
   int32_t tile_id;
   int32_t xmin;
@@ -43,8 +68,49 @@ public:
 public:
 };
 
+// Pixels of a frame in memory shared by a renderer and a viewer on the same
+// machine. The renderer writes tiles in place and only their regions go
+// through the socket. xres * yres * channel_count floats from the top row.
+class FJ_API SharedFrame {
+public:
+  SharedFrame();
+  // Closes if opened
+  ~SharedFrame();
+
+  // for renderers. the key is unique to the process
+  int Create(int32_t frame_id, int xres, int yres, int channel_count);
+  // for viewers. the key is told by MSG_RENDER_FRAME_SHARED
+  int Open(int32_t key, int32_t frame_id, int xres, int yres, int channel_count);
+  // The creator removes the name. viewers keep what they mapped
+  void Close();
+  bool IsOpen() const;
+
+  int32_t GetKey() const;
+  int GetWidth() const;
+  int GetHeight() const;
+  int GetChannelCount() const;
+
+  // NULL if opened by Open
+  float *GetWritable(int x, int y);
+  const float *GetReadOnly(int x, int y) const;
+  // copies the region of the message into the tile decoded from it
+  void ReadTile(const Message &message, FrameBuffer &tile) const;
+
+private:
+  SharedFrame(const SharedFrame &);
+  const SharedFrame &operator=(const SharedFrame &);
+
+  std::string name_;
+  float *data_;
+  int32_t key_;
+  int xres_;
+  int yres_;
+  int channel_count_;
+  bool is_creator_;
+};
+
 FJ_API int SendRenderFrameStart(Socket &socket, int32_t frame_id,
-    int xres, int yres, int channel_count, int tile_count);
+    int xres, int yres, int channel_count, int tile_count, int tile_encoding);
 
 FJ_API int SendRenderFrameDone(Socket &socket, int32_t frame_id);
 
@@ -55,9 +121,41 @@ FJ_API int SendRenderTileStart(Socket &socket, int32_t frame_id,
 
 FJ_API int SendRenderTileDone(Socket &socket, int32_t frame_id,
     int tile_id, int xmin, int ymin, int xmax, int ymax,
-    const FrameBuffer &tile);
+    const FrameBuffer &tile, int tile_encoding);
+
+FJ_API int SendRenderFrameShared(Socket &socket, int32_t frame_id, int32_t shared_key);
+
+// MSG_RENDER_TILE_DONE of TILE_ENCODING_SHARED. pixels are already written
+// to the SharedFrame. receivers get the tile resized but not filled
+FJ_API int SendRenderTileShared(Socket &socket, int32_t frame_id,
+    int tile_id, int xmin, int ymin, int xmax, int ymax, int channel_count);
+FJ_API void EncodeRenderTileShared(std::vector<char> &dst, int32_t frame_id,
+    int tile_id, int xmin, int ymin, int xmax, int ymax, int channel_count);
+
+// Appends a MSG_RENDER_TILE_DONE message to dst for SendRenderTileBatch.
+FJ_API void EncodeRenderTileDone(std::vector<char> &dst, int32_t frame_id,
+    int tile_id, int xmin, int ymin, int xmax, int ymax,
+    const FrameBuffer &tile, int tile_encoding);
+
+// Sends tile_count messages made by EncodeRenderTileDone at once.
+FJ_API int SendRenderTileBatch(Socket &socket, int32_t frame_id,
+    int tile_count, const std::vector<char> &encoded_tiles);
+
+// The coordinator replies with MSG_RENDER_TILE_START for the tile to render,
+// MSG_RENDER_FRAME_DONE if no tiles are left or MSG_RENDER_FRAME_ABORT if the
+// frame has been aborted or doesn't match.
+FJ_API int SendRenderTileRequest(Socket &socket,
+    int xres, int yres, int channel_count, int tile_count);
 
+// MSG_RENDER_TILE_BATCH only tells tile_count. Tiles in the batch are
+// received as MSG_RENDER_TILE_DONE by the following calls.
 FJ_API int ReceiveMessage(Socket &socket, Message &message, FrameBuffer &tile);
+// For receivers reading without blocking. Returns the bytes of the whole
+// message beginning at data, 0 if its size hasn't arrived yet and -1 if
+// the size is broken.
+FJ_API int PeekMessageSize(const char *data, std::size_t count);
+// Same as ReceiveMessage but from size bytes told by PeekMessageSize.
+FJ_API int DecodeMessage(const char *data, std::size_t size, Message &message, FrameBuffer &tile);
 FJ_API int ReceiveEOF(Socket &socket);
 
 FJ_API int ReceiveReply(Socket &socket, Message &message);
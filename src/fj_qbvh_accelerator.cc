@@ -0,0 +1,1048 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_qbvh_accelerator.h"
+#include "fj_bvh_accelerator.h"
+#include "fj_intersection.h"
+#include "fj_bvh_cache.h"
+#include "fj_primitive_set.h"
+#include "fj_memory_usage.h"
+#include "fj_mesh.h"
+#include "fj_multi_thread.h"
+#include "fj_numeric.h"
+#include "fj_ray_stats.h"
+#include "fj_ray.h"
+#include "internal/fj_float_rounding.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <typeinfo>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define FJ_QBVH_SSE
+  #include <emmintrin.h>
+#endif
+
+namespace fj {
+
+static const char ACCELERATOR_NAME[] = "QBVH";
+
+static const int DEFAULT_LEAF_SIZE = 4;
+// bytes of nodes in a treelet of the clustered layout
+static const int TREELET_BYTES = 4096;
+static const int CACHE_LINE_BYTES = 64;
+// a wide tree is never deeper than the binary tree it is collapsed from and
+// each level pushes at most 3 nodes besides the one popped next
+static const int MAX_STACK_SIZE = 3 * BVH_MAX_DEPTH + 4;
+
+// child boxes are tested in float. t ranges are widened by a few ulps and by
+// the error of rounding ray origin to float so that no box is falsely missed
+static const float T_RELATIVE_EPSILON = 1.f / (1 << 21);
+static const float ORIGIN_EPSILON = 1.f / (1 << 22);
+
+static_assert(sizeof(QBVHNode) == 128, "QBVHNode should be 128 bytes");
+static_assert(sizeof(CompressedQBVHNode) == 64, "CompressedQBVHNode should be 64 bytes");
+
+// exponents of cells are of normal floats
+static const int MIN_CELL_EXPONENT = -126;
+static const int MAX_CELL_EXPONENT = 127;
+static const int MAX_QUANTIZED = 255;
+
+class StackEntry {
+public:
+  int32_t child;
+  int32_t count;
+  float tnear;
+};
+
+// ray of float values for tests of four children at once
+class QuadTraversalRay {
+public:
+  float orig[3];
+  float inv_dir[3];
+  // 0 if the near plane along the axis is bounds min, 1 if the max
+  int near_side[3];
+  float tpad;
+#if defined(FJ_QBVH_SSE)
+  __m128 orig4[3];
+  __m128 inv_dir4[3];
+#endif
+};
+
+static int collapse_node(const std::vector<BVHNode> &bin_nodes, int bin_id,
+    std::vector<QBVHNode> *nodes);
+static void set_child(QBVHNode *node, int lane, const BVHNode &bin_node);
+static void set_lane_bounds(QBVHNode *node, int lane, const Box &box);
+static Box get_lane_bounds(const QBVHNode &node, int lane);
+static Box get_lane_bounds(const CompressedQBVHNode &node, int lane);
+static Real compute_tree_cost(const std::vector<QBVHNode> &nodes);
+static void setup_traversal_ray(const Ray &ray, QuadTraversalRay *tray);
+static int compress_nodes(const std::vector<QBVHNode> &nodes,
+    std::vector<CompressedQBVHNode> *compressed);
+static void cluster_nodes(std::vector<QBVHNode> *nodes, int treelet_size);
+static int intersect_children(const QBVHNode &node, const QuadTraversalRay &tray,
+    float ray_tmin, float ray_tmax, float *tnear);
+static int intersect_children(const CompressedQBVHNode &node, const QuadTraversalRay &tray,
+    float ray_tmin, float ray_tmax, float *tnear);
+static int intersect_bounds(const float (*bounds)[3][4], const QuadTraversalRay &tray,
+    float ray_tmin, float ray_tmax, float *tnear);
+
+template <typename Node>
+static inline void prefetch_node(const Node *node)
+{
+#if defined(__GNUC__)
+  for (std::size_t i = 0; i < sizeof(Node); i += CACHE_LINE_BYTES) {
+    __builtin_prefetch(reinterpret_cast<const char *>(node) + i);
+  }
+#elif defined(FJ_QBVH_SSE)
+  for (std::size_t i = 0; i < sizeof(Node); i += CACHE_LINE_BYTES) {
+    _mm_prefetch(reinterpret_cast<const char *>(node) + i, _MM_HINT_T0);
+  }
+#endif
+}
+
+// 2^exponent of a normal float
+static inline float cell_size(int exponent)
+{
+  const int32_t bits = (exponent + 127) << 23;
+  float size = 0;
+  memcpy(&size, &bits, sizeof(size));
+  return size;
+}
+
+// exact in float since q has 8 bits and scale is a power of two. only the
+// add rounds, which is the same in traversal
+static inline float decode_bound(float origin, float scale, int q)
+{
+  return origin + static_cast<float>(q) * scale;
+}
+
+QBVHNode::QBVHNode()
+{
+  // empty children have inverted bounds so they are never hit
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) {
+      bounds[0][i][j] =  HUGE_VALF;
+      bounds[1][i][j] = -HUGE_VALF;
+    }
+  }
+  for (int j = 0; j < 4; j++) {
+    child[j] = -1;
+    count[j] = 0;
+  }
+}
+
+CompressedQBVHNode::CompressedQBVHNode()
+{
+  // empty children have inverted bounds like QBVHNode
+  for (int i = 0; i < 3; i++) {
+    origin[i] = 0;
+    exponent[i] = 0;
+    for (int j = 0; j < 4; j++) {
+      qbounds[0][i][j] = MAX_QUANTIZED;
+      qbounds[1][i][j] = 0;
+    }
+  }
+  for (int j = 0; j < 4; j++) {
+    child[j] = -1;
+    count[j] = 0;
+  }
+  for (int i = 0; i < 5; i++) {
+    padding[i] = 0;
+  }
+}
+
+QBVHAccelerator::QBVHAccelerator() :
+    nodes_(),
+    compressed_nodes_(),
+    prim_indices_(),
+    build_mode_(BVH_BUILD_MEDIAN),
+    leaf_size_(DEFAULT_LEAF_SIZE),
+    split_budget_(BVH_DEFAULT_SPLIT_BUDGET),
+    compression_threshold_(QBVH_DEFAULT_COMPRESSION_THRESHOLD),
+    node_layout_(QBVH_LAYOUT_CLUSTERED),
+    prefetch_(true),
+    cache_dir_(),
+    prim_count_(0),
+    built_cost_(0)
+{
+}
+
+QBVHAccelerator::~QBVHAccelerator()
+{
+}
+
+int QBVHAccelerator::SetBuildMode(int build_mode)
+{
+  switch (build_mode) {
+  case BVH_BUILD_MEDIAN:
+  case BVH_BUILD_SAH:
+  case BVH_BUILD_SBVH:
+    build_mode_ = build_mode;
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+int QBVHAccelerator::GetBuildMode() const
+{
+  return build_mode_;
+}
+
+int QBVHAccelerator::SetSplitBudget(Real split_budget)
+{
+  if (split_budget < 0) {
+    return -1;
+  }
+
+  split_budget_ = split_budget;
+  return 0;
+}
+
+Real QBVHAccelerator::GetSplitBudget() const
+{
+  return split_budget_;
+}
+
+int QBVHAccelerator::SetLeafSize(int leaf_size)
+{
+  if (leaf_size < 1 || leaf_size > BVH_MAX_LEAF_SIZE) {
+    return -1;
+  }
+
+  leaf_size_ = leaf_size;
+  return 0;
+}
+
+int QBVHAccelerator::GetLeafSize() const
+{
+  return leaf_size_;
+}
+
+void QBVHAccelerator::SetCacheDirectory(const std::string &dir)
+{
+  cache_dir_ = dir;
+}
+
+const std::string &QBVHAccelerator::GetCacheDirectory() const
+{
+  return cache_dir_;
+}
+
+int QBVHAccelerator::SetCompressionThreshold(Real threshold)
+{
+  if (threshold < 0) {
+    return -1;
+  }
+
+  compression_threshold_ = threshold;
+  return 0;
+}
+
+Real QBVHAccelerator::GetCompressionThreshold() const
+{
+  return compression_threshold_;
+}
+
+int QBVHAccelerator::SetNodeLayout(int node_layout)
+{
+  switch (node_layout) {
+  case QBVH_LAYOUT_DEPTH_FIRST:
+  case QBVH_LAYOUT_CLUSTERED:
+    node_layout_ = node_layout;
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+int QBVHAccelerator::GetNodeLayout() const
+{
+  return node_layout_;
+}
+
+void QBVHAccelerator::SetPrefetch(bool prefetch)
+{
+  prefetch_ = prefetch;
+}
+
+bool QBVHAccelerator::IsPrefetching() const
+{
+  return prefetch_;
+}
+
+int QBVHAccelerator::GetNodeCount() const
+{
+  return static_cast<int>(nodes_.size() + compressed_nodes_.size());
+}
+
+bool QBVHAccelerator::IsCompressed() const
+{
+  return !compressed_nodes_.empty();
+}
+
+int QBVHAccelerator::build()
+{
+  std::vector<BVHNode> bin_nodes;
+  std::vector<Index> indices_tmp;
+
+  const int err = BvhBuildTreeCached(*GetPrimitiveSet(), build_mode_, leaf_size_,
+      split_budget_, cache_dir_, &bin_nodes, &indices_tmp);
+  if (err) {
+    return -1;
+  }
+
+  std::vector<QBVHNode> nodes_tmp;
+  // collapsing removes at least one of every two interior nodes
+  nodes_tmp.reserve(bin_nodes.size() / 2 + 1);
+
+  if (bin_nodes[0].is_leaf()) {
+    nodes_tmp.push_back(QBVHNode());
+    set_child(&nodes_tmp[0], 0, bin_nodes[0]);
+  } else {
+    collapse_node(bin_nodes, 0, &nodes_tmp);
+  }
+
+  if (node_layout_ == QBVH_LAYOUT_CLUSTERED) {
+    cluster_nodes(&nodes_tmp, TREELET_BYTES / sizeof(QBVHNode));
+  }
+
+  // nodes of unbounded primitives or huge leaves are left uncompressed
+  std::vector<CompressedQBVHNode> compressed_tmp;
+  const Real node_megabytes = MemoryUsageOf(nodes_tmp) / (1024. * 1024.);
+  if (node_megabytes > compression_threshold_ &&
+      compress_nodes(nodes_tmp, &compressed_tmp) == 0) {
+    std::vector<QBVHNode>().swap(nodes_tmp);
+  }
+
+  // commit
+  nodes_.swap(nodes_tmp);
+  compressed_nodes_.swap(compressed_tmp);
+  prim_indices_.swap(indices_tmp);
+  prim_count_ = GetPrimitiveSet()->GetPrimitiveCount();
+  built_cost_ = compute_tree_cost(nodes_);
+
+  // traversed by workers of all nodes
+  MtInterleaveSharedMemory(nodes_);
+  MtInterleaveSharedMemory(compressed_nodes_);
+  MtInterleaveSharedMemory(prim_indices_);
+
+  // leaves test the precomputed triangles
+  PrimitiveSet *primset = GetPrimitiveSet();
+  if (typeid(*primset) == typeid(Mesh)) {
+    static_cast<Mesh *>(primset)->PrecomputeTriangles();
+  }
+
+  return 0;
+}
+
+int QBVHAccelerator::refit()
+{
+  const PrimitiveSet &primset = *GetPrimitiveSet();
+  if (nodes_.empty() || prim_count_ != primset.GetPrimitiveCount()) {
+    return -1;
+  }
+
+  const int NNODES = static_cast<int>(nodes_.size());
+  std::vector<Box> bounds(NNODES);
+
+  // children are always after their parent in depth-first order
+  for (int i = NNODES - 1; i >= 0; i--) {
+    QBVHNode &node = nodes_[i];
+    bounds[i].ReverseInfinite();
+
+    for (int lane = 0; lane < 4; lane++) {
+      if (node.child[lane] < 0) {
+        continue;
+      }
+      Box lane_bounds;
+      lane_bounds.ReverseInfinite();
+
+      if (node.count[lane] > 0) {
+        const int begin = node.child[lane];
+        for (int j = begin; j < begin + node.count[lane]; j++) {
+          Box prim_bounds;
+          primset.GetPrimitiveBounds(prim_indices_[j], &prim_bounds);
+          lane_bounds.AddBox(prim_bounds);
+        }
+      } else {
+        lane_bounds = bounds[node.child[lane]];
+      }
+      set_lane_bounds(&node, lane, lane_bounds);
+      bounds[i].AddBox(lane_bounds);
+    }
+  }
+
+  if (compute_tree_cost(nodes_) > BVH_MAX_REFIT_COST_RATIO * built_cost_) {
+    return -1;
+  }
+  return 0;
+}
+
+bool QBVHAccelerator::intersect(const Ray &ray, Real time, Intersection *isect) const
+{
+  if (IsCompressed()) {
+    return intersect_nodes(compressed_nodes_, ray, time, isect);
+  } else {
+    return intersect_nodes(nodes_, ray, time, isect);
+  }
+}
+
+bool QBVHAccelerator::occlude(const Ray &ray, Real time, Intersection *isect) const
+{
+  if (IsCompressed()) {
+    return occlude_nodes(compressed_nodes_, ray, time, isect);
+  } else {
+    return occlude_nodes(nodes_, ray, time, isect);
+  }
+}
+
+template <typename Node>
+bool QBVHAccelerator::intersect_nodes(const std::vector<Node> &nodes,
+    const Ray &ray, Real time, Intersection *isect) const
+{
+  if (nodes.empty()) {
+    return false;
+  }
+
+  const PrimitiveSet *primset = GetPrimitiveSet();
+  QuadTraversalRay tray;
+  setup_traversal_ray(ray, &tray);
+
+  // the ray is shortened to the closest hit found so far
+  Ray ray_tmp = ray;
+  float ray_tmin = RoundDownToFloat(ray.tmin);
+  float ray_tmax = RoundUpToFloat(ray.tmax);
+  bool hit = false;
+
+  Intersection isect_candidates[2];
+  Intersection *isect_min = &isect_candidates[0];
+  Intersection *isect_tmp = &isect_candidates[1];
+
+  StackEntry stack[MAX_STACK_SIZE];
+  int stack_size = 0;
+  FJ_RAY_STATS_LOCAL(int max_stack_size = 0);
+
+  // start from the root as an interior child
+  stack[stack_size].child = 0;
+  stack[stack_size].count = 0;
+  stack[stack_size].tnear = ray_tmin;
+  stack_size++;
+
+  while (stack_size > 0) {
+    const StackEntry entry = stack[--stack_size];
+
+    // skip subtrees that are farther than the closest hit
+    if (entry.tnear > ray_tmax) {
+      continue;
+    }
+
+    if (entry.count > 0) {
+      const bool hittmp = primset->RayIntersectList(&prim_indices_[entry.child],
+          entry.count, ray_tmp, time, isect_tmp);
+      FJ_RAY_STATS_ADD(surface_primitive_test_count, entry.count);
+      if (hittmp && isect_tmp->t_hit < isect_min->t_hit) {
+        std::swap(isect_min, isect_tmp);
+        ray_tmp.tmax = isect_min->t_hit;
+        ray_tmax = RoundUpToFloat(ray_tmp.tmax);
+        hit = true;
+      }
+      continue;
+    }
+
+    const Node &node = nodes[entry.child];
+    FJ_RAY_STATS_ADD(surface_node_visit_count, 1);
+    float tnear[4];
+    const int hit_mask = intersect_children(node, tray, ray_tmin, ray_tmax, tnear);
+
+    if (hit_mask == 0) {
+      continue;
+    }
+
+    // push far to near so that the nearest child is popped first
+    StackEntry hits[4];
+    int nhits = 0;
+
+    for (int i = 0; i < 4; i++) {
+      if (!(hit_mask & (1 << i)) || node.child[i] < 0) {
+        continue;
+      }
+      StackEntry e;
+      e.child = node.child[i];
+      e.count = node.count[i];
+      e.tnear = tnear[i];
+
+      int j = nhits++;
+      while (j > 0 && hits[j - 1].tnear < e.tnear) {
+        hits[j] = hits[j - 1];
+        j--;
+      }
+      hits[j] = e;
+    }
+
+    // the nearest one is popped right away
+    for (int i = 0; i < nhits; i++) {
+      if (prefetch_ && i < nhits - 1 && hits[i].count == 0) {
+        prefetch_node(&nodes[hits[i].child]);
+      }
+      stack[stack_size++] = hits[i];
+    }
+    assert(stack_size <= MAX_STACK_SIZE);
+    FJ_RAY_STATS_MAX(max_stack_size, stack_size);
+  }
+  FJ_RAY_STATS_ADD(surface_stack_depth_sum, max_stack_size);
+
+  if (hit) {
+    *isect = *isect_min;
+  }
+
+  return hit;
+}
+
+template <typename Node>
+bool QBVHAccelerator::occlude_nodes(const std::vector<Node> &nodes,
+    const Ray &ray, Real time, Intersection *isect) const
+{
+  if (nodes.empty()) {
+    return false;
+  }
+
+  const PrimitiveSet *primset = GetPrimitiveSet();
+  QuadTraversalRay tray;
+  setup_traversal_ray(ray, &tray);
+
+  const float ray_tmin = RoundDownToFloat(ray.tmin);
+  const float ray_tmax = RoundUpToFloat(ray.tmax);
+
+  StackEntry stack[MAX_STACK_SIZE];
+  int stack_size = 0;
+  FJ_RAY_STATS_LOCAL(int max_stack_size = 0);
+
+  stack[stack_size].child = 0;
+  stack[stack_size].count = 0;
+  stack[stack_size].tnear = ray_tmin;
+  stack_size++;
+
+  // children are not sorted since the first hit ends the traversal
+  while (stack_size > 0) {
+    const StackEntry entry = stack[--stack_size];
+
+    if (entry.count > 0) {
+      const int END = entry.child + entry.count;
+
+      for (int i = entry.child; i < END; i++) {
+        FJ_RAY_STATS_ADD(surface_primitive_test_count, 1);
+        if (primset->RayOcclude(prim_indices_[i], ray, time, isect)) {
+          FJ_RAY_STATS_ADD(surface_stack_depth_sum, max_stack_size);
+          return true;
+        }
+      }
+      continue;
+    }
+
+    const Node &node = nodes[entry.child];
+    FJ_RAY_STATS_ADD(surface_node_visit_count, 1);
+    float tnear[4];
+    const int hit_mask = intersect_children(node, tray, ray_tmin, ray_tmax, tnear);
+
+    for (int i = 0; i < 4; i++) {
+      if (!(hit_mask & (1 << i)) || node.child[i] < 0) {
+        continue;
+      }
+      if (prefetch_ && node.count[i] == 0) {
+        prefetch_node(&nodes[node.child[i]]);
+      }
+      stack[stack_size].child = node.child[i];
+      stack[stack_size].count = node.count[i];
+      stack[stack_size].tnear = tnear[i];
+      stack_size++;
+    }
+    assert(stack_size <= MAX_STACK_SIZE);
+    FJ_RAY_STATS_MAX(max_stack_size, stack_size);
+  }
+  FJ_RAY_STATS_ADD(surface_stack_depth_sum, max_stack_size);
+
+  return false;
+}
+
+const char *QBVHAccelerator::get_name() const
+{
+  return ACCELERATOR_NAME;
+}
+
+std::size_t QBVHAccelerator::get_memory_usage() const
+{
+  return MemoryUsageOf(nodes_) + MemoryUsageOf(compressed_nodes_) +
+      MemoryUsageOf(prim_indices_);
+}
+
+bool QBVHAccelerator::has_same_settings(const Accelerator &other) const
+{
+  const QBVHAccelerator &qbvh = static_cast<const QBVHAccelerator &>(other);
+  return
+      build_mode_ == qbvh.build_mode_ &&
+      leaf_size_ == qbvh.leaf_size_ &&
+      split_budget_ == qbvh.split_budget_ &&
+      compression_threshold_ == qbvh.compression_threshold_ &&
+      node_layout_ == qbvh.node_layout_ &&
+      prefetch_ == qbvh.prefetch_ &&
+      cache_dir_ == qbvh.cache_dir_;
+}
+
+int QBVHAccelerator::analyze(AcceleratorStats *stats) const
+{
+  if (IsCompressed()) {
+    analyze_nodes(compressed_nodes_, stats);
+  } else {
+    analyze_nodes(nodes_, stats);
+  }
+  return nodes_.empty() && compressed_nodes_.empty() ? -1 : 0;
+}
+
+template <typename Node>
+void QBVHAccelerator::analyze_nodes(const std::vector<Node> &nodes,
+    AcceleratorStats *stats) const
+{
+  if (nodes.empty()) {
+    return;
+  }
+
+  // the root has no bounds of its own
+  Box root_bounds;
+  root_bounds.ReverseInfinite();
+  for (int lane = 0; lane < 4; lane++) {
+    if (nodes[0].child[lane] >= 0) {
+      root_bounds.AddBox(get_lane_bounds(nodes[0], lane));
+    }
+  }
+
+  // node, depth and bounds
+  std::vector<std::pair<int, int>> stack(1, std::make_pair(0, 0));
+  std::vector<Box> stack_bounds(1, root_bounds);
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back().first];
+    const int depth = stack.back().second;
+    const Box bounds = stack_bounds.back();
+    stack.pop_back();
+    stack_bounds.pop_back();
+
+    Box children[4];
+    int child_count = 0;
+    for (int lane = 0; lane < 4; lane++) {
+      if (node.child[lane] < 0) {
+        continue;
+      }
+      const Box lane_bounds = get_lane_bounds(node, lane);
+      children[child_count++] = lane_bounds;
+
+      if (node.count[lane] > 0) {
+        stats->AddLeaf(depth + 1, lane_bounds, node.count[lane]);
+      } else {
+        stack.push_back(std::make_pair(node.child[lane], depth + 1));
+        stack_bounds.push_back(lane_bounds);
+      }
+    }
+    stats->AddInterior(depth, bounds, children, child_count);
+  }
+
+  stats->Finish(root_bounds);
+}
+
+static float surface_area(const BVHNode &node)
+{
+  const float dx = node.bounds_max[0] - node.bounds_min[0];
+  const float dy = node.bounds_max[1] - node.bounds_min[1];
+  const float dz = node.bounds_max[2] - node.bounds_min[2];
+  return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+// Collapses the binary subtree at bin_id into 4-wide nodes in depth-first order
+// and returns the index of its root node. children are gathered by opening
+// the interior child with the largest surface area until four are found.
+static int collapse_node(const std::vector<BVHNode> &bin_nodes, int bin_id,
+    std::vector<QBVHNode> *nodes)
+{
+  assert(!bin_nodes[bin_id].is_leaf());
+
+  int children[4] = {bin_id + 1, bin_nodes[bin_id].offset, -1, -1};
+  int nchildren = 2;
+
+  while (nchildren < 4) {
+    int best = -1;
+    float best_area = -1;
+
+    for (int i = 0; i < nchildren; i++) {
+      const BVHNode &child = bin_nodes[children[i]];
+      if (child.is_leaf()) {
+        continue;
+      }
+      const float area = surface_area(child);
+      if (area > best_area) {
+        best_area = area;
+        best = i;
+      }
+    }
+
+    if (best == -1) {
+      break;
+    }
+
+    const int opened = children[best];
+    children[best] = opened + 1;
+    children[nchildren++] = bin_nodes[opened].offset;
+  }
+
+  const int node_id = static_cast<int>(nodes->size());
+  nodes->push_back(QBVHNode());
+
+  for (int i = 0; i < nchildren; i++) {
+    const BVHNode &child = bin_nodes[children[i]];
+    set_child(&(*nodes)[node_id], i, child);
+
+    if (!child.is_leaf()) {
+      const int child_id = collapse_node(bin_nodes, children[i], nodes);
+      // nodes may be reallocated while collapsing children
+      (*nodes)[node_id].child[i] = child_id;
+    }
+  }
+
+  return node_id;
+}
+
+static void set_child(QBVHNode *node, int lane, const BVHNode &bin_node)
+{
+  for (int i = 0; i < 3; i++) {
+    node->bounds[0][i][lane] = bin_node.bounds_min[i];
+    node->bounds[1][i][lane] = bin_node.bounds_max[i];
+  }
+
+  if (bin_node.is_leaf()) {
+    node->child[lane] = bin_node.offset;
+    node->count[lane] = bin_node.count;
+  } else {
+    node->child[lane] = -1;
+    node->count[lane] = 0;
+  }
+}
+
+static void set_lane_bounds(QBVHNode *node, int lane, const Box &box)
+{
+  for (int i = 0; i < 3; i++) {
+    node->bounds[0][i][lane] = RoundDownToFloat(box.min[i]);
+    node->bounds[1][i][lane] = RoundUpToFloat(box.max[i]);
+  }
+}
+
+static Box get_lane_bounds(const QBVHNode &node, int lane)
+{
+  return Box(
+      Vector(node.bounds[0][0][lane], node.bounds[0][1][lane], node.bounds[0][2][lane]),
+      Vector(node.bounds[1][0][lane], node.bounds[1][1][lane], node.bounds[1][2][lane]));
+}
+
+static Box get_lane_bounds(const CompressedQBVHNode &node, int lane)
+{
+  Box box;
+  for (int i = 0; i < 3; i++) {
+    const float scale = cell_size(node.exponent[i]);
+    box.min[i] = decode_bound(node.origin[i], scale, node.qbounds[0][i][lane]);
+    box.max[i] = decode_bound(node.origin[i], scale, node.qbounds[1][i][lane]);
+  }
+  return box;
+}
+
+static Real compute_tree_cost(const std::vector<QBVHNode> &nodes)
+{
+  if (nodes.empty()) {
+    return 0;
+  }
+
+  // a visit of a node tests all of its children at once
+  Real cost = 0;
+  Box root_bounds;
+  root_bounds.ReverseInfinite();
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    const QBVHNode &node = nodes[i];
+    for (int lane = 0; lane < 4; lane++) {
+      if (node.child[lane] < 0) {
+        continue;
+      }
+      const Box lane_bounds = get_lane_bounds(node, lane);
+      const Real area = lane_bounds.SurfaceArea();
+      cost += node.count[lane] > 0 ? area * node.count[lane] : area;
+
+      if (i == 0) {
+        root_bounds.AddBox(lane_bounds);
+      }
+    }
+  }
+
+  const Real root_area = root_bounds.SurfaceArea();
+  return root_area > 0 ? cost / root_area : 0;
+}
+
+static int compress_node(const QBVHNode &node, CompressedQBVHNode *compressed)
+{
+  // leaves at the max depth may be bigger than leaf size
+  for (int j = 0; j < 4; j++) {
+    if (node.count[j] > UINT8_MAX) {
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < 3; i++) {
+    float lo = HUGE_VALF;
+    float hi = -HUGE_VALF;
+    for (int j = 0; j < 4; j++) {
+      if (node.child[j] >= 0) {
+        lo = std::min(lo, node.bounds[0][i][j]);
+        hi = std::max(hi, node.bounds[1][i][j]);
+      }
+    }
+    if (!std::isfinite(lo) || !std::isfinite(hi)) {
+      return -1;
+    }
+
+    // the smallest cell of which the grid covers the node
+    int exponent = MIN_CELL_EXPONENT;
+    if (hi > lo) {
+      int e = 0;
+      std::frexp((hi - lo) / MAX_QUANTIZED, &e);
+      exponent = std::max(e - 1, MIN_CELL_EXPONENT);
+    }
+    while (decode_bound(lo, cell_size(exponent), MAX_QUANTIZED) < hi) {
+      if (exponent == MAX_CELL_EXPONENT) {
+        return -1;
+      }
+      exponent++;
+    }
+
+    const float scale = cell_size(exponent);
+    compressed->origin[i] = lo;
+    compressed->exponent[i] = static_cast<int8_t>(exponent);
+
+    for (int j = 0; j < 4; j++) {
+      if (node.child[j] < 0) {
+        continue;
+      }
+      const float child_lo = node.bounds[0][i][j];
+      const float child_hi = node.bounds[1][i][j];
+      int qlo = static_cast<int>(std::floor((child_lo - lo) / scale));
+      int qhi = static_cast<int>(std::ceil((child_hi - lo) / scale));
+      qlo = std::min(std::max(qlo, 0), MAX_QUANTIZED);
+      qhi = std::min(std::max(qhi, 0), MAX_QUANTIZED);
+
+      // rounded outward after decoding
+      while (qlo > 0 && decode_bound(lo, scale, qlo) > child_lo) {
+        qlo--;
+      }
+      while (qhi < MAX_QUANTIZED && decode_bound(lo, scale, qhi) < child_hi) {
+        qhi++;
+      }
+      compressed->qbounds[0][i][j] = static_cast<uint8_t>(qlo);
+      compressed->qbounds[1][i][j] = static_cast<uint8_t>(qhi);
+    }
+  }
+
+  for (int j = 0; j < 4; j++) {
+    compressed->child[j] = node.child[j];
+    compressed->count[j] = static_cast<uint8_t>(node.count[j]);
+  }
+  return 0;
+}
+
+static int compress_nodes(const std::vector<QBVHNode> &nodes,
+    std::vector<CompressedQBVHNode> *compressed)
+{
+  compressed->resize(nodes.size());
+
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    if (compress_node(nodes[i], &(*compressed)[i])) {
+      compressed->clear();
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Moves nodes into treelets of up to treelet_size nodes. each treelet takes
+// the top levels of a subtree breadth-first and the subtrees below it
+// become treelets visited depth-first
+static void cluster_nodes(std::vector<QBVHNode> *nodes, int treelet_size)
+{
+  const int NNODES = static_cast<int>(nodes->size());
+  std::vector<int> new_ids(NNODES, -1);
+  std::vector<int> order;
+  order.reserve(NNODES);
+
+  std::vector<int> roots(1, 0);
+  std::vector<int> treelet;
+  std::vector<int> frontier;
+
+  while (!roots.empty()) {
+    const int root = roots.back();
+    roots.pop_back();
+
+    treelet.assign(1, root);
+    frontier.clear();
+    for (std::size_t i = 0; i < treelet.size(); i++) {
+      const int id = treelet[i];
+      new_ids[id] = static_cast<int>(order.size());
+      order.push_back(id);
+
+      const QBVHNode &node = (*nodes)[id];
+      for (int lane = 0; lane < 4; lane++) {
+        if (node.child[lane] < 0 || node.count[lane] > 0) {
+          continue;
+        }
+        if (static_cast<int>(treelet.size()) < treelet_size) {
+          treelet.push_back(node.child[lane]);
+        } else {
+          frontier.push_back(node.child[lane]);
+        }
+      }
+    }
+
+    // the first subtree is clustered next
+    roots.insert(roots.end(), frontier.rbegin(), frontier.rend());
+  }
+
+  std::vector<QBVHNode> clustered(NNODES);
+  for (int i = 0; i < NNODES; i++) {
+    QBVHNode &node = clustered[i];
+    node = (*nodes)[order[i]];
+    for (int lane = 0; lane < 4; lane++) {
+      if (node.child[lane] >= 0 && node.count[lane] == 0) {
+        node.child[lane] = new_ids[node.child[lane]];
+      }
+    }
+  }
+  nodes->swap(clustered);
+}
+
+static void setup_traversal_ray(const Ray &ray, QuadTraversalRay *tray)
+{
+  Real pad = 0;
+
+  for (int i = 0; i < 3; i++) {
+    const Real inv_dir = 1 / ray.dir[i];
+
+    tray->orig[i] = static_cast<float>(ray.orig[i]);
+    tray->inv_dir[i] = static_cast<float>(inv_dir);
+    tray->near_side[i] = inv_dir < 0 ? 1 : 0;
+
+    if (std::isfinite(inv_dir)) {
+      pad = std::max(pad, std::abs(ray.orig[i] * inv_dir));
+    }
+  }
+  tray->tpad = static_cast<float>(pad * ORIGIN_EPSILON);
+
+#if defined(FJ_QBVH_SSE)
+  for (int i = 0; i < 3; i++) {
+    tray->orig4[i] = _mm_set1_ps(tray->orig[i]);
+    tray->inv_dir4[i] = _mm_set1_ps(tray->inv_dir[i]);
+  }
+#endif
+}
+
+// Tests the ray against all four child boxes. returns a bit mask of hit
+// children and stores the entry distance of each child in tnear.
+static int intersect_children(const QBVHNode &node, const QuadTraversalRay &tray,
+    float ray_tmin, float ray_tmax, float *tnear)
+{
+  return intersect_bounds(node.bounds, tray, ray_tmin, ray_tmax, tnear);
+}
+
+static int intersect_children(const CompressedQBVHNode &node, const QuadTraversalRay &tray,
+    float ray_tmin, float ray_tmax, float *tnear)
+{
+  float bounds[2][3][4];
+
+  for (int i = 0; i < 3; i++) {
+    const float scale = cell_size(node.exponent[i]);
+#if defined(FJ_QBVH_SSE)
+    const __m128 origin4 = _mm_set1_ps(node.origin[i]);
+    const __m128 scale4 = _mm_set1_ps(scale);
+    const __m128i zero = _mm_setzero_si128();
+    for (int side = 0; side < 2; side++) {
+      int32_t packed = 0;
+      memcpy(&packed, node.qbounds[side][i], sizeof(packed));
+      const __m128i q8 = _mm_cvtsi32_si128(packed);
+      const __m128i q32 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(q8, zero), zero);
+      const __m128 q = _mm_cvtepi32_ps(q32);
+      _mm_storeu_ps(bounds[side][i], _mm_add_ps(origin4, _mm_mul_ps(q, scale4)));
+    }
+#else
+    for (int side = 0; side < 2; side++) {
+      for (int j = 0; j < 4; j++) {
+        bounds[side][i][j] = decode_bound(node.origin[i], scale, node.qbounds[side][i][j]);
+      }
+    }
+#endif
+  }
+
+  return intersect_bounds(bounds, tray, ray_tmin, ray_tmax, tnear);
+}
+
+static int intersect_bounds(const float (*bounds)[3][4], const QuadTraversalRay &tray,
+    float ray_tmin, float ray_tmax, float *tnear)
+{
+#if defined(FJ_QBVH_SSE)
+  __m128 tmin = _mm_set1_ps(ray_tmin);
+  __m128 tmax = _mm_set1_ps(ray_tmax);
+
+  for (int i = 0; i < 3; i++) {
+    const int near_side = tray.near_side[i];
+    const __m128 bnear = _mm_loadu_ps(bounds[near_side][i]);
+    const __m128 bfar  = _mm_loadu_ps(bounds[1 - near_side][i]);
+    const __m128 t0 = _mm_mul_ps(_mm_sub_ps(bnear, tray.orig4[i]), tray.inv_dir4[i]);
+    const __m128 t1 = _mm_mul_ps(_mm_sub_ps(bfar,  tray.orig4[i]), tray.inv_dir4[i]);
+    // NaN from 0 * inf is in the first operand so it doesn't narrow the range
+    tmin = _mm_max_ps(t0, tmin);
+    tmax = _mm_min_ps(t1, tmax);
+  }
+
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 eps = _mm_set1_ps(T_RELATIVE_EPSILON);
+  const __m128 tpad = _mm_set1_ps(tray.tpad);
+  tmin = _mm_sub_ps(tmin, _mm_add_ps(tpad, _mm_mul_ps(_mm_and_ps(tmin, abs_mask), eps)));
+  tmax = _mm_add_ps(tmax, _mm_add_ps(tpad, _mm_mul_ps(_mm_and_ps(tmax, abs_mask), eps)));
+
+  _mm_storeu_ps(tnear, tmin);
+  return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+#else
+  int hit_mask = 0;
+
+  for (int j = 0; j < 4; j++) {
+    float tmin = ray_tmin;
+    float tmax = ray_tmax;
+
+    for (int i = 0; i < 3; i++) {
+      const int near_side = tray.near_side[i];
+      const float t0 = (bounds[near_side][i][j]     - tray.orig[i]) * tray.inv_dir[i];
+      const float t1 = (bounds[1 - near_side][i][j] - tray.orig[i]) * tray.inv_dir[i];
+      // written so that NaN from 0 * inf doesn't narrow the range
+      tmin = t0 > tmin ? t0 : tmin;
+      tmax = t1 < tmax ? t1 : tmax;
+    }
+
+    tmin -= tray.tpad + std::abs(tmin) * T_RELATIVE_EPSILON;
+    tmax += tray.tpad + std::abs(tmax) * T_RELATIVE_EPSILON;
+
+    tnear[j] = tmin;
+    if (tmin <= tmax) {
+      hit_mask |= 1 << j;
+    }
+  }
+
+  return hit_mask;
+#endif
+}
+
+} // namespace xxx
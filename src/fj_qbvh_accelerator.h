@@ -0,0 +1,147 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_QBVH_ACCELERATOR_H
+#define FJ_QBVH_ACCELERATOR_H
+
+#include "fj_accelerator.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace fj {
+
+// 4-wide node collapsed from binary BVH. child bounds are stored per axis
+// so that four boxes can be tested at once. bounds are rounded outward to float.
+class QBVHNode {
+public:
+  QBVHNode();
+  ~QBVHNode() {}
+
+  // [0] min, [1] max for each axis and child
+  float bounds[2][3][4];
+  // leaf: index of the first primitive in ordered primitive array
+  // interior: index of the child node
+  // empty: -1
+  int32_t child[4];
+  // leaf: number of primitives. interior or empty: 0
+  int32_t count[4];
+};
+
+// 64-byte node of child bounds quantized to 8 bits in the bounds of the node.
+// cells of the grid are powers of two so that bounds decode exactly in float.
+// quantized bounds are rounded outward.
+class CompressedQBVHNode {
+public:
+  CompressedQBVHNode();
+  ~CompressedQBVHNode() {}
+
+  // min of the node bounds
+  float origin[3];
+  // same as QBVHNode
+  int32_t child[4];
+  // [0] min, [1] max for each axis and child in cells from origin
+  uint8_t qbounds[2][3][4];
+  // cell size is 2^exponent for each axis
+  int8_t exponent[3];
+  // leaf: number of primitives. interior or empty: 0
+  uint8_t count[4];
+  uint8_t padding[5];
+};
+
+// nodes bigger than this in megabytes are compressed
+const Real QBVH_DEFAULT_COMPRESSION_THRESHOLD = 256;
+
+// QBVH_LAYOUT_CLUSTERED stores nodes in page sized treelets. nodes of a
+// treelet are the top levels of its subtree in breadth-first order and
+// treelets of sibling subtrees follow one another, so the top levels of
+// the tree are packed together and a traversal touches fewer pages.
+// parents are always before their children in both layouts
+enum QBVHNodeLayout {
+  QBVH_LAYOUT_DEPTH_FIRST = 0,
+  QBVH_LAYOUT_CLUSTERED
+};
+
+class QBVHAccelerator : public Accelerator {
+public:
+  QBVHAccelerator();
+  ~QBVHAccelerator();
+
+  // BVH_BUILD_MEDIAN, BVH_BUILD_SAH or BVH_BUILD_SBVH. returns -1 if mode
+  // is invalid
+  int SetBuildMode(int build_mode);
+  int GetBuildMode() const;
+
+  // references added by BVH_BUILD_SBVH relative to the number of primitives.
+  // returns -1 if budget is negative
+  int SetSplitBudget(Real split_budget);
+  Real GetSplitBudget() const;
+
+  // max number of primitives in a leaf. returns -1 if size is invalid
+  int SetLeafSize(int leaf_size);
+  int GetLeafSize() const;
+
+  // directory of cached trees. cache is not used if dir is empty
+  void SetCacheDirectory(const std::string &dir);
+  const std::string &GetCacheDirectory() const;
+
+  // nodes are stored as CompressedQBVHNode when the uncompressed ones take
+  // more than threshold megabytes. 0 always compresses. returns -1 if
+  // threshold is negative
+  int SetCompressionThreshold(Real threshold);
+  Real GetCompressionThreshold() const;
+
+  // QBVH_LAYOUT_DEPTH_FIRST or QBVH_LAYOUT_CLUSTERED. returns -1 if layout
+  // is invalid
+  int SetNodeLayout(int node_layout);
+  int GetNodeLayout() const;
+
+  // traversal prefetches nodes of children pushed to the stack
+  void SetPrefetch(bool prefetch);
+  bool IsPrefetching() const;
+
+  int GetNodeCount() const;
+  bool IsCompressed() const;
+
+private:
+  virtual int build();
+  // compressed nodes are not refit
+  virtual int refit();
+  virtual bool intersect(const Ray &ray, Real time, Intersection *isect) const;
+  virtual bool occlude(const Ray &ray, Real time, Intersection *isect) const;
+  virtual const char *get_name() const;
+  virtual std::size_t get_memory_usage() const;
+  virtual bool has_same_settings(const Accelerator &other) const;
+  virtual int analyze(AcceleratorStats *stats) const;
+
+  // walks either type of node
+  template <typename Node>
+  void analyze_nodes(const std::vector<Node> &nodes, AcceleratorStats *stats) const;
+  // traversals of either type of node
+  template <typename Node>
+  bool intersect_nodes(const std::vector<Node> &nodes,
+      const Ray &ray, Real time, Intersection *isect) const;
+  template <typename Node>
+  bool occlude_nodes(const std::vector<Node> &nodes,
+      const Ray &ray, Real time, Intersection *isect) const;
+
+  // empty if compressed
+  std::vector<QBVHNode> nodes_;
+  // empty unless compressed
+  std::vector<CompressedQBVHNode> compressed_nodes_;
+  std::vector<Index> prim_indices_;
+  int build_mode_;
+  int leaf_size_;
+  Real split_budget_;
+  Real compression_threshold_;
+  int node_layout_;
+  bool prefetch_;
+  std::string cache_dir_;
+  Index prim_count_;
+  // surface area cost of the tree at build relative to the root
+  Real built_cost_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,164 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_radiance_cache.h"
+#include "fj_numeric.h"
+#include <cmath>
+
+namespace fj {
+
+// cells are used after this many samples are averaged
+static const uint32_t MIN_SAMPLE_COUNT = 32;
+// stops adding samples to converged cells to save atomic writes
+static const uint32_t MAX_SAMPLE_COUNT = 1024;
+// entries looked up from the hashed slot before giving up
+static const int MAX_PROBE_COUNT = 8;
+
+static void atomic_add(std::atomic<float> &sum, float value)
+{
+  float old_sum = sum.load(std::memory_order_relaxed);
+  while (!sum.compare_exchange_weak(old_sum, old_sum + value,
+      std::memory_order_relaxed)) {
+  }
+}
+
+static uint64_t hash_uint64(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+RadianceCache::RadianceCache() : entries_(), inv_cell_size_(0)
+{
+}
+
+RadianceCache::~RadianceCache()
+{
+}
+
+void RadianceCache::Init(Real cell_size, int entry_count)
+{
+  if (cell_size <= 0 || entry_count < 1) {
+    std::vector<Entry>().swap(entries_);
+    inv_cell_size_ = 0;
+    return;
+  }
+
+  std::vector<Entry>(entry_count).swap(entries_);
+  inv_cell_size_ = 1. / cell_size;
+}
+
+bool RadianceCache::IsEnabled() const
+{
+  return !entries_.empty();
+}
+
+bool RadianceCache::Lookup(const Vector &P, const Vector &N, int depth,
+    Color *radiance) const
+{
+  if (!IsEnabled()) {
+    return false;
+  }
+
+  const Entry *entry = find_entry(compute_key(P, N, depth));
+  if (entry == NULL) {
+    return false;
+  }
+
+  const uint32_t count = entry->count.load(std::memory_order_relaxed);
+  if (count < MIN_SAMPLE_COUNT) {
+    return false;
+  }
+
+  // sums may have one more sample than the count. it is negligible
+  const float inv_count = 1.f / count;
+  radiance->r = entry->r.load(std::memory_order_relaxed) * inv_count;
+  radiance->g = entry->g.load(std::memory_order_relaxed) * inv_count;
+  radiance->b = entry->b.load(std::memory_order_relaxed) * inv_count;
+
+  return true;
+}
+
+void RadianceCache::Add(const Vector &P, const Vector &N, int depth,
+    const Color &radiance)
+{
+  if (!IsEnabled()) {
+    return;
+  }
+
+  Entry *entry = insert_entry(compute_key(P, N, depth));
+  if (entry == NULL) {
+    return;
+  }
+  if (entry->count.load(std::memory_order_relaxed) >= MAX_SAMPLE_COUNT) {
+    return;
+  }
+
+  atomic_add(entry->r, radiance.r);
+  atomic_add(entry->g, radiance.g);
+  atomic_add(entry->b, radiance.b);
+  entry->count.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t RadianceCache::compute_key(const Vector &P, const Vector &N, int depth) const
+{
+  // normals are binned by the axis and sign of the largest component
+  int axis = 0;
+  if (Abs(N[1]) > Abs(N[axis])) axis = 1;
+  if (Abs(N[2]) > Abs(N[axis])) axis = 2;
+  const uint64_t dir = 2 * axis + (N[axis] < 0);
+
+  const uint64_t x = static_cast<int64_t>(std::floor(P[0] * inv_cell_size_));
+  const uint64_t y = static_cast<int64_t>(std::floor(P[1] * inv_cell_size_));
+  const uint64_t z = static_cast<int64_t>(std::floor(P[2] * inv_cell_size_));
+
+  const uint64_t cell = hash_uint64(
+      (x & 0x1FFFFF) | (y & 0x1FFFFF) << 21 | (z & 0x1FFFFF) << 42);
+  const uint64_t layer = 6 * static_cast<uint64_t>(depth) + dir;
+
+  // 0 is for empty entries
+  const uint64_t key = cell ^ hash_uint64(layer + 1);
+  return key == 0 ? 1 : key;
+}
+
+const RadianceCache::Entry *RadianceCache::find_entry(uint64_t key) const
+{
+  const std::size_t N = entries_.size();
+
+  for (int i = 0; i < MAX_PROBE_COUNT; i++) {
+    const Entry &entry = entries_[(key + i) % N];
+    const uint64_t entry_key = entry.key.load(std::memory_order_acquire);
+    if (entry_key == key) {
+      return &entry;
+    }
+    if (entry_key == 0) {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+RadianceCache::Entry *RadianceCache::insert_entry(uint64_t key)
+{
+  const std::size_t N = entries_.size();
+
+  for (int i = 0; i < MAX_PROBE_COUNT; i++) {
+    Entry &entry = entries_[(key + i) % N];
+    uint64_t entry_key = entry.key.load(std::memory_order_acquire);
+    if (entry_key == 0 &&
+        entry.key.compare_exchange_strong(entry_key, key, std::memory_order_acq_rel)) {
+      return &entry;
+    }
+    // entry_key is the key of the thread claiming it first if failed
+    if (entry_key == key) {
+      return &entry;
+    }
+  }
+  return NULL;
+}
+
+} // namespace xxx
@@ -0,0 +1,58 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_RADIANCE_CACHE_H
+#define FJ_RADIANCE_CACHE_H
+
+#include "fj_compatibility.h"
+#include "fj_vector.h"
+#include "fj_color.h"
+#include "fj_types.h"
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+namespace fj {
+
+// A hash grid of incoming diffuse radiance averaged over world space cells
+// and six directions of normals. filled lazily by shaders while rendering
+// and shared by all threads with no lock. each diffuse depth has cells of
+// its own since deeper bounces are traced with fewer bounces left. what
+// cells have depends on the order threads add to them, so
+// renders with the cache are not repeatable
+class FJ_API RadianceCache {
+public:
+  RadianceCache();
+  ~RadianceCache();
+
+  // clears the cache. cell_size <= 0 disables it
+  void Init(Real cell_size, int entry_count);
+  bool IsEnabled() const;
+
+  // returns false until the cell has enough radiance added
+  bool Lookup(const Vector &P, const Vector &N, int depth, Color *radiance) const;
+  void Add(const Vector &P, const Vector &N, int depth, const Color &radiance);
+
+private:
+  class Entry {
+  public:
+    Entry() : key(0), count(0), r(0), g(0), b(0) {}
+    ~Entry() {}
+
+    std::atomic<uint64_t> key;
+    std::atomic<uint32_t> count;
+    std::atomic<float> r, g, b;
+  };
+
+  uint64_t compute_key(const Vector &P, const Vector &N, int depth) const;
+  // NULL if the entry is not found and not inserted
+  const Entry *find_entry(uint64_t key) const;
+  Entry *insert_entry(uint64_t key);
+
+  std::vector<Entry> entries_;
+  Real inv_cell_size_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
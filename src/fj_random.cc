@@ -155,7 +155,120 @@ double XorShift::GaussianRand()
     }
   }
 
-  return P[0] * sqrt(-2 * log(dot) / dot);
+  return P[0] * sqrt(-2 * Log(dot) / dot);
+}
+
+static uint32_t hash_uint32(uint32_t x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x;
+}
+
+static uint32_t reverse_bits(uint32_t x)
+{
+  x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+  x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+  x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// Practical Hash-based Owen Scrambling (Burley 2020). each bit is flipped
+// depending only on the bits above it
+static uint32_t owen_scramble(uint32_t x, uint32_t seed)
+{
+  x = reverse_bits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cU;
+  x ^= x * 0xb82f1e52U;
+  x ^= x * 0xc7afe638U;
+  x ^= x * 0x8d22f6e6U;
+  return reverse_bits(x);
+}
+
+// the first two dimensions of Sobol
+static uint32_t sobol0(uint32_t index)
+{
+  return reverse_bits(index);
+}
+
+static uint32_t sobol1(uint32_t index)
+{
+  uint32_t v = 1U << 31;
+  uint32_t x = 0;
+
+  for (; index != 0; index >>= 1) {
+    if (index & 1) {
+      x ^= v;
+    }
+    v ^= v >> 1;
+  }
+  return x;
+}
+
+static double to_float01(uint32_t x)
+{
+  // never reaches 1
+  return x * (1. / 4294967296.);
+}
+
+SampleSequence::SampleSequence() :
+  type_(SAMPLE_SEQUENCE_RANDOM),
+  index_(0),
+  seed_(0),
+  dimension_(0),
+  rng_(NULL)
+{
+}
+
+void SampleSequence::Start(int type, uint32_t index, uint32_t seed, XorShift *rng)
+{
+  type_ = type;
+  index_ = index;
+  seed_ = seed;
+  dimension_ = 0;
+  rng_ = rng;
+}
+
+int SampleSequence::GetDimension() const
+{
+  return dimension_;
+}
+
+double SampleSequence::Next1D()
+{
+  if (type_ != SAMPLE_SEQUENCE_SOBOL) {
+    dimension_++;
+    return rng_->NextFloat01();
+  }
+
+  const uint32_t seed = hash_uint32(seed_ ^ hash_uint32(dimension_));
+  const uint32_t index = owen_scramble(index_, seed);
+  dimension_++;
+
+  return to_float01(owen_scramble(sobol0(index), hash_uint32(seed + 1)));
+}
+
+Vector2 SampleSequence::Next2D()
+{
+  if (type_ != SAMPLE_SEQUENCE_SOBOL) {
+    dimension_ += 2;
+    const double x = rng_->NextFloat01();
+    const double y = rng_->NextFloat01();
+    return Vector2(x, y);
+  }
+
+  const uint32_t seed = hash_uint32(seed_ ^ hash_uint32(dimension_));
+  const uint32_t index = owen_scramble(index_, seed);
+  dimension_ += 2;
+
+  return Vector2(
+      to_float01(owen_scramble(sobol0(index), hash_uint32(seed + 1))),
+      to_float01(owen_scramble(sobol1(index), hash_uint32(seed + 2))));
 }
 
 } // namespace xxx
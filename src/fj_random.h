@@ -34,6 +34,37 @@ public:
   uint32_t state[4];
 };
 
+enum SampleSequenceType {
+  SAMPLE_SEQUENCE_RANDOM = 0,
+  // Owen scrambled Sobol points. each draw is of its own pair of dimensions
+  // shuffled and scrambled with its own seed (padding) so samples of a
+  // pixel are stratified in every pair
+  SAMPLE_SEQUENCE_SOBOL
+};
+
+// Numbers of a camera sample in dimension order. the random sequence draws
+// from rng. see SampleSequenceType
+class FJ_API SampleSequence {
+public:
+  SampleSequence();
+  ~SampleSequence() {}
+
+  // index is of the sample in its pixel and seed is of the pixel
+  void Start(int type, uint32_t index, uint32_t seed, XorShift *rng);
+
+  // dimensions drawn since Start()
+  int GetDimension() const;
+  double Next1D();
+  Vector2 Next2D();
+
+private:
+  int type_;
+  uint32_t index_;
+  uint32_t seed_;
+  int dimension_;
+  XorShift *rng_;
+};
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
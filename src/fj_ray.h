@@ -6,12 +6,16 @@
 
 #include "fj_vector.h"
 #include "fj_types.h"
+#include <limits>
 
 namespace fj {
 
+// rounding errors of hit points in units of the largest coordinate
+const int RAY_ORIGIN_OFFSET_ULPS = 16;
+
 class Ray {
 public:
-  Ray() : orig(), dir(0, 0, 1), tmin(.001), tmax(1000) {}
+  Ray() : orig(), dir(0, 0, 1), tmin(.001), tmax(1000), group_mask(~0U) {}
   ~Ray() {}
 
   Vector orig;
@@ -19,6 +23,10 @@ public:
 
   Real tmin;
   Real tmax;
+
+  // instances are hit only if their group mask shares a kind bit and a
+  // group bit with it. see GROUP_MASK_* in fj_object_group.h
+  unsigned int group_mask;
 };
 
 inline Vector RayPointAt(const Ray &ray, Real t)
@@ -31,6 +39,71 @@ inline bool RayInRange(const Ray &ray, Real t)
   return ray.tmin <= t && t <= ray.tmax;
 }
 
+// distance from a hit point within which secondary rays may hit the same
+// surface again by rounding of the hit point. it grows with the distance
+// from the world origin. far below fixed offsets in double precision but
+// above them far from the origin in single precision
+inline Real RayOriginOffset(const Vector &orig)
+{
+  const Real EPS = std::numeric_limits<Real>::epsilon();
+  const Real x = orig.x < 0 ? -orig.x : orig.x;
+  const Real y = orig.y < 0 ? -orig.y : orig.y;
+  const Real z = orig.z < 0 ? -orig.z : orig.z;
+  return RAY_ORIGIN_OFFSET_ULPS * EPS * (x > y ? (x > z ? x : z) : (y > z ? y : z));
+}
+
+// Ray for traversal of box trees with the inverse direction and the signs of
+// the direction computed once per ray. near_side is 1 where the direction is
+// negative (including -0) so that bounds[near_side] is the near side of a box.
+class TraversalRay {
+public:
+  TraversalRay() : orig(), inv_dir(), near_side() {}
+  explicit TraversalRay(const Ray &ray) :
+      orig(ray.orig),
+      inv_dir(1 / ray.dir[0], 1 / ray.dir[1], 1 / ray.dir[2]),
+      near_side()
+  {
+    for (int i = 0; i < 3; i++) {
+      near_side[i] = inv_dir[i] < 0;
+    }
+  }
+  ~TraversalRay() {}
+
+  Vector orig;
+  Vector inv_dir;
+  int near_side[3];
+};
+
+// Slab test of the box between bmin and bmax (anything indexable by axis)
+// against the range of the ray. there are no branches in the loop: the near
+// and far sides are picked by near_side and the range is narrowed with min/max.
+// Robust for axis parallel rays: infinite inverses give infinite distances,
+// and NaN from 0 * inf when the origin is on a slab plane doesn't narrow the
+// range. far distances are scaled up by the rounding bound of the three
+// operations (Ize 2013) so boxes are never missed by rounding.
+template <typename Bounds>
+inline bool RayBoxIntersect(const TraversalRay &ray,
+    const Bounds &bmin, const Bounds &bmax,
+    Real ray_tmin, Real ray_tmax, Real *hit_tmin, Real *hit_tmax)
+{
+  const Real EPS = std::numeric_limits<Real>::epsilon() / 2;
+  const Real TMAX_SCALE = 1 + 2 * (3 * EPS / (1 - 3 * EPS));
+  const Bounds *bounds[2] = {&bmin, &bmax};
+  Real tmin = ray_tmin;
+  Real tmax = ray_tmax;
+
+  for (int i = 0; i < 3; i++) {
+    const Real t0 = ((*bounds[ray.near_side[i]])[i] - ray.orig[i]) * ray.inv_dir[i];
+    const Real t1 = ((*bounds[1 - ray.near_side[i]])[i] - ray.orig[i]) * ray.inv_dir[i];
+    tmin = t0 > tmin ? t0 : tmin;
+    tmax = t1 * TMAX_SCALE < tmax ? t1 * TMAX_SCALE : tmax;
+  }
+
+  *hit_tmin = tmin;
+  *hit_tmax = tmax;
+  return tmin <= tmax;
+}
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
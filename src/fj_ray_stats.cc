@@ -0,0 +1,162 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_ray_stats.h"
+
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <cstdio>
+
+namespace fj {
+
+static const char *CONTEXT_NAMES[RAY_STATS_CONTEXT_COUNT] = {
+  "Camera",
+  "Shadow",
+  "Diffuse",
+  "Reflect",
+  "Refract"
+};
+
+#if defined(FJ_RAY_STATS)
+// counters of running threads and the sum of counters of finished threads
+static std::vector<RayStats *> thread_stats_list;
+static RayStats finished_thread_stats;
+static std::mutex thread_stats_mtx;
+
+// registers the counters of a thread while it lives
+class ThreadRayStats {
+public:
+  ThreadRayStats() : stats()
+  {
+    std::lock_guard<std::mutex> lock(thread_stats_mtx);
+    thread_stats_list.push_back(&stats);
+  }
+  ~ThreadRayStats()
+  {
+    std::lock_guard<std::mutex> lock(thread_stats_mtx);
+    finished_thread_stats.Add(stats);
+    thread_stats_list.erase(
+        std::find(thread_stats_list.begin(), thread_stats_list.end(), &stats));
+  }
+
+  RayStats stats;
+};
+
+RayStats &RayStatsGetThreadLocal()
+{
+  static thread_local ThreadRayStats thread_stats;
+  return thread_stats.stats;
+}
+#endif
+
+RayStats::RayStats()
+{
+  Clear();
+}
+
+void RayStats::Clear()
+{
+  for (int i = 0; i < RAY_STATS_CONTEXT_COUNT; i++) {
+    ray_count[i] = 0;
+  }
+  surface_query_count = 0;
+  surface_hit_count = 0;
+  surface_node_visit_count = 0;
+  surface_primitive_test_count = 0;
+  surface_stack_depth_sum = 0;
+  volume_query_count = 0;
+  volume_hit_count = 0;
+  volume_node_visit_count = 0;
+  volume_primitive_test_count = 0;
+}
+
+void RayStats::Add(const RayStats &other)
+{
+  for (int i = 0; i < RAY_STATS_CONTEXT_COUNT; i++) {
+    ray_count[i] += other.ray_count[i];
+  }
+  surface_query_count += other.surface_query_count;
+  surface_hit_count += other.surface_hit_count;
+  surface_node_visit_count += other.surface_node_visit_count;
+  surface_primitive_test_count += other.surface_primitive_test_count;
+  surface_stack_depth_sum += other.surface_stack_depth_sum;
+  volume_query_count += other.volume_query_count;
+  volume_hit_count += other.volume_hit_count;
+  volume_node_visit_count += other.volume_node_visit_count;
+  volume_primitive_test_count += other.volume_primitive_test_count;
+}
+
+bool RayStatsIsEnabled()
+{
+#if defined(FJ_RAY_STATS)
+  return true;
+#else
+  return false;
+#endif
+}
+
+void RayStatsGather(RayStats *stats)
+{
+  stats->Clear();
+
+#if defined(FJ_RAY_STATS)
+  std::lock_guard<std::mutex> lock(thread_stats_mtx);
+  stats->Add(finished_thread_stats);
+  for (size_t i = 0; i < thread_stats_list.size(); i++) {
+    stats->Add(*thread_stats_list[i]);
+  }
+#endif
+}
+
+void RayStatsReset()
+{
+#if defined(FJ_RAY_STATS)
+  std::lock_guard<std::mutex> lock(thread_stats_mtx);
+  finished_thread_stats.Clear();
+  for (size_t i = 0; i < thread_stats_list.size(); i++) {
+    thread_stats_list[i]->Clear();
+  }
+#endif
+}
+
+static double safe_div(int64_t a, int64_t b)
+{
+  return b == 0 ? 0. : static_cast<double>(a) / b;
+}
+
+void RayStatsPrint(const RayStats &stats)
+{
+  int64_t total_rays = 0;
+  for (int i = 0; i < RAY_STATS_CONTEXT_COUNT; i++) {
+    total_rays += stats.ray_count[i];
+  }
+
+  printf("# Ray Stats\n");
+  printf("#   Rays:              %12lld\n", static_cast<long long>(total_rays));
+  for (int i = 0; i < RAY_STATS_CONTEXT_COUNT; i++) {
+    printf("#     %-8s         %12lld\n", CONTEXT_NAMES[i],
+        static_cast<long long>(stats.ray_count[i]));
+  }
+  printf("#   Surface Queries:   %12lld\n",
+      static_cast<long long>(stats.surface_query_count));
+  printf("#     Hits:            %12lld\n",
+      static_cast<long long>(stats.surface_hit_count));
+  printf("#     Nodes/Query:     %12.2f\n",
+      safe_div(stats.surface_node_visit_count, stats.surface_query_count));
+  printf("#     Prims/Query:     %12.2f\n",
+      safe_div(stats.surface_primitive_test_count, stats.surface_query_count));
+  printf("#     Avg Stack Depth: %12.2f\n",
+      safe_div(stats.surface_stack_depth_sum, stats.surface_query_count));
+  printf("#   Volume Queries:    %12lld\n",
+      static_cast<long long>(stats.volume_query_count));
+  printf("#     Hits:            %12lld\n",
+      static_cast<long long>(stats.volume_hit_count));
+  printf("#     Nodes/Query:     %12.2f\n",
+      safe_div(stats.volume_node_visit_count, stats.volume_query_count));
+  printf("#     Prims/Query:     %12.2f\n",
+      safe_div(stats.volume_primitive_test_count, stats.volume_query_count));
+  printf("\n");
+}
+
+} // namespace xxx
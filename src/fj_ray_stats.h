@@ -0,0 +1,67 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_RAY_STATS_H
+#define FJ_RAY_STATS_H
+
+#include "fj_compatibility.h"
+#include <cstdint>
+
+// Counting is compiled in only when FJ_RAY_STATS is defined
+// e.g. make RAY_STATS=1. otherwise FJ_RAY_STATS_ADD expands to nothing
+// and the query functions return zeros.
+
+namespace fj {
+
+// the same order as CXT_* ray contexts in fj_shading.h
+const int RAY_STATS_CONTEXT_COUNT = 5;
+
+class FJ_API RayStats {
+public:
+  RayStats();
+  ~RayStats() {}
+
+  void Clear();
+  void Add(const RayStats &other);
+
+public:
+  // rays traced by SlTrace for each ray context
+  int64_t ray_count[RAY_STATS_CONTEXT_COUNT];
+
+  // Accelerator::Intersect and Occlude including nested ones for instances
+  int64_t surface_query_count;
+  int64_t surface_hit_count;
+  int64_t surface_node_visit_count;
+  int64_t surface_primitive_test_count;
+  // sum of the deepest traversal stack of each query
+  int64_t surface_stack_depth_sum;
+
+  // VolumeAccIntersect
+  int64_t volume_query_count;
+  int64_t volume_hit_count;
+  int64_t volume_node_visit_count;
+  int64_t volume_primitive_test_count;
+};
+
+FJ_API bool RayStatsIsEnabled();
+// sums counters of all threads. call when no thread is rendering
+FJ_API void RayStatsGather(RayStats *stats);
+FJ_API void RayStatsReset();
+FJ_API void RayStatsPrint(const RayStats &stats);
+
+#if defined(FJ_RAY_STATS)
+// counters of the calling thread. no lock after the first call in a thread
+FJ_API RayStats &RayStatsGetThreadLocal();
+
+#define FJ_RAY_STATS_ADD(member, n) (fj::RayStatsGetThreadLocal().member += (n))
+#define FJ_RAY_STATS_MAX(local, value) ((local) = (local) > (value) ? (local) : (value))
+#define FJ_RAY_STATS_LOCAL(decl) decl
+#else
+#define FJ_RAY_STATS_ADD(member, n) ((void) 0)
+#define FJ_RAY_STATS_MAX(local, value) ((void) 0)
+#define FJ_RAY_STATS_LOCAL(decl)
+#endif
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
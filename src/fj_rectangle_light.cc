@@ -5,7 +5,7 @@
 
 namespace fj {
 
-RectangleLight::RectangleLight() : rng_()
+RectangleLight::RectangleLight()
 {
 }
 
@@ -18,7 +18,13 @@ int RectangleLight::get_sample_count() const
   return GetSampleDensity();
 }
 
-void RectangleLight::get_samples(LightSample *samples, int max_samples) const
+int RectangleLight::get_sample_set_count() const
+{
+  return LIGHT_SAMPLE_SET_COUNT;
+}
+
+void RectangleLight::get_samples(LightSample *samples, int max_samples,
+    const Vector2 *points) const
 {
   Transform transform_interp;
   // TODO time sampling
@@ -33,10 +39,8 @@ void RectangleLight::get_samples(LightSample *samples, int max_samples) const
   nsamples = Min(nsamples, max_samples);
 
   for (int i = 0; i < nsamples; i++) {
-    XorShift &mutable_rng = const_cast<XorShift &>(rng_);
-    const Real x = mutable_rng.NextFloat01() - .5;
-    const Real z = mutable_rng.NextFloat01() - .5;
-    Vector P_sample(x, 0, z);
+    const Vector2 &uv = points[i];
+    Vector P_sample(uv[0] - .5, 0, uv[1] - .5);
 
     XfmTransformPoint(&transform_interp, &P_sample);
 
@@ -46,6 +50,44 @@ void RectangleLight::get_samples(LightSample *samples, int max_samples) const
   }
 }
 
+bool RectangleLight::has_samples_at() const
+{
+  return true;
+}
+
+int RectangleLight::get_samples_at(LightSample *samples, int max_samples,
+    const Vector2 *points, const Vector &Ps) const
+{
+  // area samples are already stratified on what is seen. only points
+  // behind single sided lights get no samples
+  if (!IsDoulbeSided()) {
+    Transform transform_interp;
+    // TODO time sampling
+    const float time = 0;
+    get_transform_sample(transform_interp, time);
+
+    Vector N_light(0, 1, 0);
+    XfmTransformVector(&transform_interp, &N_light);
+
+    // the same test as illuminate() is the largest at a corner
+    bool is_behind = true;
+    for (int i = 0; i < 4; i++) {
+      Vector corner(i % 2 - .5, 0, i / 2 - .5);
+      XfmTransformPoint(&transform_interp, &corner);
+      if (Dot(Ps - corner, N_light) > 0) {
+        is_behind = false;
+        break;
+      }
+    }
+    if (is_behind) {
+      return 0;
+    }
+  }
+
+  get_samples(samples, max_samples, points);
+  return Min(GetSampleCount(), max_samples);
+}
+
 Color RectangleLight::illuminate(const LightSample &sample, const Vector &Ps) const
 {
   const Vector Ln = Normalize(Ps - sample.P);
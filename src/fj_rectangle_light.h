@@ -16,11 +16,14 @@ public:
 
 private:
   virtual int get_sample_count() const;
-  virtual void get_samples(LightSample *samples, int max_samples) const;
+  virtual int get_sample_set_count() const;
+  virtual void get_samples(LightSample *samples, int max_samples,
+      const Vector2 *points) const;
+  virtual bool has_samples_at() const;
+  virtual int get_samples_at(LightSample *samples, int max_samples,
+      const Vector2 *points, const Vector &Ps) const;
   virtual Color illuminate(const LightSample &sample, const Vector &Ps) const;
   virtual int preprocess();
-
-  XorShift rng_;
 };
 
 } // namespace xxx
@@ -0,0 +1,321 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_render_checkpoint.h"
+#include "fj_framebuffer.h"
+#include "fj_serialize.h"
+#include "fj_tiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+namespace fj {
+
+static const char SIGNATURE[] = "fjckpt";
+static const size_t SIGNATURE_SIZE = 8;
+// increment when the file layout changes
+static const int CHECKPOINT_FILE_VERSION = 1;
+
+// 64-bit FNV-1a
+static const uint64_t HASH_OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t HASH_PRIME = 1099511628211ULL;
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= HASH_PRIME;
+  }
+  return hash;
+}
+
+static void write_signature(std::ofstream &file)
+{
+  char sign[SIGNATURE_SIZE] = {'\0'};
+  strcpy(sign, SIGNATURE);
+  file.write(sign, SIGNATURE_SIZE);
+}
+
+static bool match_signature(std::ifstream &file)
+{
+  char sign[SIGNATURE_SIZE] = {'\0'};
+  file.read(sign, SIGNATURE_SIZE);
+  return file && strncmp(sign, SIGNATURE, SIGNATURE_SIZE) == 0;
+}
+
+// floats in a row of the tile
+static size_t tile_row_size(const Tile *tile, int nchannels)
+{
+  return static_cast<size_t>(tile->xmax - tile->xmin) * nchannels;
+}
+
+uint64_t CheckpointComputeKey(const std::vector<double> &settings)
+{
+  uint64_t hash = HASH_OFFSET_BASIS;
+  hash = hash_bytes(hash, &CHECKPOINT_FILE_VERSION, sizeof(CHECKPOINT_FILE_VERSION));
+  if (!settings.empty()) {
+    hash = hash_bytes(hash, &settings[0], sizeof(double) * settings.size());
+  }
+  return hash;
+}
+
+RenderCheckpoint::RenderCheckpoint() :
+  filename_(),
+  interval_(0),
+  key_(0),
+  tiler_(NULL),
+  framebuffer_(NULL),
+  mutex_(),
+  tile_done_(),
+  finished_(),
+  writing_(false),
+  last_write_()
+{
+}
+
+RenderCheckpoint::~RenderCheckpoint()
+{
+}
+
+int RenderCheckpoint::Start(const std::string &filename, double interval, uint64_t key,
+    const Tiler *tiler, FrameBuffer *framebuffer)
+{
+  filename_ = filename;
+  interval_ = interval;
+  key_ = key;
+  tiler_ = tiler;
+  framebuffer_ = framebuffer;
+
+  tile_done_.assign(tiler_->GetTileCount(), 0);
+  finished_.clear();
+  writing_ = false;
+  last_write_ = std::chrono::steady_clock::now();
+
+  if (read_file()) {
+    // renders from scratch
+    tile_done_.assign(tiler_->GetTileCount(), 0);
+    finished_.clear();
+    return 0;
+  }
+
+  return static_cast<int>(finished_.size());
+}
+
+bool RenderCheckpoint::IsEnabled() const
+{
+  return !filename_.empty() && tiler_ != NULL && framebuffer_ != NULL;
+}
+
+bool RenderCheckpoint::IsTileDone(int tile_id) const
+{
+  if (tile_id < 0 || tile_id >= static_cast<int>(tile_done_.size())) {
+    return false;
+  }
+  return tile_done_[tile_id] != 0;
+}
+
+void RenderCheckpoint::TileDone(int tile_id)
+{
+  if (!IsEnabled()) {
+    return;
+  }
+
+  std::vector<int> finished;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (IsTileDone(tile_id) || tile_id < 0) {
+      return;
+    }
+    tile_done_[tile_id] = 1;
+    finished_.push_back(tile_id);
+
+    const std::chrono::duration<double> elapse =
+        std::chrono::steady_clock::now() - last_write_;
+    // other threads keep rendering while one of them writes
+    if (writing_ || elapse.count() < interval_) {
+      return;
+    }
+    writing_ = true;
+    finished = finished_;
+  }
+
+  if (write_file(finished)) {
+    std::cerr << "* WARNING: could not write checkpoint: " << filename_ << "\n";
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  writing_ = false;
+  last_write_ = std::chrono::steady_clock::now();
+}
+
+void RenderCheckpoint::Finish()
+{
+  if (!IsEnabled()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (finished_.size() == tile_done_.size()) {
+    std::remove(filename_.c_str());
+    return;
+  }
+  if (write_file(finished_)) {
+    std::cerr << "* WARNING: could not write checkpoint: " << filename_ << "\n";
+  }
+}
+
+int RenderCheckpoint::read_file()
+{
+  std::ifstream file(filename_.c_str(), std::fstream::in | std::fstream::binary);
+  if (!file) {
+    return -1;
+  }
+
+  if (!match_signature(file)) {
+    return -1;
+  }
+
+  int version = 0;
+  unsigned long long file_key = 0;
+  int width = 0;
+  int height = 0;
+  int nchannels = 0;
+  int ntiles = 0;
+  int nfinished = 0;
+
+  read_(file, version);
+  file.read(reinterpret_cast<char *>(&file_key), sizeof(file_key));
+  read_(file, width);
+  read_(file, height);
+  read_(file, nchannels);
+  read_(file, ntiles);
+  read_(file, nfinished);
+
+  const int NTILES = tiler_->GetTileCount();
+  if (!file || version != CHECKPOINT_FILE_VERSION || file_key != key_ ||
+      width != framebuffer_->GetWidth() ||
+      height != framebuffer_->GetHeight() ||
+      nchannels != framebuffer_->GetChannelCount() ||
+      ntiles != NTILES || nfinished < 0 || nfinished > NTILES) {
+    return -1;
+  }
+
+  // pixels are read into a copy so that a broken file leaves no trace
+  FrameBuffer restored;
+  restored.Resize(width, height, nchannels);
+  std::vector<char> tile_done(NTILES, 0);
+  std::vector<int> finished;
+  uint64_t hash = HASH_OFFSET_BASIS;
+
+  for (int i = 0; i < nfinished; i++) {
+    int tile_id = -1;
+    read_(file, tile_id);
+    if (!file || tile_id < 0 || tile_id >= NTILES || tile_done[tile_id]) {
+      return -1;
+    }
+    hash = hash_bytes(hash, &tile_id, sizeof(tile_id));
+
+    const Tile *tile = tiler_->GetTile(tile_id);
+    const size_t ROW_SIZE = tile_row_size(tile, nchannels);
+    for (int y = tile->ymin; y < tile->ymax; y++) {
+      float *row = restored.GetWritable(tile->xmin, y, 0);
+      file.read(reinterpret_cast<char *>(row), sizeof(float) * ROW_SIZE);
+      hash = hash_bytes(hash, row, sizeof(float) * ROW_SIZE);
+    }
+
+    tile_done[tile_id] = 1;
+    finished.push_back(tile_id);
+  }
+
+  unsigned long long checksum = 0;
+  file.read(reinterpret_cast<char *>(&checksum), sizeof(checksum));
+  if (!file || checksum != hash) {
+    return -1;
+  }
+
+  for (std::size_t i = 0; i < finished.size(); i++) {
+    const Tile *tile = tiler_->GetTile(finished[i]);
+    for (int y = tile->ymin; y < tile->ymax; y++) {
+      framebuffer_->WriteRow(tile->xmin, y, tile->xmax - tile->xmin,
+          restored.GetReadOnly(tile->xmin, y, 0));
+    }
+  }
+
+  tile_done_.swap(tile_done);
+  finished_.swap(finished);
+
+  return 0;
+}
+
+int RenderCheckpoint::write_file(const std::vector<int> &finished) const
+{
+  // write to a temporary file then rename it so that an interruption
+  // while writing never breaks the last checkpoint
+  const std::string tmpname = filename_ + ".tmp";
+  {
+    std::ofstream file(tmpname.c_str(), std::fstream::out | std::fstream::binary);
+    if (!file) {
+      return -1;
+    }
+
+    const unsigned long long file_key = key_;
+    const int width = framebuffer_->GetWidth();
+    const int height = framebuffer_->GetHeight();
+    const int nchannels = framebuffer_->GetChannelCount();
+    const int ntiles = tiler_->GetTileCount();
+    const int nfinished = static_cast<int>(finished.size());
+    uint64_t hash = HASH_OFFSET_BASIS;
+    std::vector<float> row;
+
+    write_signature(file);
+    write_(file, CHECKPOINT_FILE_VERSION);
+    file.write(reinterpret_cast<const char *>(&file_key), sizeof(file_key));
+    write_(file, width);
+    write_(file, height);
+    write_(file, nchannels);
+    write_(file, ntiles);
+    write_(file, nfinished);
+
+    for (int i = 0; i < nfinished; i++) {
+      const int tile_id = finished[i];
+      write_(file, tile_id);
+      hash = hash_bytes(hash, &tile_id, sizeof(tile_id));
+
+      // rows of finished tiles are no longer written by workers
+      const Tile *tile = tiler_->GetTile(tile_id);
+      const size_t ROW_SIZE = tile_row_size(tile, nchannels);
+      row.resize(ROW_SIZE);
+      for (int y = tile->ymin; y < tile->ymax; y++) {
+        framebuffer_->ReadRow(tile->xmin, y, tile->xmax - tile->xmin, &row[0]);
+        file.write(reinterpret_cast<const char *>(&row[0]), sizeof(float) * ROW_SIZE);
+        hash = hash_bytes(hash, &row[0], sizeof(float) * ROW_SIZE);
+      }
+    }
+
+    const unsigned long long checksum = hash;
+    file.write(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
+
+    if (!file) {
+      file.close();
+      std::remove(tmpname.c_str());
+      return -1;
+    }
+  }
+
+  if (std::rename(tmpname.c_str(), filename_.c_str()) != 0) {
+    // rename doesn't replace existing files on some platforms
+    std::remove(filename_.c_str());
+    if (std::rename(tmpname.c_str(), filename_.c_str()) != 0) {
+      std::remove(tmpname.c_str());
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+} // namespace xxx
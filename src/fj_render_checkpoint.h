@@ -0,0 +1,62 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_RENDER_CHECKPOINT_H
+#define FJ_RENDER_CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+
+namespace fj {
+
+class FrameBuffer;
+class Tiler;
+
+// Saves ids and pixels of finished tiles periodically so that an interrupted
+// render can resume without rendering them again. The file is only used by
+// renders with the same tiling, framebuffer and settings key. The scene is
+// not part of the key.
+class RenderCheckpoint {
+public:
+  RenderCheckpoint();
+  ~RenderCheckpoint();
+
+  // Reads the file if it exists and was made with the same key, and copies
+  // pixels of its tiles into framebuffer. Returns the number of restored tiles.
+  // interval is seconds between writes. 0 writes after every tile.
+  int Start(const std::string &filename, double interval, uint64_t key,
+      const Tiler *tiler, FrameBuffer *framebuffer);
+  bool IsEnabled() const;
+  bool IsTileDone(int tile_id) const;
+
+  // Thread safe. Pixels of the tile must not change after this.
+  void TileDone(int tile_id);
+  // Removes the file if all tiles are done, writes the last state otherwise.
+  void Finish();
+
+private:
+  int read_file();
+  int write_file(const std::vector<int> &finished) const;
+
+  std::string filename_;
+  double interval_;
+  uint64_t key_;
+  const Tiler *tiler_;
+  FrameBuffer *framebuffer_;
+
+  std::mutex mutex_;
+  std::vector<char> tile_done_;
+  std::vector<int> finished_;
+  bool writing_;
+  std::chrono::steady_clock::time_point last_write_;
+};
+
+// Hash of settings that change pixel values.
+extern uint64_t CheckpointComputeKey(const std::vector<double> &settings);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
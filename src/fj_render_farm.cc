@@ -0,0 +1,384 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_render_farm.h"
+#include "fj_framebuffer.h"
+#include "fj_rectangle.h"
+#include "fj_protocol.h"
+#include "fj_tiler.h"
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+namespace fj {
+
+// workers are usually started before the coordinator gets to the frame
+static const int CONNECT_RETRY_COUNT = 60;
+static const int CONNECT_RETRY_SECONDS = 1;
+// how often the listener checks if the coordinator is stopping
+static const int ACCEPT_TIMEOUT_MICRO_SEC = 100000;
+
+static void copy_tile_rows(const FrameBuffer &src, int src_x, int src_y,
+    FrameBuffer &dst, int dst_x, int dst_y, int width, int height)
+{
+  // either may be tiled
+  std::vector<float> row(width * src.GetChannelCount());
+  for (int y = 0; y < height; y++) {
+    src.ReadRow(src_x, src_y + y, width, &row[0]);
+    dst.WriteRow(dst_x, dst_y + y, width, &row[0]);
+  }
+}
+
+FarmCoordinator::FarmCoordinator() :
+  frame_id_(0),
+  tiler_(NULL),
+  framebuffer_(NULL),
+  data_(NULL),
+  tile_start_(NULL),
+  tile_done_(NULL),
+  mutex_(),
+  tile_changed_(),
+  que_(),
+  tile_state_(),
+  done_count_(0),
+  listener_(),
+  listener_thread_(),
+  worker_sockets_(),
+  worker_threads_(),
+  is_stopping_(false),
+  is_aborted_(false)
+{
+}
+
+FarmCoordinator::~FarmCoordinator()
+{
+  Stop();
+}
+
+int FarmCoordinator::Start(int port, int32_t frame_id, const Tiler *tiler,
+    const std::vector<int> &iteration_que, FrameBuffer *framebuffer,
+    void *data, FarmTileStartCallback tile_start, FarmTileDoneCallback tile_done)
+{
+  frame_id_ = frame_id;
+  tiler_ = tiler;
+  framebuffer_ = framebuffer;
+  data_ = data;
+  tile_start_ = tile_start;
+  tile_done_ = tile_done;
+
+  // tiles not in the que are finished already
+  const int NTILES = tiler_->GetTileCount();
+  que_ = iteration_que;
+  tile_state_.assign(NTILES, TILE_DONE);
+  for (std::size_t i = 0; i < que_.size(); i++) {
+    tile_state_[que_[i]] = TILE_UNCLAIMED;
+  }
+  done_count_ = NTILES - static_cast<int>(que_.size());
+
+  is_stopping_ = false;
+  is_aborted_ = false;
+
+  listener_.Open();
+  listener_.SetAddress("");
+  listener_.SetPort(port);
+  listener_.EnableReuseAddr();
+
+  if (listener_.Bind() == -1 || listener_.Listen() == -1) {
+    listener_.Close();
+    return -1;
+  }
+
+  listener_thread_ = std::thread(&FarmCoordinator::accept_workers, this);
+  return 0;
+}
+
+void FarmCoordinator::Stop()
+{
+  if (!listener_thread_.joinable()) {
+    return;
+  }
+
+  is_stopping_ = true;
+  listener_thread_.join();
+
+  {
+    // unblocks workers waiting for requests
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i = 0; i < worker_sockets_.size(); i++) {
+      worker_sockets_[i]->Shutdown();
+    }
+  }
+  for (std::size_t i = 0; i < worker_threads_.size(); i++) {
+    worker_threads_[i].join();
+  }
+  for (std::size_t i = 0; i < worker_sockets_.size(); i++) {
+    delete worker_sockets_[i];
+  }
+  worker_threads_.clear();
+  worker_sockets_.clear();
+
+  listener_.Close();
+}
+
+bool FarmCoordinator::ClaimTile(int tile_id)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (tile_state_[tile_id] != TILE_UNCLAIMED) {
+    return false;
+  }
+  tile_state_[tile_id] = TILE_LOCAL;
+  return true;
+}
+
+void FarmCoordinator::TileDone(int tile_id)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tile_state_[tile_id] = TILE_DONE;
+    done_count_++;
+  }
+  tile_changed_.notify_all();
+}
+
+int FarmCoordinator::WaitForTiles(std::vector<int> *iteration_que)
+{
+  const int NTILES = static_cast<int>(tile_state_.size());
+  iteration_que->clear();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (done_count_ == NTILES || is_aborted_) {
+      return 0;
+    }
+
+    for (std::size_t i = 0; i < que_.size(); i++) {
+      const int tile_id = que_[i];
+      if (tile_state_[tile_id] == TILE_UNCLAIMED) {
+        iteration_que->push_back(tile_id);
+      }
+    }
+    if (!iteration_que->empty()) {
+      return static_cast<int>(iteration_que->size());
+    }
+
+    tile_changed_.wait(lock);
+  }
+}
+
+void FarmCoordinator::Abort()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_aborted_ = true;
+  }
+  tile_changed_.notify_all();
+}
+
+bool FarmCoordinator::IsAborted() const
+{
+  return is_aborted_;
+}
+
+void FarmCoordinator::accept_workers()
+{
+  while (!is_stopping_) {
+    Socket *accepted = new Socket();
+    const socket_id fd =
+        listener_.AcceptOrTimeout(*accepted, 0, ACCEPT_TIMEOUT_MICRO_SEC);
+
+    if (fd == FJ_SOCKET_TIMEOUT || fd == FJ_SOCKET_INVALID) {
+      delete accepted;
+      continue;
+    }
+    accepted->EnableNoDelay();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    worker_sockets_.push_back(accepted);
+    worker_threads_.push_back(std::thread(&FarmCoordinator::serve_worker, this, accepted));
+  }
+}
+
+void FarmCoordinator::serve_worker(Socket *socket)
+{
+  // a worker renders one tile at a time
+  int tile_in_flight = -1;
+
+  for (;;) {
+    Message message;
+    FrameBuffer tile;
+
+    if (ReceiveMessage(*socket, message, tile)) {
+      break;
+    }
+
+    if (message.type == MSG_RENDER_TILE_DONE) {
+      if (message.tile_id != tile_in_flight || receive_tile(tile, tile_in_flight)) {
+        break;
+      }
+      tile_in_flight = -1;
+    }
+    else if (message.type == MSG_RENDER_TILE_REQUEST) {
+      const bool is_same_frame =
+          message.xres == framebuffer_->GetWidth() &&
+          message.yres == framebuffer_->GetHeight() &&
+          message.channel_count == framebuffer_->GetChannelCount() &&
+          message.tile_count == tiler_->GetTileCount();
+
+      if (!is_same_frame || tile_in_flight != -1 || is_aborted_) {
+        if (!is_same_frame) {
+          std::cerr << "* WARNING: farm worker rendering a different frame\n";
+        }
+        SendRenderFrameAbort(*socket, frame_id_);
+        break;
+      }
+
+      const int tile_id = claim_remote_tile();
+      if (tile_id == -1) {
+        SendRenderFrameDone(*socket, frame_id_);
+        break;
+      }
+      tile_in_flight = tile_id;
+
+      if (tile_start_ != NULL && tile_start_(data_, tile_id) == -1) {
+        Abort();
+        SendRenderFrameAbort(*socket, frame_id_);
+        break;
+      }
+
+      const Tile *t = tiler_->GetTile(tile_id);
+      SendRenderTileStart(*socket, frame_id_, tile_id, t->xmin, t->ymin, t->xmax, t->ymax);
+    }
+    else {
+      break;
+    }
+  }
+
+  if (tile_in_flight != -1) {
+    return_tile(tile_in_flight);
+  }
+  socket->Shutdown();
+}
+
+int FarmCoordinator::claim_remote_tile()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (int i = static_cast<int>(que_.size()) - 1; i >= 0; i--) {
+    const int tile_id = que_[i];
+    if (tile_state_[tile_id] == TILE_UNCLAIMED) {
+      tile_state_[tile_id] = TILE_REMOTE;
+      return tile_id;
+    }
+  }
+  return -1;
+}
+
+void FarmCoordinator::return_tile(int tile_id)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tile_state_[tile_id] = TILE_UNCLAIMED;
+  }
+  tile_changed_.notify_all();
+}
+
+int FarmCoordinator::receive_tile(const FrameBuffer &tile, int tile_id)
+{
+  const Tile *t = tiler_->GetTile(tile_id);
+  const int width = t->xmax - t->xmin;
+  const int height = t->ymax - t->ymin;
+
+  if (tile.GetWidth() != width || tile.GetHeight() != height ||
+      tile.GetChannelCount() != framebuffer_->GetChannelCount()) {
+    return -1;
+  }
+  // no other thread writes pixels of the tile
+  copy_tile_rows(tile, 0, 0, *framebuffer_, t->xmin, t->ymin, width, height);
+
+  if (tile_done_ != NULL) {
+    tile_done_(data_, tile_id);
+  }
+  TileDone(tile_id);
+  return 0;
+}
+
+FarmClient::FarmClient() : socket_(), frame_id_(0), is_aborted_(false)
+{
+}
+
+FarmClient::~FarmClient()
+{
+}
+
+int FarmClient::Connect(const std::string &address, int port)
+{
+  for (int i = 0; i < CONNECT_RETRY_COUNT; i++) {
+    socket_.Open();
+    socket_.SetAddress(address);
+    socket_.SetPort(port);
+
+    if (socket_.Connect() != -1) {
+      socket_.EnableNoDelay();
+      return 0;
+    }
+    socket_.Close();
+    std::this_thread::sleep_for(std::chrono::seconds(CONNECT_RETRY_SECONDS));
+  }
+  return -1;
+}
+
+int FarmClient::RequestTile(int xres, int yres, int channel_count, int tile_count,
+    const Tiler &tiler)
+{
+  if (SendRenderTileRequest(socket_, xres, yres, channel_count, tile_count)) {
+    return -1;
+  }
+
+  Message message;
+  FrameBuffer unused;
+  if (ReceiveMessage(socket_, message, unused)) {
+    return -1;
+  }
+
+  if (message.type == MSG_RENDER_FRAME_ABORT) {
+    is_aborted_ = true;
+    return -1;
+  }
+  if (message.type != MSG_RENDER_TILE_START ||
+      message.tile_id < 0 || message.tile_id >= tiler.GetTileCount()) {
+    return -1;
+  }
+
+  const Tile *t = tiler.GetTile(message.tile_id);
+  if (message.xmin != t->xmin || message.ymin != t->ymin ||
+      message.xmax != t->xmax || message.ymax != t->ymax) {
+    return -1;
+  }
+
+  frame_id_ = message.frame_id;
+  return message.tile_id;
+}
+
+int FarmClient::SendTile(int tile_id, const Rectangle &region, const FrameBuffer &framebuffer)
+{
+  const int width = region.Size()[0];
+  const int height = region.Size()[1];
+
+  FrameBuffer tile;
+  tile.Resize(width, height, framebuffer.GetChannelCount());
+  copy_tile_rows(framebuffer, region.min[0], region.min[1], tile, 0, 0, width, height);
+
+  // lossless since the tile goes to the output
+  const int err = SendRenderTileDone(socket_, frame_id_, tile_id,
+      region.min[0], region.min[1], region.max[0], region.max[1], tile,
+      TILE_ENCODING_FLOAT_RLE);
+  return err == -1 ? -1 : 0;
+}
+
+bool FarmClient::IsAborted() const
+{
+  return is_aborted_;
+}
+
+} // namespace xxx
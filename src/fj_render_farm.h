@@ -0,0 +1,114 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_RENDER_FARM_H
+#define FJ_RENDER_FARM_H
+
+#include "fj_socket.h"
+#include "fj_types.h"
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+namespace fj {
+
+class FrameBuffer;
+class Rectangle;
+class Tiler;
+
+// Called from connection threads of the coordinator. tile start returns -1
+// to abort the frame.
+typedef int (*FarmTileStartCallback)(void *data, int tile_id);
+typedef void (*FarmTileDoneCallback)(void *data, int tile_id);
+
+// Shares tiles of a frame between local threads and worker processes that
+// connect to port. Local threads take tiles from the front of the que and
+// workers ask for tiles from the back one at a time, so hosts that finish
+// early keep taking tiles until none is left. Tiles of workers that
+// disconnect go back to the que.
+class FarmCoordinator {
+public:
+  FarmCoordinator();
+  // Stops if started
+  ~FarmCoordinator();
+
+  int Start(int port, int32_t frame_id, const Tiler *tiler,
+      const std::vector<int> &iteration_que, FrameBuffer *framebuffer,
+      void *data, FarmTileStartCallback tile_start, FarmTileDoneCallback tile_done);
+  void Stop();
+
+  // For local threads. Returns false if the tile is taken by a worker.
+  bool ClaimTile(int tile_id);
+  void TileDone(int tile_id);
+
+  // Blocks until all tiles are done or some tiles come back from workers.
+  // Fills que with the returned tiles. local threads still need to claim them.
+  // Returns the number of returned tiles.
+  int WaitForTiles(std::vector<int> *iteration_que);
+
+  void Abort();
+  bool IsAborted() const;
+
+private:
+  enum TileState {
+    TILE_UNCLAIMED = 0,
+    TILE_LOCAL,
+    TILE_REMOTE,
+    TILE_DONE
+  };
+
+  void accept_workers();
+  void serve_worker(Socket *socket);
+  int claim_remote_tile();
+  void return_tile(int tile_id);
+  int receive_tile(const FrameBuffer &tile, int tile_id);
+
+  int32_t frame_id_;
+  const Tiler *tiler_;
+  FrameBuffer *framebuffer_;
+  void *data_;
+  FarmTileStartCallback tile_start_;
+  FarmTileDoneCallback tile_done_;
+
+  std::mutex mutex_;
+  std::condition_variable tile_changed_;
+  std::vector<int> que_;
+  std::vector<int> tile_state_;
+  int done_count_;
+
+  Socket listener_;
+  std::thread listener_thread_;
+  std::vector<Socket *> worker_sockets_;
+  std::vector<std::thread> worker_threads_;
+  std::atomic<bool> is_stopping_;
+  std::atomic<bool> is_aborted_;
+};
+
+// Connection of a worker thread to the coordinator.
+class FarmClient {
+public:
+  FarmClient();
+  ~FarmClient();
+
+  // Retries for a while since the coordinator may not be listening yet.
+  int Connect(const std::string &address, int port);
+  // Returns the tile id to render or -1 if no tiles are left. the region
+  // sent by the coordinator has to match the tile of the local tiler.
+  int RequestTile(int xres, int yres, int channel_count, int tile_count,
+      const Tiler &tiler);
+  int SendTile(int tile_id, const Rectangle &region, const FrameBuffer &framebuffer);
+
+  bool IsAborted() const;
+
+private:
+  Socket socket_;
+  int32_t frame_id_;
+  bool is_aborted_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
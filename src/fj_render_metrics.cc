@@ -0,0 +1,323 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_render_metrics.h"
+#include "fj_tessellation_cache.h"
+#include "fj_tile_cache.h"
+#include "fj_progress.h"
+#include "fj_os.h"
+
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+
+namespace fj {
+
+static const int ACCEPT_TIMEOUT_MICRO_SEC = 100000;
+static const int REQUEST_TIMEOUT_SEC = 1;
+static const std::size_t MAX_REQUEST_SIZE = 4096;
+
+// the same order as CXT_* ray contexts in fj_shading.h
+static const int RAY_CONTEXT_COUNT = 5;
+static const char *RAY_CONTEXT_NAMES[RAY_CONTEXT_COUNT] = {
+  "camera",
+  "shadow",
+  "diffuse",
+  "reflect",
+  "refract"
+};
+
+// rays of running threads and the sum of rays of finished threads
+class ThreadRayCounts;
+static std::vector<ThreadRayCounts *> thread_counts_list;
+static int64_t finished_ray_counts[RAY_CONTEXT_COUNT] = {0};
+static std::mutex thread_counts_mtx;
+static std::atomic<int> running_server_count(0);
+
+// only the owner thread writes the counts so no atomic additions are needed
+class ThreadRayCounts {
+public:
+  ThreadRayCounts()
+  {
+    for (int i = 0; i < RAY_CONTEXT_COUNT; i++) {
+      counts[i] = 0;
+    }
+    std::lock_guard<std::mutex> lock(thread_counts_mtx);
+    thread_counts_list.push_back(this);
+  }
+  ~ThreadRayCounts()
+  {
+    std::lock_guard<std::mutex> lock(thread_counts_mtx);
+    for (int i = 0; i < RAY_CONTEXT_COUNT; i++) {
+      finished_ray_counts[i] += counts[i].load(std::memory_order_relaxed);
+    }
+    thread_counts_list.erase(
+        std::find(thread_counts_list.begin(), thread_counts_list.end(), this));
+  }
+
+  std::atomic<int64_t> counts[RAY_CONTEXT_COUNT];
+};
+
+static void gather_ray_counts(int64_t *counts)
+{
+  std::lock_guard<std::mutex> lock(thread_counts_mtx);
+  for (int i = 0; i < RAY_CONTEXT_COUNT; i++) {
+    counts[i] = finished_ray_counts[i];
+    for (std::size_t j = 0; j < thread_counts_list.size(); j++) {
+      counts[i] += thread_counts_list[j]->counts[i].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void MetricsCountRay(int ray_context)
+{
+  if (running_server_count.load(std::memory_order_relaxed) == 0 ||
+      ray_context < 0 || ray_context >= RAY_CONTEXT_COUNT) {
+    return;
+  }
+  static thread_local ThreadRayCounts thread_counts;
+  std::atomic<int64_t> &count = thread_counts.counts[ray_context];
+  count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static void append_metric(std::string &text, const char *name, const char *type,
+    const char *help)
+{
+  text += "# HELP ";
+  text += name;
+  text += " ";
+  text += help;
+  text += "\n# TYPE ";
+  text += name;
+  text += " ";
+  text += type;
+  text += "\n";
+}
+
+static void append_value(std::string &text, const char *name, const char *labels,
+    double value)
+{
+  char buf[256] = {'\0'};
+  sprintf(buf, "%s%s %.15g\n", name, labels, value);
+  text += buf;
+}
+
+MetricsServer::MetricsServer() :
+    mutex_(),
+    reporter_(NULL),
+    total_tiles_(0),
+    render_count_(0),
+    busy_counters_(),
+    thread_count_(0),
+    listener_(),
+    listener_thread_(),
+    is_stopping_(false)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+  Stop();
+}
+
+int MetricsServer::Start(int port)
+{
+  Stop();
+
+  listener_.Open();
+  listener_.SetAddress("");
+  listener_.SetPort(port);
+  listener_.EnableReuseAddr();
+
+  if (listener_.Bind() == -1 || listener_.Listen() == -1) {
+    listener_.Close();
+    return -1;
+  }
+
+  is_stopping_ = false;
+  running_server_count++;
+  listener_thread_ = std::thread(&MetricsServer::accept_requests, this);
+  return 0;
+}
+
+void MetricsServer::Stop()
+{
+  if (!listener_thread_.joinable()) {
+    return;
+  }
+
+  is_stopping_ = true;
+  listener_thread_.join();
+  listener_.Close();
+  running_server_count--;
+}
+
+bool MetricsServer::IsRunning() const
+{
+  return listener_thread_.joinable();
+}
+
+void MetricsServer::StartRender(const ProgressReporter *reporter, int64_t total_tiles,
+    int thread_count)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  reporter_ = reporter;
+  total_tiles_ = total_tiles;
+  render_count_++;
+  if (thread_count != thread_count_) {
+    busy_counters_.reset(new BusyCounter[thread_count]);
+    thread_count_ = thread_count;
+  }
+  for (int i = 0; i < thread_count_; i++) {
+    busy_counters_[i].nanoseconds.store(0);
+  }
+}
+
+void MetricsServer::FinishRender()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  reporter_ = NULL;
+}
+
+void MetricsServer::AddBusyTime(int thread_id, double seconds)
+{
+  if (thread_id < 0 || thread_id >= thread_count_) {
+    return;
+  }
+  busy_counters_[thread_id].nanoseconds.fetch_add(
+      static_cast<int64_t>(seconds * 1e9), std::memory_order_relaxed);
+}
+
+std::string MetricsServer::Format() const
+{
+  std::string text;
+  char labels[64] = {'\0'};
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const bool is_rendering = reporter_ != NULL;
+    const double tiles_done = is_rendering ? reporter_->GetTileCount() : 0;
+    const double samples_done = is_rendering ? reporter_->GetSampleCount() : 0;
+
+    append_metric(text, "fj_render_active", "gauge", "1 while a render is running.");
+    append_value(text, "fj_render_active", "", is_rendering ? 1 : 0);
+    append_metric(text, "fj_renders_total", "counter", "Renders started.");
+    append_value(text, "fj_renders_total", "", render_count_);
+    append_metric(text, "fj_render_tiles", "gauge", "Tiles of the running render.");
+    append_value(text, "fj_render_tiles", "", is_rendering ? total_tiles_ : 0);
+    append_metric(text, "fj_render_tiles_done", "gauge",
+        "Tiles done in the current pass of the running render.");
+    append_value(text, "fj_render_tiles_done", "", tiles_done);
+    append_metric(text, "fj_render_progress", "gauge",
+        "Ratio of tiles done in the current pass of the running render.");
+    append_value(text, "fj_render_progress", "",
+        is_rendering && total_tiles_ > 0 ? tiles_done / total_tiles_ : 0);
+    append_metric(text, "fj_render_samples_done", "gauge",
+        "Camera samples done in the current pass of the running render.");
+    append_value(text, "fj_render_samples_done", "", samples_done);
+
+    append_metric(text, "fj_thread_busy_seconds_total", "counter",
+        "Seconds each render thread spent rendering tiles in the last render.");
+    for (int i = 0; i < thread_count_; i++) {
+      sprintf(labels, "{thread=\"%d\"}", i);
+      append_value(text, "fj_thread_busy_seconds_total", labels,
+          busy_counters_[i].nanoseconds.load(std::memory_order_relaxed) * 1e-9);
+    }
+  }
+
+  int64_t ray_counts[RAY_CONTEXT_COUNT] = {0};
+  gather_ray_counts(ray_counts);
+  append_metric(text, "fj_rays_total", "counter", "Rays traced by type.");
+  for (int i = 0; i < RAY_CONTEXT_COUNT; i++) {
+    sprintf(labels, "{type=\"%s\"}", RAY_CONTEXT_NAMES[i]);
+    append_value(text, "fj_rays_total", labels, ray_counts[i]);
+  }
+
+  // lookups are reset at the start of each render
+  const TileCache &tile_cache = TileCacheGetGlobal();
+  TileFileStats total;
+  for (int i = 0; i < tile_cache.GetFileCount(); i++) {
+    TileFileStats stats;
+    tile_cache.GetFileStats(i, &stats);
+    total.Add(stats);
+  }
+  append_metric(text, "fj_texture_lookups_total", "counter", "Texture tile lookups.");
+  append_value(text, "fj_texture_lookups_total", "", total.lookup_count);
+  append_metric(text, "fj_texture_hits_total", "counter",
+      "Texture tile lookups found in the cache.");
+  append_value(text, "fj_texture_hits_total", "", total.hit_count);
+  append_metric(text, "fj_texture_hit_ratio", "gauge",
+      "Ratio of texture tile lookups found in the cache.");
+  append_value(text, "fj_texture_hit_ratio", "", total.lookup_count > 0 ?
+      static_cast<double>(total.hit_count) / total.lookup_count : 1);
+
+  append_metric(text, "fj_memory_resident_bytes", "gauge",
+      "Resident memory of the process. -1 if not supported.");
+  append_value(text, "fj_memory_resident_bytes", "", OsGetMemoryUsage());
+  append_metric(text, "fj_memory_peak_bytes", "gauge",
+      "Peak resident memory of the process. -1 if not supported.");
+  append_value(text, "fj_memory_peak_bytes", "", OsGetPeakMemoryUsage());
+  append_metric(text, "fj_texture_cache_bytes", "gauge", "Memory of cached texture tiles.");
+  append_value(text, "fj_texture_cache_bytes", "", tile_cache.GetMemoryUsage());
+  append_metric(text, "fj_tessellation_cache_bytes", "gauge",
+      "Memory of cached tessellated faces.");
+  append_value(text, "fj_tessellation_cache_bytes", "",
+      TessellationCacheGetGlobal().GetMemoryUsage());
+
+  return text;
+}
+
+void MetricsServer::accept_requests()
+{
+  while (!is_stopping_) {
+    Socket accepted;
+    const socket_id fd =
+        listener_.AcceptOrTimeout(accepted, 0, ACCEPT_TIMEOUT_MICRO_SEC);
+
+    if (fd == FJ_SOCKET_TIMEOUT || fd == FJ_SOCKET_INVALID) {
+      continue;
+    }
+    serve_request(accepted);
+  }
+}
+
+void MetricsServer::serve_request(Socket &socket) const
+{
+  // any request is answered after its header or a timeout
+  std::string request;
+  char buf[512] = {'\0'};
+  while (request.find("\r\n\r\n") == std::string::npos &&
+      request.find("\n\n") == std::string::npos &&
+      request.size() < MAX_REQUEST_SIZE) {
+    if (socket.WaitForData(REQUEST_TIMEOUT_SEC, 0) != 1) {
+      break;
+    }
+    const int received = socket.ReceiveAvailable(buf, sizeof(buf));
+    if (received <= 0) {
+      break;
+    }
+    request.append(buf, received);
+  }
+
+  const std::string body = Format();
+  char header[256] = {'\0'};
+  sprintf(header,
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %lu\r\n"
+      "Connection: close\r\n\r\n",
+      static_cast<unsigned long>(body.size()));
+  const std::string response = header + body;
+
+  std::size_t sent = 0;
+  while (sent < response.size()) {
+    const int count = socket.Send(response.data() + sent, response.size() - sent);
+    if (count <= 0) {
+      break;
+    }
+    sent += count;
+  }
+  socket.ShutdownWrite();
+}
+
+} // namespace xxx
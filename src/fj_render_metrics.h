@@ -0,0 +1,81 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_RENDER_METRICS_H
+#define FJ_RENDER_METRICS_H
+
+#include "fj_compatibility.h"
+#include "fj_socket.h"
+#include "fj_types.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+
+// Counters of a running render served as Prometheus text to any request on
+// a port, e.g. curl http://host:port/metrics. the server answers from a
+// thread of its own reading counters without locking the workers
+
+namespace fj {
+
+class ProgressReporter;
+
+// counts rays of the calling thread by CXT_* ray context while any server
+// runs. a thread local increment
+FJ_API void MetricsCountRay(int ray_context);
+
+class FJ_API MetricsServer {
+public:
+  MetricsServer();
+  // Stops if started
+  ~MetricsServer();
+
+  // returns -1 if the port cannot be listened to
+  int Start(int port);
+  void Stop();
+  bool IsRunning() const;
+
+  // called by the renderer. tiles and samples of the render are read from
+  // the reporter until it is set to NULL. busy time of each worker is reset
+  void StartRender(const ProgressReporter *reporter, int64_t total_tiles,
+      int thread_count);
+  void FinishRender();
+  // seconds the worker spent rendering tiles. each worker adds its own
+  void AddBusyTime(int thread_id, double seconds);
+
+  // the text of the metrics
+  std::string Format() const;
+
+private:
+  MetricsServer(const MetricsServer &);
+  const MetricsServer &operator=(const MetricsServer &);
+
+  class BusyCounter {
+  public:
+    BusyCounter() : nanoseconds(0) {}
+    ~BusyCounter() {}
+
+    std::atomic<int64_t> nanoseconds;
+  private:
+    char padding_[64 - sizeof(std::atomic<int64_t>)];
+  };
+
+  void accept_requests();
+  void serve_request(Socket &socket) const;
+
+  mutable std::mutex mutex_;
+  const ProgressReporter *reporter_;
+  int64_t total_tiles_;
+  int64_t render_count_;
+  std::unique_ptr<BusyCounter[]> busy_counters_;
+  int thread_count_;
+
+  Socket listener_;
+  std::thread listener_thread_;
+  std::atomic<bool> is_stopping_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
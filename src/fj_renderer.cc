@@ -3,36 +3,78 @@
 
 #include "fj_renderer.h"
 #include "fj_adaptive_grid_sampler.h"
+#include "fj_render_checkpoint.h"
+#include "fj_sample_margin_cache.h"
+#include "fj_exr_output.h"
+#include "fj_framebuffer_io.h"
+#include "fj_denoiser.h"
+#include "fj_render_farm.h"
 #include "fj_fixed_grid_sampler.h"
+#include "fj_variance_sampler.h"
 #include "fj_multi_thread.h"
 #include "fj_pixel_sample.h"
+#include "fj_memory_arena.h"
 #include "fj_framebuffer.h"
 #include "fj_rectangle.h"
 #include "fj_property.h"
+#include "fj_ray_stats.h"
+#include "fj_os.h"
+#include "fj_profile.h"
+#include "fj_geometry_pager.h"
+#include "fj_tessellation_cache.h"
+#include "fj_tile_cache.h"
+#include "fj_trace.h"
 #include "fj_protocol.h"
 #include "fj_numeric.h"
+#include "fj_random.h"
 #include "fj_sampler.h"
 #include "fj_shading.h"
 #include "fj_camera.h"
 #include "fj_filter.h"
+#include "fj_intersection.h"
+#include "fj_accelerator.h"
+#include "fj_shader.h"
 #include "fj_socket.h"
 #include "fj_vector.h"
 #include "fj_light.h"
 #include "fj_tiler.h"
+#include "fj_object_instance.h"
+#include "fj_object_group.h"
 #include "fj_ray.h"
 #include "fj_box.h"
 
+#include <algorithm>
 #include <vector>
+#include <chrono>
 #include <cassert>
+
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <x86intrin.h>
+#endif
 #include <cstring>
+#include <cstdlib>
 #include <cstdio>
 #include <cfloat>
+#include <climits>
+#include <cmath>
 #include <ctime>
 
 #include <cerrno>
 
 namespace fj {
 
+// 24MB of entries. enough cells for a typical interior
+static const int RADIANCE_CACHE_ENTRY_COUNT = 1 << 20;
+static const int TRANSMITTANCE_CACHE_ENTRY_COUNT = 1 << 20;
+// camera rays intersected at once by ray streaming. keeps the hits
+// waiting for shading within a few hundred KB per thread
+static const int RAY_STREAM_SIZE = 1024;
+// pixels of a side of blocks traced with one ray by preview passes
+static const int PREVIEW_BLOCK_SIZES[] = {8, 4};
+static const int PREVIEW_MAX_DEPTH = 1;
+
 static bool is_socket_ready = false;
 static int renderer_instance_count = 0;
 
@@ -45,30 +87,89 @@ static int32_t generate_frame_id()
   return id < 0 ? -id : id;
 }
 
-static void distribute_progress_iterations(FrameProgress *progress, Iteration total_iteration_count)
+static void init_frame_progress(FrameProgress *progress)
 {
-  const Iteration partial_itr = (Iteration) floor(total_iteration_count / 10.);
-  Iteration remains = total_iteration_count - partial_itr * 10;
-  int i;
+  if (!is_socket_ready) {
+    progress->report_to_viewer = false;
+  }
+}
 
-  for (i = 0; i < 10; i++) {
-    const Iteration this_itr = partial_itr + (remains > 0 ? 1 : 0);
-    progress->iteration_list[i] = this_itr;
+static void print_ray_stats()
+{
+  if (RayStatsIsEnabled()) {
+    RayStats stats;
+    RayStatsGather(&stats);
+    RayStatsPrint(stats);
+  }
+}
 
-    if (remains > 0) {
-      remains--;
-    }
+static void print_geometry_paging_stats()
+{
+  const GeometryPager &pager = GeometryPagerGetGlobal();
+  if (!pager.IsEnabled()) {
+    return;
   }
 
-  progress->current_segment = 0;
+  const double MEGABYTE = 1024. * 1024.;
+  printf("# Geometry Paging\n");
+  printf("#   Budget (MB):       %12.1f\n", pager.GetMemoryBudget() / MEGABYTE);
+  printf("#   Mapped (MB):       %12.1f\n", pager.GetMappedSize() / MEGABYTE);
+  printf("#   Resident (MB):     %12.1f\n", pager.GetResidentSize() / MEGABYTE);
+  printf("#   Page-ins:          %12lld\n", pager.GetPageInCount());
+  printf("#   Evicted Clusters:  %12lld\n", pager.GetEvictedClusterCount());
+  printf("\n");
 }
 
-static void init_frame_progress(FrameProgress *progress, Iteration total_iteration_count)
+// lookups are of tiles other than the last one of each thread and level
+static void print_tile_cache_stats()
 {
-  distribute_progress_iterations(progress, total_iteration_count);
+  const TileCache &cache = TileCacheGetGlobal();
+  const double MEGABYTE = 1024. * 1024.;
+  const int file_count = cache.GetFileCount();
+  TileFileStats total;
+  std::vector<TileFileStats> stats(file_count);
+
+  for (int i = 0; i < file_count; i++) {
+    cache.GetFileStats(i, &stats[i]);
+    total.Add(stats[i]);
+  }
+  if (total.lookup_count == 0 && total.read_count == 0) {
+    return;
+  }
 
-  if (!is_socket_ready) {
-    progress->report_to_viewer = false;
+  printf("# Tile Cache\n");
+  printf("#   Budget (MB):       %12.1f\n", cache.GetMemoryBudget() / MEGABYTE);
+  printf("#   Usage (MB):        %12.1f\n", cache.GetMemoryUsage() / MEGABYTE);
+  printf("#   %-32s %10s %6s %8s %9s %8s %8s %8s %6s %6s\n",
+      "File", "Lookups", "Hit%", "Reads", "Read MB", "Read s", "Wait s",
+      "Evicted", "Opens", "Shares");
+  for (int i = 0; i <= file_count; i++) {
+    const TileFileStats &s = i < file_count ? stats[i] : total;
+    if (s.lookup_count == 0 && s.read_count == 0) {
+      continue;
+    }
+    std::string name = i < file_count ? cache.GetFileName(i) : "Total";
+    if (name.size() > 32) {
+      name = "..." + name.substr(name.size() - 29);
+    }
+    printf("#   %-32s %10lld %6.1f %8lld %9.1f %8.3f %8.3f %8lld %6lld %6lld\n",
+        name.c_str(),
+        static_cast<long long>(s.lookup_count),
+        s.lookup_count > 0 ? 100. * s.hit_count / s.lookup_count : 0.,
+        static_cast<long long>(s.read_count),
+        s.read_bytes / MEGABYTE,
+        s.read_nanoseconds * 1e-9,
+        s.wait_nanoseconds * 1e-9,
+        static_cast<long long>(s.evicted_count),
+        static_cast<long long>(s.open_count),
+        static_cast<long long>(s.share_count));
+  }
+  printf("\n");
+
+  if (total.evicted_count > 0) {
+    std::cerr << "* WARNING: tile cache exceeded its budget of " <<
+        cache.GetMemoryBudget() / MEGABYTE << " MB. " << total.evicted_count <<
+        " tiles were evicted. raise texture_cache_memory of renderers\n\n";
   }
 }
 
@@ -84,13 +185,6 @@ static Interrupt default_frame_start(void *data, const FrameInfo *info)
   printf("#   Tile Count:   %4d\n", info->tile_count);
   printf("\n");
 
-  {
-    int idx;
-    fp->current_segment = 0;
-    idx = fp->current_segment;
-    fp->progress.Start(fp->iteration_list[idx]);
-  }
-
   return CALLBACK_CONTINUE;
 }
 static Interrupt default_frame_done(void *data, const FrameInfo *info)
@@ -103,6 +197,10 @@ static Interrupt default_frame_done(void *data, const FrameInfo *info)
   printf("#   %dh %dm %ds\n", elapse.hour, elapse.min, elapse.sec);
   printf("\n");
 
+  print_ray_stats();
+  print_geometry_paging_stats();
+  print_tile_cache_stats();
+
   return CALLBACK_CONTINUE;
 }
 
@@ -110,32 +208,6 @@ static Interrupt default_tile_start(void *data, const TileInfo *info)
 {
   return CALLBACK_CONTINUE;
 }
-static void increment_progress(void *data)
-{
-  FrameProgress *fp = reinterpret_cast<FrameProgress *>(data);
-  const ProgressStatus status = fp->progress.Increment();
-
-  if (status == PROGRESS_DONE) {
-    Elapse elapse;
-    int idx;
-
-    fp->current_segment++;
-    idx = fp->current_segment;
-    elapse = fp->timer.GetElapse();
-
-    printf(" %3d%%  ", idx * 10); 
-    printf("(%dh %dm %ds)\n", elapse.hour, elapse.min, elapse.sec);
-    fp->progress.Done();
-
-    if (idx != 10) {
-      // FIXME deal with the case where total iteration < 10
-      // This is temp fix
-      if (fp->iteration_list[idx] != 0) {
-      fp->progress.Start(fp->iteration_list[idx]);
-      }
-    }
-  }
-}
 static Interrupt default_sample_done(void *data)
 {
   return CALLBACK_CONTINUE;
@@ -151,11 +223,7 @@ static Interrupt default_frame_start2(void *data, const FrameInfo *info)
   FrameProgress *fp = reinterpret_cast<FrameProgress *>(data);
 
   if (fp->report_to_viewer) {
-    Socket socket;
-    socket.Open();
-    socket.SetAddress("127.0.0.1");
-
-    const int result = socket.Connect();
+    const int result = fp->viewer.Open("127.0.0.1");
 
     if (result == -1) {
       std::cerr << "* ERROR: cannot connect to fbview: " << strerror(errno) << "\n";
@@ -164,17 +232,13 @@ static Interrupt default_frame_start2(void *data, const FrameInfo *info)
       fp->report_to_viewer = false;
     }
     else {
-      SendRenderFrameStart(socket,
+      fp->viewer.SendFrameStart(
           info->frame_id,
           info->xres,
           info->yres,
-          info->framebuffer->GetChannelCount(),
-          info->tile_count);
-
-      const int err = ReceiveEOF(socket);
-      if (err) {
-        // TODO ERROR HANDLING
-      }
+          std::min(info->framebuffer->GetChannelCount(), 4),
+          info->tile_count,
+          fp->viewer_tile_encoding);
     }
   }
 
@@ -186,11 +250,6 @@ static Interrupt default_frame_start2(void *data, const FrameInfo *info)
   printf("#   Tile Count:   %4d\n", info->tile_count);
   printf("\n");
 
-  // start progress
-  fp->current_segment = 0;
-  const int idx = fp->current_segment;
-  fp->progress.Start(fp->iteration_list[idx]);
-
   return CALLBACK_CONTINUE;
 }
 
@@ -203,24 +262,14 @@ static Interrupt default_frame_done2(void *data, const FrameInfo *info)
   printf("#   %dh %dm %ds\n", elapse.hour, elapse.min, elapse.sec);
   printf("\n");
 
-  if (fp->report_to_viewer) {
-    Socket socket;
-    socket.Open();
-    socket.SetAddress("127.0.0.1");
-
-    const int result = socket.Connect();
-
-    if (result == -1) {
-      // TODO ERROR HANDLING
-      std::cerr << "* ERROR: cannot connect to fbview: " << strerror(errno) << "\n";
-    }
-
-    SendRenderFrameDone(socket, info->frame_id);
+  print_ray_stats();
+  print_geometry_paging_stats();
+  print_tile_cache_stats();
 
-    const int err = ReceiveEOF(socket);
-    if (err) {
-      // TODO ERROR HANDLING
-    }
+  if (fp->viewer.IsOpen()) {
+    // sends tiles left in the que before disconnecting
+    fp->viewer.SendFrameDone(info->frame_id);
+    fp->viewer.Close();
   }
 
   return CALLBACK_CONTINUE;
@@ -229,62 +278,15 @@ static Interrupt default_frame_done2(void *data, const FrameInfo *info)
 static Interrupt default_tile_start2(void *data, const TileInfo *info)
 {
   FrameProgress *fp = reinterpret_cast<FrameProgress *>(data);
-  if (fp->report_to_viewer == false) {
+  if (!fp->viewer.IsOpen()) {
     return CALLBACK_CONTINUE;
   }
 
-  const int MAX_RETRY = 10;
-  int i = 0;
-
-  for (i = 0; i < MAX_RETRY; i++) {
-    int err = 0;
-    Socket socket;
-    socket.Open();
-    socket.SetAddress("127.0.0.1");
-
-    const int result = socket.Connect();
-    if (result == -1) {
-      // TODO ERROR HANDLING
-      continue;
-    }
-
-    err = SendRenderTileStart(socket,
-        info->frame_id,
-        info->region_id,
-        info->tile_region.min[0],
-        info->tile_region.min[1],
-        info->tile_region.max[0],
-        info->tile_region.max[1]);
-    if (err == -1) {
-      // TODO ERROR HANDLING
-      continue;
-    }
-
-    {
-      Message message;
-      const int result = ReceiveReply(socket, message);
-      if (result == -1) {
-        // no reply
-        break;
-      }
-      if (message.type == MSG_RENDER_FRAME_ABORT) {
-        return CALLBACK_INTERRUPT;
-      }
-    }
-#if 0
-    err = ReceiveEOF(socket);
-    if (err) {
-      // TODO ERROR HANDLING
-      continue;
-    }
-#endif
-
-    break;
+  if (fp->viewer.IsAborted()) {
+    return CALLBACK_INTERRUPT;
   }
 
-  if (i == MAX_RETRY) {
-    // TODO ERROR HANDLING
-  }
+  fp->viewer.SendTileStart(info->frame_id, info->region_id, info->tile_region);
 
   return CALLBACK_CONTINUE;
 }
@@ -292,71 +294,12 @@ static Interrupt default_tile_start2(void *data, const TileInfo *info)
 static Interrupt default_tile_done2(void *data, const TileInfo *info)
 {
   FrameProgress *fp = reinterpret_cast<FrameProgress *>(data);
-  if (fp->report_to_viewer == false) {
+  if (!fp->viewer.IsOpen()) {
     return CALLBACK_CONTINUE;
   }
 
-  const int tile_w = info->tile_region.Size()[0];
-  const int tile_h = info->tile_region.Size()[1];
-  FrameBuffer tile_fb;
-  tile_fb.Resize(tile_w, tile_h, info->framebuffer->GetChannelCount());
-
-  {
-    const int xoffset = info->tile_region.min[0];
-    const int yoffset = info->tile_region.min[1];
-    for (int y = 0; y < tile_h; y++) {
-      for (int x = 0; x < tile_w; x++) {
-        const int xx = x + xoffset;
-        const int yy = y + yoffset;
-        const Color4 color = info->framebuffer->GetColor(xx, yy);
-        tile_fb.SetColor(x, y, color);
-      }
-    }
-  }
-
-  const int MAX_RETRY = 10;
-  int i = 0;
-
-  for (i = 0; i < MAX_RETRY; i++) {
-    int err = 0;
-    Socket socket;
-    socket.Open();
-    socket.SetAddress("127.0.0.1");
-
-    const int result = socket.Connect();
-
-    if (result == -1) {
-      // TODO ERROR HANDLING
-      continue;
-    }
-
-    err = SendRenderTileDone(socket,
-        info->frame_id,
-        info->region_id,
-        info->tile_region.min[0],
-        info->tile_region.min[1],
-        info->tile_region.max[0],
-        info->tile_region.max[1],
-        tile_fb);
-    if (err == -1) {
-      // TODO ERROR HANDLING
-      continue;
-    }
-
-    err = ReceiveEOF(socket);
-    if (err) {
-      // TODO ERROR HANDLING
-    }
-
-    break;
-  }
-
-  if (i == MAX_RETRY) {
-    // TODO ERROR HANDLING
-  }
-
-  // increment progress
-  MtCriticalSection(data, increment_progress);
+  fp->viewer.SendTileDone(info->frame_id, info->region_id, info->tile_region,
+      *info->framebuffer);
 
   return CALLBACK_CONTINUE;
 }
@@ -368,10 +311,21 @@ Renderer::Renderer()
   target_objects_ = NULL;
   target_lights_ = NULL;
   nlights_ = 0;
+  interrupted_ = false;
 
   SetResolution(320, 240);
   SetTileSize(64, 64);
+  SetAutoTileSize(0);
+  SetTailSplitting(0);
+  pixel_seconds_ = 0;
+  SetTileOrder(TILE_ORDER_SCANLINE);
+  SetFrameBufferFormat(FB_FORMAT_FLOAT);
+  SetTiledFrameBuffer(0);
+  SetFrameBufferFile("");
   SetFilterWidth(2, 2);
+  SetFilterType(FLT_GAUSSIAN);
+  SetFilterSplatting(0);
+  SetFilterImportanceSampling(0);
 
   SetSamplerType(RENDERER_FIXED_GRID_SAMPLER);
   SetPixelSamples(3, 3);
@@ -379,18 +333,63 @@ Renderer::Renderer()
   SetSubdivisionThreshold(.05);
   SetSampleJitter(1);
   SetSampleTimeRange(0, 1);
-
+  SetSampleSequence(SAMPLE_SEQUENCE_RANDOM);
+
+  SetProgressive(0);
+  SetProgressiveTimeLimit(0);
+  SetProgressiveMaxSamples(64);
+  SetProgressiveNoiseThreshold(0);
+
+  SetCheckpointFile("");
+  SetCheckpointInterval(60);
+
+  SetOutputFile("");
+  SetOutputChannels("");
+  SetDenoisedFile("");
+
+  SetAOVs("");
+  SetTraceFile("");
+  SetProfile(0);
+  SetVerbose(0);
+
+  SetEstimateFile("");
+  SetEstimateResolutionScale(.25);
+  SetBenchmarkFile("");
+  SetBenchmarkThreadCounts("");
+  metrics_port_ = 0;
+
+  SetPreviewPass(0);
+  SetIncrementalRender(0);
+  keeps_last_frame_ = false;
+  SetPrimaryHitCacheMemory(0);
+
+  SetFarmMode(RENDERER_FARM_NONE);
+  SetFarmAddress("127.0.0.1");
+  SetFarmPort(50506);
+
+  SetViewerTileEncoding(TILE_ENCODING_SHARED);
+
+  SetSampledLightCount(0);
+  SetRadianceCacheCellSize(0);
+  SetTransmittanceCacheCellSize(0);
+  SetCausticPhotonCount(0);
+  SetCausticPhotonMemory(64);
+  SetCausticRadius(0);
+  SetRayStreaming(0);
   SetShadowEnable(1);
   SetMaxReflectDepth(3);
   SetMaxRefractDepth(3);
+  SetRayThroughputThreshold(0);
 
   SetRaymarchStep(.05);
   SetRaymarchShadowStep(.1);
   SetRaymarchReflectStep(.1);
   SetRaymarchRefractStep(.1);
+  SetShadowTransmittance(SHADOW_TRANSMITTANCE_RAYMARCH);
 
   SetUseMaxThread(0);
   SetThreadCount(1);
+  host_thread_count_ = 0;
 
   // TODO TEST
   if (0) {
@@ -476,6 +475,52 @@ void Renderer::SetTileSize(int xtilesize, int ytilesize)
   tilesize_[1] = ytilesize;
 }
 
+void Renderer::SetAutoTileSize(int enable)
+{
+  auto_tilesize_ = (enable != 0);
+}
+
+void Renderer::SetTailSplitting(int enable)
+{
+  tail_splitting_ = (enable != 0);
+}
+
+void Renderer::SetTileOrder(int tile_order)
+{
+  switch (tile_order) {
+  case TILE_ORDER_SCANLINE:
+  case TILE_ORDER_SPIRAL:
+  case TILE_ORDER_HILBERT:
+  case TILE_ORDER_MORTON:
+  case TILE_ORDER_COST:
+    tile_order_ = tile_order;
+    break;
+  default:
+    tile_order_ = TILE_ORDER_SCANLINE;
+    break;
+  }
+}
+
+void Renderer::SetPreviewPass(int enable)
+{
+  preview_pass_ = (enable != 0);
+}
+
+void Renderer::SetFrameBufferFormat(int format)
+{
+  framebuffer_format_ = format == FB_FORMAT_HALF ? FB_FORMAT_HALF : FB_FORMAT_FLOAT;
+}
+
+void Renderer::SetTiledFrameBuffer(int enable)
+{
+  tiled_framebuffer_ = (enable != 0);
+}
+
+void Renderer::SetFrameBufferFile(const std::string &filename)
+{
+  framebuffer_file_ = filename;
+}
+
 void Renderer::SetFilterWidth(float xfwidth, float yfwidth)
 {
   assert(xfwidth > 0);
@@ -484,11 +529,37 @@ void Renderer::SetFilterWidth(float xfwidth, float yfwidth)
   filterwidth_[1] = yfwidth;
 }
 
+void Renderer::SetFilterType(int filter_type)
+{
+  switch (filter_type) {
+  case FLT_BOX:
+  case FLT_GAUSSIAN:
+  case FLT_MITCHELL:
+  case FLT_BLACKMAN_HARRIS:
+    filter_type_ = filter_type;
+    break;
+  default:
+    filter_type_ = FLT_GAUSSIAN;
+    break;
+  }
+}
+
+void Renderer::SetFilterSplatting(int enable)
+{
+  filter_splatting_ = (enable != 0);
+}
+
+void Renderer::SetFilterImportanceSampling(int enable)
+{
+  filter_importance_sampling_ = (enable != 0);
+}
+
 void Renderer::SetSamplerType(int sampler_type)
 {
   switch (sampler_type) {
   case RENDERER_FIXED_GRID_SAMPLER:
   case RENDERER_ADAPTIVE_GRID_SAMPLER:
+  case RENDERER_VARIANCE_SAMPLER:
     sampler_type_ = sampler_type;
     break;
   default:
@@ -531,593 +602,3470 @@ void Renderer::SetSampleTimeRange(double start_time, double end_time)
   sample_time_end_ = end_time;
 }
 
-void Renderer::SetShadowEnable(int enable)
+void Renderer::SetSampleSequence(int sequence_type)
 {
-  assert(enable == 0 || enable == 1);
-  cast_shadow_ = enable;
+  switch (sequence_type) {
+  case SAMPLE_SEQUENCE_RANDOM:
+  case SAMPLE_SEQUENCE_SOBOL:
+    sample_sequence_ = sequence_type;
+    break;
+  default:
+    sample_sequence_ = SAMPLE_SEQUENCE_RANDOM;
+    break;
+  }
 }
 
-void Renderer::SetMaxDiffuseDepth(int max_depth)
+void Renderer::SetProgressive(int enable)
 {
-  assert(max_depth >= 0);
-  max_diffuse_depth_ = max_depth;
+  progressive_ = (enable != 0);
 }
 
-void Renderer::SetMaxReflectDepth(int max_depth)
+void Renderer::SetProgressiveTimeLimit(double time_limit)
 {
-  assert(max_depth >= 0);
-  max_reflect_depth_ = max_depth;
+  assert(time_limit >= 0);
+  progressive_time_limit_ = time_limit;
 }
 
-void Renderer::SetMaxRefractDepth(int max_depth)
+void Renderer::SetProgressiveMaxSamples(int max_samples)
 {
-  assert(max_depth >= 0);
-  max_refract_depth_ = max_depth;
+  assert(max_samples >= 0);
+  progressive_max_samples_ = max_samples;
 }
 
-void Renderer::SetRaymarchStep(double step)
+void Renderer::SetProgressiveNoiseThreshold(double noise_threshold)
 {
-  assert(step > 0);
-  raymarch_step_ = Max(step, .001);
+  assert(noise_threshold >= 0);
+  progressive_noise_threshold_ = noise_threshold;
 }
 
-void Renderer::SetRaymarchShadowStep(double step)
+void Renderer::SetCheckpointFile(const std::string &filename)
 {
-  assert(step > 0);
-  raymarch_shadow_step_ = Max(step, .001);
+  checkpoint_file_ = filename;
 }
 
-void Renderer::SetRaymarchDiffuseStep(double step)
+void Renderer::SetCheckpointInterval(double interval)
 {
-  assert(step > 0);
-  raymarch_diffuse_step_ = Max(step, .001);
+  assert(interval >= 0);
+  checkpoint_interval_ = interval;
 }
 
-void Renderer::SetRaymarchReflectStep(double step)
+void Renderer::SetOutputFile(const std::string &filename)
 {
-  assert(step > 0);
-  raymarch_reflect_step_ = Max(step, .001);
+  output_file_ = filename;
 }
 
-void Renderer::SetRaymarchRefractStep(double step)
+int Renderer::SetAOVs(const std::string &names)
 {
-  assert(step > 0);
-  raymarch_refract_step_ = Max(step, .001);
+  const int err = aov_layout_.Parse(names);
+#if !defined(FJ_RAY_STATS)
+  if (!err && aov_layout_.GetOffset(AOV_NODES) >= 0) {
+    std::cerr << "* WARNING: nodes aov is always 0 unless built with RAY_STATS=1\n\n";
+  }
+#endif
+  return err;
 }
 
-void Renderer::SetCamera(Camera *cam)
+void Renderer::SetTraceFile(const std::string &filename)
 {
-  assert(cam != NULL);
-  camera_ = cam;
+  trace_file_ = filename;
+  // stays on for other renderers and FJ_TRACE
+  if (!trace_file_.empty()) {
+    TraceSetEnabled(true);
+  }
 }
 
-void Renderer::SetFrameBuffers(FrameBuffer *fb)
+void Renderer::SetEstimateFile(const std::string &filename)
 {
-  assert(fb != NULL);
-  framebuffer_ = fb;
+  estimate_file_ = filename;
 }
 
-void Renderer::SetTargetObjects(ObjectGroup *grp)
+void Renderer::SetEstimateResolutionScale(double scale)
 {
-  assert(grp != NULL);
-  target_objects_ = grp;
+  assert(scale > 0);
+  estimate_resolution_scale_ = Min(scale, 1.);
 }
 
-void Renderer::SetTargetLights(Light **lights, int nlights)
+void Renderer::SetBenchmarkFile(const std::string &filename)
 {
-  assert(lights != NULL);
-  assert(nlights > 0);
-  target_lights_ = lights;
-  nlights_ = nlights;
+  benchmark_file_ = filename;
 }
 
-void Renderer::SetUseMaxThread(int use_max_thread)
+int Renderer::SetBenchmarkThreadCounts(const std::string &counts)
 {
-  use_max_thread_ = (use_max_thread != 0);
+  std::vector<int> thread_counts;
+  const char *str = counts.c_str();
+
+  while (*str != '\0') {
+    char *end = NULL;
+    const long count = strtol(str, &end, 10);
+    if (end == str || count < 1 || count > INT_MAX) {
+      return -1;
+    }
+    thread_counts.push_back(static_cast<int>(count));
+
+    str = end;
+    while (*str == ' ') {
+      str++;
+    }
+    if (*str == ',') {
+      str++;
+    } else if (*str != '\0') {
+      return -1;
+    }
+  }
+
+  benchmark_thread_counts_ = thread_counts;
+  return 0;
 }
 
-void Renderer::SetThreadCount(int thread_count)
+void Renderer::SetMetricsPort(int port)
 {
-  const int max_thread_count = MtGetMaxAvailableThreadCount();
-
-  if (thread_count < 1) {
-    thread_count_ = 1;
-  } else if (thread_count > max_thread_count) {
-    thread_count_ = max_thread_count;
-  } else {
-    thread_count_ = thread_count;
+  if (port == metrics_port_ && (port == 0 || metrics_.IsRunning())) {
+    return;
+  }
+  metrics_port_ = port;
+  metrics_.Stop();
+  if (port > 0 && metrics_.Start(port)) {
+    std::cerr << "* WARNING: cannot listen to metrics requests on port " <<
+        port << ": " << SocketErrorMessage() << "\n\n";
   }
 }
 
-int Renderer::GetThreadCount() const
+void Renderer::SetOutputChannels(const std::string &channel_names)
 {
-  const int max_thread_count = MtGetMaxAvailableThreadCount();
+  output_channels_ = channel_names;
+}
 
-  if (use_max_thread_) {
-    return max_thread_count;
-  } else {
-    return thread_count_;
-  }
+void Renderer::SetDenoisedFile(const std::string &filename)
+{
+  denoised_file_ = filename;
 }
 
-void Renderer::SetFrameReportCallback(void *data,
-    FrameStartCallback frame_start,
-    FrameAbortCallback frame_abort,
-    FrameDoneCallback frame_done)
+void Renderer::SetProfile(int enable)
 {
-  CbSetFrameReport(&frame_report_,
-      data,
-      frame_start,
-      frame_abort,
-      frame_done);
+  profile_ = (enable != 0);
 }
 
-void Renderer::SetTileReportCallback(void *data,
-    TileStartCallback tile_start,
-    SampleDoneCallback sample_done,
-    TileDoneCallback tile_done)
+void Renderer::SetVerbose(int enable)
 {
-  CbSetTileReport(&tile_report_,
-      data,
-      tile_start,
-      sample_done,
-      tile_done);
+  verbose_ = (enable != 0);
 }
 
-int Renderer::RenderScene()
+bool Renderer::IsVerbose() const
 {
-  int err = 0;
+  return verbose_ != 0;
+}
 
-  err = prepare_rendering();
-  if (err) {
-    /* TODO error handling */
-    return -1;
+void Renderer::SetIncrementalRender(int enable)
+{
+  incremental_render_ = (enable != 0);
+  if (!incremental_render_) {
+    tile_coverage_.Clear();
   }
+}
 
-  err = execute_rendering();
-  if (err) {
-    /* TODO error handling */
-    return -1;
-  }
+void Renderer::InvalidateObject(const ObjectInstance *object)
+{
+  tile_coverage_.InvalidateObject(object);
+}
 
-  return 0;
+void Renderer::InvalidateAll()
+{
+  tile_coverage_.Clear();
+  primary_hit_cache_.Clear();
 }
 
-// TODO TMP REMOVE LATER
-class Worker {
-public:
-  Worker() : camera(NULL), framebuffer(NULL), sampler(NULL) {}
-  ~Worker()
-  {
-    delete sampler;
+void Renderer::SetPrimaryHitCacheMemory(double megabytes)
+{
+  primary_hit_cache_memory_ = Max(megabytes, 0);
+  if (primary_hit_cache_memory_ == 0) {
+    primary_hit_cache_.Clear();
   }
+}
 
-public:
-  int id;
-  int region_id;
-  int region_count;
+void Renderer::SetFarmMode(int farm_mode)
+{
+  switch (farm_mode) {
+  case RENDERER_FARM_NONE:
+  case RENDERER_FARM_COORDINATOR:
+  case RENDERER_FARM_WORKER:
+    farm_mode_ = farm_mode;
+    break;
+  default:
+    farm_mode_ = RENDERER_FARM_NONE;
+    break;
+  }
+}
+
+void Renderer::SetFarmAddress(const std::string &address)
+{
+  farm_address_ = address;
+}
+
+void Renderer::SetFarmPort(int port)
+{
+  assert(port > 0);
+  farm_port_ = port;
+}
+
+void Renderer::SetViewerTileEncoding(int tile_encoding)
+{
+  switch (tile_encoding) {
+  case TILE_ENCODING_FLOAT:
+  case TILE_ENCODING_FLOAT_RLE:
+  case TILE_ENCODING_HALF:
+  case TILE_ENCODING_HALF_RLE:
+  case TILE_ENCODING_SHARED:
+    frame_progress_.viewer_tile_encoding = tile_encoding;
+    break;
+  default:
+    frame_progress_.viewer_tile_encoding = TILE_ENCODING_FLOAT_RLE;
+    break;
+  }
+}
+
+void Renderer::SetSampledLightCount(int count)
+{
+  sampled_light_count_ = Max(count, 0);
+}
+
+void Renderer::SetRadianceCacheCellSize(double cell_size)
+{
+  radiance_cache_cell_size_ = Max(cell_size, 0);
+}
+
+void Renderer::SetTransmittanceCacheCellSize(double cell_size)
+{
+  transmittance_cache_cell_size_ = Max(cell_size, 0);
+}
+
+void Renderer::SetCausticPhotonCount(int photon_count)
+{
+  caustic_photon_count_ = Max(photon_count, 0);
+}
+
+void Renderer::SetCausticPhotonMemory(double megabytes)
+{
+  caustic_photon_memory_ = Max(megabytes, 0);
+}
+
+void Renderer::SetCausticRadius(double radius)
+{
+  caustic_radius_ = Max(radius, 0);
+}
+
+void Renderer::SetRayStreaming(int enable)
+{
+  ray_streaming_ = (enable != 0);
+}
+
+void Renderer::SetShadowEnable(int enable)
+{
+  assert(enable == 0 || enable == 1);
+  cast_shadow_ = enable;
+}
+
+void Renderer::SetMaxDiffuseDepth(int max_depth)
+{
+  assert(max_depth >= 0);
+  max_diffuse_depth_ = max_depth;
+}
+
+void Renderer::SetMaxReflectDepth(int max_depth)
+{
+  assert(max_depth >= 0);
+  max_reflect_depth_ = max_depth;
+}
+
+void Renderer::SetMaxRefractDepth(int max_depth)
+{
+  assert(max_depth >= 0);
+  max_refract_depth_ = max_depth;
+}
+
+void Renderer::SetRayThroughputThreshold(float threshold)
+{
+  assert(threshold >= 0);
+  ray_throughput_threshold_ = Max(threshold, 0);
+}
+
+void Renderer::SetRaymarchStep(double step)
+{
+  assert(step > 0);
+  raymarch_step_ = Max(step, .001);
+}
+
+void Renderer::SetRaymarchShadowStep(double step)
+{
+  assert(step > 0);
+  raymarch_shadow_step_ = Max(step, .001);
+}
+
+void Renderer::SetRaymarchDiffuseStep(double step)
+{
+  assert(step > 0);
+  raymarch_diffuse_step_ = Max(step, .001);
+}
+
+void Renderer::SetRaymarchReflectStep(double step)
+{
+  assert(step > 0);
+  raymarch_reflect_step_ = Max(step, .001);
+}
+
+void Renderer::SetRaymarchRefractStep(double step)
+{
+  assert(step > 0);
+  raymarch_refract_step_ = Max(step, .001);
+}
+
+void Renderer::SetShadowTransmittance(int transmittance)
+{
+  switch (transmittance) {
+  case SHADOW_TRANSMITTANCE_RAYMARCH:
+  case SHADOW_TRANSMITTANCE_RATIO_TRACKING:
+    shadow_transmittance_ = transmittance;
+    break;
+  default:
+    shadow_transmittance_ = SHADOW_TRANSMITTANCE_RAYMARCH;
+    break;
+  }
+}
+
+void Renderer::SetCamera(Camera *cam)
+{
+  assert(cam != NULL);
+  camera_ = cam;
+}
+
+void Renderer::SetFrameBuffers(FrameBuffer *fb)
+{
+  assert(fb != NULL);
+  framebuffer_ = fb;
+}
+
+void Renderer::AddView(Camera *cam, FrameBuffer *fb)
+{
+  assert(cam != NULL);
+  assert(fb != NULL);
+  RenderView view;
+  view.camera = cam;
+  view.framebuffer = fb;
+  views_.push_back(view);
+}
+
+void Renderer::ClearViews()
+{
+  views_.clear();
+}
+
+void Renderer::SetTargetObjects(ObjectGroup *grp)
+{
+  assert(grp != NULL);
+  target_objects_ = grp;
+}
+
+void Renderer::SetTargetLights(Light **lights, int nlights)
+{
+  assert(lights != NULL);
+  assert(nlights > 0);
+  target_lights_ = lights;
+  nlights_ = nlights;
+}
+
+void Renderer::SetUseMaxThread(int use_max_thread)
+{
+  use_max_thread_ = (use_max_thread != 0);
+}
+
+void Renderer::SetThreadCount(int thread_count)
+{
+  const int max_thread_count = MtGetMaxAvailableThreadCount();
+
+  if (thread_count < 1) {
+    thread_count_ = 1;
+  } else if (thread_count > max_thread_count) {
+    thread_count_ = max_thread_count;
+  } else {
+    thread_count_ = thread_count;
+  }
+}
+
+int Renderer::GetThreadCount() const
+{
+  const int max_thread_count = MtGetMaxAvailableThreadCount();
+
+  const int thread_count = use_max_thread_ ? max_thread_count : thread_count_;
+
+  if (host_thread_count_ > 0 && host_thread_count_ < thread_count) {
+    return host_thread_count_;
+  } else {
+    return thread_count;
+  }
+}
+
+void Renderer::SetFrameReportCallback(void *data,
+    FrameStartCallback frame_start,
+    FrameAbortCallback frame_abort,
+    FrameDoneCallback frame_done)
+{
+  CbSetFrameReport(&frame_report_,
+      data,
+      frame_start,
+      frame_abort,
+      frame_done);
+}
+
+void Renderer::SetTileReportCallback(void *data,
+    TileStartCallback tile_start,
+    SampleDoneCallback sample_done,
+    TileDoneCallback tile_done)
+{
+  CbSetTileReport(&tile_report_,
+      data,
+      tile_start,
+      sample_done,
+      tile_done);
+}
+
+void Renderer::Interrupt()
+{
+  interrupted_ = true;
+}
+
+void Renderer::ClearInterrupt()
+{
+  interrupted_ = false;
+}
+
+bool Renderer::IsInterrupted() const
+{
+  return interrupted_;
+}
+
+int Renderer::RenderScene()
+{
+  const int64_t start = TraceNow();
+  int err = 0;
+
+  // benchmarks run up to all available threads
+  host_thread_count_ = host_cpus_.Acquire(MtGetHostCPUDirectory(), MtGetHostCPUBudget(),
+      benchmark_file_.empty() ? GetThreadCount() : MtGetMaxAvailableThreadCount());
+
+  if (!benchmark_file_.empty()) {
+    err = render_benchmark();
+  } else if (!estimate_file_.empty()) {
+    err = render_estimate();
+  } else {
+    err = prepare_rendering();
+    if (!err) {
+      err = execute_rendering();
+    }
+  }
+  ProfileSetEnabled(false);
+
+  host_cpus_.Release();
+  host_thread_count_ = 0;
+
+  TraceEvent("render", "RenderScene", start, TraceNow());
+  if (!trace_file_.empty() && TraceWriteFile(trace_file_)) {
+    std::cerr << "* WARNING: cannot write trace file: " << trace_file_ << "\n\n";
+  }
+
+  if (err) {
+    /* TODO error handling */
+    return -1;
+  }
+
+  return 0;
+}
+
+// TODO TMP REMOVE LATER
+// a camera ray of a stream and its closest surface hit
+class StreamRay {
+public:
+  StreamRay() : sample(NULL), ray(), key(0), shader(NULL), hit(0) {}
+  ~StreamRay() {}
+
+  Sample *sample;
+  Ray ray;
+  // direction then origin for coherent traversal
+  uint64_t key;
+  const Shader *shader;
+  int hit;
+};
+
+// tiles of a loop of render_tile are counted as they start so that the
+// last ones split their samples only when no tile is left in the queues
+class TailSplitting {
+public:
+  TailSplitting() : started_tiles(0), tile_count(0) {}
+  ~TailSplitting() {}
+
+  void Start(int count)
+  {
+    started_tiles = 0;
+    tile_count = count;
+  }
+  bool IsInTail() const { return started_tiles.load() >= tile_count; }
+
+  std::atomic<int> started_tiles;
+  int tile_count;
+};
+
+class Worker {
+public:
+  Worker() : camera(NULL), framebuffer(NULL), sampler(NULL), sample_sequence(0),
+      filter_splatting(false), filter_importance(false),
+      tile_margin(), tile_culling(false), tile_candidates(),
+      primary_hit_cache(NULL), tile_samples(NULL), cached_hits(NULL),
+      recorded_hits(NULL), tile_hits(),
+      tile_costs(NULL), margin_cache(NULL), checkpoint(NULL), output(NULL),
+      coverage(NULL), object_recorder(), metrics(NULL), tail_splitting(NULL),
+      view(0), views(NULL), view_margin_caches(NULL), view_costs(NULL),
+      preview_block_size(0), preview_costs(NULL),
+      farm(NULL), farm_address(), farm_port(0), farm_connected(false),
+      pass(0), has_deadline(false), deadline(), even_passes(NULL),
+      interrupted(NULL), progress(NULL), reporter(NULL), last_tile_done(),
+      aov_layout(NULL), aov_values(), splat_aovs(),
+      ray_streaming(false), stream_rays(), stream_hits(), stream_order(),
+      stream_sorted_rays(), stream_sorted_times(), stream_sorted_hits(),
+      stream_sorted_hit_flags() {}
+  ~Worker()
+  {
+    delete sampler;
+  }
+
+public:
+  int id;
+  int region_id;
+  int region_count;
   int xres, yres;
   int32_t frame_id;
 
-  const Camera *camera;
-  FrameBuffer *framebuffer;
-  Sampler *sampler;
-  Filter filter;
-  std::vector<Sample> pixel_samples;
+  const Camera *camera;
+  CameraRayGenerator camera_rays;
+  FrameBuffer *framebuffer;
+  Sampler *sampler;
+  int sample_sequence;
+  Filter filter;
+  std::vector<Sample> pixel_samples;
+
+  // weighted sums of samples for each pixel of the tile when splatting
+  bool filter_splatting;
+  std::vector<Color4> splat_colors;
+  std::vector<float> splat_weights;
+  std::vector<Real> splat_xweights;
+  // samples were drawn from the filter and are averaged in their pixels
+  bool filter_importance;
+
+  TraceContext context;
+  Rectangle tile_region;
+  // pixels around the tile where its samples can be for the filter
+  Int2 tile_margin;
+  // bounds of instances seen by camera rays of the tile when culling.
+  // camera rays missing all of them are not traced and no ray is traced
+  // for empty tiles
+  bool tile_culling;
+  std::vector<Box> tile_candidates;
+  // camera rays of tiles of the frame shade hits of the last render kept in
+  // the cache if not NULL. cached_hits of the samples of the tile are shaded
+  // if not NULL, otherwise hits are recorded in recorded_hits if not NULL
+  PrimaryHitCache *primary_hit_cache;
+  const Sample *tile_samples;
+  const PrimaryHit *cached_hits;
+  PrimaryHit *recorded_hits;
+  std::vector<PrimaryHit> tile_hits;
+
+  TileReport tile_report;
+
+  const Tiler *tiler;
+  double *tile_costs;
+  // samples in margins and borders are shared with neighbors if not NULL
+  SampleMarginCache *margin_cache;
+  // finished tiles are saved if not NULL
+  RenderCheckpoint *checkpoint;
+  // finished tiles are written if not NULL
+  ExrOutput *output;
+  // objects hit by rays of finished tiles are kept if not NULL
+  TileCoverage *coverage;
+  ObjectRecorder object_recorder;
+  // busy time of tiles is added if not NULL
+  MetricsServer *metrics;
+  // samples of the last tiles are traced by tasks if not NULL
+  TailSplitting *tail_splitting;
+
+  // view of the tile. 0 for the camera of the renderer and i + 1 for
+  // views[i] whose tiles are queued after the tiles of the frame
+  int view;
+  const std::vector<RenderView> *views;
+  SampleMarginCache *view_margin_caches;
+  double *view_costs;
+
+  // pixels of a side of blocks of the preview pass and timings of its tiles
+  int preview_block_size;
+  double *preview_costs;
+
+  // tiles are claimed from the coordinator if not NULL
+  FarmCoordinator *farm;
+  // coordinator of farm workers
+  std::string farm_address;
+  int farm_port;
+  bool farm_connected;
+
+  // progressive pass. tiles of passes after the first one are skipped
+  // once the deadline has passed
+  int pass;
+  bool has_deadline;
+  std::chrono::steady_clock::time_point deadline;
+  // average of even passes of each pixel of the frame for estimating noise
+  // if not NULL
+  Color4 *even_passes;
+
+  // set by Renderer::Interrupt
+  const std::atomic<bool> *interrupted;
+  // samples and tiles done by this worker. the reporter is canceled
+  // by callbacks
+  ProgressCounter *progress;
+  const ProgressReporter *reporter;
+  // when the last tile of this worker ended. the epoch if none did
+  std::chrono::steady_clock::time_point last_tile_done;
+
+  // values of aov channels of samples traced in the tile
+  const AOVLayout *aov_layout;
+  std::vector<float> aov_values;
+  std::vector<float> splat_aovs;
+
+  // buffers reused by all tiles
+  bool ray_streaming;
+  std::vector<StreamRay> stream_rays;
+  std::vector<Intersection> stream_hits;
+  std::vector<int> stream_order;
+  // rays of the stream in the order and their hits
+  std::vector<Ray> stream_sorted_rays;
+  std::vector<Real> stream_sorted_times;
+  std::vector<Intersection> stream_sorted_hits;
+  std::vector<int> stream_sorted_hit_flags;
+};
+//class Worker;
+int Renderer::preprocess_caustics()
+{
+  const std::size_t budget = static_cast<std::size_t>(caustic_photon_memory_ * 1024 * 1024);
+  photon_map_.Init(caustic_photon_count_, budget, caustic_radius_);
+  if (!photon_map_.IsEnabled()) {
+    return 0;
+  }
+
+  const TraceScope trace("render", "PreprocessCaustics");
+  printf("# Tracing Caustic Photons\n");
+  if (photon_map_.GetMaxPhotonCount() < caustic_photon_count_) {
+    std::cerr << "* WARNING: caustic photons are limited to " <<
+        photon_map_.GetMaxPhotonCount() << " by the memory\n";
+  }
+
+  Timer timer;
+  timer.Start();
+
+  const int err = photon_map_.Trace(target_objects_, target_lights_, nlights_);
+  if (err) {
+    return -1;
+  }
+
+  const Elapse elapse = timer.GetElapse();
+  printf("#   Photon Count: %d\n", photon_map_.GetPhotonCount());
+  printf("#   Radius: %g\n", photon_map_.GetRadius());
+  printf("#   Memory: %.3f MB\n", photon_map_.GetMemoryUsage() / (1024. * 1024.));
+  printf("# Tracing Caustic Photons Done\n");
+  printf("#   %dh %dm %ds\n\n", elapse.hour, elapse.min, elapse.sec);
+
+  return 0;
+}
+
+int Renderer::write_denoised_file(const Tiler *tiler) const
+{
+  const TraceScope trace("render", "Denoise");
+  printf("# Denoising\n");
+  if (aov_layout_.GetOffset(AOV_ALBEDO) < 0 ||
+      aov_layout_.GetOffset(AOV_NORMAL) < 0 ||
+      aov_layout_.GetOffset(AOV_DEPTH) < 0) {
+    std::cerr << "* WARNING: denoising without albedo, normal or depth aovs " <<
+        "blurs details\n";
+  }
+
+  Timer timer;
+  timer.Start();
+
+  FrameBuffer denoised;
+  if (DenoiseInto(*framebuffer_, aov_layout_, denoised)) {
+    return -1;
+  }
+
+  const Elapse elapse = timer.GetElapse();
+  printf("# Denoising Done\n");
+  printf("#   %dh %dm %ds\n\n", elapse.hour, elapse.min, elapse.sec);
+
+  const std::string &name = denoised_file_;
+  const bool is_exr = name.size() > 4 && name.compare(name.size() - 4, 4, ".exr") == 0;
+  if (!is_exr) {
+    return WriteFrameBuffer(name, denoised);
+  }
+
+  ExrOutput output;
+  if (output.Start(name, ExrChannelNames("R,G,B,A", 4), tiler, &denoised)) {
+    return -1;
+  }
+  return output.Finish();
+}
+
+static Sampler *new_sampler(const Renderer *renderer);
+static void init_worker(Worker *worker, int id,
+    const Renderer *renderer, const Tiler *tiler);
+static int render_frame_start(Renderer *renderer, const Tiler *tiler);
+static LoopStatus render_tile(void *data, const ThreadContext &context);
+static int render_view_tile(Worker *worker, int iteration_id);
+static void render_frame_done(Renderer *renderer, const Tiler *tiler);
+static uint64_t compute_checkpoint_key(const Renderer *renderer);
+static bool can_keep_last_frame(const Renderer *renderer);
+static void report_restored_tiles(Worker *worker, const std::vector<int> &tile_ids);
+static LoopStatus render_preview_tile(void *data, const ThreadContext &context);
+static int render_farm_worker(Renderer *renderer, std::vector<Worker> &worker_list);
+static int report_remote_tile_start(void *data, int tile_id);
+static void report_remote_tile_done(void *data, int tile_id);
+static void evict_tile(Worker *worker, int tile_id);
+static int count_progressive_passes(const Renderer *renderer);
+static double estimate_noise(const Renderer *renderer, const std::vector<Color4> &even_passes);
+static void start_progressive_pass(const Renderer *renderer, int pass, int pass_count);
+static int poll_interrupt(void *data);
+static std::size_t compute_margin_cache_bytes(const Renderer *renderer, const Tiler *tiler);
+static int write_json_file(const std::string &filename, const std::string &json);
+
+int Renderer::prepare_rendering()
+{
+  int err = 0;
+
+  err = preprocess_camera();
+  if (err) {
+    /* TODO error handling */
+    return -1;
+  }
+
+  // the framebuffer layout and the last frame depend on the tile size
+  if (auto_tilesize_) {
+    choose_tile_size();
+  }
+  keeps_last_frame_ = can_keep_last_frame(this);
+  err = preprocess_framebuffer();
+  if (err) {
+    /* TODO error handling */
+    return -1;
+  }
+
+  // displaced meshes are diced for the footprint of camera rays
+  Ray center_ray;
+  camera_->GetRay(Vector2(.5, .5), 0, &center_ray);
+  TessellationCacheGetGlobal().SetDicingCamera(center_ray.orig,
+      camera_->GetPixelSpread(resolution_[1]));
+
+  err = preprocess_lights();
+  if (err) {
+    /* TODO error handling */
+    return -1;
+  }
+
+  // filled again for each render. progressive passes share it
+  radiance_cache_.Init(radiance_cache_cell_size_, RADIANCE_CACHE_ENTRY_COUNT);
+  transmittance_cache_.Init(transmittance_cache_cell_size_, TRANSMITTANCE_CACHE_ENTRY_COUNT);
+
+  err = preprocess_caustics();
+  if (err) {
+    /* TODO error handling */
+    return -1;
+  }
+
+  return 0;
+}
+
+// incremental renders use no timings so that the tile size and the tiles
+// of the last frame are kept
+void Renderer::choose_tile_size()
+{
+  const int width = std::min(frame_region_.max[0], resolution_[0]) -
+      std::max(frame_region_.min[0], 0);
+  const int height = std::min(frame_region_.max[1], resolution_[1]) -
+      std::max(frame_region_.min[1], 0);
+  const int size = TilerChooseTileSize(width, height, GetThreadCount(),
+      pixelsamples_[0] * pixelsamples_[1], std::max(filterwidth_[0], filterwidth_[1]),
+      incremental_render_ ? 0 : pixel_seconds_);
+  SetTileSize(size, size);
+}
+
+int Renderer::execute_rendering()
+{
+  const int thread_count = GetThreadCount();
+
+  const int xres = resolution_[0];
+  const int yres = resolution_[1];
+  const int xtilesize = tilesize_[0];
+  const int ytilesize = tilesize_[1];
+
+  // Frame ID
+  frame_id_ = generate_frame_id();
+
+  // Tiler
+  Tiler tiler;
+  tiler.Divide(xres, yres, xtilesize, ytilesize);
+  tiler.GenerateTiles(frame_region_);
+  const int tile_count = tiler.GetTileCount();
+
+  // Iteration number que for parallel loop
+  std::vector<int> iteration_que;
+  tiler.GetTileOrder(tile_order_, tile_costs_, &iteration_que);
+
+  // timings from a different tiling are meaningless
+  if (static_cast<int>(tile_costs_.size()) != tile_count) {
+    tile_costs_.assign(tile_count, 0.);
+  }
+
+  // Views
+  // farm workers render tiles of the frame of the coordinator
+  const int view_count = farm_mode_ == RENDERER_FARM_WORKER ? 0 : views_.size();
+  const int frame_tile_count = tile_count * (1 + view_count);
+  if (static_cast<int>(view_tile_costs_.size()) != tile_count * view_count) {
+    view_tile_costs_.assign(tile_count * view_count, 0.);
+  }
+
+  // tiles of the frame not rendered again
+  std::vector<int> restored_tiles;
+
+  // Checkpoint
+  // passes after the first one change finished tiles
+  RenderCheckpoint checkpoint;
+  if (!checkpoint_file_.empty() && !progressive_ &&
+      farm_mode_ != RENDERER_FARM_WORKER) {
+    const int restored = checkpoint.Start(checkpoint_file_, checkpoint_interval_,
+        compute_checkpoint_key(this), &tiler, framebuffer_);
+    if (restored > 0) {
+      printf("# Resuming from Checkpoint\n");
+      printf("#   %d of %d tiles restored from %s\n\n",
+          restored, tile_count, checkpoint_file_.c_str());
+
+      std::vector<int> remaining;
+      for (std::size_t i = 0; i < iteration_que.size(); i++) {
+        if (!checkpoint.IsTileDone(iteration_que[i])) {
+          remaining.push_back(iteration_que[i]);
+        } else {
+          restored_tiles.push_back(iteration_que[i]);
+        }
+      }
+      iteration_que.swap(remaining);
+    }
+  }
+
+  // Incremental
+  // tiles whose rays hit no edited objects are kept from the last render
+  if (incremental_render_) {
+    if (!keeps_last_frame_) {
+      tile_coverage_.Init(compute_checkpoint_key(this), tile_count);
+    }
+
+    std::vector<int> remaining;
+    for (std::size_t i = 0; i < iteration_que.size(); i++) {
+      if (!tile_coverage_.IsTileRendered(iteration_que[i])) {
+        remaining.push_back(iteration_que[i]);
+      } else {
+        restored_tiles.push_back(iteration_que[i]);
+      }
+    }
+    if (keeps_last_frame_) {
+      printf("# Incremental Render\n");
+      printf("#   %d of %d tiles kept from the last render\n\n",
+          static_cast<int>(iteration_que.size() - remaining.size()), tile_count);
+    }
+    iteration_que.swap(remaining);
+  }
+
+  // Output
+  // workers write the file on the coordinator
+  ExrOutput output;
+  if (!output_file_.empty() && farm_mode_ != RENDERER_FARM_WORKER) {
+    std::string names = output_channels_;
+    if (names.empty() && !aov_layout_.IsEmpty()) {
+      names = "R,G,B,A," + aov_layout_.GetChannelNames();
+    }
+    const std::vector<std::string> channel_names =
+        ExrChannelNames(names, framebuffer_->GetChannelCount());
+    if (output.Start(output_file_, channel_names, &tiler, framebuffer_)) {
+      std::cerr << "* WARNING: cannot write output file: " << output_file_ << "\n\n";
+    }
+  }
+  // passes after the first one change finished tiles
+  const bool is_output_streamed = output.IsEnabled() && count_progressive_passes(this) == 1;
+
+  // Worker
+  TailSplitting tail_splitting;
+  std::vector<Worker> worker_list(thread_count);
+  for (std::size_t i = 0; i < worker_list.size(); i++) {
+    init_worker(&worker_list[i], i, this, &tiler);
+    worker_list[i].tile_costs = tile_costs_.empty() ? NULL : &tile_costs_[0];
+    worker_list[i].checkpoint = checkpoint.IsEnabled() ? &checkpoint : NULL;
+    worker_list[i].output = is_output_streamed ? &output : NULL;
+    worker_list[i].views = &views_;
+    worker_list[i].metrics = &metrics_;
+    // other samplers place samples by traced results so they take all samples at once
+    worker_list[i].tail_splitting =
+        tail_splitting_ && sampler_type_ == RENDERER_FIXED_GRID_SAMPLER ? &tail_splitting : NULL;
+    worker_list[i].view_costs = view_tile_costs_.empty() ? NULL : &view_tile_costs_[0];
+    if (incremental_render_) {
+      worker_list[i].coverage = &tile_coverage_;
+      worker_list[i].context.object_recorder = &worker_list[i].object_recorder;
+    }
+  }
+
+  // Primary hits
+  // other samplers place samples by shaded results
+  if (primary_hit_cache_memory_ > 0 && sampler_type_ == RENDERER_FIXED_GRID_SAMPLER &&
+      !ray_streaming_ && farm_mode_ == RENDERER_FARM_NONE) {
+    primary_hit_cache_.Init(compute_checkpoint_key(this),
+        tile_count * count_progressive_passes(this),
+        static_cast<std::size_t>(primary_hit_cache_memory_ * 1024 * 1024));
+    for (std::size_t i = 0; i < worker_list.size(); i++) {
+      worker_list[i].primary_hit_cache = &primary_hit_cache_;
+    }
+
+    int cached_slots = 0;
+    for (int i = 0; i < primary_hit_cache_.GetSlotCount(); i++) {
+      cached_slots += primary_hit_cache_.GetHits(i) != NULL;
+    }
+    if (cached_slots > 0) {
+      printf("# Primary Hit Cache\n");
+      printf("#   %d of %d tiles shade hits of the last render (%g MB)\n\n",
+          cached_slots, primary_hit_cache_.GetSlotCount(),
+          primary_hit_cache_.GetMemoryUsage() / (1024. * 1024.));
+    }
+  } else {
+    primary_hit_cache_.Clear();
+  }
+
+  // Sample margins
+  // disabled for samplers not placing samples in a grid
+  SampleMarginCache margin_cache;
+  margin_cache.Init(&tiler, Int2(pixelsamples_[0], pixelsamples_[1]), worker_list[0].sampler->GetSampleMargin(),
+      4 + aov_layout_.GetChannelCount());
+  // samples shared with neighbors would hide their objects from the tiles
+  const bool shares_margins = margin_cache.IsEnabled() && !incremental_render_;
+  // views have no coverage to hide objects from
+  std::vector<SampleMarginCache> view_margin_caches(margin_cache.IsEnabled() ? view_count : 0);
+  for (std::size_t i = 0; i < view_margin_caches.size(); i++) {
+    view_margin_caches[i].Init(&tiler, Int2(pixelsamples_[0], pixelsamples_[1]),
+        worker_list[0].sampler->GetSampleMargin(), 4 + aov_layout_.GetChannelCount());
+  }
+  for (std::size_t i = 0; i < worker_list.size(); i++) {
+    worker_list[i].margin_cache = shares_margins ? &margin_cache : NULL;
+    worker_list[i].view_margin_caches =
+        view_margin_caches.empty() ? NULL : &view_margin_caches[0];
+  }
+
+  // FrameProgress
+  init_frame_progress(&frame_progress_);
+
+  // Progress
+  // one more counter for tiles of farm workers. progress lines are printed
+  // with the default callbacks and not for the partial frame of a farm worker
+  ProgressReporter reporter;
+  reporter.Init(thread_count + 1, poll_interrupt, this);
+  for (std::size_t i = 0; i < worker_list.size(); i++) {
+    worker_list[i].progress = reporter.GetCounter(i);
+    worker_list[i].reporter = &reporter;
+  }
+  const bool print_progress = frame_report_.data == &frame_progress_ &&
+      farm_mode_ != RENDERER_FARM_WORKER;
+
+  // Run sampling
+  const int err = render_frame_start(this, &tiler);
+  if (err) {
+    return -1;
+  }
+  reporter.Start(frame_tile_count, print_progress);
+  metrics_.StartRender(&reporter, frame_tile_count, thread_count);
+  report_restored_tiles(&worker_list[0], restored_tiles);
+
+  if (farm_mode_ == RENDERER_FARM_WORKER) {
+    const int farm_err = render_farm_worker(this, worker_list);
+    metrics_.FinishRender();
+    render_frame_done(this, &tiler);
+    return farm_err;
+  }
+
+  // Preview
+  // the timings order tiles when there are none of the previous render
+  if (preview_pass_ && !iteration_que.empty()) {
+    std::vector<double> preview_costs(tile_count, 0.);
+    for (std::size_t i = 0; i < worker_list.size(); i++) {
+      worker_list[i].preview_costs = &preview_costs[0];
+    }
+
+    const int level_count = sizeof(PREVIEW_BLOCK_SIZES) / sizeof(PREVIEW_BLOCK_SIZES[0]);
+    for (int level = 0; level < level_count; level++) {
+      for (std::size_t i = 0; i < worker_list.size(); i++) {
+        worker_list[i].preview_block_size = PREVIEW_BLOCK_SIZES[level];
+      }
+      const LoopStatus status =
+          MtRunParallelLoop(&worker_list[0], render_preview_tile, thread_count, iteration_que);
+      if (status == LoopStatus::Cancel) {
+        break;
+      }
+    }
+
+    const bool has_costs = std::find_if(tile_costs_.begin(), tile_costs_.end(),
+        [](double cost) { return cost > 0; }) != tile_costs_.end();
+    if (tile_order_ == TILE_ORDER_COST && !has_costs) {
+      std::vector<char> is_queued(tile_count, 0);
+      for (std::size_t i = 0; i < iteration_que.size(); i++) {
+        is_queued[iteration_que[i]] = 1;
+      }
+      std::vector<int> order;
+      tiler.GetTileOrder(tile_order_, preview_costs, &order);
+      iteration_que.clear();
+      for (std::size_t i = 0; i < order.size(); i++) {
+        if (is_queued[order[i]]) {
+          iteration_que.push_back(order[i]);
+        }
+      }
+    }
+  }
+
+  // Farm
+  // tiles of farm workers are reported as tiles of one more worker
+  Worker remote;
+  FarmCoordinator farm;
+  if (farm_mode_ == RENDERER_FARM_COORDINATOR) {
+    init_worker(&remote, thread_count, this, &tiler);
+    remote.progress = reporter.GetCounter(thread_count);
+    remote.reporter = &reporter;
+    remote.checkpoint = worker_list[0].checkpoint;
+    remote.output = worker_list[0].output;
+
+    const int farm_err = farm.Start(farm_port_, frame_id_, &tiler, iteration_que,
+        framebuffer_, &remote, report_remote_tile_start, report_remote_tile_done);
+    if (farm_err) {
+      std::cerr << "* WARNING: cannot listen to farm workers on port " <<
+          farm_port_ << ": " << SocketErrorMessage() << "\n\n";
+    } else {
+      printf("# Farm Coordinator\n");
+      printf("#   Port: %d\n\n", farm_port_);
+      for (std::size_t i = 0; i < worker_list.size(); i++) {
+        worker_list[i].farm = &farm;
+      }
+    }
+  }
+
+  // tiles of views follow the same tile of the frame. views have no
+  // restored tiles
+  if (view_count > 0) {
+    std::vector<char> is_queued(tile_count, 0);
+    for (std::size_t i = 0; i < iteration_que.size(); i++) {
+      is_queued[iteration_que[i]] = 1;
+    }
+    std::vector<int> view_que;
+    for (std::size_t i = 0; i < iteration_que.size(); i++) {
+      view_que.push_back(iteration_que[i]);
+      for (int view = 1; view <= view_count; view++) {
+        view_que.push_back(view * tile_count + iteration_que[i]);
+      }
+    }
+    for (int tile_id = 0; tile_id < tile_count; tile_id++) {
+      for (int view = 1; view <= view_count && !is_queued[tile_id]; view++) {
+        view_que.push_back(view * tile_count + tile_id);
+      }
+    }
+    iteration_que.swap(view_que);
+  }
+
+  const int pass_count = count_progressive_passes(this);
+  const std::chrono::steady_clock::time_point tiles_start = std::chrono::steady_clock::now();
+  const bool has_time_limit = progressive_ && progressive_time_limit_ > 0;
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(progressive_time_limit_));
+
+  // Noise
+  const bool has_noise_threshold = pass_count > 1 && progressive_noise_threshold_ > 0;
+  std::vector<Color4> even_passes;
+  if (has_noise_threshold) {
+    even_passes.resize(xres * yres);
+    for (std::size_t i = 0; i < worker_list.size(); i++) {
+      worker_list[i].even_passes = &even_passes[0];
+    }
+  }
+
+  for (int pass = 0; pass < pass_count; pass++) {
+    for (std::size_t i = 0; i < worker_list.size(); i++) {
+      Worker &worker = worker_list[i];
+      worker.pass = pass;
+      worker.has_deadline = has_time_limit && pass > 0;
+      worker.deadline = deadline;
+      worker.sampler->SetSampleSeed(pass);
+    }
+    if (pass > 0) {
+      reporter.Stop();
+      start_progressive_pass(this, pass, pass_count);
+      reporter.Start(frame_tile_count, print_progress);
+    }
+
+    tail_splitting.Start(iteration_que.size());
+    LoopStatus status =
+        MtRunParallelLoop(&worker_list[0], render_tile, thread_count, iteration_que);
+
+    if (worker_list[0].farm != NULL) {
+      // tiles given back by farm workers that disconnected
+      std::vector<int> returned_que;
+      while (status == LoopStatus::Continue && farm.WaitForTiles(&returned_que) > 0) {
+        tail_splitting.Start(returned_que.size());
+        status = MtRunParallelLoop(&worker_list[0], render_tile, thread_count, returned_que);
+      }
+      if (status == LoopStatus::Cancel) {
+        farm.Abort();
+      }
+    }
+
+    if (status == LoopStatus::Cancel) {
+      break;
+    }
+    if (has_time_limit && std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    if (has_noise_threshold && pass > 0) {
+      const double noise = estimate_noise(this, even_passes);
+      printf("#   Estimated Noise: %g\n", noise);
+      if (noise <= progressive_noise_threshold_) {
+        break;
+      }
+    }
+  }
+
+  reporter.Stop();
+  metrics_.FinishRender();
+  if (interrupted_ || reporter.IsCanceled()) {
+    printf("\n# Render Interrupted\n");
+  }
+
+  thread_done_seconds_.assign(thread_count, 0.);
+  for (int i = 0; i < thread_count; i++) {
+    if (worker_list[i].last_tile_done > tiles_start) {
+      thread_done_seconds_[i] = std::chrono::duration<double>(
+          worker_list[i].last_tile_done - tiles_start).count();
+    }
+  }
+
+  farm.Stop();
+  checkpoint.Finish();
+  output.Finish();
+  render_frame_done(this, &tiler);
+
+  // for the auto tile size of the next render
+  double seconds = 0;
+  double pixels = 0;
+  for (int i = 0; i < tile_count; i++) {
+    if (tile_costs_[i] > 0) {
+      const Tile *tile = tiler.GetTile(i);
+      seconds += tile_costs_[i];
+      pixels += (tile->xmax - tile->xmin) * static_cast<double>(tile->ymax - tile->ymin);
+    }
+  }
+  if (pixels > 0) {
+    pixel_seconds_ = seconds / pixels;
+  }
+
+  if (!denoised_file_.empty() && write_denoised_file(&tiler)) {
+    std::cerr << "* WARNING: cannot write denoised file: " << denoised_file_ << "\n\n";
+  }
+
+  return 0;
+}
+
+// the render of a frame at the estimate resolution with one sample per pixel
+// and tiles of the same count scaled with the resolution. seconds of each
+// tile are scaled by the ratio of its samples to those of the full frame
+int Renderer::render_estimate()
+{
+  const TraceScope trace("render", "RenderEstimate");
+
+  // tiles of the estimate are scaled from the tile size of the full frame
+  if (auto_tilesize_) {
+    choose_tile_size();
+  }
+
+  // settings of the full frame
+  const int full_res[2] = {resolution_[0], resolution_[1]};
+  const Rectangle full_region = frame_region_;
+  const int full_tilesize[2] = {tilesize_[0], tilesize_[1]};
+  const int full_auto_tilesize = auto_tilesize_;
+  const double full_pixel_seconds = pixel_seconds_;
+  const int full_samples[2] = {pixelsamples_[0], pixelsamples_[1]};
+  const int full_passes = count_progressive_passes(this);
+  const double time_limit = progressive_ ? progressive_time_limit_ : 0;
+  const int full_progressive = progressive_;
+  const int full_incremental = incremental_render_;
+  const int full_farm_mode = farm_mode_;
+  const int full_preview = preview_pass_;
+  const std::string full_checkpoint_file = checkpoint_file_;
+  const std::string full_output_file = output_file_;
+  const std::string full_denoised_file = denoised_file_;
+  const std::string full_framebuffer_file = framebuffer_file_;
+  const std::vector<double> full_costs = tile_costs_;
+  const std::vector<double> full_view_costs = view_tile_costs_;
+
+  const double scale = estimate_resolution_scale_;
+  const int xres = std::max(1, static_cast<int>(full_res[0] * scale + .5));
+  const int yres = std::max(1, static_cast<int>(full_res[1] * scale + .5));
+  const double xratio = full_res[0] / static_cast<double>(xres);
+  const double yratio = full_res[1] / static_cast<double>(yres);
+  const int xmin = std::min(xres - 1, static_cast<int>(full_region.min[0] / xratio));
+  const int ymin = std::min(yres - 1, static_cast<int>(full_region.min[1] / yratio));
+  const int xmax = std::max(xmin + 1, std::min(xres, static_cast<int>(ceil(full_region.max[0] / xratio))));
+  const int ymax = std::max(ymin + 1, std::min(yres, static_cast<int>(ceil(full_region.max[1] / yratio))));
+
+  SetResolution(xres, yres);
+  SetRenderRegion(xmin, ymin, xmax, ymax);
+  SetTileSize(std::max(1, static_cast<int>(full_tilesize[0] * scale + .5)),
+      std::max(1, static_cast<int>(full_tilesize[1] * scale + .5)));
+  SetPixelSamples(1, 1);
+  auto_tilesize_ = 0;
+  progressive_ = 0;
+  incremental_render_ = 0;
+  farm_mode_ = RENDERER_FARM_NONE;
+  preview_pass_ = 0;
+  checkpoint_file_.clear();
+  output_file_.clear();
+  denoised_file_.clear();
+  framebuffer_file_.clear();
+  tile_costs_.clear();
+  view_tile_costs_.clear();
+
+  printf("# Render Estimate\n");
+  printf("#   Resolution: %d x %d\n", xres, yres);
+  printf("#   Estimate File: %s\n\n", estimate_file_.c_str());
+
+  // the estimate renders into empty framebuffers so that the pixels of
+  // the last render are kept
+  std::vector<FrameBuffer> full_framebuffers(1 + views_.size());
+  if (framebuffer_ != NULL) {
+    full_framebuffers[0].Swap(*framebuffer_);
+  }
+  for (std::size_t i = 0; i < views_.size(); i++) {
+    full_framebuffers[i + 1].Swap(*views_[i].framebuffer);
+  }
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int err = prepare_rendering();
+  const std::chrono::steady_clock::time_point prepared = std::chrono::steady_clock::now();
+  if (!err) {
+    // geometry is diced as finely as for the full frame
+    Ray center_ray;
+    camera_->GetRay(Vector2(.5, .5), 0, &center_ray);
+    TessellationCacheGetGlobal().SetDicingCamera(center_ray.orig,
+        camera_->GetPixelSpread(full_res[1]));
+    err = execute_rendering();
+  }
+  const std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+
+  Tiler tiler;
+  tiler.Divide(xres, yres, tilesize_[0], tilesize_[1]);
+  tiler.GenerateTiles(frame_region_);
+  const int tile_count = tiler.GetTileCount();
+  const int view_count = 1 + views_.size();
+  // tiles of views follow those of the frame
+  std::vector<double> estimate_costs = tile_costs_;
+  estimate_costs.insert(estimate_costs.end(), view_tile_costs_.begin(), view_tile_costs_.end());
+  std::size_t estimate_bytes = compute_margin_cache_bytes(this, &tiler) * view_count;
+  if (framebuffer_ != NULL) {
+    estimate_bytes += framebuffer_->GetMemoryUsage();
+    framebuffer_->Swap(full_framebuffers[0]);
+  }
+  for (std::size_t i = 0; i < views_.size(); i++) {
+    estimate_bytes += views_[i].framebuffer->GetMemoryUsage();
+    views_[i].framebuffer->Swap(full_framebuffers[i + 1]);
+  }
+
+  SetResolution(full_res[0], full_res[1]);
+  SetRenderRegion(full_region.min[0], full_region.min[1],
+      full_region.max[0], full_region.max[1]);
+  SetTileSize(full_tilesize[0], full_tilesize[1]);
+  SetPixelSamples(full_samples[0], full_samples[1]);
+  auto_tilesize_ = full_auto_tilesize;
+  pixel_seconds_ = full_pixel_seconds;
+  progressive_ = full_progressive;
+  incremental_render_ = full_incremental;
+  farm_mode_ = full_farm_mode;
+  preview_pass_ = full_preview;
+  checkpoint_file_ = full_checkpoint_file;
+  output_file_ = full_output_file;
+  denoised_file_ = full_denoised_file;
+  framebuffer_file_ = full_framebuffer_file;
+  tile_costs_ = full_costs;
+  view_tile_costs_ = full_view_costs;
+
+  if (err || interrupted_ || static_cast<int>(estimate_costs.size()) != tile_count * view_count) {
+    return -1;
+  }
+
+  // passes of time and noise limits are unknown
+  const bool has_pass_count = full_passes != INT_MAX;
+  const double sample_ratio = xratio * yratio * full_samples[0] * full_samples[1] *
+      (has_pass_count ? full_passes : 1);
+
+  // tiles are given to the first free thread in the tile order
+  const int thread_count = GetThreadCount();
+  std::vector<int> tile_que;
+  tiler.GetTileOrder(tile_order_,
+      std::vector<double>(estimate_costs.begin(), estimate_costs.begin() + tile_count),
+      &tile_que);
+  std::vector<double> thread_seconds(thread_count, 0.);
+  double total_seconds = 0;
+  for (std::size_t i = 0; i < tile_que.size(); i++) {
+    for (int view = 0; view < view_count; view++) {
+      const double seconds = estimate_costs[view * tile_count + tile_que[i]] * sample_ratio;
+      *std::min_element(thread_seconds.begin(), thread_seconds.end()) += seconds;
+      total_seconds += seconds;
+    }
+  }
+  double render_seconds = *std::max_element(thread_seconds.begin(), thread_seconds.end());
+  if (!has_pass_count && time_limit > 0) {
+    render_seconds = std::max(render_seconds, time_limit);
+  }
+
+  // memory growing with the resolution and samples replaces that of the
+  // estimate. file backed framebuffers keep tiles being rendered
+  Tiler full_tiler;
+  full_tiler.Divide(full_res[0], full_res[1], full_tilesize[0], full_tilesize[1]);
+  full_tiler.GenerateTiles(frame_region_);
+  const int bytes_per_value = framebuffer_format_ == FB_FORMAT_HALF ? 2 : 4;
+  const std::size_t pixel_count = static_cast<std::size_t>(full_res[0]) * full_res[1];
+  const std::size_t pixel_bytes = pixel_count * (4 + aov_layout_.GetChannelCount()) * bytes_per_value;
+  const std::size_t framebuffer_bytes =
+      (full_framebuffer_file.empty() ? pixel_bytes : 0) + pixel_bytes * views_.size();
+  const std::size_t margin_cache_bytes =
+      compute_margin_cache_bytes(this, &full_tiler) * view_count;
+  const std::size_t noise_bytes = full_passes > 1 && progressive_noise_threshold_ > 0 ?
+      pixel_count * sizeof(Color4) : 0;
+  const long long peak_usage = OsGetPeakMemoryUsage();
+  const long long peak_memory = peak_usage < 0 ? -1 :
+      peak_usage - static_cast<long long>(estimate_bytes) +
+      static_cast<long long>(framebuffer_bytes + margin_cache_bytes + noise_bytes);
+
+  const double prepare_seconds = std::chrono::duration<double>(prepared - start).count();
+  const double estimate_seconds = std::chrono::duration<double>(done - prepared).count();
+
+  char buf[256] = {'\0'};
+  std::string json = "{\n";
+  sprintf(buf, "  \"resolution\": [%d, %d],\n", full_res[0], full_res[1]);
+  json += buf;
+  sprintf(buf, "  \"render_region\": [%d, %d, %d, %d],\n",
+      full_region.min[0], full_region.min[1], full_region.max[0], full_region.max[1]);
+  json += buf;
+  sprintf(buf, "  \"pixel_samples\": [%d, %d],\n", full_samples[0], full_samples[1]);
+  json += buf;
+  sprintf(buf, "  \"passes\": %d,\n", has_pass_count ? full_passes : -1);
+  json += buf;
+  sprintf(buf, "  \"threads\": %d,\n", thread_count);
+  json += buf;
+  sprintf(buf, "  \"estimate_resolution\": [%d, %d],\n", xres, yres);
+  json += buf;
+  sprintf(buf, "  \"estimate_seconds\": %g,\n", estimate_seconds);
+  json += buf;
+  sprintf(buf, "  \"prepare_seconds\": %g,\n", prepare_seconds);
+  json += buf;
+  sprintf(buf, "  \"render_seconds\": %g,\n", render_seconds);
+  json += buf;
+  sprintf(buf, "  \"total_seconds\": %g,\n", prepare_seconds + render_seconds);
+  json += buf;
+  sprintf(buf, "  \"thread_seconds\": %g,\n", total_seconds);
+  json += buf;
+  sprintf(buf, "  \"framebuffer_bytes\": %llu,\n",
+      static_cast<unsigned long long>(framebuffer_bytes));
+  json += buf;
+  sprintf(buf, "  \"sample_margin_bytes\": %llu,\n",
+      static_cast<unsigned long long>(margin_cache_bytes));
+  json += buf;
+  sprintf(buf, "  \"peak_memory_bytes\": %lld,\n", peak_memory);
+  json += buf;
+  json += "  \"tiles\": [";
+  for (int i = 0; i < tile_count * view_count; i++) {
+    // regions of the full frame. view 0 is the camera of the renderer
+    const Tile *tile = tiler.GetTile(i % tile_count);
+    sprintf(buf, "%s\n    {\"view\": %d, \"region\": [%d, %d, %d, %d], \"seconds\": %g}",
+        i > 0 ? "," : "", i / tile_count,
+        std::max(full_region.min[0], static_cast<int>(tile->xmin * xratio + .5)),
+        std::max(full_region.min[1], static_cast<int>(tile->ymin * yratio + .5)),
+        std::min(full_region.max[0], static_cast<int>(tile->xmax * xratio + .5)),
+        std::min(full_region.max[1], static_cast<int>(tile->ymax * yratio + .5)),
+        estimate_costs[i] * sample_ratio);
+    json += buf;
+  }
+  json += "\n  ]\n}\n";
+
+  printf("# Render Estimate Done\n");
+  printf("#   Render Time: %g sec\n", render_seconds);
+  if (peak_memory >= 0) {
+    printf("#   Peak Memory: %g MB\n", peak_memory / (1024. * 1024.));
+  }
+  printf("\n");
+
+  if (write_json_file(estimate_file_, json)) {
+    std::cerr << "* WARNING: cannot write estimate file: " << estimate_file_ << "\n\n";
+  }
+
+  return 0;
+}
+
+// renders of the frame with each thread count after one preparation of the
+// scene. the time of tiles summed over threads grows with the threads when
+// they contend for locks, caches or memory bandwidth. the tail is the time
+// from the first thread running out of tiles to the last tile done
+int Renderer::render_benchmark()
+{
+  const TraceScope trace("render", "RenderBenchmark");
+
+  const int max_thread_count = MtGetMaxAvailableThreadCount();
+  std::vector<int> thread_counts;
+  for (std::size_t i = 0; i < benchmark_thread_counts_.size(); i++) {
+    thread_counts.push_back(std::min(benchmark_thread_counts_[i], max_thread_count));
+  }
+  if (thread_counts.empty()) {
+    for (int count = 1; count < max_thread_count; count *= 2) {
+      thread_counts.push_back(count);
+    }
+    thread_counts.push_back(max_thread_count);
+  }
+  std::sort(thread_counts.begin(), thread_counts.end());
+  thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()),
+      thread_counts.end());
+
+  // settings writing files or keeping tiles of the previous render
+  const int full_use_max_thread = use_max_thread_;
+  const int full_thread_count = thread_count_;
+  const int full_progressive = progressive_;
+  const int full_incremental = incremental_render_;
+  const int full_farm_mode = farm_mode_;
+  const int full_preview = preview_pass_;
+  const std::string full_checkpoint_file = checkpoint_file_;
+  const std::string full_output_file = output_file_;
+  const std::string full_denoised_file = denoised_file_;
+
+  use_max_thread_ = 0;
+  progressive_ = 0;
+  incremental_render_ = 0;
+  farm_mode_ = RENDERER_FARM_NONE;
+  preview_pass_ = 0;
+  checkpoint_file_.clear();
+  output_file_.clear();
+  denoised_file_.clear();
+
+  printf("# Render Benchmark\n");
+  printf("#   Thread Counts:");
+  for (std::size_t i = 0; i < thread_counts.size(); i++) {
+    printf(" %d", thread_counts[i]);
+  }
+  printf("\n");
+  printf("#   Benchmark File: %s\n\n", benchmark_file_.c_str());
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int err = prepare_rendering();
+  const std::chrono::steady_clock::time_point prepared = std::chrono::steady_clock::now();
+
+  // the first render fills texture and tessellation caches and is not
+  // counted
+  if (!err) {
+    thread_count_ = thread_counts.back();
+    err = execute_rendering();
+  }
+
+  std::vector<int> threads;
+  std::vector<double> seconds;
+  std::vector<double> tile_seconds;
+  std::vector<double> tail_seconds;
+  for (std::size_t i = 0; i < thread_counts.size() && !err && !interrupted_; i++) {
+    thread_count_ = thread_counts[i];
+    const std::chrono::steady_clock::time_point render_start = std::chrono::steady_clock::now();
+    err = execute_rendering();
+    const std::chrono::steady_clock::time_point render_done = std::chrono::steady_clock::now();
+
+    double tile_sum = 0;
+    for (std::size_t j = 0; j < tile_costs_.size(); j++) {
+      tile_sum += tile_costs_[j];
+    }
+    for (std::size_t j = 0; j < view_tile_costs_.size(); j++) {
+      tile_sum += view_tile_costs_[j];
+    }
+    threads.push_back(GetThreadCount());
+    seconds.push_back(std::chrono::duration<double>(render_done - render_start).count());
+    tile_seconds.push_back(tile_sum);
+    tail_seconds.push_back(
+        *std::max_element(thread_done_seconds_.begin(), thread_done_seconds_.end()) -
+        *std::min_element(thread_done_seconds_.begin(), thread_done_seconds_.end()));
+  }
+
+  use_max_thread_ = full_use_max_thread;
+  thread_count_ = full_thread_count;
+  progressive_ = full_progressive;
+  incremental_render_ = full_incremental;
+  farm_mode_ = full_farm_mode;
+  preview_pass_ = full_preview;
+  checkpoint_file_ = full_checkpoint_file;
+  output_file_ = full_output_file;
+  denoised_file_ = full_denoised_file;
+
+  if (err || interrupted_ || threads.empty()) {
+    return -1;
+  }
+
+  const double prepare_seconds = std::chrono::duration<double>(prepared - start).count();
+
+  char buf[256] = {'\0'};
+  std::string json = "{\n";
+  sprintf(buf, "  \"resolution\": [%d, %d],\n", resolution_[0], resolution_[1]);
+  json += buf;
+  sprintf(buf, "  \"render_region\": [%d, %d, %d, %d],\n",
+      frame_region_.min[0], frame_region_.min[1], frame_region_.max[0], frame_region_.max[1]);
+  json += buf;
+  sprintf(buf, "  \"pixel_samples\": [%d, %d],\n", pixelsamples_[0], pixelsamples_[1]);
+  json += buf;
+  sprintf(buf, "  \"available_threads\": %d,\n", max_thread_count);
+  json += buf;
+  sprintf(buf, "  \"prepare_seconds\": %g,\n", prepare_seconds);
+  json += buf;
+  json += "  \"runs\": [";
+
+  printf("# Render Benchmark Done\n");
+  printf("#   %7s %10s %8s %10s %9s %8s\n",
+      "Threads", "Seconds", "Speedup", "Efficiency", "Tile Time", "Tail");
+  // speedup of the smallest count is taken as linear
+  for (std::size_t i = 0; i < threads.size(); i++) {
+    const double speedup = seconds[0] / seconds[i] * threads[0];
+    const double efficiency = speedup / threads[i];
+    const double tile_growth = tile_seconds[0] > 0 ? tile_seconds[i] / tile_seconds[0] : 1;
+    const double tail = seconds[i] > 0 ? tail_seconds[i] / seconds[i] : 0;
+
+    sprintf(buf, "%s\n    {\"threads\": %d, \"seconds\": %g, \"speedup\": %g, "
+        "\"efficiency\": %g, \"tile_seconds\": %g, \"tile_time_growth\": %g, "
+        "\"tail_seconds\": %g}",
+        i > 0 ? "," : "", threads[i], seconds[i], speedup, efficiency,
+        tile_seconds[i], tile_growth, tail_seconds[i]);
+    json += buf;
+
+    printf("#   %7d %10.3f %8.2f %9.0f%% %8.2fx %7.0f%%", threads[i], seconds[i],
+        speedup, efficiency * 100, tile_growth, tail * 100);
+    // the larger loss of a count scaling poorly
+    if (efficiency < .8) {
+      printf(tile_growth - 1 > tail ? "  <- contention" : "  <- tail imbalance");
+    }
+    printf("\n");
+  }
+  json += "\n  ]\n}\n";
+  printf("\n");
+
+  if (write_json_file(benchmark_file_, json)) {
+    std::cerr << "* WARNING: cannot write benchmark file: " << benchmark_file_ << "\n\n";
+  }
+
+  return 0;
+}
+
+int Renderer::preprocess_camera() const
+{
+  if (camera_ == NULL)
+    return -1;
+
+  const int xres = resolution_[0];
+  const int yres = resolution_[1];
+  camera_->SetAspect(xres/(double)yres);
+  for (std::size_t i = 0; i < views_.size(); i++) {
+    views_[i].camera->SetAspect(xres/(double)yres);
+  }
+
+  return 0;
+}
+
+int Renderer::preprocess_framebuffer() const
+{
+  if (framebuffer_ == NULL)
+    return -1;
+
+  const int xres = resolution_[0];
+  const int yres = resolution_[1];
+  // tiles of the file are evicted as they finish
+  const bool tiled = tiled_framebuffer_ || !framebuffer_file_.empty();
+  framebuffer_->SetTileLayout(tiled ? tilesize_[0] : 0, tiled ? tilesize_[1] : 0);
+  framebuffer_->SetBackingFile(framebuffer_file_);
+  framebuffer_->SetFormat(framebuffer_format_);
+  if (!keeps_last_frame_) {
+    framebuffer_->Resize(xres, yres, 4 + aov_layout_.GetChannelCount());
+  }
+
+  if (framebuffer_->IsEmpty()) {
+    std::cerr << "* ERROR: cannot allocate framebuffer";
+    if (!framebuffer_file_.empty()) {
+      std::cerr << " in file: " << framebuffer_file_;
+    }
+    std::cerr << "\n\n";
+    return -1;
+  }
+
+  for (std::size_t i = 0; i < views_.size(); i++) {
+    FrameBuffer *fb = views_[i].framebuffer;
+    fb->SetTileLayout(tiled_framebuffer_ ? tilesize_[0] : 0,
+        tiled_framebuffer_ ? tilesize_[1] : 0);
+    fb->SetBackingFile("");
+    fb->SetFormat(framebuffer_format_);
+    fb->Resize(xres, yres, 4 + aov_layout_.GetChannelCount());
+    if (fb->IsEmpty()) {
+      std::cerr << "* ERROR: cannot allocate framebuffer of view " << i << "\n\n";
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int Renderer::preprocess_lights()
+{
+  const TraceScope trace("render", "PreprocessLights");
+  const int NLIGHTS = nlights_;
+
+  printf("# Preprocessing Lights\n");
+  printf("#   Light Count: %d\n", NLIGHTS);
+
+  Timer timer;
+  timer.Start();
+
+  for (int i = 0; i < NLIGHTS; i++) {
+    Light *light = target_lights_[i];
+    const int err = light->Preprocess();
+
+    if (err) {
+      /* TODO error handling */
+      return -1;
+    }
+  }
+
+  if (sampled_light_count_ > 0) {
+    light_tree_.Build(target_lights_, NLIGHTS);
+  }
+  // lights and objects of the last render may be gone
+  SlClearShadowOccluders();
+
+  const Elapse elapse = timer.GetElapse();
+  printf("# Preprocessing Lights Done\n");
+  printf("#   %dh %dm %ds\n\n", elapse.hour, elapse.min, elapse.sec);
+
+  return 0;
+}
+
+// a sampler of the settings of the renderer
+static Sampler *new_sampler(const Renderer *renderer)
+{
+  Sampler *sampler = NULL;
+  switch (renderer->sampler_type_) {
+  case RENDERER_FIXED_GRID_SAMPLER:
+    sampler = new FixedGridSampler();
+    break;
+  case RENDERER_ADAPTIVE_GRID_SAMPLER:
+    sampler = new AdaptiveGridSampler();
+    break;
+  case RENDERER_VARIANCE_SAMPLER:
+    sampler = new VarianceSampler();
+    break;
+  default:
+    sampler = new FixedGridSampler();
+    break;
+  }
+  sampler->SetResolution(Int2(renderer->resolution_[0], renderer->resolution_[1]));
+  sampler->SetPixelSamples(Int2(renderer->pixelsamples_[0], renderer->pixelsamples_[1]));
+  sampler->SetFilterWidth(Vector2(renderer->filterwidth_[0], renderer->filterwidth_[1]));
+  sampler->SetMaxSubdivision(renderer->max_subd_);
+  sampler->SetSubdivisionThreshold(renderer->subd_threshold_);
+
+  sampler->SetJitter(renderer->jitter_);
+  sampler->SetSampleTimeRange(renderer->sample_time_start_, renderer->sample_time_end_);
+
+  return sampler;
+}
+
+static void init_worker(Worker *worker, int id,
+    const Renderer *renderer, const Tiler *tiler)
+{
+  const int xres = renderer->resolution_[0];
+  const int yres = renderer->resolution_[1];
+  const double xfwidth = renderer->filterwidth_[0];
+  const double yfwidth = renderer->filterwidth_[1];
+  const int sampler_type = renderer->sampler_type_;
+
+  worker->camera = renderer->camera_;
+  worker->camera_rays.Init(worker->camera);
+  worker->framebuffer = renderer->framebuffer_;
+  worker->tiler = tiler;
+  worker->id = id;
+
+  worker->region_id = -1;
+  worker->region_count = -1;
+  worker->xres = xres;
+  worker->yres = yres;
+
+  worker->frame_id = renderer->frame_id_;
+  worker->interrupted = &renderer->interrupted_;
+  worker->aov_layout = &renderer->aov_layout_;
+
+  // Sampler
+  worker->sampler = new_sampler(renderer);
+  worker->sample_sequence = renderer->sample_sequence_;
+
+  worker->ray_streaming = renderer->ray_streaming_ &&
+      sampler_type == RENDERER_FIXED_GRID_SAMPLER;
+
+  // Filter
+  worker->filter.SetFilterType(renderer->filter_type_, xfwidth, yfwidth);
+  worker->filter_importance = renderer->filter_importance_sampling_ &&
+      sampler_type == RENDERER_FIXED_GRID_SAMPLER;
+  worker->filter_splatting = renderer->filter_splatting_ && !worker->filter_importance;
+  if (worker->filter_importance) {
+    worker->sampler->SetImportanceFilter(&worker->filter);
+  }
+
+  /* context */
+  worker->context = SlCameraContext(renderer->target_objects_);
+  worker->context.cast_shadow = renderer->cast_shadow_;
+  if (renderer->sampled_light_count_ > 0) {
+    worker->context.light_tree = &renderer->light_tree_;
+    worker->context.sampled_light_count = renderer->sampled_light_count_;
+  }
+  if (renderer->radiance_cache_.IsEnabled()) {
+    worker->context.radiance_cache = const_cast<RadianceCache *>(&renderer->radiance_cache_);
+  }
+  if (renderer->transmittance_cache_.IsEnabled()) {
+    worker->context.transmittance_cache =
+        const_cast<TransmittanceCache *>(&renderer->transmittance_cache_);
+  }
+  if (renderer->photon_map_.GetPhotonCount() > 0) {
+    worker->context.photon_map = &renderer->photon_map_;
+  }
+  worker->context.max_diffuse_depth = renderer->max_diffuse_depth_;
+  worker->context.max_reflect_depth = renderer->max_reflect_depth_;
+  worker->context.max_refract_depth = renderer->max_refract_depth_;
+  worker->context.throughput_threshold = renderer->ray_throughput_threshold_;
+  worker->context.raymarch_step = renderer->raymarch_step_;
+  worker->context.raymarch_shadow_step = renderer->raymarch_shadow_step_;
+  worker->context.raymarch_diffuse_step = renderer->raymarch_diffuse_step_;
+  worker->context.raymarch_reflect_step = renderer->raymarch_reflect_step_;
+  worker->context.raymarch_refract_step = renderer->raymarch_refract_step_;
+  worker->context.shadow_transmittance = renderer->shadow_transmittance_;
+  worker->context.ray_spread = worker->camera->GetPixelSpread(renderer->resolution_[1]);
+
+  /* region */
+  worker->tile_margin[0] = static_cast<int>(ceil(xfwidth / 2)) + 1;
+  worker->tile_margin[1] = static_cast<int>(ceil(yfwidth / 2)) + 1;
+  worker->tile_region.min[0] = 0;
+  worker->tile_region.max[0] = 0;
+  worker->tile_region.min[1] = 0;
+  worker->tile_region.max[1] = 0;
+
+  /* interruption */
+  worker->tile_report = renderer->tile_report_;
+
+  /* farm */
+  worker->farm_address = renderer->farm_address_;
+  worker->farm_port = renderer->farm_port_;
+}
+
+static void set_tile_region(Worker *worker, int region_id)
+{
+  const Tile *tile = worker->tiler->GetTile(region_id);
+
+  worker->region_id = region_id;
+  worker->region_count = worker->tiler->GetTileCount();
+  worker->tile_region.min[0] = tile->xmin;
+  worker->tile_region.min[1] = tile->ymin;
+  worker->tile_region.max[0] = tile->xmax;
+  worker->tile_region.max[1] = tile->ymax;
+}
+
+// more candidates than this are not worth testing for each camera ray
+static const int TILE_CANDIDATE_COUNT = 16;
+
+static void add_tile_candidates(Worker *worker, const ObjectSet &object_set,
+    const CameraFrame &frame, const Vector2 &uv_min, const Vector2 &uv_max)
+{
+  for (Index i = 0; i < object_set.GetObjectCount(); i++) {
+    const ObjectInstance *obj = object_set.GetObject(i);
+    if ((obj->GetVisibility() & GROUP_MASK_CAMERA) == 0) {
+      continue;
+    }
+    if (frame.IsBoxInRegion(obj->GetBounds(), uv_min, uv_max)) {
+      worker->tile_candidates.push_back(obj->GetBounds());
+    }
+  }
+}
+
+// culls instances by the frustum of the tile and its margin. only for
+// static cameras whose frustum is the same at any time
+static void cull_tile_objects(Worker *worker)
+{
+  worker->tile_culling = false;
+  worker->tile_candidates.clear();
+
+  if (!worker->camera->IsStatic()) {
+    return;
+  }
+
+  const Rectangle &region = worker->tile_region;
+  const Vector2 uv_min(
+      static_cast<Real>(region.min[0] - worker->tile_margin[0]) / worker->xres,
+      1 - static_cast<Real>(region.max[1] + worker->tile_margin[1]) / worker->yres);
+  const Vector2 uv_max(
+      static_cast<Real>(region.max[0] + worker->tile_margin[0]) / worker->xres,
+      1 - static_cast<Real>(region.min[1] - worker->tile_margin[1]) / worker->yres);
+
+  CameraFrame frame;
+  worker->camera->ComputeFrame(0, &frame);
+
+  const ObjectGroup *target = worker->context.trace_target;
+  add_tile_candidates(worker, target->GetSurfaceSet(), frame, uv_min, uv_max);
+  add_tile_candidates(worker, target->GetVolumeSet(), frame, uv_min, uv_max);
+
+  worker->tile_culling =
+      static_cast<int>(worker->tile_candidates.size()) <= TILE_CANDIDATE_COUNT;
+}
+
+// true if the camera ray can hit no instance of the tile
+static bool is_culled_ray(const Worker *worker, const Ray &ray)
+{
+  if (!worker->tile_culling) {
+    return false;
+  }
+  for (std::size_t i = 0; i < worker->tile_candidates.size(); i++) {
+    Real hit_tmin = 0, hit_tmax = 0;
+    if (BoxRayIntersect(worker->tile_candidates[i], ray.orig, ray.dir,
+        ray.tmin, ray.tmax, &hit_tmin, &hit_tmax)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void set_working_region(Worker *worker, int region_id)
+{
+  set_tile_region(worker, region_id);
+  cull_tile_objects(worker);
+
+  if (worker->sampler->GenerateSamples(worker->tile_region)) {
+    /* TODO error handling */
+  }
+}
+
+// samples are size[0] x size[1] in rows stride apart. aovs of the pixel
+// are filtered into aovs if not NULL
+static Color4 apply_pixel_filter(Worker *worker, const Sample *samples,
+    const Int2 &size, int stride, int x, int y, float *aovs)
+{
+  const int xres = worker->xres;
+  const int yres = worker->yres;
+  const Filter &filter = worker->filter;
+  const int NAOVS = aovs != NULL ? worker->aov_layout->GetChannelCount() : 0;
+
+  Color4 pixel;
+  float wgt_sum = 0.f;
+  float inv_sum = 0.f;
+  int i;
+
+  for (i = 0; i < NAOVS; i++) {
+    aovs[i] = 0;
+  }
+
+  for (i = 0; i < size[0] * size[1]; i++) {
+    const Sample &sample = samples[(i / size[0]) * stride + i % size[0]];
+    double filtx = 0, filty = 0;
+    double wgt = 0;
+
+    filtx = xres * sample.uv.x - (x + .5);
+    filty = yres * (1-sample.uv.y) - (y + .5);
+    wgt = filter.Evaluate(filtx, filty) * sample.weight;
+
+    pixel.r += wgt * sample.data[0];
+    pixel.g += wgt * sample.data[1];
+    pixel.b += wgt * sample.data[2];
+    pixel.a += wgt * sample.data[3];
+    wgt_sum += wgt;
+
+    if (NAOVS > 0 && sample.aov_index >= 0) {
+      const float *values = &worker->aov_values[sample.aov_index * NAOVS];
+      for (int j = 0; j < NAOVS; j++) {
+        aovs[j] += wgt * values[j];
+      }
+    }
+  }
+
+  inv_sum = 1.f / wgt_sum;
+  pixel.r *= inv_sum;
+  pixel.g *= inv_sum;
+  pixel.b *= inv_sum;
+  pixel.a *= inv_sum;
+
+  for (i = 0; i < NAOVS; i++) {
+    aovs[i] *= inv_sum;
+  }
+
+  // samples in the pixel itself instead of the filter
+  const int count_offset = NAOVS > 0 ? worker->aov_layout->GetOffset(AOV_SAMPLE_COUNT) : -1;
+  if (count_offset >= 0) {
+    int count = 0;
+    for (i = 0; i < size[0] * size[1]; i++) {
+      const Sample &sample = samples[(i / size[0]) * stride + i % size[0]];
+      const int px = static_cast<int>(Floor(xres * sample.uv.x));
+      const int py = static_cast<int>(Floor(yres * (1-sample.uv.y)));
+      count += px == x && py == y;
+    }
+    aovs[count_offset] = count;
+  }
+
+  return pixel;
+}
+
+// samples drawn from the filter around the pixel are averaged with their
+// weights which are the signs of the filter scaled by the importance scale.
+// sums are divided by the sample count, not by the weights that cancel out
+// where negative lobes are sampled
+static Color4 average_pixel_samples(Worker *worker, const Sample *samples,
+    const Int2 &size, int stride, float *aovs)
+{
+  const int NAOVS = aovs != NULL ? worker->aov_layout->GetChannelCount() : 0;
+
+  Color4 pixel;
+  const int N = size[0] * size[1];
+  int i;
+
+  for (i = 0; i < NAOVS; i++) {
+    aovs[i] = 0;
+  }
+
+  for (i = 0; i < N; i++) {
+    const Sample &sample = samples[(i / size[0]) * stride + i % size[0]];
+    const float wgt = sample.weight;
+
+    pixel.r += wgt * sample.data[0];
+    pixel.g += wgt * sample.data[1];
+    pixel.b += wgt * sample.data[2];
+    pixel.a += wgt * sample.data[3];
+
+    if (NAOVS > 0 && sample.aov_index >= 0) {
+      const float *values = &worker->aov_values[sample.aov_index * NAOVS];
+      for (int j = 0; j < NAOVS; j++) {
+        aovs[j] += wgt * values[j];
+      }
+    }
+  }
+
+  const float inv_count = 1.f / N;
+  pixel = pixel * inv_count;
+  for (i = 0; i < NAOVS; i++) {
+    aovs[i] *= inv_count;
+  }
+
+  // all samples are of the pixel
+  const int count_offset = NAOVS > 0 ? worker->aov_layout->GetOffset(AOV_SAMPLE_COUNT) : -1;
+  if (count_offset >= 0) {
+    aovs[count_offset] = N;
+  }
+
+  return pixel;
+}
+
+// pixels whose gather window of rate + 2 * margin samples has the sample
+// in column or row sample_pos of the grid of the whole image
+static void pixels_gathering_sample(int sample_pos, int rate, int margin,
+    int *pixel_min, int *pixel_max)
+{
+  *pixel_min = static_cast<int>(Floor(static_cast<Real>(sample_pos - margin) / rate));
+  *pixel_max = static_cast<int>(Floor(static_cast<Real>(sample_pos + margin) / rate));
+}
+
+// each sample goes to the pixels that would gather it so that splatting
+// makes the same image as gathering
+static void splat_samples(Worker *worker, const Sample *grid,
+    const Int2 &grid_origin, const Int2 &grid_size)
+{
+  const Filter &filter = worker->filter;
+  const int xres = worker->xres;
+  const int yres = worker->yres;
+  const Int2 rate = worker->sampler->GetPixelSamples();
+  const Int2 margin = worker->sampler->GetSampleMargin();
+  const int nsamples = grid_size[0] * grid_size[1];
+  const int xmin = worker->tile_region.min[0];
+  const int ymin = worker->tile_region.min[1];
+  const int xmax = worker->tile_region.max[0];
+  const int ymax = worker->tile_region.max[1];
+  const int width = xmax - xmin;
+
+  const int NAOVS = worker->aov_layout->GetChannelCount();
+  const int count_offset = worker->aov_layout->GetOffset(AOV_SAMPLE_COUNT);
+
+  worker->splat_colors.assign(width * (ymax - ymin), Color4());
+  worker->splat_weights.assign(width * (ymax - ymin), 0.f);
+  worker->splat_xweights.resize(width);
+  worker->splat_aovs.assign(NAOVS * width * (ymax - ymin), 0.f);
+
+  for (int i = 0; i < nsamples; i++) {
+    const Sample &sample = grid[i];
+    // pixel coordinates. pixel centers are at x + .5
+    const Real px = xres * sample.uv.x;
+    const Real py = yres * (1 - sample.uv.y);
+
+    const int pixel_x = static_cast<int>(Floor(px));
+    const int pixel_y = static_cast<int>(Floor(py));
+    if (count_offset >= 0 &&
+        pixel_x >= xmin && pixel_x < xmax && pixel_y >= ymin && pixel_y < ymax) {
+      const int index = (pixel_y - ymin) * width + (pixel_x - xmin);
+      worker->splat_aovs[NAOVS * index + count_offset] += 1;
+    }
+
+    int x0, x1, y0, y1;
+    pixels_gathering_sample(grid_origin[0] + i % grid_size[0], rate[0], margin[0], &x0, &x1);
+    pixels_gathering_sample(grid_origin[1] + i / grid_size[0], rate[1], margin[1], &y0, &y1);
+    x0 = std::max(x0, xmin);
+    y0 = std::max(y0, ymin);
+    x1 = std::min(x1, xmax - 1);
+    y1 = std::min(y1, ymax - 1);
+    if (x0 > x1 || y0 > y1) {
+      continue;
+    }
+
+    // the filter is separable
+    for (int x = x0; x <= x1; x++) {
+      worker->splat_xweights[x - xmin] = filter.EvaluateX(px - (x + .5));
+    }
+
+    for (int y = y0; y <= y1; y++) {
+      const Real ywgt = filter.EvaluateY(py - (y + .5)) * sample.weight;
+      Color4 *color = &worker->splat_colors[(y - ymin) * width];
+      float *wgt_sum = &worker->splat_weights[(y - ymin) * width];
+
+      for (int x = x0; x <= x1; x++) {
+        const Real wgt = worker->splat_xweights[x - xmin] * ywgt;
+        Color4 &pixel = color[x - xmin];
+        pixel.r += wgt * sample.data[0];
+        pixel.g += wgt * sample.data[1];
+        pixel.b += wgt * sample.data[2];
+        pixel.a += wgt * sample.data[3];
+        wgt_sum[x - xmin] += wgt;
+      }
+
+      if (NAOVS == 0 || sample.aov_index < 0) {
+        continue;
+      }
+      const float *values = &worker->aov_values[sample.aov_index * NAOVS];
+      for (int x = x0; x <= x1; x++) {
+        const Real wgt = worker->splat_xweights[x - xmin] * ywgt;
+        float *aovs = &worker->splat_aovs[NAOVS * ((y - ymin) * width + (x - xmin))];
+        for (int j = 0; j < NAOVS; j++) {
+          if (j != count_offset) {
+            aovs[j] += wgt * values[j];
+          }
+        }
+      }
+    }
+  }
+}
+
+static void reconstruct_image(Worker *worker)
+{
+  FrameBuffer *fb = worker->framebuffer;
+  // running average of the progressive passes
+  const float pass_weight = 1.f / (worker->pass + 1);
+  const int xmin = worker->tile_region.min[0];
+  const int ymin = worker->tile_region.min[1];
+  const int xmax = worker->tile_region.max[0];
+  const int ymax = worker->tile_region.max[1];
+  const int NAOVS = worker->aov_layout->GetChannelCount();
+  const int count_offset = worker->aov_layout->GetOffset(AOV_SAMPLE_COUNT);
+  const int variance_offset = worker->aov_layout->GetOffset(AOV_VARIANCE);
+  const Int2 pixel_samples = worker->sampler->GetPixelSamples();
+  const float inv_pixel_samples = 1.f / Max(pixel_samples[0] * pixel_samples[1], 1);
+  float aovs[AOV_MAX_CHANNEL_COUNT];
+  int x, y;
+
+  // samples of each pixel are filtered in place if they are in a grid
+  const Int2 rate = worker->sampler->GetPixelSamples();
+  const Int2 pixel_count = rate + 2 * worker->sampler->GetSampleMargin();
+  Int2 grid_origin, grid_size;
+  const Sample *grid = worker->sampler->GetSampleGrid(&grid_origin, &grid_size);
+
+  const bool splatted = grid != NULL && worker->filter_splatting;
+  if (splatted) {
+    splat_samples(worker, grid, grid_origin, grid_size);
+  }
+
+  for (y = ymin; y < ymax; y++) {
+    for (x = xmin; x < xmax; x++) {
+      Color4 pixel;
+      const int index = (y - ymin) * (xmax - xmin) + (x - xmin);
+
+      if (splatted && worker->splat_weights[index] > 0) {
+        const float wgt_sum = worker->splat_weights[index];
+        pixel = worker->splat_colors[index] / wgt_sum;
+        for (int i = 0; i < NAOVS; i++) {
+          const float value = worker->splat_aovs[NAOVS * index + i];
+          aovs[i] = i == count_offset ? value : value / wgt_sum;
+        }
+      } else {
+        // also when the splatted weights of the pixel sum to zero
+        float *pixel_aovs = NAOVS > 0 ? aovs : NULL;
+        if (grid != NULL && worker->filter_importance) {
+          const Sample *first = grid +
+              (y - ymin) * rate[1] * grid_size[0] + (x - xmin) * rate[0];
+          pixel = average_pixel_samples(worker, first, rate, grid_size[0], pixel_aovs);
+        } else if (grid != NULL) {
+          const Sample *first = grid +
+              (y - ymin) * rate[1] * grid_size[0] + (x - xmin) * rate[0];
+          pixel = apply_pixel_filter(worker, first, pixel_count, grid_size[0],
+              x, y, pixel_aovs);
+        } else {
+          worker->sampler->GetSampleSetInPixel(worker->pixel_samples, x, y);
+          const int count = worker->pixel_samples.size();
+          pixel = apply_pixel_filter(worker, &worker->pixel_samples[0],
+              Int2(count, 1), count, x, y, pixel_aovs);
+        }
+      }
+
+      // variance of samples in the filter over the samples of the pixel
+      if (variance_offset >= 0) {
+        const float lum = Luminance4(pixel);
+        aovs[variance_offset] =
+            Max(aovs[variance_offset] - lum * lum, 0.f) * inv_pixel_samples;
+      }
+
+      if (worker->even_passes != NULL && worker->pass % 2 == 0) {
+        Color4 &even = worker->even_passes[y * worker->xres + x];
+        even = even + (pixel - even) * (1.f / (worker->pass / 2 + 1));
+      }
+
+      if (worker->pass > 0) {
+        const Color4 prev = fb->GetColor(x, y);
+        pixel = prev + (pixel - prev) * pass_weight;
+      }
+
+      fb->SetColor(x, y, pixel);
+
+      if (NAOVS > 0) {
+        // of any format of the framebuffer
+        float dst[AOV_MAX_CHANNEL_COUNT] = {0};
+        for (int i = 0; i < NAOVS && worker->pass > 0; i++) {
+          dst[i] = fb->GetValue(x, y, 4 + i);
+        }
+        for (int i = 0; i < NAOVS; i++) {
+          if (worker->pass == 0) {
+            dst[i] = aovs[i];
+          } else if (i == count_offset) {
+            dst[i] += aovs[i];
+          } else if (i == variance_offset) {
+            // of the average of independent passes
+            dst[i] += (aovs[i] - dst[i] * (2 * worker->pass + 1)) *
+                pass_weight * pass_weight;
+          } else {
+            dst[i] += (aovs[i] - dst[i]) * pass_weight;
+          }
+          fb->SetValue(x, y, 4 + i, dst[i]);
+        }
+      }
+    }
+  }
+}
+
+static int render_frame_start(Renderer *renderer, const Tiler *tiler)
+{
+  FrameInfo info;
+  info.frame_id = renderer->frame_id_;
+  info.worker_count = renderer->GetThreadCount();
+  info.tile_count = tiler->GetTileCount();
+  info.xres = renderer->resolution_[0];
+  info.yres = renderer->resolution_[1];
+  info.frame_region = renderer->frame_region_;;
+  info.framebuffer = renderer->framebuffer_;
+
+  RayStatsReset();
+  GeometryPagerGetGlobal().ResetStats();
+  TileCacheGetGlobal().ResetStats();
+  ProfileReset();
+  ProfileSetEnabled(renderer->profile_ != 0);
+
+  const Interrupt interrupt = CbReportFrameStart(&renderer->frame_report_, &info);
+  if (interrupt == CALLBACK_INTERRUPT) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+static void render_frame_done(Renderer *renderer, const Tiler *tiler)
+{
+  FrameInfo info;
+  info.frame_id = renderer->frame_id_;
+  info.worker_count = renderer->GetThreadCount();
+  info.tile_count = tiler->GetTileCount();
+  info.xres = renderer->resolution_[0];
+  info.yres = renderer->resolution_[1];
+  info.frame_region = renderer->frame_region_;;
+  info.framebuffer = renderer->framebuffer_;
+
+  CbReportFrameDone(&renderer->frame_report_, &info);
+}
+
+static uint64_t compute_checkpoint_key(const Renderer *renderer)
+{
+  std::vector<double> settings;
+  settings.push_back(renderer->resolution_[0]);
+  settings.push_back(renderer->resolution_[1]);
+  settings.push_back(renderer->frame_region_.min[0]);
+  settings.push_back(renderer->frame_region_.min[1]);
+  settings.push_back(renderer->frame_region_.max[0]);
+  settings.push_back(renderer->frame_region_.max[1]);
+  settings.push_back(renderer->tilesize_[0]);
+  settings.push_back(renderer->tilesize_[1]);
+  settings.push_back(renderer->filterwidth_[0]);
+  settings.push_back(renderer->filterwidth_[1]);
+  settings.push_back(renderer->filter_type_);
+  settings.push_back(renderer->filter_splatting_);
+  settings.push_back(renderer->filter_importance_sampling_);
+  settings.push_back(renderer->sampler_type_);
+  settings.push_back(renderer->pixelsamples_[0]);
+  settings.push_back(renderer->pixelsamples_[1]);
+  settings.push_back(renderer->max_subd_);
+  settings.push_back(renderer->subd_threshold_);
+  settings.push_back(renderer->jitter_);
+  settings.push_back(renderer->sample_time_start_);
+  settings.push_back(renderer->sample_time_end_);
+  settings.push_back(renderer->sample_sequence_);
+  settings.push_back(renderer->sampled_light_count_);
+  settings.push_back(renderer->radiance_cache_cell_size_);
+  settings.push_back(renderer->transmittance_cache_cell_size_);
+  settings.push_back(renderer->caustic_photon_count_);
+  settings.push_back(renderer->caustic_photon_memory_);
+  settings.push_back(renderer->caustic_radius_);
+  settings.push_back(renderer->cast_shadow_);
+  settings.push_back(renderer->max_diffuse_depth_);
+  settings.push_back(renderer->max_reflect_depth_);
+  settings.push_back(renderer->max_refract_depth_);
+  settings.push_back(renderer->ray_throughput_threshold_);
+
+  return CheckpointComputeKey(settings);
+}
+
+// the framebuffer is of the last render of the same settings
+static bool can_keep_last_frame(const Renderer *renderer)
+{
+  const FrameBuffer *fb = renderer->framebuffer_;
+  if (!renderer->incremental_render_ || fb == NULL ||
+      renderer->farm_mode_ != RENDERER_FARM_NONE ||
+      !renderer->checkpoint_file_.empty() ||
+      !renderer->framebuffer_file_.empty() ||
+      renderer->tile_coverage_.GetTileCount() == 0 ||
+      renderer->tile_coverage_.GetKey() != compute_checkpoint_key(renderer)) {
+    return false;
+  }
+
+  return
+      fb->GetWidth() == renderer->resolution_[0] &&
+      fb->GetHeight() == renderer->resolution_[1] &&
+      fb->GetChannelCount() == 4 + renderer->aov_layout_.GetChannelCount() &&
+      fb->GetFormat() == renderer->framebuffer_format_;
+}
+
+static int count_progressive_passes(const Renderer *renderer)
+{
+  if (!renderer->progressive_ || renderer->farm_mode_ != RENDERER_FARM_NONE) {
+    return 1;
+  }
+
+  const int samples_per_pass = renderer->pixelsamples_[0] * renderer->pixelsamples_[1];
+  const int max_samples = renderer->progressive_max_samples_;
+
+  if (max_samples > 0) {
+    return max_samples > samples_per_pass ? max_samples / samples_per_pass : 1;
+  }
+  if (renderer->progressive_time_limit_ > 0 || renderer->progressive_noise_threshold_ > 0) {
+    return INT_MAX;
+  }
+  return 1;
+}
+
+// bytes of the sample margin cache of the render of the tiles
+static std::size_t compute_margin_cache_bytes(const Renderer *renderer, const Tiler *tiler)
+{
+  if (renderer->incremental_render_) {
+    return 0;
+  }
+
+  Filter filter;
+  filter.SetFilterType(renderer->filter_type_,
+      renderer->filterwidth_[0], renderer->filterwidth_[1]);
+  Sampler *sampler = new_sampler(renderer);
+  if (renderer->filter_importance_sampling_ &&
+      renderer->sampler_type_ == RENDERER_FIXED_GRID_SAMPLER) {
+    sampler->SetImportanceFilter(&filter);
+  }
+  const Int2 margin = sampler->GetSampleMargin();
+  delete sampler;
+
+  return SampleMarginCacheMemorySize(tiler,
+      Int2(renderer->pixelsamples_[0], renderer->pixelsamples_[1]), margin,
+      4 + renderer->aov_layout_.GetChannelCount());
+}
+
+static int write_json_file(const std::string &filename, const std::string &json)
+{
+  FILE *fp = fopen(filename.c_str(), "w");
+  if (fp == NULL) {
+    return -1;
+  }
+  const std::size_t written = fwrite(json.data(), 1, json.size(), fp);
+  const int err = fclose(fp);
+  return written != json.size() || err ? -1 : 0;
+}
+
+// the difference between the image and the average of its even passes is
+// about the error of the image when there are two passes or more
+static double estimate_noise(const Renderer *renderer, const std::vector<Color4> &even_passes)
+{
+  const FrameBuffer *fb = renderer->framebuffer_;
+  const Rectangle &region = renderer->frame_region_;
+  const int xres = renderer->resolution_[0];
+  double diff_sum = 0;
+  double lum_sum = 0;
+
+  for (int y = region.min[1]; y < region.max[1]; y++) {
+    for (int x = region.min[0]; x < region.max[0]; x++) {
+      const float lum = Luminance4(fb->GetColor(x, y));
+      const float diff = lum - Luminance4(even_passes[y * xres + x]);
+      diff_sum += diff * diff;
+      lum_sum += lum * lum;
+    }
+  }
+
+  if (lum_sum <= 0) {
+    return diff_sum > 0 ? REAL_MAX : 0;
+  }
+  return std::sqrt(diff_sum / lum_sum);
+}
+
+// called by the progress reporter a few times a second instead of by
+// workers after each sample
+static int poll_interrupt(void *data)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(data);
+  return CbReportSampleDone(&renderer->tile_report_) == CALLBACK_INTERRUPT;
+}
+
+static void start_progressive_pass(const Renderer *renderer, int pass, int pass_count)
+{
+  const int samples_per_pass = renderer->pixelsamples_[0] * renderer->pixelsamples_[1];
+
+  printf("# Progressive Pass %d", pass + 1);
+  if (pass_count != INT_MAX) {
+    printf(" of %d", pass_count);
+  }
+  printf(" (%d samples per pixel)\n", (pass + 1) * samples_per_pass);
+}
+
+static int render_tile_start(Worker *worker)
+{
+  TileInfo info;
+  info.frame_id = worker->frame_id;
+  info.worker_id = worker->id;
+  info.region_id = worker->region_id;
+  info.total_region_count = worker->region_count;
+  info.tile_region = worker->tile_region;
+  info.framebuffer = worker->framebuffer;
+
+  // viewers and callbacks only see the frame of the renderer
+  const Interrupt interrupt = worker->view == 0 ?
+      CbReportTileStart(&worker->tile_report, &info) : CALLBACK_CONTINUE;
+  if (interrupt == CALLBACK_INTERRUPT) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+static void render_tile_done(Worker *worker)
+{
+  TileInfo info;
+  info.frame_id = worker->frame_id;
+  info.worker_id = worker->id;
+  info.region_id = worker->region_id;
+  info.total_region_count = worker->region_count;
+  info.tile_region = worker->tile_region;
+  info.framebuffer = worker->framebuffer;
 
-  TraceContext context;
-  Rectangle tile_region;
+  if (worker->view == 0) {
+    CbReportTileDone(&worker->tile_report, &info);
+  }
+  worker->progress->AddTile();
 
-  TileReport tile_report;
+  GeometryPagerGetGlobal().Trim();
+}
 
-  const Tiler *tiler;
-};
-//class Worker;
-static void init_worker(Worker *worker, int id,
-    const Renderer *renderer, const Tiler *tiler);
-static int render_frame_start(Renderer *renderer, const Tiler *tiler);
-static LoopStatus render_tile(void *data, const ThreadContext &context);
-static void render_frame_done(Renderer *renderer, const Tiler *tiler);
+// restored tiles go through the tile callbacks as if they were rendered
+// so that progress and viewers see the whole frame
+static void report_restored_tiles(Worker *worker, const std::vector<int> &tile_ids)
+{
+  for (std::size_t i = 0; i < tile_ids.size(); i++) {
+    set_tile_region(worker, tile_ids[i]);
+    if (render_tile_start(worker)) {
+      break;
+    }
+    render_tile_done(worker);
+  }
+}
 
-int Renderer::prepare_rendering()
+// samples are at the same positions with any number of threads so the
+// seed from the position gives the same random numbers to the same sample
+static uint32_t sample_seed(const Sample &sample, int pass_seed)
 {
-  int err = 0;
+  const double values[3] = {sample.uv.x, sample.uv.y, sample.time};
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(values);
 
-  err = preprocess_camera();
-  if (err) {
-    /* TODO error handling */
-    return -1;
+  // FNV-1a
+  uint32_t seed = 2166136261U ^ static_cast<uint32_t>(pass_seed);
+  for (std::size_t i = 0; i < sizeof(values); i++) {
+    seed = (seed ^ bytes[i]) * 16777619U;
   }
+  return seed;
+}
 
-  err = preprocess_framebuffer();
-  if (err) {
-    /* TODO error handling */
-    return -1;
+// traces one ray at the center of each block of pixels of the tile and
+// fills the block with it. tiles go through the tile callbacks so that
+// viewers show them, but not through progress
+static LoopStatus render_preview_tile(void *data, const ThreadContext &context)
+{
+  Worker *worker_list = (Worker *) data;
+  Worker *worker = &worker_list[context.thread_id];
+  const int region_id = context.iteration_id;
+
+  if (*worker->interrupted || worker->reporter->IsCanceled()) {
+    return LoopStatus::Cancel;
   }
 
-  err = preprocess_lights();
-  if (err) {
-    /* TODO error handling */
-    return -1;
+  const TraceScope trace("render", "RenderPreviewTile", region_id);
+  const auto start_time = std::chrono::steady_clock::now();
+
+  set_tile_region(worker, region_id);
+  if (render_tile_start(worker)) {
+    return LoopStatus::Cancel;
+  }
+
+  // no lighting of the preview is cached for the render
+  TraceContext cxt = worker->context;
+  XorShift rng;
+  SampleSequence sequence;
+  Ray ray;
+
+  cxt.rng = &rng;
+  cxt.sequence = &sequence;
+  cxt.aov = NULL;
+  cxt.cost = NULL;
+  cxt.radiance_cache = NULL;
+  cxt.object_recorder = NULL;
+  cxt.max_diffuse_depth = Min(cxt.max_diffuse_depth, PREVIEW_MAX_DEPTH);
+  cxt.max_reflect_depth = Min(cxt.max_reflect_depth, PREVIEW_MAX_DEPTH);
+  cxt.max_refract_depth = Min(cxt.max_refract_depth, PREVIEW_MAX_DEPTH);
+
+  const Vector2 time_range = worker->sampler->GetSampleTimeRange();
+  const int block = worker->preview_block_size;
+  const Rectangle &region = worker->tile_region;
+  FrameBuffer *fb = worker->framebuffer;
+  int interrupted = 0;
+
+  for (int y = region.min[1]; y < region.max[1] && !interrupted; y += block) {
+    for (int x = region.min[0]; x < region.max[0]; x += block) {
+      const int xmax = Min(x + block, region.max[0]);
+      const int ymax = Min(y + block, region.max[1]);
+
+      Sample smp;
+      smp.uv.x =     .5 * (x + xmax) / worker->xres;
+      smp.uv.y = 1 - .5 * (y + ymax) / worker->yres;
+      smp.time = .5 * (time_range[0] + time_range[1]);
+      worker->sampler->SetSequence(smp, Int2(x, y), 0, 1);
+
+      worker->camera_rays.GetRay(smp.uv, smp.time, &ray);
+      cxt.time = smp.time;
+      rng = XorShift(sample_seed(smp, 0));
+      sequence.Start(worker->sample_sequence, smp.sequence_index, smp.sequence_seed, &rng);
+
+      Color4 C_trace;
+      double t_hit = FLT_MAX;
+      const int hit = SlTrace(&cxt, &ray.orig, &ray.dir, ray.tmin, ray.tmax, &C_trace, &t_hit);
+      MemoryArenaGetThreadLocal().Reset();
+      if (!hit) {
+        C_trace = Color4();
+      }
+
+      for (int j = y; j < ymax; j++) {
+        for (int i = x; i < xmax; i++) {
+          fb->SetColor(i, j, C_trace);
+        }
+      }
+
+      if (*worker->interrupted || worker->reporter->IsCanceled()) {
+        interrupted = 1;
+        break;
+      }
+    }
+  }
+
+  TileInfo info;
+  info.frame_id = worker->frame_id;
+  info.worker_id = worker->id;
+  info.region_id = worker->region_id;
+  info.total_region_count = worker->region_count;
+  info.tile_region = worker->tile_region;
+  info.framebuffer = worker->framebuffer;
+  CbReportTileDone(&worker->tile_report, &info);
+
+  const std::chrono::duration<double> elapse =
+      std::chrono::steady_clock::now() - start_time;
+  worker->preview_costs[region_id] += elapse.count();
+
+  return interrupted ? LoopStatus::Cancel : LoopStatus::Continue;
+}
+
+// values are kept by the worker until the tile is reconstructed
+static void store_sample_aovs(Worker *worker, Sample *smp, const AOVSample &aov)
+{
+  const int NAOVS = worker->aov_layout->GetChannelCount();
+  const std::size_t offset = worker->aov_values.size();
+
+  smp->aov_index = static_cast<int>(offset / NAOVS);
+  worker->aov_values.resize(offset + NAOVS);
+  worker->aov_layout->StoreSample(aov, &worker->aov_values[offset]);
+
+  // squared luminance filtered into the pixel becomes the variance there
+  const int variance_offset = worker->aov_layout->GetOffset(AOV_VARIANCE);
+  if (variance_offset >= 0) {
+    const float lum = Luminance4(Color4(smp->data[0], smp->data[1], smp->data[2], 0));
+    worker->aov_values[offset + variance_offset] = lum * lum;
+  }
+}
+
+// samples in margins and borders of the tile are shared with neighbor tiles
+static bool is_shared_sample(const Int2 &pos, const Int2 &size, const Int2 &margin)
+{
+  return
+    pos[0] < 2 * margin[0] || pos[0] >= size[0] - 2 * margin[0] ||
+    pos[1] < 2 * margin[1] || pos[1] >= size[1] - 2 * margin[1];
+}
+
+// samples already traced by neighbor tiles are copied instead of traced
+static void fetch_shared_samples(Worker *worker)
+{
+  const SampleMarginCache *cache = worker->margin_cache;
+  Int2 origin, size;
+  Sample *grid = worker->sampler->GetSampleGrid(&origin, &size);
+  if (cache == NULL || grid == NULL) {
+    return;
+  }
+
+  const Int2 margin = worker->sampler->GetSampleMargin();
+  const int NAOVS = worker->aov_layout->GetChannelCount();
+  float values[4 + AOV_MAX_CHANNEL_COUNT];
+
+  for (int y = 0; y < size[1]; y++) {
+    for (int x = 0; x < size[0]; x++) {
+      if (!is_shared_sample(Int2(x, y), size, margin)) {
+        x = size[0] - 2 * margin[0] - 1;
+        continue;
+      }
+      if (!cache->Fetch(origin + Int2(x, y), worker->pass, values)) {
+        continue;
+      }
+
+      Sample &smp = grid[y * size[0] + x];
+      smp.data = Vector4(values[0], values[1], values[2], values[3]);
+      smp.shared = true;
+      if (NAOVS > 0) {
+        smp.aov_index = static_cast<int>(worker->aov_values.size() / NAOVS);
+        worker->aov_values.insert(worker->aov_values.end(), values + 4, values + 4 + NAOVS);
+      }
+    }
+  }
+}
+
+// samples traced by the tile are kept for neighbor tiles
+static void store_shared_samples(Worker *worker)
+{
+  SampleMarginCache *cache = worker->margin_cache;
+  Int2 origin, size;
+  const Sample *grid = worker->sampler->GetSampleGrid(&origin, &size);
+  if (cache == NULL || grid == NULL) {
+    return;
+  }
+
+  const Int2 margin = worker->sampler->GetSampleMargin();
+  const int NAOVS = worker->aov_layout->GetChannelCount();
+  float values[4 + AOV_MAX_CHANNEL_COUNT];
+
+  for (int y = 0; y < size[1]; y++) {
+    for (int x = 0; x < size[0]; x++) {
+      if (!is_shared_sample(Int2(x, y), size, margin)) {
+        x = size[0] - 2 * margin[0] - 1;
+        continue;
+      }
+
+      const Sample &smp = grid[y * size[0] + x];
+      if (smp.shared) {
+        continue;
+      }
+      for (int i = 0; i < 4; i++) {
+        values[i] = smp.data[i];
+      }
+      for (int i = 0; i < NAOVS; i++) {
+        values[4 + i] = smp.aov_index >= 0 ? worker->aov_values[smp.aov_index * NAOVS + i] : 0;
+      }
+      cache->Store(origin + Int2(x, y), worker->pass, values);
+    }
   }
+}
+
+// cycles of the cpu counter for the time aov. nanoseconds of the steady
+// clock where the counter is not available
+static uint64_t read_cycle_counter()
+{
+#if defined(_MSC_VER) || \
+    (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
 
+static int64_t read_node_visit_count()
+{
+#if defined(FJ_RAY_STATS)
+  const RayStats &stats = RayStatsGetThreadLocal();
+  return stats.surface_node_visit_count + stats.volume_node_visit_count;
+#else
   return 0;
+#endif
 }
 
-int Renderer::execute_rendering()
+static bool has_cost_aovs(const AOVLayout &layout)
 {
-  const int thread_count = GetThreadCount();
+  return
+    layout.GetOffset(AOV_TIME) >= 0 ||
+    layout.GetOffset(AOV_RAYS) >= 0 ||
+    layout.GetOffset(AOV_NODES) >= 0 ||
+    layout.GetOffset(AOV_MARCH_STEPS) >= 0;
+}
 
-  const int xres = resolution_[0];
-  const int yres = resolution_[1];
-  const int xtilesize = tilesize_[0];
-  const int ytilesize = tilesize_[1];
+static void store_sample_cost(const SampleCost &cost, double cycles, double nodes,
+    AOVSample *aov)
+{
+  aov->time = static_cast<float>(cycles);
+  for (int i = 0; i < RAY_CONTEXT_COUNT; i++) {
+    aov->ray_count[i] = static_cast<float>(cost.ray_count[i]);
+  }
+  aov->node_count = static_cast<float>(nodes);
+  aov->march_step_count = static_cast<float>(cost.march_step_count);
+}
 
-  // Frame ID
-  frame_id_ = generate_frame_id();
+// traces the sample with random numbers of its own so that the result is
+// the same on any thread. cxt points to the random numbers, aovs and costs
+static int primary_hit_slot(const Worker *worker, int region_id)
+{
+  return worker->pass * worker->region_count + region_id;
+}
 
-  // Tiler
-  Tiler tiler;
-  tiler.Divide(xres, yres, xtilesize, ytilesize);
-  tiler.GenerateTiles(frame_region_);
-  const int tile_count = tiler.GetTileCount();
+// camera rays of the tile shade the hits of the last render if they are
+// cached and record their hits otherwise
+static void start_primary_hits(Worker *worker, int region_id)
+{
+  worker->cached_hits = NULL;
+  worker->recorded_hits = NULL;
+  if (worker->primary_hit_cache == NULL || worker->view != 0) {
+    return;
+  }
 
-  // Worker
-  std::vector<Worker> worker_list(thread_count);
-  for (std::size_t i = 0; i < worker_list.size(); i++) {
-    init_worker(&worker_list[i], i, this, &tiler);
+  int sample_count = 0;
+  worker->tile_samples = worker->sampler->GetSamples(&sample_count);
+  if (worker->tile_samples == NULL || sample_count == 0) {
+    return;
   }
 
-  // FrameProgress
-  init_frame_progress(&frame_progress_, tile_count);
+  const std::vector<PrimaryHit> *cached =
+      worker->primary_hit_cache->GetHits(primary_hit_slot(worker, region_id));
+  if (cached != NULL && static_cast<int>(cached->size()) == sample_count) {
+    worker->cached_hits = &(*cached)[0];
+    return;
+  }
+  worker->tile_hits.assign(sample_count, PrimaryHit());
+  worker->recorded_hits = &worker->tile_hits[0];
+}
 
-  // Run sampling
-  const int err = render_frame_start(this, &tiler);
-  if (err) {
-    return -1;
+static void store_primary_hits(Worker *worker, int region_id)
+{
+  if (worker->recorded_hits == NULL) {
+    return;
   }
+  // dropped if over the memory
+  worker->primary_hit_cache->SetHits(primary_hit_slot(worker, region_id),
+      worker->tile_hits);
+  worker->recorded_hits = NULL;
+}
 
-  // Iteration number que for parallel loop
-  std::vector<int> iteration_que(tile_count);
-  for (int i = 0; i <tile_count; i++) {
-    iteration_que[i] = i;
+// SlTrace of the camera ray of the sample. SlTraceHit shades the hit kept
+// from the last render instead of tracing if there is one
+static int trace_camera_ray(const Worker *worker, const TraceContext *cxt,
+    const Ray &ray, const Sample *smp, Color4 *C_trace, double *t_hit)
+{
+  // the same range as SlTrace
+  Ray primary = ray;
+  primary.tmin = Max(ray.tmin, RayOriginOffset(ray.orig));
+
+  if (worker->cached_hits != NULL) {
+    const PrimaryHit &cached = worker->cached_hits[smp - worker->tile_samples];
+    if (cached.IsTraced() && cached.object == NULL) {
+      return SlTraceHit(cxt, primary, NULL, C_trace, t_hit);
+    }
+    if (cached.IsTraced()) {
+      Intersection isect;
+      isect.prim_id = cached.prim_id;
+      isect.shading_group_id = cached.shading_group_id;
+      isect.t_hit = cached.t_hit;
+      isect.prim_uv = cached.prim_uv;
+      if (cached.object->ComputeHitAttributes(primary, cxt->time, &isect)) {
+        return SlTraceHit(cxt, primary, &isect, C_trace, t_hit);
+      }
+    }
+  }
+  else if (worker->recorded_hits != NULL) {
+    PrimaryHit &recorded = worker->recorded_hits[smp - worker->tile_samples];
+    Intersection isect;
+    const int hit = SlIntersectSurface(cxt, primary, &isect);
+    recorded.object = hit ? isect.object : NULL;
+    recorded.prim_id = hit ? isect.prim_id : 0;
+    recorded.shading_group_id = isect.shading_group_id;
+    recorded.t_hit = isect.t_hit;
+    recorded.prim_uv = isect.prim_uv;
+    return SlTraceHit(cxt, primary, hit ? &isect : NULL, C_trace, t_hit);
   }
 
-  MtRunParallelLoop(&worker_list[0], render_tile, thread_count, iteration_que);
+  return SlTrace(cxt, &ray.orig, &ray.dir, ray.tmin, ray.tmax, C_trace, t_hit);
+}
 
-  render_frame_done(this, &tiler);
+static void trace_sample(const Worker *worker, CameraRayGenerator *camera_rays,
+    TraceContext *cxt, int pass_seed, Sample *smp)
+{
+  Color4 C_trace;
+  double t_hit = FLT_MAX;
+  int hit = 0;
+  Ray ray;
 
-  return 0;
+  camera_rays->GetRay(smp->uv, smp->time, &ray);
+  if (is_culled_ray(worker, ray)) {
+    // the same as a ray hitting nothing
+    if (cxt->aov != NULL) {
+      *cxt->aov = AOVSample();
+    }
+    if (cxt->cost != NULL) {
+      *cxt->cost = SampleCost();
+    }
+    smp->data[0] = 0;
+    smp->data[1] = 0;
+    smp->data[2] = 0;
+    smp->data[3] = 0;
+    return;
+  }
+  cxt->time = smp->time;
+  *cxt->rng = XorShift(sample_seed(*smp, pass_seed));
+  cxt->sequence->Start(worker->sample_sequence, smp->sequence_index, smp->sequence_seed,
+      cxt->rng);
+  if (cxt->aov != NULL) {
+    *cxt->aov = AOVSample();
+  }
+  if (cxt->cost != NULL) {
+    *cxt->cost = SampleCost();
+  }
+
+  const uint64_t cycle_start = cxt->cost != NULL ? read_cycle_counter() : 0;
+  const int64_t node_start = cxt->cost != NULL ? read_node_visit_count() : 0;
+  hit = trace_camera_ray(worker, cxt, ray, smp, &C_trace, &t_hit);
+  if (cxt->cost != NULL) {
+    store_sample_cost(*cxt->cost,
+        static_cast<double>(read_cycle_counter() - cycle_start),
+        static_cast<double>(read_node_visit_count() - node_start), cxt->aov);
+  }
+  if (hit) {
+    smp->data[0] = C_trace.r;
+    smp->data[1] = C_trace.g;
+    smp->data[2] = C_trace.b;
+    smp->data[3] = C_trace.a;
+  } else {
+    smp->data[0] = 0;
+    smp->data[1] = 0;
+    smp->data[2] = 0;
+    smp->data[3] = 0;
+  }
 }
 
-int Renderer::preprocess_camera() const
+// samples of a tile traced by tasks in chunks
+class SampleChunks {
+public:
+  SampleChunks() : worker(NULL), samples(), pass_seed(0) {}
+  ~SampleChunks() {}
+
+  const Worker *worker;
+  std::vector<Sample *> samples;
+  int pass_seed;
+};
+
+static const int SAMPLE_CHUNK_SIZE = 256;
+
+static LoopStatus integrate_sample_chunk(void *data, const ThreadContext &context)
 {
-  if (camera_ == NULL)
+  const SampleChunks *chunks = reinterpret_cast<const SampleChunks *>(data);
+  const Worker *worker = chunks->worker;
+  const int begin = context.iteration_id * SAMPLE_CHUNK_SIZE;
+  const int end = std::min(begin + SAMPLE_CHUNK_SIZE,
+      static_cast<int>(chunks->samples.size()));
+
+  // any thread may run this so nothing of the thread's own worker is used
+  // and temporaries of a sample being traced by this thread are kept
+  CameraRayGenerator camera_rays;
+  camera_rays.Init(worker->camera);
+  TraceContext cxt = worker->context;
+  XorShift rng;
+  SampleSequence sequence;
+  cxt.rng = &rng;
+  cxt.sequence = &sequence;
+  cxt.aov = NULL;
+  cxt.cost = NULL;
+
+  MemoryArena &arena = MemoryArenaGetThreadLocal();
+  const MemoryArena::Mark mark = arena.GetMark();
+
+  for (int i = begin; i < end; i++) {
+    trace_sample(worker, &camera_rays, &cxt, chunks->pass_seed, chunks->samples[i]);
+    arena.Rewind(mark);
+
+    worker->progress->AddSample();
+    if (*worker->interrupted || worker->reporter->IsCanceled()) {
+      return LoopStatus::Cancel;
+    }
+  }
+  return LoopStatus::Continue;
+}
+
+// once every tile has started, idle threads take chunks of the remaining
+// samples of the tiles still rendering. aovs and objects hit are stored in the worker
+// by one thread so those tiles are not split. only fixed grid samples are known
+// before any of them is traced
+static bool can_split_samples(const Worker *worker)
+{
+  return worker->tail_splitting != NULL &&
+      worker->farm == NULL &&
+      worker->coverage == NULL &&
+      worker->aov_layout->IsEmpty() &&
+      worker->tail_splitting->IsInTail();
+}
+
+static int integrate_samples_split(Worker *worker)
+{
+  SampleChunks chunks;
+  chunks.worker = worker;
+  chunks.pass_seed = worker->sampler->GetSampleSeed();
+
+  Sample *smp = NULL;
+  while ((smp = worker->sampler->GetNextSample()) != NULL) {
+    if (!smp->shared) {
+      chunks.samples.push_back(smp);
+    }
+  }
+
+  const int chunk_count =
+      (static_cast<int>(chunks.samples.size()) + SAMPLE_CHUNK_SIZE - 1) / SAMPLE_CHUNK_SIZE;
+  TaskGroup group;
+  for (int i = chunk_count - 1; i >= 0; i--) {
+    group.Spawn(&chunks, integrate_sample_chunk, i);
+  }
+  const LoopStatus status = group.Wait();
+
+  if (status == LoopStatus::Cancel ||
+      *worker->interrupted || worker->reporter->IsCanceled()) {
     return -1;
+  }
+  return 0;
+}
 
-  const int xres = resolution_[0];
-  const int yres = resolution_[1];
-  camera_->SetAspect(xres/(double)yres);
+static int integrate_samples(Worker *worker)
+{
+  Sample *smp = NULL;
+  TraceContext cxt = worker->context;
+  const int pass_seed = worker->sampler->GetSampleSeed();
+  const bool has_aovs = !worker->aov_layout->IsEmpty();
+  const bool has_costs = has_cost_aovs(*worker->aov_layout);
+  XorShift rng;
+  SampleSequence sequence;
+  AOVSample aov;
+  SampleCost cost;
+
+  cxt.rng = &rng;
+  cxt.sequence = &sequence;
+  cxt.aov = has_aovs ? &aov : NULL;
+  cxt.cost = has_costs ? &cost : NULL;
+
+  for (;;) {
+    // the rest of the samples once the last tiles have started
+    if (can_split_samples(worker)) {
+      return integrate_samples_split(worker);
+    }
+    if ((smp = worker->sampler->GetNextSample()) == NULL) {
+      break;
+    }
+    if (smp->shared) {
+      continue;
+    }
+
+    trace_sample(worker, &worker->camera_rays, &cxt, pass_seed, smp);
+    // temporaries of this sample are no longer used
+    MemoryArenaGetThreadLocal().Reset();
+    if (has_aovs) {
+      store_sample_aovs(worker, smp, aov);
+    }
 
+    worker->progress->AddSample();
+    if (*worker->interrupted || worker->reporter->IsCanceled()) {
+      return -1;
+    }
+  }
   return 0;
 }
 
-int Renderer::preprocess_framebuffer() const
+// spreads the lower 10 bits to every third bit
+static uint64_t spread_bits(uint32_t x)
 {
-  if (framebuffer_ == NULL)
-    return -1;
+  uint64_t v = x & 0x3ff;
+  v = (v | (v << 16)) & 0x30000ff;
+  v = (v | (v <<  8)) & 0x300f00f;
+  v = (v | (v <<  4)) & 0x30c30c3;
+  v = (v | (v <<  2)) & 0x9249249;
+  return v;
+}
 
-  const int xres = resolution_[0];
-  const int yres = resolution_[1];
-  framebuffer_->Resize(xres, yres, 4);
+static uint64_t morton_key(const Vector &v, const Box &bounds)
+{
+  uint64_t key = 0;
+  for (int i = 0; i < 3; i++) {
+    const Real size = bounds.max[i] - bounds.min[i];
+    const Real t = size > 0 ? (v[i] - bounds.min[i]) / size : 0;
+    const uint32_t q = static_cast<uint32_t>(Clamp(t, 0, 1) * 1023);
+    key |= spread_bits(q) << i;
+  }
+  return key;
+}
+
+static uint64_t stream_ray_key(const Ray &ray, const Box &origin_bounds)
+{
+  static const Box DIRECTION_BOUNDS(Vector(-1, -1, -1), Vector(1, 1, 1));
+  const uint64_t octant =
+      (ray.dir[0] < 0) |
+      (ray.dir[1] < 0) << 1 |
+      (ray.dir[2] < 0) << 2;
+
+  // 3 bits of octant, 30 of direction and the upper 21 of origin
+  return octant << 51 |
+      morton_key(ray.dir, DIRECTION_BOUNDS) << 21 |
+      morton_key(ray.orig, origin_bounds) >> 9;
+}
+
+// traces a stream of camera rays. rays are intersected in the order of
+// their keys and then shaded in batches by shader. samples get the same
+// random numbers as integrate_samples so the image is the same. costs of
+// the stream intersection and of each batch are split evenly over their
+// samples as they can't be told apart
+static int integrate_stream(Worker *worker, int ray_count, int pass_seed)
+{
+  std::vector<StreamRay> &rays = worker->stream_rays;
+  std::vector<Intersection> &hits = worker->stream_hits;
+  std::vector<int> &order = worker->stream_order;
+  const TraceContext cxt = worker->context;
+
+  Box origin_bounds(rays[0].ray.orig, rays[0].ray.orig);
+  for (int i = 1; i < ray_count; i++) {
+    origin_bounds.AddPoint(rays[i].ray.orig);
+  }
+
+  order.resize(ray_count);
+  for (int i = 0; i < ray_count; i++) {
+    rays[i].key = stream_ray_key(rays[i].ray, origin_bounds);
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(),
+      [&rays](int a, int b)
+      {
+        return rays[a].key < rays[b].key;
+      });
+
+  // the whole stream is intersected in the order at once
+  std::vector<Ray> &sorted_rays = worker->stream_sorted_rays;
+  std::vector<Real> &sorted_times = worker->stream_sorted_times;
+  std::vector<Intersection> &sorted_hits = worker->stream_sorted_hits;
+  std::vector<int> &sorted_hit_flags = worker->stream_sorted_hit_flags;
+  sorted_rays.resize(ray_count);
+  sorted_times.resize(ray_count);
+  sorted_hits.resize(ray_count);
+  sorted_hit_flags.resize(ray_count);
+
+  for (int i = 0; i < ray_count; i++) {
+    sorted_rays[i] = rays[order[i]].ray;
+    sorted_times[i] = rays[order[i]].sample->time;
+  }
+
+  const bool has_costs = has_cost_aovs(*worker->aov_layout);
+  const uint64_t stream_cycle_start = has_costs ? read_cycle_counter() : 0;
+  const int64_t stream_node_start = has_costs ? read_node_visit_count() : 0;
+
+  SlIntersectSurfaceStream(&cxt, &sorted_rays[0], &sorted_times[0], ray_count,
+      &sorted_hits[0], &sorted_hit_flags[0]);
+
+  const double stream_cycles = has_costs ?
+      static_cast<double>(read_cycle_counter() - stream_cycle_start) / ray_count : 0;
+  const double stream_nodes = has_costs ?
+      static_cast<double>(read_node_visit_count() - stream_node_start) / ray_count : 0;
+
+  for (int i = 0; i < ray_count; i++) {
+    StreamRay &stream_ray = rays[order[i]];
+    stream_ray.hit = sorted_hit_flags[i];
+    stream_ray.shader = NULL;
+    if (stream_ray.hit) {
+      hits[order[i]] = sorted_hits[i];
+      stream_ray.shader = sorted_hits[i].GetShader();
+    }
+  }
+
+  // hits on the same shader are shaded in batches. each sample has its
+  // own random numbers and context
+  std::stable_sort(order.begin(), order.end(),
+      [&rays](int a, int b)
+      {
+        return rays[a].shader < rays[b].shader;
+      });
+
+  TraceContext batch_cxts[SHADE_BATCH_SIZE];
+  XorShift batch_rngs[SHADE_BATCH_SIZE];
+  SampleSequence batch_sequences[SHADE_BATCH_SIZE];
+  Ray batch_rays[SHADE_BATCH_SIZE];
+  Intersection batch_isects[SHADE_BATCH_SIZE];
+  Color4 batch_colors[SHADE_BATCH_SIZE];
+  double batch_t_hits[SHADE_BATCH_SIZE];
+  AOVSample batch_aovs[SHADE_BATCH_SIZE];
+  SampleCost batch_costs[SHADE_BATCH_SIZE];
+  const bool has_aovs = !worker->aov_layout->IsEmpty();
+
+  for (int begin = 0; begin < ray_count; ) {
+    const StreamRay &first = rays[order[begin]];
+    int count = 1;
+    int hit = 0;
+
+    if (first.hit) {
+      while (count < SHADE_BATCH_SIZE && begin + count < ray_count &&
+          rays[order[begin + count]].hit &&
+          rays[order[begin + count]].shader == first.shader) {
+        count++;
+      }
+    }
+
+    for (int i = 0; i < count; i++) {
+      const Sample *smp = rays[order[begin + i]].sample;
+      TraceContext &batch_cxt = batch_cxts[i];
+
+      batch_cxt = cxt;
+      batch_cxt.time = smp->time;
+      batch_rngs[i] = XorShift(sample_seed(*smp, pass_seed));
+      batch_sequences[i].Start(worker->sample_sequence,
+          smp->sequence_index, smp->sequence_seed, &batch_rngs[i]);
+      batch_cxt.rng = &batch_rngs[i];
+      batch_cxt.sequence = &batch_sequences[i];
+      batch_aovs[i] = AOVSample();
+      batch_cxt.aov = has_aovs ? &batch_aovs[i] : NULL;
+      batch_costs[i] = SampleCost();
+      batch_cxt.cost = has_costs ? &batch_costs[i] : NULL;
+
+      batch_rays[i] = rays[order[begin + i]].ray;
+      batch_t_hits[i] = FLT_MAX;
+      if (first.hit) {
+        batch_isects[i] = hits[order[begin + i]];
+      }
+    }
+
+    const uint64_t cycle_start = has_costs ? read_cycle_counter() : 0;
+    const int64_t node_start = has_costs ? read_node_visit_count() : 0;
+    if (first.hit) {
+      SlTraceHitBatch(batch_cxts, batch_rays, batch_isects, count,
+          batch_colors, batch_t_hits);
+      hit = 1;
+    } else {
+      hit = SlTraceHit(&batch_cxts[0], batch_rays[0], NULL,
+          &batch_colors[0], &batch_t_hits[0]);
+    }
+    MemoryArenaGetThreadLocal().Reset();
+    if (has_costs) {
+      const double cycles =
+          static_cast<double>(read_cycle_counter() - cycle_start) / count;
+      const double nodes =
+          static_cast<double>(read_node_visit_count() - node_start) / count;
+      for (int i = 0; i < count; i++) {
+        store_sample_cost(batch_costs[i], stream_cycles + cycles,
+            stream_nodes + nodes, &batch_aovs[i]);
+      }
+    }
+
+    for (int i = 0; i < count; i++) {
+      Sample *smp = rays[order[begin + i]].sample;
+      const Color4 &C_trace = batch_colors[i];
+
+      if (hit) {
+        smp->data[0] = C_trace.r;
+        smp->data[1] = C_trace.g;
+        smp->data[2] = C_trace.b;
+        smp->data[3] = C_trace.a;
+      } else {
+        smp->data[0] = 0;
+        smp->data[1] = 0;
+        smp->data[2] = 0;
+        smp->data[3] = 0;
+      }
+      if (has_aovs) {
+        store_sample_aovs(worker, smp, batch_aovs[i]);
+      }
 
+      worker->progress->AddSample();
+      if (*worker->interrupted || worker->reporter->IsCanceled()) {
+        return -1;
+      }
+    }
+    begin += count;
+  }
   return 0;
 }
 
-int Renderer::preprocess_lights()
+static int integrate_samples_streamed(Worker *worker)
 {
-  const int NLIGHTS = nlights_;
+  const int pass_seed = worker->sampler->GetSampleSeed();
+  const bool has_aovs = !worker->aov_layout->IsEmpty();
+  Sample *smp = NULL;
+  int ray_count = 0;
 
-  printf("# Preprocessing Lights\n");
-  printf("#   Light Count: %d\n", NLIGHTS);
+  worker->stream_rays.resize(RAY_STREAM_SIZE);
+  worker->stream_hits.resize(RAY_STREAM_SIZE);
 
-  Timer timer;
-  timer.Start();
+  while ((smp = worker->sampler->GetNextSample()) != NULL) {
+    if (smp->shared) {
+      continue;
+    }
 
-  for (int i = 0; i < NLIGHTS; i++) {
-    Light *light = target_lights_[i];
-    const int err = light->Preprocess();
+    StreamRay &stream_ray = worker->stream_rays[ray_count];
+    stream_ray.sample = smp;
+    worker->camera_rays.GetRay(smp->uv, smp->time, &stream_ray.ray);
+    if (is_culled_ray(worker, stream_ray.ray)) {
+      // the same as a ray hitting nothing
+      smp->data[0] = 0;
+      smp->data[1] = 0;
+      smp->data[2] = 0;
+      smp->data[3] = 0;
+      if (has_aovs) {
+        store_sample_aovs(worker, smp, AOVSample());
+      }
+      worker->progress->AddSample();
+      if (*worker->interrupted || worker->reporter->IsCanceled()) {
+        return -1;
+      }
+      continue;
+    }
+    ray_count++;
 
-    if (err) {
-      /* TODO error handling */
-      return -1;
+    if (ray_count == RAY_STREAM_SIZE) {
+      if (integrate_stream(worker, ray_count, pass_seed)) {
+        return -1;
+      }
+      ray_count = 0;
     }
   }
-
-  const Elapse elapse = timer.GetElapse();
-  printf("# Preprocessing Lights Done\n");
-  printf("#   %dh %dm %ds\n\n", elapse.hour, elapse.min, elapse.sec);
-
+  if (ray_count > 0) {
+    return integrate_stream(worker, ray_count, pass_seed);
+  }
   return 0;
 }
 
-static void init_worker(Worker *worker, int id,
-    const Renderer *renderer, const Tiler *tiler)
+// returns -1 if interrupted by callbacks
+static int render_tile_region(Worker *worker, int region_id)
 {
-  const int xres = renderer->resolution_[0];
-  const int yres = renderer->resolution_[1];
-  const int xrate = renderer->pixelsamples_[0];
-  const int yrate = renderer->pixelsamples_[1];
-  const double xfwidth = renderer->filterwidth_[0];
-  const double yfwidth = renderer->filterwidth_[1];
-  const int max_subd = renderer->max_subd_;
-  const float subd_threshold = renderer->subd_threshold_;
-  const int sampler_type = renderer->sampler_type_;
-
-  worker->camera = renderer->camera_;
-  worker->framebuffer = renderer->framebuffer_;
-  worker->tiler = tiler;
-  worker->id = id;
+  const TraceScope trace("render", "RenderTile", region_id);
+  int interrupted = 0;
 
-  worker->region_id = -1;
-  worker->region_count = -1;
-  worker->xres = xres;
-  worker->yres = yres;
+  const auto start_time = std::chrono::steady_clock::now();
 
-  worker->frame_id = renderer->frame_id_;
+  set_working_region(worker, region_id);
+  start_primary_hits(worker, region_id);
 
-  // Sampler
-  switch (sampler_type) {
-  case RENDERER_FIXED_GRID_SAMPLER:
-    worker->sampler = new FixedGridSampler();
-    break;
-  case RENDERER_ADAPTIVE_GRID_SAMPLER:
-    worker->sampler = new AdaptiveGridSampler();
-    break;
-  default:
-    worker->sampler = new FixedGridSampler();
-    break;
+  interrupted = render_tile_start(worker);
+  if (interrupted) {
+    return -1;
   }
-  /*
-  if (0) {
-    worker->sampler = new FixedGridSampler();
+
+  worker->aov_values.clear();
+  worker->object_recorder.Clear();
+  fetch_shared_samples(worker);
+
+  if (worker->ray_streaming) {
+    interrupted = integrate_samples_streamed(worker);
   } else {
-    worker->sampler = new AdaptiveGridSampler();
+    interrupted = integrate_samples(worker);
   }
-  */
-  worker->sampler->SetResolution(Int2(xres, yres));
-  worker->sampler->SetPixelSamples(Int2(xrate, yrate));
-  worker->sampler->SetFilterWidth(Vector2(xfwidth, yfwidth));
-  worker->sampler->SetMaxSubdivision(max_subd);
-  worker->sampler->SetSubdivisionThreshold(subd_threshold);
-
-  worker->sampler->SetJitter(renderer->jitter_);
-  worker->sampler->SetSampleTimeRange(
-      renderer->sample_time_start_, renderer->sample_time_end_);
+  if (!interrupted) {
+    store_shared_samples(worker);
+    store_primary_hits(worker, region_id);
+  }
+  reconstruct_image(worker);
 
-  // Filter
-  worker->filter.SetFilterType(FLT_GAUSSIAN, xfwidth, yfwidth);
+  if (worker->coverage != NULL) {
+    if (interrupted) {
+      worker->coverage->SetTileNeedsRendering(region_id);
+    } else {
+      worker->coverage->SetTileRendered(region_id,
+          worker->object_recorder.GetObjects(), worker->pass > 0);
+    }
+  }
 
-  /* context */
-  worker->context = SlCameraContext(renderer->target_objects_);
-  worker->context.cast_shadow = renderer->cast_shadow_;
-  worker->context.max_diffuse_depth = renderer->max_diffuse_depth_;
-  worker->context.max_reflect_depth = renderer->max_reflect_depth_;
-  worker->context.max_refract_depth = renderer->max_refract_depth_;
-  worker->context.raymarch_step = renderer->raymarch_step_;
-  worker->context.raymarch_shadow_step = renderer->raymarch_shadow_step_;
-  worker->context.raymarch_diffuse_step = renderer->raymarch_diffuse_step_;
-  worker->context.raymarch_reflect_step = renderer->raymarch_reflect_step_;
-  worker->context.raymarch_refract_step = renderer->raymarch_refract_step_;
+  render_tile_done(worker);
 
-  /* region */
-  worker->tile_region.min[0] = 0;
-  worker->tile_region.max[0] = 0;
-  worker->tile_region.min[1] = 0;
-  worker->tile_region.max[1] = 0;
+  // each tile is rendered by one thread
+  const std::chrono::duration<double> elapse =
+      std::chrono::steady_clock::now() - start_time;
+  worker->tile_costs[region_id] = elapse.count();
+  if (worker->metrics != NULL) {
+    worker->metrics->AddBusyTime(worker->id, elapse.count());
+  }
+  worker->last_tile_done = std::chrono::steady_clock::now();
 
-  /* interruption */
-  worker->tile_report = renderer->tile_report_;
+  return interrupted ? -1 : 0;
 }
 
-static void set_working_region(Worker *worker, int region_id)
+static LoopStatus render_tile(void *data, const ThreadContext &context)
 {
-  const Tile *tile = worker->tiler->GetTile(region_id);
+  Worker *worker_list = (Worker *) data;
+  Worker *worker = &worker_list[context.thread_id];
 
-  worker->region_id = region_id;
-  worker->region_count = worker->tiler->GetTileCount();
-  worker->tile_region.min[0] = tile->xmin;
-  worker->tile_region.min[1] = tile->ymin;
-  worker->tile_region.max[0] = tile->xmax;
-  worker->tile_region.max[1] = tile->ymax;
+  if (worker->tail_splitting != NULL) {
+    worker->tail_splitting->started_tiles++;
+  }
 
-  if (worker->sampler->GenerateSamples(worker->tile_region)) {
-    /* TODO error handling */
+  if (*worker->interrupted || worker->reporter->IsCanceled()) {
+    return LoopStatus::Cancel;
   }
-}
 
-static Color4 apply_pixel_filter(Worker *worker, int x, int y)
-{
-  const int nsamples = worker->pixel_samples.size();
-  const int xres = worker->xres;
-  const int yres = worker->yres;
-  const Filter &filter = worker->filter;
+  if (worker->has_deadline && std::chrono::steady_clock::now() >= worker->deadline) {
+    // out of time. the tile keeps the average of the previous passes
+    return LoopStatus::Cancel;
+  }
 
-  Color4 pixel;
-  float wgt_sum = 0.f;
-  float inv_sum = 0.f;
-  int i;
+  if (context.iteration_id >= worker->tiler->GetTileCount()) {
+    const int interrupted = render_view_tile(worker, context.iteration_id);
+    return interrupted ? LoopStatus::Cancel : LoopStatus::Continue;
+  }
 
-  for (i = 0; i < nsamples; i++) {
-    const Sample &sample = worker->pixel_samples[i];
-    double filtx = 0, filty = 0;
-    double wgt = 0;
+  if (worker->farm != NULL) {
+    if (worker->farm->IsAborted()) {
+      return LoopStatus::Cancel;
+    }
+    if (!worker->farm->ClaimTile(context.iteration_id)) {
+      // a farm worker has it
+      return LoopStatus::Continue;
+    }
+  }
 
-    filtx = xres * sample.uv.x - (x + .5);
-    filty = yres * (1-sample.uv.y) - (y + .5);
-    wgt = filter.Evaluate(filtx, filty);
+  const int interrupted = render_tile_region(worker, context.iteration_id);
+  if (interrupted) {
+    return LoopStatus::Cancel;
+  }
 
-    pixel.r += wgt * sample.data[0];
-    pixel.g += wgt * sample.data[1];
-    pixel.b += wgt * sample.data[2];
-    pixel.a += wgt * sample.data[3];
-    wgt_sum += wgt;
+  if (worker->checkpoint != NULL) {
+    worker->checkpoint->TileDone(context.iteration_id);
   }
+  if (worker->output != NULL) {
+    worker->output->TileDone(context.iteration_id);
+  }
+  if (worker->farm != NULL) {
+    worker->farm->TileDone(context.iteration_id);
+  }
+  evict_tile(worker, context.iteration_id);
 
-  inv_sum = 1.f / wgt_sum;
-  pixel.r *= inv_sum;
-  pixel.g *= inv_sum;
-  pixel.b *= inv_sum;
-  pixel.a *= inv_sum;
+  return LoopStatus::Continue;
+}
 
-  return pixel;
+// renders the tile of the view with the camera, framebuffer and caches of
+// the view. returns -1 if interrupted by callbacks
+static int render_view_tile(Worker *worker, int iteration_id)
+{
+  const int tile_count = worker->tiler->GetTileCount();
+  const int view = iteration_id / tile_count;
+  const int tile_id = iteration_id % tile_count;
+  const RenderView &render_view = (*worker->views)[view - 1];
+
+  const Camera *camera = worker->camera;
+  FrameBuffer *framebuffer = worker->framebuffer;
+  SampleMarginCache *margin_cache = worker->margin_cache;
+  double *tile_costs = worker->tile_costs;
+  TileCoverage *coverage = worker->coverage;
+  Color4 *even_passes = worker->even_passes;
+  const Real ray_spread = worker->context.ray_spread;
+
+  worker->view = view;
+  worker->camera = render_view.camera;
+  worker->camera_rays.Init(render_view.camera);
+  worker->framebuffer = render_view.framebuffer;
+  worker->margin_cache = worker->view_margin_caches != NULL ?
+      &worker->view_margin_caches[view - 1] : NULL;
+  worker->tile_costs = worker->view_costs + (view - 1) * tile_count;
+  worker->coverage = NULL;
+  worker->even_passes = NULL;
+  worker->context.ray_spread = render_view.camera->GetPixelSpread(worker->yres);
+
+  const int interrupted = render_tile_region(worker, tile_id);
+
+  worker->view = 0;
+  worker->camera = camera;
+  worker->camera_rays.Init(camera);
+  worker->framebuffer = framebuffer;
+  worker->margin_cache = margin_cache;
+  worker->tile_costs = tile_costs;
+  worker->coverage = coverage;
+  worker->even_passes = even_passes;
+  worker->context.ray_spread = ray_spread;
+
+  return interrupted;
 }
 
-static void reconstruct_image(Worker *worker)
+static LoopStatus render_farm_tiles(void *data, const ThreadContext &context)
 {
-  FrameBuffer *fb = worker->framebuffer;
-  const int xmin = worker->tile_region.min[0];
-  const int ymin = worker->tile_region.min[1];
-  const int xmax = worker->tile_region.max[0];
-  const int ymax = worker->tile_region.max[1];
-  int x, y;
+  Worker *worker_list = (Worker *) data;
+  Worker *worker = &worker_list[context.thread_id];
+  const Tiler *tiler = worker->tiler;
 
-  for (y = ymin; y < ymax; y++) {
-    for (x = xmin; x < xmax; x++) {
-      Color4 pixel;
+  // each thread has its own connection
+  FarmClient client;
+  if (client.Connect(worker->farm_address, worker->farm_port)) {
+    return LoopStatus::Continue;
+  }
+  worker->farm_connected = true;
 
-      worker->sampler->GetSampleSetInPixel(worker->pixel_samples, x, y);
-      pixel = apply_pixel_filter(worker, x, y);
+  for (;;) {
+    const int tile_id = client.RequestTile(worker->xres, worker->yres,
+        worker->framebuffer->GetChannelCount(), tiler->GetTileCount(), *tiler);
+    if (tile_id == -1) {
+      break;
+    }
 
-      fb->SetColor(x, y, pixel);
+    const int interrupted = render_tile_region(worker, tile_id);
+    if (interrupted) {
+      return LoopStatus::Cancel;
+    }
+
+    if (client.SendTile(tile_id, worker->tile_region, *worker->framebuffer)) {
+      break;
     }
   }
+
+  return client.IsAborted() ? LoopStatus::Cancel : LoopStatus::Continue;
 }
 
-static int render_frame_start(Renderer *renderer, const Tiler *tiler)
+static int render_farm_worker(Renderer *renderer, std::vector<Worker> &worker_list)
 {
-  FrameInfo info;
-  info.frame_id = renderer->frame_id_;
-  info.worker_count = renderer->GetThreadCount();
-  info.tile_count = tiler->GetTileCount();
-  info.xres = renderer->resolution_[0];
-  info.yres = renderer->resolution_[1];
-  info.frame_region = renderer->frame_region_;;
-  info.framebuffer = renderer->framebuffer_;
+  const int thread_count = static_cast<int>(worker_list.size());
 
-  const Interrupt interrupt = CbReportFrameStart(&renderer->frame_report_, &info);
-  if (interrupt == CALLBACK_INTERRUPT) {
-    return -1;
-  } else {
-    return 0;
-  }
-}
+  printf("# Farm Worker\n");
+  printf("#   Coordinator: %s:%d\n\n",
+      renderer->farm_address_.c_str(), renderer->farm_port_);
 
-static void render_frame_done(Renderer *renderer, const Tiler *tiler)
-{
-  FrameInfo info;
-  info.frame_id = renderer->frame_id_;
-  info.worker_count = renderer->GetThreadCount();
-  info.tile_count = tiler->GetTileCount();
-  info.xres = renderer->resolution_[0];
-  info.yres = renderer->resolution_[1];
-  info.frame_region = renderer->frame_region_;;
-  info.framebuffer = renderer->framebuffer_;
+  std::vector<int> thread_que(thread_count);
+  for (int i = 0; i < thread_count; i++) {
+    thread_que[i] = i;
+  }
+  MtRunParallelLoop(&worker_list[0], render_farm_tiles, thread_count, thread_que);
 
-  CbReportFrameDone(&renderer->frame_report_, &info);
+  for (int i = 0; i < thread_count; i++) {
+    if (worker_list[i].farm_connected) {
+      return 0;
+    }
+  }
+  std::cerr << "* ERROR: cannot connect to farm coordinator: " <<
+      renderer->farm_address_ << ":" << renderer->farm_port_ << "\n\n";
+  return -1;
 }
 
-static int render_tile_start(Worker *worker)
+static void make_remote_tile_info(const Worker *remote, int tile_id, TileInfo *info)
 {
-  TileInfo info;
-  info.frame_id = worker->frame_id;
-  info.worker_id = worker->id;
-  info.region_id = worker->region_id;
-  info.total_region_count = worker->region_count;
-  info.tile_region = worker->tile_region;
-  info.framebuffer = worker->framebuffer;
-
-  const Interrupt interrupt = CbReportTileStart(&worker->tile_report, &info);
-  if (interrupt == CALLBACK_INTERRUPT) {
-    return -1;
-  } else {
-    return 0;
-  }
+  const Tile *tile = remote->tiler->GetTile(tile_id);
+
+  info->frame_id = remote->frame_id;
+  info->worker_id = remote->id;
+  info->region_id = tile_id;
+  info->total_region_count = remote->tiler->GetTileCount();
+  info->tile_region.min[0] = tile->xmin;
+  info->tile_region.min[1] = tile->ymin;
+  info->tile_region.max[0] = tile->xmax;
+  info->tile_region.max[1] = tile->ymax;
+  info->framebuffer = remote->framebuffer;
 }
 
-static void render_tile_done(Worker *worker)
+// called from connection threads of the coordinator at the same time
+static int report_remote_tile_start(void *data, int tile_id)
 {
+  Worker *remote = reinterpret_cast<Worker *>(data);
   TileInfo info;
-  info.frame_id = worker->frame_id;
-  info.worker_id = worker->id;
-  info.region_id = worker->region_id;
-  info.total_region_count = worker->region_count;
-  info.tile_region = worker->tile_region;
-  info.framebuffer = worker->framebuffer;
+  make_remote_tile_info(remote, tile_id, &info);
 
-  CbReportTileDone(&worker->tile_report, &info);
+  const Interrupt interrupt = CbReportTileStart(&remote->tile_report, &info);
+  return interrupt == CALLBACK_INTERRUPT ? -1 : 0;
 }
 
-static int integrate_samples(Worker *worker)
+static void report_remote_tile_done(void *data, int tile_id)
 {
-  Sample *smp = NULL;
-  TraceContext cxt = worker->context;
-  Ray ray;
-
-  while ((smp = worker->sampler->GetNextSample()) != NULL) {
-    Color4 C_trace;
-    double t_hit = FLT_MAX;
-    int hit = 0;
-    int interrupted = 0;
-
-    worker->camera->GetRay(smp->uv, smp->time, &ray);
-    cxt.time = smp->time;
+  Worker *remote = reinterpret_cast<Worker *>(data);
+  TileInfo info;
+  make_remote_tile_info(remote, tile_id, &info);
 
-    hit = SlTrace(&cxt, &ray.orig, &ray.dir, ray.tmin, ray.tmax, &C_trace, &t_hit);
-    if (hit) {
-      smp->data[0] = C_trace.r;
-      smp->data[1] = C_trace.g;
-      smp->data[2] = C_trace.b;
-      smp->data[3] = C_trace.a;
-    } else {
-      smp->data[0] = 0;
-      smp->data[1] = 0;
-      smp->data[2] = 0;
-      smp->data[3] = 0;
-    }
+  CbReportTileDone(&remote->tile_report, &info);
+  remote->progress->AddTile();
 
-    interrupted = CbReportSampleDone(&worker->tile_report);
-    if (interrupted) {
-      printf("integrate_samples CANCELED!\n");
-      return -1;
-    }
+  if (remote->checkpoint != NULL) {
+    remote->checkpoint->TileDone(tile_id);
   }
-  return 0;
+  if (remote->output != NULL) {
+    remote->output->TileDone(tile_id);
+  }
+  evict_tile(remote, tile_id);
 }
 
-static LoopStatus render_tile(void *data, const ThreadContext &context)
+// pixels of the tile are read again from the file by the next pass
+static void evict_tile(Worker *worker, int tile_id)
 {
-  Worker *worker_list = (Worker *) data;
-  Worker *worker = &worker_list[context.thread_id];
-  int interrupted = 0;
-
-  set_working_region(worker, context.iteration_id);
-
-  interrupted = render_tile_start(worker);
-  if (interrupted) {
-    return LoopStatus::Cancel;
+  FrameBuffer *fb = worker->framebuffer;
+  if (!fb->IsFileBacked()) {
+    return;
   }
 
-  interrupted = integrate_samples(worker);
-  reconstruct_image(worker);
-
-  render_tile_done(worker);
-
-  if (interrupted) {
-    return LoopStatus::Cancel;
+  const Tile *tile = worker->tiler->GetTile(tile_id);
+  if (fb->EvictRegion(tile->xmin, tile->ymin, tile->xmax, tile->ymax)) {
+    std::cerr << "* WARNING: cannot evict tile " << tile_id << " of framebuffer\n";
   }
-
-  return LoopStatus::Continue;
 }
 
 } // namespace xxx
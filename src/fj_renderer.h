@@ -4,10 +4,23 @@
 #ifndef FJ_RENDERER_H
 #define FJ_RENDERER_H
 
+#include "fj_viewer_connection.h"
 #include "fj_compatibility.h"
+#include "fj_radiance_cache.h"
+#include "fj_photon_map.h"
+#include "fj_transmittance_cache.h"
+#include "fj_light_tree.h"
+#include "fj_tile_coverage.h"
+#include "fj_primary_hit_cache.h"
 #include "fj_callback.h"
+#include "fj_aov.h"
 #include "fj_progress.h"
+#include "fj_render_metrics.h"
+#include "fj_multi_thread.h"
 #include "fj_timer.h"
+#include <atomic>
+#include <string>
+#include <vector>
 
 namespace fj {
 
@@ -16,29 +29,50 @@ class FrameBuffer;
 class ObjectGroup;
 class Camera;
 class Light;
+class Tiler;
+class ObjectInstance;
 
 class FrameProgress {
 public:
   FrameProgress() :
       timer(),
-      progress(),
-      iteration_list(),
-      current_segment(0),
-      report_to_viewer(true)
+      report_to_viewer(true),
+      viewer_tile_encoding(0),
+      viewer()
       {}
   ~FrameProgress() {}
 
   Timer timer;
-  Progress progress;
-  Iteration iteration_list[10]; // one for 10% 100% in total
-  int current_segment;
 
   bool report_to_viewer;
+  // one of TileEncoding in fj_protocol.h
+  int viewer_tile_encoding;
+  // opened from the start to the end of a frame
+  ViewerConnection viewer;
+};
+
+// a camera rendered with the camera of the renderer and its framebuffer
+class RenderView {
+public:
+  RenderView() : camera(NULL), framebuffer(NULL) {}
+  ~RenderView() {}
+
+  Camera *camera;
+  FrameBuffer *framebuffer;
 };
 
 enum RendererSamplerType {
   RENDERER_FIXED_GRID_SAMPLER = 0,
-  RENDERER_ADAPTIVE_GRID_SAMPLER
+  RENDERER_ADAPTIVE_GRID_SAMPLER,
+  RENDERER_VARIANCE_SAMPLER
+};
+
+enum RendererFarmMode {
+  RENDERER_FARM_NONE = 0,
+  // renders the frame and shares its tiles with workers that connect
+  RENDERER_FARM_COORDINATOR,
+  // loads the same scene and renders tiles the coordinator gives
+  RENDERER_FARM_WORKER
 };
 
 class Renderer {
@@ -49,7 +83,43 @@ public:
   void SetResolution(int xres, int yres);
   void SetRenderRegion(int xmin, int ymin, int xmax, int ymax);
   void SetTileSize(int xtilesize, int ytilesize);
+  // picks a square tile size at each render from the render region, the
+  // thread count, the filter width and the time per pixel of the previous
+  // render or the pixel samples instead of the tile size. 0 by default
+  void SetAutoTileSize(int enable);
+  // traces the samples of tiles still rendering after every tile of the
+  // frame has started in chunks that idle threads take. the image is the
+  // same. tiles with aovs or incremental render, and samplers other than
+  // the fixed grid are not split. 0 by default
+  void SetTailSplitting(int enable);
+  // one of TileOrder in fj_tiler.h. TILE_ORDER_COST uses the tile timings
+  // of the previous render, or of the preview pass for the first one
+  void SetTileOrder(int tile_order);
+  // renders tiles to be rendered at 1/8 then 1/4 resolution with one ray
+  // per block of pixels and ray depths up to 1 before the render so that
+  // viewers see the frame early. 0 by default
+  void SetPreviewPass(int enable);
+  // one of FrameBufferFormat for all channels including aovs. half floats
+  // halve the memory of the framebuffer and of EXR output
+  void SetFrameBufferFormat(int format);
+  // stores the framebuffer in tiles of the tile size so that pixels of each
+  // tile are together in memory
+  void SetTiledFrameBuffer(int enable);
+  // keeps the tiled framebuffer in the file mapped in memory and drops
+  // finished tiles from memory, e.g. for resolutions larger than memory.
+  // empty filename keeps it in memory (default)
+  void SetFrameBufferFile(const std::string &filename);
   void SetFilterWidth(float xfwidth, float yfwidth);
+  // one of FLT_* in fj_filter.h
+  void SetFilterType(int filter_type);
+  // reconstructs tiles by splatting each sample onto the pixels that would
+  // gather it instead of gathering sample sets of each pixel. the image is
+  // the same. samplers that don't store samples in a grid always gather
+  void SetFilterSplatting(int enable);
+  // draws sample positions from the filter around each pixel and averages
+  // them so tiles trace no samples for the margins of the filter and skip
+  // filtering. only for the fixed grid sampler. others filter as usual
+  void SetFilterImportanceSampling(int enable);
 
   void SetSamplerType(int sampler_type);
   void SetPixelSamples(int xrate, int yrate);
@@ -57,26 +127,178 @@ public:
   void SetSubdivisionThreshold(float subd_threshold);
   void SetSampleJitter(float jitter);
   void SetSampleTimeRange(double start_time, double end_time);
+  // one of SampleSequenceType in fj_random.h. the numbers shaders and
+  // lights draw for each pixel sample
+  void SetSampleSequence(int sequence_type);
+
+  // renders the whole frame repeatedly with pixelsamples per pass and
+  // averages the passes in the framebuffer until one of the limits is reached.
+  // renders one pass if neither limit is set
+  void SetProgressive(int enable);
+  // seconds of all passes. 0 for no limit. the first pass always finishes
+  void SetProgressiveTimeLimit(double time_limit);
+  // samples per pixel of all passes. 0 for no limit
+  void SetProgressiveMaxSamples(int max_samples);
+  // stops after the pass when the estimated noise of the image goes below
+  // the threshold. the noise is the RMS difference of luminance between the
+  // image and the average of its even passes relative to the RMS luminance
+  // of the image. e.g. .01 for 1%. 0 for no limit
+  void SetProgressiveNoiseThreshold(double noise_threshold);
+
+  // saves finished tiles to the file every interval seconds and skips them
+  // when the same frame is rendered again. the file is removed when the frame
+  // is done. empty filename disables it. not used by progressive rendering
+  void SetCheckpointFile(const std::string &filename);
+  void SetCheckpointInterval(double interval);
+
+  // writes a tiled EXR file of all framebuffer channels as tiles finish.
+  // channel names are separated by commas in the order of framebuffer
+  // channels. the default names are used if empty. progressive rendering
+  // writes the file after the last pass. empty filename disables it
+  void SetOutputFile(const std::string &filename);
+  void SetOutputChannels(const std::string &channel_names);
+
+  // writes RGBA denoised with the albedo, normal, depth and variance aovs
+  // of the frame after it is done. guides not in aovs are not used. EXR if
+  // the filename ends with .exr. empty filename disables it
+  void SetDenoisedFile(const std::string &filename);
+
+  // renders arbitrary output variables into framebuffer channels following
+  // RGBA. names of AOVType in fj_aov.h separated by commas. empty for none.
+  // returns -1 for unknown names keeping the previous ones
+  int SetAOVs(const std::string &names);
+
+  // writes events recorded so far as a Chrome trace file at the end of
+  // each render. a filename starts recording, so the scene before it is
+  // only traced with FJ_TRACE=1. see fj_trace.h. empty filename disables
+  // the file
+  void SetTraceFile(const std::string &filename);
+  // counts calls and time of each shader and object instance while
+  // rendering. see fj_profile.h. 0 by default
+  void SetProfile(int enable);
+  // prints details of preparing the scene such as the quality of each
+  // accelerator. 0 by default
+  void SetVerbose(int enable);
+  bool IsVerbose() const;
+
+  // renders the frame at the scale of the resolution with one sample per
+  // pixel instead, and writes the render time and the peak memory of the
+  // full frame extrapolated from tile timings to the file as JSON, e.g. for
+  // farm schedulers. no output files are written and framebuffers keep the
+  // pixels of the last render. empty filename renders as usual (default)
+  void SetEstimateFile(const std::string &filename);
+  // .25 by default
+  void SetEstimateResolutionScale(double scale);
+
+  // prepares the scene once and renders the frame, or the render region,
+  // once for each of the benchmark thread counts, and writes the time,
+  // speedup, parallel efficiency, the growth of tile time and the tail of
+  // each count to the file as JSON, e.g. to see how a scene scales before
+  // packing it on nodes. the framebuffer keeps the last render. no output
+  // files are written. empty filename renders as usual (default)
+  void SetBenchmarkFile(const std::string &filename);
+  // thread counts separated by commas, e.g. "1,2,4,8", capped by the
+  // available threads. empty for powers of two up to the available threads
+  // (default). returns -1 for invalid counts keeping the previous ones
+  int SetBenchmarkThreadCounts(const std::string &counts);
+
+  // answers requests on the port with progress, rays, memory, texture cache
+  // and thread metrics of renders in the Prometheus text format while the
+  // renderer exists. 0 disables it (default)
+  void SetMetricsPort(int port);
+
+  // keeps the framebuffer and the objects hit by rays of each tile, shadow
+  // and reflection rays included, so that the next render only renders
+  // again tiles of objects passed to InvalidateObject() and tiles left
+  // unfinished. other edits of the scene need InvalidateAll(). not used with
+  // farms, checkpoints and framebuffer files. lighting reused from the
+  // radiance cache and caustic photons is not tracked. 0 by default
+  void SetIncrementalRender(int enable);
+  // e.g. after its shaders are edited
+  void InvalidateObject(const ObjectInstance *object);
+  void InvalidateAll();
+  // keeps what camera rays of the last renders hit, up to the memory in
+  // megabytes, so that renders after edits of shaders shade the hits
+  // again without tracing camera rays. hits are dropped by InvalidateAll()
+  // and by changes of sample settings. only the fixed grid sampler without
+  // ray streaming and farms. views trace their rays. 0 disables it (default)
+  void SetPrimaryHitCacheMemory(double megabytes);
+
+  // one of RendererFarmMode. farm modes render one pass even if progressive.
+  // address is the host of the coordinator used by workers
+  void SetFarmMode(int farm_mode);
+  void SetFarmAddress(const std::string &address);
+  void SetFarmPort(int port);
+
+  // one of TileEncoding in fj_protocol.h. the format of tiles sent to fbview.
+  // half floats are enough for display and halve the data on slow networks.
+  // TILE_ENCODING_SHARED (default) passes pixels through shared memory
+  void SetViewerTileEncoding(int tile_encoding);
+
+  // draws count lights for each shading point by their estimated
+  // contribution with a light tree. 0 shades with all lights
+  void SetSampledLightCount(int count);
+
+  // caches incoming diffuse radiance of secondary diffuse bounces in cells
+  // of this size in world space. filled while rendering and shared by
+  // threads, so images depend on the order threads fill it. the mean of a
+  // closed room is within .5% of the render without it. 0 disables it
+  void SetRadianceCacheCellSize(double cell_size);
+
+  // interpolates shadows of volumes from transmittance toward each light
+  // cached at the vertices of cells of this size in world space instead of
+  // raymarching every shadow ray. 0 disables it
+  void SetTransmittanceCacheCellSize(double cell_size);
+
+  // shoots this many photons from lights through shaders scattering them
+  // before rendering for caustics on diffuse surfaces. photons are capped
+  // by the memory in megabytes. radius is of the photons gathered for a
+  // point. 0 chooses it from the bounds of specular objects. 0 photons
+  // disables caustics
+  void SetCausticPhotonCount(int photon_count);
+  void SetCausticPhotonMemory(double megabytes);
+  void SetCausticRadius(double radius);
+
+  // intersects camera rays of a tile in batches sorted by direction and
+  // origin and then shades hits grouped by shader. gives the same image.
+  // only the fixed grid sampler since others place samples by results
+  void SetRayStreaming(int enable);
 
   void SetShadowEnable(int enable);
   void SetMaxDiffuseDepth(int max_depth);
   void SetMaxReflectDepth(int max_depth);
   void SetMaxRefractDepth(int max_depth);
+  // secondary rays whose contribution to the pixel, the product of the
+  // surface weights along the path, falls below the threshold are
+  // terminated at random and survivors are weighted up. the image is
+  // unbiased but noisier. 0 traces all rays to the max depths (default)
+  void SetRayThroughputThreshold(float threshold);
 
   void SetRaymarchStep(double step);
   void SetRaymarchShadowStep(double step);
   void SetRaymarchDiffuseStep(double step);
   void SetRaymarchReflectStep(double step);
   void SetRaymarchRefractStep(double step);
+  // one of ShadowTransmittance in fj_shading.h
+  void SetShadowTransmittance(int transmittance);
 
   void SetCamera(Camera *cam);
   void SetFrameBuffers(FrameBuffer *fb);
+  // renders the camera into the framebuffer in the same render as the
+  // camera of the renderer, e.g. the other eye of a stereo pair. tiles of
+  // all views come from one queue and share the scene and caches. views
+  // have the resolution and settings of the renderer. checkpoints, output
+  // files, denoising, farms, viewers and incremental renders only use the
+  // camera of the renderer. views are rendered again every time
+  void AddView(Camera *cam, FrameBuffer *fb);
+  void ClearViews();
   void SetTargetObjects(ObjectGroup *grp);
   void SetTargetLights(Light **lights, int nlights);
 
   // use max thread if use_max_thread is 1, otherwise takes account for thread_count
   void SetUseMaxThread(int use_max_thread);
   void SetThreadCount(int thread_count);
+  // while rendering, no more than the cpus held of the host cpu budget
   int GetThreadCount() const;
 
   void SetFrameReportCallback(void *data,
@@ -91,16 +313,29 @@ public:
 
   int RenderScene();
 
+  // makes the render running on another thread return as soon as possible.
+  // the framebuffer keeps what was rendered. renders return at once until
+  // it is cleared
+  void Interrupt();
+  void ClearInterrupt();
+  bool IsInterrupted() const;
+
 public:
   int prepare_rendering();
   int execute_rendering();
+  void choose_tile_size();
+  int render_estimate();
+  int render_benchmark();
 
   int preprocess_camera() const;
   int preprocess_framebuffer() const;
   int preprocess_lights();
+  int preprocess_caustics();
+  int write_denoised_file(const Tiler *tiler) const;
 
   Camera *camera_;
   FrameBuffer *framebuffer_;
+  std::vector<RenderView> views_;
   ObjectGroup *target_objects_;
   Light **target_lights_;
   int nlights_;
@@ -108,7 +343,22 @@ public:
   int resolution_[2];
   Rectangle frame_region_;
   int tilesize_[2];
+  int auto_tilesize_;
+  int tail_splitting_;
+  // seconds per pixel of the tiles of the last render. 0 if unknown
+  double pixel_seconds_;
+  int tile_order_;
+  int framebuffer_format_;
+  int tiled_framebuffer_;
+  std::string framebuffer_file_;
+  // seconds taken by each tile in the last render
+  std::vector<double> tile_costs_;
+  // of the tiles of each view after another
+  std::vector<double> view_tile_costs_;
   float filterwidth_[2];
+  int filter_type_;
+  int filter_splatting_;
+  int filter_importance_sampling_;
 
   int sampler_type_;
   int pixelsamples_[2];
@@ -117,26 +367,93 @@ public:
   float jitter_;
   double sample_time_start_;
   double sample_time_end_;
+  int sample_sequence_;
+
+  int progressive_;
+  double progressive_time_limit_;
+  int progressive_max_samples_;
+  double progressive_noise_threshold_;
+
+  std::string checkpoint_file_;
+  double checkpoint_interval_;
+
+  std::string output_file_;
+  std::string output_channels_;
+  std::string denoised_file_;
+
+  std::string trace_file_;
+  int profile_;
+  int verbose_;
+
+  std::string estimate_file_;
+  double estimate_resolution_scale_;
+
+  std::string benchmark_file_;
+  std::vector<int> benchmark_thread_counts_;
+  // seconds from the start of the tiles of the last render to the end of
+  // the last tile of each thread. 0 for threads with no tiles
+  std::vector<double> thread_done_seconds_;
+
+  int metrics_port_;
+  MetricsServer metrics_;
+
+  int preview_pass_;
+
+  int incremental_render_;
+  TileCoverage tile_coverage_;
+  double primary_hit_cache_memory_;
+  PrimaryHitCache primary_hit_cache_;
+  // the framebuffer has tiles of the last render to keep
+  bool keeps_last_frame_;
+
+  AOVLayout aov_layout_;
+
+  int farm_mode_;
+  std::string farm_address_;
+  int farm_port_;
+
+  int sampled_light_count_;
+  LightTree light_tree_;
+
+  double radiance_cache_cell_size_;
+  RadianceCache radiance_cache_;
+
+  double transmittance_cache_cell_size_;
+  TransmittanceCache transmittance_cache_;
+
+  int caustic_photon_count_;
+  double caustic_photon_memory_;
+  double caustic_radius_;
+  PhotonMap photon_map_;
+
+  int ray_streaming_;
 
   int cast_shadow_;
   int max_diffuse_depth_;
   int max_reflect_depth_;
   int max_refract_depth_;
+  float ray_throughput_threshold_;
 
   double raymarch_step_;
   double raymarch_shadow_step_;
   double raymarch_diffuse_step_;
   double raymarch_reflect_step_;
   double raymarch_refract_step_;
+  int shadow_transmittance_;
 
   int use_max_thread_;
   int thread_count_;
+  // cpus of the host cpu budget held while rendering. 0 if not rendering
+  HostCPULease host_cpus_;
+  int host_thread_count_;
 
   FrameReport frame_report_;
   TileReport tile_report_;
   FrameProgress frame_progress_;
 
   int32_t frame_id_;
+
+  std::atomic<bool> interrupted_;
 };
 
 } // namespace xxx
@@ -0,0 +1,196 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_sample_margin_cache.h"
+#include "fj_numeric.h"
+#include "fj_tiler.h"
+
+namespace fj {
+
+static int floor_div(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// samples of the tile within margin from its sides
+static int count_border_samples(const Int2 &size, const Int2 &margin)
+{
+  const int inner_w = Max(0, size[0] - 2 * margin[0]);
+  const int inner_h = Max(0, size[1] - 2 * margin[1]);
+  return size[0] * size[1] - inner_w * inner_h;
+}
+
+// index of the sample in the borders of the tile. -1 for inner ones
+static int compute_border_index(const Int2 &pos, const Int2 &size, const Int2 &margin)
+{
+  const int inner_w = Max(0, size[0] - 2 * margin[0]);
+  const int inner_h = Max(0, size[1] - 2 * margin[1]);
+  // all rows are borders when there are no inner samples
+  const int top = inner_w > 0 && inner_h > 0 ? margin[1] : size[1];
+  const int left = margin[0];
+  const int x = pos[0];
+  const int y = pos[1];
+
+  if (y < top) {
+    return y * size[0] + x;
+  }
+  if (y >= top + inner_h) {
+    return top * size[0] + inner_h * (size[0] - inner_w) +
+        (y - top - inner_h) * size[0] + x;
+  }
+
+  const int row = top * size[0] + (y - top) * (size[0] - inner_w);
+  if (x < left) {
+    return row + x;
+  }
+  if (x >= left + inner_w) {
+    return row + x - inner_w;
+  }
+  return -1;
+}
+
+SampleMarginCache::SampleMarginCache() :
+  tiler_(NULL),
+  rate_(1, 1),
+  margin_(0, 0),
+  channel_count_(0),
+  borders_(),
+  border_sizes_(),
+  border_offsets_(),
+  states_()
+{
+}
+
+SampleMarginCache::~SampleMarginCache()
+{
+}
+
+void SampleMarginCache::Init(const Tiler *tiler, const Int2 &pixel_samples,
+    const Int2 &margin, int channel_count)
+{
+  tiler_ = tiler;
+  rate_ = pixel_samples;
+  margin_ = margin;
+  channel_count_ = channel_count;
+
+  if (!IsEnabled()) {
+    borders_.clear();
+    border_sizes_.clear();
+    border_offsets_.clear();
+    states_.reset();
+    return;
+  }
+
+  const int tile_count = tiler_->GetTileCount();
+  borders_.resize(tile_count);
+  border_sizes_.resize(tile_count);
+  border_offsets_.resize(tile_count);
+  int total_size = 0;
+
+  for (int i = 0; i < tile_count; i++) {
+    const Tile *tile = tiler_->GetTile(i);
+    const Int2 size = Int2(tile->xmax - tile->xmin, tile->ymax - tile->ymin) * rate_;
+
+    border_sizes_[i] = count_border_samples(size, margin_);
+    border_offsets_[i] = total_size;
+    borders_[i].resize(channel_count_ * border_sizes_[i]);
+    total_size += border_sizes_[i];
+  }
+
+  states_.reset(new std::atomic<int>[total_size]);
+  for (int i = 0; i < total_size; i++) {
+    states_[i].store(0);
+  }
+}
+
+bool SampleMarginCache::IsEnabled() const
+{
+  return tiler_ != NULL && (margin_[0] > 0 || margin_[1] > 0);
+}
+
+int SampleMarginCache::GetChannelCount() const
+{
+  return channel_count_;
+}
+
+bool SampleMarginCache::Fetch(const Int2 &grid_pos, int pass, float *values) const
+{
+  int tile_id = -1;
+  const int index = find_sample(grid_pos, &tile_id);
+  if (index < 0) {
+    return false;
+  }
+  if (states_[border_offsets_[tile_id] + index].load(std::memory_order_acquire) != pass + 1) {
+    return false;
+  }
+
+  const std::vector<float> &border = borders_[tile_id];
+  const int size = border_sizes_[tile_id];
+  for (int i = 0; i < channel_count_; i++) {
+    values[i] = border[i * size + index];
+  }
+  return true;
+}
+
+void SampleMarginCache::Store(const Int2 &grid_pos, int pass, const float *values)
+{
+  int tile_id = -1;
+  const int index = find_sample(grid_pos, &tile_id);
+  if (index < 0) {
+    return;
+  }
+
+  // values of the previous pass are free to overwrite
+  std::atomic<int> &state = states_[border_offsets_[tile_id] + index];
+  int expected = state.load(std::memory_order_relaxed);
+  if (expected == pass + 1 || expected < 0 ||
+      !state.compare_exchange_strong(expected, -(pass + 1), std::memory_order_acquire)) {
+    return;
+  }
+
+  std::vector<float> &border = borders_[tile_id];
+  const int size = border_sizes_[tile_id];
+  for (int i = 0; i < channel_count_; i++) {
+    border[i * size + index] = values[i];
+  }
+  state.store(pass + 1, std::memory_order_release);
+}
+
+int SampleMarginCache::find_sample(const Int2 &grid_pos, int *tile_id) const
+{
+  *tile_id = tiler_->FindTile(
+      floor_div(grid_pos[0], rate_[0]),
+      floor_div(grid_pos[1], rate_[1]));
+  if (*tile_id < 0) {
+    return -1;
+  }
+
+  const Tile *tile = tiler_->GetTile(*tile_id);
+  const Int2 min = Int2(tile->xmin, tile->ymin) * rate_;
+  const Int2 size = Int2(tile->xmax - tile->xmin, tile->ymax - tile->ymin) * rate_;
+  const Int2 pos = grid_pos - min;
+
+  if (pos[0] < 0 || pos[1] < 0 || pos[0] >= size[0] || pos[1] >= size[1]) {
+    return -1;
+  }
+  return compute_border_index(pos, size, margin_);
+}
+
+std::size_t SampleMarginCacheMemorySize(const Tiler *tiler, const Int2 &pixel_samples,
+    const Int2 &margin, int channel_count)
+{
+  if (tiler == NULL || (margin[0] <= 0 && margin[1] <= 0)) {
+    return 0;
+  }
+
+  std::size_t total_size = 0;
+  for (int i = 0; i < tiler->GetTileCount(); i++) {
+    const Tile *tile = tiler->GetTile(i);
+    const Int2 size = Int2(tile->xmax - tile->xmin, tile->ymax - tile->ymin) * pixel_samples;
+    total_size += count_border_samples(size, margin);
+  }
+
+  return total_size * (channel_count * sizeof(float) + sizeof(std::atomic<int>));
+}
+
+} // namespace xxx
@@ -0,0 +1,65 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_SAMPLE_MARGIN_CACHE_H
+#define FJ_SAMPLE_MARGIN_CACHE_H
+
+#include "fj_vector.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace fj {
+
+class Tiler;
+
+// Values of samples along the borders of tiles. Filters wider than a pixel
+// need samples in margins around each tile which are samples of the
+// neighbor tiles. Whichever tile traces one of them first stores it here and
+// the others take it instead of tracing it again, so each sample is traced
+// once unless tiles trace it at the same time. Samples are in the grid of
+// the whole image (see Sampler::GetSampleGrid) and must be at the same
+// positions in every tile. Values are stored by channel (RGBA then aovs).
+class SampleMarginCache {
+public:
+  SampleMarginCache();
+  ~SampleMarginCache();
+
+  // margin is the number of samples outside of each side of a tile.
+  // disabled if it is 0
+  void Init(const Tiler *tiler, const Int2 &pixel_samples, const Int2 &margin,
+      int channel_count);
+  bool IsEnabled() const;
+  int GetChannelCount() const;
+
+  // Thread safe. copies channel values of the sample at the grid position if
+  // it is stored in the pass. returns false if not
+  bool Fetch(const Int2 &grid_pos, int pass, float *values) const;
+  // Thread safe. stores values of the sample in the pass. ignored unless it
+  // is in the border of a tile or if it is already stored
+  void Store(const Int2 &grid_pos, int pass, const float *values);
+
+private:
+  // index of the sample in the border of its tile. -1 if not in any
+  int find_sample(const Int2 &grid_pos, int *tile_id) const;
+
+  const Tiler *tiler_;
+  Int2 rate_;
+  Int2 margin_;
+  int channel_count_;
+
+  // values of each tile by channel then by sample
+  std::vector<std::vector<float>> borders_;
+  std::vector<int> border_sizes_;
+  std::vector<int> border_offsets_;
+  // pass + 1 of stored values of each sample. negative while storing
+  std::unique_ptr<std::atomic<int>[]> states_;
+};
+
+// bytes Init() allocates for the arguments
+std::size_t SampleMarginCacheMemorySize(const Tiler *tiler, const Int2 &pixel_samples,
+    const Int2 &margin, int channel_count);
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
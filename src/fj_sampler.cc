@@ -12,10 +12,53 @@
 
 namespace fj {
 
+static uint32_t hash_pixel(const Int2 &pixel_pos)
+{
+  return
+    static_cast<uint32_t>(pixel_pos[0]) * 73856093U ^
+    static_cast<uint32_t>(pixel_pos[1]) * 19349663U;
+}
+
+// the i-th element of a random permutation of [0, count) for the pattern
+// (Kensler, Correlated Multi-Jittered Sampling)
+static uint32_t permute(uint32_t i, uint32_t count, uint32_t pattern)
+{
+  uint32_t w = count - 1;
+  w |= w >> 1;
+  w |= w >> 2;
+  w |= w >> 4;
+  w |= w >> 8;
+  w |= w >> 16;
+
+  do {
+    i ^= pattern;
+    i *= 0xe170893dU;
+    i ^= pattern >> 16;
+    i ^= (i & w) >> 4;
+    i ^= pattern >> 8;
+    i *= 0x0929eb3fU;
+    i ^= pattern >> 23;
+    i ^= (i & w) >> 1;
+    i *= 1 | pattern >> 27;
+    i *= 0x6935fa69U;
+    i ^= (i & w) >> 11;
+    i *= 0x74dcb303U;
+    i ^= (i & w) >> 2;
+    i *= 0x9e501cc3U;
+    i ^= (i & w) >> 2;
+    i *= 0xc860a3dfU;
+    i &= w;
+    i ^= i >> 5;
+  } while (i >= count);
+
+  return (i + pattern) % count;
+}
+
 Sampler::Sampler() :
   res_(1, 1),
   rate_(1, 1),
   fwidth_(1., 1.),
+  importance_filter_(NULL),
   jitter_(1.),
   max_subd_(1),
   subd_threshold_(.05),
@@ -24,7 +67,9 @@ Sampler::Sampler() :
   need_time_sampling_(false),
 
   sample_time_start_(0),
-  sample_time_end_(0)
+  sample_time_end_(0),
+
+  seed_(0)
 {
 }
 
@@ -53,6 +98,12 @@ void Sampler::SetFilterWidth(const Vector2 &filter_width)
   update_sample_counts();
 }
 
+void Sampler::SetImportanceFilter(const Filter *filter)
+{
+  importance_filter_ = filter;
+  update_sample_counts();
+}
+
 void Sampler::SetMaxSubdivision(int max_subd)
 {
   assert(max_subd >= 0);
@@ -85,6 +136,12 @@ void Sampler::SetSampleTimeRange(Real start_time, Real end_time)
   need_time_sampling_ = true;
 }
 
+void Sampler::SetSampleSeed(int seed)
+{
+  assert(seed >= 0);
+  seed_ = seed;
+}
+
 const Int2 &Sampler::GetResolution() const
 {
   return res_;
@@ -100,6 +157,11 @@ const Vector2 &Sampler::GetFilterWidth() const
   return fwidth_;
 }
 
+const Filter *Sampler::GetImportanceFilter() const
+{
+  return importance_filter_;
+}
+
 int Sampler::GetMaxSubdivision() const
 {
   return max_subd_;
@@ -130,6 +192,11 @@ Real Sampler::GetJitter() const
   return jitter_;
 }
 
+int Sampler::GetSampleSeed() const
+{
+  return seed_;
+}
+
 int Sampler::GenerateSamples(const Rectangle &region)
 {
   return generate_samples(region);
@@ -140,6 +207,66 @@ Sample *Sampler::GetNextSample()
   return get_next_sample();
 }
 
+const Sample *Sampler::GetSamples(int *sample_count) const
+{
+  return get_samples(sample_count);
+}
+
+Sample *Sampler::GetSampleGrid(Int2 *origin, Int2 *size)
+{
+  return const_cast<Sample *>(get_sample_grid(origin, size));
+}
+
+const Sample *Sampler::GetSampleGrid(Int2 *origin, Int2 *size) const
+{
+  return get_sample_grid(origin, size);
+}
+
+Int2 Sampler::GetSampleMargin() const
+{
+  return get_sample_margin();
+}
+
+const Sample *Sampler::get_samples(int *sample_count) const
+{
+  *sample_count = 0;
+  return NULL;
+}
+
+const Sample *Sampler::get_sample_grid(Int2 *origin, Int2 *size) const
+{
+  *origin = Int2(0, 0);
+  *size = Int2(0, 0);
+  return NULL;
+}
+
+Int2 Sampler::get_sample_margin() const
+{
+  return Int2(0, 0);
+}
+
+void Sampler::SetSequence(Sample &sample, const Int2 &pixel_pos,
+    int index, int pixel_sample_count) const
+{
+  // pixels in margins of neighbor tiles get the same sequences
+  const uint32_t pixel_seed = hash_pixel(pixel_pos);
+
+  sample.sequence_index = static_cast<uint32_t>(seed_ * pixel_sample_count + index);
+  sample.sequence_seed = pixel_seed;
+}
+
+Real Sampler::ComputeSampleTime(const Int2 &pixel_pos,
+    int index, int pixel_sample_count, Real rnd) const
+{
+  const uint32_t pattern = hash_pixel(pixel_pos) ^
+      static_cast<uint32_t>(seed_ + 1) * 83492791U;
+  const uint32_t stratum = permute(static_cast<uint32_t>(index),
+      static_cast<uint32_t>(pixel_sample_count), pattern);
+  const Real t = (stratum + rnd) / pixel_sample_count;
+
+  return Fit(t, 0, 1, sample_time_start_, sample_time_end_);
+}
+
 void Sampler::GetSampleSetInPixel(std::vector<Sample> &pixelsamples,
     int pixel_x, int pixel_y) const
 {
@@ -12,6 +12,7 @@
 namespace fj {
 
 class Rectangle;
+class Filter;
 
 class Sampler {
 public:
@@ -21,16 +22,25 @@ public:
   void SetResolution(const Int2 &resolution);
   void SetPixelSamples(const Int2 &pixel_samples);
   void SetFilterWidth(const Vector2 &filter_width);
+  // draws positions of samples around the centers of their pixels from the
+  // filter so that a pixel is the average of its own samples weighted by
+  // their weight (the sign of the filter times its importance scale). no
+  // margin is needed. NULL for
+  // positions in the pixels (default). only the fixed grid sampler does it
+  void SetImportanceFilter(const Filter *filter);
   // TODO ADAPTIVE_TEST
   void SetMaxSubdivision(int max_subd);
   void SetSubdivisionThreshold(Real subd_threshold);
 
   void SetJitter(Real jitter);
   void SetSampleTimeRange(Real start_time, Real end_time);
+  // varies random jitters between progressive passes. 0 is the default
+  void SetSampleSeed(int seed);
 
   const Int2    &GetResolution() const;
   const Int2    &GetPixelSamples() const;
   const Vector2 &GetFilterWidth() const;
+  const Filter  *GetImportanceFilter() const;
   // TODO ADAPTIVE_TEST
   int            GetMaxSubdivision() const;
   Real           GetSubdivisionThreshold() const;
@@ -39,11 +49,33 @@ public:
   bool IsSamplingTime() const;
   bool IsJittered() const;
   Real GetJitter() const;
+  int GetSampleSeed() const;
 
   int GenerateSamples(const Rectangle &region);
   Sample *GetNextSample();
   void GetSampleSetInPixel(std::vector<Sample> &pixelsamples,
       int pixel_x, int pixel_y) const;
+  // all samples of the region in place. NULL if the sampler doesn't store
+  // them in one array
+  const Sample *GetSamples(int *sample_count) const;
+  // all samples of the region in place when they are in a grid. origin is
+  // the position of the first sample in the grid of the whole image where
+  // (0, 0) is the first sample of pixel (0, 0). NULL if not in a grid
+  Sample *GetSampleGrid(Int2 *origin, Int2 *size);
+  const Sample *GetSampleGrid(Int2 *origin, Int2 *size) const;
+  // samples outside of each side of the region for the filter
+  Int2 GetSampleMargin() const;
+
+  // for samplers to set the sequence of the index-th sample of the pixel
+  // which has pixel_sample_count samples in a pass
+  void SetSequence(Sample &sample, const Int2 &pixel_pos,
+      int index, int pixel_sample_count) const;
+  // for samplers to stratify time of samples in the pixel. the index-th
+  // sample takes a stratum of the shutter shuffled for each pixel and seed
+  // so that time doesn't follow the position in the pixel. rnd in [0, 1)
+  // jitters time in the stratum
+  Real ComputeSampleTime(const Int2 &pixel_pos,
+      int index, int pixel_sample_count, Real rnd) const;
 
 private:
   virtual void update_sample_counts() = 0;
@@ -51,10 +83,14 @@ private:
   virtual Sample *get_next_sample() = 0;
   virtual void get_sampleset_in_pixel(std::vector<Sample> &pixelsamples,
       const Int2 &pixel_pos) const = 0;
+  virtual const Sample *get_samples(int *sample_count) const;
+  virtual const Sample *get_sample_grid(Int2 *origin, Int2 *size) const;
+  virtual Int2 get_sample_margin() const;
 
   Int2 res_;
   Int2 rate_;
   Vector2 fwidth_;
+  const Filter *importance_filter_;
   Real jitter_;
   int  max_subd_;
   Real subd_threshold_;
@@ -64,6 +100,8 @@ private:
 
   Real sample_time_start_;
   Real sample_time_end_;
+
+  int seed_;
 };
 
 } // namespace xxx
@@ -4,12 +4,17 @@
 #include "fj_scene.h"
 #include "fj_grid_accelerator.h"
 #include "fj_bvh_accelerator.h"
+#include "fj_qbvh_accelerator.h"
+#if defined(FJ_EMBREE)
+  #include "fj_embree_accelerator.h"
+#endif
 
 #include "fj_rectangle_light.h"
 #include "fj_sphere_light.h"
 #include "fj_point_light.h"
 #include "fj_dome_light.h"
 
+#include <algorithm>
 #include <cassert>
 
 #define DEFINE_LIST_FUNCTIONS(Type) \
@@ -38,6 +43,44 @@ void delete_entries(std::vector<T *> &entry_list)
   }
 }
 
+template<typename T>
+static void add_memory_usage(const std::vector<T *> &entry_list, int category,
+    SceneMemoryUsage *usage)
+{
+  for (size_t i = 0; i < entry_list.size(); i++) {
+    const std::size_t bytes = entry_list[i]->GetMemoryUsage();
+    usage->bytes[category] += bytes;
+    usage->node_count[category]++;
+    if (usage->largest_node[category] == -1 || bytes > usage->largest_bytes[category]) {
+      usage->largest_node[category] = i;
+      usage->largest_bytes[category] = bytes;
+    }
+  }
+}
+
+SceneMemoryUsage::SceneMemoryUsage()
+{
+  for (int i = 0; i < SCENE_MEMORY_CATEGORY_COUNT; i++) {
+    bytes[i] = 0;
+    node_count[i] = 0;
+    largest_node[i] = -1;
+    largest_bytes[i] = 0;
+  }
+}
+
+SceneMemoryUsage::~SceneMemoryUsage()
+{
+}
+
+std::size_t SceneMemoryUsage::GetTotal() const
+{
+  std::size_t total = 0;
+  for (int i = 0; i < SCENE_MEMORY_CATEGORY_COUNT; i++) {
+    total += bytes[i];
+  }
+  return total;
+}
+
 template<typename T>
 static inline
 T *push_entry_(std::vector<T *> &entry_list, T *entry)
@@ -46,6 +89,25 @@ T *push_entry_(std::vector<T *> &entry_list, T *entry)
   return entry;
 }
 
+// count nodes from the pool. returns the first of them
+template<typename T>
+static inline
+T *push_entries_(std::vector<T *> &entry_list, NodePool<T> &pool, int count)
+{
+  if (count <= 0) {
+    return NULL;
+  }
+
+  T *entries = pool.Allocate(count);
+  if (entry_list.capacity() < entry_list.size() + count) {
+    entry_list.reserve(std::max(entry_list.size() + count, 2 * entry_list.capacity()));
+  }
+  for (int i = 0; i < count; i++) {
+    entry_list.push_back(&entries[i]);
+  }
+  return entries;
+}
+
 Scene::Scene()
 {
 }
@@ -58,8 +120,12 @@ Scene::~Scene()
 // ObjectInstance
 ObjectInstance *Scene::NewObjectInstance()
 {
-  ObjectInstance *object = new ObjectInstance();
-  return push_entry_(ObjectInstanceList, object);
+  return NewObjectInstances(1);
+}
+
+ObjectInstance *Scene::NewObjectInstances(int count)
+{
+  return push_entries_(ObjectInstanceList, ObjectInstancePool, count);
 }
 
 // Accelerator
@@ -75,6 +141,45 @@ Accelerator *Scene::NewBVHAccelerator()
   return push_entry_(AcceleratorList, acc);
 }
 
+Accelerator *Scene::ReplaceAccelerator(int index, int accelerator_type)
+{
+  Accelerator *old_acc = GetAccelerator(index);
+  Accelerator *new_acc = NULL;
+
+  if (old_acc == NULL) {
+    return NULL;
+  }
+
+  switch (accelerator_type) {
+  case ACC_GRID:
+    new_acc = new GridAccelerator();
+    break;
+  case ACC_BVH:
+    new_acc = new BVHAccelerator();
+    break;
+  case ACC_QBVH:
+    new_acc = new QBVHAccelerator();
+    break;
+#if defined(FJ_EMBREE)
+  case ACC_EMBREE:
+    new_acc = new EmbreeAccelerator();
+    break;
+#endif
+  default:
+    return NULL;
+  }
+
+  new_acc->SetPrimitiveSet(old_acc->GetPrimitiveSet());
+  if (old_acc->IsDeferred()) {
+    new_acc->SetDeferredProcedure(old_acc->GetDeferredProcedure(),
+        old_acc->GetDeferredBounds());
+  }
+  AcceleratorList[index] = new_acc;
+  delete old_acc;
+
+  return new_acc;
+}
+
 // FrameBuffer
 FrameBuffer *Scene::NewFrameBuffer()
 {
@@ -85,8 +190,12 @@ FrameBuffer *Scene::NewFrameBuffer()
 // ObjectGroup
 ObjectGroup *Scene::NewObjectGroup()
 {
-  ObjectGroup *group = new ObjectGroup();
-  return push_entry_(ObjectGroupList, group);
+  return NewObjectGroups(1);
+}
+
+ObjectGroup *Scene::NewObjectGroups(int count)
+{
+  return push_entries_(ObjectGroupList, ObjectGroupPool, count);
 }
 
 // PointCloud
@@ -108,6 +217,9 @@ Procedure *Scene::NewProcedure(Plugin *plugin)
 {
   void *instance = plugin->CreateInstance();
   Procedure *procedure = reinterpret_cast<Procedure *>(instance);
+  if (procedure != NULL) {
+    procedure->SetTypeName(plugin->GetName());
+  }
   return push_entry_(ProcedureList, procedure);
 }
 
@@ -211,12 +323,25 @@ DEFINE_LIST_FUNCTIONS(Curve)
 DEFINE_LIST_FUNCTIONS(Light)
 DEFINE_LIST_FUNCTIONS(Mesh)
 
+void Scene::GetMemoryUsage(SceneMemoryUsage *usage) const
+{
+  *usage = SceneMemoryUsage();
+  add_memory_usage(MeshList,        SCENE_MEMORY_MESH,         usage);
+  add_memory_usage(CurveList,       SCENE_MEMORY_CURVE,        usage);
+  add_memory_usage(PointCloudList,  SCENE_MEMORY_POINT_CLOUD,  usage);
+  add_memory_usage(VolumeList,      SCENE_MEMORY_VOLUME,       usage);
+  add_memory_usage(TextureList,     SCENE_MEMORY_TEXTURE,      usage);
+  add_memory_usage(FrameBufferList, SCENE_MEMORY_FRAMEBUFFER,  usage);
+  add_memory_usage(AcceleratorList, SCENE_MEMORY_ACCELERATOR,  usage);
+  add_memory_usage(ObjectGroupList, SCENE_MEMORY_OBJECT_GROUP, usage);
+}
+
 void Scene::free_all_node_list()
 {
-  delete_entries(ObjectInstanceList);
+  ObjectInstancePool.Clear();
   delete_entries(AcceleratorList);
   delete_entries(FrameBufferList);
-  delete_entries(ObjectGroupList);
+  ObjectGroupPool.Clear();
   delete_entries(PointCloudList);
   delete_entries(TurbulenceList);
   //delete_entries(ProcedureList);
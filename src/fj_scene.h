@@ -20,10 +20,84 @@
 #include "fj_curve.h"
 #include "fj_light.h"
 #include "fj_mesh.h"
+#include <algorithm>
+#include <cstddef>
 #include <vector>
 
 namespace fj {
 
+enum SceneMemoryCategory {
+  SCENE_MEMORY_MESH = 0,
+  SCENE_MEMORY_CURVE,
+  SCENE_MEMORY_POINT_CLOUD,
+  SCENE_MEMORY_VOLUME,
+  SCENE_MEMORY_TEXTURE,
+  SCENE_MEMORY_FRAMEBUFFER,
+  SCENE_MEMORY_ACCELERATOR,
+  SCENE_MEMORY_OBJECT_GROUP,
+  SCENE_MEMORY_CATEGORY_COUNT
+};
+
+// bytes of nodes of each category and the largest node of them.
+// largest_node is the index in the node list or -1 without nodes
+class SceneMemoryUsage {
+public:
+  SceneMemoryUsage();
+  ~SceneMemoryUsage();
+
+  std::size_t GetTotal() const;
+
+  std::size_t bytes[SCENE_MEMORY_CATEGORY_COUNT];
+  int node_count[SCENE_MEMORY_CATEGORY_COUNT];
+  int largest_node[SCENE_MEMORY_CATEGORY_COUNT];
+  std::size_t largest_bytes[SCENE_MEMORY_CATEGORY_COUNT];
+};
+
+// Nodes allocated in blocks instead of one by one so that scenes of many
+// small nodes don't fragment the heap. nodes live until Clear()
+template<typename T>
+class NodePool {
+public:
+  NodePool() : blocks_(), next_(0), capacity_(0) {}
+  ~NodePool() { Clear(); }
+
+  // count default constructed nodes next to each other in memory
+  T *Allocate(std::size_t count)
+  {
+    // blocks grow up to 4096 nodes unless more are allocated at once
+    const std::size_t MIN_BLOCK_SIZE = 16;
+    const std::size_t MAX_BLOCK_SIZE = 4096;
+
+    if (count > capacity_ - next_) {
+      const std::size_t grown = std::min(std::max(2 * capacity_, MIN_BLOCK_SIZE), MAX_BLOCK_SIZE);
+      capacity_ = std::max(count, grown);
+      blocks_.push_back(new T[capacity_]);
+      next_ = 0;
+    }
+    T *nodes = blocks_.back() + next_;
+    next_ += count;
+    return nodes;
+  }
+
+  void Clear()
+  {
+    for (std::size_t i = 0; i < blocks_.size(); i++) {
+      delete [] blocks_[i];
+    }
+    blocks_.clear();
+    next_ = 0;
+    capacity_ = 0;
+  }
+
+private:
+  NodePool(const NodePool &);
+  const NodePool &operator=(const NodePool &);
+
+  std::vector<T *> blocks_;
+  std::size_t next_;
+  std::size_t capacity_;
+};
+
 class Scene {
 public:
   Scene();
@@ -31,6 +105,8 @@ public:
 
   // ObjectInstance
   ObjectInstance *NewObjectInstance();
+  // count new instances next to each other in the list and in memory
+  ObjectInstance *NewObjectInstances(int count);
   ObjectInstance **GetObjectInstanceList() const;
   ObjectInstance *GetObjectInstance(int index) const;
   size_t GetObjectInstanceCount() const;
@@ -38,6 +114,9 @@ public:
   // Accelerator
   Accelerator *NewGridAccelerator();
   Accelerator *NewBVHAccelerator();
+  // replaces the accelerator at index with a new one of accelerator_type
+  // which inherits the primitive set. returns NULL if type is invalid
+  Accelerator *ReplaceAccelerator(int index, int accelerator_type);
   Accelerator **GetAcceleratorList() const;
   Accelerator *GetAccelerator(int index) const;
   size_t GetAcceleratorCount() const;
@@ -50,6 +129,8 @@ public:
 
   // ObjectGroup
   ObjectGroup *NewObjectGroup();
+  // count new groups next to each other in the list and in memory
+  ObjectGroup *NewObjectGroups(int count);
   ObjectGroup **GetObjectGroupList() const;
   ObjectGroup *GetObjectGroup(int index) const;
   size_t GetObjectGroupCount() const;
@@ -129,9 +210,15 @@ public:
   Mesh *GetMesh(int index) const;
   size_t GetMeshCount() const;
 
+  void GetMemoryUsage(SceneMemoryUsage *usage) const;
+
 private:
   void free_all_node_list();
 
+  // instances and groups are small and many of them are made at once
+  NodePool<ObjectInstance> ObjectInstancePool;
+  NodePool<ObjectGroup> ObjectGroupPool;
+
   std::vector<ObjectInstance *> ObjectInstanceList;
   std::vector<Accelerator *> AcceleratorList;
   std::vector<FrameBuffer *> FrameBufferList;
@@ -3,16 +3,38 @@
 
 #include "fj_scene_interface.h"
 #include "fj_volume_accelerator.h"
+#include "fj_bvh_accelerator.h"
+#include "fj_qbvh_accelerator.h"
 #include "fj_framebuffer_io.h"
+#include "fj_geometry_io.h"
 #include "fj_primitive_set.h"
+#include "fj_profile.h"
 #include "fj_multi_thread.h"
+#include "fj_cpu.h"
+#include "fj_tile_cache.h"
+#include "fj_tile_loader.h"
+#include "fj_geometry_pager.h"
+#include "fj_tessellation_cache.h"
 #include "fj_shader.h"
+#include "fj_ray.h"
 #include "fj_scene.h"
 #include "fj_timer.h"
+#include "fj_trace.h"
 #include "fj_box.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include <map>
+#include <set>
+#include <mutex>
 
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -108,11 +130,82 @@ static Scene *get_scene()
   return the_scene;
 }
 
+/* groups made at the first render and extended by objects added later */
+static ObjectGroup *implicit_all_objects = NULL;
+static int implicit_object_count = 0;
+
+/* procedures run again for each frame with the file of the frame */
+class FrameProcedure {
+public:
+  FrameProcedure() : procedure(SI_BADID), property_name(), filename() {}
+  ~FrameProcedure() {}
+
+public:
+  ID procedure;
+  std::string property_name;
+  std::string filename;
+};
+
+static std::vector<FrameProcedure> frame_procedures;
+
+/* procedures started by SiRunProcedureAsync and not waited for yet */
+class PendingProcedure {
+public:
+  PendingProcedure() : procedure(SI_BADID), nodes(), result() {}
+  ~PendingProcedure() {}
+
+public:
+  ID procedure;
+  // nodes assigned to the procedure when it started
+  std::vector<ID> nodes;
+  // 0 on success
+  std::shared_future<int> result;
+};
+
+static std::vector<PendingProcedure> pending_procedures;
+// geometry nodes assigned to procedures by property name. procedures
+// sharing a node run in the order they are started
+static std::map<std::pair<ID, std::string>, ID> procedure_nodes;
+static bool has_failed_procedure = false;
+// seconds of accelerators built by async procedures right after loading.
+// reported and cleared by the next build_accelerators
+static std::map<const Accelerator *, double> loading_build_seconds;
+static std::mutex loading_build_mtx;
+// accelerators of geometry with the same content as an earlier one, found
+// before each render. instances render the earlier one so they aren't built
+static std::map<const Accelerator *, const Accelerator *> duplicate_accelerators;
+
 static void set_scene(Scene *scene)
 {
   the_scene = scene;
+
+  implicit_all_objects = NULL;
+  implicit_object_count = 0;
+  frame_procedures.clear();
+  procedure_nodes.clear();
+  has_failed_procedure = false;
+  loading_build_seconds.clear();
+  duplicate_accelerators.clear();
 }
 
+/* the interactive session. the scene is edited only while no render runs */
+class InteractiveSession {
+public:
+  InteractiveSession() : renderer(NULL), render_thread(), needs_restart(false) {}
+  ~InteractiveSession() {}
+
+public:
+  Renderer *renderer;
+  std::thread render_thread;
+  bool needs_restart;
+};
+
+static InteractiveSession interactive;
+
+// for the trace event of loading the scene
+static int64_t scene_load_start = 0;
+static bool scene_loaded = false;
+
 // binding ID to ID
 typedef std::map<ID,ID> IDMap;
 IDMap object_to_primset;
@@ -152,6 +245,15 @@ static void bind_object_to_primset(ID object, ID primset)
   push_idmap_entry(object_to_primset, object, primset);
 }
 
+// ids of new objects are larger than any in the map
+static void bind_objects_to_primset(ID first_object, int64_t count, ID primset)
+{
+  for (int64_t i = 0; i < count; i++) {
+    object_to_primset.insert(object_to_primset.end(),
+        IDMap::value_type(first_object + static_cast<ID>(i), primset));
+  }
+}
+
 static ID find_primset_from(ID object)
 {
   return find_idmap_entry(object_to_primset, object);
@@ -174,11 +276,48 @@ static int is_valid_type(int type);
 static ID encode_id(int type, int index);
 static Entry decode_id(ID id);
 static int prepare_render(const Renderer *renderer);
+static void bind_node_to_procedure(const Entry &entry, const char *name, ID node);
+static std::vector<ID> find_nodes_of_procedure(ID procedure);
+static bool is_pending_procedure_using(const PendingProcedure &pending, ID id);
+static void wait_procedures_using(ID id);
+static void wait_all_procedures(void);
+static bool simplify_geometry(const Renderer *renderer);
+static void interrupt_interactive(void);
+static void pause_interactive(void);
+static void pause_interactive_for_shader(const Entry &entry);
+static void invalidate_renders(const ObjectInstance *object);
+static void wait_interactive(void);
+static std::string make_frame_filename(const std::string &filename, int frame);
+static void set_frame_time(double time);
+static void prefetch_files(std::vector<std::string> filenames);
+static void print_memory_usage(void);
+static void print_profile(void);
+static void compile_shaders(void);
+static void prepare_volumes(void);
+static void bake_turbulences(void);
 static void set_errno(int err_no);
 static Status status_of_error(int err);
 
+static void *get_property_owner(const Entry &entry);
 static int set_property(const Entry &entry,
     const char *name, const PropertyValue &value);
+static int replace_accelerator(Accelerator *acc, const char *type_name);
+template <typename T>
+static int set_primitive_attribute(const Entry &entry, const std::string &name,
+    const T *values, int64_t value_count);
+template <typename T>
+static int set_mesh_attribute(Mesh *mesh, const std::string &name,
+    const T *values, int64_t value_count);
+template <typename T>
+static int set_curve_attribute(Curve *curve, const std::string &name,
+    const T *values, int64_t value_count);
+template <typename T>
+static int set_point_cloud_attribute(PointCloud *ptc, const std::string &name,
+    const T *values, int64_t value_count);
+template <typename T>
+static int set_mesh_indices(Mesh *mesh, const T *indices, int64_t index_count);
+template <typename T>
+static int set_curve_indices(Curve *curve, const T *indices, int64_t index_count);
 
 /* property list description */
 #include "internal/fj_property_list_include.cc"
@@ -192,6 +331,8 @@ int SiGetErrorNo(void)
 /* Plugin interfaces */
 ID SiOpenPlugin(const char *filename)
 {
+  pause_interactive();
+
   get_scene()->OpenPlugin(filename);
 
   switch (PlgGetErrorNo()) {
@@ -231,15 +372,33 @@ Status SiOpenScene(void)
     return SI_FAIL;
   }
 
+  // workers are reused by renders, builds and procedures until closed
+  MtStartThreadPool(MtGetMaxAvailableThreadCount());
+  if (MtBindWorkersToNumaNodes() == 0) {
+    printf("# NUMA: %d nodes\n", MtGetNumaNodeCount());
+  }
+
+  printf("# SIMD: cpu %s, kernels %s\n",
+      CpuGetSimdLevelName(CpuDetectSimdLevel()),
+      CpuGetSimdLevelName(CpuGetSimdLevel()));
+
+  scene_load_start = TraceNow();
+  scene_loaded = false;
+
   set_errno(SI_ERR_NONE);
   return SI_SUCCESS;
 }
 
 Status SiCloseScene(void)
 {
+  SiStopInteractive();
+  wait_all_procedures();
+
   delete get_scene();
   set_scene(NULL);
 
+  MtStopThreadPool();
+
   set_errno(SI_ERR_NONE);
   return SI_SUCCESS;
 }
@@ -261,6 +420,10 @@ Status SiRenderScene(ID renderer)
     return SI_FAIL;
   }
 
+  // renders here instead of the interactive render
+  interrupt_interactive();
+  interactive.needs_restart = false;
+
   err = prepare_render(renderer_ptr);
   if (err) {
     /* TODO error handling */
@@ -272,6 +435,7 @@ Status SiRenderScene(ID renderer)
     /* TODO error handling */
     return SI_FAIL;
   }
+  print_profile();
 
   set_errno(SI_ERR_NONE);
   return SI_SUCCESS;
@@ -294,6 +458,8 @@ Status SiSaveFrameBuffer(ID framebuffer, const char *filename)
     return SI_FAIL;
   }
 
+  wait_interactive();
+
   err = WriteFrameBuffer(filename, *framebuffer_ptr);
   if (err) {
     /* TODO error handling */
@@ -304,8 +470,120 @@ Status SiSaveFrameBuffer(ID framebuffer, const char *filename)
   return SI_SUCCESS;
 }
 
+Status SiAddFrameProcedure(ID procedure, const char *name, const char *filename)
+{
+  const Entry entry = decode_id(procedure);
+
+  if (entry.type != Type_Procedure) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+  wait_procedures_using(procedure);
+
+  FrameProcedure frame_procedure;
+  frame_procedure.procedure = procedure;
+  frame_procedure.property_name = name;
+  frame_procedure.filename = filename;
+  frame_procedures.push_back(frame_procedure);
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+Status SiRenderFrames(ID renderer, int first_frame, int last_frame,
+    ID framebuffer, const char *filename)
+{
+  const Entry renderer_entry = decode_id(renderer);
+  const Entry framebuffer_entry = decode_id(framebuffer);
+
+  if (renderer_entry.type != Type_Renderer ||
+      framebuffer_entry.type != Type_FrameBuffer) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  Renderer *renderer_ptr = get_scene()->GetRenderer(renderer_entry.index);
+  FrameBuffer *framebuffer_ptr = get_scene()->GetFrameBuffer(framebuffer_entry.index);
+  if (renderer_ptr == NULL || framebuffer_ptr == NULL) {
+    /* TODO error handling */
+    return SI_FAIL;
+  }
+
+  // renders here instead of the interactive render
+  interrupt_interactive();
+  interactive.needs_restart = false;
+
+  std::thread prefetch_thread;
+  int err = 0;
+
+  for (int frame = first_frame; frame <= last_frame; frame++) {
+    printf("# Frame %d\n", frame);
+
+    if (prefetch_thread.joinable()) {
+      prefetch_thread.join();
+    }
+
+    set_frame_time(frame);
+    renderer_ptr->InvalidateAll();
+
+    for (std::size_t i = 0; i < frame_procedures.size(); i++) {
+      const FrameProcedure &fp = frame_procedures[i];
+      const std::string frame_file = make_frame_filename(fp.filename, frame);
+
+      if (SiSetStringProperty(fp.procedure, fp.property_name.c_str(),
+            frame_file.c_str()) == SI_FAIL ||
+          SiRunProcedure(fp.procedure) == SI_FAIL) {
+        err = -1;
+        break;
+      }
+    }
+    if (err) {
+      break;
+    }
+
+    // the files of the next frame are read into the os cache while rendering
+    if (frame < last_frame && !frame_procedures.empty()) {
+      std::vector<std::string> next_files;
+      for (std::size_t i = 0; i < frame_procedures.size(); i++) {
+        next_files.push_back(make_frame_filename(frame_procedures[i].filename, frame + 1));
+      }
+      prefetch_thread = std::thread(prefetch_files, next_files);
+    }
+
+    err = prepare_render(renderer_ptr);
+    if (err) {
+      break;
+    }
+
+    err = renderer_ptr->RenderScene();
+    if (err) {
+      break;
+    }
+
+    err = WriteFrameBuffer(make_frame_filename(filename, frame), *framebuffer_ptr);
+    if (err) {
+      break;
+    }
+  }
+
+  if (prefetch_thread.joinable()) {
+    prefetch_thread.join();
+  }
+  set_frame_time(0);
+
+  if (err) {
+    /* TODO error handling */
+    return SI_FAIL;
+  }
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
 Status SiRunProcedure(ID procedure)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(procedure);
   Procedure *procedure_ptr = NULL;
   int err = 0;
@@ -317,7 +595,18 @@ Status SiRunProcedure(ID procedure)
   if (procedure_ptr == NULL)
     return SI_FAIL;
 
-  err = procedure_ptr->Run();
+  // runs after procedures started before it on the same nodes
+  const std::vector<ID> nodes = find_nodes_of_procedure(procedure);
+  wait_procedures_using(procedure);
+  for (std::size_t i = 0; i < nodes.size(); i++) {
+    wait_procedures_using(nodes[i]);
+  }
+
+  bake_turbulences();
+  {
+    const TraceScope trace("scene", "RunProcedure", entry.index);
+    err = procedure_ptr->Run();
+  }
   if (err) {
     /* TODO error handling */
     return SI_FAIL;
@@ -327,8 +616,147 @@ Status SiRunProcedure(ID procedure)
   return SI_SUCCESS;
 }
 
+Status SiRunProcedureAsync(ID procedure)
+{
+  pause_interactive();
+
+  const Entry entry = decode_id(procedure);
+  if (entry.type != Type_Procedure) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  Procedure *procedure_ptr = get_scene()->GetProcedure(entry.index);
+  if (procedure_ptr == NULL) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  PendingProcedure pending;
+  pending.procedure = procedure;
+  pending.nodes = find_nodes_of_procedure(procedure);
+
+  // procedures started before on the same procedure or nodes
+  std::vector<std::shared_future<int>> dependencies;
+  for (std::size_t i = 0; i < pending_procedures.size(); i++) {
+    const PendingProcedure &other = pending_procedures[i];
+    bool depends = is_pending_procedure_using(other, procedure);
+    for (std::size_t j = 0; j < pending.nodes.size() && !depends; j++) {
+      depends = is_pending_procedure_using(other, pending.nodes[j]);
+    }
+    if (depends) {
+      dependencies.push_back(other.result);
+    }
+  }
+
+  // meshes are built as soon as loaded while other procedures still read
+  // files. curves and point clouds are simplified for the camera first
+  std::vector<Accelerator *> meshes;
+  for (std::size_t i = 0; i < pending.nodes.size(); i++) {
+    if (decode_id(pending.nodes[i]).type != Type_Mesh) {
+      continue;
+    }
+    const Entry acc_entry = decode_id(find_accelerator_from(pending.nodes[i]));
+    if (acc_entry.type == Type_Accelerator) {
+      meshes.push_back(get_scene()->GetAccelerator(acc_entry.index));
+    }
+  }
+
+  // turbulences are read by procedures while they run
+  bake_turbulences();
+
+  const int index = entry.index;
+  pending.result = std::async(std::launch::async,
+      [procedure_ptr, dependencies, meshes, index]()
+      {
+        for (std::size_t i = 0; i < dependencies.size(); i++) {
+          dependencies[i].wait();
+        }
+        {
+          const TraceScope trace("scene", "RunProcedure", index);
+          const int err = procedure_ptr->Run();
+          if (err) {
+            return err;
+          }
+        }
+        for (std::size_t i = 0; i < meshes.size(); i++) {
+          const std::chrono::steady_clock::time_point start =
+              std::chrono::steady_clock::now();
+          const TraceScope trace("scene", "BuildAccelerator", index);
+          if (meshes[i]->Update() || !meshes[i]->IsUpToDate()) {
+            continue;
+          }
+          const std::chrono::duration<double> elapsed =
+              std::chrono::steady_clock::now() - start;
+          std::lock_guard<std::mutex> lock(loading_build_mtx);
+          loading_build_seconds[meshes[i]] = elapsed.count();
+        }
+        return 0;
+      }).share();
+  pending_procedures.push_back(pending);
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+Status SiWaitProcedures(void)
+{
+  wait_all_procedures();
+
+  const bool failed = has_failed_procedure;
+  has_failed_procedure = false;
+  if (failed) {
+    set_errno(SI_ERR_FAILNEW);
+    return SI_FAIL;
+  }
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+Status SiDeferProcedure(ID procedure, ID primset,
+    double xmin, double ymin, double zmin,
+    double xmax, double ymax, double zmax)
+{
+  pause_interactive();
+
+  const Entry entry = decode_id(procedure);
+  if (entry.type != Type_Procedure) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  const Procedure *procedure_ptr = get_scene()->GetProcedure(entry.index);
+  if (procedure_ptr == NULL) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+  wait_procedures_using(procedure);
+  wait_procedures_using(primset);
+
+  const Entry acc_entry = decode_id(find_accelerator_from(primset));
+  if (acc_entry.type != Type_Accelerator) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  Accelerator *acc = get_scene()->GetAccelerator(acc_entry.index);
+  if (acc == NULL) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  acc->SetDeferredProcedure(procedure_ptr,
+      Box(Vector(xmin, ymin, zmin), Vector(xmax, ymax, zmax)));
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
 Status SiAddObjectToGroup(ID group, ID object)
 {
+  pause_interactive();
+
   ObjectGroup *group_ptr = NULL;
   ObjectInstance *object_ptr = NULL;
 
@@ -357,8 +785,77 @@ Status SiAddObjectToGroup(ID group, ID object)
   return SI_SUCCESS;
 }
 
+/* Interactive interfaces */
+static void render_interactive(Renderer *renderer)
+{
+  renderer->RenderScene();
+}
+
+Status SiStartInteractive(ID renderer)
+{
+  const Entry entry = decode_id(renderer);
+
+  if (entry.type != Type_Renderer) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  Renderer *renderer_ptr = get_scene()->GetRenderer(entry.index);
+  if (renderer_ptr == NULL) {
+    /* TODO error handling */
+    return SI_FAIL;
+  }
+
+  SiStopInteractive();
+
+  renderer_ptr->SetProgressive(1);
+  interactive.renderer = renderer_ptr;
+  interactive.needs_restart = true;
+
+  return SiUpdateInteractive();
+}
+
+Status SiUpdateInteractive(void)
+{
+  if (interactive.renderer == NULL || !interactive.needs_restart) {
+    set_errno(SI_ERR_NONE);
+    return SI_SUCCESS;
+  }
+
+  const int err = prepare_render(interactive.renderer);
+  if (err) {
+    /* TODO error handling */
+    return SI_FAIL;
+  }
+
+  interactive.needs_restart = false;
+  interactive.render_thread = std::thread(render_interactive, interactive.renderer);
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+Status SiStopInteractive(void)
+{
+  interrupt_interactive();
+
+  interactive.renderer = NULL;
+  interactive.needs_restart = false;
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+int SiIsInteractive(void)
+{
+  return interactive.renderer != NULL;
+}
+
 ID SiNewObjectInstance(ID primset)
 {
+  pause_interactive();
+  wait_procedures_using(primset);
+
   const ID accel_id = find_accelerator_from(primset);
   const Entry entry = decode_id(accel_id);
 
@@ -423,60 +920,160 @@ ID SiNewObjectInstance(ID primset)
   return obj_id;
 }
 
-ID SiNewFrameBuffer(const char *arg)
+ID SiNewObjectInstances(ID primset, int64_t count, const double *transforms)
 {
-  if (get_scene()->NewFrameBuffer() == NULL) {
-    set_errno(SI_ERR_NO_MEMORY);
+  pause_interactive();
+  wait_procedures_using(primset);
+
+  if (count <= 0 || count > INT_MAX) {
+    set_errno(SI_ERR_BADTYPE);
     return SI_BADID;
   }
 
-  set_errno(SI_ERR_NONE);
-  return encode_id(Type_FrameBuffer, GET_LAST_ADDED_ID(FrameBuffer));
-}
+  const Entry entry = decode_id(find_accelerator_from(primset));
+  const Accelerator *acc = NULL;
+  const Volume *volume = NULL;
+  if (entry.type == Type_Accelerator) {
+    acc = get_scene()->GetAccelerator(entry.index);
+  } else if (entry.type == Type_Volume) {
+    volume = get_scene()->GetVolume(entry.index);
+  }
+  if (acc == NULL && volume == NULL) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_BADID;
+  }
 
-ID SiNewObjectGroup(void)
-{
-  if (get_scene()->NewObjectGroup() == NULL) {
+  ObjectInstance *objects = get_scene()->NewObjectInstances(static_cast<int>(count));
+  if (objects == NULL) {
     set_errno(SI_ERR_NO_MEMORY);
     return SI_BADID;
   }
 
+  // the others are copies of the first one with defaults set
+  const int err = acc != NULL ? objects[0].SetSurface(acc) : objects[0].SetVolume(volume);
+  if (err) {
+    set_errno(SI_ERR_FAILNEW);
+    return SI_BADID;
+  }
+  PropSetAllDefaultValues(&objects[0], get_builtin_type_property_list(Type_ObjectInstance));
+  for (int64_t i = 1; i < count; i++) {
+    objects[i] = objects[0];
+  }
+
+  if (transforms != NULL) {
+    for (int64_t i = 0; i < count; i++) {
+      // in the precision of Real
+      Real trs[9];
+      std::copy(&transforms[9 * i], &transforms[9 * i + 9], trs);
+      objects[i].SetTransform(trs, 0);
+    }
+  }
+
   set_errno(SI_ERR_NONE);
-  return encode_id(Type_ObjectGroup, GET_LAST_ADDED_ID(ObjectGroup));
+
+  const int first_index = get_scene()->GetObjectInstanceCount() - static_cast<int>(count);
+  const ID first_id = encode_id(Type_ObjectInstance, first_index);
+  bind_objects_to_primset(first_id, count, primset);
+
+  return first_id;
 }
 
-ID SiNewPointCloud(void)
+ID SiCopyObjectInstance(ID object)
 {
-  PointCloud *ptc = NULL;
-  Accelerator *acc = NULL;
+  pause_interactive();
 
-  ID ptc_id = SI_BADID;
-  ID accel_id = SI_BADID;
+  const Entry entry = decode_id(object);
+  if (entry.type != Type_ObjectInstance) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_BADID;
+  }
 
-  ptc = get_scene()->NewPointCloud();
-  if (ptc == NULL) {
-    set_errno(SI_ERR_NO_MEMORY);
+  const ObjectInstance *source = get_scene()->GetObjectInstance(entry.index);
+  if (source == NULL) {
+    set_errno(SI_ERR_BADTYPE);
     return SI_BADID;
   }
 
-  acc = get_scene()->NewGridAccelerator();
-  if (acc == NULL) {
+  ObjectInstance *copy = get_scene()->NewObjectInstance();
+  if (copy == NULL) {
     set_errno(SI_ERR_NO_MEMORY);
     return SI_BADID;
   }
+  // geometry and its accelerator are shared. the self hit group is made
+  // for the copy when rendering
+  *copy = *source;
+  copy->SetSelfHitTarget(NULL);
 
-  acc->SetPrimitiveSet(ptc);
+  set_errno(SI_ERR_NONE);
 
-  ptc_id = encode_id(Type_PointCloud, GET_LAST_ADDED_ID(PointCloud));
-  accel_id = encode_id(Type_Accelerator, GET_LAST_ADDED_ID(Accelerator));
-  bind_primset_to_accelerator(ptc_id, accel_id);
+  const ID obj_id = encode_id(Type_ObjectInstance, GET_LAST_ADDED_ID(ObjectInstance));
+  bind_object_to_primset(obj_id, find_primset_from(object));
 
-  set_errno(SI_ERR_NONE);
-  return ptc_id;
+  return obj_id;
 }
 
-ID SiNewTurbulence(void)
+ID SiNewFrameBuffer(const char *arg)
 {
+  pause_interactive();
+
+  if (get_scene()->NewFrameBuffer() == NULL) {
+    set_errno(SI_ERR_NO_MEMORY);
+    return SI_BADID;
+  }
+
+  set_errno(SI_ERR_NONE);
+  return encode_id(Type_FrameBuffer, GET_LAST_ADDED_ID(FrameBuffer));
+}
+
+ID SiNewObjectGroup(void)
+{
+  pause_interactive();
+
+  if (get_scene()->NewObjectGroup() == NULL) {
+    set_errno(SI_ERR_NO_MEMORY);
+    return SI_BADID;
+  }
+
+  set_errno(SI_ERR_NONE);
+  return encode_id(Type_ObjectGroup, GET_LAST_ADDED_ID(ObjectGroup));
+}
+
+ID SiNewPointCloud(void)
+{
+  pause_interactive();
+
+  PointCloud *ptc = NULL;
+  Accelerator *acc = NULL;
+
+  ID ptc_id = SI_BADID;
+  ID accel_id = SI_BADID;
+
+  ptc = get_scene()->NewPointCloud();
+  if (ptc == NULL) {
+    set_errno(SI_ERR_NO_MEMORY);
+    return SI_BADID;
+  }
+
+  acc = get_scene()->NewGridAccelerator();
+  if (acc == NULL) {
+    set_errno(SI_ERR_NO_MEMORY);
+    return SI_BADID;
+  }
+
+  acc->SetPrimitiveSet(ptc);
+
+  ptc_id = encode_id(Type_PointCloud, GET_LAST_ADDED_ID(PointCloud));
+  accel_id = encode_id(Type_Accelerator, GET_LAST_ADDED_ID(Accelerator));
+  bind_primset_to_accelerator(ptc_id, accel_id);
+
+  set_errno(SI_ERR_NONE);
+  return ptc_id;
+}
+
+ID SiNewTurbulence(void)
+{
+  pause_interactive();
+
   Turbulence *turb = get_scene()->NewTurbulence();
   if (turb == NULL) {
     set_errno(SI_ERR_NO_MEMORY);
@@ -490,6 +1087,8 @@ ID SiNewTurbulence(void)
 
 ID SiNewProcedure(ID plugin)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(plugin);
 
   if (entry.type != Type_Plugin) {
@@ -515,6 +1114,8 @@ ID SiNewProcedure(ID plugin)
 
 ID SiNewRenderer(void)
 {
+  pause_interactive();
+
   Renderer *renderer = get_scene()->NewRenderer();
   if (renderer == NULL) {
     set_errno(SI_ERR_NO_MEMORY);
@@ -528,6 +1129,8 @@ ID SiNewRenderer(void)
 
 ID SiNewTexture(const char *filename)
 {
+  pause_interactive();
+
   Texture *tex = get_scene()->NewTexture();
 
   if (tex == NULL) {
@@ -545,6 +1148,8 @@ ID SiNewTexture(const char *filename)
 
 ID SiNewCamera(const char *arg)
 {
+  pause_interactive();
+
   Camera *camera = get_scene()->NewCamera(arg);
   if (camera == NULL) {
     set_errno(SI_ERR_NO_MEMORY);
@@ -558,6 +1163,8 @@ ID SiNewCamera(const char *arg)
 
 ID SiNewShader(ID plugin)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(plugin);
 
   if (entry.type != Type_Plugin) {
@@ -583,6 +1190,8 @@ ID SiNewShader(ID plugin)
 
 ID SiNewVolume(void)
 {
+  pause_interactive();
+
   Volume *volume = get_scene()->NewVolume();
   ID volume_id = SI_BADID;
 
@@ -603,6 +1212,8 @@ ID SiNewVolume(void)
 
 ID SiNewCurve(void)
 {
+  pause_interactive();
+
   Curve *curve = NULL;
   Accelerator *acc = NULL;
 
@@ -633,6 +1244,8 @@ ID SiNewCurve(void)
 
 ID SiNewLight(int light_type)
 {
+  pause_interactive();
+
   Light *light = NULL;
 
   switch (light_type) {
@@ -666,6 +1279,8 @@ ID SiNewLight(int light_type)
 
 ID SiNewMesh(void)
 {
+  pause_interactive();
+
   Mesh *mesh = NULL;
   Accelerator *acc = NULL;
 
@@ -697,6 +1312,8 @@ ID SiNewMesh(void)
 
 Status SiAssignShader(ID object, const char *shading_group, ID shader)
 {
+  interrupt_interactive();
+
   ObjectInstance *object_ptr = NULL;
   Shader *shader_ptr = NULL;
   int shading_group_id = 0;
@@ -738,11 +1355,14 @@ Status SiAssignShader(ID object, const char *shading_group, ID shader)
   }
 
   object_ptr->SetShader(shader_ptr, shading_group_id);
+  invalidate_renders(object_ptr);
   return SI_SUCCESS;
 }
 
 Status SiAssignObjectGroup(ID id, const char *name, ID group)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
   const Entry group_ent = decode_id(group);
   PropertyValue value;
@@ -764,6 +1384,8 @@ Status SiAssignObjectGroup(ID id, const char *name, ID group)
 
 Status SiAssignPointCloud(ID id, const char *name, ID pointcloud)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
   const Entry pointcloud_ent = decode_id(pointcloud);
   PropertyValue value;
@@ -779,6 +1401,9 @@ Status SiAssignPointCloud(ID id, const char *name, ID pointcloud)
 
   value = PropPointCloud(pointcloud_ptr);
   err = set_property(entry, name, value);
+  if (!err) {
+    bind_node_to_procedure(entry, name, pointcloud);
+  }
 
   return status_of_error(err);
 }
@@ -786,6 +1411,7 @@ Status SiAssignPointCloud(ID id, const char *name, ID pointcloud)
 Status SiAssignTexture(ID id, const char *name, ID texture)
 {
   const Entry entry = decode_id(id);
+  pause_interactive_for_shader(entry);
   const Entry texture_ent = decode_id(texture);
   PropertyValue value;
   Texture *texture_ptr = NULL;
@@ -806,6 +1432,8 @@ Status SiAssignTexture(ID id, const char *name, ID texture)
 
 Status SiAssignCamera(ID renderer, ID camera)
 {
+  pause_interactive();
+
   Renderer *renderer_ptr = NULL;
   Camera *camera_ptr = NULL;
   {
@@ -835,6 +1463,8 @@ Status SiAssignCamera(ID renderer, ID camera)
 
 Status SiAssignFrameBuffer(ID renderer, ID framebuffer)
 {
+  pause_interactive();
+
   Renderer *renderer_ptr = NULL;
   FrameBuffer *framebuffer_ptr = NULL;
   {
@@ -862,8 +1492,52 @@ Status SiAssignFrameBuffer(ID renderer, ID framebuffer)
   return SI_SUCCESS;
 }
 
+Status SiAddView(ID renderer, ID camera, ID framebuffer)
+{
+  pause_interactive();
+
+  Renderer *renderer_ptr = NULL;
+  Camera *camera_ptr = NULL;
+  FrameBuffer *framebuffer_ptr = NULL;
+  {
+    const Entry entry = decode_id(renderer);
+
+    if (entry.type != Type_Renderer)
+      return SI_FAIL;
+
+    renderer_ptr = get_scene()->GetRenderer(entry.index);
+    if (renderer_ptr == NULL)
+      return SI_FAIL;
+  }
+  {
+    const Entry entry = decode_id(camera);
+
+    if (entry.type != Type_Camera)
+      return SI_FAIL;
+
+    camera_ptr = get_scene()->GetCamera(entry.index);
+    if (camera_ptr == NULL)
+      return SI_FAIL;
+  }
+  {
+    const Entry entry = decode_id(framebuffer);
+
+    if (entry.type != Type_FrameBuffer)
+      return SI_FAIL;
+
+    framebuffer_ptr = get_scene()->GetFrameBuffer(entry.index);
+    if (framebuffer_ptr == NULL)
+      return SI_FAIL;
+  }
+
+  renderer_ptr->AddView(camera_ptr, framebuffer_ptr);
+  return SI_SUCCESS;
+}
+
 Status SiAssignTurbulence(ID id, const char *name, ID turbulence)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
   const Entry turbulence_ent = decode_id(turbulence);
   PropertyValue value;
@@ -879,12 +1553,17 @@ Status SiAssignTurbulence(ID id, const char *name, ID turbulence)
 
   value = PropTurbulence(turbulence_ptr);
   err = set_property(entry, name, value);
+  if (!err) {
+    bind_node_to_procedure(entry, name, turbulence);
+  }
 
   return status_of_error(err);
 }
 
 Status SiAssignVolume(ID id, const char *name, ID volume)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
   const Entry volume_ent = decode_id(volume);
   PropertyValue value;
@@ -900,12 +1579,17 @@ Status SiAssignVolume(ID id, const char *name, ID volume)
 
   value = PropVolume(volume_ptr);
   err = set_property(entry, name, value);
+  if (!err) {
+    bind_node_to_procedure(entry, name, volume);
+  }
 
   return status_of_error(err);
 }
 
 Status SiAssignCurve(ID id, const char *name, ID curve)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
   const Entry curve_ent = decode_id(curve);
   PropertyValue value;
@@ -921,12 +1605,17 @@ Status SiAssignCurve(ID id, const char *name, ID curve)
 
   value = PropCurve(curve_ptr);
   err = set_property(entry, name, value);
+  if (!err) {
+    bind_node_to_procedure(entry, name, curve);
+  }
 
   return status_of_error(err);
 }
 
 Status SiAssignMesh(ID id, const char *name, ID mesh)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
   const Entry mesh_ent = decode_id(mesh);
   PropertyValue value;
@@ -942,6 +1631,9 @@ Status SiAssignMesh(ID id, const char *name, ID mesh)
 
   value = PropMesh(mesh_ptr);
   err = set_property(entry, name, value);
+  if (!err) {
+    bind_node_to_procedure(entry, name, mesh);
+  }
 
   return status_of_error(err);
 }
@@ -949,6 +1641,7 @@ Status SiAssignMesh(ID id, const char *name, ID mesh)
 Status SiSetProperty1(ID id, const char *name, double v0)
 {
   const Entry entry = decode_id(id);
+  pause_interactive_for_shader(entry);
   const PropertyValue value = PropScalar(v0);
   const int err = set_property(entry, name, value);
 
@@ -958,6 +1651,7 @@ Status SiSetProperty1(ID id, const char *name, double v0)
 Status SiSetProperty2(ID id, const char *name, double v0, double v1)
 {
   const Entry entry = decode_id(id);
+  pause_interactive_for_shader(entry);
   const PropertyValue value = PropVector2(v0, v1);
   const int err = set_property(entry, name, value);
 
@@ -967,6 +1661,7 @@ Status SiSetProperty2(ID id, const char *name, double v0, double v1)
 Status SiSetProperty3(ID id, const char *name, double v0, double v1, double v2)
 {
   const Entry entry = decode_id(id);
+  pause_interactive_for_shader(entry);
   const PropertyValue value = PropVector3(v0, v1, v2);
   const int err = set_property(entry, name, value);
 
@@ -976,6 +1671,7 @@ Status SiSetProperty3(ID id, const char *name, double v0, double v1, double v2)
 Status SiSetProperty4(ID id, const char *name, double v0, double v1, double v2, double v3)
 {
   const Entry entry = decode_id(id);
+  pause_interactive_for_shader(entry);
   const PropertyValue value = PropVector4(v0, v1, v2, v3);
   const int err = set_property(entry, name, value);
 
@@ -985,15 +1681,75 @@ Status SiSetProperty4(ID id, const char *name, double v0, double v1, double v2,
 Status SiSetStringProperty(ID id, const char *name, const char *string)
 {
   const Entry entry = decode_id(id);
+  pause_interactive_for_shader(entry);
   const PropertyValue value = PropString(string);
   const int err = set_property(entry, name, value);
 
   return status_of_error(err);
 }
 
+const Property *SiFindProperty(ID id, const char *name, int property_type)
+{
+  const Entry entry = decode_id(id);
+  const PropertyTable *table = get_property_table(entry);
+
+  if (table == NULL) {
+    return NULL;
+  }
+  return table->Find(property_type, name);
+}
+
+Status SiSetPropertyValues(ID id, const Property *property, const double *values)
+{
+  const Entry entry = decode_id(id);
+  pause_interactive_for_shader(entry);
+  wait_procedures_using(id);
+
+  if (property == NULL || values == NULL) {
+    return SI_FAIL;
+  }
+
+  PropertyValue value;
+  switch (property->GetType()) {
+  case PROP_SCALAR:
+    value = PropScalar(values[0]);
+    break;
+  case PROP_VECTOR2:
+    value = PropVector2(values[0], values[1]);
+    break;
+  case PROP_VECTOR3:
+    value = PropVector3(values[0], values[1], values[2]);
+    break;
+  case PROP_VECTOR4:
+    value = PropVector4(values[0], values[1], values[2], values[3]);
+    break;
+  default:
+    return SI_FAIL;
+  }
+
+  // a property of another type would be called with a wrong self
+  const PropertyTable *table = get_property_table(entry);
+  if (table == NULL || !table->Contains(property)) {
+    return SI_FAIL;
+  }
+
+  void *self = get_property_owner(entry);
+  if (self == NULL) {
+    return SI_FAIL;
+  }
+
+  const int err = property->SetValue(self, value);
+  if (!err && entry.type == Type_Procedure) {
+    static_cast<Procedure *>(self)->RecordProperty(property->GetName(), value);
+  }
+  return status_of_error(err);
+}
+
 /* time variable property */
 Status SiSetSampleProperty3(ID id, const char *name, double v0, double v1, double v2, double time)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
   PropertyValue value = PropVector3(v0, v1, v2);
   int err = 0;
@@ -1009,6 +1765,8 @@ Status SiSetFrameReportCallback(ID id, void *data,
     FrameAbortCallback frame_abort,
     FrameDoneCallback frame_done)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
 
   if (entry.type == Type_Renderer) {
@@ -1029,6 +1787,8 @@ Status SiSetTileReportCallback(ID id, void *data,
     SampleDoneCallback sample_done,
     TileDoneCallback tile_done)
 {
+  pause_interactive();
+
   const Entry entry = decode_id(id);
 
   if (entry.type == Type_Renderer) {
@@ -1044,170 +1804,970 @@ Status SiSetTileReportCallback(ID id, void *data,
   }
 }
 
-const Property *SiGetPropertyList(const char *type_name)
-{
-  // TODO by ID instead of by type name?
-  return get_property_list(type_name);
-}
-
-static int is_valid_type(int type)
+Status SiSetPrimitiveAttribute(ID primset, const char *name,
+    int array_type, const void *values, int64_t value_count)
 {
-  return type > Type_Begin && type < Type_End;
-}
+  pause_interactive();
+  wait_procedures_using(primset);
 
-static ID encode_id(int type, int index)
-{
-  return TYPE_ID_OFFSET * type + index;
-}
+  const Entry entry = decode_id(primset);
+  if (entry.type != Type_Mesh &&
+      entry.type != Type_Curve &&
+      entry.type != Type_PointCloud) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
 
-static Entry decode_id(ID id)
-{
-  Entry entry;
-  const int type = id / TYPE_ID_OFFSET;
+  const bool is_indices = std::string(name) == "indices";
+  int err = 0;
 
-  if (!is_valid_type(type))
-    return entry;
+  switch (array_type) {
+  case SI_ARRAY_FLOAT32:
+    err = is_indices ? -1 : set_primitive_attribute(entry, name,
+        static_cast<const float *>(values), value_count);
+    break;
+  case SI_ARRAY_FLOAT64:
+    err = is_indices ? -1 : set_primitive_attribute(entry, name,
+        static_cast<const double *>(values), value_count);
+    break;
+  case SI_ARRAY_INT32:
+    err = set_primitive_attribute(entry, name,
+        static_cast<const int32_t *>(values), value_count);
+    break;
+  case SI_ARRAY_INT64:
+    err = set_primitive_attribute(entry, name,
+        static_cast<const int64_t *>(values), value_count);
+    break;
+  default:
+    err = -1;
+    break;
+  }
 
-  entry.type = type;
-  entry.index = id - (type * TYPE_ID_OFFSET);
+  if (err) {
+    /* TODO error handling */
+    return SI_FAIL;
+  }
 
-  return entry;
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
 }
 
-static int create_implicit_groups(void)
+Status SiSetObjectInstanceTransforms(const ID *objects, int64_t object_count,
+    const char *name, const double *values, double time)
 {
-  ObjectGroup *all_objects = NULL;
-  Renderer *renderer = NULL;
-  int N = 0;
-  int i;
+  pause_interactive();
 
-  all_objects = get_scene()->NewObjectGroup();
-  if (all_objects == NULL) {
-    set_errno(SI_ERR_NO_MEMORY);
+  const std::string prop_name(name);
+  if (prop_name != "translate" && prop_name != "rotate" && prop_name != "scale") {
+    /* TODO error handling */
     return SI_FAIL;
   }
 
-  N = get_scene()->GetObjectInstanceCount();
-  for (i = 0; i < N; i++) {
-    ObjectInstance *obj = get_scene()->GetObjectInstance(i);
-    all_objects->AddObject(obj);
-  }
-
-  /* Preparing ObjectInstance */
-  N = get_scene()->GetObjectInstanceCount();
-  for (i = 0; i < N; i++) {
-    ObjectInstance *obj = get_scene()->GetObjectInstance(i);
-    const Light **lightlist = (const Light **) get_scene()->GetLightList();
-    int nlights = get_scene()->GetLightCount();
-    obj->SetLightList(lightlist, nlights);
-
-    if (obj->GetReflectTarget() == NULL)
-      obj->SetReflectTarget(all_objects);
-
-    if (obj->GetRefractTarget() == NULL)
-      obj->SetRefractTarget(all_objects);
-
-    if (obj->GetShadowTarget() == NULL)
-      obj->SetShadowTarget(all_objects);
-
-    {
-      /* self hit group */
-      ObjectGroup *self_group = get_scene()->NewObjectGroup();
-      if (self_group == NULL) {
-        /* TODO error handling */
-      }
-      self_group->AddObject(obj);
-      obj->SetSelfHitTarget(self_group);
+  // checks all ids first not to leave objects half updated
+  for (int64_t i = 0; i < object_count; i++) {
+    if (decode_id(objects[i]).type != Type_ObjectInstance) {
+      set_errno(SI_ERR_BADTYPE);
+      return SI_FAIL;
     }
   }
 
-  renderer = get_scene()->GetRenderer(0);
-  renderer->SetTargetObjects(all_objects);
-  {
-    const int nlights = get_scene()->GetLightCount();
-    Light **lightlist = get_scene()->GetLightList();
-    if (nlights > 0) {
-      renderer->SetTargetLights(lightlist, nlights);
+  for (int64_t i = 0; i < object_count; i++) {
+    ObjectInstance *object = get_scene()->GetObjectInstance(decode_id(objects[i]).index);
+    const double *v = &values[3 * i];
+
+    if (prop_name == "translate") {
+      object->SetTranslate(v[0], v[1], v[2], time);
+    } else if (prop_name == "rotate") {
+      object->SetRotate(v[0], v[1], v[2], time);
+    } else {
+      object->SetScale(v[0], v[1], v[2], time);
     }
   }
 
+  set_errno(SI_ERR_NONE);
   return SI_SUCCESS;
 }
 
-static void compute_objects_bounds(void)
+Status SiGetFrameBufferData(ID framebuffer, float **data,
+    int *width, int *height, int *channel_count)
 {
-  int N = 0;
-  int i;
+  const Entry entry = decode_id(framebuffer);
 
-  N = get_scene()->GetAcceleratorCount();
-  for (i = 0; i < N; i++) {
-    Accelerator *acc = get_scene()->GetAccelerator(i);
-    acc->ComputeBounds();
+  if (entry.type != Type_FrameBuffer) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
   }
 
-  N = get_scene()->GetObjectInstanceCount();
-  for (i = 0; i < N; i++) {
-    ObjectInstance *obj = get_scene()->GetObjectInstance(i);
-    obj->ComputeBounds();
+  FrameBuffer *framebuffer_ptr = get_scene()->GetFrameBuffer(entry.index);
+  if (framebuffer_ptr == NULL) {
+    /* TODO error handling */
+    return SI_FAIL;
   }
 
-  N = get_scene()->GetObjectGroupCount();
-  for (i = 0; i < N; i++) {
-    ObjectGroup *grp = get_scene()->GetObjectGroup(i);
-    grp->ComputeBounds();
-  }
-}
+  // the pixels are written by the interactive render
+  wait_interactive();
 
-static void build_accelerators(void)
+  // pixels in tiles are not in rows of the width
+  if (framebuffer_ptr->IsTiled() || framebuffer_ptr->GetFormat() != FB_FORMAT_FLOAT) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  *data = framebuffer_ptr->GetWritable(0, 0, 0);
+  *width = framebuffer_ptr->GetWidth();
+  *height = framebuffer_ptr->GetHeight();
+  *channel_count = framebuffer_ptr->GetChannelCount();
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+Status SiGetMemoryUsage(ID id, int64_t *bytes)
+{
+  // accelerators are built by the interactive render
+  wait_interactive();
+  wait_procedures_using(id);
+
+  const Entry entry = decode_id(id);
+  const Scene *scene = get_scene();
+  const PrimitiveSet *primset = NULL;
+  std::size_t usage = 0;
+
+  switch (entry.type) {
+  case Type_Mesh:
+    primset = scene->GetMesh(entry.index);
+    break;
+  case Type_Curve:
+    primset = scene->GetCurve(entry.index);
+    break;
+  case Type_PointCloud:
+    primset = scene->GetPointCloud(entry.index);
+    break;
+  case Type_Volume:
+    usage = scene->GetVolume(entry.index)->GetMemoryUsage();
+    break;
+  case Type_Texture:
+    usage = scene->GetTexture(entry.index)->GetMemoryUsage();
+    break;
+  case Type_FrameBuffer:
+    usage = scene->GetFrameBuffer(entry.index)->GetMemoryUsage();
+    break;
+  case Type_ObjectGroup:
+    usage = scene->GetObjectGroup(entry.index)->GetMemoryUsage();
+    break;
+  default:
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  if (primset != NULL) {
+    const Entry accel_entry = decode_id(find_accelerator_from(id));
+    const Accelerator *acc = scene->GetAccelerator(accel_entry.index);
+    usage = primset->GetMemoryUsage();
+    if (accel_entry.type == Type_Accelerator && acc != NULL) {
+      usage += acc->GetMemoryUsage();
+    }
+  }
+
+  *bytes = usage;
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+Status SiGetSceneMemoryUsage(int64_t *bytes)
+{
+  wait_interactive();
+  wait_all_procedures();
+
+  SceneMemoryUsage usage;
+  get_scene()->GetMemoryUsage(&usage);
+  *bytes = usage.GetTotal();
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+Status SiGetProfile(ID id, int64_t *call_count, double *seconds)
+{
+  wait_interactive();
+
+  const Entry entry = decode_id(id);
+  const void *key = NULL;
+  int kind = 0;
+
+  switch (entry.type) {
+  case Type_Shader:
+    kind = PROFILE_SHADER;
+    key = get_scene()->GetShader(entry.index);
+    break;
+  case Type_ObjectInstance:
+    kind = PROFILE_OBJECT;
+    key = get_scene()->GetObjectInstance(entry.index);
+    break;
+  default:
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  if (key == NULL) {
+    set_errno(SI_ERR_BADTYPE);
+    return SI_FAIL;
+  }
+
+  std::vector<ProfileCounter> counters;
+  ProfileGather(kind, &counters);
+
+  *call_count = 0;
+  *seconds = 0;
+  for (size_t i = 0; i < counters.size(); i++) {
+    if (counters[i].key == key) {
+      *call_count = counters[i].call_count;
+      *seconds = counters[i].nanoseconds * 1e-9;
+      break;
+    }
+  }
+
+  set_errno(SI_ERR_NONE);
+  return SI_SUCCESS;
+}
+
+const Property *SiGetPropertyList(const char *type_name)
+{
+  // TODO by ID instead of by type name?
+  return get_property_list(type_name);
+}
+
+static int is_valid_type(int type)
+{
+  return type > Type_Begin && type < Type_End;
+}
+
+static ID encode_id(int type, int index)
+{
+  return TYPE_ID_OFFSET * type + index;
+}
+
+static Entry decode_id(ID id)
+{
+  Entry entry;
+  const int type = id / TYPE_ID_OFFSET;
+
+  if (!is_valid_type(type))
+    return entry;
+
+  entry.type = type;
+  entry.index = id - (type * TYPE_ID_OFFSET);
+
+  return entry;
+}
+
+// groups other than the group of all objects and self hit groups trace
+// the tree of all objects with a bit of their own instead of building trees
+// overlapping it. instances get the bits of the groups they are in
+static void share_group_trees(ObjectGroup *all_objects)
+{
+  Scene *scene = get_scene();
+  const int NOBJECTS = scene->GetObjectInstanceCount();
+
+  std::set<const ObjectGroup *> self_groups;
+  for (int i = 0; i < NOBJECTS; i++) {
+    self_groups.insert(scene->GetObjectInstance(i)->GetSelfHitTarget());
+  }
+
+  std::map<const ObjectInstance *, unsigned int> group_bits;
+  int shared_count = 0;
+  for (int i = 0; i < static_cast<int>(scene->GetObjectGroupCount()); i++) {
+    ObjectGroup *group = scene->GetObjectGroup(i);
+    if (group == all_objects || self_groups.count(group) > 0) {
+      continue;
+    }
+    if (shared_count == GROUP_MASK_SHARED_COUNT) {
+      group->ShareTree(NULL, 0);
+      continue;
+    }
+
+    const unsigned int bit = GroupMaskSharedBit(shared_count++);
+    group->ShareTree(all_objects, bit);
+
+    const ObjectSet *sets[] = {&group->GetSurfaceSet(), &group->GetVolumeSet()};
+    for (int j = 0; j < 2; j++) {
+      for (Index k = 0; k < sets[j]->GetObjectCount(); k++) {
+        group_bits[sets[j]->GetObject(k)] |= bit;
+      }
+    }
+  }
+
+  for (int i = 0; i < NOBJECTS; i++) {
+    ObjectInstance *obj = scene->GetObjectInstance(i);
+    obj->SetGroupMask(obj->GetVisibility() | GROUP_MASK_ALL_OBJECTS | group_bits[obj]);
+  }
+}
+
+static int create_implicit_groups(void)
+{
+  ObjectGroup *all_objects = NULL;
+  Renderer *renderer = NULL;
+  int N = 0;
+  int i;
+
+  // groups are reused when rendering again so that their accelerators
+  // don't have to be rebuilt unless instances move
+  if (implicit_all_objects == NULL) {
+    implicit_all_objects = get_scene()->NewObjectGroup();
+    if (implicit_all_objects == NULL) {
+      set_errno(SI_ERR_NO_MEMORY);
+      return SI_FAIL;
+    }
+  }
+  all_objects = implicit_all_objects;
+
+  N = get_scene()->GetObjectInstanceCount();
+  for (i = implicit_object_count; i < N; i++) {
+    ObjectInstance *obj = get_scene()->GetObjectInstance(i);
+    all_objects->AddObject(obj);
+  }
+
+  /* Preparing ObjectInstance */
+  N = get_scene()->GetObjectInstanceCount();
+  const Light **lightlist = (const Light **) get_scene()->GetLightList();
+  const int nlights = get_scene()->GetLightCount();
+  // self hit groups of new instances are made at once
+  ObjectGroup *self_groups = get_scene()->NewObjectGroups(N - implicit_object_count);
+  for (i = 0; i < N; i++) {
+    ObjectInstance *obj = get_scene()->GetObjectInstance(i);
+    obj->SetLightList(lightlist, nlights);
+
+    if (obj->GetReflectTarget() == NULL)
+      obj->SetReflectTarget(all_objects);
+
+    if (obj->GetRefractTarget() == NULL)
+      obj->SetRefractTarget(all_objects);
+
+    if (obj->GetShadowTarget() == NULL)
+      obj->SetShadowTarget(all_objects);
+
+    if (i >= implicit_object_count) {
+      /* self hit group */
+      ObjectGroup *self_group = &self_groups[i - implicit_object_count];
+      self_group->AddObject(obj);
+      obj->SetSelfHitTarget(self_group);
+    }
+  }
+  implicit_object_count = N;
+  share_group_trees(all_objects);
+
+  renderer = get_scene()->GetRenderer(0);
+  renderer->SetTargetObjects(all_objects);
+  {
+    const int nlights = get_scene()->GetLightCount();
+    Light **lightlist = get_scene()->GetLightList();
+    if (nlights > 0) {
+      renderer->SetTargetLights(lightlist, nlights);
+    }
+  }
+
+  return SI_SUCCESS;
+}
+
+static void compute_object_bounds_range(void *data, int begin, int end)
+{
+  for (int i = begin; i < end; i++) {
+    get_scene()->GetObjectInstance(i)->ComputeBounds();
+  }
+}
+
+static void compute_group_bounds_range(void *data, int begin, int end)
+{
+  for (int i = begin; i < end; i++) {
+    get_scene()->GetObjectGroup(i)->ComputeBounds();
+  }
+}
+
+static void compute_objects_bounds(void)
+{
+  // nodes of the same kind don't depend on each other
+  const int CHUNK_SIZE = 1024;
+  int N = 0;
+  int i;
+
+  N = get_scene()->GetAcceleratorCount();
+  for (i = 0; i < N; i++) {
+    Accelerator *acc = get_scene()->GetAccelerator(i);
+    acc->ComputeBounds();
+  }
+
+  N = get_scene()->GetObjectInstanceCount();
+  MtParallelFor(NULL, compute_object_bounds_range, N, CHUNK_SIZE);
+
+  N = get_scene()->GetObjectGroupCount();
+  MtParallelFor(NULL, compute_group_bounds_range, N, CHUNK_SIZE);
+}
+
+// instances of meshes, curves and point clouds of the same content render
+// the first of them. meshes also share their arrays. found again for each
+// render so edited geometry renders its own accelerator again
+static void share_duplicate_geometry(void)
+{
+  Scene *scene = get_scene();
+  duplicate_accelerators.clear();
+
+  // accelerators rendered for each hash. the hash only finds candidates and
+  // they are shared once their content and build settings are the same
+  std::map<uint64_t, std::vector<Accelerator *> > first_accelerators;
+  for (std::size_t i = 0; i < scene->GetAcceleratorCount(); i++) {
+    Accelerator *acc = scene->GetAccelerator(i);
+    PrimitiveSet *primset = acc->GetPrimitiveSet();
+    if (acc->IsDeferred() || primset->GetPrimitiveCount() == 0) {
+      continue;
+    }
+    if (dynamic_cast<Mesh *>(primset) == NULL &&
+        dynamic_cast<Curve *>(primset) == NULL &&
+        dynamic_cast<PointCloud *>(primset) == NULL) {
+      continue;
+    }
+    const uint64_t hash = primset->GetContentHash();
+    if (hash == 0) {
+      continue;
+    }
+
+    std::vector<Accelerator *> &candidates = first_accelerators[hash];
+    Accelerator *first = NULL;
+    for (std::size_t j = 0; j < candidates.size(); j++) {
+      if (candidates[j]->HasSameSettings(*acc) &&
+          candidates[j]->GetPrimitiveSet()->HasSameContent(*primset)) {
+        first = candidates[j];
+        break;
+      }
+    }
+    if (first == NULL) {
+      candidates.push_back(acc);
+      continue;
+    }
+
+    duplicate_accelerators[acc] = first;
+    Mesh *first_mesh = dynamic_cast<Mesh *>(first->GetPrimitiveSet());
+    if (first_mesh != NULL) {
+      first_mesh->ShareArrays(static_cast<Mesh *>(primset));
+    }
+  }
+
+  for (std::size_t i = 0; i < scene->GetObjectInstanceCount(); i++) {
+    ObjectInstance *obj = scene->GetObjectInstance(i);
+    const std::map<const Accelerator *, const Accelerator *>::const_iterator it =
+        duplicate_accelerators.find(obj->GetOwnSurface());
+    obj->ShareSurface(it == duplicate_accelerators.end() ? NULL : it->second);
+  }
+
+  if (!duplicate_accelerators.empty()) {
+    printf("# Sharing Geometry\n");
+    printf("#   Duplicate Count: %d\n\n", static_cast<int>(duplicate_accelerators.size()));
+  }
+}
+
+// nearest distance from the point to the box
+static Real distance_to_box(const Vector &point, const Box &box)
+{
+  Vector nearest;
+  for (int i = 0; i < 3; i++) {
+    nearest[i] = Clamp(point[i], box.min[i], box.max[i]);
+  }
+  return Length(nearest - point);
+}
+
+// simplifies curves and point clouds for the pixel size of the camera where
+// their instances are nearest to it. returns true if any has changed
+static bool simplify_geometry(const Renderer *renderer)
+{
+  if (renderer == NULL || renderer->camera_ == NULL) {
+    return false;
+  }
+
+  Ray center_ray;
+  renderer->camera_->GetRay(Vector2(.5, .5), 0, &center_ray);
+  const Vector eye = center_ray.orig;
+  const Real spread = renderer->camera_->GetPixelSpread(renderer->resolution_[1]);
+
+  // instance scale is estimated from the diagonals of the bounds
+  std::map<const Accelerator *, Real> pixel_sizes;
+  for (std::size_t i = 0; i < get_scene()->GetObjectInstanceCount(); i++) {
+    const ObjectInstance *obj = get_scene()->GetObjectInstance(i);
+    const Accelerator *acc = obj->GetSurface();
+    if (acc == NULL || acc->IsDeferred()) {
+      continue;
+    }
+    const Real object_size = Length(acc->GetBounds().Diagonal());
+    const Real world_size = Length(obj->GetBounds().Diagonal());
+    if (object_size <= 0 || world_size <= 0) {
+      continue;
+    }
+
+    const Real pixel_size = distance_to_box(eye, obj->GetBounds()) * spread *
+        object_size / world_size;
+    const std::map<const Accelerator *, Real>::iterator it = pixel_sizes.find(acc);
+    if (it == pixel_sizes.end()) {
+      pixel_sizes[acc] = pixel_size;
+    } else {
+      it->second = Min(it->second, pixel_size);
+    }
+  }
+
+  // geometry not rendered is kept as it is
+  bool changed = false;
+  for (std::size_t i = 0; i < get_scene()->GetAcceleratorCount(); i++) {
+    Accelerator *acc = get_scene()->GetAccelerator(i);
+    const std::map<const Accelerator *, Real>::const_iterator it = pixel_sizes.find(acc);
+    const Real pixel_size = it == pixel_sizes.end() ? 0 : it->second;
+
+    Curve *curve = dynamic_cast<Curve *>(acc->GetPrimitiveSet());
+    if (curve != NULL) {
+      changed |= curve->Simplify(pixel_size);
+    }
+    PointCloud *ptc = dynamic_cast<PointCloud *>(acc->GetPrimitiveSet());
+    if (ptc != NULL) {
+      changed |= ptc->Simplify(pixel_size);
+    }
+  }
+  return changed;
+}
+
+// object accelerators are built in parallel. a group is built by the thread
+// finishing the last accelerator its surface instances refer to
+class AcceleratorBuild {
+public:
+  AcceleratorBuild() {}
+  ~AcceleratorBuild() {}
+
+  std::vector<Accelerator *> accelerators;
+  std::vector<ObjectGroup *> groups;
+  // groups waiting for each accelerator
+  std::vector<std::vector<int>> dependents;
+  // accelerators each group is still waiting for
+  std::unique_ptr<std::atomic<int>[]> pending;
+  // accelerators then groups
+  std::vector<double> build_seconds;
+  // accelerators of geometry unchanged since the last render
+  std::vector<char> up_to_date;
+  // accelerators in duplicate_accelerators
+  std::vector<char> duplicate;
+};
+
+static LoopStatus build_accelerator_task(void *data, const ThreadContext &context)
+{
+  AcceleratorBuild *build = static_cast<AcceleratorBuild *>(data);
+  const int NACCS = build->accelerators.size();
+  const int id = context.iteration_id;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const TraceScope trace("scene", id >= NACCS ? "BuildGroup" : "BuildAccelerator", id);
+
+  if (id >= NACCS) {
+    build->groups[id - NACCS]->Build();
+  } else if (!build->duplicate[id]) {
+    build->accelerators[id]->Update();
+  }
+
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  build->build_seconds[id] = elapsed.count();
+
+  if (id >= NACCS) {
+    return LoopStatus::Continue;
+  }
+
+  TaskGroup ready_groups;
+  const std::vector<int> &dependents = build->dependents[id];
+  for (std::size_t i = 0; i < dependents.size(); i++) {
+    if (--build->pending[dependents[i]] == 0) {
+      ready_groups.Spawn(build, build_accelerator_task, NACCS + dependents[i]);
+    }
+  }
+  return ready_groups.Wait();
+}
+
+// prints the quality of the tree under the line of the accelerator
+static void print_accelerator_stats(const Accelerator *acc, Index nprims)
+{
+  const double MB = 1024. * 1024.;
+  AcceleratorStats stats;
+  if (acc == NULL || acc->Analyze(&stats)) {
+    return;
+  }
+
+  printf("#       SAH cost %.3f, sibling overlap %.3f, %lld interior, %lld leaves, "
+      "%.2f prims per leaf\n",
+      stats.sah_cost, stats.overlap_ratio,
+      static_cast<long long>(stats.interior_count),
+      static_cast<long long>(stats.leaf_count),
+      stats.leaf_count > 0 ?
+          static_cast<double>(stats.reference_count) / stats.leaf_count : 0.);
+
+  printf("#       leaf sizes:");
+  for (int i = 0; i < ACC_LEAF_SIZE_BIN_COUNT; i++) {
+    const int first = AccGetLeafSizeBinStart(i);
+    const int last = AccGetLeafSizeBinStart(i + 1) - 1;
+    if (i == ACC_LEAF_SIZE_BIN_COUNT - 1) {
+      printf(" %d+:", first);
+    } else if (first == last) {
+      printf(" %d:", first);
+    } else {
+      printf(" %d-%d:", first, last);
+    }
+    printf("%lld", static_cast<long long>(stats.leaf_size_histogram[i]));
+  }
+  printf("\n");
+
+  // depths are grouped into up to 8 ranges
+  const int width = stats.max_depth / 8 + 1;
+  printf("#       leaf depths (mean %.1f, max %d):", stats.average_leaf_depth, stats.max_depth);
+  for (int first = 0; first < static_cast<int>(stats.depth_histogram.size()); first += width) {
+    const int last = std::min(first + width, static_cast<int>(stats.depth_histogram.size())) - 1;
+    int64_t count = 0;
+    for (int d = first; d <= last; d++) {
+      count += stats.depth_histogram[d];
+    }
+    if (count == 0) {
+      continue;
+    }
+    if (first == last) {
+      printf(" %d:%lld", first, static_cast<long long>(count));
+    } else {
+      printf(" %d-%d:%lld", first, last, static_cast<long long>(count));
+    }
+  }
+  printf("\n");
+
+  const std::size_t bytes = acc->GetMemoryUsage();
+  printf("#       memory %.3f MB, %.1f bytes per prim\n", bytes / MB,
+      nprims > 0 ? static_cast<double>(bytes) / nprims : 0.);
+}
+
+static void build_accelerators(const Renderer *renderer)
+{
+  const bool verbose = renderer != NULL && renderer->IsVerbose();
+  Timer timer;
+  Elapse elapse;
+  const int NACCS = get_scene()->GetAcceleratorCount();
+  const int NGROUPS = get_scene()->GetObjectGroupCount();
+
+  printf("# Building Accelerators\n");
+  printf("#   Accelerator Count: %d\n", NACCS + NGROUPS);
+  timer.Start();
+
+  AcceleratorBuild build;
+  std::map<const Accelerator *, int> acc_ids;
+  for (int i = 0; i < NACCS; i++) {
+    build.accelerators.push_back(get_scene()->GetAccelerator(i));
+    acc_ids[build.accelerators[i]] = i;
+  }
+  build.dependents.resize(NACCS);
+  build.pending.reset(new std::atomic<int>[NGROUPS]);
+  build.build_seconds.resize(NACCS + NGROUPS, 0);
+  build.up_to_date.resize(NACCS, 0);
+  build.duplicate.resize(NACCS, 0);
+  for (int i = 0; i < NACCS; i++) {
+    build.up_to_date[i] = build.accelerators[i]->IsUpToDate();
+    build.duplicate[i] = duplicate_accelerators.count(build.accelerators[i]) > 0;
+  }
+
+  // accelerators built for previous frames are rebuilt only when their
+  // geometry changed. groups are refit when instances moved
+  std::vector<int> ready_groups;
+  for (int i = 0; i < NGROUPS; i++) {
+    build.groups.push_back(get_scene()->GetObjectGroup(i));
+
+    const ObjectSet &surfaces = build.groups[i]->GetSurfaceSet();
+    std::vector<int> children;
+    for (Index j = 0; j < surfaces.GetObjectCount(); j++) {
+      const std::map<const Accelerator *, int>::const_iterator it =
+          acc_ids.find(surfaces.GetObject(j)->GetSurface());
+      if (it != acc_ids.end()) {
+        children.push_back(it->second);
+      }
+    }
+    std::sort(children.begin(), children.end());
+    children.erase(std::unique(children.begin(), children.end()), children.end());
+
+    for (std::size_t j = 0; j < children.size(); j++) {
+      build.dependents[children[j]].push_back(i);
+    }
+    build.pending[i] = children.size();
+    if (children.empty()) {
+      ready_groups.push_back(NACCS + i);
+    }
+  }
+
+  // large accelerators first so they don't start last
+  std::vector<int> build_que(NACCS);
+  for (int i = 0; i < NACCS; i++) {
+    build_que[i] = i;
+  }
+  std::stable_sort(build_que.begin(), build_que.end(),
+      [&build](int a, int b)
+      {
+        const PrimitiveSet *pa = build.accelerators[a]->GetPrimitiveSet();
+        const PrimitiveSet *pb = build.accelerators[b]->GetPrimitiveSet();
+        const Index na = pa == NULL ? 0 : pa->GetPrimitiveCount();
+        const Index nb = pb == NULL ? 0 : pb->GetPrimitiveCount();
+        return na > nb;
+      });
+  build_que.insert(build_que.end(), ready_groups.begin(), ready_groups.end());
+
+  MtRunParallelLoop(&build, build_accelerator_task,
+      MtGetMaxAvailableThreadCount(), build_que);
+
+  for (int i = 0; i < NACCS; i++) {
+    Accelerator *acc = build.accelerators[i];
+    if (build.duplicate[i]) {
+      printf("#     %s %d: same as %d\n", acc->GetName(), i,
+          acc_ids[duplicate_accelerators[acc]]);
+      continue;
+    }
+    const std::map<const Accelerator *, double>::const_iterator loaded =
+        loading_build_seconds.find(acc);
+    if (build.up_to_date[i] && loaded != loading_build_seconds.end()) {
+      const PrimitiveSet *primset = acc->GetPrimitiveSet();
+      printf("#     %s %d: %d prims %.3fs while loading\n", acc->GetName(), i,
+          primset == NULL ? 0 : static_cast<int>(primset->GetPrimitiveCount()),
+          loaded->second);
+    } else if (build.up_to_date[i]) {
+      printf("#     %s %d: up to date\n", acc->GetName(), i);
+    } else {
+      const PrimitiveSet *primset = acc->GetPrimitiveSet();
+      printf("#     %s %d: %d prims %.3fs%s\n", acc->GetName(), i,
+          primset == NULL ? 0 : static_cast<int>(primset->GetPrimitiveCount()),
+          build.build_seconds[i], acc->WasRefit() ? " refit" : "");
+    }
+    if (verbose) {
+      const PrimitiveSet *primset = acc->GetPrimitiveSet();
+      print_accelerator_stats(acc, primset == NULL ? 0 : primset->GetPrimitiveCount());
+    }
+  }
+  for (int i = 0; i < NGROUPS; i++) {
+    if (build.groups[i]->IsSharingTree()) {
+      printf("#     Group %d: %d objects in the shared tree\n", i,
+          static_cast<int>(build.groups[i]->GetSurfaceSet().GetObjectCount()));
+      continue;
+    }
+    printf("#     Group %d: %d objects %.3fs\n", i,
+        static_cast<int>(build.groups[i]->GetSurfaceSet().GetObjectCount()),
+        build.build_seconds[NACCS + i]);
+    if (verbose) {
+      print_accelerator_stats(build.groups[i]->GetSurfaceAccelerator(),
+          build.groups[i]->GetSurfaceSet().GetObjectCount());
+    }
+  }
+
+  loading_build_seconds.clear();
+
+  elapse = timer.GetElapse();
+  printf("# Building Accelerators Done\n");
+  printf("#   %dh %dm %ds\n\n", elapse.hour, elapse.min, elapse.sec);
+}
+
+static void print_memory_usage(void)
+{
+  static const char *category_names[] = {
+    "Mesh",
+    "Curve",
+    "PointCloud",
+    "Volume",
+    "Texture",
+    "FrameBuffer",
+    "Accelerator",
+    "ObjectGroup"
+  };
+  const double MB = 1024. * 1024.;
+
+  SceneMemoryUsage usage;
+  get_scene()->GetMemoryUsage(&usage);
+
+  printf("# Memory Usage\n");
+  for (int i = 0; i < SCENE_MEMORY_CATEGORY_COUNT; i++) {
+    if (usage.node_count[i] == 0) {
+      continue;
+    }
+    printf("#   %-12s %6d nodes %10.3f MB  largest %d: %.3f MB\n",
+        category_names[i], usage.node_count[i], usage.bytes[i] / MB,
+        usage.largest_node[i], usage.largest_bytes[i] / MB);
+  }
+  printf("#   %-12s %12s %10.3f MB\n", "Total", "", usage.GetTotal() / MB);
+
+  // textures and volumes read from files share the budget
+  const TileCache &cache = TileCacheGetGlobal();
+  printf("#   %-12s %12s %10.3f MB of %.3f MB\n\n", "TileCache", "",
+      cache.GetMemoryUsage() / MB, cache.GetMemoryBudget() / MB);
+}
+
+// prints the most expensive shaders and objects of the last render
+static void print_profile(void)
 {
-  Timer timer;
-  Elapse elapse;
-  int NOBJTECTS = 0;
-  int NGROUPS = 0;
-  int i;
+  static const int MAX_ROWS = 20;
+  const Scene *scene = get_scene();
 
-  NOBJTECTS = get_scene()->GetAcceleratorCount();
-  NGROUPS = get_scene()->GetObjectGroupCount();
+  for (int kind = 0; kind < PROFILE_KIND_COUNT; kind++) {
+    std::vector<ProfileCounter> counters;
+    ProfileGather(kind, &counters);
+    if (counters.empty()) {
+      continue;
+    }
+    const size_t nrows = std::min(counters.size(), static_cast<size_t>(MAX_ROWS));
 
-  printf("# Building Accelerators\n");
-  printf("#   Accelerator Count: %d\n", NOBJTECTS + NGROUPS);
-  timer.Start();
+    // IDs of the rows from the nodes of the scene
+    std::map<const void *, ID> ids;
+    for (size_t i = 0; i < nrows; i++) {
+      ids[counters[i].key] = SI_BADID;
+    }
+    if (kind == PROFILE_SHADER) {
+      for (size_t i = 0; i < scene->GetShaderCount(); i++) {
+        std::map<const void *, ID>::iterator it = ids.find(scene->GetShader(i));
+        if (it != ids.end()) {
+          it->second = encode_id(Type_Shader, i);
+        }
+      }
+    } else {
+      for (size_t i = 0; i < scene->GetObjectInstanceCount(); i++) {
+        std::map<const void *, ID>::iterator it = ids.find(scene->GetObjectInstance(i));
+        if (it != ids.end()) {
+          it->second = encode_id(Type_ObjectInstance, i);
+        }
+      }
+    }
 
-  for (i = 0; i < NOBJTECTS; i++) {
-    Accelerator *acc = get_scene()->GetAccelerator(i);
-    acc->Build();
+    printf("# %s Profile (inclusive)\n", kind == PROFILE_SHADER ? "Shader" : "Object");
+    printf("#   %-10s %-16s %14s %12s %10s\n", "ID", "Plugin", "Calls", "Seconds", "ns/Call");
+    for (size_t i = 0; i < nrows; i++) {
+      const ProfileCounter &counter = counters[i];
+      const ID id = ids[counter.key];
+      const char *plugin_name = "";
+      if (kind == PROFILE_SHADER && id != SI_BADID) {
+        const Entry plugin_entry = decode_id(find_plugin_from(id));
+        const Plugin *plugin = plugin_entry.type == Type_Plugin ?
+            scene->GetPlugin(plugin_entry.index) : NULL;
+        if (plugin != NULL && plugin->GetName() != NULL) {
+          plugin_name = plugin->GetName();
+        }
+      }
+      printf("#   %-10ld %-16s %14lld %12.3f %10.1f\n",
+          static_cast<long>(id), plugin_name,
+          static_cast<long long>(counter.call_count), counter.nanoseconds * 1e-9,
+          counter.call_count > 0 ?
+              static_cast<double>(counter.nanoseconds) / counter.call_count : 0.);
+    }
+    if (counters.size() > nrows) {
+      printf("#   ... %d more\n", static_cast<int>(counters.size() - nrows));
+    }
+    printf("\n");
   }
+}
 
-  for (i = 0; i < NGROUPS; i++) {
-    ObjectGroup *grp = get_scene()->GetObjectGroup(i);
-    Accelerator *mutable_acc = NULL;
-    VolumeAccelerator *mutable_volume_acc = NULL;
+static void compile_shaders(void)
+{
+  const size_t N = get_scene()->GetShaderCount();
 
-    // TODO TRY TO AVOID MUTABLE
-    mutable_acc = (Accelerator *) grp->GetSurfaceAccelerator();
-    mutable_volume_acc = (VolumeAccelerator *) grp->GetVolumeAccelerator();
+  for (size_t i = 0; i < N; i++) {
+    Shader *shader = get_scene()->GetShader(i);
+    shader->Compile();
+  }
+}
 
-    /* TODO come up with a better way */
-    if (mutable_acc != NULL) {
-      mutable_acc->Build();
-    }
-    if (mutable_volume_acc != NULL) {
-      VolumeAccBuild(mutable_volume_acc);
+// packs voxels written since the last render in the precision of each
+// volume and builds coarser levels for secondary rays. volumes unchanged
+// since the last render keep their levels
+static void prepare_volumes(void)
+{
+  const size_t N = get_scene()->GetVolumeCount();
+
+  for (size_t i = 0; i < N; i++) {
+    Volume *volume = get_scene()->GetVolume(i);
+    volume->Compact();
+    volume->BuildLevels();
+  }
+}
+
+// bakes turbulences of bake_resolution before procedures and shaders
+// evaluate them from threads. baked ones are kept until changed
+static void bake_turbulences(void)
+{
+  const size_t N = get_scene()->GetTurbulenceCount();
+
+  for (size_t i = 0; i < N; i++) {
+    get_scene()->GetTurbulence(i)->Bake();
+  }
+}
+
+static void bind_node_to_procedure(const Entry &entry, const char *name, ID node)
+{
+  if (entry.type == Type_Procedure) {
+    procedure_nodes[std::make_pair(encode_id(entry.type, entry.index), std::string(name))] = node;
+  }
+}
+
+static std::vector<ID> find_nodes_of_procedure(ID procedure)
+{
+  std::vector<ID> nodes;
+  std::map<std::pair<ID, std::string>, ID>::const_iterator it =
+      procedure_nodes.lower_bound(std::make_pair(procedure, std::string()));
+  for (; it != procedure_nodes.end() && it->first.first == procedure; ++it) {
+    nodes.push_back(it->second);
+  }
+  return nodes;
+}
+
+static bool is_pending_procedure_using(const PendingProcedure &pending, ID id)
+{
+  return pending.procedure == id ||
+      std::find(pending.nodes.begin(), pending.nodes.end(), id) != pending.nodes.end();
+}
+
+static void finish_pending_procedure(const PendingProcedure &pending)
+{
+  if (pending.result.get()) {
+    fprintf(stderr, "* WARNING: procedure %ld failed\n\n", static_cast<long>(pending.procedure));
+    has_failed_procedure = true;
+  }
+}
+
+// waits for procedures running on the procedure or the node id
+static void wait_procedures_using(ID id)
+{
+  std::vector<PendingProcedure>::iterator it = pending_procedures.begin();
+  while (it != pending_procedures.end()) {
+    if (is_pending_procedure_using(*it, id)) {
+      finish_pending_procedure(*it);
+      it = pending_procedures.erase(it);
+    } else {
+      ++it;
     }
   }
+}
 
-  elapse = timer.GetElapse();
-  printf("# Building Accelerators Done\n");
-  printf("#   %dh %dm %ds\n\n", elapse.hour, elapse.min, elapse.sec);
+static void wait_all_procedures(void)
+{
+  for (std::size_t i = 0; i < pending_procedures.size(); i++) {
+    finish_pending_procedure(pending_procedures[i]);
+  }
+  pending_procedures.clear();
 }
 
 static int prepare_render(const Renderer *renderer)
 {
   int err = 0;
 
+  // renders need all geometry
+  wait_all_procedures();
+
   printf("\n");
 
+  // from opening the scene to the first render
+  if (!scene_loaded) {
+    TraceEvent("scene", "LoadScene", scene_load_start, TraceNow());
+    scene_loaded = true;
+  }
+
+  share_duplicate_geometry();
   compute_objects_bounds();
+  // pruned geometry has new bounds
+  if (simplify_geometry(renderer)) {
+    compute_objects_bounds();
+  }
 
   /* TODO need err? */
   err = create_implicit_groups();
@@ -1216,11 +2776,417 @@ static int prepare_render(const Renderer *renderer)
     return SI_FAIL;
   }
 
-  build_accelerators();
+  compile_shaders();
+  bake_turbulences();
+  prepare_volumes();
+  build_accelerators(renderer);
+  print_memory_usage();
+
+  return 0;
+}
+
+// replaces the last run of # in filename with the frame number padded
+// with zeros to the length of the run
+static std::string make_frame_filename(const std::string &filename, int frame)
+{
+  const std::size_t end = filename.find_last_of('#');
+  if (end == std::string::npos) {
+    return filename;
+  }
+
+  std::size_t begin = end;
+  while (begin > 0 && filename[begin - 1] == '#') {
+    begin--;
+  }
+
+  char number[32] = {'\0'};
+  snprintf(number, sizeof(number), "%0*d", static_cast<int>(end - begin + 1), frame);
+
+  return filename.substr(0, begin) + number + filename.substr(end + 1);
+}
+
+// transforms of objects, cameras and lights are looked up from time
+static void set_frame_time(double time)
+{
+  Scene *scene = get_scene();
+
+  for (std::size_t i = 0; i < scene->GetObjectInstanceCount(); i++) {
+    scene->GetObjectInstance(i)->SetTimeOffset(time);
+  }
+  for (std::size_t i = 0; i < scene->GetCameraCount(); i++) {
+    scene->GetCamera(i)->SetTimeOffset(time);
+  }
+  for (std::size_t i = 0; i < scene->GetLightCount(); i++) {
+    scene->GetLight(i)->SetTimeOffset(time);
+  }
+}
+
+// reads files through so procedures find them in the os cache
+static void prefetch_files(std::vector<std::string> filenames)
+{
+  std::vector<char> buf(1024 * 1024);
+
+  for (std::size_t i = 0; i < filenames.size(); i++) {
+    FILE *fp = fopen(filenames[i].c_str(), "rb");
+    if (fp == NULL) {
+      continue;
+    }
+    while (fread(&buf[0], 1, buf.size(), fp) == buf.size()) {
+    }
+    fclose(fp);
+  }
+}
+
+// stops the interactive render so the scene can be edited
+static void interrupt_interactive(void)
+{
+  if (interactive.renderer == NULL) {
+    return;
+  }
+
+  if (interactive.render_thread.joinable()) {
+    interactive.renderer->Interrupt();
+    interactive.render_thread.join();
+    interactive.renderer->ClearInterrupt();
+  }
+  interactive.needs_restart = true;
+}
+
+// the scene is about to be edited. renders after it render all tiles again
+static void pause_interactive(void)
+{
+  interrupt_interactive();
+  invalidate_renders(NULL);
+}
+
+// only tiles of objects with the shader are rendered again for edits of
+// shaders. other entries are as pause_interactive()
+static void pause_interactive_for_shader(const Entry &entry)
+{
+  const Shader *shader = NULL;
+  if (entry.type == Type_Shader) {
+    shader = get_scene()->GetShader(entry.index);
+  }
+  if (shader == NULL) {
+    pause_interactive();
+    return;
+  }
+
+  interrupt_interactive();
+
+  const Scene *scene = get_scene();
+  for (std::size_t i = 0; i < scene->GetObjectInstanceCount(); i++) {
+    const ObjectInstance *object = scene->GetObjectInstance(i);
+    if (object != NULL && object->HasShader(shader)) {
+      invalidate_renders(object);
+    }
+  }
+}
+
+// tiles of the last renders whose rays hit the object are rendered again.
+// all tiles if NULL
+static void invalidate_renders(const ObjectInstance *object)
+{
+  const Scene *scene = get_scene();
+  for (std::size_t i = 0; i < scene->GetRendererCount(); i++) {
+    Renderer *renderer = scene->GetRenderer(i);
+    if (renderer == NULL) {
+      continue;
+    }
+    if (object != NULL) {
+      renderer->InvalidateObject(object);
+    } else {
+      renderer->InvalidateAll();
+    }
+  }
+}
+
+// lets the interactive render finish
+static void wait_interactive(void)
+{
+  if (interactive.render_thread.joinable()) {
+    interactive.render_thread.join();
+  }
+}
+
+// the element count of value_count values of element_size or -1
+static int64_t count_elements(int64_t value_count, int element_size)
+{
+  if (value_count < 0 || value_count % element_size != 0) {
+    return -1;
+  }
+  return value_count / element_size;
+}
+
+template <typename T>
+static int set_primitive_attribute(const Entry &entry, const std::string &name,
+    const T *values, int64_t value_count)
+{
+  switch (entry.type) {
+  case Type_Mesh:
+    if (name == "indices") {
+      return set_mesh_indices(get_scene()->GetMesh(entry.index),
+          values, value_count);
+    }
+    return set_mesh_attribute(get_scene()->GetMesh(entry.index),
+        name, values, value_count);
+  case Type_Curve:
+    if (name == "indices") {
+      return set_curve_indices(get_scene()->GetCurve(entry.index),
+          values, value_count);
+    }
+    return set_curve_attribute(get_scene()->GetCurve(entry.index),
+        name, values, value_count);
+  case Type_PointCloud:
+    return set_point_cloud_attribute(get_scene()->GetPointCloud(entry.index),
+        name, values, value_count);
+  default:
+    return -1;
+  }
+}
+
+template <typename T>
+static int set_mesh_attribute(Mesh *mesh, const std::string &name,
+    const T *values, int64_t value_count)
+{
+  if (mesh == NULL) {
+    return -1;
+  }
+
+  const int element_size = name == "uv" ? 2 : 3;
+  const int64_t count = count_elements(value_count, element_size);
+  if (count < 0 || count > INT_MAX) {
+    return -1;
+  }
+
+  if (name == "P") {
+    if (count != mesh->GetPointCount()) {
+      mesh->SetPointCount(count);
+      mesh->SetFaceCount(0);
+    }
+    mesh->AddPointPosition();
+  } else if (count != mesh->GetPointCount()) {
+    return -1;
+  }
+
+  const T *v = values;
+  if (name == "P") {
+    for (int i = 0; i < count; i++, v += 3) {
+      mesh->SetPointPosition(i, Vector(v[0], v[1], v[2]));
+    }
+  } else if (name == "N") {
+    mesh->AddPointNormal();
+    for (int i = 0; i < count; i++, v += 3) {
+      mesh->SetPointNormal(i, Vector(v[0], v[1], v[2]));
+    }
+  } else if (name == "Cd") {
+    mesh->AddPointColor();
+    for (int i = 0; i < count; i++, v += 3) {
+      mesh->SetPointColor(i, Color(v[0], v[1], v[2]));
+    }
+  } else if (name == "uv") {
+    mesh->AddPointTexture();
+    for (int i = 0; i < count; i++, v += 2) {
+      mesh->SetPointTexture(i, TexCoord(v[0], v[1]));
+    }
+  } else if (name == "velocity") {
+    mesh->AddPointVelocity();
+    for (int i = 0; i < count; i++, v += 3) {
+      mesh->SetPointVelocity(i, Vector(v[0], v[1], v[2]));
+    }
+  } else {
+    return -1;
+  }
+
+  mesh->ComputeBounds();
+  return 0;
+}
+
+template <typename T>
+static int set_curve_attribute(Curve *curve, const std::string &name,
+    const T *values, int64_t value_count)
+{
+  if (curve == NULL) {
+    return -1;
+  }
+
+  const int element_size = name == "uv" ? 2 : name == "width" ? 1 : 3;
+  const int64_t count = count_elements(value_count, element_size);
+  if (count < 0 || count > INT_MAX) {
+    return -1;
+  }
+
+  if (name == "P") {
+    if (count != curve->GetVertexCount()) {
+      curve->SetVertexCount(count);
+      curve->SetCurveCount(0);
+    }
+    curve->AddVertexPosition();
+  } else if (count != curve->GetVertexCount()) {
+    return -1;
+  }
+
+  const T *v = values;
+  if (name == "P") {
+    for (int i = 0; i < count; i++, v += 3) {
+      curve->SetVertexPosition(i, Vector(v[0], v[1], v[2]));
+    }
+  } else if (name == "Cd") {
+    curve->AddVertexColor();
+    for (int i = 0; i < count; i++, v += 3) {
+      curve->SetVertexColor(i, Color(v[0], v[1], v[2]));
+    }
+  } else if (name == "uv") {
+    curve->AddVertexTexture();
+    for (int i = 0; i < count; i++, v += 2) {
+      curve->SetVertexTexture(i, TexCoord(v[0], v[1]));
+    }
+  } else if (name == "velocity") {
+    curve->AddVertexVelocity();
+    for (int i = 0; i < count; i++, v += 3) {
+      curve->SetVertexVelocity(i, Vector(v[0], v[1], v[2]));
+    }
+  } else if (name == "width") {
+    curve->AddVertexWidth();
+    for (int i = 0; i < count; i++) {
+      curve->SetVertexWidth(i, v[i]);
+    }
+  } else {
+    return -1;
+  }
+
+  curve->ComputeBounds();
+  return 0;
+}
+
+template <typename T>
+static int set_point_cloud_attribute(PointCloud *ptc, const std::string &name,
+    const T *values, int64_t value_count)
+{
+  if (ptc == NULL) {
+    return -1;
+  }
+
+  const int element_size = name == "radius" ? 1 : 3;
+  const int64_t count = count_elements(value_count, element_size);
+  if (count < 0 || count > INT_MAX) {
+    return -1;
+  }
+
+  if (name == "P") {
+    ptc->SetPointCount(count);
+    ptc->AddPointPosition();
+  } else if (count != ptc->GetPointCount()) {
+    return -1;
+  }
+
+  const T *v = values;
+  if (name == "P") {
+    for (int i = 0; i < count; i++, v += 3) {
+      ptc->SetPointPosition(i, Vector(v[0], v[1], v[2]));
+    }
+  } else if (name == "velocity") {
+    ptc->AddPointVelocity();
+    for (int i = 0; i < count; i++, v += 3) {
+      ptc->SetPointVelocity(i, Vector(v[0], v[1], v[2]));
+    }
+  } else if (name == "radius") {
+    ptc->AddPointRadius();
+    for (int i = 0; i < count; i++) {
+      ptc->SetPointRadius(i, v[i]);
+    }
+  } else {
+    return -1;
+  }
+
+  ptc->ComputeBounds();
+  return 0;
+}
+
+template <typename T>
+static int set_mesh_indices(Mesh *mesh, const T *indices, int64_t index_count)
+{
+  if (mesh == NULL) {
+    return -1;
+  }
+
+  const int64_t count = count_elements(index_count, 3);
+  if (count < 0 || count > INT_MAX) {
+    return -1;
+  }
+
+  const int64_t point_count = mesh->GetPointCount();
+  for (int64_t i = 0; i < index_count; i++) {
+    if (indices[i] < 0 || indices[i] >= point_count) {
+      return -1;
+    }
+  }
+
+  mesh->SetFaceCount(count);
+  mesh->AddFaceIndices();
+  for (int i = 0; i < count; i++) {
+    const T *face = &indices[3 * i];
+    mesh->SetFaceIndices(i, Index3(face[0], face[1], face[2]));
+  }
+
+  if (!mesh->HasPointNormal()) {
+    mesh->ComputeNormals();
+  }
+  mesh->ComputeBounds();
+  return 0;
+}
+
+template <typename T>
+static int set_curve_indices(Curve *curve, const T *indices, int64_t index_count)
+{
+  if (curve == NULL || index_count < 0 || index_count > INT_MAX) {
+    return -1;
+  }
+
+  // each curve is a cubic bezier of four control points
+  const int64_t vertex_count = curve->GetVertexCount();
+  for (int64_t i = 0; i < index_count; i++) {
+    if (indices[i] < 0 || indices[i] + 3 >= vertex_count) {
+      return -1;
+    }
+  }
+
+  curve->SetCurveCount(index_count);
+  curve->AddCurveIndices();
+  for (int i = 0; i < index_count; i++) {
+    curve->SetCurveIndices(i, indices[i]);
+  }
 
+  curve->ComputeBounds();
   return 0;
 }
 
+static int replace_accelerator(Accelerator *acc, const char *type_name)
+{
+  const int accelerator_type = AccFindTypeByName(type_name);
+  if (accelerator_type == -1) {
+    return -1;
+  }
+
+  // accelerator can't be replaced once it is referenced by object instances
+  const int NOBJECTS = get_scene()->GetObjectInstanceCount();
+  for (int i = 0; i < NOBJECTS; i++) {
+    const ObjectInstance *obj = get_scene()->GetObjectInstance(i);
+    if (obj->GetOwnSurface() == acc || obj->GetSurface() == acc) {
+      return -1;
+    }
+  }
+
+  const int NACCS = get_scene()->GetAcceleratorCount();
+  for (int i = 0; i < NACCS; i++) {
+    if (get_scene()->GetAccelerator(i) == acc) {
+      return get_scene()->ReplaceAccelerator(i, accelerator_type) == NULL ? -1 : 0;
+    }
+  }
+
+  return -1;
+}
+
 static void set_errno(int err_no)
 {
   si_errno = err_no;
@@ -1234,44 +3200,47 @@ static Status status_of_error(int err)
     return SI_SUCCESS;
 }
 
-static int find_and_set_property(void *self, const Property *property_list,
-    const char *property_name, const PropertyValue &value)
+static void *get_property_owner(const Entry &entry)
 {
-  const Property *property = PropFind(property_list, value.type, property_name);
-  if (property == NULL) {
-    return -1;
-  }
-  if (self == NULL) {
-    return -1;
+  switch (entry.type) {
+  case Type_Procedure:
+    return get_scene()->GetProcedure(entry.index);
+  case Type_Shader:
+    return get_scene()->GetShader(entry.index);
+  default:
+    return get_builtin_type_entry(get_scene(), entry);
   }
-  return property->SetValue(self, value);
 }
 
 static int set_property(const Entry &entry,
     const char *name, const PropertyValue &value)
 {
-  void *self = NULL;
+  wait_procedures_using(encode_id(entry.type, entry.index));
+  void *self = get_property_owner(entry);
 
-  switch (entry.type) {
-  case Type_Procedure:
-    self = get_scene()->GetProcedure(entry.index);
-    break;
-  case Type_Shader:
-    self = get_scene()->GetShader(entry.index);
-    break;
-  default:
-    self = get_builtin_type_entry(get_scene(), entry);
-    break;
-  }
+  const PropertyTable *table = get_property_table(entry);
+  assert(table && "Some types are not implemented yet");
 
-  const Property *property_list = get_property_list(entry);
-  assert(property_list && "Some types are not implemented yet");
-  
   if (self == NULL) {
     return -1;
   }
 
-  return find_and_set_property(self, property_list, name, value);
+  const Property *property = table->Find(value.type, name);
+  if (property == NULL) {
+    // procedures of any plugin cache their results in cache_dir
+    if (entry.type == Type_Procedure && value.type == PROP_STRING &&
+        strcmp(name, "cache_dir") == 0 && value.string != NULL) {
+      static_cast<Procedure *>(self)->SetCacheDirectory(value.string);
+      return 0;
+    }
+    return -1;
+  }
+
+  const int err = property->SetValue(self, value);
+  if (!err && entry.type == Type_Procedure) {
+    static_cast<Procedure *>(self)->RecordProperty(name, value);
+  }
+  return err;
 }
 
 } // namespace xxx
@@ -7,6 +7,7 @@
 #include "fj_compatibility.h"
 #include "fj_callback.h"
 #include "fj_renderer.h"
+#include <cstdint>
 
 namespace fj {
 
@@ -48,6 +49,13 @@ enum SiTransformOrder {
   SI_ORDER_ZYX
 };
 
+enum SiArrayType {
+  SI_ARRAY_FLOAT32 = 0,
+  SI_ARRAY_FLOAT64,
+  SI_ARRAY_INT32,
+  SI_ARRAY_INT64
+};
+
 enum SiLightType {
   SI_POINT_LIGHT = 0,
   SI_GRID_LIGHT,
@@ -57,7 +65,8 @@ enum SiLightType {
 
 enum SiSamplerType {
   SI_FIXED_GRID_SAMPLER = RENDERER_FIXED_GRID_SAMPLER,
-  SI_ADAPTIVE_GRID_SAMPLER = RENDERER_ADAPTIVE_GRID_SAMPLER
+  SI_ADAPTIVE_GRID_SAMPLER = RENDERER_ADAPTIVE_GRID_SAMPLER,
+  SI_VARIANCE_SAMPLER = RENDERER_VARIANCE_SAMPLER
 };
 
 /* Error interfaces */
@@ -70,12 +79,58 @@ FJ_API ID SiOpenPlugin(const char *filename);
 FJ_API Status SiOpenScene(void);
 FJ_API Status SiCloseScene(void);
 FJ_API Status SiRenderScene(ID renderer);
+// waits for the interactive render to finish before saving
 FJ_API Status SiSaveFrameBuffer(ID framebuffer, const char *filename);
+
+/* Animation interfaces */
+// runs procedure again before each frame of SiRenderFrames with its string
+// property name set to filename. the last run of # in filename is replaced
+// by the frame number padded with zeros like mesh.####.ply
+FJ_API Status SiAddFrameProcedure(ID procedure, const char *name, const char *filename);
+// renders frames from first_frame to last_frame and saves framebuffer of
+// each frame to filename with # replaced by the frame number. frame f is
+// rendered with transform samples at time f plus the sample time range.
+// geometry not changed by frame procedures is built once. the files of the
+// next frame are read ahead while a frame renders
+FJ_API Status SiRenderFrames(ID renderer, int first_frame, int last_frame,
+    ID framebuffer, const char *filename);
 FJ_API Status SiRunProcedure(ID procedure);
+// runs procedure on its own thread and returns at once. it starts after
+// procedures already running on the same procedure or assigned nodes.
+// assigned meshes are built right after loading on the same thread.
+// later calls touching those wait for it and renders wait for all
+FJ_API Status SiRunProcedureAsync(ID procedure);
+// waits for all procedures run by SiRunProcedureAsync. fails if any of
+// them failed since the last wait
+FJ_API Status SiWaitProcedures(void);
+// runs procedure when a ray first enters the bounds of primset instead
+// of now. bounds are in object space and must hold what it generates
+FJ_API Status SiDeferProcedure(ID procedure, ID primset,
+    double xmin, double ymin, double zmin,
+    double xmax, double ymax, double zmax);
 
 FJ_API Status SiAddObjectToGroup(ID group, ID object);
 
+/* Interactive interfaces */
+// renders progressively on another thread and keeps the scene. other Si
+// calls stop the render before editing the scene and SiUpdateInteractive
+// restarts it. only changed geometry is rebuilt. one session at a time
+FJ_API Status SiStartInteractive(ID renderer);
+// restarts the render if the scene was edited since it started
+FJ_API Status SiUpdateInteractive(void);
+FJ_API Status SiStopInteractive(void);
+FJ_API int SiIsInteractive(void);
+
+// instances of the same primset share its geometry and accelerator.
+// only the transform, shaders and targets are kept per instance
 FJ_API ID SiNewObjectInstance(ID primset);
+// count instances of primset at once. transforms are translate, rotate and
+// scale of each instance at time 0 in nine values, or NULL for the
+// defaults. returns the id of the first one. ids of the others follow it
+FJ_API ID SiNewObjectInstances(ID primset, int64_t count, const double *transforms);
+// a new instance with the primset, transform, shaders and targets of
+// object. object groups are not copied
+FJ_API ID SiCopyObjectInstance(ID object);
 FJ_API ID SiNewFrameBuffer(const char *arg);
 FJ_API ID SiNewObjectGroup(void);
 FJ_API ID SiNewPointCloud(void);
@@ -97,6 +152,8 @@ FJ_API Status SiAssignTurbulence(ID id, const char *name, ID turbulence);
 FJ_API Status SiAssignTexture(ID id, const char *name, ID texture);
 FJ_API Status SiAssignVolume(ID id, const char *name, ID volume);
 FJ_API Status SiAssignCamera(ID renderer, ID camera);
+/* renders the camera into the framebuffer along with the camera of the renderer */
+FJ_API Status SiAddView(ID renderer, ID camera, ID framebuffer);
 FJ_API Status SiAssignShader(ID object, const char *shading_group, ID shader);
 FJ_API Status SiAssignCurve(ID id, const char *name, ID curve);
 FJ_API Status SiAssignMesh(ID id, const char *name, ID mesh);
@@ -108,11 +165,52 @@ FJ_API Status SiSetProperty3(ID id, const char *name, double v0, double v1, doub
 FJ_API Status SiSetProperty4(ID id, const char *name, double v0, double v1, double v2, double v3);
 FJ_API Status SiSetStringProperty(ID id, const char *name, const char *string);
 
+class Property;
+// resolves the property of the type of id by name once so that it can be
+// set many times without lookups. NULL if the type has no such property
+FJ_API const Property *SiFindProperty(ID id, const char *name, int property_type);
+// sets a scalar or vector property found by SiFindProperty for an entry of
+// the same type. values has as many numbers as the property has
+FJ_API Status SiSetPropertyValues(ID id, const Property *property, const double *values);
+
 /* time variable property */
 FJ_API Status SiSetSampleProperty3(ID id, const char *name,
     double v0, double v1, double v2, double time);
 
-class Property;
+/* Primitive data interfaces */
+// copies value_count values of array_type into the attribute name of a
+// mesh, curve or point cloud. "P" sets the point count and removes faces or
+// curves if it changes. the others need values for every point.
+// mesh: P N Cd uv velocity indices. curve: P Cd uv velocity width indices.
+// point cloud: P velocity radius. indices are integers of three points of
+// each face or the first of four control points of each curve. normals of
+// meshes without N are computed from indices
+FJ_API Status SiSetPrimitiveAttribute(ID primset, const char *name,
+    int array_type, const void *values, int64_t value_count);
+// sets translate, rotate or scale at time of object_count object instances
+// from three values for each object
+FJ_API Status SiSetObjectInstanceTransforms(const ID *objects, int64_t object_count,
+    const char *name, const double *values, double time);
+
+/* Framebuffer data interfaces */
+// the pixels of framebuffer in rows of width pixels of channel_count floats.
+// valid until the framebuffer is resized by a render or the scene is closed.
+// fails if the render stored the framebuffer in tiles or in half floats
+FJ_API Status SiGetFrameBufferData(ID framebuffer, float **data,
+    int *width, int *height, int *channel_count);
+
+/* Memory interfaces */
+// bytes of mesh, curve, point cloud including its accelerator, volume,
+// texture, framebuffer or object group
+FJ_API Status SiGetMemoryUsage(ID id, int64_t *bytes);
+// bytes of all nodes of the scene
+FJ_API Status SiGetSceneMemoryUsage(int64_t *bytes);
+
+/* Profile interfaces */
+// calls and inclusive seconds of shader or object instance in the last
+// render with the renderer property profile. zeros if not profiled
+FJ_API Status SiGetProfile(ID id, int64_t *call_count, double *seconds);
+
 FJ_API const Property *SiGetPropertyList(const char *type_name);
 
 /* Callback interfaces */
@@ -2,6 +2,7 @@
 // See LICENSE and README
 
 #include "fj_shader.h"
+#include "fj_profile.h"
 
 namespace fj {
 
@@ -18,7 +19,62 @@ Shader::~Shader()
 void Shader::Evaluate(const TraceContext &cxt,
     const SurfaceInput &in, SurfaceOutput *out) const
 {
+  const ProfileScope profile(PROFILE_SHADER, this);
   evaluate(cxt, in, out);
 }
 
+bool Shader::IsOpaque() const
+{
+  return is_opaque();
+}
+
+float Shader::EvaluateOpacity(const TraceContext &cxt, const SurfaceInput &in) const
+{
+  const ProfileScope profile(PROFILE_SHADER, this);
+  return evaluate_opacity(cxt, in);
+}
+
+void Shader::EvaluateBatch(const TraceContext *cxts, const SurfaceInput *in, int count,
+    SurfaceOutput *out) const
+{
+  const ProfileScope profile(PROFILE_SHADER, this, count);
+  evaluate_batch(cxts, in, count, out);
+}
+
+void Shader::Compile()
+{
+  compile();
+}
+
+bool Shader::ScatterPhoton(const SurfaceInput &in, double u,
+    Vector *dir, Color *weight) const
+{
+  return scatter_photon(in, u, dir, weight);
+}
+
+bool Shader::ScattersPhotons() const
+{
+  return scatters_photons();
+}
+
+bool Shader::IsDensityOnly(int ray_context) const
+{
+  return is_density_only(ray_context);
+}
+
+float Shader::evaluate_opacity(const TraceContext &cxt, const SurfaceInput &in) const
+{
+  SurfaceOutput out;
+  evaluate(cxt, in, &out);
+  return out.Os;
+}
+
+void Shader::evaluate_batch(const TraceContext *cxts, const SurfaceInput *in, int count,
+    SurfaceOutput *out) const
+{
+  for (int i = 0; i < count; i++) {
+    evaluate(cxts[i], in[i], &out[i]);
+  }
+}
+
 } // namespace xxx
@@ -26,10 +26,42 @@ public:
   virtual ~Shader();
 
   void Evaluate(const TraceContext &cxt, const SurfaceInput &in, SurfaceOutput *out) const;
+  // true if Evaluate always returns Os = 1. shadow rays stop at
+  // the first hit on opaque shaders without evaluating them
+  bool IsOpaque() const;
+  // Os alone for shadow rays through transparent shaders. evaluates
+  // the whole shader unless overridden
+  float EvaluateOpacity(const TraceContext &cxt, const SurfaceInput &in) const;
+  // shades up to SHADE_BATCH_SIZE points of this shader at once. cxts[i] is
+  // the context of in[i]. evaluates one by one unless overridden
+  void EvaluateBatch(const TraceContext *cxts, const SurfaceInput *in, int count,
+      SurfaceOutput *out) const;
+  // called once after properties are set before rendering. shaders
+  // can choose evaluate paths for the property values here
+  void Compile();
+  // specular shaders draw the direction a photon leaves the hit to with u
+  // in [0, 1) and return true. weight is multiplied to the photon power.
+  // photons are stored on shaders returning false
+  bool ScatterPhoton(const SurfaceInput &in, double u, Vector *dir, Color *weight) const;
+  // true if ScatterPhoton scatters. caustic photons are aimed at these
+  bool ScattersPhotons() const;
+  // true if volumes of the shader only absorb rays of the CXT_* ray context
+  // so that raymarching takes their density alone without Evaluate. shadow
+  // rays never evaluate volume shaders
+  bool IsDensityOnly(int ray_context) const;
 
 private:
   virtual void evaluate(const TraceContext &cxt,
       const SurfaceInput &in, SurfaceOutput *out) const = 0;
+  virtual bool is_opaque() const { return true; }
+  virtual float evaluate_opacity(const TraceContext &cxt, const SurfaceInput &in) const;
+  virtual void evaluate_batch(const TraceContext *cxts, const SurfaceInput *in, int count,
+      SurfaceOutput *out) const;
+  virtual void compile() {}
+  virtual bool scatter_photon(const SurfaceInput &in, double u,
+      Vector *dir, Color *weight) const { return false; }
+  virtual bool scatters_photons() const { return false; }
+  virtual bool is_density_only(int ray_context) const { return false; }
 };
 
 } // namespace xxx
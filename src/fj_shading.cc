@@ -6,15 +6,26 @@
 #include "fj_object_instance.h"
 #include "fj_intersection.h"
 #include "fj_object_group.h"
+#include "fj_memory_arena.h"
 #include "fj_accelerator.h"
 #include "fj_interval.h"
 #include "fj_numeric.h"
+#include "fj_random.h"
+#include "fj_ray_stats.h"
+#include "fj_render_metrics.h"
 #include "fj_texture.h"
 #include "fj_shader.h"
 #include "fj_volume.h"
+#include "fj_radiance_cache.h"
+#include "fj_transmittance_cache.h"
+#include "fj_photon_map.h"
+#include "fj_light_tree.h"
 #include "fj_light.h"
+#include "fj_tile_coverage.h"
 #include "fj_ray.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdio>
 #include <cfloat>
@@ -22,10 +33,51 @@
 
 namespace fj {
 
+// spread of diffuse rays. wide enough to read coarse levels of textures
+static const double DIFFUSE_RAY_SPREAD = .3;
 static const Color NO_SHADER_COLOR(.5, 1., 0.);
-
+// raymarch steps grow up to this many times the step size
+// while the opacity of a step stays under the limit
+static const int MAX_STEP_SCALE = 4;
+static const float MAX_STEP_OPACITY = .01;
+// volume samples a shadow ray takes at a time
+static const int SHADOW_SAMPLE_COUNT = 4;
+// ratio tracking plays russian roulette under this transmittance
+static const double ROULETTE_TRANSMITTANCE = .1;
+// moves tracking forward on the border of bricks
+static const double MIN_TRACKING_DISTANCE = 1e-6;
+
+// slots of the last occluders of shadow rays on a thread. lights sharing
+// a slot replace the occluder of each other
+static const int SHADOW_OCCLUDER_SLOT_COUNT = 64;
+
+// the last opaque primitive blocking shadow rays toward the light. shadow
+// rays of nearby points toward the light are likely blocked by it again
+class ShadowOccluder {
+public:
+  ShadowOccluder() : epoch(0), light(NULL), target(NULL), object(NULL), prim_id(0) {}
+  ~ShadowOccluder() {}
+
+  // occluders of earlier epochs are stale
+  int64_t epoch;
+  const Light *light;
+  const ObjectGroup *target;
+  const ObjectInstance *object;
+  Index prim_id;
+};
+
+static std::atomic<int64_t> shadow_occluder_epoch(1);
+
+static_assert(CXT_REFRACT_RAY + 1 == RAY_STATS_CONTEXT_COUNT,
+    "RayStats should have a counter for each ray context");
+
+static void record_object(const TraceContext *cxt, const ObjectInstance *object);
+static void count_ray(const TraceContext *cxt);
+static void count_march_steps(const TraceContext *cxt, int count);
 static int has_reached_bounce_limit(const TraceContext *cxt);
 static int shadow_ray_has_reached_opcity_limit(const TraceContext *cxt, float opac);
+static int trace_shadow_layers(const TraceContext *cxt, const Accelerator *acc,
+    const Ray &ray, Color4 *out_rgba, double *t_hit);
 static void setup_ray(const Vector *ray_orig, const Vector *ray_dir,
     double ray_tmin, double ray_tmax,
     Ray *ray);
@@ -33,11 +85,37 @@ static void setup_surface_input(
     const Intersection *isect,
     const Ray *ray,
     SurfaceInput *in);
+static TraceContext hit_context(const TraceContext *cxt, Real t_hit);
+static Ray target_ray(const TraceContext *cxt, const Ray &ray);
+static void setup_footprint(const TraceContext *hit_cxt, SurfaceInput *in);
 
 static int trace_surface(const TraceContext *cxt, const Ray &ray,
     Color4 *out_rgba, double *t_hit);
+static int occlude_surface(const TraceContext *cxt, const Ray &target,
+    Color4 *out_rgba, double *t_hit, ShadowOccluder *occluder);
+static int trace_shadow(const TraceContext *shad_cxt, const Light *light,
+    const Vector &Ps, const Vector &Ln, double distance, Color4 *out_rgba);
+static int illuminate_sample(const TraceContext *cxt, const LightSample *sample,
+    const Vector *Ps, const Vector *axis, double angle, const SurfaceInput *in,
+    float known_visibility, float *visibility, LightOutput *out);
+static void shade_surface(const TraceContext *cxt, const Ray &ray,
+    const Intersection &isect, Color4 *out_rgba, double *t_hit);
+static void surface_output_to_color(SurfaceOutput *out, Color4 *out_rgba);
+static void store_aov(const Intersection &isect, const SurfaceInput &in,
+    const SurfaceOutput &out, AOVSample *aov);
+static int composite_volume(const TraceContext *cxt, Ray &ray,
+    int hit_surface, const Color4 &surface_color, double t_hit, Color4 *out_rgba);
+static float max_volume_density(const IntervalList &intervals, const Ray &ray,
+    Real t, Real time, Real *t_exit);
+static double ratio_tracking_transmittance(const TraceContext *cxt, const Ray *ray,
+    const IntervalList &intervals);
 static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
     Color4 *out_rgba);
+static double volume_filter_width(const TraceContext *cxt, double t, double t_delta);
+static bool use_transmittance_cache(const TraceContext *shad_cxt, const Light *light,
+    const Vector &Ps, const Vector &Ln, double distance);
+static int trace_cached_shadow(const TraceContext *shad_cxt, const Light *light,
+    const Vector &Ps, const Vector &Ln, double distance, Color4 *out_rgba);
 
 void SlFaceforward(const Vector *I, const Vector *N, Vector *Nf)
 {
@@ -69,7 +147,8 @@ double SlFresnel(const Vector *I, const Vector *N, double ior)
   k2 = .0;
   F0 = ((1.-eta) * (1.-eta) + k2) / ((1.+eta) * (1.+eta) + k2);
 
-  return F0 + (1. - F0) * pow(1. - cos, 5.);
+  const double c = 1. - cos;
+  return F0 + (1. - F0) * (c * c) * (c * c) * c;
 }
 
 double SlPhong(const Vector *I, const Vector *N, const Vector *L,
@@ -82,7 +161,7 @@ double SlPhong(const Vector *I, const Vector *N, const Vector *L,
 
   spec = Dot(*I, Lrefl);
   spec = Max(0., spec);
-  spec = pow(spec, 1/Max(.001, roughness));
+  spec = Pow(spec, 1/Max(.001, roughness));
 
   return spec;
 }
@@ -143,9 +222,7 @@ int SlTrace(const TraceContext *cxt,
 {
   Ray ray;
   Color4 surface_color;
-  Color4 volume_color;
   int hit_surface = 0;
-  int hit_volume = 0;
 
   out_rgba->r = 0;
   out_rgba->g = 0;
@@ -156,6 +233,7 @@ int SlTrace(const TraceContext *cxt,
   }
 
   setup_ray(ray_orig, ray_dir, ray_tmin, ray_tmax, &ray);
+  count_ray(cxt);
 
   hit_surface = trace_surface(cxt, ray, &surface_color, t_hit);
 
@@ -164,18 +242,128 @@ int SlTrace(const TraceContext *cxt,
     return 1;
   }
 
-  if (hit_surface) {
-    ray.tmax = *t_hit;
+  return composite_volume(cxt, ray, hit_surface, surface_color, *t_hit, out_rgba);
+}
+
+int SlIntersectSurface(const TraceContext *cxt, const Ray &ray, Intersection *isect)
+{
+  const Accelerator *acc = cxt->trace_target->GetSurfaceAccelerator();
+  return acc->Intersect(target_ray(cxt, ray), cxt->time, isect);
+}
+
+unsigned int SlIntersectSurfacePacket(const TraceContext *cxt,
+    const Ray *rays, const Real *times, int count, Intersection *isects)
+{
+  const Accelerator *acc = cxt->trace_target->GetSurfaceAccelerator();
+  Ray targets[RAY_PACKET_SIZE];
+  for (int i = 0; i < count; i++) {
+    targets[i] = target_ray(cxt, rays[i]);
   }
+  return acc->IntersectPacket(targets, times, count, isects);
+}
 
-  hit_volume = raymarch_volume(cxt, &ray, &volume_color);
+void SlIntersectSurfaceStream(const TraceContext *cxt,
+    const Ray *rays, const Real *times, int count, Intersection *isects, int *hits)
+{
+  const Accelerator *acc = cxt->trace_target->GetSurfaceAccelerator();
 
-  out_rgba->r = volume_color.r + surface_color.r * (1 - volume_color.a);
-  out_rgba->g = volume_color.g + surface_color.g * (1 - volume_color.a);
-  out_rgba->b = volume_color.b + surface_color.b * (1 - volume_color.a);
-  out_rgba->a = volume_color.a + surface_color.a * (1 - volume_color.a);
+  for (int begin = 0; begin < count; begin += RAY_PACKET_SIZE) {
+    const int packet_size = std::min(RAY_PACKET_SIZE, count - begin);
+    Ray targets[RAY_PACKET_SIZE];
+    for (int i = 0; i < packet_size; i++) {
+      targets[i] = target_ray(cxt, rays[begin + i]);
+    }
+    const unsigned int hit_mask = acc->IntersectPacket(targets, &times[begin],
+        packet_size, &isects[begin]);
 
-  return hit_surface || hit_volume;
+    for (int i = 0; i < packet_size; i++) {
+      hits[begin + i] = (hit_mask >> i) & 1;
+    }
+  }
+}
+
+int SlTraceHit(const TraceContext *cxt, const Ray &ray, const Intersection *isect,
+    Color4 *out_rgba, double *t_hit)
+{
+  Ray volume_ray = ray;
+  Color4 surface_color;
+  int hit_surface = 0;
+
+  out_rgba->r = 0;
+  out_rgba->g = 0;
+  out_rgba->b = 0;
+  out_rgba->a = 0;
+  if (has_reached_bounce_limit(cxt)) {
+    return 0;
+  }
+
+  count_ray(cxt);
+
+  if (isect != NULL) {
+    shade_surface(cxt, ray, *isect, &surface_color, t_hit);
+    hit_surface = 1;
+  }
+
+  if (shadow_ray_has_reached_opcity_limit(cxt, surface_color.a)) {
+    *out_rgba = surface_color;
+    return 1;
+  }
+
+  return composite_volume(cxt, volume_ray, hit_surface, surface_color, *t_hit, out_rgba);
+}
+
+void SlTraceHitBatch(const TraceContext *cxts, const Ray *rays,
+    const Intersection *isects, int count, Color4 *out_rgba, double *t_hit)
+{
+  TraceContext hit_cxts[SHADE_BATCH_SIZE];
+  SurfaceInput in[SHADE_BATCH_SIZE];
+  SurfaceOutput out[SHADE_BATCH_SIZE];
+
+  if (count <= 0) {
+    return;
+  }
+  if (has_reached_bounce_limit(&cxts[0])) {
+    for (int i = 0; i < count; i++) {
+      out_rgba[i] = Color4();
+    }
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    record_object(&cxts[i], isects[i].object);
+    hit_cxts[i] = hit_context(&cxts[i], isects[i].t_hit);
+    setup_surface_input(&isects[i], &rays[i], &in[i]);
+    setup_footprint(&hit_cxts[i], &in[i]);
+  }
+
+  const Shader *shader = isects[0].GetShader();
+  if (shader != NULL) {
+    shader->EvaluateBatch(hit_cxts, in, count, out);
+  } else {
+    for (int i = 0; i < count; i++) {
+      out[i].Cs = NO_SHADER_COLOR;
+      out[i].Os = 1;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    const TraceContext *cxt = &cxts[i];
+    Ray volume_ray = rays[i];
+    Color4 surface_color;
+
+    count_ray(cxt);
+    if (cxt->aov != NULL) {
+      store_aov(isects[i], in[i], out[i], cxt->aov);
+    }
+    surface_output_to_color(&out[i], &surface_color);
+    t_hit[i] = isects[i].t_hit;
+
+    if (shadow_ray_has_reached_opcity_limit(cxt, surface_color.a)) {
+      out_rgba[i] = surface_color;
+      continue;
+    }
+    composite_volume(cxt, volume_ray, 1, surface_color, t_hit[i], &out_rgba[i]);
+  }
 }
 
 int SlSurfaceRayIntersect(const TraceContext *cxt,
@@ -190,9 +378,10 @@ int SlSurfaceRayIntersect(const TraceContext *cxt,
 
   setup_ray(ray_orig, ray_dir, ray_tmin, ray_tmax, &ray);
   acc = cxt->trace_target->GetSurfaceAccelerator();
-  hit = acc->Intersect(ray, cxt->time, &isect);
+  hit = acc->Intersect(target_ray(cxt, ray), cxt->time, &isect);
 
   if (hit) {
+    record_object(cxt, isect.object);
     *P_hit = isect.P;
     *N_hit = isect.N;
     *t_hit = isect.t_hit;
@@ -201,6 +390,11 @@ int SlSurfaceRayIntersect(const TraceContext *cxt,
   return hit;
 }
 
+void SlGetSurfaceBounds(const TraceContext *cxt, Box *bounds)
+{
+  *bounds = cxt->trace_target->GetSurfaceAccelerator()->GetBounds();
+}
+
 TraceContext SlCameraContext(const ObjectGroup *target)
 {
   TraceContext cxt;
@@ -223,6 +417,21 @@ TraceContext SlCameraContext(const ObjectGroup *target)
   cxt.raymarch_diffuse_step = .05;
   cxt.raymarch_reflect_step = .05;
   cxt.raymarch_refract_step = .05;
+  cxt.shadow_transmittance = SHADOW_TRANSMITTANCE_RAYMARCH;
+  cxt.rng = NULL;
+  cxt.sequence = NULL;
+  cxt.light_tree = NULL;
+  cxt.sampled_light_count = 0;
+  cxt.throughput = 1;
+  cxt.throughput_threshold = 0;
+  cxt.radiance_cache = NULL;
+  cxt.transmittance_cache = NULL;
+  cxt.photon_map = NULL;
+  cxt.ray_width = 0;
+  cxt.ray_spread = 0;
+  cxt.aov = NULL;
+  cxt.object_recorder = NULL;
+  cxt.cost = NULL;
 
   return cxt;
 }
@@ -235,6 +444,8 @@ TraceContext SlDiffuseContext(const TraceContext *cxt,
   diff_cxt.diffuse_depth++;
   diff_cxt.ray_context = CXT_DIFFUSE_RAY;
   diff_cxt.trace_target = obj->GetReflectTarget();
+  // diffuse rays are spread over the hemisphere and need only coarse data
+  diff_cxt.ray_spread = Max(diff_cxt.ray_spread, DIFFUSE_RAY_SPREAD);
 
   return diff_cxt;
 }
@@ -263,6 +474,22 @@ TraceContext SlRefractContext(const TraceContext *cxt,
   return refr_cxt;
 }
 
+float SlWeightRay(TraceContext *cxt, const Color &weight)
+{
+  cxt->throughput *= Max(weight.r, Max(weight.g, weight.b));
+  if (cxt->throughput >= cxt->throughput_threshold) {
+    return 1;
+  }
+
+  // russian roulette
+  const float continue_prob = cxt->throughput / cxt->throughput_threshold;
+  if (SlGetRandom(cxt).NextFloat01() >= continue_prob) {
+    return 0;
+  }
+  cxt->throughput = cxt->throughput_threshold;
+  return 1 / continue_prob;
+}
+
 TraceContext SlShadowContext(const TraceContext *cxt,
     const ObjectInstance *obj)
 {
@@ -288,14 +515,154 @@ TraceContext SlSelfHitContext(const TraceContext *cxt,
   return self_cxt;
 }
 
+XorShift &SlGetRandom(const TraceContext *cxt)
+{
+  static thread_local XorShift thread_rng;
+
+  if (cxt->rng == NULL) {
+    return thread_rng;
+  }
+  return *cxt->rng;
+}
+
+SampleSequence &SlGetSampleSequence(const TraceContext *cxt)
+{
+  static thread_local SampleSequence thread_sequence;
+
+  if (cxt->sequence == NULL) {
+    thread_sequence.Start(SAMPLE_SEQUENCE_RANDOM, 0, 0, &SlGetRandom(cxt));
+    return thread_sequence;
+  }
+  return *cxt->sequence;
+}
+
+int SlLookupRadianceCache(const TraceContext *cxt,
+    const Vector *P, const Vector *N, Color *radiance)
+{
+  if (cxt->radiance_cache == NULL) {
+    return 0;
+  }
+  return cxt->radiance_cache->Lookup(*P, *N, cxt->diffuse_depth, radiance);
+}
+
+void SlAddRadianceCache(const TraceContext *cxt,
+    const Vector *P, const Vector *N, const Color *radiance)
+{
+  if (cxt->radiance_cache == NULL) {
+    return;
+  }
+  cxt->radiance_cache->Add(*P, *N, cxt->diffuse_depth, *radiance);
+}
+
+int SlLookupCaustics(const TraceContext *cxt,
+    const Vector *P, const Vector *N, Color *irradiance)
+{
+  if (cxt->photon_map == NULL) {
+    return 0;
+  }
+  return cxt->photon_map->Lookup(*P, *N, irradiance);
+}
+
 int SlGetLightCount(const SurfaceInput *in)
 {
   return in->shaded_object->GetLightCount();
 }
 
+// irradiance around the axis as if it arrived along the axis so that
+// diffuse shading sums it as one light. ambient occlusion of one shadow
+// ray in a cosine weighted direction if the light asks for it
+static int illuminate_irradiance(const TraceContext *cxt, const LightSample *sample,
+    const Vector *Ps, const Vector *axis, const SurfaceInput *in, LightOutput *out)
+{
+  const Vector N = Normalize(*axis);
+  out->Ln = N;
+  out->distance = FLT_MAX;
+
+  if (cxt->ray_context == CXT_SHADOW_RAY) {
+    return 0;
+  }
+
+  Color light_color = sample->light->Irradiance(N) * sample->weight;
+
+  if (cxt->cast_shadow && sample->light->GetSHIrradiance() == SH_IRRADIANCE_OCCLUDED &&
+      (N.x != 0 || N.y != 0 || N.z != 0)) {
+    Vector u = Abs(N.x) > .001 ? Vector(0, 1, 0) : Vector(1, 0, 0);
+    u = Normalize(Cross(u, N));
+    const Vector v = Cross(N, u);
+
+    const Vector2 uv = SlGetSampleSequence(cxt).Next2D();
+    const Real phi = 2. * PI * uv[0];
+    const Real r = Sqrt(uv[1]);
+    const Vector dir = Normalize(u * (Cos(phi) * r) + v * (Sin(phi) * r) +
+        N * Sqrt(1. - uv[1]));
+
+    const TraceContext shad_cxt = SlShadowContext(cxt, in->shaded_object);
+    Color4 C_occl;
+    double t_hit = FLT_MAX;
+    if (SlTrace(&shad_cxt, Ps, &dir, .0001, FLT_MAX, &C_occl, &t_hit)) {
+      light_color *= 1 - C_occl.a;
+    }
+  }
+
+  out->Cl = light_color;
+  return 1;
+}
+
 int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
     const Vector *Ps, const Vector *axis, double angle,
     const SurfaceInput *in, LightOutput *out)
+{
+  return illuminate_sample(cxt, sample, Ps, axis, angle, in, -1, NULL, out);
+}
+
+int SlIlluminanceList(const TraceContext *cxt, const LightSample *samples, int count,
+    const Vector *Ps, const Vector *axis, double angle,
+    const SurfaceInput *in, LightOutput *outs)
+{
+  const int NPROBES = Max(LIGHT_PROBE_SAMPLE_COUNT, count / 4);
+  int nlit = 0;
+
+  if (count < 2 * NPROBES || !samples[0].light->IsAdaptiveSampling() ||
+      !cxt->cast_shadow || cxt->ray_context == CXT_SHADOW_RAY) {
+    for (int i = 0; i < count; i++) {
+      nlit += SlIlluminance(cxt, &samples[i], Ps, axis, angle, in, &outs[i]);
+    }
+    return nlit;
+  }
+
+  // visibility of the first probes the light reaches. the others are fully
+  // lit or fully shadowed too unless in penumbra
+  float min_visibility = 1;
+  float max_visibility = 0;
+  int nprobes = 0;
+  for (int i = 0; i < count; i++) {
+    if (nprobes < NPROBES) {
+      float visibility = -1;
+      nlit += illuminate_sample(cxt, &samples[i], Ps, axis, angle, in, -1, &visibility,
+          &outs[i]);
+      if (visibility >= 0) {
+        min_visibility = Min(min_visibility, visibility);
+        max_visibility = Max(max_visibility, visibility);
+        nprobes++;
+      }
+      continue;
+    }
+
+    const bool agree = min_visibility == max_visibility &&
+        (min_visibility == 0 || min_visibility == 1);
+    nlit += illuminate_sample(cxt, &samples[i], Ps, axis, angle, in,
+        agree ? min_visibility : -1, NULL, &outs[i]);
+  }
+
+  return nlit;
+}
+
+// visibility of the light is known_visibility if it's not negative instead
+// of tracing the shadow ray. the one found is written to visibility if the
+// light is not culled
+static int illuminate_sample(const TraceContext *cxt, const LightSample *sample,
+    const Vector *Ps, const Vector *axis, double angle, const SurfaceInput *in,
+    float known_visibility, float *visibility, LightOutput *out)
 {
   double cosangle = 0.;
   Vector nml_axis;
@@ -305,6 +672,11 @@ int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
   out->Cl.g = 0;
   out->Cl.b = 0;
 
+  // lights projected to spherical harmonics
+  if (sample->light->HasIrradiance()) {
+    return illuminate_irradiance(cxt, sample, Ps, axis, in, out);
+  }
+
   out->Ln.x = sample->P.x - Ps->x;
   out->Ln.y = sample->P.y - Ps->y;
   out->Ln.z = sample->P.z - Ps->z;
@@ -320,11 +692,11 @@ int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
   nml_axis = *axis;
   nml_axis = Normalize(nml_axis);
   cosangle = Dot(nml_axis, out->Ln);
-  if (cosangle < cos(angle)) {
+  if (cosangle < Cos(angle)) {
     return 0;
   }
 
-  light_color = sample->light->Illuminate(*sample, *Ps);
+  light_color = sample->light->Illuminate(*sample, *Ps) * sample->weight;
   if (light_color.r < .0001 &&
     light_color.g < .0001 &&
     light_color.b < .0001) {
@@ -336,18 +708,28 @@ int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
   }
 
   if (cxt->cast_shadow) {
-    TraceContext shad_cxt;
-    Color4 C_occl;
-    double t_hit = FLT_MAX;
-    int hit = 0;
-
-    shad_cxt = SlShadowContext(cxt, in->shaded_object);
-    hit = SlTrace(&shad_cxt, Ps, &out->Ln, .0001, out->distance, &C_occl, &t_hit);
-
-    if (hit) {
-      // return 0;
+    float alpha_complement = known_visibility;
+
+    if (alpha_complement < 0) {
+      TraceContext shad_cxt;
+      Color4 C_occl;
+      int hit = 0;
+
+      shad_cxt = SlShadowContext(cxt, in->shaded_object);
+      if (use_transmittance_cache(&shad_cxt, sample->light, *Ps, out->Ln, out->distance)) {
+        hit = trace_cached_shadow(&shad_cxt, sample->light, *Ps, out->Ln, out->distance,
+            &C_occl);
+      } else {
+        hit = trace_shadow(&shad_cxt, sample->light, *Ps, out->Ln, out->distance, &C_occl);
+      }
       // TODO handle light_color for shadow ray
-      const float alpha_complement = 1 - C_occl.a;
+      alpha_complement = hit ? 1 - C_occl.a : 1;
+    }
+    if (visibility != NULL) {
+      *visibility = alpha_complement;
+    }
+
+    if (alpha_complement < 1) {
       light_color.r *= alpha_complement;
       light_color.g *= alpha_complement;
       light_color.b *= alpha_complement;
@@ -358,6 +740,11 @@ int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
   return 1;
 }
 
+void SlClearShadowOccluders()
+{
+  shadow_occluder_epoch++;
+}
+
   // TODO temp solution compute before rendering
 int SlGetLightSampleCount(const SurfaceInput *in)
 {
@@ -377,7 +764,60 @@ int SlGetLightSampleCount(const SurfaceInput *in)
   return nsamples;
 }
 
-LightSample *SlNewLightSamples(const SurfaceInput *in)
+int SlGetLightSelectionCount(const TraceContext *cxt, const SurfaceInput *in)
+{
+  if (cxt->light_tree != NULL && !cxt->light_tree->IsEmpty()) {
+    return cxt->sampled_light_count;
+  }
+  return SlGetLightCount(in);
+}
+
+MemoryArena &SlGetScratchArena(const TraceContext *cxt)
+{
+  return MemoryArenaGetThreadLocal();
+}
+
+const LightSample *SlGetLightSamples(const TraceContext *cxt,
+    const SurfaceInput *in, int light_index, int *sample_count)
+{
+  if (cxt->light_tree != NULL && !cxt->light_tree->IsEmpty()) {
+    SampleSequence &sequence = SlGetSampleSequence(cxt);
+    Real pdf = 0;
+    const Light *light = cxt->light_tree->Sample(in->P, sequence.Next1D(), &pdf);
+    if (light == NULL || pdf <= 0) {
+      *sample_count = 0;
+      return NULL;
+    }
+
+    int NSAMPLES = light->GetSampleCount();
+    const LightSample *set = NULL;
+    if (light->HasSamplesAt()) {
+      set = light->GetSamplesAt(sequence, in->P, &NSAMPLES);
+    } else {
+      set = light->GetSampleSet(sequence);
+    }
+    LightSample *samples = SlGetScratchArena(cxt).NewArray<LightSample>(NSAMPLES);
+    const float weight = 1. / (pdf * cxt->sampled_light_count);
+
+    for (int i = 0; i < NSAMPLES; i++) {
+      samples[i] = set[i];
+      samples[i].weight *= weight;
+    }
+    *sample_count = NSAMPLES;
+    return samples;
+  }
+
+  const Light **lights = in->shaded_object->GetLightList();
+  const Light *light = lights[light_index];
+
+  if (light->HasSamplesAt()) {
+    return light->GetSamplesAt(SlGetSampleSequence(cxt), in->P, sample_count);
+  }
+  *sample_count = light->GetSampleCount();
+  return light->GetSampleSet(SlGetSampleSequence(cxt));
+}
+
+LightSample *SlNewLightSamples(const TraceContext *cxt, const SurfaceInput *in)
 {
   const Light **lights = in->shaded_object->GetLightList();
   const int nlights = SlGetLightCount(in);
@@ -392,11 +832,13 @@ LightSample *SlNewLightSamples(const SurfaceInput *in)
     return NULL;
   }
 
-  samples = new LightSample[nsamples];
+  // a temporary of this shading. freed by SlFreeLightSamples or arena reset
+  samples = SlGetScratchArena(cxt).NewArray<LightSample>(nsamples);
   sample = samples;
   for (i = 0; i < nlights; i++) {
     const int nsmp = lights[i]->GetSampleCount();
-    lights[i]->GetSamples(sample, nsmp);
+    const LightSample *src = lights[i]->GetSampleSet(SlGetSampleSequence(cxt));
+    std::copy(src, src + nsmp, sample);
     sample += nsmp;
   }
 
@@ -407,7 +849,7 @@ void SlFreeLightSamples(LightSample * samples)
 {
   if (samples == NULL)
     return;
-  delete [] samples;
+  MemoryArenaGetThreadLocal().Free(samples);
 }
 
 #define MUL(a,val) do { \
@@ -417,7 +859,7 @@ void SlFreeLightSamples(LightSample * samples)
   } while(0)
 void SlBumpMapping(const Texture *bump_map,
     const Vector *dPdu, const Vector *dPdv,
-    const TexCoord *texcoord, double amplitude,
+    const TexCoord *texcoord, float footprint_du, float footprint_dv, double amplitude,
     const Vector *N, Vector *N_bump)
 {
   Color4 C_tex0(0, 0, 0, 1);
@@ -426,6 +868,7 @@ void SlBumpMapping(const Texture *bump_map,
   Vector N_dPdv;
   float Bu, Bv;
   float du, dv;
+  float step_u, step_v;
   float val0, val1;
   const int xres = bump_map->GetWidth();
   const int yres = bump_map->GetHeight();
@@ -436,20 +879,32 @@ void SlBumpMapping(const Texture *bump_map,
 
   du = 1. / xres;
   dv = 1. / yres;
-
-  // Bu = B(u - du, v) - B(v + du, v) / (2 * du)
-  C_tex0 = bump_map->Lookup(texcoord->u - du, texcoord->v);
-  C_tex1 = bump_map->Lookup(texcoord->u + du, texcoord->v);
-  val0 = Luminance4(C_tex0);
-  val1 = Luminance4(C_tex1);
-  Bu = (val0 - val1) / (2 * du);
-
-  // Bv = B(u, v - dv) - B(v, v + dv) / (2 * dv)
-  C_tex0 = bump_map->Lookup(texcoord->u, texcoord->v - dv);
-  C_tex1 = bump_map->Lookup(texcoord->u, texcoord->v + dv);
-  val0 = Luminance4(C_tex0);
-  val1 = Luminance4(C_tex1);
-  Bv = (val0 - val1) / (2 * dv);
+  // differences over the footprint. Bu and Bv are of texels of level 0
+  step_u = Max(du, Abs(footprint_du));
+  step_v = Max(dv, Abs(footprint_dv));
+
+  float dhdu = 0;
+  float dhdv = 0;
+  if (bump_map->LookupBumpDerivatives(texcoord->u, texcoord->v,
+        footprint_du, footprint_dv, &dhdu, &dhdv) == 0) {
+    // baked in the mipmap
+    Bu = -dhdu;
+    Bv = -dhdv;
+  } else {
+    // Bu = B(u - du, v) - B(v + du, v) / (2 * du)
+    C_tex0 = bump_map->Lookup(texcoord->u - step_u, texcoord->v, footprint_du, footprint_dv);
+    C_tex1 = bump_map->Lookup(texcoord->u + step_u, texcoord->v, footprint_du, footprint_dv);
+    val0 = Luminance4(C_tex0);
+    val1 = Luminance4(C_tex1);
+    Bu = (val0 - val1) / (2 * step_u);
+
+    // Bv = B(u, v - dv) - B(v, v + dv) / (2 * dv)
+    C_tex0 = bump_map->Lookup(texcoord->u, texcoord->v - step_v, footprint_du, footprint_dv);
+    C_tex1 = bump_map->Lookup(texcoord->u, texcoord->v + step_v, footprint_du, footprint_dv);
+    val0 = Luminance4(C_tex0);
+    val1 = Luminance4(C_tex1);
+    Bv = (val0 - val1) / (2 * step_v);
+  }
 
   // N ~= N + Bv(N x Pu) + Bu(N x Pv)
   N_dPdu = Cross(*N, *dPdu);
@@ -464,6 +919,29 @@ void SlBumpMapping(const Texture *bump_map,
 }
 #undef MUL
 
+static void record_object(const TraceContext *cxt, const ObjectInstance *object)
+{
+  if (cxt->object_recorder != NULL) {
+    cxt->object_recorder->Record(object);
+  }
+}
+
+static void count_ray(const TraceContext *cxt)
+{
+  FJ_RAY_STATS_ADD(ray_count[cxt->ray_context], 1);
+  MetricsCountRay(cxt->ray_context);
+  if (cxt->cost != NULL) {
+    cxt->cost->ray_count[cxt->ray_context]++;
+  }
+}
+
+static void count_march_steps(const TraceContext *cxt, int count)
+{
+  if (cxt->cost != NULL) {
+    cxt->cost->march_step_count += count;
+  }
+}
+
 static int has_reached_bounce_limit(const TraceContext *cxt)
 {
   int current_depth = 0;
@@ -504,10 +982,27 @@ static void setup_ray(const Vector *ray_orig, const Vector *ray_dir,
 {
   ray->orig = *ray_orig;
   ray->dir = *ray_dir;
-  ray->tmin = ray_tmin;
+  ray->tmin = Max(ray_tmin, RayOriginOffset(*ray_orig));
   ray->tmax = ray_tmax;
 }
 
+// rays carry the bit of their kind and the bits of the group traced so that
+// a tree shared by groups only hits instances in the group visible to them
+static Ray target_ray(const TraceContext *cxt, const Ray &ray)
+{
+  // in the order of CXT_* ray contexts
+  static const unsigned int KIND_BITS[] = {
+    GROUP_MASK_CAMERA,
+    GROUP_MASK_SHADOW,
+    GROUP_MASK_REFLECT,
+    GROUP_MASK_REFLECT,
+    GROUP_MASK_REFRACT
+  };
+  Ray target = ray;
+  target.group_mask = KIND_BITS[cxt->ray_context] | cxt->trace_target->GetRayMask();
+  return target;
+}
+
 static void setup_surface_input(
     const Intersection *isect,
     const Ray *ray,
@@ -522,6 +1017,29 @@ static void setup_surface_input(
 
   in->dPdu = isect->dPdu;
   in->dPdv = isect->dPdv;
+
+  in->du = 0;
+  in->dv = 0;
+}
+
+static TraceContext hit_context(const TraceContext *cxt, Real t_hit)
+{
+  TraceContext hit_cxt = *cxt;
+
+  hit_cxt.ray_width = cxt->ray_width + cxt->ray_spread * t_hit;
+  // rays traced by the shader don't overwrite aovs of this hit
+  hit_cxt.aov = NULL;
+  return hit_cxt;
+}
+
+// texture space size of the ray width at the hit
+static void setup_footprint(const TraceContext *hit_cxt, SurfaceInput *in)
+{
+  const Real len_u = Length(in->dPdu);
+  const Real len_v = Length(in->dPdv);
+
+  in->du = len_u > 0 ? hit_cxt->ray_width / len_u : 0;
+  in->dv = len_v > 0 ? hit_cxt->ray_width / len_v : 0;
 }
 
 static int trace_surface(const TraceContext *cxt, const Ray &ray,
@@ -536,41 +1054,323 @@ static int trace_surface(const TraceContext *cxt, const Ray &ray,
   out_rgba->b = 0;
   out_rgba->a = 0;
   acc = cxt->trace_target->GetSurfaceAccelerator();
-  hit = acc->Intersect(ray, cxt->time, &isect);
+  const Ray target = target_ray(cxt, ray);
 
-  // TODO handle shadow ray for surface geometry
-#if 0
   if (cxt->ray_context == CXT_SHADOW_RAY) {
-    return hit;
+    return occlude_surface(cxt, target, out_rgba, t_hit, NULL);
   }
-#endif
+
+  hit = acc->Intersect(target, cxt->time, &isect);
 
   if (hit) {
-    SurfaceInput in;
-    SurfaceOutput out;
+    shade_surface(cxt, ray, isect, out_rgba, t_hit);
+  }
+
+  return hit;
+}
 
-    setup_surface_input(&isect, &ray, &in);
+// any opaque hit blocks the light. the closest hit is only needed when the
+// first hit found is on a transparent shader. the opaque hit is written to
+// occluder if not NULL
+static int occlude_surface(const TraceContext *cxt, const Ray &target,
+    Color4 *out_rgba, double *t_hit, ShadowOccluder *occluder)
+{
+  const Accelerator *acc = cxt->trace_target->GetSurfaceAccelerator();
+  Intersection isect;
 
-    const Shader *shader = isect.GetShader();
-    if (shader != NULL) {
-      shader->Evaluate(*cxt, in, &out);
-    } else {
-      out.Cs = NO_SHADER_COLOR;
-      out.Os = 1;
+  if (!acc->Occlude(target, cxt->time, &isect)) {
+    return 0;
+  }
+  record_object(cxt, isect.object);
+
+  const Shader *shader = isect.GetShader();
+  if (shader == NULL || shader->IsOpaque()) {
+    out_rgba->a = 1;
+    *t_hit = isect.t_hit;
+    if (occluder != NULL && isect.object != NULL) {
+      occluder->object = isect.object;
+      occluder->prim_id = isect.prim_id;
     }
+    return 1;
+  }
 
-    out.Os = Clamp(out.Os, 0, 1);
-    out_rgba->r = out.Cs.r;
-    out_rgba->g = out.Cs.g;
-    out_rgba->b = out.Cs.b;
-    out_rgba->a = out.Os;
+  return trace_shadow_layers(cxt, acc, target, out_rgba, t_hit);
+}
 
-    *t_hit = isect.t_hit;
+static ShadowOccluder &get_shadow_occluder(const Light *light)
+{
+  static thread_local ShadowOccluder thread_occluders[SHADOW_OCCLUDER_SLOT_COUNT];
+
+  const std::size_t slot = reinterpret_cast<std::size_t>(light) / sizeof(Light *);
+  return thread_occluders[slot % SHADOW_OCCLUDER_SLOT_COUNT];
+}
+
+// SlTrace of the shadow ray testing the last occluder toward the light
+// first. any opaque hit blocks the light so the result is the same
+static int trace_shadow(const TraceContext *shad_cxt, const Light *light,
+    const Vector &Ps, const Vector &Ln, double distance, Color4 *out_rgba)
+{
+  Ray ray;
+  Color4 surface_color;
+  double t_hit = FLT_MAX;
+
+  *out_rgba = Color4();
+  if (has_reached_bounce_limit(shad_cxt)) {
+    return 0;
+  }
+
+  setup_ray(&Ps, &Ln, .0001, distance, &ray);
+  count_ray(shad_cxt);
+
+  const Ray target = target_ray(shad_cxt, ray);
+  ShadowOccluder &occluder = get_shadow_occluder(light);
+  const int64_t epoch = shadow_occluder_epoch.load(std::memory_order_relaxed);
+  int hit_surface = 0;
+
+  if (occluder.epoch == epoch &&
+      occluder.light == light && occluder.target == shad_cxt->trace_target) {
+    const ObjectInstance *obj = occluder.object;
+    Intersection isect;
+
+    if (GroupMaskHits(obj->GetGroupMask(), target.group_mask) &&
+        obj->RayOccludePrimitive(occluder.prim_id, target, shad_cxt->time, &isect)) {
+      record_object(shad_cxt, obj);
+      surface_color.a = 1;
+      t_hit = isect.t_hit;
+      hit_surface = 1;
+    }
+  }
+
+  if (!hit_surface) {
+    ShadowOccluder found;
+    hit_surface = occlude_surface(shad_cxt, target, &surface_color, &t_hit, &found);
+    if (found.object != NULL) {
+      found.epoch = epoch;
+      found.light = light;
+      found.target = shad_cxt->trace_target;
+      occluder = found;
+    }
+  }
+
+  if (shadow_ray_has_reached_opcity_limit(shad_cxt, surface_color.a)) {
+    *out_rgba = surface_color;
+    return 1;
+  }
+
+  return composite_volume(shad_cxt, ray, hit_surface, surface_color, t_hit, out_rgba);
+}
+
+// composites opacity of transparent layers along the shadow ray front to
+// back. layers are collected in one traversal for each HitList and it ends
+// when opacity reaches the threshold
+static int trace_shadow_layers(const TraceContext *cxt, const Accelerator *acc,
+    const Ray &ray, Color4 *out_rgba, double *t_hit)
+{
+  // a small step so that the last hit of a full list is not found again
+  const Real T_STEP = .0001;
+  Ray ray_tmp = ray;
+  int hit = 0;
+
+  for (;;) {
+    HitList hits;
+    if (!acc->IntersectAll(ray_tmp, cxt->time, &hits)) {
+      break;
+    }
+    if (!hit) {
+      *t_hit = hits.Get(0).t_hit;
+      hit = 1;
+    }
+
+    for (int i = 0; i < hits.GetCount(); i++) {
+      const Intersection &isect = hits.Get(i);
+      SurfaceInput in;
+      record_object(cxt, isect.object);
+      setup_surface_input(&isect, &ray, &in);
+
+      const Shader *shader = isect.GetShader();
+      const float opacity = shader != NULL ? shader->EvaluateOpacity(*cxt, in) : 1;
+      out_rgba->a += Clamp(opacity, 0, 1) * (1 - out_rgba->a);
+
+      if (out_rgba->a >= cxt->opacity_threshold) {
+        return hit;
+      }
+    }
+
+    if (!hits.IsFull()) {
+      break;
+    }
+    ray_tmp.tmin = hits.Get(hits.GetCount() - 1).t_hit + T_STEP;
   }
 
   return hit;
 }
 
+static void shade_surface(const TraceContext *cxt, const Ray &ray,
+    const Intersection &isect, Color4 *out_rgba, double *t_hit)
+{
+  SurfaceInput in;
+  SurfaceOutput out;
+
+  record_object(cxt, isect.object);
+  const TraceContext hit_cxt = hit_context(cxt, isect.t_hit);
+  setup_surface_input(&isect, &ray, &in);
+  setup_footprint(&hit_cxt, &in);
+
+  const Shader *shader = isect.GetShader();
+  if (shader != NULL) {
+    shader->Evaluate(hit_cxt, in, &out);
+  } else {
+    out.Cs = NO_SHADER_COLOR;
+    out.Os = 1;
+  }
+
+  if (cxt->aov != NULL) {
+    store_aov(isect, in, out, cxt->aov);
+  }
+  surface_output_to_color(&out, out_rgba);
+  *t_hit = isect.t_hit;
+}
+
+static void surface_output_to_color(SurfaceOutput *out, Color4 *out_rgba)
+{
+  out->Os = Clamp(out->Os, 0, 1);
+  out_rgba->r = out->Cs.r;
+  out_rgba->g = out->Cs.g;
+  out_rgba->b = out->Cs.b;
+  out_rgba->a = out->Os;
+}
+
+static void store_aov(const Intersection &isect, const SurfaceInput &in,
+    const SurfaceOutput &out, AOVSample *aov)
+{
+  aov->depth = isect.t_hit;
+  aov->N = in.N;
+  aov->albedo = out.albedo;
+  aov->direct = out.direct;
+  aov->indirect = out.Cs - out.direct;
+}
+
+// volumes in front of the surface hit over the surface color
+static int composite_volume(const TraceContext *cxt, Ray &ray,
+    int hit_surface, const Color4 &surface_color, double t_hit, Color4 *out_rgba)
+{
+  Color4 volume_color;
+  int hit_volume = 0;
+
+  if (hit_surface) {
+    ray.tmax = t_hit;
+  }
+
+  hit_volume = raymarch_volume(cxt, &ray, &volume_color);
+
+  out_rgba->r = volume_color.r + surface_color.r * (1 - volume_color.a);
+  out_rgba->g = volume_color.g + surface_color.g * (1 - volume_color.a);
+  out_rgba->b = volume_color.b + surface_color.b * (1 - volume_color.a);
+  out_rgba->a = volume_color.a + surface_color.a * (1 - volume_color.a);
+
+  return hit_surface || hit_volume;
+}
+
+// the max density of all volumes at t and the distance it holds for
+static float max_volume_density(const IntervalList &intervals, const Ray &ray,
+    Real t, Real time, Real *t_exit)
+{
+  const Vector P = RayPointAt(ray, t);
+  float max_density = 0;
+  *t_exit = REAL_MAX;
+
+  for (int i = 0; i < intervals.GetCount(); i++) {
+    const Interval &interval = intervals.Get(i);
+    Real t_next = REAL_MAX;
+    float density = 0;
+
+    if (t < interval.tmin) {
+      t_next = interval.tmin - t;
+    }
+    else if (t <= interval.tmax) {
+      density = interval.object->GetVolumeMaxDensity(P, ray.dir, time, &t_next);
+    }
+    max_density = Max(max_density, density);
+    *t_exit = Min(*t_exit, t_next);
+  }
+
+  return max_density;
+}
+
+// the same ray gets the same random numbers so renders are repeatable
+static uint32_t ray_seed(const Ray &ray)
+{
+  const double values[6] = {
+      ray.orig.x, ray.orig.y, ray.orig.z,
+      ray.dir.x, ray.dir.y, ray.dir.z};
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(values);
+
+  // FNV-1a
+  uint32_t seed = 2166136261U;
+  for (std::size_t i = 0; i < sizeof(values); i++) {
+    seed = (seed ^ bytes[i]) * 16777619U;
+  }
+  return seed;
+}
+
+// ratio tracking with the max density of each brick as the majorant.
+// collisions are sampled in every brick the ray goes through and
+// the transmittance is weighted by the ratio of null collision
+static double ratio_tracking_transmittance(const TraceContext *cxt, const Ray *ray,
+    const IntervalList &intervals)
+{
+  XorShift rng(ray_seed(*ray));
+  double transmittance = 1;
+
+  const double t_limit = Min(intervals.GetMaxT(), ray->tmax);
+  double t = Max(intervals.GetMinT(), ray->tmin);
+
+  while (t < t_limit) {
+    Real t_exit = 0;
+    const float majorant = max_volume_density(intervals, *ray, t, cxt->time, &t_exit);
+    const double t_next = Min(t + Max(t_exit, MIN_TRACKING_DISTANCE), t_limit);
+
+    if (majorant == 0) {
+      t = t_next;
+      continue;
+    }
+
+    // the majorant is the same until t_next
+    for (;;) {
+      t -= Log(1 - rng.NextFloat01()) / majorant;
+      if (t >= t_next) {
+        break;
+      }
+
+      const Vector P = RayPointAt(*ray, t);
+      const double filter_width = volume_filter_width(cxt, t, cxt->raymarch_shadow_step);
+      count_march_steps(cxt, 1);
+      float density = 0;
+      for (int i = 0; i < intervals.GetCount(); i++) {
+        const Interval &interval = intervals.Get(i);
+        VolumeSample sample;
+        if (interval.object->GetVolumeSample(P, cxt->time, filter_width, &sample)) {
+          density = Max(density, sample.density);
+        }
+      }
+      transmittance *= 1 - Clamp(density / majorant, 0, 1);
+
+      if (transmittance == 0) {
+        return 0;
+      }
+      if (transmittance < ROULETTE_TRANSMITTANCE) {
+        if (rng.NextFloat01() < .5) {
+          return 0;
+        }
+        transmittance *= 2;
+      }
+    }
+    t = t_next;
+  }
+
+  return transmittance;
+}
+
 static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
     Color4 *out_rgba)
 {
@@ -584,15 +1384,24 @@ static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
   out_rgba->a = 0;
 
   acc = cxt->trace_target->GetVolumeAccelerator();
-  hit = VolumeAccIntersect(acc, cxt->time, ray, &intervals);
+  const Ray target = target_ray(cxt, *ray);
+  hit = VolumeAccIntersect(acc, cxt->time, &target, &intervals);
 
   if (!hit) {
     return 0;
   }
+  for (int i = 0; i < intervals.GetCount(); i++) {
+    record_object(cxt, intervals.Get(i).object);
+  }
+
+  if (cxt->ray_context == CXT_SHADOW_RAY &&
+      cxt->shadow_transmittance == SHADOW_TRANSMITTANCE_RATIO_TRACKING) {
+    out_rgba->a = 1 - ratio_tracking_transmittance(cxt, ray, intervals);
+    return hit;
+  }
 
   {
     Vector P;
-    Vector ray_delta;
     double t = 0, t_start = 0, t_delta = 0, t_limit = 0;
     const float opacity_threshold = cxt->opacity_threshold;
 
@@ -628,47 +1437,122 @@ static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
       t_start = t_start - fmod(t_start, t_delta) + t_delta;
     }
 
-    P = RayPointAt(*ray, t_start);
-    ray_delta.x = t_delta * ray->dir.x;
-    ray_delta.y = t_delta * ray->dir.y;
-    ray_delta.z = t_delta * ray->dir.z;
     t = t_start;
 
     // raymarch
     while (t <= t_limit && out_rgba->a < opacity_threshold) {
-      const Interval *interval = intervals.GetHead();
       Color color;
       float opacity = 0;
 
-      // loop over volume candidates at this sample point
-      for (; interval != NULL; interval = interval->next) {
+      // skip empty space by whole steps to keep samples on the same grid
+      Real t_exit = 0;
+      const float max_density = max_volume_density(intervals, *ray, t, cxt->time, &t_exit);
+      if (max_density == 0) {
+        t += t_delta * Max(1, ceil(t_exit / t_delta));
+        continue;
+      }
+
+      // take longer steps where the density is too low to change the result.
+      // filtered samples of secondary rays may step as far as their footprint
+      const double filter_width = volume_filter_width(cxt, t, t_delta);
+      const double max_step = Max(t_delta * MAX_STEP_SCALE, filter_width);
+      double t_step = t_delta;
+      while (2 * t_step <= max_step) {
+        if (2 * t_step * max_density > MAX_STEP_OPACITY || 2 * t_step > t_exit) {
+          break;
+        }
+        t_step *= 2;
+      }
+
+      // shadow rays only need opacity. samples of the next steps in the
+      // same density bound are taken at a time and composited in order
+      if (cxt->ray_context == CXT_SHADOW_RAY) {
+        Vector points[SHADOW_SAMPLE_COUNT];
+        float opacities[SHADOW_SAMPLE_COUNT] = {0};
+        int count = 0;
+        while (count < SHADOW_SAMPLE_COUNT &&
+            (count == 0 || (count + 1) * t_step <= t_exit) &&
+            t + count * t_step <= t_limit) {
+          points[count] = RayPointAt(*ray, t + count * t_step);
+          count++;
+        }
+
+        for (int i = 0; i < intervals.GetCount(); i++) {
+          const Interval &interval = intervals.Get(i);
+          VolumeSample samples[SHADOW_SAMPLE_COUNT];
+          interval.object->GetVolumeSamples(points, count, cxt->time, filter_width, samples);
+          for (int j = 0; j < count; j++) {
+            opacities[j] = Max(opacities[j], t_step * samples[j].density);
+          }
+        }
+
+        count_march_steps(cxt, count);
+        for (int j = 0; j < count && out_rgba->a < opacity_threshold; j++) {
+          out_rgba->a = out_rgba->a + Clamp(opacities[j], 0, 1) * (1-out_rgba->a);
+        }
+        t += count * t_step;
+        continue;
+      }
+
+      P = RayPointAt(*ray, t);
+      count_march_steps(cxt, 1);
+
+      // volumes empty at this point are not shaded and volumes only
+      // absorbing rays of this context are not shaded either. colors of
+      // overlapping volumes are averaged by their densities
+      Color Cs_sum;
+      Color Cs_last;
+      float density_sum = 0;
+      int contrib_count = 0;
+      int shaded_count = 0;
+      for (int i = 0; i < intervals.GetCount(); i++) {
+        const Interval &interval = intervals.Get(i);
         VolumeSample sample;
-        interval->object->GetVolumeSample(P, cxt->time, &sample);
+        interval.object->GetVolumeSample(P, cxt->time, filter_width, &sample);
+        if (sample.density <= 0) {
+          continue;
+        }
 
         // merge volume with max density
-        opacity = Max(opacity, t_delta * sample.density);
-
-        if (cxt->ray_context != CXT_SHADOW_RAY) {
-          SurfaceInput in;
-          SurfaceOutput out;
-
-          in.shaded_object = interval->object;
-          in.P = P;
-          in.N = Vector(0, 0, 0);
-
-          // TODO shading group
-          const Shader *shader = interval->object->GetShader(0);
-          if (shader != NULL) {
-            shader->Evaluate(*cxt, in, &out);
-          } else {
-            out.Cs = NO_SHADER_COLOR;
-            out.Os = 1;
-          }
+        opacity = Max(opacity, t_step * sample.density);
+        density_sum += sample.density;
+        contrib_count++;
+
+        // TODO shading group
+        const Shader *shader = interval.object->GetShader(0);
+        if (shader != NULL && shader->IsDensityOnly(cxt->ray_context)) {
+          continue;
+        }
 
-          color.r = out.Cs.r * opacity;
-          color.g = out.Cs.g * opacity;
-          color.b = out.Cs.b * opacity;
+        SurfaceInput in;
+        SurfaceOutput out;
+        in.shaded_object = interval.object;
+        in.P = P;
+        in.N = Vector(0, 0, 0);
+        in.du = 0;
+        in.dv = 0;
+
+        if (shader != NULL) {
+          shader->Evaluate(*cxt, in, &out);
+        } else {
+          out.Cs = NO_SHADER_COLOR;
+          out.Os = 1;
         }
+        Cs_sum += out.Cs * sample.density;
+        Cs_last = out.Cs;
+        shaded_count++;
+      }
+
+      if (contrib_count == 0) {
+        t += t_step;
+        continue;
+      }
+      if (contrib_count == 1 && shaded_count == 1) {
+        color.r = Cs_last.r * opacity;
+        color.g = Cs_last.g * opacity;
+        color.b = Cs_last.b * opacity;
+      } else if (shaded_count > 0) {
+        color = Cs_sum * (opacity / density_sum);
       }
 
       // composite color
@@ -678,10 +1562,7 @@ static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
       out_rgba->a = out_rgba->a + Clamp(opacity, 0, 1) * (1-out_rgba->a);
 
       // advance sample point
-      P.x += ray_delta.x;
-      P.y += ray_delta.y;
-      P.z += ray_delta.z;
-      t += t_delta;
+      t += t_step;
     }
     if (out_rgba->a >= opacity_threshold) {
       out_rgba->a = 1;
@@ -692,6 +1573,16 @@ static int raymarch_volume(const TraceContext *cxt, const Ray *ray,
   return hit;
 }
 
+// the footprint of secondary rays at t which is no smaller than the step
+// since finer voxels are skipped by steps. camera rays are not filtered
+static double volume_filter_width(const TraceContext *cxt, double t, double t_delta)
+{
+  if (cxt->ray_context == CXT_CAMERA_RAY) {
+    return 0;
+  }
+  return Max(cxt->ray_width + cxt->ray_spread * t, t_delta);
+}
+
 static int shadow_ray_has_reached_opcity_limit(const TraceContext *cxt, float opac)
 {
   if (cxt->ray_context == CXT_SHADOW_RAY && opac > cxt->opacity_threshold) {
@@ -701,4 +1592,105 @@ static int shadow_ray_has_reached_opcity_limit(const TraceContext *cxt, float op
   }
 }
 
+// the cache stands for lights by their centers, so lights as large as the
+// volumes and shadow rays missing the volumes are traced as usual
+static bool use_transmittance_cache(const TraceContext *shad_cxt, const Light *light,
+    const Vector &Ps, const Vector &Ln, double distance)
+{
+  if (shad_cxt->transmittance_cache == NULL) {
+    return false;
+  }
+
+  const VolumeAccelerator *acc = shad_cxt->trace_target->GetVolumeAccelerator();
+  if (acc == NULL) {
+    return false;
+  }
+
+  const Box &volume_bounds = acc->GetBounds();
+  Real hit_tmin = 0, hit_tmax = 0;
+  if (!BoxRayIntersect(volume_bounds, Ps, Ln, .0001, distance, &hit_tmin, &hit_tmax)) {
+    return false;
+  }
+
+  return Length(light->GetBounds().Diagonal()) < Length(volume_bounds.Diagonal());
+}
+
+// raymarches volumes from the vertex to the center of the light
+static float vertex_transmittance(const TraceContext *shad_cxt, const Light *light,
+    const Vector &vertex)
+{
+  const Box &light_bounds = light->GetBounds();
+  const Vector light_center = .5 * (light_bounds.min + light_bounds.max);
+  const Vector dir = light_center - vertex;
+  const double distance = Length(dir);
+  if (distance == 0) {
+    return 1;
+  }
+
+  Ray ray;
+  ray.orig = vertex;
+  ray.dir = dir / distance;
+  ray.tmin = 0;
+  ray.tmax = distance;
+  count_ray(shad_cxt);
+
+  Color4 volume_color;
+  raymarch_volume(shad_cxt, &ray, &volume_color);
+  return 1 - volume_color.a;
+}
+
+// surfaces are traced and volumes are interpolated from the eight
+// vertices around Ps. vertices not in the cache yet are raymarched
+static int trace_cached_shadow(const TraceContext *shad_cxt, const Light *light,
+    const Vector &Ps, const Vector &Ln, double distance, Color4 *out_rgba)
+{
+  TransmittanceCache *cache = shad_cxt->transmittance_cache;
+  const ObjectGroup *target = shad_cxt->trace_target;
+  Ray ray;
+  double t_hit = FLT_MAX;
+
+  setup_ray(&Ps, &Ln, .0001, distance, &ray);
+  count_ray(shad_cxt);
+
+  const int hit_surface = trace_surface(shad_cxt, ray, out_rgba, &t_hit);
+  if (shadow_ray_has_reached_opcity_limit(shad_cxt, out_rgba->a)) {
+    return 1;
+  }
+
+  const Real cell_size = cache->GetCellSize();
+  const Vector P = Ps / cell_size;
+  const int x0 = static_cast<int>(std::floor(P.x));
+  const int y0 = static_cast<int>(std::floor(P.y));
+  const int z0 = static_cast<int>(std::floor(P.z));
+  const Vector f(P.x - x0, P.y - y0, P.z - z0);
+  float transmittance = 0;
+
+  for (int i = 0; i < 8; i++) {
+    const int dx = i & 1;
+    const int dy = (i >> 1) & 1;
+    const int dz = (i >> 2) & 1;
+    const int x = x0 + dx;
+    const int y = y0 + dy;
+    const int z = z0 + dz;
+    float T = 1;
+
+    if (!cache->Lookup(light, target, x, y, z, &T)) {
+      const Vector vertex(x * cell_size, y * cell_size, z * cell_size);
+      T = vertex_transmittance(shad_cxt, light, vertex);
+      cache->Add(light, target, x, y, z, T);
+    }
+
+    const double weight =
+        (dx ? f.x : 1 - f.x) *
+        (dy ? f.y : 1 - f.y) *
+        (dz ? f.z : 1 - f.z);
+    transmittance += weight * T;
+  }
+
+  const float volume_alpha = Clamp(1 - transmittance, 0, 1);
+  out_rgba->a = volume_alpha + out_rgba->a * (1 - volume_alpha);
+
+  return hit_surface || volume_alpha > 0;
+}
+
 } // namespace xxx
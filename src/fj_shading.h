@@ -13,7 +13,20 @@ namespace fj {
 
 class ObjectInstance;
 class ObjectGroup;
+class XorShift;
+class SampleSequence;
+class MemoryArena;
+class LightTree;
+class RadianceCache;
+class PhotonMap;
+class TransmittanceCache;
 class Texture;
+class Box;
+class Ray;
+class Intersection;
+class AOVSample;
+class ObjectRecorder;
+class SampleCost;
 
 enum RayContext {
   CXT_CAMERA_RAY = 0,
@@ -22,6 +35,17 @@ enum RayContext {
   CXT_REFLECT_RAY,
   CXT_REFRACT_RAY
 };
+const int RAY_CONTEXT_COUNT = 5;
+
+// how shadow rays find the transmittance of volumes
+enum ShadowTransmittance {
+  SHADOW_TRANSMITTANCE_RAYMARCH = 0,
+  // unbiased but noisy. takes far fewer samples in dense volumes
+  SHADOW_TRANSMITTANCE_RATIO_TRACKING
+};
+
+// max number of hits shaded at once by SlTraceHitBatch()
+const int SHADE_BATCH_SIZE = 64;
 
 class FJ_API TraceContext {
 public:
@@ -42,8 +66,59 @@ public:
   double raymarch_diffuse_step;
   double raymarch_reflect_step;
   double raymarch_refract_step;
+  int shadow_transmittance;
 
   const ObjectGroup *trace_target;
+
+  // random numbers of the pixel sample being traced. seeded by the sample
+  // so renders don't depend on the thread count. use SlGetRandom()
+  XorShift *rng;
+  // numbers of the pixel sample by dimension for sampling directions and
+  // lights. use SlGetSampleSequence()
+  SampleSequence *sequence;
+
+  // draws sampled_light_count lights by their contribution instead of
+  // shading with all lights if not NULL
+  const LightTree *light_tree;
+  int sampled_light_count;
+
+  // product of the surface weights along the path to the ray. shaders
+  // may terminate paths of low throughput at random and weight survivors.
+  // see SlWeightRay()
+  float throughput;
+  // secondary rays whose throughput falls below this are terminated at
+  // random by SlWeightRay(). 0 traces all rays to the max depths
+  float throughput_threshold;
+
+  // incoming diffuse radiance shared by all threads if not NULL.
+  // use SlLookupRadianceCache() and SlAddRadianceCache()
+  RadianceCache *radiance_cache;
+
+  // transmittance of volumes toward lights shared by all threads. shadow
+  // rays of lights smaller than the volumes read it if not NULL
+  TransmittanceCache *transmittance_cache;
+
+  // caustic photons landed on diffuse surfaces if not NULL.
+  // use SlLookupCaustics()
+  const PhotonMap *photon_map;
+
+  // footprint of rays as a cone. width at the ray origin and its growth
+  // per unit distance. shaders get the context of the hit whose width is
+  // of the ray there, so contexts of secondary rays start at that width
+  double ray_width;
+  double ray_spread;
+
+  // the first surface hit of the ray writes arbitrary output variables
+  // here if not NULL. contexts of hits passed to shaders have NULL
+  AOVSample *aov;
+
+  // objects hit by all rays of the pixel sample, including shadow rays,
+  // are recorded here if not NULL
+  ObjectRecorder *object_recorder;
+
+  // rays and volume steps of all rays of the pixel sample are counted here
+  // if not NULL
+  SampleCost *cost;
 };
 
 class FJ_API SurfaceInput {
@@ -60,6 +135,11 @@ public:
   Vector dPdu;
   Vector dPdv;
 
+  // footprint of the ray in texture space for Texture::Lookup(u, v, du, dv).
+  // 0 reads the finest level
+  float du;
+  float dv;
+
   const ObjectInstance *shaded_object;
 };
 
@@ -67,6 +147,40 @@ class FJ_API SurfaceOutput {
 public:
   Color Cs;
   float Os;
+
+  // for arbitrary output variables. the part of Cs lit by lights directly.
+  // shaders that don't set direct leave all of Cs in indirect
+  Color albedo;
+  Color direct;
+};
+
+// arbitrary output variables of the first surface hit of a camera ray
+class FJ_API AOVSample {
+public:
+  AOVSample() : depth(0), N(), albedo(), direct(), indirect(),
+      time(0), ray_count(), node_count(0), march_step_count(0) {}
+  ~AOVSample() {}
+
+  float depth;
+  Vector N;
+  Color albedo;
+  Color direct;
+  Color indirect;
+
+  // costs of the whole sample set by the renderer
+  float time;
+  float ray_count[RAY_CONTEXT_COUNT];
+  float node_count;
+  float march_step_count;
+};
+
+class FJ_API SampleCost {
+public:
+  SampleCost() : ray_count(), march_step_count(0) {}
+  ~SampleCost() {}
+
+  int ray_count[RAY_CONTEXT_COUNT];
+  int march_step_count;
 };
 
 class FJ_API LightOutput {
@@ -90,11 +204,37 @@ FJ_API void SlRefract(const Vector *I, const Vector *N, double ior,
 FJ_API int SlTrace(const TraceContext *cxt,
     const Vector *ray_orig, const Vector *ray_dir,
     double ray_tmin, double ray_tmax, Color4 *out_color, double *t_hit);
+// SlTrace split for rays intersected in batches before shading.
+// SlTraceHit shades the hit, or only volumes if isect is NULL, the same
+// as SlTrace does after its own intersection
+FJ_API int SlIntersectSurface(const TraceContext *cxt, const Ray &ray,
+    Intersection *isect);
+FJ_API int SlTraceHit(const TraceContext *cxt, const Ray &ray,
+    const Intersection *isect, Color4 *out_color, double *t_hit);
+// SlTraceHit of up to SHADE_BATCH_SIZE hits on the same shader. cxts[i] is
+// the context of rays[i] and they are of the same ray context and depths.
+// the shader evaluates all hits at once
+FJ_API void SlTraceHitBatch(const TraceContext *cxts, const Ray *rays,
+    const Intersection *isects, int count, Color4 *out_rgba, double *t_hit);
+// SlIntersectSurface of up to RAY_PACKET_SIZE coherent rays each at its
+// own time. returns the mask of rays that hit
+FJ_API unsigned int SlIntersectSurfacePacket(const TraceContext *cxt,
+    const Ray *rays, const Real *times, int count, Intersection *isects);
+// SlIntersectSurface of a stream of any number of rays. hits[i] is 1 if
+// rays[i] hit. rays next to each other are intersected together so they
+// should be sorted to be coherent. the whole stream is one query, which
+// is where an offload device would take all rays at once
+FJ_API void SlIntersectSurfaceStream(const TraceContext *cxt,
+    const Ray *rays, const Real *times, int count, Intersection *isects, int *hits);
 FJ_API int SlSurfaceRayIntersect(const TraceContext *cxt,
     const Vector *ray_orig, const Vector *ray_dir,
     double ray_tmin, double ray_tmax,
     Vector *P_hit, Vector *N_hit, double *t_hit);
 
+// bounds of surfaces of the trace target. with SlSelfHitContext() they
+// are of the shaded object
+FJ_API void SlGetSurfaceBounds(const TraceContext *cxt, Box *bounds);
+
 FJ_API TraceContext SlCameraContext(const ObjectGroup *target);
 FJ_API TraceContext SlDiffuseContext(const TraceContext *cxt,
     const ObjectInstance *obj);
@@ -102,27 +242,85 @@ FJ_API TraceContext SlReflectContext(const TraceContext *cxt,
     const ObjectInstance *obj);
 FJ_API TraceContext SlRefractContext(const TraceContext *cxt,
     const ObjectInstance *obj);
+// multiplies the throughput of the context of a secondary ray by the max
+// component of the weight of its radiance. under the throughput threshold
+// the ray survives with the probability of the ratio of its throughput to
+// the threshold and carries the threshold. returns the factor of the
+// radiance of the ray, 1 / probability, or 0 if it's not to be traced
+FJ_API float SlWeightRay(TraceContext *cxt, const Color &weight);
 FJ_API TraceContext SlShadowContext(const TraceContext *cxt,
     const ObjectInstance *obj);
 FJ_API TraceContext SlSelfHitContext(const TraceContext *cxt,
     const ObjectInstance *obj);
 
+// random numbers for shaders and lights. numbers of the pixel sample, or of
+// the thread outside of rendering. never shared between threads
+FJ_API XorShift &SlGetRandom(const TraceContext *cxt);
+// the same for sampling directions where stratification by dimension helps.
+// draws from SlGetRandom() unless the renderer uses the sobol sequence
+FJ_API SampleSequence &SlGetSampleSequence(const TraceContext *cxt);
+
+// scratch memory of the thread for temporaries of shaders and lights.
+// the renderer resets it after the camera sample so nothing needs freeing
+// while rendering. elsewhere e.g. in procedures rewind to a mark of it.
+// state kept across samples goes in ThreadState of fj_thread_state.h
+FJ_API MemoryArena &SlGetScratchArena(const TraceContext *cxt);
+
+// incoming diffuse radiance around the point averaged by the cache of the
+// renderer for the diffuse depth of cxt. returns 0 if the cache is disabled or has too few samples there
+FJ_API int SlLookupRadianceCache(const TraceContext *cxt,
+    const Vector *P, const Vector *N, Color *radiance);
+// adds one sample of incoming diffuse radiance to the cache if enabled
+FJ_API void SlAddRadianceCache(const TraceContext *cxt,
+    const Vector *P, const Vector *N, const Color *radiance);
+
+// irradiance of caustics around the point estimated from the photon map of
+// the renderer. returns 0 if the map is disabled or has no photon there
+FJ_API int SlLookupCaustics(const TraceContext *cxt,
+    const Vector *P, const Vector *N, Color *irradiance);
+
 // lighting functions
 class LightSample;
 
+// shadow rays of each thread test the last opaque primitive blocking the
+// light first and traverse the scene when it misses
 FJ_API int SlIlluminance(const TraceContext *cxt, const LightSample *sample,
     const Vector *Ps, const Vector *axis, double angle,
     const SurfaceInput *in, LightOutput *out);
+// SlIlluminance of count samples of a light from SlGetLightSamples(). for
+// lights with adaptive sampling, shadow rays of samples after the first
+// probes are traced only if those disagree on whether the light is fully
+// visible or fully blocked. probes are a quarter of the samples but at
+// least LIGHT_PROBE_SAMPLE_COUNT. returns the number of samples
+// SlIlluminance would return 1 for
+FJ_API int SlIlluminanceList(const TraceContext *cxt, const LightSample *samples, int count,
+    const Vector *Ps, const Vector *axis, double angle,
+    const SurfaceInput *in, LightOutput *outs);
+// forgets the last occluders of all threads. call this before rendering
+// once objects or lights may have been replaced
+FJ_API void SlClearShadowOccluders();
 
 FJ_API int SlGetLightCount(const SurfaceInput *in);
 FJ_API int SlGetLightSampleCount(const SurfaceInput *in);
-FJ_API LightSample *SlNewLightSamples(const SurfaceInput *in);
+// lights for SlGetLightSamples(). all lights of the object or lights drawn
+// from the light tree of the context
+FJ_API int SlGetLightSelectionCount(const TraceContext *cxt, const SurfaceInput *in);
+// samples of the light_index-th light for the shading point. they are in
+// the sample table of the light so nothing is allocated or freed. drawn
+// lights and lights with visible sampling give samples of the shading point
+// which live until the end of the pixel sample
+FJ_API const LightSample *SlGetLightSamples(const TraceContext *cxt,
+    const SurfaceInput *in, int light_index, int *sample_count);
+// copies of samples of all lights. SlGetLightSamples() doesn't copy
+FJ_API LightSample *SlNewLightSamples(const TraceContext *cxt, const SurfaceInput *in);
 FJ_API void SlFreeLightSamples(LightSample * samples);
 
 // texture functions
+// du and dv are the footprint of SurfaceInput. differences are taken
+// over it and read from the mipmap level of it
 FJ_API void SlBumpMapping(const Texture *bump_map,
     const Vector *dPdu, const Vector *dPdv,
-    const TexCoord *texcoord, double amplitude,
+    const TexCoord *texcoord, float du, float dv, double amplitude,
     const Vector *N, Vector *N_bump);
 
 } // namespace xxx
@@ -2,8 +2,19 @@
 // See LICENSE and README
 
 #include "fj_socket.h"
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
 
+#if defined(FJ_LINUX)
+  #include <sys/epoll.h>
+  #include <fcntl.h>
+#elif defined(FJ_MACOSX)
+  #include <sys/event.h>
+  #include <sys/time.h>
+  #include <fcntl.h>
+#endif
+
 namespace fj {
 
 #if defined(FJ_WINDOWS)
@@ -49,6 +60,10 @@ namespace fj {
   {
     return WSACleanup();
   }
+  inline bool would_block()
+  {
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+  }
 #else
   // MacOSX Linux
   enum {
@@ -72,8 +87,15 @@ namespace fj {
   {
     return 0;
   }
+  inline bool would_block()
+  {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
 #endif
 
+// events taken by a call of SocketPoller::Wait
+static const int MAX_EVENTS = 64;
+
 const int DEFAULT_PORT = 50505;
 
 inline static struct sockaddr *get_sockaddr(struct sockaddr_in * addr_in)
@@ -190,6 +212,24 @@ int Socket::EnableReuseAddr()
   return 0;
 }
 
+int Socket::SetNonBlocking(bool enable)
+{
+#if defined(FJ_WINDOWS)
+  u_long mode = enable ? 1 : 0;
+  const int result = ioctlsocket(fd_, FIONBIO, &mode);
+#else
+  const int flags = fcntl(fd_, F_GETFL, 0);
+  const int result = flags == -1 ? -1 :
+      fcntl(fd_, F_SETFL, enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+#endif
+
+  if (result == FJ_SOCKET_ERROR) {
+    return -1;
+  }
+
+  return 0;
+}
+
 void Socket::SetAddress(const std::string &address)
 {
   if (address == "") {
@@ -283,14 +323,190 @@ socket_id Socket::AcceptOrTimeout(Socket &accepted, int sec, int micro_sec)
   }
 }
 
+int Socket::WaitForData(int sec, int micro_sec)
+{
+  struct timeval timeout;
+  timeout.tv_sec = sec;
+  timeout.tv_usec = micro_sec;
+
+  fd_set read_mask;
+  FD_ZERO(&read_mask);
+  FD_SET(fd_, &read_mask);
+
+  const int result = select(fd_ + 1, &read_mask, NULL, NULL, &timeout);
+  if (result == FJ_SOCKET_ERROR) {
+    return FJ_SOCKET_ERROR;
+  }
+  return FD_ISSET(fd_, &read_mask) ? 1 : FJ_SOCKET_TIMEOUT;
+}
+
 int Socket::Receive(char *data, size_t count)
 {
   return recv(fd_, data, count, MSG_WAITALL);
 }
 
+int Socket::ReceiveAvailable(char *data, size_t count)
+{
+  const int result = recv(fd_, data, count, 0);
+  if (result > 0) {
+    return result;
+  }
+  if (result == FJ_SOCKET_ERROR && would_block()) {
+    return 0;
+  }
+  // closed or error
+  return -1;
+}
+
 int Socket::Send(const char *data, size_t count)
 {
+  // a closed peer is reported as an error instead of SIGPIPE
+#if defined(MSG_NOSIGNAL)
+  return send(fd_, data, count, MSG_NOSIGNAL);
+#else
   return send(fd_, data, count, 0);
+#endif
+}
+
+SocketPoller::SocketPoller() :
+    handle_(-1), fds_(), keys_()
+{
+}
+
+SocketPoller::~SocketPoller()
+{
+  Close();
+}
+
+int SocketPoller::Open()
+{
+  if (IsOpen()) {
+    return 0;
+  }
+
+#if defined(FJ_LINUX)
+  handle_ = epoll_create1(0);
+#elif defined(FJ_MACOSX)
+  handle_ = kqueue();
+#else
+  handle_ = 0;
+#endif
+
+  return IsOpen() ? 0 : -1;
+}
+
+bool SocketPoller::IsOpen() const
+{
+  return handle_ != -1;
+}
+
+void SocketPoller::Close()
+{
+  if (!IsOpen()) {
+    return;
+  }
+
+#if defined(FJ_LINUX) || defined(FJ_MACOSX)
+  close(handle_);
+#endif
+  handle_ = -1;
+  fds_.clear();
+  keys_.clear();
+}
+
+int SocketPoller::Add(const Socket &socket, int key)
+{
+  const socket_id fd = socket.GetFileDescriptor();
+
+#if defined(FJ_LINUX)
+  struct epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.u64 = static_cast<uint64_t>(static_cast<uint32_t>(key));
+  return epoll_ctl(handle_, EPOLL_CTL_ADD, fd, &event) == -1 ? -1 : 0;
+#elif defined(FJ_MACOSX)
+  struct kevent event;
+  EV_SET(&event, fd, EVFILT_READ, EV_ADD, 0, 0,
+      reinterpret_cast<void *>(static_cast<intptr_t>(key)));
+  return kevent(handle_, &event, 1, NULL, 0, NULL) == -1 ? -1 : 0;
+#else
+  fds_.push_back(fd);
+  keys_.push_back(key);
+  return 0;
+#endif
+}
+
+int SocketPoller::Remove(const Socket &socket)
+{
+  const socket_id fd = socket.GetFileDescriptor();
+
+#if defined(FJ_LINUX)
+  struct epoll_event event;
+  std::memset(&event, 0, sizeof(event));
+  return epoll_ctl(handle_, EPOLL_CTL_DEL, fd, &event) == -1 ? -1 : 0;
+#elif defined(FJ_MACOSX)
+  struct kevent event;
+  EV_SET(&event, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  return kevent(handle_, &event, 1, NULL, 0, NULL) == -1 ? -1 : 0;
+#else
+  const std::vector<socket_id>::iterator it = std::find(fds_.begin(), fds_.end(), fd);
+  if (it == fds_.end()) {
+    return -1;
+  }
+  keys_.erase(keys_.begin() + (it - fds_.begin()));
+  fds_.erase(it);
+  return 0;
+#endif
+}
+
+int SocketPoller::Wait(int timeout_msec, std::vector<int> &ready_keys)
+{
+  ready_keys.clear();
+
+#if defined(FJ_LINUX)
+  struct epoll_event events[MAX_EVENTS];
+  const int count = epoll_wait(handle_, events, MAX_EVENTS, timeout_msec);
+  if (count == -1) {
+    return errno == EINTR ? 0 : -1;
+  }
+  for (int i = 0; i < count; i++) {
+    ready_keys.push_back(static_cast<int>(events[i].data.u64));
+  }
+#elif defined(FJ_MACOSX)
+  struct kevent events[MAX_EVENTS];
+  struct timespec timeout;
+  timeout.tv_sec = timeout_msec / 1000;
+  timeout.tv_nsec = (timeout_msec % 1000) * 1000 * 1000;
+  const int count = kevent(handle_, NULL, 0, events, MAX_EVENTS, &timeout);
+  if (count == -1) {
+    return errno == EINTR ? 0 : -1;
+  }
+  for (int i = 0; i < count; i++) {
+    ready_keys.push_back(static_cast<int>(reinterpret_cast<intptr_t>(events[i].udata)));
+  }
+#else
+  std::vector<WSAPOLLFD> polled(fds_.size());
+  for (std::size_t i = 0; i < fds_.size(); i++) {
+    polled[i].fd = fds_[i];
+    polled[i].events = POLLRDNORM;
+    polled[i].revents = 0;
+  }
+  if (polled.empty()) {
+    Sleep(timeout_msec);
+    return 0;
+  }
+  const int count = WSAPoll(&polled[0], static_cast<ULONG>(polled.size()), timeout_msec);
+  if (count == FJ_SOCKET_ERROR) {
+    return -1;
+  }
+  for (std::size_t i = 0; i < polled.size(); i++) {
+    if (polled[i].revents != 0) {
+      ready_keys.push_back(keys_[i]);
+    }
+  }
+#endif
+
+  return static_cast<int>(ready_keys.size());
 }
 
 } // namespace xxx
@@ -6,6 +6,7 @@
 
 #include "fj_compatibility.h"
 #include <string>
+#include <vector>
 
 #if defined(FJ_WINDOWS)
   // Windows
@@ -71,6 +72,8 @@ public:
 
   int EnableNoDelay();
   int EnableReuseAddr();
+  // Accept and ReceiveAvailable return at once instead of waiting
+  int SetNonBlocking(bool enable);
   void SetAddress(const std::string &address);
   void SetPort(int port);
 
@@ -81,7 +84,14 @@ public:
   socket_id Accept(Socket &accepted);
   socket_id AcceptOrTimeout(Socket &accepted, int sec, int micro_sec);
 
+  // Returns 1 if data or the end of the stream can be received without
+  // blocking, FJ_SOCKET_TIMEOUT if not and FJ_SOCKET_ERROR on errors.
+  int WaitForData(int sec, int micro_sec);
   int Receive(char *data, size_t count);
+  // Returns the number of bytes received up to count without blocking on
+  // a non-blocking socket. 0 if none have arrived yet and -1 if the peer
+  // has closed or on errors.
+  int ReceiveAvailable(char *data, size_t count);
   int Send(const char *data, size_t count);
 
 private:
@@ -90,6 +100,36 @@ private:
   struct sockaddr_in address_;
 };
 
+// Waits for many sockets at once with epoll on Linux, kqueue on MacOSX and
+// WSAPoll on Windows. sockets are reported while they can be read without
+// blocking or their peers have closed.
+class FJ_API SocketPoller {
+public:
+  SocketPoller();
+  // Closes if opened
+  ~SocketPoller();
+
+  int Open();
+  bool IsOpen() const;
+  void Close();
+
+  // key is returned by Wait for the socket. remove sockets before closing
+  int Add(const Socket &socket, int key);
+  int Remove(const Socket &socket);
+  // Fills keys of ready sockets and returns the count of them. 0 on time
+  // out and -1 on errors.
+  int Wait(int timeout_msec, std::vector<int> &ready_keys);
+
+private:
+  SocketPoller(const SocketPoller &);
+  const SocketPoller &operator=(const SocketPoller &);
+
+  int handle_;
+  // sockets polled on Windows
+  std::vector<socket_id> fds_;
+  std::vector<int> keys_;
+};
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
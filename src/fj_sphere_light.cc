@@ -3,10 +3,12 @@
 
 #include "fj_sphere_light.h"
 #include "fj_multi_thread.h"
+#include "fj_numeric.h"
+#include <cmath>
 
 namespace fj {
 
-SphereLight::SphereLight() : rng_()
+SphereLight::SphereLight()
 {
 }
 
@@ -19,19 +21,81 @@ int SphereLight::get_sample_count() const
   return GetSampleDensity();
 }
 
-void SphereLight::get_samples(LightSample *samples, int max_samples) const
+int SphereLight::get_sample_set_count() const
+{
+  return LIGHT_SAMPLE_SET_COUNT;
+}
+
+void SphereLight::get_samples(LightSample *samples, int max_samples,
+    const Vector2 *points) const
+{
+  Transform transform_interp;
+  // TODO time sampling
+  const float time = 0;
+  get_transform_sample(transform_interp, time);
+
+  int nsamples = GetSampleCount();
+  nsamples = Min(nsamples, max_samples);
+
+  for (int i = 0; i < nsamples; i++) {
+    // uniform on the unit sphere
+    const Vector2 &uv = points[i];
+    const Real z = 1 - 2 * uv[0];
+    const Real r = sqrt(Max(0., 1 - z * z));
+    const Real phi = 2 * PI * uv[1];
+    Vector P_sample(r * Cos(phi), r * Sin(phi), z);
+    Vector N_sample = P_sample;
+
+    XfmTransformPoint(&transform_interp, &P_sample);
+    XfmTransformVector(&transform_interp, &N_sample);
+    N_sample = Normalize(N_sample);
+
+    samples[i].P = P_sample;
+    samples[i].N = N_sample;
+    samples[i].light = this;
+  }
+}
+
+bool SphereLight::has_samples_at() const
+{
+  return true;
+}
+
+int SphereLight::get_samples_at(LightSample *samples, int max_samples,
+    const Vector2 *points, const Vector &Ps) const
 {
   Transform transform_interp;
   // TODO time sampling
   const float time = 0;
   get_transform_sample(transform_interp, time);
 
+  // the cap of the unit sphere seen from Ps. illuminate() sees nothing
+  // from inside or on the sphere
+  Vector axis = Ps;
+  XfmTransformPointInverse(&transform_interp, &axis);
+  const Real dist = Length(axis);
+  if (dist <= 1) {
+    return 0;
+  }
+  axis /= dist;
+  const Real z_min = 1 / dist;
+  // share of the sphere area in the cap
+  const float weight = .5 * (1 - z_min);
+
+  Vector u = Abs(axis.x) > .001 ? Vector(0, 1, 0) : Vector(1, 0, 0);
+  u = Normalize(Cross(u, axis));
+  const Vector v = Cross(axis, u);
+
   int nsamples = GetSampleCount();
   nsamples = Min(nsamples, max_samples);
 
   for (int i = 0; i < nsamples; i++) {
-    XorShift &mutable_rng = const_cast<XorShift &>(rng_);
-    Vector P_sample = mutable_rng.HollowSphereRand();
+    // uniform on the cap
+    const Vector2 &uv = points[i];
+    const Real z = 1 - uv[0] * (1 - z_min);
+    const Real r = sqrt(Max(0., 1 - z * z));
+    const Real phi = 2 * PI * uv[1];
+    Vector P_sample = u * (r * Cos(phi)) + v * (r * Sin(phi)) + axis * z;
     Vector N_sample = P_sample;
 
     XfmTransformPoint(&transform_interp, &P_sample);
@@ -41,7 +105,10 @@ void SphereLight::get_samples(LightSample *samples, int max_samples) const
     samples[i].P = P_sample;
     samples[i].N = N_sample;
     samples[i].light = this;
+    samples[i].weight = weight;
   }
+
+  return nsamples;
 }
 
 Color SphereLight::illuminate(const LightSample &sample, const Vector &Ps) const
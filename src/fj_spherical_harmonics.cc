@@ -0,0 +1,81 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_spherical_harmonics.h"
+#include "fj_numeric.h"
+
+namespace fj {
+
+// real spherical harmonics of bands 0 to 2
+static void eval_basis(const Vector &d, Real *Y)
+{
+  Y[0] = .282095;
+  Y[1] = .488603 * d.y;
+  Y[2] = .488603 * d.z;
+  Y[3] = .488603 * d.x;
+  Y[4] = 1.092548 * d.x * d.y;
+  Y[5] = 1.092548 * d.y * d.z;
+  Y[6] = .315392 * (3 * d.z * d.z - 1);
+  Y[7] = 1.092548 * d.x * d.z;
+  Y[8] = .546274 * (d.x * d.x - d.y * d.y);
+}
+
+// the clamped cosine of each band
+static const Real BAND_WEIGHTS[SHIrradiance::COEFF_COUNT] = {
+  PI,
+  2 * PI / 3, 2 * PI / 3, 2 * PI / 3,
+  PI / 4, PI / 4, PI / 4, PI / 4, PI / 4
+};
+
+SHIrradiance::SHIrradiance() : is_empty_(true)
+{
+}
+
+SHIrradiance::~SHIrradiance()
+{
+}
+
+void SHIrradiance::Clear()
+{
+  for (int i = 0; i < COEFF_COUNT; i++) {
+    coeffs_[i] = Color();
+  }
+  is_empty_ = true;
+}
+
+void SHIrradiance::AddRadiance(const Vector &dir, const Color &weighted_radiance)
+{
+  Real Y[COEFF_COUNT];
+  eval_basis(dir, Y);
+
+  for (int i = 0; i < COEFF_COUNT; i++) {
+    coeffs_[i] += weighted_radiance * Y[i];
+  }
+  is_empty_ = false;
+}
+
+bool SHIrradiance::IsEmpty() const
+{
+  return is_empty_;
+}
+
+Color SHIrradiance::Evaluate(const Vector &N) const
+{
+  Real Y[COEFF_COUNT];
+  eval_basis(N, Y);
+  if (N.x == 0 && N.y == 0 && N.z == 0) {
+    // the average over all normals is the band 0 alone
+    Y[6] = 0;
+  }
+
+  Color E;
+  for (int i = 0; i < COEFF_COUNT; i++) {
+    E += coeffs_[i] * (BAND_WEIGHTS[i] * Y[i]);
+  }
+  E.r = Max(E.r, 0);
+  E.g = Max(E.g, 0);
+  E.b = Max(E.b, 0);
+  return E;
+}
+
+} // namespace xxx
@@ -0,0 +1,42 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_SPHERICAL_HARMONICS_H
+#define FJ_SPHERICAL_HARMONICS_H
+
+#include "fj_compatibility.h"
+#include "fj_vector.h"
+#include "fj_color.h"
+
+namespace fj {
+
+// Diffuse irradiance of distant light from the 9 spherical harmonics of
+// bands 0 to 2 convolved with the clamped cosine (Ramamoorthi and Hanrahan
+// 2001). radiance is projected once and irradiance at any normal is
+// evaluated in constant time
+class FJ_API SHIrradiance {
+public:
+  SHIrradiance();
+  ~SHIrradiance();
+
+  void Clear();
+  // radiance arriving along dir multiplied by its solid angle, or by the
+  // probability of the direction for averages over a distribution
+  void AddRadiance(const Vector &dir, const Color &weighted_radiance);
+  bool IsEmpty() const;
+
+  // integral of radiance times the cosine to N over the hemisphere. N is
+  // normalized. zero N gives the average over all normals. negative
+  // values of the truncated series are clamped
+  Color Evaluate(const Vector &N) const;
+
+  static const int COEFF_COUNT = 9;
+
+private:
+  Color coeffs_[COEFF_COUNT];
+  bool is_empty_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
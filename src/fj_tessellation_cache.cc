@@ -0,0 +1,221 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_tessellation_cache.h"
+
+namespace fj {
+
+static const int SHARD_COUNT = 32;
+static const std::size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+// bookkeeping of each entry besides points and bounds
+static const std::size_t ENTRY_OVERHEAD = 64;
+
+// 24 bits for mesh and 40 for face
+static uint64_t make_key(int mesh_id, Index face_id)
+{
+  return
+      (static_cast<uint64_t>(mesh_id & 0xffffff) << 40) |
+      (static_cast<uint64_t>(face_id) & 0xffffffffffULL);
+}
+
+static int key_to_mesh_id(uint64_t key)
+{
+  return static_cast<int>(key >> 40);
+}
+
+// faces of neighbor ids go to different shards
+static uint64_t mix_key(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return key;
+}
+
+static std::size_t face_bytes(const TessellatedFace &face)
+{
+  return
+      sizeof(Vector) * face.points.size() +
+      sizeof(Box) * face.bounds.size() +
+      ENTRY_OVERHEAD;
+}
+
+TessellationCache::TessellationCache() :
+  shards_(SHARD_COUNT),
+  budget_(DEFAULT_MEMORY_BUDGET),
+  next_mesh_id_(0),
+  dicing_position_(),
+  dicing_spread_(0)
+{
+}
+
+TessellationCache::~TessellationCache()
+{
+}
+
+int TessellationCache::NewMeshID()
+{
+  return next_mesh_id_++;
+}
+
+TessellationCache::FacePtr TessellationCache::Find(int mesh_id, Index face_id)
+{
+  const uint64_t key = make_key(mesh_id, face_id);
+  Shard &shard = get_shard(key);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+      shard.table.find(key);
+  if (it == shard.table.end()) {
+    return FacePtr();
+  }
+
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  return it->second->face;
+}
+
+TessellationCache::FacePtr TessellationCache::Insert(int mesh_id, Index face_id,
+    const FacePtr &face)
+{
+  const uint64_t key = make_key(mesh_id, face_id);
+  Shard &shard = get_shard(key);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+      shard.table.find(key);
+  if (it != shard.table.end()) {
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return it->second->face;
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.face = face;
+  entry.bytes = face_bytes(*face);
+
+  shard.lru.push_front(entry);
+  shard.table[key] = shard.lru.begin();
+  shard.usage += entry.bytes;
+
+  evict(shard);
+  return face;
+}
+
+void TessellationCache::RemoveMesh(int mesh_id)
+{
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    std::list<Entry>::iterator it = shard.lru.begin();
+    while (it != shard.lru.end()) {
+      if (key_to_mesh_id(it->key) == (mesh_id & 0xffffff)) {
+        shard.usage -= it->bytes;
+        shard.table.erase(it->key);
+        it = shard.lru.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void TessellationCache::Clear()
+{
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.lru.clear();
+    shard.table.clear();
+    shard.usage = 0;
+  }
+}
+
+void TessellationCache::SetDicingCamera(const Vector &position, Real spread)
+{
+  // faces diced for another camera are no longer right
+  const bool moved =
+      position.x != dicing_position_.x ||
+      position.y != dicing_position_.y ||
+      position.z != dicing_position_.z;
+  if (moved || spread != dicing_spread_) {
+    Clear();
+  }
+  dicing_position_ = position;
+  dicing_spread_ = spread;
+}
+
+const Vector &TessellationCache::GetDicingPosition() const
+{
+  return dicing_position_;
+}
+
+Real TessellationCache::GetDicingSpread() const
+{
+  return dicing_spread_;
+}
+
+void TessellationCache::SetMemoryBudget(std::size_t bytes)
+{
+  budget_ = bytes;
+
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    evict(shard);
+  }
+}
+
+std::size_t TessellationCache::GetMemoryBudget() const
+{
+  return budget_;
+}
+
+std::size_t TessellationCache::GetMemoryUsage() const
+{
+  std::size_t usage = 0;
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    const Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    usage += shard.usage;
+  }
+  return usage;
+}
+
+std::size_t TessellationCache::GetFaceCount() const
+{
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    const Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    count += shard.table.size();
+  }
+  return count;
+}
+
+TessellationCache::Shard &TessellationCache::get_shard(uint64_t key)
+{
+  return shards_[mix_key(key) % shards_.size()];
+}
+
+void TessellationCache::evict(Shard &shard)
+{
+  // each shard gets the same share of the budget. the newest face is kept
+  // even if it alone exceeds the share
+  const std::size_t share = budget_ / shards_.size();
+
+  while (shard.usage > share && shard.lru.size() > 1) {
+    const Entry &oldest = shard.lru.back();
+    shard.usage -= oldest.bytes;
+    shard.table.erase(oldest.key);
+    shard.lru.pop_back();
+  }
+}
+
+TessellationCache &TessellationCacheGetGlobal()
+{
+  static TessellationCache cache;
+  return cache;
+}
+
+} // namespace xxx
@@ -0,0 +1,124 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_TESSELLATION_CACHE_H
+#define FJ_TESSELLATION_CACHE_H
+
+#include "fj_compatibility.h"
+#include "fj_vector.h"
+#include "fj_types.h"
+#include "fj_box.h"
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <list>
+
+namespace fj {
+
+// Micro-triangles of a displaced face. the face is split into 4 sub-triangles
+// level times, and the points are on the grid of 2^level segments along each
+// edge. bounds of sub-triangles of all levels make a tree of 4 children.
+class FJ_API TessellatedFace {
+public:
+  TessellatedFace() : level(0), points(), bounds() {}
+  ~TessellatedFace() {}
+
+  // number of segments along each edge
+  int GetResolution() const { return 1 << level; }
+  // the grid point at barycentric coordinates (i, j) / resolution
+  const Vector &GetPoint(int i, int j) const
+  {
+    const int n = GetResolution();
+    return points[j * (n + 1) - j * (j - 1) / 2 + i];
+  }
+  // bounds of the index-th sub-triangle of the depth
+  const Box &GetBounds(int depth, int index) const
+  {
+    return bounds[((1 << (2 * depth)) - 1) / 3 + index];
+  }
+
+  int level;
+  std::vector<Vector> points;
+  std::vector<Box> bounds;
+};
+
+// Tessellated faces shared by all displaced meshes and threads. The least
+// recently used faces are evicted when the memory budget is exceeded. The
+// dicing camera decides how finely faces are tessellated.
+class FJ_API TessellationCache {
+public:
+  typedef std::shared_ptr<const TessellatedFace> FacePtr;
+
+  TessellationCache();
+  ~TessellationCache();
+
+  // a new id for a mesh whose faces are cached
+  int NewMeshID();
+
+  // Returns NULL if not cached. faces are cached at the level of the dicing
+  // camera when they are tessellated, and the cache is cleared when it moves.
+  FacePtr Find(int mesh_id, Index face_id);
+  // Returns the face in the cache when another thread has inserted it first.
+  FacePtr Insert(int mesh_id, Index face_id, const FacePtr &face);
+  // Drops all faces of the mesh e.g. when it is edited.
+  void RemoveMesh(int mesh_id);
+  void Clear();
+
+  // position in world space and spread of camera rays per unit distance.
+  // spread 0 makes faces tessellated at the max level of the mesh
+  void SetDicingCamera(const Vector &position, Real spread);
+  const Vector &GetDicingPosition() const;
+  Real GetDicingSpread() const;
+
+  void SetMemoryBudget(std::size_t bytes);
+  std::size_t GetMemoryBudget() const;
+  std::size_t GetMemoryUsage() const;
+  std::size_t GetFaceCount() const;
+
+private:
+  TessellationCache(const TessellationCache &);
+  const TessellationCache &operator=(const TessellationCache &);
+
+  class Entry {
+  public:
+    Entry() : key(0), face(), bytes(0) {}
+    ~Entry() {}
+
+    uint64_t key;
+    FacePtr face;
+    std::size_t bytes;
+  };
+
+  class Shard {
+  public:
+    Shard() : mutex(), lru(), table(), usage(0) {}
+    ~Shard() {}
+
+    mutable std::mutex mutex;
+    // the most recently used face first
+    std::list<Entry> lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> table;
+    std::size_t usage;
+  };
+
+  Shard &get_shard(uint64_t key);
+  void evict(Shard &shard);
+
+  std::vector<Shard> shards_;
+  std::atomic<std::size_t> budget_;
+  std::atomic<int> next_mesh_id_;
+
+  Vector dicing_position_;
+  Real dicing_spread_;
+};
+
+// cache used by displaced meshes. 256MB by default
+FJ_API TessellationCache &TessellationCacheGetGlobal();
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -3,22 +3,38 @@
 
 #include "fj_texture.h"
 #include "fj_framebuffer_io.h"
-#include "fj_multi_thread.h"
 #include "fj_tex_coord.h"
 #include "fj_vector.h"
 #include "fj_color.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cmath>
 
 namespace fj {
 
 static const Color4 NO_TEXTURE_COLOR(1, .63, .63, 1);
+// footprints longer than this times the width are blurred across
+static const int MAX_ANISOTROPY = 8;
+
+static Color4 texel_to_color(const float *texel, int nchannels)
+{
+  switch (nchannels) {
+  case 1:
+    return Color4(texel[0], texel[0], texel[0], 1);
+  case 3:
+    return Color4(texel[0], texel[1], texel[2], 1);
+  case 4:
+    return Color4(texel[0], texel[1], texel[2], texel[3]);
+  default:
+    return NO_TEXTURE_COLOR;
+  }
+}
 
 TextureCache::TextureCache() :
-  fb_(),
+  last_tiles_(),
   mip_(),
-  last_xtile_(-1),
-  last_ytile_(-1),
+  file_id_(-1),
   is_open_(false)
 {
 }
@@ -42,7 +58,23 @@ int TextureCache::OpenMipmap(const std::string &filename)
     return -1;
   }
 
-  fb_.Resize(mip_.GetTileSize(), mip_.GetTileSize(), mip_.GetChannelCount());
+  file_id_ = TileCacheGetGlobal().GetFileID(filename);
+  TileCacheGetGlobal().RecordOpen(file_id_, false);
+  last_tiles_.assign(mip_.GetLevelCount(), LevelTile());
+  is_open_ = true;
+
+  return 0;
+}
+
+int TextureCache::ShareMipmap(const MipInput &mip)
+{
+  if (mip_.Share(mip)) {
+    return -1;
+  }
+
+  file_id_ = TileCacheGetGlobal().GetFileID(mip.GetFilename());
+  TileCacheGetGlobal().RecordOpen(file_id_, true);
+  last_tiles_.assign(mip_.GetLevelCount(), LevelTile());
   is_open_ = true;
 
   return 0;
@@ -54,27 +86,267 @@ Color4 TextureCache::LookupTexture(float u, float v)
     return NO_TEXTURE_COLOR;
   }
 
+  return lookup_level(u, v, 0);
+}
+
+Color4 TextureCache::LookupTexture(float u, float v, float du, float dv)
+{
+  if (!mip_.IsOpen()) {
+    return NO_TEXTURE_COLOR;
+  }
+
+  // footprint in texels of level 0
+  const float texels = std::max(
+      std::abs(du) * mip_.GetWidth(),
+      std::abs(dv) * mip_.GetHeight());
+
+  const int level = static_cast<int>(std::floor(compute_level(texels) + .5f));
+  return lookup_level(u, v, level);
+}
+
+Color4 TextureCache::LookupBilinear(float u, float v)
+{
+  if (!mip_.IsOpen()) {
+    return NO_TEXTURE_COLOR;
+  }
+
+  return lookup_bilinear(u, v, 0);
+}
+
+Color4 TextureCache::LookupTrilinear(float u, float v, float du, float dv)
+{
+  if (!mip_.IsOpen()) {
+    return NO_TEXTURE_COLOR;
+  }
+
+  const float texels = std::max(
+      std::abs(du) * mip_.GetWidth(),
+      std::abs(dv) * mip_.GetHeight());
+
+  return lookup_trilinear(u, v, compute_level(texels));
+}
+
+int TextureCache::LookupBumpDerivatives(float u, float v, float du, float dv,
+    float *dhdu, float *dhdv)
+{
+  if (!mip_.IsOpen() || !mip_.HasBumpDerivatives()) {
+    return -1;
+  }
+
+  // the same level as LookupTexture
+  const float texels = std::max(
+      std::abs(du) * mip_.GetWidth(),
+      std::abs(dv) * mip_.GetHeight());
+  const int level = static_cast<int>(std::floor(compute_level(texels) + .5f));
+
+  float texel[2] = {0, 0};
+  if (bilinear_channels(u, v, level, mip_.GetChannelCount() - 2, 2, texel)) {
+    return -1;
+  }
+
+  // from texels of level 0 to texture space
+  *dhdu = texel[0] * mip_.GetWidth();
+  *dhdv = texel[1] * mip_.GetHeight();
+  return 0;
+}
+
+Color4 TextureCache::LookupAnisotropic(float u, float v,
+    float dudx, float dvdx, float dudy, float dvdy)
+{
+  if (!mip_.IsOpen()) {
+    return NO_TEXTURE_COLOR;
+  }
+
+  // axes of the footprint in texels of level 0
+  const float W = mip_.GetWidth();
+  const float H = mip_.GetHeight();
+  const float x_len = std::sqrt(dudx * dudx * W * W + dvdx * dvdx * H * H);
+  const float y_len = std::sqrt(dudy * dudy * W * W + dvdy * dvdy * H * H);
+
+  const bool is_x_major = x_len >= y_len;
+  const float major_len = is_x_major ? x_len : y_len;
+  const float minor_len = is_x_major ? y_len : x_len;
+  const float major_du = is_x_major ? dudx : dudy;
+  const float major_dv = is_x_major ? dvdx : dvdy;
+
+  if (major_len <= 0) {
+    return lookup_bilinear(u, v, 0);
+  }
+
+  // lookups of the minor width cover the major axis
+  const float width = std::max(minor_len, major_len / MAX_ANISOTROPY);
+  const int nprobes = std::max(1, std::min(MAX_ANISOTROPY,
+      static_cast<int>(std::ceil(major_len / width))));
+  const float level = compute_level(width);
+
+  Color4 sum(0, 0, 0, 0);
+  for (int i = 0; i < nprobes; i++) {
+    const float t = (i + .5f) / nprobes - .5f;
+    sum += lookup_trilinear(u + t * major_du, v + t * major_dv, level);
+  }
+
+  return sum / nprobes;
+}
+
+void TextureCache::Prefetch(const TileLoader::MipPtr &source,
+    float u, float v, float du, float dv)
+{
+  if (!mip_.IsOpen()) {
+    return;
+  }
+
+  const float texels = std::max(
+      std::abs(du) * mip_.GetWidth(),
+      std::abs(dv) * mip_.GetHeight());
+  const float level = compute_level(texels);
+  const int level0 = static_cast<int>(floor(level));
+
+  prefetch_level(source, u, v, level0);
+  if (level > level0 && level0 + 1 < mip_.GetLevelCount()) {
+    prefetch_level(source, u, v, level0 + 1);
+  }
+}
+
+// each level doubles the size of texels
+float TextureCache::compute_level(float texels) const
+{
+  if (texels <= 1) {
+    return 0;
+  }
+  return std::min(std::log2(texels), static_cast<float>(mip_.GetLevelCount() - 1));
+}
+
+const CachedTile *TextureCache::get_tile(int level, int xtile, int ytile)
+{
+  LevelTile &last = last_tiles_[level];
+
+  if (xtile != last.xtile || ytile != last.ytile) {
+    last.tile = TileLoaderGetGlobal().Load(mip_, file_id_, level, xtile, ytile);
+    last.xtile = xtile;
+    last.ytile = ytile;
+  }
+
+  return last.tile.get();
+}
+
+Color4 TextureCache::lookup_level(float u, float v, int level)
+{
   const TexCoord tex_space(
       u - floor(u),
       v - floor(v));
 
   const TexCoord tile_space(
-           tex_space.u  * mip_.GetTileCountX(),
-      (1 - tex_space.v) * mip_.GetTileCountY());
+           tex_space.u  * mip_.GetLevelTileCountX(level),
+      (1 - tex_space.v) * mip_.GetLevelTileCountY(level));
 
   const int xtile = static_cast<int>(floor(tile_space.u));
   const int ytile = static_cast<int>(floor(tile_space.v));
 
-  if (xtile != last_xtile_ || ytile != last_ytile_) {
-    mip_.ReadTile(xtile, ytile, fb_.GetWritable(0, 0, 0));
-    last_xtile_ = xtile;
-    last_ytile_ = ytile;
+  const CachedTile *tile = get_tile(level, xtile, ytile);
+  if (tile == NULL) {
+    return NO_TEXTURE_COLOR;
+  }
+
+  const int TILESIZE = tile->tilesize;
+  const int xpxl = std::min((int)( (tile_space.u - floor(tile_space.u)) * TILESIZE), TILESIZE - 1);
+  const int ypxl = std::min((int)( (tile_space.v - floor(tile_space.v)) * TILESIZE), TILESIZE - 1);
+
+  return texel_to_color(tile->GetTexel(xpxl, ypxl), color_channel_count());
+}
+
+Color4 TextureCache::lookup_bilinear(float u, float v, int level)
+{
+  const int NCHANS = color_channel_count();
+  float texel[4] = {0, 0, 0, 0};
+  if (bilinear_channels(u, v, level, 0, std::min(NCHANS, 4), texel)) {
+    return NO_TEXTURE_COLOR;
+  }
+
+  return texel_to_color(texel, NCHANS);
+}
+
+int TextureCache::bilinear_channels(float u, float v, int level,
+    int first, int count, float *dst)
+{
+  const int W = mip_.GetLevelWidth(level);
+  const int H = mip_.GetLevelHeight(level);
+  const int TILESIZE = mip_.GetLevelTileSize(level);
+
+  // centers of texels are at half of integers
+  const float s = (u - floor(u)) * W - .5f;
+  const float t = (1 - (v - floor(v))) * H - .5f;
+  const float s0 = floor(s);
+  const float t0 = floor(t);
+  const float fs = s - s0;
+  const float ft = t - t0;
+
+  // the image repeats. texels on the right and below the last ones are
+  // in the border of the tile
+  const int x = (static_cast<int>(s0) % W + W) % W;
+  const int y = (static_cast<int>(t0) % H + H) % H;
+
+  const CachedTile *tile = get_tile(level, x / TILESIZE, y / TILESIZE);
+  if (tile == NULL) {
+    return -1;
+  }
+
+  const int xpxl = x % TILESIZE;
+  const int ypxl = y % TILESIZE;
+  const float *t00 = tile->GetTexel(xpxl,     ypxl)     + first;
+  const float *t10 = tile->GetTexel(xpxl + 1, ypxl)     + first;
+  const float *t01 = tile->GetTexel(xpxl,     ypxl + 1) + first;
+  const float *t11 = tile->GetTexel(xpxl + 1, ypxl + 1) + first;
+
+  for (int ch = 0; ch < count; ch++) {
+    const float top    = t00[ch] + fs * (t10[ch] - t00[ch]);
+    const float bottom = t01[ch] + fs * (t11[ch] - t01[ch]);
+    dst[ch] = top + ft * (bottom - top);
+  }
+
+  return 0;
+}
+
+// derivatives follow colors
+int TextureCache::color_channel_count() const
+{
+  return mip_.GetChannelCount() - (mip_.HasBumpDerivatives() ? 2 : 0);
+}
+
+Color4 TextureCache::lookup_trilinear(float u, float v, float level)
+{
+  const int level0 = static_cast<int>(floor(level));
+  const float t = level - level0;
+
+  const Color4 C0 = lookup_bilinear(u, v, level0);
+  if (t <= 0 || level0 + 1 >= mip_.GetLevelCount()) {
+    return C0;
   }
 
-  const int xpxl = (int)( (tile_space.u - floor(tile_space.u)) * 64);
-  const int ypxl = (int)( (tile_space.v - floor(tile_space.v)) * 64);
+  const Color4 C1 = lookup_bilinear(u, v, level0 + 1);
+  return C0 + t * (C1 - C0);
+}
 
-  return fb_.GetColor(xpxl, ypxl);
+// the tile lookup_bilinear reads
+void TextureCache::prefetch_level(const TileLoader::MipPtr &source,
+    float u, float v, int level)
+{
+  const int W = mip_.GetLevelWidth(level);
+  const int H = mip_.GetLevelHeight(level);
+  const int TILESIZE = mip_.GetLevelTileSize(level);
+
+  const float s = (u - floor(u)) * W - .5f;
+  const float t = (1 - (v - floor(v))) * H - .5f;
+  const int x = (static_cast<int>(floor(s)) % W + W) % W;
+  const int y = (static_cast<int>(floor(t)) % H + H) % H;
+  const int xtile = x / TILESIZE;
+  const int ytile = y / TILESIZE;
+
+  const LevelTile &last = last_tiles_[level];
+  if (xtile == last.xtile && ytile == last.ytile) {
+    return;
+  }
+
+  TileLoaderGetGlobal().Request(source, file_id_, level, xtile, ytile);
 }
 
 int TextureCache::GetTextureWidth() const
@@ -100,7 +372,10 @@ bool TextureCache::IsOpen() const
 
 Texture::Texture() :
     filename_(""),
-    cache_list_(MtGetMaxAvailableThreadCount())
+    mip_(),
+    io_mip_(),
+    file_id_(-1),
+    thread_caches_()
 {
 }
 
@@ -110,42 +385,128 @@ Texture::~Texture()
 
 Color4 Texture::Lookup(float u, float v) const
 {
-  const int thread_id = MtGetThreadID();
-  TextureCache &this_cache = const_cast<TextureCache&>(cache_list_[thread_id]);
+  return get_thread_cache().LookupTexture(u, v);
+}
+
+Color4 Texture::Lookup(float u, float v, float du, float dv) const
+{
+  return get_thread_cache().LookupTexture(u, v, du, dv);
+}
 
-  if (!this_cache.IsOpen()) {
-    this_cache.OpenMipmap(filename_);
+Color4 Texture::LookupBilinear(float u, float v) const
+{
+  return get_thread_cache().LookupBilinear(u, v);
+}
+
+Color4 Texture::LookupTrilinear(float u, float v, float du, float dv) const
+{
+  return get_thread_cache().LookupTrilinear(u, v, du, dv);
+}
+
+Color4 Texture::LookupAnisotropic(float u, float v,
+    float dudx, float dvdx, float dudy, float dvdy) const
+{
+  return get_thread_cache().LookupAnisotropic(u, v, dudx, dvdx, dudy, dvdy);
+}
+
+int Texture::LookupBumpDerivatives(float u, float v, float du, float dv,
+    float *dhdu, float *dhdv) const
+{
+  return get_thread_cache().LookupBumpDerivatives(u, v, du, dv, dhdu, dhdv);
+}
+
+bool Texture::HasBumpDerivatives() const
+{
+  return mip_.IsOpen() && mip_.HasBumpDerivatives();
+}
+
+void Texture::Prefetch(float u, float v, float du, float dv) const
+{
+  if (!io_mip_) {
+    return;
+  }
+  get_thread_cache().Prefetch(io_mip_, u, v, du, dv);
+}
+
+void Texture::PrefetchLevel(int level) const
+{
+  if (!io_mip_ || level < 0 || level >= mip_.GetLevelCount()) {
+    return;
   }
 
-  return this_cache.LookupTexture(u, v);
+  TileLoader &loader = TileLoaderGetGlobal();
+  const int XNTILES = mip_.GetLevelTileCountX(level);
+  const int YNTILES = mip_.GetLevelTileCountY(level);
+  for (int y = 0; y < YNTILES; y++) {
+    for (int x = 0; x < XNTILES; x++) {
+      loader.Request(io_mip_, file_id_, level, x, y);
+    }
+  }
 }
 
 int Texture::LoadFile(const std::string &filename)
 {
   if (filename_ == "") {
-    const size_t cache_count = cache_list_.size();
-    cache_list_.clear();
-    cache_list_.resize(cache_count);
+    thread_caches_.Clear();
   }
   filename_ = filename;
 
-  return cache_list_[0].OpenMipmap(filename_);
+  // the file may have changed since tiles were cached. tiles being read
+  // are inserted before they are dropped
+  TileLoaderGetGlobal().Wait();
+  TileCache &cache = TileCacheGetGlobal();
+  file_id_ = cache.GetFileID(filename_);
+  cache.RemoveFile(file_id_);
+  io_mip_.reset();
+
+  if (mip_.Open(filename_) || mip_.ReadHeader()) {
+    mip_.Close();
+    return -1;
+  }
+  cache.RecordOpen(file_id_, false);
+
+  std::shared_ptr<MipInput> io_mip = std::make_shared<MipInput>();
+  if (io_mip->Share(mip_) == 0) {
+    io_mip_ = io_mip;
+  }
+
+  return thread_caches_.Get().ShareMipmap(mip_);
 }
 
 int Texture::GetWidth() const
 {
-  if (!cache_list_[0].IsOpen()) {
+  if (!mip_.IsOpen()) {
     return 0;
   }
-  return cache_list_[0].GetTextureWidth();
+  return mip_.GetWidth();
 }
 
 int Texture::GetHeight() const
 {
-  if (!cache_list_[0].IsOpen()) {
+  if (!mip_.IsOpen()) {
+    return 0;
+  }
+  return mip_.GetHeight();
+}
+
+std::size_t Texture::GetMemoryUsage() const
+{
+  if (!mip_.IsOpen()) {
     return 0;
   }
-  return cache_list_[0].GetTextureHeight();
+  return TileCacheGetGlobal().GetFileMemoryUsage(
+      TileCacheGetGlobal().GetFileID(filename_));
+}
+
+TextureCache &Texture::get_thread_cache() const
+{
+  TextureCache &this_cache = thread_caches_.Get();
+
+  if (!this_cache.IsOpen()) {
+    this_cache.ShareMipmap(mip_);
+  }
+
+  return this_cache;
 }
 
 } // namespace xxx
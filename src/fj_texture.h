@@ -6,7 +6,10 @@
 
 #include "fj_compatibility.h"
 #include "fj_framebuffer.h"
+#include "fj_tile_cache.h"
+#include "fj_tile_loader.h"
 #include "fj_mipmap.h"
+#include "fj_thread_state.h"
 #include <string>
 #include <vector>
 
@@ -15,24 +18,58 @@ namespace fj {
 class MipInput;
 class Color4;
 
-// Texture cache for each thread
+// Reads tiles of a texture for each thread. tiles are shared with other
+// threads and textures through TileCacheGetGlobal()
 class FJ_API TextureCache {
 public:
   TextureCache();
   ~TextureCache();
 
   int OpenMipmap(const std::string &filename);
+  // Shares the mapping of the file opened by mip
+  int ShareMipmap(const MipInput &mip);
   Color4 LookupTexture(float u, float v);
+  Color4 LookupTexture(float u, float v, float du, float dv);
+  Color4 LookupBilinear(float u, float v);
+  Color4 LookupTrilinear(float u, float v, float du, float dv);
+  Color4 LookupAnisotropic(float u, float v,
+      float dudx, float dvdx, float dudy, float dvdy);
+  // returns -1 if the mipmap has no derivatives
+  int LookupBumpDerivatives(float u, float v, float du, float dv,
+      float *dhdu, float *dhdv);
+  // requests the tiles LookupTrilinear(u, v, du, dv) reads from source
+  // unless they are the last tiles used by this thread
+  void Prefetch(const TileLoader::MipPtr &source, float u, float v, float du, float dv);
 
   int GetTextureWidth() const;
   int GetTextureHeight() const;
   bool IsOpen() const;
 
 private:
-  FrameBuffer fb_;
+  class LevelTile {
+  public:
+    LevelTile() : tile(), xtile(-1), ytile(-1) {}
+    ~LevelTile() {}
+
+    TileCache::TilePtr tile;
+    int xtile;
+    int ytile;
+  };
+
+  float compute_level(float texels) const;
+  const CachedTile *get_tile(int level, int xtile, int ytile);
+  Color4 lookup_level(float u, float v, int level);
+  Color4 lookup_bilinear(float u, float v, int level);
+  int bilinear_channels(float u, float v, int level, int first, int count, float *dst);
+  int color_channel_count() const;
+  Color4 lookup_trilinear(float u, float v, float level);
+  void prefetch_level(const TileLoader::MipPtr &source, float u, float v, int level);
+
+  // the last tile of each level used by this thread. trilinear lookups
+  // read two levels in turn
+  std::vector<LevelTile> last_tiles_;
   MipInput mip_;
-  int last_xtile_;
-  int last_ytile_;
+  int file_id_;
   bool is_open_;
 };
 
@@ -46,14 +83,53 @@ public:
   // (r, g, b, 1) will be returned when texture is rgb.
   // (r, g, b, a) will be returned when texture is rgba.
   Color4 Lookup(float u, float v) const;
+  // Same as above but reads the level of mipmap whose texels are as large
+  // as the filter footprint du x dv in texture space. for ray differentials
+  // du and dv are the largest of |du/dx|, |du/dy| and |dv/dx|, |dv/dy|.
+  Color4 Lookup(float u, float v, float du, float dv) const;
+  // Filtered lookups. bilinear interpolates the 4 nearest texels of level 0.
+  // trilinear also interpolates the 2 levels around the footprint du x dv.
+  // anisotropic takes the derivatives of u and v along two axes of the
+  // footprint e.g. d/dx and d/dy of the screen, and averages trilinear
+  // lookups along the longer axis.
+  Color4 LookupBilinear(float u, float v) const;
+  Color4 LookupTrilinear(float u, float v, float du, float dv) const;
+  Color4 LookupAnisotropic(float u, float v,
+      float dudx, float dvdx, float dudy, float dvdy) const;
+  // Derivatives of the height (the luminance) with respect to u and v over
+  // the footprint du x dv, baked by MipOutput::SetBumpDerivatives. one
+  // lookup instead of finite differences of four. returns -1 if the
+  // texture has none of them
+  int LookupBumpDerivatives(float u, float v, float du, float dv,
+      float *dhdu, float *dhdv) const;
+  bool HasBumpDerivatives() const;
+  // Hints that lookups around (u, v) with the footprint du x dv come soon
+  // e.g. for a batch of points before they are shaded. missing tiles are
+  // read by TileLoaderGetGlobal() meanwhile
+  void Prefetch(float u, float v, float du, float dv) const;
+  // requests all tiles of the level e.g. coarse levels for an object
+  // known to be visible
+  void PrefetchLevel(int level) const;
   int LoadFile(const std::string &filename);
 
   int GetWidth() const;
   int GetHeight() const;
+  // bytes of tiles of the texture in the global tile cache
+  std::size_t GetMemoryUsage() const;
 
 private:
+  Texture(const Texture &);
+  const Texture &operator=(const Texture &);
+
+  TextureCache &get_thread_cache() const;
+
   std::string filename_;
-  std::vector<TextureCache> cache_list_;
+  // opened once and shared by caches of all threads
+  MipInput mip_;
+  // shared with I/O threads of the tile loader
+  TileLoader::MipPtr io_mip_;
+  int file_id_;
+  ThreadState<TextureCache> thread_caches_;
 };
 
 } // namespace xxx
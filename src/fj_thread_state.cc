@@ -0,0 +1,135 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_thread_state.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace fj {
+
+typedef void (*DestroyFunction)(void *value);
+
+class ThreadValues;
+
+// destroy functions of slots. NULL once the slot is freed
+static std::vector<DestroyFunction> slot_list;
+static std::vector<ThreadValues *> thread_values_list;
+static std::mutex thread_state_mtx;
+
+// values of a thread indexed by slot. registered while the thread lives
+class ThreadValues {
+public:
+  ThreadValues() : values()
+  {
+    std::lock_guard<std::mutex> lock(thread_state_mtx);
+    thread_values_list.push_back(this);
+  }
+  ~ThreadValues()
+  {
+    std::lock_guard<std::mutex> lock(thread_state_mtx);
+    for (std::size_t i = 0; i < values.size(); i++) {
+      if (values[i] != NULL && slot_list[i] != NULL) {
+        slot_list[i](values[i]);
+      }
+    }
+    thread_values_list.erase(
+        std::find(thread_values_list.begin(), thread_values_list.end(), this));
+  }
+
+  std::vector<void *> values;
+};
+
+static ThreadValues &get_thread_values()
+{
+  static thread_local ThreadValues thread_values;
+  return thread_values;
+}
+
+static void clear_slot(int slot)
+{
+  for (std::size_t i = 0; i < thread_values_list.size(); i++) {
+    std::vector<void *> &values = thread_values_list[i]->values;
+    if (slot < static_cast<int>(values.size()) && values[slot] != NULL) {
+      slot_list[slot](values[slot]);
+      values[slot] = NULL;
+    }
+  }
+}
+
+int ThreadStateNewSlot(void (*destroy)(void *value))
+{
+  // slots are never reused so values of freed slots are never found
+  std::lock_guard<std::mutex> lock(thread_state_mtx);
+  slot_list.push_back(destroy);
+  return static_cast<int>(slot_list.size()) - 1;
+}
+
+void ThreadStateClearSlot(int slot)
+{
+  std::lock_guard<std::mutex> lock(thread_state_mtx);
+  if (slot < 0 || slot >= static_cast<int>(slot_list.size()) || slot_list[slot] == NULL) {
+    return;
+  }
+  clear_slot(slot);
+}
+
+void ThreadStateFreeSlot(int slot)
+{
+  std::lock_guard<std::mutex> lock(thread_state_mtx);
+  if (slot < 0 || slot >= static_cast<int>(slot_list.size()) || slot_list[slot] == NULL) {
+    return;
+  }
+  clear_slot(slot);
+  slot_list[slot] = NULL;
+}
+
+void *ThreadStateGetValue(int slot)
+{
+  const std::vector<void *> &values = get_thread_values().values;
+  if (slot < 0 || slot >= static_cast<int>(values.size())) {
+    return NULL;
+  }
+  return values[slot];
+}
+
+void ThreadStateSetValue(int slot, void *value)
+{
+  ThreadValues &thread_values = get_thread_values();
+  std::lock_guard<std::mutex> lock(thread_state_mtx);
+  if (slot < 0 || slot >= static_cast<int>(slot_list.size())) {
+    return;
+  }
+  if (slot >= static_cast<int>(thread_values.values.size())) {
+    thread_values.values.resize(slot + 1, NULL);
+  }
+  thread_values.values[slot] = value;
+}
+
+void *ThreadStateAllocate(std::size_t size)
+{
+  // the address of new[] is stored right before the aligned memory
+  const std::size_t padded_size =
+      (size + THREAD_STATE_ALIGNMENT - 1) / THREAD_STATE_ALIGNMENT * THREAD_STATE_ALIGNMENT;
+  char *data = new char[padded_size + THREAD_STATE_ALIGNMENT + sizeof(char *)];
+
+  const uintptr_t start = reinterpret_cast<uintptr_t>(data + sizeof(char *));
+  const uintptr_t aligned =
+      (start + THREAD_STATE_ALIGNMENT - 1) / THREAD_STATE_ALIGNMENT * THREAD_STATE_ALIGNMENT;
+  char *ptr = reinterpret_cast<char *>(aligned);
+  reinterpret_cast<char **>(ptr)[-1] = data;
+
+  return ptr;
+}
+
+void ThreadStateFree(void *ptr)
+{
+  if (ptr == NULL) {
+    return;
+  }
+  delete [] reinterpret_cast<char **>(ptr)[-1];
+}
+
+} // namespace xxx
@@ -0,0 +1,75 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_THREAD_STATE_H
+#define FJ_THREAD_STATE_H
+
+#include "fj_compatibility.h"
+#include <cstddef>
+#include <new>
+
+// Per-thread persistent values of shaders, procedures and the renderer.
+// a slot holds one value for each thread that asked for it. values are
+// found through thread local storage instead of MtGetThreadID() since
+// ids are reused by loops running at the same time
+
+namespace fj {
+
+// values are padded and aligned to this not to share cache lines
+const std::size_t THREAD_STATE_ALIGNMENT = 64;
+
+// destroy is called for each value of the slot when the thread exits,
+// or when the slot is cleared or freed. it must not use thread states
+FJ_API int ThreadStateNewSlot(void (*destroy)(void *value));
+// destroys values of all threads. call when no thread uses the slot
+FJ_API void ThreadStateClearSlot(int slot);
+FJ_API void ThreadStateFreeSlot(int slot);
+
+// value of the calling thread or NULL if not set
+FJ_API void *ThreadStateGetValue(int slot);
+FJ_API void ThreadStateSetValue(int slot, void *value);
+
+// memory aligned and padded to THREAD_STATE_ALIGNMENT
+FJ_API void *ThreadStateAllocate(std::size_t size);
+FJ_API void ThreadStateFree(void *ptr);
+
+// a default constructed T for each thread, created on the first Get() of
+// the thread. typically a member of a shader created with the shader and
+// used in Evaluate() without locks or allocations
+template<typename T>
+class ThreadState {
+public:
+  ThreadState() : slot_(ThreadStateNewSlot(destroy)) {}
+  ~ThreadState() { ThreadStateFreeSlot(slot_); }
+
+  T &Get() const
+  {
+    void *value = ThreadStateGetValue(slot_);
+    if (value == NULL) {
+      value = ThreadStateAllocate(sizeof(T));
+      new (value) T();
+      ThreadStateSetValue(slot_, value);
+    }
+    return *static_cast<T *>(value);
+  }
+
+  // values are created again by the next Get(). call when no thread
+  // uses them
+  void Clear() { ThreadStateClearSlot(slot_); }
+
+private:
+  ThreadState(const ThreadState &);
+  const ThreadState &operator=(const ThreadState &);
+
+  static void destroy(void *value)
+  {
+    static_cast<T *>(value)->~T();
+    ThreadStateFree(value);
+  }
+
+  const int slot_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
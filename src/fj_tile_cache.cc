@@ -0,0 +1,333 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_tile_cache.h"
+
+namespace fj {
+
+static const int SHARD_COUNT = 32;
+static const std::size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+// bookkeeping of each entry besides texels
+static const std::size_t ENTRY_OVERHEAD = 64;
+
+// 21 bits for file, 5 for level and 19 for each tile coordinate
+static uint64_t make_key(int file_id, int level, int xtile, int ytile)
+{
+  return
+      (static_cast<uint64_t>(file_id) << 43) |
+      (static_cast<uint64_t>(level & 0x1f) << 38) |
+      (static_cast<uint64_t>(xtile & 0x7ffff) << 19) |
+      (static_cast<uint64_t>(ytile & 0x7ffff));
+}
+
+static int key_to_file_id(uint64_t key)
+{
+  return static_cast<int>(key >> 43);
+}
+
+// neighbor tiles go to different shards
+static uint64_t mix_key(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return key;
+}
+
+static std::size_t tile_bytes(const CachedTile &tile)
+{
+  return sizeof(float) * tile.texels.size() + ENTRY_OVERHEAD;
+}
+
+// counters of the file in the shard. called with the shard locked
+static TileFileStats &file_stats_of(std::vector<TileFileStats> &file_stats, int file_id)
+{
+  if (file_id >= static_cast<int>(file_stats.size())) {
+    file_stats.resize(file_id + 1);
+  }
+  return file_stats[file_id];
+}
+
+TileFileStats::TileFileStats() :
+  lookup_count(0),
+  hit_count(0),
+  read_count(0),
+  read_bytes(0),
+  read_nanoseconds(0),
+  wait_nanoseconds(0),
+  evicted_count(0),
+  open_count(0),
+  share_count(0)
+{
+}
+
+void TileFileStats::Add(const TileFileStats &other)
+{
+  lookup_count += other.lookup_count;
+  hit_count += other.hit_count;
+  read_count += other.read_count;
+  read_bytes += other.read_bytes;
+  read_nanoseconds += other.read_nanoseconds;
+  wait_nanoseconds += other.wait_nanoseconds;
+  evicted_count += other.evicted_count;
+  open_count += other.open_count;
+  share_count += other.share_count;
+}
+
+TileCache::TileCache() :
+  shards_(SHARD_COUNT),
+  budget_(DEFAULT_MEMORY_BUDGET),
+  file_mutex_(),
+  file_ids_(),
+  file_names_()
+{
+}
+
+TileCache::~TileCache()
+{
+}
+
+int TileCache::GetFileID(const std::string &filename)
+{
+  std::lock_guard<std::mutex> lock(file_mutex_);
+  std::unordered_map<std::string, int>::const_iterator it = file_ids_.find(filename);
+  if (it != file_ids_.end()) {
+    return it->second;
+  }
+
+  const int id = static_cast<int>(file_ids_.size());
+  file_ids_[filename] = id;
+  file_names_.push_back(filename);
+  return id;
+}
+
+TileCache::TilePtr TileCache::Find(int file_id, int level, int xtile, int ytile)
+{
+  const uint64_t key = make_key(file_id, level, xtile, ytile);
+  Shard &shard = get_shard(key);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  TileFileStats &stats = file_stats_of(shard.file_stats, file_id);
+  stats.lookup_count++;
+
+  std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+      shard.table.find(key);
+  if (it == shard.table.end()) {
+    return TilePtr();
+  }
+
+  stats.hit_count++;
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  return it->second->tile;
+}
+
+TileCache::TilePtr TileCache::Insert(int file_id, int level, int xtile, int ytile,
+    const TilePtr &tile)
+{
+  const uint64_t key = make_key(file_id, level, xtile, ytile);
+  Shard &shard = get_shard(key);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+      shard.table.find(key);
+  if (it != shard.table.end()) {
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return it->second->tile;
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.tile = tile;
+  entry.bytes = tile_bytes(*tile);
+
+  shard.lru.push_front(entry);
+  shard.table[key] = shard.lru.begin();
+  shard.usage += entry.bytes;
+
+  evict(shard);
+  return tile;
+}
+
+void TileCache::RemoveFile(int file_id)
+{
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    std::list<Entry>::iterator it = shard.lru.begin();
+    while (it != shard.lru.end()) {
+      if (key_to_file_id(it->key) == file_id) {
+        shard.usage -= it->bytes;
+        shard.table.erase(it->key);
+        it = shard.lru.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void TileCache::Clear()
+{
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.lru.clear();
+    shard.table.clear();
+    shard.usage = 0;
+  }
+}
+
+void TileCache::SetMemoryBudget(std::size_t bytes)
+{
+  budget_ = bytes;
+
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    evict(shard);
+  }
+}
+
+std::size_t TileCache::GetMemoryBudget() const
+{
+  return budget_;
+}
+
+std::size_t TileCache::GetMemoryUsage() const
+{
+  std::size_t usage = 0;
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    const Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    usage += shard.usage;
+  }
+  return usage;
+}
+
+std::size_t TileCache::GetFileMemoryUsage(int file_id) const
+{
+  std::size_t usage = 0;
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    const Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    std::list<Entry>::const_iterator it = shard.lru.begin();
+    for (; it != shard.lru.end(); ++it) {
+      if (key_to_file_id(it->key) == file_id) {
+        usage += it->bytes;
+      }
+    }
+  }
+  return usage;
+}
+
+std::size_t TileCache::GetTileCount() const
+{
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    const Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    count += shard.table.size();
+  }
+  return count;
+}
+
+void TileCache::RecordRead(int file_id, std::size_t bytes, int64_t nanoseconds)
+{
+  Shard &shard = get_shard(static_cast<uint64_t>(file_id));
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  TileFileStats &stats = file_stats_of(shard.file_stats, file_id);
+  stats.read_count++;
+  stats.read_bytes += bytes;
+  stats.read_nanoseconds += nanoseconds;
+}
+
+void TileCache::RecordWait(int file_id, int64_t nanoseconds)
+{
+  Shard &shard = get_shard(static_cast<uint64_t>(file_id));
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  file_stats_of(shard.file_stats, file_id).wait_nanoseconds += nanoseconds;
+}
+
+void TileCache::RecordOpen(int file_id, bool is_shared)
+{
+  Shard &shard = get_shard(static_cast<uint64_t>(file_id));
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  TileFileStats &stats = file_stats_of(shard.file_stats, file_id);
+  if (is_shared) {
+    stats.share_count++;
+  } else {
+    stats.open_count++;
+  }
+}
+
+int TileCache::GetFileCount() const
+{
+  std::lock_guard<std::mutex> lock(file_mutex_);
+  return static_cast<int>(file_names_.size());
+}
+
+std::string TileCache::GetFileName(int file_id) const
+{
+  std::lock_guard<std::mutex> lock(file_mutex_);
+  if (file_id < 0 || file_id >= static_cast<int>(file_names_.size())) {
+    return "";
+  }
+  return file_names_[file_id];
+}
+
+void TileCache::GetFileStats(int file_id, TileFileStats *stats) const
+{
+  *stats = TileFileStats();
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    const Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (file_id >= 0 && file_id < static_cast<int>(shard.file_stats.size())) {
+      stats->Add(shard.file_stats[file_id]);
+    }
+  }
+}
+
+void TileCache::ResetStats()
+{
+  for (std::size_t i = 0; i < shards_.size(); i++) {
+    Shard &shard = shards_[i];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (std::size_t j = 0; j < shard.file_stats.size(); j++) {
+      TileFileStats &stats = shard.file_stats[j];
+      TileFileStats cleared;
+      cleared.open_count = stats.open_count;
+      cleared.share_count = stats.share_count;
+      stats = cleared;
+    }
+  }
+}
+
+TileCache::Shard &TileCache::get_shard(uint64_t key)
+{
+  return shards_[mix_key(key) % shards_.size()];
+}
+
+void TileCache::evict(Shard &shard)
+{
+  // each shard gets the same share of the budget. the newest tile is kept
+  // even if it alone exceeds the share
+  const std::size_t share = budget_ / shards_.size();
+
+  while (shard.usage > share && shard.lru.size() > 1) {
+    const Entry &oldest = shard.lru.back();
+    file_stats_of(shard.file_stats, key_to_file_id(oldest.key)).evicted_count++;
+    shard.usage -= oldest.bytes;
+    shard.table.erase(oldest.key);
+    shard.lru.pop_back();
+  }
+}
+
+TileCache &TileCacheGetGlobal()
+{
+  static TileCache cache;
+  return cache;
+}
+
+} // namespace xxx
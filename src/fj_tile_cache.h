@@ -0,0 +1,145 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_TILE_CACHE_H
+#define FJ_TILE_CACHE_H
+
+#include "fj_compatibility.h"
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <list>
+
+namespace fj {
+
+// Texels of a tile and a border of one texel on the right and the bottom
+// copied from the neighbor tiles. rows have tilesize + 1 texels.
+class FJ_API CachedTile {
+public:
+  CachedTile() : texels(), tilesize(0), nchannels(0) {}
+  ~CachedTile() {}
+
+  const float *GetTexel(int x, int y) const
+  {
+    return &texels[((tilesize + 1) * y + x) * nchannels];
+  }
+
+  std::vector<float> texels;
+  int tilesize;
+  int nchannels;
+};
+
+// counters of a file in the tile cache since the last ResetStats()
+class FJ_API TileFileStats {
+public:
+  TileFileStats();
+  ~TileFileStats() {}
+
+  void Add(const TileFileStats &other);
+
+  // Find() and the tiles found
+  int64_t lookup_count;
+  int64_t hit_count;
+  // tiles read from the file, bytes of their texels and time of reading
+  int64_t read_count;
+  int64_t read_bytes;
+  int64_t read_nanoseconds;
+  // time lookups were blocked waiting for tiles read by other threads
+  int64_t wait_nanoseconds;
+  int64_t evicted_count;
+  // readers opening the file and readers sharing the mapping of another.
+  // kept by ResetStats() as files are opened while loading scenes
+  int64_t open_count;
+  int64_t share_count;
+};
+
+// Texture tiles shared by all textures and threads. The least recently used
+// tiles are evicted when the memory budget is exceeded. Keys are split into
+// shards with their own lock so threads rarely wait for each other. Evicted
+// tiles stay valid while someone holds them.
+class FJ_API TileCache {
+public:
+  typedef std::shared_ptr<const CachedTile> TilePtr;
+
+  TileCache();
+  ~TileCache();
+
+  // the same id for the same filename
+  int GetFileID(const std::string &filename);
+
+  // Returns NULL if not cached.
+  TilePtr Find(int file_id, int level, int xtile, int ytile);
+  // Returns the tile in the cache when another thread has inserted it first.
+  TilePtr Insert(int file_id, int level, int xtile, int ytile, const TilePtr &tile);
+  // Drops all tiles of the file e.g. when it is loaded again.
+  void RemoveFile(int file_id);
+  void Clear();
+
+  void SetMemoryBudget(std::size_t bytes);
+  std::size_t GetMemoryBudget() const;
+  std::size_t GetMemoryUsage() const;
+  // bytes of tiles of the file in the cache
+  std::size_t GetFileMemoryUsage(int file_id) const;
+  std::size_t GetTileCount() const;
+
+  // called by readers of files. read_nanoseconds includes decoding
+  void RecordRead(int file_id, std::size_t bytes, int64_t nanoseconds);
+  void RecordWait(int file_id, int64_t nanoseconds);
+  void RecordOpen(int file_id, bool is_shared);
+
+  // file ids are from 0 to GetFileCount() - 1
+  int GetFileCount() const;
+  std::string GetFileName(int file_id) const;
+  void GetFileStats(int file_id, TileFileStats *stats) const;
+  void ResetStats();
+
+private:
+  TileCache(const TileCache &);
+  const TileCache &operator=(const TileCache &);
+
+  class Entry {
+  public:
+    Entry() : key(0), tile(), bytes(0) {}
+    ~Entry() {}
+
+    uint64_t key;
+    TilePtr tile;
+    std::size_t bytes;
+  };
+
+  class Shard {
+  public:
+    Shard() : mutex(), lru(), table(), usage(0), file_stats() {}
+    ~Shard() {}
+
+    mutable std::mutex mutex;
+    // the most recently used tile first
+    std::list<Entry> lru;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> table;
+    std::size_t usage;
+    // counters of keys of this shard by file id
+    std::vector<TileFileStats> file_stats;
+  };
+
+  Shard &get_shard(uint64_t key);
+  void evict(Shard &shard);
+
+  std::vector<Shard> shards_;
+  std::atomic<std::size_t> budget_;
+
+  mutable std::mutex file_mutex_;
+  std::unordered_map<std::string, int> file_ids_;
+  std::vector<std::string> file_names_;
+};
+
+// cache used by textures. 256MB by default
+FJ_API TileCache &TileCacheGetGlobal();
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
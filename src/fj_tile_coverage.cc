@@ -0,0 +1,123 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_tile_coverage.h"
+#include <algorithm>
+#include <iterator>
+
+namespace fj {
+
+static const std::size_t MIN_COMPACT_SIZE = 64;
+
+ObjectRecorder::ObjectRecorder() :
+  objects_(),
+  last_(NULL),
+  compact_size_(MIN_COMPACT_SIZE)
+{
+}
+
+ObjectRecorder::~ObjectRecorder()
+{
+}
+
+void ObjectRecorder::Clear()
+{
+  objects_.clear();
+  last_ = NULL;
+  compact_size_ = MIN_COMPACT_SIZE;
+}
+
+const std::vector<const ObjectInstance *> &ObjectRecorder::GetObjects()
+{
+  compact();
+  return objects_;
+}
+
+void ObjectRecorder::compact()
+{
+  std::sort(objects_.begin(), objects_.end());
+  objects_.erase(std::unique(objects_.begin(), objects_.end()), objects_.end());
+  // grows so that tiles hitting many objects don't sort all the time
+  compact_size_ = std::max(MIN_COMPACT_SIZE, 2 * objects_.size());
+}
+
+TileCoverage::TileCoverage() :
+  key_(0),
+  tile_objects_(),
+  is_rendered_()
+{
+}
+
+TileCoverage::~TileCoverage()
+{
+}
+
+void TileCoverage::Init(uint64_t key, int tile_count)
+{
+  key_ = key;
+  tile_objects_.clear();
+  tile_objects_.resize(std::max(tile_count, 0));
+  is_rendered_.assign(std::max(tile_count, 0), 0);
+}
+
+void TileCoverage::Clear()
+{
+  Init(0, 0);
+}
+
+uint64_t TileCoverage::GetKey() const
+{
+  return key_;
+}
+
+int TileCoverage::GetTileCount() const
+{
+  return static_cast<int>(is_rendered_.size());
+}
+
+void TileCoverage::SetTileRendered(int tile_id,
+    const std::vector<const ObjectInstance *> &objects, bool merges)
+{
+  if (tile_id < 0 || tile_id >= GetTileCount()) {
+    return;
+  }
+
+  std::vector<const ObjectInstance *> &dst = tile_objects_[tile_id];
+  if (merges && !dst.empty()) {
+    std::vector<const ObjectInstance *> merged;
+    std::set_union(dst.begin(), dst.end(), objects.begin(), objects.end(),
+        std::back_inserter(merged));
+    dst.swap(merged);
+  } else {
+    dst = objects;
+  }
+  is_rendered_[tile_id] = 1;
+}
+
+void TileCoverage::SetTileNeedsRendering(int tile_id)
+{
+  if (tile_id < 0 || tile_id >= GetTileCount()) {
+    return;
+  }
+  is_rendered_[tile_id] = 0;
+}
+
+bool TileCoverage::IsTileRendered(int tile_id) const
+{
+  if (tile_id < 0 || tile_id >= GetTileCount()) {
+    return false;
+  }
+  return is_rendered_[tile_id] != 0;
+}
+
+void TileCoverage::InvalidateObject(const ObjectInstance *object)
+{
+  for (int i = 0; i < GetTileCount(); i++) {
+    const std::vector<const ObjectInstance *> &objects = tile_objects_[i];
+    if (std::binary_search(objects.begin(), objects.end(), object)) {
+      is_rendered_[i] = 0;
+    }
+  }
+}
+
+} // namespace xxx
@@ -0,0 +1,81 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_TILE_COVERAGE_H
+#define FJ_TILE_COVERAGE_H
+
+#include "fj_compatibility.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace fj {
+
+class ObjectInstance;
+
+// Objects hit by rays of a tile being rendered. Camera, shadow,
+// reflection and other rays record their hits through the trace context.
+class FJ_API ObjectRecorder {
+public:
+  ObjectRecorder();
+  ~ObjectRecorder();
+
+  void Clear();
+  void Record(const ObjectInstance *object)
+  {
+    // rays of neighbor samples mostly hit the same object
+    if (object == last_ || object == NULL) {
+      return;
+    }
+    last_ = object;
+    objects_.push_back(object);
+    if (objects_.size() >= compact_size_) {
+      compact();
+    }
+  }
+
+  // sorted without duplicates
+  const std::vector<const ObjectInstance *> &GetObjects();
+
+private:
+  void compact();
+
+  std::vector<const ObjectInstance *> objects_;
+  const ObjectInstance *last_;
+  std::size_t compact_size_;
+};
+
+// Objects each tile of the last render depends on, so that renders after
+// edits of objects only render again tiles whose rays hit them. Tiles are
+// either rendered with their objects known or need rendering.
+class FJ_API TileCoverage {
+public:
+  TileCoverage();
+  ~TileCoverage();
+
+  // all tiles of the render of the key need rendering
+  void Init(uint64_t key, int tile_count);
+  // no tiles are known. the next render needs Init
+  void Clear();
+  uint64_t GetKey() const;
+  int GetTileCount() const;
+
+  // threads may set different tiles at once. objects are merged to the
+  // previous ones if merges is true, e.g. for progressive passes
+  void SetTileRendered(int tile_id, const std::vector<const ObjectInstance *> &objects,
+      bool merges);
+  void SetTileNeedsRendering(int tile_id);
+  bool IsTileRendered(int tile_id) const;
+
+  // tiles whose rays hit the object need rendering
+  void InvalidateObject(const ObjectInstance *object);
+
+private:
+  uint64_t key_;
+  std::vector<std::vector<const ObjectInstance *>> tile_objects_;
+  std::vector<char> is_rendered_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -0,0 +1,241 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_tile_loader.h"
+#include "fj_mipmap.h"
+#include "fj_trace.h"
+#include <algorithm>
+#include <chrono>
+
+namespace fj {
+
+static const int DEFAULT_THREAD_COUNT = 2;
+
+static int64_t nanoseconds_since(const std::chrono::steady_clock::time_point &start)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+// the same layout as the keys of the tile cache
+static uint64_t make_key(int file_id, int level, int xtile, int ytile)
+{
+  return
+      (static_cast<uint64_t>(file_id) << 43) |
+      (static_cast<uint64_t>(level & 0x1f) << 38) |
+      (static_cast<uint64_t>(xtile & 0x7ffff) << 19) |
+      (static_cast<uint64_t>(ytile & 0x7ffff));
+}
+
+static TileCache::TilePtr read_tile(MipInput &mip, int file_id,
+    int level, int xtile, int ytile)
+{
+  const TraceScope trace("texture", "ReadTextureTile", file_id);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const int TILESIZE = mip.GetLevelTileSize(level);
+  std::shared_ptr<CachedTile> loaded = std::make_shared<CachedTile>();
+  loaded->tilesize = TILESIZE;
+  loaded->nchannels = mip.GetChannelCount();
+  loaded->texels.resize((TILESIZE + 1) * (TILESIZE + 1) * loaded->nchannels);
+
+  if (mip.ReadTileWithBorder(level, xtile, ytile, &loaded->texels[0])) {
+    return TileCache::TilePtr();
+  }
+
+  TileCache &cache = TileCacheGetGlobal();
+  cache.RecordRead(file_id, sizeof(float) * loaded->texels.size(), nanoseconds_since(start));
+
+  // another thread may have read the same tile meanwhile
+  return cache.Insert(file_id, level, xtile, ytile, loaded);
+}
+
+TileLoader::TileLoader() :
+  thread_count_(DEFAULT_THREAD_COUNT),
+  threads_(),
+  mutex_(),
+  wake_(),
+  done_(),
+  queue_(),
+  pending_(),
+  is_stopping_(false)
+{
+  // threads insert tiles until the loader is destroyed
+  TileCacheGetGlobal();
+}
+
+TileLoader::~TileLoader()
+{
+  Stop();
+}
+
+void TileLoader::SetThreadCount(int count)
+{
+  Stop();
+  thread_count_ = std::max(0, count);
+}
+
+int TileLoader::GetThreadCount() const
+{
+  return thread_count_;
+}
+
+void TileLoader::Request(const MipPtr &mip, int file_id, int level, int xtile, int ytile)
+{
+  if (thread_count_ == 0 || !mip || level < 0 || level >= mip->GetLevelCount()) {
+    return;
+  }
+
+  // the same clamping as MipInput::ReadTile so that keys match tiles
+  TileRequest request;
+  request.mip = mip;
+  request.file_id = file_id;
+  request.level = level;
+  request.xtile = std::max(0, std::min(xtile, mip->GetLevelTileCountX(level) - 1));
+  request.ytile = std::max(0, std::min(ytile, mip->GetLevelTileCountY(level) - 1));
+  request.key = make_key(file_id, level, request.xtile, request.ytile);
+
+  if (TileCacheGetGlobal().Find(file_id, level, request.xtile, request.ytile)) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.find(request.key) != pending_.end()) {
+      return;
+    }
+    if (threads_.empty()) {
+      is_stopping_ = false;
+      for (int i = 0; i < thread_count_; i++) {
+        threads_.push_back(std::thread(&TileLoader::run, this));
+      }
+    }
+    pending_[request.key] = false;
+    queue_.push_back(request);
+  }
+  wake_.notify_one();
+}
+
+TileCache::TilePtr TileLoader::Load(MipInput &mip, int file_id, int level, int xtile, int ytile)
+{
+  const int x = std::max(0, std::min(xtile, mip.GetLevelTileCountX(level) - 1));
+  const int y = std::max(0, std::min(ytile, mip.GetLevelTileCountY(level) - 1));
+  const uint64_t key = make_key(file_id, level, x, y);
+  TileCache &cache = TileCacheGetGlobal();
+
+  for (;;) {
+    const TileCache::TilePtr found = cache.Find(file_id, level, x, y);
+    if (found) {
+      return found;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::unordered_map<uint64_t, bool>::iterator it = pending_.find(key);
+    if (it != pending_.end() && it->second) {
+      // read by another thread. looks up the cache again once it is done
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      done_.wait(lock, [this, key] { return pending_.find(key) == pending_.end(); });
+      cache.RecordWait(file_id, nanoseconds_since(start));
+      continue;
+    }
+
+    // takes over the queued request if any so the I/O thread skips it
+    pending_[key] = true;
+    lock.unlock();
+
+    const TileCache::TilePtr loaded = read_tile(mip, file_id, level, x, y);
+
+    lock.lock();
+    pending_.erase(key);
+    lock.unlock();
+    done_.notify_all();
+
+    return loaded;
+  }
+}
+
+void TileLoader::Wait()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return queue_.empty() && pending_.empty(); });
+}
+
+void TileLoader::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  wake_.notify_all();
+
+  for (std::size_t i = 0; i < threads_.size(); i++) {
+    threads_[i].join();
+  }
+  threads_.clear();
+
+  // keys being read by lookups are left to them
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i = 0; i < queue_.size(); i++) {
+      std::unordered_map<uint64_t, bool>::iterator it = pending_.find(queue_[i].key);
+      if (it != pending_.end() && !it->second) {
+        pending_.erase(it);
+      }
+    }
+    queue_.clear();
+  }
+  done_.notify_all();
+}
+
+void TileLoader::run()
+{
+  // readers of this thread for each source. holding sources keeps their
+  // addresses from being reused by other textures
+  std::unordered_map<const MipInput *,
+      std::pair<MipPtr, std::unique_ptr<MipInput>>> readers;
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  for (;;) {
+    wake_.wait(lock, [this] { return is_stopping_ || !queue_.empty(); });
+    if (is_stopping_) {
+      break;
+    }
+
+    const TileRequest request = queue_.front();
+    queue_.pop_front();
+
+    // skips requests taken over by lookups or done already
+    std::unordered_map<uint64_t, bool>::iterator it = pending_.find(request.key);
+    if (it == pending_.end() || it->second) {
+      continue;
+    }
+    it->second = true;
+    lock.unlock();
+
+    std::pair<MipPtr, std::unique_ptr<MipInput>> &reader = readers[request.mip.get()];
+    if (reader.first != request.mip) {
+      reader.first = request.mip;
+      reader.second.reset(new MipInput());
+      if (reader.second->Share(*request.mip)) {
+        reader.second.reset();
+      } else {
+        TileCacheGetGlobal().RecordOpen(request.file_id, true);
+      }
+    }
+    if (reader.second) {
+      read_tile(*reader.second, request.file_id,
+          request.level, request.xtile, request.ytile);
+    }
+
+    lock.lock();
+    pending_.erase(request.key);
+    done_.notify_all();
+  }
+}
+
+TileLoader &TileLoaderGetGlobal()
+{
+  static TileLoader loader;
+  return loader;
+}
+
+} // namespace xxx
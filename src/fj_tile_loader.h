@@ -0,0 +1,86 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_TILE_LOADER_H
+#define FJ_TILE_LOADER_H
+
+#include "fj_compatibility.h"
+#include "fj_tile_cache.h"
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <deque>
+
+namespace fj {
+
+class MipInput;
+
+// Reads texture tiles into TileCacheGetGlobal() on I/O threads of its own so
+// that tiles requested ahead of lookups are in flight before renderers need
+// them. tiles being read are tracked so that a lookup missing one of them
+// waits for it instead of reading it again.
+class FJ_API TileLoader {
+public:
+  typedef std::shared_ptr<const MipInput> MipPtr;
+
+  TileLoader();
+  ~TileLoader();
+
+  // threads start at the first request. 0 ignores requests. 2 by default
+  void SetThreadCount(int count);
+  int GetThreadCount() const;
+
+  // Queues the tile unless it is cached, queued or being read. I/O threads
+  // read it through their own readers shared from mip
+  void Request(const MipPtr &mip, int file_id, int level, int xtile, int ytile);
+  // Returns the tile in the cache. waits for it if it is being read, or
+  // reads it on the calling thread otherwise. NULL if it can't be read
+  TileCache::TilePtr Load(MipInput &mip, int file_id, int level, int xtile, int ytile);
+
+  // waits until all requests are done
+  void Wait();
+  // drops queued requests and joins the threads
+  void Stop();
+
+private:
+  TileLoader(const TileLoader &);
+  const TileLoader &operator=(const TileLoader &);
+
+  class TileRequest {
+  public:
+    TileRequest() : mip(), key(0), file_id(-1), level(0), xtile(0), ytile(0) {}
+    ~TileRequest() {}
+
+    MipPtr mip;
+    uint64_t key;
+    int file_id;
+    int level;
+    int xtile;
+    int ytile;
+  };
+
+  void run();
+
+  std::atomic<int> thread_count_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::deque<TileRequest> queue_;
+  // keys of queued tiles. true once someone is reading the tile
+  std::unordered_map<uint64_t, bool> pending_;
+  bool is_stopping_;
+};
+
+// loader of tiles of textures
+FJ_API TileLoader &TileLoaderGetGlobal();
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
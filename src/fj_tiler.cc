@@ -5,11 +5,60 @@
 #include "fj_rectangle.h"
 #include "fj_numeric.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cassert>
+#include <cstdint>
+#include <cmath>
 
 namespace fj {
 
+static const int MIN_TILE_SIZE = 8;
+static const int MAX_TILE_SIZE = 128;
+static const int TILES_PER_THREAD = 8;
+// samples and seconds of a tile below which starting it costs too much
+static const int MIN_TILE_SAMPLES = 4096;
+static const double MIN_TILE_SECONDS = .005;
+
+// sorts tile indices by keys in ascending order. ties keep scanline order
+template<typename T>
+static void sort_by_keys(const std::vector<T> &keys, std::vector<int> *que)
+{
+  std::stable_sort(que->begin(), que->end(),
+      [&keys](int a, int b) { return keys[a] < keys[b]; });
+}
+
+static uint32_t morton_index(uint32_t x, uint32_t y)
+{
+  uint32_t index = 0;
+  for (int i = 0; i < 16; i++) {
+    index |= ((x >> i) & 1) << (2 * i);
+    index |= ((y >> i) & 1) << (2 * i + 1);
+  }
+  return index;
+}
+
+// distance along the Hilbert curve filling an n x n grid. n is a power of 2
+static uint32_t hilbert_index(uint32_t n, uint32_t x, uint32_t y)
+{
+  uint32_t index = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    const uint32_t rx = (x & s) > 0;
+    const uint32_t ry = (y & s) > 0;
+    index += s * s * ((3 * rx) ^ ry);
+
+    // rotate the quadrant
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return index;
+}
+
 Tiler::Tiler() :
   total_ntiles_(0),
   xntiles_(0),
@@ -40,6 +89,27 @@ const Tile *Tiler::GetTile(int index) const
   return &tiles_[index];
 }
 
+int Tiler::FindTile(int x, int y) const
+{
+  if (tiles_.empty() || x < 0 || y < 0) {
+    return -1;
+  }
+
+  // the first tile is clipped by the region but in the same column and row
+  const int xtile = x / xtile_size_ - tiles_[0].xmin / xtile_size_;
+  const int ytile = y / ytile_size_ - tiles_[0].ymin / ytile_size_;
+  if (xtile < 0 || ytile < 0 || xtile >= xntiles_ || ytile >= yntiles_) {
+    return -1;
+  }
+
+  const int index = ytile * xntiles_ + xtile;
+  const Tile &tile = tiles_[index];
+  if (x < tile.xmin || y < tile.ymin || x >= tile.xmax || y >= tile.ymax) {
+    return -1;
+  }
+  return index;
+}
+
 void Tiler::Divide(int xres, int yres, int xtile_size, int ytile_size)
 {
   assert(xres > 0);
@@ -112,4 +182,102 @@ void Tiler::GenerateTiles(const Rectangle &region)
   tiles_.swap(tmp_tiles);
 }
 
+void Tiler::GetTileOrder(int tile_order, const std::vector<double> &costs,
+    std::vector<int> *que) const
+{
+  const int NTILES = GetTileCount();
+
+  que->resize(NTILES);
+  for (int i = 0; i < NTILES; i++) {
+    (*que)[i] = i;
+  }
+
+  bool has_costs = static_cast<int>(costs.size()) == NTILES;
+  if (has_costs) {
+    has_costs = std::find_if(costs.begin(), costs.end(),
+        [](double cost) { return cost > 0; }) != costs.end();
+  }
+  if (tile_order == TILE_ORDER_COST && !has_costs) {
+    tile_order = TILE_ORDER_SPIRAL;
+  }
+
+  // tiles are stored in scanline order in the xntiles_ x yntiles_ grid
+  switch (tile_order) {
+  case TILE_ORDER_SPIRAL:
+    {
+      // rings around the center then counterclockwise in each ring
+      const double xcenter = .5 * (xntiles_ - 1);
+      const double ycenter = .5 * (yntiles_ - 1);
+      std::vector<std::pair<double, double>> keys(NTILES);
+      for (int i = 0; i < NTILES; i++) {
+        const double dx = i % xntiles_ - xcenter;
+        const double dy = i / xntiles_ - ycenter;
+        const double ring = Max(std::floor(Abs(dx) + .5), std::floor(Abs(dy) + .5));
+        keys[i] = std::make_pair(ring, std::atan2(dy, dx));
+      }
+      sort_by_keys(keys, que);
+    }
+    break;
+  case TILE_ORDER_HILBERT:
+    {
+      uint32_t n = 1;
+      while (n < static_cast<uint32_t>(Max(xntiles_, yntiles_))) {
+        n *= 2;
+      }
+      std::vector<uint32_t> keys(NTILES);
+      for (int i = 0; i < NTILES; i++) {
+        keys[i] = hilbert_index(n, i % xntiles_, i / xntiles_);
+      }
+      sort_by_keys(keys, que);
+    }
+    break;
+  case TILE_ORDER_MORTON:
+    {
+      std::vector<uint32_t> keys(NTILES);
+      for (int i = 0; i < NTILES; i++) {
+        keys[i] = morton_index(i % xntiles_, i / xntiles_);
+      }
+      sort_by_keys(keys, que);
+    }
+    break;
+  case TILE_ORDER_COST:
+    {
+      std::vector<double> keys(NTILES);
+      for (int i = 0; i < NTILES; i++) {
+        keys[i] = -costs[i];
+      }
+      sort_by_keys(keys, que);
+    }
+    break;
+  case TILE_ORDER_SCANLINE:
+  default:
+    break;
+  }
+}
+
+int TilerChooseTileSize(int region_width, int region_height, int thread_count,
+    int samples_per_pixel, double filter_width, double pixel_seconds)
+{
+  const double area =
+      std::max(region_width, 1) * static_cast<double>(std::max(region_height, 1));
+  const int tile_count = std::max(thread_count, 1) * TILES_PER_THREAD;
+  const double balanced_size = std::sqrt(area / tile_count);
+
+  // pixels of the margin on each side
+  const double margin = std::max(std::ceil(.5 * filter_width), 1.);
+  double min_size = 16 * margin;
+  if (pixel_seconds > 0) {
+    min_size = std::max(min_size, std::sqrt(MIN_TILE_SECONDS / pixel_seconds));
+  } else {
+    const int samples = std::max(samples_per_pixel, 1);
+    min_size = std::max(min_size, std::sqrt(static_cast<double>(MIN_TILE_SAMPLES) / samples));
+  }
+
+  const double size =
+      std::min(std::max(balanced_size, min_size), static_cast<double>(MAX_TILE_SIZE));
+  // multiples of the smallest size
+  const int rounded = static_cast<int>(size) / MIN_TILE_SIZE * MIN_TILE_SIZE;
+  return std::max(rounded, MIN_TILE_SIZE);
+}
+
 } // namespace xxx
@@ -10,6 +10,15 @@ namespace fj {
 
 class Rectangle;
 
+enum TileOrder {
+  TILE_ORDER_SCANLINE = 0,
+  TILE_ORDER_SPIRAL,
+  TILE_ORDER_HILBERT,
+  TILE_ORDER_MORTON,
+  // the most expensive tiles first
+  TILE_ORDER_COST
+};
+
 class Tile {
 public:
   Tile() : id(0), xmin(0), ymin(0), xmax(0), ymax(0) {}
@@ -25,10 +34,18 @@ public:
 
   int GetTileCount() const;
   const Tile *GetTile(int index) const;
+  // index of the tile including the pixel. -1 if no tile
+  int FindTile(int x, int y) const;
 
   void Divide(int xres, int yres, int xtile_size, int ytile_size);
   void GenerateTiles(const Rectangle &region);
 
+  // fills que with tile indices in the tile_order. costs are indexed by tile
+  // and only used by TILE_ORDER_COST. it falls back to the spiral order
+  // if costs are not given for all tiles
+  void GetTileOrder(int tile_order, const std::vector<double> &costs,
+      std::vector<int> *que) const;
+
 public:
   int total_ntiles_;
   int xntiles_;
@@ -41,6 +58,14 @@ public:
   int ytile_size_;
 };
 
+// a square tile size for a region of the frame. tiles are small enough for
+// every thread to get several and large enough that the filter margins and
+// the start of each tile cost little compared to their samples.
+// pixel_seconds is the time per pixel of the previous render, or 0 if
+// unknown for the samples per pixel to estimate the cost instead
+int TilerChooseTileSize(int region_width, int region_height, int thread_count,
+    int samples_per_pixel, double filter_width, double pixel_seconds);
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -0,0 +1,227 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <cstdlib>
+#include <cstring>
+
+namespace fj {
+
+// 32 bytes each. older events are overwritten
+static const int64_t EVENTS_PER_THREAD = 16384;
+
+class RecordedEvent {
+public:
+  RecordedEvent() : category(NULL), name(NULL), start(0), end(0), arg(-1) {}
+  ~RecordedEvent() {}
+
+  const char *category;
+  const char *name;
+  int64_t start;
+  int64_t end;
+  int64_t arg;
+};
+
+class ThreadTrace {
+public:
+  ThreadTrace(int id) : thread_id(id), in_use(false), event_count(0),
+      events(EVENTS_PER_THREAD), mutex() {}
+  ~ThreadTrace() {}
+
+  const int thread_id;
+  // owned by a running thread. guarded by the registry mutex
+  bool in_use;
+  int64_t event_count;
+  std::vector<RecordedEvent> events;
+  std::mutex mutex;
+};
+
+class TraceRegistry {
+public:
+  TraceRegistry() : traces(), mutex() {}
+  ~TraceRegistry() {}
+
+  std::vector<std::unique_ptr<ThreadTrace>> traces;
+  std::mutex mutex;
+};
+
+// buffers of finished threads are reused by new ones so that memory
+// is bounded by the number of threads alive at the same time
+class ThreadTraceHolder {
+public:
+  ThreadTraceHolder() : trace(NULL) {}
+  ~ThreadTraceHolder();
+
+  ThreadTrace *trace;
+};
+
+static const std::chrono::steady_clock::time_point trace_epoch =
+    std::chrono::steady_clock::now();
+static thread_local ThreadTraceHolder thread_trace;
+
+static bool enabled_by_env();
+static TraceRegistry &get_registry();
+static ThreadTrace *get_thread_trace();
+static void write_string(std::ostream &strm, const char *str);
+
+static std::atomic<bool> trace_enabled(enabled_by_env());
+
+void TraceSetEnabled(bool enable)
+{
+  trace_enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool TraceIsEnabled()
+{
+  return trace_enabled.load(std::memory_order_relaxed);
+}
+
+int64_t TraceNow()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+void TraceEvent(const char *category, const char *name,
+    int64_t start, int64_t end, int64_t arg)
+{
+  if (!TraceIsEnabled()) {
+    return;
+  }
+
+  ThreadTrace *trace = get_thread_trace();
+  std::lock_guard<std::mutex> lock(trace->mutex);
+
+  RecordedEvent &event = trace->events[trace->event_count % EVENTS_PER_THREAD];
+  event.category = category;
+  event.name = name;
+  event.start = start;
+  event.end = end;
+  event.arg = arg;
+  trace->event_count++;
+}
+
+int TraceWriteFile(const std::string &filename)
+{
+  std::ofstream file(filename.c_str());
+  if (!file) {
+    return -1;
+  }
+
+  TraceRegistry &registry = get_registry();
+  std::lock_guard<std::mutex> registry_lock(registry.mutex);
+  const char *separator = "\n";
+
+  file << "{\"traceEvents\":[";
+  for (std::size_t i = 0; i < registry.traces.size(); i++) {
+    ThreadTrace *trace = registry.traces[i].get();
+    std::lock_guard<std::mutex> lock(trace->mutex);
+
+    file << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,";
+    file << "\"tid\":" << trace->thread_id << ",";
+    file << "\"args\":{\"name\":\"thread " << trace->thread_id << "\"}}";
+    separator = ",\n";
+
+    const int64_t first = std::max<int64_t>(0, trace->event_count - EVENTS_PER_THREAD);
+    for (int64_t j = first; j < trace->event_count; j++) {
+      const RecordedEvent &event = trace->events[j % EVENTS_PER_THREAD];
+
+      file << separator << "{\"name\":";
+      write_string(file, event.name);
+      file << ",\"cat\":";
+      write_string(file, event.category);
+      file << ",\"ph\":\"X\",\"ts\":" << event.start;
+      file << ",\"dur\":" << event.end - event.start;
+      file << ",\"pid\":1,\"tid\":" << trace->thread_id;
+      if (event.arg >= 0) {
+        file << ",\"args\":{\"id\":" << event.arg << "}";
+      }
+      file << "}";
+    }
+  }
+  file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+  return file ? 0 : -1;
+}
+
+void TraceClear()
+{
+  TraceRegistry &registry = get_registry();
+  std::lock_guard<std::mutex> registry_lock(registry.mutex);
+
+  for (std::size_t i = 0; i < registry.traces.size(); i++) {
+    ThreadTrace *trace = registry.traces[i].get();
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    trace->event_count = 0;
+  }
+}
+
+ThreadTraceHolder::~ThreadTraceHolder()
+{
+  if (trace == NULL) {
+    return;
+  }
+  TraceRegistry &registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  trace->in_use = false;
+}
+
+static bool enabled_by_env()
+{
+  const char *env = std::getenv("FJ_TRACE");
+  return env != NULL && strcmp(env, "1") == 0;
+}
+
+static TraceRegistry &get_registry()
+{
+  // never destroyed so that threads exiting late can still release buffers
+  static TraceRegistry *registry = new TraceRegistry();
+  return *registry;
+}
+
+static ThreadTrace *get_thread_trace()
+{
+  if (thread_trace.trace != NULL) {
+    return thread_trace.trace;
+  }
+
+  TraceRegistry &registry = get_registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+
+  for (std::size_t i = 0; i < registry.traces.size(); i++) {
+    if (!registry.traces[i]->in_use) {
+      thread_trace.trace = registry.traces[i].get();
+      break;
+    }
+  }
+  if (thread_trace.trace == NULL) {
+    const int id = static_cast<int>(registry.traces.size());
+    registry.traces.push_back(std::unique_ptr<ThreadTrace>(new ThreadTrace(id)));
+    thread_trace.trace = registry.traces.back().get();
+  }
+
+  thread_trace.trace->in_use = true;
+  return thread_trace.trace;
+}
+
+static void write_string(std::ostream &strm, const char *str)
+{
+  strm << '"';
+  for (const char *c = str; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      strm << '\\';
+    }
+    strm << *c;
+  }
+  strm << '"';
+}
+
+} // namespace xxx
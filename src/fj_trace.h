@@ -0,0 +1,61 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_TRACE_H
+#define FJ_TRACE_H
+
+#include "fj_compatibility.h"
+#include <cstdint>
+#include <string>
+
+namespace fj {
+
+// Events of scene loading and rendering are kept in a ring buffer of
+// each thread so the latest ones can be written as a Chrome trace file
+// (chrome://tracing, Perfetto). Recording takes a lock no other thread
+// takes while rendering, so events of tiles and file reads are cheap.
+// category and name are not copied and must be string literals.
+// recording is switched on by TraceSetEnabled(), e.g. by the trace_file
+// property of renderers, or from the start with FJ_TRACE=1 in the
+// environment to include the scene loading. while off an event costs a
+// flag check
+
+FJ_API void TraceSetEnabled(bool enable);
+FJ_API bool TraceIsEnabled();
+
+// microseconds since the library was loaded
+FJ_API int64_t TraceNow();
+// records an event of the calling thread from start to end if enabled.
+// arg is written as "id" when not negative
+FJ_API void TraceEvent(const char *category, const char *name,
+    int64_t start, int64_t end, int64_t arg = -1);
+// writes recorded events of all threads. returns -1 if failed
+FJ_API int TraceWriteFile(const std::string &filename);
+FJ_API void TraceClear();
+
+// records an event from construction to destruction
+class FJ_API TraceScope {
+public:
+  TraceScope(const char *category, const char *name, int64_t arg = -1) :
+      category_(category), name_(name), arg_(arg),
+      start_(TraceIsEnabled() ? TraceNow() : -1) {}
+  ~TraceScope()
+  {
+    if (start_ >= 0) {
+      TraceEvent(category_, name_, start_, TraceNow(), arg_);
+    }
+  }
+
+private:
+  TraceScope(const TraceScope &);
+  const TraceScope &operator=(const TraceScope &);
+
+  const char *category_;
+  const char *name_;
+  int64_t arg_;
+  int64_t start_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -4,6 +4,7 @@
 #include "fj_transform.h"
 #include "fj_matrix.h"
 #include "fj_box.h"
+#include "fj_numeric.h"
 #include <assert.h>
 #include <float.h>
 
@@ -12,6 +13,9 @@ namespace fj {
 static int is_transform_order(int order);
 static int is_rotate_order(int order);
 static void update_matrix(Transform *transform);
+static void update_transform_cache(TransformSampleList *list);
+static void lerp_transform_cache(const TransformSampleList *list, Real time,
+    Transform *transform_interp);
 static void make_transform_matrix(
     int transform_order, int rotate_order,
     Real tx, Real ty, Real tz,
@@ -245,11 +249,14 @@ void XfmInitTransformSampleList(TransformSampleList *list)
 
   list->transform_order = ORDER_SRT;
   list->rotate_order = ORDER_ZXY;
+  list->time_offset = 0;
 
   list->scale.samples[0].vector[0] = 1;
   list->scale.samples[0].vector[1] = 1;
   list->scale.samples[0].vector[2] = 1;
   list->scale.samples[0].vector[3] = 1;
+
+  update_transform_cache(list);
 }
 
 void XfmPushTranslateSample(TransformSampleList *list,
@@ -263,6 +270,7 @@ void XfmPushTranslateSample(TransformSampleList *list,
   sample.time = time;
 
   PropPushSample(&list->translate, &sample);
+  update_transform_cache(list);
 }
 
 void XfmPushRotateSample(TransformSampleList *list,
@@ -276,6 +284,7 @@ void XfmPushRotateSample(TransformSampleList *list,
   sample.time = time;
 
   PropPushSample(&list->rotate, &sample);
+  update_transform_cache(list);
 }
 
 void XfmPushScaleSample(TransformSampleList *list,
@@ -289,23 +298,65 @@ void XfmPushScaleSample(TransformSampleList *list,
   sample.time = time;
 
   PropPushSample(&list->scale, &sample);
+  update_transform_cache(list);
+}
+
+void XfmPushTransformSamples(TransformSampleList *list,
+    const Real *trs, Real time)
+{
+  PropertySampleList *lists[3] = {&list->translate, &list->rotate, &list->scale};
+
+  for (int i = 0; i < 3; i++) {
+    PropertySample sample;
+
+    sample.vector[0] = trs[3 * i + 0];
+    sample.vector[1] = trs[3 * i + 1];
+    sample.vector[2] = trs[3 * i + 2];
+    sample.time = time;
+
+    PropPushSample(lists[i], &sample);
+  }
+  update_transform_cache(list);
 }
 
 void XfmSetSampleTransformOrder(TransformSampleList *list, int order)
 {
   assert(is_transform_order(order));
   list->transform_order = order;
+  update_transform_cache(list);
 }
 
 void XfmSetSampleRotateOrder(TransformSampleList *list, int order)
 {
   assert(is_rotate_order(order));
   list->rotate_order = order;
+  update_transform_cache(list);
+}
+
+void XfmSetSampleTimeOffset(TransformSampleList *list, Real time_offset)
+{
+  list->time_offset = time_offset;
 }
 
 void XfmLerpTransformSample(const TransformSampleList *list, Real time,
     Transform *transform_interp)
 {
+  *transform_interp = *XfmGetTransformSample(list, time, transform_interp);
+}
+
+const Transform *XfmGetTransformSample(const TransformSampleList *list,
+    Real time, Transform *transform_tmp)
+{
+  time += list->time_offset;
+
+  if (list->cache_count == 1) {
+    return &list->cache[0];
+  }
+  if (list->cache_count > 1) {
+    lerp_transform_cache(list, time, transform_tmp);
+    return transform_tmp;
+  }
+
   PropertySample T;
   PropertySample R;
   PropertySample S;
@@ -314,11 +365,76 @@ void XfmLerpTransformSample(const TransformSampleList *list, Real time,
   PropLerpSamples(&list->rotate, time, &R);
   PropLerpSamples(&list->scale, time, &S);
 
-  XfmSetTransform(transform_interp,
+  XfmSetTransform(transform_tmp,
     list->transform_order, list->rotate_order,
     T.vector[0], T.vector[1], T.vector[2],
     R.vector[0], R.vector[1], R.vector[2],
     S.vector[0], S.vector[1], S.vector[2]);
+
+  return transform_tmp;
+}
+
+static void update_transform_cache(TransformSampleList *list)
+{
+  if (list->rotate.sample_count > 1 || list->scale.sample_count > 1) {
+    list->cache.clear();
+    list->cache_count = 0;
+    return;
+  }
+
+  list->cache.resize(list->translate.sample_count);
+  const Real *R = list->rotate.samples[0].vector;
+  const Real *S = list->scale.samples[0].vector;
+
+  for (int i = 0; i < list->translate.sample_count; i++) {
+    const Real *T = list->translate.samples[i].vector;
+    XfmSetTransform(&list->cache[i],
+      list->transform_order, list->rotate_order,
+      T[0], T[1], T[2],
+      R[0], R[1], R[2],
+      S[0], S[1], S[2]);
+  }
+  list->cache_count = list->translate.sample_count;
+}
+
+// interpolates between translate samples in the same way as PropLerpSamples
+static void lerp_transform_cache(const TransformSampleList *list, Real time,
+    Transform *transform_interp)
+{
+  const PropertySample *samples = list->translate.samples;
+  const int N = list->cache_count;
+
+  if (samples[0].time >= time) {
+    *transform_interp = list->cache[0];
+    return;
+  }
+  if (samples[N-1].time <= time) {
+    *transform_interp = list->cache[N-1];
+    return;
+  }
+
+  int i = 1;
+  while (samples[i].time < time) {
+    i++;
+  }
+  if (samples[i].time == time) {
+    *transform_interp = list->cache[i];
+    return;
+  }
+
+  const Transform &xfm0 = list->cache[i-1];
+  const Transform &xfm1 = list->cache[i];
+  const Real t = Fit(time, samples[i-1].time, samples[i].time, 0, 1);
+
+  *transform_interp = xfm0;
+  for (int j = 0; j < 16; j++) {
+    transform_interp->matrix.e[j]  = Lerp(xfm0.matrix.e[j],  xfm1.matrix.e[j],  t);
+    transform_interp->inverse.e[j] = Lerp(xfm0.inverse.e[j], xfm1.inverse.e[j], t);
+  }
+  transform_interp->translate = Vector(
+      Lerp(xfm0.translate.x, xfm1.translate.x, t),
+      Lerp(xfm0.translate.y, xfm1.translate.y, t),
+      Lerp(xfm0.translate.z, xfm1.translate.z, t));
 }
 
 static void update_matrix(Transform *transform)
@@ -9,6 +9,7 @@
 #include "fj_matrix.h"
 #include "fj_vector.h"
 #include "fj_types.h"
+#include <vector>
 
 namespace fj {
 
@@ -100,7 +101,7 @@ extern int XfmIsRotateOrder(int order);
 // TransformSampleList
 class TransformSampleList {
 public:
-  TransformSampleList() {}
+  TransformSampleList() : time_offset(0), cache_count(0) {}
   ~TransformSampleList() {}
 
 public:
@@ -109,11 +110,25 @@ public:
   PropertySampleList scale;
   int transform_order;
   int rotate_order;
+  // added to times given to lerp functions. the start of the frame when
+  // frames of an animation are rendered
+  Real time_offset;
+
+  // transforms made at each translate sample by Xfm functions that modify
+  // the list. matrices are linear to translation so they are interpolated
+  // when only translate is animated. 0 if rotate or scale is animated.
+  // sized to the samples as most instances have only one
+  std::vector<Transform> cache;
+  int cache_count;
 };
 
 extern void XfmInitTransformSampleList(TransformSampleList *list);
 extern void XfmLerpTransformSample(const TransformSampleList *list, Real time,
     Transform *transform_interp);
+// Returns the cached transform without copying if it is static, otherwise
+// makes the transform at time in transform_tmp and returns it.
+extern const Transform *XfmGetTransformSample(const TransformSampleList *list,
+    Real time, Transform *transform_tmp);
 
 extern void XfmPushTranslateSample(TransformSampleList *list,
     Real tx, Real ty, Real tz, Real time);
@@ -121,9 +136,13 @@ extern void XfmPushRotateSample(TransformSampleList *list,
     Real rx, Real ry, Real rz, Real time);
 extern void XfmPushScaleSample(TransformSampleList *list,
     Real sx, Real sy, Real sz, Real time);
+// pushes translate, rotate and scale in trs at once. the cache is made once
+extern void XfmPushTransformSamples(TransformSampleList *list,
+    const Real *trs, Real time);
 
 extern void XfmSetSampleTransformOrder(TransformSampleList *list, int order);
 extern void XfmSetSampleRotateOrder(TransformSampleList *list, int order);
+extern void XfmSetSampleTimeOffset(TransformSampleList *list, Real time_offset);
 
 } // namespace xxx
 
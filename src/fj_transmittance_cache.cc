@@ -0,0 +1,140 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_transmittance_cache.h"
+#include <cstddef>
+
+namespace fj {
+
+// entries looked up from the hashed slot before giving up
+static const int MAX_PROBE_COUNT = 8;
+
+static uint64_t hash_uint64(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+TransmittanceCache::TransmittanceCache() : entries_(), cell_size_(0)
+{
+}
+
+TransmittanceCache::~TransmittanceCache()
+{
+}
+
+void TransmittanceCache::Init(Real cell_size, int entry_count)
+{
+  if (cell_size <= 0 || entry_count < 1) {
+    std::vector<Entry>().swap(entries_);
+    cell_size_ = 0;
+    return;
+  }
+
+  std::vector<Entry>(entry_count).swap(entries_);
+  cell_size_ = cell_size;
+}
+
+bool TransmittanceCache::IsEnabled() const
+{
+  return !entries_.empty();
+}
+
+Real TransmittanceCache::GetCellSize() const
+{
+  return cell_size_;
+}
+
+bool TransmittanceCache::Lookup(const Light *light, const ObjectGroup *target,
+    int x, int y, int z, float *transmittance) const
+{
+  if (!IsEnabled()) {
+    return false;
+  }
+
+  const Entry *entry = find_entry(compute_key(light, target, x, y, z));
+  if (entry == NULL) {
+    return false;
+  }
+
+  const float value = entry->transmittance.load(std::memory_order_acquire);
+  if (value < 0) {
+    return false;
+  }
+
+  *transmittance = value;
+  return true;
+}
+
+void TransmittanceCache::Add(const Light *light, const ObjectGroup *target,
+    int x, int y, int z, float transmittance)
+{
+  if (!IsEnabled()) {
+    return;
+  }
+
+  Entry *entry = insert_entry(compute_key(light, target, x, y, z));
+  if (entry == NULL) {
+    return;
+  }
+
+  // threads computing the same vertex at once store the same value
+  entry->transmittance.store(transmittance, std::memory_order_release);
+}
+
+uint64_t TransmittanceCache::compute_key(const Light *light, const ObjectGroup *target,
+    int x, int y, int z) const
+{
+  const uint64_t ux = static_cast<uint32_t>(x);
+  const uint64_t uy = static_cast<uint32_t>(y);
+  const uint64_t uz = static_cast<uint32_t>(z);
+  const uint64_t owner = hash_uint64(reinterpret_cast<uintptr_t>(light)) ^
+      hash_uint64(reinterpret_cast<uintptr_t>(target) + 1);
+
+  // 0 is for empty entries
+  const uint64_t key = hash_uint64(
+      ((ux & 0x1FFFFF) | (uy & 0x1FFFFF) << 21 | (uz & 0x1FFFFF) << 42) ^ owner);
+  return key == 0 ? 1 : key;
+}
+
+const TransmittanceCache::Entry *TransmittanceCache::find_entry(uint64_t key) const
+{
+  const std::size_t N = entries_.size();
+
+  for (int i = 0; i < MAX_PROBE_COUNT; i++) {
+    const Entry &entry = entries_[(key + i) % N];
+    const uint64_t entry_key = entry.key.load(std::memory_order_acquire);
+    if (entry_key == key) {
+      return &entry;
+    }
+    if (entry_key == 0) {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+TransmittanceCache::Entry *TransmittanceCache::insert_entry(uint64_t key)
+{
+  const std::size_t N = entries_.size();
+
+  for (int i = 0; i < MAX_PROBE_COUNT; i++) {
+    Entry &entry = entries_[(key + i) % N];
+    uint64_t entry_key = entry.key.load(std::memory_order_acquire);
+    if (entry_key == 0 &&
+        entry.key.compare_exchange_strong(entry_key, key, std::memory_order_acq_rel)) {
+      return &entry;
+    }
+    // entry_key is the key of the thread claiming it first if failed
+    if (entry_key == key) {
+      return &entry;
+    }
+  }
+  return NULL;
+}
+
+} // namespace xxx
@@ -0,0 +1,62 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_TRANSMITTANCE_CACHE_H
+#define FJ_TRANSMITTANCE_CACHE_H
+
+#include "fj_compatibility.h"
+#include "fj_types.h"
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+namespace fj {
+
+class ObjectGroup;
+class Light;
+
+// A hash grid of volume transmittance from the vertices of world space cells
+// toward lights. vertices are raymarched once when shaders first need them
+// and shadows of volumes are interpolated from the vertices around shaded
+// points. shared by all threads with no lock
+class FJ_API TransmittanceCache {
+public:
+  TransmittanceCache();
+  ~TransmittanceCache();
+
+  // clears the cache. cell_size <= 0 disables it
+  void Init(Real cell_size, int entry_count);
+  bool IsEnabled() const;
+  Real GetCellSize() const;
+
+  // transmittance from the vertex (x, y, z) in cells to the light through
+  // volumes of the shadow target. returns false until it is added
+  bool Lookup(const Light *light, const ObjectGroup *target,
+      int x, int y, int z, float *transmittance) const;
+  void Add(const Light *light, const ObjectGroup *target,
+      int x, int y, int z, float transmittance);
+
+private:
+  class Entry {
+  public:
+    Entry() : key(0), transmittance(-1) {}
+    ~Entry() {}
+
+    std::atomic<uint64_t> key;
+    // negative until the claiming thread stores it
+    std::atomic<float> transmittance;
+  };
+
+  uint64_t compute_key(const Light *light, const ObjectGroup *target,
+      int x, int y, int z) const;
+  // NULL if the entry is not found and not inserted
+  const Entry *find_entry(uint64_t key) const;
+  Entry *insert_entry(uint64_t key);
+
+  std::vector<Entry> entries_;
+  Real cell_size_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
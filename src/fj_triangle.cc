@@ -4,6 +4,7 @@
 #include "fj_triangle.h"
 #include "fj_tex_coord.h"
 #include "fj_numeric.h"
+#include "fj_vector_lanes.h"
 #include "fj_vector.h"
 #include "fj_box.h"
 
@@ -11,6 +12,11 @@ namespace fj {
 
 static const Real EPSILON = 1e-6;
 
+static bool ray_intersect(
+    const Vector &vert0, const Vector &edge1, const Vector &edge2,
+    const Vector &orig, const Vector &dir, int cull_backfaces,
+    Real *t, Real *u, Real *v);
+
 Real TriComputeArea(
     const Vector &vert0, const Vector &vert1, const Vector &vert2)
 {
@@ -73,23 +79,102 @@ void TriComputeDerivatives(
   *dPdv = (-du2 * dP1 + du1 * dP2) * invdet;
 }
 
+bool TriRayIntersect(
+    const Vector &vert0, const Vector &vert1, const Vector &vert2,
+    const Vector &orig, const Vector &dir, int cull_backfaces,
+    Real *t, Real *u, Real *v)
+{
+  /* find vectors for two edges sharing vert0 */
+  const Vector edge1 = vert1 - vert0;
+  const Vector edge2 = vert2 - vert0;
+
+  return ray_intersect(vert0, edge1, edge2, orig, dir, cull_backfaces, t, u, v);
+}
+
+void TriPrecompute(
+    const Vector &vert0, const Vector &vert1, const Vector &vert2,
+    PrecomputedTriangle *tri)
+{
+  tri->vert0 = vert0;
+  tri->edge1 = vert1 - vert0;
+  tri->edge2 = vert2 - vert0;
+}
+
+bool TriRayIntersectPrecomputed(const PrecomputedTriangle &tri,
+    const Vector &orig, const Vector &dir, int cull_backfaces,
+    Real *t, Real *u, Real *v)
+{
+  return ray_intersect(tri.vert0, tri.edge1, tri.edge2,
+      orig, dir, cull_backfaces, t, u, v);
+}
+
+// four triangles in lanes. every step follows the same order of operations
+// as ray_intersect so that the results match the scalar version exactly
+static int ray_intersect4(const PrecomputedTriangle *const *lanes,
+    const Vector &orig, const Vector &dir,
+    Real *t, Real *u, Real *v)
+{
+  Vector4N vert0, edge1, edge2;
+  for (int i = 0; i < 4; i++) {
+    vert0.Set(i, lanes[i]->vert0);
+    edge1.Set(i, lanes[i]->edge1);
+    edge2.Set(i, lanes[i]->edge2);
+  }
+  const Vector4N dir4(dir);
+
+  const Vector4N pvec = Cross(dir4, edge2);
+  const Real4N det = Dot(edge1, pvec);
+  const Real4N inv_det = Real4N(1.0) / det;
+
+  const Vector4N tvec = Vector4N(orig) - vert0;
+  const Real4N uu = Dot(tvec, pvec) * inv_det;
+
+  const Vector4N qvec = Cross(tvec, edge1);
+  const Real4N vv = Dot(dir4, qvec) * inv_det;
+  const Real4N tt = Dot(edge2, qvec) * inv_det;
+
+  // the same rejections as the scalar version. NaNs are not rejected there either
+  const Real4N zero(0.0);
+  const Real4N one(1.0);
+  const int reject_det =
+      GreaterThan(det, Real4N(-EPSILON)) & LessThan(det, Real4N(EPSILON));
+  const int reject_u = LessThan(uu, zero) | GreaterThan(uu, one);
+  const int reject_v = LessThan(vv, zero) | GreaterThan(uu + vv, one);
+
+  tt.Store(t);
+  uu.Store(u);
+  vv.Store(v);
+
+  return ~(reject_det | reject_u | reject_v) & AllLanes<4>();
+}
+
+int TriRayIntersect4(const PrecomputedTriangle *const *tris, int count,
+    const Vector &orig, const Vector &dir,
+    Real *t, Real *u, Real *v)
+{
+  // unused lanes repeat the first triangle and are masked out
+  const PrecomputedTriangle *lanes[4] = {tris[0], tris[0], tris[0], tris[0]};
+  for (int i = 1; i < count && i < 4; i++) {
+    lanes[i] = tris[i];
+  }
+
+  const int mask = ray_intersect4(lanes, orig, dir, t, u, v);
+  return mask & ((1 << count) - 1);
+}
+
 /* Codes from
  * Fast, minimum storage ray-triangle intersection.
  * Tomas Möller and Ben Trumbore.
  * Journal of Graphics Tools, 2(1):21--28, 1997.
  */
-bool TriRayIntersect(
-    const Vector &vert0, const Vector &vert1, const Vector &vert2,
+static bool ray_intersect(
+    const Vector &vert0, const Vector &edge1, const Vector &edge2,
     const Vector &orig, const Vector &dir, int cull_backfaces,
     Real *t, Real *u, Real *v)
 {
-  Vector edge1, edge2, tvec, pvec, qvec;
+  Vector tvec, pvec, qvec;
   Real det, inv_det;
 
-  /* find vectors for two edges sharing vert0 */
-  edge1 = vert1 - vert0;
-  edge2 = vert2 - vert0;
-
   /* begin calculating determinant - also used to calculate U parameter */
   pvec = Cross(dir, edge2);
 
@@ -320,4 +405,74 @@ bool TriBoxIntersect(
    return true;   /* box and triangle overlaps */
 }
 
+// a triangle clipped by 6 planes has 9 vertices at most. more room for
+// polygons made slightly concave by rounding
+static const int MAX_CLIPPED_VERTS = 16;
+
+// Sutherland-Hodgman clipping of the polygon by the plane of the axis at
+// the position. keeps the side of sign * (P[axis] - position) >= 0.
+// returns -1 if dst runs out of room
+static int clip_polygon(const Vector *src, int nsrc, int axis, Real position,
+    Real sign, Vector *dst)
+{
+  int ndst = 0;
+
+  for (int i = 0; i < nsrc; i++) {
+    if (ndst > MAX_CLIPPED_VERTS - 2) {
+      return -1;
+    }
+    const Vector &P0 = src[i];
+    const Vector &P1 = src[(i + 1) % nsrc];
+    const Real d0 = sign * (P0[axis] - position);
+    const Real d1 = sign * (P1[axis] - position);
+
+    if (d0 >= 0) {
+      dst[ndst++] = P0;
+    }
+    if ((d0 < 0 && d1 > 0) || (d0 > 0 && d1 < 0)) {
+      Vector P = P0 + d0 / (d0 - d1) * (P1 - P0);
+      // exactly on the plane regardless of rounding
+      P[axis] = position;
+      dst[ndst++] = P;
+    }
+  }
+
+  return ndst;
+}
+
+void TriClipBounds(
+    const Vector &vert0, const Vector &vert1, const Vector &vert2,
+    const Box &box, Box *bounds)
+{
+  Vector poly[2][MAX_CLIPPED_VERTS];
+  int npoly = 3;
+  int cur = 0;
+
+  poly[0][0] = vert0;
+  poly[0][1] = vert1;
+  poly[0][2] = vert2;
+
+  for (int axis = 0; axis < 3 && npoly > 0; axis++) {
+    npoly = clip_polygon(poly[cur], npoly, axis, box.min[axis], 1, poly[1 - cur]);
+    cur = 1 - cur;
+    if (npoly > 0) {
+      npoly = clip_polygon(poly[cur], npoly, axis, box.max[axis], -1, poly[1 - cur]);
+      cur = 1 - cur;
+    }
+  }
+
+  if (npoly < 0) {
+    // falls back to the clipped bounds of the whole triangle
+    TriComputeBounds(vert0, vert1, vert2, bounds);
+    bounds->Clip(box);
+    return;
+  }
+
+  bounds->ReverseInfinite();
+  for (int i = 0; i < npoly; i++) {
+    bounds->AddPoint(poly[cur][i]);
+  }
+  bounds->Clip(box);
+}
+
 } // namespace xxx
@@ -5,6 +5,7 @@
 #define FJ_TRIANGLE_H
 
 #include "fj_compatibility.h"
+#include "fj_vector.h"
 #include "fj_types.h"
 
 namespace fj {
@@ -15,9 +16,20 @@ enum {
 };
 
 class TexCoord;
-class Vector;
 class Box;
 
+// vert0 and the two edges sharing it. TriRayIntersect computes these for
+// every ray so static meshes store them once.
+class PrecomputedTriangle {
+public:
+  PrecomputedTriangle() : vert0(), edge1(), edge2() {}
+  ~PrecomputedTriangle() {}
+
+  Vector vert0;
+  Vector edge1;
+  Vector edge2;
+};
+
 FJ_API Real TriComputeArea(
     const Vector &vert0, const Vector &vert1, const Vector &vert2);
 
@@ -42,10 +54,32 @@ FJ_API bool TriRayIntersect(
     const Vector &orig, const Vector &dir, int cull_backfaces,
     Real *t, Real *u, Real *v);
 
+FJ_API void TriPrecompute(
+    const Vector &vert0, const Vector &vert1, const Vector &vert2,
+    PrecomputedTriangle *tri);
+
+// same results as TriRayIntersect bit by bit
+FJ_API bool TriRayIntersectPrecomputed(const PrecomputedTriangle &tri,
+    const Vector &orig, const Vector &dir, int cull_backfaces,
+    Real *t, Real *u, Real *v);
+
+// Tests up to 4 triangles at once without culling backfaces. returns a bit
+// mask of hit triangles. t, u and v are the same as TriRayIntersect for hits
+// and undefined for the others.
+FJ_API int TriRayIntersect4(const PrecomputedTriangle *const *tris, int count,
+    const Vector &orig, const Vector &dir,
+    Real *t, Real *u, Real *v);
+
 FJ_API bool TriBoxIntersect(
     const Vector &vert0, const Vector &vert1, const Vector &vert2,
     const Vector &boxcenter, const Vector &boxhalfsize);
 
+// Bounds of the part of the triangle inside the box found by clipping the
+// triangle by the planes of the box. empty if the triangle is outside.
+FJ_API void TriClipBounds(
+    const Vector &vert0, const Vector &vert1, const Vector &vert2,
+    const Box &box, Box *bounds);
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -3,17 +3,36 @@
 
 #include "fj_turbulence.h"
 #include "fj_noise.h"
+#include "fj_multi_thread.h"
+#include "fj_primitive_set.h"
+#include <iostream>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <vector>
 
 namespace fj {
 
+// noise cells the baked texture repeats over
+static const int BAKE_PERIOD = 8;
+// finer octaves have too few voxels for each cell to be baked
+static const Real MIN_VOXELS_PER_CELL = 2;
+// of the channels of Evaluate3d. the same as PerlinNoise3d
+static const Vector CHANNEL_OFFSETS[3] = {
+  Vector(0, 0, 0),
+  Vector(131.977, 21.1823, 71.0231),
+  Vector(237.492, 11.1312, 133.129)};
+
 Turbulence::Turbulence() :
     amplitude_  (1, 1, 1),
     frequency_  (1, 1, 1),
     offset_     (0, 0, 0),
     lacunarity_ (2),
     gain_       (.5),
-    octaves_    (8)
+    octaves_    (8),
+    bake_resolution_(0),
+    baked_octaves_(0),
+    texture_()
 {
 }
 
@@ -39,22 +58,147 @@ void Turbulence::SetOffset(Real x, Real y, Real z)
 void Turbulence::SetLacunarity(Real lacunarity)
 {
   lacunarity_ = lacunarity;
+  clear_texture();
 }
 
 void Turbulence::SetGain(Real gain)
 {
   gain_ = gain;
+  clear_texture();
 }
 
 void Turbulence::SetOctaves(int octaves)
 {
   assert(octaves > 0);
   octaves_ = octaves;
+  clear_texture();
+}
+
+void Turbulence::SetBakeResolution(int resolution)
+{
+  assert(resolution >= 0);
+  bake_resolution_ = resolution;
+  clear_texture();
+}
+
+uint64_t Turbulence::GetContentHash() const
+{
+  uint64_t hash = PRIM_HASH_BASIS;
+  hash = PrimHashBytes(hash, &amplitude_, sizeof(amplitude_));
+  hash = PrimHashBytes(hash, &frequency_, sizeof(frequency_));
+  hash = PrimHashBytes(hash, &offset_, sizeof(offset_));
+  hash = PrimHashBytes(hash, &lacunarity_, sizeof(lacunarity_));
+  hash = PrimHashBytes(hash, &gain_, sizeof(gain_));
+  hash = PrimHashBytes(hash, &octaves_, sizeof(octaves_));
+  hash = PrimHashBytes(hash, &bake_resolution_, sizeof(bake_resolution_));
+  hash = PrimHashBytes(hash, &baked_octaves_, sizeof(baked_octaves_));
+  return hash == 0 ? 1 : hash;
+}
+
+class BakeTask {
+public:
+  BakeTask() : lacunarity(2), gain(.5), resolution(0), octaves(0), texture(NULL) {}
+  ~BakeTask() {}
+
+  Real lacunarity;
+  Real gain;
+  int resolution;
+  int octaves;
+  float *texture;
+};
+
+static LoopStatus bake_slice(void *data, const ThreadContext &context)
+{
+  const BakeTask *task = reinterpret_cast<const BakeTask *>(data);
+  const int res = task->resolution;
+  const int z = context.iteration_id;
+  const Real scale = static_cast<Real>(BAKE_PERIOD) / res;
+  float *dst = task->texture + static_cast<std::size_t>(z) * res * res;
+
+  for (int y = 0; y < res; y++) {
+    for (int x = 0; x < res; x++) {
+      const Vector P = Vector(x, y, z) * scale;
+      Real freq = 1;
+      Real amp = 1;
+      Real noise = 0;
+      for (int i = 0; i < task->octaves; i++) {
+        // each octave repeats over the same period in P
+        const int period = static_cast<int>(BAKE_PERIOD * freq + .5);
+        noise += amp * TiledNoise3d(P.x * freq, P.y * freq, P.z * freq, period);
+        freq *= task->lacunarity;
+        amp *= task->gain;
+      }
+      *dst++ = static_cast<float>(noise);
+    }
+  }
+  return LoopStatus::Continue;
+}
+
+int Turbulence::Bake()
+{
+  if (IsBaked()) {
+    return 0;
+  }
+  if (bake_resolution_ == 0) {
+    return 0;
+  }
+
+  // octaves repeat over the period only at integer lacunarity
+  // and the lattice repeats every 256 cells
+  if (lacunarity_ < 1 || lacunarity_ != std::floor(lacunarity_)) {
+    std::cerr << "* WARNING: turbulence with lacunarity " << lacunarity_ <<
+        " is not baked\n";
+    return -1;
+  }
+
+  int octaves = 0;
+  Real freq = 1;
+  while (octaves < octaves_ &&
+      bake_resolution_ / (BAKE_PERIOD * freq) >= MIN_VOXELS_PER_CELL &&
+      BAKE_PERIOD * freq <= 256) {
+    octaves++;
+    freq *= lacunarity_;
+  }
+  if (octaves == 0) {
+    return 0;
+  }
+
+  const int res = bake_resolution_;
+  texture_.resize(static_cast<std::size_t>(res) * res * res);
+
+  BakeTask task;
+  task.lacunarity = lacunarity_;
+  task.gain = gain_;
+  task.resolution = res;
+  task.octaves = octaves;
+  task.texture = &texture_[0];
+
+  std::vector<int> slice_que(res);
+  for (int i = 0; i < res; i++) {
+    slice_que[i] = i;
+  }
+  MtRunParallelLoop(&task, bake_slice, MtGetMaxAvailableThreadCount(), slice_que);
+
+  baked_octaves_ = octaves;
+  return 0;
+}
+
+bool Turbulence::IsBaked() const
+{
+  return baked_octaves_ > 0;
+}
+
+int Turbulence::GetBakedOctaves() const
+{
+  return baked_octaves_;
 }
 
 Real Turbulence::Evaluate(const Vector &position) const
 {
   const Vector P = position * frequency_ + offset_;
+  if (IsBaked()) {
+    return amplitude_.x * (texture_value(P) + fine_noise(P));
+  }
   const Real noise = PerlinNoise(P, lacunarity_, gain_, octaves_);
 
   return amplitude_.x * noise;
@@ -63,9 +207,105 @@ Real Turbulence::Evaluate(const Vector &position) const
 Vector Turbulence::Evaluate3d(const Vector &position) const
 {
   const Vector P = position * frequency_ + offset_;
+  if (IsBaked()) {
+    // fine octaves of the three channels share lanes
+    const Vector Q[3] = {
+      P + CHANNEL_OFFSETS[0],
+      P + CHANNEL_OFFSETS[1],
+      P + CHANNEL_OFFSETS[2]};
+    Real noise[3];
+    evaluate_baked(Q, 3, noise);
+    return amplitude_ * Vector(noise[0], noise[1], noise[2]);
+  }
   const Vector noise = PerlinNoise3d(P, lacunarity_, gain_, octaves_);
 
   return amplitude_ * noise;
 }
 
+void Turbulence::Evaluate(const Vector *positions, int count, Real *noise) const
+{
+  std::vector<Vector> P(count);
+  for (int i = 0; i < count; i++) {
+    P[i] = positions[i] * frequency_ + offset_;
+  }
+  if (count > 0 && IsBaked()) {
+    evaluate_baked(&P[0], count, noise);
+  }
+  else if (count > 0) {
+    PerlinNoise(&P[0], count, lacunarity_, gain_, octaves_, noise);
+  }
+
+  for (int i = 0; i < count; i++) {
+    noise[i] *= amplitude_.x;
+  }
+}
+
+void Turbulence::clear_texture()
+{
+  baked_octaves_ = 0;
+  std::vector<float>().swap(texture_);
+}
+
+float Turbulence::texture_value(const Vector &P) const
+{
+  const int res = bake_resolution_;
+  const Real scale = static_cast<Real>(res) / BAKE_PERIOD;
+  const Real u[3] = {P.x * scale, P.y * scale, P.z * scale};
+
+  int i0[3], i1[3];
+  float f[3];
+  for (int i = 0; i < 3; i++) {
+    const Real fl = std::floor(u[i]);
+    f[i] = static_cast<float>(u[i] - fl);
+    // voxels repeat every res
+    i0[i] = static_cast<int>(fl - res * std::floor(fl / res));
+    i1[i] = i0[i] + 1 == res ? 0 : i0[i] + 1;
+  }
+
+  const float *T = &texture_[0];
+  const std::size_t Y0 = static_cast<std::size_t>(i0[1]) * res;
+  const std::size_t Y1 = static_cast<std::size_t>(i1[1]) * res;
+  const std::size_t Z0 = static_cast<std::size_t>(i0[2]) * res * res;
+  const std::size_t Z1 = static_cast<std::size_t>(i1[2]) * res * res;
+
+  const float x00 = T[Z0 + Y0 + i0[0]] + f[0] * (T[Z0 + Y0 + i1[0]] - T[Z0 + Y0 + i0[0]]);
+  const float x10 = T[Z0 + Y1 + i0[0]] + f[0] * (T[Z0 + Y1 + i1[0]] - T[Z0 + Y1 + i0[0]]);
+  const float x01 = T[Z1 + Y0 + i0[0]] + f[0] * (T[Z1 + Y0 + i1[0]] - T[Z1 + Y0 + i0[0]]);
+  const float x11 = T[Z1 + Y1 + i0[0]] + f[0] * (T[Z1 + Y1 + i1[0]] - T[Z1 + Y1 + i0[0]]);
+  const float xy0 = x00 + f[1] * (x10 - x00);
+  const float xy1 = x01 + f[1] * (x11 - x01);
+  return xy0 + f[2] * (xy1 - xy0);
+}
+
+void Turbulence::evaluate_baked(const Vector *P, int count, Real *noise) const
+{
+  const int fine_octaves = octaves_ - baked_octaves_;
+  if (fine_octaves > 0) {
+    const Real scale = std::pow(lacunarity_, baked_octaves_);
+    std::vector<Vector> P_fine(count);
+    for (int i = 0; i < count; i++) {
+      P_fine[i] = P[i] * scale;
+    }
+    PerlinNoise(&P_fine[0], count, lacunarity_, gain_, fine_octaves, noise);
+  } else {
+    std::fill(noise, noise + count, 0);
+  }
+
+  const Real amp = std::pow(gain_, baked_octaves_);
+  for (int i = 0; i < count; i++) {
+    noise[i] = texture_value(P[i]) + amp * noise[i];
+  }
+}
+
+Real Turbulence::fine_noise(const Vector &P) const
+{
+  const int fine_octaves = octaves_ - baked_octaves_;
+  if (fine_octaves <= 0) {
+    return 0;
+  }
+  const Real scale = std::pow(lacunarity_, baked_octaves_);
+  const Real amp = std::pow(gain_, baked_octaves_);
+  return amp * PerlinNoise(P * scale, lacunarity_, gain_, fine_octaves);
+}
+
 } // namespace xxx
@@ -7,6 +7,8 @@
 #include "fj_compatibility.h"
 #include "fj_vector.h"
 #include "fj_types.h"
+#include <cstdint>
+#include <vector>
 
 namespace fj {
 
@@ -21,9 +23,25 @@ public:
   void SetLacunarity(Real lacunarity);
   void SetGain(Real gain);
   void SetOctaves(int octaves);
+  // voxels on each side of the baked texture. 0 disables baking
+  void SetBakeResolution(int resolution);
 
-  double Evaluate(const Vector &position) const;
+  // Bakes octaves coarse enough for the texture into a periodic texture in
+  // noise space. Evaluate then reads the texture trilinearly and evaluates
+  // only the finer octaves. Changing lacunarity, gain or octaves discards it.
+  // Not thread safe. Call before evaluating from threads
+  int Bake();
+  bool IsBaked() const;
+  int GetBakedOctaves() const;
+
+  Real Evaluate(const Vector &position) const;
   Vector Evaluate3d(const Vector &position) const;
+  // Evaluate() of count positions at once. faster than one at a time
+  void Evaluate(const Vector *positions, int count, Real *noise) const;
+
+  // hash of the parameters and the baked octaves. equal hashes evaluate
+  // the same noise
+  uint64_t GetContentHash() const;
 
 private:
   Vector amplitude_;
@@ -32,6 +50,17 @@ private:
   Real   lacunarity_;
   Real   gain_;
   int    octaves_;
+
+  int bake_resolution_;
+  int baked_octaves_;
+  std::vector<float> texture_;
+
+  void clear_texture();
+  float texture_value(const Vector &P) const;
+  // the octaves not in the texture
+  Real fine_noise(const Vector &P) const;
+  // texture and fine octaves at positions in noise space
+  void evaluate_baked(const Vector *P, int count, Real *noise) const;
 };
 
 } // namespace xxx
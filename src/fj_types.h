@@ -9,8 +9,13 @@
 
 namespace fj {
 
-//XXX CHANGE FJ_REAL_MAX IF REAL IS FLOAT
+// make SINGLE_PRECISION=1 builds the renderer with float reals. the
+// library and the plugins linked to it need the same precision
+#if defined(FJ_SINGLE_PRECISION)
+using Real = float;
+#else
 using Real = double;
+#endif
 using Index = int;
 
 class FJ_API Index3 {
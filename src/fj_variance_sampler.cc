@@ -0,0 +1,257 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_variance_sampler.h"
+#include "fj_rectangle.h"
+#include "fj_numeric.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace fj {
+
+// pixels in margins of neighbor tiles get the same samples
+static unsigned int pixel_seed(const Int2 &pixel_pos, int seed)
+{
+  return
+    static_cast<unsigned int>(pixel_pos[0]) * 73856093U ^
+    static_cast<unsigned int>(pixel_pos[1]) * 19349663U ^
+    static_cast<unsigned int>(seed) * 83492791U;
+}
+
+VarianceSampler::VarianceSampler() :
+  pixels_(),
+  pending_(),
+
+  pixel_start_(0, 0),
+  npixels_(0, 0),
+  margin_(0, 0),
+
+  current_index_(0),
+  round_start_()
+{
+}
+
+VarianceSampler::~VarianceSampler()
+{
+}
+
+void VarianceSampler::update_sample_counts()
+{
+  margin_ = count_samples_in_margin();
+}
+
+int VarianceSampler::generate_samples(const Rectangle &region)
+{
+  pixel_start_ = region.min - margin_;
+  npixels_ = region.Size() + 2 * margin_;
+
+  const int NPIXELS = npixels_[0] * npixels_[1];
+  pixels_.resize(NPIXELS);
+  round_start_.assign(NPIXELS, 0);
+  pending_.clear();
+  current_index_ = 0;
+
+  for (int y = 0; y < npixels_[1]; y++) {
+    for (int x = 0; x < npixels_[0]; x++) {
+      const Int2 pixel_pos = pixel_start_ + Int2(x, y);
+      Pixel &pixel = pixels_[y * npixels_[0] + x];
+
+      pixel.samples.clear();
+      pixel.mean = Vector4();
+      pixel.m2 = Vector4();
+      pixel.rng = XorShift(pixel_seed(pixel_pos, GetSampleSeed()));
+
+      add_stratified_samples(pixel, pixel_pos);
+    }
+  }
+
+  for (int i = 0; i < NPIXELS; i++) {
+    std::vector<Sample> &samples = pixels_[i].samples;
+    for (std::size_t j = 0; j < samples.size(); j++) {
+      pending_.push_back(&samples[j]);
+    }
+  }
+  return 0;
+}
+
+Sample *VarianceSampler::get_next_sample()
+{
+  if (current_index_ >= static_cast<int>(pending_.size())) {
+    if (start_next_round() == 0) {
+      return NULL;
+    }
+  }
+
+  return pending_[current_index_++];
+}
+
+void VarianceSampler::get_sampleset_in_pixel(std::vector<Sample> &pixelsamples,
+    const Int2 &pixel_pos) const
+{
+  // pixel_pos and its neighbors within margin
+  const Int2 local = pixel_pos - pixel_start_ - margin_;
+  const Int2 extent = 2 * margin_ + Int2(1, 1);
+
+  std::size_t sample_count = 0;
+  for (int y = 0; y < extent[1]; y++) {
+    for (int x = 0; x < extent[0]; x++) {
+      const int OFFSET = (local[1] + y) * npixels_[0] + (local[0] + x);
+      sample_count += pixels_[OFFSET].samples.size();
+    }
+  }
+
+  // the filter uses all samples in the vector
+  pixelsamples.resize(sample_count);
+  Sample *dst = pixelsamples.empty() ? NULL : &pixelsamples[0];
+
+  for (int y = 0; y < extent[1]; y++) {
+    for (int x = 0; x < extent[0]; x++) {
+      const int OFFSET = (local[1] + y) * npixels_[0] + (local[0] + x);
+      const std::vector<Sample> &src = pixels_[OFFSET].samples;
+      // each pixel has the same total weight however many samples it has
+      const Real weight = 1. / src.size();
+      for (std::size_t i = 0; i < src.size(); i++) {
+        *dst = src[i];
+        dst->weight = weight;
+        dst++;
+      }
+    }
+  }
+}
+
+Int2 VarianceSampler::count_samples_in_margin() const
+{
+  return Int2(
+      static_cast<int>(Ceil((GetFilterWidth()[0] - 1) * .5)),
+      static_cast<int>(Ceil((GetFilterWidth()[1] - 1) * .5)));
+}
+
+int VarianceSampler::get_max_sample_count() const
+{
+  const Int2 rate = GetPixelSamples();
+  return rate[0] * rate[1] * (1 << (2 * GetMaxSubdivision()));
+}
+
+void VarianceSampler::add_stratified_samples(Pixel &pixel, const Int2 &pixel_pos)
+{
+  const Int2 rate = GetPixelSamples();
+  const Int2 res  = GetResolution();
+  const Real jitter = GetJitter();
+
+  for (int y = 0; y < rate[1]; y++) {
+    for (int x = 0; x < rate[0]; x++) {
+      Real u = .5;
+      Real v = .5;
+
+      if (IsJittered()) {
+        u += (pixel.rng.NextFloat01() - .5) * jitter;
+        v += (pixel.rng.NextFloat01() - .5) * jitter;
+      }
+
+      Sample sample;
+      sample.uv.x =     (pixel_pos[0] + (x + u) / rate[0]) / res[0];
+      sample.uv.y = 1 - (pixel_pos[1] + (y + v) / rate[1]) / res[1];
+
+      if (IsSamplingTime()) {
+        const Real rnd = pixel.rng.NextFloat01();
+        sample.time = ComputeSampleTime(pixel_pos, y * rate[0] + x, rate[0] * rate[1], rnd);
+      }
+
+      SetSequence(sample, pixel_pos, pixel.samples.size(), get_max_sample_count());
+      pixel.samples.push_back(sample);
+    }
+  }
+}
+
+void VarianceSampler::add_random_samples(Pixel &pixel, const Int2 &pixel_pos,
+    int count)
+{
+  const Int2 res  = GetResolution();
+  const Vector2 sample_time_range = GetSampleTimeRange();
+
+  for (int i = 0; i < count; i++) {
+    const Real u = pixel.rng.NextFloat01();
+    const Real v = pixel.rng.NextFloat01();
+
+    Sample sample;
+    sample.uv.x =     (pixel_pos[0] + u) / res[0];
+    sample.uv.y = 1 - (pixel_pos[1] + v) / res[1];
+
+    if (IsSamplingTime()) {
+      const Real rnd = pixel.rng.NextFloat01();
+      sample.time = Fit(rnd, 0, 1, sample_time_range[0], sample_time_range[1]);
+    }
+
+    SetSequence(sample, pixel_pos, pixel.samples.size(), get_max_sample_count());
+    pixel.samples.push_back(sample);
+  }
+}
+
+void VarianceSampler::update_estimates(Pixel &pixel, int first_sample) const
+{
+  // Welford's online algorithm
+  for (std::size_t i = first_sample; i < pixel.samples.size(); i++) {
+    const Vector4 &data = pixel.samples[i].data;
+    const Vector4 delta = data - pixel.mean;
+    pixel.mean = pixel.mean + delta / static_cast<Real>(i + 1);
+    pixel.m2 = pixel.m2 + delta * (data - pixel.mean);
+  }
+}
+
+bool VarianceSampler::need_more_samples(const Pixel &pixel) const
+{
+  const int N = pixel.samples.size();
+
+  if (N >= get_max_sample_count()) {
+    return false;
+  }
+  // too few samples to trust the variance
+  if (N < 4) {
+    return true;
+  }
+
+  const Real threshold = GetSubdivisionThreshold();
+  for (int i = 0; i < 4; i++) {
+    const Real variance = pixel.m2[i] / (N - 1);
+    const Real std_error = std::sqrt(variance / N);
+    if (std_error > threshold) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int VarianceSampler::start_next_round()
+{
+  const int NPIXELS = pixels_.size();
+  const int MAX_SAMPLES = get_max_sample_count();
+
+  pending_.clear();
+  current_index_ = 0;
+
+  for (int i = 0; i < NPIXELS; i++) {
+    Pixel &pixel = pixels_[i];
+    const int N = pixel.samples.size();
+
+    update_estimates(pixel, round_start_[i]);
+    round_start_[i] = N;
+
+    if (need_more_samples(pixel)) {
+      const Int2 pixel_pos = pixel_start_ + Int2(i % npixels_[0], i / npixels_[0]);
+      add_random_samples(pixel, pixel_pos, std::min(N, MAX_SAMPLES - N));
+    }
+  }
+
+  // no more push_back until the next round
+  for (int i = 0; i < NPIXELS; i++) {
+    std::vector<Sample> &samples = pixels_[i].samples;
+    for (std::size_t j = round_start_[i]; j < samples.size(); j++) {
+      pending_.push_back(&samples[j]);
+    }
+  }
+
+  return pending_.size();
+}
+
+} // namespace xxx
@@ -0,0 +1,63 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_VARIANCE_SAMPLER_H
+#define FJ_VARIANCE_SAMPLER_H
+
+#include "fj_sampler.h"
+#include "fj_random.h"
+#include <vector>
+
+namespace fj {
+
+// Starts with pixel samples in each pixel then doubles samples of pixels
+// whose standard error of mean exceeds subdivision threshold. Pixels get
+// pixel samples * 4^max subdivision samples at most.
+class VarianceSampler : public Sampler {
+public:
+  VarianceSampler();
+  virtual ~VarianceSampler();
+
+private:
+  class Pixel {
+  public:
+    Pixel() : samples(), mean(), m2(), rng() {}
+    ~Pixel() {}
+
+    std::vector<Sample> samples;
+    // running estimates over samples already traced
+    Vector4 mean;
+    Vector4 m2;
+    XorShift rng;
+  };
+
+  virtual void update_sample_counts();
+  virtual int generate_samples(const Rectangle &region);
+  virtual Sample *get_next_sample();
+  virtual void get_sampleset_in_pixel(std::vector<Sample> &pixelsamples,
+      const Int2 &pixel_pos) const;
+
+  Int2 count_samples_in_margin() const;
+  int get_max_sample_count() const;
+
+  void add_stratified_samples(Pixel &pixel, const Int2 &pixel_pos);
+  void add_random_samples(Pixel &pixel, const Int2 &pixel_pos, int count);
+  void update_estimates(Pixel &pixel, int first_sample) const;
+  bool need_more_samples(const Pixel &pixel) const;
+  int start_next_round();
+
+  std::vector<Pixel> pixels_;
+  std::vector<Sample *> pending_;
+
+  Int2 pixel_start_;
+  Int2 npixels_;
+  Int2 margin_;
+
+  int current_index_;
+  // samples count of each pixel before the current round
+  std::vector<int> round_start_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
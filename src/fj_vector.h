@@ -682,6 +682,25 @@ inline std::ostream &operator<<(std::ostream &os, const Int2 &a)
     a[1] << ")";
 }
 
+// Storage of geometry attributes. make COMPACT_GEOMETRY=1 keeps them
+// in floats for half the memory. they are widened to Real when read
+#if defined(FJ_COMPACT_GEOMETRY)
+class FJ_API CompactVector {
+public:
+  CompactVector() : x(0), y(0), z(0) {}
+  CompactVector(const Vector &a) : x(a.x), y(a.y), z(a.z) {}
+  ~CompactVector() {}
+
+  operator Vector() const { return Vector(x, y, z); }
+
+  float x, y, z;
+};
+using CompactReal = float;
+#else
+using CompactVector = Vector;
+using CompactReal = Real;
+#endif
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -0,0 +1,343 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_VECTOR_LANES_H
+#define FJ_VECTOR_LANES_H
+
+#include "fj_types.h"
+#include "fj_vector.h"
+#include <cassert>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define FJ_LANES_SSE2
+  #include <emmintrin.h>
+#endif
+
+// lanes of an SSE2 register and the intrinsic of an operation on them
+#if defined(FJ_LANES_SSE2) && defined(FJ_SINGLE_PRECISION)
+  #define FJ_LANES_STEP 4
+  #define FJ_LANES_INTRINSIC(op) _mm_##op##_ps
+#elif defined(FJ_LANES_SSE2)
+  #define FJ_LANES_STEP 2
+  #define FJ_LANES_INTRINSIC(op) _mm_##op##_pd
+#else
+  #define FJ_LANES_STEP 2
+#endif
+
+// N-wide lanes of reals and vectors for batched kernels. each lane follows
+// the same order of operations as the scalar Vector functions so that a lane
+// computes exactly what the scalar version computes. two double or four
+// float lanes are processed per SSE2 register, and the lanes are plain
+// loops without SSE2
+
+namespace fj {
+
+template <int N>
+class RealN {
+public:
+  RealN()
+  {
+    for (int i = 0; i < N; i++) {
+      lane_[i] = 0;
+    }
+  }
+  explicit RealN(Real scalar)
+  {
+    for (int i = 0; i < N; i++) {
+      lane_[i] = scalar;
+    }
+  }
+  ~RealN() {}
+
+  static RealN Load(const Real *src)
+  {
+    RealN a;
+    for (int i = 0; i < N; i++) {
+      a.lane_[i] = src[i];
+    }
+    return a;
+  }
+  void Store(Real *dst) const
+  {
+    for (int i = 0; i < N; i++) {
+      dst[i] = lane_[i];
+    }
+  }
+
+  Real operator[](int i) const
+  {
+    assert(i >= 0 && i < N && "bounds error at RealN::get");
+    return lane_[i];
+  }
+  Real &operator[](int i)
+  {
+    assert(i >= 0 && i < N && "bounds error at RealN::set");
+    return lane_[i];
+  }
+
+  const RealN &operator+=(const RealN &a) { return *this = *this + a; }
+  const RealN &operator-=(const RealN &a) { return *this = *this - a; }
+  const RealN &operator*=(const RealN &a) { return *this = *this * a; }
+  const RealN &operator/=(const RealN &a) { return *this = *this / a; }
+
+  static const int LANE_COUNT = N;
+
+private:
+  static_assert(N > 0 && N % FJ_LANES_STEP == 0,
+      "lane count must be a multiple of the lanes of a register");
+
+  template <int M> friend RealN<M> operator+(const RealN<M> &a, const RealN<M> &b);
+  template <int M> friend RealN<M> operator-(const RealN<M> &a, const RealN<M> &b);
+  template <int M> friend RealN<M> operator*(const RealN<M> &a, const RealN<M> &b);
+  template <int M> friend RealN<M> operator/(const RealN<M> &a, const RealN<M> &b);
+  template <int M> friend RealN<M> Min(const RealN<M> &a, const RealN<M> &b);
+  template <int M> friend RealN<M> Max(const RealN<M> &a, const RealN<M> &b);
+  template <int M> friend RealN<M> Sqrt(const RealN<M> &a);
+  template <int M> friend int LessThan(const RealN<M> &a, const RealN<M> &b);
+  template <int M> friend int GreaterThan(const RealN<M> &a, const RealN<M> &b);
+
+  alignas(16) Real lane_[N];
+};
+
+// returns the bits of all lanes
+template <int N>
+inline int AllLanes()
+{
+  return (1 << N) - 1;
+}
+
+#if defined(FJ_LANES_SSE2)
+  #define FJ_LANES_BINARY_OP(a, b, sse_op, scalar_expr) \
+    RealN<N> r; \
+    for (int i = 0; i < N; i += FJ_LANES_STEP) { \
+      FJ_LANES_INTRINSIC(store)(&r.lane_[i], FJ_LANES_INTRINSIC(sse_op)( \
+          FJ_LANES_INTRINSIC(load)(&(a).lane_[i]), \
+          FJ_LANES_INTRINSIC(load)(&(b).lane_[i]))); \
+    } \
+    return r;
+  #define FJ_LANES_COMPARE(a, b, sse_op, scalar_expr) \
+    int mask = 0; \
+    for (int i = 0; i < N; i += FJ_LANES_STEP) { \
+      mask |= FJ_LANES_INTRINSIC(movemask)(FJ_LANES_INTRINSIC(sse_op)( \
+          FJ_LANES_INTRINSIC(load)(&(a).lane_[i]), \
+          FJ_LANES_INTRINSIC(load)(&(b).lane_[i]))) << i; \
+    } \
+    return mask;
+#else
+  #define FJ_LANES_BINARY_OP(a, b, sse_op, scalar_expr) \
+    RealN<N> r; \
+    for (int i = 0; i < N; i++) { \
+      const Real x = (a).lane_[i]; \
+      const Real y = (b).lane_[i]; \
+      r.lane_[i] = (scalar_expr); \
+    } \
+    return r;
+  #define FJ_LANES_COMPARE(a, b, sse_op, scalar_expr) \
+    int mask = 0; \
+    for (int i = 0; i < N; i++) { \
+      const Real x = (a).lane_[i]; \
+      const Real y = (b).lane_[i]; \
+      mask |= (scalar_expr) << i; \
+    } \
+    return mask;
+#endif
+
+template <int N>
+inline RealN<N> operator+(const RealN<N> &a, const RealN<N> &b)
+{
+  FJ_LANES_BINARY_OP(a, b, add, x + y)
+}
+
+template <int N>
+inline RealN<N> operator-(const RealN<N> &a, const RealN<N> &b)
+{
+  FJ_LANES_BINARY_OP(a, b, sub, x - y)
+}
+
+template <int N>
+inline RealN<N> operator*(const RealN<N> &a, const RealN<N> &b)
+{
+  FJ_LANES_BINARY_OP(a, b, mul, x * y)
+}
+
+template <int N>
+inline RealN<N> operator/(const RealN<N> &a, const RealN<N> &b)
+{
+  FJ_LANES_BINARY_OP(a, b, div, x / y)
+}
+
+// the second argument is returned for NaN lanes as _mm_min_pd does
+template <int N>
+inline RealN<N> Min(const RealN<N> &a, const RealN<N> &b)
+{
+  FJ_LANES_BINARY_OP(a, b, min, x < y ? x : y)
+}
+
+template <int N>
+inline RealN<N> Max(const RealN<N> &a, const RealN<N> &b)
+{
+  FJ_LANES_BINARY_OP(a, b, max, x > y ? x : y)
+}
+
+// returns a bit per lane where a < b. false for NaN lanes
+template <int N>
+inline int LessThan(const RealN<N> &a, const RealN<N> &b)
+{
+  FJ_LANES_COMPARE(a, b, cmplt, x < y)
+}
+
+template <int N>
+inline int GreaterThan(const RealN<N> &a, const RealN<N> &b)
+{
+  FJ_LANES_COMPARE(a, b, cmpgt, x > y)
+}
+
+template <int N>
+inline RealN<N> Sqrt(const RealN<N> &a)
+{
+  RealN<N> r;
+#if defined(FJ_LANES_SSE2)
+  for (int i = 0; i < N; i += FJ_LANES_STEP) {
+    FJ_LANES_INTRINSIC(store)(&r.lane_[i],
+        FJ_LANES_INTRINSIC(sqrt)(FJ_LANES_INTRINSIC(load)(&a.lane_[i])));
+  }
+#else
+  for (int i = 0; i < N; i++) {
+    r.lane_[i] = std::sqrt(a.lane_[i]);
+  }
+#endif
+  return r;
+}
+
+#undef FJ_LANES_BINARY_OP
+#undef FJ_LANES_COMPARE
+#undef FJ_LANES_INTRINSIC
+
+template <int N>
+inline RealN<N> operator-(const RealN<N> &a)
+{
+  return RealN<N>(-1) * a;
+}
+
+template <int N>
+class VectorN {
+public:
+  VectorN() : x(), y(), z() {}
+  VectorN(const RealN<N> &xx, const RealN<N> &yy, const RealN<N> &zz)
+    : x(xx), y(yy), z(zz) {}
+  // every lane is a
+  explicit VectorN(const Vector &a)
+    : x(a.x), y(a.y), z(a.z) {}
+  ~VectorN() {}
+
+  Vector Get(int i) const
+  {
+    return Vector(x[i], y[i], z[i]);
+  }
+  void Set(int i, const Vector &a)
+  {
+    x[i] = a.x;
+    y[i] = a.y;
+    z[i] = a.z;
+  }
+
+  const VectorN &operator+=(const VectorN &a) { return *this = *this + a; }
+  const VectorN &operator-=(const VectorN &a) { return *this = *this - a; }
+  const VectorN &operator*=(const RealN<N> &a) { return *this = *this * a; }
+
+  static const int LANE_COUNT = N;
+
+  RealN<N> x, y, z;
+};
+
+typedef RealN<4> Real4N;
+typedef RealN<8> Real8N;
+typedef VectorN<4> Vector4N;
+typedef VectorN<8> Vector8N;
+
+template <int N>
+inline VectorN<N> operator+(const VectorN<N> &a, const VectorN<N> &b)
+{
+  return VectorN<N>(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+template <int N>
+inline VectorN<N> operator-(const VectorN<N> &a, const VectorN<N> &b)
+{
+  return VectorN<N>(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+template <int N>
+inline VectorN<N> operator*(const VectorN<N> &a, const VectorN<N> &b)
+{
+  return VectorN<N>(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+template <int N>
+inline VectorN<N> operator*(const VectorN<N> &a, const RealN<N> &scalar)
+{
+  return VectorN<N>(a.x * scalar, a.y * scalar, a.z * scalar);
+}
+
+template <int N>
+inline VectorN<N> operator*(const RealN<N> &scalar, const VectorN<N> &a)
+{
+  return a * scalar;
+}
+
+template <int N>
+inline VectorN<N> operator/(const VectorN<N> &a, const RealN<N> &scalar)
+{
+  // no checking zero division
+  const RealN<N> inv = RealN<N>(1.) / scalar;
+  return a * inv;
+}
+
+template <int N>
+inline VectorN<N> operator-(const VectorN<N> &a)
+{
+  return RealN<N>(-1) * a;
+}
+
+template <int N>
+inline RealN<N> Dot(const VectorN<N> &a, const VectorN<N> &b)
+{
+  return
+    a.x * b.x +
+    a.y * b.y +
+    a.z * b.z;
+}
+
+template <int N>
+inline VectorN<N> Cross(const VectorN<N> &a, const VectorN<N> &b)
+{
+  return VectorN<N>(
+    a.y * b.z - a.z * b.y,
+    a.z * b.x - a.x * b.z,
+    a.x * b.y - a.y * b.x);
+}
+
+template <int N>
+inline RealN<N> Length(const VectorN<N> &a)
+{
+  return Sqrt(Dot(a, a));
+}
+
+// zero length lanes are returned as they are
+template <int N>
+inline VectorN<N> Normalize(const VectorN<N> &a)
+{
+  const RealN<N> len = Length(a);
+  VectorN<N> r = a / len;
+  for (int i = 0; i < N; i++) {
+    if (len[i] == 0) {
+      r.Set(i, a.Get(i));
+    }
+  }
+  return r;
+}
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
@@ -24,6 +24,10 @@ public:
   {
     return value_.empty();
   }
+  std::size_t GetMemoryUsage() const
+  {
+    return value_.capacity() * sizeof(Value) + index_.capacity() * sizeof(Index);
+  }
 
   // Resize
   void ResizeValue(Index size)
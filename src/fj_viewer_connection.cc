@@ -0,0 +1,383 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "fj_viewer_connection.h"
+#include "fj_protocol.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <vector>
+
+namespace fj {
+
+// tiles waiting to be sent. render threads wait when the viewer is this far behind
+static const std::size_t MAX_QUEUED_PACKETS = 64;
+// tiles done sent in one message when the viewer is behind
+static const std::size_t MAX_TILES_PER_BATCH = 16;
+// how long closing waits for the viewer to read the last messages
+static const int CLOSE_TIMEOUT_SEC = 5;
+
+ViewerConnection::ViewerConnection() :
+  socket_(),
+  sender_thread_(),
+  mutex_(),
+  que_changed_(),
+  que_(),
+  is_closing_(true),
+  has_error_(false),
+  is_aborted_(false),
+  tile_encoding_(TILE_ENCODING_FLOAT),
+  shared_frame_()
+{
+}
+
+ViewerConnection::~ViewerConnection()
+{
+  Close();
+}
+
+int ViewerConnection::Open(const std::string &address)
+{
+  if (IsOpen()) {
+    return -1;
+  }
+
+  socket_.Open();
+  socket_.SetAddress(address);
+  if (socket_.Connect() == -1) {
+    socket_.Close();
+    return -1;
+  }
+  socket_.EnableNoDelay();
+
+  is_closing_ = false;
+  has_error_ = false;
+  is_aborted_ = false;
+  sender_thread_ = std::thread(&ViewerConnection::send_packets, this);
+  return 0;
+}
+
+bool ViewerConnection::IsOpen() const
+{
+  return sender_thread_.joinable();
+}
+
+void ViewerConnection::Close()
+{
+  if (!IsOpen()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_closing_ = true;
+  }
+  que_changed_.notify_all();
+  sender_thread_.join();
+
+  for (std::size_t i = 0; i < que_.size(); i++) {
+    delete que_[i];
+  }
+  que_.clear();
+
+  // closing with replies not received may reset the connection before
+  // the viewer reads the last tiles
+  socket_.ShutdownWrite();
+  while (socket_.WaitForData(CLOSE_TIMEOUT_SEC, 0) == 1) {
+    Message message;
+    if (ReceiveReply(socket_, message) == -1) {
+      break;
+    }
+  }
+  socket_.Close();
+
+  // the viewer keeps the frame it has mapped
+  shared_frame_.Close();
+}
+
+void ViewerConnection::SendFrameStart(int32_t frame_id, int xres, int yres,
+    int channel_count, int tile_count, int tile_encoding)
+{
+  if (tile_encoding == TILE_ENCODING_SHARED &&
+      shared_frame_.Create(frame_id, xres, yres, channel_count)) {
+    std::cerr << "* WARNING: cannot create shared frame for fbview. "
+        "tiles are sent through the socket\n\n";
+    tile_encoding = TILE_ENCODING_FLOAT_RLE;
+  }
+
+  Packet *packet = new Packet();
+  packet->type = MSG_RENDER_FRAME_START;
+  packet->frame_id = frame_id;
+  packet->xres = xres;
+  packet->yres = yres;
+  packet->channel_count = channel_count;
+  packet->tile_count = tile_count;
+  packet->tile_encoding = tile_encoding;
+  push(packet, false);
+}
+
+void ViewerConnection::SendFrameDone(int32_t frame_id)
+{
+  Packet *packet = new Packet();
+  packet->type = MSG_RENDER_FRAME_DONE;
+  packet->frame_id = frame_id;
+  push(packet, false);
+}
+
+void ViewerConnection::SendTileStart(int32_t frame_id, int tile_id,
+    const Rectangle &region)
+{
+  Packet *packet = new Packet();
+  packet->type = MSG_RENDER_TILE_START;
+  packet->frame_id = frame_id;
+  packet->tile_id = tile_id;
+  packet->region = region;
+  push(packet, true);
+}
+
+void ViewerConnection::SendTileDone(int32_t frame_id, int tile_id,
+    const Rectangle &region, const FrameBuffer &framebuffer)
+{
+  const int width = region.Size()[0];
+  const int height = region.Size()[1];
+  // channels after rgba are of arbitrary output variables
+  const int nchannels = std::min(framebuffer.GetChannelCount(), 4);
+  const int src_nchannels = framebuffer.GetChannelCount();
+
+  Packet *packet = new Packet();
+  packet->type = MSG_RENDER_TILE_DONE;
+  packet->frame_id = frame_id;
+  packet->tile_id = tile_id;
+  packet->region = region;
+  packet->channel_count = nchannels;
+
+  if (shared_frame_.IsOpen()) {
+    write_shared_tile(region, framebuffer);
+    push(packet, false);
+    return;
+  }
+
+  packet->tile.Resize(width, height, nchannels);
+
+  std::vector<float> row(nchannels == src_nchannels ? 0 : width * src_nchannels);
+  for (int y = 0; y < height; y++) {
+    float *dst = packet->tile.GetWritable(0, y, 0);
+    if (nchannels == src_nchannels) {
+      framebuffer.ReadRow(region.min[0], region.min[1] + y, width, dst);
+      continue;
+    }
+    framebuffer.ReadRow(region.min[0], region.min[1] + y, width, &row[0]);
+    for (int x = 0; x < width; x++) {
+      memcpy(dst + x * nchannels, &row[x * src_nchannels], sizeof(float) * nchannels);
+    }
+  }
+  push(packet, false);
+}
+
+void ViewerConnection::write_shared_tile(const Rectangle &region,
+    const FrameBuffer &framebuffer)
+{
+  const int width = region.Size()[0];
+  const int height = region.Size()[1];
+  const int nchannels = shared_frame_.GetChannelCount();
+  const int src_nchannels = framebuffer.GetChannelCount();
+  if (region.min[0] < 0 || region.min[1] < 0 ||
+      region.max[0] > shared_frame_.GetWidth() ||
+      region.max[1] > shared_frame_.GetHeight()) {
+    return;
+  }
+
+  std::vector<float> row(nchannels == src_nchannels ? 0 : width * src_nchannels);
+  for (int y = 0; y < height; y++) {
+    float *dst = shared_frame_.GetWritable(region.min[0], region.min[1] + y);
+    if (nchannels == src_nchannels) {
+      framebuffer.ReadRow(region.min[0], region.min[1] + y, width, dst);
+      continue;
+    }
+    framebuffer.ReadRow(region.min[0], region.min[1] + y, width, &row[0]);
+    for (int x = 0; x < width; x++) {
+      memcpy(dst + x * nchannels, &row[x * src_nchannels], sizeof(float) * nchannels);
+    }
+  }
+}
+
+bool ViewerConnection::IsAborted() const
+{
+  return is_aborted_;
+}
+
+bool ViewerConnection::push(Packet *packet, bool can_drop)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (!has_error_ && !is_closing_ && que_.size() >= MAX_QUEUED_PACKETS) {
+    if (can_drop) {
+      break;
+    }
+    que_changed_.wait(lock);
+  }
+  if (has_error_ || is_closing_ || que_.size() >= MAX_QUEUED_PACKETS) {
+    delete packet;
+    return false;
+  }
+
+  que_.push_back(packet);
+  lock.unlock();
+  que_changed_.notify_all();
+  return true;
+}
+
+void ViewerConnection::send_packets()
+{
+  for (;;) {
+    Packet *packet = NULL;
+    std::vector<Packet *> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (que_.empty() && !is_closing_) {
+        que_changed_.wait(lock);
+      }
+      if (que_.empty()) {
+        break;
+      }
+      if (que_.front()->type == MSG_RENDER_TILE_DONE) {
+        take_tile_batch(batch);
+      } else {
+        packet = que_.front();
+        que_.pop_front();
+      }
+    }
+    // makes room for threads waiting to push
+    que_changed_.notify_all();
+
+    int err = 0;
+    if (packet != NULL) {
+      err = send_packet(*packet);
+      delete packet;
+    } else {
+      err = send_tile_batch(batch);
+      for (std::size_t i = 0; i < batch.size(); i++) {
+        delete batch[i];
+      }
+    }
+
+    if (err) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (std::size_t i = 0; i < que_.size(); i++) {
+        delete que_[i];
+      }
+      que_.clear();
+      has_error_ = true;
+      que_changed_.notify_all();
+      break;
+    }
+
+    receive_replies();
+  }
+}
+
+// takes tiles done from the front of the que. tile starts in between stay
+// in the que except the ones of the taken tiles which are already done
+void ViewerConnection::take_tile_batch(std::vector<Packet *> &batch)
+{
+  std::deque<Packet *> skipped;
+
+  while (!que_.empty() && batch.size() < MAX_TILES_PER_BATCH) {
+    Packet *packet = que_.front();
+
+    if (packet->type == MSG_RENDER_TILE_START) {
+      skipped.push_back(packet);
+    }
+    else if (packet->type == MSG_RENDER_TILE_DONE) {
+      for (std::size_t i = 0; i < skipped.size(); i++) {
+        if (skipped[i]->tile_id == packet->tile_id) {
+          delete skipped[i];
+          skipped.erase(skipped.begin() + i);
+          break;
+        }
+      }
+      batch.push_back(packet);
+    }
+    else {
+      break;
+    }
+    que_.pop_front();
+  }
+
+  que_.insert(que_.begin(), skipped.begin(), skipped.end());
+}
+
+int ViewerConnection::send_packet(const Packet &packet)
+{
+  const Rectangle &r = packet.region;
+
+  switch (packet.type) {
+  case MSG_RENDER_FRAME_START:
+    tile_encoding_ = packet.tile_encoding;
+    if (SendRenderFrameStart(socket_, packet.frame_id,
+        packet.xres, packet.yres, packet.channel_count, packet.tile_count,
+        packet.tile_encoding)) {
+      return -1;
+    }
+    if (tile_encoding_ == TILE_ENCODING_SHARED) {
+      return SendRenderFrameShared(socket_, packet.frame_id, shared_frame_.GetKey());
+    }
+    return 0;
+  case MSG_RENDER_FRAME_DONE:
+    return SendRenderFrameDone(socket_, packet.frame_id);
+  case MSG_RENDER_TILE_START:
+    return SendRenderTileStart(socket_, packet.frame_id, packet.tile_id,
+        r.min[0], r.min[1], r.max[0], r.max[1]);
+  case MSG_RENDER_TILE_DONE:
+    if (tile_encoding_ == TILE_ENCODING_SHARED) {
+      return SendRenderTileShared(socket_, packet.frame_id, packet.tile_id,
+          r.min[0], r.min[1], r.max[0], r.max[1], packet.channel_count);
+    }
+    return SendRenderTileDone(socket_, packet.frame_id, packet.tile_id,
+        r.min[0], r.min[1], r.max[0], r.max[1], packet.tile, tile_encoding_);
+  default:
+    return -1;
+  }
+}
+
+int ViewerConnection::send_tile_batch(const std::vector<Packet *> &batch)
+{
+  if (batch.size() == 1) {
+    return send_packet(*batch[0]);
+  }
+
+  std::vector<char> encoded_tiles;
+  for (std::size_t i = 0; i < batch.size(); i++) {
+    const Packet &packet = *batch[i];
+    const Rectangle &r = packet.region;
+    if (tile_encoding_ == TILE_ENCODING_SHARED) {
+      EncodeRenderTileShared(encoded_tiles, packet.frame_id, packet.tile_id,
+          r.min[0], r.min[1], r.max[0], r.max[1], packet.channel_count);
+      continue;
+    }
+    EncodeRenderTileDone(encoded_tiles, packet.frame_id, packet.tile_id,
+        r.min[0], r.min[1], r.max[0], r.max[1], packet.tile, tile_encoding_);
+  }
+  // tiles in the que are of the same frame
+  return SendRenderTileBatch(socket_, batch[0]->frame_id, batch.size(),
+      encoded_tiles);
+}
+
+void ViewerConnection::receive_replies()
+{
+  // the viewer only replies to abort the frame
+  while (socket_.WaitForData(0, 0) == 1) {
+    Message message;
+    message.type = MSG_NONE;
+    if (ReceiveReply(socket_, message) == -1) {
+      // disconnected. the next send fails
+      break;
+    }
+    if (message.type == MSG_RENDER_FRAME_ABORT) {
+      is_aborted_ = true;
+    }
+  }
+}
+
+} // namespace xxx
@@ -0,0 +1,100 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_VIEWER_CONNECTION_H
+#define FJ_VIEWER_CONNECTION_H
+
+#include "fj_framebuffer.h"
+#include "fj_protocol.h"
+#include "fj_rectangle.h"
+#include "fj_socket.h"
+#include "fj_types.h"
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+
+namespace fj {
+
+// One connection to fbview for a whole frame. Messages are queued and sent
+// by a sender thread so render threads never wait for the socket. Threads
+// wait only when the que is full of tiles the viewer has not read yet.
+// Tiles done waiting in the que are sent in one batch. Frames of
+// TILE_ENCODING_SHARED are written to a SharedFrame by render threads and
+// only regions of tiles are sent.
+class ViewerConnection {
+public:
+  ViewerConnection();
+  // Closes if opened
+  ~ViewerConnection();
+
+  int Open(const std::string &address);
+  bool IsOpen() const;
+  // Sends messages left in the que then disconnects.
+  void Close();
+
+  // tiles of the frame are sent in tile_encoding, one of TileEncoding.
+  // TILE_ENCODING_FLOAT_RLE is used if the shared frame can't be created
+  void SendFrameStart(int32_t frame_id, int xres, int yres, int channel_count,
+      int tile_count, int tile_encoding);
+  void SendFrameDone(int32_t frame_id);
+  // Dropped if the que is full since the viewer only marks the tile.
+  void SendTileStart(int32_t frame_id, int tile_id, const Rectangle &region);
+  // Copies pixels of the region to the que or to the shared frame.
+  void SendTileDone(int32_t frame_id, int tile_id, const Rectangle &region,
+      const FrameBuffer &framebuffer);
+
+  // True once the viewer asks to abort the frame.
+  bool IsAborted() const;
+
+private:
+  ViewerConnection(const ViewerConnection &);
+  const ViewerConnection &operator=(const ViewerConnection &);
+
+  class Packet {
+  public:
+    Packet() : type(0), frame_id(0), xres(0), yres(0), channel_count(0),
+        tile_count(0), tile_encoding(0), tile_id(0), region(), tile() {}
+    ~Packet() {}
+
+    int type;
+    int32_t frame_id;
+    int xres;
+    int yres;
+    int channel_count;
+    int tile_count;
+    int tile_encoding;
+    int tile_id;
+    Rectangle region;
+    FrameBuffer tile;
+  };
+
+  void write_shared_tile(const Rectangle &region, const FrameBuffer &framebuffer);
+  bool push(Packet *packet, bool can_drop);
+  void send_packets();
+  void take_tile_batch(std::vector<Packet *> &batch);
+  int send_packet(const Packet &packet);
+  int send_tile_batch(const std::vector<Packet *> &batch);
+  void receive_replies();
+
+  Socket socket_;
+  std::thread sender_thread_;
+
+  std::mutex mutex_;
+  std::condition_variable que_changed_;
+  std::deque<Packet *> que_;
+  bool is_closing_;
+  bool has_error_;
+  std::atomic<bool> is_aborted_;
+  // used only by the sender thread
+  int tile_encoding_;
+  // written by render threads. created before the frame starts
+  SharedFrame shared_frame_;
+};
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
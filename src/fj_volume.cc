@@ -2,11 +2,124 @@
 // See LICENSE and README
 
 #include "fj_volume.h"
+#include "fj_multi_thread.h"
+#include "fj_tile_cache.h"
+#include "fj_compression.h"
+#include "fj_memory_usage.h"
 #include "fj_numeric.h"
+#include "fj_trace.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace fj {
 
-VoxelBuffer::VoxelBuffer() : data_(), res_()
+static const int BRICK_SHIFT = 3;
+static const int BRICK_SIZE = 1 << BRICK_SHIFT;
+static_assert(BRICK_SIZE == VOXEL_BRICK_SIZE, "brick size of files");
+static const int BRICK_MASK = BRICK_SIZE - 1;
+static const int BRICK_VOXEL_COUNT = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+// bulk writes over fewer bricks than this run on the calling thread
+static const int PARALLEL_MIN_BRICKS = 8;
+// coarser levels of volumes. each halves the resolution
+static const int MAX_VOLUME_LEVEL_COUNT = 4;
+
+// floor() is a library call without SSE4.1
+static inline int fast_floor(float x)
+{
+  const int i = static_cast<int>(x);
+  return x < i ? i - 1 : i;
+}
+
+#if defined(__SSE2__)
+static inline __m128 lerp4(__m128 t, __m128 a, __m128 b)
+{
+  return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+#endif
+
+static int voxel_index_in_brick(int x, int y, int z)
+{
+  return
+      ((z & BRICK_MASK) << (2 * BRICK_SHIFT)) +
+      ((y & BRICK_MASK) << BRICK_SHIFT) +
+      (x & BRICK_MASK);
+}
+
+// tile cache keys have 19 bits for x and y tiles
+static const int64_t TILE_INDEX_MASK = (1 << 19) - 1;
+static const int TILE_INDEX_SHIFT = 19;
+
+static std::atomic<int64_t> next_serial_number(1);
+
+VoxelBrickReader::VoxelBrickReader() : serial_number_(next_serial_number++)
+{
+}
+
+VoxelBrickReader::~VoxelBrickReader()
+{
+}
+
+int64_t VoxelBrickReader::GetSerialNumber() const
+{
+  return serial_number_;
+}
+
+// the brick each thread read last. most lookups of a ray stay in a brick
+class LastPagedBrick {
+public:
+  LastPagedBrick() : serial_number(0), index(-1), tile() {}
+  ~LastPagedBrick() {}
+
+  int64_t serial_number;
+  int64_t index;
+  TileCache::TilePtr tile;
+};
+
+static thread_local LastPagedBrick last_paged_brick;
+
+static TileCache::TilePtr load_paged_brick(const VoxelBrickReader &reader, int64_t index)
+{
+  TileCache &cache = TileCacheGetGlobal();
+  const int file_id = reader.GetFileID();
+  const int xtile = static_cast<int>(index & TILE_INDEX_MASK);
+  const int ytile = static_cast<int>(index >> TILE_INDEX_SHIFT);
+
+  TileCache::TilePtr tile = cache.Find(file_id, 0, xtile, ytile);
+  if (tile != NULL) {
+    return tile;
+  }
+
+  const TraceScope trace("texture", "ReadVolumeBrick", file_id);
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::shared_ptr<CachedTile> new_tile = std::make_shared<CachedTile>();
+  new_tile->texels.resize(BRICK_VOXEL_COUNT, 0);
+  new_tile->tilesize = BRICK_SIZE;
+  new_tile->nchannels = 1;
+  if (reader.ReadBrick(index, &new_tile->texels[0])) {
+    // a broken brick is read as empty space rather than stopping rendering
+    std::cerr << "* WARNING: could not read volume brick: " << index << "\n";
+    std::fill(new_tile->texels.begin(), new_tile->texels.end(), 0.f);
+  }
+  cache.RecordRead(file_id, sizeof(float) * new_tile->texels.size(),
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count());
+
+  return cache.Insert(file_id, 0, xtile, ytile, new_tile);
+}
+
+VoxelBuffer::VoxelBuffer() :
+    bricks_(), packed_bricks_(), precision_(VOXEL_PRECISION_FLOAT),
+    tile_values_(), brick_max_values_(),
+    reader_(), is_paged_(), res_(), brick_res_()
 {
 }
 
@@ -16,8 +129,20 @@ VoxelBuffer::~VoxelBuffer()
 
 void VoxelBuffer::Resize(int xres, int yres, int zres)
 {
-  data_.resize(xres * yres * zres, 0);
   res_ = Resolution(xres, yres, zres);
+  brick_res_ = Resolution(
+      (xres + BRICK_MASK) >> BRICK_SHIFT,
+      (yres + BRICK_MASK) >> BRICK_SHIFT,
+      (zres + BRICK_MASK) >> BRICK_SHIFT);
+
+  const int64_t brick_count =
+      static_cast<int64_t>(brick_res_.x) * brick_res_.y * brick_res_.z;
+  std::vector<std::vector<float>>(brick_count).swap(bricks_);
+  std::vector<PackedBrick>(
+      precision_ == VOXEL_PRECISION_FLOAT ? 0 : brick_count).swap(packed_bricks_);
+  std::vector<float>(brick_count, 0).swap(tile_values_);
+  std::vector<float>(brick_count, 0).swap(brick_max_values_);
+  drop_reader();
 }
 
 const Resolution &VoxelBuffer::GetResolution() const
@@ -27,7 +152,7 @@ const Resolution &VoxelBuffer::GetResolution() const
 
 bool VoxelBuffer::IsEmpty() const
 {
-  return data_.empty();
+  return bricks_.empty();
 }
 
 void VoxelBuffer::SetValue(int x, int y, int z, float value)
@@ -39,8 +164,35 @@ void VoxelBuffer::SetValue(int x, int y, int z, float value)
   if (z < 0 || res_.z <= z)
     return;
 
-  const int64_t index = (z * res_.x * res_.y) + (y * res_.x) + x;
-  data_[index] = value;
+  const int64_t index = brick_index(x, y, z);
+  own_brick(index);
+  std::vector<float> &brick = bricks_[index];
+
+  if (brick.empty()) {
+    if (value == tile_values_[index]) {
+      return;
+    }
+    brick.resize(BRICK_VOXEL_COUNT, tile_values_[index]);
+  }
+  brick[voxel_index_in_brick(x, y, z)] = value;
+
+  // bricks next to the voxel read it too
+  const float abs_value = std::abs(value);
+  const int x0 = std::max(x - 1, 0) >> BRICK_SHIFT;
+  const int y0 = std::max(y - 1, 0) >> BRICK_SHIFT;
+  const int z0 = std::max(z - 1, 0) >> BRICK_SHIFT;
+  const int x1 = std::min(x + 1, res_.x - 1) >> BRICK_SHIFT;
+  const int y1 = std::min(y + 1, res_.y - 1) >> BRICK_SHIFT;
+  const int z1 = std::min(z + 1, res_.z - 1) >> BRICK_SHIFT;
+  for (int bz = z0; bz <= z1; bz++) {
+    for (int by = y0; by <= y1; by++) {
+      for (int bx = x0; bx <= x1; bx++) {
+        float &max_value = brick_max_values_[
+            brick_index(bx << BRICK_SHIFT, by << BRICK_SHIFT, bz << BRICK_SHIFT)];
+        max_value = std::max(max_value, abs_value);
+      }
+    }
+  }
 }
 
 float VoxelBuffer::GetValue(int x, int y, int z) const
@@ -52,15 +204,712 @@ float VoxelBuffer::GetValue(int x, int y, int z) const
   if (z < 0 || res_.z <= z)
     return 0;
 
-  const int64_t index = (z * res_.x * res_.y) + (y * res_.x) + x;
-  return data_[index];
+  const int64_t index = brick_index(x, y, z);
+  const std::vector<float> &brick = bricks_[index];
+
+  if (brick.empty()) {
+    if (is_packed(index)) {
+      return packed_value(index, voxel_index_in_brick(x, y, z));
+    }
+    if (is_paged(index)) {
+      return paged_value(index, voxel_index_in_brick(x, y, z));
+    }
+    return tile_values_[index];
+  }
+  return brick[voxel_index_in_brick(x, y, z)];
+}
+
+float VoxelBuffer::GetTrilinearValue(const Vector &P) const
+{
+  float v[8];
+  float f[3];
+  get_corner_values(P, v, f);
+
+  const float x00 = v[0] + f[0] * (v[1] - v[0]);
+  const float x10 = v[2] + f[0] * (v[3] - v[2]);
+  const float x01 = v[4] + f[0] * (v[5] - v[4]);
+  const float x11 = v[6] + f[0] * (v[7] - v[6]);
+  const float xy0 = x00 + f[1] * (x10 - x00);
+  const float xy1 = x01 + f[1] * (x11 - x01);
+  return xy0 + f[2] * (xy1 - xy0);
+}
+
+void VoxelBuffer::GetTrilinearValues4(const Vector *P, float *values) const
+{
+#if defined(__SSE2__)
+  float v[8][4];
+  float f[3][4];
+  for (int i = 0; i < 4; i++) {
+    float corners[8];
+    float fractions[3];
+    get_corner_values(P[i], corners, fractions);
+    for (int j = 0; j < 8; j++) {
+      v[j][i] = corners[j];
+    }
+    for (int j = 0; j < 3; j++) {
+      f[j][i] = fractions[j];
+    }
+  }
+
+  __m128 corners[8];
+  for (int j = 0; j < 8; j++) {
+    corners[j] = _mm_loadu_ps(v[j]);
+  }
+  const __m128 fx = _mm_loadu_ps(f[0]);
+  const __m128 fy = _mm_loadu_ps(f[1]);
+  const __m128 fz = _mm_loadu_ps(f[2]);
+
+  const __m128 result =
+    lerp4(fz,
+      lerp4(fy,
+        lerp4(fx, corners[0], corners[1]),
+        lerp4(fx, corners[2], corners[3])),
+      lerp4(fy,
+        lerp4(fx, corners[4], corners[5]),
+        lerp4(fx, corners[6], corners[7])));
+
+  _mm_storeu_ps(values, result);
+#else
+  for (int i = 0; i < 4; i++) {
+    values[i] = GetTrilinearValue(P[i]);
+  }
+#endif
+}
+
+void VoxelBuffer::Fill(float value)
+{
+  drop_reader();
+  for (std::size_t i = 0; i < bricks_.size(); i++) {
+    std::vector<float>().swap(bricks_[i]);
+  }
+  std::vector<PackedBrick>(packed_bricks_.size()).swap(packed_bricks_);
+  std::fill(tile_values_.begin(), tile_values_.end(), value);
+  std::fill(brick_max_values_.begin(), brick_max_values_.end(), std::abs(value));
+}
+
+// Updates bricks in parallel. Each task owns a brick so no voxel and no
+// allocation is shared between threads.
+class VoxelBufferUpdate {
+public:
+  VoxelBufferUpdate() :
+      buffer(NULL), other(NULL), update_fn(NULL), data(NULL),
+      min(), max(), brick_min(), brick_count(), brick_max_values() {}
+  ~VoxelBufferUpdate() {}
+
+  static LoopStatus update_brick_task(void *data, const ThreadContext &context);
+  static LoopStatus add_brick_task(void *data, const ThreadContext &context);
+
+  VoxelBuffer *buffer;
+  const VoxelBuffer *other;
+  VoxelUpdateFunction update_fn;
+  void *data;
+  Resolution min;
+  Resolution max;
+  Resolution brick_min;
+  Resolution brick_count;
+  // max absolute value written to each brick
+  std::vector<float> brick_max_values;
+};
+
+static void run_brick_tasks(VoxelBufferUpdate *update, TaskFunction task_fn, int brick_count)
+{
+  if (brick_count < PARALLEL_MIN_BRICKS) {
+    ThreadContext context;
+    context.iteration_count = brick_count;
+    for (int i = 0; i < brick_count; i++) {
+      context.iteration_id = i;
+      task_fn(update, context);
+    }
+    return;
+  }
+
+  std::vector<int> brick_que(brick_count);
+  for (int i = 0; i < brick_count; i++) {
+    brick_que[i] = i;
+  }
+  MtRunParallelLoop(update, task_fn, MtGetMaxAvailableThreadCount(), brick_que);
+}
+
+LoopStatus VoxelBufferUpdate::update_brick_task(void *data, const ThreadContext &context)
+{
+  VoxelBufferUpdate *update = reinterpret_cast<VoxelBufferUpdate *>(data);
+  VoxelBuffer *buffer = update->buffer;
+  const Resolution &count = update->brick_count;
+
+  const int i = context.iteration_id;
+  const int bx = update->brick_min.x + i % count.x;
+  const int by = update->brick_min.y + i / count.x % count.y;
+  const int bz = update->brick_min.z + i / (count.x * count.y);
+
+  const int x0 = std::max(bx << BRICK_SHIFT, update->min.x);
+  const int y0 = std::max(by << BRICK_SHIFT, update->min.y);
+  const int z0 = std::max(bz << BRICK_SHIFT, update->min.z);
+  const int x1 = std::min((bx + 1) << BRICK_SHIFT, update->max.x + 1);
+  const int y1 = std::min((by + 1) << BRICK_SHIFT, update->max.y + 1);
+  const int z1 = std::min((bz + 1) << BRICK_SHIFT, update->max.z + 1);
+
+  const int64_t index = buffer->brick_index(x0, y0, z0);
+  buffer->own_brick(index);
+  std::vector<float> &brick = buffer->bricks_[index];
+  const float tile_value = buffer->tile_values_[index];
+  float max_value = 0;
+
+  for (int z = z0; z < z1; z++) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        const int voxel = voxel_index_in_brick(x, y, z);
+        const float value = brick.empty() ? tile_value : brick[voxel];
+        const float new_value = update->update_fn(update->data, x, y, z, value);
+
+        if (brick.empty()) {
+          if (new_value == tile_value) {
+            continue;
+          }
+          brick.resize(BRICK_VOXEL_COUNT, tile_value);
+        }
+        brick[voxel] = new_value;
+        max_value = std::max(max_value, std::abs(new_value));
+      }
+    }
+  }
+  update->brick_max_values[i] = max_value;
+
+  return LoopStatus::Continue;
+}
+
+LoopStatus VoxelBufferUpdate::add_brick_task(void *data, const ThreadContext &context)
+{
+  VoxelBufferUpdate *update = reinterpret_cast<VoxelBufferUpdate *>(data);
+  VoxelBuffer *buffer = update->buffer;
+  const VoxelBuffer *other = update->other;
+
+  const int index = context.iteration_id;
+  buffer->own_brick(index);
+  std::vector<float> &brick = buffer->bricks_[index];
+
+  std::vector<float> other_voxels;
+  if (other->is_paged(index)) {
+    other_voxels = load_paged_brick(*other->reader_, index)->texels;
+  } else if (other->is_packed(index)) {
+    other->unpack_brick(index, other_voxels);
+  }
+  const std::vector<float> &other_brick =
+      other_voxels.empty() ? other->bricks_[index] : other_voxels;
+  const float other_tile_value = other->tile_values_[index];
+
+  if (other_brick.empty()) {
+    if (brick.empty()) {
+      buffer->tile_values_[index] += other_tile_value;
+    } else if (other_tile_value != 0) {
+      for (int i = 0; i < BRICK_VOXEL_COUNT; i++) {
+        brick[i] += other_tile_value;
+      }
+    }
+    return LoopStatus::Continue;
+  }
+
+  if (brick.empty()) {
+    brick.resize(BRICK_VOXEL_COUNT, buffer->tile_values_[index]);
+  }
+  for (int i = 0; i < BRICK_VOXEL_COUNT; i++) {
+    brick[i] += other_brick[i];
+  }
+
+  return LoopStatus::Continue;
+}
+
+void VoxelBuffer::UpdateValues(int xmin, int ymin, int zmin, int xmax, int ymax, int zmax,
+    VoxelUpdateFunction update_fn, void *data)
+{
+  VoxelBufferUpdate update;
+  update.min = Resolution(std::max(xmin, 0), std::max(ymin, 0), std::max(zmin, 0));
+  update.max = Resolution(
+      std::min(xmax, res_.x - 1),
+      std::min(ymax, res_.y - 1),
+      std::min(zmax, res_.z - 1));
+
+  if (update.min.x > update.max.x ||
+      update.min.y > update.max.y ||
+      update.min.z > update.max.z) {
+    return;
+  }
+
+  update.buffer = this;
+  update.update_fn = update_fn;
+  update.data = data;
+  update.brick_min = Resolution(
+      update.min.x >> BRICK_SHIFT,
+      update.min.y >> BRICK_SHIFT,
+      update.min.z >> BRICK_SHIFT);
+  update.brick_count = Resolution(
+      (update.max.x >> BRICK_SHIFT) - update.brick_min.x + 1,
+      (update.max.y >> BRICK_SHIFT) - update.brick_min.y + 1,
+      (update.max.z >> BRICK_SHIFT) - update.brick_min.z + 1);
+
+  const Resolution &count = update.brick_count;
+  const int brick_count = count.x * count.y * count.z;
+  update.brick_max_values.resize(brick_count, 0);
+
+  run_brick_tasks(&update, VoxelBufferUpdate::update_brick_task, brick_count);
+
+  for (int i = 0; i < brick_count; i++) {
+    raise_brick_max_values(
+        update.brick_min.x + i % count.x,
+        update.brick_min.y + i / count.x % count.y,
+        update.brick_min.z + i / (count.x * count.y),
+        update.brick_max_values[i]);
+  }
+}
+
+void VoxelBuffer::AddValues(const VoxelBuffer &other)
+{
+  if (other.res_.x != res_.x || other.res_.y != res_.y || other.res_.z != res_.z) {
+    return;
+  }
+
+  VoxelBufferUpdate update;
+  update.buffer = this;
+  update.other = &other;
+
+  run_brick_tasks(&update, VoxelBufferUpdate::add_brick_task,
+      static_cast<int>(bricks_.size()));
+
+  compute_brick_max_values();
+}
+
+void VoxelBuffer::Compact()
+{
+  for (int bz = 0; bz < brick_res_.z; bz++) {
+    for (int by = 0; by < brick_res_.y; by++) {
+      for (int bx = 0; bx < brick_res_.x; bx++) {
+        const int x0 = bx << BRICK_SHIFT;
+        const int y0 = by << BRICK_SHIFT;
+        const int z0 = bz << BRICK_SHIFT;
+        const int64_t index = brick_index(x0, y0, z0);
+        std::vector<float> &brick = bricks_[index];
+        // paged bricks were compacted when written
+        if (brick.empty()) {
+          continue;
+        }
+
+        // voxels out of the resolution are not compared
+        const int x1 = std::min(x0 + BRICK_SIZE, res_.x);
+        const int y1 = std::min(y0 + BRICK_SIZE, res_.y);
+        const int z1 = std::min(z0 + BRICK_SIZE, res_.z);
+        const float first = brick[0];
+        bool is_constant = true;
+
+        for (int z = z0; z < z1 && is_constant; z++) {
+          for (int y = y0; y < y1 && is_constant; y++) {
+            for (int x = x0; x < x1; x++) {
+              if (brick[voxel_index_in_brick(x, y, z)] != first) {
+                is_constant = false;
+                break;
+              }
+            }
+          }
+        }
+
+        if (is_constant) {
+          tile_values_[index] = first;
+          std::vector<float>().swap(brick);
+        } else if (precision_ != VOXEL_PRECISION_FLOAT) {
+          pack_brick(index);
+        }
+      }
+    }
+  }
+
+  compute_brick_max_values();
+}
+
+int64_t VoxelBuffer::GetAllocatedBrickCount() const
+{
+  int64_t count = 0;
+  for (std::size_t i = 0; i < bricks_.size(); i++) {
+    if (!bricks_[i].empty() || is_packed(i)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+void VoxelBuffer::SetPrecision(int precision)
+{
+  if (precision < VOXEL_PRECISION_FLOAT || precision > VOXEL_PRECISION_FIXED8 ||
+      precision == precision_) {
+    return;
+  }
+
+  // unpacked with the old precision
+  for (std::size_t i = 0; i < packed_bricks_.size(); i++) {
+    own_brick(i);
+  }
+
+  precision_ = precision;
+  if (precision_ == VOXEL_PRECISION_FLOAT) {
+    std::vector<PackedBrick>().swap(packed_bricks_);
+    return;
+  }
+
+  packed_bricks_.resize(bricks_.size());
+  for (std::size_t i = 0; i < bricks_.size(); i++) {
+    if (!bricks_[i].empty()) {
+      pack_brick(i);
+    }
+  }
+}
+
+int VoxelBuffer::GetPrecision() const
+{
+  return precision_;
+}
+
+std::size_t VoxelBuffer::GetMemoryUsage() const
+{
+  std::size_t usage =
+      MemoryUsageOf(bricks_) +
+      MemoryUsageOf(packed_bricks_) +
+      MemoryUsageOf(tile_values_) +
+      MemoryUsageOf(brick_max_values_) +
+      MemoryUsageOf(is_paged_);
+  for (std::size_t i = 0; i < bricks_.size(); i++) {
+    usage += MemoryUsageOf(bricks_[i]);
+  }
+  for (std::size_t i = 0; i < packed_bricks_.size(); i++) {
+    usage += MemoryUsageOf(packed_bricks_[i].data);
+  }
+  if (reader_) {
+    usage += TileCacheGetGlobal().GetFileMemoryUsage(reader_->GetFileID());
+  }
+  return usage;
+}
+
+int64_t VoxelBuffer::GetBrickCount() const
+{
+  return static_cast<int64_t>(bricks_.size());
+}
+
+bool VoxelBuffer::GetBrick(int64_t index, float *voxels, float *tile_value) const
+{
+  *tile_value = tile_values_[index];
+
+  if (is_paged(index)) {
+    const TileCache::TilePtr tile = load_paged_brick(*reader_, index);
+    std::copy(tile->texels.begin(), tile->texels.end(), voxels);
+    return true;
+  }
+  if (is_packed(index)) {
+    for (int i = 0; i < BRICK_VOXEL_COUNT; i++) {
+      voxels[i] = packed_value(index, i);
+    }
+    return true;
+  }
+
+  const std::vector<float> &brick = bricks_[index];
+  if (brick.empty()) {
+    return false;
+  }
+  std::copy(brick.begin(), brick.end(), voxels);
+  return true;
+}
+
+void VoxelBuffer::SetBrickReader(const std::shared_ptr<const VoxelBrickReader> &reader)
+{
+  drop_reader();
+  if (reader == NULL) {
+    return;
+  }
+
+  reader_ = reader;
+  is_paged_.resize(bricks_.size(), 0);
+
+  for (std::size_t i = 0; i < bricks_.size(); i++) {
+    float tile_value = 0;
+    float max_value = 0;
+    std::vector<float>().swap(bricks_[i]);
+    if (!packed_bricks_.empty()) {
+      std::vector<unsigned char>().swap(packed_bricks_[i].data);
+    }
+    if (reader_->GetBrickInfo(i, &tile_value, &max_value)) {
+      is_paged_[i] = 1;
+      tile_values_[i] = 0;
+    } else {
+      tile_values_[i] = tile_value;
+    }
+  }
+
+  compute_brick_max_values();
+}
+
+float VoxelBuffer::GetBrickMaxValue(int x, int y, int z) const
+{
+  if (x < 0 || res_.x <= x)
+    return 0;
+  if (y < 0 || res_.y <= y)
+    return 0;
+  if (z < 0 || res_.z <= z)
+    return 0;
+
+  return brick_max_values_[brick_index(x, y, z)];
+}
+
+int64_t VoxelBuffer::brick_index(int x, int y, int z) const
+{
+  const int64_t bx = x >> BRICK_SHIFT;
+  const int64_t by = y >> BRICK_SHIFT;
+  const int64_t bz = z >> BRICK_SHIFT;
+  return (bz * brick_res_.y + by) * brick_res_.x + bx;
+}
+
+bool VoxelBuffer::is_paged(int64_t index) const
+{
+  return !is_paged_.empty() && is_paged_[index];
+}
+
+void VoxelBuffer::get_corner_values(const Vector &P, float *corners, float *fractions) const
+{
+  const float sx = static_cast<float>(P.x) - .5f;
+  const float sy = static_cast<float>(P.y) - .5f;
+  const float sz = static_cast<float>(P.z) - .5f;
+  const int x0 = fast_floor(sx);
+  const int y0 = fast_floor(sy);
+  const int z0 = fast_floor(sz);
+  fractions[0] = sx - x0;
+  fractions[1] = sy - y0;
+  fractions[2] = sz - z0;
+
+  // eight voxels in the same brick are read with one lookup of the brick.
+  // (7/8)^3 of samples are. the others read voxels one by one
+  if (x0 < 0 || y0 < 0 || z0 < 0 ||
+      x0 + 1 >= res_.x || y0 + 1 >= res_.y || z0 + 1 >= res_.z ||
+      (x0 & BRICK_MASK) == BRICK_MASK ||
+      (y0 & BRICK_MASK) == BRICK_MASK ||
+      (z0 & BRICK_MASK) == BRICK_MASK) {
+    for (int i = 0; i < 8; i++) {
+      corners[i] = GetValue(x0 + (i & 1), y0 + ((i >> 1) & 1), z0 + ((i >> 2) & 1));
+    }
+    return;
+  }
+
+  static const int offsets[8] = {
+      0, 1, BRICK_SIZE, BRICK_SIZE + 1,
+      BRICK_SIZE * BRICK_SIZE, BRICK_SIZE * BRICK_SIZE + 1,
+      BRICK_SIZE * BRICK_SIZE + BRICK_SIZE, BRICK_SIZE * BRICK_SIZE + BRICK_SIZE + 1};
+  const int64_t index = brick_index(x0, y0, z0);
+  const int voxel = voxel_index_in_brick(x0, y0, z0);
+  const std::vector<float> &brick = bricks_[index];
+
+  if (!brick.empty()) {
+    const float *voxels = &brick[voxel];
+    for (int i = 0; i < 8; i++) {
+      corners[i] = voxels[offsets[i]];
+    }
+  }
+  else if (is_packed(index)) {
+    for (int i = 0; i < 8; i++) {
+      corners[i] = packed_value(index, voxel + offsets[i]);
+    }
+  }
+  else if (is_paged(index)) {
+    const float *voxels = paged_voxels(index) + voxel;
+    for (int i = 0; i < 8; i++) {
+      corners[i] = voxels[offsets[i]];
+    }
+  }
+  else {
+    std::fill(corners, corners + 8, tile_values_[index]);
+  }
+}
+
+float VoxelBuffer::paged_value(int64_t index, int voxel) const
+{
+  return paged_voxels(index)[voxel];
+}
+
+// valid until the thread reads another paged brick
+const float *VoxelBuffer::paged_voxels(int64_t index) const
+{
+  LastPagedBrick &last = last_paged_brick;
+  const int64_t serial_number = reader_->GetSerialNumber();
+
+  if (last.serial_number != serial_number || last.index != index) {
+    last.tile = load_paged_brick(*reader_, index);
+    last.serial_number = serial_number;
+    last.index = index;
+  }
+  return &last.tile->texels[0];
+}
+
+// copies the paged or packed brick into memory before writing to it.
+// different threads own different bricks so is_paged_ needs no lock
+void VoxelBuffer::own_brick(int64_t index)
+{
+  if (is_packed(index)) {
+    unpack_brick(index, bricks_[index]);
+    std::vector<unsigned char>().swap(packed_bricks_[index].data);
+    return;
+  }
+  if (!is_paged(index)) {
+    return;
+  }
+  bricks_[index] = load_paged_brick(*reader_, index)->texels;
+  is_paged_[index] = 0;
+}
+
+bool VoxelBuffer::is_packed(int64_t index) const
+{
+  return !packed_bricks_.empty() && !packed_bricks_[index].data.empty();
+}
+
+float VoxelBuffer::packed_value(int64_t index, int voxel) const
+{
+  const PackedBrick &packed = packed_bricks_[index];
+  uint16_t value = 0;
+
+  switch (precision_) {
+  case VOXEL_PRECISION_HALF:
+    memcpy(&value, &packed.data[2 * voxel], sizeof(value));
+    return HalfToFloat(value);
+  case VOXEL_PRECISION_FIXED16:
+    memcpy(&value, &packed.data[2 * voxel], sizeof(value));
+    return packed.offset + packed.scale * value;
+  default:
+    return packed.offset + packed.scale * packed.data[voxel];
+  }
+}
+
+// replaces the float brick with the packed one
+void VoxelBuffer::pack_brick(int64_t index)
+{
+  std::vector<float> &brick = bricks_[index];
+  PackedBrick &packed = packed_bricks_[index];
+
+  if (precision_ == VOXEL_PRECISION_HALF) {
+    packed.data.resize(2 * BRICK_VOXEL_COUNT);
+    for (int i = 0; i < BRICK_VOXEL_COUNT; i++) {
+      const uint16_t value = FloatToHalf(brick[i]);
+      memcpy(&packed.data[2 * i], &value, sizeof(value));
+    }
+    std::vector<float>().swap(brick);
+    return;
+  }
+
+  const bool is_fixed16 = precision_ == VOXEL_PRECISION_FIXED16;
+  const int max_code = is_fixed16 ? 0xFFFF : 0xFF;
+  const float min_value = *std::min_element(brick.begin(), brick.end());
+  const float max_value = *std::max_element(brick.begin(), brick.end());
+  const float inv_scale = max_value > min_value ? max_code / (max_value - min_value) : 0;
+
+  packed.offset = min_value;
+  packed.scale = (max_value - min_value) / max_code;
+  packed.data.resize((is_fixed16 ? 2 : 1) * BRICK_VOXEL_COUNT);
+
+  for (int i = 0; i < BRICK_VOXEL_COUNT; i++) {
+    const int code = std::min(std::max(
+        static_cast<int>((brick[i] - min_value) * inv_scale + .5f), 0), max_code);
+    if (is_fixed16) {
+      const uint16_t value = static_cast<uint16_t>(code);
+      memcpy(&packed.data[2 * i], &value, sizeof(value));
+    } else {
+      packed.data[i] = static_cast<unsigned char>(code);
+    }
+  }
+  std::vector<float>().swap(brick);
+}
+
+void VoxelBuffer::unpack_brick(int64_t index, std::vector<float> &voxels) const
+{
+  voxels.resize(BRICK_VOXEL_COUNT);
+  for (int i = 0; i < BRICK_VOXEL_COUNT; i++) {
+    voxels[i] = packed_value(index, i);
+  }
+}
+
+void VoxelBuffer::drop_reader()
+{
+  reader_.reset();
+  std::vector<char>().swap(is_paged_);
+}
+
+// raises the max of the brick and the 26 bricks around it
+void VoxelBuffer::raise_brick_max_values(int bx, int by, int bz, float value)
+{
+  if (value == 0) {
+    return;
+  }
+
+  for (int z = std::max(bz - 1, 0); z <= std::min(bz + 1, brick_res_.z - 1); z++) {
+    for (int y = std::max(by - 1, 0); y <= std::min(by + 1, brick_res_.y - 1); y++) {
+      for (int x = std::max(bx - 1, 0); x <= std::min(bx + 1, brick_res_.x - 1); x++) {
+        const int64_t index = (static_cast<int64_t>(z) * brick_res_.y + y) * brick_res_.x + x;
+        brick_max_values_[index] = std::max(brick_max_values_[index], value);
+      }
+    }
+  }
+}
+
+// the max of each brick and the 26 bricks around it. larger than the max
+// the brick and the voxels next to it but cheap to compute
+void VoxelBuffer::compute_brick_max_values()
+{
+  std::vector<float> own_max_values(bricks_.size(), 0);
+  std::vector<float> unpacked;
+
+  for (std::size_t i = 0; i < bricks_.size(); i++) {
+    const std::vector<float> *brick = &bricks_[i];
+    if (is_packed(i)) {
+      unpack_brick(i, unpacked);
+      brick = &unpacked;
+    }
+    if (is_paged(i)) {
+      float tile_value = 0;
+      reader_->GetBrickInfo(i, &tile_value, &own_max_values[i]);
+      continue;
+    }
+    if (brick->empty()) {
+      own_max_values[i] = std::abs(tile_values_[i]);
+      continue;
+    }
+    // voxels out of the resolution are the value the brick was made with
+    // so they are counted as well
+    float max_value = 0;
+    for (int j = 0; j < BRICK_VOXEL_COUNT; j++) {
+      max_value = std::max(max_value, std::abs((*brick)[j]));
+    }
+    own_max_values[i] = max_value;
+  }
+
+  dilate_brick_max_values(own_max_values);
+}
+
+void VoxelBuffer::dilate_brick_max_values(const std::vector<float> &own_max_values)
+{
+  for (int bz = 0; bz < brick_res_.z; bz++) {
+    for (int by = 0; by < brick_res_.y; by++) {
+      for (int bx = 0; bx < brick_res_.x; bx++) {
+        float max_value = 0;
+        for (int z = std::max(bz - 1, 0); z <= std::min(bz + 1, brick_res_.z - 1); z++) {
+          for (int y = std::max(by - 1, 0); y <= std::min(by + 1, brick_res_.y - 1); y++) {
+            for (int x = std::max(bx - 1, 0); x <= std::min(bx + 1, brick_res_.x - 1); x++) {
+              const int64_t index = (static_cast<int64_t>(z) * brick_res_.y + y) * brick_res_.x + x;
+              max_value = std::max(max_value, own_max_values[index]);
+            }
+          }
+        }
+        const int64_t index = (static_cast<int64_t>(bz) * brick_res_.y + by) * brick_res_.x + bx;
+        brick_max_values_[index] = max_value;
+      }
+    }
+  }
 }
 
-static float trilinear_buffer_value(const VoxelBuffer &buffer, const Vector &P);
 static float nearest_buffer_value(const VoxelBuffer &buffer, const Vector &P);
+static float downsample_voxel(void *data, int x, int y, int z, float value);
 
 Volume::Volume() :
   buffer_(),
+  levels_(),
   bounds_(),
   size_()
 {
@@ -78,6 +927,7 @@ void Volume::Resize(int xres, int yres, int zres)
   }
 
   buffer_.Resize(xres, yres, zres);
+  levels_.clear();
   compute_filter_size();
 }
 
@@ -137,6 +987,7 @@ void Volume::SetValue(int x, int y, int z, float value)
     return;
   }
   buffer_.SetValue(x, y, z, value);
+  levels_.clear();
 }
 
 float Volume::GetValue(int x, int y, int z) const
@@ -144,6 +995,61 @@ float Volume::GetValue(int x, int y, int z) const
   return buffer_.GetValue(x, y, z);
 }
 
+void Volume::Fill(float value)
+{
+  buffer_.Fill(value);
+  levels_.clear();
+}
+
+void Volume::UpdateValues(int xmin, int ymin, int zmin, int xmax, int ymax, int zmax,
+    VoxelUpdateFunction update_fn, void *data)
+{
+  buffer_.UpdateValues(xmin, ymin, zmin, xmax, ymax, zmax, update_fn, data);
+  levels_.clear();
+}
+
+void Volume::AddValues(const Volume &other)
+{
+  buffer_.AddValues(other.buffer_);
+  levels_.clear();
+}
+
+void Volume::Compact()
+{
+  buffer_.Compact();
+}
+
+void Volume::SetPrecision(int precision)
+{
+  buffer_.SetPrecision(precision);
+  levels_.clear();
+}
+
+const VoxelBuffer &Volume::GetVoxelBuffer() const
+{
+  return buffer_;
+}
+
+std::size_t Volume::GetMemoryUsage() const
+{
+  std::size_t usage = buffer_.GetMemoryUsage();
+  for (std::size_t i = 0; i < levels_.size(); i++) {
+    usage += levels_[i].GetMemoryUsage();
+  }
+  return usage;
+}
+
+void Volume::SetBrickReader(int xres, int yres, int zres,
+    const std::shared_ptr<const VoxelBrickReader> &reader)
+{
+  Resize(xres, yres, zres);
+  if (buffer_.IsEmpty()) {
+    return;
+  }
+  buffer_.SetBrickReader(reader);
+  levels_.clear();
+}
+
 bool Volume::GetSample(const Vector &point, VolumeSample *sample) const
 {
   if (buffer_.IsEmpty()) {
@@ -162,7 +1068,7 @@ bool Volume::GetSample(const Vector &point, VolumeSample *sample) const
       (point.z - bounds_.min.z) / size_.z * res.z);
 
   if (1) {
-    sample->density = trilinear_buffer_value(buffer_, P);
+    sample->density = buffer_.GetTrilinearValue(P);
   } else {
     sample->density = nearest_buffer_value(buffer_, P);
   }
@@ -170,6 +1076,163 @@ bool Volume::GetSample(const Vector &point, VolumeSample *sample) const
   return true;
 }
 
+bool Volume::GetFilteredSample(const Vector &point, Real filter_width,
+    VolumeSample *sample) const
+{
+  if (levels_.empty() || filter_width < 2 * filtersize_) {
+    return GetSample(point, sample);
+  }
+
+  const bool hit = bounds_.ContainsPoint(point);
+  if (!hit) {
+    return false;
+  }
+
+  const VoxelBuffer &buffer = filtered_buffer(filter_width);
+  const Resolution &res = buffer.GetResolution();
+  const Vector P(
+      (point.x - bounds_.min.x) / size_.x * res.x,
+      (point.y - bounds_.min.y) / size_.y * res.y,
+      (point.z - bounds_.min.z) / size_.z * res.z);
+
+  sample->density = buffer.GetTrilinearValue(P);
+
+  return true;
+}
+
+void Volume::GetFilteredSamples(const Vector *points, int count, Real filter_width,
+    VolumeSample *samples) const
+{
+  const VoxelBuffer &buffer = filtered_buffer(filter_width);
+  if (buffer.IsEmpty()) {
+    for (int i = 0; i < count; i++) {
+      samples[i].density = 0;
+    }
+    return;
+  }
+
+  const Resolution &res = buffer.GetResolution();
+  // no voxels are around it
+  const Vector OUTSIDE(-2, -2, -2);
+
+  for (int i = 0; i < count; i += 4) {
+    const int lane_count = Min(count - i, 4);
+    Vector P[4];
+    float values[4];
+
+    for (int j = 0; j < lane_count; j++) {
+      const Vector &point = points[i + j];
+      if (!bounds_.ContainsPoint(point)) {
+        P[j] = OUTSIDE;
+        continue;
+      }
+      P[j] = Vector(
+          (point.x - bounds_.min.x) / size_.x * res.x,
+          (point.y - bounds_.min.y) / size_.y * res.y,
+          (point.z - bounds_.min.z) / size_.z * res.z);
+    }
+
+    if (lane_count == 4) {
+      buffer.GetTrilinearValues4(P, values);
+    } else {
+      for (int j = 0; j < lane_count; j++) {
+        values[j] = buffer.GetTrilinearValue(P[j]);
+      }
+    }
+    for (int j = 0; j < lane_count; j++) {
+      samples[i + j].density = values[j];
+    }
+  }
+}
+
+void Volume::BuildLevels()
+{
+  if (!levels_.empty() || buffer_.IsEmpty()) {
+    return;
+  }
+
+  // keeps the finer level in place while adding the next
+  levels_.reserve(MAX_VOLUME_LEVEL_COUNT);
+  const VoxelBuffer *fine = &buffer_;
+  for (int i = 0; i < MAX_VOLUME_LEVEL_COUNT; i++) {
+    const Resolution &res = fine->GetResolution();
+    if (res.x < 2 && res.y < 2 && res.z < 2) {
+      break;
+    }
+
+    levels_.push_back(VoxelBuffer());
+    VoxelBuffer &coarse = levels_.back();
+    coarse.SetPrecision(buffer_.GetPrecision());
+    coarse.Resize((res.x + 1) / 2, (res.y + 1) / 2, (res.z + 1) / 2);
+
+    const Resolution &coarse_res = coarse.GetResolution();
+    coarse.UpdateValues(0, 0, 0, coarse_res.x - 1, coarse_res.y - 1, coarse_res.z - 1,
+        downsample_voxel, const_cast<VoxelBuffer *>(fine));
+    coarse.Compact();
+
+    fine = &levels_.back();
+  }
+}
+
+int Volume::GetLevelCount() const
+{
+  return static_cast<int>(levels_.size());
+}
+
+float Volume::GetMaxDensity(const Vector &point, const Vector &dir, Real *t_exit) const
+{
+  *t_exit = 0;
+
+  if (buffer_.IsEmpty()) {
+    return 0;
+  }
+
+  const bool hit = bounds_.ContainsPoint(point);
+  if (!hit) {
+    return 0;
+  }
+
+  const Resolution &res = buffer_.GetResolution();
+  const Vector P(
+      (point.x - bounds_.min.x) / size_.x * res.x,
+      (point.y - bounds_.min.y) / size_.y * res.y,
+      (point.z - bounds_.min.z) / size_.z * res.z);
+  const Vector D(
+      dir.x / size_.x * res.x,
+      dir.y / size_.y * res.y,
+      dir.z / size_.z * res.z);
+
+  const int x = std::min((int) P.x, res.x - 1);
+  const int y = std::min((int) P.y, res.y - 1);
+  const int z = std::min((int) P.z, res.z - 1);
+  const int voxel[3] = {x, y, z};
+
+  Real t_min = std::numeric_limits<Real>::max();
+  for (int i = 0; i < 3; i++) {
+    if (D[i] == 0) {
+      continue;
+    }
+    const int brick_min = (voxel[i] >> BRICK_SHIFT) << BRICK_SHIFT;
+    const Real plane = D[i] > 0 ? brick_min + BRICK_SIZE : brick_min;
+    t_min = std::min(t_min, Real((plane - P[i]) / D[i]));
+  }
+  *t_exit = std::max(t_min, Real(0));
+
+  return buffer_.GetBrickMaxValue(x, y, z);
+}
+
+const VoxelBuffer &Volume::filtered_buffer(Real filter_width) const
+{
+  if (levels_.empty() || filter_width < 2 * filtersize_) {
+    return buffer_;
+  }
+
+  // voxels of level i are 2^(i+1) times larger
+  const int level = Min(static_cast<int>(std::log2(filter_width / filtersize_)),
+      static_cast<int>(levels_.size())) - 1;
+  return levels_[level];
+}
+
 void Volume::compute_filter_size()
 {
   if (buffer_.IsEmpty()) {
@@ -205,49 +1268,33 @@ void VolGetIndexRange(const Volume *volume,
   volume->PointToIndex(P_max, xmax, ymax, zmax);
 }
 
-static float trilinear_buffer_value(const VoxelBuffer &buffer, const Vector &P)
+static float nearest_buffer_value(const VoxelBuffer &buffer, const Vector &P)
 {
-  const Vector P_sample(
-      P.x - .5,
-      P.y - .5,
-      P.z - .5);
-
-  const int lowest_corner[3] = {
-      (int) P_sample[0],
-      (int) P_sample[1],
-      (int) P_sample[2]};
-
-  int x, y, z;
-  float weight[3];
-  float value = 0;
-
-  for (int i = 0; i < 2; i++) {
-    x = lowest_corner[0] + i;
-    weight[0] = 1 - fabs(P_sample[0] - x);
+  const int x = (int) P.x;
+  const int y = (int) P.y;
+  const int z = (int) P.z;
 
-    for (int j = 0; j < 2; j++) {
-      y = lowest_corner[1] + j;
-      weight[1] = 1 - fabs(P_sample[1] - y);
+  return buffer.GetValue(x, y, z);
+}
 
-      for (int k = 0; k < 2; k++) {
-        z = lowest_corner[2] + k;
-        weight[2] = 1 - fabs(P_sample[2] - z);
+// average of the voxels of the finer buffer in data the voxel covers
+static float downsample_voxel(void *data, int x, int y, int z, float value)
+{
+  const VoxelBuffer *fine = static_cast<const VoxelBuffer *>(data);
+  const Resolution &res = fine->GetResolution();
+  float sum = 0;
+  int count = 0;
 
-        value += weight[0] * weight[1] * weight[2] * buffer.GetValue(x, y, z);
+  for (int k = 2 * z; k < Min(2 * z + 2, res.z); k++) {
+    for (int j = 2 * y; j < Min(2 * y + 2, res.y); j++) {
+      for (int i = 2 * x; i < Min(2 * x + 2, res.x); i++) {
+        sum += fine->GetValue(i, j, k);
+        count++;
       }
     }
   }
 
-  return value;
-}
-
-static float nearest_buffer_value(const VoxelBuffer &buffer, const Vector &P)
-{
-  const int x = (int) P.x;
-  const int y = (int) P.y;
-  const int z = (int) P.z;
-
-  return buffer.GetValue(x, y, z);
+  return count > 0 ? sum / count : 0;
 }
 
 } // namespace xxx
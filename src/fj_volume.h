@@ -8,6 +8,7 @@
 #include "fj_vector.h"
 #include "fj_types.h"
 #include "fj_box.h"
+#include <memory>
 #include <vector>
 
 namespace fj {
@@ -21,21 +22,140 @@ public:
   int x, y, z;
 };
 
+// returns the new value of the voxel from the current value
+typedef float (*VoxelUpdateFunction)(void *data, int x, int y, int z, float value);
+
+// voxels of a brick in each axis
+const int VOXEL_BRICK_SIZE = 8;
+
+// how bricks of voxels are stored after compacting
+enum VoxelPrecision {
+  VOXEL_PRECISION_FLOAT = 0,
+  VOXEL_PRECISION_HALF,
+  // fixed point between the min and max of each brick
+  VOXEL_PRECISION_FIXED16,
+  VOXEL_PRECISION_FIXED8
+};
+
+// Reads bricks of a volume file on first access. bricks read are kept in
+// the texture tile cache so they share its memory budget.
+class FJ_API VoxelBrickReader {
+public:
+  VoxelBrickReader();
+  virtual ~VoxelBrickReader();
+
+  // unique to each reader to tell bricks of a file loaded again
+  int64_t GetSerialNumber() const;
+  // the tile cache id of the file
+  virtual int GetFileID() const = 0;
+  // returns false if all voxels of the brick are tile_value. max_value is
+  // the max absolute value of the brick
+  virtual bool GetBrickInfo(int64_t index, float *tile_value, float *max_value) const = 0;
+  // reads VOXEL_BRICK_SIZE^3 voxels, x first. called from multiple threads
+  virtual int ReadBrick(int64_t index, float *voxels) const = 0;
+
+private:
+  int64_t serial_number_;
+};
+
+// Voxels are stored in bricks of 8x8x8. A brick is allocated when one of
+// its voxels is set to a value other than the value of the whole brick, so
+// empty space costs one float per brick. Reading is thread safe while
+// setting is not. bulk writes divide bricks between threads themselves.
 class FJ_API VoxelBuffer {
 public:
   VoxelBuffer();
   ~VoxelBuffer();
 
+  // all voxels are 0
   void Resize(int xres, int yres, int zres);
   const Resolution &GetResolution() const;
   bool IsEmpty() const;
 
   void SetValue(int x, int y, int z, float value);
   float GetValue(int x, int y, int z) const;
+  // trilinear interpolation at P in voxels where the center of voxel i is
+  // at i + .5. voxels out of the resolution are 0
+  float GetTrilinearValue(const Vector &P) const;
+  // GetTrilinearValue of 4 points at a time with SSE2
+  void GetTrilinearValues4(const Vector *P, float *values) const;
+
+  // sets all voxels without allocating bricks
+  void Fill(float value);
+  // updates voxels in the index range including max. bricks are updated
+  // in parallel so update_fn is called from multiple threads
+  void UpdateValues(int xmin, int ymin, int zmin, int xmax, int ymax, int zmax,
+      VoxelUpdateFunction update_fn, void *data);
+  // adds voxels of the buffer of the same resolution
+  void AddValues(const VoxelBuffer &other);
+  // frees bricks whose voxels are all the same value and packs the others
+  // in the precision
+  void Compact();
+  int64_t GetAllocatedBrickCount() const;
+  // packed bricks are unpacked to float on the first write and packed
+  // again by Compact(). changing it packs bricks in the new one
+  void SetPrecision(int precision);
+  int GetPrecision() const;
+  // bytes of bricks and tiles including bricks of the reader in the
+  // tile cache
+  std::size_t GetMemoryUsage() const;
+
+  // bricks are ordered x first
+  int64_t GetBrickCount() const;
+  // returns false without voxels if all voxels of the brick are tile_value
+  bool GetBrick(int64_t index, float *voxels, float *tile_value) const;
+  // bricks of the reader are read on first access and copied on the first
+  // write. call after Resize() with the resolution of the file
+  void SetBrickReader(const std::shared_ptr<const VoxelBrickReader> &reader);
+
+  // the max absolute value of the brick of the voxel and voxels next to it
+  // which filters read. it can be larger than the actual max after values
+  // are lowered until Compact() is called
+  float GetBrickMaxValue(int x, int y, int z) const;
 
 private:
-  std::vector<float> data_;
+  friend class VoxelBufferUpdate;
+
+  int64_t brick_index(int x, int y, int z) const;
+  bool is_paged(int64_t index) const;
+  // 8 voxels around P x first and the position of P between them
+  void get_corner_values(const Vector &P, float *corners, float *fractions) const;
+  float paged_value(int64_t index, int voxel) const;
+  const float *paged_voxels(int64_t index) const;
+  void own_brick(int64_t index);
+  bool is_packed(int64_t index) const;
+  float packed_value(int64_t index, int voxel) const;
+  void pack_brick(int64_t index);
+  void unpack_brick(int64_t index, std::vector<float> &voxels) const;
+  void drop_reader();
+  void compute_brick_max_values();
+  void dilate_brick_max_values(const std::vector<float> &own_max_values);
+  void raise_brick_max_values(int bx, int by, int bz, float value);
+
+  class PackedBrick {
+  public:
+    PackedBrick() : data(), offset(0), scale(0) {}
+    ~PackedBrick() {}
+
+    // one or two bytes of each voxel by the precision
+    std::vector<unsigned char> data;
+    // value of fixed point voxels is offset + scale * voxel
+    float offset;
+    float scale;
+  };
+
+  // empty for the bricks of tile_values_
+  std::vector<std::vector<float>> bricks_;
+  // empty with float precision. each is empty unless packed
+  std::vector<PackedBrick> packed_bricks_;
+  int precision_;
+  std::vector<float> tile_values_;
+  std::vector<float> brick_max_values_;
+  // bricks to be read from reader_. empty without reader
+  std::shared_ptr<const VoxelBrickReader> reader_;
+  std::vector<char> is_paged_;
   Resolution res_;
+  Resolution brick_res_;
 };
 
 class FJ_API VolumeSample {
@@ -64,13 +184,49 @@ public:
 
   void SetValue(int x, int y, int z, float value);
   float GetValue(int x, int y, int z) const;
+  void Fill(float value);
+  // bulk writes. see VoxelBuffer
+  void UpdateValues(int xmin, int ymin, int zmin, int xmax, int ymax, int zmax,
+      VoxelUpdateFunction update_fn, void *data);
+  void AddValues(const Volume &other);
+  // frees memory of space of the same density. call after setting values
+  void Compact();
+  // see VoxelPrecision. voxels are packed when compacted
+  void SetPrecision(int precision);
+
+  const VoxelBuffer &GetVoxelBuffer() const;
+  std::size_t GetMemoryUsage() const;
+  // see VoxelBuffer. resolution is the one of the file
+  void SetBrickReader(int xres, int yres, int zres,
+      const std::shared_ptr<const VoxelBrickReader> &reader);
 
   bool GetSample(const Vector &point, VolumeSample *sample) const;
+  // the sample of the coarsest level whose voxels fit in filter_width.
+  // the same as GetSample() if filter_width is 0 or levels are not built
+  bool GetFilteredSample(const Vector &point, Real filter_width,
+      VolumeSample *sample) const;
+  // GetFilteredSample of points at a time. density is 0 out of bounds
+  void GetFilteredSamples(const Vector *points, int count, Real filter_width,
+      VolumeSample *samples) const;
+
+  // builds coarser levels of voxels each of half the resolution of the
+  // previous one for filtered samples. levels are kept until voxels are
+  // changed. bricks of volumes read from files are all read once for it
+  void BuildLevels();
+  // coarser levels built excluding the voxels of the full resolution
+  int GetLevelCount() const;
+  // the max density around point for raymarching to skip empty space.
+  // t_exit is the distance in dir to leave the block of voxels the max
+  // density is for. dir doesn't have to be normalized
+  float GetMaxDensity(const Vector &point, const Vector &dir, Real *t_exit) const;
 
 public:
   void compute_filter_size();
+  // the level for the filter width or the voxels of the full resolution
+  const VoxelBuffer &filtered_buffer(Real filter_width) const;
 
   VoxelBuffer buffer_;
+  std::vector<VoxelBuffer> levels_;
   Box bounds_;
   Vector size_;
 
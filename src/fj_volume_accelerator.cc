@@ -4,13 +4,14 @@
 #include "fj_volume_accelerator.h"
 #include "fj_intersection.h"
 #include "fj_interval.h"
+#include "fj_ray_stats.h"
 #include "fj_volume.h"
 #include "fj_ray.h"
 
+#include <algorithm>
 #include <vector>
 #include <cassert>
 #include <cstdio>
-#include <cstdlib>
 
 #define EXPAND .0001
 #define HALF_EXPAND (.5*EXPAND)
@@ -59,9 +60,6 @@ bool VolumeAccelerator::Intersect(const Ray &ray, double time,
 /* VolumeAccelerator */
 static int ray_volume_intersect(const VolumeAccelerator *acc, int volume_id,
   double time, const Ray *ray, IntervalList *intervals);
-#if 0
-static void swap_isect_ptr(IntervalList **isect0, IntervalList **isect1);
-#endif
 
 /* -------------------------------------------------------------------------- */
 /* VolumeBruteForceAccelerator */
@@ -83,15 +81,7 @@ static int intersect_bruteforce_accel(const VolumeAccelerator *acc, double time,
 
 /* -------------------------------------------------------------------------- */
 /* VolumeBVHAccelerator */
-#if 0
-enum { BVH_STACKSIZE = 64 };
-enum {
-  HIT_NONE = 0,
-  HIT_LEFT = 1,
-  HIT_RIGHT = 2,
-  HIT_BOTH = 3
-};
-#endif
+static const int MAX_STACK_DEPTH = 64;
 
 class VolumePrimitive {
 public:
@@ -103,43 +93,30 @@ public:
   int index;
 };
 
+// nodes are stored in depth-first order. the left child is next to its
+// parent and offset is the index of the right child
 class VolumeBVHNode {
 public:
-  VolumeBVHNode() : left(NULL), right(NULL), bounds(), volume_id(-1) {}
+  VolumeBVHNode() : bounds(), offset(0), volume_id(-1) {}
   ~VolumeBVHNode() {}
 
   bool is_leaf() const
   {
-    return (
-      left == NULL &&
-      right == NULL &&
-      volume_id != -1);
+    return volume_id != -1;
   }
 
-  VolumeBVHNode *left;
-  VolumeBVHNode *right;
   Box bounds;
+  int offset;
   int volume_id;
 };
 
-#if 0
-class VolumeBVHNodeStack {
-public:
-  VolumeBVHNodeStack() {}
-  ~VolumeBVHNodeStack() {}
-
-  int depth;
-  const VolumeBVHNode *node[BVH_STACKSIZE];
-};
-#endif
-
 class VolumeBVHAccelerator {
 public:
   VolumeBVHAccelerator();
   ~VolumeBVHAccelerator();
 
 public:
-  VolumeBVHNode *root_;
+  std::vector<VolumeBVHNode> nodes_;
 };
 
 static VolumeBVHAccelerator *new_bvh_accel(void);
@@ -148,38 +125,16 @@ static int build_bvh_accel(VolumeAccelerator *acc);
 static int intersect_bvh_accel(const VolumeAccelerator *acc, double time,
     const Ray *ray, IntervalList *intervals);
 
-static int intersect_bvh_recursive(const VolumeAccelerator *acc,
-    const VolumeBVHNode *node, double time,
-    const Ray *ray, IntervalList *intervals);
-#if 0
-static int intersect_bvh_loop(const VolumeAccelerator *acc, const VolumeBVHNode *root,
-    const Ray *ray, IntervalList *intervals);
-#endif
-
-static VolumeBVHNode *new_bvhnode(void);
-static void free_bvhnode_recursive(VolumeBVHNode *node);
-static VolumeBVHNode *build_bvh(VolumePrimitive **volumes, int begin, int end, int axis);
-static int is_bvh_leaf(const VolumeBVHNode *node);
+static int build_bvh(std::vector<VolumeBVHNode> &nodes,
+    VolumePrimitive **volume_ptr, int begin, int end, int axis, int depth);
 static int find_median(VolumePrimitive **volumes, int begin, int end, int axis);
 
-static int compare_double(double x, double y);
-static int volume_compare_x(const void *a, const void *b);
-static int volume_compare_y(const void *a, const void *b);
-static int volume_compare_z(const void *a, const void *b);
-
-#if 0
-static int is_empty(const VolumeBVHNodeStack *stack);
-static void push_node(VolumeBVHNodeStack *stack, const VolumeBVHNode *node);
-static const VolumeBVHNode *pop_node(VolumeBVHNodeStack *stack);
-#endif
-
-VolumeBVHAccelerator::VolumeBVHAccelerator() : root_(NULL)
+VolumeBVHAccelerator::VolumeBVHAccelerator() : nodes_()
 {
 }
 
 VolumeBVHAccelerator::~VolumeBVHAccelerator()
 {
-  free_bvhnode_recursive(root_);
 }
 
 VolumeAccelerator *VolumeAccNew(int accelerator_type)
@@ -258,8 +213,11 @@ int VolumeAccBuild(VolumeAccelerator *acc)
 int VolumeAccIntersect(const VolumeAccelerator *acc, double time,
     const Ray *ray, IntervalList *intervals)
 {
-  double boxhit_tmin;
-  double boxhit_tmax;
+  Real boxhit_tmin;
+  Real boxhit_tmax;
+  int hit;
+
+  FJ_RAY_STATS_ADD(volume_query_count, 1);
 
   /* check intersection with overall bounds */
   if (!BoxRayIntersect(acc->bounds_, ray->orig, ray->dir, ray->tmin, ray->tmax,
@@ -274,7 +232,10 @@ int VolumeAccIntersect(const VolumeAccelerator *acc, double time,
     fflush(stdout);
   }
 
-  return acc->Intersect_(acc, time, ray, intervals);
+  hit = acc->Intersect_(acc, time, ray, intervals);
+  FJ_RAY_STATS_ADD(volume_hit_count, hit != 0);
+
+  return hit;
 }
 
 void VolumeAccSetTargetGeometry(VolumeAccelerator *acc,
@@ -366,8 +327,12 @@ static int build_bvh_accel(VolumeAccelerator *acc)
     volume_ptr[i] = &volumes[i];
   }
 
-  bvh->root_ = build_bvh(&volume_ptr[0], 0, NPRIMS, 0);
-  if (bvh->root_ == NULL) {
+  // a binary tree of n leaves has 2n - 1 nodes
+  bvh->nodes_.clear();
+  bvh->nodes_.reserve(2 * NPRIMS - 1);
+
+  if (build_bvh(bvh->nodes_, &volume_ptr[0], 0, NPRIMS, 0, 0) == -1) {
+    bvh->nodes_.clear();
     return -1;
   }
 
@@ -378,207 +343,117 @@ static int intersect_bvh_accel(const VolumeAccelerator *acc, double time,
     const Ray *ray, IntervalList *intervals)
 {
   const VolumeBVHAccelerator *bvh = (const VolumeBVHAccelerator *) acc->derived_;
+  const std::vector<VolumeBVHNode> &nodes = bvh->nodes_;
 
-#if 0
-  if (1)
-    return intersect_bvh_loop(acc, bvh->root_, ray, intervals);
-  else
-#endif
-    return intersect_bvh_recursive(acc, bvh->root_, time, ray, intervals);
-}
-
-static int intersect_bvh_recursive(const VolumeAccelerator *acc,
-    const VolumeBVHNode *node, double time,
-    const Ray *ray, IntervalList *intervals)
-{
-  double boxhit_tmin;
-  double boxhit_tmax;
-  int hit_left, hit_right;
-  int hit;
-
-  hit = BoxRayIntersect(node->bounds,
-      ray->orig, ray->dir, ray->tmin, ray->tmax,
-      &boxhit_tmin, &boxhit_tmax);
-  if (!hit) {
+  if (nodes.empty()) {
     return 0;
   }
 
-  if (is_bvh_leaf(node)) {
-    return ray_volume_intersect(acc, node->volume_id, time, ray, intervals);
-  }
-
-  hit_left  = intersect_bvh_recursive(acc, node->left,  time, ray, intervals);
-  hit_right = intersect_bvh_recursive(acc, node->right, time, ray, intervals);
-
-  return hit_left || hit_right;
-}
-
-#if 0
-static int intersect_bvh_loop(const VolumeAccelerator *acc, const VolumeBVHNode *root,
-    const Ray *ray, IntervalList *intervals)
-{
-  int hit, hittmp;
-  int whichhit;
-  int hit_left, hit_right;
-  double boxhit_tmin, boxhit_tmax;
-  IntervalList isect_candidates[2];
-  IntervalList *isect_min, *isect_tmp;
-
-  const VolumeBVHNode *node;
-  VolumeBVHNodeStack stack = {0, {NULL}};
-
-  node = root;
-  hit = 0;
-
-  isect_min = &isect_candidates[0];
-  isect_tmp = &isect_candidates[1];
-  isect_min->t_hit = FLT_MAX;
+  const TraversalRay traversal_ray(*ray);
+  int stack[MAX_STACK_DEPTH];
+  int stack_size = 0;
+  int node_id = 0;
+  int hit = 0;
 
+  // every volume along the ray is needed so children are visited in any order
   for (;;) {
-    if (is_bvh_leaf(node)) {
-      hittmp = ray_volume_intersect(acc, node->volume_id, ray, isect_tmp);
-      if (hittmp && isect_tmp->t_hit < isect_min->t_hit) {
-        swap_isect_ptr(&isect_min, &isect_tmp);
-        hit = hittmp;
-      }
-
-      if (is_empty(&stack))
-        goto loop_exit;
-      node = pop_node(&stack);
-      continue;
-    }
+    const VolumeBVHNode &node = nodes[node_id];
+    Real boxhit_tmin;
+    Real boxhit_tmax;
 
-    hit_left = BoxRayIntersect(node->left->bounds_,
-        ray->orig, ray->dir, ray->tmin, ray->tmax,
-        &boxhit_tmin, &boxhit_tmax);
+    FJ_RAY_STATS_ADD(volume_node_visit_count, 1);
 
-    hit_right = BoxRayIntersect(node->right->bounds_,
-        ray->orig, ray->dir, ray->tmin, ray->tmax,
+    const bool hit_node = RayBoxIntersect(traversal_ray,
+        node.bounds.min, node.bounds.max, ray->tmin, ray->tmax,
         &boxhit_tmin, &boxhit_tmax);
 
-    whichhit = HIT_NONE;
-    whichhit |= hit_left  ? HIT_LEFT :  HIT_NONE;
-    whichhit |= hit_right ? HIT_RIGHT : HIT_NONE;
-
-    switch (whichhit) {
-    case HIT_NONE:
-      if (is_empty(&stack))
-        goto loop_exit;
-      node = pop_node(&stack);
-      break;
-
-    case HIT_LEFT:
-      node = node->left;
-      break;
-
-    case HIT_RIGHT:
-      node = node->right;
-      break;
-
-    case HIT_BOTH:
-      push_node(&stack, node->right);
-      node = node->left;
-      break;
-
-    default:
-      assert(!"invalid whichhit");
-      break;
+    if (hit_node && !node.is_leaf()) {
+      stack[stack_size++] = node.offset;
+      node_id = node_id + 1;
+      assert(stack_size < MAX_STACK_DEPTH);
+      continue;
+    }
+    if (hit_node) {
+      hit |= ray_volume_intersect(acc, node.volume_id, time, ray, intervals);
     }
-  }
-loop_exit:
 
-  if (hit) {
-    *intervals = *isect_min;
+    if (stack_size == 0)
+      break;
+    node_id = stack[--stack_size];
   }
 
   return hit;
 }
-#endif
 
-static VolumeBVHNode *build_bvh(VolumePrimitive **volume_ptr, int begin, int end, int axis)
+// Compares an axis component of volume centroid for std::sort.
+template<int Axis>
+class VolumeCentroidLess {
+public:
+  bool operator()(const VolumePrimitive *a, const VolumePrimitive *b) const
+  {
+    return a->centroid[Axis] < b->centroid[Axis];
+  }
+};
+
+// Builds the subtree of volumes [begin, end) in depth-first order and
+// returns the index of its root node or -1 if the tree is too deep.
+static int build_bvh(std::vector<VolumeBVHNode> &nodes,
+    VolumePrimitive **volume_ptr, int begin, int end, int axis, int depth)
 {
-  VolumeBVHNode *node = NULL;
   const int NPRIMS = end - begin;
-  int median;
-  int new_axis;
-  int (*volume_compare)(const void *, const void *);
+  const int node_id = static_cast<int>(nodes.size());
 
-  node = new_bvhnode();
-  if (node == NULL)
-    return NULL;
+  if (depth >= MAX_STACK_DEPTH - 1) {
+    return -1;
+  }
+
+  nodes.push_back(VolumeBVHNode());
 
   if (NPRIMS == 1) {
-    node->volume_id = volume_ptr[begin]->index;
-    node->bounds = volume_ptr[begin]->bounds;
-    return node;
+    nodes[node_id].volume_id = volume_ptr[begin]->index;
+    nodes[node_id].bounds = volume_ptr[begin]->bounds;
+    return node_id;
   }
 
+  VolumePrimitive **prim_begin = volume_ptr + begin;
+  VolumePrimitive **prim_end   = volume_ptr + end;
+
   switch (axis) {
     case 0:
-      volume_compare = volume_compare_x;
-      new_axis = 1;
+      std::sort(prim_begin, prim_end, VolumeCentroidLess<0>());
       break;
     case 1:
-      volume_compare = volume_compare_y;
-      new_axis = 2;
+      std::sort(prim_begin, prim_end, VolumeCentroidLess<1>());
       break;
     case 2:
-      volume_compare = volume_compare_z;
-      new_axis = 0;
+      std::sort(prim_begin, prim_end, VolumeCentroidLess<2>());
       break;
     default:
       assert(!"invalid axis");
       break;
   }
 
-  qsort(volume_ptr + begin, NPRIMS, sizeof(VolumePrimitive *), volume_compare);
-  median = find_median(volume_ptr, begin, end, axis);
-
-  node->left  = build_bvh(volume_ptr, begin, median, new_axis);
-  if (node->left == NULL)
-    return NULL;
-
-  node->right = build_bvh(volume_ptr, median, end, new_axis);
-  if (node->right == NULL)
-    return NULL;
-
-  node->bounds = node->left->bounds;
-  node->bounds.AddBox(node->right->bounds);
-
-  return node;
-}
-
-static VolumeBVHNode *new_bvhnode(void)
-{
-  VolumeBVHNode *node = new VolumeBVHNode();
-  if (node == NULL)
-    return NULL;
-
-  node->left = NULL;
-  node->right = NULL;
-  node->volume_id = -1;
-  node->bounds = Box();
-
-  return node;
-}
+  // volumes of the same centroid are split in half
+  int median = find_median(volume_ptr, begin, end, axis);
+  if (median <= begin || median >= end) {
+    median = begin + NPRIMS / 2;
+  }
+  const int new_axis = (axis + 1) % 3;
 
-static void free_bvhnode_recursive(VolumeBVHNode *node)
-{
-  if (node == NULL)
-    return;
+  const int left_id = build_bvh(nodes, volume_ptr, begin, median, new_axis, depth + 1);
+  if (left_id == -1)
+    return -1;
 
-  free_bvhnode_recursive(node->left);
-  free_bvhnode_recursive(node->right);
+  const int right_id = build_bvh(nodes, volume_ptr, median, end, new_axis, depth + 1);
+  if (right_id == -1)
+    return -1;
 
-  delete node;
-}
+  VolumeBVHNode &node = nodes[node_id];
+  node.offset = right_id;
+  node.bounds = nodes[left_id].bounds;
+  node.bounds.AddBox(nodes[right_id].bounds);
 
-static int is_bvh_leaf(const VolumeBVHNode *node)
-{
-  return (
-    node->left == NULL &&
-    node->right == NULL &&
-    node->volume_id != -1);
+  return node_id;
 }
 
 static int find_median(VolumePrimitive **volumes, int begin, int end, int axis)
@@ -592,23 +467,12 @@ static int find_median(VolumePrimitive **volumes, int begin, int end, int axis)
   high = end - 1;
   mid = -1;
 
-  switch (axis) {
-  case 0: key = (volumes[low]->centroid.x + volumes[high]->centroid.x) / 2; break;
-  case 1: key = (volumes[low]->centroid.y + volumes[high]->centroid.y) / 2; break;
-  case 2: key = (volumes[low]->centroid.z + volumes[high]->centroid.z) / 2; break;
-  default: break;
-  }
+  key = (volumes[low]->centroid[axis] + volumes[high]->centroid[axis]) / 2;
 
   while (low != mid) {
     double value = 0;
     mid = (low + high) / 2;
-
-    switch (axis) {
-    case 0: value = volumes[mid]->centroid.x; break;
-    case 1: value = volumes[mid]->centroid.y; break;
-    case 2: value = volumes[mid]->centroid.z; break;
-    default: break;
-    }
+    value = volumes[mid]->centroid[axis];
 
     if (key < value)
       high = mid;
@@ -621,43 +485,14 @@ static int find_median(VolumePrimitive **volumes, int begin, int end, int axis)
   return mid + 1;
 }
 
-static int compare_double(double x, double y)
-{
-  if (x > y)
-    return 1;
-  else if (x < y)
-    return -1;
-  else
-    return 0;
-}
-
-static int volume_compare_x(const void *a, const void *b)
-{
-  VolumePrimitive **A = (VolumePrimitive **) a;
-  VolumePrimitive **B = (VolumePrimitive **) b;
-  return compare_double((*A)->centroid.x, (*B)->centroid.x);
-}
-
-static int volume_compare_y(const void *a, const void *b)
-{
-  VolumePrimitive **A = (VolumePrimitive **) a;
-  VolumePrimitive **B = (VolumePrimitive **) b;
-  return compare_double((*A)->centroid.y, (*B)->centroid.y);
-}
-
-static int volume_compare_z(const void *a, const void *b)
-{
-  VolumePrimitive **A = (VolumePrimitive **) a;
-  VolumePrimitive **B = (VolumePrimitive **) b;
-  return compare_double((*A)->centroid.z, (*B)->centroid.z);
-}
-
 static int ray_volume_intersect (const VolumeAccelerator *acc, int volume_id,
   double time, const Ray *ray, IntervalList *intervals)
 {
   Interval interval;
   int hit;
 
+  FJ_RAY_STATS_ADD(volume_primitive_test_count, 1);
+
   hit = acc->VolumeIntersect_(acc->volume_set_, volume_id, time, ray, &interval);
   if (!hit) {
     return 0;
@@ -671,30 +506,4 @@ static int ray_volume_intersect (const VolumeAccelerator *acc, int volume_id,
   return 1;
 }
 
-#if 0
-static void swap_isect_ptr(IntervalList **isect0, IntervalList **isect1)
-{
-  IntervalList *isect_swp = *isect0;
-  *isect0 = *isect1;
-  *isect1 = isect_swp;
-}
-
-static int is_empty(const VolumeBVHNodeStack *stack)
-{
-  return (stack->depth == 0);
-}
-
-static void push_node(VolumeBVHNodeStack *stack, const VolumeBVHNode *node)
-{
-  stack->node[stack->depth++] = node;
-  assert(stack->depth < BVH_STACKSIZE);
-}
-
-static const VolumeBVHNode *pop_node(VolumeBVHNodeStack *stack)
-{
-  assert(!is_empty(stack));
-  return stack->node[--stack->depth];
-}
-#endif
-
 } // namespace xxx
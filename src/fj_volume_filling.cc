@@ -2,10 +2,17 @@
 // See LICENSE and README
 
 #include "fj_volume_filling.h"
+#include "fj_multi_thread.h"
+#include "fj_progress.h"
 #include "fj_numeric.h"
+#include "fj_random.h"
 #include "fj_vector.h"
 #include "fj_volume.h"
 
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #define VEC3_BILERP(dst,v00,v10,v01,v11,s,t) do { \
   (dst)->x = Bilerp((v00)->x, (v10)->x, (v01)->x, (v11)->x, (s), (t)); \
   (dst)->y = Bilerp((v00)->y, (v10)->y, (v01)->y, (v11)->y, (s), (t)); \
@@ -14,6 +21,43 @@
 
 namespace fj {
 
+// the number of specks a task fills. each chunk has its own random seed
+// so specks don't depend on the thread count
+static const int SPECK_CHUNK_SIZE = 16384;
+
+class SphereFill {
+public:
+  SphereFill() : volume(NULL), center(), radius(0), density(0), thresholdwidth(0) {}
+  ~SphereFill() {}
+
+  const Volume *volume;
+  Vector center;
+  Real radius;
+  float density;
+  Real thresholdwidth;
+};
+
+class SpeckFill {
+public:
+  SpeckFill() :
+      volume(NULL), speck_fn(NULL), data(NULL), speck_count(0),
+      mutex(), progress(), thread_volumes() {}
+  ~SpeckFill() {}
+
+  const Volume *volume;
+  SpeckFunction speck_fn;
+  void *data;
+  int speck_count;
+
+  std::mutex mutex;
+  Progress progress;
+  // specks are accumulated per thread and added at the end
+  std::vector<std::unique_ptr<Volume>> thread_volumes;
+};
+
+static float add_sphere_value(void *data, int x, int y, int z, float value);
+static LoopStatus fill_speck_chunk_task(void *data, const ThreadContext &context);
+
 void LerpWispConstrolPoint(WispsControlPoint *cp,
     const WispsControlPoint *cp0, const WispsControlPoint *cp1,
     Real t)
@@ -64,34 +108,104 @@ void BilerpWispConstrolPoint(WispsControlPoint *cp,
 void FillWithSphere(Volume *volume,
     const Vector *center, Real radius, float density)
 {
-  int i, j, k;
   int xmin, ymin, zmin;
   int xmax, ymax, zmax;
-  const Real thresholdwidth = .5 * volume->GetFilterSize();
+
+  SphereFill sphere;
+  sphere.volume = volume;
+  sphere.center = *center;
+  sphere.radius = radius;
+  sphere.density = density;
+  sphere.thresholdwidth = .5 * volume->GetFilterSize();
 
   VolGetIndexRange(volume, center, radius,
       &xmin, &ymin, &zmin,
       &xmax, &ymax, &zmax);
 
-  for (k = zmin; k <= zmax; k++) {
-    for (j = ymin; j <= ymax; j++) {
-      for (i = xmin; i <= xmax; i++) {
-        Vector P;
-        float value = 0;
+  volume->UpdateValues(xmin, ymin, zmin, xmax, ymax, zmax,
+      add_sphere_value, &sphere);
+}
+
+void FillWithSpecks(Volume *volume, int speck_count,
+    SpeckFunction speck_fn, void *data)
+{
+  if (speck_count <= 0) {
+    return;
+  }
 
-        P = volume->IndexToPoint(i, j, k);
+  SpeckFill fill;
+  fill.volume = volume;
+  fill.speck_fn = speck_fn;
+  fill.data = data;
+  fill.speck_count = speck_count;
 
-        P.x -= center->x;
-        P.y -= center->y;
-        P.z -= center->z;
+  const int NCHUNKS = (speck_count + SPECK_CHUNK_SIZE - 1) / SPECK_CHUNK_SIZE;
+  std::vector<int> chunk_que(NCHUNKS);
+  for (int i = 0; i < NCHUNKS; i++) {
+    chunk_que[i] = i;
+  }
+
+  fill.progress.Start(NCHUNKS);
+  MtRunParallelLoop(&fill, fill_speck_chunk_task,
+      MtGetMaxAvailableThreadCount(), chunk_que);
+  fill.progress.Done();
 
-        value = volume->GetValue(i, j, k);
-        value += density * Fit(Length(P) - radius,
-            -thresholdwidth, thresholdwidth, 1, 0);
-        volume->SetValue(i, j, k, value);
-      }
+  for (std::size_t i = 0; i < fill.thread_volumes.size(); i++) {
+    if (fill.thread_volumes[i] != nullptr) {
+      volume->AddValues(*fill.thread_volumes[i]);
     }
   }
 }
 
+static float add_sphere_value(void *data, int x, int y, int z, float value)
+{
+  const SphereFill *sphere = reinterpret_cast<const SphereFill *>(data);
+  const Vector P = sphere->volume->IndexToPoint(x, y, z) - sphere->center;
+
+  return value + sphere->density * Fit(Length(P) - sphere->radius,
+      -sphere->thresholdwidth, sphere->thresholdwidth, 1, 0);
+}
+
+static LoopStatus fill_speck_chunk_task(void *data, const ThreadContext &context)
+{
+  SpeckFill *fill = reinterpret_cast<SpeckFill *>(data);
+  Volume *thread_volume = NULL;
+
+  {
+    std::lock_guard<std::mutex> lock(fill->mutex);
+    if (static_cast<int>(fill->thread_volumes.size()) <= context.thread_id) {
+      fill->thread_volumes.resize(context.thread_id + 1);
+    }
+    std::unique_ptr<Volume> &volume = fill->thread_volumes[context.thread_id];
+    if (volume == nullptr) {
+      int xres, yres, zres;
+      fill->volume->GetResolution(&xres, &yres, &zres);
+      volume.reset(new Volume());
+      volume->Resize(xres, yres, zres);
+      volume->SetBounds(fill->volume->GetBounds());
+    }
+    thread_volume = volume.get();
+  }
+
+  const int begin = context.iteration_id * SPECK_CHUNK_SIZE;
+  const int end = Min(begin + SPECK_CHUNK_SIZE, fill->speck_count);
+  XorShift rng(context.iteration_id + 1);
+
+  for (int i = begin; i < end; i++) {
+    Vector center;
+    Real radius = 0;
+    float density = 0;
+
+    fill->speck_fn(fill->data, rng, &center, &radius, &density);
+    FillWithSphere(thread_volume, &center, radius, density);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(fill->mutex);
+    fill->progress.Increment();
+  }
+
+  return LoopStatus::Continue;
+}
+
 } // namespace xxx
@@ -11,6 +11,7 @@
 namespace fj {
 
 class Volume;
+class XorShift;
 
 class FJ_API CloudControlPoint {
 public:
@@ -61,6 +62,14 @@ FJ_API void BilerpWispConstrolPoint(WispsControlPoint *cp,
 FJ_API void FillWithSphere(Volume *volume,
     const Vector *center, Real radius, float density);
 
+// makes a speck from the random numbers. called from multiple threads
+typedef void (*SpeckFunction)(void *data, XorShift &rng,
+    Vector *center, Real *radius, float *density);
+
+// fills spheres of specks in parallel
+FJ_API void FillWithSpecks(Volume *volume, int speck_count,
+    SpeckFunction speck_fn, void *data);
+
 } // namespace xxx
 
 #endif // FJ_XXX_H
@@ -0,0 +1,38 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef FJ_FLOAT_ROUNDING_H
+#define FJ_FLOAT_ROUNDING_H
+
+// included by accelerators after fj_types.h for Real
+#include <cfloat>
+#include <cmath>
+
+namespace fj {
+
+// rounds to float so that float bounds and ray ranges of accelerators
+// always contain the original. values beyond the float range become the
+// largest float or infinity
+inline float RoundDownToFloat(Real x)
+{
+  if (x < -FLT_MAX)
+    return -HUGE_VALF;
+  if (x > FLT_MAX)
+    return FLT_MAX;
+  const float f = static_cast<float>(x);
+  return f > x ? std::nextafter(f, -HUGE_VALF) : f;
+}
+
+inline float RoundUpToFloat(Real x)
+{
+  if (x > FLT_MAX)
+    return HUGE_VALF;
+  if (x < -FLT_MAX)
+    return -FLT_MAX;
+  const float f = static_cast<float>(x);
+  return f < x ? std::nextafter(f, HUGE_VALF) : f;
+}
+
+} // namespace xxx
+
+#endif // FJ_XXX_H
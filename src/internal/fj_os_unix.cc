@@ -3,9 +3,23 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <dlfcn.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <aio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
 
 void *OsDlopen(const char *filename)
 {
@@ -49,3 +63,685 @@ int OsDlclose(void *handle)
     return 0;
   }
 }
+
+int OsSetThreadAffinity(const int *cpu_ids, int count)
+{
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+
+  if (count == 0) {
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      CPU_SET(i, &cpu_set);
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (cpu_ids[i] < 0 || cpu_ids[i] >= CPU_SETSIZE) {
+      return -1;
+    }
+    CPU_SET(cpu_ids[i], &cpu_set);
+  }
+
+  const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (err) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+int OsGetNumaNodeCPUs(int node_id, int *cpu_ids, int max_count)
+{
+  char filename[256] = {'\0'};
+  sprintf(filename, "/sys/devices/system/node/node%d/cpulist", node_id);
+
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+
+  // cpulist is a list of ranges e.g. 0-3,8-11
+  int count = 0;
+  int first = 0;
+  while (fscanf(fp, "%d", &first) == 1) {
+    int last = first;
+    const int c = fgetc(fp);
+    if (c == '-') {
+      if (fscanf(fp, "%d", &last) != 1) {
+        break;
+      }
+      fgetc(fp);
+    }
+    for (int i = first; i <= last && count < max_count; i++) {
+      cpu_ids[count++] = i;
+    }
+  }
+  fclose(fp);
+
+  return count;
+}
+
+int OsGetNumaNodeCount()
+{
+  FILE *fp = fopen("/sys/devices/system/node/online", "r");
+  if (fp == NULL) {
+    return 1;
+  }
+
+  // online is a list of ranges e.g. 0-1. the last one is the highest node
+  int count = 1;
+  int first = 0;
+  while (fscanf(fp, "%d", &first) == 1) {
+    int last = first;
+    const int c = fgetc(fp);
+    if (c == '-') {
+      if (fscanf(fp, "%d", &last) != 1) {
+        break;
+      }
+      fgetc(fp);
+    }
+    count = last + 1;
+  }
+  fclose(fp);
+
+  return count;
+}
+
+int OsGetAffinityCPUCount()
+{
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+
+  if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == -1) {
+    return -1;
+  }
+  return CPU_COUNT(&cpu_set);
+}
+
+// cpu.max of cgroup v2 is the quota and the period e.g. 250000 100000
+// or max 100000 for no quota
+static double read_cgroup2_quota(const std::string &dirname)
+{
+  FILE *fp = fopen((dirname + "/cpu.max").c_str(), "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  char quota[64] = {'\0'};
+  long long period = 0;
+  const int count = fscanf(fp, "%63s %lld", quota, &period);
+  fclose(fp);
+
+  if (count != 2 || strcmp(quota, "max") == 0 || period <= 0) {
+    return -1;
+  }
+  return atof(quota) / period;
+}
+
+static long long read_cgroup1_value(const char *filename)
+{
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  long long value = -1;
+  if (fscanf(fp, "%lld", &value) != 1) {
+    value = -1;
+  }
+  fclose(fp);
+  return value;
+}
+
+double OsGetCPUQuota()
+{
+  // the cgroup v2 path of the process is the line of hierarchy 0 e.g. 0::/a/b
+  std::string path;
+  FILE *fp = fopen("/proc/self/cgroup", "r");
+  if (fp != NULL) {
+    char line[1024] = {'\0'};
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      if (strncmp(line, "0::", 3) == 0) {
+        path = line + 3;
+        path.erase(path.find_last_not_of("\n") + 1);
+        break;
+      }
+    }
+    fclose(fp);
+  }
+
+  // the lowest quota of the cgroup and its parents
+  double quota = -1;
+  if (!path.empty()) {
+    for (;;) {
+      const double q = read_cgroup2_quota("/sys/fs/cgroup" + path);
+      if (q > 0 && (quota < 0 || q < quota)) {
+        quota = q;
+      }
+      if (path.empty() || path == "/") {
+        break;
+      }
+      path.erase(path.rfind('/'));
+    }
+  }
+  if (quota > 0) {
+    return quota;
+  }
+
+  // cgroup v1 has no quota with -1
+  const long long quota_us = read_cgroup1_value("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+  const long long period_us = read_cgroup1_value("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+  if (quota_us > 0 && period_us > 0) {
+    return static_cast<double>(quota_us) / period_us;
+  }
+
+  return -1;
+}
+
+int OsInterleaveMemory(const void *data, size_t size)
+{
+#if defined(SYS_mbind)
+  // from numaif.h without depending on libnuma
+  const int MPOL_INTERLEAVE_ = 3;
+  const unsigned MPOL_MF_MOVE_ = 1 << 1;
+  const int NODE_COUNT = OsGetNumaNodeCount();
+  const int MASK_BITS = 8 * sizeof(unsigned long);
+  if (NODE_COUNT > MASK_BITS) {
+    return -1;
+  }
+  const unsigned long node_mask = NODE_COUNT == MASK_BITS ?
+      ~0UL : (1UL << NODE_COUNT) - 1;
+
+  const size_t PAGE_SIZE = OsGetPageSize();
+  const size_t addr = reinterpret_cast<size_t>(data);
+  const size_t begin = (addr + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+  const size_t end = (addr + size) / PAGE_SIZE * PAGE_SIZE;
+  if (begin >= end) {
+    return 0;
+  }
+
+  const long err = syscall(SYS_mbind, begin, end - begin, MPOL_INTERLEAVE_,
+      &node_mask, NODE_COUNT + 1, MPOL_MF_MOVE_);
+  return err == 0 ? 0 : -1;
+#else
+  return -1;
+#endif
+}
+
+void *OsMapFile(const char *filename, size_t *size)
+{
+  const int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+
+  // the mapping stays valid after the file is closed
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+
+  *size = static_cast<size_t>(st.st_size);
+  return data;
+}
+
+int OsUnmapFile(void *data, size_t size)
+{
+  if (data == NULL) {
+    return 0;
+  }
+
+  if (munmap(data, size)) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+void *OsMapWritableFile(const char *filename, size_t size)
+{
+  if (size == 0) {
+    return NULL;
+  }
+
+  const int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  // the file has holes until pages are written
+  if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+
+  return data;
+}
+
+int OsFlushMappedPages(void *data, size_t size)
+{
+  if (data == NULL) {
+    return 0;
+  }
+
+  if (msync(data, size, MS_SYNC)) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+void *OsCreateSharedMemory(const char *name, size_t size)
+{
+  if (size == 0) {
+    return NULL;
+  }
+
+  const std::string path = std::string("/") + name;
+  // memory left by a crashed process of the same id is replaced
+  shm_unlink(path.c_str());
+  const int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+    close(fd);
+    shm_unlink(path.c_str());
+    return NULL;
+  }
+
+  void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    shm_unlink(path.c_str());
+    return NULL;
+  }
+
+  return data;
+}
+
+void *OsOpenSharedMemory(const char *name, size_t size)
+{
+  if (size == 0) {
+    return NULL;
+  }
+
+  const std::string path = std::string("/") + name;
+  const int fd = shm_open(path.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  // smaller memory than expected is of another frame
+  struct stat st;
+  if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < size) {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+
+  return data;
+}
+
+int OsUnmapSharedMemory(void *data, size_t size)
+{
+  if (data == NULL) {
+    return 0;
+  }
+
+  if (munmap(data, size)) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+int OsRemoveSharedMemory(const char *name)
+{
+  const std::string path = std::string("/") + name;
+  if (shm_unlink(path.c_str())) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+int OsGetProcessId()
+{
+  return static_cast<int>(getpid());
+}
+
+size_t OsGetPageSize()
+{
+  return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+int OsEvictMappedPages(const void *data, size_t size)
+{
+  if (data == NULL) {
+    return 0;
+  }
+
+  // pages of private read only mappings are only dropped, not written back.
+  // paging out also drops them from the page cache if no one else maps them.
+  // modified pages of writable mappings are kept in the file
+#if defined(MADV_PAGEOUT)
+  if (madvise(const_cast<void *>(data), size, MADV_PAGEOUT) == 0) {
+    return 0;
+  }
+#endif
+  if (madvise(const_cast<void *>(data), size, MADV_DONTNEED)) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+int OsGetResidentSize(const void *data, size_t size, size_t *resident)
+{
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t page_count = (size + page_size - 1) / page_size;
+  std::vector<unsigned char> pages(page_count);
+
+  *resident = 0;
+  if (page_count == 0) {
+    return 0;
+  }
+  if (mincore(const_cast<void *>(data), size, &pages[0])) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < page_count; i++) {
+    if (pages[i] & 1) {
+      *resident += page_size;
+    }
+  }
+  if (*resident > size) {
+    *resident = size;
+  }
+  return 0;
+}
+
+int OsAdviseMappedPages(const void *data, size_t size, int advice)
+{
+  if (data == NULL || size == 0) {
+    return 0;
+  }
+
+  const uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~(page_size - 1);
+  const uintptr_t end = reinterpret_cast<uintptr_t>(data) + size;
+  int sys_advice = MADV_NORMAL;
+  switch (advice) {
+  case OS_ACCESS_NORMAL:     sys_advice = MADV_NORMAL;     break;
+  case OS_ACCESS_SEQUENTIAL: sys_advice = MADV_SEQUENTIAL; break;
+  case OS_ACCESS_RANDOM:     sys_advice = MADV_RANDOM;     break;
+  case OS_ACCESS_WILLNEED:   sys_advice = MADV_WILLNEED;   break;
+  default:
+    return -1;
+  }
+
+  if (madvise(reinterpret_cast<void *>(begin), end - begin, sys_advice)) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+class OsFile {
+public:
+  OsFile() : fd(-1) {}
+  ~OsFile() {}
+
+  int fd;
+};
+
+OsFile *OsOpenFile(const char *filename)
+{
+  const int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+  OsFile *file = new OsFile();
+  file->fd = fd;
+  return file;
+}
+
+void OsCloseFile(OsFile *file)
+{
+  if (file == NULL) {
+    return;
+  }
+  close(file->fd);
+  delete file;
+}
+
+long long OsGetFileSize(const OsFile *file)
+{
+  struct stat st;
+  if (fstat(file->fd, &st) == -1) {
+    return -1;
+  }
+  return static_cast<long long>(st.st_size);
+}
+
+long long OsReadFile(OsFile *file, long long offset, void *dst, size_t size)
+{
+  char *bytes = static_cast<char *>(dst);
+  size_t nread = 0;
+
+  // a read may return fewer bytes than asked before the end of the file
+  while (nread < size) {
+    const ssize_t count = pread(file->fd, bytes + nread, size - nread, offset + nread);
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (count == 0) {
+      break;
+    }
+    nread += count;
+  }
+  return static_cast<long long>(nread);
+}
+
+// the control block is allocated by itself since it may end with a zero
+// size array, which can't be a member
+class OsAsyncRead {
+public:
+  OsAsyncRead() : file(NULL), control(new aiocb()) {}
+  ~OsAsyncRead() { delete control; }
+
+  OsFile *file;
+  aiocb *control;
+
+private:
+  OsAsyncRead(const OsAsyncRead &);
+  const OsAsyncRead &operator=(const OsAsyncRead &);
+};
+
+OsAsyncRead *OsStartAsyncRead(OsFile *file, long long offset, void *dst, size_t size)
+{
+  OsAsyncRead *read = new OsAsyncRead();
+  read->file = file;
+  read->control->aio_fildes = file->fd;
+  read->control->aio_offset = offset;
+  read->control->aio_buf = dst;
+  read->control->aio_nbytes = size;
+  read->control->aio_sigevent.sigev_notify = SIGEV_NONE;
+
+  if (aio_read(read->control) == -1) {
+    delete read;
+    return NULL;
+  }
+  return read;
+}
+
+bool OsIsAsyncReadDone(OsAsyncRead *read)
+{
+  return aio_error(read->control) != EINPROGRESS;
+}
+
+long long OsFinishAsyncRead(OsAsyncRead *read)
+{
+  const aiocb *list[1] = {read->control};
+  while (aio_error(read->control) == EINPROGRESS) {
+    aio_suspend(list, 1, NULL);
+  }
+
+  long long nread = -1;
+  if (aio_error(read->control) == 0) {
+    nread = static_cast<long long>(aio_return(read->control));
+  } else {
+    aio_return(read->control);
+  }
+
+  // the rest of a short read before the end of the file
+  const size_t size = read->control->aio_nbytes;
+  if (nread > 0 && static_cast<size_t>(nread) < size) {
+    char *bytes = static_cast<char *>(const_cast<void *>(read->control->aio_buf));
+    const long long rest = OsReadFile(read->file, read->control->aio_offset + nread,
+        bytes + nread, size - nread);
+    nread = rest == -1 ? -1 : nread + rest;
+  }
+
+  delete read;
+  return nread;
+}
+
+int OsAdviseFile(OsFile *file, long long offset, size_t size, int advice)
+{
+  int sys_advice = POSIX_FADV_NORMAL;
+  switch (advice) {
+  case OS_ACCESS_NORMAL:     sys_advice = POSIX_FADV_NORMAL;     break;
+  case OS_ACCESS_SEQUENTIAL: sys_advice = POSIX_FADV_SEQUENTIAL; break;
+  case OS_ACCESS_RANDOM:     sys_advice = POSIX_FADV_RANDOM;     break;
+  case OS_ACCESS_WILLNEED:   sys_advice = POSIX_FADV_WILLNEED;   break;
+  default:
+    return -1;
+  }
+
+  if (posix_fadvise(file->fd, offset, size, sys_advice)) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+long long OsGetPageInCount()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return -1;
+  }
+  return static_cast<long long>(usage.ru_majflt);
+}
+
+long long OsGetPeakMemoryUsage()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return -1;
+  }
+  // kilobytes on linux
+  return static_cast<long long>(usage.ru_maxrss) * 1024;
+}
+
+long long OsGetMemoryUsage()
+{
+  // pages of the whole program then resident pages
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  long long size = 0, resident = 0;
+  const int count = fscanf(fp, "%lld %lld", &size, &resident);
+  fclose(fp);
+  if (count != 2) {
+    return -1;
+  }
+  return resident * static_cast<long long>(OsGetPageSize());
+}
+
+class OsFileLock {
+public:
+  OsFileLock() : fd(-1) {}
+  ~OsFileLock() {}
+
+  int fd;
+};
+
+OsFileLock *OsTryLockFile(const char *filename)
+{
+  const int fd = open(filename, O_RDWR | O_CREAT, 0666);
+  if (fd == -1) {
+    return NULL;
+  }
+  // flock locks belong to the open file so a second open in the same
+  // process doesn't get the lock either
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+    close(fd);
+    return NULL;
+  }
+  OsFileLock *lock = new OsFileLock();
+  lock->fd = fd;
+  return lock;
+}
+
+void OsUnlockFile(OsFileLock *lock)
+{
+  if (lock == NULL) {
+    return;
+  }
+  close(lock->fd);
+  delete lock;
+}
+
+std::string OsGetTempDirectory()
+{
+  const char *dirname = getenv("TMPDIR");
+  std::string result = (dirname != NULL && dirname[0] != '\0') ? dirname : "/tmp";
+  if (result.size() > 1 && result[result.size() - 1] == '/') {
+    result.erase(result.size() - 1);
+  }
+  return result;
+}
+
+int OsListFiles(const char *dirname, std::vector<std::string> *filenames)
+{
+  DIR *dir = opendir(dirname);
+  if (dir == NULL) {
+    return -1;
+  }
+
+  filenames->clear();
+  for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+    const std::string path = std::string(dirname) + "/" + entry->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      filenames->push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+
+  std::sort(filenames->begin(), filenames->end());
+  return 0;
+}
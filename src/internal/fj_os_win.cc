@@ -60,3 +60,537 @@ int OsDlclose(void *handle)
     return 0;
   }
 }
+
+int OsSetThreadAffinity(const int *cpu_ids, int count)
+{
+  DWORD_PTR mask = 0;
+
+  if (count == 0) {
+    DWORD_PTR system_mask = 0;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &mask, &system_mask) == 0) {
+      return -1;
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (cpu_ids[i] < 0 || cpu_ids[i] >= static_cast<int>(8 * sizeof(mask))) {
+      return -1;
+    }
+    mask |= static_cast<DWORD_PTR>(1) << cpu_ids[i];
+  }
+
+  if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+int OsGetNumaNodeCPUs(int node_id, int *cpu_ids, int max_count)
+{
+  ULONGLONG mask = 0;
+
+  if (node_id < 0 || GetNumaNodeProcessorMask(static_cast<UCHAR>(node_id), &mask) == 0) {
+    return -1;
+  }
+
+  int count = 0;
+  for (int i = 0; i < 64 && count < max_count; i++) {
+    if (mask & (static_cast<ULONGLONG>(1) << i)) {
+      cpu_ids[count++] = i;
+    }
+  }
+
+  return count;
+}
+
+int OsGetNumaNodeCount()
+{
+  ULONG highest = 0;
+  if (GetNumaHighestNodeNumber(&highest) == 0) {
+    return 1;
+  }
+  return static_cast<int>(highest) + 1;
+}
+
+int OsGetAffinityCPUCount()
+{
+  DWORD_PTR process_mask = 0;
+  DWORD_PTR system_mask = 0;
+  if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) == 0) {
+    return -1;
+  }
+
+  int count = 0;
+  for (; process_mask != 0; process_mask &= process_mask - 1) {
+    count++;
+  }
+  return count;
+}
+
+double OsGetCPUQuota()
+{
+  // rate limits of job objects are not read
+  return -1;
+}
+
+int OsInterleaveMemory(const void *data, size_t size)
+{
+  // pages of an existing allocation cannot be moved between nodes
+  return -1;
+}
+
+void *OsMapFile(const char *filename, size_t *size)
+{
+  HANDLE file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  LARGE_INTEGER file_size;
+  if (GetFileSizeEx(file, &file_size) == 0 || file_size.QuadPart <= 0) {
+    CloseHandle(file);
+    return NULL;
+  }
+
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (mapping == NULL) {
+    return NULL;
+  }
+
+  // the view keeps the mapping alive
+  void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  *size = static_cast<size_t>(file_size.QuadPart);
+  return data;
+}
+
+int OsUnmapFile(void *data, size_t size)
+{
+  if (data == NULL) {
+    return 0;
+  }
+
+  if (UnmapViewOfFile(data) == 0) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+void *OsMapWritableFile(const char *filename, size_t size)
+{
+  if (size == 0) {
+    return NULL;
+  }
+
+  HANDLE file = CreateFile(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+      CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+
+  // the mapping extends the file to the size
+  const unsigned long long size64 = size;
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READWRITE,
+      static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64 & 0xFFFFFFFF), NULL);
+  CloseHandle(file);
+  if (mapping == NULL) {
+    return NULL;
+  }
+
+  void *data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+  CloseHandle(mapping);
+  return data;
+}
+
+int OsFlushMappedPages(void *data, size_t size)
+{
+  if (data == NULL) {
+    return 0;
+  }
+
+  if (FlushViewOfFile(data, size) == 0) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+// mapping handles of created memory. names live while handles are open
+static std::mutex shared_memory_mutex;
+static std::map<void *, HANDLE> shared_memory_handles;
+
+void *OsCreateSharedMemory(const char *name, size_t size)
+{
+  if (size == 0) {
+    return NULL;
+  }
+
+  const std::string path = std::string("Local\\") + name;
+  const unsigned long long size64 = size;
+  HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64 & 0xFFFFFFFF),
+      path.c_str());
+  if (mapping == NULL) {
+    return NULL;
+  }
+  if (GetLastError() == ERROR_ALREADY_EXISTS) {
+    CloseHandle(mapping);
+    return NULL;
+  }
+
+  void *data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+  if (data == NULL) {
+    CloseHandle(mapping);
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(shared_memory_mutex);
+  shared_memory_handles[data] = mapping;
+  return data;
+}
+
+void *OsOpenSharedMemory(const char *name, size_t size)
+{
+  if (size == 0) {
+    return NULL;
+  }
+
+  const std::string path = std::string("Local\\") + name;
+  HANDLE mapping = OpenFileMapping(FILE_MAP_READ, FALSE, path.c_str());
+  if (mapping == NULL) {
+    return NULL;
+  }
+
+  void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+  CloseHandle(mapping);
+  return data;
+}
+
+int OsUnmapSharedMemory(void *data, size_t size)
+{
+  if (data == NULL) {
+    return 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(shared_memory_mutex);
+    std::map<void *, HANDLE>::iterator it = shared_memory_handles.find(data);
+    if (it != shared_memory_handles.end()) {
+      CloseHandle(it->second);
+      shared_memory_handles.erase(it);
+    }
+  }
+
+  if (UnmapViewOfFile(data) == 0) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+int OsRemoveSharedMemory(const char *name)
+{
+  // the name is removed when the creator unmaps it
+  return 0;
+}
+
+int OsGetProcessId()
+{
+  return static_cast<int>(GetCurrentProcessId());
+}
+
+size_t OsGetPageSize()
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return static_cast<size_t>(info.dwPageSize);
+}
+
+int OsEvictMappedPages(const void *data, size_t size)
+{
+  if (data == NULL) {
+    return 0;
+  }
+
+  // unlocking pages that are not locked removes them from the working set
+  if (VirtualUnlock(const_cast<void *>(data), size) == 0 &&
+      GetLastError() != ERROR_NOT_LOCKED) {
+    return -1;
+  } else {
+    return 0;
+  }
+}
+
+int OsGetResidentSize(const void *data, size_t size, size_t *resident)
+{
+  return -1;
+}
+
+int OsAdviseMappedPages(const void *data, size_t size, int advice)
+{
+  if (data == NULL || size == 0) {
+    return 0;
+  }
+
+  // only reading ahead has an equivalent
+  switch (advice) {
+  case OS_ACCESS_NORMAL:
+    return 0;
+  case OS_ACCESS_WILLNEED:
+    {
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+      WIN32_MEMORY_RANGE_ENTRY range;
+      range.VirtualAddress = const_cast<void *>(data);
+      range.NumberOfBytes = size;
+      return PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0) == 0 ? -1 : 0;
+#else
+      return -1;
+#endif
+    }
+  default:
+    return -1;
+  }
+}
+
+class OsFile {
+public:
+  OsFile() : handle(INVALID_HANDLE_VALUE) {}
+  ~OsFile() {}
+
+  HANDLE handle;
+};
+
+OsFile *OsOpenFile(const char *filename)
+{
+  // overlapped so that reads at offsets can run at once
+  HANDLE handle = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+  OsFile *file = new OsFile();
+  file->handle = handle;
+  return file;
+}
+
+void OsCloseFile(OsFile *file)
+{
+  if (file == NULL) {
+    return;
+  }
+  CloseHandle(file->handle);
+  delete file;
+}
+
+long long OsGetFileSize(const OsFile *file)
+{
+  LARGE_INTEGER file_size;
+  if (GetFileSizeEx(file->handle, &file_size) == 0) {
+    return -1;
+  }
+  return static_cast<long long>(file_size.QuadPart);
+}
+
+class OsAsyncRead {
+public:
+  OsAsyncRead() : file(NULL), overlapped(), dst(NULL), size(0) {}
+  ~OsAsyncRead() {}
+
+  OsFile *file;
+  OVERLAPPED overlapped;
+  char *dst;
+  DWORD size;
+};
+
+// reads up to 4GB minus 1 at once
+static bool start_read(OsAsyncRead *read, OsFile *file, long long offset,
+    void *dst, size_t size)
+{
+  read->file = file;
+  read->dst = static_cast<char *>(dst);
+  read->size = static_cast<DWORD>(size < MAXDWORD ? size : MAXDWORD);
+  read->overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+  read->overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  read->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (read->overlapped.hEvent == NULL) {
+    return false;
+  }
+
+  if (ReadFile(file->handle, read->dst, read->size, NULL, &read->overlapped) == 0 &&
+      GetLastError() != ERROR_IO_PENDING && GetLastError() != ERROR_HANDLE_EOF) {
+    CloseHandle(read->overlapped.hEvent);
+    return false;
+  }
+  return true;
+}
+
+// returns the bytes read or -1
+static long long finish_read(OsAsyncRead *read)
+{
+  DWORD nread = 0;
+  const BOOL ok = GetOverlappedResult(read->file->handle, &read->overlapped, &nread, TRUE);
+  CloseHandle(read->overlapped.hEvent);
+
+  if (ok == 0) {
+    return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+  }
+  return static_cast<long long>(nread);
+}
+
+long long OsReadFile(OsFile *file, long long offset, void *dst, size_t size)
+{
+  char *bytes = static_cast<char *>(dst);
+  size_t nread = 0;
+
+  while (nread < size) {
+    OsAsyncRead read;
+    if (!start_read(&read, file, offset + nread, bytes + nread, size - nread)) {
+      return -1;
+    }
+    const long long count = finish_read(&read);
+    if (count == -1) {
+      return -1;
+    }
+    if (count == 0) {
+      break;
+    }
+    nread += static_cast<size_t>(count);
+  }
+  return static_cast<long long>(nread);
+}
+
+int OsAdviseFile(OsFile *file, long long offset, size_t size, int advice)
+{
+  // hints are given when files are opened on windows
+  return advice == OS_ACCESS_NORMAL ? 0 : -1;
+}
+
+OsAsyncRead *OsStartAsyncRead(OsFile *file, long long offset, void *dst, size_t size)
+{
+  OsAsyncRead *read = new OsAsyncRead();
+  if (!start_read(read, file, offset, dst, size)) {
+    delete read;
+    return NULL;
+  }
+  return read;
+}
+
+bool OsIsAsyncReadDone(OsAsyncRead *read)
+{
+  return HasOverlappedIoCompleted(&read->overlapped);
+}
+
+long long OsFinishAsyncRead(OsAsyncRead *read)
+{
+  const long long offset =
+      (static_cast<long long>(read->overlapped.OffsetHigh) << 32) | read->overlapped.Offset;
+  long long nread = finish_read(read);
+
+  // the rest of a short read before the end of the file
+  if (nread > 0 && nread < read->size) {
+    const long long rest = OsReadFile(read->file, offset + nread,
+        read->dst + nread, read->size - nread);
+    nread = rest == -1 ? -1 : nread + rest;
+  }
+
+  delete read;
+  return nread;
+}
+
+long long OsGetPageInCount()
+{
+  return -1;
+}
+
+long long OsGetPeakMemoryUsage()
+{
+  return -1;
+}
+
+long long OsGetMemoryUsage()
+{
+  return -1;
+}
+
+class OsFileLock {
+public:
+  OsFileLock() : file(INVALID_HANDLE_VALUE) {}
+  ~OsFileLock() {}
+
+  HANDLE file;
+};
+
+OsFileLock *OsTryLockFile(const char *filename)
+{
+  const HANDLE file = CreateFileA(filename,
+      GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+  // locks belong to the handle so a second handle in the same process
+  // doesn't get the lock either
+  OVERLAPPED overlapped;
+  ZeroMemory(&overlapped, sizeof(overlapped));
+  if (LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY,
+        0, 1, 0, &overlapped) == 0) {
+    CloseHandle(file);
+    return NULL;
+  }
+  OsFileLock *lock = new OsFileLock();
+  lock->file = file;
+  return lock;
+}
+
+void OsUnlockFile(OsFileLock *lock)
+{
+  if (lock == NULL) {
+    return;
+  }
+  CloseHandle(lock->file);
+  delete lock;
+}
+
+std::string OsGetTempDirectory()
+{
+  char dirname[MAX_PATH + 1] = {'\0'};
+  const DWORD len = GetTempPathA(sizeof(dirname), dirname);
+  if (len == 0 || len > sizeof(dirname)) {
+    return ".";
+  }
+  std::string result(dirname, len);
+  if (result.size() > 1 && (result[result.size() - 1] == '\\' ||
+        result[result.size() - 1] == '/')) {
+    result.erase(result.size() - 1);
+  }
+  return result;
+}
+
+int OsListFiles(const char *dirname, std::vector<std::string> *filenames)
+{
+  const std::string pattern = std::string(dirname) + "\\*";
+  WIN32_FIND_DATA data;
+  HANDLE find = FindFirstFile(pattern.c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE) {
+    return -1;
+  }
+
+  filenames->clear();
+  do {
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+      filenames->push_back(data.cFileName);
+    }
+  } while (FindNextFile(find, &data) != 0);
+  FindClose(find);
+
+  std::sort(filenames->begin(), filenames->end());
+  return 0;
+}
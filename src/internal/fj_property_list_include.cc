@@ -68,6 +68,37 @@ static int set_ObjectInstance_shadow_target(void *self, const PropertyValue &val
   return 0;
 }
 
+static int set_visibility(ObjectInstance *obj, unsigned int kind, double visible)
+{
+  const unsigned int visibility = obj->GetVisibility();
+  obj->SetVisibility(visible != 0 ? visibility | kind : visibility & ~kind);
+  return 0;
+}
+
+static int set_ObjectInstance_visible_camera(void *self, const PropertyValue &value)
+{
+  ObjectInstance *obj = reinterpret_cast<ObjectInstance *>(self);
+  return set_visibility(obj, GROUP_MASK_CAMERA, value.vector[0]);
+}
+
+static int set_ObjectInstance_visible_shadow(void *self, const PropertyValue &value)
+{
+  ObjectInstance *obj = reinterpret_cast<ObjectInstance *>(self);
+  return set_visibility(obj, GROUP_MASK_SHADOW, value.vector[0]);
+}
+
+static int set_ObjectInstance_visible_reflect(void *self, const PropertyValue &value)
+{
+  ObjectInstance *obj = reinterpret_cast<ObjectInstance *>(self);
+  return set_visibility(obj, GROUP_MASK_REFLECT, value.vector[0]);
+}
+
+static int set_ObjectInstance_visible_refract(void *self, const PropertyValue &value)
+{
+  ObjectInstance *obj = reinterpret_cast<ObjectInstance *>(self);
+  return set_visibility(obj, GROUP_MASK_REFRACT, value.vector[0]);
+}
+
 static int set_Turbulence_lacunarity(void *self, const PropertyValue &value)
 {
   Turbulence *turbulence = reinterpret_cast<Turbulence *>(self);
@@ -110,6 +141,13 @@ static int set_Turbulence_offset(void *self, const PropertyValue &value)
   return 0;
 }
 
+static int set_Turbulence_bake_resolution(void *self, const PropertyValue &value)
+{
+  Turbulence *turbulence = reinterpret_cast<Turbulence *>(self);
+  turbulence->SetBakeResolution(Max(0, static_cast<int>(value.vector[0])));
+  return 0;
+}
+
 static int set_Renderer_sample_jitter(void *self, const PropertyValue &value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -117,6 +155,62 @@ static int set_Renderer_sample_jitter(void *self, const PropertyValue &value)
   return 0;
 }
 
+static int set_Renderer_sample_sequence(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetSampleSequence((int) value.vector[0]);
+  return 0;
+}
+
+static int set_Renderer_sampled_light_count(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetSampledLightCount((int) value.vector[0]);
+  return 0;
+}
+
+static int set_Renderer_radiance_cache_cell_size(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetRadianceCacheCellSize(value.vector[0]);
+  return 0;
+}
+
+static int set_Renderer_transmittance_cache_cell_size(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetTransmittanceCacheCellSize(value.vector[0]);
+  return 0;
+}
+
+static int set_Renderer_caustic_photons(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetCausticPhotonCount((int) value.vector[0]);
+  return 0;
+}
+
+static int set_Renderer_caustic_photon_memory(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetCausticPhotonMemory(value.vector[0]);
+  return 0;
+}
+
+static int set_Renderer_caustic_radius(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetCausticRadius(value.vector[0]);
+  return 0;
+}
+
+static int set_Renderer_ray_streaming(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetRayStreaming((int) value.vector[0]);
+  return 0;
+}
+
 static int set_Renderer_cast_shadow(void *self, const PropertyValue &value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -145,6 +239,16 @@ static int set_Renderer_max_refract_depth(void *self, const PropertyValue &value
   return 0;
 }
 
+static int set_Renderer_ray_throughput_threshold(void *self, const PropertyValue &value)
+{
+  if (value.vector[0] < 0) {
+    return -1;
+  }
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetRayThroughputThreshold(value.vector[0]);
+  return 0;
+}
+
 static int set_Renderer_raymarch_step(void *self, const PropertyValue &value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -159,6 +263,13 @@ static int set_Renderer_raymarch_shadow_step(void *self, const PropertyValue &va
   return 0;
 }
 
+static int set_Renderer_shadow_transmittance(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetShadowTransmittance(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
 static int set_Renderer_raymarch_diffuse_step(void *self, const PropertyValue &value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -187,6 +298,221 @@ static int set_Renderer_sample_time_range(void *self, const PropertyValue &value
   return 0;
 }
 
+static int set_Renderer_progressive(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetProgressive(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_progressive_time_limit(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetProgressiveTimeLimit(Max(0, value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_progressive_max_samples(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetProgressiveMaxSamples(static_cast<int>(Max(0, value.vector[0])));
+  return 0;
+}
+
+static int set_Renderer_progressive_noise_threshold(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetProgressiveNoiseThreshold(Max(0, value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_checkpoint_file(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetCheckpointFile(value.string != NULL ? value.string : "");
+  return 0;
+}
+
+static int set_Renderer_checkpoint_interval(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetCheckpointInterval(Max(0, value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_output_file(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetOutputFile(value.string != NULL ? value.string : "");
+  return 0;
+}
+
+static int set_Renderer_aovs(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  return renderer->SetAOVs(value.string != NULL ? value.string : "");
+}
+
+static int set_Renderer_trace_file(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetTraceFile(value.string != NULL ? value.string : "");
+  return 0;
+}
+
+static int set_Renderer_estimate_file(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetEstimateFile(value.string != NULL ? value.string : "");
+  return 0;
+}
+
+static int set_Renderer_estimate_resolution_scale(void *self, const PropertyValue &value)
+{
+  if (value.vector[0] <= 0) {
+    return -1;
+  }
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetEstimateResolutionScale(value.vector[0]);
+  return 0;
+}
+
+static int set_Renderer_benchmark_file(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetBenchmarkFile(value.string != NULL ? value.string : "");
+  return 0;
+}
+
+static int set_Renderer_benchmark_thread_counts(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  return renderer->SetBenchmarkThreadCounts(value.string != NULL ? value.string : "");
+}
+
+static int set_Renderer_metrics_port(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetMetricsPort(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_profile(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetProfile(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_verbose(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetVerbose(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_output_channels(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetOutputChannels(value.string != NULL ? value.string : "");
+  return 0;
+}
+
+static int set_Renderer_denoised_file(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetDenoisedFile(value.string != NULL ? value.string : "");
+  return 0;
+}
+
+static int set_Renderer_farm_mode(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFarmMode(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_farm_address(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFarmAddress(value.string != NULL ? value.string : "127.0.0.1");
+  return 0;
+}
+
+static int set_Renderer_farm_port(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFarmPort(static_cast<int>(Max(1, value.vector[0])));
+  return 0;
+}
+
+static int set_Renderer_viewer_tile_encoding(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetViewerTileEncoding(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_preview_pass(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetPreviewPass(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_incremental_render(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetIncrementalRender(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_primary_hit_cache_memory(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetPrimaryHitCacheMemory(value.vector[0]);
+  return 0;
+}
+
+// the accuracy is shared by all renderers of the process
+static int set_Renderer_math_accuracy(void *self, const PropertyValue &value)
+{
+  MathSetAccuracy(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+// the cache is shared by all textures of the process
+static int set_Renderer_texture_cache_memory(void *self, const PropertyValue &value)
+{
+  const double megabytes = Max(1, value.vector[0]);
+  TileCacheGetGlobal().SetMemoryBudget(static_cast<std::size_t>(megabytes * 1024 * 1024));
+  return 0;
+}
+
+// threads reading tiles prefetched by shaders. 0 ignores prefetches
+static int set_Renderer_texture_io_threads(void *self, const PropertyValue &value)
+{
+  TileLoaderGetGlobal().SetThreadCount(static_cast<int>(Max(0, value.vector[0])));
+  return 0;
+}
+
+// mapped geometry files of the process are paged under the budget. 0 keeps
+// them resident. set before loading geometry for meshes to be paged
+static int set_Renderer_geometry_memory(void *self, const PropertyValue &value)
+{
+  const double megabytes = Max(0, value.vector[0]);
+  GeometryPagerGetGlobal().SetMemoryBudget(static_cast<std::size_t>(megabytes * 1024 * 1024));
+  return 0;
+}
+
+// the cache is shared by all displaced meshes of the process
+static int set_Renderer_tessellation_cache_memory(void *self, const PropertyValue &value)
+{
+  const double megabytes = Max(1, value.vector[0]);
+  TessellationCacheGetGlobal().SetMemoryBudget(static_cast<std::size_t>(megabytes * 1024 * 1024));
+  return 0;
+}
+
 static int set_Renderer_resolution(void *self, const PropertyValue &value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -201,6 +527,48 @@ static int set_Renderer_tilesize(void *self, const PropertyValue &value)
   return 0;
 }
 
+static int set_Renderer_auto_tilesize(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetAutoTileSize(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_tail_splitting(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetTailSplitting(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_framebuffer_format(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFrameBufferFormat(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_tiled_framebuffer(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetTiledFrameBuffer(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_framebuffer_file(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFrameBufferFile(value.string != NULL ? value.string : "");
+  return 0;
+}
+
+static int set_Renderer_tile_order(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetTileOrder(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
 static int set_Renderer_filterwidth(void *self, const PropertyValue &value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -208,6 +576,27 @@ static int set_Renderer_filterwidth(void *self, const PropertyValue &value)
   return 0;
 }
 
+static int set_Renderer_filter_type(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFilterType(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_filter_splatting(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFilterSplatting(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Renderer_filter_importance_sampling(void *self, const PropertyValue &value)
+{
+  Renderer *renderer = reinterpret_cast<Renderer *>(self);
+  renderer->SetFilterImportanceSampling(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
 static int set_Renderer_sampler_type(void *self, const PropertyValue &value)
 {
   Renderer *renderer = reinterpret_cast<Renderer *>(self);
@@ -347,6 +736,24 @@ static int set_Volume_bounds_max(void *self, const PropertyValue &value)
   return 0;
 }
 
+static int set_Volume_precision(void *self, const PropertyValue &value)
+{
+  Volume *volume = reinterpret_cast<Volume *>(self);
+  volume->SetPrecision(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Volume_file(void *self, const PropertyValue &value)
+{
+  Volume *volume = reinterpret_cast<Volume *>(self);
+
+  if (value.string == NULL)
+    return -1;
+
+  // sets resolution and bounds. bricks are read on first access
+  return VolumeInputFile(value.string).Read(*volume);
+}
+
 static int set_Light_intensity(void *self, const PropertyValue &value)
 {
   Light *light = reinterpret_cast<Light *>(self);
@@ -382,6 +789,27 @@ static int set_Light_environment_map(void *self, const PropertyValue &value)
   return 0;
 }
 
+static int set_Light_sh_irradiance(void *self, const PropertyValue &value)
+{
+  Light *light = reinterpret_cast<Light *>(self);
+  light->SetSHIrradiance(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Light_visible_sampling(void *self, const PropertyValue &value)
+{
+  Light *light = reinterpret_cast<Light *>(self);
+  light->SetVisibleSampling((bool) value.vector[0]);
+  return 0;
+}
+
+static int set_Light_adaptive_sampling(void *self, const PropertyValue &value)
+{
+  Light *light = reinterpret_cast<Light *>(self);
+  light->SetAdaptiveSampling((bool) value.vector[0]);
+  return 0;
+}
+
 static int set_Light_transform_order(void *self, const PropertyValue &value)
 {
   // TODO error handling
@@ -425,6 +853,196 @@ static int set_Light_scale(void *self, const PropertyValue &value)
   return 0;
 }
 
+// accelerator type has to be set before making object instances of it
+static int set_Accelerator_accelerator(void *self, const PropertyValue &value)
+{
+  if (value.string == NULL)
+    return -1;
+
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+  return replace_accelerator(acc, value.string);
+}
+
+// bvh properties apply to both binary and wide bvh
+static int set_Accelerator_bvh_build_mode(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  BVHAccelerator *bvh = dynamic_cast<BVHAccelerator *>(acc);
+  if (bvh != NULL)
+    return bvh->SetBuildMode((int) value.vector[0]);
+
+  QBVHAccelerator *qbvh = dynamic_cast<QBVHAccelerator *>(acc);
+  if (qbvh != NULL)
+    return qbvh->SetBuildMode((int) value.vector[0]);
+
+  return -1;
+}
+
+static int set_Accelerator_bvh_leaf_size(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  BVHAccelerator *bvh = dynamic_cast<BVHAccelerator *>(acc);
+  if (bvh != NULL)
+    return bvh->SetLeafSize((int) value.vector[0]);
+
+  QBVHAccelerator *qbvh = dynamic_cast<QBVHAccelerator *>(acc);
+  if (qbvh != NULL)
+    return qbvh->SetLeafSize((int) value.vector[0]);
+
+  return -1;
+}
+
+static int set_Accelerator_bvh_split_budget(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  BVHAccelerator *bvh = dynamic_cast<BVHAccelerator *>(acc);
+  if (bvh != NULL)
+    return bvh->SetSplitBudget(value.vector[0]);
+
+  QBVHAccelerator *qbvh = dynamic_cast<QBVHAccelerator *>(acc);
+  if (qbvh != NULL)
+    return qbvh->SetSplitBudget(value.vector[0]);
+
+  return -1;
+}
+
+static int set_Accelerator_bvh_mesh_clusters(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  BVHAccelerator *bvh = dynamic_cast<BVHAccelerator *>(acc);
+  if (bvh != NULL) {
+    bvh->SetMeshClusters(value.vector[0] != 0);
+    return 0;
+  }
+
+  return -1;
+}
+
+static int set_Accelerator_qbvh_compress_threshold(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  QBVHAccelerator *qbvh = dynamic_cast<QBVHAccelerator *>(acc);
+  if (qbvh != NULL)
+    return qbvh->SetCompressionThreshold(value.vector[0]);
+
+  return -1;
+}
+
+static int set_Accelerator_qbvh_node_layout(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  QBVHAccelerator *qbvh = dynamic_cast<QBVHAccelerator *>(acc);
+  if (qbvh != NULL)
+    return qbvh->SetNodeLayout((int) value.vector[0]);
+
+  return -1;
+}
+
+static int set_Accelerator_qbvh_prefetch(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  QBVHAccelerator *qbvh = dynamic_cast<QBVHAccelerator *>(acc);
+  if (qbvh != NULL) {
+    qbvh->SetPrefetch(value.vector[0] != 0);
+    return 0;
+  }
+
+  return -1;
+}
+
+static int set_Accelerator_bvh_cache_dir(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+  const std::string dir = value.string != NULL ? value.string : "";
+
+  BVHAccelerator *bvh = dynamic_cast<BVHAccelerator *>(acc);
+  if (bvh != NULL) {
+    bvh->SetCacheDirectory(dir);
+    return 0;
+  }
+
+  QBVHAccelerator *qbvh = dynamic_cast<QBVHAccelerator *>(acc);
+  if (qbvh != NULL) {
+    qbvh->SetCacheDirectory(dir);
+    return 0;
+  }
+
+  return -1;
+}
+
+// displacement properties only apply to meshes
+static int set_Accelerator_displacement_map(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  Mesh *mesh = dynamic_cast<Mesh *>(acc->GetPrimitiveSet());
+  if (mesh == NULL)
+    return -1;
+
+  mesh->SetDisplacementMap(value.texture);
+  return 0;
+}
+
+static int set_Accelerator_displacement_scale(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  Mesh *mesh = dynamic_cast<Mesh *>(acc->GetPrimitiveSet());
+  if (mesh == NULL)
+    return -1;
+
+  mesh->SetDisplacementScale(value.vector[0]);
+  return 0;
+}
+
+static int set_Accelerator_displacement_rate(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  Mesh *mesh = dynamic_cast<Mesh *>(acc->GetPrimitiveSet());
+  if (mesh == NULL)
+    return -1;
+
+  mesh->SetDisplacementRate(value.vector[0]);
+  return 0;
+}
+
+static int set_Accelerator_displacement_max_level(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  Mesh *mesh = dynamic_cast<Mesh *>(acc->GetPrimitiveSet());
+  if (mesh == NULL)
+    return -1;
+
+  mesh->SetDisplacementMaxLevel(static_cast<int>(value.vector[0]));
+  return 0;
+}
+
+static int set_Accelerator_lod_width(void *self, const PropertyValue &value)
+{
+  Accelerator *acc = reinterpret_cast<Accelerator *>(self);
+
+  Curve *curve = dynamic_cast<Curve *>(acc->GetPrimitiveSet());
+  if (curve != NULL) {
+    curve->SetLevelOfDetailWidth(value.vector[0]);
+    return 0;
+  }
+  PointCloud *ptc = dynamic_cast<PointCloud *>(acc->GetPrimitiveSet());
+  if (ptc != NULL) {
+    ptc->SetLevelOfDetailWidth(value.vector[0]);
+    return 0;
+  }
+  return -1;
+}
+
 #define END_OF_PROPERTY {PROP_NONE, NULL, {0, 0, 0, 0}, NULL}
 static const Property ObjectInstance_properties[] = {
   Property("transform_order", PropScalar(ORDER_SRT), set_ObjectInstance_transform_order),
@@ -435,6 +1053,10 @@ static const Property ObjectInstance_properties[] = {
   Property("reflect_target",  PropObjectGroup(NULL), set_ObjectInstance_reflect_target),
   Property("refract_target",  PropObjectGroup(NULL), set_ObjectInstance_refract_target),
   Property("shadow_target",   PropObjectGroup(NULL), set_ObjectInstance_shadow_target),
+  Property("visible_camera",  PropScalar(1),         set_ObjectInstance_visible_camera),
+  Property("visible_shadow",  PropScalar(1),         set_ObjectInstance_visible_shadow),
+  Property("visible_reflect", PropScalar(1),         set_ObjectInstance_visible_reflect),
+  Property("visible_refract", PropScalar(1),         set_ObjectInstance_visible_refract),
   Property()
 };
 
@@ -445,24 +1067,74 @@ static const Property Turbulence_properties[] = {
   Property("amplitude",  PropVector3(1, 1, 1), set_Turbulence_amplitude),
   Property("frequency",  PropVector3(1, 1, 1), set_Turbulence_frequency),
   Property("offset",     PropVector3(0, 0, 0), set_Turbulence_offset),
+  Property("bake_resolution", PropScalar(0),   set_Turbulence_bake_resolution),
   Property()
 };
 
 static const Property Renderer_properties[] = {
   Property("sample_jitter",         PropScalar(1),     set_Renderer_sample_jitter),
+  Property("sample_sequence",       PropScalar(0),     set_Renderer_sample_sequence),
+  Property("sampled_light_count",   PropScalar(0),     set_Renderer_sampled_light_count),
+  Property("radiance_cache_cell_size", PropScalar(0),  set_Renderer_radiance_cache_cell_size),
+  Property("transmittance_cache_cell_size", PropScalar(0), set_Renderer_transmittance_cache_cell_size),
+  Property("caustic_photons",       PropScalar(0),     set_Renderer_caustic_photons),
+  Property("caustic_photon_memory", PropScalar(64),    set_Renderer_caustic_photon_memory),
+  Property("caustic_radius",        PropScalar(0),     set_Renderer_caustic_radius),
+  Property("ray_streaming",         PropScalar(0),     set_Renderer_ray_streaming),
   Property("cast_shadow",           PropScalar(1),     set_Renderer_cast_shadow),
   Property("max_diffuse_depth",     PropScalar(3),     set_Renderer_max_diffuse_depth),
   Property("max_reflect_depth",     PropScalar(3),     set_Renderer_max_reflect_depth),
   Property("max_refract_depth",     PropScalar(3),     set_Renderer_max_refract_depth),
+  Property("ray_throughput_threshold", PropScalar(0),  set_Renderer_ray_throughput_threshold),
   Property("raymarch_step",         PropScalar(.05),   set_Renderer_raymarch_step),
   Property("raymarch_shadow_step",  PropScalar(.1),    set_Renderer_raymarch_shadow_step),
   Property("raymarch_diffuse_step", PropScalar(.1),    set_Renderer_raymarch_diffuse_step),
   Property("raymarch_reflect_step", PropScalar(.1),    set_Renderer_raymarch_reflect_step),
   Property("raymarch_refract_step", PropScalar(.1),    set_Renderer_raymarch_refract_step),
+  Property("shadow_transmittance",  PropScalar(0),     set_Renderer_shadow_transmittance),
   Property("sample_time_range",     PropVector2(0, 1), set_Renderer_sample_time_range),
+  Property("progressive",           PropScalar(0),  set_Renderer_progressive),
+  Property("progressive_time_limit", PropScalar(0), set_Renderer_progressive_time_limit),
+  Property("progressive_max_samples", PropScalar(64), set_Renderer_progressive_max_samples),
+  Property("progressive_noise_threshold", PropScalar(0), set_Renderer_progressive_noise_threshold),
+  Property("checkpoint_file",       PropString(NULL), set_Renderer_checkpoint_file),
+  Property("checkpoint_interval",   PropScalar(60),   set_Renderer_checkpoint_interval),
+  Property("output_file",           PropString(NULL), set_Renderer_output_file),
+  Property("output_channels",       PropString(NULL), set_Renderer_output_channels),
+  Property("denoised_file",         PropString(NULL), set_Renderer_denoised_file),
+  Property("aovs",                  PropString(NULL), set_Renderer_aovs),
+  Property("trace_file",            PropString(NULL), set_Renderer_trace_file),
+  Property("profile",               PropScalar(0),    set_Renderer_profile),
+  Property("verbose",               PropScalar(0),    set_Renderer_verbose),
+  Property("estimate_file",         PropString(NULL), set_Renderer_estimate_file),
+  Property("estimate_resolution_scale", PropScalar(.25), set_Renderer_estimate_resolution_scale),
+  Property("benchmark_file",        PropString(NULL), set_Renderer_benchmark_file),
+  Property("benchmark_thread_counts", PropString(NULL), set_Renderer_benchmark_thread_counts),
+  Property("metrics_port",          PropScalar(0),    set_Renderer_metrics_port),
+  Property("farm_mode",             PropScalar(0),    set_Renderer_farm_mode),
+  Property("farm_address",          PropString(NULL), set_Renderer_farm_address),
+  Property("farm_port",             PropScalar(50506), set_Renderer_farm_port),
+  Property("viewer_tile_encoding",  PropScalar(4),    set_Renderer_viewer_tile_encoding),
+  Property("preview_pass",          PropScalar(0),    set_Renderer_preview_pass),
+  Property("incremental_render",    PropScalar(0),    set_Renderer_incremental_render),
+  Property("primary_hit_cache_memory", PropScalar(0), set_Renderer_primary_hit_cache_memory),
+  Property("math_accuracy",         PropScalar(0),   set_Renderer_math_accuracy),
+  Property("texture_cache_memory",  PropScalar(256), set_Renderer_texture_cache_memory),
+  Property("texture_io_threads",    PropScalar(2),   set_Renderer_texture_io_threads),
+  Property("geometry_memory",       PropScalar(0),   set_Renderer_geometry_memory),
+  Property("tessellation_cache_memory", PropScalar(256), set_Renderer_tessellation_cache_memory),
   Property("resolution",            PropVector2(320, 240), set_Renderer_resolution),
   Property("tilesize",              PropVector2(32, 32),   set_Renderer_tilesize),
+  Property("auto_tilesize",         PropScalar(0),         set_Renderer_auto_tilesize),
+  Property("tile_order",            PropScalar(0),         set_Renderer_tile_order),
+  Property("tail_splitting",        PropScalar(0),         set_Renderer_tail_splitting),
+  Property("framebuffer_format",    PropScalar(0),         set_Renderer_framebuffer_format),
+  Property("tiled_framebuffer",     PropScalar(0),         set_Renderer_tiled_framebuffer),
+  Property("framebuffer_file",      PropString(NULL),      set_Renderer_framebuffer_file),
   Property("filterwidth",           PropVector2(2, 2),     set_Renderer_filterwidth),
+  Property("filter_type",           PropScalar(1),         set_Renderer_filter_type),
+  Property("filter_splatting",      PropScalar(0),         set_Renderer_filter_splatting),
+  Property("filter_importance_sampling", PropScalar(0),    set_Renderer_filter_importance_sampling),
   Property("sampler_type",          PropScalar(0),         set_Renderer_sampler_type),
   Property("pixelsamples",          PropVector2(3, 3),     set_Renderer_pixelsamples),
   Property("adaptive_max_subdivision", PropScalar(1), set_Renderer_adaptive_max_subdivision),
@@ -488,6 +1160,28 @@ static const Property Volume_properties[] = {
   Property("resolution", PropVector3(0, 0, 0), set_Volume_resolution),
   Property("bounds_min", PropVector3(0, 0, 0), set_Volume_bounds_min),
   Property("bounds_max", PropVector3(0, 0, 0), set_Volume_bounds_max),
+  Property("file",       PropString(NULL),     set_Volume_file),
+  Property("precision",  PropScalar(0),        set_Volume_precision),
+  Property()
+};
+
+// properties for primitive sets (Mesh, Curve and PointCloud) are applied to
+// the accelerator bound to them
+static const Property Accelerator_properties[] = {
+  Property("accelerator",             PropString(NULL),                               set_Accelerator_accelerator),
+  Property("bvh_build_mode",          PropScalar(BVH_BUILD_MEDIAN),                   set_Accelerator_bvh_build_mode),
+  Property("bvh_leaf_size",           PropScalar(4),                                  set_Accelerator_bvh_leaf_size),
+  Property("bvh_split_budget",        PropScalar(BVH_DEFAULT_SPLIT_BUDGET),           set_Accelerator_bvh_split_budget),
+  Property("bvh_mesh_clusters",       PropScalar(1),                                  set_Accelerator_bvh_mesh_clusters),
+  Property("qbvh_compress_threshold", PropScalar(QBVH_DEFAULT_COMPRESSION_THRESHOLD), set_Accelerator_qbvh_compress_threshold),
+  Property("qbvh_node_layout",        PropScalar(QBVH_LAYOUT_CLUSTERED),              set_Accelerator_qbvh_node_layout),
+  Property("qbvh_prefetch",           PropScalar(1),                                  set_Accelerator_qbvh_prefetch),
+  Property("bvh_cache_dir",           PropString(NULL),                               set_Accelerator_bvh_cache_dir),
+  Property("displacement_map",        PropTexture(NULL),                              set_Accelerator_displacement_map),
+  Property("displacement_scale",      PropScalar(1),                                  set_Accelerator_displacement_scale),
+  Property("displacement_rate",       PropScalar(1),                                  set_Accelerator_displacement_rate),
+  Property("displacement_max_level",  PropScalar(MESH_DEFAULT_DISPLACEMENT_MAX_LEVEL), set_Accelerator_displacement_max_level),
+  Property("lod_width",               PropScalar(0),                                  set_Accelerator_lod_width),
   Property()
 };
 
@@ -502,6 +1196,9 @@ static const Property Light_properties[] = {
   Property("sample_count",    PropScalar(16),        set_Light_sample_count),
   Property("double_sided",    PropScalar(0),         set_Light_double_sided),
   Property("environment_map", PropTexture(NULL),     set_Light_environment_map),
+  Property("sh_irradiance",   PropScalar(0),         set_Light_sh_irradiance),
+  Property("visible_sampling", PropScalar(0),        set_Light_visible_sampling),
+  Property("adaptive_sampling", PropScalar(0),       set_Light_adaptive_sampling),
   Property()
 };
 
@@ -524,6 +1221,20 @@ DEFINE_GET_ENTRY_FUNC(Renderer)
 DEFINE_GET_ENTRY_FUNC(Camera)
 DEFINE_GET_ENTRY_FUNC(Volume)
 DEFINE_GET_ENTRY_FUNC(Light)
+
+#define DEFINE_GET_ACCELERATOR_FUNC(primset) \
+void *get_##primset##_accelerator(const Scene *scene, int index) { \
+  const ID accel_id = find_accelerator_from(encode_id(Type_##primset, index)); \
+  const Entry accel_entry = decode_id(accel_id); \
+  if (accel_entry.type != Type_Accelerator) return NULL; \
+  return (void *) scene->GetAccelerator(accel_entry.index); \
+}
+#define ACCELERATOR_PROPERTY_DESC(type) \
+  {Type_##type, #type, Accelerator_properties, get_##type##_accelerator}
+DEFINE_GET_ACCELERATOR_FUNC(PointCloud)
+DEFINE_GET_ACCELERATOR_FUNC(Curve)
+DEFINE_GET_ACCELERATOR_FUNC(Mesh)
+
 static const property_desc property_desc_list[] = {
   PROPERTY_DESC(ObjectInstance),
   PROPERTY_DESC(Turbulence),
@@ -531,10 +1242,15 @@ static const property_desc property_desc_list[] = {
   PROPERTY_DESC(Camera),
   PROPERTY_DESC(Volume),
   PROPERTY_DESC(Light),
+  ACCELERATOR_PROPERTY_DESC(PointCloud),
+  ACCELERATOR_PROPERTY_DESC(Curve),
+  ACCELERATOR_PROPERTY_DESC(Mesh),
   {Type_Begin, NULL, NULL, NULL}
 };
 #undef DEFINE_GET_ENTRY_FUNC
+#undef DEFINE_GET_ACCELERATOR_FUNC
 #undef PROPERTY_DESC
+#undef ACCELERATOR_PROPERTY_DESC
 
 static void *get_builtin_type_entry(Scene *scene, const Entry &entry)
 {
@@ -560,6 +1276,30 @@ static const Property *get_builtin_type_property_list(int entry_type)
   return NULL;
 }
 
+static std::vector<PropertyTable> make_builtin_type_property_tables()
+{
+  std::vector<PropertyTable> tables;
+
+  for (const property_desc *desc = property_desc_list; desc->type_name != NULL; desc++) {
+    tables.push_back(PropertyTable(desc->property_list));
+  }
+  return tables;
+}
+
+static const PropertyTable *get_builtin_type_property_table(int entry_type)
+{
+  // built once for all scenes in the order of property_desc_list
+  static const std::vector<PropertyTable> tables = make_builtin_type_property_tables();
+  int i = 0;
+
+  for (const property_desc *desc = property_desc_list; desc->type_name != NULL; desc++, i++) {
+    if (desc->entry_type == entry_type) {
+      return &tables[i];
+    }
+  }
+  return NULL;
+}
+
 static int get_builtin_type_by_name(const char *builtin_type_name)
 {
   const property_desc *desc = NULL;
@@ -605,13 +1345,13 @@ static const Property *get_property_list(const char *type_name)
   }
 }
 
-static const Property *get_property_list(const Entry &entry)
+static const PropertyTable *get_property_table(const Entry &entry)
 {
   // builtin type properties
-  const Property *builtin_props = get_builtin_type_property_list(entry.type);
+  const PropertyTable *builtin_table = get_builtin_type_property_table(entry.type);
 
-  if (builtin_props != NULL) {
-    return builtin_props;
+  if (builtin_table != NULL) {
+    return builtin_table;
   }
 
   // plugin type properties
@@ -622,6 +1362,6 @@ static const Property *get_property_list(const Entry &entry)
   if (plugin == NULL) {
     return NULL;
   } else {
-    return plugin->GetPropertyList();
+    return &plugin->GetPropertyTable();
   }
 }
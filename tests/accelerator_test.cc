@@ -0,0 +1,914 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_bvh_accelerator.h"
+#include "fj_bvh_cache.h"
+#include "fj_grid_accelerator.h"
+#include "fj_intersection.h"
+#include "fj_mesh.h"
+#include "fj_procedure.h"
+#include "fj_qbvh_accelerator.h"
+#include "fj_random.h"
+#include "fj_ray.h"
+#include <cstdio>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+using namespace fj;
+
+// a row of points along x counting how many times it ran
+class PointRowProcedure : public Procedure {
+public:
+  PointRowProcedure(PointCloud *ptc) : run_count(0), result(0), ptc_(ptc) {}
+  virtual ~PointRowProcedure() {}
+
+  mutable int run_count;
+  // returned by run
+  int result;
+
+private:
+  virtual int run() const
+  {
+    run_count++;
+    ptc_->SetPointCount(10);
+    ptc_->AddPointPosition();
+    ptc_->AddPointRadius();
+    for (int i = 0; i < 10; i++) {
+      ptc_->SetPointPosition(i, Vector(i, 0, 0));
+      ptc_->SetPointRadius(i, .25);
+    }
+    ptc_->ComputeBounds();
+    return result;
+  }
+
+  PointCloud *ptc_;
+};
+
+// small random triangles crowded around a corner and sparse elsewhere so
+// that trees are uneven
+static void make_triangle_soup(Mesh *mesh, int nfaces, bool moving)
+{
+  XorShift rng(nfaces);
+  mesh->SetPointCount(3 * nfaces);
+  mesh->AddPointPosition();
+  if (moving) {
+    mesh->AddPointVelocity();
+  }
+  for (int i = 0; i < 3 * nfaces; i += 3) {
+    const Vector center = i % 4 == 0 ?
+        10 * rng.NextVector01() : Vector(1, 1, 1) + rng.NextVector01();
+    for (int j = 0; j < 3; j++) {
+      mesh->SetPointPosition(i + j, center + .5 * (rng.NextVector01() - Vector(.5, .5, .5)));
+      if (moving) {
+        mesh->SetPointVelocity(i + j, 2 * (rng.NextVector01() - Vector(.5, .5, .5)));
+      }
+    }
+  }
+  mesh->SetFaceCount(nfaces);
+  mesh->AddFaceIndices();
+  for (int i = 0; i < nfaces; i++) {
+    mesh->SetFaceIndices(i, Index3(3 * i, 3 * i + 1, 3 * i + 2));
+  }
+  mesh->ComputeBounds();
+}
+
+// closest hit of all primitives tested one by one
+static bool brute_force_intersect(const PrimitiveSet &primset, const Ray &ray,
+    Real time, Intersection *isect)
+{
+  bool hit = false;
+  isect->t_hit = REAL_MAX;
+  for (Index i = 0; i < primset.GetPrimitiveCount(); i++) {
+    Intersection isect_tmp;
+    if (primset.RayIntersect(i, ray, time, &isect_tmp) && isect_tmp.t_hit < isect->t_hit) {
+      *isect = isect_tmp;
+      hit = true;
+    }
+  }
+  return hit;
+}
+
+// rays from random points in the bounds toward the centers of random
+// primitives. returns the number of rays whose closest hit or occlusion
+// differ from brute force
+static int count_mismatches(const Accelerator &acc, const PrimitiveSet &primset,
+    Real time, int *hit_count)
+{
+  Box bounds;
+  primset.GetEntireBounds(&bounds);
+  const Vector size = bounds.max - bounds.min;
+  XorShift rng;
+  int mismatch_count = 0;
+  *hit_count = 0;
+
+  for (int i = 0; i < 500; i++) {
+    Box prim_bounds;
+    primset.GetPrimitiveBounds(rng.NextInteger() % primset.GetPrimitiveCount(), &prim_bounds);
+    Ray ray;
+    ray.orig = bounds.min + size * rng.NextVector01();
+    ray.dir = Normalize(prim_bounds.Centroid() - ray.orig);
+
+    Intersection isect_acc;
+    Intersection isect_brute;
+    Intersection isect_occ;
+    const bool hit_acc = acc.Intersect(ray, time, &isect_acc);
+    const bool hit_brute = brute_force_intersect(primset, ray, time, &isect_brute);
+    if (hit_acc != hit_brute ||
+        (hit_acc && (isect_acc.prim_id != isect_brute.prim_id ||
+                     std::abs(isect_acc.t_hit - isect_brute.t_hit) > 1e-6)) ||
+        acc.Occlude(ray, time, &isect_occ) != hit_brute) {
+      mismatch_count++;
+    }
+    *hit_count += hit_brute;
+  }
+  return mismatch_count;
+}
+
+int main()
+{
+  {
+    // median and sah trees find the closest hits brute force finds
+    Mesh mesh;
+    make_triangle_soup(&mesh, 300, false);
+    const int modes[] = {BVH_BUILD_MEDIAN, BVH_BUILD_SAH};
+    int mismatch_count = 0;
+    int hit_count = 0;
+    for (int i = 0; i < 2; i++) {
+      BVHAccelerator bvh;
+      bvh.SetPrimitiveSet(&mesh);
+      bvh.SetBuildMode(modes[i]);
+      bvh.SetMeshClusters(false);
+      bvh.Build();
+      int hits = 0;
+      mismatch_count += count_mismatches(bvh, mesh, 0, &hits);
+      hit_count += hits;
+    }
+    TEST(hit_count > 100);
+    TEST_INT(mismatch_count, 0);
+  }
+
+  {
+    // leaves of many primitives and clusters of their vertices find the
+    // closest hits and as many hits along rays as brute force
+    Mesh mesh;
+    make_triangle_soup(&mesh, 300, false);
+    const int leaf_sizes[] = {1, 4, 8};
+    int mismatch_count = 0;
+    int hit_count = 0;
+    int all_mismatch_count = 0;
+    for (int i = 0; i < 3; i++) {
+      BVHAccelerator bvh;
+      bvh.SetPrimitiveSet(&mesh);
+      bvh.SetBuildMode(BVH_BUILD_SAH);
+      bvh.SetLeafSize(leaf_sizes[i]);
+      bvh.SetMeshClusters(i == 2);
+      bvh.Build();
+      int hits = 0;
+      mismatch_count += count_mismatches(bvh, mesh, 0, &hits);
+      hit_count += hits;
+
+      Ray ray;
+      ray.orig = Vector(-1, -1, -1);
+      for (int j = 0; j < 50; j++) {
+        Box prim_bounds;
+        mesh.GetPrimitiveBounds(7 * j, &prim_bounds);
+        ray.dir = Normalize(prim_bounds.Centroid() - ray.orig);
+        HitList hits_bvh;
+        bvh.IntersectAll(ray, 0, &hits_bvh);
+        int brute_count = 0;
+        for (Index k = 0; k < mesh.GetPrimitiveCount(); k++) {
+          Intersection isect;
+          brute_count += mesh.RayIntersect(k, ray, 0, &isect);
+        }
+        all_mismatch_count += hits_bvh.GetCount() !=
+            Min(brute_count, static_cast<int>(HitList::MAX_HIT_COUNT));
+      }
+    }
+    TEST(hit_count > 300);
+    TEST_INT(mismatch_count, 0);
+    TEST_INT(all_mismatch_count, 0);
+  }
+
+  {
+    // 4-wide trees find the closest hits and packets of hits brute force finds
+    Mesh mesh;
+    make_triangle_soup(&mesh, 300, false);
+    QBVHAccelerator qbvh;
+    qbvh.SetPrimitiveSet(&mesh);
+    TEST_INT(qbvh.Build(), 0);
+    int hit_count = 0;
+    TEST_INT(count_mismatches(qbvh, mesh, 0, &hit_count), 0);
+    TEST(hit_count > 100);
+
+    Ray rays[RAY_PACKET_SIZE];
+    Real times[RAY_PACKET_SIZE];
+    Intersection isects[RAY_PACKET_SIZE];
+    unsigned int brute_mask = 0;
+    for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+      Box prim_bounds;
+      mesh.GetPrimitiveBounds(11 * i, &prim_bounds);
+      rays[i].orig = Vector(5, 5, -5);
+      rays[i].dir = Normalize(prim_bounds.Centroid() - rays[i].orig);
+      times[i] = 0;
+      Intersection isect;
+      if (brute_force_intersect(mesh, rays[i], 0, &isect)) {
+        brute_mask |= 1u << i;
+      }
+    }
+    TEST(qbvh.IntersectPacket(rays, times, RAY_PACKET_SIZE, isects) == brute_mask);
+  }
+
+  {
+    // trees of bounds at shutter open and close find the hits of moving
+    // triangles at any time brute force finds
+    Mesh mesh;
+    make_triangle_soup(&mesh, 300, true);
+    BVHAccelerator bvh;
+    bvh.SetPrimitiveSet(&mesh);
+    TEST_INT(bvh.Build(), 0);
+    TEST(bvh.HasMotion());
+    int mismatch_count = 0;
+    int hit_count = 0;
+    for (int i = 0; i < 3; i++) {
+      int hits = 0;
+      mismatch_count += count_mismatches(bvh, mesh, .5 * i, &hits);
+      hit_count += hits;
+    }
+    TEST(hit_count > 300);
+    TEST_INT(mismatch_count, 0);
+  }
+
+  {
+    // precomputed triangles are built only by accelerators using them
+    Mesh mesh;
+    make_triangle_soup(&mesh, 300, false);
+    const std::size_t mesh_memory = mesh.GetMemoryUsage();
+    BVHAccelerator clustered;
+    clustered.SetPrimitiveSet(&mesh);
+    TEST_INT(clustered.Build(), 0);
+    TEST(mesh.GetMemoryUsage() == mesh_memory);
+    GridAccelerator grid;
+    grid.SetPrimitiveSet(&mesh);
+    TEST_INT(grid.Build(), 0);
+    TEST(mesh.GetMemoryUsage() > mesh_memory);
+    int hit_count = 0;
+    TEST_INT(count_mismatches(grid, mesh, 0, &hit_count), 0);
+    mesh.ReleasePrecomputedTriangles();
+    TEST(mesh.GetMemoryUsage() == mesh_memory);
+  }
+
+  {
+    // deferred procedure runs once the first ray enters bounds
+    PointCloud ptc;
+    PointRowProcedure procedure(&ptc);
+    BVHAccelerator acc;
+    acc.SetPrimitiveSet(&ptc);
+    acc.SetDeferredProcedure(&procedure, Box(Vector(-1, -1, -1), Vector(10, 1, 1)));
+    acc.ComputeBounds();
+    TEST_INT(acc.Build(), 0);
+    TEST(acc.IsDeferred());
+    TEST(acc.GetBounds().max.x >= 10);
+
+    Ray ray;
+    ray.orig = Vector(3, 5, 5);
+    ray.dir = Vector(0, 0, 1);
+    Intersection isect;
+    TEST(!acc.Intersect(ray, 0, &isect));
+    TEST_INT(procedure.run_count, 0);
+
+    ray.orig = Vector(3, 0, -5);
+    TEST(acc.Intersect(ray, 0, &isect));
+    TEST_INT(procedure.run_count, 1);
+    TEST(!acc.IsDeferred());
+    TEST_INT(isect.prim_id, 3);
+    TEST(std::abs(isect.t_hit - 4.75) < 1e-9);
+
+    ray.orig = Vector(7, 0, -5);
+    TEST(acc.Intersect(ray, 0, &isect));
+    TEST_INT(procedure.run_count, 1);
+    TEST_INT(isect.prim_id, 7);
+  }
+
+  {
+    // a failed deferred procedure runs once and rays miss the accelerator
+    PointCloud ptc;
+    PointRowProcedure procedure(&ptc);
+    procedure.result = -1;
+    BVHAccelerator acc;
+    acc.SetPrimitiveSet(&ptc);
+    acc.SetDeferredProcedure(&procedure, Box(Vector(-1, -1, -1), Vector(10, 1, 1)));
+    acc.ComputeBounds();
+
+    Ray ray;
+    ray.orig = Vector(3, 0, -5);
+    ray.dir = Vector(0, 0, 1);
+    Intersection isect;
+    TEST(!acc.Intersect(ray, 0, &isect));
+    TEST(!acc.Occlude(ray, 0, &isect));
+    TEST_INT(procedure.run_count, 1);
+    TEST(acc.IsDeferred());
+    TEST(!acc.HasBuilt());
+    TEST_INT(acc.Expand(), -1);
+    TEST_INT(procedure.run_count, 1);
+  }
+
+  {
+    // rays of threads entering a deferred accelerator together all hit
+    // the built tree and the procedure runs once
+    PointCloud ptc;
+    PointRowProcedure procedure(&ptc);
+    BVHAccelerator acc;
+    acc.SetPrimitiveSet(&ptc);
+    acc.SetDeferredProcedure(&procedure, Box(Vector(-1, -1, -1), Vector(10, 1, 1)));
+    acc.ComputeBounds();
+
+    const int THREAD_COUNT = 8;
+    std::vector<int> hit_ids(THREAD_COUNT, -1);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREAD_COUNT; i++) {
+      threads.push_back(std::thread([&acc, &hit_ids, i]() {
+        Ray ray;
+        ray.orig = Vector(i, 0, -5);
+        ray.dir = Vector(0, 0, 1);
+        Intersection isect;
+        if (acc.Intersect(ray, 0, &isect)) {
+          hit_ids[i] = isect.prim_id;
+        }
+      }));
+    }
+    for (std::size_t i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < THREAD_COUNT; i++) {
+      mismatches += hit_ids[i] != i;
+    }
+    TEST_INT(mismatches, 0);
+    TEST_INT(procedure.run_count, 1);
+    TEST(!acc.IsDeferred());
+  }
+
+  {
+    // trees of the cache directory refer to the mapped file
+    PointCloud ptc;
+    PointRowProcedure procedure(&ptc);
+    procedure.Run();
+    BVHAccelerator built, mapped;
+    built.SetPrimitiveSet(&ptc);
+    mapped.SetPrimitiveSet(&ptc);
+    built.SetCacheDirectory("/tmp");
+    mapped.SetCacheDirectory("/tmp");
+    const std::string filename = BvhGetCacheFilename("/tmp", BvhComputeCacheKey(ptc,
+        built.GetBuildMode(), built.GetLeafSize(), built.GetSplitBudget()));
+    remove(filename.c_str());
+
+    TEST_INT(built.Build(), 0);
+    TEST_INT(built.GetMemoryUsage(), 0);
+    TEST_INT(mapped.Build(), 0);
+    TEST_INT(mapped.GetMemoryUsage(), 0);
+    TEST_INT(mapped.GetNodeCount(), built.GetNodeCount());
+
+    Ray ray;
+    ray.orig = Vector(6, 0, -5);
+    ray.dir = Vector(0, 0, 1);
+    Intersection isect;
+    TEST(mapped.Intersect(ray, 0, &isect));
+    TEST_INT(isect.prim_id, 6);
+
+    // refit copies the nodes
+    TEST_INT(mapped.Refit(), 0);
+    TEST(mapped.GetMemoryUsage() > 0);
+    remove(filename.c_str());
+  }
+  {
+    // trees read from the cache find the hits brute force finds and
+    // writers of the same key at once leave a valid file
+    Mesh mesh;
+    make_triangle_soup(&mesh, 300, false);
+    BVHAccelerator built;
+    built.SetPrimitiveSet(&mesh);
+    built.SetCacheDirectory("/tmp");
+    built.SetMeshClusters(false);
+    const uint64_t key = BvhComputeCacheKey(mesh,
+        built.GetBuildMode(), built.GetLeafSize(), built.GetSplitBudget());
+    const std::string filename = BvhGetCacheFilename("/tmp", key);
+    remove(filename.c_str());
+    TEST_INT(built.Build(), 0);
+
+    BVHAccelerator cached;
+    cached.SetPrimitiveSet(&mesh);
+    cached.SetCacheDirectory("/tmp");
+    cached.SetMeshClusters(false);
+    TEST_INT(cached.Build(), 0);
+    int hit_count = 0;
+    TEST_INT(count_mismatches(cached, mesh, 0, &hit_count), 0);
+    TEST(hit_count > 100);
+
+    std::vector<BVHNode> nodes;
+    std::vector<Index> prim_indices;
+    TEST_INT(BvhReadCache(filename, key, mesh.GetPrimitiveCount(), &nodes, &prim_indices), 0);
+    std::vector<std::thread> writers;
+    for (int i = 0; i < 4; i++) {
+      writers.push_back(std::thread([&]() {
+        for (int j = 0; j < 20; j++) {
+          BvhWriteCache(filename, key, nodes, prim_indices);
+        }
+      }));
+    }
+    for (int i = 0; i < 4; i++) {
+      writers[i].join();
+    }
+    std::vector<BVHNode> nodes_read;
+    std::vector<Index> indices_read;
+    TEST_INT(BvhReadCache(filename, key, mesh.GetPrimitiveCount(), &nodes_read, &indices_read), 0);
+    TEST(nodes_read.size() == nodes.size());
+    remove(filename.c_str());
+  }
+  {
+    // edited geometry is rebuilt by Update or refit keeping the tree
+    PointCloud ptc;
+    PointRowProcedure procedure(&ptc);
+    procedure.Run();
+    BVHAccelerator acc;
+    acc.SetPrimitiveSet(&ptc);
+    TEST_INT(acc.GetMemoryUsage(), 0);
+    TEST_INT(acc.Update(), 0);
+    TEST(acc.IsUpToDate());
+    TEST(acc.GetMemoryUsage() >= 10 * sizeof(Index));
+    TEST(ptc.GetMemoryUsage() >= 10 * (sizeof(CompactVector) + sizeof(CompactReal)));
+
+    for (int i = 0; i < 10; i++) {
+      ptc.SetPointPosition(i, Vector(i, 2, 0));
+    }
+    ptc.ComputeBounds();
+    TEST(!acc.IsUpToDate());
+    TEST_INT(acc.Update(), 0);
+    TEST(acc.IsUpToDate());
+
+    Ray ray;
+    ray.orig = Vector(4, 2, -5);
+    ray.dir = Vector(0, 0, 1);
+    Intersection isect;
+    TEST(acc.Intersect(ray, 0, &isect));
+    TEST_INT(isect.prim_id, 4);
+    TEST(acc.Occlude(ray, 0, &isect));
+    ray.tmax = 4;
+    TEST(!acc.Occlude(ray, 0, &isect));
+    ray.tmax = REAL_MAX;
+
+    const int node_count = acc.GetNodeCount();
+    for (int i = 0; i < 10; i++) {
+      ptc.SetPointPosition(i, Vector(i, -3, 0));
+    }
+    ptc.ComputeBounds();
+    TEST_INT(acc.Refit(), 0);
+    TEST_INT(acc.GetNodeCount(), node_count);
+    ray.orig = Vector(4, -3, -5);
+    TEST(acc.Intersect(ray, 0, &isect));
+    TEST_INT(isect.prim_id, 4);
+
+    // moved points are refit by Update
+    for (int i = 0; i < 10; i++) {
+      ptc.SetPointPosition(i, Vector(i, 1, 0));
+    }
+    ptc.ComputeBounds();
+    TEST_INT(acc.Update(), 0);
+    TEST(acc.WasRefit());
+    TEST(acc.IsUpToDate());
+
+    // shuffled points make the refit tree much worse and are rebuilt
+    for (int i = 0; i < 10; i++) {
+      ptc.SetPointPosition(i, Vector((3 * i) % 10, 1, 0));
+    }
+    ptc.ComputeBounds();
+    TEST_INT(acc.Update(), 0);
+    TEST(!acc.WasRefit());
+    ray.orig = Vector(2, 1, -5);
+    TEST(acc.Intersect(ray, 0, &isect));
+    TEST_INT(isect.prim_id, 4);
+  }
+
+  {
+    // simplified points are fewer and larger and rebuilt by Update
+    PointCloud ptc;
+    ptc.SetPointCount(10000);
+    ptc.AddPointPosition();
+    ptc.AddPointRadius();
+    for (int i = 0; i < 10000; i++) {
+      ptc.SetPointPosition(i, Vector(i % 100, i / 100, 0));
+      ptc.SetPointRadius(i, .1);
+    }
+    ptc.ComputeBounds();
+    BVHAccelerator acc;
+    acc.SetPrimitiveSet(&ptc);
+    TEST_INT(acc.Update(), 0);
+
+    // no lod width keeps all points
+    TEST(!ptc.Simplify(1));
+    ptc.SetLevelOfDetailWidth(1);
+    TEST(ptc.Simplify(1));
+    TEST(!ptc.Simplify(1));
+    TEST(!acc.IsUpToDate());
+    TEST_INT(acc.Update(), 0);
+
+    // kept for 1/25 of the area, stepped down to a quarter octave
+    const int kept = ptc.GetKeptPointCount();
+    TEST(kept > 250 && kept < 500);
+
+    int hit_count = 0;
+    Real t_max = 0;
+    for (int i = 0; i < 10000; i++) {
+      Ray ray;
+      ray.orig = Vector(i % 100, i / 100, -5);
+      ray.dir = Vector(0, 0, 1);
+      Intersection isect;
+      if (acc.Intersect(ray, 0, &isect)) {
+        hit_count++;
+        t_max = Max(t_max, isect.t_hit);
+      }
+    }
+    TEST_INT(hit_count, kept);
+    TEST(t_max < 5 - .1 * 5);
+
+    TEST(ptc.Simplify(0));
+    TEST_INT(ptc.GetKeptPointCount(), 10000);
+  }
+
+  {
+    // the grid finds the same closest hits as the bvh on points
+    // overlapping many cells and each other
+    PointCloud ptc;
+    ptc.SetPointCount(10);
+    ptc.AddPointPosition();
+    ptc.AddPointRadius();
+    for (int i = 0; i < 10; i++) {
+      ptc.SetPointPosition(i, Vector(i, .1 * i, 0));
+      ptc.SetPointRadius(i, .9);
+    }
+    ptc.ComputeBounds();
+    BVHAccelerator bvh;
+    bvh.SetPrimitiveSet(&ptc);
+    TEST_INT(bvh.Build(), 0);
+    GridAccelerator grid;
+    grid.SetPrimitiveSet(&ptc);
+    TEST_INT(grid.Build(), 0);
+    TEST(grid.GetMemoryUsage() >= 10 * sizeof(Index));
+
+    // every primitive is in a leaf of either tree
+    AcceleratorStats bvh_stats;
+    TEST_INT(bvh.Analyze(&bvh_stats), 0);
+    TEST(bvh_stats.reference_count == 10);
+    TEST(bvh_stats.leaf_count == bvh_stats.interior_count + 1);
+    TEST(bvh_stats.sah_cost > 1);
+    TEST(bvh_stats.overlap_ratio > 0);
+    AcceleratorStats grid_stats;
+    TEST_INT(grid.Analyze(&grid_stats), 0);
+    TEST(grid_stats.reference_count >= 10);
+    TEST(grid_stats.max_depth == 1);
+
+    for (int i = 0; i < 20; i++) {
+
+      Ray ray;
+      ray.orig = Vector(.5 * i - .25, .05 * i, -5);
+      ray.dir = Normalize(Vector(.1, 0, 1));
+      Intersection isect_bvh;
+      Intersection isect_grid;
+      const bool hit_bvh = bvh.Intersect(ray, 0, &isect_bvh);
+      const bool hit_grid = grid.Intersect(ray, 0, &isect_grid);
+      TEST(hit_bvh == hit_grid);
+      if (hit_bvh && hit_grid) {
+        TEST_INT(isect_grid.prim_id, isect_bvh.prim_id);
+        TEST(std::abs(isect_grid.t_hit - isect_bvh.t_hit) < 1e-9);
+      }
+    }
+
+    Ray ray;
+    ray.orig = Vector(-5, 0, 0);
+    ray.dir = Vector(1, 0, 0);
+    Intersection isect;
+    TEST(grid.Intersect(ray, 0, &isect));
+    TEST_INT(isect.prim_id, 0);
+  }
+
+  {
+    // compressed wide nodes find the same closest hits as full ones
+    PointCloud ptc;
+    ptc.SetPointCount(100);
+    ptc.AddPointPosition();
+    ptc.AddPointRadius();
+    for (int i = 0; i < 100; i++) {
+      ptc.SetPointPosition(i, Vector(i % 10 + 1000, .3 * (i / 10), .01 * i));
+      ptc.SetPointRadius(i, .2);
+    }
+    ptc.ComputeBounds();
+    QBVHAccelerator qbvh;
+    qbvh.SetPrimitiveSet(&ptc);
+    qbvh.SetLeafSize(1);
+    TEST_INT(qbvh.Build(), 0);
+    TEST(!qbvh.IsCompressed());
+    QBVHAccelerator compressed;
+    compressed.SetPrimitiveSet(&ptc);
+    compressed.SetLeafSize(1);
+    TEST_INT(compressed.SetCompressionThreshold(-1), -1);
+    TEST_INT(compressed.SetCompressionThreshold(0), 0);
+    TEST_INT(compressed.Build(), 0);
+    TEST(compressed.IsCompressed());
+    TEST_INT(compressed.GetNodeCount(), qbvh.GetNodeCount());
+
+    int mismatch_count = 0;
+    int hit_count = 0;
+    for (int i = 0; i < 200; i++) {
+      Ray ray;
+      ray.orig = Vector(.05 * i + 999.5, .015 * i - .1, -5);
+      ray.dir = Vector(0, 0, 1);
+      Intersection isect_qbvh;
+      Intersection isect_compressed;
+      const bool hit_qbvh = qbvh.Intersect(ray, 0, &isect_qbvh);
+      const bool hit_compressed = compressed.Intersect(ray, 0, &isect_compressed);
+      if (hit_qbvh != hit_compressed ||
+          (hit_qbvh && isect_qbvh.prim_id != isect_compressed.prim_id) ||
+          hit_qbvh != compressed.Occlude(ray, 0, &isect_compressed)) {
+        mismatch_count++;
+      }
+      hit_count += hit_qbvh;
+    }
+    TEST(hit_count > 50);
+    TEST_INT(mismatch_count, 0);
+  }
+
+  {
+    // closest hits along the row in one traversal and by stepping
+    PointCloud ptc;
+    PointRowProcedure procedure(&ptc);
+    procedure.Run();
+    BVHAccelerator bvh;
+    bvh.SetPrimitiveSet(&ptc);
+    TEST_INT(bvh.Build(), 0);
+    GridAccelerator grid;
+    grid.SetPrimitiveSet(&ptc);
+    TEST_INT(grid.Build(), 0);
+
+    Ray ray;
+    ray.orig = Vector(-5, 0, 0);
+    ray.dir = Vector(1, 0, 0);
+    HitList hits_bvh;
+    HitList hits_grid;
+    TEST(bvh.IntersectAll(ray, 0, &hits_bvh));
+    TEST(grid.IntersectAll(ray, 0, &hits_grid));
+    TEST_INT(hits_bvh.GetCount(), HitList::MAX_HIT_COUNT);
+    TEST_INT(hits_grid.GetCount(), HitList::MAX_HIT_COUNT);
+
+    bool all_sorted = true;
+    for (int i = 0; i < HitList::MAX_HIT_COUNT; i++) {
+      all_sorted = all_sorted &&
+          hits_bvh.Get(i).prim_id == i && hits_grid.Get(i).prim_id == i &&
+          std::abs(hits_bvh.Get(i).t_hit - (4.75 + i)) < 1e-9;
+    }
+    TEST(all_sorted);
+    TEST(std::abs(hits_bvh.Get(0).P.x - -.25) < 1e-9);
+
+    // continues past the hits found
+    ray.tmin = 10;
+    HitList hits_next;
+    TEST(bvh.IntersectAll(ray, 0, &hits_next));
+    TEST_INT(hits_next.GetCount(), 4);
+    TEST_INT(hits_next.Get(0).prim_id, 6);
+  }
+
+  {
+    // spatial splits find the same hits as object splits on long diagonal
+    // slivers and the same hits only once
+    const int NFACES = 20;
+    Mesh mesh;
+    mesh.SetPointCount(3 * NFACES);
+    mesh.AddPointPosition();
+    for (int i = 0; i < NFACES; i++) {
+      const Real y = .5 * i - 5;
+      const Real z = .1 * i;
+      mesh.SetPointPosition(3 * i + 0, Vector(-10, y - 10, z));
+      mesh.SetPointPosition(3 * i + 1, Vector( 10, y + 10, z));
+      mesh.SetPointPosition(3 * i + 2, Vector( 10, y + 10.2, z));
+    }
+    mesh.SetFaceCount(NFACES);
+    mesh.AddFaceIndices();
+    for (int i = 0; i < NFACES; i++) {
+      mesh.SetFaceIndices(i, Index3(3 * i, 3 * i + 1, 3 * i + 2));
+    }
+    mesh.ComputeBounds();
+
+    BVHAccelerator sah;
+    sah.SetPrimitiveSet(&mesh);
+    sah.SetBuildMode(BVH_BUILD_SAH);
+    sah.SetLeafSize(1);
+    TEST_INT(sah.Build(), 0);
+    BVHAccelerator sbvh;
+    sbvh.SetPrimitiveSet(&mesh);
+    TEST_INT(sbvh.SetBuildMode(BVH_BUILD_SBVH), 0);
+    TEST_INT(sbvh.SetSplitBudget(-1), -1);
+    TEST_INT(sbvh.SetSplitBudget(1), 0);
+    sbvh.SetLeafSize(1);
+    TEST_INT(sbvh.Build(), 0);
+    // primitives are referred more than once
+    TEST(sbvh.GetMemoryUsage() > sah.GetMemoryUsage());
+
+    int mismatch_count = 0;
+    int hit_count = 0;
+    for (int i = 0; i < 400; i++) {
+      Ray ray;
+      ray.orig = Vector(.05 * i - 10, .05 * i - 9.9 + (i % 7) * .5, 5);
+      ray.dir = Vector(0, 0, -1);
+      Intersection isect_sah;
+      Intersection isect_sbvh;
+      const bool hit_sah = sah.Intersect(ray, 0, &isect_sah);
+      const bool hit_sbvh = sbvh.Intersect(ray, 0, &isect_sbvh);
+      HitList hits_sah;
+      HitList hits_sbvh;
+      sah.IntersectAll(ray, 0, &hits_sah);
+      sbvh.IntersectAll(ray, 0, &hits_sbvh);
+      if (hit_sah != hit_sbvh ||
+          (hit_sah && isect_sah.prim_id != isect_sbvh.prim_id) ||
+          hits_sah.GetCount() != hits_sbvh.GetCount()) {
+        mismatch_count++;
+      }
+      hit_count += hit_sah;
+    }
+    TEST(hit_count > 100);
+    TEST_INT(mismatch_count, 0);
+
+    TEST_INT(sbvh.Refit(), 0);
+    Ray ray;
+    ray.orig = Vector(0, .05, 5);
+    ray.dir = Vector(0, 0, -1);
+    Intersection isect;
+    TEST(sbvh.Intersect(ray, 0, &isect));
+    TEST_INT(isect.prim_id, 10);
+  }
+
+  {
+    // leaf clusters of a grid sharing vertices find the same hits as
+    // precomputed triangles and replace them
+    const int N = 8;
+    Mesh mesh;
+    mesh.SetPointCount((N + 1) * (N + 1));
+    mesh.AddPointPosition();
+    for (int i = 0; i <= N; i++) {
+      for (int j = 0; j <= N; j++) {
+        mesh.SetPointPosition(i * (N + 1) + j, Vector(j, i, .1 * ((i * j) % 3)));
+      }
+    }
+    mesh.SetFaceCount(2 * N * N);
+    mesh.AddFaceIndices();
+    for (int i = 0; i < N; i++) {
+      for (int j = 0; j < N; j++) {
+        const Index v = i * (N + 1) + j;
+        mesh.SetFaceIndices(2 * (i * N + j) + 0, Index3(v, v + 1, v + N + 2));
+        mesh.SetFaceIndices(2 * (i * N + j) + 1, Index3(v, v + N + 2, v + N + 1));
+      }
+    }
+    mesh.ComputeBounds();
+
+    BVHAccelerator plain;
+    plain.SetPrimitiveSet(&mesh);
+    plain.SetMeshClusters(false);
+    TEST_INT(plain.Build(), 0);
+    const std::size_t mesh_memory = mesh.GetMemoryUsage();
+
+    BVHAccelerator clustered;
+    clustered.SetPrimitiveSet(&mesh);
+    TEST(clustered.IsMeshClusters());
+    TEST_INT(clustered.Build(), 0);
+    TEST(mesh.GetMemoryUsage() < mesh_memory);
+
+    int mismatch_count = 0;
+    int hit_count = 0;
+    for (int i = 0; i < 100; i++) {
+      Ray ray;
+      ray.orig = Vector(.083 * i - .1, .077 * i + .05 * (i % 5), 5);
+      ray.dir = Normalize(Vector(.01 * (i % 3), -.02, -1));
+      Intersection isect_plain;
+      Intersection isect_clustered;
+      const bool hit_plain = plain.Intersect(ray, 0, &isect_plain);
+      const bool hit_clustered = clustered.Intersect(ray, 0, &isect_clustered);
+      Intersection occ_plain;
+      Intersection occ_clustered;
+      if (hit_plain != hit_clustered ||
+          (hit_plain && (isect_plain.prim_id != isect_clustered.prim_id ||
+                         isect_plain.t_hit != isect_clustered.t_hit)) ||
+          plain.Occlude(ray, 0, &occ_plain) != clustered.Occlude(ray, 0, &occ_clustered)) {
+        mismatch_count++;
+      }
+      hit_count += hit_plain;
+    }
+    TEST(hit_count > 50);
+    TEST_INT(mismatch_count, 0);
+  }
+
+  {
+    // points tested in blocks find the same closest hits as one by one,
+    // for a shared radius and for mixed radii. 37 points leave a partial
+    // last block
+    const int N = 37;
+    for (int mixed = 0; mixed < 2; mixed++) {
+      PointCloud ptc;
+      XorShift rng(N);
+      ptc.SetPointCount(N);
+      ptc.AddPointPosition();
+      ptc.AddPointRadius();
+      for (int i = 0; i < N; i++) {
+        ptc.SetPointPosition(i, 4 * rng.NextVector01());
+        ptc.SetPointRadius(i, mixed ? .1 + .4 * rng.NextFloat01() : .3);
+      }
+      ptc.ComputeBounds();
+
+      std::vector<Index> prim_ids(N);
+      for (int i = 0; i < N; i++) {
+        prim_ids[i] = N - 1 - i;
+      }
+
+      int mismatch_count = 0;
+      int hit_count = 0;
+      for (int i = 0; i < 500; i++) {
+        Ray ray;
+        ray.orig = Vector(-2, -2, -2) + 8 * rng.NextVector01();
+        ray.dir = Normalize(ptc.GetPointPosition(i % N) - ray.orig);
+        if (i % 5 == 0) {
+          ray.tmin = 2;
+        }
+
+        Intersection isect_list;
+        Intersection isect_each;
+        const bool hit_list = ptc.RayIntersectList(&prim_ids[0], N, ray, 0, &isect_list);
+        const bool hit_each = brute_force_intersect(ptc, ray, 0, &isect_each);
+        if (hit_list != hit_each ||
+            (hit_list && (isect_list.prim_id != isect_each.prim_id ||
+                          std::abs(isect_list.t_hit - isect_each.t_hit) > 1e-9))) {
+          mismatch_count++;
+        }
+        hit_count += hit_list;
+      }
+      TEST(hit_count > 300);
+      TEST_INT(mismatch_count, 0);
+    }
+  }
+
+  {
+    // sets of the same hash are compared byte by byte so that a collision
+    // isn't shared. one point moved is not the same content
+    Mesh mesh_a;
+    Mesh mesh_b;
+    make_triangle_soup(&mesh_a, 50, false);
+    make_triangle_soup(&mesh_b, 50, false);
+    TEST(mesh_a.GetContentHash() == mesh_b.GetContentHash());
+    TEST(mesh_a.HasSameContent(mesh_b));
+    mesh_b.SetPointPosition(7, Vector(100, 100, 100));
+    mesh_b.ComputeBounds();
+    TEST(!mesh_a.HasSameContent(mesh_b));
+
+    PointCloud ptc_a;
+    PointCloud ptc_b;
+    PointRowProcedure proc_a(&ptc_a);
+    PointRowProcedure proc_b(&ptc_b);
+    TEST_INT(proc_a.Run(), 0);
+    TEST_INT(proc_b.Run(), 0);
+    TEST(ptc_a.HasSameContent(ptc_b));
+    TEST(!ptc_a.HasSameContent(mesh_a));
+    ptc_b.SetPointRadius(3, .5);
+    ptc_b.ComputeBounds();
+    TEST(!ptc_a.HasSameContent(ptc_b));
+  }
+
+  {
+    // accelerators of different build settings aren't shared
+    BVHAccelerator bvh_a;
+    BVHAccelerator bvh_b;
+    QBVHAccelerator qbvh_a;
+    QBVHAccelerator qbvh_b;
+    GridAccelerator grid_a;
+    GridAccelerator grid_b;
+    TEST(bvh_a.HasSameSettings(bvh_b));
+    TEST(qbvh_a.HasSameSettings(qbvh_b));
+    TEST(grid_a.HasSameSettings(grid_b));
+    TEST(!bvh_a.HasSameSettings(qbvh_a));
+    TEST(!grid_a.HasSameSettings(bvh_a));
+
+    TEST_INT(bvh_b.SetLeafSize(bvh_a.GetLeafSize() + 1), 0);
+    TEST(!bvh_a.HasSameSettings(bvh_b));
+    TEST_INT(bvh_b.SetLeafSize(bvh_a.GetLeafSize()), 0);
+    TEST_INT(bvh_b.SetBuildMode(BVH_BUILD_SBVH), 0);
+    TEST(!bvh_a.HasSameSettings(bvh_b));
+    TEST_INT(bvh_a.SetBuildMode(BVH_BUILD_SBVH), 0);
+    TEST_INT(bvh_b.SetSplitBudget(bvh_a.GetSplitBudget() * 2), 0);
+    TEST(!bvh_a.HasSameSettings(bvh_b));
+
+    TEST_INT(qbvh_b.SetCompressionThreshold(qbvh_a.GetCompressionThreshold() + 1), 0);
+    TEST(!qbvh_a.HasSameSettings(qbvh_b));
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
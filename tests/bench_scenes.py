@@ -0,0 +1,271 @@
+#!/usr/bin/env python
+
+# render a fixed set of scenes at fixed settings, record phase times,
+# peak memory and ray throughput to a history file and fail when they
+# regress from the previous runs
+# Copyright (c) 2011-2020 Hiroshi Tsubokawa
+#
+# run from the top directory after make:
+#   python tests/bench_scenes.py [--threads 1,8] [--repeat 3] [--threshold .1]
+#
+# each run appends one json line to the history file. phases are read from
+# the trace file of the renderer:
+#   load:   LoadScene, from opening the scene to the first render
+#   build:  from the end of LoadScene to RenderScene (bounds, accelerators)
+#   render: RenderScene
+# rays/sec is of the ray counters when built with make RAY_STATS=1, or of
+# camera samples (resolution x pixelsamples) otherwise. values of a scene
+# are medians of the repeats
+
+from __future__ import print_function
+
+import argparse
+import json
+import multiprocessing
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+scn_list = [
+	'scenes/furry_bunny.scn',
+	'scenes/happy_buddhas.scn',
+	'scenes/teapot.scn',
+	'scenes/xyzrgb_dragon.scn']
+
+RESOLUTION = '320 240'
+
+# metrics compared with the history and whether larger is better
+metric_list = [
+	('load',         False),
+	('build',        False),
+	('render',       False),
+	('peak_rss_mb',  False),
+	('rays_per_sec', True)]
+
+# phases shorter than this are too noisy to regress
+time_metrics = ['load', 'build', 'render']
+
+def median(values):
+	s = sorted(values)
+	n = len(s)
+	if n == 0:
+		return 0
+	if n % 2 == 1:
+		return s[n // 2]
+	return .5 * (s[n // 2 - 1] + s[n // 2])
+
+def make_scene(filepath, thread_count, trace_file):
+	lines = []
+	width, height, samples = 640, 480, 1
+
+	for line in open(filepath):
+		line = line.replace('640 480', RESOLUTION)
+		args = line.split()
+
+		if len(args) == 5 and args[0] == 'SetProperty2':
+			if args[2] == 'resolution':
+				width, height = float(args[3]), float(args[4])
+			elif args[2] == 'pixelsamples':
+				samples = float(args[3]) * float(args[4])
+
+		# fixed settings for every renderer just before it renders
+		if len(args) == 2 and args[0] == 'RenderScene':
+			lines.append('SetProperty1 %s thread_count %d\n' % (args[1], thread_count))
+			lines.append('SetStringProperty %s trace_file %s\n' % (args[1], trace_file))
+		lines.append(line)
+
+	return ''.join(lines), width * height * samples
+
+def read_phases(trace_file):
+	events = json.load(open(trace_file))['traceEvents']
+	load = None
+	render = None
+
+	for e in events:
+		if e.get('ph') != 'X':
+			continue
+		if e['name'] == 'LoadScene' and load is None:
+			load = e
+		elif e['name'] == 'RenderScene' and render is None:
+			render = e
+
+	if load is None or render is None:
+		return None
+
+	return {
+		'load':   load['dur'] * 1e-6,
+		'build':  (render['ts'] - load['ts'] - load['dur']) * 1e-6,
+		'render': render['dur'] * 1e-6}
+
+def run_scene(filepath, thread_count):
+	(fd, trace_file) = tempfile.mkstemp(suffix='.json')
+	os.close(fd)
+	(fd, scene_file) = tempfile.mkstemp(suffix='.scn')
+
+	(text, camera_samples) = make_scene(filepath, thread_count, trace_file)
+	os.write(fd, text.encode())
+	os.close(fd)
+
+	env = dict(os.environ)
+	env['LD_LIBRARY_PATH'] = 'lib'
+
+	try:
+		proc = subprocess.Popen(['bin/scene', scene_file], env=env,
+				stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+		output = proc.stdout.read().decode('utf-8', 'replace')
+		(pid, status, usage) = os.wait4(proc.pid, 0)
+		proc.returncode = status
+
+		if status != 0:
+			return None
+
+		phases = read_phases(trace_file)
+		if phases is None:
+			return None
+	finally:
+		os.remove(scene_file)
+		if os.path.exists(trace_file):
+			os.remove(trace_file)
+
+	# kilobytes on linux
+	phases['peak_rss_mb'] = usage.ru_maxrss / 1024.
+
+	m = re.search(r'#   Rays:\s+(\d+)', output)
+	rays = float(m.group(1)) if m else camera_samples
+	phases['rays_per_sec'] = rays / phases['render'] if phases['render'] > 0 else 0
+
+	return phases
+
+def git_revision():
+	try:
+		out = subprocess.check_output(['git', 'rev-parse', '--short', 'HEAD'],
+				stderr=subprocess.STDOUT)
+		return out.decode().strip()
+	except (OSError, subprocess.CalledProcessError):
+		return ''
+
+def read_history(filepath):
+	history = []
+	if not os.path.exists(filepath):
+		return history
+	for line in open(filepath):
+		line = line.strip()
+		if line:
+			history.append(json.loads(line))
+	return history
+
+def baseline_of(history, key, scene, count):
+	# medians of the last runs with the same settings
+	values = {}
+	runs = [h for h in history if h['key'] == key and scene in h['scenes']]
+	for h in runs[-count:]:
+		for (name, larger_is_better) in metric_list:
+			values.setdefault(name, []).append(h['scenes'][scene][name])
+	return dict((name, median(v)) for (name, v) in values.items())
+
+def main():
+	parser = argparse.ArgumentParser(description='scene benchmark with a timing history')
+	parser.add_argument('--threads', default='1,%d' % multiprocessing.cpu_count(),
+			help='comma separated thread counts (default: 1 and all cpus)')
+	parser.add_argument('--repeat', type=int, default=3,
+			help='renders of each scene per thread count (default: 3)')
+	parser.add_argument('--threshold', type=float, default=.1,
+			help='relative change reported as a regression (default: .1)')
+	parser.add_argument('--min-seconds', type=float, default=.05,
+			help='phase time changes ignored below this (default: .05)')
+	parser.add_argument('--baseline-runs', type=int, default=5,
+			help='previous runs the baseline is the median of (default: 5)')
+	parser.add_argument('--history', default='bench_scenes_history.jsonl',
+			help='history file appended one line per run')
+	parser.add_argument('--no-record', action='store_true',
+			help='compares with the history without appending to it')
+	parser.add_argument('scenes', nargs='*', default=scn_list,
+			help='scene files (default: the fixed set)')
+	args = parser.parse_args()
+
+	thread_counts = []
+	for t in args.threads.split(','):
+		if t and int(t) not in thread_counts:
+			thread_counts.append(int(t))
+	history = read_history(args.history)
+	regressions = []
+	records = []
+
+	for thread_count in thread_counts:
+		key = 'threads=%d resolution=%s' % (
+				thread_count, RESOLUTION.replace(' ', 'x'))
+		record = {
+			'time': time.strftime('%Y-%m-%dT%H:%M:%S'),
+			'revision': git_revision(),
+			'key': key,
+			'scenes': {}}
+
+		for filepath in args.scenes:
+			runs = []
+			for i in range(args.repeat):
+				print('bin/scene %s threads %d run %d/%d' % (
+						filepath, thread_count, i + 1, args.repeat))
+				r = run_scene(filepath, thread_count)
+				if r is None:
+					print('  failed')
+					break
+				runs.append(r)
+
+			if len(runs) < args.repeat:
+				regressions.append((filepath, thread_count, 'failed', 0, 0))
+				continue
+
+			result = dict((name, median([r[name] for r in runs]))
+					for (name, larger_is_better) in metric_list)
+			record['scenes'][filepath] = result
+
+			base = baseline_of(history, key, filepath, args.baseline_runs)
+			print('  %-14s %12s %12s %8s' % ('metric', 'now', 'baseline', 'change'))
+			for (name, larger_is_better) in metric_list:
+				now = result[name]
+				if name not in base or base[name] <= 0:
+					print('  %-14s %12.3f %12s' % (name, now, '-'))
+					continue
+				change = now / base[name] - 1
+				worse = -change if larger_is_better else change
+				mark = ''
+				if name in time_metrics and abs(now - base[name]) < args.min_seconds:
+					worse = 0
+				if worse > args.threshold:
+					mark = ' REGRESSION'
+					regressions.append((filepath, thread_count, name, now, base[name]))
+				print('  %-14s %12.3f %12.3f %+7.1f%%%s' % (
+						name, now, base[name], 100 * change, mark))
+
+		records.append(record)
+
+	if not args.no_record:
+		with open(args.history, 'a') as f:
+			for record in records:
+				f.write(json.dumps(record, sort_keys=True) + '\n')
+
+	if regressions:
+		print('')
+		print('%d regression(s) beyond %.0f%%:' % (len(regressions), 100 * args.threshold))
+		for (filepath, thread_count, name, now, base) in regressions:
+			if name == 'failed':
+				print('  %s threads %d: failed to render' % (filepath, thread_count))
+			else:
+				print('  %s threads %d: %s %.3f (baseline %.3f)' % (
+						filepath, thread_count, name, now, base))
+		return 1
+
+	print('')
+	print('no regressions')
+	return 0
+
+if __name__ == '__main__':
+	try:
+		sys.exit(main())
+	except KeyboardInterrupt:
+		print('')
+		print('benchmark terminated')
+		sys.exit(1)
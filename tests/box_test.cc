@@ -3,7 +3,9 @@
 
 #include "unit_test.h"
 #include "fj_box.h"
+#include "fj_numeric.h"
 #include "fj_vector.h"
+#include "fj_ray.h"
 #include <cstdio>
 #include <cfloat>
 
@@ -108,6 +110,49 @@ int main()
     TEST(TestDoubleEq(hit_tmin, -FLT_MAX));
     TEST(TestDoubleEq(hit_tmax, FLT_MAX));
   }
+  {
+    Box box(Vector(-1, -1, -1), Vector(1, 2, 3));
+
+    TEST(TestDoubleEq(box.SurfaceArea(), 2 * (2 * 3 + 3 * 4 + 4 * 2)));
+  }
+  {
+    Box box;
+    box.ReverseInfinite();
+
+    TEST(TestDoubleEq(box.SurfaceArea(), 0));
+  }
+  {
+    // axis parallel rays with traversal rays. origins on a slab plane
+    // and -0 directions give 0 * inf that must not miss the box
+    Box box(Vector(-1, -1, -1), Vector(1, 1, 1));
+    Ray ray;
+    ray.orig = Vector(1, 0, -2);
+    ray.dir = Vector(0, -0., 1);
+    Real hit_tmin = 0;
+    Real hit_tmax = 0;
+
+    const TraversalRay traversal_ray(ray);
+    TEST_INT(traversal_ray.near_side[0], 0);
+    TEST_INT(traversal_ray.near_side[1], 1);
+    TEST_INT(traversal_ray.near_side[2], 0);
+    TEST(RayBoxIntersect(traversal_ray, box.min, box.max,
+          0., 1000., &hit_tmin, &hit_tmax));
+    TEST_FLOAT(hit_tmin, 1.);
+    TEST(hit_tmax >= 3 && hit_tmax < 3 * (1 + 4 * REAL_EPSILON));
+
+    ray.orig = Vector(1.5, 0, -2);
+    TEST(!RayBoxIntersect(TraversalRay(ray), box.min, box.max,
+          0., 1000., &hit_tmin, &hit_tmax));
+
+    ray.orig = Vector(0, 0, 2);
+    ray.dir = Vector(0, 0, -1);
+    TEST(RayBoxIntersect(TraversalRay(ray), box.min, box.max,
+          0., 2., &hit_tmin, &hit_tmax));
+    TEST_FLOAT(hit_tmin, 1.);
+    TEST(!RayBoxIntersect(TraversalRay(ray), box.min, box.max,
+          0., .5, &hit_tmin, &hit_tmax));
+  }
+
   printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
       TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
 
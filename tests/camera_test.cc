@@ -0,0 +1,46 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_camera.h"
+#include "fj_box.h"
+#include <cstdio>
+
+using namespace fj;
+
+int main()
+{
+  {
+    // the camera at the origin looks down -z
+    Camera camera;
+    camera.SetAspect(1);
+    camera.SetFov(30);
+    CameraFrame frame;
+    camera.ComputeFrame(0, &frame);
+
+    const Vector2 screen_min(0, 0);
+    const Vector2 screen_max(1, 1);
+    const Vector2 left_min(0, 0);
+    const Vector2 left_max(.5, 1);
+    const Vector2 right_min(.5, 0);
+    const Vector2 right_max(1, 1);
+
+    const Box center(Vector(-.1, -.1, -5.1), Vector(.1, .1, -4.9));
+    const Box left(Vector(-1, -.1, -5.1), Vector(-.5, .1, -4.9));
+    const Box behind(Vector(-.1, -.1, 4.9), Vector(.1, .1, 5.1));
+    const Box around(Vector(-1, -1, -1), Vector(1, 1, 1));
+
+    TEST(frame.IsBoxInRegion(center, screen_min, screen_max));
+    TEST(frame.IsBoxInRegion(center, left_min, left_max));
+    TEST(frame.IsBoxInRegion(center, right_min, right_max));
+    TEST(frame.IsBoxInRegion(left, left_min, left_max));
+    TEST(!frame.IsBoxInRegion(left, right_min, right_max));
+    TEST(!frame.IsBoxInRegion(behind, screen_min, screen_max));
+    TEST(frame.IsBoxInRegion(around, right_min, right_max));
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_denoiser.h"
+#include "fj_framebuffer.h"
+#include "fj_random.h"
+#include "fj_color.h"
+#include "fj_aov.h"
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+static double rms_error(const FrameBuffer &fb, float expected)
+{
+  double sum = 0;
+  for (int y = 0; y < fb.GetHeight(); y++) {
+    for (int x = 0; x < fb.GetWidth(); x++) {
+      const double diff = fb.GetColor(x, y).r - expected;
+      sum += diff * diff;
+    }
+  }
+  return std::sqrt(sum / (fb.GetWidth() * fb.GetHeight()));
+}
+
+int main()
+{
+  {
+    // no color to denoise
+    FrameBuffer src, dst;
+    AOVLayout layout;
+    TEST(DenoiseInto(src, layout, dst) == -1);
+  }
+  {
+    // noise on a flat image is smoothed without guides
+    FrameBuffer src, dst;
+    AOVLayout layout;
+    XorShift rng;
+    src.Resize(64, 64, 4);
+    for (int y = 0; y < 64; y++) {
+      for (int x = 0; x < 64; x++) {
+        const float noise = static_cast<float>(rng.NextFloat01()) - .5f;
+        src.SetColor(x, y, Color4(.5f + noise, .5f + noise, .5f + noise, 1));
+      }
+    }
+    TEST(DenoiseInto(src, layout, dst) == 0);
+    TEST(dst.GetWidth() == 64);
+    TEST(dst.GetHeight() == 64);
+    TEST(dst.GetChannelCount() == 4);
+    TEST(rms_error(dst, .5f) < .5 * rms_error(src, .5f));
+    TEST_FLOAT(dst.GetColor(10, 10).a, 1.);
+  }
+  {
+    // edges in normals are kept
+    FrameBuffer src, dst;
+    AOVLayout layout;
+    TEST(layout.Parse("normal") == 0);
+    const int N = 4 + layout.GetOffset(AOV_NORMAL);
+    src.Resize(32, 32, 4 + layout.GetChannelCount());
+    for (int y = 0; y < 32; y++) {
+      for (int x = 0; x < 32; x++) {
+        const float C = x < 16 ? 0 : 1;
+        src.SetColor(x, y, Color4(C, C, C, 1));
+        float *normal = src.GetWritable(x, y, N);
+        normal[0] = x < 16 ? 1 : 0;
+        normal[1] = x < 16 ? 0 : 1;
+        normal[2] = 0;
+      }
+    }
+    TEST(DenoiseInto(src, layout, dst) == 0);
+    TEST_FLOAT(dst.GetColor(15, 16).r, 0.);
+    TEST_FLOAT(dst.GetColor(16, 16).r, 1.);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
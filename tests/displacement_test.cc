@@ -0,0 +1,132 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_tessellation_cache.h"
+#include "fj_bvh_accelerator.h"
+#include "fj_intersection.h"
+#include "fj_mipmap.h"
+#include "fj_texture.h"
+#include "fj_mesh.h"
+#include "fj_ray.h"
+#include <cstdio>
+#include <vector>
+
+using namespace fj;
+
+static TessellationCache::FacePtr new_face(int level)
+{
+  std::shared_ptr<TessellatedFace> face = std::make_shared<TessellatedFace>();
+  face->level = level;
+  face->points.resize(1024);
+  return face;
+}
+
+static void make_quad(Mesh &mesh)
+{
+  mesh.Clear();
+  mesh.SetPointCount(4);
+  mesh.SetFaceCount(2);
+  mesh.AddPointPosition();
+  mesh.AddPointTexture();
+  mesh.AddFaceIndices();
+  mesh.SetPointPosition(0, Vector(0, 0, 0));
+  mesh.SetPointPosition(1, Vector(1, 0, 0));
+  mesh.SetPointPosition(2, Vector(1, 1, 0));
+  mesh.SetPointPosition(3, Vector(0, 1, 0));
+  mesh.SetPointTexture(0, TexCoord(0, 0));
+  mesh.SetPointTexture(1, TexCoord(1, 0));
+  mesh.SetPointTexture(2, TexCoord(1, 1));
+  mesh.SetPointTexture(3, TexCoord(0, 1));
+  mesh.SetFaceIndices(0, Index3(0, 1, 2));
+  mesh.SetFaceIndices(1, Index3(0, 2, 3));
+  mesh.ComputeNormals();
+  mesh.ComputeBounds();
+}
+
+int main()
+{
+  {
+    // faces are found by mesh and face
+    TessellationCache cache;
+    const int a = cache.NewMeshID();
+    const int b = cache.NewMeshID();
+    cache.Insert(a, 0, new_face(1));
+    cache.Insert(a, 1, new_face(2));
+    cache.Insert(b, 0, new_face(3));
+
+    TEST(cache.Find(a, 0)->level == 1);
+    TEST(cache.Find(a, 1)->level == 2);
+    TEST(cache.Find(b, 0)->level == 3);
+    TEST(!cache.Find(b, 1));
+
+    // the first insertion wins
+    TEST(cache.Insert(a, 0, new_face(4))->level == 1);
+
+    cache.RemoveMesh(a);
+    TEST(cache.GetFaceCount() == 1);
+    TEST(!cache.Find(a, 0));
+
+    // moving the dicing camera drops all faces
+    cache.SetDicingCamera(Vector(0, 0, 1), .001);
+    TEST(cache.GetFaceCount() == 0);
+  }
+  {
+    // memory stays in the budget
+    TessellationCache cache;
+    cache.SetMemoryBudget(1024 * 1024);
+    for (int i = 0; i < 1000; i++) {
+      cache.Insert(0, i, new_face(0));
+    }
+    TEST(cache.GetMemoryUsage() <= cache.GetMemoryBudget() + 32 * 1024 * sizeof(Vector));
+    TEST(cache.GetFaceCount() < 1000);
+  }
+  {
+    // rays hit displaced faces at the height of the map
+    const char filename[] = "displacement_test.mip";
+    std::vector<float> pixels(16 * 16, .5f);
+    MipOutput out;
+    TEST_INT(out.Open(filename), 0);
+    TEST_INT(out.GenerateFromSourceData(&pixels[0], 16, 16, 1), 0);
+    out.WriteFile();
+    out.Close();
+
+    Texture map;
+    TEST_INT(map.LoadFile(filename), 0);
+
+    Mesh mesh;
+    make_quad(mesh);
+    mesh.SetDisplacementMap(&map);
+    mesh.SetDisplacementScale(2);
+    mesh.SetDisplacementMaxLevel(3);
+    TEST(mesh.HasDisplacement());
+    TEST_FLOAT(mesh.GetBounds().max.z, 2.);
+
+    BVHAccelerator acc;
+    acc.SetPrimitiveSet(&mesh);
+    TEST_INT(acc.Build(), 0);
+
+    Ray ray;
+    ray.orig = Vector(.3, .6, 5);
+    ray.dir = Vector(0, 0, -1);
+    Intersection isect;
+    TEST(acc.Intersect(ray, 0, &isect));
+    TEST_FLOAT(isect.P.z, 1.);
+    TEST_FLOAT(isect.N.z, 1.);
+
+    // faces are tessellated at the max level without dicing camera
+    TEST(TessellationCacheGetGlobal().GetFaceCount() > 0);
+
+    mesh.SetDisplacementScale(0);
+    TEST(!mesh.HasDisplacement());
+    TEST_INT(acc.Rebuild(), 0);
+    TEST(acc.Intersect(ray, 0, &isect));
+    TEST_FLOAT(isect.P.z, 0.);
+    remove(filename);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
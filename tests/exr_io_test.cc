@@ -0,0 +1,136 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_exr_output.h"
+#include "fj_exr_input.h"
+#include "fj_framebuffer.h"
+#include "fj_color.h"
+#include "fj_tiler.h"
+#include "fj_rectangle.h"
+#include <cstdio>
+
+using namespace fj;
+
+int main()
+{
+  const char *filename = "exr_io_test.exr";
+  {
+    // pixels written by tiles are read back in the order of names
+    FrameBuffer fb;
+    fb.Resize(37, 21, 4);
+    for (int y = 0; y < fb.GetHeight(); y++) {
+      for (int x = 0; x < fb.GetWidth(); x++) {
+        // flat areas are compressed
+        fb.SetColor(x, y, Color4(x < 20 ? .5f : x, y, x * y, 1));
+      }
+    }
+    Tiler tiler;
+    tiler.Divide(fb.GetWidth(), fb.GetHeight(), 16, 16);
+
+    ExrOutput out;
+    TEST_INT(out.Start(filename, ExrChannelNames("", 4), &tiler, &fb), 0);
+    TEST_INT(out.Finish(), 0);
+
+    ExrInput in;
+    TEST_INT(in.Open(filename), 0);
+    TEST_INT(in.GetWidth(), 37);
+    TEST_INT(in.GetHeight(), 21);
+    TEST_INT(static_cast<int>(in.GetChannelNames().size()), 4);
+    TEST(in.GetChannelNames()[0] == "A");
+
+    std::vector<std::string> names;
+    names.push_back("R");
+    names.push_back("G");
+    names.push_back("B");
+    names.push_back("Z");
+    FrameBuffer read;
+    TEST_INT(in.ReadPixels(names, read), 0);
+    TEST_INT(read.GetChannelCount(), 4);
+
+    int mismatch = 0;
+    for (int y = 0; y < fb.GetHeight(); y++) {
+      for (int x = 0; x < fb.GetWidth(); x++) {
+        const Color4 a = fb.GetColor(x, y);
+        const Color4 b = read.GetColor(x, y);
+        // Z is not in the file
+        if (a.r != b.r || a.g != b.g || a.b != b.b || b.a != 0) {
+          mismatch++;
+        }
+      }
+    }
+    TEST_INT(mismatch, 0);
+  }
+  {
+    // aov channels of float and half framebuffers written as tiles finish
+    // in any order, one of them twice, and the rest at Finish
+    const int formats[] = {FB_FORMAT_FLOAT, FB_FORMAT_HALF};
+    for (int f = 0; f < 2; f++) {
+      FrameBuffer fb;
+      fb.SetFormat(formats[f]);
+      fb.Resize(45, 30, 6);
+      for (int y = 0; y < fb.GetHeight(); y++) {
+        for (int x = 0; x < fb.GetWidth(); x++) {
+          for (int z = 0; z < 6; z++) {
+            // exact in half floats
+            fb.SetValue(x, y, z, (x + 2 * y) % 16 - z * .25f);
+          }
+        }
+      }
+      Tiler tiler;
+      tiler.Divide(fb.GetWidth(), fb.GetHeight(), 16, 16);
+      Rectangle region;
+      region.max = Int2(fb.GetWidth(), fb.GetHeight());
+      tiler.GenerateTiles(region);
+      TEST_INT(tiler.GetTileCount(), 3 * 2);
+
+      const std::vector<std::string> names =
+          ExrChannelNames("R,G,B,A,diffuse.R,depth", 6);
+      TEST_INT(static_cast<int>(names.size()), 6);
+      ExrOutput out;
+      TEST_INT(out.Start(filename, names, &tiler, &fb), 0);
+      for (int i = tiler.GetTileCount() - 1; i > 1; i--) {
+        out.TileDone(i);
+      }
+      out.TileDone(3);
+      out.TileDone(tiler.GetTileCount());
+      TEST_INT(out.Finish(), 0);
+
+      ExrInput in;
+      TEST_INT(in.Open(filename), 0);
+      TEST_INT(in.GetWidth(), 45);
+      TEST_INT(in.GetHeight(), 30);
+      TEST_INT(static_cast<int>(in.GetChannelNames().size()), 6);
+
+      FrameBuffer read;
+      TEST_INT(in.ReadPixels(names, read), 0);
+      TEST_INT(read.GetChannelCount(), 6);
+
+      int mismatch = 0;
+      for (int y = 0; y < fb.GetHeight(); y++) {
+        for (int x = 0; x < fb.GetWidth(); x++) {
+          for (int z = 0; z < 6; z++) {
+            mismatch += fb.GetValue(x, y, z) != read.GetValue(x, y, z);
+          }
+        }
+      }
+      TEST_INT(mismatch, 0);
+    }
+  }
+  {
+    // not an exr file
+    FILE *file = fopen(filename, "w");
+    fputs("not exr", file);
+    fclose(file);
+
+    ExrInput in;
+    TEST_INT(in.Open(filename), -1);
+    TEST(!in.IsOpen());
+  }
+  remove(filename);
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_filter.h"
+#include "fj_numeric.h"
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+// the kernels written out again to check the tables against
+static double exact_kernel(int filter_type, double width, double t)
+{
+  switch (filter_type) {
+  case FLT_BOX:
+    return 1;
+
+  case FLT_GAUSSIAN:
+    {
+      const double tt = 2 * t / width;
+      return std::exp(-2 * tt * tt);
+    }
+
+  case FLT_MITCHELL:
+    {
+      const double B = 1./3;
+      const double C = 1./3;
+      const double x = std::abs(4 * t / width);
+      if (x < 1) {
+        return ((12 - 9 * B - 6 * C) * x * x * x +
+            (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6;
+      }
+      if (x < 2) {
+        return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x +
+            (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6;
+      }
+      return 0;
+    }
+
+  case FLT_BLACKMAN_HARRIS:
+    {
+      const double x = t / width + .5;
+      if (x < 0 || x > 1) {
+        return 0;
+      }
+      return .35875 -
+          .48829 * std::cos(2 * PI * x) +
+          .14128 * std::cos(4 * PI * x) -
+          .01168 * std::cos(6 * PI * x);
+    }
+
+  default:
+    return 0;
+  }
+}
+
+int main()
+{
+  {
+    // table lookups are close to the kernels inside and beyond the tables
+    // for each filter type and for x and y widths of their own
+    const int filters[] = {
+      FLT_BOX,
+      FLT_GAUSSIAN,
+      FLT_MITCHELL,
+      FLT_BLACKMAN_HARRIS
+    };
+    for (int i = 0; i < 4; i++) {
+      const double xwidth = 2;
+      const double ywidth = 3;
+      Filter filter;
+      filter.SetFilterType(filters[i], xwidth, ywidth);
+
+      double max_error = 0;
+      for (int j = 0; j < 1000; j++) {
+        // past the tables that end one pixel beyond the radius
+        const double x = -3 + .00617 * j;
+        const double y = 3.5 - .00743 * j;
+        const double exact =
+            exact_kernel(filters[i], xwidth, x) * exact_kernel(filters[i], ywidth, y);
+        max_error = Max(max_error, std::abs(filter.Evaluate(x, y) - exact));
+        max_error = Max(max_error,
+            std::abs(filter.EvaluateX(x) - exact_kernel(filters[i], xwidth, x)));
+        max_error = Max(max_error,
+            std::abs(filter.EvaluateY(y) - exact_kernel(filters[i], ywidth, y)));
+      }
+      TEST(max_error < 1e-4);
+    }
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,197 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_framebuffer.h"
+#include "fj_framebuffer_io.h"
+#include "fj_color.h"
+#include "fj_os.h"
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+
+using namespace fj;
+
+static void fill(FrameBuffer &fb)
+{
+  for (int y = 0; y < fb.GetHeight(); y++) {
+    for (int x = 0; x < fb.GetWidth(); x++) {
+      for (int z = 0; z < fb.GetChannelCount(); z++) {
+        *fb.GetWritable(x, y, z) = static_cast<float>((y * 1000 + x) * 10 + z);
+      }
+    }
+  }
+}
+
+static bool same_pixels(const FrameBuffer &a, const FrameBuffer &b)
+{
+  const int W = a.GetWidth();
+  const int NC = a.GetChannelCount();
+  std::vector<float> row_a(W * NC), row_b(W * NC);
+  for (int y = 0; y < a.GetHeight(); y++) {
+    a.ReadRow(0, y, W, &row_a[0]);
+    b.ReadRow(0, y, W, &row_b[0]);
+    if (row_a != row_b) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  {
+    // tiles of partial size on the edges keep the same pixels
+    FrameBuffer scanline;
+    scanline.Resize(37, 21, 3);
+    fill(scanline);
+
+    FrameBuffer tiled;
+    tiled.SetTileLayout(16, 8);
+    tiled.Resize(37, 21, 3);
+    TEST(tiled.IsTiled());
+    fill(tiled);
+    TEST(same_pixels(scanline, tiled));
+    TEST_FLOAT(tiled.GetColor(36, 20).g, scanline.GetColor(36, 20).g);
+
+    // rows written over tile boundaries
+    std::vector<float> row(37 * 3, 5.f);
+    tiled.WriteRow(3, 9, 30, &row[0]);
+    TEST_FLOAT(*tiled.GetReadOnly(32, 9, 2), 5.);
+    TEST_FLOAT(*tiled.GetReadOnly(33, 9, 2), (9 * 1000 + 33) * 10 + 2.);
+
+    FrameBuffer copy(tiled);
+    TEST(copy.IsTiled());
+    TEST(same_pixels(copy, tiled));
+  }
+  {
+    // half floats are converted when read or written
+    FrameBuffer fb;
+    fb.SetFormat(FB_FORMAT_HALF);
+    fb.Resize(8, 4, 5);
+    TEST_INT(fb.GetFormat(), FB_FORMAT_HALF);
+    TEST(fb.GetWritable(0, 0, 0) == NULL);
+    TEST_INT(static_cast<int>(fb.GetMemoryUsage()), 8 * 4 * 5 * 2);
+
+    fb.SetColor(3, 2, Color4(.5f, 1.f / 3, 2048, 1));
+    fb.SetValue(3, 2, 4, 70000);
+    TEST_FLOAT(fb.GetColor(3, 2).r, .5);
+    TEST(std::abs(fb.GetColor(3, 2).g - 1. / 3) < 1e-3);
+    TEST_FLOAT(fb.GetValue(3, 2, 2), 2048.);
+    // beyond the largest half
+    TEST(fb.GetValue(3, 2, 4) > 65504);
+
+    std::vector<float> row(8 * 5);
+    fb.ReadRow(0, 2, 8, &row[0]);
+    TEST_FLOAT(row[3 * 5 + 0], .5);
+
+    FrameBuffer copy(fb);
+    TEST_INT(copy.GetFormat(), FB_FORMAT_HALF);
+    TEST_FLOAT(copy.GetColor(3, 2).b, 2048.);
+  }
+  {
+    // evicted pixels are read from the file again
+    const char *filename = "/tmp/fj_framebuffer_test.fbmap";
+    {
+      FrameBuffer fb;
+      fb.SetTileLayout(64, 64);
+      fb.SetBackingFile(filename);
+      fb.Resize(256, 128, 4);
+      TEST(!fb.IsEmpty());
+      TEST(fb.IsFileBacked());
+      fill(fb);
+
+      TEST_INT(fb.EvictRegion(0, 0, 64, 64), 0);
+      TEST_INT(fb.EvictRegion(0, 0, 256, 128), 0);
+      TEST_FLOAT(*fb.GetReadOnly(10, 20, 3), (20 * 1000 + 10) * 10 + 3.);
+      TEST_FLOAT(*fb.GetReadOnly(255, 127, 0), (127 * 1000 + 255) * 10.);
+    }
+    // the file is removed with the pixels
+    FILE *fp = std::fopen(filename, "rb");
+    TEST(fp == NULL);
+    if (fp != NULL) {
+      std::fclose(fp);
+    }
+  }
+
+  {
+    // binary files read back the same pixels whether they are written in
+    // one write or row by row from tiles. text files are still read
+    const std::string filename = OsGetTempDirectory() + "/fj_framebuffer_test.fb";
+
+    FrameBuffer scanline;
+    scanline.Resize(37, 21, 5);
+    fill(scanline);
+    TEST_INT(WriteFrameBuffer(filename, scanline), 0);
+
+    FILE *fp = std::fopen(filename.c_str(), "rb");
+    char magic[4] = {'\0'};
+    long file_size = 0;
+    if (fp != NULL) {
+      TEST_INT(static_cast<int>(std::fread(magic, 1, 4, fp)), 4);
+      std::fseek(fp, 0, SEEK_END);
+      file_size = std::ftell(fp);
+      std::fclose(fp);
+    }
+    TEST(std::string(magic, 4) == "FJFB");
+    TEST_INT(file_size, 32 + 37 * 21 * 5 * 4);
+
+    FrameBuffer read;
+    TEST_INT(ReadFrameBuffer(filename, read), 0);
+    TEST_INT(read.GetWidth(), 37);
+    TEST_INT(read.GetHeight(), 21);
+    TEST_INT(read.GetChannelCount(), 5);
+    TEST(same_pixels(read, scanline));
+
+    FrameBuffer tiled;
+    tiled.SetTileLayout(16, 8);
+    tiled.Resize(37, 21, 5);
+    fill(tiled);
+    TEST_INT(WriteFrameBuffer(filename, tiled), 0);
+    FrameBuffer read_tiled;
+    read_tiled.SetTileLayout(8, 8);
+    TEST_INT(ReadFrameBuffer(filename, read_tiled), 0);
+    TEST(read_tiled.IsTiled());
+    TEST(same_pixels(read_tiled, scanline));
+
+    FrameBuffer rgba;
+    rgba.Resize(37, 21, 4);
+    fill(rgba);
+    TEST_INT(WriteFrameBufferText(filename, rgba), 0);
+    FrameBuffer read_text;
+    TEST_INT(ReadFrameBuffer(filename, read_text), 0);
+    TEST_INT(read_text.GetChannelCount(), 4);
+    TEST(same_pixels(read_text, rgba));
+
+    // headers of other versions and payloads shorter than the header
+    // says are errors
+    TEST_INT(WriteFrameBuffer(filename, scanline), 0);
+    fp = std::fopen(filename.c_str(), "r+b");
+    if (fp != NULL) {
+      const int version = 2;
+      std::fseek(fp, 4, SEEK_SET);
+      std::fwrite(&version, sizeof(version), 1, fp);
+      std::fclose(fp);
+    }
+    TEST_INT(ReadFrameBuffer(filename, read), -1);
+    TEST_INT(FbGetErrorNo(), ERR_FB_BADVER);
+
+    TEST_INT(WriteFrameBuffer(filename, scanline), 0);
+    fp = std::fopen(filename.c_str(), "r+b");
+    if (fp != NULL) {
+      const int height = 22;
+      std::fseek(fp, 12, SEEK_SET);
+      std::fwrite(&height, sizeof(height), 1, fp);
+      std::fclose(fp);
+    }
+    TEST_INT(ReadFrameBuffer(filename, read), -1);
+    TEST_INT(FbGetErrorNo(), ERR_FB_NOTFB);
+    std::remove(filename.c_str());
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -4,210 +4,114 @@
 #include "unit_test.h"
 #include "fj_vector.h"
 #include "fj_geo_io.h"
-#include <iostream>
+#include <cstdio>
+#include <vector>
 
 using namespace fj;
 
-int main()
+static long file_size(const char *filename)
 {
-#if 0
-  //const int format_version = 7;
-  //const char signature[] = "fjgeo";
-#endif
-  const int32_t position_count = 8;
-  const int32_t normal_count = 6;
-  const Vector position[] = {
-      Vector(1.1, 2.1, 3.1),
-      Vector(2.2, 3.2, 1.2),
-      Vector(3.3, 1.3, 2.3)
-      };
-  const int64_t position_index[] = {0, 1, 2};
-  const int64_t position_index_count = 3;
-
-  const Vector normal[] = {
-      Vector(1, 0, 0),
-      Vector(0, 1, 0),
-      Vector(0, 0, 1)
-      };
-  const int64_t normal_index[] = {0, 1, 2};
-  const int64_t normal_index_count = 3;
-#if 0
-#endif
-
-  {
-    Archive ar;
-
-    ar.OpenOutput("archive_test.bin");
-
-    ar.SetPositionData(position, position_count, position_index, position_index_count);
-    ar.SetNormalData(normal, normal_count, normal_index, normal_index_count);
-#if 0
-    ar.SetPositionCount(position_count);
-    ar.SetNormalCount(normal_count);
-
-    ar.SetPosition(P);
-    ar.AddSignature(signature);
-    ar.AddAttribute("position_count", &position_count, 1);
-#endif
-
-    ar.Write();
+  FILE *fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    return -1;
   }
-  {
-    Archive ar;
-    //Vector position[3] = {};
-
-    ar.OpenInput("archive_test.bin");
-
-    TEST_INT(ar.IsFailed(), 0);
-
-    TEST_INT(ar.GetPositionCount(), position_count);
-
-    const std::string name = ar.ReadDataName();
-    std::cout << name << "]\n";
-    TEST(name == "position_data");
-
-#if N
-    // If we want to use an API like this
-    //   ar.SetPosition(pos, count, index, index_count)
-    // Then we need to allow this API to access to raw data of mesh.
-    // And to allocate position data before setting data ref,
-    // we have to iterate over data names and check all count data
-    // for every attributes.
-    while (ar.ReadData()) {
-      const std::string name = ar.GetDataName();
-      const int64_t count = ar.GetDataCount();
-
-      if (name == "position") {
-        mesh.SetVertexCount(count);
-        mesh.AddVertexPosition();
-        for (int i = 0; i < count; i++) {
-          const Vector P = ar.GetData(i);
-          mesh.SetVertexPosition(i, P);
-        }
-      }
-      else {
+  fseek(fp, 0, SEEK_END);
+  const long size = ftell(fp);
+  fclose(fp);
+  return size;
+}
+
+int main()
+{
+  // a grid large enough to be split into chunks
+  const int N = 300;
+  std::vector<Vector> position(N * N);
+  std::vector<Vector> normal(N * N);
+  std::vector<TexCoord> texture(N * N);
+  std::vector<Color> color(N * N);
+  std::vector<int64_t> index;
+
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      const int k = i * N + j;
+      position[k] = Vector(j * .1, .25 * ((i + j) % 7), i * .1);
+      normal[k] = Vector(0, 1, 0);
+      texture[k] = TexCoord(j / float(N), i / float(N));
+      color[k] = Color(1, .5, k % 3);
+      if (i < N - 1 && j < N - 1) {
+        index.push_back(k);
+        index.push_back(k + 1);
+        index.push_back(k + N);
       }
     }
-#endif
-
-#if 0
-#endif
-
-    //ar.SetOutputPosition(position);
-
-    //ar.Read();
-#if 0
-    TEST_INT(ar.MatchSignature(signature), 1);
-
-    std::string name;
-    name = ar.ReadAttributeName();
-    TEST(name == "position_count");
-
-    //int32_t value = 0;
-    ar.ReadAttributeData();
-#endif
   }
-#if 0
-  {
-    OutputFile *out = IOOpenOutputFile("io_test_file.bin", "PTCD", format_version);
-    const Vector P[] = {
-        Vector(1, 2, 3),
-        Vector(2, 3, 1),
-        Vector(3, 1, 2)
-        };
-    const double radius[] = {
-        1.24,
-        2.34,
-        3.45
-        };
-    const int npoints = sizeof(P)/sizeof(P[0]);
-
-    IOSetOutputInt     (out, "position_count", &npoints, 1);
-    IOEndOutputHeader  (out);
-    IOSetOutputVector3 (out, "P",           P,         npoints);
-    IOSetOutputDouble  (out, "radius",      radius,    npoints);
-
-    IOWriteOutputHeader(out);
-    IOWriteOutputData(out);
-
-    IOCloseOutputFile(out);
-  }
-  {
-    InputFile *in = IOOpenInputFile("io_test_file.bin", "PTCD");
-    Vector P[] = {
-        Vector(0, 0, 0),
-        Vector(0, 0, 0),
-        Vector(0, 0, 0)
-        };
-    double radius[] = {
-        0,
-        0,
-        0
-        };
-    int npoints = 0;
-
-    TEST_INT(IOGetInputFileFormatVersion(in), format_version);
-
-    IOSetInputInt     (in, "position_count", &npoints, 1);
-    IOEndInputHeader  (in);
-
-    IOReadInputHeader(in);
-    IOSetInputVector3 (in, "P", P, npoints);
-    IOSetInputDouble  (in, "radius", radius, npoints);
-
-    {
-      const ChunkData *chunk = NULL;
 
-      TEST_INT(IOGetInputHeaderChunkCount(in), 1);
+  const int compressions[] = {ARCHIVE_COMPRESSION_NONE, ARCHIVE_COMPRESSION_RLE};
+  const char *filenames[] = {"archive_test_none.bin", "archive_test_rle.bin"};
 
-      chunk = IOGetInputHeaderChunk(in, 0);
-      TEST_STR(ChkGetElementName(chunk), "position_count");
-      TEST_INT(ChkGetElementType(chunk), ELM_INT);
-      TEST_INT(ChkGetElementCount(chunk), 1);
-    }
+  for (int c = 0; c < 2; c++) {
     {
-      const ChunkData *chunk = NULL;
-
-      TEST_INT(IOGetInputDataChunkCount(in), 2);
-
-      chunk = IOGetInputDataChunk(in, 0);
-      TEST_STR(ChkGetElementName(chunk), "P");
-      TEST_INT(ChkGetElementType(chunk), ELM_VECTOR3);
-      TEST_INT(ChkGetElementCount(chunk), 3);
+      Archive ar;
+      TEST_INT(ar.OpenOutput(filenames[c]), 0);
+      ar.SetCompression(compressions[c]);
 
-      chunk = IOGetInputDataChunk(in, 1);
-      TEST_STR(ChkGetElementName(chunk), "radius");
-      TEST_INT(ChkGetElementType(chunk), ELM_DOUBLE);
-      TEST_INT(ChkGetElementCount(chunk), 3);
+      ar.SetPositionData(&position[0], position.size(), &index[0], index.size());
+      ar.SetNormalData(&normal[0], normal.size(), NULL, 0);
+      ar.SetTextureData(&texture[0], texture.size(), NULL, 0);
+      ar.SetColorData(&color[0], color.size(), NULL, 0);
 
-      chunk = IOGetInputDataChunk(in, 2);
-      TEST_PTR(chunk, NULL);
+      TEST_INT(ar.Write(), 0);
     }
-
-    IOReadInputData(in);
-
     {
-      TEST_DOUBLE(P[0].x, 1);
-      TEST_DOUBLE(P[0].y, 2);
-      TEST_DOUBLE(P[0].z, 3);
-
-      TEST_DOUBLE(P[1].x, 2);
-      TEST_DOUBLE(P[1].y, 3);
-      TEST_DOUBLE(P[1].z, 1);
-
-      TEST_DOUBLE(P[2].x, 3);
-      TEST_DOUBLE(P[2].y, 1);
-      TEST_DOUBLE(P[2].z, 2);
-    }
-    {
-      TEST_DOUBLE(radius[0], 1.24);
-      TEST_DOUBLE(radius[1], 2.34);
-      TEST_DOUBLE(radius[2], 3.45);
+      Archive ar;
+      TEST_INT(ar.OpenInput(filenames[c]), 0);
+      TEST_INT(ar.IsFailed(), 0);
+
+      TEST_INT(ar.GetPositionCount(), N * N);
+      TEST_INT(ar.GetPositionIndexCount(), int64_t(index.size()));
+      TEST_INT(ar.GetNormalCount(), N * N);
+      TEST_INT(ar.GetNormalIndexCount(), 0);
+      TEST_INT(ar.GetTextureCount(), N * N);
+      TEST_INT(ar.GetColorCount(), N * N);
+
+      // normals are skipped
+      std::vector<Vector> P(ar.GetPositionCount());
+      std::vector<int64_t> P_index(ar.GetPositionIndexCount());
+      std::vector<TexCoord> uv(ar.GetTextureCount());
+      std::vector<Color> Cd(ar.GetColorCount());
+      ar.SetPositionData(&P[0], P.size(), &P_index[0], P_index.size());
+      ar.SetNormalData(NULL, 0, NULL, 0);
+      ar.SetTextureData(&uv[0], uv.size(), NULL, 0);
+      ar.SetColorData(&Cd[0], Cd.size(), NULL, 0);
+
+      TEST_INT(ar.Read(), 0);
+
+      bool all_match = P_index == index;
+      for (int i = 0; i < N * N; i++) {
+        all_match = all_match &&
+            P[i].x == position[i].x && P[i].y == position[i].y &&
+            P[i].z == position[i].z &&
+            uv[i].u == texture[i].u && uv[i].v == texture[i].v &&
+            Cd[i].r == color[i].r && Cd[i].g == color[i].g && Cd[i].b == color[i].b;
+      }
+      TEST(all_match);
     }
+  }
+
+  // RLE shrinks grid positions and indices
+  TEST(file_size(filenames[1]) < file_size(filenames[0]) / 2);
 
-    IOCloseInputFile(in);
+  {
+    // counts not matching the file fail
+    Archive ar;
+    TEST_INT(ar.OpenInput(filenames[1]), 0);
+    std::vector<Vector> P(10);
+    ar.SetPositionData(&P[0], P.size(), NULL, 0);
+    TEST_INT(ar.Read(), -1);
+    TEST(ar.IsFailed());
   }
-#endif
+  remove(filenames[0]);
+  remove(filenames[1]);
 
   printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
       TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
@@ -0,0 +1,80 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_importance_sampling.h"
+#include "fj_numeric.h"
+#include "fj_random.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+using namespace fj;
+
+int main()
+{
+  {
+    // indices are drawn in proportion to their weights
+    const double weights[] = {1, 0, 3, 8, .5, 2.5, 0, 1};
+    const int N = sizeof(weights) / sizeof(weights[0]);
+    AliasTable table;
+    table.Build(weights, N);
+    TEST_INT(table.GetCount(), N);
+    TEST(std::abs(table.GetProbability(3) - .5) < 1e-12);
+    TEST(table.GetProbability(1) == 0);
+
+    XorShift rng;
+    const int NDRAWS = 200000;
+    std::vector<int> counts(N, 0);
+    std::vector<int> remapped_counts(10, 0);
+    bool in_range = true;
+    for (int i = 0; i < NDRAWS; i++) {
+      double u_remapped = 0;
+      const int index = table.Sample(rng.NextFloat01(), &u_remapped);
+      in_range = in_range && index >= 0 && index < N;
+      in_range = in_range && u_remapped >= 0 && u_remapped < 1;
+      counts[index]++;
+      remapped_counts[static_cast<int>(u_remapped * 10)]++;
+    }
+    TEST(in_range);
+    TEST_INT(counts[1], 0);
+    TEST_INT(counts[6], 0);
+
+    double max_error = 0;
+    for (int i = 0; i < N; i++) {
+      max_error = std::max(max_error,
+          std::abs(counts[i] / double(NDRAWS) - table.GetProbability(i)));
+    }
+    TEST(max_error < .005);
+
+    // the rest of u is uniform for jittering in the pixel
+    double max_remapped_error = 0;
+    for (int i = 0; i < 10; i++) {
+      max_remapped_error = std::max(max_remapped_error,
+          std::abs(remapped_counts[i] / double(NDRAWS) - .1));
+    }
+    TEST(max_remapped_error < .005);
+  }
+  {
+    // all zero weights are drawn uniformly
+    const double weights[] = {0, 0, 0, 0};
+    AliasTable table;
+    table.Build(weights, 4);
+    TEST(table.GetProbability(2) == .25);
+    double u_remapped = 0;
+    TEST_INT(table.Sample(.6, &u_remapped), 2);
+    TEST(std::abs(u_remapped - .4) < 4 * REAL_EPSILON);
+  }
+  {
+    // an empty sampler until built with a texture
+    EnvironmentSampler sampler;
+    TEST(sampler.IsEmpty());
+    TEST_INT(sampler.Build(NULL, 8, 4), -1);
+    TEST(sampler.IsEmpty());
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_volume_accelerator.h"
+#include "fj_memory_arena.h"
+#include "fj_interval.h"
+#include "fj_ray.h"
+#include <vector>
+#include <cstdio>
+
+using namespace fj;
+
+static int box_intersect(const void *volume_set, int volume_id, double time,
+      const Ray *ray, Interval *interval)
+{
+  const std::vector<Box> &boxes = *static_cast<const std::vector<Box> *>(volume_set);
+  return BoxRayIntersect(boxes[volume_id], ray->orig, ray->dir, ray->tmin, ray->tmax,
+      &interval->tmin, &interval->tmax);
+}
+
+static void box_bounds(const void *volume_set, int volume_id, Box *bounds)
+{
+  const std::vector<Box> &boxes = *static_cast<const std::vector<Box> *>(volume_set);
+  *bounds = boxes[volume_id];
+}
+
+int main()
+{
+  {
+    // intervals are sorted by tmin
+    IntervalList intervals;
+    const Real tmins[] = {3, 1, 2, 5, 4, 0, 6};
+    for (int i = 0; i < 7; i++) {
+      Interval interval;
+      interval.tmin = tmins[i];
+      interval.tmax = tmins[i] + 10;
+      intervals.Push(interval);
+    }
+    TEST_INT(intervals.GetCount(), 7);
+    TEST_DOUBLE(intervals.GetMinT(), 0);
+    TEST_DOUBLE(intervals.GetMaxT(), 16);
+
+    bool is_sorted = true;
+    for (int i = 0; i < intervals.GetCount(); i++) {
+      is_sorted = is_sorted && intervals.Get(i).tmin == i;
+    }
+    TEST(is_sorted);
+  }
+  {
+    // arrays moved to the arena are released with the list
+    MemoryArena &arena = MemoryArenaGetThreadLocal();
+    const MemoryArena::Mark mark = arena.GetMark();
+    {
+      IntervalList intervals;
+      for (int i = 0; i < 100; i++) {
+        intervals.Push(Interval());
+      }
+      TEST_INT(intervals.GetCount(), 100);
+    }
+    const MemoryArena::Mark after = arena.GetMark();
+    TEST(after.block == mark.block && after.offset == mark.offset);
+  }
+  {
+    // the bvh finds the same volumes as brute force
+    std::vector<Box> boxes;
+    Box set_bounds;
+    set_bounds.ReverseInfinite();
+    for (int z = 0; z < 5; z++) {
+      for (int y = 0; y < 5; y++) {
+        for (int x = 0; x < 5; x++) {
+          const Box box(Vector(x, y, z), Vector(x + .75, y + .75, z + .75));
+          boxes.push_back(box);
+          set_bounds.AddBox(box);
+        }
+      }
+    }
+    const int NBOXES = static_cast<int>(boxes.size());
+
+    VolumeAccelerator *bvh = VolumeAccNew(VOLACC_BVH);
+    VolumeAccelerator *bruteforce = VolumeAccNew(VOLACC_BRUTEFORCE);
+    VolumeAccSetTargetGeometry(bvh, &boxes, NBOXES, &set_bounds,
+        box_intersect, box_bounds);
+    VolumeAccSetTargetGeometry(bruteforce, &boxes, NBOXES, &set_bounds,
+        box_intersect, box_bounds);
+    TEST_INT(VolumeAccBuild(bvh), 0);
+    TEST_INT(VolumeAccBuild(bruteforce), 0);
+
+    bool is_same = true;
+    int total_count = 0;
+    for (int i = 0; i < 100; i++) {
+      Ray ray;
+      ray.orig = Vector(-1, .1 + .05 * i, .2 + .043 * i);
+      ray.dir = Normalize(Vector(1, .01 * (i % 7), -.01 * (i % 5)));
+      ray.tmin = 0;
+      ray.tmax = 100;
+
+      IntervalList bvh_intervals;
+      IntervalList bruteforce_intervals;
+      VolumeAccIntersect(bvh, 0, &ray, &bvh_intervals);
+      VolumeAccIntersect(bruteforce, 0, &ray, &bruteforce_intervals);
+
+      is_same = is_same && bvh_intervals.GetCount() == bruteforce_intervals.GetCount();
+      for (int j = 0; is_same && j < bvh_intervals.GetCount(); j++) {
+        is_same = bvh_intervals.Get(j).tmin == bruteforce_intervals.Get(j).tmin;
+      }
+      total_count += bvh_intervals.GetCount();
+    }
+    TEST(is_same);
+    TEST(total_count > 100);
+
+    VolumeAccFree(bvh);
+    VolumeAccFree(bruteforce);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
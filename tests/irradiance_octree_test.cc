@@ -0,0 +1,155 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_irradiance_octree.h"
+#include "fj_scene_interface.h"
+#include "fj_random.h"
+#include "fj_numeric.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+using namespace fj;
+
+static Color exponential_profile(void *data, Real distance_sq)
+{
+  const Real sigma = *(const Real *) data;
+  const Real d = sqrt(distance_sq);
+  return Color(exp(-sigma * d), exp(-2 * sigma * d), exp(-4 * sigma * d));
+}
+
+// a closed cube of 2 x 2 x 2 with faces to the outside
+static ID new_cube_mesh()
+{
+  const double P[] = {
+    -1, -1, -1,   1, -1, -1,   1,  1, -1,  -1,  1, -1,
+    -1, -1,  1,   1, -1,  1,   1,  1,  1,  -1,  1,  1
+  };
+  const int quads[6][4] = {
+    {3, 2, 1, 0}, {6, 7, 4, 5}, {7, 3, 0, 4}, {2, 6, 5, 1}, {0, 1, 5, 4}, {7, 6, 2, 3}
+  };
+  std::vector<int> indices;
+  for (int i = 0; i < 6; i++) {
+    const int *q = quads[i];
+    const int tris[] = {q[0], q[1], q[2], q[0], q[2], q[3]};
+    indices.insert(indices.end(), tris, tris + 6);
+  }
+
+  const ID mesh = SiNewMesh();
+  SiSetPrimitiveAttribute(mesh, "P", SI_ARRAY_FLOAT64, P, 8 * 3);
+  SiSetPrimitiveAttribute(mesh, "indices", SI_ARRAY_INT32, &indices[0], indices.size());
+  return mesh;
+}
+
+// mean of the pixels of the cube with only multiple scattering of the sss
+// shader lit by a point light. -1 if failed
+static double render_sss_cube(int point_based)
+{
+  SiOpenScene();
+  const ID shader = SiNewShader(SiOpenPlugin("SSSShader"));
+  SiSetProperty3(shader, "specular", 0, 0, 0);
+  SiSetProperty3(shader, "reflect", 0, 0, 0);
+  SiSetProperty1(shader, "multiple_scattering_samples", 4);
+  SiSetProperty1(shader, "point_based_scattering", point_based);
+  SiSetProperty1(shader, "irradiance_point_count", 20000);
+  const ID cube = SiNewObjectInstance(new_cube_mesh());
+  SiSetProperty3(cube, "rotate", 30, 40, 0);
+  SiAssignShader(cube, "DEFAULT_SHADING_GROUP", shader);
+  const ID light = SiNewLight(SI_POINT_LIGHT);
+  SiSetProperty3(light, "translate", 3, 4, 5);
+  const ID camera = SiNewCamera("PerspectiveCamera");
+  SiSetProperty3(camera, "translate", 0, 0, 5);
+  const ID framebuffer = SiNewFrameBuffer("rgba");
+
+  const ID renderer = SiNewRenderer();
+  SiAssignCamera(renderer, camera);
+  SiAssignFrameBuffer(renderer, framebuffer);
+  SiSetProperty2(renderer, "resolution", 40, 30);
+  SiSetProperty2(renderer, "pixelsamples", 3, 3);
+  SiRenderScene(renderer);
+
+  double mean = -1;
+  float *data = NULL;
+  int width = 0, height = 0, nchannels = 0;
+  if (SiGetFrameBufferData(framebuffer, &data, &width, &height, &nchannels) == SI_SUCCESS) {
+    double sum = 0;
+    int count = 0;
+    for (int i = 0; i < width * height; i++) {
+      const float *pixel = &data[i * nchannels];
+      if (pixel[3] > .99) {
+        sum += (pixel[0] + pixel[1] + pixel[2]) / 3;
+        count++;
+      }
+    }
+    mean = count > 0 ? sum / count : -1;
+  }
+  SiCloseScene();
+  return mean;
+}
+
+int main()
+{
+  // points on a unit sphere lit from above
+  XorShift rng;
+  std::vector<IrradiancePoint> points(20000);
+  for (std::size_t i = 0; i < points.size(); i++) {
+    IrradiancePoint &point = points[i];
+    point.N = rng.HollowSphereRand();
+    point.P = point.N;
+    const Real E = Max(0, point.N.y);
+    point.E = Color(E, E, E);
+    point.area = 4 * PI / points.size();
+  }
+
+  IrradianceOctree octree;
+  TEST(octree.IsEmpty());
+  TEST(octree.Evaluate(Vector(0, 1, 0), .1, exponential_profile, NULL).r == 0);
+  octree.Build(points);
+  TEST(!octree.IsEmpty());
+  TEST_INT(octree.GetPointCount(), 20000);
+
+  {
+    // matches the sum over all points where lit points are near
+    Real sigma = 3;
+    const Vector P_list[] = {Vector(0, 1, 0), Vector(1, 0, 0)};
+    for (int j = 0; j < 2; j++) {
+      const Vector &P = P_list[j];
+      Color brute;
+      for (std::size_t i = 0; i < points.size(); i++) {
+        const Vector D = points[i].P - P;
+        brute += exponential_profile(&sigma, Dot(D, D)) * points[i].E * points[i].area;
+      }
+      const Color hier = octree.Evaluate(P, .1, exponential_profile, &sigma);
+      for (int k = 0; k < 3; k++) {
+        TEST(std::abs(hier[k] - brute[k]) <= .02 * brute[k] + 1e-6);
+      }
+    }
+  }
+  {
+    // the root alone when the whole tree is far enough away
+    Real sigma = 0;
+    const Color far = octree.Evaluate(Vector(1e6, 0, 0), .1, exponential_profile, &sigma);
+    Real total = 0;
+    for (std::size_t i = 0; i < points.size(); i++) {
+      total += points[i].E.r * points[i].area;
+    }
+    TEST(std::abs(far.r - total) < 1e-5 * total);
+  }
+
+  {
+    // the point-based path is about 1/70 of the brute-force path with the
+    // default coefficients as documented in the shader
+    const double brute_force = render_sss_cube(0);
+    const double point_based = render_sss_cube(1);
+    TEST(brute_force > 0);
+    TEST(point_based > 0);
+    TEST(point_based / brute_force > .012);
+    TEST(point_based / brute_force < .018);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
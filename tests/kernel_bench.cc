@@ -0,0 +1,631 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+// microbenchmarks of core ray tracing kernels.
+// results are written to stdout in JSON
+//
+//   $ make bench
+//   $ ./kernel_bench [ascii ply files ...] > result.json
+
+#include "fj_qbvh_accelerator.h"
+#include "fj_bvh_accelerator.h"
+#include "fj_intersection.h"
+#include "fj_triangle.h"
+#include "fj_numeric.h"
+#include "fj_filter.h"
+#include "fj_random.h"
+#include "fj_volume.h"
+#include "fj_curve.h"
+#include "fj_noise.h"
+#include "fj_mesh.h"
+#include "fj_ray.h"
+#include "fj_box.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace fj;
+
+// each benchmark runs for at least this long and reports the best repeat
+static const double MIN_SECONDS = .2;
+static const int REPEAT_COUNT = 5;
+
+static const int RAY_COUNT = 1 << 12;
+static const int RAY_MASK = RAY_COUNT - 1;
+
+static const char DEFAULT_PLY[] = "../scenes/cube.ply";
+
+class BenchData {
+public:
+  BenchData() : mesh(NULL), bvh(NULL), qbvh(NULL), qbvh_depth_first(NULL), curve(NULL) {}
+  ~BenchData() {}
+
+  std::vector<Ray> rays;
+  std::vector<Vector> points;
+
+  Mesh *mesh;
+  Accelerator *bvh;
+  Accelerator *qbvh;
+  // without clustering nodes and prefetching them
+  Accelerator *qbvh_depth_first;
+  Curve *curve;
+  Volume volume;
+  Filter filter;
+};
+
+class BenchResult {
+public:
+  BenchResult() : name(), iterations(0), ns_per_op(0), checksum(0) {}
+  ~BenchResult() {}
+
+  std::string name;
+  long long iterations;
+  double ns_per_op;
+  double checksum;
+};
+
+// returns a checksum so the compiler can't drop the work
+typedef double (*BenchFunction)(const BenchData &data, long long iterations);
+
+static double elapsed_seconds(BenchFunction func, const BenchData &data,
+    long long iterations, double *checksum)
+{
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  *checksum = func(data, iterations);
+  const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(end - start).count();
+}
+
+static BenchResult run_bench(const std::string &name, BenchFunction func,
+    const BenchData &data)
+{
+  BenchResult result;
+  result.name = name;
+
+  // find an iteration count that runs long enough to be timed
+  long long iterations = 1;
+  double checksum = 0;
+  for (;;) {
+    const double sec = elapsed_seconds(func, data, iterations, &checksum);
+    if (sec >= MIN_SECONDS) {
+      break;
+    }
+    const double scale = sec > 0 ? 1.2 * MIN_SECONDS / sec : 10;
+    iterations = static_cast<long long>(iterations * Clamp(scale, 2, 10));
+  }
+
+  double best = REAL_MAX;
+  for (int i = 0; i < REPEAT_COUNT; i++) {
+    const double sec = elapsed_seconds(func, data, iterations, &checksum);
+    best = Min(best, sec);
+  }
+
+  result.iterations = iterations;
+  result.ns_per_op = best * 1e9 / iterations;
+  result.checksum = checksum;
+
+  fprintf(stderr, "  %-32s %12.2f ns/op\n", name.c_str(), result.ns_per_op);
+  return result;
+}
+
+// rays from a sphere around the bounds aimed at random points in the bounds
+static void generate_rays(const Box &bounds, std::vector<Ray> *rays)
+{
+  XorShift rng(1);
+  const Vector center = (bounds.min + bounds.max) * .5;
+  const Vector size = bounds.max - bounds.min;
+  const Real radius = Length(size);
+
+  rays->resize(RAY_COUNT);
+  for (int i = 0; i < RAY_COUNT; i++) {
+    const Vector target = bounds.min + Vector(
+        size.x * rng.NextFloat01(),
+        size.y * rng.NextFloat01(),
+        size.z * rng.NextFloat01());
+    Ray &ray = (*rays)[i];
+    ray.orig = center + radius * rng.HollowSphereRand();
+    ray.dir = Normalize(target - ray.orig);
+    ray.tmin = .001;
+    ray.tmax = REAL_MAX;
+  }
+}
+
+static int read_ascii_ply(const char *filename, Mesh *mesh)
+{
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL) {
+    return -1;
+  }
+
+  char line[1024] = {'\0'};
+  int nverts = 0;
+  int nfaces = 0;
+  int nvert_props = 0;
+  int nface_props = 0;
+  bool is_ascii = false;
+  bool in_face = false;
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    int count = 0;
+    if (strncmp(line, "format ascii", 12) == 0) {
+      is_ascii = true;
+    }
+    else if (sscanf(line, "element vertex %d", &count) == 1) {
+      nverts = count;
+      in_face = false;
+    }
+    else if (sscanf(line, "element face %d", &count) == 1) {
+      nfaces = count;
+      in_face = true;
+    }
+    else if (strncmp(line, "property", 8) == 0) {
+      if (in_face) {
+        nface_props++;
+      } else {
+        nvert_props++;
+      }
+    }
+    else if (strncmp(line, "end_header", 10) == 0) {
+      break;
+    }
+  }
+
+  if (!is_ascii || nverts == 0 || nfaces == 0 || nvert_props < 3) {
+    fclose(fp);
+    return -1;
+  }
+
+  std::vector<Vector> P(nverts);
+  for (int i = 0; i < nverts; i++) {
+    for (int j = 0; j < nvert_props; j++) {
+      double value = 0;
+      if (fscanf(fp, "%lf", &value) != 1) {
+        fclose(fp);
+        return -1;
+      }
+      if (j < 3) {
+        P[i][j] = value;
+      }
+    }
+  }
+
+  // polygons are split into triangle fans
+  std::vector<Index3> indices;
+  for (int i = 0; i < nfaces; i++) {
+    int count = 0;
+    if (fscanf(fp, "%d", &count) != 1 || count < 3) {
+      fclose(fp);
+      return -1;
+    }
+    std::vector<Index> face(count);
+    for (int j = 0; j < count; j++) {
+      if (fscanf(fp, "%d", &face[j]) != 1 || face[j] < 0 || face[j] >= nverts) {
+        fclose(fp);
+        return -1;
+      }
+    }
+    for (int j = 1; j < count - 1; j++) {
+      indices.push_back(Index3(face[0], face[j], face[j + 1]));
+    }
+    // skip properties after the vertex list
+    for (int j = 1; j < nface_props; j++) {
+      double value = 0;
+      if (fscanf(fp, "%lf", &value) != 1) {
+        fclose(fp);
+        return -1;
+      }
+    }
+  }
+  fclose(fp);
+
+  mesh->SetPointCount(nverts);
+  mesh->AddPointPosition();
+  for (int i = 0; i < nverts; i++) {
+    mesh->SetPointPosition(i, P[i]);
+  }
+
+  const int NFACES = static_cast<int>(indices.size());
+  mesh->SetFaceCount(NFACES);
+  mesh->AddFaceIndices();
+  for (int i = 0; i < NFACES; i++) {
+    mesh->SetFaceIndices(i, indices[i]);
+  }
+
+  mesh->ComputeNormals();
+  mesh->ComputeBounds();
+
+  return 0;
+}
+
+static void generate_sphere(int nu, int nv, Mesh *mesh)
+{
+  const int NVERTS = nu * (nv + 1);
+  const int NFACES = 2 * nu * nv;
+
+  mesh->SetPointCount(NVERTS);
+  mesh->AddPointPosition();
+  for (int j = 0; j <= nv; j++) {
+    const Real theta = PI * j / nv;
+    for (int i = 0; i < nu; i++) {
+      const Real phi = 2 * PI * i / nu;
+      const Vector P(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+      mesh->SetPointPosition(j * nu + i, P);
+    }
+  }
+
+  mesh->SetFaceCount(NFACES);
+  mesh->AddFaceIndices();
+  for (int j = 0; j < nv; j++) {
+    for (int i = 0; i < nu; i++) {
+      const Index i00 = j * nu + i;
+      const Index i01 = j * nu + (i + 1) % nu;
+      const Index i10 = i00 + nu;
+      const Index i11 = i01 + nu;
+      const int face_id = 2 * (j * nu + i);
+      mesh->SetFaceIndices(face_id + 0, Index3(i00, i10, i11));
+      mesh->SetFaceIndices(face_id + 1, Index3(i00, i11, i01));
+    }
+  }
+
+  mesh->ComputeNormals();
+  mesh->ComputeBounds();
+}
+
+// strands standing on the unit square
+static void generate_curves(int count, Curve *curve)
+{
+  XorShift rng(2);
+  const int NVERTS = 4 * count;
+
+  curve->SetVertexCount(NVERTS);
+  curve->SetCurveCount(count);
+  curve->AddVertexPosition();
+  curve->AddVertexWidth();
+  curve->AddVertexColor();
+  curve->AddCurveIndices();
+
+  for (int i = 0; i < count; i++) {
+    const Vector root(2 * rng.NextFloat01() - 1, 0, 2 * rng.NextFloat01() - 1);
+    const Vector bend = .2 * rng.SolidSphereRand();
+
+    for (int j = 0; j < 4; j++) {
+      const Real s = j / 3.;
+      const Vector P = root + Vector(0, s, 0) + s * s * bend;
+      curve->SetVertexPosition(4 * i + j, P);
+      curve->SetVertexWidth(4 * i + j, .01 * (1 - .5 * s));
+      curve->SetVertexColor(4 * i + j, Color(1, 1, 1));
+    }
+    curve->SetCurveIndices(i, 4 * i);
+  }
+
+  curve->ComputeBounds();
+}
+
+static void generate_volume(int res, Volume *volume)
+{
+  volume->Resize(res, res, res);
+  volume->SetBounds(Box(Vector(-1, -1, -1), Vector(1, 1, 1)));
+
+  for (int k = 0; k < res; k++) {
+    for (int j = 0; j < res; j++) {
+      for (int i = 0; i < res; i++) {
+        const Vector P = volume->IndexToPoint(i, j, k);
+        const Real noise = PerlinNoise(3 * P, 2, .5, 4);
+        volume->SetValue(i, j, k, Max(noise, 0.));
+      }
+    }
+  }
+}
+
+static double bench_box_ray_intersect(const BenchData &data, long long n)
+{
+  const Box box(Vector(-.5, -.5, -.5), Vector(.5, .5, .5));
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    const Ray &ray = data.rays[i & RAY_MASK];
+    Real tmin = 0, tmax = 0;
+    if (BoxRayIntersect(box, ray.orig, ray.dir, ray.tmin, ray.tmax, &tmin, &tmax)) {
+      sum += tmin;
+    }
+  }
+  return sum;
+}
+
+static double bench_tri_ray_intersect(const BenchData &data, long long n)
+{
+  const Vector vert0(-.5, -.5, 0), vert1(.5, -.5, 0), vert2(0, .5, 0);
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    const Ray &ray = data.rays[i & RAY_MASK];
+    Real t = 0, u = 0, v = 0;
+    if (TriRayIntersect(vert0, vert1, vert2, ray.orig, ray.dir,
+          DO_NOT_CULL_BACKFACES, &t, &u, &v)) {
+      sum += t;
+    }
+  }
+  return sum;
+}
+
+static double bench_tri_ray_intersect4(const BenchData &data, long long n)
+{
+  // 4 triangles per iteration
+  PrecomputedTriangle tris[4];
+  const PrecomputedTriangle *ptrs[4];
+  for (int i = 0; i < 4; i++) {
+    const Real z = .1 * i;
+    TriPrecompute(Vector(-.5, -.5, z), Vector(.5, -.5, z), Vector(0, .5, z), &tris[i]);
+    ptrs[i] = &tris[i];
+  }
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    const Ray &ray = data.rays[i & RAY_MASK];
+    Real t[4], u[4], v[4];
+    sum += TriRayIntersect4(ptrs, 4, ray.orig, ray.dir, t, u, v);
+  }
+  return sum;
+}
+
+static double bench_curve_ray_intersect(const BenchData &data, long long n)
+{
+  // each ray is tested against one curve so this mostly times the bezier
+  // subdivision in converge_bezier3
+  const int NCURVES = data.curve->GetPrimitiveCount();
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    const Ray &ray = data.rays[i & RAY_MASK];
+    Intersection isect;
+    if (data.curve->RayIntersect(i % NCURVES, ray, 0, &isect)) {
+      sum += isect.t_hit;
+    }
+  }
+  return sum;
+}
+
+static double bench_perlin_noise(const BenchData &data, long long n)
+{
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    sum += PerlinNoise(data.points[i & RAY_MASK], 2, .5, 8);
+  }
+  return sum;
+}
+
+static double bench_filter_evaluate(const BenchData &data, long long n)
+{
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    const Vector &P = data.points[i & RAY_MASK];
+    sum += data.filter.Evaluate(P.x, P.y);
+  }
+  return sum;
+}
+
+static double bench_bvh_build(const BenchData &data, long long n)
+{
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    BVHAccelerator acc;
+    acc.SetPrimitiveSet(data.mesh);
+    acc.Build();
+    sum += acc.GetNodeCount();
+  }
+  return sum;
+}
+
+static double bench_qbvh_build(const BenchData &data, long long n)
+{
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    QBVHAccelerator acc;
+    acc.SetPrimitiveSet(data.mesh);
+    acc.Build();
+    sum += acc.GetNodeCount();
+  }
+  return sum;
+}
+
+static double trace_rays(const Accelerator *acc, const BenchData &data, long long n,
+    bool any_hit)
+{
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    const Ray &ray = data.rays[i & RAY_MASK];
+    Intersection isect;
+    const bool hit = any_hit ?
+        acc->Occlude(ray, 0, &isect) :
+        acc->Intersect(ray, 0, &isect);
+    if (hit) {
+      sum += any_hit ? 1 : isect.t_hit;
+    }
+  }
+  return sum;
+}
+
+static double bench_bvh_intersect(const BenchData &data, long long n)
+{
+  return trace_rays(data.bvh, data, n, false);
+}
+
+static double bench_bvh_occlude(const BenchData &data, long long n)
+{
+  return trace_rays(data.bvh, data, n, true);
+}
+
+static double bench_qbvh_intersect(const BenchData &data, long long n)
+{
+  return trace_rays(data.qbvh, data, n, false);
+}
+
+static double bench_qbvh_occlude(const BenchData &data, long long n)
+{
+  return trace_rays(data.qbvh, data, n, true);
+}
+
+static double bench_qbvh_intersect_depth_first(const BenchData &data, long long n)
+{
+  return trace_rays(data.qbvh_depth_first, data, n, false);
+}
+
+static double bench_volume_raymarch(const BenchData &data, long long n)
+{
+  // the same stepping and compositing as raymarch_volume in fj_shading.cc
+  const Real t_delta = .01;
+  const Box &bounds = data.volume.GetBounds();
+  double sum = 0;
+
+  for (long long i = 0; i < n; i++) {
+    const Ray &ray = data.rays[i & RAY_MASK];
+    Real t_start = 0, t_limit = 0;
+    if (!BoxRayIntersect(bounds, ray.orig, ray.dir, ray.tmin, ray.tmax,
+          &t_start, &t_limit)) {
+      continue;
+    }
+
+    const Vector ray_delta = t_delta * ray.dir;
+    Vector P = RayPointAt(ray, t_start);
+    float alpha = 0;
+
+    for (Real t = t_start; t <= t_limit && alpha < 1; t += t_delta) {
+      VolumeSample sample;
+      data.volume.GetSample(P, &sample);
+      const float opacity = t_delta * sample.density;
+      alpha = alpha + Clamp(opacity, 0, 1) * (1 - alpha);
+      P += ray_delta;
+    }
+    sum += alpha;
+  }
+  return sum;
+}
+
+static void run_mesh_bench(const std::string &mesh_name, Mesh *mesh,
+    BenchData *data, std::vector<BenchResult> *results)
+{
+  BVHAccelerator bvh;
+  QBVHAccelerator qbvh;
+  QBVHAccelerator qbvh_depth_first;
+  bvh.SetPrimitiveSet(mesh);
+  qbvh.SetPrimitiveSet(mesh);
+  qbvh_depth_first.SetPrimitiveSet(mesh);
+  qbvh_depth_first.SetNodeLayout(QBVH_LAYOUT_DEPTH_FIRST);
+  qbvh_depth_first.SetPrefetch(false);
+  bvh.Build();
+  qbvh.Build();
+  qbvh_depth_first.Build();
+
+  data->mesh = mesh;
+  data->bvh = &bvh;
+  data->qbvh = &qbvh;
+  data->qbvh_depth_first = &qbvh_depth_first;
+  generate_rays(mesh->GetBounds(), &data->rays);
+
+  results->push_back(run_bench("bvh_build/" + mesh_name, bench_bvh_build, *data));
+  results->push_back(run_bench("qbvh_build/" + mesh_name, bench_qbvh_build, *data));
+  results->push_back(run_bench("bvh_intersect/" + mesh_name, bench_bvh_intersect, *data));
+  results->push_back(run_bench("bvh_occlude/" + mesh_name, bench_bvh_occlude, *data));
+  results->push_back(run_bench("qbvh_intersect/" + mesh_name, bench_qbvh_intersect, *data));
+  results->push_back(run_bench("qbvh_occlude/" + mesh_name, bench_qbvh_occlude, *data));
+  results->push_back(run_bench("qbvh_intersect_depth_first/" + mesh_name,
+      bench_qbvh_intersect_depth_first, *data));
+
+  data->mesh = NULL;
+  data->bvh = NULL;
+  data->qbvh = NULL;
+  data->qbvh_depth_first = NULL;
+}
+
+static std::string get_basename(const std::string &path)
+{
+  const size_t slash = path.find_last_of("/\\");
+  const std::string file = slash == std::string::npos ? path : path.substr(slash + 1);
+  const size_t dot = file.find_last_of('.');
+  return dot == std::string::npos ? file : file.substr(0, dot);
+}
+
+static void print_json(const std::vector<BenchResult> &results)
+{
+  printf("{\n");
+  printf("  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    printf("    {\"name\": \"%s\", \"iterations\": %lld, \"ns_per_op\": %.3f, "
+        "\"checksum\": %.17g}%s\n",
+        r.name.c_str(), r.iterations, r.ns_per_op, r.checksum,
+        i + 1 < results.size() ? "," : "");
+  }
+  printf("  ]\n");
+  printf("}\n");
+}
+
+int main(int argc, const char **argv)
+{
+  std::vector<BenchResult> results;
+  BenchData data;
+
+  XorShift rng(3);
+  data.points.resize(RAY_COUNT);
+  for (int i = 0; i < RAY_COUNT; i++) {
+    data.points[i] = 4 * rng.SolidCubeRand();
+  }
+  data.filter.SetFilterType(FLT_GAUSSIAN, 2, 2);
+
+  Curve curve;
+  generate_curves(256, &curve);
+  data.curve = &curve;
+
+  generate_volume(64, &data.volume);
+
+  fprintf(stderr, "# Kernel Benchmarks\n");
+
+  // primitive kernels
+  generate_rays(Box(Vector(-.5, -.5, -.5), Vector(.5, .5, .5)), &data.rays);
+  results.push_back(run_bench("box_ray_intersect", bench_box_ray_intersect, data));
+  results.push_back(run_bench("tri_ray_intersect", bench_tri_ray_intersect, data));
+  results.push_back(run_bench("tri_ray_intersect4", bench_tri_ray_intersect4, data));
+  results.push_back(run_bench("perlin_noise", bench_perlin_noise, data));
+  results.push_back(run_bench("filter_evaluate", bench_filter_evaluate, data));
+
+  generate_rays(curve.GetBounds(), &data.rays);
+  results.push_back(run_bench("curve_ray_intersect", bench_curve_ray_intersect, data));
+
+  generate_rays(data.volume.GetBounds(), &data.rays);
+  results.push_back(run_bench("volume_raymarch", bench_volume_raymarch, data));
+
+  // acceleration structures
+  std::vector<std::string> ply_files;
+  ply_files.push_back(DEFAULT_PLY);
+  for (int i = 1; i < argc; i++) {
+    ply_files.push_back(argv[i]);
+  }
+
+  for (size_t i = 0; i < ply_files.size(); i++) {
+    Mesh mesh;
+    if (read_ascii_ply(ply_files[i].c_str(), &mesh)) {
+      fprintf(stderr, "  skipped: could not read ascii ply: %s\n", ply_files[i].c_str());
+      continue;
+    }
+    run_mesh_bench(get_basename(ply_files[i]), &mesh, &data, &results);
+  }
+
+  // the shipped ply is tiny so a dense mesh is also measured
+  Mesh sphere;
+  generate_sphere(256, 128, &sphere);
+  run_mesh_bench("sphere", &sphere, &data, &results);
+
+  print_json(results);
+
+  return 0;
+}
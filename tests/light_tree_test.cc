@@ -0,0 +1,91 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_rectangle_light.h"
+#include "fj_point_light.h"
+#include "fj_light_tree.h"
+#include "fj_numeric.h"
+#include "fj_random.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+using namespace fj;
+
+int main()
+{
+  // a row of point lights along x and an area light above
+  std::vector<PointLight> points(20);
+  for (int i = 0; i < 20; i++) {
+    points[i].SetTranslate(i, 0, 0, 0);
+    points[i].SetIntensity(1 + i % 3);
+    points[i].Preprocess();
+  }
+  RectangleLight area;
+  area.SetTranslate(5, 10, 0, 0);
+  area.SetScale(4, 1, 4, 0);
+  area.SetSampleCount(4);
+  area.Preprocess();
+
+  std::vector<const Light *> lights;
+  for (int i = 0; i < 20; i++) {
+    lights.push_back(&points[i]);
+  }
+  lights.push_back(&area);
+
+  LightTree tree;
+  TEST(tree.IsEmpty());
+  tree.Build(&lights[0], lights.size());
+  TEST(!tree.IsEmpty());
+
+  {
+    // area light bounds are of its samples
+    const Box &bounds = area.GetBounds();
+    TEST(bounds.min.x >= 3 && bounds.max.x <= 7);
+    TEST(bounds.min.y == 10 && bounds.max.y == 10);
+  }
+  {
+    // probabilities of all lights sum to 1
+    const Vector P(3.2, .5, .1);
+    Real sum = 0;
+    for (std::size_t i = 0; i < lights.size(); i++) {
+      sum += tree.Pdf(P, lights[i]);
+    }
+    TEST(std::abs(sum - 1) < 16 * REAL_EPSILON);
+  }
+  {
+    // drawn lights follow their probabilities
+    const Vector P(12.3, .5, 0);
+    std::vector<int> counts(lights.size(), 0);
+    XorShift rng;
+    const int N = 200000;
+    bool pdf_matches = true;
+    for (int i = 0; i < N; i++) {
+      Real pdf = 0;
+      const Light *light = tree.Sample(P, rng.NextFloat01(), &pdf);
+      for (std::size_t j = 0; j < lights.size(); j++) {
+        if (lights[j] == light) {
+          counts[j]++;
+        }
+      }
+      pdf_matches = pdf_matches && std::abs(pdf - tree.Pdf(P, light)) < 4 * REAL_EPSILON;
+    }
+    TEST(pdf_matches);
+
+    Real max_error = 0;
+    for (std::size_t j = 0; j < lights.size(); j++) {
+      const Real expected = tree.Pdf(P, lights[j]);
+      max_error = std::max(max_error, std::abs(counts[j] / Real(N) - expected));
+    }
+    TEST(max_error < .01);
+    // nearby lights are drawn more often than far ones of the same power
+    TEST(counts[12] > counts[0] * 10);
+    TEST(counts[12] > 0 && counts[0] > 0);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_memory_arena.h"
+#include "fj_thread_state.h"
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+using namespace fj;
+
+class Item {
+public:
+  Item() : value(7) {}
+  ~Item() {}
+
+  double value;
+};
+
+int main()
+{
+  {
+    // allocations are aligned and don't overlap
+    MemoryArena arena;
+    char *a = static_cast<char *>(arena.Allocate(3));
+    char *b = static_cast<char *>(arena.Allocate(5));
+    TEST(reinterpret_cast<uintptr_t>(a) % 16 == 0);
+    TEST(reinterpret_cast<uintptr_t>(b) % 16 == 0);
+    TEST(b >= a + 3);
+  }
+  {
+    // freeing in reverse order reuses the memory
+    MemoryArena arena;
+    void *a = arena.Allocate(100);
+    void *b = arena.Allocate(100);
+    arena.Free(b);
+    arena.Free(a);
+    TEST(arena.Allocate(100) == a);
+
+    // freeing other than the last one does nothing
+    MemoryArena other;
+    void *c = other.Allocate(100);
+    void *d = other.Allocate(100);
+    other.Free(c);
+    TEST(other.Allocate(100) != c);
+    TEST(d != c);
+  }
+  {
+    // rewind to a mark and reset keep blocks for reuse
+    MemoryArena arena;
+    arena.Allocate(10);
+    const MemoryArena::Mark mark = arena.GetMark();
+    void *a = arena.Allocate(10);
+    arena.Rewind(mark);
+    TEST(arena.Allocate(10) == a);
+
+    for (int i = 0; i < 1000; i++) {
+      arena.Allocate(1000);
+    }
+    const std::size_t reserved = arena.GetReservedSize();
+    arena.Reset();
+    for (int i = 0; i < 1000; i++) {
+      arena.Allocate(1000);
+    }
+    TEST(arena.GetReservedSize() == reserved);
+  }
+  {
+    // larger than a block
+    MemoryArena arena;
+    char *a = static_cast<char *>(arena.Allocate(1 << 20));
+    a[(1 << 20) - 1] = 1;
+    TEST(arena.GetReservedSize() >= (1 << 20));
+  }
+  {
+    // larger alignments and freeing them
+    MemoryArena arena;
+    arena.Allocate(3);
+    char *a = static_cast<char *>(arena.AllocateAligned(10, 64));
+    TEST(reinterpret_cast<uintptr_t>(a) % 64 == 0);
+    arena.Free(a);
+    TEST(arena.AllocateAligned(10, 64) == a);
+    char *b = static_cast<char *>(arena.AllocateAligned(100 * 1024, 256));
+    TEST(reinterpret_cast<uintptr_t>(b) % 256 == 0);
+  }
+  {
+    // a value for each thread isolated in cache lines
+    ThreadState<Item> state;
+    Item &main_item = state.Get();
+    main_item.value = 1;
+    TEST(&state.Get() == &main_item);
+    TEST(reinterpret_cast<uintptr_t>(&main_item) % THREAD_STATE_ALIGNMENT == 0);
+
+    Item *other_item = NULL;
+    double other_value = 0;
+    std::thread other([&]()
+        {
+          other_item = &state.Get();
+          other_value = other_item->value;
+        });
+    other.join();
+    TEST(other_item != &main_item);
+    TEST(other_value == 7);
+    TEST(state.Get().value == 1);
+
+    state.Clear();
+    TEST(state.Get().value == 7);
+  }
+  {
+    // arrays are default constructed
+    Item *items = MemoryArenaGetThreadLocal().NewArray<Item>(10);
+    int constructed = 0;
+    for (int i = 0; i < 10; i++) {
+      constructed += items[i].value == 7;
+    }
+    TEST(constructed == 10);
+    MemoryArenaGetThreadLocal().Reset();
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_geometry_io.h"
+#include "fj_geometry_pager.h"
+#include "fj_mesh.h"
+#include <cstdio>
+
+using namespace fj;
+
+static void make_quad(Mesh &mesh)
+{
+  mesh.Clear();
+  mesh.SetPointCount(4);
+  mesh.SetFaceCount(2);
+  mesh.AddPointPosition();
+  mesh.AddFaceIndices();
+  mesh.SetPointPosition(0, Vector(0, 0, 0));
+  mesh.SetPointPosition(1, Vector(1, 0, 0));
+  mesh.SetPointPosition(2, Vector(1, 1, 0));
+  mesh.SetPointPosition(3, Vector(0, 1, 0));
+  mesh.SetFaceIndices(0, Index3(0, 1, 2));
+  mesh.SetFaceIndices(1, Index3(0, 2, 3));
+  mesh.ComputeNormals();
+}
+
+int main()
+{
+  const char filename[] = "mesh_io_test.bin";
+  {
+    // mapped meshes have the same data as written
+    Mesh src;
+    make_quad(src);
+    TEST(MeshOutputFile(filename).Write(src) == 0);
+
+    Mesh dst;
+    TEST(MeshInputFile(filename).Read(dst) == 0);
+    TEST(dst.GetPointCount() == 4);
+    TEST(dst.GetFaceCount() == 2);
+    TEST(dst.HasPointNormal());
+    TEST(dst.GetPointPosition(2).x == 1 && dst.GetPointPosition(2).y == 1);
+    TEST(dst.GetPointNormal(3).z == src.GetPointNormal(3).z);
+    TEST(dst.GetFaceIndices(1).i2 == 3);
+    TEST(dst.GetBounds().max.x == 1 && dst.GetBounds().max.y == 1);
+
+    // writing copies the mapped data
+    dst.SetPointPosition(2, Vector(2, 2, 2));
+    TEST(dst.GetPointPosition(2).x == 2);
+    TEST(dst.GetPointPosition(1).x == 1);
+
+    // the mapping outlives the file
+    remove(filename);
+    TEST(dst.GetFaceIndices(0).i1 == 1);
+    TEST(dst.GetPointNormal(0).z == src.GetPointNormal(0).z);
+  }
+  {
+    // paged meshes read evicted clusters again from the file
+    GeometryPager &pager = GeometryPagerGetGlobal();
+    pager.SetMemoryBudget(1);
+
+    Mesh src;
+    make_quad(src);
+    TEST(MeshOutputFile(filename).Write(src) == 0);
+    {
+      Mesh dst;
+      TEST(MeshInputFile(filename).Read(dst) == 0);
+      TEST(pager.GetMappedSize() > 0);
+      TEST(pager.Trim() == 1);
+      TEST(dst.GetPointPosition(2).x == 1 && dst.GetPointPosition(2).y == 1);
+      TEST(dst.GetFaceIndices(1).i2 == 3);
+      TEST(dst.GetBounds().max.x == 1 && dst.GetBounds().max.y == 1);
+    }
+    TEST(pager.GetMappedSize() == 0);
+    TEST(pager.GetEvictedClusterCount() == 1);
+
+    pager.SetMemoryBudget(0);
+    remove(filename);
+  }
+  {
+    // broken files leave the mesh as it is
+    FILE *file = fopen(filename, "wb");
+    fputs("fjmesh", file);
+    fclose(file);
+
+    Mesh mesh;
+    make_quad(mesh);
+    TEST(MeshInputFile(filename).Read(mesh) == -1);
+    TEST(MeshInputFile("no_such_file.bin").Read(mesh) == -1);
+    TEST(mesh.GetFaceCount() == 2);
+    remove(filename);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,422 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_multi_thread.h"
+#include "fj_progress.h"
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+
+using namespace fj;
+
+static const int THREAD_COUNT = 4;
+
+class LoopData {
+public:
+  LoopData(int count) : visits(count), cancel_at(-1), max_thread_id(0),
+      context_mismatch_count(0) {}
+  ~LoopData() {}
+
+  std::vector<std::atomic<int>> visits;
+  int cancel_at;
+  std::atomic<int> max_thread_id;
+  std::atomic<int> context_mismatch_count;
+};
+
+static LoopStatus visit_task(void *data, const ThreadContext &context)
+{
+  LoopData *loop = reinterpret_cast<LoopData *>(data);
+  loop->visits[context.iteration_id]++;
+
+  const ThreadContext &current = MtGetThreadContext();
+  if (current.thread_id != context.thread_id ||
+      current.iteration_id != context.iteration_id ||
+      current.thread_id != MtGetThreadID()) {
+    loop->context_mismatch_count++;
+  }
+
+  if (context.thread_id > loop->max_thread_id) {
+    loop->max_thread_id = context.thread_id;
+  }
+  if (context.iteration_id == loop->cancel_at) {
+    return LoopStatus::Cancel;
+  }
+  return LoopStatus::Continue;
+}
+
+// counts leaves of a binary tree of ranges [begin, end) by spawning tasks
+class RangeData {
+public:
+  RangeData() : leaf_count(0) {}
+  ~RangeData() {}
+
+  std::atomic<int> leaf_count;
+};
+
+static const int RANGE_BITS = 12;
+
+static LoopStatus split_range_task(void *data, const ThreadContext &context)
+{
+  RangeData *range = reinterpret_cast<RangeData *>(data);
+  // iteration_id encodes a node of an implicit binary tree
+  const int node = context.iteration_id;
+
+  if (node >= (1 << RANGE_BITS)) {
+    range->leaf_count++;
+    return LoopStatus::Continue;
+  }
+
+  TaskGroup group;
+  group.Spawn(data, split_range_task, 2 * node);
+  group.Spawn(data, split_range_task, 2 * node + 1);
+  return group.Wait();
+}
+
+static LoopStatus nested_loop_task(void *data, const ThreadContext &context)
+{
+  LoopData *loop = reinterpret_cast<LoopData *>(data);
+  std::vector<int> que(10);
+  for (int i = 0; i < 10; i++) {
+    que[i] = 10 * context.iteration_id + i;
+  }
+  return MtRunParallelLoop(loop, visit_task, THREAD_COUNT, que);
+}
+
+// outer iterations running nested loops. counts outer iterations started
+// on a thread while it is still inside another one and nested iterations
+// of another outer iteration run by a thread waiting for its own
+class OuterLoopData {
+public:
+  OuterLoopData(int count) : inner(10 * count), visits(count),
+      reentry_count(0), foreign_count(0), cancelled_count(0) {}
+  ~OuterLoopData() {}
+
+  LoopData inner;
+  std::vector<std::atomic<int>> visits;
+  std::atomic<int> reentry_count;
+  std::atomic<int> foreign_count;
+  std::atomic<int> cancelled_count;
+};
+
+// the outer iteration the calling thread is inside. -1 if none
+static thread_local int current_outer = -1;
+
+static LoopStatus inner_loop_task(void *data, const ThreadContext &context)
+{
+  OuterLoopData *outer = reinterpret_cast<OuterLoopData *>(data);
+  if (current_outer != -1 && current_outer != context.iteration_id / 10) {
+    outer->foreign_count++;
+  }
+
+  // long enough that other threads steal the rest of the nested loop
+  std::this_thread::sleep_for(std::chrono::microseconds(100));
+  return visit_task(&outer->inner, context);
+}
+
+static LoopStatus outer_loop_task(void *data, const ThreadContext &context)
+{
+  OuterLoopData *outer = reinterpret_cast<OuterLoopData *>(data);
+  outer->visits[context.iteration_id]++;
+  if (current_outer != -1) {
+    outer->reentry_count++;
+  }
+
+  std::vector<int> que(10);
+  for (int i = 0; i < 10; i++) {
+    que[i] = 10 * context.iteration_id + i;
+  }
+  const int prev_outer = current_outer;
+  current_outer = context.iteration_id;
+  const LoopStatus status = MtRunParallelLoop(outer, inner_loop_task, THREAD_COUNT, que);
+  current_outer = prev_outer;
+
+  if (status == LoopStatus::Cancel) {
+    outer->cancelled_count++;
+  }
+  return LoopStatus::Continue;
+}
+
+// iteration 0 waits for its task running on another thread while
+// iteration 1 leaves its own task queued
+class HandshakeData {
+public:
+  HandshakeData() : waited_started(false), waited_finished(false),
+      queued_started(false), foreign_count(0) {}
+  ~HandshakeData() {}
+
+  std::atomic<bool> waited_started;
+  std::atomic<bool> waited_finished;
+  std::atomic<bool> queued_started;
+  std::atomic<int> foreign_count;
+};
+
+static bool wait_for_flag(const std::atomic<bool> &flag, int milliseconds)
+{
+  const std::chrono::steady_clock::time_point end =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+  while (!flag.load()) {
+    if (std::chrono::steady_clock::now() > end) {
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+static LoopStatus handshake_inner_task(void *data, const ThreadContext &context)
+{
+  HandshakeData *handshake = reinterpret_cast<HandshakeData *>(data);
+  if (context.iteration_id == 0) {
+    handshake->waited_started = true;
+    // finishes early if the thread waiting for it takes the other task
+    wait_for_flag(handshake->queued_started, 100);
+    handshake->waited_finished = true;
+  } else {
+    handshake->queued_started = true;
+    if (current_outer != -1 && current_outer != 1) {
+      handshake->foreign_count++;
+    }
+  }
+  return LoopStatus::Continue;
+}
+
+static LoopStatus handshake_task(void *data, const ThreadContext &context)
+{
+  HandshakeData *handshake = reinterpret_cast<HandshakeData *>(data);
+  const int prev_outer = current_outer;
+  current_outer = context.iteration_id;
+
+  TaskGroup group;
+  if (context.iteration_id == 0) {
+    group.Spawn(handshake, handshake_inner_task, 0);
+    wait_for_flag(handshake->waited_started, 1000);
+  } else {
+    wait_for_flag(handshake->waited_started, 1000);
+    group.Spawn(handshake, handshake_inner_task, 1);
+    wait_for_flag(handshake->waited_finished, 1000);
+  }
+  const LoopStatus status = group.Wait();
+
+  current_outer = prev_outer;
+  return status;
+}
+
+// counts samples and tiles of each thread in its own counter
+static LoopStatus count_task(void *data, const ThreadContext &context)
+{
+  ProgressReporter *reporter = reinterpret_cast<ProgressReporter *>(data);
+  ProgressCounter *counter = reporter->GetCounter(context.thread_id);
+
+  for (int i = 0; i < 100; i++) {
+    counter->AddSample();
+  }
+  counter->AddTile();
+  return reporter->IsCanceled() ? LoopStatus::Cancel : LoopStatus::Continue;
+}
+
+static int poll_cancel(void *data)
+{
+  const std::atomic<bool> *cancel = reinterpret_cast<std::atomic<bool> *>(data);
+  return *cancel;
+}
+
+int main()
+{
+  {
+    // every iteration runs exactly once
+    const int N = 1000;
+    LoopData loop(N);
+    std::vector<int> que(N);
+    for (int i = 0; i < N; i++) {
+      que[i] = i;
+    }
+
+    const LoopStatus status = MtRunParallelLoop(&loop, visit_task, THREAD_COUNT, que);
+    int once = 0;
+    for (int i = 0; i < N; i++) {
+      once += loop.visits[i] == 1;
+    }
+    TEST(status == LoopStatus::Continue);
+    TEST(once == N);
+    TEST(loop.max_thread_id < THREAD_COUNT);
+    TEST(loop.context_mismatch_count == 0);
+    TEST(MtGetThreadContext().thread_id == 0);
+    TEST(MtGetThreadContext().thread_count == 1);
+  }
+
+  // the rest runs on the pool
+  TEST(MtStartThreadPool(THREAD_COUNT) == 0);
+  TEST(MtGetThreadPoolSize() == THREAD_COUNT);
+  TEST(MtSetWorkerCPU(THREAD_COUNT, 0) == -1);
+  {
+    // cancelled loops stop and don't affect the next loop
+    const int N = 1000;
+    LoopData loop(N);
+    loop.cancel_at = 0;
+    std::vector<int> que(N);
+    for (int i = 0; i < N; i++) {
+      que[i] = i;
+    }
+
+    TEST(MtRunParallelLoop(&loop, visit_task, THREAD_COUNT, que) == LoopStatus::Cancel);
+
+    loop.cancel_at = -1;
+    TEST(MtRunParallelLoop(&loop, visit_task, THREAD_COUNT, que) == LoopStatus::Continue);
+  }
+  {
+    // recursive tasks
+    RangeData range;
+    std::vector<int> que(1, 1);
+
+    const LoopStatus status = MtRunParallelLoop(&range, split_range_task, THREAD_COUNT, que);
+    TEST(status == LoopStatus::Continue);
+    TEST(range.leaf_count == (1 << RANGE_BITS));
+  }
+  {
+    // tasks spawned outside loops run immediately
+    RangeData range;
+    TaskGroup group;
+    group.Spawn(&range, split_range_task, 1 << (RANGE_BITS - 2));
+    TEST(range.leaf_count == 4);
+    TEST(group.Wait() == LoopStatus::Continue);
+  }
+  {
+    // nested loops run on the threads of the outer loop
+    const int N = 100;
+    LoopData loop(10 * N);
+    std::vector<int> que(N);
+    for (int i = 0; i < N; i++) {
+      que[i] = i;
+    }
+
+    const LoopStatus status = MtRunParallelLoop(&loop, nested_loop_task, THREAD_COUNT, que);
+    int once = 0;
+    for (int i = 0; i < 10 * N; i++) {
+      once += loop.visits[i] == 1;
+    }
+    TEST(status == LoopStatus::Continue);
+    TEST(once == 10 * N);
+    TEST(loop.max_thread_id < THREAD_COUNT);
+    TEST(loop.context_mismatch_count == 0);
+  }
+  {
+    // threads waiting for nested loops don't start outer iterations and
+    // a nested loop cancels only itself
+    const int N = 100;
+    OuterLoopData outer(N);
+    outer.inner.cancel_at = 0;
+    std::vector<int> que(N);
+    for (int i = 0; i < N; i++) {
+      que[i] = i;
+    }
+
+    const LoopStatus status = MtRunParallelLoop(&outer, outer_loop_task, THREAD_COUNT, que);
+    int once = 0;
+    for (int i = 0; i < N; i++) {
+      once += outer.visits[i] == 1;
+    }
+    TEST(status == LoopStatus::Continue);
+    TEST(once == N);
+    TEST(outer.reentry_count == 0);
+    TEST(outer.foreign_count == 0);
+    TEST(outer.cancelled_count == 1);
+  }
+  {
+    // a thread waiting for a task stolen by another thread doesn't take
+    // the task queued by another outer iteration
+    HandshakeData handshake;
+    std::vector<int> que(2);
+    que[0] = 0;
+    que[1] = 1;
+
+    TEST(MtRunParallelLoop(&handshake, handshake_task, 3, que) == LoopStatus::Continue);
+    TEST(handshake.queued_started);
+    TEST(handshake.foreign_count == 0);
+  }
+  {
+    // loops with more threads than the pool spawn their own
+    const int N = 100;
+    LoopData loop(N);
+    std::vector<int> que(N);
+    for (int i = 0; i < N; i++) {
+      que[i] = i;
+    }
+
+    TEST(MtRunParallelLoop(&loop, visit_task, 2 * THREAD_COUNT, que) == LoopStatus::Continue);
+    TEST(loop.max_thread_id < 2 * THREAD_COUNT);
+  }
+  {
+    // counters of workers are summed and polling cancels the reporter
+    std::atomic<bool> cancel(false);
+    ProgressReporter reporter;
+    reporter.Init(THREAD_COUNT, poll_cancel, &cancel);
+    reporter.Start(64, false);
+    TEST(!reporter.IsCanceled());
+
+    std::vector<int> que(64);
+    for (int i = 0; i < 64; i++) {
+      que[i] = i;
+    }
+    TEST(MtRunParallelLoop(&reporter, count_task, THREAD_COUNT, que) == LoopStatus::Continue);
+    TEST_INT(reporter.GetSampleCount(), 6400);
+    TEST_INT(reporter.GetTileCount(), 64);
+
+    cancel = true;
+    reporter.Start(64, false);
+    TEST(reporter.IsCanceled());
+    TEST_INT(reporter.GetTileCount(), 0);
+    reporter.Stop();
+  }
+
+  {
+    // shared data keeps its values wherever its pages go
+    TEST(MtGetNumaNodeCount() >= 1);
+    if (MtGetNumaNodeCount() == 1) {
+      TEST_INT(MtBindWorkersToNumaNodes(), -1);
+    }
+
+    std::vector<int> shared(1 << 20);
+    for (int i = 0; i < static_cast<int>(shared.size()); i++) {
+      shared[i] = i;
+    }
+    MtInterleaveSharedMemory(shared);
+    TEST_INT(shared[12345], 12345);
+    TEST_INT(shared.back(), (1 << 20) - 1);
+  }
+
+  {
+    // processes hold cpus of the host budget until released
+    TEST(MtGetMaxAvailableThreadCount() >= 1);
+
+    HostCPULease a, b;
+    TEST_INT(a.Acquire(".", 0, 8), 8);
+    TEST_INT(a.GetHeldCount(), 0);
+
+    TEST_INT(a.Acquire(".", 3, 2), 2);
+    TEST_INT(b.Acquire(".", 3, 2), 1);
+    TEST_INT(b.GetHeldCount(), 1);
+    TEST_INT(b.Acquire(".", 1, 2), 1);
+    TEST_INT(b.GetHeldCount(), 0);
+
+    a.Release();
+    TEST_INT(b.Acquire(".", 3, 4), 3);
+    b.Release();
+
+    for (int i = 0; i < 3; i++) {
+      char filename[64] = {'\0'};
+      sprintf(filename, "./fj_host_cpu_%d.lock", i);
+      remove(filename);
+    }
+  }
+
+  MtStopThreadPool();
+  TEST(MtGetThreadPoolSize() == 0);
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,176 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_turbulence.h"
+#include "fj_random.h"
+#include "fj_vector.h"
+#include "fj_noise.h"
+#include "fj_cpu.h"
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+static const Real TOLERANCE = 1e-5;
+
+static Real octave_sum(const Vector &position, int octaves)
+{
+  Vector P = position;
+  Real noise = 0;
+  Real amp = 1;
+  for (int i = 0; i < octaves; i++) {
+    noise += amp * PeriodicNoise3d(P.x, P.y, P.z);
+    amp *= .5;
+    P *= 2;
+  }
+  return noise;
+}
+
+int main()
+{
+  {
+    // single precision noise is the double precision noise
+    XorShift rng;
+    Real max_error = 0;
+    for (int i = 0; i < 1000; i += 4) {
+      Real x[4], y[4], z[4];
+      for (int j = 0; j < 4; j++) {
+        const Vector P = 300 * rng.SolidCubeRand();
+        x[j] = P.x;
+        y[j] = P.y;
+        z[j] = P.z;
+      }
+      float noise[4];
+      PeriodicNoise3d4(x, y, z, noise);
+      for (int j = 0; j < 4; j++) {
+        const Real expected = PeriodicNoise3d(x[j], y[j], z[j]);
+        max_error = std::max(max_error, std::abs(noise[j] - expected));
+        max_error = std::max(max_error,
+            std::abs(PeriodicNoise3df(x[j], y[j], z[j]) - expected));
+      }
+    }
+    TEST(max_error < TOLERANCE);
+
+    // noise is 0 on lattice points
+    const Real x[4] = {0, 1, -3, 100000};
+    const Real y[4] = {0, 2, 7, -100000};
+    const Real z[4] = {0, -5, 1, 3};
+    float noise[4] = {1, 1, 1, 1};
+    PeriodicNoise3d4(x, y, z, noise);
+    TEST(noise[0] == 0 && noise[1] == 0 && noise[2] == 0 && noise[3] == 0);
+  }
+  {
+    // octaves of positions share lanes without mixing them
+    XorShift rng;
+    Vector P[7];
+    Real noise[7];
+    for (int i = 0; i < 7; i++) {
+      P[i] = 4 * rng.SolidCubeRand();
+    }
+    PerlinNoise(P, 7, 2, .5, 3, noise);
+
+    Real max_error = 0;
+    for (int i = 0; i < 7; i++) {
+      max_error = std::max(max_error, std::abs(noise[i] - octave_sum(P[i], 3)));
+      max_error = std::max(max_error,
+          std::abs(PerlinNoise(P[i], 2, .5, 3) - octave_sum(P[i], 3)));
+    }
+    TEST(max_error < TOLERANCE);
+
+    const Vector noise3d = PerlinNoise3d(P[0], 2, .5, 8);
+    TEST(std::abs(noise3d.x - octave_sum(P[0], 8)) < TOLERANCE);
+    TEST(std::abs(noise3d.z -
+        octave_sum(P[0] + Vector(237.492, 11.1312, 133.129), 8)) < TOLERANCE);
+  }
+  {
+    // batched turbulence is the same as one at a time
+    Turbulence turbulence;
+    turbulence.SetFrequency(2, 3, 4);
+    turbulence.SetAmplitude(1.5, 1, 1);
+    const Vector P[3] = {Vector(.1, .2, .3), Vector(-1, 5, 2), Vector(7, 0, .5)};
+    Real noise[3];
+    turbulence.Evaluate(P, 3, noise);
+    TEST(noise[0] == turbulence.Evaluate(P[0]));
+    TEST(noise[1] == turbulence.Evaluate(P[1]));
+    TEST(noise[2] == turbulence.Evaluate(P[2]));
+  }
+
+  {
+    // 8 lanes are the same noise at every simd level
+    XorShift rng;
+    Real x[8], y[8], z[8];
+    for (int i = 0; i < 8; i++) {
+      const Vector P = 300 * rng.SolidCubeRand();
+      x[i] = P.x;
+      y[i] = P.y;
+      z[i] = P.z;
+    }
+    const int level = CpuGetSimdLevel();
+    const int levels[2] = {CPU_SIMD_SSE2, CPU_SIMD_AVX2};
+    Real max_error = 0;
+    for (int i = 0; i < 2; i++) {
+      CpuSetSimdLevel(levels[i]);
+      TEST(CpuGetSimdLevel() <= levels[i]);
+      float noise[8];
+      PeriodicNoise3d8(x, y, z, noise);
+      for (int j = 0; j < 8; j++) {
+        max_error = std::max(max_error,
+            std::abs(noise[j] - PeriodicNoise3d(x[j], y[j], z[j])));
+      }
+    }
+    CpuSetSimdLevel(level);
+    TEST(max_error < TOLERANCE);
+  }
+  {
+    // tiled noise repeats over the period and is the noise at 256
+    XorShift rng;
+    Real max_error = 0;
+    for (int i = 0; i < 100; i++) {
+      const Vector P = 20 * rng.SolidCubeRand();
+      max_error = std::max(max_error,
+          std::abs(TiledNoise3d(P.x, P.y, P.z, 256) - PeriodicNoise3d(P.x, P.y, P.z)));
+      max_error = std::max(max_error,
+          std::abs(TiledNoise3d(P.x + 6, P.y - 12, P.z, 6) - TiledNoise3d(P.x, P.y, P.z, 6)));
+    }
+    TEST(max_error < TOLERANCE);
+  }
+  {
+    // baked turbulence is the tiled octaves at voxels and repeats
+    Turbulence turbulence;
+    turbulence.SetOctaves(2);
+    turbulence.SetBakeResolution(64);
+    TEST_INT(turbulence.Bake(), 0);
+    TEST(turbulence.IsBaked());
+    TEST_INT(turbulence.GetBakedOctaves(), 2);
+
+    const Vector P(5 * .125, 17 * .125, 3 * .125);
+    const Real expected = TiledNoise3d(P.x, P.y, P.z, 8) +
+        .5 * TiledNoise3d(2 * P.x, 2 * P.y, 2 * P.z, 16);
+    TEST(std::abs(turbulence.Evaluate(P) - expected) < TOLERANCE);
+
+    const Vector Q(.31, -2.7, 1.9);
+    TEST(std::abs(turbulence.Evaluate(Q) - turbulence.Evaluate(Q + Vector(8, 0, -8))) < TOLERANCE);
+    Real noise[2];
+    const Vector points[2] = {P, Q};
+    turbulence.Evaluate(points, 2, noise);
+    TEST(std::abs(noise[1] - turbulence.Evaluate(Q)) < TOLERANCE);
+
+    // finer octaves are evaluated as they are
+    turbulence.SetOctaves(6);
+    TEST(!turbulence.IsBaked());
+    TEST_INT(turbulence.Bake(), 0);
+    TEST_INT(turbulence.GetBakedOctaves(), 3);
+    turbulence.Evaluate(points, 2, noise);
+    TEST(std::abs(noise[1] - turbulence.Evaluate(Q)) < TOLERANCE);
+
+    turbulence.SetLacunarity(2.5);
+    TEST_INT(turbulence.Bake(), -1);
+    TEST(!turbulence.IsBaked());
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
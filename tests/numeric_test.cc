@@ -4,6 +4,7 @@
 #include "unit_test.h"
 #include "fj_numeric.h"
 #include <cstdio>
+#include <cmath>
 
 using namespace fj;
 
@@ -24,8 +25,8 @@ int main()
     TEST(Max(x, y) == y);
   }
   {
-    const double x = 12.35;
-    const double y = 389.93;
+    const Real x = 12.35;
+    const Real y = 389.93;
 
     TEST(Min(x, y) == x);
     TEST(Max(x, y) == y);
@@ -43,6 +44,41 @@ int main()
 
     TEST(Clamp(u, l, u) == u);
   }
+  {
+    // approximations are within their relative errors
+    double exp_error = 0, log_error = 0, pow_error = 0, sin_error = 0, cos_error = 0;
+    for (int i = 0; i < 1000; i++) {
+      const double x = -50 + 100 * (i + .5) / 1000;
+      const double y = 1e-3 + 100 * (i + .5) / 1000;
+      exp_error = Max(exp_error, std::abs(FastExp(x) / std::exp(x) - 1));
+      log_error = Max(log_error, std::abs(FastLog(y) - std::log(y)));
+      pow_error = Max(pow_error, std::abs(FastPow(y, 2.5) / std::pow(y, 2.5) - 1));
+      sin_error = Max(sin_error, std::abs(FastSin(x) - std::sin(x)));
+      cos_error = Max(cos_error, std::abs(FastCos(x) - std::cos(x)));
+    }
+    TEST(exp_error < 1e-5);
+    TEST(log_error < 1e-7);
+    TEST(pow_error < 1e-5);
+    // x up to 50 is reduced by PI of Real precision
+    TEST(sin_error < 1e-6 + 50 * REAL_EPSILON);
+    TEST(cos_error < 1e-6 + 50 * REAL_EPSILON);
+  }
+  {
+    // the accuracy switches all threads
+    TEST_INT(MathGetAccuracy(), MATH_ACCURACY_EXACT);
+    TEST(Exp(1.) == std::exp(Real(1)));
+
+    MathSetAccuracy(MATH_ACCURACY_FAST);
+    TEST_INT(MathGetAccuracy(), MATH_ACCURACY_FAST);
+    TEST(Exp(1.) == Real(FastExp(1.)));
+    TEST(Log(0.) == std::log(0.));
+
+    MathSetAccuracy(MATH_ACCURACY_BALANCED);
+    TEST(Pow(2., .5) == std::pow(2.f, .5f));
+
+    MathSetAccuracy(100);
+    TEST_INT(MathGetAccuracy(), MATH_ACCURACY_EXACT);
+  }
   printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
     TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
 
@@ -0,0 +1,124 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "ObjBuffer.h"
+#include "fj_random.h"
+#include "fj_os.h"
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace fj;
+
+template <typename T>
+static bool same_array(const std::vector<T> &a, const std::vector<T> &b)
+{
+  return a.size() == b.size() &&
+      (a.empty() || memcmp(&a[0], &b[0], sizeof(T) * a.size()) == 0);
+}
+
+static double random_number(XorShift &rng)
+{
+  return 200 * rng.NextFloat01() - 100;
+}
+
+// writes numbers as they come from exporters with exponents and up to 17
+// digits, every face form with absolute and relative indices, groups and
+// comments. crlf lines are mixed in
+static void write_obj(const std::string &filename, long min_size)
+{
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  const char *number_formats[] = {"%g", "%.6f", "%.17g", "%.3e"};
+  const char *groups[] = {"body", "head", "body", "tail"};
+  XorShift rng;
+  long v_count = 0;
+  char line[256];
+
+  for (int i = 0; file.tellp() < min_size; i++) {
+    if (i % 1000 == 0) {
+      file << "# block " << i << "\n";
+      file << "g " << groups[(i / 1000) % 4] << " extra\n";
+    }
+
+    const char *fmt = number_formats[i % 4];
+    std::string v = "v";
+    std::string vt = "vt";
+    std::string vn = "vn";
+    for (int j = 0; j < 3; j++) {
+      snprintf(line, sizeof(line), fmt, random_number(rng));
+      v += std::string(" ") + line;
+      snprintf(line, sizeof(line), fmt, rng.NextFloat01());
+      vt += j < 2 ? std::string(" ") + line : std::string();
+      snprintf(line, sizeof(line), fmt, random_number(rng) / 100);
+      vn += std::string(" ") + line;
+    }
+    const char *eol = i % 7 == 0 ? "\r\n" : "\n";
+    file << v << eol << vt << eol << vn << eol;
+    v_count++;
+
+    if (v_count < 4) {
+      continue;
+    }
+    const long a = v_count - 3;
+    const long b = v_count - 2;
+    const long c = v_count - 1;
+    const long d = v_count;
+    switch (i % 5) {
+    case 0:
+      snprintf(line, sizeof(line), "f %ld %ld %ld", a, b, c);
+      break;
+    case 1:
+      snprintf(line, sizeof(line), "f %ld/%ld %ld/%ld %ld/%ld %ld/%ld", a, a, b, b, c, c, d, d);
+      break;
+    case 2:
+      snprintf(line, sizeof(line), "f %ld//%ld %ld//%ld %ld//%ld", a, a, b, b, c, c);
+      break;
+    case 3:
+      snprintf(line, sizeof(line), "f %ld/%ld/%ld %ld/%ld/%ld %ld/%ld/%ld", a, a, a, b, b, b, d, d, d);
+      break;
+    default:
+      snprintf(line, sizeof(line), "f -4/-4/-4 -3/-3/-3 -2/-2/-2 -1/-1/-1");
+      break;
+    }
+    file << line << eol;
+  }
+}
+
+int main()
+{
+  {
+    // the chunked parser of the mapped file reads the same buffers as the
+    // stream parser. the file is a few chunks long
+    const std::string filename = OsGetTempDirectory() + "/fj_obj_parser_test.obj";
+    write_obj(filename, 3 * (1 << 20) + 12345);
+
+    ObjBuffer serial;
+    std::ifstream file(filename.c_str());
+    TEST_INT(serial.Parse(file), 0);
+
+    ObjBuffer chunked;
+    TEST_INT(ObjBufferReadFile(chunked, filename), 0);
+    TEST(serial.vertex_count > 10000);
+
+    TEST(chunked.vertex_count == serial.vertex_count);
+    TEST(chunked.face_count == serial.face_count);
+    TEST(same_array(chunked.vertex_position, serial.vertex_position));
+    TEST(same_array(chunked.vertex_texture, serial.vertex_texture));
+    TEST(same_array(chunked.vertex_normal, serial.vertex_normal));
+    TEST(same_array(chunked.position_indices, serial.position_indices));
+    TEST(same_array(chunked.texture_indices, serial.texture_indices));
+    TEST(same_array(chunked.normal_indices, serial.normal_indices));
+    TEST(same_array(chunked.face_group_id, serial.face_group_id));
+    TEST(chunked.group_name_to_id == serial.group_name_to_id);
+    TEST_INT(chunked.current_group_id, serial.current_group_id);
+    remove(filename.c_str());
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
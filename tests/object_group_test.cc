@@ -0,0 +1,93 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_object_group.h"
+#include "fj_object_instance.h"
+#include "fj_bvh_accelerator.h"
+#include "fj_intersection.h"
+#include "fj_point_cloud.h"
+#include "fj_ray.h"
+#include <cstdio>
+
+using namespace fj;
+
+int main()
+{
+  {
+    // groups sharing the tree of all objects hit only their instances
+    PointCloud ptc;
+    ptc.SetPointCount(1);
+    ptc.AddPointPosition();
+    ptc.AddPointRadius();
+    ptc.SetPointPosition(0, Vector(0, 0, 0));
+    ptc.SetPointRadius(0, .5);
+    ptc.ComputeBounds();
+
+    BVHAccelerator acc;
+    acc.SetPrimitiveSet(&ptc);
+    TEST_INT(acc.Build(), 0);
+
+    ObjectInstance near, far;
+    near.SetSurface(&acc);
+    far.SetSurface(&acc);
+    near.SetTranslate(0, 0, 2, 0);
+    far.SetTranslate(0, 0, 4, 0);
+    near.ComputeBounds();
+    far.ComputeBounds();
+
+    ObjectGroup all_objects, far_only;
+    all_objects.AddObject(&near);
+    all_objects.AddObject(&far);
+    far_only.AddObject(&far);
+    all_objects.ComputeBounds();
+    far_only.ComputeBounds();
+
+    far_only.ShareTree(&all_objects, GroupMaskSharedBit(0));
+    TEST(far_only.IsSharingTree());
+    TEST(far_only.GetSurfaceAccelerator() == all_objects.GetSurfaceAccelerator());
+    near.SetGroupMask(GROUP_MASK_KINDS | GROUP_MASK_ALL_OBJECTS);
+    far.SetGroupMask(GROUP_MASK_KINDS | GROUP_MASK_ALL_OBJECTS | GroupMaskSharedBit(0));
+    TEST_INT(all_objects.Build(), 0);
+    TEST_INT(far_only.Build(), 0);
+
+    Ray ray;
+    ray.orig = Vector(0, 0, -1);
+    ray.dir = Vector(0, 0, 1);
+    ray.tmax = 100;
+    Intersection isect;
+
+    ray.group_mask = GROUP_MASK_CAMERA | all_objects.GetRayMask();
+    TEST(all_objects.GetSurfaceAccelerator()->Intersect(ray, 0, &isect));
+    TEST(isect.object == &near);
+
+    ray.group_mask = GROUP_MASK_CAMERA | far_only.GetRayMask();
+    TEST(far_only.GetSurfaceAccelerator()->Intersect(ray, 0, &isect));
+    TEST(isect.object == &far);
+
+    // invisible to camera rays but not to shadow rays
+    near.SetVisibility(GROUP_MASK_KINDS & ~GROUP_MASK_CAMERA);
+    ray.group_mask = GROUP_MASK_CAMERA | all_objects.GetRayMask();
+    TEST(all_objects.GetSurfaceAccelerator()->Intersect(ray, 0, &isect));
+    TEST(isect.object == &far);
+    ray.group_mask = GROUP_MASK_SHADOW | all_objects.GetRayMask();
+    TEST(all_objects.GetSurfaceAccelerator()->Intersect(ray, 0, &isect));
+    TEST(isect.object == &near);
+
+    // the last occluder is tested alone without traversal
+    TEST(near.RayOccludePrimitive(0, ray, 0, &isect));
+    TEST(isect.object == &near);
+    TEST(!near.RayOccludePrimitive(1, ray, 0, &isect));
+    ray.tmax = 2;
+    TEST(!far.RayOccludePrimitive(0, ray, 0, &isect));
+
+    far_only.ShareTree(NULL, 0);
+    TEST(!far_only.IsSharingTree());
+    TEST(far_only.GetSurfaceAccelerator() != all_objects.GetSurfaceAccelerator());
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
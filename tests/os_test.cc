@@ -0,0 +1,63 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_os.h"
+#include <vector>
+#include <cstdio>
+
+using namespace fj;
+
+int main()
+{
+  const char *filename = "os_test.bin";
+  std::vector<unsigned char> bytes(10000);
+  for (std::size_t i = 0; i < bytes.size(); i++) {
+    bytes[i] = static_cast<unsigned char>(i * 7);
+  }
+  FILE *fp = fopen(filename, "wb");
+  fwrite(&bytes[0], 1, bytes.size(), fp);
+  fclose(fp);
+
+  {
+    // reads at offsets and short reads at the end
+    OsFile *file = OsOpenFile(filename);
+    TEST(file != NULL);
+    TEST(OsGetFileSize(file) == 10000);
+    TEST(OsAdviseFile(file, 0, 10000, OS_ACCESS_WILLNEED) == 0);
+
+    unsigned char dst[100] = {0};
+    TEST(OsReadFile(file, 5000, dst, 100) == 100);
+    TEST(dst[0] == bytes[5000] && dst[99] == bytes[5099]);
+    TEST(OsReadFile(file, 9950, dst, 100) == 50);
+    TEST(dst[49] == bytes[9999]);
+
+    // reads running at once
+    std::vector<unsigned char> first(4000), second(4000);
+    OsAsyncRead *read0 = OsStartAsyncRead(file, 0, &first[0], first.size());
+    OsAsyncRead *read1 = OsStartAsyncRead(file, 8000, &second[0], second.size());
+    TEST(read0 != NULL && read1 != NULL);
+    TEST(OsFinishAsyncRead(read1) == 2000);
+    TEST(OsFinishAsyncRead(read0) == 4000);
+    TEST(first[3999] == bytes[3999]);
+    TEST(second[1999] == bytes[9999]);
+
+    OsCloseFile(file);
+    TEST(OsOpenFile("os_test_none.bin") == NULL);
+  }
+  {
+    size_t size = 0;
+    void *data = OsMapFile(filename, &size);
+    TEST(data != NULL);
+    TEST(OsAdviseMappedPages(data, size, OS_ACCESS_RANDOM) == 0);
+    TEST(OsAdviseMappedPages(data, size, OS_ACCESS_SEQUENTIAL) == 0);
+    TEST(OsAdviseMappedPages(static_cast<char *>(data) + 100, 10, OS_ACCESS_WILLNEED) == 0);
+    OsUnmapFile(data, size);
+  }
+  remove(filename);
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_photon_map.h"
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+int main()
+{
+  {
+    // disabled by default and with no photons
+    PhotonMap map;
+    TEST(!map.IsEnabled());
+    map.Init(0, 1024 * 1024, .1);
+    TEST(!map.IsEnabled());
+
+    Color E;
+    TEST(!map.Lookup(Vector(0, 0, 0), Vector(0, 1, 0), &E));
+  }
+  {
+    // photons are capped by the memory budget
+    PhotonMap map;
+    map.Init(1000, 1000, .1);
+    TEST(map.IsEnabled());
+    TEST(map.GetMaxPhotonCount() > 0);
+    TEST(map.GetMaxPhotonCount() < 1000);
+
+    for (int i = 0; i < 1000; i++) {
+      map.Store(Vector(0, 0, 0), Vector(0, -1, 0), Color(1, 1, 1));
+    }
+    TEST(map.GetPhotonCount() == map.GetMaxPhotonCount());
+  }
+  {
+    // photons spread on a plane give their power per area
+    PhotonMap map;
+    map.Init(100000, 64 * 1024 * 1024, .1);
+
+    const Real spacing = .01;
+    for (int i = -100; i < 100; i++) {
+      for (int j = -100; j < 100; j++) {
+        map.Store(Vector((i + .5) * spacing, 0, (j + .5) * spacing),
+            Vector(0, -1, 0), Color(.0001, .0002, 0));
+      }
+    }
+    map.Build();
+    TEST(map.GetPhotonCount() == 40000);
+
+    Color E;
+    TEST(map.Lookup(Vector(.123, 0, -.456), Vector(0, 1, 0), &E));
+    TEST(std::abs(E.r - 1) < .05);
+    TEST(std::abs(E.g - 2) < .1);
+    TEST(E.b == 0);
+
+    // photons coming to the back side and out of the radius are not
+    TEST(!map.Lookup(Vector(.123, 0, -.456), Vector(0, -1, 0), &E));
+    TEST(!map.Lookup(Vector(1.2, 0, 0), Vector(0, 1, 0), &E));
+    TEST(!map.Lookup(Vector(0, .2, 0), Vector(0, 1, 0), &E));
+
+    // cleared by init
+    map.Init(100000, 64 * 1024 * 1024, .1);
+    TEST(map.GetPhotonCount() == 0);
+    TEST(!map.Lookup(Vector(0, 0, 0), Vector(0, 1, 0), &E));
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
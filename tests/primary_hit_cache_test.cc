@@ -0,0 +1,63 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_primary_hit_cache.h"
+#include <cstdio>
+#include <vector>
+
+using namespace fj;
+
+int main()
+{
+  // only addresses are used
+  const ObjectInstance *a = reinterpret_cast<const ObjectInstance *>(0x10);
+
+  {
+    // samples not traced are told from rays that hit nothing
+    PrimaryHit hit;
+    TEST(!hit.IsTraced());
+    hit.prim_id = 0;
+    TEST(hit.IsTraced());
+  }
+  {
+    // hits are kept for the same key and slot count
+    PrimaryHitCache cache;
+    cache.Init(123, 4, 1024);
+    TEST(cache.GetHits(0) == NULL);
+
+    std::vector<PrimaryHit> hits(3);
+    hits[1].object = a;
+    hits[1].prim_id = 7;
+    TEST_INT(cache.SetHits(2, hits), 0);
+    TEST(cache.GetHits(2) != NULL);
+    TEST_INT(cache.GetHits(2)->size(), 3);
+    TEST((*cache.GetHits(2))[1].object == a);
+    TEST_INT(cache.GetMemoryUsage(), 3 * sizeof(PrimaryHit));
+
+    cache.Init(123, 4, 1024);
+    TEST(cache.GetHits(2) != NULL);
+    cache.Init(456, 4, 1024);
+    TEST(cache.GetHits(2) == NULL);
+    TEST_INT(cache.GetMemoryUsage(), 0);
+  }
+  {
+    // hits over the memory are not kept. replacing hits frees the old ones
+    PrimaryHitCache cache;
+    cache.Init(123, 2, 4 * sizeof(PrimaryHit));
+
+    std::vector<PrimaryHit> hits(3);
+    TEST_INT(cache.SetHits(0, hits), 0);
+    hits.resize(2);
+    TEST_INT(cache.SetHits(1, hits), -1);
+    TEST(cache.GetHits(1) == NULL);
+    hits.resize(4);
+    TEST_INT(cache.SetHits(0, hits), 0);
+    TEST_INT(cache.GetMemoryUsage(), 4 * sizeof(PrimaryHit));
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
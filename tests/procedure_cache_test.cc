@@ -0,0 +1,89 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_procedure_cache.h"
+#include "fj_turbulence.h"
+#include "fj_curve.h"
+#include <cstdio>
+
+using namespace fj;
+
+static void make_curve(Curve &curve)
+{
+  curve.SetVertexCount(8);
+  curve.SetCurveCount(2);
+  curve.AddVertexPosition();
+  curve.AddVertexWidth();
+  curve.AddVertexColor();
+  curve.AddCurveIndices();
+  for (int i = 0; i < 8; i++) {
+    curve.SetVertexPosition(i, Vector(i, .5 * i, 0));
+    curve.SetVertexWidth(i, .1);
+    curve.SetVertexColor(i, Color(1, .5, i));
+  }
+  curve.SetCurveIndices(0, 0);
+  curve.SetCurveIndices(1, 4);
+  curve.ComputeBounds();
+}
+
+int main()
+{
+  {
+    // keys change with values and input geometry
+    Turbulence turbulence;
+    Curve curve;
+    ProcedurePropertyMap properties;
+    properties["density"] = PropScalar(1);
+    properties["turbulence"] = PropTurbulence(&turbulence);
+    properties["curve"] = PropCurve(&curve);
+
+    const uint64_t key = ProcCacheComputeKey("Wisps", properties);
+    TEST(key != 0);
+    TEST(ProcCacheComputeKey("Wisps", properties) == key);
+    TEST(ProcCacheComputeKey("Other", properties) != key);
+
+    properties["density"] = PropScalar(2);
+    TEST(ProcCacheComputeKey("Wisps", properties) != key);
+    properties["density"] = PropScalar(1);
+
+    turbulence.SetOctaves(3);
+    const uint64_t turbulence_key = ProcCacheComputeKey("Wisps", properties);
+    TEST(turbulence_key != key);
+
+    make_curve(curve);
+    TEST(ProcCacheComputeKey("Wisps", properties) != turbulence_key);
+
+    // shaders and textures are not hashed
+    properties["texture"] = PropTexture(NULL);
+    TEST(ProcCacheComputeKey("Wisps", properties) == 0);
+  }
+  {
+    // results are read into the nodes of the same properties
+    Curve src;
+    make_curve(src);
+    ProcedurePropertyMap src_properties;
+    src_properties["curve"] = PropCurve(&src);
+    std::vector<std::string> results(1, "curve");
+    const uint64_t key = 12345;
+    TEST(ProcCacheWrite(".", key, src_properties, results) == 0);
+
+    Curve dst;
+    ProcedurePropertyMap dst_properties;
+    dst_properties["curve"] = PropCurve(&dst);
+    TEST(ProcCacheRead(".", key, dst_properties) == 0);
+    TEST(dst.GetContentHash() == src.GetContentHash());
+    TEST(dst.GetCurveIndices(1) == 4);
+
+    // not cached
+    TEST(ProcCacheRead(".", key + 1, dst_properties) == -1);
+
+    remove(ProcCacheGetFilename(".", key).c_str());
+    remove("./0000000000003039.0.crv");
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_property.h"
+#include <cstdio>
+
+using namespace fj;
+
+static int set_nothing(void *self, const PropertyValue &value)
+{
+  return 0;
+}
+
+int main()
+{
+  {
+    // the table finds the same properties as PropFind
+    const Property list[] = {
+      Property("gain",      PropScalar(1),        set_nothing),
+      Property("amplitude", PropVector3(1, 1, 1), set_nothing),
+      Property("offset",    PropVector3(0, 0, 0), set_nothing),
+      Property("offset",    PropScalar(0),        set_nothing),
+      Property("bias",      PropScalar(0),        set_nothing),
+      Property()
+    };
+    const PropertyTable table(list);
+
+    TEST(table.Find(PROP_SCALAR, "gain") == &list[0]);
+    TEST(table.Find(PROP_VECTOR3, "offset") == &list[2]);
+    TEST(table.Find(PROP_SCALAR, "offset") == &list[3]);
+    TEST(table.Find(PROP_SCALAR, "bias") == PropFind(list, PROP_SCALAR, "bias"));
+    TEST(table.Find(PROP_VECTOR2, "offset") == NULL);
+    TEST(table.Find(PROP_SCALAR, "zzz") == NULL);
+    TEST(table.Find(PROP_SCALAR, "") == NULL);
+
+    TEST(table.Contains(&list[4]));
+    TEST(!table.Contains(&list[5]));
+
+    const PropertyTable empty;
+    TEST(empty.Find(PROP_SCALAR, "gain") == NULL);
+    TEST(!empty.Contains(&list[0]));
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,162 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_radiance_cache.h"
+#include "fj_scene_interface.h"
+#include "fj_multi_thread.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+using namespace fj;
+
+static LoopStatus add_radiance_task(void *data, const ThreadContext &context)
+{
+  RadianceCache *cache = (RadianceCache *) data;
+  const Real x = .01 * (context.iteration_id % 10);
+  cache->Add(Vector(x, .5, .5), Vector(0, 1, 0), 1, Color(1, 2, 4));
+  return LoopStatus::Continue;
+}
+
+// a closed box of 2 x 2 x 2 with faces to the inside
+static ID new_room_mesh()
+{
+  const double P[] = {
+    -1, -1, -1,   1, -1, -1,   1,  1, -1,  -1,  1, -1,
+    -1, -1,  1,   1, -1,  1,   1,  1,  1,  -1,  1,  1
+  };
+  const int quads[6][4] = {
+    {0, 1, 2, 3}, {5, 4, 7, 6}, {4, 0, 3, 7}, {1, 5, 6, 2}, {4, 5, 1, 0}, {3, 2, 6, 7}
+  };
+  std::vector<int> indices;
+  for (int i = 0; i < 6; i++) {
+    const int *q = quads[i];
+    const int tris[] = {q[0], q[1], q[2], q[0], q[2], q[3]};
+    indices.insert(indices.end(), tris, tris + 6);
+  }
+
+  const ID mesh = SiNewMesh();
+  SiSetPrimitiveAttribute(mesh, "P", SI_ARRAY_FLOAT64, P, 8 * 3);
+  SiSetPrimitiveAttribute(mesh, "indices", SI_ARRAY_INT32, &indices[0], indices.size());
+  return mesh;
+}
+
+// mean red of the room lit by a point light and rendered by the path
+// tracer. -1 if failed
+static double render_room(double cell_size, int max_diffuse_depth)
+{
+  SiOpenScene();
+  const ID shader = SiNewShader(SiOpenPlugin("PathtracingShader"));
+  SiSetProperty3(shader, "diffuse", .7, .7, .7);
+  const ID room = SiNewObjectInstance(new_room_mesh());
+  SiAssignShader(room, "DEFAULT_SHADING_GROUP", shader);
+  const ID light = SiNewLight(SI_POINT_LIGHT);
+  SiSetProperty3(light, "translate", 0, .8, 0);
+  const ID camera = SiNewCamera("PerspectiveCamera");
+  SiSetProperty3(camera, "translate", 0, 0, .95);
+  const ID framebuffer = SiNewFrameBuffer("rgba");
+
+  const ID renderer = SiNewRenderer();
+  SiAssignCamera(renderer, camera);
+  SiAssignFrameBuffer(renderer, framebuffer);
+  SiSetProperty2(renderer, "resolution", 40, 30);
+  SiSetProperty2(renderer, "pixelsamples", 8, 8);
+  SiSetProperty1(renderer, "max_diffuse_depth", max_diffuse_depth);
+  SiSetProperty1(renderer, "radiance_cache_cell_size", cell_size);
+  SiRenderScene(renderer);
+
+  double mean = -1;
+  float *data = NULL;
+  int width = 0, height = 0, nchannels = 0;
+  if (SiGetFrameBufferData(framebuffer, &data, &width, &height, &nchannels) == SI_SUCCESS) {
+    mean = 0;
+    for (int i = 0; i < width * height; i++) {
+      mean += data[i * nchannels];
+    }
+    mean /= width * height;
+  }
+  SiCloseScene();
+  return mean;
+}
+
+int main()
+{
+  {
+    // disabled by default and with no cell size
+    RadianceCache cache;
+    TEST(!cache.IsEnabled());
+    cache.Init(0, 1024);
+    TEST(!cache.IsEnabled());
+
+    Color C;
+    cache.Add(Vector(0, 0, 0), Vector(0, 1, 0), 1, Color(1, 1, 1));
+    TEST(!cache.Lookup(Vector(0, 0, 0), Vector(0, 1, 0), 1, &C));
+  }
+  {
+    // cells average radiance added to them once they have enough
+    RadianceCache cache;
+    cache.Init(.1, 1024);
+    TEST(cache.IsEnabled());
+
+    const Vector P(1.02, 2.03, 3.04);
+    const Vector N(0, 0, 1);
+    Color C;
+    cache.Add(P, N, 1, Color(1, 1, 1));
+    TEST(!cache.Lookup(P, N, 1, &C));
+
+    for (int i = 1; i < 64; i++) {
+      cache.Add(P, N, 1, Color(i % 2 ? 3 : 1, 1, 1));
+    }
+    TEST(cache.Lookup(P, N, 1, &C));
+    TEST(std::abs(C.r - 2) < 1e-6);
+    TEST(std::abs(C.g - 1) < 1e-6);
+
+    // the same cell
+    TEST(cache.Lookup(Vector(1.08, 2.01, 3.09), Vector(.1, .2, .9), 1, &C));
+    // neighbour cells, opposite normals and other depths are not
+    TEST(!cache.Lookup(Vector(1.12, 2.03, 3.04), N, 1, &C));
+    TEST(!cache.Lookup(Vector(-1.02, 2.03, 3.04), N, 1, &C));
+    TEST(!cache.Lookup(P, Vector(0, 0, -1), 1, &C));
+    TEST(!cache.Lookup(P, Vector(1, 0, 0), 1, &C));
+    TEST(!cache.Lookup(P, N, 2, &C));
+
+    // cleared by init
+    cache.Init(.1, 1024);
+    TEST(!cache.Lookup(P, N, 1, &C));
+  }
+  {
+    // threads add to the same cell
+    RadianceCache cache;
+    cache.Init(.5, 1024);
+
+    std::vector<int> que(1000);
+    for (int i = 0; i < 1000; i++) {
+      que[i] = i;
+    }
+    MtRunParallelLoop(&cache, add_radiance_task, 8, que);
+
+    Color C;
+    TEST(cache.Lookup(Vector(.25, .5, .5), Vector(0, 1, 0), 1, &C));
+    TEST(std::abs(C.r - 1) < 1e-6);
+    TEST(std::abs(C.g - 2) < 1e-6);
+    TEST(std::abs(C.b - 4) < 1e-6);
+  }
+
+  {
+    // renders with the cache are within .5% of renders without it. they
+    // were 1.3-1.7% darker when depths shared cells
+    const int depths[] = {3, 8};
+    for (int i = 0; i < 2; i++) {
+      const double traced = render_room(0, depths[i]);
+      const double cached = render_room(.25, depths[i]);
+      TEST(traced > 0);
+      TEST(std::abs(cached / traced - 1) < .005);
+    }
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
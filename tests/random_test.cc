@@ -0,0 +1,107 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_random.h"
+#include "fj_vector.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+using namespace fj;
+
+// true if each of 2^m points is in its own elementary interval of
+// 2^xbits by 2^(m - xbits) for all xbits
+static bool is_net(const Vector2 *points, int m)
+{
+  const int N = 1 << m;
+  for (int xbits = 0; xbits <= m; xbits++) {
+    const int xcells = 1 << xbits;
+    const int ycells = N / xcells;
+    std::vector<int> counts(N, 0);
+    for (int i = 0; i < N; i++) {
+      const int x = static_cast<int>(points[i][0] * xcells);
+      const int y = static_cast<int>(points[i][1] * ycells);
+      if (++counts[y * xcells + x] > 1) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main()
+{
+  {
+    // the samples of a pixel are stratified in every pair of dimensions
+    XorShift rng;
+    std::vector<Vector2> points[4];
+    for (uint32_t i = 0; i < 64; i++) {
+      SampleSequence sequence;
+      sequence.Start(SAMPLE_SEQUENCE_SOBOL, i, 12345, &rng);
+      for (int dim = 0; dim < 4; dim++) {
+        points[dim].push_back(sequence.Next2D());
+      }
+      TEST_INT(sequence.GetDimension(), 8);
+    }
+    for (int dim = 0; dim < 4; dim++) {
+      TEST(is_net(&points[dim][0], 6));
+    }
+    // a later progressive pass continues the stratification
+    TEST(is_net(&points[0][0], 4));
+    TEST(is_net(&points[0][16], 4));
+  }
+  {
+    // pairs and pixels are not correlated
+    XorShift rng;
+    SampleSequence a, b, c;
+    a.Start(SAMPLE_SEQUENCE_SOBOL, 3, 1, &rng);
+    b.Start(SAMPLE_SEQUENCE_SOBOL, 3, 2, &rng);
+    c.Start(SAMPLE_SEQUENCE_SOBOL, 3, 1, &rng);
+    const Vector2 a0 = a.Next2D();
+    const Vector2 a1 = a.Next2D();
+    const Vector2 b0 = b.Next2D();
+    const Vector2 c0 = c.Next2D();
+    TEST(a0[0] != a1[0] && a0[1] != a1[1]);
+    TEST(a0[0] != b0[0] && a0[1] != b0[1]);
+    TEST(a0[0] == c0[0] && a0[1] == c0[1]);
+  }
+  {
+    // 1D draws are stratified too and in [0, 1)
+    XorShift rng;
+    std::vector<int> counts(32, 0);
+    bool in_range = true;
+    for (uint32_t i = 0; i < 32; i++) {
+      SampleSequence sequence;
+      sequence.Start(SAMPLE_SEQUENCE_SOBOL, i, 777, &rng);
+      sequence.Next2D();
+      const double x = sequence.Next1D();
+      in_range = in_range && x >= 0 && x < 1;
+      counts[static_cast<int>(x * 32)]++;
+      TEST_INT(sequence.GetDimension(), 3);
+    }
+    TEST(in_range);
+    int empty = 0;
+    for (int i = 0; i < 32; i++) {
+      empty += counts[i] == 0;
+    }
+    TEST_INT(empty, 0);
+  }
+  {
+    // the random sequence draws from the rng
+    XorShift rng(5);
+    XorShift expected(5);
+    SampleSequence sequence;
+    sequence.Start(SAMPLE_SEQUENCE_RANDOM, 0, 0, &rng);
+    const Vector2 uv = sequence.Next2D();
+    TEST(uv[0] == Real(expected.NextFloat01()));
+    TEST(uv[1] == Real(expected.NextFloat01()));
+    TEST(sequence.Next1D() == expected.NextFloat01());
+    TEST_INT(sequence.GetDimension(), 3);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,131 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_render_checkpoint.h"
+#include "fj_framebuffer.h"
+#include "fj_rectangle.h"
+#include "fj_tiler.h"
+#include "fj_os.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace fj;
+
+// fills pixels of the tile with values of their own
+static void render_tile(const Tile *tile, FrameBuffer *fb)
+{
+  for (int y = tile->ymin; y < tile->ymax; y++) {
+    for (int x = tile->xmin; x < tile->xmax; x++) {
+      for (int z = 0; z < fb->GetChannelCount(); z++) {
+        fb->SetValue(x, y, z, x + 100 * y + .25f * z);
+      }
+    }
+  }
+}
+
+// pixels of the tile different from render_tile
+static int count_wrong_pixels(const Tile *tile, const FrameBuffer &fb)
+{
+  int count = 0;
+  for (int y = tile->ymin; y < tile->ymax; y++) {
+    for (int x = tile->xmin; x < tile->xmax; x++) {
+      for (int z = 0; z < fb.GetChannelCount(); z++) {
+        count += fb.GetValue(x, y, z) != x + 100 * y + .25f * z;
+      }
+    }
+  }
+  return count;
+}
+
+static bool file_exists(const std::string &filename)
+{
+  FILE *file = fopen(filename.c_str(), "rb");
+  if (file == NULL) {
+    return false;
+  }
+  fclose(file);
+  return true;
+}
+
+int main()
+{
+  const std::string filename = OsGetTempDirectory() + "/fj_render_checkpoint_test.ckpt";
+  std::vector<double> settings;
+  settings.push_back(640);
+  settings.push_back(3);
+  const uint64_t key = CheckpointComputeKey(settings);
+  remove(filename.c_str());
+
+  Tiler tiler;
+  tiler.Divide(37, 21, 8, 8);
+  Rectangle region;
+  region.max = Int2(37, 21);
+  tiler.GenerateTiles(region);
+  const int NTILES = tiler.GetTileCount();
+
+  {
+    // tiles done before the interruption are written and restored by a
+    // render of the same key. the rest are rendered again
+    FrameBuffer fb;
+    fb.Resize(37, 21, 4);
+    RenderCheckpoint checkpoint;
+    TEST_INT(checkpoint.Start(filename, 0, key, &tiler, &fb), 0);
+    TEST(checkpoint.IsEnabled());
+    for (int i = 0; i < NTILES; i += 2) {
+      render_tile(tiler.GetTile(i), &fb);
+      checkpoint.TileDone(i);
+    }
+    checkpoint.Finish();
+    TEST(file_exists(filename));
+
+    FrameBuffer resumed;
+    resumed.Resize(37, 21, 4);
+    RenderCheckpoint resume;
+    TEST_INT(resume.Start(filename, 0, key, &tiler, &resumed), (NTILES + 1) / 2);
+
+    int wrong_done = 0;
+    int wrong_pixels = 0;
+    for (int i = 0; i < NTILES; i++) {
+      wrong_done += resume.IsTileDone(i) != (i % 2 == 0);
+      if (i % 2 == 0) {
+        wrong_pixels += count_wrong_pixels(tiler.GetTile(i), resumed);
+      }
+    }
+    TEST_INT(wrong_done, 0);
+    TEST_INT(wrong_pixels, 0);
+
+    // the file is removed once the frame is done
+    for (int i = 1; i < NTILES; i += 2) {
+      render_tile(tiler.GetTile(i), &resumed);
+      resume.TileDone(i);
+    }
+    resume.Finish();
+    TEST(!file_exists(filename));
+  }
+
+  {
+    // a checkpoint of other settings isn't restored
+    FrameBuffer fb;
+    fb.Resize(37, 21, 4);
+    RenderCheckpoint checkpoint;
+    TEST_INT(checkpoint.Start(filename, 0, key, &tiler, &fb), 0);
+    render_tile(tiler.GetTile(0), &fb);
+    checkpoint.TileDone(0);
+    checkpoint.Finish();
+
+    settings[1] = 4;
+    FrameBuffer other;
+    other.Resize(37, 21, 4);
+    RenderCheckpoint resume;
+    TEST_INT(resume.Start(filename, 0, CheckpointComputeKey(settings), &tiler, &other), 0);
+    TEST(!resume.IsTileDone(0));
+    remove(filename.c_str());
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,207 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_renderer.h"
+#include "fj_bvh_accelerator.h"
+#include "fj_camera.h"
+#include "fj_filter.h"
+#include "fj_framebuffer.h"
+#include "fj_object_group.h"
+#include "fj_object_instance.h"
+#include "fj_os.h"
+#include "fj_point_cloud.h"
+#include "fj_shader.h"
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <string>
+
+using namespace fj;
+
+class ConstantShader : public Shader {
+public:
+  ConstantShader() {}
+  virtual ~ConstantShader() {}
+
+private:
+  virtual void evaluate(const TraceContext &cxt,
+      const SurfaceInput &in, SurfaceOutput *out) const
+  {
+    out->Cs = Color(1, .5, .25);
+    out->Os = 1;
+  }
+};
+
+static double sum_pixels(const FrameBuffer &fb)
+{
+  double sum = 0;
+  for (int y = 0; y < fb.GetHeight(); y++) {
+    for (int x = 0; x < fb.GetWidth(); x++) {
+      sum += fb.GetColor(x, y).r;
+    }
+  }
+  return sum;
+}
+
+// a sphere covering part of the image so that adaptive samplers subdivide
+class SphereScene {
+public:
+  SphereScene()
+  {
+    ptc.SetPointCount(1);
+    ptc.AddPointPosition();
+    ptc.AddPointRadius();
+    ptc.SetPointPosition(0, Vector(0, 0, -5));
+    ptc.SetPointRadius(0, 1);
+    ptc.ComputeBounds();
+
+    acc.SetPrimitiveSet(&ptc);
+    acc.Build();
+
+    obj.SetSurface(&acc);
+    obj.SetShader(&shader, 0);
+    obj.ComputeBounds();
+
+    all_objects.AddObject(&obj);
+    all_objects.ComputeBounds();
+    all_objects.Build();
+    obj.SetReflectTarget(&all_objects);
+    obj.SetRefractTarget(&all_objects);
+    obj.SetShadowTarget(&all_objects);
+    obj.SetSelfHitTarget(&all_objects);
+  }
+  ~SphereScene() {}
+
+  // renders 64x48 pixels with 3x3 samples
+  void SetUp(Renderer *renderer, FrameBuffer *fb)
+  {
+    renderer->SetCamera(&camera);
+    renderer->SetFrameBuffers(fb);
+    renderer->SetTargetObjects(&all_objects);
+    renderer->SetResolution(64, 48);
+    renderer->SetPixelSamples(3, 3);
+  }
+
+private:
+  PointCloud ptc;
+  BVHAccelerator acc;
+  ConstantShader shader;
+  ObjectInstance obj;
+  ObjectGroup all_objects;
+  Camera camera;
+};
+
+static double render_pixel_sum(int sampler_type, int tail_splitting,
+    const std::string &estimate_file)
+{
+  SphereScene scene;
+  FrameBuffer fb;
+
+  Renderer renderer;
+  scene.SetUp(&renderer, &fb);
+  // the only tile is in the tail as soon as it starts
+  renderer.SetTileSize(64, 48);
+  renderer.SetThreadCount(4);
+  renderer.SetSamplerType(sampler_type);
+  renderer.SetTailSplitting(tail_splitting);
+  if (renderer.RenderScene()) {
+    return -1;
+  }
+  if (estimate_file.empty()) {
+    return sum_pixels(fb);
+  }
+
+  // the estimate renders a smaller frame and keeps the last one
+  const double sum = sum_pixels(fb);
+  renderer.SetEstimateFile(estimate_file);
+  if (renderer.RenderScene() || fb.GetWidth() != 64 || fb.GetHeight() != 48) {
+    return -1;
+  }
+  return sum_pixels(fb) == sum ? sum : -1;
+}
+
+// largest difference of rgb between images of the same size. -1 if either
+// render fails
+static double render_splat_difference(int filter_type)
+{
+  SphereScene scene;
+  FrameBuffer fb[2];
+
+  for (int splatting = 0; splatting < 2; splatting++) {
+    Renderer renderer;
+    scene.SetUp(&renderer, &fb[splatting]);
+    // tiles smaller than the image so samples splat across tile borders
+    renderer.SetTileSize(16, 16);
+    renderer.SetThreadCount(1);
+    renderer.SetFilterType(filter_type);
+    renderer.SetFilterWidth(2, 2);
+    renderer.SetFilterSplatting(splatting);
+    if (renderer.RenderScene()) {
+      return -1;
+    }
+  }
+
+  double max_diff = 0;
+  for (int y = 0; y < fb[0].GetHeight(); y++) {
+    for (int x = 0; x < fb[0].GetWidth(); x++) {
+      const Color4 a = fb[0].GetColor(x, y);
+      const Color4 b = fb[1].GetColor(x, y);
+      max_diff = std::max(max_diff, static_cast<double>(std::abs(a.r - b.r)));
+      max_diff = std::max(max_diff, static_cast<double>(std::abs(a.g - b.g)));
+      max_diff = std::max(max_diff, static_cast<double>(std::abs(a.b - b.b)));
+    }
+  }
+  return max_diff;
+}
+
+int main()
+{
+  {
+    // splitting the tail samples renders the same image for every sampler
+    const int samplers[] = {
+      RENDERER_FIXED_GRID_SAMPLER,
+      RENDERER_ADAPTIVE_GRID_SAMPLER,
+      RENDERER_VARIANCE_SAMPLER
+    };
+    for (int i = 0; i < 3; i++) {
+      const double whole = render_pixel_sum(samplers[i], 0, "");
+      const double split = render_pixel_sum(samplers[i], 1, "");
+      TEST(whole > 0);
+      TEST(std::abs(split - whole) <= .01 * whole);
+    }
+  }
+
+  {
+    // estimates don't overwrite the framebuffer
+    const std::string filename = OsGetTempDirectory() + "/fj_renderer_test_estimate.json";
+    TEST(render_pixel_sum(RENDERER_FIXED_GRID_SAMPLER, 0, filename) > 0);
+    FILE *fp = fopen(filename.c_str(), "r");
+    TEST(fp != NULL);
+    if (fp != NULL) {
+      fclose(fp);
+    }
+    remove(filename.c_str());
+  }
+
+  {
+    // splatting samples onto pixels makes the same image as gathering
+    // them, also for filters that don't end at their radius
+    const int filters[] = {
+      FLT_BOX,
+      FLT_GAUSSIAN,
+      FLT_MITCHELL,
+      FLT_BLACKMAN_HARRIS
+    };
+    for (int i = 0; i < 4; i++) {
+      const double diff = render_splat_difference(filters[i]);
+      TEST(diff >= 0);
+      TEST(diff < 1e-5);
+    }
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,207 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_fixed_grid_sampler.h"
+#include "fj_variance_sampler.h"
+#include "fj_rectangle.h"
+#include "fj_filter.h"
+#include "fj_random.h"
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace fj;
+
+int main()
+{
+  {
+    // each sample of a pixel takes its own stratum of the shutter
+    FixedGridSampler sampler;
+    sampler.SetResolution(Int2(4, 4));
+    sampler.SetPixelSamples(Int2(3, 3));
+    sampler.SetFilterWidth(Vector2(1, 1));
+    sampler.SetSampleTimeRange(2, 3);
+
+    Rectangle region;
+    region.min = Int2(0, 0);
+    region.max = Int2(4, 4);
+    TEST_INT(sampler.GenerateSamples(region), 0);
+
+    bool all_stratified = true;
+    bool all_in_range = true;
+    std::vector<Sample> pixel_samples;
+    for (int y = 0; y < 4; y++) {
+      for (int x = 0; x < 4; x++) {
+        sampler.GetSampleSetInPixel(pixel_samples, x, y);
+        std::vector<int> strata(9, 0);
+        for (std::size_t i = 0; i < pixel_samples.size(); i++) {
+          const Real time = pixel_samples[i].time;
+          all_in_range = all_in_range && time >= 2 && time < 3;
+          const int stratum = static_cast<int>((time - 2) * 9);
+          if (stratum >= 0 && stratum < 9) {
+            strata[stratum]++;
+          }
+        }
+        for (int i = 0; i < 9; i++) {
+          all_stratified = all_stratified && strata[i] == 1;
+        }
+      }
+    }
+    TEST(all_in_range);
+    TEST(all_stratified);
+  }
+  {
+    // samples drawn from the filter are around their pixel with no margin
+    Filter filter;
+    filter.SetFilterType(FLT_GAUSSIAN, 2, 2);
+
+    FixedGridSampler sampler;
+    sampler.SetResolution(Int2(4, 4));
+    sampler.SetPixelSamples(Int2(4, 4));
+    sampler.SetFilterWidth(Vector2(2, 2));
+    TEST_INT(sampler.GetSampleMargin()[0], 2);
+    sampler.SetImportanceFilter(&filter);
+    TEST_INT(sampler.GetSampleMargin()[0], 0);
+    TEST_INT(sampler.GetSampleMargin()[1], 0);
+
+    Rectangle region;
+    region.min = Int2(1, 1);
+    region.max = Int2(3, 3);
+    TEST_INT(sampler.GenerateSamples(region), 0);
+
+    int count = 0;
+    TEST(sampler.GetSamples(&count) != NULL);
+    TEST_INT(count, 2 * 4 * 2 * 4);
+
+    bool all_in_radius = true;
+    bool any_outside_pixel = false;
+    Real xsum = 0;
+    std::vector<Sample> pixel_samples;
+    sampler.GetSampleSetInPixel(pixel_samples, 2, 1);
+    for (std::size_t i = 0; i < pixel_samples.size(); i++) {
+      const Real x = 4 * pixel_samples[i].uv.x - 2.5;
+      const Real y = 4 * (1 - pixel_samples[i].uv.y) - 1.5;
+      all_in_radius = all_in_radius && std::abs(x) <= 1 && std::abs(y) <= 1;
+      any_outside_pixel = any_outside_pixel || std::abs(x) > .5 || std::abs(y) > .5;
+      xsum += x;
+    }
+    TEST(all_in_radius);
+    TEST(any_outside_pixel);
+    TEST(std::abs(xsum / pixel_samples.size()) < .1);
+  }
+  {
+    // offsets increase with u and negative lobes have negative signs
+    Filter filter;
+    filter.SetFilterType(FLT_MITCHELL, 4, 4);
+
+    Real sign = 0;
+    bool increasing = true;
+    bool any_negative = false;
+    bool signs_match = true;
+    Real prev = -3;
+    for (int i = 0; i < 100; i++) {
+      const Real x = filter.SampleX((i + .5) / 100, &sign);
+      increasing = increasing && x > prev;
+      any_negative = any_negative || sign < 0;
+      signs_match = signs_match && (sign < 0) == (filter.EvaluateX(x) < 0);
+      prev = x;
+    }
+    TEST(increasing);
+    TEST(any_negative);
+    TEST(signs_match);
+    TEST(prev <= 2);
+
+    filter.SetFilterType(FLT_BOX, 1, 1);
+    TEST_FLOAT(filter.SampleX(.25, &sign), -.25);
+    TEST_FLOAT(sign, 1.);
+  }
+  {
+    // a flat scene stays flat through the negative lobes of mitchell.
+    // pixels are the averages of their weighted samples over the count
+    Filter filter;
+    filter.SetFilterType(FLT_MITCHELL, 2, 2);
+    TEST(filter.GetImportanceScale() > 1);
+
+    const int RES = 64;
+    FixedGridSampler sampler;
+    sampler.SetResolution(Int2(RES, RES));
+    sampler.SetPixelSamples(Int2(2, 2));
+    sampler.SetFilterWidth(Vector2(2, 2));
+    sampler.SetImportanceFilter(&filter);
+
+    Rectangle region;
+    region.min = Int2(0, 0);
+    region.max = Int2(RES, RES);
+    TEST_INT(sampler.GenerateSamples(region), 0);
+
+    const Real FLAT = .5;
+    Real sum = 0;
+    Real max_pixel = 0;
+    int negative_count = 0;
+    std::vector<Sample> pixel_samples;
+    for (int y = 0; y < RES; y++) {
+      for (int x = 0; x < RES; x++) {
+        sampler.GetSampleSetInPixel(pixel_samples, x, y);
+        Real pixel = 0;
+        for (std::size_t i = 0; i < pixel_samples.size(); i++) {
+          pixel += pixel_samples[i].weight * FLAT;
+          negative_count += pixel_samples[i].weight < 0;
+        }
+        pixel /= pixel_samples.size();
+        sum += pixel;
+        max_pixel = std::max(max_pixel, pixel);
+      }
+    }
+    TEST(negative_count > 0);
+    TEST(std::abs(sum / (RES * RES) - FLAT) < .01 * FLAT);
+    TEST(max_pixel <= FLAT * filter.GetImportanceScale() * (1 + 1e-6));
+  }
+
+  {
+    // noisy pixels on the right half get more samples up to the max and
+    // flat pixels on the left stop at the pixel samples
+    const int RES = 4;
+    VarianceSampler sampler;
+    sampler.SetResolution(Int2(RES, RES));
+    sampler.SetPixelSamples(Int2(2, 2));
+    sampler.SetFilterWidth(Vector2(1, 1));
+    sampler.SetMaxSubdivision(2);
+    sampler.SetSubdivisionThreshold(.01);
+
+    Rectangle region;
+    region.min = Int2(0, 0);
+    region.max = Int2(RES, RES);
+    TEST_INT(sampler.GenerateSamples(region), 0);
+
+    XorShift rng;
+    Sample *sample = NULL;
+    while ((sample = sampler.GetNextSample()) != NULL) {
+      const Real value = sample->uv.x < .5 ? .5 : rng.NextFloat01();
+      sample->data = Vector4(value, value, value, 1);
+    }
+
+    bool all_flat_min = true;
+    bool all_noisy_max = true;
+    std::vector<Sample> pixel_samples;
+    for (int y = 0; y < RES; y++) {
+      for (int x = 0; x < RES; x++) {
+        sampler.GetSampleSetInPixel(pixel_samples, x, y);
+        const int count = pixel_samples.size();
+        if (x < RES / 2) {
+          all_flat_min = all_flat_min && count == 2 * 2;
+        } else {
+          all_noisy_max = all_noisy_max && count == 2 * 2 * 4 * 4;
+        }
+      }
+    }
+    TEST(all_flat_min);
+    TEST(all_noisy_max);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
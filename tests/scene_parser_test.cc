@@ -0,0 +1,121 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "parser.h"
+#include "binary_scene.h"
+#include "fj_os.h"
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// the cube scene. the last line saves the frame buffer to the file
+static std::vector<std::string> scene_lines(const std::string &output)
+{
+  const char *lines[] = {
+    "OpenPlugin plastic_shader PlasticShader",
+    "OpenPlugin stanfordply_procedure StanfordPlyProcedure",
+    "NewCamera cam1 PerspectiveCamera",
+    "SetProperty3 cam1 translate 3 3 3",
+    "SetProperty3 cam1 rotate -35 45 0",
+    "NewLight light1 PointLight",
+    "SetProperty3 light1 translate 1 5 2",
+    "NewShader shader1 plastic_shader",
+    "SetProperty3 shader1 diffuse .8 .5 .2",
+    "NewMesh mesh1",
+    "NewProcedure proc1 stanfordply_procedure",
+    "AssignMesh proc1 mesh mesh1",
+    "SetStringProperty proc1 filepath ../scenes/cube.ply",
+    "RunProcedure proc1",
+    "NewObjectInstance obj1 mesh1",
+    "SetProperty3 obj1 rotate 0 30 0",
+    "AssignShader obj1 DEFAULT_SHADING_GROUP shader1",
+    "NewFrameBuffer fb1 rgba",
+    "NewRenderer ren1",
+    "AssignCamera ren1 cam1",
+    "AssignFrameBuffer ren1 fb1",
+    "SetProperty2 ren1 resolution 32 24",
+    "SetProperty2 ren1 pixelsamples 2 2",
+    "RenderScene ren1"
+  };
+  std::vector<std::string> scene(lines, lines + sizeof(lines) / sizeof(lines[0]));
+  scene.push_back("SaveFrameBuffer fb1 " + output);
+  return scene;
+}
+
+static std::string read_file(const std::string &filename)
+{
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+      std::istreambuf_iterator<char>());
+}
+
+int main()
+{
+  {
+    // a compiled scene renders the same image as the text scene
+    const std::string text_fb = fj::OsGetTempDirectory() + "/fj_scene_parser_test_text.fb";
+    const std::string binary_fb = fj::OsGetTempDirectory() + "/fj_scene_parser_test_binary.fb";
+    remove(text_fb.c_str());
+    remove(binary_fb.c_str());
+
+    int text_errors = 0;
+    {
+      const std::vector<std::string> lines = scene_lines(text_fb);
+      Parser parser;
+      for (std::size_t i = 0; i < lines.size(); i++) {
+        text_errors += parser.ParseLine(lines[i]) != 0;
+      }
+    }
+    TEST_INT(text_errors, 0);
+
+    std::stringstream compiled;
+    int compile_errors = 0;
+    {
+      const std::vector<std::string> lines = scene_lines(binary_fb);
+      Parser parser;
+      BinarySceneWriter writer;
+      TEST_INT(writer.Open(compiled), 0);
+      for (std::size_t i = 0; i < lines.size(); i++) {
+        compile_errors += parser.CompileLine(lines[i], writer) != 0;
+      }
+    }
+    TEST_INT(compile_errors, 0);
+
+    int commands = 0;
+    int binary_errors = 0;
+    {
+      Parser parser;
+      BinarySceneReader reader;
+      TEST_INT(reader.Open(compiled), 0);
+      for (;;) {
+        const int result = parser.ParseBinary(reader);
+        if (result == 0) {
+          break;
+        }
+        if (result < 0) {
+          binary_errors++;
+          break;
+        }
+        commands++;
+      }
+    }
+    TEST_INT(binary_errors, 0);
+    TEST_INT(commands, static_cast<int>(scene_lines(binary_fb).size()));
+
+    const std::string text_image = read_file(text_fb);
+    const std::string binary_image = read_file(binary_fb);
+    TEST(!text_image.empty());
+    TEST(text_image == binary_image);
+    remove(text_fb.c_str());
+    remove(binary_fb.c_str());
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
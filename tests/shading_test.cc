@@ -0,0 +1,56 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_shading.h"
+#include "fj_random.h"
+#include "fj_color.h"
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+int main()
+{
+  {
+    // rays above the threshold are always traced
+    TraceContext cxt = SlCameraContext(NULL);
+    cxt.throughput_threshold = .1;
+    TEST(SlWeightRay(&cxt, Color(.5, .2, .1)) == 1);
+    TEST(std::abs(cxt.throughput - .5) < 1e-6);
+    TEST(SlWeightRay(&cxt, Color(.3, .3, .3)) == 1);
+    TEST(std::abs(cxt.throughput - .15) < 1e-6);
+
+    // no threshold traces rays of any weight
+    cxt.throughput_threshold = 0;
+    TEST(SlWeightRay(&cxt, Color(.001, .001, .001)) == 1);
+  }
+  {
+    // survivors under the threshold are weighted up so that the expected
+    // weight stays 1
+    XorShift rng;
+    const int N = 100000;
+    double sum = 0;
+    int survived = 0;
+    int wrong_throughput = 0;
+    for (int i = 0; i < N; i++) {
+      TraceContext cxt = SlCameraContext(NULL);
+      cxt.rng = &rng;
+      cxt.throughput_threshold = .1;
+      const float weight = SlWeightRay(&cxt, Color(.02, .01, .01));
+      if (weight > 0) {
+        survived++;
+        wrong_throughput += std::abs(cxt.throughput - .1) > 1e-6;
+      }
+      sum += weight;
+    }
+    TEST(std::abs(sum / N - 1) < .05);
+    TEST_INT(wrong_throughput, 0);
+    TEST(std::abs(survived / static_cast<double>(N) - .2) < .01);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,155 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_socket.h"
+#include "fj_protocol.h"
+#include "fj_framebuffer.h"
+#include <cstdio>
+#include <vector>
+
+using namespace fj;
+
+static const int TEST_PORT = 50599;
+
+int main()
+{
+  {
+    // messages of many renderers arrive through one poller
+    SocketStartup();
+
+    Socket server;
+    server.Open();
+    server.EnableReuseAddr();
+    server.SetPort(TEST_PORT);
+    TEST(server.Bind() != -1);
+    TEST_INT(server.Listen(), 0);
+    TEST_INT(server.SetNonBlocking(true), 0);
+
+    SocketPoller poller;
+    TEST_INT(poller.Open(), 0);
+    TEST_INT(poller.Add(server, -1), 0);
+
+    const int NCLIENTS = 3;
+    Socket clients[NCLIENTS];
+    for (int i = 0; i < NCLIENTS; i++) {
+      clients[i].Open();
+      clients[i].SetAddress("127.0.0.1");
+      clients[i].SetPort(TEST_PORT);
+      TEST(clients[i].Connect() != -1);
+    }
+
+    std::vector<int> ready;
+    TEST(poller.Wait(1000, ready) > 0);
+    TEST_INT(ready[0], -1);
+
+    Socket accepted[NCLIENTS];
+    int naccepted = 0;
+    while (naccepted < NCLIENTS) {
+      if (server.Accept(accepted[naccepted]) == FJ_SOCKET_INVALID) {
+        if (poller.Wait(1000, ready) <= 0) {
+          break;
+        }
+        continue;
+      }
+      accepted[naccepted].SetNonBlocking(true);
+      poller.Add(accepted[naccepted], naccepted);
+      naccepted++;
+    }
+    TEST_INT(naccepted, NCLIENTS);
+    poller.Remove(server);
+
+    // nothing has been sent yet
+    char byte = 0;
+    TEST_INT(accepted[0].ReceiveAvailable(&byte, 1), 0);
+    TEST_INT(poller.Wait(0, ready), 0);
+
+    FrameBuffer tile;
+    tile.Resize(4, 2, 3);
+    for (std::size_t i = 0; i < tile.GetSize(); i++) {
+      tile.GetWritable(0, 0, 0)[i] = i * .5f;
+    }
+    SendRenderFrameStart(clients[2], 7, 640, 480, 3, 10, TILE_ENCODING_FLOAT);
+    SendRenderTileDone(clients[2], 7, 3, 8, 16, 12, 18, tile, TILE_ENCODING_FLOAT_RLE);
+
+    TEST_INT(poller.Wait(1000, ready), 1);
+    TEST_INT(ready[0], 2);
+
+    // reads in small pieces as from a slow network
+    std::vector<char> buffer;
+    std::vector<Message> messages;
+    FrameBuffer received_tile;
+    for (int n = 0; n < 1000 && messages.size() < 2; n++) {
+      char piece[7];
+      const int nreads = accepted[2].ReceiveAvailable(piece, sizeof(piece));
+      TEST(nreads >= 0);
+      buffer.insert(buffer.end(), piece, piece + nreads);
+
+      const int size = PeekMessageSize(buffer.empty() ? NULL : &buffer[0], buffer.size());
+      if (size > 0 && static_cast<int>(buffer.size()) >= size) {
+        Message message;
+        TEST_INT(DecodeMessage(&buffer[0], size, message, received_tile), 0);
+        messages.push_back(message);
+        buffer.erase(buffer.begin(), buffer.begin() + size);
+      }
+    }
+    TEST_INT(static_cast<int>(messages.size()), 2);
+    TEST_INT(messages[0].type, MSG_RENDER_FRAME_START);
+    TEST_INT(messages[0].xres, 640);
+    TEST_INT(messages[1].type, MSG_RENDER_TILE_DONE);
+    TEST_INT(messages[1].tile_id, 3);
+    TEST_INT(received_tile.GetWidth(), 4);
+    TEST_FLOAT(received_tile.GetReadOnly(3, 1, 2)[0], 11.5);
+
+    // closed peers are ready and read as -1
+    clients[0].Close();
+    TEST_INT(poller.Wait(1000, ready), 1);
+    TEST_INT(ready[0], 0);
+    TEST_INT(accepted[0].ReceiveAvailable(&byte, 1), -1);
+
+    SocketCleanup();
+  }
+
+  {
+    // tiles of shared frames are read from the memory of the sender
+    SharedFrame sender;
+    TEST_INT(sender.Create(3, 8, 4, 2), 0);
+    float *dst = sender.GetWritable(2, 1);
+    TEST(dst != NULL);
+    for (int i = 0; i < 3 * 2; i++) {
+      dst[i] = i + 1.f;
+    }
+
+    SharedFrame receiver;
+    TEST_INT(receiver.Open(sender.GetKey(), 4, 8, 4, 2), -1);
+    TEST_INT(receiver.Open(sender.GetKey(), 3, 8, 4, 2), 0);
+    TEST(receiver.GetWritable(0, 0) == NULL);
+
+    std::vector<char> encoded;
+    EncodeRenderTileShared(encoded, 3, 5, 2, 1, 5, 2, 2);
+    TEST_INT(PeekMessageSize(&encoded[0], encoded.size()), static_cast<int>(encoded.size()));
+
+    Message message;
+    FrameBuffer tile;
+    TEST_INT(DecodeMessage(&encoded[0], encoded.size(), message, tile), 0);
+    TEST_INT(message.tile_encoding, TILE_ENCODING_SHARED);
+    TEST_INT(tile.GetWidth(), 3);
+    TEST_INT(tile.GetHeight(), 1);
+
+    receiver.ReadTile(message, tile);
+    TEST_FLOAT(tile.GetReadOnly(0, 0, 0)[0], 1.);
+    TEST_FLOAT(tile.GetReadOnly(2, 0, 1)[0], 6.);
+
+    // the receiver keeps its mapping after the sender is done
+    const int32_t key = sender.GetKey();
+    sender.Close();
+    TEST_FLOAT(receiver.GetReadOnly(3, 1)[1], 4.);
+    SharedFrame late_receiver;
+    TEST_INT(late_receiver.Open(key, 3, 8, 4, 2), -1);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_spherical_harmonics.h"
+#include "fj_numeric.h"
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+int main()
+{
+  {
+    SHIrradiance sh;
+    TEST(sh.IsEmpty());
+    TEST_DOUBLE(sh.Evaluate(Vector(0, 0, 1)).r, 0);
+
+    // constant radiance from every direction gives pi at any normal
+    const int N = 4096;
+    for (int i = 0; i < N; i++) {
+      const double z = 1 - (2 * i + 1) / static_cast<double>(N);
+      const double r = std::sqrt(1 - z * z);
+      const double phi = i * PI * (3 - std::sqrt(5.));
+      sh.AddRadiance(Vector(r * std::cos(phi), r * std::sin(phi), z),
+          Color(1, 1, 1) * (4 * PI / N));
+    }
+    TEST(!sh.IsEmpty());
+    TEST(std::abs(sh.Evaluate(Vector(0, 0, 1)).r - PI) < 1e-3);
+    TEST(std::abs(sh.Evaluate(Vector(0, -1, 0)).g - PI) < 1e-3);
+    TEST(std::abs(sh.Evaluate(Normalize(Vector(1, 1, 1))).b - PI) < 1e-3);
+
+    // zero normal gives the average
+    TEST(std::abs(sh.Evaluate(Vector(0, 0, 0)).r - PI) < 1e-3);
+  }
+  {
+    // light from above does not reach normals facing down
+    SHIrradiance sh;
+    sh.AddRadiance(Vector(0, 1, 0), Color(1, 1, 1));
+    TEST(sh.Evaluate(Vector(0, 1, 0)).r > .5);
+    TEST(sh.Evaluate(Vector(0, -1, 0)).r < .1);
+    TEST(sh.Evaluate(Vector(0, -1, 0)).r >= 0);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "ply2mesh.h"
+#include "fj_random.h"
+#include "fj_mesh.h"
+#include "fj_os.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace fj;
+
+struct PlyPoint {
+  float x, y, z, confidence;
+};
+
+// ascii files are read to doubles. multiples of 1/1024 are written
+// exactly in both files
+static float random_coordinate(XorShift &rng)
+{
+  return static_cast<int>(rng.NextInteger() % 10240) / 1024.f - 5;
+}
+
+// the same mesh as an ascii file and as a binary little endian file with
+// an extra property before z, triangles and quads, and indices of the type
+static void write_ply(const std::string &ascii_name, const std::string &binary_name,
+    const char *index_type)
+{
+  const int NVERTS = 5000;
+  const int NFACES = 9000;
+  XorShift rng;
+
+  std::vector<PlyPoint> points(NVERTS);
+  for (int i = 0; i < NVERTS; i++) {
+    points[i].x = random_coordinate(rng);
+    points[i].y = random_coordinate(rng);
+    points[i].z = random_coordinate(rng);
+    points[i].confidence = rng.NextFloat01();
+  }
+
+  FILE *ascii = fopen(ascii_name.c_str(), "wb");
+  FILE *binary = fopen(binary_name.c_str(), "wb");
+  const char *formats[] = {"ascii", "binary_little_endian"};
+  FILE *files[] = {ascii, binary};
+  for (int i = 0; i < 2; i++) {
+    fprintf(files[i],
+        "ply\n"
+        "format %s 1.0\n"
+        "element vertex %d\n"
+        "property float x\n"
+        "property float y\n"
+        "property float confidence\n"
+        "property float z\n"
+        "element face %d\n"
+        "property list uchar %s vertex_indices\n"
+        "end_header\n", formats[i], NVERTS, NFACES, index_type);
+  }
+
+  for (int i = 0; i < NVERTS; i++) {
+    const PlyPoint &p = points[i];
+    fprintf(ascii, "%.17g %.17g %.17g %.17g\n", p.x, p.y, p.confidence, p.z);
+    const float record[] = {p.x, p.y, p.confidence, p.z};
+    fwrite(record, sizeof(record), 1, binary);
+  }
+
+  for (int i = 0; i < NFACES; i++) {
+    const unsigned char nverts = i % 3 == 0 ? 4 : 3;
+    int verts[4];
+    fprintf(ascii, "%d", nverts);
+    for (int j = 0; j < nverts; j++) {
+      verts[j] = rng.NextInteger() % NVERTS;
+      fprintf(ascii, " %d", verts[j]);
+    }
+    fprintf(ascii, "\n");
+    fwrite(&nverts, sizeof(nverts), 1, binary);
+    fwrite(verts, sizeof(verts[0]), nverts, binary);
+  }
+
+  fclose(ascii);
+  fclose(binary);
+}
+
+int main()
+{
+  {
+    // binary files read in bulk make the same meshes as ascii files read
+    // element by element
+    const char *index_types[] = {"int", "uint"};
+    for (int i = 0; i < 2; i++) {
+      const std::string ascii_name = OsGetTempDirectory() + "/fj_stanford_ply_test_ascii.ply";
+      const std::string binary_name = OsGetTempDirectory() + "/fj_stanford_ply_test_binary.ply";
+      write_ply(ascii_name, binary_name, index_types[i]);
+
+      Mesh element_mesh;
+      Mesh bulk_mesh;
+      TEST_INT(ReadPlyFile(ascii_name.c_str(), element_mesh), 0);
+      TEST_INT(ReadPlyFile(binary_name.c_str(), bulk_mesh), 0);
+
+      // 3000 quads are split into two triangles
+      TEST_INT(bulk_mesh.GetPointCount(), 5000);
+      TEST_INT(bulk_mesh.GetFaceCount(), 12000);
+      TEST(bulk_mesh.HasSameContent(element_mesh));
+
+      remove(ascii_name.c_str());
+      remove(binary_name.c_str());
+    }
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
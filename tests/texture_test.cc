@@ -0,0 +1,74 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_texture.h"
+#include "fj_mipmap.h"
+#include "fj_color.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+using namespace fj;
+
+// a ramp of height along u
+static int write_ramp(const char *filename, float slope, int format, bool bump)
+{
+  const int W = 64;
+  std::vector<float> pixels(W * W);
+  for (int y = 0; y < W; y++) {
+    for (int x = 0; x < W; x++) {
+      pixels[y * W + x] = .5f + slope * ((x + .5f) / W - .5f);
+    }
+  }
+
+  MipOutput out;
+  if (out.Open(filename)) {
+    return -1;
+  }
+  out.SetBumpDerivatives(bump);
+  if (out.GenerateFromSourceData(&pixels[0], W, W, 1)) {
+    return -1;
+  }
+  out.SetTileFormat(format);
+  out.WriteFile();
+  out.Close();
+  return 0;
+}
+
+int main()
+{
+  {
+    // baked derivatives are of texture space and colors stay the same
+    const char filename[] = "texture_test.mip";
+    TEST_INT(write_ramp(filename, .5, MIP_TILE_FLOAT, true), 0);
+
+    Texture tex;
+    TEST_INT(tex.LoadFile(filename), 0);
+    TEST(tex.HasBumpDerivatives());
+    TEST(std::abs(tex.Lookup(.5, .5).r - .5) < .01);
+
+    float dhdu = 0, dhdv = 0;
+    TEST_INT(tex.LookupBumpDerivatives(.3, .6, 0, 0, &dhdu, &dhdv), 0);
+    TEST(std::abs(dhdu - .5) < 1e-4);
+    TEST(std::abs(dhdv) < 1e-4);
+
+    // uint8 can't have negative derivatives so they are written as half
+    TEST_INT(write_ramp(filename, -.5, MIP_TILE_UINT8, true), 0);
+    TEST_INT(tex.LoadFile(filename), 0);
+    TEST_INT(tex.LookupBumpDerivatives(.3, .6, 0, 0, &dhdu, &dhdv), 0);
+    TEST(std::abs(dhdu + .5) < 1e-3);
+
+    TEST_INT(write_ramp(filename, .5, MIP_TILE_FLOAT, false), 0);
+    TEST_INT(tex.LoadFile(filename), 0);
+    TEST(!tex.HasBumpDerivatives());
+    TEST_INT(tex.LookupBumpDerivatives(.3, .6, 0, 0, &dhdu, &dhdv), -1);
+
+    remove(filename);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,137 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_tile_cache.h"
+#include "fj_tile_loader.h"
+#include "fj_texture.h"
+#include "fj_mipmap.h"
+#include "fj_color.h"
+#include <cstdio>
+#include <vector>
+
+using namespace fj;
+
+static TileCache::TilePtr new_tile(float value)
+{
+  std::shared_ptr<CachedTile> tile = std::make_shared<CachedTile>();
+  tile->tilesize = 64;
+  tile->nchannels = 1;
+  tile->texels.assign(64 * 64, value);
+  return tile;
+}
+
+int main()
+{
+  {
+    // the same id for the same file
+    TileCache cache;
+    const int a = cache.GetFileID("a.mip");
+    const int b = cache.GetFileID("b.mip");
+    TEST(a != b);
+    TEST(cache.GetFileID("a.mip") == a);
+  }
+  {
+    // tiles are found by file, level and position
+    TileCache cache;
+    cache.Insert(0, 0, 1, 2, new_tile(1));
+    cache.Insert(0, 1, 1, 2, new_tile(2));
+    cache.Insert(1, 0, 1, 2, new_tile(3));
+
+    TEST(cache.Find(0, 0, 1, 2)->texels[0] == 1);
+    TEST(cache.Find(0, 1, 1, 2)->texels[0] == 2);
+    TEST(cache.Find(1, 0, 1, 2)->texels[0] == 3);
+    TEST(!cache.Find(0, 0, 2, 1));
+
+    // the first insertion wins
+    TEST(cache.Insert(0, 0, 1, 2, new_tile(4))->texels[0] == 1);
+    TEST(cache.GetTileCount() == 3);
+
+    cache.RemoveFile(0);
+    TEST(cache.GetTileCount() == 1);
+    TEST(!cache.Find(0, 0, 1, 2));
+  }
+  {
+    // memory stays in the budget and held tiles stay valid after eviction
+    TileCache cache;
+    const TileCache::TilePtr held = cache.Insert(0, 0, 0, 0, new_tile(5));
+    cache.SetMemoryBudget(1024 * 1024);
+    for (int i = 0; i < 1000; i++) {
+      cache.Insert(0, 0, i, 1, new_tile(i));
+    }
+    TEST(cache.GetMemoryUsage() <= cache.GetMemoryBudget() + 32 * 64 * 64 * sizeof(float) * 2);
+    TEST(cache.GetTileCount() < 1000);
+    TEST(held->texels[0] == 5);
+
+    TileFileStats stats;
+    cache.GetFileStats(0, &stats);
+    TEST(stats.evicted_count == static_cast<int64_t>(1001 - cache.GetTileCount()));
+  }
+  {
+    // tiles used recently are kept
+    TileCache cache;
+    cache.SetMemoryBudget(4 * 1024 * 1024);
+    cache.Insert(0, 0, 0, 0, new_tile(1));
+    int found = 0;
+    for (int i = 0; i < 1000; i++) {
+      found += cache.Find(0, 0, 0, 0) != NULL;
+      cache.Insert(0, 0, i, 1, new_tile(i));
+    }
+    TEST(found == 1000);
+    TEST(!cache.Find(0, 0, 0, 1));
+
+    cache.Clear();
+    TEST(cache.GetTileCount() == 0);
+    TEST(cache.GetMemoryUsage() == 0);
+  }
+  {
+    // prefetched tiles are read into the global cache by I/O threads
+    const char filename[] = "tile_cache_test.mip";
+    std::vector<float> pixels(256 * 256, .25f);
+    MipOutput out;
+    TEST_INT(out.Open(filename), 0);
+    TEST_INT(out.GenerateFromSourceData(&pixels[0], 256, 256, 1), 0);
+    out.WriteFile();
+    out.Close();
+
+    Texture tex;
+    TEST_INT(tex.LoadFile(filename), 0);
+    TEST(tex.GetMemoryUsage() == 0);
+
+    TileLoader &loader = TileLoaderGetGlobal();
+    TEST_INT(loader.GetThreadCount(), 2);
+    tex.PrefetchLevel(0);
+    loader.Wait();
+    const std::size_t usage = tex.GetMemoryUsage();
+    TEST(usage > 0);
+
+    // lookups find them without reading
+    TileCache &cache = TileCacheGetGlobal();
+    const int file_id = cache.GetFileID(filename);
+    TileFileStats stats;
+    cache.GetFileStats(file_id, &stats);
+    const int64_t read_count = stats.read_count;
+    TEST(read_count > 0);
+    TEST(stats.read_bytes > 0);
+    TEST_FLOAT(tex.Lookup(.3, .7).r, .25);
+    TEST(tex.GetMemoryUsage() == usage);
+    cache.GetFileStats(file_id, &stats);
+    TEST(stats.read_count == read_count);
+    TEST(stats.hit_count > 0);
+    TEST(stats.open_count == 1);
+
+    // no threads ignore requests
+    loader.SetThreadCount(0);
+    tex.PrefetchLevel(1);
+    loader.Wait();
+    TEST(tex.GetMemoryUsage() == usage);
+    loader.SetThreadCount(2);
+
+    remove(filename);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_tile_coverage.h"
+#include <cstdio>
+#include <vector>
+
+using namespace fj;
+
+int main()
+{
+  // only addresses are used
+  const ObjectInstance *a = reinterpret_cast<const ObjectInstance *>(0x10);
+  const ObjectInstance *b = reinterpret_cast<const ObjectInstance *>(0x20);
+  const ObjectInstance *c = reinterpret_cast<const ObjectInstance *>(0x30);
+
+  {
+    // repeats are recorded once and objects are sorted
+    ObjectRecorder recorder;
+    for (int i = 0; i < 100; i++) {
+      recorder.Record(c);
+      recorder.Record(a);
+      recorder.Record(NULL);
+      recorder.Record(c);
+    }
+    const std::vector<const ObjectInstance *> &objects = recorder.GetObjects();
+    TEST_INT(objects.size(), 2);
+    TEST(objects[0] == a);
+    TEST(objects[1] == c);
+
+    recorder.Clear();
+    TEST_INT(recorder.GetObjects().size(), 0);
+  }
+  {
+    // only tiles hitting the object need rendering after it is invalidated
+    TileCoverage coverage;
+    coverage.Init(123, 3);
+    TEST(coverage.GetKey() == 123);
+    TEST(!coverage.IsTileRendered(0));
+
+    std::vector<const ObjectInstance *> objects;
+    objects.push_back(a);
+    coverage.SetTileRendered(0, objects, false);
+    objects[0] = b;
+    coverage.SetTileRendered(1, objects, false);
+    coverage.SetTileRendered(2, std::vector<const ObjectInstance *>(), false);
+
+    // a later pass of tile 1 hits another object
+    objects[0] = c;
+    coverage.SetTileRendered(1, objects, true);
+
+    coverage.InvalidateObject(c);
+    TEST(coverage.IsTileRendered(0));
+    TEST(!coverage.IsTileRendered(1));
+    TEST(coverage.IsTileRendered(2));
+
+    coverage.InvalidateObject(a);
+    TEST(!coverage.IsTileRendered(0));
+    TEST(coverage.IsTileRendered(2));
+
+    coverage.Clear();
+    TEST_INT(coverage.GetTileCount(), 0);
+    TEST(!coverage.IsTileRendered(2));
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_tiler.h"
+#include "fj_rectangle.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace fj;
+
+// tiles of the whole frame in a grid of xntiles x yntiles. the last
+// column and row are partial
+static void divide(Tiler &tiler, int xntiles, int yntiles)
+{
+  const int xres = 8 * xntiles - 3;
+  const int yres = 8 * yntiles - 5;
+  tiler.Divide(xres, yres, 8, 8);
+  Rectangle region;
+  region.max = Int2(xres, yres);
+  tiler.GenerateTiles(region);
+}
+
+int main()
+{
+  {
+    // every thread gets several tiles
+    const int size = TilerChooseTileSize(1920, 1080, 8, 9, 2, 0);
+    TEST_INT(size % 8, 0);
+    TEST((1920 / size) * (1080 / size) >= 8 * 4);
+
+    // more threads get smaller tiles
+    TEST(TilerChooseTileSize(1920, 1080, 32, 9, 2, 0) < size);
+  }
+  {
+    // wide filters and cheap pixels make tiles larger
+    TEST_INT(TilerChooseTileSize(320, 240, 64, 9, 2, 0), 16);
+    TEST_INT(TilerChooseTileSize(320, 240, 64, 9, 6, 0), 48);
+    TEST(TilerChooseTileSize(320, 240, 64, 9, 2, 1e-7) > 16);
+  }
+  {
+    // the smallest and the largest sizes
+    TEST_INT(TilerChooseTileSize(1, 1, 1, 1024, 0, 0), 16);
+    TEST_INT(TilerChooseTileSize(16384, 16384, 1, 1, 2, 0), 128);
+  }
+
+  {
+    // hilbert and morton orders visit every tile once for grids of odd and
+    // non power of two counts
+    const int grids[][2] = {
+      {1, 1}, {1, 9}, {9, 1}, {3, 5}, {7, 7}, {5, 13}, {17, 9}, {16, 16}, {33, 2}
+    };
+    const int orders[] = {TILE_ORDER_HILBERT, TILE_ORDER_MORTON};
+    int wrong_sizes = 0;
+    int wrong_visits = 0;
+    for (int i = 0; i < 9; i++) {
+      Tiler tiler;
+      divide(tiler, grids[i][0], grids[i][1]);
+      const int NTILES = tiler.GetTileCount();
+      TEST_INT(NTILES, grids[i][0] * grids[i][1]);
+
+      for (int j = 0; j < 2; j++) {
+        std::vector<int> que;
+        tiler.GetTileOrder(orders[j], std::vector<double>(), &que);
+        wrong_sizes += static_cast<int>(que.size()) != NTILES;
+
+        std::vector<int> visits(NTILES, 0);
+        for (std::size_t k = 0; k < que.size(); k++) {
+          if (que[k] < 0 || que[k] >= NTILES) {
+            wrong_visits++;
+            continue;
+          }
+          visits[que[k]]++;
+        }
+        for (int k = 0; k < NTILES; k++) {
+          wrong_visits += visits[k] != 1;
+        }
+      }
+    }
+    TEST_INT(wrong_sizes, 0);
+    TEST_INT(wrong_visits, 0);
+  }
+  {
+    // next tiles of the hilbert order share an edge on power of two grids
+    Tiler tiler;
+    divide(tiler, 16, 16);
+    std::vector<int> que;
+    tiler.GetTileOrder(TILE_ORDER_HILBERT, std::vector<double>(), &que);
+    int jumps = 0;
+    for (std::size_t i = 1; i < que.size(); i++) {
+      const Tile *prev = tiler.GetTile(que[i - 1]);
+      const Tile *next = tiler.GetTile(que[i]);
+      jumps += std::abs(next->xmin - prev->xmin) + std::abs(next->ymin - prev->ymin) != 8;
+    }
+    TEST_INT(jumps, 0);
+
+    // morton order finishes each 2x2 block before the next
+    tiler.GetTileOrder(TILE_ORDER_MORTON, std::vector<double>(), &que);
+    int split_blocks = 0;
+    for (std::size_t i = 0; i < que.size(); i += 4) {
+      const Tile *first = tiler.GetTile(que[i]);
+      for (std::size_t j = i; j < i + 4; j++) {
+        const Tile *tile = tiler.GetTile(que[j]);
+        split_blocks += tile->xmin / 16 != first->xmin / 16 || tile->ymin / 16 != first->ymin / 16;
+      }
+    }
+    TEST_INT(split_blocks, 0);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
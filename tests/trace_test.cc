@@ -0,0 +1,57 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_trace.h"
+#include "fj_os.h"
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <string>
+
+using namespace fj;
+
+static std::string write_trace(const std::string &filename)
+{
+  TraceWriteFile(filename);
+  std::ifstream file(filename.c_str());
+  const std::string text((std::istreambuf_iterator<char>(file)),
+      std::istreambuf_iterator<char>());
+  remove(filename.c_str());
+  return text;
+}
+
+int main()
+{
+  const std::string filename = OsGetTempDirectory() + "/fj_trace_test.json";
+
+  {
+    // nothing is recorded until enabled
+    TraceSetEnabled(false);
+    TraceClear();
+    {
+      const TraceScope trace("test", "DisabledScope", 3);
+    }
+    TraceEvent("test", "DisabledEvent", 0, 10);
+    const std::string text = write_trace(filename);
+    TEST(text.find("DisabledScope") == std::string::npos);
+    TEST(text.find("DisabledEvent") == std::string::npos);
+  }
+  {
+    TraceSetEnabled(true);
+    TEST(TraceIsEnabled());
+    {
+      const TraceScope trace("test", "EnabledScope", 3);
+    }
+    TraceEvent("test", "EnabledEvent", 0, 10);
+    const std::string text = write_trace(filename);
+    TEST(text.find("\"name\":\"EnabledScope\",\"cat\":\"test\"") != std::string::npos);
+    TEST(text.find("\"args\":{\"id\":3}") != std::string::npos);
+    TEST(text.find("\"name\":\"EnabledEvent\"") != std::string::npos);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
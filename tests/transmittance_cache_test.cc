@@ -0,0 +1,52 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_transmittance_cache.h"
+#include <cstdio>
+
+using namespace fj;
+
+int main()
+{
+  {
+    // disabled by default and with no cell size
+    TransmittanceCache cache;
+    TEST(!cache.IsEnabled());
+    cache.Init(0, 1024);
+    TEST(!cache.IsEnabled());
+
+    float T = 0;
+    cache.Add(NULL, NULL, 0, 0, 0, .5);
+    TEST(!cache.Lookup(NULL, NULL, 0, 0, 0, &T));
+  }
+  {
+    // vertices are stored for each light and target
+    TransmittanceCache cache;
+    cache.Init(.25, 1024);
+    TEST(cache.IsEnabled());
+    TEST(cache.GetCellSize() == .25);
+
+    const Light *light1 = reinterpret_cast<const Light *>(16);
+    const Light *light2 = reinterpret_cast<const Light *>(32);
+    const ObjectGroup *target = reinterpret_cast<const ObjectGroup *>(64);
+
+    float T = 0;
+    TEST(!cache.Lookup(light1, target, 1, -2, 3, &T));
+    cache.Add(light1, target, 1, -2, 3, .25);
+    TEST(cache.Lookup(light1, target, 1, -2, 3, &T));
+    TEST_FLOAT(T, .25);
+
+    TEST(!cache.Lookup(light2, target, 1, -2, 3, &T));
+    TEST(!cache.Lookup(light1, NULL, 1, -2, 3, &T));
+    TEST(!cache.Lookup(light1, target, 1, -2, 4, &T));
+
+    cache.Init(.25, 1024);
+    TEST(!cache.Lookup(light1, target, 1, -2, 3, &T));
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_triangle.h"
+#include "fj_box.h"
+#include "fj_vector.h"
+#include <cstdio>
+
+using namespace fj;
+
+int main()
+{
+  {
+    // hit, miss, degenerate and hit from the back
+    const Vector verts[4][3] = {
+      {Vector(-1, -1, 0), Vector(1, -1, 0), Vector(0, 1, 0)},
+      {Vector( 2,  2, 0), Vector(3,  2, 0), Vector(2, 3, 0)},
+      {Vector( 0,  0, 0), Vector(1,  1, 0), Vector(2, 2, 0)},
+      {Vector(-1, -1, 2), Vector(0,  1, 2), Vector(1, -1, 2)}
+    };
+    const Vector orig(.1, .2, -1);
+    const Vector dir(.01, -.02, 1);
+
+    PrecomputedTriangle tris[4];
+    const PrecomputedTriangle *ptrs[4];
+    for (int i = 0; i < 4; i++) {
+      TriPrecompute(verts[i][0], verts[i][1], verts[i][2], &tris[i]);
+      ptrs[i] = &tris[i];
+    }
+
+    Real t[4], u[4], v[4];
+    const int mask = TriRayIntersect4(ptrs, 4, orig, dir, t, u, v);
+
+    TEST(mask == 0x9);
+
+    for (int i = 0; i < 4; i++) {
+      Real t0 = 0, u0 = 0, v0 = 0;
+      const bool hit = TriRayIntersect(verts[i][0], verts[i][1], verts[i][2],
+          orig, dir, DO_NOT_CULL_BACKFACES, &t0, &u0, &v0);
+
+      TEST(hit == ((mask & (1 << i)) != 0));
+      if (hit) {
+        TEST(t[i] == t0);
+        TEST(u[i] == u0);
+        TEST(v[i] == v0);
+      }
+    }
+
+    // unused lanes never hit
+    TEST(TriRayIntersect4(ptrs, 1, orig, dir, t, u, v) == 0x1);
+  }
+  {
+    // bounds of the part of a diagonal triangle inside boxes
+    const Vector P0(0, 0, 0);
+    const Vector P1(4, 0, 0);
+    const Vector P2(4, 4, 0);
+    Box bounds;
+    TriClipBounds(P0, P1, P2, Box(Vector(-1, -1, -1), Vector(2, 5, 1)), &bounds);
+    TEST_FLOAT(bounds.min.x, 0.);
+    TEST_FLOAT(bounds.max.x, 2.);
+    TEST_FLOAT(bounds.max.y, 2.);
+    TriClipBounds(P0, P1, P2, Box(Vector(3, -1, -1), Vector(5, 1, 1)), &bounds);
+    TEST_FLOAT(bounds.min.x, 3.);
+    TEST_FLOAT(bounds.max.y, 1.);
+    TriClipBounds(P0, P1, P2, Box(Vector(0, 2, -1), Vector(1, 5, 1)), &bounds);
+    TEST(bounds.IsEmpty());
+  }
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
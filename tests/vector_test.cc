@@ -2,6 +2,7 @@
 // See LICENSE and README
 
 #include "unit_test.h"
+#include "fj_vector_lanes.h"
 #include "fj_vector.h"
 #include <cstdio>
 
@@ -19,6 +20,35 @@ int main()
     TEST(c.y == 0);
     TEST(c.z == 1);
   }
+  {
+    // every lane matches the scalar functions exactly
+    const Vector a[4] = {
+      Vector(1, 2, 3), Vector(-.3, .7, 1e-3), Vector(0, 0, 0), Vector(5, -1, .25)};
+    const Vector b(.1, -2.5, 7);
+    Vector4N a4;
+    for (int i = 0; i < 4; i++) {
+      a4.Set(i, a[i]);
+    }
+    const Vector4N b4(b);
+
+    const Real4N dot = Dot(a4, b4);
+    const Vector4N cross = Cross(a4, b4);
+    const Vector4N normal = Normalize(a4);
+    const Vector4N lerp = Real4N(.3) * a4 + Real4N(.7) * b4;
+    for (int i = 0; i < 4; i++) {
+      TEST(dot[i] == Dot(a[i], b));
+      TEST(cross.Get(i).x == Cross(a[i], b).x);
+      TEST(cross.Get(i).y == Cross(a[i], b).y);
+      TEST(cross.Get(i).z == Cross(a[i], b).z);
+      TEST(normal.Get(i).x == Normalize(a[i]).x);
+      TEST(normal.Get(i).z == Normalize(a[i]).z);
+      TEST(lerp.Get(i).y == (.3 * a[i] + .7 * b).y);
+    }
+
+    TEST(LessThan(dot, Real4N(0)) == 0x2);
+    TEST(GreaterThan(Real4N(0), dot) == 0x2);
+    TEST(AllLanes<8>() == 0xff);
+  }
   printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
     TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
 
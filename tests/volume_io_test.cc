@@ -0,0 +1,86 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_geometry_io.h"
+#include "fj_volume.h"
+#include "fj_box.h"
+#include <cstdio>
+
+using namespace fj;
+
+static void make_volume(Volume &volume)
+{
+  volume.Resize(20, 17, 9);
+  volume.SetBounds(Box(Vector(-1, -2, -3), Vector(1, 2, 3)));
+  volume.Fill(.5);
+  volume.SetValue(3, 4, 5, 1);
+  volume.SetValue(19, 16, 8, 2);
+  for (int x = 8; x < 16; x++) {
+    volume.SetValue(x, 10, 2, x);
+  }
+  volume.Compact();
+}
+
+int main()
+{
+  const char filename[] = "volume_io_test.bin";
+  const int compressions[] = {VOLUME_COMPRESSION_RLE, VOLUME_COMPRESSION_NONE};
+
+  for (int i = 0; i < 2; i++) {
+    // bricks are read on first access with the values written
+    Volume src;
+    make_volume(src);
+    VolumeOutputFile file(filename);
+    file.SetCompression(compressions[i]);
+    TEST(file.Write(src) == 0);
+
+    Volume dst;
+    TEST(VolumeInputFile(filename).Read(dst) == 0);
+    int xres = 0, yres = 0, zres = 0;
+    dst.GetResolution(&xres, &yres, &zres);
+    TEST(xres == 20 && yres == 17 && zres == 9);
+    TEST(dst.GetBounds().min.y == -2 && dst.GetBounds().max.z == 3);
+    TEST(dst.GetVoxelBuffer().GetAllocatedBrickCount() == 0);
+    TEST(dst.GetValue(0, 0, 0) == .5);
+    TEST(dst.GetValue(3, 4, 5) == 1);
+    TEST(dst.GetValue(19, 16, 8) == 2);
+    TEST(dst.GetValue(12, 10, 2) == 12);
+    TEST(dst.GetValue(12, 11, 2) == .5);
+
+    Real t_exit = 0;
+    TEST(dst.GetMaxDensity(Vector(0, 0, 0), Vector(1, 0, 0), &t_exit) ==
+        src.GetMaxDensity(Vector(0, 0, 0), Vector(1, 0, 0), &t_exit));
+    VolumeSample a, b;
+    TEST(dst.GetSample(Vector(.1, .3, -.2), &a) && src.GetSample(Vector(.1, .3, -.2), &b));
+    TEST(a.density == b.density);
+
+    // writing copies the brick
+    dst.SetValue(12, 10, 2, 0);
+    TEST(dst.GetVoxelBuffer().GetAllocatedBrickCount() == 1);
+    TEST(dst.GetValue(12, 10, 2) == 0);
+    TEST(dst.GetValue(13, 10, 2) == 13);
+
+    // the mapping outlives the file
+    remove(filename);
+    TEST(dst.GetValue(19, 16, 8) == 2);
+  }
+  {
+    // broken files leave the volume as it is
+    FILE *file = fopen(filename, "wb");
+    fputs("fjvol", file);
+    fclose(file);
+
+    Volume volume;
+    make_volume(volume);
+    TEST(VolumeInputFile(filename).Read(volume) == -1);
+    TEST(VolumeInputFile("no_such_file.bin").Read(volume) == -1);
+    TEST(volume.GetValue(3, 4, 5) == 1);
+    remove(filename);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
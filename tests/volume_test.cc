@@ -0,0 +1,212 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "unit_test.h"
+#include "fj_volume.h"
+#include "fj_box.h"
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+
+using namespace fj;
+
+static float add_x(void *data, int x, int y, int z, float value)
+{
+  return value + x;
+}
+
+static float ramp_value(void *data, int x, int y, int z, float value)
+{
+  return (x + y + z) / 10.f;
+}
+
+int main()
+{
+  {
+    // empty space allocates no bricks
+    VoxelBuffer buffer;
+    TEST(buffer.IsEmpty());
+    buffer.Resize(20, 17, 9);
+    TEST(!buffer.IsEmpty());
+    TEST(buffer.GetValue(19, 16, 8) == 0);
+    buffer.SetValue(3, 4, 5, 0);
+    TEST(buffer.GetAllocatedBrickCount() == 0);
+
+    buffer.SetValue(3, 4, 5, 1);
+    buffer.SetValue(19, 16, 8, 2);
+    buffer.SetValue(20, 0, 0, 3);
+    TEST(buffer.GetAllocatedBrickCount() == 2);
+    TEST(buffer.GetValue(3, 4, 5) == 1);
+    TEST(buffer.GetValue(19, 16, 8) == 2);
+    TEST(buffer.GetValue(4, 4, 5) == 0);
+    TEST(buffer.GetValue(20, 0, 0) == 0);
+    TEST(buffer.GetValue(-1, 0, 0) == 0);
+  }
+  {
+    // bricks of the same value become tiles
+    VoxelBuffer buffer;
+    buffer.Resize(12, 12, 12);
+    for (int z = 0; z < 12; z++) {
+      for (int y = 0; y < 12; y++) {
+        for (int x = 0; x < 12; x++) {
+          buffer.SetValue(x, y, z, .5);
+        }
+      }
+    }
+    buffer.SetValue(0, 0, 0, 1);
+    TEST(buffer.GetAllocatedBrickCount() == 8);
+
+    buffer.Compact();
+    TEST(buffer.GetAllocatedBrickCount() == 1);
+    TEST(buffer.GetValue(0, 0, 0) == 1);
+    TEST(buffer.GetValue(1, 0, 0) == .5);
+    TEST(buffer.GetValue(11, 11, 11) == .5);
+
+    buffer.Fill(2);
+    TEST(buffer.GetAllocatedBrickCount() == 0);
+    TEST(buffer.GetValue(0, 0, 0) == 2);
+    TEST(buffer.GetValue(11, 11, 11) == 2);
+  }
+
+  {
+    // max values cover voxels next to bricks
+    VoxelBuffer buffer;
+    buffer.Resize(32, 32, 32);
+    buffer.SetValue(8, 8, 8, -.5);
+    TEST(buffer.GetBrickMaxValue(8, 8, 8) == .5f);
+    TEST(buffer.GetBrickMaxValue(7, 7, 7) == .5f);
+    TEST(buffer.GetBrickMaxValue(16, 8, 8) == 0);
+
+    buffer.Compact();
+    TEST(buffer.GetBrickMaxValue(16, 8, 8) == .5f);
+    TEST(buffer.GetBrickMaxValue(24, 24, 24) == 0);
+    TEST(buffer.GetBrickMaxValue(32, 0, 0) == 0);
+  }
+  {
+    // max density and distance to the next brick
+    Volume volume;
+    volume.Resize(32, 32, 32);
+    volume.SetBounds(Box(Vector(0, 0, 0), Vector(4, 4, 4)));
+    volume.SetValue(30, 30, 30, 2);
+
+    Real t_exit = 0;
+    TEST(volume.GetMaxDensity(Vector(.5, .5, .5), Vector(1, 0, 0), &t_exit) == 0);
+    TEST_DOUBLE(t_exit, .5);
+    TEST(volume.GetMaxDensity(Vector(.5, .5, .5), Vector(0, -2, 0), &t_exit) == 0);
+    TEST_DOUBLE(t_exit, .25);
+    TEST(volume.GetMaxDensity(Vector(3.5, 3.5, 3.5), Vector(1, 1, 1), &t_exit) == 2);
+    TEST(volume.GetMaxDensity(Vector(5, 5, 5), Vector(1, 1, 1), &t_exit) == 0);
+    TEST(t_exit == 0);
+  }
+
+  {
+    // bulk writes touch only the voxels in the range
+    VoxelBuffer buffer;
+    buffer.Resize(40, 40, 40);
+    buffer.UpdateValues(-5, 2, 3, 30, 50, 20, add_x, NULL);
+    TEST(buffer.GetValue(0, 2, 3) == 0);
+    TEST(buffer.GetValue(7, 39, 20) == 7);
+    TEST(buffer.GetValue(30, 10, 10) == 30);
+    TEST(buffer.GetValue(31, 10, 10) == 0);
+    TEST(buffer.GetValue(7, 1, 10) == 0);
+    TEST(buffer.GetValue(7, 10, 21) == 0);
+    TEST(buffer.GetBrickMaxValue(31, 39, 20) == 30);
+    TEST(buffer.GetBrickMaxValue(39, 39, 39) == 0);
+
+    VoxelBuffer other;
+    other.Resize(40, 40, 40);
+    other.Fill(1);
+    other.SetValue(35, 35, 35, 2);
+    buffer.AddValues(other);
+    TEST(buffer.GetValue(0, 0, 0) == 1);
+    TEST(buffer.GetValue(30, 10, 10) == 31);
+    TEST(buffer.GetValue(35, 35, 35) == 2);
+    TEST(buffer.GetBrickMaxValue(0, 0, 39) == 1);
+  }
+
+  {
+    // filtered samples read levels of averaged voxels
+    Volume volume;
+    volume.Resize(32, 32, 32);
+    volume.SetBounds(Box(Vector(0, 0, 0), Vector(1, 1, 1)));
+    for (int z = 0; z < 32; z++) {
+      for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) {
+          volume.SetValue(x, y, z, (x + y + z) % 2);
+        }
+      }
+    }
+    volume.BuildLevels();
+    TEST_INT(volume.GetLevelCount(), 4);
+
+    const Vector P((10 + .5) / 32, (12 + .5) / 32, (14 + .5) / 32);
+    VolumeSample sample;
+    TEST(volume.GetFilteredSample(P, 0, &sample));
+    TEST_FLOAT(sample.density, 0.);
+    TEST(volume.GetFilteredSample(P, .2, &sample));
+    TEST(std::abs(sample.density - .5) < 1e-6);
+    TEST(!volume.GetFilteredSample(Vector(2, 0, 0), .2, &sample));
+
+    volume.SetValue(0, 0, 0, 1);
+    TEST_INT(volume.GetLevelCount(), 0);
+  }
+
+  {
+    // packed bricks keep values within the precision until written
+    const int precisions[] = {VOXEL_PRECISION_HALF, VOXEL_PRECISION_FIXED16, VOXEL_PRECISION_FIXED8};
+    for (int i = 0; i < 3; i++) {
+      VoxelBuffer buffer;
+      buffer.Resize(16, 16, 16);
+      buffer.UpdateValues(0, 0, 0, 15, 15, 15, ramp_value, NULL);
+      const std::size_t float_usage = buffer.GetMemoryUsage();
+
+      buffer.SetPrecision(precisions[i]);
+      buffer.Compact();
+      TEST_INT(buffer.GetPrecision(), precisions[i]);
+      TEST_INT(buffer.GetAllocatedBrickCount(), 8);
+      TEST(buffer.GetMemoryUsage() < float_usage);
+
+      float max_error = 0;
+      for (int x = 0; x < 16; x++) {
+        max_error = std::max(max_error, std::abs(buffer.GetValue(x, 3, 5) - (x + 3 + 5) / 10.f));
+      }
+      TEST(max_error < .01);
+      TEST(buffer.GetBrickMaxValue(15, 15, 15) >= 4.5 - .01);
+
+      buffer.SetValue(1, 2, 3, 10);
+      TEST_FLOAT(buffer.GetValue(1, 2, 3), 10.);
+      TEST(std::abs(buffer.GetValue(2, 2, 3) - .7) < .01);
+    }
+  }
+
+  {
+    // trilinear samples across bricks and four at a time are the same
+    VoxelBuffer buffer;
+    buffer.Resize(16, 16, 16);
+    buffer.UpdateValues(0, 0, 0, 15, 15, 15, ramp_value, NULL);
+
+    const Vector P[4] = {
+      Vector(7.9, 8.2, 3.3),
+      Vector(2.25, 8.5, 15.1),
+      Vector(.8, 4.6, 12.7),
+      Vector(.2, 15.9, 16)};
+    float values[4];
+    buffer.GetTrilinearValues4(P, values);
+
+    float max_error = 0;
+    for (int i = 0; i < 3; i++) {
+      const float expected = (P[i].x + P[i].y + P[i].z - 1.5) / 10;
+      max_error = std::max(max_error, std::abs(buffer.GetTrilinearValue(P[i]) - expected));
+    }
+    TEST(max_error < 1e-5);
+    for (int i = 0; i < 4; i++) {
+      TEST(std::abs(values[i] - buffer.GetTrilinearValue(P[i])) < 1e-6);
+    }
+    TEST_FLOAT(buffer.GetTrilinearValue(Vector(-2, -2, -2)), 0.);
+  }
+
+  printf("%s: %d/%d/%d: (FAIL/PASS/TOTAL)\n", __FILE__,
+    TestGetFailCount(), TestGetPassCount(), TestGetTotalCount());
+
+  return 0;
+}
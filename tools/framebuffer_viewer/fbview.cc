@@ -12,7 +12,7 @@
 using namespace fj;
 
 static const char USAGE[] =
-"Usage: fbview [options] file(*.fb, *.mip)\n"
+"Usage: fbview [options] file(*.fb, *.mip, *.exr)\n"
 "Options:\n"
 "  --help            Display this information\n"
 "  --listen          Start viewer waiting for rendering\n"
@@ -98,7 +98,7 @@ int main(int argc, char **argv)
   glutMouseFunc(mouse);
   glutMotionFunc(motion);
   glutKeyboardFunc(keyboard);
-  glutTimerFunc(1000, timer, 0);
+  glutTimerFunc(16, timer, 0);
 
 #if defined(FJ_WINDOWS)
   {
@@ -180,11 +180,22 @@ static void keyboard(unsigned char key, int x, int y)
 
 static void timer(int value)
 {
+  if (viewer->IsLoading()) {
+    // images are decoded in the background
+    viewer->FinishLoading();
+    glutPostRedisplay();
+    if (viewer->IsLoading()) {
+      glutTimerFunc(16, timer, 0);
+      return;
+    }
+  }
+
   if (viewer->IsListening()) {
     viewer->Listen();
     glutPostRedisplay();
 
-    const int interval = viewer->IsRendering() ? 1 : 100;
+    // tiles are received in the background. a display refresh is enough
+    const int interval = viewer->IsRendering() ? 16 : 100;
     glutTimerFunc(interval, timer, 0);
   }
 }
@@ -14,15 +14,71 @@
 #include "load_images.h"
 
 #include <iostream>
+#include <fstream>
 #include <cmath>
 #include <cassert>
 
 namespace fj {
 
 static bool is_socket_ready = false;
+// the receiver thread checks closing and abort at least this often
+static const int RECEIVE_TIMEOUT_MSEC = 50;
+// bytes read from a ready renderer at a time
+static const int RECEIVE_CHUNK_SIZE = 64 * 1024;
 static void draw_tile_guide(int width, int height, int tilesize);
 
+// tiles are gamma corrected by the receiver thread
+class FrameBufferViewer::ReceivedMessage {
+public:
+  ReceivedMessage() : message(), tile() {}
+  ~ReceivedMessage() {}
+
+  Message message;
+  FrameBuffer tile;
+};
+
+// bytes of a renderer received so far. messages are decoded once the
+// whole of them have arrived so that no renderer blocks the others
+class FrameBufferViewer::Connection {
+public:
+  Connection() : socket(), frame_id(-1), buffer(),
+      xres(0), yres(0), channel_count(0), shared_frame() {}
+  ~Connection() {}
+
+  Socket socket;
+  // of the last message. aborts are sent to renderers of the frame
+  int32_t frame_id;
+  std::vector<char> buffer;
+
+  // of the last frame start. tiles of the frame are read from the shared
+  // frame if the renderer is on this machine
+  int xres;
+  int yres;
+  int channel_count;
+  SharedFrame shared_frame;
+};
+
+// decoded and gamma corrected by the loader thread
+class FrameBufferViewer::LoadedImage {
+public:
+  LoadedImage() : filename(), fb(), levels(), info(), err(0) {}
+  ~LoadedImage() {}
+
+  std::string filename;
+  FrameBuffer fb;
+  std::vector<FrameBuffer> levels;
+  BufferInfo info;
+  int err;
+};
+
 FrameBufferViewer::FrameBufferViewer() :
+    levels_(),
+    image_level_(0),
+    max_texture_size_(0),
+    loader_thread_(),
+    loaded_(),
+    is_loaded_(false),
+
     filename_(""),
     status_message_(""),
 
@@ -33,11 +89,19 @@ FrameBufferViewer::FrameBufferViewer() :
     pressbutton_(MOUSE_BUTTON_NONE),
 
     viewbox_(),
+    dirty_region_(),
 
     tilesize_(0),
     draw_tile_(1),
 
     server_(),
+    poller_(),
+    connections_(),
+    receiver_thread_(),
+    que_mutex_(),
+    que_(),
+    is_closing_(false),
+    abort_frame_id_(-1),
     state_(STATE_NONE),
     tile_status_(),
     frame_id_(-1)
@@ -47,6 +111,12 @@ FrameBufferViewer::FrameBufferViewer() :
 
 FrameBufferViewer::~FrameBufferViewer()
 {
+  StopListening();
+
+  if (loader_thread_.joinable()) {
+    loader_thread_.join();
+  }
+
   if (is_socket_ready) {
     const int err = SocketCleanup();
     if (err) {
@@ -56,7 +126,7 @@ FrameBufferViewer::~FrameBufferViewer()
   }
 }
 
-void FrameBufferViewer::Draw() const
+void FrameBufferViewer::Draw()
 {
   const int xviewsize = viewbox_.Size()[0];
   const int yviewsize = viewbox_.Size()[1];
@@ -70,6 +140,23 @@ void FrameBufferViewer::Draw() const
     return;
   }
 
+  if (max_texture_size_ == 0) {
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size_);
+  }
+  // only the level for the zoom is in the texture
+  if (choose_level() != image_level_) {
+    setup_image_card();
+  }
+
+  // tiles received since the last frame are uploaded at once
+  if (dirty_region_.min[0] < dirty_region_.max[0] &&
+      dirty_region_.min[1] < dirty_region_.max[1]) {
+    image_.Update(
+        dirty_region_.min[0], dirty_region_.min[1],
+        dirty_region_.max[0], dirty_region_.max[1]);
+    dirty_region_ = Rectangle();
+  }
+
   glMatrixMode(GL_MODELVIEW);
   glLoadIdentity();
 
@@ -274,11 +361,22 @@ void FrameBufferViewer::StartListening()
   server_.EnableReuseAddr();
   server_.Bind();
   server_.Listen();
+  server_.SetNonBlocking(true);
+  if (poller_.Open() || poller_.Add(server_, server_.GetFileDescriptor())) {
+    std::cerr << "SocketPoller::Open() failed: " << SocketErrorMessage() << "\n\n";
+    poller_.Close();
+    server_.Close();
+    return;
+  }
   is_listening_ = true;
 
   state_ = STATE_READY;
   frame_id_ = -1;
 
+  is_closing_ = false;
+  abort_frame_id_ = -1;
+  receiver_thread_ = std::thread(&FrameBufferViewer::receive_messages, this);
+
   change_status_message("READY: Listening to Renderer");
 }
 
@@ -287,6 +385,22 @@ void FrameBufferViewer::StopListening()
   if (!IsListening())
     return;
 
+  is_closing_ = true;
+  receiver_thread_.join();
+
+  {
+    std::lock_guard<std::mutex> lock(que_mutex_);
+    for (std::size_t i = 0; i < que_.size(); i++) {
+      delete que_[i];
+    }
+    que_.clear();
+  }
+
+  for (std::size_t i = 0; i < connections_.size(); i++) {
+    poller_.Remove(connections_[i]->socket);
+  }
+  connections_.clear();
+  poller_.Close();
   server_.Shutdown();
   server_.Close();
   is_listening_ = false;
@@ -304,119 +418,255 @@ bool FrameBufferViewer::IsListening() const
 
 void FrameBufferViewer::Listen()
 {
-  Socket client;
-
-  const int timeout_sec = 0;
-  const int timeout_micro_sec = 0;
-  const int result = server_.AcceptOrTimeout(client, timeout_sec, timeout_micro_sec);
-
-  if (result == -1) {
-    // TODO ERROR HANDLING
-    return;
+  std::vector<ReceivedMessage *> received;
+  {
+    std::lock_guard<std::mutex> lock(que_mutex_);
+    received.swap(que_);
   }
-  else if (result == 0) {
-    // time out
-    return;
+
+  for (std::size_t i = 0; i < received.size(); i++) {
+    receive_message(received[i]->message, received[i]->tile);
+    delete received[i];
   }
-  else {
-    Message message;
-    FrameBuffer tilebuf;
+}
 
-    int e = ReceiveMessage(client, message, tilebuf);
-    if (e < 0) {
-      // TODO ERROR HANDLING
+void FrameBufferViewer::receive_messages()
+{
+  std::vector<int> ready_keys;
+
+  while (!is_closing_) {
+    const int32_t abort_frame_id = abort_frame_id_.exchange(-1);
+    if (abort_frame_id != -1) {
+      for (std::size_t i = 0; i < connections_.size(); i++) {
+        if (connections_[i]->frame_id == abort_frame_id) {
+          SendRenderFrameAbort(connections_[i]->socket, abort_frame_id);
+        }
+      }
     }
-    client.ShutdownRead();
 
-    switch (message.type) {
+    // time out or error
+    if (poller_.Wait(RECEIVE_TIMEOUT_MSEC, ready_keys) <= 0) {
+      continue;
+    }
 
-    case MSG_RENDER_FRAME_START:
-      if (frame_id_ > 0) {
-        // TODO ERROR HANDLING
-        std::cerr << "WARNING: fbview recieved another frame ID: " << message.frame_id << "\n";
-        std::cerr << "WARNING: fbview ignored this message.\n\n";
-        return;
+    // sockets are keyed by their file descriptors
+    for (std::size_t i = 0; i < ready_keys.size(); i++) {
+      if (ready_keys[i] == server_.GetFileDescriptor()) {
+        accept_connections();
+        continue;
       }
-      frame_id_   = message.frame_id;
-      fb_.Resize(message.xres, message.yres, message.channel_count);
-      viewbox_.min[0] = 0;
-      viewbox_.min[1] = 0;
-      viewbox_.max[0] = message.xres;
-      viewbox_.max[1] = message.yres;
-      setup_image_card();
-      tile_status_.clear();
-      tile_status_.resize(message.tile_count);
-      state_ = STATE_RENDERING;
-
-      change_status_message("RENDERING: ESC to Stop Rendering");
-      break;
 
-    case MSG_RENDER_FRAME_DONE:
-      if (frame_id_ != message.frame_id) {
-        std::cerr << "WARNING: fbview recieved another frame ID: " << message.frame_id << "\n";
-        std::cerr << "WARNING: fbview ignored this message.\n";
-        return;
-      }
-      if (state_ == STATE_RENDERING) {
-        state_ = STATE_READY;
-        change_status_message("READY: Listeing to Renderer"); 
-      }
-      else if (state_ == STATE_INTERRUPTED) {
-        for (size_t i = 0; i < tile_status_.size(); i++) {
-          tile_status_[i] = TileStatus();
+      for (std::size_t j = 0; j < connections_.size(); j++) {
+        Connection &connection = *connections_[j];
+        if (connection.socket.GetFileDescriptor() != ready_keys[i]) {
+          continue;
+        }
+        if (read_connection(connection)) {
+          // disconnected
+          poller_.Remove(connection.socket);
+          connections_.erase(connections_.begin() + j);
         }
-        state_ = STATE_ABORT;
-        change_status_message("INCOMPLETE: Rendering Terminated"); 
+        break;
       }
-      frame_id_ = -1;
+    }
+  }
+}
+
+void FrameBufferViewer::accept_connections()
+{
+  // all renderers waiting at once
+  for (;;) {
+    std::unique_ptr<Connection> connection(new Connection());
+    if (server_.Accept(connection->socket) == FJ_SOCKET_INVALID) {
       break;
+    }
 
-    case MSG_RENDER_TILE_START:
-      if (frame_id_ != message.frame_id) {
-        return;
-      }
-      tile_status_[message.tile_id].region.min[0] = message.xmin;
-      tile_status_[message.tile_id].region.min[1] = message.ymin;
-      tile_status_[message.tile_id].region.max[0] = message.xmax;
-      tile_status_[message.tile_id].region.max[1] = message.ymax;
-      tile_status_[message.tile_id].state = STATE_RENDERING;
+    Socket &socket = connection->socket;
+    if (socket.SetNonBlocking(true) ||
+        poller_.Add(socket, socket.GetFileDescriptor())) {
+      continue;
+    }
+    connections_.push_back(std::move(connection));
+  }
+}
+
+int FrameBufferViewer::read_connection(Connection &connection)
+{
+  char chunk[RECEIVE_CHUNK_SIZE];
+  const int nreads = connection.socket.ReceiveAvailable(chunk, sizeof(chunk));
+  if (nreads < 0) {
+    return -1;
+  }
+
+  std::vector<char> &buffer = connection.buffer;
+  buffer.insert(buffer.end(), chunk, chunk + nreads);
+
+  std::vector<ReceivedMessage *> received_list;
+  std::size_t consumed = 0;
+  int err = 0;
+
+  while (consumed < buffer.size()) {
+    const int size = PeekMessageSize(&buffer[consumed], buffer.size() - consumed);
+    if (size < 0) {
+      err = -1;
+      break;
+    }
+    if (size == 0 || buffer.size() - consumed < static_cast<std::size_t>(size)) {
+      break;
+    }
+
+    ReceivedMessage *received = new ReceivedMessage();
+    received->message.type = MSG_NONE;
+
+    if (DecodeMessage(&buffer[consumed], size, received->message, received->tile)) {
+      delete received;
+      err = -1;
       break;
+    }
+    consumed += size;
+    const Message &message = received->message;
+    if (message.type != MSG_NONE) {
+      connection.frame_id = message.frame_id;
+    }
 
-    case MSG_RENDER_TILE_DONE:
-      if (frame_id_ != message.frame_id) {
-        return;
+    if (message.type == MSG_RENDER_FRAME_START) {
+      connection.xres = message.xres;
+      connection.yres = message.yres;
+      connection.channel_count = message.channel_count;
+      connection.shared_frame.Close();
+    }
+    else if (message.type == MSG_RENDER_FRAME_SHARED) {
+      if (connection.shared_frame.Open(message.shared_key, message.frame_id,
+          connection.xres, connection.yres, connection.channel_count)) {
+        std::cerr << "* WARNING: fbview cannot open shared frame of frame ID: " <<
+            message.frame_id << "\n\n";
       }
-      tile_status_[message.tile_id].region.min[0] = message.xmin;
-      tile_status_[message.tile_id].region.min[1] = message.ymin;
-      tile_status_[message.tile_id].region.max[0] = message.xmax;
-      tile_status_[message.tile_id].region.max[1] = message.ymax;
-      tile_status_[message.tile_id].state = STATE_DONE;
-
-      // Gamma
-      for (int y = 0; y < tilebuf.GetHeight(); y++) {
-        for (int x = 0; x < tilebuf.GetWidth(); x++) {
-          const Color4 color = tilebuf.GetColor(x, y);
-          tilebuf.SetColor(x, y, Gamma(color, 1/2.2));
-        }
+      delete received;
+      continue;
+    }
+    else if (message.type == MSG_RENDER_TILE_DONE &&
+        message.tile_encoding == TILE_ENCODING_SHARED) {
+      connection.shared_frame.ReadTile(message, received->tile);
+    }
+
+    // Gamma
+    FrameBuffer &tilebuf = received->tile;
+    for (int y = 0; y < tilebuf.GetHeight(); y++) {
+      for (int x = 0; x < tilebuf.GetWidth(); x++) {
+        const Color4 color = tilebuf.GetColor(x, y);
+        tilebuf.SetColor(x, y, Gamma(color, 1/2.2));
       }
+    }
+    received_list.push_back(received);
+  }
+  buffer.erase(buffer.begin(), buffer.begin() + consumed);
 
-      PasteInto(fb_, tilebuf,
-          tile_status_[message.tile_id].region.min[0],
-          tile_status_[message.tile_id].region.min[1]);
+  // messages decoded before a broken one are still applied
+  if (!received_list.empty()) {
+    std::lock_guard<std::mutex> lock(que_mutex_);
+    que_.insert(que_.end(), received_list.begin(), received_list.end());
+  }
 
-      setup_image_card();
-      break;
+  return err;
+}
 
-    default:
+void FrameBufferViewer::receive_message(const Message &message, const FrameBuffer &tilebuf)
+{
+  switch (message.type) {
+
+  case MSG_RENDER_FRAME_START:
+    if (frame_id_ > 0) {
       // TODO ERROR HANDLING
-      break;
+      std::cerr << "WARNING: fbview recieved another frame ID: " << message.frame_id << "\n";
+      std::cerr << "WARNING: fbview ignored this message.\n\n";
+      return;
     }
+    frame_id_   = message.frame_id;
+    fb_.Resize(message.xres, message.yres, message.channel_count);
+    levels_.clear();
+    viewbox_.min[0] = 0;
+    viewbox_.min[1] = 0;
+    viewbox_.max[0] = message.xres;
+    viewbox_.max[1] = message.yres;
+    setup_image_card();
+    tile_status_.clear();
+    tile_status_.resize(message.tile_count);
+    state_ = STATE_RENDERING;
+
+    change_status_message("RENDERING: ESC to Stop Rendering");
+    break;
+
+  case MSG_RENDER_FRAME_DONE:
+    if (frame_id_ != message.frame_id) {
+      std::cerr << "WARNING: fbview recieved another frame ID: " << message.frame_id << "\n";
+      std::cerr << "WARNING: fbview ignored this message.\n";
+      return;
+    }
+    if (state_ == STATE_RENDERING) {
+      state_ = STATE_READY;
+      change_status_message("READY: Listeing to Renderer"); 
+    }
+    else if (state_ == STATE_INTERRUPTED) {
+      for (size_t i = 0; i < tile_status_.size(); i++) {
+        tile_status_[i] = TileStatus();
+      }
+      state_ = STATE_ABORT;
+      change_status_message("INCOMPLETE: Rendering Terminated"); 
+    }
+    frame_id_ = -1;
+    break;
+
+  case MSG_RENDER_TILE_START:
+    if (frame_id_ != message.frame_id) {
+      return;
+    }
+    tile_status_[message.tile_id].region.min[0] = message.xmin;
+    tile_status_[message.tile_id].region.min[1] = message.ymin;
+    tile_status_[message.tile_id].region.max[0] = message.xmax;
+    tile_status_[message.tile_id].region.max[1] = message.ymax;
+    tile_status_[message.tile_id].state = STATE_RENDERING;
+    break;
 
-    if (state_ == STATE_INTERRUPTED) {
-      change_status_message("INTERRUPTED: Aborting Render Process"); 
-      SendRenderFrameAbort(client, message.frame_id);
-      // abort;
+  case MSG_RENDER_TILE_DONE:
+    if (frame_id_ != message.frame_id) {
+      return;
+    }
+    tile_status_[message.tile_id].region.min[0] = message.xmin;
+    tile_status_[message.tile_id].region.min[1] = message.ymin;
+    tile_status_[message.tile_id].region.max[0] = message.xmax;
+    tile_status_[message.tile_id].region.max[1] = message.ymax;
+    tile_status_[message.tile_id].state = STATE_DONE;
+
+    PasteInto(fb_, tilebuf,
+        tile_status_[message.tile_id].region.min[0],
+        tile_status_[message.tile_id].region.min[1]);
+
+    if (dirty_region_.min[0] < dirty_region_.max[0]) {
+      dirty_region_.min[0] = Min(dirty_region_.min[0], message.xmin);
+      dirty_region_.min[1] = Min(dirty_region_.min[1], message.ymin);
+      dirty_region_.max[0] = Max(dirty_region_.max[0], message.xmax);
+      dirty_region_.max[1] = Max(dirty_region_.max[1], message.ymax);
+    } else {
+      dirty_region_.min[0] = message.xmin;
+      dirty_region_.min[1] = message.ymin;
+      dirty_region_.max[0] = message.xmax;
+      dirty_region_.max[1] = message.ymax;
     }
+    break;
+
+  case MSG_RENDER_TILE_BATCH:
+    // tiles follow as MSG_RENDER_TILE_DONE
+    break;
+
+  default:
+    // TODO ERROR HANDLING
+    break;
+  }
+
+  if (state_ == STATE_INTERRUPTED) {
+    change_status_message("INTERRUPTED: Aborting Render Process"); 
+    abort_frame_id_ = message.frame_id;
+    // abort;
   }
 }
 
@@ -427,44 +677,56 @@ bool FrameBufferViewer::IsRendering() const
 
 int FrameBufferViewer::LoadImage(const std::string &filename)
 {
-  int err = 0;
-
-  if (filename_ != filename) {
-    filename_ = filename;
+  if (IsLoading()) {
+    return 0;
   }
 
-  const std::string ext = GetFileExtension(filename_);
-  if (ext == "") {
+  const std::string ext = GetFileExtension(filename);
+  if (ext != "fb" && ext != "mip" && ext != "exr") {
     return -1;
   }
-
-  if (ext == "fb") {
-    BufferInfo info;
-    err = LoadFb(filename_, &fb_, &info);
-    viewbox_ = info.viewbox;
-    tilesize_ = info.tilesize;
-  }
-  else if (ext == "mip") {
-    BufferInfo info;
-    err = LoadMip(filename_, &fb_, &info);
-    viewbox_ = info.viewbox;
-    tilesize_ = info.tilesize;
-  }
-  else {
+  if (!std::ifstream(filename.c_str())) {
     return -1;
   }
-  if (err) {
-    return -1;
+  filename_ = filename;
+
+  if (loader_thread_.joinable()) {
+    loader_thread_.join();
   }
+  loaded_.reset(new LoadedImage());
+  loaded_->filename = filename_;
+  is_loaded_ = false;
+  loader_thread_ = std::thread(&FrameBufferViewer::load_image, this, loaded_.get());
 
-  // Gamma
-  for (int y = 0; y < fb_.GetHeight(); y++) {
-    for (int x = 0; x < fb_.GetWidth(); x++) {
-      const Color4 color = fb_.GetColor(x, y);
-      fb_.SetColor(x, y, Gamma(color, 1/2.2));
-    }
+  change_status_message("LOADING: " + filename_);
+  return 0;
+}
+
+bool FrameBufferViewer::IsLoading() const
+{
+  return loaded_ != NULL;
+}
+
+void FrameBufferViewer::FinishLoading()
+{
+  if (!IsLoading() || !is_loaded_) {
+    return;
   }
 
+  loader_thread_.join();
+  std::unique_ptr<LoadedImage> loaded(std::move(loaded_));
+
+  if (loaded->err) {
+    change_status_message("ERROR: Could not load " + loaded->filename);
+    return;
+  }
+
+  fb_.Swap(loaded->fb);
+  levels_.swap(loaded->levels);
+  viewbox_ = loaded->info.viewbox;
+  tilesize_ = loaded->info.tilesize;
+  dirty_region_ = Rectangle();
+
   setup_image_card();
 
   {
@@ -490,8 +752,52 @@ int FrameBufferViewer::LoadImage(const std::string &filename)
       format;
     change_status_message(msg);
   }
+}
 
-  return err;
+void FrameBufferViewer::load_image(LoadedImage *loaded)
+{
+  const std::string ext = GetFileExtension(loaded->filename);
+  FrameBuffer &fb = loaded->fb;
+
+  if (ext == "fb") {
+    loaded->err = LoadFb(loaded->filename, &fb, &loaded->info);
+  }
+  else if (ext == "mip") {
+    loaded->err = LoadMip(loaded->filename, &fb, &loaded->info);
+  }
+  else if (ext == "exr") {
+    loaded->err = LoadExr(loaded->filename, &fb, &loaded->info);
+  }
+  else {
+    loaded->err = -1;
+  }
+
+  if (!loaded->err && !fb.IsEmpty()) {
+    // down to 1x1. levels are averaged before gamma
+    int nlevels = 0;
+    for (int w = fb.GetWidth(), h = fb.GetHeight(); w > 1 || h > 1;
+        w = Max(w / 2, 1), h = Max(h / 2, 1)) {
+      nlevels++;
+    }
+    std::vector<FrameBuffer> &levels = loaded->levels;
+    levels.resize(nlevels);
+    for (int i = 0; i < nlevels; i++) {
+      DownsampleInto(i == 0 ? fb : levels[i - 1], levels[i]);
+    }
+
+    // Gamma
+    for (int i = -1; i < static_cast<int>(levels.size()); i++) {
+      FrameBuffer &level = i < 0 ? fb : levels[i];
+      for (int y = 0; y < level.GetHeight(); y++) {
+        for (int x = 0; x < level.GetWidth(); x++) {
+          const Color4 color = level.GetColor(x, y);
+          level.SetColor(x, y, Gamma(color, 1/2.2));
+        }
+      }
+    }
+  }
+
+  is_loaded_ = true;
 }
 
 void FrameBufferViewer::GetImageSize(Rectangle &viewbox, int *nchannels) const
@@ -531,14 +837,40 @@ void FrameBufferViewer::setup_image_card()
     return;
   }
 
-  image_.Init(fb_.GetReadOnly(0, 0, 0),
-      fb_.GetChannelCount(), diplay_channel_,
+  image_level_ = choose_level();
+  const FrameBuffer &level = get_level(image_level_);
+
+  image_.Init(level.GetReadOnly(0, 0, 0),
+      level.GetWidth(), level.GetHeight(),
+      level.GetChannelCount(), diplay_channel_,
       viewbox_.min[0],
       -viewbox_.min[1],
       viewbox_.Size()[0],
       viewbox_.Size()[1]);
 }
 
+int FrameBufferViewer::choose_level() const
+{
+  const int nlevels = static_cast<int>(levels_.size()) + 1;
+  int level = 0;
+
+  while (level + 1 < nlevels && scale_ * (2 << level) <= 1) {
+    level++;
+  }
+  // e.g. 16K images are larger than textures of some GPUs
+  while (level + 1 < nlevels && max_texture_size_ > 0 &&
+      (get_level(level).GetWidth() > max_texture_size_ ||
+       get_level(level).GetHeight() > max_texture_size_)) {
+    level++;
+  }
+  return level;
+}
+
+const FrameBuffer &FrameBufferViewer::get_level(int level) const
+{
+  return level == 0 ? fb_ : levels_[level - 1];
+}
+
 void FrameBufferViewer::draw_viewbox() const
 {
   float r, g, b;
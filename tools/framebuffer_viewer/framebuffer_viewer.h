@@ -12,9 +12,15 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 namespace fj {
 
+class Message;
+
 enum MouseButton {
   MOUSE_BUTTON_NONE = 0,
   MOUSE_BUTTON_LEFT,
@@ -27,7 +33,8 @@ public:
   FrameBufferViewer();
   ~FrameBufferViewer();
 
-  void Draw() const;
+  // uploads pixels changed since the last draw
+  void Draw();
   void Resize(int width, int height);
 
   void PressButton(MouseButton button, int x, int y);
@@ -35,13 +42,23 @@ public:
   void MoveMouse(int x, int y);
   void PressKey(unsigned char key, int mouse_x, int mouse_y);
 
+  // a background thread accepts renderers and receives their messages.
+  // any number of renderers can be connected. messages of each are
+  // applied in order and those of other frames than the one shown are
+  // ignored
   void StartListening();
   void StopListening();
   bool IsListening() const;
+  // applies messages received since the last call
   void Listen();
   bool IsRendering() const;
 
+  // a background thread decodes the image. returns -1 if the file
+  // cannot be opened
   int LoadImage(const std::string &filename);
+  bool IsLoading() const;
+  // shows the image if it has been decoded
+  void FinishLoading();
 
   void GetImageSize(Rectangle &viewbox, int *nchannels) const;
   void GetWindowSize(int &width, int &height) const;
@@ -50,11 +67,34 @@ public:
 private:
   void set_to_home_position();
   void setup_image_card();
+  // the coarsest level not smaller than the image on screen
+  int choose_level() const;
+  const FrameBuffer &get_level(int level) const;
   void draw_viewbox() const;
   void change_status_message(const std::string &message);
+  void receive_message(const Message &message, const FrameBuffer &tilebuf);
+
+  class ReceivedMessage;
+  class Connection;
+  void receive_messages();
+  void accept_connections();
+  // returns -1 when the connection is closed
+  int read_connection(Connection &connection);
+
+  class LoadedImage;
+  void load_image(LoadedImage *loaded);
 
   FrameBuffer fb_;
+  // levels from 1 to the last one, each is half the size of the previous
+  // one. only loaded images have them
+  std::vector<FrameBuffer> levels_;
   ImageCard image_;
+  int image_level_;
+  int max_texture_size_;
+
+  std::thread loader_thread_;
+  std::unique_ptr<LoadedImage> loaded_;
+  std::atomic<bool> is_loaded_;
 
   std::string filename_;
   std::string status_message_;
@@ -78,12 +118,23 @@ private:
   float ylockoffset_;
 
   Rectangle viewbox_;
+  // pixels pasted since the last upload
+  Rectangle dirty_region_;
 
   int tilesize_;
   int draw_tile_;
 
   //TODO make class for icp/status management
+  // sockets are only used by the receiver thread while listening
   Socket server_;
+  SocketPoller poller_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+  std::thread receiver_thread_;
+  std::mutex que_mutex_;
+  std::vector<ReceivedMessage *> que_;
+  std::atomic<bool> is_closing_;
+  // frame id the receiver thread sends abort for. -1 if none
+  std::atomic<int32_t> abort_frame_id_;
   int state_;
   enum {
     STATE_NONE = 0,
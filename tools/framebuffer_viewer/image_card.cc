@@ -9,10 +9,13 @@ ImageCard::ImageCard() :
     pixels_(NULL),
     display_channel_(DISPLAY_RGB),
     channel_count_(4),
+    width_(0),
+    height_(0),
     xmin_(0),
     ymin_(0),
     xmax_(0),
-    ymax_(0)
+    ymax_(0),
+    format_(0)
 {
 }
 
@@ -20,7 +23,8 @@ ImageCard::~ImageCard()
 {
 }
 
-void ImageCard::Init(const float *pixels, int channel_count, int display_channel,
+void ImageCard::Init(const float *pixels, int width, int height,
+    int channel_count, int display_channel,
     int xoffset, int yoffset, int xsize, int ysize)
 {
   GLenum format = 0;
@@ -28,6 +32,8 @@ void ImageCard::Init(const float *pixels, int channel_count, int display_channel
   pixels_ = pixels;
   channel_count_ = channel_count;
   display_channel_ = display_channel;
+  width_ = width;
+  height_ = height;
   xmin_ = xoffset;
   ymin_ = yoffset;
   xmax_ = xoffset + xsize;
@@ -47,8 +53,9 @@ void ImageCard::Init(const float *pixels, int channel_count, int display_channel
     assert(!"invalid channel count");
     break;
   }
+  format_ = format;
   glPixelStorei(GL_UNPACK_ALIGNMENT, channel_count_);
-  glTexImage2D(GL_TEXTURE_2D, 0, format, xsize, ysize, 0,
+  glTexImage2D(GL_TEXTURE_2D, 0, format, width_, height_, 0,
           format, GL_FLOAT, pixels_);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -58,6 +65,24 @@ void ImageCard::Init(const float *pixels, int channel_count, int display_channel
   }
 }
 
+void ImageCard::Update(int xmin, int ymin, int xmax, int ymax)
+{
+  if (pixels_ == NULL) {
+    return;
+  }
+
+  // rows of the region are in rows of the whole image
+  glPixelStorei(GL_UNPACK_ALIGNMENT, channel_count_);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, width_);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, xmin);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, ymin);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, xmin, ymin, xmax - xmin, ymax - ymin,
+      format_, GL_FLOAT, pixels_);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+}
+
 void ImageCard::Draw() const
 {
   if (pixels_ == NULL) {
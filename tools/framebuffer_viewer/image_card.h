@@ -19,8 +19,13 @@ public:
   ImageCard();
   ~ImageCard();
 
-  void Init(const float *pixels, int channel_count, int display_channel,
+  // pixels of width x height are stretched over xsize x ysize so that
+  // zoomed out views can upload smaller images
+  void Init(const float *pixels, int width, int height,
+      int channel_count, int display_channel,
       int xoffset, int yoffset, int xsize, int ysize);
+  // uploads pixels in the region of the texture again after they changed
+  void Update(int xmin, int ymin, int xmax, int ymax);
 
   void Draw() const;
   void DrawOutline() const;
@@ -29,8 +34,11 @@ private:
   const float *pixels_;
   int display_channel_;
   int channel_count_;
+  int width_;
+  int height_;
 
   int xmin_, ymin_, xmax_, ymax_;
+  GLenum format_;
   ShaderProgram shader_program_;
 };
 
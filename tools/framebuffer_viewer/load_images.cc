@@ -4,9 +4,13 @@
 #include "load_images.h"
 #include "fj_framebuffer_io.h"
 #include "fj_framebuffer.h"
+#include "fj_exr_input.h"
 #include "fj_mipmap.h"
 #include "fj_box.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace fj {
 
 std::string GetFileExtension(const std::string &filename)
@@ -77,4 +81,49 @@ int LoadMip(const std::string &filename, FrameBuffer *fb, BufferInfo *info)
   return 0;
 }
 
+int LoadExr(const std::string &filename, FrameBuffer *fb, BufferInfo *info)
+{
+  if (fb == NULL) {
+    return -1;
+  }
+
+  ExrInput in;
+  if (in.Open(filename)) {
+    return -1;
+  }
+
+  const std::vector<std::string> &channels = in.GetChannelNames();
+  const auto has_channel = [&channels](const char *name) {
+    return std::find(channels.begin(), channels.end(), name) != channels.end();
+  };
+
+  std::vector<std::string> names;
+  if (has_channel("R") && has_channel("G") && has_channel("B")) {
+    names.push_back("R");
+    names.push_back("G");
+    names.push_back("B");
+    if (has_channel("A")) {
+      names.push_back("A");
+    }
+  }
+  else if (has_channel("Y")) {
+    names.push_back("Y");
+  }
+  else {
+    names.push_back(channels[0]);
+  }
+
+  if (in.ReadPixels(names, *fb)) {
+    return -1;
+  }
+
+  info->viewbox.min[0] = 0;
+  info->viewbox.min[1] = 0;
+  info->viewbox.max[0] = fb->GetWidth();
+  info->viewbox.max[1] = fb->GetHeight();
+  info->tilesize = 0;
+
+  return 0;
+}
+
 } // namespace xxx
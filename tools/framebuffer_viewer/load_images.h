@@ -25,6 +25,8 @@ extern std::string GetFileExtension(const std::string &filename);
 
 extern int LoadFb(const std::string &filename, FrameBuffer *fb, BufferInfo *info);
 extern int LoadMip(const std::string &filename, FrameBuffer *fb, BufferInfo *info);
+// reads R, G, B and A if the file has R, G and B. otherwise Y or the first channel
+extern int LoadExr(const std::string &filename, FrameBuffer *fb, BufferInfo *info);
 
 } // namespace xxx
 
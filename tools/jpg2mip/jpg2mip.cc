@@ -2,8 +2,10 @@
 // See LICENSE and README
 
 #include "fj_framebuffer.h"
+#include "fj_multi_thread.h"
 #include "fj_mipmap.h"
 #include "fj_box.h"
+#include "fj_os.h"
 
 #include <jpeglib.h>
 #include <setjmp.h>
@@ -13,14 +15,26 @@
 #include <string.h>
 #include <errno.h>
 
+#include <string>
+#include <vector>
+
 using namespace fj;
 
 static const char USAGE[] =
 "Usage: jpg2mip [options] inputfile(*.jpeg, *.jpg) outputfile(*.mip)\n"
+"       jpg2mip [options] --batch inputdir outputdir\n"
 "Options:\n"
 "  --help         Display this information\n"
+"  --format <fmt> Texel format: float, half or uint8 (default uint8)\n"
+"  --bump         Bake derivatives of the luminance for bump mapping.\n"
+"                 uint8 is written as half\n"
+"  --batch        Convert all *.jpeg and *.jpg in inputdir into outputdir.\n"
+"                 files not changed since the last conversion are skipped\n"
 "\n";
 
+// in the output directory of batch mode
+static const char CACHE_FILENAME[] = ".mipcache";
+
 struct my_error_mgr {
   struct jpeg_error_mgr pub;	/* "public" fields */
 
@@ -44,8 +58,78 @@ my_error_exit (j_common_ptr cinfo)
 }
 
 static void copy_scanline(JSAMPROW j_scanline, float *fb_scanline, int width, int nchans);
+static int convert(const char *inputfile, const char *outputfile, int format, bool bump);
+static int convert_directory(const char *inputdir, const char *outputdir, int format, bool bump);
+
+// returns -1 if the name is unknown
+static int parse_tile_format(const char *name)
+{
+  if (strcmp(name, "float") == 0) {
+    return MIP_TILE_FLOAT;
+  }
+  else if (strcmp(name, "half") == 0) {
+    return MIP_TILE_HALF;
+  }
+  else if (strcmp(name, "uint8") == 0) {
+    return MIP_TILE_UINT8;
+  }
+  return -1;
+}
 
 int main(int argc, const char **argv)
+{
+  if (argc == 2 && strcmp(argv[1], "--help") == 0) {
+    printf("%s", USAGE);
+    return 0;
+  }
+
+  int format = MIP_TILE_UINT8;
+  bool is_batch = false;
+  bool bump = false;
+  while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--format") == 0 && argc > 2) {
+      format = parse_tile_format(argv[2]);
+      if (format == -1) {
+        fprintf(stderr, "error: unknown format: %s\n", argv[2]);
+        return -1;
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "--bump") == 0) {
+      bump = true;
+      argc -= 1;
+      argv += 1;
+    }
+    else if (strcmp(argv[1], "--batch") == 0) {
+      is_batch = true;
+      argc -= 1;
+      argv += 1;
+    }
+    else {
+      fprintf(stderr, "error: unknown option: %s\n", argv[1]);
+      return -1;
+    }
+  }
+
+  if (argc != 3) {
+    fprintf(stderr, "error: invalid number of arguments.\n");
+    fprintf(stderr, "%s", USAGE);
+    return -1;
+  }
+
+  // resampling and tiles run on all cores
+  MtStartThreadPool(MtGetMaxAvailableThreadCount());
+
+  const int err = is_batch ?
+      convert_directory(argv[1], argv[2], format, bump) :
+      convert(argv[1], argv[2], format, bump);
+
+  MtStopThreadPool();
+  return err;
+}
+
+static int convert(const char *inputfile, const char *outputfile, int format, bool bump)
 {
   int width = 0;
   int height = 0;
@@ -61,20 +145,9 @@ int main(int argc, const char **argv)
   JSAMPARRAY buffer;
   int row_stride;
 
-  if (argc == 2 && strcmp(argv[1], "--help") == 0) {
-    printf("%s", USAGE);
-    return 0;
-  }
-
-  if (argc != 3) {
-    fprintf(stderr, "error: invalid number of arguments.\n");
-    fprintf(stderr, "%s", USAGE);
-    return -1;
-  }
-
   errno = 0;
-  if ((jpg_file = fopen(argv[1], "rb")) == NULL) {
-    fprintf(stderr, "error: %s: %s\n", argv[1], strerror(errno));
+  if ((jpg_file = fopen(inputfile, "rb")) == NULL) {
+    fprintf(stderr, "error: %s: %s\n", inputfile, strerror(errno));
     return -1;
   }
 
@@ -123,16 +196,18 @@ int main(int argc, const char **argv)
   jpeg_destroy_decompress(&cinfo);
   fclose(jpg_file);
 
-  mip.Open(argv[2]);
+  mip.Open(outputfile);
   if (!mip.IsOpen()) {
     fprintf(stderr, "error: couldn't open output file\n");
     return -1;
   }
 
+  mip.SetBumpDerivatives(bump);
   mip.GenerateFromSourceData(fb.GetReadOnly(0, 0, 0), width, height, nchans);
   printf("input res: %d, %d\n", width, height);
   printf("output res: %d, %d\n", mip.GetWidth(), mip.GetHeight());
 
+  mip.SetTileFormat(format);
   mip.WriteFile();
 
   return 0;
@@ -143,6 +218,58 @@ cleanup_jpeg:
   return -1;
 }
 
+static int convert_directory(const char *inputdir, const char *outputdir, int format, bool bump)
+{
+  std::vector<std::string> filenames;
+  if (OsListFiles(inputdir, &filenames)) {
+    fprintf(stderr, "error: %s: could not read directory\n", inputdir);
+    return -1;
+  }
+
+  const std::string cache_file = std::string(outputdir) + "/" + CACHE_FILENAME;
+  MipConvertCache cache;
+  cache.Read(cache_file);
+  int err = 0;
+
+  for (std::size_t i = 0; i < filenames.size(); i++) {
+    const std::string &name = filenames[i];
+    const std::string::size_type dotpos = name.rfind('.');
+    if (dotpos == std::string::npos ||
+        (name.compare(dotpos, std::string::npos, ".jpeg") != 0 &&
+         name.compare(dotpos, std::string::npos, ".jpg") != 0)) {
+      continue;
+    }
+
+    const std::string inputfile = std::string(inputdir) + "/" + name;
+    const std::string outputfile = std::string(outputdir) + "/" + name.substr(0, dotpos) + ".mip";
+    // baked derivatives count as another format
+    const uint64_t key = MipComputeSourceKey(inputfile, bump ? -1 - format : format);
+
+    FILE *output = fopen(outputfile.c_str(), "rb");
+    const bool has_output = output != NULL;
+    if (output != NULL) {
+      fclose(output);
+    }
+    if (has_output && cache.IsConverted(name, key)) {
+      printf("up to date: %s\n", outputfile.c_str());
+      continue;
+    }
+
+    printf("converting: %s\n", inputfile.c_str());
+    if (convert(inputfile.c_str(), outputfile.c_str(), format, bump)) {
+      err = -1;
+      continue;
+    }
+    cache.SetConverted(name, key);
+  }
+
+  if (cache.Write(cache_file)) {
+    fprintf(stderr, "error: %s: could not write cache\n", cache_file.c_str());
+    err = -1;
+  }
+  return err;
+}
+
 static void copy_scanline(JSAMPROW j_scanline, float *fb_scanline, int width, int nchans)
 {
   const int N = width * nchans;
@@ -169,6 +169,14 @@ class SceneInterface:
 		cmd = 'RenderScene %s' % (renderer)
 		self.commands.append(cmd)
 
+	def StartInteractive(self, renderer):
+		cmd = 'StartInteractive %s' % (renderer)
+		self.commands.append(cmd)
+
+	def StopInteractive(self):
+		cmd = 'StopInteractive'
+		self.commands.append(cmd)
+
 	def SaveFrameBuffer(self, framebuffer, filename):
 		filepath, ext = os.path.splitext(filename)
 
@@ -183,10 +191,30 @@ class SceneInterface:
 		cmd = 'SaveFrameBuffer %s %s' % (framebuffer, temp_filename)
 		self.commands.append(cmd)
 
+	def AddFrameProcedure(self, procedure, name, filename):
+		cmd = 'AddFrameProcedure %s %s %s' % (procedure, name, filename)
+		self.commands.append(cmd)
+
+	def RenderFrames(self, renderer, first_frame, last_frame, framebuffer, filename):
+		cmd = 'RenderFrames %s %s %s %s %s' % (renderer, first_frame, last_frame, framebuffer, filename)
+		self.commands.append(cmd)
+
 	def RunProcedure(self, procedure):
 		cmd = 'RunProcedure %s' % (procedure)
 		self.commands.append(cmd)
 
+	def RunProcedureAsync(self, procedure):
+		cmd = 'RunProcedureAsync %s' % (procedure)
+		self.commands.append(cmd)
+
+	def WaitProcedures(self):
+		cmd = 'WaitProcedures'
+		self.commands.append(cmd)
+
+	def DeferProcedure(self, procedure, primset, xmin, ymin, zmin, xmax, ymax, zmax):
+		cmd = 'DeferProcedure %s %s %s %s %s %s %s %s' % (procedure, primset, xmin, ymin, zmin, xmax, ymax, zmax)
+		self.commands.append(cmd)
+
 	def AddObjectToGroup(self, group, object):
 		cmd = 'AddObjectToGroup %s %s' % (group, object)
 		self.commands.append(cmd)
@@ -195,6 +223,10 @@ class SceneInterface:
 		cmd = 'NewObjectInstance %s %s' % (name, accelerator)
 		self.commands.append(cmd)
 
+	def CopyObjectInstance(self, name, object):
+		cmd = 'CopyObjectInstance %s %s' % (name, object)
+		self.commands.append(cmd)
+
 	def NewFrameBuffer(self, name, arg):
 		cmd = 'NewFrameBuffer %s %s' % (name, arg)
 		self.commands.append(cmd)
@@ -271,6 +303,10 @@ class SceneInterface:
 		cmd = 'AssignCamera %s %s' % (renderer, camera)
 		self.commands.append(cmd)
 
+	def AddView(self, renderer, camera, framebuffer):
+		cmd = 'AddView %s %s %s' % (renderer, camera, framebuffer)
+		self.commands.append(cmd)
+
 	def AssignObjectGroup(self, entry_name, prop_name, object_group):
 		cmd = 'AssignObjectGroup %s %s %s' % (entry_name, prop_name, object_group)
 		self.commands.append(cmd)
@@ -0,0 +1,640 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+// Python module calling the scene interface in the same process. commands
+// are the ones of the scene parser and return ids of new entries. data of
+// primitives are copied from buffers such as numpy arrays without text, and
+// framebuffers are returned as memoryviews over the pixels
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "fj_scene_interface.h"
+#include <cstring>
+#include <string>
+
+using namespace fj;
+
+static void set_command_error(const char *command)
+{
+  const int err = SiGetErrorNo();
+  if (err == SI_ERR_NONE) {
+    PyErr_Format(PyExc_RuntimeError, "%s failed", command);
+  } else {
+    PyErr_Format(PyExc_RuntimeError, "%s failed: error %d", command, err);
+  }
+}
+
+static PyObject *status_result(Status status, const char *command)
+{
+  if (status == SI_FAIL) {
+    set_command_error(command);
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *id_result(ID id, const char *command)
+{
+  if (id == SI_BADID) {
+    set_command_error(command);
+    return NULL;
+  }
+  return PyLong_FromLong(id);
+}
+
+// the buffer format without the byte order character
+static char buffer_format(const Py_buffer &view)
+{
+  const char *format = view.format != NULL ? view.format : "B";
+  if (strchr("@=<>!", format[0]) != NULL) {
+    format++;
+  }
+  return strlen(format) == 1 ? format[0] : '\0';
+}
+
+// the array type of a buffer of float32, float64, int32 or int64 or -1
+static int buffer_array_type(const Py_buffer &view)
+{
+  const char format = buffer_format(view);
+  if (format == '\0') {
+    return -1;
+  }
+  if (format == 'f' && view.itemsize == 4) {
+    return SI_ARRAY_FLOAT32;
+  }
+  if (format == 'd' && view.itemsize == 8) {
+    return SI_ARRAY_FLOAT64;
+  }
+  if (strchr("iIlLqQ", format) != NULL && view.itemsize == 4) {
+    return SI_ARRAY_INT32;
+  }
+  if (strchr("iIlLqQ", format) != NULL && view.itemsize == 8) {
+    return SI_ARRAY_INT64;
+  }
+  return -1;
+}
+
+/* Scene */
+static PyObject *py_OpenScene(PyObject *self, PyObject *args)
+{
+  return status_result(SiOpenScene(), "OpenScene");
+}
+
+static PyObject *py_CloseScene(PyObject *self, PyObject *args)
+{
+  return status_result(SiCloseScene(), "CloseScene");
+}
+
+static PyObject *py_OpenPlugin(PyObject *self, PyObject *args)
+{
+  const char *filename = NULL;
+  if (!PyArg_ParseTuple(args, "s", &filename)) {
+    return NULL;
+  }
+  return id_result(SiOpenPlugin(filename), "OpenPlugin");
+}
+
+static PyObject *py_RenderScene(PyObject *self, PyObject *args)
+{
+  long renderer = 0;
+  if (!PyArg_ParseTuple(args, "l", &renderer)) {
+    return NULL;
+  }
+  Status status;
+  Py_BEGIN_ALLOW_THREADS
+  status = SiRenderScene(renderer);
+  Py_END_ALLOW_THREADS
+  return status_result(status, "RenderScene");
+}
+
+static PyObject *py_SaveFrameBuffer(PyObject *self, PyObject *args)
+{
+  long framebuffer = 0;
+  const char *filename = NULL;
+  if (!PyArg_ParseTuple(args, "ls", &framebuffer, &filename)) {
+    return NULL;
+  }
+  return status_result(SiSaveFrameBuffer(framebuffer, filename), "SaveFrameBuffer");
+}
+
+static PyObject *py_RunProcedure(PyObject *self, PyObject *args)
+{
+  long procedure = 0;
+  if (!PyArg_ParseTuple(args, "l", &procedure)) {
+    return NULL;
+  }
+  Status status;
+  Py_BEGIN_ALLOW_THREADS
+  status = SiRunProcedure(procedure);
+  Py_END_ALLOW_THREADS
+  return status_result(status, "RunProcedure");
+}
+
+static PyObject *py_RunProcedureAsync(PyObject *self, PyObject *args)
+{
+  long procedure = 0;
+  if (!PyArg_ParseTuple(args, "l", &procedure)) {
+    return NULL;
+  }
+  return status_result(SiRunProcedureAsync(procedure), "RunProcedureAsync");
+}
+
+static PyObject *py_WaitProcedures(PyObject *self, PyObject *args)
+{
+  Status status;
+  Py_BEGIN_ALLOW_THREADS
+  status = SiWaitProcedures();
+  Py_END_ALLOW_THREADS
+  return status_result(status, "WaitProcedures");
+}
+
+static PyObject *py_DeferProcedure(PyObject *self, PyObject *args)
+{
+  long procedure = 0, primset = 0;
+  double xmin, ymin, zmin, xmax, ymax, zmax;
+  if (!PyArg_ParseTuple(args, "lldddddd", &procedure, &primset,
+        &xmin, &ymin, &zmin, &xmax, &ymax, &zmax)) {
+    return NULL;
+  }
+  return status_result(SiDeferProcedure(procedure, primset,
+        xmin, ymin, zmin, xmax, ymax, zmax), "DeferProcedure");
+}
+
+static PyObject *py_AddObjectToGroup(PyObject *self, PyObject *args)
+{
+  long group = 0, object = 0;
+  if (!PyArg_ParseTuple(args, "ll", &group, &object)) {
+    return NULL;
+  }
+  return status_result(SiAddObjectToGroup(group, object), "AddObjectToGroup");
+}
+
+/* Interactive and animation */
+static PyObject *py_StartInteractive(PyObject *self, PyObject *args)
+{
+  long renderer = 0;
+  if (!PyArg_ParseTuple(args, "l", &renderer)) {
+    return NULL;
+  }
+  return status_result(SiStartInteractive(renderer), "StartInteractive");
+}
+
+static PyObject *py_UpdateInteractive(PyObject *self, PyObject *args)
+{
+  return status_result(SiUpdateInteractive(), "UpdateInteractive");
+}
+
+static PyObject *py_StopInteractive(PyObject *self, PyObject *args)
+{
+  Status status;
+  Py_BEGIN_ALLOW_THREADS
+  status = SiStopInteractive();
+  Py_END_ALLOW_THREADS
+  return status_result(status, "StopInteractive");
+}
+
+static PyObject *py_AddFrameProcedure(PyObject *self, PyObject *args)
+{
+  long procedure = 0;
+  const char *name = NULL, *filename = NULL;
+  if (!PyArg_ParseTuple(args, "lss", &procedure, &name, &filename)) {
+    return NULL;
+  }
+  return status_result(SiAddFrameProcedure(procedure, name, filename), "AddFrameProcedure");
+}
+
+static PyObject *py_RenderFrames(PyObject *self, PyObject *args)
+{
+  long renderer = 0, framebuffer = 0;
+  int first_frame = 0, last_frame = 0;
+  const char *filename = NULL;
+  if (!PyArg_ParseTuple(args, "liils", &renderer, &first_frame, &last_frame,
+        &framebuffer, &filename)) {
+    return NULL;
+  }
+  Status status;
+  Py_BEGIN_ALLOW_THREADS
+  status = SiRenderFrames(renderer, first_frame, last_frame, framebuffer, filename);
+  Py_END_ALLOW_THREADS
+  return status_result(status, "RenderFrames");
+}
+
+/* New entries */
+#define DEFINE_NEW(Name) \
+static PyObject *py_##Name(PyObject *self, PyObject *args) \
+{ \
+  return id_result(Si##Name(), #Name); \
+}
+#define DEFINE_NEW_WITH_ID(Name) \
+static PyObject *py_##Name(PyObject *self, PyObject *args) \
+{ \
+  long id = 0; \
+  if (!PyArg_ParseTuple(args, "l", &id)) { \
+    return NULL; \
+  } \
+  return id_result(Si##Name(id), #Name); \
+}
+#define DEFINE_NEW_WITH_STRING(Name) \
+static PyObject *py_##Name(PyObject *self, PyObject *args) \
+{ \
+  const char *arg = NULL; \
+  if (!PyArg_ParseTuple(args, "s", &arg)) { \
+    return NULL; \
+  } \
+  return id_result(Si##Name(arg), #Name); \
+}
+DEFINE_NEW_WITH_ID(NewObjectInstance)
+DEFINE_NEW_WITH_ID(CopyObjectInstance)
+DEFINE_NEW_WITH_STRING(NewFrameBuffer)
+DEFINE_NEW(NewObjectGroup)
+DEFINE_NEW(NewPointCloud)
+DEFINE_NEW(NewTurbulence)
+DEFINE_NEW_WITH_ID(NewProcedure)
+DEFINE_NEW(NewRenderer)
+DEFINE_NEW_WITH_STRING(NewTexture)
+DEFINE_NEW_WITH_STRING(NewCamera)
+DEFINE_NEW_WITH_ID(NewShader)
+DEFINE_NEW(NewVolume)
+DEFINE_NEW(NewCurve)
+DEFINE_NEW(NewMesh)
+#undef DEFINE_NEW
+#undef DEFINE_NEW_WITH_ID
+#undef DEFINE_NEW_WITH_STRING
+
+// takes the light type names of the scene parser
+static PyObject *py_NewLight(PyObject *self, PyObject *args)
+{
+  const char *type_name = NULL;
+  if (!PyArg_ParseTuple(args, "s", &type_name)) {
+    return NULL;
+  }
+
+  const std::string type(type_name);
+  int light_type = SI_POINT_LIGHT;
+  if (type == "PointLight") {
+    light_type = SI_POINT_LIGHT;
+  } else if (type == "GridLight") {
+    light_type = SI_GRID_LIGHT;
+  } else if (type == "SphereLight") {
+    light_type = SI_SPHERE_LIGHT;
+  } else if (type == "DomeLight") {
+    light_type = SI_DOME_LIGHT;
+  } else {
+    PyErr_Format(PyExc_ValueError, "unknown light type: %s", type_name);
+    return NULL;
+  }
+  return id_result(SiNewLight(light_type), "NewLight");
+}
+
+/* Assignments */
+static PyObject *py_AssignFrameBuffer(PyObject *self, PyObject *args)
+{
+  long renderer = 0, framebuffer = 0;
+  if (!PyArg_ParseTuple(args, "ll", &renderer, &framebuffer)) {
+    return NULL;
+  }
+  return status_result(SiAssignFrameBuffer(renderer, framebuffer), "AssignFrameBuffer");
+}
+
+static PyObject *py_AssignCamera(PyObject *self, PyObject *args)
+{
+  long renderer = 0, camera = 0;
+  if (!PyArg_ParseTuple(args, "ll", &renderer, &camera)) {
+    return NULL;
+  }
+  return status_result(SiAssignCamera(renderer, camera), "AssignCamera");
+}
+
+static PyObject *py_AddView(PyObject *self, PyObject *args)
+{
+  long renderer = 0, camera = 0, framebuffer = 0;
+  if (!PyArg_ParseTuple(args, "lll", &renderer, &camera, &framebuffer)) {
+    return NULL;
+  }
+  return status_result(SiAddView(renderer, camera, framebuffer), "AddView");
+}
+
+#define DEFINE_ASSIGN(Name) \
+static PyObject *py_##Name(PyObject *self, PyObject *args) \
+{ \
+  long id = 0, entry = 0; \
+  const char *name = NULL; \
+  if (!PyArg_ParseTuple(args, "lsl", &id, &name, &entry)) { \
+    return NULL; \
+  } \
+  return status_result(Si##Name(id, name, entry), #Name); \
+}
+DEFINE_ASSIGN(AssignShader)
+DEFINE_ASSIGN(AssignObjectGroup)
+DEFINE_ASSIGN(AssignPointCloud)
+DEFINE_ASSIGN(AssignTurbulence)
+DEFINE_ASSIGN(AssignTexture)
+DEFINE_ASSIGN(AssignVolume)
+DEFINE_ASSIGN(AssignCurve)
+DEFINE_ASSIGN(AssignMesh)
+#undef DEFINE_ASSIGN
+
+/* Properties */
+static PyObject *py_SetProperty1(PyObject *self, PyObject *args)
+{
+  long id = 0;
+  const char *name = NULL;
+  double v0;
+  if (!PyArg_ParseTuple(args, "lsd", &id, &name, &v0)) {
+    return NULL;
+  }
+  return status_result(SiSetProperty1(id, name, v0), "SetProperty1");
+}
+
+static PyObject *py_SetProperty2(PyObject *self, PyObject *args)
+{
+  long id = 0;
+  const char *name = NULL;
+  double v0, v1;
+  if (!PyArg_ParseTuple(args, "lsdd", &id, &name, &v0, &v1)) {
+    return NULL;
+  }
+  return status_result(SiSetProperty2(id, name, v0, v1), "SetProperty2");
+}
+
+static PyObject *py_SetProperty3(PyObject *self, PyObject *args)
+{
+  long id = 0;
+  const char *name = NULL;
+  double v0, v1, v2;
+  if (!PyArg_ParseTuple(args, "lsddd", &id, &name, &v0, &v1, &v2)) {
+    return NULL;
+  }
+  return status_result(SiSetProperty3(id, name, v0, v1, v2), "SetProperty3");
+}
+
+static PyObject *py_SetProperty4(PyObject *self, PyObject *args)
+{
+  long id = 0;
+  const char *name = NULL;
+  double v0, v1, v2, v3;
+  if (!PyArg_ParseTuple(args, "lsdddd", &id, &name, &v0, &v1, &v2, &v3)) {
+    return NULL;
+  }
+  return status_result(SiSetProperty4(id, name, v0, v1, v2, v3), "SetProperty4");
+}
+
+static PyObject *py_SetStringProperty(PyObject *self, PyObject *args)
+{
+  long id = 0;
+  const char *name = NULL, *string = NULL;
+  if (!PyArg_ParseTuple(args, "lss", &id, &name, &string)) {
+    return NULL;
+  }
+  return status_result(SiSetStringProperty(id, name, string), "SetStringProperty");
+}
+
+static PyObject *py_SetSampleProperty3(PyObject *self, PyObject *args)
+{
+  long id = 0;
+  const char *name = NULL;
+  double v0, v1, v2, time;
+  if (!PyArg_ParseTuple(args, "lsdddd", &id, &name, &v0, &v1, &v2, &time)) {
+    return NULL;
+  }
+  return status_result(SiSetSampleProperty3(id, name, v0, v1, v2, time),
+      "SetSampleProperty3");
+}
+
+/* Primitive data */
+static PyObject *py_SetPrimitiveAttribute(PyObject *self, PyObject *args)
+{
+  long primset = 0;
+  const char *name = NULL;
+  PyObject *obj = NULL;
+  if (!PyArg_ParseTuple(args, "lsO", &primset, &name, &obj)) {
+    return NULL;
+  }
+
+  Py_buffer view;
+  if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == -1) {
+    return NULL;
+  }
+
+  // buffers are passed as they are and copied once by the renderer
+  const int array_type = buffer_array_type(view);
+  if (array_type == -1) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_TypeError,
+        "buffer of float32, float64, int32 or int64 is required");
+    return NULL;
+  }
+
+  const Status status = SiSetPrimitiveAttribute(primset, name,
+      array_type, view.buf, view.len / view.itemsize);
+  PyBuffer_Release(&view);
+
+  return status_result(status, "SetPrimitiveAttribute");
+}
+
+static PyObject *py_SetObjectInstanceTransforms(PyObject *self, PyObject *args)
+{
+  PyObject *objects_obj = NULL;
+  const char *name = NULL;
+  PyObject *values_obj = NULL;
+  double time = 0;
+  if (!PyArg_ParseTuple(args, "OsO|d", &objects_obj, &name, &values_obj, &time)) {
+    return NULL;
+  }
+
+  Py_buffer objects;
+  if (PyObject_GetBuffer(objects_obj, &objects, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == -1) {
+    return NULL;
+  }
+  Py_buffer values;
+  if (PyObject_GetBuffer(values_obj, &values, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == -1) {
+    PyBuffer_Release(&objects);
+    return NULL;
+  }
+
+  const int objects_type = buffer_array_type(objects);
+  const int values_type = buffer_array_type(values);
+  const bool is_id = sizeof(ID) == 8 ?
+      objects_type == SI_ARRAY_INT64 : objects_type == SI_ARRAY_INT32;
+  const Py_ssize_t object_count = objects.len / objects.itemsize;
+  PyObject *result = NULL;
+
+  if (!is_id || values_type != SI_ARRAY_FLOAT64) {
+    PyErr_SetString(PyExc_TypeError,
+        "buffers of object ids and float64 are required");
+  } else if (values.len / values.itemsize != 3 * object_count) {
+    PyErr_SetString(PyExc_ValueError,
+        "three values for each object are required");
+  } else {
+    result = status_result(SiSetObjectInstanceTransforms(
+          static_cast<const ID *>(objects.buf), object_count, name,
+          static_cast<const double *>(values.buf), time),
+        "SetObjectInstanceTransforms");
+  }
+
+  PyBuffer_Release(&values);
+  PyBuffer_Release(&objects);
+  return result;
+}
+
+// count instances of primset with an optional float64 buffer of nine
+// transform values for each. returns the id of the first one
+static PyObject *py_NewObjectInstances(PyObject *self, PyObject *args)
+{
+  long primset = 0;
+  long long count = 0;
+  PyObject *transforms_obj = Py_None;
+  if (!PyArg_ParseTuple(args, "lL|O", &primset, &count, &transforms_obj)) {
+    return NULL;
+  }
+
+  if (transforms_obj == Py_None) {
+    return id_result(SiNewObjectInstances(primset, count, NULL), "NewObjectInstances");
+  }
+
+  Py_buffer transforms;
+  if (PyObject_GetBuffer(transforms_obj, &transforms, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == -1) {
+    return NULL;
+  }
+
+  PyObject *result = NULL;
+  if (buffer_array_type(transforms) != SI_ARRAY_FLOAT64) {
+    PyErr_SetString(PyExc_TypeError, "a buffer of float64 is required");
+  } else if (transforms.len / transforms.itemsize != 9 * count) {
+    PyErr_SetString(PyExc_ValueError,
+        "nine values for each object are required");
+  } else {
+    result = id_result(SiNewObjectInstances(primset, count,
+          static_cast<const double *>(transforms.buf)), "NewObjectInstances");
+  }
+
+  PyBuffer_Release(&transforms);
+  return result;
+}
+
+// a float32 memoryview of shape (height, width, channels) over the pixels
+static PyObject *py_GetFrameBuffer(PyObject *self, PyObject *args)
+{
+  long framebuffer = 0;
+  if (!PyArg_ParseTuple(args, "l", &framebuffer)) {
+    return NULL;
+  }
+
+  float *data = NULL;
+  int width = 0, height = 0, channel_count = 0;
+  if (SiGetFrameBufferData(framebuffer, &data, &width, &height, &channel_count) == SI_FAIL) {
+    return status_result(SI_FAIL, "GetFrameBuffer");
+  }
+
+  const Py_ssize_t size = sizeof(float) * width * height * channel_count;
+  if (data == NULL || size == 0) {
+    PyErr_SetString(PyExc_RuntimeError, "GetFrameBuffer failed: empty framebuffer");
+    return NULL;
+  }
+
+  PyObject *bytes = PyMemoryView_FromMemory(reinterpret_cast<char *>(data), size, PyBUF_WRITE);
+  if (bytes == NULL) {
+    return NULL;
+  }
+  PyObject *view = PyObject_CallMethod(bytes, "cast", "s(iii)",
+      "f", height, width, channel_count);
+  Py_DECREF(bytes);
+  return view;
+}
+
+/* Memory */
+static PyObject *py_GetMemoryUsage(PyObject *self, PyObject *args)
+{
+  long id = 0;
+  if (!PyArg_ParseTuple(args, "l", &id)) {
+    return NULL;
+  }
+
+  int64_t bytes = 0;
+  if (SiGetMemoryUsage(id, &bytes) == SI_FAIL) {
+    return status_result(SI_FAIL, "GetMemoryUsage");
+  }
+  return PyLong_FromLongLong(bytes);
+}
+
+static PyObject *py_GetSceneMemoryUsage(PyObject *self, PyObject *args)
+{
+  int64_t bytes = 0;
+  if (SiGetSceneMemoryUsage(&bytes) == SI_FAIL) {
+    return status_result(SI_FAIL, "GetSceneMemoryUsage");
+  }
+  return PyLong_FromLongLong(bytes);
+}
+
+#define METHOD(Name) {#Name, py_##Name, METH_VARARGS, NULL}
+static PyMethodDef fujiyama_native_methods[] = {
+  METHOD(OpenScene),
+  METHOD(CloseScene),
+  METHOD(OpenPlugin),
+  METHOD(RenderScene),
+  METHOD(SaveFrameBuffer),
+  METHOD(RunProcedure),
+  METHOD(RunProcedureAsync),
+  METHOD(WaitProcedures),
+  METHOD(DeferProcedure),
+  METHOD(AddObjectToGroup),
+  METHOD(StartInteractive),
+  METHOD(UpdateInteractive),
+  METHOD(StopInteractive),
+  METHOD(AddFrameProcedure),
+  METHOD(RenderFrames),
+  METHOD(NewObjectInstance),
+  METHOD(NewObjectInstances),
+  METHOD(CopyObjectInstance),
+  METHOD(NewFrameBuffer),
+  METHOD(NewObjectGroup),
+  METHOD(NewPointCloud),
+  METHOD(NewTurbulence),
+  METHOD(NewProcedure),
+  METHOD(NewRenderer),
+  METHOD(NewTexture),
+  METHOD(NewCamera),
+  METHOD(NewShader),
+  METHOD(NewVolume),
+  METHOD(NewCurve),
+  METHOD(NewLight),
+  METHOD(NewMesh),
+  METHOD(AssignFrameBuffer),
+  METHOD(AssignCamera),
+  METHOD(AddView),
+  METHOD(AssignShader),
+  METHOD(AssignObjectGroup),
+  METHOD(AssignPointCloud),
+  METHOD(AssignTurbulence),
+  METHOD(AssignTexture),
+  METHOD(AssignVolume),
+  METHOD(AssignCurve),
+  METHOD(AssignMesh),
+  METHOD(SetProperty1),
+  METHOD(SetProperty2),
+  METHOD(SetProperty3),
+  METHOD(SetProperty4),
+  METHOD(SetStringProperty),
+  METHOD(SetSampleProperty3),
+  METHOD(SetPrimitiveAttribute),
+  METHOD(SetObjectInstanceTransforms),
+  METHOD(GetFrameBuffer),
+  METHOD(GetMemoryUsage),
+  METHOD(GetSceneMemoryUsage),
+  {NULL, NULL, 0, NULL}
+};
+#undef METHOD
+
+static struct PyModuleDef fujiyama_native_module = {
+  PyModuleDef_HEAD_INIT,
+  "fujiyama_native",
+  "scene interface of Fujiyama Renderer in the same process",
+  -1,
+  fujiyama_native_methods
+};
+
+PyMODINIT_FUNC PyInit_fujiyama_native(void)
+{
+  return PyModule_Create(&fujiyama_native_module);
+}
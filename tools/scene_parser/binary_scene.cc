@@ -0,0 +1,246 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "binary_scene.h"
+
+#include <cstring>
+#include <cstdint>
+
+const char BINARY_SCENE_MAGIC[8] = {'\x7f', 'F', 'J', 'S', 'C', 'E', 'N', 'E'};
+
+enum {
+  TAG_NUMBER = 'n',
+  TAG_ENTRY  = 'e',
+  TAG_STRING = 's'
+};
+
+static int tag_of(int arg_type);
+
+BinarySceneWriter::BinarySceneWriter() : strm_(NULL), record_()
+{
+}
+
+BinarySceneWriter::~BinarySceneWriter()
+{
+}
+
+int BinarySceneWriter::Open(std::ostream &strm)
+{
+  strm_ = &strm;
+
+  const uint32_t version = BINARY_SCENE_VERSION;
+  const uint32_t command_count = GetCommandCount();
+  record_.clear();
+  write_bytes(BINARY_SCENE_MAGIC, sizeof(BINARY_SCENE_MAGIC));
+  write_bytes(&version, sizeof(version));
+  write_bytes(&command_count, sizeof(command_count));
+  for (uint32_t i = 0; i < command_count; i++) {
+    write_string(GetCommandByIndex(i)->name);
+  }
+
+  strm_->write(&record_[0], record_.size());
+  return strm_->good() ? 0 : -1;
+}
+
+int BinarySceneWriter::WriteCommand(const Command *command, const CommandArgument *args)
+{
+  const uint16_t command_index = static_cast<uint16_t>(command - GetCommandByIndex(0));
+  const uint8_t arg_count = static_cast<uint8_t>(command->arg_count - 1);
+  uint32_t size = 0;
+
+  record_.clear();
+  write_bytes(&size, sizeof(size));
+  write_bytes(&command_index, sizeof(command_index));
+  write_bytes(&arg_count, sizeof(arg_count));
+
+  for (int i = 1; i < command->arg_count; i++) {
+    const uint8_t tag = tag_of(command->arg_types[i]);
+    write_bytes(&tag, sizeof(tag));
+
+    switch (tag) {
+    case TAG_NUMBER: {
+      const double number = args[i].GetNumber();
+      write_bytes(&number, sizeof(number));
+      }
+      break;
+    case TAG_ENTRY: {
+      const uint32_t entry = static_cast<uint32_t>(args[i].GetID());
+      write_bytes(&entry, sizeof(entry));
+      }
+      break;
+    default:
+      write_string(args[i].GetString());
+      break;
+    }
+  }
+
+  size = static_cast<uint32_t>(record_.size() - sizeof(size));
+  memcpy(&record_[0], &size, sizeof(size));
+
+  strm_->write(&record_[0], record_.size());
+  return strm_->good() ? 0 : -1;
+}
+
+void BinarySceneWriter::write_string(const char *str)
+{
+  const uint32_t length = static_cast<uint32_t>(strlen(str));
+  write_bytes(&length, sizeof(length));
+  write_bytes(str, length + 1);
+}
+
+void BinarySceneWriter::write_bytes(const void *data, int size)
+{
+  const char *bytes = static_cast<const char *>(data);
+  record_.insert(record_.end(), bytes, bytes + size);
+}
+
+BinarySceneReader::BinarySceneReader() : strm_(NULL), commands_(), record_()
+{
+}
+
+BinarySceneReader::~BinarySceneReader()
+{
+}
+
+int BinarySceneReader::Open(std::istream &strm)
+{
+  strm_ = &strm;
+
+  char magic[8] = {0};
+  uint32_t version = 0;
+  uint32_t command_count = 0;
+  strm_->read(magic, sizeof(magic));
+  strm_->read(reinterpret_cast<char *>(&version), sizeof(version));
+  strm_->read(reinterpret_cast<char *>(&command_count), sizeof(command_count));
+  if (!*strm_ ||
+      memcmp(magic, BINARY_SCENE_MAGIC, sizeof(magic)) != 0 ||
+      version != BINARY_SCENE_VERSION) {
+    return -1;
+  }
+
+  // commands are looked up by name so that the table can change
+  commands_.resize(command_count);
+  for (uint32_t i = 0; i < command_count; i++) {
+    uint32_t length = 0;
+    strm_->read(reinterpret_cast<char *>(&length), sizeof(length));
+    if (!*strm_ || length > 1024) {
+      return -1;
+    }
+    record_.resize(length + 1);
+    strm_->read(&record_[0], length + 1);
+    if (!*strm_ || record_[length] != '\0') {
+      return -1;
+    }
+    commands_[i] = SearchCommand(&record_[0]);
+  }
+
+  return 0;
+}
+
+int BinarySceneReader::ReadCommand(const Command **command,
+    CommandArgument *args, int max_args)
+{
+  uint32_t size = 0;
+  strm_->read(reinterpret_cast<char *>(&size), sizeof(size));
+  if (strm_->gcount() == 0 && strm_->eof()) {
+    return 0;
+  }
+  if (!*strm_ || size < 3) {
+    return -1;
+  }
+
+  if (record_.size() < size) {
+    record_.resize(size);
+  }
+  strm_->read(&record_[0], size);
+  if (!*strm_) {
+    return -1;
+  }
+
+  const char *p = &record_[0];
+  const char *end = p + size;
+  uint16_t command_index = 0;
+  uint8_t arg_count = 0;
+  memcpy(&command_index, p, sizeof(command_index));
+  p += sizeof(command_index);
+  memcpy(&arg_count, p, sizeof(arg_count));
+  p += sizeof(arg_count);
+
+  if (command_index >= commands_.size() || commands_[command_index] == NULL) {
+    return -1;
+  }
+  const Command *cmd = commands_[command_index];
+  if (arg_count != cmd->arg_count - 1 || cmd->arg_count > max_args) {
+    return -1;
+  }
+
+  args[0].ReferString(cmd->name);
+
+  for (int i = 1; i < cmd->arg_count; i++) {
+    CommandArgument *arg = &args[i];
+    const int tag = tag_of(cmd->arg_types[i]);
+    if (p == end || *p != tag) {
+      return -1;
+    }
+    p++;
+
+    switch (tag) {
+    case TAG_NUMBER: {
+      double number = 0;
+      if (end - p < static_cast<long>(sizeof(number))) {
+        return -1;
+      }
+      memcpy(&number, p, sizeof(number));
+      p += sizeof(number);
+      arg->SetNumber(number);
+      arg->ReferString(NULL);
+      }
+      break;
+    case TAG_ENTRY: {
+      uint32_t entry = 0;
+      if (end - p < static_cast<long>(sizeof(entry))) {
+        return -1;
+      }
+      memcpy(&entry, p, sizeof(entry));
+      p += sizeof(entry);
+      arg->SetID(entry);
+      arg->ReferString(NULL);
+      }
+      break;
+    default: {
+      uint32_t length = 0;
+      if (end - p < static_cast<long>(sizeof(length))) {
+        return -1;
+      }
+      memcpy(&length, p, sizeof(length));
+      p += sizeof(length);
+      if (static_cast<uint32_t>(end - p) <= length || p[length] != '\0') {
+        return -1;
+      }
+      arg->ReferString(p);
+      p += length + 1;
+      }
+      break;
+    }
+  }
+
+  if (p != end) {
+    return -1;
+  }
+
+  *command = cmd;
+  return 1;
+}
+
+static int tag_of(int arg_type)
+{
+  switch (arg_type) {
+  case ARG_NUMBER:
+  case ARG_LIGHT_TYPE:
+    return TAG_NUMBER;
+  case ARG_ENTRY_ID:
+    return TAG_ENTRY;
+  default:
+    return TAG_STRING;
+  }
+}
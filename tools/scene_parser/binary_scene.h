@@ -0,0 +1,62 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#ifndef BINARY_SCENE_H
+#define BINARY_SCENE_H
+
+#include "command.h"
+#include <iostream>
+#include <vector>
+
+// Binary scenes are a header of command names followed by records of
+// commands whose arguments are already resolved: numbers are doubles and
+// entries are the order they were created in instead of names. Records are
+// length-prefixed and values are in native byte order.
+//
+//   header: magic[8] version:u32 command_count:u32 (length:u32 name\0)...
+//   record: size:u32 command:u16 arg_count:u8 (tag:u8 value)...
+//   value:  'n' f64 | 'e' entry:u32 | 's' length:u32 string\0
+
+enum { BINARY_SCENE_VERSION = 1 };
+
+// the first byte never begins a line of text scenes
+extern const char BINARY_SCENE_MAGIC[8];
+
+class BinarySceneWriter {
+public:
+  BinarySceneWriter();
+  ~BinarySceneWriter();
+
+  // writes the header of all commands
+  int Open(std::ostream &strm);
+
+  // args of ARG_ENTRY_ID have the entry order as their ID
+  int WriteCommand(const Command *command, const CommandArgument *args);
+
+private:
+  void write_string(const char *str);
+  void write_bytes(const void *data, int size);
+
+  std::ostream *strm_;
+  std::vector<char> record_;
+};
+
+class BinarySceneReader {
+public:
+  BinarySceneReader();
+  ~BinarySceneReader();
+
+  int Open(std::istream &strm);
+
+  // reads the next record into args pointing to the record for strings.
+  // args of ARG_ENTRY_ID have the entry order as their ID. returns 1 when
+  // read, 0 at the end and -1 for broken records or unknown commands
+  int ReadCommand(const Command **command, CommandArgument *args, int max_args);
+
+private:
+  std::istream *strm_;
+  std::vector<const Command *> commands_;
+  std::vector<char> record_;
+};
+
+#endif // XXX_H
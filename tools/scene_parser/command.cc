@@ -56,6 +56,27 @@ static CommandResult RenderScene_run(const CommandArgument *args)
   return result;
 }
 
+/* StartInteractive */
+static const int StartInteractive_args[] = {
+  ARG_COMMAND_NAME,
+  ARG_ENTRY_ID};
+static CommandResult StartInteractive_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetStatus(SiStartInteractive(args[1].GetID()));
+  return result;
+}
+
+/* StopInteractive */
+static const int StopInteractive_args[] = {
+  ARG_COMMAND_NAME};
+static CommandResult StopInteractive_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetStatus(SiStopInteractive());
+  return result;
+}
+
 /* RunProcedure */
 static const int RunProcedure_args[] = {
   ARG_COMMAND_NAME,
@@ -67,6 +88,47 @@ static CommandResult RunProcedure_run(const CommandArgument *args)
   return result;
 }
 
+/* RunProcedureAsync */
+static const int RunProcedureAsync_args[] = {
+  ARG_COMMAND_NAME,
+  ARG_ENTRY_ID};
+static CommandResult RunProcedureAsync_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetStatus(SiRunProcedureAsync(args[1].GetID()));
+  return result;
+}
+
+/* WaitProcedures */
+static const int WaitProcedures_args[] = {
+  ARG_COMMAND_NAME};
+static CommandResult WaitProcedures_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetStatus(SiWaitProcedures());
+  return result;
+}
+
+/* DeferProcedure */
+static const int DeferProcedure_args[] = {
+  ARG_COMMAND_NAME,
+  ARG_ENTRY_ID,
+  ARG_ENTRY_ID,
+  ARG_NUMBER,
+  ARG_NUMBER,
+  ARG_NUMBER,
+  ARG_NUMBER,
+  ARG_NUMBER,
+  ARG_NUMBER};
+static CommandResult DeferProcedure_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetStatus(SiDeferProcedure(args[1].GetID(), args[2].GetID(),
+      args[3].GetNumber(), args[4].GetNumber(), args[5].GetNumber(),
+      args[6].GetNumber(), args[7].GetNumber(), args[8].GetNumber()));
+  return result;
+}
+
 /* SaveFrameBuffer */
 static const int SaveFrameBuffer_args[] = {
   ARG_COMMAND_NAME,
@@ -79,6 +141,39 @@ static CommandResult SaveFrameBuffer_run(const CommandArgument *args)
   return result;
 }
 
+/* AddFrameProcedure */
+static const int AddFrameProcedure_args[] = {
+  ARG_COMMAND_NAME,
+  ARG_ENTRY_ID,
+  ARG_PROPERTY_NAME,
+  ARG_FILE_PATH};
+static CommandResult AddFrameProcedure_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetStatus(SiAddFrameProcedure(
+      args[1].GetID(), args[2].GetString(), args[3].GetString()));
+  return result;
+}
+
+/* RenderFrames */
+static const int RenderFrames_args[] = {
+  ARG_COMMAND_NAME,
+  ARG_ENTRY_ID,
+  ARG_NUMBER,
+  ARG_NUMBER,
+  ARG_ENTRY_ID,
+  ARG_FILE_PATH};
+static CommandResult RenderFrames_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetStatus(SiRenderFrames(
+      args[1].GetID(),
+      static_cast<int>(args[2].GetNumber()),
+      static_cast<int>(args[3].GetNumber()),
+      args[4].GetID(), args[5].GetString()));
+  return result;
+}
+
 /* AddObjectToGroup */
 static const int AddObjectToGroup_args[] = {
   ARG_COMMAND_NAME,
@@ -104,6 +199,19 @@ static CommandResult NewObjectInstance_run(const CommandArgument *args)
   return result;
 }
 
+/* CopyObjectInstance */
+static const int CopyObjectInstance_args[] = {
+  ARG_COMMAND_NAME,
+  ARG_NEW_ENTRY_ID,
+  ARG_ENTRY_ID};
+static CommandResult CopyObjectInstance_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetEntryID(SiCopyObjectInstance(args[2].GetID()));
+  result.SetEntryName(args[1].GetString());
+  return result;
+}
+
 /* NewFrameBuffer */
 static const int NewFrameBuffer_args[] = {
   ARG_COMMAND_NAME,
@@ -342,6 +450,19 @@ static CommandResult AssignCamera_run(const CommandArgument *args)
   return result;
 }
 
+/* AddView */
+static const int AddView_args[] = {
+  ARG_COMMAND_NAME,
+  ARG_ENTRY_ID,
+  ARG_ENTRY_ID,
+  ARG_ENTRY_ID};
+static CommandResult AddView_run(const CommandArgument *args)
+{
+  CommandResult result;
+  result.SetStatus(SiAddView(args[1].GetID(), args[2].GetID(), args[3].GetID()));
+  return result;
+}
+
 /* AssignShader */
 static const int AssignShader_args[] = {
   ARG_COMMAND_NAME,
@@ -504,10 +625,18 @@ static const Command command_list[] = {
     sizeof(name##_args)/sizeof(name##_args[0]), name##_run}
   REGISTER_COMMAND(OpenPlugin),
   REGISTER_COMMAND(RenderScene),
+  REGISTER_COMMAND(StartInteractive),
+  REGISTER_COMMAND(StopInteractive),
   REGISTER_COMMAND(RunProcedure),
+  REGISTER_COMMAND(RunProcedureAsync),
+  REGISTER_COMMAND(WaitProcedures),
+  REGISTER_COMMAND(DeferProcedure),
   REGISTER_COMMAND(SaveFrameBuffer),
+  REGISTER_COMMAND(AddFrameProcedure),
+  REGISTER_COMMAND(RenderFrames),
   REGISTER_COMMAND(AddObjectToGroup),
   REGISTER_COMMAND(NewObjectInstance),
+  REGISTER_COMMAND(CopyObjectInstance),
   REGISTER_COMMAND(NewFrameBuffer),
   REGISTER_COMMAND(NewObjectGroup),
   REGISTER_COMMAND(NewPointCloud),
@@ -527,6 +656,7 @@ static const Command command_list[] = {
   REGISTER_COMMAND(AssignTurbulence),
   REGISTER_COMMAND(AssignTexture),
   REGISTER_COMMAND(AssignCamera),
+  REGISTER_COMMAND(AddView),
   REGISTER_COMMAND(AssignShader),
   REGISTER_COMMAND(AssignVolume),
   REGISTER_COMMAND(AssignCurve),
@@ -555,6 +685,16 @@ const Command *SearchCommand(const char *command_name)
   return NULL;
 }
 
+int GetCommandCount()
+{
+  return sizeof(command_list) / sizeof(command_list[0]) - 1;
+}
+
+const Command *GetCommandByIndex(int index)
+{
+  return &command_list[index];
+}
+
 static void scalar_to_transform_order_string(char *dst, const char *prop_name, double value)
 {
   if (strcmp(prop_name, "transform_order") == 0 || strcmp(prop_name, "rotate_order") == 0) {
@@ -646,7 +786,7 @@ static int print_property_list(const char *type_name)
 }
 
 CommandArgument::CommandArgument() :
-  str_("N/A"), num_(0), id_(SI_BADID) //TODO string for invalid argument
+  str_("N/A"), ref_(NULL), has_string_(true), num_(0), id_(SI_BADID) //TODO string for invalid argument
 {
 }
 
@@ -657,11 +797,27 @@ CommandArgument::~CommandArgument()
 void CommandArgument::SetString(const std::string &str)
 {
   str_ = str;
+  ref_ = NULL;
+  has_string_ = true;
 }
 
 const char *CommandArgument::GetString() const
 {
-  return str_.c_str();
+  if (ref_ != NULL) {
+    return ref_;
+  }
+  return has_string_ ? str_.c_str() : "";
+}
+
+void CommandArgument::ReferString(const char *str)
+{
+  ref_ = str;
+  has_string_ = str != NULL;
+}
+
+bool CommandArgument::HasString() const
+{
+  return has_string_;
 }
 
 void CommandArgument::SetNumber(double num)
@@ -713,19 +869,19 @@ ID CommandResult::GetEntryID() const
   return new_id_;
 }
 
-void CommandResult::SetEntryName(const std::string &name)
+void CommandResult::SetEntryName(const char *name)
 {
   entry_name_ = name;
 }
 
 const char *CommandResult::GetEntryName() const
 {
-  return entry_name_.c_str();
+  return entry_name_;
 }
 
 bool CommandResult::HasEntryName() const
 {
-  return !entry_name_.empty();
+  return entry_name_[0] != '\0';
 }
 
 bool CommandResult::IsFail() const
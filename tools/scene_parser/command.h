@@ -32,6 +32,10 @@ public:
   void SetString(const std::string &str);
   const char *GetString() const;
 
+  // refers to str without copying. NULL for arguments without strings
+  void ReferString(const char *str);
+  bool HasString() const;
+
   void SetNumber(double num);
   double GetNumber() const;
 
@@ -40,6 +44,8 @@ public:
 
 private:
   std::string str_;
+  const char *ref_;
+  bool has_string_;
   double num_;
   ID id_;
 };
@@ -56,7 +62,8 @@ public:
   void SetEntryID(ID id);
   ID GetEntryID() const;
 
-  void SetEntryName(const std::string &name);
+  // name is referred to and needs to outlive the result
+  void SetEntryName(const char *name);
   const char *GetEntryName() const;
 
   bool HasEntryName() const;
@@ -65,7 +72,7 @@ public:
 private:
   Status status_;
   ID new_id_;
-  std::string entry_name_;
+  const char *entry_name_;
 };
 
 typedef CommandResult (*CommandFunction)(const CommandArgument *args);
@@ -79,5 +86,7 @@ public:
 };
 
 extern const Command *SearchCommand(const char *command_name);
+extern int GetCommandCount();
+extern const Command *GetCommandByIndex(int index);
 
 #endif // XXX_H
@@ -2,19 +2,29 @@
 // See LICENSE and README
 
 #include "parser.h"
+#include "binary_scene.h"
+#include "fj_scene_interface.h"
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstring>
+
+static int parse_text(std::istream &strm);
+static int parse_binary(std::istream &strm);
+static int compile(const char *input, const char *output);
 
 int main(int argc, const char **argv)
 {
   std::istream *strm = NULL;
   std::ifstream file;
-  std::string line;
+
+  if (argc == 4 && strcmp(argv[1], "-c") == 0) {
+    return compile(argv[2], argv[3]);
+  }
 
   switch (argc) {
   case 2:
-    file.open(argv[1]);
+    file.open(argv[1], std::ios::binary);
     if (!file) {
       std::cerr << "error: Could not open file: " << argv[1] << std::endl;
       return -1;
@@ -26,14 +36,100 @@ int main(int argc, const char **argv)
     break;
   default:
     std::cerr << "usage: scene [path]" << std::endl;
+    std::cerr << "       scene -c <text scene> <binary scene>" << std::endl;
     return 0;
   }
 
+  if (strm->peek() == BINARY_SCENE_MAGIC[0]) {
+    return parse_binary(*strm);
+  } else {
+    return parse_text(*strm);
+  }
+}
+
+static int parse_text(std::istream &strm)
+{
   Parser parser;
+  std::string line;
 
-  while (getline(*strm, line)) {
+  while (getline(strm, line)) {
     const int err = parser.ParseLine(line);
 
+    if (err) {
+      std::cerr << "error: ";
+      std::cerr << parser.GetErrorMessage() << ": ";
+      std::cerr << parser.GetLineNumber() << ": ";
+      std::cerr << line.c_str() << std::endl;
+      // a mistyped edit doesn't end the interactive session
+      if (!fj::SiIsInteractive()) {
+        return -1;
+      }
+    }
+
+    // restarts the render with the edit of the line
+    fj::SiUpdateInteractive();
+  }
+
+  return 0;
+}
+
+static int parse_binary(std::istream &strm)
+{
+  Parser parser;
+  BinarySceneReader reader;
+
+  if (reader.Open(strm)) {
+    std::cerr << "error: Could not read binary scene header" << std::endl;
+    return -1;
+  }
+
+  for (;;) {
+    const int result = parser.ParseBinary(reader);
+
+    if (result == 0) {
+      break;
+    }
+    if (result < 0) {
+      std::cerr << "error: ";
+      std::cerr << parser.GetErrorMessage() << ": ";
+      std::cerr << "command " << parser.GetLineNumber() << std::endl;
+      // records after a broken one can't be found
+      if (!fj::SiIsInteractive() || !strm) {
+        return -1;
+      }
+    }
+
+    fj::SiUpdateInteractive();
+  }
+
+  return 0;
+}
+
+static int compile(const char *input, const char *output)
+{
+  std::ifstream in(input);
+  if (!in) {
+    std::cerr << "error: Could not open file: " << input << std::endl;
+    return -1;
+  }
+  std::ofstream out(output, std::ios::binary);
+  if (!out) {
+    std::cerr << "error: Could not open file: " << output << std::endl;
+    return -1;
+  }
+
+  Parser parser;
+  BinarySceneWriter writer;
+  std::string line;
+
+  if (writer.Open(out)) {
+    std::cerr << "error: Could not write file: " << output << std::endl;
+    return -1;
+  }
+
+  while (getline(in, line)) {
+    const int err = parser.CompileLine(line, writer);
+
     if (err) {
       std::cerr << "error: ";
       std::cerr << parser.GetErrorMessage() << ": ";
@@ -2,17 +2,19 @@
 // See LICENSE and README
 
 #include "parser.h"
+#include "binary_scene.h"
 
-#include <sstream>
 #include <vector>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cctype>
 
 static void print_command(const CommandArgument *args, int nargs);
 static int symbol_to_number(CommandArgument *arg);
 static int scan_number(CommandArgument *arg);
-static int args_from_tokens(const std::vector<std::string> &tokens,
+static int args_from_tokens(const std::vector<std::string> &tokens, int ntokens,
     CommandArgument *args, int max_args);
 static int tokenize(const std::string &str, std::vector<std::string> &tokens);
 
@@ -24,14 +26,20 @@ enum PsrErroNo {
   PSR_ERR_BAD_NUMBER,
   PSR_ERR_BAD_ENUM,
   PSR_ERR_NAME_EXISTS,
-  PSR_ERR_NAME_NOT_FOUND
+  PSR_ERR_NAME_NOT_FOUND,
+  PSR_ERR_BAD_RECORD,
+  PSR_ERR_WRITE_FAIL
 };
 
 Parser::Parser() :
   name_map_(),
   line_no_(0),
   error_message_(NULL),
-  error_no_()
+  error_no_(),
+  tokens_(),
+  entry_ids_(),
+  entry_name_offsets_(),
+  entry_names_()
 {
   SiOpenScene();
   parse_error(PSR_ERR_NONE);
@@ -44,52 +52,105 @@ Parser::~Parser()
 
 int Parser::ParseLine(const std::string &line)
 {
-  std::vector<std::string> tokens;
-  const int ntokens = tokenize(line, tokens);
-
   line_no_++;
 
-  if (ntokens == 0) {
-    // blank line
-    return 0;
+  const Command *command = NULL;
+  if (parse_tokens(line, &command)) {
+    return -1;
   }
-  if (tokens[0][0] == '#') {
-    // comment line
+  if (command == NULL) {
+    // blank or comment line
     return 0;
   }
 
-  CommandArgument arguments[16];
-  args_from_tokens(tokens, arguments, 16);
+  print_command(arguments_, command->arg_count);
 
-  const Command *command = SearchCommand(arguments[0].GetString());
-  if (command == NULL) {
-    parse_error(PSR_ERR_UNKNOWN_COMMAND);
+  const CommandResult result = command->Run(arguments_);
+  if (result.IsFail()) {
+    parse_error(SiGetErrorNo());
     return -1;
   }
-  if (ntokens < command->arg_count) {
-    parse_error(PSR_ERR_FEW_ARGS);
-    return -1;
+
+  if (result.HasEntryName()) {
+    register_name(result.GetEntryName(), result.GetEntryID());
   }
-  if (ntokens > command->arg_count) {
-    parse_error(PSR_ERR_MANY_ARGS);
+
+  return 0;
+}
+
+int Parser::ParseBinary(BinarySceneReader &reader)
+{
+  const Command *command = NULL;
+  const int read = reader.ReadCommand(&command, arguments_, MAX_ARGS);
+  if (read < 0) {
+    line_no_++;
+    parse_error(PSR_ERR_BAD_RECORD);
     return -1;
   }
+  if (read == 0) {
+    return 0;
+  }
 
-  const int err = build_arguments(command, arguments);
-  if (err) {
-    return -1;
+  line_no_++;
+
+  for (int i = 1; i < command->arg_count; i++) {
+    if (command->arg_types[i] != ARG_ENTRY_ID) {
+      continue;
+    }
+    const ID entry = arguments_[i].GetID();
+    if (entry < 0 || entry >= static_cast<ID>(entry_ids_.size()) ||
+        entry_ids_[entry] == SI_BADID) {
+      parse_error(PSR_ERR_NAME_NOT_FOUND);
+      return -1;
+    }
+    arguments_[i].SetID(entry_ids_[entry]);
+    arguments_[i].ReferString(&entry_names_[entry_name_offsets_[entry]]);
   }
 
-  print_command(arguments, command->arg_count);
+  print_command(arguments_, command->arg_count);
+
+  const CommandResult result = command->Run(arguments_);
+
+  // failed entries keep their numbers for the following commands
+  for (int i = 1; i < command->arg_count; i++) {
+    if (command->arg_types[i] != ARG_NEW_ENTRY_ID) {
+      continue;
+    }
+    const char *name = arguments_[i].GetString();
+    entry_ids_.push_back(result.GetEntryID());
+    entry_name_offsets_.push_back(entry_names_.size());
+    entry_names_.insert(entry_names_.end(), name, name + strlen(name) + 1);
+  }
 
-  const CommandResult result = command->Run(arguments);
   if (result.IsFail()) {
     parse_error(SiGetErrorNo());
     return -1;
   }
 
-  if (result.HasEntryName()) {
-    register_name(result.GetEntryName(), result.GetEntryID());
+  return 1;
+}
+
+int Parser::CompileLine(const std::string &line, BinarySceneWriter &writer)
+{
+  line_no_++;
+
+  const Command *command = NULL;
+  if (parse_tokens(line, &command)) {
+    return -1;
+  }
+  if (command == NULL) {
+    return 0;
+  }
+
+  for (int i = 1; i < command->arg_count; i++) {
+    if (command->arg_types[i] == ARG_NEW_ENTRY_ID) {
+      register_name(arguments_[i].GetString(), name_map_.size());
+    }
+  }
+
+  if (writer.WriteCommand(command, arguments_)) {
+    parse_error(PSR_ERR_WRITE_FAIL);
+    return -1;
   }
 
   return 0;
@@ -105,6 +166,47 @@ const char *Parser::GetErrorMessage() const
   return error_message_;
 }
 
+// finds the command of the line and builds its arguments. command is NULL
+// for blank and comment lines
+int Parser::parse_tokens(const std::string &line, const Command **command)
+{
+  const int ntokens = tokenize(line, tokens_);
+  *command = NULL;
+
+  if (ntokens == 0) {
+    // blank line
+    return 0;
+  }
+  if (tokens_[0][0] == '#') {
+    // comment line
+    return 0;
+  }
+
+  args_from_tokens(tokens_, ntokens, arguments_, MAX_ARGS);
+
+  const Command *cmd = SearchCommand(arguments_[0].GetString());
+  if (cmd == NULL) {
+    parse_error(PSR_ERR_UNKNOWN_COMMAND);
+    return -1;
+  }
+  if (ntokens < cmd->arg_count) {
+    parse_error(PSR_ERR_FEW_ARGS);
+    return -1;
+  }
+  if (ntokens > cmd->arg_count) {
+    parse_error(PSR_ERR_MANY_ARGS);
+    return -1;
+  }
+
+  const int err = build_arguments(cmd, arguments_);
+  if (err) {
+    return -1;
+  }
+
+  *command = cmd;
+  return 0;
+}
+
 bool Parser::register_name(const std::string &name, ID id)
 {
   NameMap::const_iterator it = name_map_.find(name);
@@ -217,6 +319,8 @@ void Parser::parse_error(int error_no)
     {PSR_ERR_BAD_ENUM,         "bad enum arguments"},
     {PSR_ERR_NAME_EXISTS,      "entry name already exists"},
     {PSR_ERR_NAME_NOT_FOUND,   "entry name not found"},
+    {PSR_ERR_BAD_RECORD,       "broken binary scene record"},
+    {PSR_ERR_WRITE_FAIL,       "write failed"},
     // from SceneInterface
     {SI_ERR_PLUGIN_NOT_FOUND,           "plugin not found"},
     {SI_ERR_INIT_PLUGIN_FUNC_NOT_EXIST, "initialize plugin function not exit"},
@@ -240,30 +344,38 @@ void Parser::parse_error(int error_no)
     }
   }
 }
+// tokens are assigned to the elements of the last line to reuse their
+// buffers. returns the number of tokens of the line
 static int tokenize(const std::string &str, std::vector<std::string> &tokens)
 {
-  std::istringstream iss(str);
-  std::string s;
-  tokens.clear();
-
-  while (!iss.eof()) {
-    s.clear();
+  const char *p = str.c_str();
+  const char *end = p + str.size();
+  int ntokens = 0;
 
-    iss >> s;
-    if (!iss) {
+  for (;;) {
+    while (p != end && isspace(static_cast<unsigned char>(*p))) {
+      p++;
+    }
+    if (p == end) {
       break;
     }
 
-    tokens.push_back(s);
+    const char *begin = p;
+    while (p != end && !isspace(static_cast<unsigned char>(*p))) {
+      p++;
+    }
+
+    if (ntokens == static_cast<int>(tokens.size())) {
+      tokens.push_back(std::string());
+    }
+    tokens[ntokens++].assign(begin, p);
   }
-  return static_cast<int>(tokens.size());
+  return ntokens;
 }
 
-static int args_from_tokens(const std::vector<std::string> &tokens,
+static int args_from_tokens(const std::vector<std::string> &tokens, int ntokens,
     CommandArgument *args, int max_args)
 {
-  const int ntokens = static_cast<int>(tokens.size());
-
   for (int i = 0; i < ntokens && i < max_args; i++) {
     args[i].SetString(tokens[i]);
   }
@@ -275,7 +387,12 @@ static void print_command(const CommandArgument *args, int nargs)
 {
   printf("-- %s: ", args[0].GetString());
   for (int i = 1; i < nargs; i++) {
-    printf("[%s]", args[i].GetString());
+    // numbers of binary scenes have no strings
+    if (args[i].HasString()) {
+      printf("[%s]", args[i].GetString());
+    } else {
+      printf("[%g]", args[i].GetNumber());
+    }
     if (i == nargs - 1) {
       printf("\n");
     } else {
@@ -286,45 +403,58 @@ static void print_command(const CommandArgument *args, int nargs)
 
 static int scan_number(CommandArgument *arg)
 {
+  const char *str = arg->GetString();
   char *end = NULL;
-  const int is_symbol = symbol_to_number(arg);
 
+  const double n = strtod(str, &end);
+  if (end != str && *end == '\0') {
+    arg->SetNumber(n);
+    return 0;
+  }
+
+  const int is_symbol = symbol_to_number(arg);
   if (is_symbol) {
     // number is already set from symbol string
     return 0;
   }
 
-  const double n = strtod(arg->GetString(), &end);
   arg->SetNumber(n);
-  if (*end != '\0') {
-    return -1;
-  }
-
-  return 0;
+  return -1;
 }
 
 static int symbol_to_number(CommandArgument *arg)
 {
-  const std::string str = arg->GetString();
-
-  // transform orders
-  if (str == "ORDER_SRT") {arg->SetNumber(SI_ORDER_SRT); return 1;}
-  if (str == "ORDER_STR") {arg->SetNumber(SI_ORDER_STR); return 1;}
-  if (str == "ORDER_RST") {arg->SetNumber(SI_ORDER_RST); return 1;}
-  if (str == "ORDER_RTS") {arg->SetNumber(SI_ORDER_RTS); return 1;}
-  if (str == "ORDER_TRS") {arg->SetNumber(SI_ORDER_TRS); return 1;}
-  if (str == "ORDER_TSR") {arg->SetNumber(SI_ORDER_TSR); return 1;}
-  // rotate orders
-  if (str == "ORDER_XYZ") {arg->SetNumber(SI_ORDER_XYZ); return 1;}
-  if (str == "ORDER_XZY") {arg->SetNumber(SI_ORDER_XZY); return 1;}
-  if (str == "ORDER_YXZ") {arg->SetNumber(SI_ORDER_YXZ); return 1;}
-  if (str == "ORDER_YZX") {arg->SetNumber(SI_ORDER_YZX); return 1;}
-  if (str == "ORDER_ZXY") {arg->SetNumber(SI_ORDER_ZXY); return 1;}
-  if (str == "ORDER_ZYX") {arg->SetNumber(SI_ORDER_ZYX); return 1;}
-
-  // sampler type
-  if (str == "FIXED_GRID_SAMPER")     {arg->SetNumber(SI_FIXED_GRID_SAMPLER); return 1;}
-  if (str == "ADAPTIVE_GRID_SAMPLER") {arg->SetNumber(SI_ADAPTIVE_GRID_SAMPLER); return 1;}
+  static const struct {
+    const char *name;
+    int number;
+  } symbols[] = {
+    // transform orders
+    {"ORDER_SRT", SI_ORDER_SRT},
+    {"ORDER_STR", SI_ORDER_STR},
+    {"ORDER_RST", SI_ORDER_RST},
+    {"ORDER_RTS", SI_ORDER_RTS},
+    {"ORDER_TRS", SI_ORDER_TRS},
+    {"ORDER_TSR", SI_ORDER_TSR},
+    // rotate orders
+    {"ORDER_XYZ", SI_ORDER_XYZ},
+    {"ORDER_XZY", SI_ORDER_XZY},
+    {"ORDER_YXZ", SI_ORDER_YXZ},
+    {"ORDER_YZX", SI_ORDER_YZX},
+    {"ORDER_ZXY", SI_ORDER_ZXY},
+    {"ORDER_ZYX", SI_ORDER_ZYX},
+    // sampler type
+    {"FIXED_GRID_SAMPER",     SI_FIXED_GRID_SAMPLER},
+    {"ADAPTIVE_GRID_SAMPLER", SI_ADAPTIVE_GRID_SAMPLER},
+    {NULL, 0}
+  };
+  const char *str = arg->GetString();
+
+  for (int i = 0; symbols[i].name != NULL; i++) {
+    if (strcmp(str, symbols[i].name) == 0) {
+      arg->SetNumber(symbols[i].number);
+      return 1;
+    }
+  }
 
   return 0;
 }
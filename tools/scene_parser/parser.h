@@ -7,8 +7,12 @@
 #include "fj_scene_interface.h"
 #include "command.h"
 #include <string>
+#include <vector>
 #include <map>
 
+class BinarySceneReader;
+class BinarySceneWriter;
+
 using fj::ID;
 
 class Parser {
@@ -17,16 +21,35 @@ public:
   ~Parser();
 
   int ParseLine(const std::string &line);
+  // runs the next command of a binary scene. returns 1 when run, 0 at
+  // the end and -1 on errors
+  int ParseBinary(BinarySceneReader &reader);
+  // writes the line to a binary scene without running it. entries are
+  // numbered in the order they are created
+  int CompileLine(const std::string &line, BinarySceneWriter &writer);
+
   int GetLineNumber() const;
   const char *GetErrorMessage() const;
 
 private:
+  enum { MAX_ARGS = 16 };
+
   typedef std::map<std::string, ID> NameMap;
   NameMap name_map_;
   int line_no_;
   const char *error_message_;
   int error_no_;
 
+  // reused for every line to keep their buffers
+  std::vector<std::string> tokens_;
+  CommandArgument arguments_[MAX_ARGS];
+
+  // entries of binary scenes with their names in one pool
+  std::vector<ID> entry_ids_;
+  std::vector<std::size_t> entry_name_offsets_;
+  std::vector<char> entry_names_;
+
+  int parse_tokens(const std::string &line, const Command **command);
   bool register_name(const std::string &name, ID id);
   ID lookup_name(const std::string &name) const;
   int build_arguments(const Command *command, CommandArgument *arguments);
@@ -0,0 +1,512 @@
+// Copyright (c) 2011-2020 Hiroshi Tsubokawa
+// See LICENSE and README
+
+#include "parser.h"
+#include "binary_scene.h"
+#include "fj_framebuffer_io.h"
+#include "fj_framebuffer.h"
+#include "fj_multi_thread.h"
+#include "fj_pto.h"
+#include "fj_os.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace fj;
+
+static const char USAGE[] =
+"Usage: text2bin [options] inputfile(*.fb, *.scn) outputfile\n"
+"       text2bin [options] --batch inputdir outputdir\n"
+"Options:\n"
+"  --help         Display this information\n"
+"  --batch        Convert all text *.fb and *.scn in inputdir into outputdir\n"
+"                 with the same names. files already binary are skipped\n"
+"\n"
+"Framebuffers are written in the binary format of WriteFrameBuffer and scenes\n"
+"in the binary format of scene -c. both are read by the same readers.\n"
+"\n";
+
+// bytes of text of pixels parsed by a task
+static const std::size_t CHUNK_BYTES = 1 << 20;
+
+static int convert(const char *inputfile, const char *outputfile);
+static int convert_directory(const char *inputdir, const char *outputdir);
+static int convert_framebuffer(const char *inputfile, const char *outputfile);
+static int convert_scene(const char *inputfile, const char *outputfile);
+
+int main(int argc, const char **argv)
+{
+  if (argc == 2 && strcmp(argv[1], "--help") == 0) {
+    printf("%s", USAGE);
+    return 0;
+  }
+
+  bool is_batch = false;
+  while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+    if (strcmp(argv[1], "--batch") == 0) {
+      is_batch = true;
+      argc -= 1;
+      argv += 1;
+    }
+    else {
+      fprintf(stderr, "error: unknown option: %s\n", argv[1]);
+      return -1;
+    }
+  }
+
+  if (argc != 3) {
+    fprintf(stderr, "error: invalid number of arguments.\n");
+    fprintf(stderr, "%s", USAGE);
+    return -1;
+  }
+
+  // chunks of pixels are parsed on all cores
+  MtStartThreadPool(MtGetMaxAvailableThreadCount());
+
+  const int err = is_batch ?
+      convert_directory(argv[1], argv[2]) :
+      convert(argv[1], argv[2]);
+
+  MtStopThreadPool();
+  return err;
+}
+
+static bool has_extension(const std::string &name, const char *ext)
+{
+  const std::string::size_type dotpos = name.rfind('.');
+  return dotpos != std::string::npos && name.compare(dotpos, std::string::npos, ext) == 0;
+}
+
+static int convert(const char *inputfile, const char *outputfile)
+{
+  if (has_extension(inputfile, ".fb")) {
+    return convert_framebuffer(inputfile, outputfile);
+  }
+  else if (has_extension(inputfile, ".scn")) {
+    return convert_scene(inputfile, outputfile);
+  }
+  fprintf(stderr, "error: %s: unknown file type\n", inputfile);
+  return -1;
+}
+
+static int convert_directory(const char *inputdir, const char *outputdir)
+{
+  std::vector<std::string> filenames;
+  if (OsListFiles(inputdir, &filenames)) {
+    fprintf(stderr, "error: %s: could not read directory\n", inputdir);
+    return -1;
+  }
+
+  int err = 0;
+
+  for (std::size_t i = 0; i < filenames.size(); i++) {
+    const std::string &name = filenames[i];
+    if (!has_extension(name, ".fb") && !has_extension(name, ".scn")) {
+      continue;
+    }
+
+    const std::string inputfile = std::string(inputdir) + "/" + name;
+    const std::string outputfile = std::string(outputdir) + "/" + name;
+
+    printf("converting: %s\n", inputfile.c_str());
+    // files already binary return 1
+    if (convert(inputfile.c_str(), outputfile.c_str()) < 0) {
+      err = -1;
+    }
+  }
+  return err;
+}
+
+static bool is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\v' || c == '\r';
+}
+
+static bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+// the end of the token from p
+static const char *token_end(const char *p, const char *end)
+{
+  while (p != end && !is_space(*p) && *p != '\n') {
+    p++;
+  }
+  return p;
+}
+
+// the next token from p in the line. NULL at the end of the line
+static const char *next_token(const char *p, const char *end)
+{
+  while (p != end && is_space(*p)) {
+    p++;
+  }
+  return p == end || *p == '\n' ? NULL : p;
+}
+
+// the beginning of the next line from p
+static const char *next_line(const char *p, const char *end)
+{
+  const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+  return newline == NULL ? end : newline + 1;
+}
+
+static bool token_equals(const char *token, const char *end, const char *str)
+{
+  const std::size_t len = strlen(str);
+  return token_end(token, end) - token == static_cast<std::ptrdiff_t>(len) &&
+      strncmp(token, str, len) == 0;
+}
+
+static double fallback_float(const char *begin, const char *end)
+{
+  const std::string token(begin, end);
+  char *endp = NULL;
+  const double f = strtod(token.c_str(), &endp);
+  return *endp == '\0' ? f : 0;
+}
+
+// scans the token the same as strtod with 0 for bad numbers but without
+// copying it. up to 15 digits times powers of 10 up to 22 are exact in
+// doubles, so one multiplication or division rounds the same as strtod.
+// the others fall back to strtod
+static double scan_float(const char *begin, const char *end)
+{
+  static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char *p = begin;
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool has_digits = false;
+
+  for (; p != end && is_digit(*p); p++) {
+    if (mantissa > 0 || *p != '0') {
+      if (++digits > 15) {
+        return fallback_float(begin, end);
+      }
+      mantissa = mantissa * 10 + (*p - '0');
+    }
+    has_digits = true;
+  }
+  if (p != end && *p == '.') {
+    for (p++; p != end && is_digit(*p); p++) {
+      if (mantissa > 0 || *p != '0') {
+        if (++digits > 15) {
+          return fallback_float(begin, end);
+        }
+        mantissa = mantissa * 10 + (*p - '0');
+      }
+      exponent--;
+      has_digits = true;
+    }
+  }
+  if (has_digits && p != end && (*p == 'e' || *p == 'E')) {
+    p++;
+    bool negative_exp = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+      negative_exp = *p == '-';
+      p++;
+    }
+    if (p == end || !is_digit(*p)) {
+      return fallback_float(begin, end);
+    }
+    int e = 0;
+    for (; p != end && is_digit(*p) && e < 1000; p++) {
+      e = e * 10 + (*p - '0');
+    }
+    exponent += negative_exp ? -e : e;
+  }
+  // inf, nan, hex and the others
+  if (!has_digits || p != end || exponent < -22 || exponent > 22) {
+    return fallback_float(begin, end);
+  }
+
+  const double m = static_cast<double>(mantissa);
+  const double f = exponent < 0 ? m / POW10[-exponent] : m * POW10[exponent];
+  return negative ? -f : f;
+}
+
+// blank, comment, begin and end lines don't have pixels
+static bool is_pixel_line(const char *token, const char *end)
+{
+  return token != NULL && *token != '#' &&
+      !token_equals(token, end, "begin") && !token_equals(token, end, "end");
+}
+
+class PixelChunk {
+public:
+  PixelChunk() : begin(NULL), end(NULL), first_pixel(0), pixel_count(0), bad_count(0) {}
+  ~PixelChunk() {}
+
+  const char *begin;
+  const char *end;
+  long long first_pixel;
+  long long pixel_count;
+  long long bad_count;
+};
+
+class PixelParsing {
+public:
+  PixelParsing() : chunks(), fb(NULL) {}
+  ~PixelParsing() {}
+
+  std::vector<PixelChunk> chunks;
+  FrameBuffer *fb;
+};
+
+static void count_pixels(void *data, int begin, int end)
+{
+  PixelParsing *parsing = static_cast<PixelParsing *>(data);
+
+  for (int i = begin; i < end; i++) {
+    PixelChunk &chunk = parsing->chunks[i];
+    for (const char *p = chunk.begin; p != chunk.end; p = next_line(p, chunk.end)) {
+      chunk.pixel_count += is_pixel_line(next_token(p, chunk.end), chunk.end);
+    }
+  }
+}
+
+// lines of the channel count are stored as they are. lines of 4 values are
+// stored like SetColor as WriteFrameBufferText writes GetColor of pixels.
+// lines of the other counts are zero like ReadFrameBuffer
+static void parse_pixels(void *data, int begin, int end)
+{
+  PixelParsing *parsing = static_cast<PixelParsing *>(data);
+  FrameBuffer &fb = *parsing->fb;
+  const int NCHANNELS = fb.GetChannelCount();
+  const long long NPIXELS = static_cast<long long>(fb.GetWidth()) * fb.GetHeight();
+  float *pixels = fb.GetWritable(0, 0, 0);
+  std::vector<float> values(std::max(NCHANNELS, 4));
+
+  for (int i = begin; i < end; i++) {
+    PixelChunk &chunk = parsing->chunks[i];
+    long long pixel = chunk.first_pixel;
+
+    for (const char *p = chunk.begin; p != chunk.end && pixel < NPIXELS;
+        p = next_line(p, chunk.end)) {
+      const char *token = next_token(p, chunk.end);
+      if (!is_pixel_line(token, chunk.end)) {
+        continue;
+      }
+
+      int count = 0;
+      for (; token != NULL; token = next_token(token, chunk.end)) {
+        const char *tail = token_end(token, chunk.end);
+        if (count < static_cast<int>(values.size())) {
+          values[count] = static_cast<float>(scan_float(token, tail));
+        }
+        count++;
+        token = tail;
+      }
+
+      float *dst = pixels + pixel * NCHANNELS;
+      if (count == NCHANNELS || count == 4) {
+        const int n = std::min(count, NCHANNELS);
+        std::copy(values.begin(), values.begin() + n, dst);
+        std::fill(dst + n, dst + NCHANNELS, 0.f);
+      }
+      else {
+        std::fill(dst, dst + NCHANNELS, 0.f);
+        chunk.bad_count++;
+      }
+      pixel++;
+    }
+  }
+}
+
+// reads resolution and channel_count up to begin pixels. returns the first
+// line of pixels or NULL if they are not found
+static const char *parse_header(const char *p, const char *end,
+    int *width, int *height, int *nchannels)
+{
+  for (; p != end; p = next_line(p, end)) {
+    const char *token = next_token(p, end);
+    if (token == NULL || *token == '#') {
+      continue;
+    }
+
+    const char *arg1 = next_token(token_end(token, end), end);
+    const char *arg2 = arg1 == NULL ? NULL : next_token(token_end(arg1, end), end);
+
+    if (token_equals(token, end, "begin") && arg1 != NULL &&
+        token_equals(arg1, end, "pixels")) {
+      return next_line(p, end);
+    }
+    else if (token_equals(token, end, "resolution") && arg2 != NULL) {
+      *width = atoi(std::string(arg1, token_end(arg1, end)).c_str());
+      *height = atoi(std::string(arg2, token_end(arg2, end)).c_str());
+    }
+    else if (token_equals(token, end, "channel_count") && arg1 != NULL) {
+      *nchannels = atoi(std::string(arg1, token_end(arg1, end)).c_str());
+    }
+  }
+  return NULL;
+}
+
+// the last line if it is end pixels, otherwise the end
+static const char *find_pixels_end(const char *begin, const char *end)
+{
+  const char *last = end;
+  while (last != begin && (is_space(last[-1]) || last[-1] == '\n')) {
+    last--;
+  }
+  const char *line = last;
+  while (line != begin && line[-1] != '\n') {
+    line--;
+  }
+
+  const char *token = next_token(line, end);
+  if (token != NULL && token_equals(token, end, "end")) {
+    const char *arg1 = next_token(token_end(token, end), end);
+    if (arg1 != NULL && token_equals(arg1, end, "pixels")) {
+      return line;
+    }
+  }
+  return end;
+}
+
+// returns 1 if the file is already binary
+static int convert_framebuffer(const char *inputfile, const char *outputfile)
+{
+  size_t size = 0;
+  void *data = OsMapFile(inputfile, &size);
+  if (data == NULL) {
+    fprintf(stderr, "error: %s: could not open file\n", inputfile);
+    return -1;
+  }
+  const char *text = static_cast<const char *>(data);
+  const char *text_end = text + size;
+
+  if (size >= 4 && memcmp(text, "FJFB", 4) == 0) {
+    printf("already binary: %s\n", inputfile);
+    OsUnmapFile(data, size);
+    return 1;
+  }
+  const char *body = next_line(text, text_end);
+  const char *header_end = body;
+  while (header_end != text && (header_end[-1] == '\n' || header_end[-1] == '\r')) {
+    header_end--;
+  }
+  if (std::string(text, header_end) != PTO_HEADER) {
+    fprintf(stderr, "error: %s: not a framebuffer file\n", inputfile);
+    OsUnmapFile(data, size);
+    return -1;
+  }
+
+  int width = 0, height = 0, nchannels = 0;
+  const char *pixels_begin = parse_header(body, text_end, &width, &height, &nchannels);
+  if (pixels_begin == NULL || width <= 0 || height <= 0 || nchannels <= 0) {
+    fprintf(stderr, "error: %s: no pixels, resolution or channel count\n", inputfile);
+    OsUnmapFile(data, size);
+    return -1;
+  }
+  const char *pixels_end = find_pixels_end(pixels_begin, text_end);
+
+  FrameBuffer fb;
+  fb.Resize(width, height, nchannels);
+  if (fb.IsEmpty() || fb.GetWritable(0, 0, 0) == NULL || fb.IsTiled()) {
+    fprintf(stderr, "error: could not allocate framebuffer: %d x %d\n", width, height);
+    OsUnmapFile(data, size);
+    return -1;
+  }
+
+  // chunks end at lines so that each line is parsed by one task
+  PixelParsing parsing;
+  parsing.fb = &fb;
+  for (const char *p = pixels_begin; p != pixels_end;) {
+    PixelChunk chunk;
+    chunk.begin = p;
+    const std::size_t rest = pixels_end - p;
+    chunk.end = rest <= CHUNK_BYTES ? pixels_end :
+        next_line(p + CHUNK_BYTES - 1, pixels_end);
+    parsing.chunks.push_back(chunk);
+    p = chunk.end;
+  }
+  const int NCHUNKS = static_cast<int>(parsing.chunks.size());
+
+  // the first pixel of each chunk is known after counting lines of all
+  MtParallelFor(&parsing, count_pixels, NCHUNKS, 1);
+  long long pixel_count = 0;
+  for (int i = 0; i < NCHUNKS; i++) {
+    parsing.chunks[i].first_pixel = pixel_count;
+    pixel_count += parsing.chunks[i].pixel_count;
+  }
+  MtParallelFor(&parsing, parse_pixels, NCHUNKS, 1);
+  OsUnmapFile(data, size);
+
+  long long bad_count = 0;
+  for (int i = 0; i < NCHUNKS; i++) {
+    bad_count += parsing.chunks[i].bad_count;
+  }
+  if (bad_count > 0) {
+    printf("warning: %s: %lld pixels don't match the channel count. set to zero\n",
+        inputfile, bad_count);
+  }
+  if (pixel_count != static_cast<long long>(width) * height) {
+    printf("warning: %s: %lld pixels for resolution %d x %d\n",
+        inputfile, pixel_count, width, height);
+  }
+
+  if (WriteFrameBuffer(outputfile, fb)) {
+    fprintf(stderr, "error: %s: could not write file\n", outputfile);
+    return -1;
+  }
+  return 0;
+}
+
+// entries of binary scenes are numbered in the order they are created and
+// the parser opens the scene interface, so lines are compiled in order
+// returns 1 if the file is already binary
+static int convert_scene(const char *inputfile, const char *outputfile)
+{
+  std::ifstream in(inputfile, std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "error: %s: could not open file\n", inputfile);
+    return -1;
+  }
+  if (in.peek() == BINARY_SCENE_MAGIC[0]) {
+    printf("already binary: %s\n", inputfile);
+    return 1;
+  }
+  std::ofstream out(outputfile, std::ios::binary);
+  if (!out) {
+    fprintf(stderr, "error: %s: could not open file\n", outputfile);
+    return -1;
+  }
+
+  Parser parser;
+  BinarySceneWriter writer;
+  std::string line;
+
+  if (writer.Open(out)) {
+    fprintf(stderr, "error: %s: could not write file\n", outputfile);
+    return -1;
+  }
+
+  while (getline(in, line)) {
+    const int err = parser.CompileLine(line, writer);
+
+    if (err) {
+      fprintf(stderr, "error: %s: %s: %d: %s\n", inputfile,
+          parser.GetErrorMessage(), parser.GetLineNumber(), line.c_str());
+      return -1;
+    }
+  }
+
+  return 0;
+}
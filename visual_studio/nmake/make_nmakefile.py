@@ -28,6 +28,11 @@ opts = """\
 opt = /O2 /Oi /GL
 warn = /wd4351 #/W3
 macro = /D "NODEBUG"
+
+# nmake SINGLE_PRECISION=1 builds with float reals
+!IFDEF SINGLE_PRECISION
+macro = $(macro) /D "FJ_SINGLE_PRECISION"
+!ENDIF
 """
 
 aliases = """\